@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/AdmissionController.h"
+#include "watchman/Errors.h"
+
+namespace watchman {
+
+AdmissionController::Ticket& AdmissionController::Ticket::operator=(
+    Ticket&& other) noexcept {
+  if (this != &other) {
+    if (owner_) {
+      owner_->release();
+    }
+    owner_ = other.owner_;
+    other.owner_ = nullptr;
+  }
+  return *this;
+}
+
+AdmissionController::Ticket::~Ticket() {
+  if (owner_) {
+    owner_->release();
+  }
+}
+
+AdmissionController::Ticket AdmissionController::admit(const char* name) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto hasSlot = [&] {
+    return config_.maxConcurrent == 0 ||
+        stats_.running < config_.maxConcurrent;
+  };
+
+  // Waiters go first so that a steady stream of new commands can't starve
+  // them
+  if (stats_.queued == 0 && hasSlot()) {
+    ++stats_.running;
+    ++stats_.admitted;
+    return Ticket{this};
+  }
+
+  if (stats_.queued >= config_.maxQueued) {
+    ++stats_.rejected;
+    throw CommandOverloadedError(
+        "too many commands like '",
+        name,
+        "' are already running or waiting to run");
+  }
+
+  ++stats_.queued;
+  bool admitted = slotFreed_.wait_until(
+      lock, Clock::now() + config_.queueTimeout, hasSlot);
+  --stats_.queued;
+  if (!admitted) {
+    ++stats_.timedOut;
+    throw CommandOverloadedError(
+        "'",
+        name,
+        "' waited ",
+        config_.queueTimeout.count(),
+        "ms to run without getting a turn");
+  }
+  ++stats_.running;
+  ++stats_.admitted;
+  return Ticket{this};
+}
+
+void AdmissionController::release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --stats_.running;
+  }
+  slotFreed_.notify_one();
+}
+
+AdmissionController::Stats AdmissionController::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+} // namespace watchman
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace watchman {
+
+/**
+ * Bounds how many commands of a class run at once, so that a burst of
+ * clients each get an answer in turn instead of all of them contending for
+ * the views and CPU and getting slow together.
+ *
+ * A command that finds every slot taken waits for one, up to a deadline.
+ * When too many are already waiting, or the deadline passes, admit() throws
+ * CommandOverloadedError so that the client can back off and retry.
+ *
+ * Thread safe.
+ */
+class AdmissionController {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Config {
+    // Commands that may run at once; 0 means unlimited
+    size_t maxConcurrent{0};
+    // Commands that may wait for a slot at once
+    size_t maxQueued{0};
+    // How long a command may wait for a slot
+    std::chrono::milliseconds queueTimeout{0};
+  };
+
+  struct Stats {
+    size_t running{0};
+    size_t queued{0};
+    uint64_t admitted{0};
+    // Turned away because the queue was full
+    uint64_t rejected{0};
+    // Turned away because they waited until their deadline
+    uint64_t timedOut{0};
+  };
+
+  // Holds a slot until it is destroyed
+  class Ticket {
+   public:
+    Ticket() = default;
+    Ticket(Ticket&& other) noexcept : owner_{other.owner_} {
+      other.owner_ = nullptr;
+    }
+    Ticket& operator=(Ticket&& other) noexcept;
+    Ticket(const Ticket&) = delete;
+    Ticket& operator=(const Ticket&) = delete;
+    ~Ticket();
+
+   private:
+    friend class AdmissionController;
+    explicit Ticket(AdmissionController* owner) : owner_{owner} {}
+
+    AdmissionController* owner_{nullptr};
+  };
+
+  explicit AdmissionController(Config config) : config_{config} {}
+
+  // Blocks until a slot is free, and throws CommandOverloadedError if the
+  // queue is full or a slot isn't freed before the deadline.  `name` is
+  // the command, for the error message.
+  Ticket admit(const char* name);
+
+  Stats stats() const;
+
+  const Config& config() const {
+    return config_;
+  }
+
+ private:
+  void release();
+
+  const Config config_;
+  mutable std::mutex mutex_;
+  std::condition_variable slotFreed_;
+  Stats stats_;
+};
+
+} // namespace watchman
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <folly/Varint.h>
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+void appendVarint(std::string& data, uint64_t value) {
+  uint8_t buf[folly::kMaxVarintLength64];
+  auto len = folly::encodeVarint(value, buf);
+  data.append(reinterpret_cast<const char*>(buf), len);
+}
+
+void appendSigned(std::string& data, int64_t value) {
+  appendVarint(data, folly::encodeZigZag(value));
+}
+
+int64_t readSigned(folly::ByteRange& data) {
+  return folly::decodeZigZag(folly::decodeVarint(data));
+}
+
+} // namespace
+
+ChangeJournal::ChangeJournal(size_t maxBytes, size_t blockBytes)
+    : maxBytes_(maxBytes), blockBytes_(blockBytes) {}
+
+void ChangeJournal::record(
+    w_string_piece path,
+    const w_clock_t& otime,
+    const w_clock_t& ctime,
+    uint32_t mode) {
+  auto state = state_.wlock();
+  if (state->blocks.empty() ||
+      state->blocks.back().data.size() >= blockBytes_) {
+    state->blocks.emplace_back();
+  }
+  auto& block = state->blocks.back();
+  auto before = block.data.size() + block.lastPath.size();
+
+  // Age-out removes the files of a dir together, so consecutive paths
+  // tend to share most of their length.
+  auto pathEnd = path.data() + path.size();
+  auto lastEnd = block.lastPath.data() + block.lastPath.size();
+  size_t shared =
+      std::mismatch(path.data(), pathEnd, block.lastPath.data(), lastEnd)
+          .first -
+      path.data();
+  appendVarint(block.data, shared);
+  appendVarint(block.data, path.size() - shared);
+  block.data.append(path.data() + shared, path.size() - shared);
+
+  appendSigned(block.data, int64_t(otime.ticks) - block.lastOtime.ticks);
+  appendSigned(
+      block.data, int64_t(otime.timestamp) - block.lastOtime.timestamp);
+  appendSigned(block.data, int64_t(otime.ticks) - ctime.ticks);
+  appendSigned(block.data, int64_t(otime.timestamp) - ctime.timestamp);
+  appendVarint(block.data, mode);
+
+  block.lastPath.assign(path.data(), path.size());
+  block.lastOtime = otime;
+  block.maxTicks = std::max(block.maxTicks, otime.ticks);
+  block.maxTimestamp = std::max(block.maxTimestamp, otime.timestamp);
+  ++block.numEntries;
+  state->bytes += block.data.size() + block.lastPath.size() - before;
+
+  while (state->bytes > maxBytes_ && state->blocks.size() > 1) {
+    auto& oldest = state->blocks.front();
+    state->forgottenTicks = std::max(state->forgottenTicks, oldest.maxTicks);
+    state->bytes -= oldest.data.size() + oldest.lastPath.size();
+    state->blocks.pop_front();
+  }
+}
+
+void ChangeJournal::forget(uint32_t ticks) {
+  auto state = state_.wlock();
+  state->forgottenTicks = std::max(state->forgottenTicks, ticks);
+}
+
+uint32_t ChangeJournal::forgottenTicks() const {
+  return state_.rlock()->forgottenTicks;
+}
+
+void ChangeJournal::forEachSince(
+    const QuerySince& since,
+    const std::function<void(const Entry&)>& visit) const {
+  auto state = state_.rlock();
+  Entry entry;
+  std::string path;
+  for (auto& block : state->blocks) {
+    if (since.is_timestamp ? block.maxTimestamp <= since.timestamp
+                           : block.maxTicks <= since.clock.ticks) {
+      continue;
+    }
+    folly::ByteRange data(folly::StringPiece(block.data));
+    path.clear();
+    w_clock_t otime{0, 0};
+    for (size_t i = 0; i < block.numEntries; ++i) {
+      auto shared = folly::decodeVarint(data);
+      auto suffixLen = folly::decodeVarint(data);
+      path.resize(shared);
+      path.append(reinterpret_cast<const char*>(data.data()), suffixLen);
+      data.advance(suffixLen);
+
+      otime.ticks = uint32_t(otime.ticks + readSigned(data));
+      otime.timestamp = time_t(otime.timestamp + readSigned(data));
+      auto ctimeTicks = uint32_t(otime.ticks - readSigned(data));
+      auto ctimeTimestamp = time_t(otime.timestamp - readSigned(data));
+      auto mode = uint32_t(folly::decodeVarint(data));
+
+      if (since.is_timestamp ? otime.timestamp <= since.timestamp
+                             : otime.ticks <= since.clock.ticks) {
+        continue;
+      }
+      entry.path = w_string(path.data(), path.size());
+      entry.otime = otime;
+      entry.ctime = w_clock_t{ctimeTicks, ctimeTimestamp};
+      entry.mode = mode;
+      visit(entry);
+    }
+  }
+}
+
+size_t ChangeJournal::numEntries() const {
+  auto state = state_.rlock();
+  size_t numEntries = 0;
+  for (auto& block : state->blocks) {
+    numEntries += block.numEntries;
+  }
+  return numEntries;
+}
+
+size_t ChangeJournal::memoryUsage() const {
+  return state_.rlock()->bytes;
+}
+
+} // namespace watchman
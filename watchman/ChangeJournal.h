@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include "watchman/Clock.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers the deleted files that age-out removed from a view, so that a
+ * since query from before the age-out can still report them, rather than
+ * telling the client to start over with a fresh instance.  Everything else
+ * that changed since is still in the view.
+ *
+ * Entries are kept in blocks of a few KiB, each of which front-codes the
+ * paths and delta-encodes the clocks of its entries against the previous
+ * entry.  Once the blocks exceed `maxBytes`, the oldest are dropped, and
+ * the ticks of their entries can no longer be answered.
+ *
+ * Thread safe.
+ */
+class ChangeJournal {
+ public:
+  struct Entry {
+    // Full path of the file
+    w_string path;
+    w_clock_t otime;
+    w_clock_t ctime;
+    uint32_t mode;
+  };
+
+  explicit ChangeJournal(size_t maxBytes, size_t blockBytes = 4096);
+
+  void record(
+      w_string_piece path,
+      const w_clock_t& otime,
+      const w_clock_t& ctime,
+      uint32_t mode);
+
+  /**
+   * Declares that changes at or before ticks are unknown, as when the
+   * journal starts out for a view that was aged out earlier.
+   */
+  void forget(uint32_t ticks);
+
+  /**
+   * Since queries from before this tick can't be answered by the journal.
+   */
+  uint32_t forgottenTicks() const;
+
+  /**
+   * Calls visit with each recorded entry that changed after since, in no
+   * particular order.  A path that was aged out more than once is visited
+   * once per time.
+   */
+  void forEachSince(
+      const QuerySince& since,
+      const std::function<void(const Entry&)>& visit) const;
+
+  size_t numEntries() const;
+  size_t memoryUsage() const;
+
+ private:
+  struct Block {
+    std::string data;
+    size_t numEntries{0};
+    // Of any entry, for discarding the block and skipping it in queries
+    uint32_t maxTicks{0};
+    time_t maxTimestamp{0};
+    // What the next entry is encoded against
+    std::string lastPath;
+    w_clock_t lastOtime{0, 0};
+  };
+  struct State {
+    std::deque<Block> blocks;
+    size_t bytes{0};
+    uint32_t forgottenTicks{0};
+  };
+
+  const size_t maxBytes_;
+  const size_t blockBytes_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
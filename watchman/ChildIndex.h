@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A compact map from child name to owning node pointer, used for the files
+ * and dirs of a watchman_dir.
+ *
+ * Entries are stored densely in a vector, in no particular order.  Most
+ * directories only have a handful of children, and for those a lookup is a
+ * linear scan over that vector, which is both smaller and faster than
+ * chasing pointers through hash buckets.  Once a directory grows past
+ * kLinearScanMax entries we additionally build an open-addressing index of
+ * (hash, position) slots over the vector.
+ *
+ * Like the unordered_map that it replaces, keys are non-owning string pieces;
+ * the caller must ensure that the referenced name is kept alive by the
+ * stored node.
+ *
+ * References and iterators are invalidated by insertion and erasure.
+ */
+template <typename Ptr>
+class ChildIndex {
+ public:
+  using value_type = std::pair<w_string_piece, Ptr>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  static constexpr size_t kLinearScanMax = 16;
+
+  iterator begin() {
+    return entries_.begin();
+  }
+  iterator end() {
+    return entries_.end();
+  }
+  const_iterator begin() const {
+    return entries_.begin();
+  }
+  const_iterator end() const {
+    return entries_.end();
+  }
+
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  void reserve(size_t n) {
+    entries_.reserve(n);
+  }
+
+  /**
+   * Gives back the spare capacity that growth and erasure leave behind, for
+   * directories that have gone quiet.
+   */
+  void shrinkToFit() {
+    entries_.shrink_to_fit();
+    if (slots_.empty()) {
+      return;
+    }
+    auto numSlots = kLinearScanMax * 4;
+    while (entries_.size() * 2 > numSlots) {
+      numSlots *= 2;
+    }
+    if (numSlots < slots_.size()) {
+      slots_ = std::vector<Slot>();
+      rebuildIndex(numSlots);
+    }
+  }
+
+  iterator find(w_string_piece key) {
+    auto idx = lookup(key);
+    return idx == kNotFound ? end() : begin() + idx;
+  }
+
+  const_iterator find(w_string_piece key) const {
+    auto idx = lookup(key);
+    return idx == kNotFound ? end() : begin() + idx;
+  }
+
+  /**
+   * Returns a reference to the value for key, inserting an empty value if
+   * there was no such entry.
+   */
+  Ptr& operator[](w_string_piece key) {
+    auto idx = lookup(key);
+    if (idx != kNotFound) {
+      return entries_[idx].second;
+    }
+
+    entries_.emplace_back(key, Ptr());
+    if (!slots_.empty()) {
+      if (entries_.size() * 2 > slots_.size()) {
+        rebuildIndex(slots_.size() * 2);
+      } else {
+        insertSlot(key.hashValue(), entries_.size() - 1);
+      }
+    } else if (entries_.size() > kLinearScanMax) {
+      rebuildIndex(kLinearScanMax * 4);
+    }
+    return entries_.back().second;
+  }
+
+  /**
+   * Removes the entry for key, destroying its value.
+   * Returns the number of entries removed.
+   */
+  size_t erase(w_string_piece key) {
+    auto idx = lookup(key);
+    if (idx == kNotFound) {
+      return 0;
+    }
+
+    auto last = entries_.size() - 1;
+    if (!slots_.empty()) {
+      removeSlot(findSlot(idx));
+      if (idx != last) {
+        // The last entry is about to move into idx
+        slots_[findSlot(last)].position = idx + 1;
+      }
+    }
+    if (idx != last) {
+      entries_[idx] = std::move(entries_[last]);
+    }
+    entries_.pop_back();
+
+    if (!slots_.empty() && entries_.size() <= kLinearScanMax / 2) {
+      // Small again; go back to scanning.
+      slots_ = std::vector<Slot>();
+    }
+    return 1;
+  }
+
+ private:
+  struct Slot {
+    uint32_t hash;
+    // 1-based index into entries_, or 0 for an empty slot
+    uint32_t position;
+  };
+
+  static constexpr size_t kNotFound = ~size_t(0);
+
+  size_t mask() const {
+    return slots_.size() - 1;
+  }
+
+  size_t lookup(w_string_piece key) const {
+    if (slots_.empty()) {
+      for (size_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].first == key) {
+          return i;
+        }
+      }
+      return kNotFound;
+    }
+
+    auto hash = key.hashValue();
+    for (auto pos = hash & mask();; pos = (pos + 1) & mask()) {
+      const auto& slot = slots_[pos];
+      if (slot.position == 0) {
+        return kNotFound;
+      }
+      if (slot.hash == hash && entries_[slot.position - 1].first == key) {
+        return slot.position - 1;
+      }
+    }
+  }
+
+  // Returns the slot number that refers to the entry at idx
+  size_t findSlot(size_t idx) const {
+    for (auto pos = slotHash(idx) & mask();; pos = (pos + 1) & mask()) {
+      if (slots_[pos].position == idx + 1) {
+        return pos;
+      }
+    }
+  }
+
+  uint32_t slotHash(size_t idx) const {
+    return entries_[idx].first.hashValue();
+  }
+
+  void insertSlot(uint32_t hash, size_t idx) {
+    auto pos = hash & mask();
+    while (slots_[pos].position != 0) {
+      pos = (pos + 1) & mask();
+    }
+    slots_[pos] = Slot{hash, uint32_t(idx + 1)};
+  }
+
+  // Backward-shift deletion keeps probe sequences intact without tombstones.
+  void removeSlot(size_t hole) {
+    for (auto next = (hole + 1) & mask(); slots_[next].position != 0;
+         next = (next + 1) & mask()) {
+      auto home = slots_[next].hash & mask();
+      if (((next - home) & mask()) >= ((next - hole) & mask())) {
+        slots_[hole] = slots_[next];
+        hole = next;
+      }
+    }
+    slots_[hole] = Slot{0, 0};
+  }
+
+  void rebuildIndex(size_t numSlots) {
+    std::vector<Slot> old;
+    std::swap(old, slots_);
+    slots_.resize(numSlots);
+    if (old.empty()) {
+      for (size_t i = 0; i < entries_.size(); ++i) {
+        insertSlot(slotHash(i), i);
+      }
+    } else {
+      for (const auto& slot : old) {
+        if (slot.position != 0) {
+          insertSlot(slot.hash, slot.position - 1);
+        }
+      }
+      // The entry that triggered the growth isn't in the old index
+      insertSlot(slotHash(entries_.size() - 1), entries_.size() - 1);
+    }
+  }
+
+  std::vector<value_type> entries_;
+  // Empty while we're small enough for linear scans; otherwise a power of
+  // two sized table at most half full.
+  std::vector<Slot> slots_;
+};
+
+} // namespace watchman
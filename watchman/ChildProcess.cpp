@@ -8,24 +8,68 @@
 #include "watchman/ChildProcess.h"
 #include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#ifndef _WIN32
+#include <folly/io/async/EventHandler.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#endif
+#include <array>
 #include <memory>
 #include <system_error>
 #include <thread>
+#include "watchman/LatencyHistogram.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 
 namespace watchman {
 
-ChildProcess::Environment::Environment() {
-  // Construct the map from the current process environment
+namespace {
+
+constexpr size_t kNumKinds = 3;
+const char* const kKindNames[kNumKinds] = {"other", "trigger", "scm"};
+
+std::array<LatencyHistogram, kNumKinds>& getSpawnLatency() {
+  static std::array<LatencyHistogram, kNumKinds> latency;
+  return latency;
+}
+
+MetricsCollectorRegistration childProcessMetrics(
+    "child_process",
+    [](MetricsWriter& writer) {
+      static const std::pair<double, const char*> quantiles[] = {
+          {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+      for (size_t i = 0; i < kNumKinds; ++i) {
+        auto latency = getSpawnLatency()[i].snapshot();
+        MetricLabels labels{{"kind", kKindNames[i]}};
+        writer.add(
+            "watchman_spawns",
+            MetricType::Counter,
+            "Child processes spawned, by what they were spawned for",
+            labels,
+            latency.count);
+        for (auto& [quantile, name] : quantiles) {
+          auto quantileLabels = labels;
+          quantileLabels.emplace_back("quantile", name);
+          writer.add(
+              "watchman_spawn_seconds",
+              MetricType::Gauge,
+              "Percentiles of the time taken to spawn a child process",
+              quantileLabels,
+              latency.percentile(quantile).count() / 1e6);
+        }
+      }
+    });
+
+std::unordered_map<w_string, w_string> readProcessEnvironment() {
   uint32_t nenv, i;
   const char* eq;
   const char* ent;
+  std::unordered_map<w_string, w_string> map;
 
   for (i = 0, nenv = 0; environ[i]; i++) {
     nenv++;
   }
 
-  map_.reserve(nenv);
+  map.reserve(nenv);
 
   for (i = 0; environ[i]; i++) {
     ent = environ[i];
@@ -40,13 +84,33 @@ ChildProcess::Environment::Environment() {
 
     // Replace rather than set, just in case we somehow have duplicate
     // keys in our environment array.
-    map_[key.asWString()] = val.asWString();
+    map[key.asWString()] = val.asWString();
   }
+  return map;
+}
+
+} // namespace
+
+ChildProcess::Environment::Environment() {
+  // The daemon doesn't modify its own environment once it is running, so
+  // it is read once and shared by every environment constructed from it
+  static const auto processState =
+      std::make_shared<State>(readProcessEnvironment());
+  state_ = processState;
 }
 
 ChildProcess::Environment::Environment(
     const std::unordered_map<w_string, w_string>& map)
-    : map_(map) {}
+    : state_(std::make_shared<State>(map)) {}
+
+ChildProcess::Environment::Map& ChildProcess::Environment::mutableMap() {
+  if (state_.use_count() > 1) {
+    state_ = std::make_shared<State>(state_->map);
+  } else {
+    state_->encoded.wlock()->reset();
+  }
+  return state_->map;
+}
 
 /* Constructs an envp array from a hash table.
  * The returned array occupies a single contiguous block of memory
@@ -55,10 +119,11 @@ ChildProcess::Environment::Environment(
  * with posix_spawn() */
 std::unique_ptr<char*, ChildProcess::Deleter>
 ChildProcess::Environment::asEnviron(size_t* env_size) const {
-  size_t len = (1 + map_.size()) * sizeof(char*);
+  const auto& map = state_->map;
+  size_t len = (1 + map.size()) * sizeof(char*);
 
   // Make a pass through to compute the required memory size
-  for (const auto& it : map_) {
+  for (const auto& it : map) {
     const auto& key = it.first;
     const auto& val = it.second;
 
@@ -73,9 +138,9 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
   auto result = std::unique_ptr<char*, Deleter>(envp, Deleter());
 
   // Now populate
-  auto buf = (char*)(envp + map_.size() + 1);
+  auto buf = (char*)(envp + map.size() + 1);
   size_t i = 0;
-  for (const auto& it : map_) {
+  for (const auto& it : map) {
     const auto& key = it.first;
     const auto& val = it.second;
 
@@ -95,7 +160,7 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
     buf++;
   }
 
-  envp[map_.size()] = nullptr;
+  envp[map.size()] = nullptr;
 
   if (env_size) {
     *env_size = len;
@@ -103,15 +168,37 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
   return result;
 }
 
+std::shared_ptr<const ChildProcess::Environment::Encoded>
+ChildProcess::Environment::encode() const {
+  {
+    auto encoded = state_->encoded.rlock();
+    if (*encoded) {
+      return *encoded;
+    }
+  }
+  auto encoded = state_->encoded.wlock();
+  if (!*encoded) {
+    size_t size;
+    auto envp = asEnviron(&size);
+    *encoded = std::make_shared<const Encoded>(Encoded{std::move(envp), size});
+  }
+  return *encoded;
+}
+
 void ChildProcess::Environment::set(const w_string& key, const w_string& val) {
-  map_[key] = val;
+  // Leave the encoding alone if nothing changes
+  auto it = state_->map.find(key);
+  if (it != state_->map.end() && it->second == val) {
+    return;
+  }
+  mutableMap()[key] = val;
 }
 
 void ChildProcess::Environment::setBool(const w_string& key, bool bval) {
   if (bval) {
-    map_[key] = "true";
+    set(key, "true");
   } else {
-    map_.erase(key);
+    unset(key);
   }
 }
 
@@ -123,13 +210,20 @@ void ChildProcess::Environment::set(
 }
 
 void ChildProcess::Environment::unset(const w_string& key) {
-  map_.erase(key);
+  if (state_->map.find(key) != state_->map.end()) {
+    mutableMap().erase(key);
+  }
 }
 
 ChildProcess::Options::Options() : inner_(std::make_unique<Inner>()) {
 #ifdef POSIX_SPAWN_CLOEXEC_DEFAULT
   setFlags(POSIX_SPAWN_CLOEXEC_DEFAULT);
 #endif
+#ifdef POSIX_SPAWN_USEVFORK
+  // Spawn without copying the page tables of the daemon, which are large
+  // when it watches large trees.  Recent glibc always does this.
+  setFlags(POSIX_SPAWN_USEVFORK);
+#endif
 }
 
 ChildProcess::Options::Inner::Inner() {
@@ -245,6 +339,10 @@ void ChildProcess::Options::nullStdin() {
 #endif
 }
 
+void ChildProcess::Options::setKind(Kind kind) {
+  kind_ = kind;
+}
+
 void ChildProcess::Options::chdir(w_string_piece path) {
   cwd_ = std::string(path.data(), path.size());
 #ifdef _WIN32
@@ -309,14 +407,19 @@ ChildProcess::ChildProcess(
   }
 #endif
 
-  auto envp = options.env_.asEnviron();
+  auto spawnStart = std::chrono::steady_clock::now();
+  auto encoded = options.env_.encode();
+  auto envp = encoded->envp.get();
   auto ret = posix_spawnp(
       &pid_,
       argv[0],
       &options.inner_->actions,
       &options.inner_->attr,
       &argv[0],
-      envp.get());
+      envp);
+  getSpawnLatency()[size_t(options.kind_)].record(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - spawnStart));
 
   if (ret) {
     // Failed, so the creator cannot call wait() on us.
@@ -330,8 +433,8 @@ ChildProcess::ChildProcess(
   for (size_t i = 0; i < args.size(); ++i) {
     watchman::log(level, "argv[", i, "] ", args[i], "\n");
   }
-  for (size_t i = 0; envp.get()[i]; ++i) {
-    watchman::log(level, "envp[", i, "] ", envp.get()[i], "\n");
+  for (size_t i = 0; envp[i]; ++i) {
+    watchman::log(level, "envp[", i, "] ", envp[i], "\n");
   }
 
   // Close the other ends of the pipes
@@ -423,12 +526,196 @@ std::unique_ptr<Pipe> ChildProcess::takeStdin() {
   return pipe;
 }
 
+std::unique_ptr<Pipe> ChildProcess::takePipe(int fd) {
+  auto it = pipes_.find(fd);
+  if (it == pipes_.end()) {
+    return nullptr;
+  }
+  auto pipe = std::move(it->second);
+  pipes_.erase(it);
+  return pipe;
+}
+
+#ifndef _WIN32
+namespace {
+
+// Services the pipes of every child that communicates asynchronously
+folly::EventBase* childIoEventBase() {
+  static folly::ScopedEventBaseThread thread("child-io");
+  return thread.getEventBase();
+}
+
+// Returns true if the reader of a pipe has gone away, in which case
+// writing to it would only fail
+bool readerClosed(const FileDescriptor& fd) {
+  pollfd pfd;
+  pfd.fd = fd.fd();
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  return ::poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR));
+}
+
+/** Moves the output of a child into buffers and feeds its input from a
+ * pipeWriteCallback, on the child-io event loop, until all of its pipes are
+ * closed.  Keeps itself alive until then. */
+class AsyncCommunicator
+    : public std::enable_shared_from_this<AsyncCommunicator> {
+ public:
+  AsyncCommunicator(
+      folly::EventBase* evb,
+      std::unordered_map<int, std::unique_ptr<Pipe>> pipes,
+      ChildProcess::pipeWriteCallback writeCallback)
+      : evb_(evb), writeCallback_(std::move(writeCallback)) {
+    for (auto& it : pipes) {
+      auto& end =
+          it.first == STDIN_FILENO ? it.second->write : it.second->read;
+      end.setNonBlock();
+      if (it.first != STDIN_FILENO) {
+        outputs_.emplace(it.first, std::string());
+      }
+      handlers_.push_back(
+          std::make_unique<Handler>(*this, it.first, std::move(end)));
+    }
+  }
+
+  folly::Future<std::pair<w_string, w_string>> start() {
+    auto future = promise_.getFuture();
+    if (handlers_.empty()) {
+      finish();
+      return future;
+    }
+    evb_->runInEventBaseThread([self = shared_from_this()] {
+      for (auto& handler : self->handlers_) {
+        handler->registerHandler(
+            (handler->childFd == STDIN_FILENO ? folly::EventHandler::WRITE
+                                              : folly::EventHandler::READ) |
+            folly::EventHandler::PERSIST);
+      }
+      self->self_ = self;
+    });
+    return future;
+  }
+
+ private:
+  class Handler : public folly::EventHandler {
+   public:
+    Handler(AsyncCommunicator& owner, int childFd, FileDescriptor&& fd)
+        : folly::EventHandler(
+              owner.evb_,
+              folly::NetworkSocket::fromFd(fd.fd())),
+          childFd(childFd),
+          fd(std::move(fd)),
+          owner_(owner) {}
+
+    void handlerReady(uint16_t /*events*/) noexcept override {
+      owner_.ready(*this);
+    }
+
+    const int childFd;
+    FileDescriptor fd;
+
+   private:
+    AsyncCommunicator& owner_;
+  };
+
+  void ready(Handler& handler) noexcept {
+    try {
+      if (handler.childFd == STDIN_FILENO) {
+        if (readerClosed(handler.fd) || writeCallback_(handler.fd)) {
+          close(handler);
+        }
+        return;
+      }
+
+      char buf[BUFSIZ];
+      auto l = ::read(handler.fd.fd(), buf, sizeof(buf));
+      if (l == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+      }
+      if (l == -1) {
+        throw std::system_error(
+            errno, std::generic_category(), "reading from child process");
+      }
+      if (l == 0) {
+        close(handler);
+        return;
+      }
+      outputs_[handler.childFd].append(buf, l);
+    } catch (const std::exception& exc) {
+      watchman::log(
+          watchman::ERR, "communicating with child: ", exc.what(), "\n");
+      for (auto& other : handlers_) {
+        if (other->isHandlerRegistered()) {
+          other->unregisterHandler();
+          other->fd.close();
+        }
+      }
+      promise_.setException(
+          folly::exception_wrapper{std::current_exception(), exc});
+      release();
+    }
+  }
+
+  void close(Handler& handler) {
+    handler.unregisterHandler();
+    handler.fd.close();
+    if (++closed_ == handlers_.size()) {
+      finish();
+    }
+  }
+
+  void finish() {
+    auto optBuffer = [&](int fd) -> w_string {
+      auto it = outputs_.find(fd);
+      if (it == outputs_.end()) {
+        return nullptr;
+      }
+      return w_string(it->second.data(), it->second.size());
+    };
+    promise_.setValue(
+        std::make_pair(optBuffer(STDOUT_FILENO), optBuffer(STDERR_FILENO)));
+    release();
+  }
+
+  // We are usually inside one of our handlers here, so let it return
+  // before they are destroyed
+  void release() {
+    if (self_) {
+      evb_->runInLoop([self = std::move(self_)] {});
+    }
+  }
+
+  folly::EventBase* const evb_;
+  ChildProcess::pipeWriteCallback writeCallback_;
+  std::vector<std::unique_ptr<Handler>> handlers_;
+  std::unordered_map<int, std::string> outputs_;
+  size_t closed_{0};
+  folly::Promise<std::pair<w_string, w_string>> promise_;
+  std::shared_ptr<AsyncCommunicator> self_;
+};
+
+} // namespace
+#endif
+
 std::pair<w_string, w_string> ChildProcess::communicate(
     pipeWriteCallback writeCallback) {
 #ifdef _WIN32
   return threadedCommunicate(writeCallback);
 #else
-  return pollingCommunicate(writeCallback);
+  return communicateAsync(std::move(writeCallback)).get();
+#endif
+}
+
+folly::Future<std::pair<w_string, w_string>> ChildProcess::communicateAsync(
+    pipeWriteCallback writeCallback) {
+#ifdef _WIN32
+  return folly::makeFutureWith(
+      [&] { return threadedCommunicate(writeCallback); });
+#else
+  auto communicator = std::make_shared<AsyncCommunicator>(
+      childIoEventBase(), std::move(pipes_), std::move(writeCallback));
+  pipes_.clear();
+  return communicator->start();
 #endif
 }
 
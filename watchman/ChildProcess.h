@@ -6,8 +6,10 @@
  */
 
 #pragma once
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <spawn.h>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -27,8 +29,23 @@ class ChildProcess {
     }
   };
 
+  // What a process is spawned for, for the spawn latency metrics
+  enum class Kind { Other, Trigger, Scm };
+
+  /**
+   * The environment of a child process.  Copies share the variables, and
+   * their encoding as an environ array, until one of them is modified, so
+   * that spawning many processes with the same environment builds it once.
+   * The daemon's own environment is read once, on first use.
+   */
   class Environment {
    public:
+    // An environ array and the bytes that it occupies
+    struct Encoded {
+      std::unique_ptr<char*, Deleter> envp;
+      size_t size;
+    };
+
     // Constructs an environment from the current process environment
     Environment();
     Environment(const Environment&) = default;
@@ -40,6 +57,10 @@ class ChildProcess {
     // Returns the environment as an environ compatible array
     std::unique_ptr<char*, Deleter> asEnviron(size_t* env_size = nullptr) const;
 
+    // Like asEnviron(), but built only once for this environment and the
+    // unmodified copies of it
+    std::shared_ptr<const Encoded> encode() const;
+
     // Set a value in the environment
     void set(const w_string& key, const w_string& value);
     void set(
@@ -50,7 +71,18 @@ class ChildProcess {
     void unset(const w_string& key);
 
    private:
-    std::unordered_map<w_string, w_string> map_;
+    using Map = std::unordered_map<w_string, w_string>;
+    struct State {
+      Map map;
+      folly::Synchronized<std::shared_ptr<const Encoded>> encoded;
+
+      explicit State(Map map) : map{std::move(map)} {}
+    };
+
+    // Returns the map, first copying it if another Environment shares it
+    Map& mutableMap();
+
+    std::shared_ptr<State> state_;
   };
 
   class Options {
@@ -100,6 +132,9 @@ class ChildProcess {
     // Arrange to set the cwd for the child process
     void chdir(w_string_piece path);
 
+    // Sets what the process is spawned for, for the spawn latency metrics
+    void setKind(Kind kind);
+
    private:
     struct Inner {
       // There is no defined way to copy or move either of
@@ -115,6 +150,7 @@ class ChildProcess {
     Environment env_;
     std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
     std::string cwd_;
+    Kind kind_{Kind::Other};
 
     friend class ChildProcess;
   };
@@ -154,6 +190,11 @@ class ChildProcess {
   // terminate.
   std::unique_ptr<Pipe> takeStdin();
 
+  // Takes ownership of the pipe connected to `fd` in the child, or returns
+  // nullptr if there isn't one.  For talking to long-lived children, whose
+  // pipes are then read and written by the caller instead of communicate().
+  std::unique_ptr<Pipe> takePipe(int fd);
+
   // The pipeWriteCallback is called by communicate when it is safe to write
   // data to the pipe.  The callback should then attempt to write to it.
   // The callback must return true when it has nothing more
@@ -175,6 +216,18 @@ class ChildProcess {
         return true;
       });
 
+  /** Like communicate(), but returns as soon as the pipes are handed over
+   * to an event loop that is shared by every child, instead of servicing
+   * them on the calling thread.  Waiting on many children at once therefore
+   * doesn't tie up a thread per child, or per pipe.  The write callback runs
+   * on the loop's thread and must not block, and so do continuations that
+   * are attached to the future without an executor.  The pipes belong to
+   * the loop from now on; call wait() once the future is fulfilled.
+   * On Windows, where pipes can't be polled, this communicates
+   * synchronously and returns a completed future. */
+  folly::Future<std::pair<w_string, w_string>> communicateAsync(
+      pipeWriteCallback writeCallback = [](FileDescriptor&) { return true; });
+
   // these are public for the sake of testing.  You should use the
   // communicate() method instead of calling these directly.
   std::pair<w_string, w_string> pollingCommunicate(pipeWriteCallback writable);
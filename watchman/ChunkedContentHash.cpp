@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChunkedContentHash.h"
+#include <folly/Exception.h>
+#include <folly/File.h>
+#include <folly/FileUtil.h>
+#include <folly/hash/SpookyHashV2.h>
+#include <folly/portability/SysStat.h>
+#include "watchman/ThreadPool.h"
+#include "watchman/fs/FileSystem.h"
+
+namespace watchman {
+
+namespace {
+
+using Digest = ChunkTree::Digest;
+
+Digest finish(folly::hash::SpookyHashV2& spooky) {
+  uint64_t hash[2];
+  spooky.Final(&hash[0], &hash[1]);
+  // Most significant byte first, as for content.spooky128hex
+  Digest result;
+  for (size_t i = 0; i < 16; ++i) {
+    result[i] = uint8_t(hash[i / 8] >> (56 - 8 * (i % 8)));
+  }
+  return result;
+}
+
+// Reads and hashes chunk `index` of the file, which is `size` bytes long
+Digest hashChunk(
+    const folly::File& file,
+    uint64_t size,
+    size_t index,
+    std::vector<uint8_t>& buf,
+    uint64_t& bytesRead) {
+  uint64_t offset = uint64_t(index) * ChunkTree::kChunkSize;
+  auto len =
+      size_t(std::min<uint64_t>(ChunkTree::kChunkSize, size - offset));
+  auto n = folly::preadFull(file.fd(), buf.data(), len, off_t(offset));
+  if (n < 0) {
+    folly::throwSystemError("reading a chunk to hash");
+  }
+  if (size_t(n) != len) {
+    throw std::runtime_error(
+        "file shrank while hashing; query again to get latest status");
+  }
+  bytesRead += len;
+
+  folly::hash::SpookyHashV2 spooky;
+  spooky.Init(0, 0);
+  spooky.Update(buf.data(), len);
+  return finish(spooky);
+}
+
+} // namespace
+
+Digest ChunkTree::rootHash() const {
+  folly::hash::SpookyHashV2 spooky;
+  spooky.Init(0, 0);
+  uint8_t sizeBytes[8];
+  for (size_t i = 0; i < 8; ++i) {
+    sizeBytes[i] = uint8_t(size >> (8 * i));
+  }
+  spooky.Update(sizeBytes, sizeof(sizeBytes));
+  for (auto& chunk : chunks) {
+    spooky.Update(chunk.data(), chunk.size());
+  }
+  return finish(spooky);
+}
+
+ChunkTree ChunkedContentHashCache::hashFile(
+    const char* fullPath,
+    const ChunkTree* previous,
+    uint64_t& bytesRead) {
+  folly::File file(fullPath, O_RDONLY);
+  struct stat st;
+  folly::checkUnixError(fstat(file.fd(), &st), "fstat ", fullPath);
+
+  ChunkTree tree;
+  tree.ino = uint64_t(st.st_ino);
+  tree.size = uint64_t(st.st_size);
+  size_t numChunks =
+      size_t((tree.size + ChunkTree::kChunkSize - 1) / ChunkTree::kChunkSize);
+  tree.chunks.reserve(numChunks);
+  std::vector<uint8_t> buf(
+      size_t(std::min<uint64_t>(ChunkTree::kChunkSize, tree.size)));
+
+  if (previous && previous->ino == tree.ino && previous->size <= tree.size) {
+    // Only the complete chunks can be unchanged by an append
+    size_t reusable = size_t(previous->size / ChunkTree::kChunkSize);
+    auto unchanged = [&](size_t i) {
+      return hashChunk(file, tree.size, i, buf, bytesRead) ==
+          previous->chunks[i];
+    };
+    if (reusable > 0 && unchanged(0) &&
+        (reusable == 1 || unchanged(reusable - 1))) {
+      tree.chunks.assign(
+          previous->chunks.begin(), previous->chunks.begin() + reusable);
+    }
+  }
+
+  for (size_t i = tree.chunks.size(); i < numChunks; ++i) {
+    tree.chunks.push_back(hashChunk(file, tree.size, i, buf, bytesRead));
+  }
+  return tree;
+}
+
+ChunkedContentHashCache::ChunkedContentHashCache(
+    const w_string& rootPath,
+    size_t maxItems,
+    std::chrono::milliseconds errorTTL,
+    size_t numShards)
+    : cache_(maxItems, errorTTL, std::chrono::seconds(300), numShards),
+      rootPath_(rootPath) {}
+
+void ChunkedContentHashCache::rememberTrees(uint64_t minSize, size_t maxTrees) {
+  treeMinSize_ = minSize;
+  trees_ = std::make_unique<
+      LRUCache<w_string, std::shared_ptr<const ChunkTree>>>(
+      maxTrees, std::chrono::milliseconds(0));
+}
+
+folly::Future<std::shared_ptr<const ChunkedContentHashCache::Node>>
+ChunkedContentHashCache::get(const ContentHashCacheKey& key) {
+  return cache_.get(key, [this](const ContentHashCacheKey& k) {
+    // Hashing comes in bulk, so let cheaper tasks go first
+    auto executor = getThreadPool().executor(ThreadPool::Priority::Low);
+    return folly::via(executor, [k, this] { return computeHashImmediate(k); });
+  });
+}
+
+ChunkedContentHashCache::HashValue
+ChunkedContentHashCache::computeHashImmediate(
+    const ContentHashCacheKey& key) const {
+  auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
+  bool remember = trees_ && key.fileSize >= treeMinSize_;
+
+  std::shared_ptr<const ChunkTree> previous;
+  if (remember) {
+    if (auto node = trees_->get(key.relativePath)) {
+      previous = node->value();
+    }
+  }
+
+  uint64_t bytesRead = 0;
+  auto tree = hashFile(fullPath.c_str(), previous.get(), bytesRead);
+
+  // As in ContentHashCache, don't associate what was read with the key if
+  // the file changed in the meantime
+  auto stat = getFileInformation(fullPath.c_str());
+  if (tree.size != key.fileSize || size_t(stat.size) != key.fileSize ||
+      stat.mtime.tv_sec != key.mtime.tv_sec ||
+      stat.mtime.tv_nsec != key.mtime.tv_nsec) {
+    throw std::runtime_error(
+        "metadata changed during hashing; query again to get latest status");
+  }
+
+  filesHashed_.fetch_add(1, std::memory_order_relaxed);
+  bytesHashed_.fetch_add(bytesRead, std::memory_order_relaxed);
+  if (tree.size > bytesRead) {
+    bytesReused_.fetch_add(tree.size - bytesRead, std::memory_order_relaxed);
+  }
+
+  auto hash = tree.rootHash();
+  if (remember) {
+    trees_->set(
+        key.relativePath, std::make_shared<const ChunkTree>(std::move(tree)));
+  }
+  return hash;
+}
+
+void ChunkedContentHashCache::clear() {
+  cache_.clear();
+  if (trees_) {
+    trees_->clear();
+  }
+}
+
+ChunkedContentHashStats ChunkedContentHashCache::stats() const {
+  ChunkedContentHashStats stats{cache_.stats()};
+  stats.filesHashed = filesHashed_.load(std::memory_order_relaxed);
+  stats.bytesHashed = bytesHashed_.load(std::memory_order_relaxed);
+  stats.bytesReused = bytesReused_.load(std::memory_order_relaxed);
+  stats.numTrees = trees_ ? trees_->size() : 0;
+  return stats;
+}
+
+} // namespace watchman
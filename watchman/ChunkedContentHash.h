@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "watchman/ContentHash.h"
+#include "watchman/LRUCache.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The digests of the fixed-size chunks of a file, from which its
+ * content.chunked128hex hash is derived.
+ */
+struct ChunkTree {
+  using Digest = std::array<uint8_t, 16>;
+
+  // Identify the version of the file that the chunks were read from
+  uint64_t ino{0};
+  uint64_t size{0};
+  // The SpookyHash V2 of each kChunkSize bytes of the file; the last chunk
+  // may be shorter
+  std::vector<Digest> chunks;
+
+  // Fixed so that the hash of a file doesn't depend on configuration
+  static constexpr size_t kChunkSize = 1024 * 1024;
+
+  // The SpookyHash V2 of the file's size followed by its chunk digests
+  Digest rootHash() const;
+};
+
+struct ChunkedContentHashStats : public CacheStats {
+  explicit ChunkedContentHashStats(const CacheStats& stats)
+      : CacheStats(stats) {}
+  uint64_t filesHashed{0};
+  // The bytes that were read, and the bytes whose chunk digests were reused
+  // from an earlier version of a file instead
+  uint64_t bytesHashed{0};
+  uint64_t bytesReused{0};
+  // The number of files whose chunk digests are remembered
+  size_t numTrees{0};
+};
+
+/**
+ * Computes and caches content.chunked128hex hashes.
+ *
+ * When enabled with rememberTrees(), the chunk digests of the large files
+ * are kept after they are hashed.  When such a file is hashed again and it
+ * has only grown, and is still the same inode, then only the chunks from
+ * the one that held its old end onwards are read; the complete chunks
+ * before that are assumed to be unchanged.  That makes the cost of hashing
+ * a large append-mostly file, such as a log, proportional to what was
+ * appended.  The first and last of the reused chunks are read again to
+ * check that assumption, and the file is hashed in full if either differs,
+ * which catches most files that were rewritten in place rather than
+ * appended to, but not all of them.
+ */
+class ChunkedContentHashCache {
+ public:
+  using HashValue = ChunkTree::Digest;
+  using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
+
+  ChunkedContentHashCache(
+      const w_string& rootPath,
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      size_t numShards = 1);
+
+  // Remembers the chunk digests of up to maxTrees files of at least minSize
+  // bytes.  Must be called before the cache is used.
+  void rememberTrees(uint64_t minSize, size_t maxTrees);
+
+  // Returns a future with the hash for key, computing it on the thread
+  // pool if it isn't cached
+  folly::Future<std::shared_ptr<const Node>> get(
+      const ContentHashCacheKey& key);
+
+  // Computes the hash for key, blocking the calling thread
+  HashValue computeHashImmediate(const ContentHashCacheKey& key) const;
+
+  /**
+   * Reads the chunk digests of the file at fullPath.  If previous is the
+   * tree of an earlier version of the file, its digests are reused where
+   * the file has only been appended to.  bytesRead is incremented by the
+   * number of bytes that were read.
+   */
+  static ChunkTree hashFile(
+      const char* fullPath,
+      const ChunkTree* previous,
+      uint64_t& bytesRead);
+
+  // Returns the number of cached hashes
+  size_t size() const {
+    return cache_.size();
+  }
+
+  // Forgets every cached hash and chunk tree
+  void clear();
+
+  ChunkedContentHashStats stats() const;
+
+ private:
+  LRUCache<ContentHashCacheKey, HashValue> cache_;
+  w_string rootPath_;
+  uint64_t treeMinSize_{0};
+  // Keyed by the path relative to the root; null unless rememberTrees()
+  std::unique_ptr<LRUCache<w_string, std::shared_ptr<const ChunkTree>>>
+      trees_;
+  mutable std::atomic<uint64_t> filesHashed_{0};
+  mutable std::atomic<uint64_t> bytesHashed_{0};
+  mutable std::atomic<uint64_t> bytesReused_{0};
+};
+
+} // namespace watchman
@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ClientEventLoop.h"
+#include <folly/Exception.h>
+#include <folly/String.h>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+#include "watchman/Logging.h"
+#include "watchman/fs/Pipe.h"
+
+#ifdef HAVE_EPOLL_CREATE1
+#include <sys/epoll.h> // @manual
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h> // @manual
+#endif
+
+namespace watchman {
+
+namespace {
+
+constexpr size_t kMaxEventsPerWait = 128;
+
+/**
+ * A thin wrapper around the platform's readiness notification mechanism.
+ * Descriptors are registered for edge triggered read events and are
+ * identified by an opaque tag.
+ */
+class Poller {
+ public:
+  using Handle = FileDescriptor::system_handle_type;
+
+#ifdef HAVE_EPOLL_CREATE1
+  Poller()
+      : fd_(epoll_create1(EPOLL_CLOEXEC),
+            "epoll_create1",
+            FileDescriptor::FDType::Generic) {}
+
+  void add(Handle fd, void* tag) {
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = tag;
+    folly::checkUnixError(
+        epoll_ctl(fd_.fd(), EPOLL_CTL_ADD, fd, &ev), "epoll_ctl ADD");
+  }
+
+  void remove(Handle fd) {
+    struct epoll_event ev {};
+    // The descriptor is still open, so failure here is a logic error, but
+    // there's nothing useful that we can do about it.
+    if (epoll_ctl(fd_.fd(), EPOLL_CTL_DEL, fd, &ev) != 0) {
+      logf(ERR, "epoll_ctl DEL {}: {}\n", fd, folly::errnoStr(errno));
+    }
+  }
+
+  void wait(std::vector<void*>& ready) {
+    struct epoll_event events[kMaxEventsPerWait];
+    int n = epoll_wait(fd_.fd(), events, kMaxEventsPerWait, -1);
+    if (n == -1 && errno != EINTR) {
+      folly::throwSystemError("epoll_wait");
+    }
+    for (int i = 0; i < n; ++i) {
+      ready.push_back(events[i].data.ptr);
+    }
+  }
+
+  static constexpr bool kSupported = true;
+#elif defined(HAVE_KQUEUE)
+  Poller() : fd_(kqueue(), "kqueue", FileDescriptor::FDType::Generic) {
+    fd_.setCloExec();
+  }
+
+  void add(Handle fd, void* tag) {
+    struct kevent k;
+    EV_SET(&k, fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, tag);
+    folly::checkUnixError(
+        kevent(fd_.fd(), &k, 1, nullptr, 0, nullptr), "kevent EV_ADD");
+  }
+
+  void remove(Handle fd) {
+    struct kevent k;
+    EV_SET(&k, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    if (kevent(fd_.fd(), &k, 1, nullptr, 0, nullptr) != 0) {
+      logf(ERR, "kevent EV_DELETE {}: {}\n", fd, folly::errnoStr(errno));
+    }
+  }
+
+  void wait(std::vector<void*>& ready) {
+    struct kevent events[kMaxEventsPerWait];
+    int n = kevent(fd_.fd(), nullptr, 0, events, kMaxEventsPerWait, nullptr);
+    if (n == -1 && errno != EINTR) {
+      folly::throwSystemError("kevent");
+    }
+    for (int i = 0; i < n; ++i) {
+      ready.push_back(events[i].udata);
+    }
+  }
+
+  static constexpr bool kSupported = true;
+#else
+  Poller() {
+    throw std::system_error(
+        std::make_error_code(std::errc::function_not_supported),
+        "no client event loop poller on this platform");
+  }
+
+  void add(Handle, void*) {}
+  void remove(Handle) {}
+  void wait(std::vector<void*>&) {}
+
+  static constexpr bool kSupported = false;
+#endif
+
+ private:
+  FileDescriptor fd_;
+};
+
+} // namespace
+
+struct ClientEventLoop::Connection
+    : public std::enable_shared_from_this<Connection> {
+  // The address of one of these is the tag that the Poller hands back, so
+  // that we know which descriptor became ready.
+  struct Watch {
+    Connection* conn;
+    bool isPing;
+  };
+
+  Connection(
+      FileDescriptor::system_handle_type socket,
+      FileDescriptor::system_handle_type ping,
+      Step step,
+      Close close)
+      : socket(socket),
+        ping(ping),
+        step(std::move(step)),
+        close(std::move(close)) {}
+
+  const FileDescriptor::system_handle_type socket;
+  const FileDescriptor::system_handle_type ping;
+  Step step;
+  Close close;
+  IoThread* owner{nullptr};
+
+  Watch socketWatch{this, false};
+  Watch pingWatch{this, true};
+
+  std::mutex mutex;
+  // All of the following are protected by mutex.
+  // Set while a Step is queued or running.
+  bool running{false};
+  bool readable{false};
+  bool pinged{false};
+  bool closed{false};
+};
+
+class ClientEventLoop::IoThread {
+ public:
+  IoThread(ClientEventLoop& loop, size_t index) : loop_(loop) {
+    poller_.add(wake_.read.system_handle(), nullptr);
+    thread_ = std::thread([this, index] {
+      w_set_thread_name("client-io-", index);
+      run();
+    });
+  }
+
+  ~IoThread() {
+    stop();
+  }
+
+  void watch(const std::shared_ptr<Connection>& conn) {
+    conn->owner = this;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      conns_.emplace(conn.get(), conn);
+    }
+    try {
+      poller_.add(conn->socket, &conn->socketWatch);
+      try {
+        poller_.add(conn->ping, &conn->pingWatch);
+      } catch (const std::exception&) {
+        poller_.remove(conn->socket);
+        throw;
+      }
+    } catch (const std::exception&) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      conns_.erase(conn.get());
+      throw;
+    }
+  }
+
+  // Stops watching conn.  The IO thread may be holding a pointer to conn
+  // from its current batch of events, so it is responsible for releasing
+  // its reference at the end of that batch.
+  void unwatch(Connection* conn) {
+    poller_.remove(conn->socket);
+    poller_.remove(conn->ping);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      reap_.push_back(conn);
+    }
+    wake();
+  }
+
+  void stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake();
+    thread_.join();
+
+    // Destroy the connections, and with them their clients, outside of the
+    // lock.
+    std::unordered_map<Connection*, std::shared_ptr<Connection>> conns;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::swap(conns, conns_);
+      reap_.clear();
+    }
+  }
+
+ private:
+  void wake() {
+    ignore_result(wake_.write.write("a", 1).hasValue());
+  }
+
+  void run() {
+    std::vector<void*> ready;
+    std::vector<std::shared_ptr<Connection>> reaped;
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto conn : reap_) {
+          auto it = conns_.find(conn);
+          if (it != conns_.end()) {
+            reaped.push_back(std::move(it->second));
+            conns_.erase(it);
+          }
+        }
+        reap_.clear();
+        if (stopping_) {
+          return;
+        }
+      }
+      reaped.clear();
+
+      ready.clear();
+      try {
+        poller_.wait(ready);
+      } catch (const std::exception& exc) {
+        logf(ERR, "client event loop: {}\n", exc.what());
+        continue;
+      }
+
+      for (auto tag : ready) {
+        if (!tag) {
+          char buf[64];
+          while (true) {
+            auto res = wake_.read.read(buf, sizeof(buf));
+            if (res.hasError() || res.value() == 0) {
+              break;
+            }
+          }
+          continue;
+        }
+
+        auto watch = static_cast<Connection::Watch*>(tag);
+        auto conn = watch->conn;
+        bool needSchedule = false;
+        {
+          std::lock_guard<std::mutex> lock(conn->mutex);
+          if (conn->closed) {
+            continue;
+          }
+          if (watch->isPing) {
+            conn->pinged = true;
+          } else {
+            conn->readable = true;
+          }
+          if (!conn->running) {
+            conn->running = true;
+            needSchedule = true;
+          }
+        }
+        if (needSchedule) {
+          loop_.schedule(conn->shared_from_this());
+        }
+      }
+    }
+  }
+
+  ClientEventLoop& loop_;
+  Poller poller_;
+  Pipe wake_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  // Owns the registered connections.  Keyed by address so that we can
+  // release them from the reap list.
+  std::unordered_map<Connection*, std::shared_ptr<Connection>> conns_;
+  std::vector<Connection*> reap_;
+  bool stopping_{false};
+};
+
+bool ClientEventLoop::isSupported() {
+  return Poller::kSupported;
+}
+
+ClientEventLoop::ClientEventLoop(size_t ioThreads, size_t workerThreads) {
+  // Each connection has at most one queued Step, so the queue is bounded by
+  // the number of clients.
+  workers_.start(
+      std::max(workerThreads, size_t(1)), std::numeric_limits<size_t>::max());
+  for (size_t i = 0; i < std::max(ioThreads, size_t(1)); ++i) {
+    ioThreads_.push_back(std::make_unique<IoThread>(*this, i));
+  }
+}
+
+ClientEventLoop::~ClientEventLoop() {
+  stop();
+}
+
+void ClientEventLoop::stop() {
+  if (stopped_) {
+    return;
+  }
+  stopped_ = true;
+  // Stop the IO threads first so that nothing new gets scheduled, then let
+  // the workers finish whatever they were doing.
+  for (auto& thread : ioThreads_) {
+    thread->stop();
+  }
+  workers_.stop();
+  ioThreads_.clear();
+}
+
+size_t ClientEventLoop::size() const {
+  return numConnections_.load(std::memory_order_relaxed);
+}
+
+void ClientEventLoop::add(
+    FileDescriptor::system_handle_type socket,
+    FileDescriptor::system_handle_type ping,
+    Step step,
+    Close close) {
+  auto conn = std::make_shared<Connection>(
+      socket, ping, std::move(step), std::move(close));
+  auto& thread =
+      ioThreads_[nextIoThread_.fetch_add(1, std::memory_order_relaxed) %
+                 ioThreads_.size()];
+
+  // Hold off the IO thread until we've queued the initial Step.
+  {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    conn->running = true;
+    conn->readable = true;
+    conn->pinged = true;
+  }
+  thread->watch(conn);
+  numConnections_.fetch_add(1, std::memory_order_relaxed);
+  schedule(std::move(conn));
+}
+
+void ClientEventLoop::schedule(std::shared_ptr<Connection> conn) {
+  try {
+    workers_.add([this, conn] { run(conn); });
+  } catch (const std::exception& exc) {
+    // The pool is stopping; the connection will be dropped along with the
+    // IO threads.
+    logf(DBG, "not scheduling client step: {}\n", exc.what());
+  }
+}
+
+void ClientEventLoop::run(const std::shared_ptr<Connection>& conn) {
+  while (true) {
+    bool readable;
+    bool pinged;
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      readable = conn->readable;
+      pinged = conn->pinged;
+      conn->readable = false;
+      conn->pinged = false;
+    }
+
+    auto result = StepResult::Disconnect;
+    try {
+      result = conn->step(readable, pinged);
+    } catch (const std::exception& exc) {
+      logf(ERR, "client step failed, disconnecting: {}\n", exc.what());
+    }
+
+    if (result == StepResult::Disconnect) {
+      {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->closed = true;
+      }
+      conn->owner->unwatch(conn.get());
+      numConnections_.fetch_sub(1, std::memory_order_relaxed);
+      conn->close();
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (result == StepResult::MoreInput) {
+      // Go to the back of the queue so that a busy client can't starve the
+      // others.
+      conn->readable = true;
+      schedule(conn);
+      return;
+    }
+    if (!conn->readable && !conn->pinged) {
+      conn->running = false;
+      return;
+    }
+    // Something arrived while we were running; go around again.
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "watchman/ThreadPool.h"
+#include "watchman/fs/FileDescriptor.h"
+
+namespace watchman {
+
+/**
+ * Multiplexes client connections over a small number of IO threads, instead
+ * of the one thread per client that the listener creates by default.
+ *
+ * Each connection is represented by a pair of descriptors: the client socket
+ * and the read end of its ping pipe.  The IO threads wait for either of them
+ * to become readable using epoll or kqueue and then run the connection's
+ * Step function on a pool of worker threads.  At most one Step for a given
+ * connection is running at any time, so the state that the thread-per-client
+ * model kept thread-local is still only ever touched by one thread at once.
+ *
+ * Readiness is edge triggered: Step must consume everything that is
+ * currently available (read until EAGAIN and drain the ping pipe) or ask to
+ * be run again.
+ */
+class ClientEventLoop {
+ public:
+  enum class StepResult {
+    // Wait for the next event on the connection.
+    Idle,
+    // Input was left unconsumed; run again after other connections have had
+    // a turn.
+    MoreInput,
+    // Tear down the connection.
+    Disconnect,
+  };
+
+  /**
+   * Called on a worker thread.  `readable` is set if the socket became
+   * readable and `pinged` if the ping pipe did since the last call.
+   */
+  using Step = std::function<StepResult(bool readable, bool pinged)>;
+
+  /**
+   * Called on a worker thread once the connection has been removed from the
+   * loop.  Neither descriptor is watched any longer.
+   */
+  using Close = std::function<void()>;
+
+  /**
+   * Returns true if this platform has a poller that the loop can use.
+   */
+  static bool isSupported();
+
+  /**
+   * Starts `ioThreads` threads to wait for events and `workerThreads`
+   * threads to run commands.  Throws std::system_error if the pollers
+   * cannot be created.
+   */
+  ClientEventLoop(size_t ioThreads, size_t workerThreads);
+  ~ClientEventLoop();
+
+  ClientEventLoop(const ClientEventLoop&) = delete;
+  ClientEventLoop& operator=(const ClientEventLoop&) = delete;
+
+  /**
+   * Registers a connection.  An initial Step is run as though both
+   * descriptors were readable, so that anything that arrived before the
+   * connection was registered is not missed.  Throws std::system_error if
+   * the descriptors cannot be watched, in which case neither callback is
+   * retained.
+   */
+  void add(
+      FileDescriptor::system_handle_type socket,
+      FileDescriptor::system_handle_type ping,
+      Step step,
+      Close close);
+
+  /**
+   * Stops the IO threads and waits for any running Steps to complete.
+   * Connections that are still registered are dropped without calling
+   * their Close function.
+   */
+  void stop();
+
+  /** Returns the number of registered connections. */
+  size_t size() const;
+
+ private:
+  struct Connection;
+  class IoThread;
+
+  void schedule(std::shared_ptr<Connection> conn);
+  void run(const std::shared_ptr<Connection>& conn);
+
+  std::vector<std::unique_ptr<IoThread>> ioThreads_;
+  ThreadPool workers_;
+  std::atomic<size_t> nextIoThread_{0};
+  std::atomic<size_t> numConnections_{0};
+  bool stopped_{false};
+};
+
+} // namespace watchman
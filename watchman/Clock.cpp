@@ -7,7 +7,6 @@
 
 #include "watchman/Clock.h"
 #include <folly/String.h>
-#include <folly/Synchronized.h>
 #include <memory>
 
 using namespace watchman;
@@ -142,8 +141,8 @@ ClockSpec::ClockSpec(const ClockPosition& position)
 QuerySince ClockSpec::evaluate(
     const ClockPosition& position,
     const uint32_t lastAgeOutTick,
-    folly::Synchronized<std::unordered_map<w_string, uint32_t>>* cursorMap)
-    const {
+    CursorMap* cursorMap,
+    const std::vector<ClockEpoch>* epochs) const {
   QuerySince since;
 
   switch (tag) {
@@ -161,22 +160,15 @@ QuerySince ClockSpec::evaluate(
             "illegal to use a named cursor in this context");
       }
 
-      {
-        auto wlock = cursorMap->wlock();
-        auto& cursors = *wlock;
-        auto it = cursors.find(named_cursor.cursor);
-
-        if (it == cursors.end()) {
-          since.clock.is_fresh_instance = true;
-          since.clock.ticks = 0;
-        } else {
-          since.clock.ticks = it->second;
-          since.clock.is_fresh_instance = since.clock.ticks < lastAgeOutTick;
-        }
-
-        // record the current tick value against the cursor so that we use that
-        // as the basis for a subsequent query.
-        cursors[named_cursor.cursor] = position.ticks;
+      // record the current tick value against the cursor so that we use that
+      // as the basis for a subsequent query.
+      auto previous = cursorMap->exchange(named_cursor.cursor, position.ticks);
+      if (!previous) {
+        since.clock.is_fresh_instance = true;
+        since.clock.ticks = 0;
+      } else {
+        since.clock.ticks = *previous;
+        since.clock.is_fresh_instance = since.clock.ticks < lastAgeOutTick;
       }
 
       watchman::log(
@@ -191,8 +183,20 @@ QuerySince ClockSpec::evaluate(
     }
 
     case w_cs_clock: {
-      if (clock.start_time == proc_start_time && clock.pid == proc_pid &&
-          clock.position.rootNumber == position.rootNumber) {
+      bool current = clock.start_time == proc_start_time &&
+          clock.pid == proc_pid &&
+          clock.position.rootNumber == position.rootNumber;
+      if (!current && epochs) {
+        for (auto& epoch : *epochs) {
+          if (clock.start_time == epoch.startTime && clock.pid == epoch.pid &&
+              clock.position.rootNumber == epoch.rootNumber &&
+              clock.position.ticks <= epoch.ticks) {
+            current = true;
+            break;
+          }
+        }
+      }
+      if (current) {
         since.clock.is_fresh_instance = clock.position.ticks < lastAgeOutTick;
         if (since.clock.is_fresh_instance) {
           since.clock.ticks = 0;
@@ -202,7 +206,9 @@ QuerySince ClockSpec::evaluate(
       } else {
         // If the pid, start time or root number don't match, they asked a
         // different incarnation of the server or a different instance of this
-        // root, so we treat them as having never spoken to us before.
+        // root, so we treat them as having never spoken to us before.  The
+        // same goes for a clock that an earlier incarnation issued after
+        // its last snapshot.
         since.clock.is_fresh_instance = true;
         since.clock.ticks = 0;
       }
@@ -234,6 +240,11 @@ bool clock_id_string(
   return (size_t)res < bufsize;
 }
 
+ClockEpoch ClockEpoch::current(const ClockPosition& position) {
+  return ClockEpoch{
+      proc_start_time, proc_pid, position.rootNumber, position.ticks};
+}
+
 w_string ClockPosition::toClockString() const {
   char clockbuf[128];
   if (!clock_id_string(rootNumber, ticks, clockbuf, sizeof(clockbuf))) {
@@ -6,8 +6,8 @@
  */
 
 #pragma once
-#include <folly/Synchronized.h>
-#include <unordered_map>
+#include <vector>
+#include "watchman/CursorMap.h"
 #include "watchman/Logging.h"
 
 struct w_clock_t {
@@ -41,6 +41,23 @@ struct ClockPosition {
   w_string toClockString() const;
 };
 
+/**
+ * Identifies the clocks that one daemon process issued for one root, up to
+ * `ticks`.  Clocks are normally meaningless to any other process, but a
+ * view snapshot carries the epoch of the process that wrote it over to the
+ * next one, which continues counting ticks from there.  Clocks of the
+ * epoch then still denote positions of the view.
+ */
+struct ClockEpoch {
+  uint64_t startTime{0};
+  int pid{0};
+  uint32_t rootNumber{0};
+  uint32_t ticks{0};
+
+  // The epoch of this process, for a root at position
+  static ClockEpoch current(const ClockPosition& position);
+};
+
 enum w_clockspec_tag { w_cs_timestamp, w_cs_clock, w_cs_named_cursor };
 
 struct ClockSpec {
@@ -77,13 +94,14 @@ struct ClockSpec {
 
   /** Evaluate the clockspec against the inputs, returning
    * the effective since parameter.
-   * If cursorMap is passed in, it MUST be unlocked, as this method
-   * will acquire a lock to evaluate a named cursor. */
+   * A named cursor is evaluated against cursorMap, which records the
+   * position for the cursor's next use.  A clock from an earlier process is
+   * honored if it falls within one of the epochs carried over from it. */
   QuerySince evaluate(
       const ClockPosition& position,
       const uint32_t lastAgeOutTick,
-      folly::Synchronized<std::unordered_map<w_string, uint32_t>>* cursorMap =
-          nullptr) const;
+      CursorMap* cursorMap = nullptr,
+      const std::vector<ClockEpoch>* epochs = nullptr) const;
 
   /** Initializes some global state needed for clockspec evaluation */
   static void init();
@@ -30,6 +30,11 @@ inline constexpr auto CMD_DAEMON = CommandFlags::raw(1);
 inline constexpr auto CMD_CLIENT = CommandFlags::raw(2);
 inline constexpr auto CMD_POISON_IMMUNE = CommandFlags::raw(4);
 inline constexpr auto CMD_ALLOW_ANY_USER = CommandFlags::raw(8);
+// Evaluates a query, so it is admitted under the tighter concurrency limit
+inline constexpr auto CMD_QUERY = CommandFlags::raw(16);
+// Only dispatches other commands, which are admitted on their own, so it
+// doesn't take an admission slot itself
+inline constexpr auto CMD_DISPATCHER = CommandFlags::raw(32);
 
 struct command_handler_def {
   const char* name;
@@ -7,6 +7,9 @@
 
 #include "watchman/ContentHash.h"
 #include <folly/ScopeGuard.h>
+#include <folly/hash/SpookyHashV2.h>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include "watchman/Logging.h"
 #include "watchman/ThreadPool.h"
@@ -30,60 +33,26 @@ namespace watchman {
 using HashValue = typename ContentHashCache::HashValue;
 using Node = typename ContentHashCache::Node;
 
-bool ContentHashCacheKey::operator==(const ContentHashCacheKey& other) const {
-  return fileSize == other.fileSize && mtime.tv_sec == other.mtime.tv_sec &&
-      mtime.tv_nsec == other.mtime.tv_nsec &&
-      relativePath == other.relativePath;
-}
-
-std::size_t ContentHashCacheKey::hashValue() const {
-  return hash_128_to_64(
-      w_string_hval(relativePath),
-      hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
-}
-
-ContentHashCache::ContentHashCache(
-    const w_string& rootPath,
-    size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+namespace {
+// Files are read in blocks of up to kMaxReadSize bytes so that hashing a
+// large file takes few syscalls; smaller files get a buffer of their size.
+constexpr size_t kMinReadSize = 8192;
+constexpr size_t kMaxReadSize = 1024 * 1024;
 
-folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
-    const ContentHashCacheKey& key) {
-  return cache_.get(
-      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+size_t readSizeFor(const watchman_stream& stm) {
+  auto size = size_t(stm.getFileDescriptor().getInfo().size);
+  return std::clamp(size, kMinReadSize, kMaxReadSize);
 }
 
-HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
-  HashValue result;
-  uint8_t buf[8192];
-
-  auto stm = w_stm_open(fullPath, O_RDONLY);
-  if (!stm) {
-    throw std::system_error(
-        errno,
-        std::generic_category(),
-        to<std::string>("w_stm_open ", fullPath));
-  }
-
+// Returns the SHA-1 of the bytes that `feed` passes to the function that it
+// is given
+template <typename Feed>
+HashValue sha1Of(Feed feed) {
+  HashValue result{};
 #ifndef _WIN32
   SHA_CTX ctx;
   SHA1_Init(&ctx);
-
-  while (true) {
-    auto n = stm->read(buf, sizeof(buf));
-    if (n == 0) {
-      break;
-    }
-    if (n < 0) {
-      throw std::system_error(
-          errno,
-          std::generic_category(),
-          to<std::string>("while reading from ", fullPath));
-    }
-    SHA1_Update(&ctx, buf, n);
-  }
-
+  feed([&](const uint8_t* data, int n) { SHA1_Update(&ctx, data, n); });
   SHA1_Final(result.data(), &ctx);
 #else
   // Use the built-in crypt provider API on windows to avoid introducing a
@@ -112,23 +81,12 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
     CryptDestroyHash(ctx);
   };
 
-  while (true) {
-    auto n = stm->read(buf, sizeof(buf));
-    if (n == 0) {
-      break;
-    }
-    if (n < 0) {
-      throw std::system_error(
-          errno,
-          std::generic_category(),
-          to<std::string>("while reading from ", fullPath));
-    }
-
-    if (!CryptHashData(ctx, buf, n, 0)) {
+  feed([&](const uint8_t* data, int n) {
+    if (!CryptHashData(ctx, data, n, 0)) {
       throw std::system_error(
           GetLastError(), std::system_category(), "CryptHashData");
     }
-  }
+  });
 
   DWORD size = result.size();
   if (!CryptGetHashParam(ctx, HP_HASHVAL, result.data(), &size, 0)) {
@@ -138,11 +96,127 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
 #endif
   return result;
 }
+} // namespace
+
+bool ContentHashCacheKey::operator==(const ContentHashCacheKey& other) const {
+  return fileSize == other.fileSize && mtime.tv_sec == other.mtime.tv_sec &&
+      mtime.tv_nsec == other.mtime.tv_nsec &&
+      relativePath == other.relativePath;
+}
+
+std::size_t ContentHashCacheKey::hashValue() const {
+  return hash_128_to_64(
+      w_string_hval(relativePath),
+      hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
+}
+
+bool ContentHashInodeKey::operator==(const ContentHashInodeKey& other) const {
+  return dev == other.dev && ino == other.ino && fileSize == other.fileSize &&
+      mtime.tv_sec == other.mtime.tv_sec &&
+      mtime.tv_nsec == other.mtime.tv_nsec;
+}
+
+std::size_t ContentHashInodeKey::hashValue() const {
+  return hash_128_to_64(
+      hash_128_to_64(dev, ino),
+      hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
+}
+
+ContentHashCache::ContentHashCache(
+    const w_string& rootPath,
+    size_t maxItems,
+    std::chrono::milliseconds errorTTL,
+    ContentHashAlgorithm algorithm,
+    size_t numShards)
+    : cache_(maxItems, errorTTL, std::chrono::seconds(300), numShards),
+      rootPath_(rootPath),
+      algorithm_(algorithm) {}
+
+folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
+    const ContentHashCacheKey& key) {
+  return cache_.get(
+      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+}
+
+HashValue ContentHashCache::computeHashImmediate(
+    const char* fullPath,
+    ContentHashAlgorithm algorithm) {
+  HashValue result{};
+
+  auto stm = w_stm_open(fullPath, O_RDONLY);
+  if (!stm) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        to<std::string>("w_stm_open ", fullPath));
+  }
+
+  auto bufSize = readSizeFor(*stm);
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[bufSize]);
+#ifdef __linux__
+  // We read the whole file exactly once, so let the kernel read ahead
+  // aggressively.  This is only advice, so failure is harmless.
+  (void)posix_fadvise(
+      stm->getFileDescriptor().fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  // Feeds the whole of the file to `update`
+  auto readAll = [&](auto update) {
+    while (true) {
+      auto n = stm->read(buf.get(), int(bufSize));
+      if (n == 0) {
+        break;
+      }
+      if (n < 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            to<std::string>("while reading from ", fullPath));
+      }
+      update(buf.get(), n);
+    }
+  };
+
+  if (algorithm == ContentHashAlgorithm::Spooky128) {
+    folly::hash::SpookyHashV2 spooky;
+    spooky.Init(0, 0);
+    readAll([&](const uint8_t* data, int n) { spooky.Update(data, n); });
+
+    uint64_t hash[2];
+    spooky.Final(&hash[0], &hash[1]);
+    // Most significant byte first, to give the same hex on every platform
+    for (size_t i = 0; i < 16; ++i) {
+      result[i] = uint8_t(hash[i / 8] >> (56 - 8 * (i % 8)));
+    }
+    return result;
+  }
+
+  return sha1Of(readAll);
+}
+
+size_t ContentHashCache::hashSize(ContentHashAlgorithm algorithm) {
+  switch (algorithm) {
+    case ContentHashAlgorithm::Spooky128:
+      return 16;
+    case ContentHashAlgorithm::Sha1:
+    default:
+      return 20;
+  }
+}
+
+HashValue ContentHashCache::computeSha1(const void* data, size_t size) {
+  return sha1Of([&](auto update) {
+    update(static_cast<const uint8_t*>(data), int(size));
+  });
+}
 
 HashValue ContentHashCache::computeHashImmediate(
     const ContentHashCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
-  auto result = computeHashImmediate(fullPath.c_str());
+  auto start = std::chrono::steady_clock::now();
+  auto result = computeHashImmediate(fullPath.c_str(), algorithm_);
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
 
   // Since TOCTOU is everywhere and everything, double check to make sure that
   // the file looks like we were expecting at the start.  If it isn't, then
@@ -156,20 +230,125 @@ HashValue ContentHashCache::computeHashImmediate(
         "metadata changed during hashing; query again to get latest status");
   }
 
+  filesHashed_.fetch_add(1, std::memory_order_relaxed);
+  bytesHashed_.fetch_add(key.fileSize, std::memory_order_relaxed);
+  hashingMicros_.fetch_add(elapsed.count(), std::memory_order_relaxed);
+  if (throttle_) {
+    throttle_->record(
+        IoThrottle::Kind::Data,
+        elapsed,
+        size_t((key.fileSize + kMaxReadSize - 1) / kMaxReadSize));
+  }
   return result;
 }
 
 folly::Future<HashValue> ContentHashCache::computeHash(
     const ContentHashCacheKey& key) const {
-  return folly::via(
-      &getThreadPool(), [key, this] { return computeHashImmediate(key); });
+  // Hashing comes in bulk, so let cheaper tasks go first
+  auto executor = getThreadPool().executor(ThreadPool::Priority::Low);
+  auto slot = throttle_ ? throttle_->acquire()
+                        : folly::makeSemiFuture(IoThrottle::Slot{});
+  // The slot is held until the hash has been computed
+  return std::move(slot).via(executor).thenValue(
+      [key, this](IoThrottle::Slot) {
+        if (auto hash = lookupInode(key)) {
+          inodeHit_.fetch_add(1, std::memory_order_relaxed);
+          return *hash;
+        }
+        if (store_) {
+          if (auto hash = store_->lookup(key)) {
+            diskHit_.fetch_add(1, std::memory_order_relaxed);
+            rememberInode(key, *hash);
+            return *hash;
+          }
+          diskMiss_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto hash = computeHashImmediate(key);
+        if (store_) {
+          store_->add(key, hash);
+        }
+        rememberInode(key, hash);
+        return hash;
+      });
+}
+
+std::optional<HashValue> ContentHashCache::lookupInode(
+    const ContentHashCacheKey& key) const {
+  if (!inodes_ || key.ino == 0) {
+    return std::nullopt;
+  }
+  auto node = inodes_->get(
+      ContentHashInodeKey{key.dev, key.ino, key.fileSize, key.mtime});
+  if (!node) {
+    return std::nullopt;
+  }
+
+  // The inode may have been reused for a file of the same size and mtime
+  // since, or the key may be stale, so check that the path still names it
+  auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
+  try {
+    auto stat = getFileInformation(fullPath.c_str());
+    if (uint64_t(stat.ino) != key.ino || uint64_t(stat.dev) != key.dev ||
+        size_t(stat.size) != key.fileSize ||
+        stat.mtime.tv_sec != key.mtime.tv_sec ||
+        stat.mtime.tv_nsec != key.mtime.tv_nsec) {
+      return std::nullopt;
+    }
+  } catch (const std::system_error&) {
+    return std::nullopt;
+  }
+  return node->value();
+}
+
+void ContentHashCache::rememberInode(
+    const ContentHashCacheKey& key,
+    HashValue hash) const {
+  if (!inodes_ || key.ino == 0) {
+    return;
+  }
+  inodes_->set(
+      ContentHashInodeKey{key.dev, key.ino, key.fileSize, key.mtime},
+      std::move(hash));
+}
+
+void ContentHashCache::setStore(std::unique_ptr<ContentHashStore> store) {
+  store_ = std::move(store);
+}
+
+void ContentHashCache::setThrottle(std::shared_ptr<IoThrottle> throttle) {
+  throttle_ = std::move(throttle);
+}
+
+void ContentHashCache::reuseByInode(size_t maxItems) {
+  inodes_ = std::make_unique<LRUCache<ContentHashInodeKey, HashValue>>(
+      maxItems, std::chrono::milliseconds(0));
 }
 
 const w_string& ContentHashCache::rootPath() const {
   return rootPath_;
 }
 
-CacheStats ContentHashCache::stats() const {
-  return cache_.stats();
+size_t ContentHashCache::size() const {
+  return cache_.size();
+}
+
+void ContentHashCache::clear() {
+  cache_.clear();
+  if (inodes_) {
+    inodes_->clear();
+  }
+}
+
+ContentHashCacheStats ContentHashCache::stats() const {
+  ContentHashCacheStats stats{cache_.stats()};
+  stats.filesHashed = filesHashed_.load(std::memory_order_relaxed);
+  stats.bytesHashed = bytesHashed_.load(std::memory_order_relaxed);
+  stats.hashingTime = std::chrono::microseconds(
+      hashingMicros_.load(std::memory_order_relaxed));
+  stats.diskHit = diskHit_.load(std::memory_order_relaxed);
+  stats.diskMiss = diskMiss_.load(std::memory_order_relaxed);
+  stats.inodeHit = inodeHit_.load(std::memory_order_relaxed);
+  return stats;
 }
 } // namespace watchman
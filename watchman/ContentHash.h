@@ -7,6 +7,12 @@
 
 #pragma once
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include "watchman/ContentHashStore.h"
+#include "watchman/IoThrottle.h"
 #include "watchman/LRUCache.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
@@ -19,11 +25,30 @@ struct ContentHashCacheKey {
   size_t fileSize;
   // The modification time
   struct timespec mtime;
+  // The device and inode number of the file, if known; they aren't part of
+  // the key, but let ContentHashCache reuse the hash of another path to the
+  // same file
+  uint64_t dev{0};
+  uint64_t ino{0};
 
   // Computes a hash value for use in the cache map
   std::size_t hashValue() const;
   bool operator==(const ContentHashCacheKey& other) const;
 };
+
+/**
+ * Identifies the contents of a file by its inode rather than its path.  The
+ * ctime isn't part of it since renaming or linking a file changes it.
+ */
+struct ContentHashInodeKey {
+  uint64_t dev;
+  uint64_t ino;
+  size_t fileSize;
+  struct timespec mtime;
+
+  std::size_t hashValue() const;
+  bool operator==(const ContentHashInodeKey& other) const;
+};
 } // namespace watchman
 
 namespace std {
@@ -33,21 +58,58 @@ struct hash<watchman::ContentHashCacheKey> {
     return key.hashValue();
   }
 };
+
+template <>
+struct hash<watchman::ContentHashInodeKey> {
+  std::size_t operator()(watchman::ContentHashInodeKey const& key) const {
+    return key.hashValue();
+  }
+};
 } // namespace std
 
 namespace watchman {
+enum class ContentHashAlgorithm {
+  // The hash reported by the content.sha1hex field
+  Sha1,
+  // SpookyHash V2, a much faster non-cryptographic 128-bit hash, reported by
+  // the content.spooky128hex field
+  Spooky128,
+};
+
+struct ContentHashCacheStats : public CacheStats {
+  explicit ContentHashCacheStats(const CacheStats& stats)
+      : CacheStats(stats) {}
+  // The number of files that have been hashed, and their total size
+  uint64_t filesHashed{0};
+  uint64_t bytesHashed{0};
+  // The time spent hashing them
+  std::chrono::microseconds hashingTime{0};
+  // Lookups that missed the in-memory cache and were then looked up in the
+  // ContentHashStore, if there is one
+  uint64_t diskHit{0};
+  uint64_t diskMiss{0};
+  // Lookups that missed the in-memory cache and were served by the hash of
+  // another path to the same inode
+  uint64_t inodeHit{0};
+};
+
 class ContentHashCache {
  public:
+  // Large enough for any of the algorithms.  Shorter hashes occupy the
+  // first hashSize() bytes and the rest are zero.
   using HashValue = std::array<uint8_t, 20>;
   using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
+  // caching TTL.  The cache is split into numShards independently
+  // locked LRUCache shards.
   ContentHashCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      ContentHashAlgorithm algorithm = ContentHashAlgorithm::Sha1,
+      size_t numShards = 1);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
@@ -65,7 +127,19 @@ class ContentHashCache {
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
-  static HashValue computeHashImmediate(const char* fullPath);
+  static HashValue computeHashImmediate(
+      const char* fullPath,
+      ContentHashAlgorithm algorithm = ContentHashAlgorithm::Sha1);
+
+  // Returns the SHA-1 of size bytes at data
+  static HashValue computeSha1(const void* data, size_t size);
+
+  // Returns the number of bytes of a HashValue that algorithm produces
+  static size_t hashSize(ContentHashAlgorithm algorithm);
+
+  ContentHashAlgorithm algorithm() const {
+    return algorithm_;
+  }
 
   // Compute the hash value for a given input via the thread pool.
   // Returns a future to operate on the result of this async operation
@@ -74,11 +148,49 @@ class ContentHashCache {
   // Returns the root path that this cache is associated with
   const w_string& rootPath() const;
 
+  // Returns the number of cached hashes
+  size_t size() const;
+
+  // Forgets every cached hash; they are computed again on demand
+  void clear();
+
+  // Backs the cache with `store`, which is then consulted before hashing a
+  // file, and which records the hashes that are computed.  Must be called
+  // before the cache is used.
+  void setStore(std::unique_ptr<ContentHashStore> store);
+
+  // Hashes files only while holding a slot of `throttle`, and reports the
+  // time spent reading them to it.  Must be called before the cache is
+  // used.
+  void setThrottle(std::shared_ptr<IoThrottle> throttle);
+
+  // Also remembers the hashes of up to maxItems files by their inode, so
+  // that a file that was renamed or hardlinked reuses the hash computed for
+  // its other path instead of being read again.  The file is stat'd by its
+  // new path to check that it is still that inode before the hash is
+  // reused.  Only keys with an inode number take part.  Must be called
+  // before the cache is used.
+  void reuseByInode(size_t maxItems);
+
   // Returns cache statistics
-  CacheStats stats() const;
+  ContentHashCacheStats stats() const;
 
  private:
   LRUCache<ContentHashCacheKey, HashValue> cache_;
   w_string rootPath_;
+  ContentHashAlgorithm algorithm_;
+  mutable std::atomic<uint64_t> filesHashed_{0};
+  mutable std::atomic<uint64_t> bytesHashed_{0};
+  mutable std::atomic<uint64_t> hashingMicros_{0};
+  std::unique_ptr<ContentHashStore> store_;
+  std::shared_ptr<IoThrottle> throttle_;
+  mutable std::atomic<uint64_t> diskHit_{0};
+  mutable std::atomic<uint64_t> diskMiss_{0};
+  // Null unless reuseByInode()
+  std::unique_ptr<LRUCache<ContentHashInodeKey, HashValue>> inodes_;
+  mutable std::atomic<uint64_t> inodeHit_{0};
+
+  std::optional<HashValue> lookupInode(const ContentHashCacheKey& key) const;
+  void rememberInode(const ContentHashCacheKey& key, HashValue hash) const;
 };
 } // namespace watchman
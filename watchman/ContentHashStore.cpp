@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <folly/FileUtil.h>
+#include <folly/Range.h>
+#include <folly/String.h>
+#include <cstring>
+#include <string>
+#include "watchman/ContentHash.h"
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'C', 'H', 'A', 'S', 'H', 0};
+constexpr uint32_t kVersion = 1;
+
+// The log is only compacted once it has at least this many records, so
+// that small stores aren't rewritten over and over.
+constexpr size_t kMinRecordsToCompact = 1024;
+
+struct StoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t rootPathLength;
+};
+
+template <typename T>
+void append(std::string& buf, const T& value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read(folly::ByteRange& data, T& value) {
+  if (data.size() < sizeof(value)) {
+    return false;
+  }
+  memcpy(&value, data.data(), sizeof(value));
+  data.advance(sizeof(value));
+  return true;
+}
+
+std::string encodeHeader(const w_string& rootPath) {
+  StoreHeader header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.rootPathLength = rootPath.size();
+
+  std::string buf;
+  append(buf, header);
+  buf.append(rootPath.data(), rootPath.size());
+  return buf;
+}
+
+// Returns false if data doesn't start with the header for rootPath
+bool readHeader(folly::ByteRange& data, const w_string& rootPath) {
+  StoreHeader header;
+  if (!read(data, header) || memcmp(header.magic, kMagic, sizeof(kMagic)) ||
+      header.version != kVersion || header.rootPathLength != rootPath.size() ||
+      data.size() < rootPath.size() ||
+      memcmp(data.data(), rootPath.data(), rootPath.size())) {
+    return false;
+  }
+  data.advance(rootPath.size());
+  return true;
+}
+
+} // namespace
+
+ContentHashStore::ContentHashStore(w_string path, w_string rootPath)
+    : path_(std::move(path)), rootPath_(std::move(rootPath)) {}
+
+std::optional<ContentHashStore::HashValue> ContentHashStore::lookup(
+    const ContentHashCacheKey& key) {
+  auto state = state_.wlock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  auto it = state->entries.find(key.relativePath);
+  if (it == state->entries.end()) {
+    return std::nullopt;
+  }
+  const auto& entry = it->second;
+  if (entry.fileSize != key.fileSize || entry.mtimeSec != key.mtime.tv_sec ||
+      entry.mtimeNsec != key.mtime.tv_nsec) {
+    return std::nullopt;
+  }
+  return entry.hash;
+}
+
+void ContentHashStore::add(
+    const ContentHashCacheKey& key,
+    const HashValue& hash) {
+  auto state = state_.wlock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  Entry entry{
+      uint64_t(key.fileSize),
+      int64_t(key.mtime.tv_sec),
+      int64_t(key.mtime.tv_nsec),
+      hash};
+  state->entries[key.relativePath] = entry;
+
+  if (!state->log) {
+    return;
+  }
+
+  std::string buf;
+  appendRecord(buf, key.relativePath, entry);
+  if (folly::writeFull(state->log.fd(), buf.data(), buf.size()) !=
+      ssize_t(buf.size())) {
+    logf(
+        ERR,
+        "unable to write to content hash store {}: {}\n",
+        path_,
+        folly::errnoStr(errno));
+    // Stop appending; a partial record at the end is ignored when loading
+    state->log.close();
+    return;
+  }
+  ++state->numRecords;
+}
+
+size_t ContentHashStore::size() {
+  auto state = state_.wlock();
+  if (!state->loaded) {
+    load(*state);
+  }
+  return state->entries.size();
+}
+
+void ContentHashStore::appendRecord(
+    std::string& buf,
+    w_string_piece name,
+    const Entry& entry) {
+  append(buf, uint32_t(name.size()));
+  buf.append(name.data(), name.size());
+  append(buf, entry.fileSize);
+  append(buf, entry.mtimeSec);
+  append(buf, entry.mtimeNsec);
+  append(buf, entry.hash);
+}
+
+void ContentHashStore::load(State& state) {
+  state.loaded = true;
+
+  std::string data;
+  bool needRewrite = true;
+  if (folly::readFile(path_.c_str(), data)) {
+    folly::ByteRange range{folly::StringPiece(data)};
+    if (readHeader(range, rootPath_)) {
+      needRewrite = false;
+      while (!range.empty()) {
+        uint32_t nameLength;
+        Entry entry;
+        if (!read(range, nameLength) || range.size() < nameLength) {
+          needRewrite = true;
+          break;
+        }
+        w_string name(reinterpret_cast<const char*>(range.data()), nameLength);
+        range.advance(nameLength);
+        if (!read(range, entry.fileSize) || !read(range, entry.mtimeSec) ||
+            !read(range, entry.mtimeNsec) || !read(range, entry.hash)) {
+          needRewrite = true;
+          break;
+        }
+        state.entries[name] = entry;
+        ++state.numRecords;
+      }
+    } else {
+      logf(ERR, "ignoring {}: not a content hash store for this root\n", path_);
+    }
+
+    logf(
+        DBG,
+        "loaded {} content hashes from {}\n",
+        state.entries.size(),
+        path_);
+  }
+
+  if (state.numRecords >= kMinRecordsToCompact &&
+      state.numRecords > 2 * state.entries.size()) {
+    needRewrite = true;
+  }
+
+  try {
+    if (needRewrite) {
+      // Also covers a missing file, and discards a partial record from
+      // an interrupted write so that new records can follow.
+      rewrite(state);
+    }
+    state.log = folly::File(path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "unable to open content hash store {}: {}; hashes will only be "
+        "kept in memory\n",
+        path_,
+        exc.what());
+  }
+}
+
+void ContentHashStore::rewrite(State& state) {
+  auto buf = encodeHeader(rootPath_);
+  for (const auto& [name, entry] : state.entries) {
+    appendRecord(buf, name, entry);
+  }
+  folly::writeFileAtomic(path_.c_str(), buf, 0600);
+  state.numRecords = state.entries.size();
+}
+
+} // namespace watchman
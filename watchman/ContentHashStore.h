@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/File.h>
+#include <folly/Synchronized.h>
+#include <array>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+struct ContentHashCacheKey;
+
+/**
+ * An on-disk record of content hashes for a root, so that they survive a
+ * restart of the daemon.
+ *
+ * The file is a header naming the root followed by an append-only log of
+ * (relativePath, fileSize, mtime, hash) records; the last record for a path
+ * supersedes any earlier ones.  The whole log is read on the first lookup,
+ * and is rewritten without the superseded records at that point if they
+ * make up most of it.  A record that was only partially written, eg: because
+ * the daemon crashed, is ignored.
+ *
+ * Everything is stored in native byte order, as in the view snapshot.
+ */
+class ContentHashStore {
+ public:
+  using HashValue = std::array<uint8_t, 20>;
+
+  ContentHashStore(w_string path, w_string rootPath);
+
+  // Returns the stored hash for key, if there is one for exactly its size
+  // and mtime.
+  std::optional<HashValue> lookup(const ContentHashCacheKey& key);
+
+  // Records the hash for key, replacing any stored for the same path.
+  void add(const ContentHashCacheKey& key, const HashValue& hash);
+
+  // Returns the number of paths with a stored hash
+  size_t size();
+
+  const w_string& path() const {
+    return path_;
+  }
+
+ private:
+  struct Entry {
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    HashValue hash;
+  };
+
+  struct State {
+    bool loaded{false};
+    std::unordered_map<w_string, Entry> entries;
+    // The number of records in the log, including superseded ones
+    size_t numRecords{0};
+    // Open for appending once loaded; invalid if the log can't be written
+    folly::File log;
+  };
+
+  static void appendRecord(
+      std::string& buf,
+      w_string_piece name,
+      const Entry& entry);
+  void load(State& state);
+  void rewrite(State& state);
+
+  const w_string path_;
+  const w_string rootPath_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
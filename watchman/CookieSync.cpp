@@ -47,15 +47,37 @@ void CookieSync::removeCookieDir(const w_string& dir) {
 
   // Cancel the cookies in the removed directory. These are considered to be
   // serviced.
-  auto cookies = cookies_.wlock();
-  for (const auto& [cookiePath, cookie] : *cookies) {
-    if (w_string_startswith(cookiePath, dir)) {
-      cookie->notify();
-      cookies->erase(cookiePath);
+  std::shared_ptr<Cookie> failed;
+  folly::exception_wrapper error;
+  {
+    auto cookies = cookies_.wlock();
+    auto& outstanding = cookies->outstanding;
+    for (auto it = outstanding.begin(); it != outstanding.end();) {
+      if (w_string_startswith(it->first, dir)) {
+        it->second->notify();
+        it = outstanding.erase(it);
+      } else {
+        ++it;
+      }
     }
+    failed = writeNextCookie(*cookies, false, error);
+  }
+  if (failed) {
+    failed->promise.setException(error);
   }
 }
 
+void CookieSync::setCoalesceSyncs(
+    bool coalesce,
+    std::chrono::milliseconds maxWait) {
+  coalesceSyncs_.store(coalesce, std::memory_order_relaxed);
+  maxCoalesceWait_.store(maxWait, std::memory_order_relaxed);
+}
+
+uint64_t CookieSync::getCoalescedSyncCount() const {
+  return coalescedSyncs_.load(std::memory_order_relaxed);
+}
+
 void CookieSync::setCookieDir(const w_string& dir) {
   auto guard = cookieDirs_.wlock();
   guard->dirs_.clear();
@@ -64,7 +86,7 @@ void CookieSync::setCookieDir(const w_string& dir) {
 
 std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
   std::vector<w_string> result;
-  for (auto& it : *cookies_.rlock()) {
+  for (auto& it : cookies_.rlock()->outstanding) {
     result.push_back(it.first);
   }
 
@@ -73,25 +95,75 @@ std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
 
 folly::Future<folly::Unit> CookieSync::sync(
     std::vector<w_string>& cookieFileNames) {
-  auto prefixes = cookiePrefix();
-  auto serial = serial_++;
+  return syncImpl(cookieFileNames, false);
+}
 
-  auto cookie = std::make_shared<Cookie>(prefixes.size());
+folly::Future<folly::Unit> CookieSync::syncImpl(
+    std::vector<w_string>& cookieFileNames,
+    bool coalesce) {
+  auto prefixes = cookiePrefix();
 
   // Even though we only write to the cookie at the end of the function, we
   // need to hold it while the files are written on disk to avoid a race where
   // cookies are detected on disk by the watcher, and notifyCookie is called
   // prior to all the pending cookies being added to cookies_. Holding the lock
   // will make sure that notifyCookie will be serialized with this code.
-  auto cookiesLock = cookies_.wlock();
+  auto cookies = cookies_.wlock();
+
+  std::shared_ptr<Cookie> cookie;
+  uint32_t serial;
+  if (cookies->next) {
+    // Share the cookie that other syncs are already waiting for
+    cookie = cookies->next;
+    serial = cookies->nextSerial;
+  } else {
+    cookie = std::make_shared<Cookie>(0);
+    serial = serial_++;
+  }
+
+  cookieFileNames.reserve(cookieFileNames.size() + prefixes.size());
+  for (const auto& prefix : prefixes) {
+    cookieFileNames.push_back(w_string::build(prefix, serial));
+  }
+
+  if (coalesce && !cookies->outstanding.empty()) {
+    // The outstanding cookies may have been written before this sync began,
+    // so observing them doesn't tell us that we've caught up.  Wait for the
+    // next cookie, which is written once they have all been observed.
+    if (!cookies->next) {
+      cookies->next = cookie;
+      cookies->nextSerial = serial;
+    }
+    coalescedSyncs_.fetch_add(1, std::memory_order_relaxed);
+    logf(DBG, "sync will share cookie {}\n", serial);
+    return cookie->promise.getFuture();
+  }
+
+  cookies->next.reset();
+  try {
+    writeCookies(*cookies, cookie, prefixes, serial);
+  } catch (const std::system_error&) {
+    // Other syncs may be sharing this cookie
+    cookies.unlock();
+    cookie->promise.setException(
+        folly::exception_wrapper(std::current_exception()));
+    throw;
+  }
+  return cookie->promise.getFuture();
+}
+
+void CookieSync::writeCookies(
+    Cookies& cookies,
+    const std::shared_ptr<Cookie>& cookie,
+    const std::unordered_set<w_string>& prefixes,
+    uint32_t serial) {
+  cookie->numPending.store(prefixes.size(), std::memory_order_release);
 
   CookieMap pendingCookies;
   std::optional<std::tuple<w_string, int>> lastError;
 
-  cookieFileNames.reserve(prefixes.size());
   for (const auto& prefix : prefixes) {
     auto path_str = w_string::build(prefix, serial);
-    cookieFileNames.push_back(path_str);
 
     /* then touch the file */
     auto file = w_stm_open(
@@ -126,9 +198,36 @@ folly::Future<folly::Unit> CookieSync::sync(
             folly::errnoStr(errCode)));
   }
 
-  cookiesLock->insert(pendingCookies.begin(), pendingCookies.end());
+  cookies.outstanding.insert(pendingCookies.begin(), pendingCookies.end());
+}
+
+std::shared_ptr<CookieSync::Cookie> CookieSync::writeNextCookie(
+    Cookies& cookies,
+    bool force,
+    folly::exception_wrapper& error) {
+  if (!cookies.next || (!force && !cookies.outstanding.empty())) {
+    return nullptr;
+  }
+  auto cookie = std::move(cookies.next);
+  try {
+    writeCookies(cookies, cookie, cookiePrefix(), cookies.nextSerial);
+  } catch (const std::system_error&) {
+    error = folly::exception_wrapper(std::current_exception());
+    return cookie;
+  }
+  return nullptr;
+}
 
-  return cookie->promise.getFuture();
+void CookieSync::flushNextCookie() {
+  std::shared_ptr<Cookie> failed;
+  folly::exception_wrapper error;
+  {
+    auto cookies = cookies_.wlock();
+    failed = writeNextCookie(*cookies, true, error);
+  }
+  if (failed) {
+    failed->promise.setException(error);
+  }
 }
 
 void CookieSync::syncToNow(
@@ -139,9 +238,21 @@ void CookieSync::syncToNow(
   auto deadline = system_clock::now() + timeout;
 
   while (true) {
-    auto cookie = sync(cookieFileNames);
+    bool coalesce = coalesceSyncs_.load(std::memory_order_relaxed);
+    auto cookie = syncImpl(cookieFileNames, coalesce);
+
+    auto remaining = timeout;
+    auto maxWait = maxCoalesceWait_.load(std::memory_order_relaxed);
+    if (coalesce && timeout > maxWait) {
+      if (!cookie.wait(maxWait).isReady()) {
+        // An outstanding cookie may have been lost, so rather than waiting
+        // for it to be observed, write the cookie that we're sharing now.
+        flushNextCookie();
+      }
+      remaining -= maxWait;
+    }
 
-    if (!cookie.wait(timeout).isReady()) {
+    if (!cookie.wait(remaining).isReady()) {
       auto why = folly::to<std::string>(
           "syncToNow: timed out waiting for cookie file to be "
           "observed by watcher within ",
@@ -155,6 +266,10 @@ void CookieSync::syncToNow(
       // Success!
       return;
     }
+    if (!cookie.result().exception().is_compatible_with<CookieSyncAborted>()) {
+      // A shared cookie couldn't be written
+      cookie.result().throwUnlessValue();
+    }
 
     // Sync was aborted by a recrawl; recompute the timeout
     // and wait again if we still have time
@@ -166,11 +281,13 @@ void CookieSync::syncToNow(
 }
 
 void CookieSync::abortAllCookies() {
-  std::unordered_map<w_string, std::shared_ptr<Cookie>> cookies;
+  CookieMap cookies;
+  std::shared_ptr<Cookie> next;
 
   {
-    auto map = cookies_.wlock();
-    std::swap(*map, cookies);
+    auto locked = cookies_.wlock();
+    std::swap(locked->outstanding, cookies);
+    next = std::move(locked->next);
   }
 
   for (const auto& [path, cookie] : cookies) {
@@ -182,6 +299,12 @@ void CookieSync::abortAllCookies() {
           folly::make_exception_wrapper<CookieSyncAborted>());
     }
   }
+
+  if (next) {
+    // Its files haven't been written yet
+    next->promise.setException(
+        folly::make_exception_wrapper<CookieSyncAborted>());
+  }
 }
 
 void CookieSync::Cookie::notify() {
@@ -192,20 +315,24 @@ void CookieSync::Cookie::notify() {
 
 void CookieSync::notifyCookie(const w_string& path) {
   std::shared_ptr<Cookie> cookie;
+  std::shared_ptr<Cookie> failed;
+  folly::exception_wrapper error;
 
   {
-    auto map = cookies_.wlock();
-    auto cookie_iter = map->find(path);
+    auto cookies = cookies_.wlock();
+    auto& map = cookies->outstanding;
+    auto cookie_iter = map.find(path);
     log(DBG,
         "cookie for ",
         path,
         "? ",
-        cookie_iter != map->end() ? "yes" : "no",
+        cookie_iter != map.end() ? "yes" : "no",
         "\n");
 
-    if (cookie_iter != map->end()) {
+    if (cookie_iter != map.end()) {
       cookie = std::move(cookie_iter->second);
-      map->erase(cookie_iter);
+      map.erase(cookie_iter);
+      failed = writeNextCookie(*cookies, false, error);
     }
   }
 
@@ -217,6 +344,10 @@ void CookieSync::notifyCookie(const w_string& path) {
     // We don't care about the return code; best effort is fine.
     unlink(path.c_str());
   }
+
+  if (failed) {
+    failed->promise.setException(error);
+  }
 }
 
 bool CookieSync::isCookiePrefix(w_string_piece path) const {
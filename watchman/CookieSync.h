@@ -8,6 +8,7 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
 #include "watchman/Cookie.h"
 #include "watchman/watchman_string.h"
 
@@ -20,6 +21,21 @@ class CookieSync {
   explicit CookieSync(const w_string& dir);
   ~CookieSync();
 
+  /**
+   * When enabled, a syncToNow that starts while another sync's cookie is
+   * still waiting to be observed doesn't write a cookie of its own.  Instead
+   * it shares a single cookie with every other such syncToNow, which is
+   * written once the outstanding cookies have been observed, or after
+   * maxWait, in case an outstanding cookie was lost.
+   */
+  void setCoalesceSyncs(
+      bool coalesce,
+      std::chrono::milliseconds maxWait = std::chrono::milliseconds(100));
+
+  // Returns the number of times that syncToNow has waited for a shared
+  // cookie rather than writing its own
+  uint64_t getCoalescedSyncCount() const;
+
   void setCookieDir(const w_string& dir);
   void addCookieDir(const w_string& dir);
   void removeCookieDir(const w_string& dir);
@@ -84,7 +100,7 @@ class CookieSync {
 
  private:
   struct Cookie {
-    folly::Promise<folly::Unit> promise;
+    folly::SharedPromise<folly::Unit> promise;
     std::atomic<uint64_t> numPending;
 
     explicit Cookie(uint64_t numCookies);
@@ -100,10 +116,52 @@ class CookieSync {
     w_string cookiePrefix_;
   };
 
+  using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
+
+  struct Cookies {
+    // The cookie files that have been written and not yet observed
+    CookieMap outstanding;
+    // When coalescing, the cookie shared by the syncs that are waiting for
+    // the outstanding ones to be observed before it is written, and the
+    // serial number reserved for its files.
+    std::shared_ptr<Cookie> next;
+    uint32_t nextSerial{0};
+  };
+
+  // Like sync, but if coalesce is set and a cookie is outstanding, shares
+  // the next cookie instead of writing one.
+  folly::Future<folly::Unit> syncImpl(
+      std::vector<w_string>& cookieFileNames,
+      bool coalesce);
+
+  // Writes a cookie file with the given serial number to each of the cookie
+  // dirs given by prefixes, and adds them to cookies.outstanding.  Throws
+  // std::system_error if none of them could be written.
+  void writeCookies(
+      Cookies& cookies,
+      const std::shared_ptr<Cookie>& cookie,
+      const std::unordered_set<w_string>& prefixes,
+      uint32_t serial);
+
+  // Writes the next cookie, if there is one and either force is set or
+  // nothing is outstanding.  Returns the cookie, and sets error, if it
+  // couldn't be written; its promise must be completed once the lock on
+  // cookies_ has been released.
+  std::shared_ptr<Cookie> writeNextCookie(
+      Cookies& cookies,
+      bool force,
+      folly::exception_wrapper& error);
+
+  // Writes the next cookie now, even if others are still outstanding
+  void flushNextCookie();
+
   folly::Synchronized<CookieDirectories> cookieDirs_;
   // Serial number for cookie filename
   std::atomic<uint32_t> serial_{0};
-  using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
-  folly::Synchronized<CookieMap> cookies_;
+  std::atomic<bool> coalesceSyncs_{false};
+  std::atomic<std::chrono::milliseconds> maxCoalesceWait_{
+      std::chrono::milliseconds(100)};
+  std::atomic<uint64_t> coalescedSyncs_{0};
+  folly::Synchronized<Cookies> cookies_;
 };
 } // namespace watchman
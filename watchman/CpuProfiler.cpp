@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CpuProfiler.h"
+#include <folly/Demangle.h>
+#include <folly/ScopeGuard.h>
+#include <folly/experimental/symbolizer/Symbolizer.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include "watchman/Logging.h"
+#include "watchman/watchman_system.h"
+
+#if defined(HAVE_BACKTRACE) && !defined(_WIN32)
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace watchman {
+
+#if defined(HAVE_BACKTRACE) && !defined(_WIN32)
+
+namespace {
+
+constexpr size_t kMaxFrames = 64;
+// The signal handler and the trampoline that called it
+constexpr size_t kHandlerFrames = 2;
+// Bounds the memory that a profile takes, at about 520 bytes per sample
+constexpr size_t kMaxSamples = 32768;
+
+struct Sample {
+  std::thread::id thread;
+  size_t numFrames;
+  void* frames[kMaxFrames];
+};
+
+struct SampleBuffer {
+  explicit SampleBuffer(size_t capacity) : samples(capacity) {}
+
+  std::vector<Sample> samples;
+  // The index of the next sample to take; may run past the end
+  std::atomic<size_t> next{0};
+};
+
+std::atomic<bool> profiling{false};
+std::atomic<SampleBuffer*> activeBuffer{nullptr};
+// The handlers that may have seen activeBuffer before it was cleared
+std::atomic<int> handlersRunning{0};
+
+void onProfilingSignal(int) {
+  auto savedErrno = errno;
+  handlersRunning.fetch_add(1);
+  if (auto buffer = activeBuffer.load()) {
+    auto index = buffer->next.fetch_add(1, std::memory_order_relaxed);
+    if (index < buffer->samples.size()) {
+      auto& sample = buffer->samples[index];
+      sample.thread = std::this_thread::get_id();
+      sample.numFrames = backtrace(sample.frames, kMaxFrames);
+    }
+  }
+  handlersRunning.fetch_sub(1);
+  errno = savedErrno;
+}
+
+// Folded stacks separate frames with ';' and the count with a space
+std::string foldable(std::string name) {
+  std::replace(name.begin(), name.end(), ';', ':');
+  return name;
+}
+
+class FrameNames {
+ public:
+  // frame is the address of the instruction that was interrupted when
+  // `interrupted`, and otherwise a return address
+  const std::string& nameOf(void* frame, bool interrupted) {
+    // A return address follows the call, which may be the last instruction
+    // of the function; the call itself is in the right one
+    auto address = uintptr_t(frame) - (interrupted ? 0 : 1);
+    auto it = names_.find(address);
+    if (it == names_.end()) {
+      it = names_.emplace(address, foldable(lookup(address))).first;
+    }
+    return it->second;
+  }
+
+ private:
+  std::string lookup(uintptr_t address) {
+#if FOLLY_HAVE_ELF && FOLLY_HAVE_DWARF
+    // Finds the symbols that aren't exported too
+    folly::symbolizer::SymbolizedFrame symbolized;
+    if (symbolizer_.symbolize(address, symbolized) && symbolized.name) {
+      return folly::demangle(symbolized.name).toStdString();
+    }
+#endif
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(address), &info)) {
+      if (info.dli_sname) {
+        return folly::demangle(info.dli_sname).toStdString();
+      }
+      if (info.dli_fname) {
+        // The object and offset at least tell the frames apart
+        std::ostringstream name;
+        name << info.dli_fname << "+0x" << std::hex
+             << (address - uintptr_t(info.dli_fbase));
+        return name.str();
+      }
+    }
+    std::ostringstream name;
+    name << "0x" << std::hex << address;
+    return name.str();
+  }
+
+#if FOLLY_HAVE_ELF && FOLLY_HAVE_DWARF
+  folly::symbolizer::Symbolizer symbolizer_{
+      folly::symbolizer::LocationInfoMode::DISABLED};
+#endif
+  std::unordered_map<uintptr_t, std::string> names_;
+};
+
+CpuProfile fold(const SampleBuffer& buffer) {
+  CpuProfile profile;
+  auto numTaken = buffer.next.load();
+  profile.samples = std::min(numTaken, buffer.samples.size());
+  profile.dropped = numTaken - profile.samples;
+
+  auto threadNames = Log::getThreadNames();
+  FrameNames frameNames;
+  std::map<std::string, size_t> counts;
+  for (size_t i = 0; i < profile.samples; ++i) {
+    auto& sample = buffer.samples[i];
+
+    std::string stack;
+    auto it = threadNames.find(sample.thread);
+    if (it != threadNames.end()) {
+      stack = foldable(it->second);
+    } else {
+      std::ostringstream name;
+      name << "thread-" << sample.thread;
+      stack = name.str();
+    }
+    // backtrace() lists the innermost frame first
+    for (size_t frame = sample.numFrames; frame > kHandlerFrames; --frame) {
+      stack.push_back(';');
+      stack.append(frameNames.nameOf(
+          sample.frames[frame - 1], frame - 1 == kHandlerFrames));
+    }
+    ++counts[stack];
+  }
+
+  profile.folded.reserve(counts.size());
+  for (auto& [stack, count] : counts) {
+    profile.folded.push_back(stack + " " + std::to_string(count));
+  }
+  return profile;
+}
+
+void installHandler() {
+  // Installed once and for all: a signal may still be pending when a
+  // profile stops, and SIGPROF would otherwise terminate the process
+  static bool installed = [] {
+    // The first call may load the unwinder, which isn't safe to do from
+    // within a signal handler
+    void* warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onProfilingSignal;
+    // The signal lands on whichever thread is running, which may be in the
+    // middle of a system call
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0) {
+      throw std::system_error(errno, std::generic_category(), "sigaction");
+    }
+    return true;
+  }();
+  (void)installed;
+}
+
+} // namespace
+
+CpuProfile profileCpu(std::chrono::milliseconds duration, uint32_t frequency) {
+  if (frequency == 0 || frequency > 1000000) {
+    throw std::runtime_error("profiling frequency must be within 1..1000000");
+  }
+  if (profiling.exchange(true)) {
+    throw std::runtime_error("a CPU profile is already being taken");
+  }
+  SCOPE_EXIT {
+    profiling = false;
+  };
+  installHandler();
+
+  // Every thread may be sampled at the full frequency
+  auto expected = uint64_t(duration.count()) * frequency / 1000 *
+      std::max(1u, std::thread::hardware_concurrency());
+  SampleBuffer buffer{size_t(std::min<uint64_t>(expected + 1, kMaxSamples))};
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  auto interval = 1000000 / frequency;
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value = timer.it_interval;
+
+  activeBuffer = &buffer;
+  {
+    SCOPE_EXIT {
+      struct itimerval stopped;
+      memset(&stopped, 0, sizeof(stopped));
+      setitimer(ITIMER_PROF, &stopped, nullptr);
+      // A handler that saw the buffer before this may still be writing to
+      // it
+      activeBuffer = nullptr;
+      while (handlersRunning.load() != 0) {
+        std::this_thread::yield();
+      }
+    };
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+      throw std::system_error(errno, std::generic_category(), "setitimer");
+    }
+    std::this_thread::sleep_for(duration);
+  }
+
+  return fold(buffer);
+}
+
+#else
+
+CpuProfile profileCpu(std::chrono::milliseconds, uint32_t) {
+  throw std::runtime_error("CPU profiling is not supported on this platform");
+}
+
+#endif
+
+} // namespace watchman
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace watchman {
+
+struct CpuProfile {
+  // One line per distinct stack, in the folded format that flame graph
+  // tools read: the name of the thread and then the frames from the
+  // outermost in, separated by ';', then a space and the number of samples
+  // of that stack.  Sorted.
+  std::vector<std::string> folded;
+  size_t samples{0};
+  // Samples that didn't fit in the buffer and were discarded
+  size_t dropped{0};
+};
+
+/**
+ * Samples the stacks of the threads of this process for `duration`, from
+ * within the process, so that a profile can be had without attaching perf
+ * and the privileges that takes.  Blocks the calling thread meanwhile.
+ *
+ * The samples are taken `frequency` times for each second of CPU time
+ * that the process uses: ITIMER_PROF sends SIGPROF to whichever thread is
+ * running as each interval of it elapses.  The threads are thus sampled in
+ * proportion to the CPU that they use, and idle ones not at all.  The
+ * signal handler only records the thread and the return addresses of its
+ * stack; they are symbolized once sampling has stopped.  Threads are named
+ * by what they last passed to w_set_thread_name().
+ *
+ * Only one profile may be taken at a time.  Throws std::runtime_error if
+ * another is being taken, or if the platform doesn't support profiling.
+ */
+CpuProfile profileCpu(std::chrono::milliseconds duration, uint32_t frequency);
+
+} // namespace watchman
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlHeat.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+using Entry = std::pair<w_string, uint32_t>;
+
+// How many touches per path of capacity pass between halvings
+constexpr size_t kTouchesPerDecay = 8;
+
+// Hottest first, then by name so that the order is stable
+bool hotter(const Entry& a, const Entry& b) {
+  if (a.second != b.second) {
+    return a.second > b.second;
+  }
+  return a.first < b.first;
+}
+
+std::vector<Entry> sortedEntries(
+    const std::unordered_map<w_string, uint32_t>& heat) {
+  std::vector<Entry> entries(heat.begin(), heat.end());
+  std::sort(entries.begin(), entries.end(), hotter);
+  return entries;
+}
+
+} // namespace
+
+CrawlHeat::CrawlHeat(size_t capacity) : capacity_{capacity} {}
+
+void CrawlHeat::touch(const w_string& path) {
+  if (capacity_ == 0) {
+    return;
+  }
+  auto state = state_.wlock();
+  if (++state->touches >= capacity_ * kTouchesPerDecay) {
+    state->touches = 0;
+    for (auto it = state->heat.begin(); it != state->heat.end();) {
+      it->second /= 2;
+      if (it->second == 0) {
+        it = state->heat.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  ++state->heat[path];
+  trim(*state, &path);
+}
+
+void CrawlHeat::trim(State& state, const w_string* keep) const {
+  while (state.heat.size() > capacity_) {
+    auto coldest = state.heat.end();
+    for (auto it = state.heat.begin(); it != state.heat.end(); ++it) {
+      if ((keep && it->first == *keep) ||
+          (coldest != state.heat.end() && !hotter(*coldest, *it))) {
+        continue;
+      }
+      coldest = it;
+    }
+    state.heat.erase(coldest);
+  }
+}
+
+std::vector<w_string> CrawlHeat::hottest() const {
+  std::vector<w_string> result;
+  for (auto& entry : sortedEntries(state_.rlock()->heat)) {
+    result.push_back(std::move(entry.first));
+  }
+  return result;
+}
+
+json_ref CrawlHeat::toJson() const {
+  auto result = json_array();
+  for (auto& [path, heat] : sortedEntries(state_.rlock()->heat)) {
+    json_array_append_new(
+        result, json_array({w_string_to_json(path), json_integer(heat)}));
+  }
+  return result;
+}
+
+void CrawlHeat::load(const json_ref& heat) {
+  if (capacity_ == 0 || !heat || !heat.isArray()) {
+    return;
+  }
+  auto state = state_.wlock();
+  for (auto& item : heat.array()) {
+    if (!item.isArray() || item.array().size() != 2 ||
+        !item.at(0).isString() || !item.at(1).isInt() ||
+        item.at(1).asInt() <= 0) {
+      continue;
+    }
+    auto& value = state->heat[item.at(0).asString()];
+    value = std::max(
+        value,
+        uint32_t(std::min<json_int_t>(item.at(1).asInt(), UINT32_MAX)));
+  }
+  trim(*state, nullptr);
+}
+
+} // namespace watchman
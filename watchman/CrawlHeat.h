@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers which parts of a root its queries are restricted to, so that
+ * the crawl that follows a restart or a recrawl can index them before the
+ * rest of the tree.
+ *
+ * Paths are relative to the root.  Each query adds one to the heat of each
+ * of its paths, and after every eight times `capacity` of these all the
+ * heat is halved, so that the map follows the queries as they change.
+ * Beyond `capacity` paths, the coldest are forgotten.  The map is kept in
+ * the state file along with its root.
+ *
+ * Thread safe.
+ */
+class CrawlHeat {
+ public:
+  // A capacity of 0 disables the map
+  explicit CrawlHeat(size_t capacity);
+
+  void touch(const w_string& path);
+
+  // The known paths, hottest first
+  std::vector<w_string> hottest() const;
+
+  // The state file form: an array of [path, heat] pairs, hottest first
+  json_ref toJson() const;
+
+  // Merges in what toJson() returned, skipping anything malformed
+  void load(const json_ref& heat);
+
+ private:
+  struct State {
+    std::unordered_map<w_string, uint32_t> heat;
+    size_t touches{0};
+  };
+
+  // Forgets the coldest paths, other than `keep`, beyond the capacity
+  void trim(State& state, const w_string* keep) const;
+
+  const size_t capacity_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlProfile.h"
+#include <algorithm>
+#include "watchman/watchman_dir.h"
+
+namespace watchman {
+
+namespace {
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+json_ref entriesToJson(
+    const std::vector<CrawlProfileEntry>& entries,
+    size_t limit) {
+  auto result = json_array();
+  for (size_t i = 0; i < entries.size() && i < limit; ++i) {
+    json_array_append_new(result, entries[i].toJson());
+  }
+  return result;
+}
+
+} // namespace
+
+json_ref CrawlProfileEntry::toJson() const {
+  return json_object({
+      {"path", w_string_to_json(path)},
+      {"readdir_us", json_integer(readTime.count())},
+      {"stat_us", json_integer(statTime.count())},
+      {"entries", json_integer(entries)},
+      {"subtree_us", json_integer(subtreeTime.count())},
+      {"subtree_entries", json_integer(subtreeEntries)},
+      {"subtree_dirs", json_integer(subtreeDirs)},
+  });
+}
+
+json_ref CrawlProfileReport::toJson(size_t limit) const {
+  return json_object({
+      {"started",
+       json_integer(std::chrono::system_clock::to_time_t(started))},
+      {"duration_ms", json_integer(duration.count())},
+      {"dirs", json_integer(numDirs)},
+      {"entries", json_integer(numEntries)},
+      {"slowest_subtrees", entriesToJson(slowestSubtrees, limit)},
+      {"slowest_dirs", entriesToJson(slowestDirs, limit)},
+      {"largest_dirs", entriesToJson(largestDirs, limit)},
+  });
+}
+
+CrawlProfiler::CrawlProfiler()
+    : started_{std::chrono::system_clock::now()}, start_{Clock::now()} {}
+
+void CrawlProfiler::record(
+    const watchman_dir* dir,
+    Clock::duration readTime,
+    Clock::duration statTime,
+    size_t entries) {
+  auto& cost = dirs_[dir];
+  cost.readTime += readTime;
+  cost.statTime += statTime;
+  cost.entries += entries;
+}
+
+CrawlProfileReport CrawlProfiler::finish(
+    const w_string& rootPath,
+    size_t topN) {
+  CrawlProfileReport report;
+  report.started = started_;
+  report.duration =
+      duration_cast<std::chrono::milliseconds>(Clock::now() - start_);
+  report.numDirs = dirs_.size();
+
+  // Add each dir's own cost to it and to each of its recorded ancestors
+  for (auto& [dir, cost] : dirs_) {
+    report.numEntries += cost.entries;
+    auto time = cost.readTime + cost.statTime;
+    for (auto node = dir; node; node = node->parent) {
+      auto it = dirs_.find(node);
+      if (it != dirs_.end()) {
+        it->second.subtreeTime += time;
+        it->second.subtreeEntries += cost.entries;
+        ++it->second.subtreeDirs;
+      }
+    }
+  }
+
+  using Item = std::pair<const watchman_dir*, const Cost*>;
+  std::vector<Item> items;
+  items.reserve(dirs_.size());
+  for (auto& [dir, cost] : dirs_) {
+    items.emplace_back(dir, &cost);
+  }
+
+  auto top = [&](auto key) {
+    auto n = std::min(topN, items.size());
+    std::partial_sort(
+        items.begin(),
+        items.begin() + n,
+        items.end(),
+        [&](const Item& a, const Item& b) {
+          return key(*a.second) > key(*b.second);
+        });
+
+    std::vector<CrawlProfileEntry> result;
+    result.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      auto& [dir, cost] = items[i];
+      CrawlProfileEntry entry;
+      auto fullPath = dir->getFullPath();
+      if (fullPath.size() > rootPath.size()) {
+        entry.path = w_string_piece(
+                         fullPath.data() + rootPath.size() + 1,
+                         fullPath.size() - rootPath.size() - 1)
+                         .asWString();
+      }
+      entry.readTime = duration_cast<microseconds>(cost->readTime);
+      entry.statTime = duration_cast<microseconds>(cost->statTime);
+      entry.entries = cost->entries;
+      entry.subtreeTime = duration_cast<microseconds>(cost->subtreeTime);
+      entry.subtreeEntries = cost->subtreeEntries;
+      entry.subtreeDirs = cost->subtreeDirs;
+      result.push_back(std::move(entry));
+    }
+    return result;
+  };
+
+  report.slowestSubtrees = top([](const Cost& c) { return c.subtreeTime; });
+  report.slowestDirs =
+      top([](const Cost& c) { return c.readTime + c.statTime; });
+  report.largestDirs = top([](const Cost& c) { return c.entries; });
+  return report;
+}
+
+} // namespace watchman
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+struct watchman_dir;
+
+namespace watchman {
+
+// What it cost to crawl one dir, and the dirs below it
+struct CrawlProfileEntry {
+  // Relative to the root; empty for the root itself
+  w_string path;
+  // Opening and reading the dir
+  std::chrono::microseconds readTime{0};
+  // Stat'ing its entries and adding them to the view
+  std::chrono::microseconds statTime{0};
+  uint64_t entries{0};
+  // readTime and statTime, summed over the dir and every dir below it
+  std::chrono::microseconds subtreeTime{0};
+  uint64_t subtreeEntries{0};
+  uint64_t subtreeDirs{0};
+
+  json_ref toJson() const;
+};
+
+struct CrawlProfileReport {
+  std::chrono::system_clock::time_point started;
+  std::chrono::milliseconds duration{0};
+  uint64_t numDirs{0};
+  uint64_t numEntries{0};
+  // Up to the requested number of dirs, by subtreeTime, by their own
+  // readTime + statTime, and by entries
+  std::vector<CrawlProfileEntry> slowestSubtrees;
+  std::vector<CrawlProfileEntry> slowestDirs;
+  std::vector<CrawlProfileEntry> largestDirs;
+
+  // Includes at most `limit` dirs of each list
+  json_ref toJson(size_t limit) const;
+};
+
+/**
+ * Collects the cost of each dir that a full crawl reads, so that the dirs
+ * that make a crawl slow can be found and ignored or fixed.
+ *
+ * The dirs are only identified by their nodes until finish(), so recording
+ * a dir costs no allocation beyond its map entry.  The nodes must therefore
+ * outlive the profiler, which holds for a crawl since it holds the view
+ * lock throughout.
+ *
+ * Not thread safe.
+ */
+class CrawlProfiler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  CrawlProfiler();
+
+  // Adds to the cost of crawling dir, which may be crawled more than once
+  void record(
+      const watchman_dir* dir,
+      Clock::duration readTime,
+      Clock::duration statTime,
+      size_t entries);
+
+  // Sums up the subtrees and picks out the topN dirs of each list.  The
+  // paths are made relative to rootPath.
+  CrawlProfileReport finish(const w_string& rootPath, size_t topN);
+
+ private:
+  struct Cost {
+    Clock::duration readTime{0};
+    Clock::duration statTime{0};
+    uint64_t entries{0};
+    Clock::duration subtreeTime{0};
+    uint64_t subtreeEntries{0};
+    uint64_t subtreeDirs{0};
+  };
+
+  std::chrono::system_clock::time_point started_;
+  Clock::time_point start_;
+  std::unordered_map<const watchman_dir*, Cost> dirs_;
+};
+
+} // namespace watchman
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CursorMap.h"
+#include <folly/hash/Hash.h>
+
+namespace watchman {
+
+CursorMap::CursorMap(std::chrono::seconds ttl) : ttl_(ttl) {}
+
+CursorMap::Shard& CursorMap::shardFor(const w_string& name) {
+  // Mix the hash so that the shard isn't picked by the same low bits
+  // that pick the bucket in the shard's map.
+  return shards_
+      [folly::hash::twang_mix64(std::hash<w_string>()(name)) % kNumShards];
+}
+
+void CursorMap::sweep(
+    State& state,
+    uint32_t minTicks,
+    std::chrono::steady_clock::time_point now) const {
+  auto it = state.cursors.begin();
+  while (it != state.cursors.end()) {
+    if (it->second.ticks < minTicks ||
+        (ttl_.count() > 0 && it->second.lastUsed + ttl_ <= now)) {
+      it = state.cursors.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::optional<uint32_t> CursorMap::exchange(
+    const w_string& name,
+    uint32_t ticks,
+    std::chrono::steady_clock::time_point now) {
+  auto state = shardFor(name).state.wlock();
+
+  // Sweeping at most once per ttl keeps the cost of expiry proportional
+  // to the use of the shard, without a thread of its own.
+  if (ttl_.count() > 0 && now >= state->nextSweep) {
+    sweep(*state, 0, now);
+    state->nextSweep = now + ttl_;
+  }
+
+  std::optional<uint32_t> previous;
+  auto [it, inserted] = state->cursors.try_emplace(name, Entry{ticks, now});
+  if (!inserted) {
+    previous = it->second.ticks;
+    it->second = Entry{ticks, now};
+  }
+  return previous;
+}
+
+void CursorMap::expire(
+    uint32_t minTicks,
+    std::chrono::steady_clock::time_point now) {
+  for (auto& shard : shards_) {
+    sweep(*shard.state.wlock(), minTicks, now);
+  }
+}
+
+std::vector<std::pair<w_string, uint32_t>> CursorMap::snapshot() const {
+  std::vector<std::pair<w_string, uint32_t>> result;
+  for (auto& shard : shards_) {
+    auto state = shard.state.rlock();
+    for (auto& [name, entry] : state->cursors) {
+      result.emplace_back(name, entry.ticks);
+    }
+  }
+  return result;
+}
+
+size_t CursorMap::size() const {
+  size_t size = 0;
+  for (auto& shard : shards_) {
+    size += shard.state.rlock()->cursors.size();
+  }
+  return size;
+}
+
+} // namespace watchman
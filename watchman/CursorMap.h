@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Maps the named cursors of a root to the tick that each last observed.
+ *
+ * The map is split into shards by name, so that queries using different
+ * cursors don't wait for each other.  Queries using the same cursor are
+ * still serialized, as each must see the tick that the previous one left.
+ *
+ * A cursor that hasn't been used for `ttl` is forgotten, so that cursors
+ * with one-off names can't accumulate.  Using a forgotten cursor produces
+ * a fresh instance result, just as it does once the cursor is aged out.
+ *
+ * Thread safe.
+ */
+class CursorMap {
+ public:
+  // A ttl of 0 keeps cursors until they are aged out
+  explicit CursorMap(std::chrono::seconds ttl = std::chrono::seconds(0));
+
+  // Records ticks against name, returning the ticks recorded by its
+  // previous use
+  std::optional<uint32_t> exchange(
+      const w_string& name,
+      uint32_t ticks,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+
+  // Forgets the cursors that last observed a tick before minTicks, and
+  // those that have outlived the ttl as of now
+  void expire(
+      uint32_t minTicks,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+
+  std::vector<std::pair<w_string, uint32_t>> snapshot() const;
+
+  size_t size() const;
+
+ private:
+  static constexpr size_t kNumShards = 16;
+
+  struct Entry {
+    uint32_t ticks;
+    std::chrono::steady_clock::time_point lastUsed;
+  };
+  struct State {
+    std::unordered_map<w_string, Entry> cursors;
+    // When exchange() next sweeps the shard for cursors past the ttl
+    std::chrono::steady_clock::time_point nextSweep;
+  };
+  struct alignas(64) Shard {
+    folly::Synchronized<State> state;
+  };
+
+  Shard& shardFor(const w_string& name);
+  void sweep(
+      State& state,
+      uint32_t minTicks,
+      std::chrono::steady_clock::time_point now) const;
+
+  const std::chrono::seconds ttl_;
+  std::array<Shard, kNumShards> shards_;
+};
+
+} // namespace watchman
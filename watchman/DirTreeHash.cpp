@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/DirTreeHash.h"
+#include <algorithm>
+#include <string>
+
+namespace watchman {
+
+DirTreeHashes::Digest DirTreeHashes::combine(std::vector<Entry>& entries) {
+  std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+    return a.name.view() < b.name.view();
+  });
+
+  std::string buf;
+  for (auto& entry : entries) {
+    buf.push_back(entry.type);
+    buf.append(entry.name.view());
+    buf.push_back('\0');
+    buf.append(
+        reinterpret_cast<const char*>(entry.digest.data()),
+        entry.digest.size());
+  }
+  return ContentHashCache::computeSha1(buf.data(), buf.size());
+}
+
+std::optional<Result<DirTreeHashes::Digest>> DirTreeHashes::get(
+    const w_string& fullPath) const {
+  auto digests = digests_.rlock();
+  auto it = digests->find(fullPath);
+  if (it == digests->end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+void DirTreeHashes::set(const w_string& fullPath, Result<Digest> digest) {
+  digests_.wlock()->insert_or_assign(fullPath, std::move(digest));
+}
+
+void DirTreeHashes::erase(const w_string& fullPath) {
+  digests_.wlock()->erase(fullPath);
+}
+
+size_t DirTreeHashes::size() const {
+  return digests_.rlock()->size();
+}
+
+} // namespace watchman
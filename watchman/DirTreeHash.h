@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/ContentHash.h"
+#include "watchman/Result.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The content.treesha1hex digests of the dirs of a view, keyed by their full
+ * paths.
+ *
+ * The digest of a dir is the SHA-1 of an entry for each of its children that
+ * exists, in order of name.  An entry is a type letter, the name, a NUL and
+ * the 20 bytes of the child's digest: 'f' for a regular file, or 'x' if it is
+ * executable, with the SHA-1 of its content; 'l' for a symlink, with the
+ * SHA-1 of its target; and 'd' for a dir, with its own digest.  Other kinds
+ * of file are left out.
+ *
+ * The view computes digests bottom up, reusing those of the dirs that haven't
+ * changed since, and drops the digests of the dirs above a file when it
+ * changes.  The digests are guarded by a lock of their own rather than the
+ * view's so that results can look them up without holding the view lock.
+ */
+class DirTreeHashes {
+ public:
+  using Digest = ContentHashCache::HashValue;
+
+  struct Entry {
+    char type;
+    w_string_piece name;
+    Digest digest;
+  };
+
+  // Returns the digest of a dir with the given children, in any order
+  static Digest combine(std::vector<Entry>& entries);
+
+  // Returns the digest of the dir at fullPath, or the error that prevented
+  // its computation, or nullopt if it hasn't been computed since the dir
+  // last changed
+  std::optional<Result<Digest>> get(const w_string& fullPath) const;
+
+  void set(const w_string& fullPath, Result<Digest> digest);
+  void erase(const w_string& fullPath);
+
+  // Returns the number of dirs with a digest or an error
+  size_t size() const;
+
+ private:
+  folly::Synchronized<std::unordered_map<w_string, Result<Digest>>> digests_;
+};
+
+} // namespace watchman
@@ -105,6 +105,19 @@ class CommandValidationError : public std::runtime_error {
             std::forward<Args>(args)...)) {}
 };
 
+/**
+ * A command was turned away because the server is too busy to run it now.
+ * The client should back off and retry.
+ */
+class CommandOverloadedError : public std::runtime_error {
+ public:
+  template <typename... Args>
+  explicit CommandOverloadedError(Args&&... args)
+      : std::runtime_error(folly::to<std::string>(
+            "server overloaded, retry later: ",
+            std::forward<Args>(args)...)) {}
+};
+
 /**
  * Represents an error parsing a query.
  */
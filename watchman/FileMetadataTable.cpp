@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/FileMetadataTable.h"
+#include <algorithm>
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+uint32_t FileMetadataTable::add(watchman_file* file) {
+  uint32_t id;
+  if (!freeIds_.empty()) {
+    id = freeIds_.back();
+    freeIds_.pop_back();
+    files_[id] = file;
+  } else {
+    id = uint32_t(files_.size());
+    files_.push_back(file);
+    exists_.push_back(0);
+    types_.push_back(uint8_t(DType::Unknown));
+    otimeTicks_.push_back(0);
+    mtimes_.push_back(0);
+    sizes_.push_back(0);
+  }
+  update(id, *file);
+  return id;
+}
+
+void FileMetadataTable::remove(uint32_t id) {
+  files_[id] = nullptr;
+  exists_[id] = 0;
+  types_[id] = uint8_t(DType::Unknown);
+  freeIds_.push_back(id);
+}
+
+void FileMetadataTable::update(uint32_t id, const watchman_file& file) {
+  exists_[id] = file.exists ? 1 : 0;
+  types_[id] = uint8_t(file.stat.dtype());
+  otimeTicks_[id] = file.otime.ticks;
+  mtimes_[id] = file.stat.mtimeSec;
+  sizes_[id] = int64_t(file.stat.size);
+}
+
+void FileMetadataTable::matchBlock(
+    const MetadataFilter& filter,
+    size_t begin,
+    std::vector<uint32_t>& ids) const {
+  auto n = std::min(kBlockSize, files_.size() - begin);
+
+  // One byte per row, cleared as each bound rules rows out.  Each of the
+  // loops reads a single array with no branches, which compilers vectorize.
+  uint8_t pass[kBlockSize];
+  auto files = files_.data() + begin;
+  for (size_t i = 0; i < n; ++i) {
+    pass[i] = files[i] != nullptr;
+  }
+  if (filter.existing) {
+    auto exists = exists_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= exists[i];
+    }
+  }
+  if (filter.type) {
+    auto type = uint8_t(*filter.type);
+    auto types = types_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= uint8_t(types[i] == type);
+    }
+  }
+  if (filter.changedAfterTicks) {
+    auto after = *filter.changedAfterTicks;
+    auto ticks = otimeTicks_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= uint8_t(ticks[i] > after);
+    }
+  }
+  if (filter.modifiedSince) {
+    auto since = *filter.modifiedSince;
+    auto mtimes = mtimes_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= uint8_t(mtimes[i] >= since);
+    }
+  }
+  if (filter.minSize) {
+    auto minSize = *filter.minSize;
+    auto sizes = sizes_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= uint8_t(sizes[i] >= minSize);
+    }
+  }
+  if (filter.maxSize) {
+    auto maxSize = *filter.maxSize;
+    auto sizes = sizes_.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+      pass[i] &= uint8_t(sizes[i] <= maxSize);
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (pass[i]) {
+      ids.push_back(uint32_t(begin + i));
+    }
+  }
+}
+
+size_t FileMetadataTable::getMemoryBytes() const {
+  return files_.capacity() * sizeof(watchman_file*) + exists_.capacity() +
+      types_.capacity() + otimeTicks_.capacity() * sizeof(uint32_t) +
+      mtimes_.capacity() * sizeof(int64_t) +
+      sizes_.capacity() * sizeof(int64_t) +
+      freeIds_.capacity() * sizeof(uint32_t);
+}
+
+} // namespace watchman
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "watchman/query/QueryExpr.h"
+
+struct watchman_file;
+
+namespace watchman {
+
+/**
+ * A dense copy of the metadata that queries most often filter on, kept in
+ * one array per field and indexed by a file id that the table assigns.
+ *
+ * Checking a MetadataFilter against every file of a large root by walking
+ * the file nodes pulls each node, with its list links, name and stat,
+ * through the cache.  Scanning these arrays touches a few bytes per file,
+ * in order, and lends itself to vectorization; only the files that pass
+ * are visited.
+ *
+ * The ViewDatabase keeps the rows up to date as it records stat results and
+ * changes, and each file removes its row when it is destroyed.
+ *
+ * Thread safety: like the ViewDatabase, the table must only be modified
+ * while holding the view's write lock, and only scanned while holding it
+ * for reading.
+ */
+class FileMetadataTable {
+ public:
+  FileMetadataTable() = default;
+  FileMetadataTable(const FileMetadataTable&) = delete;
+  FileMetadataTable& operator=(const FileMetadataTable&) = delete;
+
+  // Assigns file a row, initialized from its current metadata, and returns
+  // the id of that row
+  uint32_t add(watchman_file* file);
+
+  // Frees the row with the given id, which may then be reused
+  void remove(uint32_t id);
+
+  // Copies the metadata of file into the row with the given id
+  void update(uint32_t id, const watchman_file& file);
+
+  /**
+   * Calls func with each file whose metadata is within the bounds of
+   * filter, in no particular order.  Deleted files that have not yet been
+   * aged out are included unless the filter requires existing files.  The
+   * bounds on metadata that the table doesn't keep, such as the otime
+   * timestamp and the ctime, are left to the expression to check.
+   */
+  template <typename Func>
+  void scan(const MetadataFilter& filter, Func&& func) const {
+    if (filter.matchesNothing) {
+      return;
+    }
+    std::vector<uint32_t> ids;
+    for (size_t begin = 0; begin < files_.size(); begin += kBlockSize) {
+      ids.clear();
+      matchBlock(filter, begin, ids);
+      for (auto id : ids) {
+        func(files_[id]);
+      }
+    }
+  }
+
+  // The number of files in the table
+  size_t size() const {
+    return files_.size() - freeIds_.size();
+  }
+
+  // The bytes held by the arrays
+  size_t getMemoryBytes() const;
+
+ private:
+  // The number of rows whose bounds are checked together, before any of
+  // the files that pass are visited
+  static constexpr size_t kBlockSize = 1024;
+
+  // Appends to ids those of the rows in [begin, begin + kBlockSize) that
+  // are within the bounds of filter
+  void matchBlock(
+      const MetadataFilter& filter,
+      size_t begin,
+      std::vector<uint32_t>& ids) const;
+
+  // Null for free rows
+  std::vector<watchman_file*> files_;
+  // 1 if the file exists; free rows are 0
+  std::vector<uint8_t> exists_;
+  // The DType of the file; free rows are DType::Unknown
+  std::vector<uint8_t> types_;
+  std::vector<uint32_t> otimeTicks_;
+  std::vector<int64_t> mtimes_;
+  std::vector<int64_t> sizes_;
+  std::vector<uint32_t> freeIds_;
+};
+
+} // namespace watchman
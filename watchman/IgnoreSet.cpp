@@ -6,6 +6,8 @@
  */
 
 #include "watchman/IgnoreSet.h"
+#include <algorithm>
+#include <cstring>
 
 // The path and everything below it is ignored.
 #define FULL_IGNORE 0x1
@@ -15,83 +17,83 @@
 
 namespace watchman {
 
-void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
-  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(path);
-
-  tree.insert(path, is_vcs_ignore ? VCS_IGNORE : FULL_IGNORE);
+namespace {
 
-  if (!is_vcs_ignore) {
-    dirs_vec.push_back(path);
+// Returns the first path component at or after cursor, skipping any leading
+// separators.  The result is empty if there are no more components.
+w_string_piece nextComponent(const char* cursor, const char* end) {
+  while (cursor < end && is_slash(*cursor)) {
+    ++cursor;
   }
+  auto component = cursor;
+  while (cursor < end && !is_slash(*cursor)) {
+    ++cursor;
+  }
+  return w_string_piece(component, cursor - component);
 }
 
-bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
-  const char* skip_prefix;
-  uint32_t len;
-  auto leaf = tree.longestMatch((const unsigned char*)path, (int)pathlen);
-
-  if (!leaf) {
-    // No entry -> not ignored.
-    return false;
-  }
+bool containsSlash(const char* cursor, const char* end) {
+#ifndef _WIN32
+  return memchr(cursor, '/', end - cursor) != nullptr;
+#else
+  // On windows, both '/' and '\' are possible.
+  return std::find_if(cursor, end, is_slash) != end;
+#endif
+}
 
-  if (pathlen < leaf->key.size()) {
-    // We wanted "buil" but matched "build"
-    return false;
-  }
+} // namespace
 
-  if (pathlen == leaf->key.size()) {
-    // Exact match.  This is an ignore if we are in FULL_IGNORE,
-    // but not in VCS_IGNORE mode.
-    return leaf->value == FULL_IGNORE ? true : false;
-  }
+void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
+  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(path);
 
-  // Our input string was longer than the leaf key string.
-  // We need to ensure that we observe a directory separator at the
-  // character after the common prefix, otherwise we may be falsely
-  // matching a sibling entry.
-  skip_prefix = path + leaf->key.size();
-  len = pathlen - leaf->key.size();
-
-  if (!is_slash(*skip_prefix)) {
-    // we wanted "foo/bar" but we matched something like "food"
-    // this is not an ignore situation.
-    return false;
+  auto node = &trie_;
+  auto end = path.data() + path.size();
+  for (auto component = nextComponent(path.data(), end); !component.empty();
+       component = nextComponent(component.data() + component.size(), end)) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      auto child = std::make_unique<Node>();
+      child->name = w_string{component.data(), component.size()};
+      w_string_piece key{child->name};
+      it = node->children.emplace(key, std::move(child)).first;
+    }
+    node = it->second.get();
   }
+  node->flags |= is_vcs_ignore ? VCS_IGNORE : FULL_IGNORE;
 
-  if (leaf->value == FULL_IGNORE) {
-    // Definitely ignoring this portion of the tree
-    return true;
+  if (!is_vcs_ignore) {
+    dirs_vec.push_back(path);
   }
+}
 
-  // we need to apply vcs_ignore style logic to determine if we are ignoring
-  // this path.  This devolves to: "is there a '/' character after the end of
-  // the leaf key prefix?"
-
-  if (pathlen <= leaf->key.size()) {
-    // There can't be a slash after this portion of the tree, therefore
-    // this is not ignored.
-    return false;
-  }
+bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
+  auto node = &trie_;
+  auto end = path + pathlen;
+  for (auto component = nextComponent(path, end); !component.empty();) {
+    auto it = node->children.find(component);
+    if (it == node->children.end()) {
+      // No entry covers this path
+      return false;
+    }
+    node = it->second.get();
+    auto cursor = component.data() + component.size();
 
-  // Skip over the '/'
-  skip_prefix++;
-  len--;
+    if (node->flags & FULL_IGNORE) {
+      // The path and everything below it is ignored, regardless of any
+      // entries deeper in the tree
+      return true;
+    }
 
-#ifndef _WIN32
-  // If we find a '/' from this point, we are ignoring this path.
-  return memchr(skip_prefix, '/', len) != nullptr;
-#else
-  // On windows, both '/' and '\' are possible.
-  while (len > 0) {
-    if (is_slash(*skip_prefix)) {
+    // A vcs ignore applies to the grandchildren of the entry: there must be
+    // a separator after the entry and another one after the child.
+    if ((node->flags & VCS_IGNORE) && cursor < end && is_slash(*cursor) &&
+        containsSlash(cursor + 1, end)) {
       return true;
     }
-    skip_prefix++;
-    len--;
+
+    component = nextComponent(cursor, end);
   }
   return false;
-#endif
 }
 
 bool IgnoreSet::isIgnoreVCS(const w_string& path) const {
@@ -7,8 +7,9 @@
 
 #pragma once
 
+#include <memory>
+#include <unordered_map>
 #include <unordered_set>
-#include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -20,7 +21,10 @@ class IgnoreSet {
   // or a vcs-style grandchild ignore.
   void add(const w_string& path, bool is_vcs_ignore);
 
-  // Tests whether path is ignored.
+  // Tests whether path is ignored, either because it is at or below an
+  // ignore_dirs entry, or because it is a grandchild of a vcs ignore.
+  // This is a single walk down the components of path, cheap enough for the
+  // watchers and the crawler to call for every path they see.
   // Returns true if the path is ignored, false otherwise.
   bool isIgnored(const char* path, uint32_t pathlen) const;
 
@@ -38,10 +42,17 @@ class IgnoreSet {
   // if the map has an entry for a given dir, we're ignoring it */
   std::unordered_set<w_string> ignore_vcs;
   std::unordered_set<w_string> ignore_dirs;
-  /* radix tree containing the same information as the ignore
-   * entries above.  This is used only on macOS and Windows because
-   * we cannot exclude these dirs using the kernel watching APIs */
-  art_tree<uint8_t, w_string> tree;
+  // A trie of path components containing the same information as the
+  // ignore entries above, which isIgnored() walks one component at a time.
+  struct Node {
+    // FULL_IGNORE and/or VCS_IGNORE, if an entry ends at this node
+    uint8_t flags{0};
+    // The component that leads to this node; the key of this node in its
+    // parent's children refers to it.
+    w_string name;
+    std::unordered_map<w_string_piece, std::unique_ptr<Node>> children;
+  };
+  Node trie_;
   /* On macOS, we need to preserve the order of the ignore list so
    * that we can exclude things deterministically and fit within
    * system limits. */
@@ -6,13 +6,32 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
 #include <folly/ScopeGuard.h>
+#include <folly/system/MemoryMapping.h>
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
+#include "watchman/Constants.h"
 #include "watchman/Errors.h"
+#include "watchman/FileMetadataTable.h"
+#include "watchman/Options.h"
+#include "watchman/ThreadAccounting.h"
+#include "watchman/ThreadLocalFreeList.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/Trace.h"
+#include "watchman/ViewSnapshot.h"
+#include "watchman/fs/DirFdCache.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/fs/IoUringStat.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
@@ -22,6 +41,11 @@
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_file.h"
+#include "watchman/watchman_hash.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 // Each root gets a number that uniquely identifies it within the process. This
 // helps avoid confusion if a root is removed and then added again.
@@ -29,66 +53,490 @@ static std::atomic<long> next_root_number{1};
 
 namespace watchman {
 
+// One of the lists of an index of a ViewDatabase, which starts at head and
+// continues via next
+struct FileIndexList {
+  const watchman_file* head;
+  watchman_file* watchman_file::*next;
+};
+
 namespace {
-/** Concatenate dir_name and name around a unix style directory
- * separator.
- * dir_name may be NULL in which case this returns a copy of name.
+// Distinguishes the state files of different roots.  This uses lookup3
+// rather than hashValue() so that the names stay the same between builds.
+uint32_t stateFileHash(const w_string& root_path) {
+  return w_hash_bytes(root_path.data(), root_path.size(), 0);
+}
+
+// A parallel walk divides the tree into more subtrees than there are
+// threads, so that the threads stay busy when the subtrees differ in size.
+constexpr size_t kSubtreesPerThread = 4;
+// How many levels below its starting dir a parallel walk looks for subtrees
+constexpr uint32_t kMaxSplitDepth = 3;
+
+// InMemoryFileResult storage is recycled through a per-thread freelist,
+// since a query creates and destroys a result for every file that it
+// considers, and its generators and render loop run on the thread that
+// owns the query (or on a parallel generator's worker).  Each thread keeps
+// at most 4096 of them.
+using FileResultFreeList = ThreadLocalFreeList<InMemoryFileResult, 4096>;
+
+// How many daemon generations' clocks a view snapshot keeps honoring
+constexpr size_t kMaxSnapshotEpochs = 16;
+
+// How many levels `path` is below `rootPath`, which contains it
+uint32_t depthBelow(const w_string& rootPath, const w_string& path) {
+  uint32_t depth = 0;
+  for (size_t i = rootPath.size(); i < path.size(); ++i) {
+    if (is_slash(path.data()[i])) {
+      ++depth;
+    }
+  }
+  return depth;
+}
+
+// The node of the file or dir at `path`, if the view has one for it and
+// it exists
+watchman_file* existingNode(ViewDatabase& view, const w_string& path) {
+  auto parent = view.resolveDir(path.dirName(), false);
+  auto file = parent ? parent->getChildFile(path.baseName()) : nullptr;
+  return file && file->exists ? file : nullptr;
+}
+
+// Whether `path` is `ancestor` or beneath it
+bool isWithin(const w_string& path, const w_string& ancestor) {
+  auto len = ancestor.size();
+  return path.size() >= len && memcmp(path.data(), ancestor.data(), len) == 0 &&
+      (path.size() == len || is_slash(path.data()[len]));
+}
+
+/**
+ * Resolves the dirs of paths beneath the root that are visited in sorted
+ * order.  It remembers the chain of dirs leading to the last one that it
+ * resolved, so that paths which share ancestors walk down from the deepest
+ * shared one rather than from the root, and siblings resolve their parent
+ * only once.  The resolved names must outlive the resolver.
  */
-inline std::string make_path_name(
-    const char* dir_name,
-    uint32_t dlen,
-    const char* name,
-    uint32_t nlen) {
-  std::string result;
-  result.reserve(dlen + nlen + 1);
-
-  if (dlen) {
-    result.append(dir_name, dlen);
-    // wildmatch wants unix separators
-    result.push_back('/');
-  }
-  result.append(name, nlen);
-  return result;
+class SortedDirResolver {
+ public:
+  explicit SortedDirResolver(const ViewDatabase& view)
+      : view_{view},
+        chain_{{view.getRootPath(), view.resolveDir(view.getRootPath())}} {}
+
+  const watchman_dir* resolve(w_string_piece dirName) {
+    // The common case for long lists of files: a sibling of the last path
+    if (dirName == chain_.back().path) {
+      return chain_.back().dir;
+    }
+    if (dirName == missing_) {
+      return nullptr;
+    }
+
+    while (chain_.size() > 1 && !isPrefix(chain_.back().path, dirName)) {
+      chain_.pop_back();
+    }
+    if (!isPrefix(chain_.back().path, dirName)) {
+      // Not beneath the root
+      return nullptr;
+    }
+
+    const char* end = dirName.data() + dirName.size();
+    const char* component = dirName.data() + chain_.back().path.size() + 1;
+    while (component < end) {
+      auto sep = std::find_if(component, end, is_slash);
+      auto dir = view_.findChildDir(
+          chain_.back().dir, w_string_piece(component, sep - component));
+      if (!dir) {
+        missing_ = dirName;
+        return nullptr;
+      }
+      chain_.push_back(
+          {w_string_piece(dirName.data(), sep - dirName.data()), dir});
+      component = sep + 1;
+    }
+    return chain_.back().dir;
+  }
+
+ private:
+  struct Step {
+    w_string_piece path;
+    const watchman_dir* dir;
+  };
+
+  // Whether `prefix` is a proper ancestor of `path`
+  static bool isPrefix(w_string_piece prefix, w_string_piece path) {
+    auto len = prefix.size();
+    return path.size() > len && is_slash(path.data()[len]) &&
+        memcmp(path.data(), prefix.data(), len) == 0;
+  }
+
+  const ViewDatabase& view_;
+  std::vector<Step> chain_;
+  // The last dir found not to exist
+  w_string_piece missing_;
+};
+
+// Whether f changed after since.  The files on the recency index ahead of
+// the first that didn't are those that the time generator reports.
+bool changedSince(const QuerySince& since, const watchman_file* f) {
+  // Note that we use <= for the time comparisons in here so that we
+  // report the things that changed inclusive of the boundary presented.
+  // This is especially important for clients using the coarse unix
+  // timestamp as the since basis, as they would be much more
+  // likely to miss out on changes if we didn't.
+  if (since.is_timestamp) {
+    return f->otime.timestamp > since.timestamp;
+  }
+  return f->otime.ticks > since.clock.ticks;
+}
+
+// Whether more than limit files changed since `since`.  The checkpoints
+// usually tell; otherwise at most limit files of the recency index are
+// looked at, so that this costs no more than whatever is being weighed
+// against the walk of the index.
+bool changesExceed(
+    const ViewDatabase& view,
+    const QuerySince& since,
+    size_t limit) {
+  if (view.estimateFilesChangedSince(since) <= limit) {
+    return false;
+  }
+  size_t numChanged = 0;
+  for (auto f = view.getLatestFile(); f && changedSince(since, f);
+       f = f->next) {
+    if (++numChanged > limit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The point after which the files within the bounds of filter changed, in
+// the form that changedSince() takes, if filter bounds that.  The otime
+// ticks bound it exactly.  The otime timestamp bounds it too, as do the
+// mtime and ctime as far as the view has seen them run ahead of the otime.
+// Given both, whichever the checkpoints expect to reach fewer files wins.
+std::optional<QuerySince> changedSinceBound(
+    const ViewDatabase& view,
+    const MetadataFilter& filter) {
+  std::optional<QuerySince> byTicks;
+  if (filter.changedAfterTicks) {
+    byTicks.emplace();
+    byTicks->clock.is_fresh_instance = false;
+    byTicks->clock.ticks = *filter.changedAfterTicks;
+  }
+
+  std::optional<int64_t> earliest = filter.changedSince;
+  auto raise = [&](const std::optional<int64_t>& statBound) {
+    if (statBound) {
+      auto bound = *statBound - view.getStatTimeSkew();
+      if (!earliest || bound > *earliest) {
+        earliest = bound;
+      }
+    }
+  };
+  raise(filter.modifiedSince);
+  raise(filter.statusChangedSince);
+  std::optional<QuerySince> byTimestamp;
+  if (earliest) {
+    byTimestamp.emplace();
+    byTimestamp->is_timestamp = true;
+    // changedSince() reports the files that changed after the timestamp
+    byTimestamp->timestamp = time_t(*earliest - 1);
+  }
+
+  if (!byTicks || !byTimestamp) {
+    return byTicks ? byTicks : byTimestamp;
+  }
+  return view.estimateFilesChangedSince(*byTimestamp) <
+          view.estimateFilesChangedSince(*byTicks)
+      ? byTimestamp
+      : byTicks;
+}
+
+// Following the recency index costs about a cache miss per file, while the
+// FileMetadataTable is scanned a column at a time and a parallel walk of the
+// tree is divided between threads; once the walk would visit more than one
+// in this many of the files, those are the cheaper way to cover them
+constexpr size_t kRecencyWalkMaxFraction = 4;
+
+// The number of files on the lists that start at each of heads and
+// continue via next, or limit if that is fewer.  Like changesExceed(),
+// looks at no more files than the alternative would.
+size_t countFilesUpTo(
+    const std::vector<const watchman_file*>& heads,
+    watchman_file* watchman_file::*next,
+    size_t limit) {
+  size_t count = 0;
+  for (auto head : heads) {
+    for (auto f = head; f && count < limit; f = f->*next) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+// A bound on the number of files that a walk of dir to depth visits
+size_t filesWithinDepth(const watchman_dir* dir, uint32_t depth) {
+  return depth == 0 ? dir->files.size() : dir->subtreeFiles;
+}
+
+// The heads of the suffix index's lists of files with each of suffixes
+std::vector<const watchman_file*> suffixListHeads(
+    const ViewDatabase& view,
+    const std::vector<w_string>& suffixes) {
+  std::vector<const watchman_file*> heads;
+  heads.reserve(suffixes.size());
+  for (const auto& suffix : suffixes) {
+    heads.push_back(view.getFilesWithSuffix(suffix));
+  }
+  return heads;
+}
+
+size_t countFilesUpTo(const std::vector<FileIndexList>& lists, size_t limit) {
+  size_t count = 0;
+  for (auto& list : lists) {
+    count += countFilesUpTo({list.head}, list.next, limit - count);
+  }
+  return count;
+}
+
+// The lists of the view's indexes that between them hold every file that
+// the ** children of node can match: those named by a Literal, and those
+// with the suffix of a Suffix that ends in an extension.  Returns nothing
+// if any child can match other files.
+std::optional<std::vector<FileIndexList>> doublestarIndexLists(
+    const ViewDatabase& view,
+    const GlobTree* node) {
+  std::vector<w_string> names;
+  std::vector<w_string> suffixes;
+  for (auto& child : node->doublestar_children) {
+    w_string_piece literal{child->literal.data(), child->literal.size()};
+    if (child->kind == GlobTree::Kind::Literal) {
+      names.push_back(literal.asLowerCase());
+      continue;
+    }
+    if (child->kind != GlobTree::Kind::Suffix) {
+      return std::nullopt;
+    }
+    auto suffix = literal.suffix();
+    if (suffix == nullptr || suffix.empty()) {
+      return std::nullopt;
+    }
+    suffixes.push_back(suffix.asLowerCase());
+  }
+
+  std::vector<FileIndexList> lists;
+  auto add = [&](std::vector<w_string>& keys, auto lookup, auto next) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    for (auto& key : keys) {
+      lists.push_back(FileIndexList{(view.*lookup)(key), next});
+    }
+  };
+  add(names, &ViewDatabase::getFilesNamed, &watchman_file::name_next);
+  add(suffixes, &ViewDatabase::getFilesWithSuffix, &watchman_file::suffix_next);
+  return lists;
 }
 } // namespace
 
+/**
+ * A dir that a generator is walking, along with its full path, which is
+ * built from its parent's the first time that it's needed.  The files of a
+ * dir then share one copy of the path rather than each walking up the tree
+ * to build their own, and dirs without any results never build theirs.
+ */
+class WalkedDir {
+ public:
+  WalkedDir(const watchman_dir* dir, w_string path)
+      : dir_{dir}, path_{std::move(path)} {}
+
+  WalkedDir(const WalkedDir& parent, const watchman_dir* dir)
+      : dir_{dir}, parent_{&parent} {}
+
+  const watchman_dir* get() const {
+    return dir_;
+  }
+
+  const watchman_dir* operator->() const {
+    return dir_;
+  }
+
+  const w_string& path() const {
+    if (!path_) {
+      path_ = w_string::pathCat({parent_->path(), dir_->name});
+    }
+    return path_;
+  }
+
+  std::unique_ptr<InMemoryFileResult> makeResult(
+      const watchman_file* file,
+      InMemoryViewCaches& caches) const {
+    return std::make_unique<InMemoryFileResult>(file, path(), caches);
+  }
+
+ private:
+  const watchman_dir* dir_;
+  const WalkedDir* parent_{nullptr};
+  mutable w_string path_;
+};
+
 InMemoryViewCaches::InMemoryViewCaches(
     const w_string& rootPath,
     size_t maxHashes,
     size_t maxSymlinks,
-    std::chrono::milliseconds errorTTL)
-    : contentHashCache(rootPath, maxHashes, errorTTL),
-      symlinkTargetCache(rootPath, maxSymlinks, errorTTL) {}
+    std::chrono::milliseconds errorTTL,
+    size_t hashShards,
+    size_t symlinkShards)
+    : contentHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          ContentHashAlgorithm::Sha1,
+          hashShards),
+      fastContentHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          ContentHashAlgorithm::Spooky128,
+          hashShards),
+      chunkedContentHashCache(rootPath, maxHashes, errorTTL, hashShards),
+      symlinkTargetCache(rootPath, maxSymlinks, errorTTL, symlinkShards) {}
+
+void* InMemoryFileResult::operator new(size_t size) {
+  return FileResultFreeList::allocate(size);
+}
+
+void InMemoryFileResult::operator delete(void* ptr, size_t size) {
+  FileResultFreeList::deallocate(ptr, size);
+}
+
+const void* InMemoryFileResult::identity() const {
+  return file_;
+}
+
+InMemoryFileResult::InMemoryFileResult(
+    const watchman_file* file,
+    InMemoryViewCaches& caches)
+    : stat_(&file->stat),
+      baseName_(file->getName()),
+      parent_(file->parent),
+      file_(file),
+      otime_(file->otime),
+      ctime_(file->ctime),
+      exists_(file->exists),
+      caches_(caches) {}
 
 InMemoryFileResult::InMemoryFileResult(
     const watchman_file* file,
+    w_string dirName,
+    InMemoryViewCaches& caches)
+    : stat_(&file->stat),
+      baseName_(file->getName()),
+      parent_(file->parent),
+      file_(file),
+      dirName_(std::move(dirName)),
+      otime_(file->otime),
+      ctime_(file->ctime),
+      exists_(file->exists),
+      caches_(caches) {}
+
+InMemoryFileResult::InMemoryFileResult(
+    std::shared_ptr<const ChangeSet> changes,
+    const ChangedFile* file,
     InMemoryViewCaches& caches)
-    : file_(file), caches_(caches) {}
+    : stat_(&file->stat),
+      baseName_(file->baseName),
+      parent_(nullptr),
+      file_(nullptr),
+      dirName_(file->dirName),
+      otime_(file->otime),
+      ctime_(file->ctime),
+      exists_(file->exists),
+      changes_(std::move(changes)),
+      caches_(caches) {}
 
 void InMemoryFileResult::batchFetchProperties(
-    const std::vector<std::unique_ptr<FileResult>>& files) {
-  std::vector<folly::Future<folly::Unit>> readlinkFutures;
-  std::vector<folly::Future<folly::Unit>> sha1Futures;
+    const std::vector<std::unique_ptr<FileResult>>& files,
+    std::chrono::steady_clock::time_point deadline) {
+  std::vector<folly::Future<folly::Unit>> futures;
+  // The files that are waiting on each kind of fetch, to be failed if the
+  // deadline passes before they are complete
+  std::vector<InMemoryFileResult*> readlinkFiles;
+  std::vector<InMemoryFileResult*> sha1Files;
+  std::vector<InMemoryFileResult*> spookyFiles;
+  std::vector<InMemoryFileResult*> chunkedFiles;
+  // Set once we stop waiting; the continuations hold the read lock while
+  // they store into a file, so they never touch one after that.
+  auto abandoned = std::make_shared<folly::Synchronized<bool>>(false);
 
   // Since we may initiate some async work in the body of the function
-  // below, we need to ensure that we wait for it to complete before
-  // we return from this scope, even if we are throwing an exception.
-  // If we fail to do so, the continuation on the futures that we
-  // schedule will access invalid memory and we'll all feel bad.
+  // below, we need to ensure that we wait for it to complete (or for the
+  // deadline to pass) before we return from this scope, even if we are
+  // throwing an exception.  If we fail to do so, the continuation on the
+  // futures that we schedule will access invalid memory and we'll all
+  // feel bad.
   SCOPE_EXIT {
-    if (!readlinkFutures.empty()) {
-      folly::collectAll(readlinkFutures.begin(), readlinkFutures.end()).wait();
+    if (futures.empty()) {
+      return;
+    }
+    auto all = folly::collectAll(futures.begin(), futures.end());
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      all.wait();
+      return;
+    }
+    all.wait(std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(
+        deadline - std::chrono::steady_clock::now(),
+        std::chrono::steady_clock::duration::zero())));
+    if (all.isReady()) {
+      return;
     }
-    if (!sha1Futures.empty()) {
-      folly::collectAll(sha1Futures.begin(), sha1Futures.end()).wait();
+
+    *abandoned->wlock() = true;
+    auto timedOut = [] {
+      return std::make_exception_ptr(std::system_error(
+          std::make_error_code(std::errc::timed_out),
+          "not available before the query's fetch_timeout"));
+    };
+    for (auto file : readlinkFiles) {
+      if (!file->symlinkTarget_) {
+        file->symlinkTarget_ = w_string();
+      }
+    }
+    for (auto file : sha1Files) {
+      if (file->contentSha1_.empty()) {
+        file->contentSha1_ = Result<FileResult::ContentHash>(timedOut());
+      }
+    }
+    for (auto file : spookyFiles) {
+      if (file->contentSpooky128_.empty()) {
+        file->contentSpooky128_ =
+            Result<FileResult::FastContentHash>(timedOut());
+      }
+    }
+    for (auto file : chunkedFiles) {
+      if (file->contentChunked128_.empty()) {
+        file->contentChunked128_ =
+            Result<FileResult::FastContentHash>(timedOut());
+      }
     }
   };
 
   for (auto& f : files) {
     auto* file = dynamic_cast<InMemoryFileResult*>(f.get());
 
+    if (file->neededProperties() & FileResult::Property::StatTimeStamps) {
+      // The view doesn't keep access times, so stat the file for it
+      auto path = w_string::pathCat({file->dirName(), file->baseName()});
+      try {
+        file->atime_ = getFileInformation(path.c_str()).atime;
+      } catch (const std::exception&) {
+        // Deleted since the view saw it
+        file->atime_ = timespec{0, 0};
+      }
+    }
+
     if (file->neededProperties() & FileResult::Property::SymlinkTarget) {
-      if (!file->file_->stat.isSymlink()) {
+      if (!file->stat_->isSymlink()) {
         // If this file is not a symlink then we yield
         // a nullptr w_string instance rather than propagating an error.
         // This behavior is relied upon by the field rendering code and
@@ -106,46 +554,78 @@ void InMemoryFileResult::batchFetchProperties(
         }
 
         SymlinkTargetCacheKey key{
-            w_string::pathCat({dir, file->baseName()}), file->file_->otime};
-
-        readlinkFutures.emplace_back(
-            caches_.symlinkTargetCache.get(key).thenTry(
-                [file](folly::Try<std::shared_ptr<
-                           const SymlinkTargetCache::Node>>&& result) {
-                  if (result.hasValue()) {
-                    file->symlinkTarget_ = result.value()->value();
-                  } else {
-                    // we don't have a way to report the error for readlink
-                    // due to legacy requirements in the interface, so we
-                    // just set it to empty.
-                    file->symlinkTarget_ = w_string();
-                  }
-                }));
+            w_string::pathCat({dir, file->baseName()}), file->otime_};
+
+        readlinkFiles.push_back(file);
+        futures.emplace_back(caches_.symlinkTargetCache.get(key).thenTry(
+            [file, abandoned](folly::Try<std::shared_ptr<
+                                  const SymlinkTargetCache::Node>>&& result) {
+              auto isAbandoned = abandoned->rlock();
+              if (*isAbandoned) {
+                return;
+              }
+              if (result.hasValue()) {
+                file->symlinkTarget_ = result.value()->value();
+              } else {
+                // we don't have a way to report the error for readlink
+                // due to legacy requirements in the interface, so we
+                // just set it to empty.
+                file->symlinkTarget_ = w_string();
+              }
+            }));
       }
     }
 
     if (file->neededProperties() & FileResult::Property::ContentSha1) {
-      auto dir = file->dirName();
-      dir.advance(file->caches_.contentHashCache.rootPath().size());
-
-      // If dirName is the root, dir.size() will now be zero
-      if (dir.size() > 0) {
-        // if not at the root, skip the slash character at the
-        // front of dir
-        dir.advance(1);
-      }
+      sha1Files.push_back(file);
+      futures.emplace_back(
+          caches_.contentHashCache.get(file->contentHashCacheKey())
+              .thenTry([file, abandoned](
+                           folly::Try<std::shared_ptr<
+                               const ContentHashCache::Node>>&& result) {
+                auto isAbandoned = abandoned->rlock();
+                if (*isAbandoned) {
+                  return;
+                }
+                file->contentSha1_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
+    }
 
-      ContentHashCacheKey key{
-          w_string::pathCat({dir, file->baseName()}),
-          size_t(file->file_->stat.size),
-          file->file_->stat.mtime};
+    if (file->neededProperties() & FileResult::Property::ContentSpooky128) {
+      spookyFiles.push_back(file);
+      futures.emplace_back(
+          caches_.fastContentHashCache.get(file->contentHashCacheKey())
+              .thenTry([file, abandoned](
+                           folly::Try<std::shared_ptr<
+                               const ContentHashCache::Node>>&& result) {
+                auto isAbandoned = abandoned->rlock();
+                if (*isAbandoned) {
+                  return;
+                }
+                file->contentSpooky128_ = makeResultWith([&] {
+                  const auto& hash = result.value()->value();
+                  FileResult::FastContentHash fast;
+                  std::copy_n(hash.begin(), fast.size(), fast.begin());
+                  return fast;
+                });
+              }));
+    }
 
-      sha1Futures.emplace_back(caches_.contentHashCache.get(key).thenTry(
-          [file](folly::Try<std::shared_ptr<const ContentHashCache::Node>>&&
-                     result) {
-            file->contentSha1_ =
-                makeResultWith([&] { return result.value()->value(); });
-          }));
+    if (file->neededProperties() & FileResult::Property::ContentChunked128) {
+      chunkedFiles.push_back(file);
+      futures.emplace_back(
+          caches_.chunkedContentHashCache.get(file->contentHashCacheKey())
+              .thenTry([file, abandoned](
+                           folly::Try<std::shared_ptr<
+                               const ChunkedContentHashCache::Node>>&& result) {
+                auto isAbandoned = abandoned->rlock();
+                if (*isAbandoned) {
+                  return;
+                }
+                file->contentChunked128_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
     }
 
     file->clearNeededProperties();
@@ -153,51 +633,70 @@ void InMemoryFileResult::batchFetchProperties(
 }
 
 std::optional<FileInformation> InMemoryFileResult::stat() {
-  return file_->stat;
+  auto info = stat_->expand();
+  if (atime_) {
+    info.atime = *atime_;
+  }
+  return info;
 }
 
 std::optional<size_t> InMemoryFileResult::size() {
-  return file_->stat.size;
+  return stat_->size;
 }
 
 std::optional<struct timespec> InMemoryFileResult::accessedTime() {
-  return file_->stat.atime;
+  if (!atime_) {
+    if (!exists_ || !caches_.fetchAccessTimes) {
+      atime_ = timespec{0, 0};
+    } else {
+      accessorNeedsProperties(FileResult::Property::StatTimeStamps);
+      return std::nullopt;
+    }
+  }
+  return atime_;
 }
 
 std::optional<struct timespec> InMemoryFileResult::modifiedTime() {
-  return file_->stat.mtime;
+  return stat_->mtime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::changedTime() {
-  return file_->stat.ctime;
+  return stat_->ctime();
 }
 
 w_string_piece InMemoryFileResult::baseName() {
-  return file_->getName();
+  return baseName_;
+}
+
+w_string InMemoryFileResult::lowerCaseBaseName() {
+  if (file_) {
+    return file_->lower_name;
+  }
+  return FileResult::lowerCaseBaseName();
 }
 
 w_string_piece InMemoryFileResult::dirName() {
   if (!dirName_) {
-    dirName_ = file_->parent->getFullPath();
+    dirName_ = parent_->getFullPath();
   }
   return dirName_;
 }
 
 std::optional<bool> InMemoryFileResult::exists() {
-  return file_->exists;
+  return exists_;
 }
 
 std::optional<w_clock_t> InMemoryFileResult::ctime() {
-  return file_->ctime;
+  return ctime_;
 }
 
 std::optional<w_clock_t> InMemoryFileResult::otime() {
-  return file_->otime;
+  return otime_;
 }
 
 std::optional<w_string> InMemoryFileResult::readLink() {
   if (!symlinkTarget_.has_value()) {
-    if (!file_->stat.isSymlink()) {
+    if (!stat_->isSymlink()) {
       // If this file is not a symlink then we immediately yield
       // a nullptr w_string instance rather than propagating an error.
       // This behavior is relied upon by the field rendering code and
@@ -212,228 +711,84 @@ std::optional<w_string> InMemoryFileResult::readLink() {
   return symlinkTarget_;
 }
 
-std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
-  if (!file_->exists) {
+void InMemoryFileResult::checkHashable() const {
+  if (!exists_) {
     // Don't return hashes for files that we believe to be deleted.
     throw std::system_error(
         std::make_error_code(std::errc::no_such_file_or_directory));
   }
 
-  if (!file_->stat.isFile()) {
+  if (!stat_->isFile()) {
     // We only want to compute the hash for regular files
     throw std::system_error(std::make_error_code(std::errc::is_a_directory));
   }
-
-  if (contentSha1_.empty()) {
-    accessorNeedsProperties(FileResult::Property::ContentSha1);
-    return std::nullopt;
-  }
-  return contentSha1_.value();
 }
 
-ViewDatabase::ViewDatabase(const w_string& root_path)
-    : rootPath_{root_path},
-      rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {}
-
-watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
-  if (dir_name == rootPath_) {
-    return rootDir_.get();
-  }
-
-  const char* dir_component = dir_name.data();
-  const char* dir_end = dir_component + dir_name.size();
+ContentHashCacheKey InMemoryFileResult::contentHashCacheKey() {
+  auto dir = dirName();
+  dir.advance(caches_.contentHashCache.rootPath().size());
 
-  watchman_dir* dir = rootDir_.get();
-  dir_component += rootPath_.size() + 1; // Skip root path prefix
-
-  w_assert(dir_component <= dir_end, "impossible file name");
-
-  watchman_dir* parent;
-  while (true) {
-    auto sep = (const char*)memchr(dir_component, '/', dir_end - dir_component);
-    // Note: if sep is NULL it means that we're looking at the basename
-    // component of the input directory name, which is the terminal
-    // iteration of this search.
-
-    w_string_piece component(
-        dir_component, sep ? (sep - dir_component) : (dir_end - dir_component));
-
-    auto child = dir->getChildDir(component);
-
-    if (!child && !create) {
-      return nullptr;
-    }
-    if (!child && sep && create) {
-      // A component in the middle wasn't present.  Since we're in create
-      // mode, we know that the leaf must exist.  The assumption is that
-      // we have another pending item for the parent.  We'll create the
-      // parent dir now and our other machinery will populate its contents
-      // later.
-      w_string child_name(dir_component, (uint32_t)(sep - dir_component));
-
-      // Careful! dir->dirs is keyed by non-owning string pieces so the
-      // child_name MUST be stored or otherwise kept alive by the watchman_dir
-      // instance constructed below!
-      auto& new_child = dir->dirs[child_name];
-      new_child.reset(new watchman_dir(child_name, dir));
-
-      child = new_child.get();
-    }
-
-    parent = dir;
-    dir = child;
-
-    if (!sep) {
-      // We reached the end of the string
-      if (dir) {
-        // We found the dir
-        return dir;
-      }
-      // We need to create the dir
-      break;
-    }
-
-    // Skip to the next component for the next iteration
-    dir_component = sep + 1;
+  // If dirName is the root, dir.size() will now be zero
+  if (dir.size() > 0) {
+    // if not at the root, skip the slash character at the
+    // front of dir
+    dir.advance(1);
   }
 
-  w_string child_name(dir_component, (uint32_t)(dir_end - dir_component));
-  // Careful! parent->dirs is keyed by non-owning string pieces so the
-  // child_name MUST be stored or otherwise kept alive by the watchman_dir
-  // instance constructed below!
-  auto& new_child = parent->dirs[child_name];
-  new_child.reset(new watchman_dir(child_name, parent));
-  return new_child.get();
+  return ContentHashCacheKey{
+      w_string::pathCat({dir, baseName()}),
+      size_t(stat_->size),
+      stat_->mtime(),
+      uint64_t(stat_->dev),
+      uint64_t(stat_->ino)};
 }
 
-const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
-  if (dir_name == rootPath_) {
-    return rootDir_.get();
-  }
-
-  const char* dir_component = dir_name.data();
-  const char* dir_end = dir_component + dir_name.size();
-
-  watchman_dir* dir = rootDir_.get();
-  dir_component += rootPath_.size() + 1; // Skip root path prefix
-
-  w_assert(dir_component <= dir_end, "impossible file name");
-
-  while (true) {
-    auto sep = (const char*)memchr(dir_component, '/', dir_end - dir_component);
-    // Note: if sep is NULL it means that we're looking at the basename
-    // component of the input directory name, which is the terminal
-    // iteration of this search.
-
-    w_string_piece component(
-        dir_component, sep ? (sep - dir_component) : (dir_end - dir_component));
-
-    auto child = dir->getChildDir(component);
-    if (!child) {
-      return nullptr;
-    }
-
-    dir = child;
-
-    if (!sep) {
-      // We reached the end of the string
-      if (dir) {
-        // We found the dir
-        return dir;
-      }
-      // Does not exist
-      return nullptr;
-    }
-
-    // Skip to the next component for the next iteration
-    dir_component = sep + 1;
+std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
+  checkHashable();
+  if (contentSha1_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentSha1);
+    return std::nullopt;
   }
-
-  return nullptr;
+  return contentSha1_.value();
 }
 
-watchman_file* ViewDatabase::getOrCreateChildFile(
-    Watcher& watcher,
-    watchman_dir* dir,
-    const w_string& file_name,
-    w_clock_t ctime) {
-  // file_name is typically a baseName slice; let's use it as-is
-  // to look up a child...
-  auto it = dir->files.find(file_name);
-  if (it != dir->files.end()) {
-    return it->second.get();
+std::optional<FileResult::FastContentHash>
+InMemoryFileResult::getContentSpooky128() {
+  checkHashable();
+  if (contentSpooky128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentSpooky128);
+    return std::nullopt;
   }
-
-  // ... but take the shorter string from inside the file that
-  // we create as the key.
-  auto file = watchman_file::make(file_name, dir);
-  auto& file_ptr = dir->files[file->getName()];
-  file_ptr = std::move(file);
-
-  file_ptr->ctime = ctime;
-
-  watcher.startWatchFile(file_ptr.get());
-
-  return file_ptr.get();
+  return contentSpooky128_.value();
 }
 
-void ViewDatabase::markFileChanged(
-    Watcher& watcher,
-    watchman_file* file,
-    w_clock_t otime) {
-  if (file->exists) {
-    watcher.startWatchFile(file);
-  }
-
-  file->otime = otime;
-
-  if (latestFile_ != file) {
-    // unlink from list
-    file->removeFromFileList();
-
-    // and move to the head
-    insertAtHeadOfFileList(file);
+std::optional<FileResult::FastContentHash>
+InMemoryFileResult::getContentChunked128() {
+  checkHashable();
+  if (contentChunked128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentChunked128);
+    return std::nullopt;
   }
+  return contentChunked128_.value();
 }
 
-void ViewDatabase::markDirDeleted(
-    Watcher& watcher,
-    watchman_dir* dir,
-    w_clock_t otime,
-    bool recursive) {
-  if (!dir->last_check_existed) {
-    // If we know that it doesn't exist, return early
-    return;
-  }
-  dir->last_check_existed = false;
-
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-
-    if (file->exists) {
-      auto full_name = dir->getFullPathToChild(file->getName());
-      logf(DBG, "mark_deleted: {}\n", full_name);
-      file->exists = false;
-      markFileChanged(watcher, file, otime);
-    }
+std::optional<FileResult::ContentHash> InMemoryFileResult::getTreeSha1() {
+  if (!exists_) {
+    throw std::system_error(
+        std::make_error_code(std::errc::no_such_file_or_directory));
   }
-
-  if (recursive) {
-    for (auto& it : dir->dirs) {
-      auto child = it.second.get();
-
-      markDirDeleted(watcher, child, otime, true);
-    }
+  if (!stat_->isDir()) {
+    throw std::system_error(std::make_error_code(std::errc::not_a_directory));
   }
-}
-
-void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
-  file->next = latestFile_;
-  if (file->next) {
-    file->next->prev = &file->next;
+  // The query computed the digests before it started; a dir that changed
+  // since then has none.
+  auto digest =
+      caches_.treeHashes->get(w_string::pathCat({dirName(), baseName()}));
+  if (!digest) {
+    throw std::runtime_error(
+        "the dir changed while its tree was being hashed; query again");
   }
-  latestFile_ = file;
-  file->prev = &latestFile_;
+  return digest->value();
 }
 
 InMemoryView::PendingChangeLogEntry::PendingChangeLogEntry(
@@ -472,7 +827,10 @@ InMemoryView::InMemoryView(
     : QueryableView{/*requiresRecrawl=*/true},
       fileSystem_{fileSystem},
       config_(std::move(config)),
-      view_(folly::in_place, root_path),
+      nodeArena_(std::make_shared<NodeArena>()),
+      nameTable_(std::make_shared<NameTable>()),
+      treeHashes_(std::make_shared<DirTreeHashes>()),
+      view_(folly::in_place, root_path, nodeArena_, nameTable_, treeHashes_),
       rootNumber_(next_root_number++),
       rootPath_(root_path),
       watcher_(std::move(watcher)),
@@ -481,20 +839,218 @@ InMemoryView::InMemoryView(
           config_.getInt("content_hash_max_items", 128 * 1024),
           config_.getInt("symlink_target_max_items", 32 * 1024),
           std::chrono::milliseconds(
-              config_.getInt("content_hash_negative_cache_ttl_ms", 2000))),
+              config_.getInt("content_hash_negative_cache_ttl_ms", 2000)),
+          config_.getInt("content_hash_cache_shards", 1),
+          config_.getInt("symlink_target_cache_shards", 1)),
       enableContentCacheWarming_(
           config_.getBool("content_hash_warming", false)),
       maxFilesToWarmInContentCache_(
           size_t(config_.getInt("content_hash_max_warm_per_settle", 1024))),
       syncContentCacheWarming_(
           config_.getBool("content_hash_warm_wait_before_settle", false)),
+      enableQueryContentCacheWarming_(
+          config_.getBool("content_hash_warm_subscriptions", false)),
+      maxChangeSetFiles_(size_t(
+          config_.getInt("subscription_change_set_max_files", 4096))),
       scm_(SCM::scmForPath(root_path)) {
+  caches_.treeHashes = treeHashes_;
+
   json_int_t in_memory_view_ring_log_size =
       config_.getInt("in_memory_view_ring_log_size", 0);
   if (in_memory_view_ring_log_size) {
     this->processedPaths_ = std::make_unique<RingBuffer<PendingChangeLogEntry>>(
         in_memory_view_ring_log_size);
   }
+
+  json_int_t crawl_stat_threads = config_.getInt("crawl_stat_threads", 0);
+  if (crawl_stat_threads > 0) {
+    crawlPool_ = std::make_unique<ThreadPool>();
+    crawlPool_->start(crawl_stat_threads, WATCHMAN_BATCH_LIMIT * 4);
+    crawlParallelMinEntries_ =
+        size_t(config_.getInt("crawl_stat_parallel_min_entries", 32));
+  }
+
+  json_int_t io_shards = config_.getInt("io_shards", 0);
+  if (io_shards > 1) {
+    ioShards_ = size_t(io_shards);
+    ioShardPool_ = std::make_unique<ThreadPool>();
+    ioShardPool_->start(ioShards_, ioShards_ * 2);
+  }
+
+  crawlProfileSize_ = size_t(config_.getInt("crawl_profile_size", 20));
+  crawlProgressInterval_ = std::chrono::milliseconds(
+      config_.getInt("crawl_progress_interval_ms", 500));
+  incompleteReadYield_ = std::chrono::milliseconds(
+      config_.getInt("incomplete_query_yield_ms", 1000));
+
+  if (config_.getBool("io_throttle", false)) {
+    IoThrottle::Config throttle;
+    throttle.minConcurrency =
+        size_t(config_.getInt("io_throttle_min_concurrency", 1));
+    throttle.maxConcurrency = size_t(config_.getInt(
+        "io_throttle_max_concurrency",
+        std::max<json_int_t>({8, crawl_stat_threads, io_shards})));
+    throttle.latencyRatio = config_.getDouble("io_throttle_latency_ratio", 2);
+    throttle.minLatency = std::chrono::microseconds(
+        config_.getInt("io_throttle_min_latency_us", 1000));
+    ioThrottle_ = std::make_shared<IoThrottle>(throttle);
+    caches_.contentHashCache.setThrottle(ioThrottle_);
+    caches_.fastContentHashCache.setThrottle(ioThrottle_);
+  }
+
+  if (config_.getBool("pending_stat_io_uring", false)) {
+    try {
+      ioUringStat_ = std::make_unique<IoUringStat>(
+          unsigned(config_.getInt("pending_stat_io_uring_entries", 256)));
+    } catch (const std::system_error& exc) {
+      logf(
+          ERR,
+          "pending_stat_io_uring is set but io_uring can't be used: {}\n",
+          exc.what());
+    }
+  }
+  // The view doesn't keep access times; queries read them when asked for
+  statOptions_.atime = false;
+  caches_.fetchAccessTimes = config_.getBool("stat_atime", true);
+  statOptions_.dontSync = config_.getBool("stat_dont_sync", false);
+
+  json_int_t dir_fd_cache_size = config_.getInt("dir_fd_cache_size", 32);
+  if (dir_fd_cache_size > 0) {
+    dirFds_ =
+        std::make_unique<DirFdCache>(fileSystem_, size_t(dir_fd_cache_size));
+  }
+  recrawlTrustReadDir_ = config_.getBool("recrawl_trust_readdir", false);
+  recrawlSkipUnchangedDirs_ =
+      config_.getBool("recrawl_skip_unchanged_dirs", false);
+  clientModeSkipUnchangedDirs_ =
+      config_.getBool("client_mode_skip_unchanged_dirs", false);
+  snapshotSkipUnchangedDirs_ =
+      config_.getBool("view_snapshot_skip_unchanged_dirs", false);
+  prefetchSymlinkTargets_ = config_.getBool("symlink_target_prefetch", false);
+  if (config_.getBool("view_metadata_columns", false)) {
+    view_.wlock()->enableMetadataTable();
+  }
+  lazyCrawlDepth_ = uint32_t(config_.getInt("lazy_crawl_depth", 0));
+  if (auto summaryDirs = config_.get("summary_dirs")) {
+    if (!(watcher_->flags & WATCHER_WATCHES_PATHS)) {
+      logf(
+          ERR,
+          "summary_dirs is ignored because the {} watcher can't watch "
+          "them\n",
+          watcher_->name);
+    } else if (!summaryDirs.isArray()) {
+      logf(ERR, "summary_dirs must be an array of strings\n");
+    } else {
+      for (auto& dir : summaryDirs.array()) {
+        if (!dir.isString() || json_to_w_string(dir).empty()) {
+          logf(ERR, "summary_dirs must be an array of strings\n");
+          continue;
+        }
+        summaryDirPaths_.push_back(
+            w_string::pathCat({rootPath_, json_to_w_string(dir)}));
+      }
+      summaryDirs_.wlock()->resize(summaryDirPaths_.size());
+    }
+  }
+
+  priorityYieldTimeout_ = std::chrono::milliseconds(
+      config_.getInt("sync_priority_yield_ms", 0));
+  pendingSliceBudget_ = std::chrono::milliseconds(
+      std::max(json_int_t(0), config_.getInt("pending_slice_ms", 0)));
+  pendingSliceItems_ =
+      size_t(std::max(json_int_t(0), config_.getInt("pending_slice_items", 0)));
+
+  if (config_.getBool("adaptive_settle", false)) {
+    settleController_ =
+        std::make_unique<folly::Synchronized<SettleController, std::mutex>>(
+            folly::in_place,
+            std::chrono::milliseconds(
+                config_.getInt("adaptive_settle_min_ms", 5)),
+            std::chrono::milliseconds(
+                config_.getInt("adaptive_settle_max_ms", 200)),
+            config_.getDouble("adaptive_settle_half_rate", 100));
+  }
+
+  ageOutSliceBudget_ = std::chrono::milliseconds(
+      std::max(json_int_t(1), config_.getInt("age_out_slice_ms", 10)));
+
+  json_int_t change_journal_max_bytes =
+      config_.getInt("change_journal_max_bytes", 0);
+  if (change_journal_max_bytes > 0) {
+    changeJournal_ =
+        std::make_unique<ChangeJournal>(size_t(change_journal_max_bytes));
+  }
+
+  if (config_.getBool("view_snapshot", false) && !flags.dont_save_state &&
+      !flags.watchman_state_file.empty()) {
+    auto stateDir = w_string_piece(flags.watchman_state_file).dirName();
+    // The root path is recorded in the snapshot header, so a hash collision
+    // is detected at load time rather than silently loading the wrong root.
+    snapshotPath_ = w_string(fmt::format(
+        "{}/view-{:08x}.snapshot",
+        stateDir.view(),
+        stateFileHash(root_path)));
+    snapshotInterval_ = std::chrono::seconds(
+        config_.getInt("view_snapshot_interval_seconds", 600));
+  }
+
+  w_string_piece warmAlgorithm =
+      config_.getString("content_hash_warm_algorithm", "sha1");
+  if (warmAlgorithm == "spooky128") {
+    warmContentCache_ = &caches_.fastContentHashCache;
+  } else {
+    if (warmAlgorithm != "sha1") {
+      logf(
+          ERR,
+          "unknown content_hash_warm_algorithm `{}`, using sha1\n",
+          warmAlgorithm);
+    }
+    warmContentCache_ = &caches_.contentHashCache;
+  }
+
+  auto chunkTreeMinSize = config_.getInt("content_hash_chunk_min_size", 0);
+  if (chunkTreeMinSize > 0) {
+    caches_.chunkedContentHashCache.rememberTrees(
+        uint64_t(chunkTreeMinSize),
+        config_.getInt("content_hash_chunk_max_files", 1024));
+  }
+
+  if (config_.getBool("content_hash_reuse_by_inode", false)) {
+    auto maxItems =
+        size_t(config_.getInt("content_hash_max_items", 128 * 1024));
+    caches_.contentHashCache.reuseByInode(maxItems);
+    caches_.fastContentHashCache.reuseByInode(maxItems);
+  }
+
+  if (config_.getBool("content_hash_persist", false) &&
+      !flags.dont_save_state && !flags.watchman_state_file.empty()) {
+    auto stateDir = w_string_piece(flags.watchman_state_file).dirName();
+    caches_.contentHashCache.setStore(std::make_unique<ContentHashStore>(
+        w_string(fmt::format(
+            "{}/contenthash-{:08x}.log",
+            stateDir.view(),
+            stateFileHash(root_path))),
+        root_path));
+    caches_.fastContentHashCache.setStore(std::make_unique<ContentHashStore>(
+        w_string(fmt::format(
+            "{}/contenthash-spooky128-{:08x}.log",
+            stateDir.view(),
+            stateFileHash(root_path))),
+        root_path));
+  }
+
+  auto recordingSize = config_.getInt("watcher_event_recording_size", 0);
+  if (recordingSize > 0 && !flags.dont_save_state &&
+      !flags.watchman_state_file.empty()) {
+    auto stateDir = w_string_piece(flags.watchman_state_file).dirName();
+    eventRecorder_ = std::make_unique<WatcherEventRecorder>(
+        w_string(fmt::format(
+            "{}/watcher-events-{:08x}.bin",
+            stateDir.view(),
+            stateFileHash(root_path))),
+        root_path,
+        recordingSize);
+  }
 }
 
 InMemoryView::~InMemoryView() = default;
@@ -508,6 +1064,10 @@ w_clock_t InMemoryView::ageOutFile(
   logf(DBG, "age_out file={}\n", full_name);
 
   auto ageOutOtime = file->otime;
+  if (changeJournal_) {
+    changeJournal_->record(
+        full_name, file->otime, file->ctime, file->stat.mode);
+  }
 
   // If we have a corresponding dir, we want to arrange to remove it, but only
   // after we have unlinked all of the associated file nodes.
@@ -522,76 +1082,196 @@ w_clock_t InMemoryView::ageOutFile(
 }
 
 void InMemoryView::ageOut(PerfSample& sample, std::chrono::seconds minAge) {
+  // Only one pass may be in flight, since a pass keeps a cursor into the
+  // recency list while it doesn't hold the view lock.
+  std::lock_guard<std::mutex> ageOutGuard(ageOutMutex_);
+
   uint32_t num_aged_files = 0;
   uint32_t num_walked = 0;
+  uint32_t num_slices = 0;
+  size_t num_erased_dirs = 0;
   std::unordered_set<w_string> dirs_to_erase;
+  std::chrono::steady_clock::duration lockHeld{};
+  std::chrono::steady_clock::duration maxSliceLockHeld{};
 
   auto now = std::chrono::system_clock::now();
   lastAgeOutTimestamp_ = now;
-  auto view = view_.wlock();
-
-  watchman_file* file = view->getLatestFile();
-  watchman_file* prior = nullptr;
-  while (file) {
-    ++num_walked;
-    if (file->exists ||
-        std::chrono::system_clock::from_time_t(file->otime.timestamp) + minAge >
-            now) {
-      prior = file;
-      file = file->next;
-      continue;
+  // Files that changed after this are too recent to age out
+  auto cutoff = std::chrono::system_clock::to_time_t(now - minAge);
+
+  // The last file that we decided to keep, and its otime.ticks at that
+  // point.  Files are only freed by age-out, so the node remains valid
+  // between slices, but it may have been moved to the head of the list.
+  watchman_file* cursor = nullptr;
+  uint32_t cursorTicks = 0;
+
+  bool done = false;
+  while (!done) {
+    auto view = view_.wlock();
+    auto sliceStart = std::chrono::steady_clock::now();
+    ++num_slices;
+
+    watchman_file* file;
+    if (!cursor) {
+      file = view->getAgeOutStart(cutoff);
+    } else if (cursor->otime.ticks != cursorTicks) {
+      // The cursor was touched and moved to the head between slices.
+      // Anything that it passed over is still in the same order, but we
+      // no longer know where that is, so start over.
+      cursor = nullptr;
+      file = view->getAgeOutStart(cutoff);
+    } else {
+      file = cursor->next;
     }
 
-    auto agedOtime = ageOutFile(dirs_to_erase, file);
+    uint32_t walkedThisSlice = 0;
+    while (file) {
+      ++num_walked;
+      ++walkedThisSlice;
+      if (file->exists ||
+          std::chrono::system_clock::from_time_t(file->otime.timestamp) +
+                  minAge >
+              now) {
+        cursor = file;
+        cursorTicks = file->otime.ticks;
+        file = file->next;
+      } else {
+        // Grab the next node before ageOutFile frees this one.  Dirs are
+        // only erased at the end of the pass, so it remains valid.
+        auto next = file->next;
+        auto agedOtime = ageOutFile(dirs_to_erase, file);
 
-    // Revise tick for fresh instance reporting
-    lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
+        // Revise tick for fresh instance reporting
+        lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
 
-    num_aged_files++;
+        num_aged_files++;
+        file = next;
+      }
 
-    // Go back to last good file node; we can't trust that the
-    // value of file->next saved before age_out_file is a valid
-    // file node as anything past that point may have also been
-    // aged out along with it.
-    file = prior;
-  }
+      // Checking the clock is relatively expensive, so only do it
+      // periodically.
+      if (file && walkedThisSlice % 256 == 0 &&
+          std::chrono::steady_clock::now() - sliceStart >= ageOutSliceBudget_) {
+        break;
+      }
+    }
+
+    if (!file) {
+      // Reached the end of the list; erase the dirs of any aged out files.
+      // Skip any that were recreated between slices; the crawler will have
+      // given them a new file node in their parent.
+      for (auto& name : dirs_to_erase) {
+        auto parent = view->resolveDir(name.dirName(), false);
+        if (parent && !parent->getChildFile(name.baseName())) {
+          num_erased_dirs += parent->dirs.erase(name.baseName());
+        }
+      }
+      if (num_erased_dirs) {
+        // Erasing a dir frees its files regardless of when they changed
+        view->clearCheckpoints();
+      }
+      view->pruneSuffixIndex();
+      view->pruneNameIndex();
+      view->pruneNames();
+      done = true;
+    }
 
-  for (auto& name : dirs_to_erase) {
-    auto parent = view->resolveDir(name.dirName(), false);
-    if (parent) {
-      parent->dirs.erase(name.baseName());
+    auto held = std::chrono::steady_clock::now() - sliceStart;
+    lockHeld += held;
+    maxSliceLockHeld = std::max(maxSliceLockHeld, held);
+    view.unlock();
+
+    if (!done) {
+      // Give queries a chance at the lock before the next slice.
+      std::this_thread::yield();
     }
   }
 
-  if (num_aged_files + dirs_to_erase.size()) {
-    logf(ERR, "aged {} files, {} dirs\n", num_aged_files, dirs_to_erase.size());
+  auto toMs = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  };
+  lastAgeOutMaxSliceMs_.store(
+      toMs(maxSliceLockHeld), std::memory_order_relaxed);
+  lastAgeOutSlices_.store(num_slices, std::memory_order_relaxed);
+
+  if (num_aged_files + num_erased_dirs) {
+    logf(ERR, "aged {} files, {} dirs\n", num_aged_files, num_erased_dirs);
   }
   sample.add_meta(
       "age_out",
       json_object(
           {{"walked", json_integer(num_walked)},
            {"files", json_integer(num_aged_files)},
-           {"dirs", json_integer(dirs_to_erase.size())}}));
+           {"dirs", json_integer(num_erased_dirs)},
+           {"slices", json_integer(num_slices)},
+           {"lock_held_ms", json_integer(toMs(lockHeld))},
+           {"max_slice_lock_held_ms", json_integer(toMs(maxSliceLockHeld))}}));
 }
 
 void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
-  struct watchman_file* f;
-
-  // Walk back in time until we hit the boundary
-  auto view = view_.rlock();
+  auto view = readView();
   ctx->generationStarted();
-
-  for (f = view->getLatestFile(); f; f = f->next) {
-    ctx->bumpNumWalked();
-    // Note that we use <= for the time comparisons in here so that we
-    // report the things that changed inclusive of the boundary presented.
-    // This is especially important for clients using the coarse unix
-    // timestamp as the since basis, as they would be much more
-    // likely to miss out on changes if we didn't.
-    if (ctx->since.is_timestamp && f->otime.timestamp <= ctx->since.timestamp) {
-      break;
+  SCOPE_EXIT {
+    ctx->walkingInOrder = false;
+  };
+
+  // The recency index leads to the files that changed wherever they are.
+  // If the query can only match those beneath a dir that holds fewer files
+  // than changed, checking each file of that dir is the cheaper walk, and
+  // it avoids working out where each of the changed files is.
+  const watchman_dir* scope = nullptr;
+  w_string scopePath;
+  uint32_t scopeDepth = std::numeric_limits<uint32_t>::max();
+  if (query->limit == 0 || !ctx->ordersByRecency()) {
+    auto required = query->expr ? query->expr->requiredDir() : std::nullopt;
+    if (required) {
+      scopePath = w_string::pathCat(
+          {query->relative_root ? query->relative_root : rootPath_,
+           required->name});
+      scopeDepth = required->depth;
+    } else if (query->relative_root) {
+      scopePath = query->relative_root;
+    }
+    if (scopePath) {
+      scope = view->resolveDir(scopePath);
     }
-    if (!ctx->since.is_timestamp && f->otime.ticks <= ctx->since.clock.ticks) {
+    if (scope &&
+        !changesExceed(
+            *view, ctx->since, filesWithinDepth(scope, scopeDepth))) {
+      scope = nullptr;
+    }
+  }
+
+  if (scope) {
+    changedDirGenerator(query, ctx, WalkedDir{scope, scopePath}, scopeDepth);
+  } else {
+    recencyGenerator(*view, query, ctx, ctx->since);
+  }
+
+  if (changeJournal_ && !ctx->limitReached() &&
+      (ctx->since.is_timestamp ||
+       (!ctx->since.clock.is_fresh_instance &&
+        ctx->since.clock.ticks < lastAgeOutTick_))) {
+    // The aged out files don't fit into the recency order
+    ctx->walkingInOrder = false;
+    journalGenerator(*view, query, ctx);
+  }
+}
+
+void InMemoryView::recencyGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    const QuerySince& since) const {
+  // Walk back in time until we hit the boundary
+  ctx->walkingInOrder = ctx->ordersByRecency();
+  SCOPE_EXIT {
+    ctx->walkingInOrder = false;
+  };
+  for (auto f = view.getLatestFile(); f && !ctx->limitReached();
+       f = f->next) {
+    ctx->bumpNumWalked();
+    if (!changedSince(since, f)) {
       break;
     }
 
@@ -604,6 +1284,118 @@ void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
   }
 }
 
+void InMemoryView::journalGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx) const {
+  std::vector<ChangeJournal::Entry> entries;
+  changeJournal_->forEachSince(
+      ctx->since,
+      [&](const ChangeJournal::Entry& entry) { entries.push_back(entry); });
+  std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+    return a.otime.ticks > b.otime.ticks;
+  });
+
+  auto changes = std::make_shared<ChangeSet>();
+  std::unordered_set<w_string> seen;
+  for (auto& entry : entries) {
+    // Report only the most recent removal of a path, and nothing for paths
+    // that the view has since learned about again.
+    if (!seen.insert(entry.path).second) {
+      continue;
+    }
+    auto dirName = entry.path.dirName();
+    auto baseName = entry.path.baseName();
+    auto dir = view.resolveDir(dirName);
+    if (dir && dir->getChildFile(baseName)) {
+      continue;
+    }
+
+    ChangedFile file;
+    file.dirName = std::move(dirName);
+    file.baseName = std::move(baseName);
+    file.stat.mode = entry.mode;
+    file.otime = entry.otime;
+    file.ctime = entry.ctime;
+    file.exists = false;
+    changes->files.push_back(std::move(file));
+  }
+
+  for (const auto& file : changes->files) {
+    if (ctx->limitReached()) {
+      break;
+    }
+    ctx->bumpNumWalked();
+    if (!ctx->dirMatchesRelativeRoot(file.dirName)) {
+      continue;
+    }
+    w_query_process_file(
+        query,
+        ctx,
+        std::make_unique<InMemoryFileResult>(changes, &file, caches_));
+  }
+}
+
+void InMemoryView::changeSetGenerator(const Query* query, QueryContext* ctx)
+    const {
+  auto changes = changeSet_.copy();
+  auto position = ctx->clockAtStartOfQuery.position();
+  if (!changes || ctx->since.is_timestamp ||
+      ctx->since.clock.is_fresh_instance ||
+      changes->position.rootNumber != position.rootNumber ||
+      changes->position.ticks != position.ticks ||
+      ctx->since.clock.ticks < changes->since.ticks) {
+    timeGenerator(query, ctx);
+    return;
+  }
+
+  // The view may have changed since, but the recorded files are a copy, so
+  // there is no need to lock it.
+  ctx->generationStarted();
+
+  for (const auto& file : changes->files) {
+    if (ctx->limitReached()) {
+      break;
+    }
+    ctx->bumpNumWalked();
+    if (file.otime.ticks <= ctx->since.clock.ticks) {
+      break;
+    }
+
+    if (!ctx->dirMatchesRelativeRoot(file.dirName)) {
+      continue;
+    }
+
+    w_query_process_file(
+        query,
+        ctx,
+        std::make_unique<InMemoryFileResult>(changes, &file, caches_));
+  }
+}
+
+std::optional<bool> InMemoryView::anyFileChangedBetween(
+    ClockPosition since,
+    ClockPosition upTo,
+    const std::function<bool(w_string_piece, w_string_piece)>& visit) const {
+  auto changes = changeSet_.copy();
+  if (!changes || since.rootNumber != upTo.rootNumber ||
+      changes->position.rootNumber != upTo.rootNumber ||
+      changes->position.ticks != upTo.ticks ||
+      since.ticks < changes->since.ticks) {
+    return std::nullopt;
+  }
+
+  for (const auto& file : changes->files) {
+    if (file.otime.ticks <= since.ticks) {
+      break;
+    }
+    if (visit(file.dirName, file.baseName)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
   w_string_t* relative_root;
   struct watchman_file* f;
@@ -614,15 +1406,46 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
-  ctx->generationStarted();
-
+  // Build tools pass thousands of paths, mostly siblings.  Visiting them in
+  // sorted order lets the resolver walk them as a trie, resolving each
+  // shared ancestor once.
+  struct Requested {
+    w_string fullName;
+    w_string dirName;
+    const QueryPath* path;
+  };
+  std::vector<Requested> requested;
+  requested.reserve(query->paths->size());
   for (const auto& path : *query->paths) {
-    const watchman_dir* dir;
-    w_string dir_name;
-
     // Compose path with root
     auto full_name = w_string::pathCat({relative_root, path.name});
+    auto dir_name = full_name.dirName();
+    requested.push_back({std::move(full_name), std::move(dir_name), &path});
+  }
+  // When they all share a parent, which is resolved once regardless, they
+  // are left in the order given.
+  bool oneParent = std::all_of(
+      requested.begin(), requested.end(), [&](const Requested& r) {
+        return r.dirName == requested.front().dirName;
+      });
+  if (!oneParent) {
+    std::stable_sort(
+        requested.begin(),
+        requested.end(),
+        [](const Requested& a, const Requested& b) {
+          return a.fullName < b.fullName;
+        });
+  }
+
+  auto view = readView();
+  ctx->generationStarted();
+  SortedDirResolver resolver{*view};
+
+  for (const auto& [full_name, dir_name, path] : requested) {
+    if (ctx->limitReached()) {
+      break;
+    }
+    const watchman_dir* dir;
 
     // special case of root dir itself
     if (w_string_equal(rootPath_, full_name)) {
@@ -635,12 +1458,11 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     // It's not quite so simple though, because we may resolve a dir
     // that had been deleted and replaced by a file.
     // We prefer to resolve the parent and walk down.
-    dir_name = full_name.dirName();
     if (!dir_name) {
       continue;
     }
 
-    dir = view->resolveDir(dir_name);
+    dir = resolver.resolve(dir_name);
 
     if (!dir) {
       // Doesn't exist, and never has
@@ -648,14 +1470,16 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
     }
 
     if (!dir->files.empty()) {
-      auto file_name = path.name.baseName();
+      auto file_name = path->name.baseName();
       f = dir->getChildFile(file_name);
 
       // If it's a file (but not an existent dir)
       if (f && (!f->exists || !f->stat.isDir())) {
         ctx->bumpNumWalked();
         w_query_process_file(
-            query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+            query,
+            ctx,
+            std::make_unique<InMemoryFileResult>(f, dir_name, caches_));
         continue;
       }
     }
@@ -669,7 +1493,12 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
   is_dir:
     // We got a dir; process recursively to specified depth
     if (dir) {
-      dirGenerator(query, ctx, dir, path.depth);
+      WalkedDir walked{dir, full_name};
+      if (query->parallel) {
+        parallelDirGenerator(query, ctx, walked, path->depth);
+      } else {
+        dirGenerator(query, ctx, walked, path->depth);
+      }
     }
   }
 }
@@ -677,47 +1506,209 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
 void InMemoryView::dirGenerator(
     const Query* query,
     QueryContext* ctx,
-    const watchman_dir* dir,
+    const WalkedDir& dir,
     uint32_t depth) const {
   for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
     auto file = it.second.get();
     ctx->bumpNumWalked();
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(file, caches_));
+    w_query_process_file(query, ctx, dir.makeResult(file, caches_));
+  }
+
+  if (depth > 0) {
+    for (auto& it : dir->dirs) {
+      if (ctx->limitReached()) {
+        return;
+      }
+      dirGenerator(query, ctx, WalkedDir{dir, it.second.get()}, depth - 1);
+    }
+  }
+}
+
+void InMemoryView::changedDirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const WalkedDir& dir,
+    uint32_t depth) const {
+  for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    auto file = it.second.get();
+    ctx->bumpNumWalked();
+    if (!changedSince(ctx->since, file)) {
+      continue;
+    }
+
+    w_query_process_file(query, ctx, dir.makeResult(file, caches_));
   }
 
   if (depth > 0) {
     for (auto& it : dir->dirs) {
-      const auto child = it.second.get();
+      if (ctx->limitReached()) {
+        return;
+      }
+      changedDirGenerator(
+          query, ctx, WalkedDir{dir, it.second.get()}, depth - 1);
+    }
+  }
+}
+
+void InMemoryView::parallelDirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const WalkedDir& dir,
+    uint32_t depth) const {
+  auto& pool = getThreadPool();
+  // The pool's threads plus this one
+  size_t numThreads = pool.numWorkers() + 1;
+  if (numThreads == 1 || depth == 0) {
+    dirGenerator(query, ctx, dir, depth);
+    return;
+  }
+
+  // The subtrees are walked on other threads, so they are given their own
+  // copies of their paths rather than referring to their parents.
+  struct Subtree {
+    WalkedDir dir;
+    uint32_t depth;
+  };
+
+  // Process the files at the top of the tree on this thread until it has
+  // branched out far enough to keep all of the threads busy.
+  std::vector<Subtree> subtrees{{WalkedDir{dir.get(), dir.path()}, depth}};
+  for (uint32_t level = 0; level < kMaxSplitDepth &&
+       subtrees.size() < numThreads * kSubtreesPerThread;
+       ++level) {
+    std::vector<Subtree> children;
+    for (auto& subtree : subtrees) {
+      for (auto& it : subtree.dir->files) {
+        if (ctx->limitReached()) {
+          return;
+        }
+        ctx->bumpNumWalked();
+        w_query_process_file(
+            query, ctx, subtree.dir.makeResult(it.second.get(), caches_));
+      }
+      if (subtree.depth > 0) {
+        for (auto& it : subtree.dir->dirs) {
+          auto child = it.second.get();
+          children.push_back(
+              {WalkedDir{child,
+                         w_string::pathCat({subtree.dir.path(), child->name})},
+               subtree.depth - 1});
+        }
+      }
+    }
+    subtrees = std::move(children);
+  }
+  if (subtrees.empty()) {
+    return;
+  }
+
+  // Tasks that only get to run after the walk is complete still refer to
+  // this, so its lifetime is shared with them.  Such a task finds no
+  // subtrees left and touches nothing else.
+  struct Walk {
+    std::vector<Subtree> subtrees;
+    std::vector<std::unique_ptr<QueryContext>> shards;
+    std::atomic<size_t> nextSubtree{0};
+    std::atomic<size_t> nextShard{0};
+
+    std::mutex mutex;
+    std::condition_variable done;
+    // Protected by mutex
+    size_t numDone{0};
+    std::exception_ptr error;
+  };
+  auto walk = std::make_shared<Walk>();
+  walk->subtrees = std::move(subtrees);
+  size_t numShards = std::min(numThreads, walk->subtrees.size());
+  for (size_t i = 0; i < numShards; ++i) {
+    walk->shards.push_back(ctx->createShard());
+  }
+
+  auto run = [this, query, walk] {
+    auto& shard = *walk->shards[walk->nextShard++];
+    size_t i;
+    while ((i = walk->nextSubtree++) < walk->subtrees.size()) {
+      std::exception_ptr error;
+      try {
+        dirGenerator(
+            query, &shard, walk->subtrees[i].dir, walk->subtrees[i].depth);
+      } catch (const std::exception&) {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(walk->mutex);
+      if (error && !walk->error) {
+        walk->error = error;
+      }
+      if (++walk->numDone == walk->subtrees.size()) {
+        walk->done.notify_all();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < numShards; ++i) {
+    try {
+      pool.add(run);
+    } catch (const std::exception& exc) {
+      // The pool is busy or stopping; this thread will pick up the slack.
+      logf(DBG, "not parallelizing query walk: {}\n", exc.what());
+      break;
+    }
+  }
+  run();
 
-      dirGenerator(query, ctx, child, depth - 1);
+  {
+    std::unique_lock<std::mutex> lock(walk->mutex);
+    walk->done.wait(
+        lock, [&] { return walk->numDone == walk->subtrees.size(); });
+    if (walk->error) {
+      std::rethrow_exception(walk->error);
     }
   }
+
+  for (auto& shard : walk->shards) {
+    ctx->mergeShard(*shard);
+  }
 }
 
 /** This is our specialized handler for the ** recursive glob pattern.
- * This is the unhappy path because we have no choice but to recursively
- * walk the tree; we have no way to prune portions that won't match.
+ * This is the unhappy path because we have to recursively walk the tree;
+ * the only portions that we can prune are those whose path already rules
+ * out a match, such as dot dirs when the query doesn't include dotfiles.
  * We do coalesce recursive matches together that might generate multiple
  * results.
  * For example: */
 // globs: ["foo/**/*.h", "foo/**/**/*.h"]
 /* effectively runs the same query multiple times.  By combining the
  * doublestar walk for both into a single walk, we can then match each
- * file against the list of patterns, terminating that match as soon
- * as any one of them matches the file node.
+ * file against all of the patterns at once.  The matcher consumes each
+ * path component once, when we descend into its dir, rather than once per
+ * file and pattern.
  */
 void InMemoryView::globGeneratorDoublestar(
     QueryContext* ctx,
-    const struct watchman_dir* dir,
+    GlobTreeMatcher& matcher,
+    const WalkedDir& dir,
     const GlobTree* node,
-    const char* dir_name,
-    uint32_t dir_name_len) const {
-  bool matched;
+    GlobMatcher::State state,
+    StringBuffer& dir_name) const {
+  auto& patterns = *matcher.get(node).doublestar;
+  // We only need the full path to hand to wildmatch
+  bool needPath = patterns.hasFallbackPatterns();
+  std::vector<uint32_t> matched;
 
   // First step is to walk the set of files contained in this node
   for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
     auto file = it.second.get();
     auto file_name = file->getName();
 
@@ -728,39 +1719,30 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, file_name.data(), file_name.size());
-
-    // Now that we have computed the name of this candidate file node,
-    // attempt to match against each of the possible doublestar patterns
-    // in turn.  As soon as any one of them matches we can stop this loop
-    // as it doesn't make a lot of sense to yield multiple results for
-    // the same file.
-    for (const auto& child_node : node->doublestar_children) {
-      matched =
-          wildmatch(
-              child_node->pattern.c_str(),
-              subject.c_str(),
-              ctx->query->glob_flags | WM_PATHNAME |
-                  (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive
-                       ? 0
-                       : WM_CASEFOLD),
-              0) == WM_MATCH;
-
-      if (matched) {
-        w_query_process_file(
-            ctx->query,
-            ctx,
-            std::make_unique<InMemoryFileResult>(file, caches_));
-        // No sense running multiple matches for this same file node
-        // if this one succeeded.
-        break;
-      }
+    // Match the candidate against all of the doublestar patterns at once.
+    // We only need to know whether any one of them matched as it doesn't
+    // make a lot of sense to yield multiple results for the same file.
+    auto fileState = patterns.advance(state, file_name.view());
+    matched.clear();
+    if (needPath) {
+      auto dir_name_len = dir_name.size();
+      dir_name.appendComponent(file_name);
+      patterns.matches(fileState, dir_name.c_str(), matched);
+      dir_name.resize(dir_name_len);
+    } else {
+      patterns.matches(fileState, nullptr, matched);
+    }
+
+    if (!matched.empty()) {
+      w_query_process_file(ctx->query, ctx, dir.makeResult(file, caches_));
     }
   }
 
-  // And now walk down to any dirs; all dirs are eligible
+  // And now walk down to any dirs that can still contain matches
   for (auto& it : dir->dirs) {
+    if (ctx->limitReached()) {
+      return;
+    }
     const auto child = it.second.get();
 
     if (!child->last_check_existed) {
@@ -768,71 +1750,129 @@ void InMemoryView::globGeneratorDoublestar(
       continue;
     }
 
-    auto subject = make_path_name(
-        dir_name, dir_name_len, child->name.data(), child->name.size());
-    globGeneratorDoublestar(ctx, child, node, subject.data(), subject.size());
+    auto childState =
+        patterns.advance(patterns.advance(state, child->name.view()), "/");
+    if (patterns.isDead(childState)) {
+      continue;
+    }
+
+    WalkedDir walkedChild{dir, child};
+    if (needPath) {
+      auto dir_name_len = dir_name.size();
+      dir_name.appendComponent(child->name);
+      globGeneratorDoublestar(
+          ctx, matcher, walkedChild, node, childState, dir_name);
+      dir_name.resize(dir_name_len);
+    } else {
+      globGeneratorDoublestar(
+          ctx, matcher, walkedChild, node, childState, dir_name);
+    }
+  }
+}
+
+void InMemoryView::globGeneratorIndexed(
+    QueryContext* ctx,
+    GlobTreeMatcher& matcher,
+    const watchman_dir* dir,
+    const GlobTree* node,
+    const std::vector<FileIndexList>& lists) const {
+  auto& patterns = *matcher.get(node).doublestar;
+  std::vector<const watchman_dir*> parents;
+  std::string relative;
+  std::vector<uint32_t> matched;
+
+  for (auto& list : lists) {
+    for (auto file = list.head; file && !ctx->limitReached();
+         file = file->*list.next) {
+      ctx->bumpNumWalked();
+      if (!file->exists) {
+        // Globs can only match files that exist
+        continue;
+      }
+
+      // Build the path of the file relative to dir, if it is beneath it and
+      // every dir in between exists
+      parents.clear();
+      auto parent = file->parent;
+      while (parent && parent != dir && parent->last_check_existed) {
+        parents.push_back(parent);
+        parent = parent->parent;
+      }
+      if (parent != dir) {
+        continue;
+      }
+      relative.clear();
+      for (auto it = parents.rbegin(); it != parents.rend(); ++it) {
+        relative.append((*it)->name.data(), (*it)->name.size());
+        relative.push_back('/');
+      }
+      auto file_name = file->getName();
+      relative.append(file_name.data(), file_name.size());
+
+      matched.clear();
+      patterns.matches(
+          patterns.advance(patterns.start(), relative),
+          relative.c_str(),
+          matched);
+      if (!matched.empty()) {
+        w_query_process_file(
+            ctx->query,
+            ctx,
+            std::make_unique<InMemoryFileResult>(file, caches_));
+      }
+    }
   }
 }
 
 /* Match each child of node against the children of dir */
 void InMemoryView::globGeneratorTree(
     QueryContext* ctx,
+    const ViewDatabase& view,
+    GlobTreeMatcher& matcher,
     const GlobTree* node,
-    const struct watchman_dir* dir) const {
+    const WalkedDir& dir) const {
+  if (ctx->limitReached()) {
+    return;
+  }
+  auto& compiled = matcher.get(node);
+
   if (!node->doublestar_children.empty()) {
-    globGeneratorDoublestar(ctx, dir, node, nullptr, 0);
-  }
-
-  for (const auto& child_node : node->children) {
-    w_assert(!child_node->is_doublestar, "should not get here with ** glob");
-
-    // If there are child dirs, consider them for recursion.
-    // Note that we don't restrict this to !leaf because the user may have
-    // set their globs list to something like ["some_dir", "some_dir/file"]
-    // and we don't want to preclude matching the latter.
-    if (!dir->dirs.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
-        const auto child_dir = dir->getChildDir(component);
-
-        if (child_dir) {
-          globGeneratorTree(ctx, child_node.get(), child_dir);
-        }
-      } else {
-        // Otherwise we have to walk and match
-        for (auto& it : dir->dirs) {
-          const auto child_dir = it.second.get();
+    // Patterns such as **/*.h can only match files on a few of the lists of
+    // the view's indexes, which may be far fewer than the files beneath dir.
+    auto lists = doublestarIndexLists(view, node);
+    if (lists &&
+        countFilesUpTo(*lists, dir->subtreeFiles) < dir->subtreeFiles) {
+      globGeneratorIndexed(ctx, matcher, dir.get(), node, *lists);
+    } else {
+      StringBuffer dir_name;
+      globGeneratorDoublestar(
+          ctx, matcher, dir, node, compiled.doublestar->start(), dir_name);
+    }
+  }
 
-          if (!child_dir->last_check_existed) {
-            // Globs can only match files in dirs that exist
-            continue;
-          }
+  // Children without wildcards can be looked up by name when we are
+  // matching case sensitively; the matcher only holds the others.
+  if (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
+    for (const auto& child_node : node->children) {
+      w_assert(!child_node->is_doublestar, "should not get here with ** glob");
+      if (child_node->had_specials) {
+        continue;
+      }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  child_dir->name.c_str(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            globGeneratorTree(ctx, child_node.get(), child_dir);
-          }
-        }
+      w_string_piece component(
+          child_node->pattern.data(), child_node->pattern.size());
+
+      // Note that we don't restrict this to !leaf because the user may have
+      // set their globs list to something like ["some_dir", "some_dir/file"]
+      // and we don't want to preclude matching the latter.
+      const auto child_dir = dir->getChildDir(component);
+      if (child_dir) {
+        globGeneratorTree(
+            ctx, view, matcher, child_node.get(), WalkedDir{dir, child_dir});
       }
-    }
 
-    // If the node is a leaf we are in a position to match files.
-    if (child_node->is_leaf && !dir->files.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
+      // If the node is a leaf we are in a position to match files.
+      if (child_node->is_leaf) {
         auto file = dir->getChildFile(component);
 
         if (file) {
@@ -840,40 +1880,99 @@ void InMemoryView::globGeneratorTree(
           if (file->exists) {
             // Globs can only match files that exist
             w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
+                ctx->query, ctx, dir.makeResult(file, caches_));
           }
         }
-      } else {
-        for (auto& it : dir->files) {
-          // Otherwise we have to walk and match
-          auto file = it.second.get();
-          auto file_name = file->getName();
-          ctx->bumpNumWalked();
+      }
+    }
+  }
 
-          if (!file->exists) {
-            // Globs can only match files that exist
-            continue;
-          }
+  if (compiled.comparedChildren.empty() && compiled.matchedChildren.empty()) {
+    return;
+  }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  file_name.data(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
-          }
-        }
+  // Otherwise we have to walk and match.  Each entry is compared with the
+  // children that are a literal with a leading or trailing star, and matched
+  // against the rest in a single pass.
+  auto patterns = compiled.children.get();
+  auto flags = matcher.flags();
+  std::vector<uint32_t> matched;
+
+  for (auto& it : dir->dirs) {
+    const auto child_dir = it.second.get();
+
+    if (!child_dir->last_check_existed) {
+      // Globs can only match files in dirs that exist
+      continue;
+    }
+
+    WalkedDir walkedChild{dir, child_dir};
+    for (auto child_node : compiled.comparedChildren) {
+      if (child_node->matchesName(child_dir->name.view(), flags)) {
+        globGeneratorTree(ctx, view, matcher, child_node, walkedChild);
       }
     }
+    if (!patterns) {
+      continue;
+    }
+    matched.clear();
+    patterns->matches(
+        patterns->advance(patterns->start(), child_dir->name.view()),
+        child_dir->name.c_str(),
+        matched);
+    for (auto index : matched) {
+      globGeneratorTree(
+          ctx, view, matcher, compiled.matchedChildren[index], walkedChild);
+    }
+  }
+
+  auto isLeaf = [](const GlobTree* child) { return child->is_leaf; };
+  bool anyLeaf = std::any_of(
+                     compiled.comparedChildren.begin(),
+                     compiled.comparedChildren.end(),
+                     isLeaf) ||
+      std::any_of(
+                     compiled.matchedChildren.begin(),
+                     compiled.matchedChildren.end(),
+                     isLeaf);
+  if (!anyLeaf) {
+    return;
+  }
+
+  for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    auto file = it.second.get();
+    auto file_name = file->getName();
+    ctx->bumpNumWalked();
+
+    if (!file->exists) {
+      // Globs can only match files that exist
+      continue;
+    }
+
+    bool leafMatched = std::any_of(
+        compiled.comparedChildren.begin(),
+        compiled.comparedChildren.end(),
+        [&](const GlobTree* child) {
+          return child->is_leaf &&
+              child->matchesName(file_name.view(), flags);
+        });
+    if (!leafMatched && patterns) {
+      matched.clear();
+      patterns->matches(
+          patterns->advance(patterns->start(), file_name.view()),
+          file_name.data(),
+          matched);
+      leafMatched = std::any_of(
+          matched.begin(), matched.end(), [&](uint32_t index) {
+            return compiled.matchedChildren[index]->is_leaf;
+          });
+    }
+    if (leafMatched) {
+      w_query_process_file(ctx->query, ctx, dir.makeResult(file, caches_));
+    }
   }
 }
 
@@ -886,7 +1985,7 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
     relative_root = rootPath_;
   }
 
-  auto view = view_.rlock();
+  auto view = readView();
 
   const auto dir = view->resolveDir(relative_root);
   if (!dir) {
@@ -897,16 +1996,243 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
         "relative_root parameter!"));
   }
 
-  globGeneratorTree(ctx, query->glob_tree.get(), dir);
+  // The suffix index lists files from all over the view, so beneath a
+  // relative root it only pays if it lists fewer files than that holds.
+  if (query->suffixes &&
+      (!query->relative_root ||
+       countFilesUpTo(
+           suffixListHeads(*view, *query->suffixes),
+           &watchman_file::suffix_next,
+           dir->subtreeFiles) < dir->subtreeFiles)) {
+    suffixGenerator(*view, query, ctx, *query->suffixes, true);
+    return;
+  }
+
+  // The patterns are compiled once per query, as the walk reaches each
+  // node of the tree.
+  bool caseSensitive = query->case_sensitive == CaseSensitivity::CaseSensitive;
+  GlobTreeMatcher matcher(
+      query->glob_flags | (caseSensitive ? 0 : WM_CASEFOLD), caseSensitive);
+  globGeneratorTree(
+      ctx,
+      *view,
+      matcher,
+      query->glob_tree.get(),
+      WalkedDir{dir, relative_root});
+}
+
+void InMemoryView::suffixGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& suffixes,
+    bool existingOnly) const {
+  for (const auto& suffix : suffixes) {
+    for (auto f = view.getFilesWithSuffix(suffix); f && !ctx->limitReached();
+         f = f->suffix_next) {
+      ctx->bumpNumWalked();
+      if (existingOnly && !f->exists) {
+        continue;
+      }
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      w_query_process_file(
+          query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+    }
+  }
+}
+
+void InMemoryView::nameGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<w_string>& names) const {
+  for (const auto& name : names) {
+    for (auto f = view.getFilesNamed(name); f && !ctx->limitReached();
+         f = f->name_next) {
+      ctx->bumpNumWalked();
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      w_query_process_file(
+          query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+    }
+  }
+}
+
+void InMemoryView::typeGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    DType type) const {
+  for (auto f = view.getFilesOfType(type); f && !ctx->limitReached();
+       f = f->type_next) {
+    ctx->bumpNumWalked();
+    if (!ctx->fileMatchesRelativeRoot(f)) {
+      continue;
+    }
+
+    w_query_process_file(
+        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+  }
+}
+
+void InMemoryView::metadataGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    const MetadataFilter& filter) const {
+  view.getMetadataTable()->scan(filter, [&](watchman_file* f) {
+    ctx->bumpNumWalked();
+    if (ctx->limitReached() || !ctx->fileMatchesRelativeRoot(f)) {
+      return;
+    }
+
+    w_query_process_file(
+        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+  });
+}
+
+bool InMemoryView::indexGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx,
+    std::optional<size_t> maxFiles) const {
+  if (auto suffixes = query->expr->requiredSuffixes()) {
+    if (maxFiles &&
+        countFilesUpTo(
+            suffixListHeads(view, *suffixes),
+            &watchman_file::suffix_next,
+            *maxFiles) >= *maxFiles) {
+      return false;
+    }
+    suffixGenerator(view, query, ctx, *suffixes, false);
+    return true;
+  }
+
+  auto type = query->expr->requiredType();
+  if (!type || !ViewDatabase::indexesType(*type)) {
+    return false;
+  }
+  if (maxFiles &&
+      countFilesUpTo(
+          {view.getFilesOfType(*type)}, &watchman_file::type_next, *maxFiles) >=
+          *maxFiles) {
+    return false;
+  }
+  typeGenerator(view, query, ctx, *type);
+  return true;
 }
 
 void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
     const {
   struct watchman_file* f;
-  auto view = view_.rlock();
+  auto view = readView();
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
+  // The first files on the recency list to match are the answer to a
+  // query for the most recently changed ones, which usually makes walking
+  // it cheaper than any of the indexes below.
+  bool topByRecency = query->limit != 0 && ctx->ordersByRecency();
+
+  // If the expression can only match files with certain names, look them
+  // up; a handful of names is typically the narrowest restriction of all.
+  if (query->expr && !topByRecency) {
+    if (auto names = query->expr->requiredNames()) {
+      nameGenerator(*view, query, ctx, *names);
+      return;
+    }
+  }
+
+  // If the expression can only match files that changed after some point,
+  // the files on the recency index ahead of that are the only candidates.
+  // This is how a "since" term nested within "allof" avoids a full walk.
+  std::optional<MetadataFilter> filter;
+  std::optional<QuerySince> changedAfter;
+  if (query->expr) {
+    filter = query->expr->requiredMetadata(ctx);
+    if (filter) {
+      changedAfter = changedSinceBound(*view, *filter);
+    }
+  }
+
+  // If the expression can only match files within a subtree, walk just that
+  // subtree, to the depth that can match, unless the expression is also
+  // confined to fewer files that changed, or to an index that lists fewer
+  // files, than the subtree holds.
+  if (query->expr && !topByRecency) {
+    if (auto required = query->expr->requiredDir()) {
+      auto fullName = w_string::pathCat(
+          {query->relative_root ? query->relative_root : rootPath_,
+           required->name});
+      auto dir = view->resolveDir(fullName);
+      if (dir) {
+        auto dirFiles = filesWithinDepth(dir, required->depth);
+        if (changedAfter && !changesExceed(*view, *changedAfter, dirFiles)) {
+          recencyGenerator(*view, query, ctx, *changedAfter);
+        } else if (!indexGenerator(*view, query, ctx, dirFiles)) {
+          WalkedDir walked{dir, fullName};
+          if (query->parallel) {
+            parallelDirGenerator(query, ctx, walked, required->depth);
+          } else {
+            dirGenerator(query, ctx, walked, required->depth);
+          }
+        }
+      }
+      return;
+    }
+  }
+
+  // If the expression can only match files with certain suffixes or of
+  // certain types, there's no need to look at any of the others.
+  if (query->expr && !topByRecency) {
+    std::optional<size_t> maxFiles;
+    if (changedAfter) {
+      maxFiles = view->estimateFilesChangedSince(*changedAfter);
+    }
+    if (indexGenerator(*view, query, ctx, maxFiles)) {
+      return;
+    }
+  }
+
+  if (changedAfter) {
+    // Unless so many of the files changed that the scan of the metadata
+    // table or the parallel walk below would get through them sooner
+    auto numFiles = view->resolveDir(rootPath_)->subtreeFiles;
+    if (topByRecency || !(view->getMetadataTable() || query->parallel) ||
+        !changesExceed(
+            *view, *changedAfter, numFiles / kRecencyWalkMaxFraction)) {
+      recencyGenerator(*view, query, ctx, *changedAfter);
+      return;
+    }
+  }
+
+  // Otherwise, if the view keeps a dense copy of the metadata that the
+  // expression bounds, scan that rather than the file nodes
+  if (filter && !topByRecency && view->getMetadataTable()) {
+    metadataGenerator(*view, query, ctx, *filter);
+    return;
+  }
+
+  if (query->parallel && !topByRecency) {
+    // The recency index can't be divided up, but the tree can
+    const auto dir = view->resolveDir(
+        query->relative_root ? query->relative_root : rootPath_);
+    if (dir) {
+      parallelDirGenerator(
+          query, ctx, dir, std::numeric_limits<uint32_t>::max());
+    }
+    return;
+  }
+
+  ctx->walkingInOrder = ctx->ordersByRecency();
+  SCOPE_EXIT {
+    ctx->walkingInOrder = false;
+  };
+  for (f = view->getLatestFile(); f && !ctx->limitReached(); f = f->next) {
     ctx->bumpNumWalked();
     if (!ctx->fileMatchesRelativeRoot(f)) {
       continue;
@@ -927,106 +2253,618 @@ w_string InMemoryView::getCurrentClockString() const {
           rootNumber_, mostRecentTick_, clockbuf, sizeof(clockbuf))) {
     throw std::runtime_error("clock string exceeded clockbuf size");
   }
-  return w_string(clockbuf, W_STRING_UNICODE);
+  return w_string(clockbuf, W_STRING_UNICODE);
+}
+
+uint32_t InMemoryView::getLastAgeOutTickValue() const {
+  // Clocks from before an age-out remain good for as long as the journal
+  // remembers what it removed
+  if (changeJournal_) {
+    return changeJournal_->forgottenTicks();
+  }
+  return lastAgeOutTick_;
+}
+
+std::vector<ClockEpoch> InMemoryView::getClockEpochs() const {
+  return *clockEpochs_.rlock();
+}
+
+std::chrono::system_clock::time_point InMemoryView::getLastAgeOutTimeStamp()
+    const {
+  return lastAgeOutTimestamp_;
+}
+
+void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
+  // Start a thread to call into the watcher API for filesystem notifications
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  logf(DBG, "starting threads for {} {}\n", fmt::ptr(this), rootPath_);
+  std::thread notifyThreadInstance([self, root]() {
+    w_set_thread_name(
+        "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    ThreadAccount account{"notify", self->rootPath_.string()};
+    try {
+      self->notifyThread(root);
+    } catch (const std::exception& e) {
+      watchman::log(watchman::ERR, "Exception: ", e.what(), " cancel root\n");
+      root->cancel();
+    }
+    watchman::log(watchman::DBG, "out of loop\n");
+  });
+  notifyThreadInstance.detach();
+
+  // Wait for it to signal that the watcher has been initialized
+  bool pinged = false;
+  pendingFromWatcher_.lockAndWait(
+      std::chrono::milliseconds(-1) /* infinite */, pinged);
+
+  // And now start the IO thread
+  threadsStarted_ = true;
+  std::thread ioThreadInstance([self, root]() {
+    w_set_thread_name(
+        "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    ThreadAccount account{"io", self->rootPath_.string()};
+    try {
+      self->ioThread(root);
+    } catch (const std::exception& e) {
+      watchman::log(watchman::ERR, "Exception: ", e.what(), " cancel root\n");
+      root->cancel();
+    }
+    watchman::log(watchman::DBG, "out of loop\n");
+    self->ioThreadStopped_.set_value();
+  });
+  ioThreadInstance.detach();
+}
+
+void InMemoryView::stopThreads() {
+  logf(DBG, "signalThreads! {} {}\n", fmt::ptr(this), rootPath_);
+  stopThreads_ = true;
+  watcher_->stopThreads();
+  pendingFromWatcher_.lock()->ping();
+}
+
+bool InMemoryView::waitForThreadsToStop(
+    std::chrono::steady_clock::time_point deadline) {
+  if (!threadsStarted_) {
+    return true;
+  }
+  // The notify thread holds nothing that needs saving, so only the IO
+  // thread is waited for
+  return ioThreadStoppedFuture_.wait_until(deadline) ==
+      std::future_status::ready;
+}
+
+void InMemoryView::wakeThreads() {
+  pendingFromWatcher_.lock()->ping();
+}
+
+void InMemoryView::discardSnapshot() {
+  snapshotDiscarded_.store(true, std::memory_order_release);
+}
+
+/* Ensure that we're synchronized with the state of the
+ * filesystem at the current time.
+ * We do this by touching a cookie file and waiting to
+ * observe it via inotify.  When we see it we know that
+ * we've seen everything up to the point in time at which
+ * we're asking questions.
+ * Throws a std::system_error with an ETIMEDOUT error if
+ * the timeout expires before we observe the change, or
+ * a runtime_error if the root has been deleted or rendered
+ * inaccessible. */
+void InMemoryView::syncToNow(
+    const std::shared_ptr<Root>& root,
+    std::chrono::milliseconds timeout,
+    std::vector<w_string>& cookieFileNames) {
+  // Watchers with an ordered event stream can tell us which event is "now",
+  // which saves the round trip through the filesystem for a cookie.
+  auto sequenced = watcher_->syncToSequencePosition();
+  if (sequenced.valid()) {
+    try {
+      std::move(sequenced).get(timeout);
+    } catch (folly::FutureTimeout&) {
+      auto why = folly::to<std::string>(
+          "syncToNow: timed out waiting for watcher events within ",
+          timeout.count(),
+          " milliseconds");
+      log(ERR, why, "\n");
+      throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+    }
+    return;
+  }
+
+  syncToNowCookies(root, timeout, cookieFileNames);
+
+  // Some watcher implementations (notably, FSEvents) reorder change events
+  // before they're reported, and cookie files are not sufficient. Instead, the
+  // watcher supports direct synchronization. Once a cookie file has been
+  // observed, ensure that all pending events have been flushed and wait until
+  // the pending event queue is fully crawled.
+  auto result = watcher_->flushPendingEvents();
+  if (result.valid()) {
+    // The watcher has made all pending events available and inserted a promise
+    // into its PendingCollection. Wait for InMemoryView to observe it and
+    // everything prior.
+    //
+    // Would be nice to use a deadline rather than a timeout here.
+
+    try {
+      std::move(result).get(timeout);
+    } catch (folly::FutureTimeout&) {
+      auto why = folly::to<std::string>(
+          "syncToNow: timed out waiting for pending watcher events to be flushed within ",
+          timeout.count(),
+          " milliseconds");
+      log(ERR, why, "\n");
+      throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+    }
+  }
+}
+
+void InMemoryView::addPriorityPaths(
+    const void* query,
+    std::vector<w_string> paths) {
+  if (priorityYieldTimeout_.count() > 0) {
+    priorityPaths_.add(query, std::move(paths));
+  }
+}
+
+bool InMemoryView::shouldDeferCrawl(const Root& root, const w_string& dir) {
+  if (depthBelow(rootPath_, dir) < lazyCrawlDepth_) {
+    return false;
+  }
+  // Cookies have to be seen for queries to sync at all
+  for (auto& cookieDir : root.cookies.cookieDirs()) {
+    if (isWithin(cookieDir, dir)) {
+      return false;
+    }
+  }
+  auto lazy = lazyCrawl_.wlock();
+  for (auto& path : lazy->materialized) {
+    if (isWithin(dir, path) || isWithin(path, dir)) {
+      return false;
+    }
+  }
+  lazy->deferred.insert(dir);
+  return true;
+}
+
+std::optional<size_t> InMemoryView::summaryDirContaining(
+    const w_string& path) const {
+  for (size_t i = 0; i < summaryDirPaths_.size(); ++i) {
+    if (isWithin(path, summaryDirPaths_[i])) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+void InMemoryView::markSummaryDirChanged(
+    ViewDatabase& view,
+    size_t index,
+    std::chrono::system_clock::time_point now) {
+  if (auto file = existingNode(view, summaryDirPaths_[index])) {
+    view.markFileChanged(*watcher_, file, getClock(now));
+  }
+  auto dirs = summaryDirs_.wlock();
+  ++(*dirs)[index].changes;
+  (*dirs)[index].dirty = true;
+}
+
+InMemoryView::SummaryTotals InMemoryView::walkSummaryDir(
+    const std::shared_ptr<Root>& root,
+    const w_string& path) {
+  TraceSpan span("io", "walkSummaryDir", path.view());
+  SummaryTotals totals;
+  std::vector<w_string> toWalk{path};
+  while (!toWalk.empty()) {
+    auto dirPath = std::move(toWalk.back());
+    toWalk.pop_back();
+
+    std::unique_ptr<DirHandle> osdir;
+    try {
+      ThreadWait wait(ThreadAccount::Io);
+      osdir = watcher_->startWatchDir(root, nullptr, dirPath.c_str());
+    } catch (const std::system_error& err) {
+      // It was removed or replaced since it was read; the watcher reports
+      // that as a change beneath the summary dir
+      logf(DBG, "walkSummaryDir: opendir({}) {}\n", dirPath, err.what());
+      continue;
+    }
+
+    auto readNext = [&] {
+      ThreadWait wait(ThreadAccount::Io);
+      return osdir->readDir();
+    };
+    try {
+      while (const DirEntry* dirent = readNext()) {
+        if (dirent->d_name[0] == '.' &&
+            (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
+          continue;
+        }
+        auto fullPath = w_string::pathCat({dirPath, dirent->d_name});
+        if (root->ignore.isIgnored(fullPath.data(), fullPath.size())) {
+          continue;
+        }
+        FileInformation st;
+        if (dirent->has_stat) {
+          st = dirent->stat;
+        } else {
+          try {
+            st = getEntryInformation(*root, fullPath);
+          } catch (const std::system_error&) {
+            continue;
+          }
+        }
+        if (st.isDir()) {
+          ++totals.dirs;
+          toWalk.push_back(std::move(fullPath));
+        } else {
+          ++totals.files;
+        }
+        if (st.mtime.tv_sec > totals.newestMtime.tv_sec ||
+            (st.mtime.tv_sec == totals.newestMtime.tv_sec &&
+             st.mtime.tv_nsec > totals.newestMtime.tv_nsec)) {
+          totals.newestMtime = st.mtime;
+        }
+      }
+    } catch (const std::system_error& err) {
+      logf(DBG, "walkSummaryDir: readdir({}) {}\n", dirPath, err.what());
+    }
+  }
+  return totals;
+}
+
+void InMemoryView::refreshSummaryDirs(const std::shared_ptr<Root>& root) {
+  for (size_t i = 0; i < summaryDirPaths_.size(); ++i) {
+    {
+      auto dirs = summaryDirs_.wlock();
+      if (!(*dirs)[i].dirty) {
+        continue;
+      }
+      (*dirs)[i].dirty = false;
+    }
+
+    auto totals = walkSummaryDir(root, summaryDirPaths_[i]);
+
+    bool changed;
+    {
+      auto dirs = summaryDirs_.wlock();
+      auto& dir = (*dirs)[i];
+      // The first walk has nothing to compare with; it happens when the
+      // root first settles after crawling the dir's parent
+      changed = dir.walks > 0 &&
+          (totals.files != dir.totals.files ||
+           totals.dirs != dir.totals.dirs ||
+           totals.newestMtime.tv_sec != dir.totals.newestMtime.tv_sec ||
+           totals.newestMtime.tv_nsec != dir.totals.newestMtime.tv_nsec);
+      dir.totals = totals;
+      ++dir.walks;
+    }
+    if (changed) {
+      auto view = lockView();
+      mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+      if (auto file = existingNode(*view, summaryDirPaths_[i])) {
+        view->markFileChanged(
+            *watcher_, file, getClock(std::chrono::system_clock::now()));
+      }
+    }
+  }
+}
+
+bool InMemoryView::addMaterialized(
+    LazyCrawl& lazy,
+    const w_string& path,
+    std::vector<w_string>& toCrawl) {
+  auto& materialized = lazy.materialized;
+  if (std::any_of(
+          materialized.begin(), materialized.end(), [&](auto& existing) {
+            return isWithin(path, existing);
+          })) {
+    return false;
+  }
+  materialized.erase(
+      std::remove_if(
+          materialized.begin(),
+          materialized.end(),
+          [&](auto& existing) { return isWithin(existing, path); }),
+      materialized.end());
+  materialized.push_back(path);
+
+  // Crawling a deferred dir above the path only crawls the dirs that lead
+  // down to it; the rest are deferred again.
+  for (auto it = lazy.deferred.begin(); it != lazy.deferred.end();) {
+    if (isWithin(*it, path) || isWithin(path, *it)) {
+      toCrawl.push_back(*it);
+      it = lazy.deferred.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return true;
+}
+
+void InMemoryView::materialize(
+    const std::vector<w_string>& paths,
+    std::chrono::milliseconds timeout) {
+  if (lazyCrawlDepth_ == 0) {
+    return;
+  }
+
+  std::vector<w_string> toCrawl;
+  bool added = false;
+  {
+    auto lazy = lazyCrawl_.wlock();
+    for (auto& path : paths) {
+      added |= addMaterialized(*lazy, path, toCrawl);
+    }
+  }
+  if (!added) {
+    return;
+  }
+
+  auto [promise, future] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto now = std::chrono::system_clock::now();
+    auto pending = pendingFromWatcher_.lock();
+    for (auto& dir : toCrawl) {
+      pending->add(dir, now, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+    }
+    pending->addSync(std::move(promise));
+    pending->ping();
+  }
+
+  try {
+    std::move(future).get(timeout);
+  } catch (folly::FutureTimeout&) {
+    auto why = folly::to<std::string>(
+        "materialize: timed out crawling the queried paths within ",
+        timeout.count(),
+        " milliseconds");
+    log(ERR, why, "\n");
+    throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+  }
 }
 
-uint32_t InMemoryView::getLastAgeOutTickValue() const {
-  return lastAgeOutTick_;
+struct InMemoryView::TreeHashInputs {
+  using Digest = DirTreeHashes::Digest;
+  // The SHA-1 of each regular file, and of the target of each symlink
+  std::unordered_map<ContentHashCacheKey, Result<Digest>> contents;
+  std::unordered_map<SymlinkTargetCacheKey, Result<Digest>> targets;
+  // The number of dirs whose digests need computing
+  size_t numDirs{0};
+};
+
+namespace {
+// Returns the path of `dir`, which is the root or below it, relative to the
+// root, as the caches key files
+w_string_piece relativeToRoot(const w_string& rootPath, const w_string& dir) {
+  w_string_piece rel = dir;
+  rel.advance(std::min(rootPath.size() + 1, rel.size()));
+  return rel;
 }
 
-std::chrono::system_clock::time_point InMemoryView::getLastAgeOutTimeStamp()
-    const {
-  return lastAgeOutTimestamp_;
+// Waits for `future` until `deadline`, then stores its value, converted by
+// `digestOf`, or its error, in `result`
+template <typename T, typename DigestOf>
+void waitForDigest(
+    folly::Future<T>& future,
+    std::chrono::steady_clock::time_point deadline,
+    Result<DirTreeHashes::Digest>& result,
+    DigestOf digestOf) {
+  if (deadline == std::chrono::steady_clock::time_point::max()) {
+    future.wait();
+  } else {
+    future.wait(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::max(
+            deadline - std::chrono::steady_clock::now(),
+            std::chrono::steady_clock::duration::zero())));
+  }
+  if (!future.isReady()) {
+    result = Result<DirTreeHashes::Digest>(
+        std::make_exception_ptr(std::system_error(
+            std::make_error_code(std::errc::timed_out),
+            "not available before the query's fetch_timeout")));
+    return;
+  }
+  result = makeResultWith([&] { return digestOf(future.value()->value()); });
 }
+} // namespace
 
-void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
-  // Start a thread to call into the watcher API for filesystem notifications
-  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
-  logf(DBG, "starting threads for {} {}\n", fmt::ptr(this), rootPath_);
-  std::thread notifyThreadInstance([self, root]() {
-    w_set_thread_name(
-        "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
-    try {
-      self->notifyThread(root);
-    } catch (const std::exception& e) {
-      watchman::log(watchman::ERR, "Exception: ", e.what(), " cancel root\n");
-      root->cancel();
+void InMemoryView::hashTrees(
+    const IgnoreSet& ignore,
+    const std::vector<w_string>& paths,
+    std::chrono::steady_clock::time_point deadline) {
+  // Files that change between collecting the inputs and combining them
+  // leave their dirs without digests; try again, a few times at most, since
+  // a busy tree may never settle.
+  constexpr int kAttempts = 3;
+  for (int attempt = 0; attempt < kAttempts; ++attempt) {
+    TreeHashInputs inputs;
+    {
+      auto view = readView();
+      for (auto& path : paths) {
+        if (auto dir = view->resolveDir(path)) {
+          collectTreeHashInputs(ignore, dir, inputs);
+        }
+      }
+    }
+    if (inputs.numDirs == 0) {
+      return;
     }
-    watchman::log(watchman::DBG, "out of loop\n");
-  });
-  notifyThreadInstance.detach();
 
-  // Wait for it to signal that the watcher has been initialized
-  bool pinged = false;
-  pendingFromWatcher_.lockAndWait(
-      std::chrono::milliseconds(-1) /* infinite */, pinged);
+    // Hash without holding the view lock; the lookups start together and
+    // run on the thread pool.
+    std::vector<std::pair<
+        Result<DirTreeHashes::Digest>*,
+        folly::Future<std::shared_ptr<const ContentHashCache::Node>>>>
+        contents;
+    for (auto& [key, digest] : inputs.contents) {
+      contents.emplace_back(&digest, caches_.contentHashCache.get(key));
+    }
+    std::vector<std::pair<
+        Result<DirTreeHashes::Digest>*,
+        folly::Future<std::shared_ptr<const SymlinkTargetCache::Node>>>>
+        targets;
+    for (auto& [key, digest] : inputs.targets) {
+      targets.emplace_back(&digest, caches_.symlinkTargetCache.get(key));
+    }
+    for (auto& [digest, future] : contents) {
+      waitForDigest(
+          future, deadline, *digest, [](const ContentHashCache::HashValue& h) {
+            return h;
+          });
+    }
+    for (auto& [digest, future] : targets) {
+      waitForDigest(future, deadline, *digest, [](const w_string& target) {
+        return ContentHashCache::computeSha1(target.data(), target.size());
+      });
+    }
 
-  // And now start the IO thread
-  std::thread ioThreadInstance([self, root]() {
-    w_set_thread_name(
-        "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
-    try {
-      self->ioThread(root);
-    } catch (const std::exception& e) {
-      watchman::log(watchman::ERR, "Exception: ", e.what(), " cancel root\n");
-      root->cancel();
+    // Combining the hashes is cheap, and the write lock keeps the dirs from
+    // changing under us and other queries from combining at the same time.
+    bool complete = true;
+    {
+      auto view = view_.wlock();
+      for (auto& path : paths) {
+        if (auto dir = view->resolveDir(path, false)) {
+          complete &=
+              computeTreeHash(*view, ignore, dir, inputs).has_value();
+        }
+      }
     }
-    watchman::log(watchman::DBG, "out of loop\n");
-  });
-  ioThreadInstance.detach();
+    if (complete) {
+      return;
+    }
+  }
 }
 
-void InMemoryView::stopThreads() {
-  logf(DBG, "signalThreads! {} {}\n", fmt::ptr(this), rootPath_);
-  stopThreads_ = true;
-  watcher_->stopThreads();
-  pendingFromWatcher_.lock()->ping();
-}
+void InMemoryView::collectTreeHashInputs(
+    const IgnoreSet& ignore,
+    const watchman_dir* dir,
+    TreeHashInputs& inputs) const {
+  if (dir->treeHashValid) {
+    return;
+  }
+  ++inputs.numDirs;
 
-void InMemoryView::wakeThreads() {
-  pendingFromWatcher_.lock()->ping();
+  auto path = dir->getFullPath();
+  auto rel = relativeToRoot(rootPath_, path);
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      continue;
+    }
+    auto& st = file->stat;
+    if (st.isFile()) {
+      inputs.contents.emplace(
+          ContentHashCacheKey{
+              w_string::pathCat({rel, file->getName()}),
+              size_t(st.size),
+              st.mtime(),
+              uint64_t(st.dev),
+              uint64_t(st.ino)},
+          Result<DirTreeHashes::Digest>());
+    } else if (st.isSymlink()) {
+      inputs.targets.emplace(
+          SymlinkTargetCacheKey{
+              w_string::pathCat({rel, file->getName()}), file->otime},
+          Result<DirTreeHashes::Digest>());
+    } else if (st.isDir()) {
+      auto child = dir->getChildDir(file->getName());
+      if (child &&
+          !ignore.isIgnoreVCS(dir->getFullPathToChild(file->getName()))) {
+        collectTreeHashInputs(ignore, child, inputs);
+      }
+    }
+  }
 }
 
-/* Ensure that we're synchronized with the state of the
- * filesystem at the current time.
- * We do this by touching a cookie file and waiting to
- * observe it via inotify.  When we see it we know that
- * we've seen everything up to the point in time at which
- * we're asking questions.
- * Throws a std::system_error with an ETIMEDOUT error if
- * the timeout expires before we observe the change, or
- * a runtime_error if the root has been deleted or rendered
- * inaccessible. */
-void InMemoryView::syncToNow(
-    const std::shared_ptr<Root>& root,
-    std::chrono::milliseconds timeout,
-    std::vector<w_string>& cookieFileNames) {
-  syncToNowCookies(root, timeout, cookieFileNames);
+std::optional<Result<DirTreeHashes::Digest>> InMemoryView::computeTreeHash(
+    ViewDatabase& view,
+    const IgnoreSet& ignore,
+    watchman_dir* dir,
+    const TreeHashInputs& inputs) const {
+  auto& hashes = view.treeHashes();
+  auto path = dir->getFullPath();
+  if (dir->treeHashValid) {
+    if (auto digest = hashes.get(path)) {
+      return digest;
+    }
+  }
 
-  // Some watcher implementations (notably, FSEvents) reorder change events
-  // before they're reported, and cookie files are not sufficient. Instead, the
-  // watcher supports direct synchronization. Once a cookie file has been
-  // observed, ensure that all pending events have been flushed and wait until
-  // the pending event queue is fully crawled.
-  auto result = watcher_->flushPendingEvents();
-  if (result.valid()) {
-    // The watcher has made all pending events available and inserted a promise
-    // into its PendingCollection. Wait for InMemoryView to observe it and
-    // everything prior.
-    //
-    // Would be nice to use a deadline rather than a timeout here.
+  auto rel = relativeToRoot(rootPath_, path);
+  std::vector<DirTreeHashes::Entry> entries;
+  std::optional<Result<DirTreeHashes::Digest>> error;
+  bool complete = true;
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      continue;
+    }
+    auto& st = file->stat;
+    char type;
+    std::optional<Result<DirTreeHashes::Digest>> digest;
+    if (st.isFile()) {
+      type = (st.mode & 0111) ? 'x' : 'f';
+      auto found = inputs.contents.find(ContentHashCacheKey{
+          w_string::pathCat({rel, file->getName()}),
+          size_t(st.size),
+          st.mtime()});
+      if (found != inputs.contents.end()) {
+        digest = found->second;
+      }
+    } else if (st.isSymlink()) {
+      type = 'l';
+      auto found = inputs.targets.find(SymlinkTargetCacheKey{
+          w_string::pathCat({rel, file->getName()}), file->otime});
+      if (found != inputs.targets.end()) {
+        digest = found->second;
+      }
+    } else if (st.isDir()) {
+      type = 'd';
+      if (ignore.isIgnoreVCS(dir->getFullPathToChild(file->getName()))) {
+        continue;
+      }
+      if (auto child = dir->getChildDir(file->getName())) {
+        digest = computeTreeHash(view, ignore, child, inputs);
+      } else {
+        digest = Result<DirTreeHashes::Digest>(
+            std::make_exception_ptr(std::runtime_error(fmt::format(
+                "{} has not been crawled",
+                dir->getFullPathToChild(file->getName())))));
+      }
+    } else {
+      continue;
+    }
 
-    try {
-      std::move(result).get(timeout);
-    } catch (folly::FutureTimeout&) {
-      auto why = folly::to<std::string>(
-          "syncToNow: timed out waiting for pending watcher events to be flushed within ",
-          timeout.count(),
-          " milliseconds");
-      log(ERR, why, "\n");
-      throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+    if (!digest) {
+      complete = false;
+    } else if (digest->hasError()) {
+      error = std::move(digest);
+    } else {
+      entries.push_back({type, file->getName(), digest->value()});
     }
   }
+
+  if (!complete) {
+    return std::nullopt;
+  }
+  if (error) {
+    hashes.set(path, *error);
+    return error;
+  }
+  auto digest = Result<DirTreeHashes::Digest>(DirTreeHashes::combine(entries));
+  hashes.set(path, digest);
+  dir->treeHashValid = true;
+  return digest;
+}
+
+void InMemoryView::markPrioritySynced(const void* query) {
+  priorityPaths_.markSynced(query);
+}
+
+void InMemoryView::removePriorityPaths(const void* query) {
+  priorityPaths_.remove(query);
 }
 
 void InMemoryView::syncToNowCookies(
@@ -1110,7 +2948,7 @@ void InMemoryView::syncToNowCookies(
 
 bool InMemoryView::doAnyOfTheseFilesExist(
     const std::vector<w_string>& fileNames) const {
-  auto view = view_.rlock();
+  auto view = readView();
   for (auto& name : fileNames) {
     auto fullName = w_string::pathCat({rootPath_, name});
     const auto dir = view->resolveDir(fullName.dirName());
@@ -1162,6 +3000,261 @@ json_ref InMemoryView::getViewDebugInfo() const {
   });
 }
 
+json_ref InMemoryView::getViewStatus() const {
+  auto stats = nodeArena_->getStats();
+  auto settle = json_null();
+  if (settleController_) {
+    auto now = std::chrono::steady_clock::now();
+    auto controller = settleController_->lock();
+    settle = json_object({
+        {"settle_ms", json_integer(controller->settle(now).count())},
+        {"event_rate", json_real(controller->eventRate(now))},
+        {"last_batch_size", json_integer(controller->lastBatchSize())},
+    });
+  }
+  auto lazy = json_null();
+  if (lazyCrawlDepth_ > 0) {
+    auto lazyCrawl = lazyCrawl_.rlock();
+    lazy = json_object({
+        {"depth", json_integer(lazyCrawlDepth_)},
+        {"deferred_dirs", json_integer(lazyCrawl->deferred.size())},
+        {"materialized_paths",
+         json_integer(lazyCrawl->materialized.size())},
+    });
+  }
+  auto summaries = json_null();
+  if (!summaryDirPaths_.empty()) {
+    summaries = json_array();
+    auto dirs = summaryDirs_.rlock();
+    for (size_t i = 0; i < summaryDirPaths_.size(); ++i) {
+      auto& dir = (*dirs)[i];
+      json_array_append(
+          summaries,
+          json_object({
+              {"path", w_string_to_json(summaryDirPaths_[i])},
+              {"files", json_integer(dir.totals.files)},
+              {"dirs", json_integer(dir.totals.dirs)},
+              {"newest_mtime", json_integer(dir.totals.newestMtime.tv_sec)},
+              {"changes", json_integer(dir.changes)},
+              {"walks", json_integer(dir.walks)},
+          }));
+    }
+  }
+  auto held = pendingLockHeld_.snapshot();
+  return json_object({
+      {"pending_slices",
+       json_object({
+           {"yields",
+            json_integer(
+                pendingSliceYields_.load(std::memory_order_relaxed))},
+           {"lock_held",
+            json_object({
+                {"count", json_integer(held.count)},
+                {"p50-microseconds",
+                 json_integer(held.percentile(0.5).count())},
+                {"p90-microseconds",
+                 json_integer(held.percentile(0.9).count())},
+                {"p99-microseconds",
+                 json_integer(held.percentile(0.99).count())},
+                {"max-microseconds", json_integer(held.max.count())},
+            })},
+       })},
+      {"age_out",
+       json_object({
+           {"last_slices",
+            json_integer(lastAgeOutSlices_.load(std::memory_order_relaxed))},
+           {"last_max_slice_lock_held_ms",
+            json_integer(
+                lastAgeOutMaxSliceMs_.load(std::memory_order_relaxed))},
+       })},
+      {"compaction",
+       json_object({
+           {"count",
+            json_integer(compactions_.load(std::memory_order_relaxed))},
+           {"last_released_bytes",
+            json_integer(lastCompactionReleasedBytes_.load(
+                std::memory_order_relaxed))},
+       })},
+      {"adaptive_settle", settle},
+      {"lazy_crawl", lazy},
+      {"summary_dirs", summaries},
+      {"node_arena",
+       json_object({
+           {"slabs", json_integer(stats.slabs)},
+           {"reserved_bytes", json_integer(stats.reservedBytes)},
+           {"live_bytes", json_integer(stats.liveBytes)},
+           {"live_nodes", json_integer(stats.liveAllocations)},
+           {"free_bytes", json_integer(stats.freeBytes)},
+           {"large_nodes", json_integer(stats.largeAllocations)},
+       })},
+  });
+}
+
+size_t InMemoryView::getMemoryBytes() const {
+  // The names are strings, which MemoryAccounting already counts
+  return nodeArena_->getStats().reservedBytes;
+}
+
+json_ref InMemoryView::getMemoryStatus() const {
+  auto stats = nodeArena_->getStats();
+  auto names = nameTable_->getStats();
+  auto status = json_object({
+      {"view_nodes",
+       json_object({
+           {"live_bytes", json_integer(stats.liveBytes)},
+           {"reserved_bytes", json_integer(stats.reservedBytes)},
+           {"nodes", json_integer(stats.liveAllocations)},
+       })},
+      {"view_names",
+       json_object({
+           {"names", json_integer(names.names)},
+           {"bytes", json_integer(names.bytes)},
+       })},
+      {"pending_changes",
+       json_integer(pendingFromWatcher_.lock()->getPendingItemCount())},
+      {"cache_entries",
+       json_object({
+           {"content_hash", json_integer(caches_.contentHashCache.size())},
+           {"fast_content_hash",
+            json_integer(caches_.fastContentHashCache.size())},
+           {"chunked_content_hash",
+            json_integer(caches_.chunkedContentHashCache.size())},
+           {"dir_tree_hash", json_integer(treeHashes_->size())},
+           {"symlink_target",
+            json_integer(caches_.symlinkTargetCache.size())},
+       })},
+  });
+  auto view = view_.rlock();
+  if (auto table = view->getMetadataTable()) {
+    status.set(
+        "view_metadata_columns",
+        json_object({
+            {"files", json_integer(table->size())},
+            {"bytes", json_integer(table->getMemoryBytes())},
+        }));
+  }
+  return status;
+}
+
+void InMemoryView::collectMetrics(
+    MetricsWriter& writer,
+    const MetricLabels& labels) const {
+  writer.add(
+      "watchman_view_pending_changes",
+      MetricType::Gauge,
+      "Changes reported by the watcher that the view has yet to apply",
+      labels,
+      pendingFromWatcher_.lock()->getPendingItemCount());
+  writer.add(
+      "watchman_view_live_bytes",
+      MetricType::Gauge,
+      "Memory held by the nodes of the view",
+      labels,
+      nodeArena_->getStats().liveBytes);
+
+  auto held = pendingLockHeld_.snapshot();
+  static const std::pair<double, const char*> quantiles[] = {
+      {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+  for (auto& [quantile, name] : quantiles) {
+    auto quantileLabels = labels;
+    quantileLabels.emplace_back("quantile", name);
+    writer.add(
+        "watchman_view_write_lock_held_seconds",
+        MetricType::Gauge,
+        "Percentiles of how long the IO thread holds the view at a time "
+        "while it applies changes",
+        quantileLabels,
+        held.percentile(quantile).count() / 1e6);
+  }
+  writer.add(
+      "watchman_view_write_lock_yields",
+      MetricType::Counter,
+      "Times that the IO thread released the view for waiting queries "
+      "while it applied changes",
+      labels,
+      pendingSliceYields_.load(std::memory_order_relaxed));
+
+  auto addCache = [&](const char* name, const CacheStats& stats) {
+    auto cacheLabels = labels;
+    cacheLabels.emplace_back("cache", name);
+    auto lookups = [&](const char* result, size_t count) {
+      auto resultLabels = cacheLabels;
+      resultLabels.emplace_back("result", result);
+      writer.add(
+          "watchman_cache_lookups",
+          MetricType::Counter,
+          "Lookups in the caches of the view, by whether they were found, "
+          "shared an outstanding fetch or missed",
+          resultLabels,
+          count);
+    };
+    lookups("hit", stats.cacheHit);
+    lookups("share", stats.cacheShare);
+    lookups("miss", stats.cacheMiss);
+    writer.add(
+        "watchman_cache_evictions",
+        MetricType::Counter,
+        "Entries evicted from the caches of the view",
+        cacheLabels,
+        stats.cacheEvict);
+    writer.add(
+        "watchman_cache_entries",
+        MetricType::Gauge,
+        "Entries in the caches of the view",
+        cacheLabels,
+        stats.size);
+  };
+  addCache("content_sha1", caches_.contentHashCache.stats());
+  addCache("content_spooky128", caches_.fastContentHashCache.stats());
+  auto chunked = caches_.chunkedContentHashCache.stats();
+  addCache("content_chunked128", chunked);
+  addCache("symlink_target", caches_.symlinkTargetCache.stats());
+
+  auto chunkLabels = labels;
+  chunkLabels.emplace_back("source", "read");
+  writer.add(
+      "watchman_chunked_hash_bytes",
+      MetricType::Counter,
+      "Bytes covered by content.chunked128hex hashes, by whether they were "
+      "read or their chunk digests were reused",
+      chunkLabels,
+      chunked.bytesHashed);
+  chunkLabels.back().second = "reused";
+  writer.add(
+      "watchman_chunked_hash_bytes",
+      MetricType::Counter,
+      "Bytes covered by content.chunked128hex hashes, by whether they were "
+      "read or their chunk digests were reused",
+      chunkLabels,
+      chunked.bytesReused);
+
+  if (ioThrottle_) {
+    auto throttle = ioThrottle_->stats();
+    writer.add(
+        "watchman_io_throttle_limit",
+        MetricType::Gauge,
+        "Crawl and hashing tasks that io_throttle currently lets do I/O at "
+        "once",
+        labels,
+        throttle.limit);
+    writer.add(
+        "watchman_io_throttle_waits",
+        MetricType::Counter,
+        "Crawl and hashing tasks that waited for io_throttle to let them do "
+        "I/O",
+        labels,
+        throttle.throttled);
+  }
+}
+
+json_ref InMemoryView::getCrawlProfile(size_t limit) const {
+  auto profile = crawlProfile_.rlock();
+  if (!*profile) {
+    return json_null();
+  }
+  return (*profile)->toJson(limit);
+}
+
 void InMemoryView::clearViewDebugInfo() {
   if (processedPaths_) {
     processedPaths_->clear();
@@ -1172,6 +3265,153 @@ SCM* InMemoryView::getSCM() const {
   return scm_.get();
 }
 
+bool InMemoryView::loadSnapshot(ViewDatabase& view) {
+  if (snapshotPath_.empty() || snapshotLoadAttempted_) {
+    return false;
+  }
+  snapshotLoadAttempted_ = true;
+
+  PerfSample sample("load-view-snapshot");
+  ViewSnapshotClock clock;
+  SCOPE_EXIT {
+    // Files restored from the snapshot carry its ticks, even if a later
+    // record was invalid, so new ticks must not collide with them.
+    if (!clock.epochs.empty()) {
+      auto ticks = clock.epochs.back().ticks;
+      if (mostRecentTick_.load(std::memory_order_acquire) <= ticks) {
+        mostRecentTick_.store(ticks + 1, std::memory_order_release);
+      }
+    }
+  };
+  try {
+    folly::MemoryMapping mapping(snapshotPath_.c_str());
+    auto numFiles =
+        loadViewSnapshot(view, *watcher_, mapping.range(), clock);
+    lastAgeOutTick_ = std::max(lastAgeOutTick_, clock.lastAgeOutTick);
+    if (changeJournal_) {
+      // What the previous process aged out was not journaled here
+      changeJournal_->forget(clock.lastAgeOutTick);
+    }
+    *clockEpochs_.wlock() = clock.epochs;
+    snapshotWatcherPosition_ = std::move(clock.watcherPosition);
+    sample.add_meta(
+        "view_snapshot",
+        json_object({{"num_files", json_integer(numFiles)}}));
+    sample.finish();
+    sample.force_log();
+    sample.log();
+    logf(
+        ERR,
+        "loaded {} files from view snapshot {}\n",
+        numFiles,
+        snapshotPath_);
+    return true;
+  } catch (const std::system_error& exc) {
+    if (exc.code() != error_code::no_such_file_or_directory) {
+      logf(
+          ERR,
+          "unable to read view snapshot {}: {}\n",
+          snapshotPath_,
+          exc.what());
+    }
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "ignoring view snapshot {}: {}\n",
+        snapshotPath_,
+        exc.what());
+  }
+  return false;
+}
+
+void InMemoryView::saveSnapshot() {
+  if (snapshotPath_.empty() ||
+      snapshotDiscarded_.load(std::memory_order_acquire)) {
+    return;
+  }
+  lastSnapshot_ = std::chrono::steady_clock::now();
+
+  ViewSnapshotClock clock;
+  clock.epochs = *clockEpochs_.rlock();
+  // Taken before the view is encoded, so that the view reflects at least
+  // every event up to it
+  clock.watcherPosition = watcher_->getStreamPosition();
+  // Only hold the view lock while encoding; the write can take a while for
+  // a large root.
+  std::string data;
+  {
+    auto view = view_.rlock();
+    // The IO thread is the only one that ticks, and it's the one here
+    clock.epochs.push_back(ClockEpoch::current(
+        ClockPosition(rootNumber_, mostRecentTick_.load())));
+    if (clock.epochs.size() > kMaxSnapshotEpochs) {
+      clock.epochs.erase(
+          clock.epochs.begin(), clock.epochs.end() - kMaxSnapshotEpochs);
+    }
+    clock.lastAgeOutTick = lastAgeOutTick_;
+    data = serializeViewSnapshot(*view, clock);
+  }
+  try {
+    folly::writeFileAtomic(snapshotPath_.c_str(), data, 0600);
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "unable to write view snapshot {}: {}\n",
+        snapshotPath_,
+        exc.what());
+  }
+}
+
+void InMemoryView::compact() {
+  caches_.contentHashCache.clear();
+  caches_.fastContentHashCache.clear();
+  caches_.chunkedContentHashCache.clear();
+  caches_.symlinkTargetCache.clear();
+
+  size_t released;
+  {
+    auto view = view_.wlock();
+    std::vector<watchman_dir*> dirs{view->resolveDir(rootPath_, false)};
+    while (!dirs.empty()) {
+      auto dir = dirs.back();
+      dirs.pop_back();
+      if (!dir) {
+        continue;
+      }
+      dir->files.shrinkToFit();
+      dir->dirs.shrinkToFit();
+      for (auto& it : dir->dirs) {
+        dirs.push_back(it.second.get());
+      }
+    }
+    view->pruneSuffixIndex();
+    view->pruneNameIndex();
+    view->pruneNames();
+    released = nodeArena_->trim();
+  }
+
+#ifdef __GLIBC__
+  // The arena's slabs and the caches' nodes came from malloc, which holds
+  // on to freed memory unless asked
+  malloc_trim(0);
+#endif
+
+  compactions_.fetch_add(1, std::memory_order_relaxed);
+  lastCompactionReleasedBytes_.store(released, std::memory_order_relaxed);
+  logf(
+      ERR,
+      "compacted idle root {}, freeing {} bytes of node slabs\n",
+      rootPath_,
+      released);
+}
+
+size_t InMemoryView::releaseNodes(size_t maxNodes) {
+  auto view = view_.wlock();
+  auto released = view->releaseNodes(maxNodes);
+  nodeArena_->trim();
+  return released;
+}
+
 void InMemoryView::warmContentCache() {
   if (!enableContentCacheWarming_) {
     return;
@@ -1209,7 +3449,7 @@ void InMemoryView::warmContentCache() {
 
         auto dirStr = f->parent->getFullPath();
         w_string_piece dir(dirStr);
-        dir.advance(caches_.contentHashCache.rootPath().size());
+        dir.advance(warmContentCache_->rootPath().size());
 
         // If dirName is the root, dir.size() will now be zero
         if (dir.size() > 0) {
@@ -1220,11 +3460,13 @@ void InMemoryView::warmContentCache() {
         ContentHashCacheKey key{
             w_string::pathCat({dir, f->getName()}),
             size_t(f->stat.size),
-            f->stat.mtime};
+            f->stat.mtime(),
+            uint64_t(f->stat.dev),
+            uint64_t(f->stat.ino)};
 
         watchman::log(
             watchman::DBG, "warmContentCache: lookup ", key.relativePath, "\n");
-        auto f = caches_.contentHashCache.get(key);
+        auto f = warmContentCache_->get(key);
         if (syncContentCacheWarming_) {
           futures.emplace_back(std::move(f));
         }
@@ -1253,4 +3495,140 @@ void InMemoryView::warmContentCache() {
   }
 }
 
+void InMemoryView::warmContentCacheForQueries(Root& root) {
+  if (!enableQueryContentCacheWarming_) {
+    return;
+  }
+
+  std::vector<std::shared_ptr<const Query>> queries;
+  {
+    auto registered = root.contentHashQueries.wlock();
+    auto it = registered->begin();
+    while (it != registered->end()) {
+      if (auto query = it->lock()) {
+        queries.push_back(std::move(query));
+        ++it;
+      } else {
+        it = registered->erase(it);
+      }
+    }
+  }
+
+  auto changes = changeSet_.copy();
+  if (queries.empty() || !changes) {
+    // If too much changed for a change set to be recorded, the
+    // subscriptions will walk the view and hash the files themselves.
+    return;
+  }
+
+  auto rootPtr = root.shared_from_this();
+  std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
+      futures;
+  // For each file in changes, the caches it has been looked up in
+  enum : uint8_t { kSha1 = 1, kSpooky128 = 2 };
+  std::vector<uint8_t> warmed(changes->files.size(), 0);
+  size_t n = 0;
+
+  for (const auto& query : queries) {
+    uint8_t wanted = 0;
+    if (query->isFieldRequested("content.sha1hex")) {
+      wanted |= kSha1;
+    }
+    if (query->isFieldRequested("content.spooky128hex")) {
+      wanted |= kSpooky128;
+    }
+
+    QueryContext ctx{query.get(), rootPtr, /*disableFreshInstance=*/true};
+    for (size_t i = 0;
+         i < changes->files.size() && n < maxFilesToWarmInContentCache_;
+         ++i) {
+      const auto& file = changes->files[i];
+      uint8_t needed = wanted & ~warmed[i];
+      if (!needed || !file.exists || !file.stat.isFile() ||
+          !ctx.dirMatchesRelativeRoot(file.dirName)) {
+        continue;
+      }
+
+      auto result =
+          std::make_unique<InMemoryFileResult>(changes, &file, caches_);
+      auto* fileResult = result.get();
+      ctx.file = std::move(result);
+      SCOPE_EXIT {
+        ctx.file.reset();
+      };
+      if (query->expr) {
+        auto match = query->expr->evaluate(&ctx, fileResult);
+        // A term that needs more than the change set holds can't rule
+        // the file out, so warm it anyway.
+        if (match.has_value() && !*match) {
+          continue;
+        }
+      }
+
+      auto key = fileResult->contentHashCacheKey();
+      if (needed & kSha1) {
+        futures.emplace_back(caches_.contentHashCache.get(key));
+      }
+      if (needed & kSpooky128) {
+        futures.emplace_back(caches_.fastContentHashCache.get(key));
+      }
+      warmed[i] |= needed;
+      ++n;
+    }
+  }
+
+  logf(
+      DBG,
+      "warmContentCacheForQueries: {} queries scheduled {} files for "
+      "hashing\n",
+      queries.size(),
+      n);
+
+  if (syncContentCacheWarming_) {
+    // Wait for them to finish, but don't use get() because we don't
+    // care about any errors that may have occurred.
+    folly::collectAll(futures.begin(), futures.end()).wait();
+  }
+}
+
+void InMemoryView::recordChangeSet() {
+  if (maxChangeSetFiles_ == 0) {
+    return;
+  }
+
+  auto changes = std::make_shared<ChangeSet>();
+  changes->since = ClockPosition(rootNumber_, lastChangeSetTick_);
+  {
+    auto view = view_.rlock();
+    // Only the IO thread changes the view, so this is consistent with it
+    changes->position = getMostRecentRootNumberAndTickValue();
+    lastChangeSetTick_ = changes->position.ticks;
+
+    for (auto f = view->getLatestFile(); f; f = f->next) {
+      if (f->otime.ticks <= changes->since.ticks) {
+        break;
+      }
+      if (changes->files.size() >= maxChangeSetFiles_) {
+        // Too much changed for a copy to be worthwhile
+        changes.reset();
+        break;
+      }
+      changes->files.push_back(ChangedFile{
+          f->parent->getFullPath(),
+          f->getName().asWString(),
+          f->stat,
+          f->otime,
+          f->ctime,
+          f->exists});
+    }
+  }
+
+  logf(
+      DBG,
+      "recorded {} changed files up to tick {}\n",
+      changes ? changes->files.size() : 0,
+      lastChangeSetTick_);
+  *changeSet_.wlock() = std::move(changes);
+}
+
 } // namespace watchman
@@ -7,70 +7,173 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include "watchman/ChangeJournal.h"
+#include "watchman/ChunkedContentHash.h"
 #include "watchman/ContentHash.h"
 #include "watchman/CookieSync.h"
+#include "watchman/CrawlProfile.h"
+#include "watchman/DirTreeHash.h"
+#include "watchman/IoThrottle.h"
+#include "watchman/LatencyHistogram.h"
+#include "watchman/NameTable.h"
+#include "watchman/NodeArena.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PerfSample.h"
+#include "watchman/PriorityPaths.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Result.h"
 #include "watchman/RingBuffer.h"
+#include "watchman/SettleController.h"
+#include "watchman/StringBuffer.h"
 #include "watchman/SymlinkTargets.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatcherEventRecording.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/query/FileResult.h"
+#include "watchman/query/GlobMatcher.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
 struct watchman_client;
+struct watchman_dir;
 struct watchman_file;
 
 namespace watchman {
 
+class DirFdCache;
+struct FileIndexList;
+class FileMetadataTable;
 class FileSystem;
+class IoUringStat;
 class RootConfig;
 struct GlobTree;
+class WalkedDir;
 class Watcher;
 
 // Helper struct to hold caches used by the InMemoryView
 struct InMemoryViewCaches {
   ContentHashCache contentHashCache;
+  // Holds the hashes for content.spooky128hex
+  ContentHashCache fastContentHashCache;
+  // Holds the hashes for content.chunked128hex
+  ChunkedContentHashCache chunkedContentHashCache;
   SymlinkTargetCache symlinkTargetCache;
+  // Whether the atime fields of query results are read from the filesystem,
+  // since the view doesn't keep access times; see stat_atime
+  bool fetchAccessTimes{true};
+  // Holds the digests for content.treesha1hex; shared with the view's
+  // ViewDatabase, which drops those of the dirs that change
+  std::shared_ptr<DirTreeHashes> treeHashes;
 
   InMemoryViewCaches(
       const w_string& rootPath,
       size_t maxHashes,
       size_t maxSymlinks,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t hashShards = 1,
+      size_t symlinkShards = 1);
+};
+
+// A copy of the state of a file that changed, taken when the view settled
+struct ChangedFile {
+  w_string dirName;
+  w_string baseName;
+  CompactFileInformation stat;
+  w_clock_t otime;
+  w_clock_t ctime;
+  bool exists;
+};
+
+// The files that changed in the view between two clock positions, newest
+// first, as recorded by InMemoryView when it settled.  Since this is a copy
+// it can be queried without holding the view lock.
+struct ChangeSet {
+  // The files are those whose otime is after this position
+  ClockPosition since;
+  // The most recent position of the view when the set was recorded
+  ClockPosition position;
+  std::vector<ChangedFile> files;
 };
 
 class InMemoryFileResult final : public FileResult {
  public:
   InMemoryFileResult(const watchman_file* file, InMemoryViewCaches& caches);
+  // For generators that already know the full path to the file's dir.
+  InMemoryFileResult(
+      const watchman_file* file,
+      w_string dirName,
+      InMemoryViewCaches& caches);
+  // Serves a file of `changes`, which is kept alive for as long as this is.
+  InMemoryFileResult(
+      std::shared_ptr<const ChangeSet> changes,
+      const ChangedFile* file,
+      InMemoryViewCaches& caches);
+
+  // Recycled through a per-thread freelist, since a query creates and
+  // destroys one of these for every file that it considers.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   std::optional<FileInformation> stat() override;
   std::optional<struct timespec> accessedTime() override;
   std::optional<struct timespec> modifiedTime() override;
   std::optional<struct timespec> changedTime() override;
   std::optional<size_t> size() override;
   w_string_piece baseName() override;
+  w_string lowerCaseBaseName() override;
   w_string_piece dirName() override;
   std::optional<bool> exists() override;
   std::optional<w_string> readLink() override;
   std::optional<w_clock_t> ctime() override;
   std::optional<w_clock_t> otime() override;
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::FastContentHash> getContentSpooky128() override;
+  std::optional<FileResult::FastContentHash> getContentChunked128() override;
+  std::optional<FileResult::ContentHash> getTreeSha1() override;
+  // The watchman_file, for the results that come from the view
+  const void* identity() const override;
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      std::chrono::steady_clock::time_point deadline) override;
+
+  // Returns the key for this file in the content hash caches
+  ContentHashCacheKey contentHashCacheKey();
 
  private:
+  // The state of the file.  stat_ and baseName_ point into either the view
+  // or changes_.
+  const CompactFileInformation* stat_;
+  w_string_piece baseName_;
+  // The parent dir in the view, used to compute dirName_ on demand; null if
+  // this is a ChangedFile.
+  const watchman_dir* parent_;
+  // The file in the view; null if this is a ChangedFile.
   const watchman_file* file_;
   w_string dirName_;
+  w_clock_t otime_;
+  w_clock_t ctime_;
+  bool exists_;
+  std::shared_ptr<const ChangeSet> changes_;
   InMemoryViewCaches& caches_;
   std::optional<w_string> symlinkTarget_;
+  // Read from the filesystem on demand
+  std::optional<struct timespec> atime_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::FastContentHash> contentSpooky128_;
+  Result<FileResult::FastContentHash> contentChunked128_;
+
+  // Throws if this file should have no content hash
+  void checkHashable() const;
 };
 
 /**
@@ -80,12 +183,141 @@ class InMemoryFileResult final : public FileResult {
  */
 class ViewDatabase {
  public:
-  explicit ViewDatabase(const w_string& root_path);
+  explicit ViewDatabase(
+      const w_string& root_path,
+      std::shared_ptr<NodeArena> arena = std::make_shared<NodeArena>(),
+      std::shared_ptr<NameTable> names = std::make_shared<NameTable>(),
+      std::shared_ptr<DirTreeHashes> treeHashes =
+          std::make_shared<DirTreeHashes>());
+
+  const w_string& getRootPath() const {
+    return rootPath_;
+  }
 
   watchman_file* getLatestFile() const {
     return latestFile_;
   }
 
+  /**
+   * Returns the first of the files whose names have the given lowercased
+   * suffix, or nullptr if there are none.  Walk the rest via suffix_next.
+   * The files are in no particular order and include deleted files that
+   * have not yet been aged out.
+   */
+  watchman_file* getFilesWithSuffix(const w_string& suffix) const;
+
+  /**
+   * Forgets the suffixes that no longer have any files.  Age-out calls this
+   * so that the index doesn't accumulate suffixes of long gone files.
+   */
+  void pruneSuffixIndex();
+
+  /**
+   * Returns the first of the files whose lowercased names are the given
+   * lowercased name, or nullptr if there are none.  Walk the rest via
+   * name_next, and compare the names to tell the cases apart.  Like
+   * getFilesWithSuffix(), the files are in no particular order and include
+   * deleted files.
+   */
+  watchman_file* getFilesNamed(const w_string& lowerCaseName) const;
+
+  /**
+   * Forgets the names that no longer have any files, for the same reason as
+   * pruneSuffixIndex().
+   */
+  void pruneNameIndex();
+
+  /**
+   * Returns true if getFilesOfType() can list the files of the given type.
+   * Only dirs and symlinks are indexed; they are a small fraction of most
+   * trees, whereas an index of the regular files would save nothing over
+   * walking every file.
+   */
+  static bool indexesType(DType type) {
+    return type == DType::Dir || type == DType::Symlink;
+  }
+
+  /**
+   * Returns the first of the files of the given type, which must be one
+   * that indexesType() accepts, or nullptr if there are none.  Walk the rest
+   * via type_next.  Like getFilesWithSuffix(), the files are in no
+   * particular order and include deleted files.
+   */
+  watchman_file* getFilesOfType(DType type) const;
+
+  /**
+   * Records a new stat result for the file, moving it to the type index for
+   * its new type if that changed.  Everything that updates a file's stat
+   * must go through here to keep the index in sync.
+   */
+  void setFileStat(watchman_file* file, const CompactFileInformation& st);
+
+  /**
+   * Forgets the interned names that no file or dir has any more.  Returns
+   * the number of names forgotten.  Age-out calls this after erasing nodes.
+   */
+  size_t pruneNames();
+
+  /**
+   * Destroys up to maxNodes of the file and dir nodes, deepest first, and
+   * returns the number destroyed; 0 once only the root dir is left.  For
+   * tearing down a view that is no longer in use in steps.
+   */
+  size_t releaseNodes(size_t maxNodes);
+
+  /**
+   * Returns a file in the recency index that comes before every file that
+   * last changed at or before `cutoff`, so that age-out can skip over the
+   * files that are too recent to age out.  Forgets the checkpoints that
+   * refer to files that changed at or before `cutoff`, since age-out may
+   * free them.
+   */
+  watchman_file* getAgeOutStart(time_t cutoff);
+
+  /**
+   * Forgets all of the checkpoints.  Age-out calls this when it frees files
+   * other than those after the one that getAgeOutStart() returned.
+   */
+  void clearCheckpoints() {
+    checkpoints_.clear();
+  }
+
+  /**
+   * Returns a bound on the number of files that have changed since `since`,
+   * and so on the length of the walk of the recency index that finds them,
+   * for weighing that walk against others.  The bound is as coarse as the
+   * checkpoints, and is the number of files in the view if none of them is
+   * as old as `since`.
+   */
+  size_t estimateFilesChangedSince(const QuerySince& since) const;
+
+  // The number of file nodes in the view, including those of deleted files
+  // that have yet to age out
+  size_t getNumFiles() const;
+
+  /**
+   * How many seconds the mtime or ctime of a file has been ahead of the
+   * otime timestamp at which the view saw the file change.  Normally none,
+   * since a change is only seen after it is made, but a file can be given
+   * an mtime in the future and the clock of a network filesystem can run
+   * ahead of ours.  Files whose mtime is at least T thus have an otime no
+   * earlier than T less this.  Never decreases.
+   */
+  int64_t getStatTimeSkew() const {
+    return statTimeSkew_;
+  }
+
+  /**
+   * Starts keeping a FileMetadataTable of the files of the view.  Must be
+   * called before any file is created.
+   */
+  void enableMetadataTable();
+
+  // The dense copy of the files' metadata, or null if it isn't kept
+  const FileMetadataTable* getMetadataTable() const {
+    return metadataTable_.get();
+  }
+
   ino_t getRootInode() const {
     return rootInode_;
   }
@@ -98,6 +330,14 @@ class ViewDatabase {
 
   const watchman_dir* resolveDir(const w_string& dirname) const;
 
+  /**
+   * Returns the direct child dir of dir named name, or nullptr if there is
+   * none.  Used to resolve paths one component at a time.
+   */
+  const watchman_dir* findChildDir(
+      const watchman_dir* dir,
+      w_string_piece name) const;
+
   /**
    * Returns the direct child file named name if it already exists, else creates
    * that entry and returns it.
@@ -110,10 +350,14 @@ class ViewDatabase {
 
   /**
    * Updates the otime for the file and bubbles it to the front of recency
-   * index.
+   * index, and drops the tree digests of the dirs above it.
    */
   void markFileChanged(Watcher& watcher, watchman_file* file, w_clock_t otime);
 
+  DirTreeHashes& treeHashes() const {
+    return *treeHashes_;
+  }
+
   /**
    * Mark a directory as being removed from the view. Marks the contained set of
    * files as deleted. If recursive is true, is recursively invoked on child
@@ -125,15 +369,90 @@ class ViewDatabase {
       w_clock_t otime,
       bool recursive);
 
+  /**
+   * Moves what the view knows of the dir `from` and everything below it to
+   * `to`, both full paths, as the watcher reported them renamed.  The files
+   * at `to` keep the stat information that they had and are marked changed
+   * at otime, and those at `from` are marked deleted, so that queries see
+   * the rename as deletions and creations without anything being stat'd.
+   *
+   * Returns false, having changed nothing, if the view doesn't know `from`
+   * as an existing dir, or if it knows anything other than a deleted file
+   * at `to`; the usual handling of the changes sorts those out.
+   */
+  bool renameDir(
+      Watcher& watcher,
+      const w_string& from,
+      const w_string& to,
+      w_clock_t otime);
+
  private:
+  void copyDirContents(
+      Watcher& watcher,
+      const watchman_dir* src,
+      watchman_dir* dst,
+      w_clock_t otime);
   void insertAtHeadOfFileList(struct watchman_file* file);
+  void noteStatTimes(const watchman_file* file);
+  void insertIntoSuffixIndex(struct watchman_file* file);
+  void insertIntoNameIndex(struct watchman_file* file);
+  watchman_file** typeListHead(DType type);
 
   const w_string rootPath_;
 
   /* the most recently changed file */
   watchman_file* latestFile_ = nullptr;
 
-  std::unique_ptr<watchman_dir> rootDir_;
+  // A coarse index into the recency list.  Every kCheckpointInterval files
+  // that move to its head, we remember the head and its otime.timestamp.
+  // Every file that precedes a checkpoint's file has a timestamp no older
+  // than the checkpoint's, even if that file has since moved, as long as
+  // the clock doesn't go backwards.  The newest checkpoint is at the back.
+  struct Checkpoint {
+    watchman_file* file;
+    time_t timestamp;
+    uint32_t ticks;
+    // numChanges_ when the checkpoint was made
+    uint64_t changes;
+  };
+  std::deque<Checkpoint> checkpoints_;
+  uint32_t filesSinceCheckpoint_{0};
+  // The number of times that a file has moved to the head of the list
+  uint64_t numChanges_{0};
+  // See getStatTimeSkew()
+  int64_t statTimeSkew_{0};
+
+  // Maps a lowercased filename suffix to the head of the list of files with
+  // that suffix.  The files' suffix_prev point into the mapped values, which
+  // is fine because unordered_map never relocates its elements.  Declared
+  // before rootDir_ so that the files can unlink themselves on destruction.
+  std::unordered_map<w_string, watchman_file*> suffixIndex_;
+
+  // Likewise, maps a lowercased filename to the head of the list of files
+  // with that name, linked via name_prev and name_next.
+  std::unordered_map<w_string, watchman_file*> nameIndex_;
+
+  // The heads of the lists of dirs and symlinks, linked via type_prev and
+  // type_next.  Declared before rootDir_ for the same reason as suffixIndex_.
+  watchman_file* dirFiles_{nullptr};
+  watchman_file* symlinkFiles_{nullptr};
+
+  // See enableMetadataTable().  Declared before rootDir_ so that the files
+  // can remove their rows on destruction.
+  std::unique_ptr<FileMetadataTable> metadataTable_;
+
+  // The names of the file and dir nodes.  Declared before rootDir_ so that
+  // it outlives the tree.
+  std::shared_ptr<NameTable> names_;
+
+  // Backing storage for the file and dir nodes.  Declared before rootDir_ so
+  // that it outlives the tree.
+  std::shared_ptr<NodeArena> arena_;
+
+  // The digests of the dirs whose treeHashValid is set
+  std::shared_ptr<DirTreeHashes> treeHashes_;
+
+  watchman_dir::Ptr rootDir_;
 
   // Inode number for the root dir.  This is used to detect what should
   // be impossible situations, but is needed in practice to workaround
@@ -159,6 +478,7 @@ class InMemoryView final : public QueryableView {
 
   ClockPosition getMostRecentRootNumberAndTickValue() const override;
   uint32_t getLastAgeOutTickValue() const override;
+  std::vector<ClockEpoch> getClockEpochs() const override;
   std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const override;
   w_string getCurrentClockString() const override;
 
@@ -175,11 +495,39 @@ class InMemoryView final : public QueryableView {
       std::chrono::milliseconds timeout,
       std::vector<w_string>& cookieFileNames) override;
 
+  void addPriorityPaths(const void* query, std::vector<w_string> paths)
+      override;
+  void markPrioritySynced(const void* query) override;
+  void removePriorityPaths(const void* query) override;
+
+  void materialize(
+      const std::vector<w_string>& paths,
+      std::chrono::milliseconds timeout) override;
+
+  void hashTrees(
+      const IgnoreSet& ignore,
+      const std::vector<w_string>& paths,
+      std::chrono::steady_clock::time_point deadline) override;
+
   bool doAnyOfTheseFilesExist(
       const std::vector<w_string>& fileNames) const override;
 
   void timeGenerator(const Query* query, QueryContext* ctx) const override;
 
+  // Serves the query from the ChangeSet recorded when the view last settled
+  // if that covers the query's since clock and nothing has changed since,
+  // otherwise falls back to timeGenerator.
+  void changeSetGenerator(const Query* query, QueryContext* ctx)
+      const override;
+
+  // Answers from the ChangeSet recorded when the view last settled, if it
+  // covers the range.
+  std::optional<bool> anyFileChangedBetween(
+      ClockPosition since,
+      ClockPosition upTo,
+      const std::function<bool(w_string_piece dirName, w_string_piece baseName)>&
+          visit) const override;
+
   void pathGenerator(const Query* query, QueryContext* ctx) const override;
 
   void globGenerator(const Query* query, QueryContext* ctx) const override;
@@ -189,9 +537,15 @@ class InMemoryView final : public QueryableView {
   std::shared_future<void> waitUntilReadyToQuery(
       const std::shared_ptr<Root>& root) override;
 
+  bool beginIncompleteRead(const std::shared_ptr<Root>& root) override;
+  void endIncompleteRead() override;
+
   void startThreads(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
+  bool waitForThreadsToStop(
+      std::chrono::steady_clock::time_point deadline) override;
   void wakeThreads() override;
+  void discardSnapshot() override;
   void clientModeCrawl(const std::shared_ptr<Root>& root);
 
   const w_string& getName() const override;
@@ -201,21 +555,76 @@ class InMemoryView final : public QueryableView {
   json_ref getViewDebugInfo() const;
   void clearViewDebugInfo();
 
+  /**
+   * Returns the costliest dirs of the last full crawl, at most `limit` of
+   * each sort, or null if no crawl has finished since the watch started or
+   * crawl_profile_size is 0.
+   */
+  json_ref getCrawlProfile(size_t limit) const;
+  json_ref getViewStatus() const override;
+  json_ref getMemoryStatus() const override;
+  void collectMetrics(MetricsWriter& writer, const MetricLabels& labels)
+      const override;
+
   // If content cache warming is configured, do the warm up now
   void warmContentCache();
 
+  /**
+   * Drops the caches, trims the spare capacity of the view's directories
+   * and indexes, frees the node slabs that hold nothing, and asks the
+   * allocator to give free memory back to the system.  What is dropped is
+   * rebuilt on demand.
+   */
+  void compact() override;
+
+  /**
+   * Destroys up to maxNodes of the view's nodes and frees the node slabs
+   * that that empties.
+   */
+  size_t releaseNodes(size_t maxNodes) override;
+
+  size_t getMemoryBytes() const override;
+
+  // If configured, hashes the files in the current change set that match
+  // the root's registered contentHashQueries, so that the subscriptions
+  // that run them find the hashes in the cache.
+  void warmContentCacheForQueries(Root& root);
+
+  // Records the files that changed since the previous settle, for
+  // changeSetGenerator.
+  void recordChangeSet();
+
   SCM* getSCM() const override;
 
   InMemoryViewCaches& debugAccessCaches() const {
     return caches_;
   }
 
+  /**
+   * Hands the events of a watcher event recording to the IO thread as the
+   * notify thread would have, with their recorded timing divided by `speed`,
+   * or without pauses if `speed` is 0.  Paths under the recorded root are
+   * moved under this one.  Returns the number of events replayed.
+   */
+  size_t replayWatcherEvents(WatcherEventReader& reader, double speed);
+
+  const folly::Synchronized<ViewDatabase>& debugAccessViewDatabase() const {
+    return view_;
+  }
+
  private:
   void syncToNowCookies(
       const std::shared_ptr<Root>& root,
       std::chrono::milliseconds timeout,
       std::vector<w_string>& cookieFileNames);
 
+  // Reports the files that age-out removed since the query's since clock,
+  // from changeJournal_.  Called by timeGenerator with the view locked.
+  void journalGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx) const;
+
   // Returns the erased file's otime.
   w_clock_t ageOutFile(
       std::unordered_set<w_string>& dirs_to_erase,
@@ -231,18 +640,96 @@ class InMemoryView final : public QueryableView {
   void dirGenerator(
       const Query* query,
       QueryContext* ctx,
-      const watchman_dir* dir,
+      const WalkedDir& dir,
+      uint32_t depth) const;
+  /** Like dirGenerator, but only visits the files that changed since the
+   * query's since clock */
+  void changedDirGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const WalkedDir& dir,
+      uint32_t depth) const;
+  /** Like dirGenerator, but divides the subtrees of dir between the threads
+   * of the shared ThreadPool and this one.  Each thread evaluates the query
+   * against its own shard of ctx, and the matches are then merged into ctx
+   * on this thread. */
+  void parallelDirGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const WalkedDir& dir,
       uint32_t depth) const;
   void globGeneratorTree(
       QueryContext* ctx,
+      const ViewDatabase& view,
+      GlobTreeMatcher& matcher,
       const GlobTree* node,
-      const struct watchman_dir* dir) const;
+      const WalkedDir& dir) const;
+  /** Matches the files on lists that are beneath dir against the **
+   * children of node, in place of walking dir with
+   * globGeneratorDoublestar(). */
+  void globGeneratorIndexed(
+      QueryContext* ctx,
+      GlobTreeMatcher& matcher,
+      const watchman_dir* dir,
+      const GlobTree* node,
+      const std::vector<FileIndexList>& lists) const;
+  /** `state` is the state of the node's doublestar matcher after consuming
+   * the path of dir relative to the node.  dir_name holds that path, which
+   * is only built up if the matcher has to fall back to wildmatch; anything
+   * appended to it is removed again before returning. */
   void globGeneratorDoublestar(
       QueryContext* ctx,
-      const struct watchman_dir* dir,
+      GlobTreeMatcher& matcher,
+      const WalkedDir& dir,
       const GlobTree* node,
-      const char* dir_name,
-      uint32_t dir_name_len) const;
+      GlobMatcher::State state,
+      StringBuffer& dir_name) const;
+  /** Walks the files whose names have one of the given lowercased suffixes,
+   * using the suffix index rather than visiting every file */
+  void suffixGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& suffixes,
+      bool existingOnly) const;
+  /** Walks the files whose names are one of the given lowercased names,
+   * using the name index rather than visiting every file */
+  void nameGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<w_string>& names) const;
+  /** Walks the files of the given type, which must be one that
+   * ViewDatabase::indexesType() accepts, rather than visiting every file */
+  void typeGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      DType type) const;
+  /** If the query's expression can only match files with certain suffixes
+   * or of a type that the view indexes, walks those files with the
+   * suffixGenerator or typeGenerator and returns true.  Given maxFiles, only
+   * does so if the index lists fewer files than that; the alternative is
+   * expected to visit maxFiles.  Returns false if it walked nothing. */
+  bool indexGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      std::optional<size_t> maxFiles) const;
+  /** Walks the files whose metadata is within the bounds of filter, using
+   * the view's FileMetadataTable rather than visiting every file */
+  void metadataGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      const MetadataFilter& filter) const;
+  /** Walks the recency index back to the first file that didn't change
+   * since `since`, which may be tighter than the query's since clock */
+  void recencyGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx,
+      const QuerySince& since) const;
 
   void notifyThread(const std::shared_ptr<Root>& root);
 
@@ -250,13 +737,55 @@ class InMemoryView final : public QueryableView {
 
   void ioThread(const std::shared_ptr<Root>& root);
 
+  // Stat results gathered for pending paths before the view lock is taken,
+  // keyed by full path.
+  using PendingStats = std::unordered_map<w_string, DirEntry>;
+
   // Consume entries from `pending` and apply them to the InMemoryView. Any new
   // pending paths generated by processPath will be crawled before
-  // processAllPending returns.
+  // processAllPending returns.  If preStats is provided, it is consulted for
+  // the items that are in `pending` on entry; see prefetchPendingStats.
+  //
+  // If viewLock is provided, it holds `view`, and once the changes relevant
+  // to the queries waiting in priorityPaths_ have been applied, the lock may
+  // be released for a while to let them run before the rest are.
+  //
+  // Otherwise, if crawlFirst is provided, the changes to those full paths,
+  // and to the dirs above them, are applied before the rest.
   IsDesynced processAllPending(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
-      PendingChanges& pending);
+      PendingChanges& pending,
+      const PendingStats* preStats = nullptr,
+      folly::Synchronized<ViewDatabase>::WLockedPtr* viewLock = nullptr,
+      const std::vector<w_string>* crawlFirst = nullptr);
+
+  /**
+   * Called by the IO thread before it takes the view write lock.  Stats each
+   * pending item that processPath would hand to statPath, so that the
+   * syscalls don't extend the time for which queries are locked out of the
+   * view.  Paths that fail to stat are omitted and statPath re-examines them
+   * under the lock in the usual way.  Paths whose metadata the watcher
+   * reported via takeNotifiedStats are not stat'ed at all.
+   */
+  PendingStats prefetchPendingStats(
+      const RootConfig& root,
+      const CookieSync& cookies,
+      const PendingChanges& pending);
+
+  /**
+   * Called by the IO thread under the view lock before it processes
+   * `pending`.  Moves the subtrees of the dirs that the watcher reported
+   * renamed, then adds the pending changes that are needed to bring them up
+   * to date: the changes in `pending` below an old path are repeated below
+   * the new one, and the new path gets a crawl that trusts readdir to
+   * verify the move.
+   */
+  void applyRenames(
+      const RootConfig& root,
+      ViewDatabase& view,
+      PendingChanges& pending,
+      const std::vector<PendingRename>& renames);
 
   void processPath(
       const std::shared_ptr<Root>& root,
@@ -265,6 +794,59 @@ class InMemoryView final : public QueryableView {
       const PendingChange& pending,
       const DirEntry* pre_stat);
 
+  // Whether processPath hands `pending` to the crawler rather than statPath
+  bool isCrawl(const PendingChange& pending) const;
+
+  /**
+   * Notifies cookies, puts off the dirs that lazy crawling defers and
+   * records changes beneath summary dirs as changes to those dirs.
+   * Returns whether `pending` still needs to be crawled or stat'ed.
+   */
+  bool admitPath(
+      Root& root,
+      ViewDatabase& view,
+      const PendingChange& pending);
+
+  /**
+   * Processes a batch of pending items when io_shards is configured.  The
+   * dirs to crawl are read first, then everything that the batch needs to
+   * stat is stat'ed across ioShardPool_, sharded by parent dir, and
+   * finally the results are applied in order.
+   */
+  void processShardedBatch(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      PendingChain pending,
+      const PendingStats* preStats);
+
+  /**
+   * Whether the crawl of `dir` should be put off until a query needs it,
+   * because it is at least lazy_crawl_depth levels below the root and is
+   * neither materialized nor above a cookie dir.  Records `dir` as
+   * deferred if so.
+   */
+  bool shouldDeferCrawl(const Root& root, const w_string& dir);
+
+  // The hashes that hashTrees() combines, keyed as the caches key them
+  struct TreeHashInputs;
+
+  // Adds to `inputs` the files of `dir`, and of the dirs below it, whose
+  // tree digests aren't valid
+  void collectTreeHashInputs(
+      const IgnoreSet& ignore,
+      const watchman_dir* dir,
+      TreeHashInputs& inputs) const;
+
+  // Returns the tree digest of `dir`, after computing those of it and of
+  // the dirs below it that aren't valid from `inputs`.  Returns nullopt if
+  // a file changed after `inputs` was collected.
+  std::optional<Result<DirTreeHashes::Digest>> computeTreeHash(
+      ViewDatabase& view,
+      const IgnoreSet& ignore,
+      watchman_dir* dir,
+      const TreeHashInputs& inputs) const;
+
   /**
    * Crawl the given directory.
    *
@@ -280,11 +862,168 @@ class InMemoryView final : public QueryableView {
       PendingChanges& coll,
       const PendingChange& pending);
 
+  // The entries of a dir that a crawl has read and has yet to examine
+  struct CrawlListing {
+    const PendingChange* pending;
+    watchman_dir* dir;
+    bool recursive;
+    std::vector<w_string> paths;
+    std::vector<PendingFlags> flags;
+    std::vector<DirEntry> entries;
+    // For crawlProfiler_: how long it took to open and read the dir, how
+    // many entries it has, and how long it took to prefetch their stats
+    std::chrono::steady_clock::duration readTime{0};
+    size_t numEntries{0};
+    std::chrono::steady_clock::duration statTime{0};
+  };
+
+  // A dir that a crawl has started watching and opened.  Reading its
+  // entries doesn't involve the view, so it may happen on another thread.
+  struct OpenedCrawlDir {
+    const PendingChange* pending{nullptr};
+    watchman_dir* dir{nullptr};
+    bool recursive{false};
+    bool statAll{false};
+    bool trustReadDir{false};
+    // The dir is unchanged since it was last read, so it isn't read again
+    bool skipped{false};
+    bool isNewDir{false};
+    // The number of child dirs that its link count suggests, if isNewDir
+    uint32_t numDirs{0};
+    std::optional<FileInformation> dirStat;
+    std::unique_ptr<DirHandle> osdir;
+    std::chrono::steady_clock::time_point readStart;
+
+    // Filled in by readCrawlEntries.  The d_name of the entries is null,
+    // and their names are kept alongside them instead.
+    std::vector<DirEntry> entries;
+    std::vector<w_string> names;
+    bool readAll{false};
+    std::string readError;
+    std::chrono::steady_clock::duration readTime{0};
+  };
+
+  /**
+   * The first half of the crawler: starts watching the dir and reads it.
+   * Returns nullopt if it can't be crawled, having dealt with that.
+   */
+  std::optional<CrawlListing> readCrawlDir(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      const PendingChange& pending);
+
+  // readCrawlDir in three steps, so that several dirs can be read at once:
+  // openCrawlDir starts watching the dir and opens it, readCrawlEntries
+  // reads it on any thread, and listCrawlDir compares what it read with the
+  // view and picks the entries that are to be examined.
+  std::optional<OpenedCrawlDir> openCrawlDir(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      const PendingChange& pending);
+  void readCrawlEntries(OpenedCrawlDir& opened);
+  CrawlListing listCrawlDir(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      OpenedCrawlDir& opened);
+
+  /**
+   * Like readCrawlDir for each of items, but reads the dirs in parallel on
+   * pool, if given.  The dirs are watched and their listings examined on
+   * the calling thread, in order.  The listings refer to the items, which
+   * must outlive them.
+   */
+  std::vector<CrawlListing> readCrawlDirs(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      const std::vector<const PendingChange*>& items,
+      ThreadPool* pool);
+
+  /**
+   * Crawls the dirs in pending together when crawlPool_ is configured, so
+   * that sibling dirs are read in parallel and their entries stat'd on the
+   * pool, and returns the rest of the items for processAllPending to apply
+   * as usual.
+   */
+  PendingChain crawlSiblingDirs(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      PendingChain pending);
+
+  // The second half: examines the entries, and re-queues those that are
+  // gone and the child dirs of a recursive crawl
+  void applyCrawl(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      CrawlListing& listing);
+
+  /**
+   * Publishes a crawl-progress item on the root's unilateral stream if
+   * crawl_progress_interval_ms has passed since the last one, for the
+   * clients that are waiting on the crawl without blocking on it.
+   */
+  void maybeReportCrawlProgress(Root& root, const PendingChanges& coll);
+
+  // view_.wlock(), charging the wait to the calling thread's account
+  folly::Synchronized<ViewDatabase>::WLockedPtr lockView();
+
+  // view_.rlock() for the queries, counting them in queuedReaders_ while
+  // they wait for it
+  folly::Synchronized<ViewDatabase>::ConstRLockedPtr readView() const;
+
+  /**
+   * Called by processAllPending between slices when queries are waiting in
+   * readView.  Releases the view until they have it, takes it back, and
+   * records the rest of the changes as happening after the tick that they
+   * reported.
+   */
+  void yieldToQueuedReaders(
+      folly::Synchronized<ViewDatabase>::WLockedPtr& viewLock);
+
+  /**
+   * Called by processAllPending between batches.  While fullCrawl runs and
+   * queries are waiting in beginIncompleteRead, releases the view until
+   * they have read it, and then records the rest of the crawl as happening
+   * after the tick that they reported.  Returns whether it released it.
+   */
+  bool yieldToIncompleteReads();
+
+  /**
+   * Called by the crawler once the directory watch has been established.
+   * Fills in the stat field of each entry that doesn't already have one,
+   * fanning the getFileInformation calls out across crawlPool_.  Entries
+   * that fail to stat are left with has_stat=false so that statPath can
+   * re-examine and report them in the usual way.
+   */
+  void prefetchCrawlStats(
+      const RootConfig& root,
+      const std::vector<w_string>& paths,
+      std::vector<DirEntry>& entries);
+
+  /**
+   * Blocks until ioThrottle_ allows another task to do I/O, if it is
+   * configured.  The slot is held until the result is destroyed.
+   */
+  IoThrottle::Slot acquireIoSlot();
+
+  /**
+   * Stats path, relative to a cached descriptor of its parent dir when the
+   * root is case sensitive, and reports its latency to ioThrottle_.  May be
+   * called from any thread.
+   */
+  FileInformation getEntryInformation(
+      const RootConfig& root,
+      const w_string& path);
+
   bool propagateToParentDirIfAppropriate(
       const RootConfig& root,
       PendingChanges& coll,
       std::chrono::system_clock::time_point now,
-      const FileInformation& entryStat,
+      const CompactFileInformation& entryStat,
       const w_string& dirName,
       const watchman_dir* parentDir,
       bool isUnlink);
@@ -334,15 +1073,58 @@ class InMemoryView final : public QueryableView {
   void fullCrawl(
       const std::shared_ptr<Root>& root,
       PendingCollection& pendingFromWatcher,
-      PendingChanges& localPending);
+      PendingChanges& localPending,
+      bool clientMode = false);
+
+  /**
+   * If view snapshots are enabled and one exists for this root, seeds view
+   * with its contents.  Called on the IO thread ahead of the initial crawl,
+   * which then revalidates the nodes, unless the watcher can resume from
+   * the position that the snapshot recorded.  Ticks continue from where the
+   * snapshot left off, so that clocks issued against it remain valid.
+   * Returns true if the snapshot was loaded.
+   */
+  bool loadSnapshot(ViewDatabase& view);
+
+  /**
+   * Writes a view snapshot for this root, if enabled and not discarded.  A
+   * failure to write is logged and otherwise ignored.
+   */
+  void saveSnapshot();
 
   // Performs settle-time actions.
   // Returns whether the root was reaped and the IO thread should terminate.
   Continue doSettleThings(Root& root);
 
+  // The index into summaryDirPaths_ of the summary dir that is or contains
+  // `path`, if any
+  std::optional<size_t> summaryDirContaining(const w_string& path) const;
+
+  // Marks the node of a summary dir changed, and the dir as needing to be
+  // walked again
+  void markSummaryDirChanged(
+      ViewDatabase& view,
+      size_t index,
+      std::chrono::system_clock::time_point now);
+
+  // Walks the summary dirs that changed since they were last walked,
+  // without holding the view.  One whose totals differ from those of its
+  // last walk is marked changed again, since the walk may have found
+  // changes that the watcher didn't report.
+  void refreshSummaryDirs(const std::shared_ptr<Root>& root);
+
+  // How long to wait for the root to be quiet before considering it settled
+  std::chrono::milliseconds settlePeriod(const Root& root) const;
+
   FileSystem& fileSystem_;
   const Configuration config_;
 
+  // Shared with view_ so that their occupancy can be reported without
+  // acquiring the view lock.
+  const std::shared_ptr<NodeArena> nodeArena_;
+  const std::shared_ptr<NameTable> nameTable_;
+  // Likewise, so that results can look up tree digests without it.
+  const std::shared_ptr<DirTreeHashes> treeHashes_;
   folly::Synchronized<ViewDatabase> view_;
   // The most recently observed tick value of an item in the view
   // Only incremented by the iothread, but may be read by other threads.
@@ -363,7 +1145,21 @@ class InMemoryView final : public QueryableView {
   };
   folly::Synchronized<CrawlState> crawlState_;
 
+  // Serializes age-out passes.
+  std::mutex ageOutMutex_;
+  // How long age-out may hold the view lock before yielding it.
+  std::chrono::milliseconds ageOutSliceBudget_{10};
+  // Describe the most recent age-out pass, for debug-status.
+  std::atomic<uint32_t> lastAgeOutSlices_{0};
+  std::atomic<int64_t> lastAgeOutMaxSliceMs_{0};
+  // Describe idle compaction, for debug-status.
+  std::atomic<uint64_t> compactions_{0};
+  std::atomic<size_t> lastCompactionReleasedBytes_{0};
+
   uint32_t lastAgeOutTick_{0};
+  // Remembers aged out files for since queries from before the age-out;
+  // null unless change_journal_max_bytes is set.
+  std::unique_ptr<ChangeJournal> changeJournal_;
   // This is system_clock instead of steady_clock because it's compared with a
   // file's otime.
   std::chrono::system_clock::time_point lastAgeOutTimestamp_{};
@@ -377,6 +1173,12 @@ class InMemoryView final : public QueryableView {
   PendingCollection pendingFromWatcher_;
 
   std::atomic<bool> stopThreads_{false};
+  // Set by startThreads(); ioThreadStopped_ is fulfilled once the IO thread
+  // has returned, having saved the view's snapshot.
+  std::atomic<bool> threadsStarted_{false};
+  std::promise<void> ioThreadStopped_;
+  std::shared_future<void> ioThreadStoppedFuture_{
+      ioThreadStopped_.get_future().share()};
   std::shared_ptr<Watcher> watcher_;
 
   // mutable because we pass a reference to other things from inside
@@ -390,12 +1192,192 @@ class InMemoryView final : public QueryableView {
   // If true, we will wait for the items to be hashed before
   // dispatching the settle to watchman clients
   bool syncContentCacheWarming_{false};
+  // Which of the caches to warm
+  ContentHashCache* warmContentCache_{nullptr};
+  // Should we warm the caches for the subscriptions when we settle?
+  bool enableQueryContentCacheWarming_{false};
   // Remember what we've already warmed up
   uint32_t lastWarmedTick_{0};
 
+  // The most files a ChangeSet may hold; if more changed during a settle
+  // period, subscriptions walk the view instead.  Zero disables change sets.
+  size_t maxChangeSetFiles_{4096};
+  folly::Synchronized<std::shared_ptr<const ChangeSet>> changeSet_;
+  // The position up to which changes were last recorded.  Only accessed
+  // from the IO thread.
+  uint32_t lastChangeSetTick_{0};
+
   // The source control system that we detected during initialization
   std::unique_ptr<SCM> scm_;
 
+  // If crawl_stat_threads is configured, the crawler uses this pool to
+  // lstat directory entries in parallel.  The directory enumeration itself
+  // and all mutation of the view remain on the IO thread.
+  std::unique_ptr<ThreadPool> crawlPool_;
+  // Directories with fewer entries needing a stat than this are processed
+  // serially; the fan-out isn't worth it for small dirs.
+  size_t crawlParallelMinEntries_{32};
+  // If io_shards is configured, each batch of pending items is stat'ed
+  // across this many workers; see processShardedBatch.
+  size_t ioShards_{0};
+  std::unique_ptr<ThreadPool> ioShardPool_;
+  // If io_throttle is configured, bounds how many of the crawlPool_ and
+  // ioShardPool_ tasks, and of the content hashes, do I/O at once, by the
+  // latency of the stats and reads; shared with the content hash caches.
+  std::shared_ptr<IoThrottle> ioThrottle_;
+  // Records the cost of each dir while fullCrawl runs, and is null
+  // otherwise.  Only used by the IO thread.
+  std::unique_ptr<CrawlProfiler> crawlProfiler_;
+  // How many dirs of each sort the report of a full crawl keeps; see
+  // crawl_profile_size
+  size_t crawlProfileSize_{0};
+  folly::Synchronized<std::optional<CrawlProfileReport>> crawlProfile_;
+  // What fullCrawl has done so far, while it runs.  Only used by the IO
+  // thread.
+  struct CrawlProgress {
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastReport;
+    size_t dirs{0};
+    size_t entries{0};
+    // The files that the view held when the crawl started, which a crawl
+    // of a restored or recrawled root will mostly find again
+    size_t expectedFiles{0};
+    // The lock that fullCrawl holds on the view, which it releases between
+    // batches for the incomplete reads
+    folly::Synchronized<ViewDatabase>::WLockedPtr* viewLock{nullptr};
+  };
+  std::optional<CrawlProgress> crawlProgress_;
+  // The queries that read the view while it is being crawled, and asked to
+  // be let in between the crawl's batches or are reading it
+  struct IncompleteReads {
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t waiting{0};
+    size_t reading{0};
+  };
+  IncompleteReads incompleteReads_;
+  // The longest that the crawl waits for incomplete reads to finish before
+  // it takes the view back; see incomplete_query_yield_ms
+  std::chrono::milliseconds incompleteReadYield_{1000};
+  // How often fullCrawl publishes its progress; see
+  // crawl_progress_interval_ms
+  std::chrono::milliseconds crawlProgressInterval_{500};
+  // If pending_stat_io_uring is configured and io_uring is available, the
+  // pending paths are stat'd in a single batch through this.
+  std::unique_ptr<IoUringStat> ioUringStat_;
+  // What the stats of changed and crawled files fetch; see stat_atime and
+  // stat_dont_sync.
+  StatOptions statOptions_;
+  // The dirs whose entries were recently stat'd, by getEntryInformation.
+  // Cleared after each batch of pending changes.
+  std::unique_ptr<DirFdCache> dirFds_;
+  // If set, recursive crawls of dirs whose mtime hasn't changed only stat
+  // the entries whose inode or type readdir reports as different.
+  bool recrawlTrustReadDir_{false};
+  // If set, recrawls don't read the dirs whose mtime and inode haven't
+  // changed since they were last read, on filesystems that keep dir mtimes
+  // reliably.
+  bool recrawlSkipUnchangedDirs_{false};
+  // If set, a client mode crawl that starts from a view snapshot doesn't
+  // read the dirs whose mtime and inode match the snapshot.
+  bool clientModeSkipUnchangedDirs_{false};
+  // Likewise for the crawl of a service that restarted.
+  bool snapshotSkipUnchangedDirs_{false};
+  // If set, the targets of changed symlinks are read into the symlink
+  // target cache as they are stat'd rather than when a query asks for them.
+  bool prefetchSymlinkTargets_{false};
+
+  // If lazy_crawl_depth is configured, directories that are that many
+  // levels or more below the root are only crawled, and watched, once a
+  // query needs them; see materialize().
+  uint32_t lazyCrawlDepth_{0};
+  struct LazyCrawl {
+    // The directories whose crawl was put off
+    std::unordered_set<w_string> deferred;
+    // Everything beneath these paths, and the directories above them, is
+    // crawled.  None of them is beneath another.
+    std::vector<w_string> materialized;
+  };
+  folly::Synchronized<LazyCrawl> lazyCrawl_;
+
+  // If summary_dirs is configured, the view has a node for each of those
+  // dirs but none for anything beneath them.  A change beneath one is
+  // recorded as a change to the dir itself, and its totals are kept up to
+  // date by walking it when the root settles.
+  struct SummaryTotals {
+    uint64_t files{0};
+    uint64_t dirs{0};
+    // The newest mtime of anything beneath the dir
+    timespec newestMtime{0, 0};
+  };
+  struct SummaryDir {
+    // As of the last walk
+    SummaryTotals totals;
+    uint64_t walks{0};
+    // How many changes beneath the dir have been recorded
+    uint64_t changes{0};
+    // Whether it changed since it was last walked
+    bool dirty{false};
+  };
+  // Fixed at construction, so that they can be looked up without a lock
+  std::vector<w_string> summaryDirPaths_;
+  // One for each of summaryDirPaths_
+  folly::Synchronized<std::vector<SummaryDir>> summaryDirs_;
+
+  // Counts what is beneath `path`, watching the dirs as it goes
+  SummaryTotals walkSummaryDir(
+      const std::shared_ptr<Root>& root,
+      const w_string& path);
+
+  // Records `path` as materialized, unless it already is, and moves the
+  // deferred dirs that it needs crawled into `toCrawl`.  Returns whether it
+  // was added.
+  static bool addMaterialized(
+      LazyCrawl& lazy,
+      const w_string& path,
+      std::vector<w_string>& toCrawl);
+
+  // The paths that queries waiting to synchronize will examine.  Only
+  // maintained if sync_priority_yield_ms is configured, which is the longest
+  // that processAllPending releases the view for to let them run.
+  PriorityPaths priorityPaths_;
+  std::chrono::milliseconds priorityYieldTimeout_{0};
+
+  // The longest, and the most changes, that processAllPending applies
+  // before it lets the queries in readView have the view; see
+  // pending_slice_ms and pending_slice_items.  Zero is unbounded.
+  std::chrono::milliseconds pendingSliceBudget_{0};
+  size_t pendingSliceItems_{0};
+  // The queries that are waiting for the view in readView
+  mutable std::atomic<uint32_t> queuedReaders_{0};
+  // How long processAllPending holds the view for at a time, and how often
+  // it released it for queries, for debug-status and the metrics
+  LatencyHistogram pendingLockHeld_;
+  std::atomic<uint64_t> pendingSliceYields_{0};
+
+  // If adaptive_settle is configured, picks the settle period from the rate
+  // at which changes arrive instead of using the fixed `settle` value.
+  // Updated by the IO thread and read by debug-status.
+  std::unique_ptr<folly::Synchronized<SettleController, std::mutex>>
+      settleController_;
+
+  // Where to persist the view between daemon restarts; empty if
+  // view_snapshot is disabled.
+  w_string snapshotPath_;
+  // How often a settled view is written out.
+  std::chrono::seconds snapshotInterval_{600};
+  // The epochs restored from the view snapshot, oldest first.
+  folly::Synchronized<std::vector<ClockEpoch>> clockEpochs_;
+  // Only accessed from the IO thread.
+  bool snapshotLoadAttempted_{false};
+  // The watcher position that the loaded snapshot recorded, if any.  Only
+  // accessed from the IO thread.
+  std::string snapshotWatcherPosition_;
+  std::chrono::steady_clock::time_point lastSnapshot_{};
+  // Set by discardSnapshot; the IO thread then removes the snapshot as it
+  // stops instead of writing it.
+  std::atomic<bool> snapshotDiscarded_{false};
+
   struct PendingChangeLogEntry {
     PendingChangeLogEntry() noexcept {
       // time_point is not noexcept so this can't be defaulted.
@@ -426,6 +1408,9 @@ class InMemoryView final : public QueryableView {
 
   // If set, paths processed by processPending are logged here.
   std::unique_ptr<RingBuffer<PendingChangeLogEntry>> processedPaths_;
+
+  // If set, the notify thread records the watcher's events here.
+  std::unique_ptr<WatcherEventRecorder> eventRecorder_;
 };
 
 } // namespace watchman
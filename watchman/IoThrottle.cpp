@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/IoThrottle.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+// How long the throttle must see no I/O to consider the disk idle
+constexpr auto kIdleReset = std::chrono::seconds(1);
+// The baseline moves 1/kBaselineDrift of the way towards each window
+// average that is above it
+constexpr int kBaselineDrift = 64;
+
+IoThrottle::Config normalized(IoThrottle::Config config) {
+  config.minConcurrency = std::max<size_t>(config.minConcurrency, 1);
+  config.maxConcurrency =
+      std::max(config.minConcurrency, config.maxConcurrency);
+  return config;
+}
+} // namespace
+
+IoThrottle::Slot& IoThrottle::Slot::operator=(Slot&& other) noexcept {
+  if (this != &other) {
+    if (owner_) {
+      owner_->release();
+    }
+    owner_ = other.owner_;
+    other.owner_ = nullptr;
+  }
+  return *this;
+}
+
+IoThrottle::Slot::~Slot() {
+  if (owner_) {
+    owner_->release();
+  }
+}
+
+IoThrottle::IoThrottle(Config config)
+    : config_{normalized(config)}, limit_{config_.maxConcurrency} {}
+
+folly::SemiFuture<IoThrottle::Slot> IoThrottle::acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_ == 0 && limit_ < config_.maxConcurrency &&
+      Clock::now() - lastSample_ > kIdleReset) {
+    limit_ = config_.maxConcurrency;
+    ++increases_;
+  }
+
+  // Waiters go first so that a steady stream of new work can't starve them
+  if (waiters_.empty() && running_ < limit_) {
+    ++running_;
+    return folly::makeSemiFuture(Slot{this});
+  }
+  ++throttled_;
+  waiters_.emplace_back();
+  return waiters_.back().getSemiFuture();
+}
+
+std::vector<folly::Promise<IoThrottle::Slot>> IoThrottle::grantLocked() {
+  std::vector<folly::Promise<Slot>> granted;
+  while (!waiters_.empty() && running_ < limit_) {
+    ++running_;
+    granted.push_back(std::move(waiters_.front()));
+    waiters_.pop_front();
+  }
+  return granted;
+}
+
+void IoThrottle::release() {
+  std::vector<folly::Promise<Slot>> granted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+    granted = grantLocked();
+  }
+  for (auto& promise : granted) {
+    promise.setValue(Slot{this});
+  }
+}
+
+void IoThrottle::record(Kind kind, Clock::duration elapsed, size_t units) {
+  std::vector<folly::Promise<Slot>> granted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lastSample_ = Clock::now();
+
+    auto& window = windows_[size_t(kind)];
+    window.sum += elapsed / Clock::rep(std::max<size_t>(units, 1));
+    if (++window.count < kWindowSamples) {
+      return;
+    }
+    auto average = window.sum / Clock::rep(window.count);
+    window.sum = Clock::duration{0};
+    window.count = 0;
+
+    bool congested = window.baseline.count() > 0 &&
+        average > config_.minLatency &&
+        average.count() > window.baseline.count() * config_.latencyRatio;
+
+    if (window.baseline.count() == 0 || average < window.baseline) {
+      window.baseline = average;
+    } else if (!congested || limit_ == config_.minConcurrency) {
+      // A slower average that persists even when we're issuing as little
+      // I/O as we can is the disk's new normal
+      window.baseline += (average - window.baseline) / kBaselineDrift;
+    }
+
+    if (congested) {
+      if (limit_ > config_.minConcurrency) {
+        limit_ = std::max(config_.minConcurrency, limit_ - (limit_ + 3) / 4);
+        ++decreases_;
+      }
+    } else if (limit_ < config_.maxConcurrency) {
+      ++limit_;
+      ++increases_;
+      granted = grantLocked();
+    }
+  }
+  for (auto& promise : granted) {
+    promise.setValue(Slot{this});
+  }
+}
+
+size_t IoThrottle::limit() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limit_;
+}
+
+IoThrottle::Stats IoThrottle::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  stats.limit = limit_;
+  stats.running = running_;
+  stats.waiting = waiters_.size();
+  stats.throttled = throttled_;
+  stats.decreases = decreases_;
+  stats.increases = increases_;
+  for (size_t i = 0; i < kNumKinds; ++i) {
+    stats.baseline[i] = std::chrono::duration_cast<std::chrono::microseconds>(
+        windows_[i].baseline);
+  }
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Bounds how much of a root's background I/O (the stat calls of a crawl
+ * and content hashing) is in flight at once, adapting the bound to the
+ * latency that the I/O sees, so that a crawl of a disk that is shared with
+ * a build backs off while the build is hammering it and goes flat out when
+ * the disk is otherwise idle.
+ *
+ * Callers hold a Slot around each unit of work and record() the latency of
+ * each operation.  The latencies are averaged over windows of
+ * kWindowSamples operations, and compared with a baseline, which is the
+ * lowest window average seen, drifting slowly upwards towards the more
+ * recent averages.  A window whose average exceeds latencyRatio times the
+ * baseline, and also minLatency, means that the disk is queueing our
+ * requests, and the limit is cut by a quarter; any other window raises it
+ * by one.  Metadata operations and data reads, which are measured per MiB,
+ * have separate baselines since their latencies aren't comparable.  After
+ * a second without any I/O the limit goes back up to maxConcurrency.
+ *
+ * Thread safe.
+ */
+class IoThrottle {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Kind : uint8_t {
+    // stat and the like
+    Metadata,
+    // Reading file contents; record() one unit per MiB
+    Data,
+  };
+  static constexpr size_t kNumKinds = 2;
+  static constexpr size_t kWindowSamples = 16;
+
+  struct Config {
+    size_t minConcurrency{1};
+    size_t maxConcurrency{8};
+    double latencyRatio{2.0};
+    // Latencies below this are never treated as congestion, so that a
+    // baseline from the page cache doesn't throttle actual disk reads
+    std::chrono::microseconds minLatency{1000};
+  };
+
+  struct Stats {
+    size_t limit{0};
+    size_t running{0};
+    size_t waiting{0};
+    // Slots that weren't granted straight away
+    uint64_t throttled{0};
+    uint64_t decreases{0};
+    uint64_t increases{0};
+    std::array<std::chrono::microseconds, kNumKinds> baseline{};
+  };
+
+  // Holds a slot until it is destroyed
+  class Slot {
+   public:
+    Slot() = default;
+    Slot(Slot&& other) noexcept : owner_{other.owner_} {
+      other.owner_ = nullptr;
+    }
+    Slot& operator=(Slot&& other) noexcept;
+    Slot(const Slot&) = delete;
+    Slot& operator=(const Slot&) = delete;
+    ~Slot();
+
+   private:
+    friend class IoThrottle;
+    explicit Slot(IoThrottle* owner) : owner_{owner} {}
+
+    IoThrottle* owner_{nullptr};
+  };
+
+  explicit IoThrottle(Config config);
+
+  // Returns a future that is fulfilled with a slot once fewer than limit()
+  // slots are held.  Slots are granted in the order they were asked for.
+  folly::SemiFuture<Slot> acquire();
+
+  // Records that an operation of `kind` took `elapsed`, covering `units`
+  // units of work
+  void record(Kind kind, Clock::duration elapsed, size_t units = 1);
+
+  size_t limit() const;
+
+  Stats stats() const;
+
+  const Config& config() const {
+    return config_;
+  }
+
+ private:
+  struct Window {
+    Clock::duration sum{0};
+    size_t count{0};
+    Clock::duration baseline{0};
+  };
+
+  void release();
+  // Grants slots to waiters while there is room; call with mutex_ held and
+  // fulfil the returned promises after releasing it
+  std::vector<folly::Promise<Slot>> grantLocked();
+
+  const Config config_;
+  mutable std::mutex mutex_;
+  size_t limit_;
+  size_t running_{0};
+  std::deque<folly::Promise<Slot>> waiters_;
+  std::array<Window, kNumKinds> windows_;
+  Clock::time_point lastSample_;
+  uint64_t throttled_{0};
+  uint64_t decreases_{0};
+  uint64_t increases_{0};
+};
+
+} // namespace watchman
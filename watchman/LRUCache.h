@@ -8,10 +8,13 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/hash/Hash.h>
+#include <algorithm>
 #include <chrono>
 #include <deque>
 #include <memory>
 #include <unordered_map>
+#include "watchman/MemoryAccounting.h"
 #include "watchman/WatchmanConfig.h"
 
 namespace watchman {
@@ -49,6 +52,13 @@ namespace watchman {
  * and its nodes.  Because the cache is LRU it needs to touch
  * a node as part of a lookup to ensure that it will not
  * be evicted prematurely.
+ *
+ * For caches that are hit by many threads at once, that lock can
+ * be split by constructing the cache with more than one shard.
+ * Each shard is an independent LRU with its own lock, holding an
+ * equal share of the maxItems limit, and a key always maps to the
+ * same shard.  Eviction is then only LRU within a shard, which is
+ * a close enough approximation when the keys are well distributed.
  */
 
 template <typename KeyType, typename ValueType>
@@ -77,12 +87,23 @@ class Node {
 
   // Construct a node via LRUCache::set()
   Node(const KeyType& key, ValueType&& value)
-      : key_(key), value_(std::move(value)) {}
+      : key_(key), value_(std::move(value)) {
+    recordAllocation(MemoryCategory::CacheEntries, sizeof(Node));
+  }
 
   // Construct a node using a getter function.
   // The value is empty and the promise list is initialized.
   explicit Node(const KeyType& key)
-      : key_(key), promises_(std::make_unique<PromiseList>()) {}
+      : key_(key), promises_(std::make_unique<PromiseList>()) {
+    recordAllocation(MemoryCategory::CacheEntries, sizeof(Node));
+  }
+
+  ~Node() {
+    recordDeallocation(MemoryCategory::CacheEntries, sizeof(Node));
+  }
+
+  Node(const Node&) = delete;
+  Node& operator=(const Node&) = delete;
 
   // Returns the underlying value.
   const ValueType& value() const {
@@ -200,6 +221,19 @@ struct Stats {
   // Number of times that the cache has been clear()'d
   size_t clearCount{0};
 
+  // Accumulates the counters of another shard of the same cache
+  void add(const Stats& other) {
+    cacheHit += other.cacheHit;
+    cacheShare += other.cacheShare;
+    cacheMiss += other.cacheMiss;
+    cacheEvict += other.cacheEvict;
+    cacheStore += other.cacheStore;
+    cacheLoad += other.cacheLoad;
+    cacheErase += other.cacheErase;
+    // All of the shards are cleared together
+    clearCount = std::max(clearCount, other.clearCount);
+  }
+
   void clear() {
     cacheHit = 0;
     cacheShare = 0;
@@ -266,17 +300,24 @@ class LRUCache {
 
  private:
   using State = lrucache::InternalState<KeyType, ValueType>;
-  using LockedState = typename folly::Synchronized<State>::LockedPtr;
+  using Shard = folly::Synchronized<State>;
+  using LockedState = typename Shard::LockedPtr;
 
  public:
   // Construct a cache with a defined limit and the specified
   // negative caching TTL duration.  The errorTTL is measured
   // from the start of the lookup, not its completion.
+  // The cache is split into numShards independently locked shards.
   LRUCache(
       size_t maxItems,
       std::chrono::milliseconds errorTTL,
-      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300))
-      : maxItems_(maxItems), errorTTL_(errorTTL), fetchTimeout_(fetchTimeout) {}
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300),
+      size_t numShards = 1)
+      : numShards_(std::max(size_t(1), numShards)),
+        maxItemsPerShard_((maxItems + numShards_ - 1) / numShards_),
+        errorTTL_(errorTTL),
+        fetchTimeout_(fetchTimeout),
+        shards_(std::make_unique<Shard[]>(numShards_)) {}
 
   LRUCache(
       Configuration&& cfg,
@@ -284,17 +325,21 @@ class LRUCache {
       size_t defaultMaxItems,
       size_t errorTTLSeconds,
       size_t fetchTimeoutSeconds = 60)
-      : maxItems_(cfg.getInt(
-            folly::to<std::string>(configPrefix, "_cache_size").c_str(),
-            defaultMaxItems)),
-        errorTTL_(std::chrono::seconds(cfg.getInt(
-            folly::to<std::string>(configPrefix, "_cache_error_ttl_seconds")
-                .c_str(),
-            errorTTLSeconds))),
-        fetchTimeout_(std::chrono::seconds(cfg.getInt(
-            folly::to<std::string>(configPrefix, "_fetch_timeout_seconds")
-                .c_str(),
-            fetchTimeoutSeconds))) {}
+      : LRUCache(
+            cfg.getInt(
+                folly::to<std::string>(configPrefix, "_cache_size").c_str(),
+                defaultMaxItems),
+            std::chrono::seconds(cfg.getInt(
+                folly::to<std::string>(configPrefix, "_cache_error_ttl_seconds")
+                    .c_str(),
+                errorTTLSeconds)),
+            std::chrono::seconds(cfg.getInt(
+                folly::to<std::string>(configPrefix, "_fetch_timeout_seconds")
+                    .c_str(),
+                fetchTimeoutSeconds)),
+            cfg.getInt(
+                folly::to<std::string>(configPrefix, "_cache_shards").c_str(),
+                1)) {}
 
   // No moving or copying
   LRUCache(const LRUCache&) = delete;
@@ -311,7 +356,7 @@ class LRUCache {
       const KeyType& key,
       std::chrono::steady_clock::time_point now =
           std::chrono::steady_clock::now()) {
-    auto state = state_.wlock();
+    auto state = shardFor(key).wlock();
     ++state->stats.cacheLoad;
 
     auto it = state->map.find(key);
@@ -377,10 +422,11 @@ class LRUCache {
           std::chrono::steady_clock::now()) {
     std::shared_ptr<NodeType> node;
     auto future = folly::Future<std::shared_ptr<const NodeType>>::makeEmpty();
+    auto* shard = &shardFor(key);
 
     // Only hold the lock on the state while we set up the map entry.
     {
-      auto state = state_.wlock();
+      auto state = shard->wlock();
       ++state->stats.cacheLoad;
 
       auto it = state->map.find(key);
@@ -432,12 +478,13 @@ class LRUCache {
     // simple callback that executes immediately in our context;
     // if that were to then try to operate on the cache, it would
     // deadlock.
-    getter(key).thenTry([node, this, now](folly::Try<ValueType>&& result) {
+    getter(key).thenTry([node, shard, this, now](
+                            folly::Try<ValueType>&& result) {
       // We're going to steal the promises so that we can fulfil
       // them outside of the lock
       std::unique_ptr<typename NodeType::PromiseList> promises;
       {
-        auto state = state_.wlock();
+        auto state = shard->wlock();
         node->value_ = std::move(result);
 
         if (whichQ(node.get(), state) != &state->lookupOrder) {
@@ -478,7 +525,7 @@ class LRUCache {
         // more requests than the cache limits allow.  Now that we're
         // done we should be able to free up some of those entries,
         // so take a stab at that now.
-        while (state->map.size() > maxItems_) {
+        while (state->map.size() > maxItemsPerShard_) {
           if (!evictOne(state, now, true)) {
             // We were not able to evict anything, so stop
             // trying.  We'll be over our cache size limit,
@@ -505,7 +552,7 @@ class LRUCache {
       ValueType&& value,
       std::chrono::steady_clock::time_point now =
           std::chrono::steady_clock::now()) {
-    auto state = state_.wlock();
+    auto state = shardFor(key).wlock();
     auto it = state->map.find(key);
 
     if (it != state->map.end()) {
@@ -535,7 +582,7 @@ class LRUCache {
   // Erase the entry associated with key.
   // Returns the node if it was present, else nullptr.
   std::shared_ptr<const NodeType> erase(const KeyType& key) {
-    auto state = state_.wlock();
+    auto state = shardFor(key).wlock();
     auto it = state->map.find(key);
     if (it == state->map.end()) {
       return nullptr;
@@ -554,27 +601,54 @@ class LRUCache {
 
   // Returns the number of cached items
   size_t size() const {
-    auto state = state_.rlock();
-    return state->map.size();
+    size_t size = 0;
+    for (size_t i = 0; i < numShards_; ++i) {
+      size += shards_[i].rlock()->map.size();
+    }
+    return size;
   }
 
-  // Returns cache statistics
+  // Returns cache statistics, summed across the shards
   CacheStats stats() const {
-    auto state = state_.rlock();
-    return CacheStats(state->stats, state->map.size());
+    lrucache::Stats stats;
+    size_t size = 0;
+    for (size_t i = 0; i < numShards_; ++i) {
+      auto state = shards_[i].rlock();
+      stats.add(state->stats);
+      size += state->map.size();
+    }
+    return CacheStats(stats, size);
+  }
+
+  // Returns the number of independently locked shards
+  size_t numShards() const {
+    return numShards_;
   }
 
   // Purge all of the entries from the cache
   void clear() {
-    auto state = state_.wlock();
-    state->evictionOrder.clear();
-    state->erroredOrder.clear();
-    state->lookupOrder.clear();
-    state->map.clear();
-    state->stats.clear();
+    for (size_t i = 0; i < numShards_; ++i) {
+      auto state = shards_[i].wlock();
+      state->evictionOrder.clear();
+      state->erroredOrder.clear();
+      state->lookupOrder.clear();
+      state->map.clear();
+      state->stats.clear();
+    }
   }
 
  private:
+  // Returns the shard that holds key
+  Shard& shardFor(const KeyType& key) {
+    if (numShards_ == 1) {
+      return shards_[0];
+    }
+    // Mix the hash so that the shard isn't picked by the same low bits
+    // that pick the bucket in the shard's map.
+    return shards_
+        [folly::hash::twang_mix64(std::hash<KeyType>()(key)) % numShards_];
+  }
+
   // Small helper for creating a new Node.  This checks for capacity
   // and attempts to evict an item to make room if needed.
   // The eviction may fail in some cases, which results in this method
@@ -586,7 +660,7 @@ class LRUCache {
       Args&&... args) {
     // If we are too full, try to evict an item; this may throw if there are no
     // evictable items!
-    if (state->map.size() + 1 > maxItems_) {
+    if (state->map.size() + 1 > maxItemsPerShard_) {
       evictOne(state, now, true);
     }
 
@@ -653,11 +727,12 @@ class LRUCache {
     return false;
   }
 
-  // The maximum allowed capacity
-  const size_t maxItems_;
+  const size_t numShards_;
+  // The maximum allowed capacity of each shard
+  const size_t maxItemsPerShard_;
   // How long to cache items that have an error Result
   const std::chrono::milliseconds errorTTL_;
   const std::chrono::milliseconds fetchTimeout_;
-  folly::Synchronized<State> state_;
+  std::unique_ptr<Shard[]> shards_;
 };
 } // namespace watchman
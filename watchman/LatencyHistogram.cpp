@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/LatencyHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace watchman {
+
+namespace {
+
+size_t stripeForThisThread() {
+  static std::atomic<size_t> nextStripe{0};
+  static thread_local size_t stripe =
+      nextStripe.fetch_add(1, std::memory_order_relaxed) %
+      LatencyHistogram::kNumStripes;
+  return stripe;
+}
+
+size_t highestBit(uint64_t value) {
+  size_t bit = 0;
+  while (value >>= 1) {
+    ++bit;
+  }
+  return bit;
+}
+
+} // namespace
+
+size_t LatencyHistogram::bucketFor(uint64_t micros) {
+  if (micros < kSubBuckets) {
+    return micros;
+  }
+  auto bit = highestBit(micros);
+  if (bit >= kMaxBits) {
+    return kNumBuckets - 1;
+  }
+  // The kSubBucketBits below the highest set bit select the sub-bucket
+  auto sub = (micros >> (bit - kSubBucketBits)) & (kSubBuckets - 1);
+  return (bit - kSubBucketBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  auto group = bucket / kSubBuckets;
+  auto sub = bucket % kSubBuckets;
+  auto shift = group - 1;
+  return ((uint64_t(kSubBuckets + sub + 1)) << shift) - 1;
+}
+
+void LatencyHistogram::record(std::chrono::microseconds duration) {
+  auto micros = uint64_t(std::max<int64_t>(0, duration.count()));
+  auto& stripe = stripes_[stripeForThisThread()];
+  stripe.counts[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+
+  auto max = stripe.max.load(std::memory_order_relaxed);
+  while (micros > max &&
+         !stripe.max.compare_exchange_weak(
+             max, micros, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snap;
+  uint64_t max = 0;
+  for (auto& stripe : stripes_) {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+      auto count = stripe.counts[i].load(std::memory_order_relaxed);
+      snap.counts[i] += count;
+      snap.count += count;
+    }
+    max = std::max(max, stripe.max.load(std::memory_order_relaxed));
+  }
+  snap.max = std::chrono::microseconds(max);
+  return snap;
+}
+
+std::chrono::microseconds LatencyHistogram::Snapshot::percentile(
+    double fraction) const {
+  if (count == 0) {
+    return std::chrono::microseconds(0);
+  }
+  auto rank = uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * count));
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      return std::min(
+          max, std::chrono::microseconds(int64_t(bucketUpperBound(i))));
+    }
+  }
+  return max;
+}
+
+} // namespace watchman
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace watchman {
+
+/**
+ * A histogram of durations that is cheap enough to record every query in.
+ *
+ * Durations are counted in log-linear buckets, in the manner of HDR
+ * histograms: each power of two microseconds is split into kSubBuckets
+ * linear buckets, so a bucket's width is at most 1/kSubBuckets of its
+ * lower bound.  record() is lock-free; the counts are striped across
+ * cache-line aligned shards by thread so that concurrent queries don't
+ * contend on them, and snapshot() adds the shards back together.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 3;
+  static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+  // Enough for durations of a little over a month
+  static constexpr size_t kMaxBits = 42;
+  static constexpr size_t kNumBuckets =
+      (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+  static constexpr size_t kNumStripes = 4;
+
+  void record(std::chrono::microseconds duration);
+
+  struct Snapshot {
+    uint64_t count{0};
+    std::chrono::microseconds max{0};
+    std::array<uint64_t, kNumBuckets> counts{};
+
+    /**
+     * The duration that `fraction` (between 0 and 1) of the recorded
+     * durations are no longer than.  This is the upper bound of the bucket
+     * that holds it, or the largest recorded duration if that is smaller.
+     */
+    std::chrono::microseconds percentile(double fraction) const;
+  };
+
+  Snapshot snapshot() const;
+
+  static size_t bucketFor(uint64_t micros);
+  // The largest duration that falls into `bucket`
+  static uint64_t bucketUpperBound(size_t bucket);
+
+ private:
+  struct alignas(64) Stripe {
+    std::array<std::atomic<uint64_t>, kNumBuckets> counts{};
+    std::atomic<uint64_t> max{0};
+  };
+
+  std::array<Stripe, kNumStripes> stripes_;
+};
+
+} // namespace watchman
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/LatencyProbe.h"
+#include <folly/String.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/watchman_stream.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+namespace {
+
+const char* const kStageNames[LatencyProbe::kNumStages] =
+    {"watcher", "process", "settle", "dispatch", "total"};
+
+} // namespace
+
+bool LatencyProbe::writeCanary(const w_string& prefix, Clock::time_point now) {
+  w_string lost;
+  bool ok;
+  {
+    auto state = state_.wlock();
+    if (state->progress == Progress::Written) {
+      lost = state->canary;
+      lost_.fetch_add(1, std::memory_order_relaxed);
+    }
+    state->progress = Progress::Idle;
+
+    auto path = w_string::build(prefix, "probe", ++state->serial);
+    auto file = w_stm_open(
+        path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0700);
+    ok = bool(file);
+    if (!ok) {
+      logf(
+          ERR,
+          "latency probe canary {} couldn't be created: {}\n",
+          path,
+          folly::errnoStr(errno));
+    } else {
+      state->progress = Progress::Written;
+      state->canary = path;
+      state->written = now;
+      state->reached = now;
+      written_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  if (lost) {
+    unlink(lost.c_str());
+  }
+  return ok;
+}
+
+bool LatencyProbe::observe(
+    const w_string& path,
+    Clock::time_point reported,
+    Clock::time_point now) {
+  {
+    auto state = state_.wlock();
+    if (state->progress != Progress::Written || state->canary != path) {
+      return false;
+    }
+    record(Watcher, reported - state->written);
+    record(Process, now - reported);
+    state->progress = Progress::Observed;
+    state->reached = now;
+  }
+
+  // Best effort; the removal is itself reported, but is no longer the
+  // canary
+  unlink(path.c_str());
+  return true;
+}
+
+void LatencyProbe::settled(Clock::time_point now) {
+  auto state = state_.wlock();
+  if (state->progress != Progress::Observed) {
+    return;
+  }
+  record(Settle, now - state->reached);
+  state->progress = Progress::Settled;
+  state->reached = now;
+}
+
+void LatencyProbe::dispatched(Clock::time_point now) {
+  auto state = state_.wlock();
+  if (state->progress != Progress::Settled) {
+    return;
+  }
+  record(Dispatch, now - state->reached);
+  record(Total, now - state->written);
+  state->progress = Progress::Idle;
+}
+
+void LatencyProbe::record(Stage stage, Clock::duration duration) {
+  // The watcher's timestamps come from the same clock, but don't let a
+  // step of the clock produce a negative duration
+  latency_[stage].record(std::max(
+      std::chrono::microseconds(0),
+      std::chrono::duration_cast<std::chrono::microseconds>(duration)));
+}
+
+void LatencyProbe::collectMetrics(
+    MetricsWriter& writer,
+    const MetricLabels& labels) const {
+  auto addCanaries = [&](const char* result, uint64_t count) {
+    auto resultLabels = labels;
+    resultLabels.emplace_back("result", result);
+    writer.add(
+        "watchman_latency_probe_canaries",
+        MetricType::Counter,
+        "Canary files that the latency probe wrote, and those that the "
+        "watcher never reported",
+        resultLabels,
+        count);
+  };
+  addCanaries("written", written_.load(std::memory_order_relaxed));
+  addCanaries("lost", lost_.load(std::memory_order_relaxed));
+
+  static const std::pair<double, const char*> quantiles[] = {
+      {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+  for (size_t i = 0; i < kNumStages; ++i) {
+    auto latency = latency_[i].snapshot();
+    if (latency.count == 0) {
+      continue;
+    }
+    for (auto& [quantile, name] : quantiles) {
+      auto stageLabels = labels;
+      stageLabels.emplace_back("stage", kStageNames[i]);
+      stageLabels.emplace_back("quantile", name);
+      writer.add(
+          "watchman_latency_probe_seconds",
+          MetricType::Gauge,
+          "Percentiles of the time that each stage of delivering a change "
+          "to subscribers takes, as measured by the latency probe",
+          stageLabels,
+          latency.percentile(quantile).count() / 1e6);
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "watchman/LatencyHistogram.h"
+#include "watchman/Metrics.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Measures how long a change to a root takes to reach its subscribers, by
+ * writing a canary file next to the root's sync cookies now and then and
+ * timing it through each stage:
+ *
+ *   watcher   from the write to the watcher reporting it
+ *   process   from there to the IO thread applying it
+ *   settle    from there to the root settling
+ *   dispatch  from there to a subscription of the root being processed
+ *   total     from the write to the subscription being processed
+ *
+ * One canary is in flight at a time.  Like cookies, canaries never appear
+ * in the view.  A canary that the watcher hasn't reported by the time the
+ * next one is written is counted as lost, and one that no subscription
+ * picks up completes at the settle stage.
+ *
+ * Thread safe.
+ */
+class LatencyProbe {
+ public:
+  using Clock = std::chrono::system_clock;
+
+  enum Stage { Watcher, Process, Settle, Dispatch, Total, kNumStages };
+
+  /**
+   * Writes a new canary, named by prefix, which should be one of the root's
+   * cookie prefixes, followed by a serial number.  Returns false if the
+   * file couldn't be written.
+   */
+  bool writeCanary(const w_string& prefix, Clock::time_point now);
+
+  /**
+   * Called by the IO thread for each cookie file it applies, with the time
+   * that the watcher reported it.  Returns true if path was the canary.
+   */
+  bool observe(
+      const w_string& path,
+      Clock::time_point reported,
+      Clock::time_point now);
+
+  // Called by the IO thread as the root settles
+  void settled(Clock::time_point now);
+
+  // Called as a subscription of the root is processed
+  void dispatched(Clock::time_point now);
+
+  void collectMetrics(MetricsWriter& writer, const MetricLabels& labels) const;
+
+  LatencyHistogram::Snapshot getLatency(Stage stage) const {
+    return latency_[stage].snapshot();
+  }
+
+  uint64_t getLostCanaries() const {
+    return lost_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  enum class Progress { Idle, Written, Observed, Settled };
+
+  struct State {
+    Progress progress{Progress::Idle};
+    w_string canary;
+    uint64_t serial{0};
+    Clock::time_point written;
+    // When the stage that progress names was reached
+    Clock::time_point reached;
+  };
+
+  void record(Stage stage, Clock::duration duration);
+
+  folly::Synchronized<State> state_;
+  std::array<LatencyHistogram, kNumStages> latency_;
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> lost_{0};
+};
+
+} // namespace watchman
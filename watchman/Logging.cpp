@@ -7,15 +7,20 @@
 
 #include "watchman/Logging.h"
 
+#include <folly/ProducerConsumerQueue.h>
 #include <folly/ScopeGuard.h>
 #include <folly/ThreadLocal.h>
 #include <folly/experimental/symbolizer/Symbolizer.h>
 #include <folly/system/ThreadName.h>
 
+#include <algorithm>
 #include <array>
+#include <condition_variable>
 #include <limits>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <thread>
 
 #ifdef __APPLE__
 #include <pthread.h>
@@ -25,6 +30,15 @@ using namespace watchman;
 
 static folly::ThreadLocal<std::optional<std::string>> threadName;
 
+// See Log::getThreadNames().  Never destroyed, since threads may still name
+// themselves during static destruction.
+static folly::Synchronized<std::unordered_map<std::thread::id, std::string>>&
+namedThreads() {
+  static auto* names =
+      new folly::Synchronized<std::unordered_map<std::thread::id, std::string>>;
+  return *names;
+}
+
 namespace {
 template <typename String>
 void write_stderr(const String& str) {
@@ -92,6 +106,169 @@ LogLevel logLabelToLevel(const w_string& label) {
   return getLevelMaps().labelToLevel.at(label);
 }
 
+namespace {
+
+struct BufferedLine {
+  uint64_t seq;
+  LogLevel level;
+  w_string line;
+};
+
+// Orders the lines that different threads buffered concurrently
+std::atomic<uint64_t> nextLineSeq{0};
+
+} // namespace
+
+// The lines logged by one thread.  Only that thread writes to `lines` and
+// only the drain, serialized by AsyncLogWriter::drainMutex_, reads from it.
+struct ThreadLogBuffer {
+  explicit ThreadLogBuffer(size_t capacity) : lines(capacity + 1) {}
+
+  folly::ProducerConsumerQueue<BufferedLine> lines;
+  std::atomic<uint64_t> dropped{0};
+};
+
+class AsyncLogWriter {
+ public:
+  explicit AsyncLogWriter(Log& log, size_t linesPerThread)
+      : log_(log), linesPerThread_(linesPerThread) {
+    thread_ = std::thread([this] {
+      w_set_thread_name("log-writer");
+      run();
+    });
+  }
+
+  // Returns false if the line was dropped
+  bool append(LogLevel level, w_string&& line);
+  void drain();
+  void stop();
+
+ private:
+  void run();
+  ThreadLogBuffer& getThreadBuffer();
+
+  Log& log_;
+  const size_t linesPerThread_;
+  folly::Synchronized<std::vector<std::shared_ptr<ThreadLogBuffer>>, std::mutex>
+      buffers_;
+  std::mutex drainMutex_;
+
+  std::atomic<bool> wakeup_{false};
+  bool stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread thread_;
+};
+
+namespace {
+
+struct ThreadLogBufferHolder {
+  AsyncLogWriter* writer{nullptr};
+  std::shared_ptr<ThreadLogBuffer> buffer;
+};
+
+thread_local ThreadLogBufferHolder threadLogBuffer;
+
+} // namespace
+
+ThreadLogBuffer& AsyncLogWriter::getThreadBuffer() {
+  if (threadLogBuffer.writer != this) {
+    auto buffer = std::make_shared<ThreadLogBuffer>(linesPerThread_);
+    buffers_.lock()->push_back(buffer);
+    threadLogBuffer.writer = this;
+    threadLogBuffer.buffer = std::move(buffer);
+  }
+  return *threadLogBuffer.buffer;
+}
+
+bool AsyncLogWriter::append(LogLevel level, w_string&& line) {
+  auto& buffer = getThreadBuffer();
+  if (!buffer.lines.write(BufferedLine{
+          nextLineSeq.fetch_add(1, std::memory_order_relaxed),
+          level,
+          std::move(line)})) {
+    buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (!wakeup_.load(std::memory_order_relaxed) && !wakeup_.exchange(true)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cond_.notify_one();
+  }
+  return true;
+}
+
+void AsyncLogWriter::drain() {
+  std::lock_guard<std::mutex> drainLock(drainMutex_);
+
+  std::vector<BufferedLine> lines;
+  uint64_t dropped = 0;
+  {
+    auto buffers = buffers_.lock();
+    for (auto& buffer : *buffers) {
+      BufferedLine line;
+      while (buffer->lines.read(line)) {
+        lines.push_back(std::move(line));
+      }
+      dropped += buffer->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    // The buffers of threads that have exited won't be written to again
+    buffers->erase(
+        std::remove_if(
+            buffers->begin(),
+            buffers->end(),
+            [](const std::shared_ptr<ThreadLogBuffer>& buffer) {
+              return buffer.use_count() == 1 && buffer->lines.isEmpty();
+            }),
+        buffers->end());
+  }
+
+  std::sort(
+      lines.begin(), lines.end(), [](const auto& a, const auto& b) {
+        return a.seq < b.seq;
+      });
+  for (auto& line : lines) {
+    log_.publish(line.level, line.line);
+  }
+
+  if (dropped > 0) {
+    log_.droppedLines_.fetch_add(dropped, std::memory_order_relaxed);
+    char timebuf[64];
+    log_.publish(
+        ERR,
+        w_string::build(
+            Log::currentTimeString(timebuf, sizeof(timebuf)),
+            ": [",
+            Log::getThreadName(),
+            "] logging is falling behind; dropped ",
+            dropped,
+            " lines\n"));
+  }
+}
+
+void AsyncLogWriter::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return wakeup_.load() || stopping_; });
+      if (stopping_) {
+        break;
+      }
+      wakeup_.store(false);
+    }
+    drain();
+  }
+  drain();
+}
+
+void AsyncLogWriter::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
 Log::Log()
     : errorPub_(std::make_shared<Publisher>()),
       debugPub_(std::make_shared<Publisher>()) {
@@ -103,6 +280,52 @@ Log& getLog() {
   return log;
 }
 
+void Log::dispatch(LogLevel level, w_string&& line) {
+  auto writer = asyncWriter_.load(std::memory_order_acquire);
+  if (writer && level > FATAL) {
+    writer->append(level, std::move(line));
+    return;
+  }
+  if (writer) {
+    // Make sure that what led up to a fatal error makes it to the log first
+    writer->drain();
+  }
+  publish(level, line);
+}
+
+void Log::publish(LogLevel level, const w_string& line) {
+  auto payload = json_object(
+      {{"log", typed_string_to_json(line)},
+       {"unilateral", json_true()},
+       {"level", typed_string_to_json(logLevelToLabel(level))}});
+
+  levelToPub(level).enqueue(std::move(payload));
+}
+
+void Log::startAsyncWriter(size_t linesPerThread) {
+  auto writer = new AsyncLogWriter(*this, linesPerThread);
+  AsyncLogWriter* expected = nullptr;
+  if (!asyncWriter_.compare_exchange_strong(expected, writer)) {
+    // Already running
+    writer->stop();
+    delete writer;
+  }
+}
+
+void Log::stopAsyncWriter() {
+  auto writer = asyncWriter_.exchange(nullptr);
+  if (writer) {
+    writer->stop();
+  }
+}
+
+void Log::flushAsyncWriter() {
+  auto writer = asyncWriter_.load(std::memory_order_acquire);
+  if (writer) {
+    writer->drain();
+  }
+}
+
 char* Log::timeString(char* buf, size_t bufsize, timeval tv) {
   struct tm tm;
 #ifdef _WIN32
@@ -138,10 +361,15 @@ const char* Log::setThreadName(std::string&& name) {
     folly::setThreadName(name);
   }
 
+  (*namedThreads().wlock())[std::this_thread::get_id()] = name;
   threadName->emplace(name);
   return threadName->value().c_str();
 }
 
+std::unordered_map<std::thread::id, std::string> Log::getThreadNames() {
+  return *namedThreads().rlock();
+}
+
 const char* Log::getThreadName() {
   if (!threadName->has_value()) {
     auto name = folly::getCurrentThreadName();
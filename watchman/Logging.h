@@ -6,6 +6,10 @@
  */
 
 #pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include "folly/Synchronized.h"
 #include "watchman/PubSub.h"
 #include "watchman/watchman_preprocessor.h"
@@ -13,6 +17,8 @@
 
 namespace watchman {
 
+class AsyncLogWriter;
+
 enum LogLevel { ABORT = -2, FATAL = -1, OFF = 0, ERR = 1, DBG = 2 };
 
 const w_string& logLevelToLabel(LogLevel level);
@@ -30,6 +36,10 @@ class Log {
   static char* timeString(char* buf, size_t bufsize, timeval tv);
   static const char* getThreadName();
   static const char* setThreadName(std::string&& name);
+  // The names that threads gave themselves with setThreadName().  A thread
+  // that exits keeps its entry until another thread with the same id names
+  // itself.
+  static std::unordered_map<std::thread::id, std::string> getThreadNames();
 
   void setStdErrLoggingLevel(LogLevel level);
 
@@ -45,18 +55,14 @@ class Log {
 
     char timebuf[64];
 
-    auto payload = json_object(
-        {{"log",
-          typed_string_to_json(w_string::build(
-              currentTimeString(timebuf, sizeof(timebuf)),
-              ": [",
-              getThreadName(),
-              "] ",
-              std::forward<Args>(args)...))},
-         {"unilateral", json_true()},
-         {"level", typed_string_to_json(logLevelToLabel(level))}});
-
-    pub.enqueue(std::move(payload));
+    dispatch(
+        level,
+        w_string::build(
+            currentTimeString(timebuf, sizeof(timebuf)),
+            ": [",
+            getThreadName(),
+            "] ",
+            std::forward<Args>(args)...));
   }
 
   // Format a string and log it
@@ -72,18 +78,33 @@ class Log {
     char timebuf[64];
 
     auto message = fmt::format(format_str, std::forward<Args>(args)...);
-    auto payload = json_object(
-        {{"log",
-          typed_string_to_json(w_string::build(
-              currentTimeString(timebuf, sizeof(timebuf)),
-              ": [",
-              getThreadName(),
-              "] ",
-              std::move(message)))},
-         {"unilateral", json_true()},
-         {"level", typed_string_to_json(logLevelToLabel(level))}});
-
-    pub.enqueue(std::move(payload));
+    dispatch(
+        level,
+        w_string::build(
+            currentTimeString(timebuf, sizeof(timebuf)),
+            ": [",
+            getThreadName(),
+            "] ",
+            std::move(message)));
+  }
+
+  // Hands log lines to a writer thread, which publishes them to the
+  // subscribers and writes them to stderr, instead of doing so on the thread
+  // that logged them.  Each thread buffers up to `linesPerThread` lines;
+  // lines logged while its buffer is full are dropped and counted, so a slow
+  // subscriber can't stall the thread.  FATAL and ABORT lines are published
+  // synchronously, after the lines that were buffered before them.
+  void startAsyncWriter(size_t linesPerThread);
+
+  // Publishes the buffered lines and returns to synchronous logging
+  void stopAsyncWriter();
+
+  // Publishes the lines that have been buffered so far, on this thread
+  void flushAsyncWriter();
+
+  // The number of lines dropped because a thread's buffer was full
+  uint64_t getDroppedLines() const {
+    return droppedLines_.load(std::memory_order_relaxed);
   }
 
   Log();
@@ -110,6 +131,15 @@ class Log {
   }
 
   void doLogToStdErr();
+
+  friend class AsyncLogWriter;
+  void dispatch(LogLevel level, w_string&& line);
+  void publish(LogLevel level, const w_string& line);
+
+  // Retired writers are leaked rather than deleted, as threads that are
+  // logging concurrently with stopAsyncWriter() may still reference them.
+  std::atomic<AsyncLogWriter*> asyncWriter_{nullptr};
+  std::atomic<uint64_t> droppedLines_{0};
 };
 
 // Get the logger singleton
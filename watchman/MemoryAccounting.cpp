@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryAccounting.h"
+#include <atomic>
+
+namespace watchman {
+
+namespace {
+
+constexpr size_t kNumShards = 16;
+
+struct alignas(64) Shard {
+  std::atomic<int64_t> bytes[kNumMemoryCategories];
+  std::atomic<int64_t> allocations[kNumMemoryCategories];
+};
+
+// Zero-initialized before any code runs, so usable from static
+// constructors and destructors
+Shard shards[kNumShards];
+
+std::atomic<size_t> nextShard{0};
+
+Shard& getShard() noexcept {
+  thread_local size_t shard =
+      nextShard.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return shards[shard];
+}
+
+} // namespace
+
+void recordAllocation(MemoryCategory category, size_t bytes) noexcept {
+  auto& shard = getShard();
+  auto index = static_cast<size_t>(category);
+  shard.bytes[index].fetch_add(int64_t(bytes), std::memory_order_relaxed);
+  shard.allocations[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void recordDeallocation(MemoryCategory category, size_t bytes) noexcept {
+  auto& shard = getShard();
+  auto index = static_cast<size_t>(category);
+  shard.bytes[index].fetch_sub(int64_t(bytes), std::memory_order_relaxed);
+  shard.allocations[index].fetch_sub(1, std::memory_order_relaxed);
+}
+
+void recordReallocation(
+    MemoryCategory category,
+    size_t oldBytes,
+    size_t newBytes) noexcept {
+  auto& shard = getShard();
+  auto index = static_cast<size_t>(category);
+  shard.bytes[index].fetch_add(
+      int64_t(newBytes) - int64_t(oldBytes), std::memory_order_relaxed);
+}
+
+MemoryUsage getMemoryUsage(MemoryCategory category) noexcept {
+  auto index = static_cast<size_t>(category);
+  MemoryUsage usage;
+  for (auto& shard : shards) {
+    usage.bytes += shard.bytes[index].load(std::memory_order_relaxed);
+    usage.allocations +=
+        shard.allocations[index].load(std::memory_order_relaxed);
+  }
+  return usage;
+}
+
+const char* getMemoryCategoryName(MemoryCategory category) noexcept {
+  switch (category) {
+    case MemoryCategory::Strings:
+      return "strings";
+    case MemoryCategory::PendingChanges:
+      return "pending_changes";
+    case MemoryCategory::CacheEntries:
+      return "cache_entries";
+    case MemoryCategory::SubscriptionQueues:
+      return "subscription_queues";
+    case MemoryCategory::ClientBuffers:
+      return "client_buffers";
+  }
+  return "unknown";
+}
+
+} // namespace watchman
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace watchman {
+
+/**
+ * Process-wide accounting of the memory held by watchman's own data
+ * structures, maintained at the sites that allocate and free it.  This is
+ * cheap enough to leave enabled in production, which lets hosts be sized
+ * and leaks be spotted from `watchman debug-memory` without a profiler.
+ *
+ * The nodes of each view are accounted for by its NodeArena rather than
+ * here.
+ */
+enum class MemoryCategory : size_t {
+  // The storage of w_string values
+  Strings,
+  // PendingChanges nodes, including those pooled for reuse
+  PendingChanges,
+  // LRUCache nodes, not including what their values point to
+  CacheEntries,
+  // Items queued by a Publisher for its subscribers, not including their
+  // payloads
+  SubscriptionQueues,
+  // The buffers that client requests are decoded from and responses
+  // encoded into
+  ClientBuffers,
+};
+
+constexpr size_t kNumMemoryCategories = 5;
+
+struct MemoryUsage {
+  int64_t bytes{0};
+  int64_t allocations{0};
+};
+
+/**
+ * The counters are spread across per-thread shards so that accounting for
+ * frequent allocations, such as those of strings, doesn't have every thread
+ * contending on the same cache line.
+ */
+void recordAllocation(MemoryCategory category, size_t bytes) noexcept;
+void recordDeallocation(MemoryCategory category, size_t bytes) noexcept;
+
+// Adjusts the size of an allocation that was grown or shrunk in place
+void recordReallocation(
+    MemoryCategory category,
+    size_t oldBytes,
+    size_t newBytes) noexcept;
+
+// Sums the shards; the result is approximate while other threads allocate
+MemoryUsage getMemoryUsage(MemoryCategory category) noexcept;
+
+const char* getMemoryCategoryName(MemoryCategory category) noexcept;
+
+} // namespace watchman
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryBudget.h"
+#include <algorithm>
+#include <thread>
+#include <unordered_set>
+#include "watchman/Logging.h"
+#include "watchman/MemoryAccounting.h"
+#include "watchman/Shutdown.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+// How often the budget thread measures the total
+constexpr auto kCheckInterval = std::chrono::seconds(5);
+
+size_t totalAccounted() {
+  int64_t total = 0;
+  for (size_t i = 0; i < kNumMemoryCategories; ++i) {
+    total += getMemoryUsage(static_cast<MemoryCategory>(i)).bytes;
+  }
+  return size_t(std::max(int64_t(0), total));
+}
+
+void memoryBudgetThread() noexcept {
+  w_set_thread_name("memorybudget");
+  auto lastCheck = std::chrono::steady_clock::now();
+  // Sleep a second at a time so that shutdown isn't held up
+  while (!w_is_stopping()) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastCheck < kCheckInterval) {
+      /* sleep override */
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    lastCheck = now;
+    try {
+      getMemoryBudget().enforce();
+    } catch (const std::exception& exc) {
+      logf(ERR, "enforcing the memory budget failed: {}\n", exc.what());
+    }
+  }
+}
+
+} // namespace
+
+MemoryBudget::MemoryBudget(size_t budgetBytes, ListConsumers consumers)
+    : budgetBytes_{budgetBytes}, consumers_{std::move(consumers)} {}
+
+void MemoryBudget::setConsumers(ListConsumers consumers) {
+  *consumers_.wlock() = std::move(consumers);
+}
+
+size_t MemoryBudget::accountedBytes(
+    const std::function<size_t()>& used) const {
+  return used ? used() : totalAccounted();
+}
+
+void MemoryBudget::enforce(std::function<size_t()> used) {
+  if (budgetBytes_ == 0) {
+    return;
+  }
+  auto list = *consumers_.rlock();
+  auto target = size_t(double(budgetBytes_) * kLowWatermark);
+  auto wasUnderPressure = underPressure();
+
+  std::unordered_set<w_string> reclaimed;
+  uint64_t numReclaims = 0;
+  size_t accounted = 0;
+  size_t total = 0;
+  bool overBudget = false;
+  for (bool first = true;; first = false) {
+    auto consumers = list ? list() : std::vector<Consumer>{};
+    accounted = accountedBytes(used);
+    total = accounted;
+    for (auto& consumer : consumers) {
+      total += consumer.bytes;
+    }
+    if (first) {
+      overBudget = total > budgetBytes_;
+      if (!overBudget && !wasUnderPressure) {
+        break;
+      }
+    }
+    if (total <= target) {
+      break;
+    }
+
+    // Give back the memory of the roots that are least likely to be
+    // needed soon first
+    auto victim = consumers.end();
+    for (auto it = consumers.begin(); it != consumers.end(); ++it) {
+      if (!it->reclaim || it->bytes == 0 || reclaimed.count(it->name)) {
+        continue;
+      }
+      if (victim == consumers.end() || it->lastUsed < victim->lastUsed) {
+        victim = it;
+      }
+    }
+    if (victim == consumers.end()) {
+      break;
+    }
+    reclaimed.insert(victim->name);
+    logf(
+        DBG,
+        "memory budget: {} bytes in use, compacting {}\n",
+        total,
+        victim->name);
+    victim->reclaim();
+    ++numReclaims;
+  }
+
+  auto pressure = (overBudget || wasUnderPressure) && total > target;
+  if (pressure != wasUnderPressure) {
+    logf(
+        ERR,
+        "memory budget: {} bytes in use of {}; {}\n",
+        total,
+        budgetBytes_,
+        pressure ? "applying backpressure to clients" : "pressure relieved");
+  }
+  underPressure_.store(pressure, std::memory_order_relaxed);
+
+  auto stats = stats_.wlock();
+  stats->lastTotalBytes = total;
+  stats->lastAccountedBytes = accounted;
+  ++stats->checks;
+  if (overBudget) {
+    ++stats->overBudget;
+  }
+  if (numReclaims > 0) {
+    stats->reclaims += numReclaims;
+    stats->lastReclaim = std::chrono::steady_clock::now();
+  }
+}
+
+json_ref MemoryBudget::report() const {
+  auto now = std::chrono::steady_clock::now();
+  auto roots = json_array();
+  auto list = *consumers_.rlock();
+  if (list) {
+    for (auto& consumer : list()) {
+      json_array_append_new(
+          roots,
+          json_object({
+              {"root", w_string_to_json(consumer.name)},
+              {"bytes", json_integer(consumer.bytes)},
+              {"idle_seconds",
+               json_integer(std::chrono::duration_cast<std::chrono::seconds>(
+                                now - consumer.lastUsed)
+                                .count())},
+          }));
+    }
+  }
+
+  auto stats = stats_.copy();
+  return json_object({
+      {"budget_bytes", json_integer(budgetBytes_)},
+      {"accounted_bytes", json_integer(totalAccounted())},
+      {"last_total_bytes", json_integer(stats.lastTotalBytes)},
+      {"under_pressure", json_boolean(underPressure())},
+      {"checks", json_integer(stats.checks)},
+      {"over_budget", json_integer(stats.overBudget)},
+      {"reclaims", json_integer(stats.reclaims)},
+      {"seconds_since_reclaim",
+       stats.reclaims == 0
+           ? json_null()
+           : json_integer(std::chrono::duration_cast<std::chrono::seconds>(
+                              now - stats.lastReclaim)
+                              .count())},
+      {"roots", std::move(roots)},
+  });
+}
+
+MemoryBudget& getMemoryBudget() {
+  static MemoryBudget budget{size_t(std::max(
+      json_int_t(0), Configuration().getInt("memory_budget_bytes", 0)))};
+  return budget;
+}
+
+void startMemoryBudgetThread() {
+  if (getMemoryBudget().budgetBytes() == 0) {
+    return;
+  }
+  std::thread thr(memoryBudgetThread);
+  thr.detach();
+}
+
+} // namespace watchman
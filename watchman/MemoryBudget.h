@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Keeps the memory that the daemon holds within memory_budget_bytes.
+ *
+ * The total is what MemoryAccounting tracks, which covers strings, caches
+ * and client queues, plus the nodes of each root's view.  When it exceeds
+ * the budget, the roots are compacted, least recently used first, until it
+ * is back below kLowWatermark of the budget.  Until then the daemon is
+ * under pressure, and clients that have fallen behind have their
+ * subscription results merged rather than queued.
+ *
+ * Thread safe.
+ */
+class MemoryBudget {
+ public:
+  // Pressure ends once the total falls below this fraction of the budget
+  static constexpr double kLowWatermark = 0.9;
+
+  // A root whose view can give memory back
+  struct Consumer {
+    w_string name;
+    size_t bytes{0};
+    std::chrono::steady_clock::time_point lastUsed;
+    std::function<void()> reclaim;
+  };
+  using ListConsumers = std::function<std::vector<Consumer>()>;
+
+  // A budget of 0 is unlimited
+  explicit MemoryBudget(size_t budgetBytes, ListConsumers consumers = {});
+
+  // Sets what the budget draws from, before enforce() is first called
+  void setConsumers(ListConsumers consumers);
+
+  /**
+   * Measures the total, and reclaims memory if it is over budget.  `used`
+   * returns the bytes tracked by MemoryAccounting; the default sums its
+   * categories.
+   */
+  void enforce(std::function<size_t()> used = {});
+
+  bool underPressure() const {
+    return underPressure_.load(std::memory_order_relaxed);
+  }
+
+  size_t budgetBytes() const {
+    return budgetBytes_;
+  }
+
+  // For `debug-memory-budget`
+  json_ref report() const;
+
+ private:
+  size_t accountedBytes(const std::function<size_t()>& used) const;
+
+  const size_t budgetBytes_;
+  folly::Synchronized<ListConsumers> consumers_;
+  std::atomic<bool> underPressure_{false};
+
+  struct Stats {
+    size_t lastTotalBytes{0};
+    size_t lastAccountedBytes{0};
+    uint64_t checks{0};
+    uint64_t overBudget{0};
+    uint64_t reclaims{0};
+    std::chrono::steady_clock::time_point lastReclaim;
+  };
+  folly::Synchronized<Stats> stats_;
+};
+
+// The daemon's budget, as configured by memory_budget_bytes
+MemoryBudget& getMemoryBudget();
+
+// Enforces the daemon's budget periodically, if there is one
+void startMemoryBudgetThread();
+
+} // namespace watchman
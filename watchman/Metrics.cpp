@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <cmath>
+#include <cstdio>
+
+namespace watchman {
+
+namespace {
+
+std::string formatValue(double value) {
+  if (std::isnan(value)) {
+    return "NaN";
+  }
+  if (std::isinf(value)) {
+    return value > 0 ? "+Inf" : "-Inf";
+  }
+  if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0) {
+    return std::to_string(int64_t(value));
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", value);
+  return buf;
+}
+
+const char* typeName(MetricType type) {
+  switch (type) {
+    case MetricType::Counter:
+      return "counter";
+    case MetricType::Gauge:
+      return "gauge";
+  }
+  return "unknown";
+}
+
+} // namespace
+
+std::string MetricsWriter::escapeLabelValue(std::string_view value) {
+  std::string result;
+  result.reserve(value.size());
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        result += "\\\\";
+        break;
+      case '"':
+        result += "\\\"";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      default:
+        result += c;
+    }
+  }
+  return result;
+}
+
+void MetricsWriter::add(
+    std::string_view name,
+    MetricType type,
+    std::string_view help,
+    const MetricLabels& labels,
+    double value) {
+  auto [it, inserted] =
+      familyIndex_.emplace(std::string{name}, families_.size());
+  if (inserted) {
+    families_.push_back(
+        Family{std::string{name}, type, std::string{help}, {}});
+  }
+  auto& family = families_[it->second];
+
+  std::string sample{name};
+  if (family.type == MetricType::Counter) {
+    sample += "_total";
+  }
+  if (!labels.empty()) {
+    sample += '{';
+    for (size_t i = 0; i < labels.size(); ++i) {
+      if (i > 0) {
+        sample += ',';
+      }
+      sample += labels[i].first;
+      sample += "=\"";
+      sample += escapeLabelValue(labels[i].second);
+      sample += '"';
+    }
+    sample += '}';
+  }
+  sample += ' ';
+  sample += formatValue(value);
+  family.samples.push_back(std::move(sample));
+}
+
+std::string MetricsWriter::render() const {
+  std::string result;
+  for (auto& family : families_) {
+    result += "# TYPE " + family.name + " " + typeName(family.type) + "\n";
+    if (!family.help.empty()) {
+      result += "# HELP " + family.name + " " + family.help + "\n";
+    }
+    for (auto& sample : family.samples) {
+      result += sample;
+      result += '\n';
+    }
+  }
+  result += "# EOF\n";
+  return result;
+}
+
+void MetricsRegistry::add(std::string name, Collector collector) {
+  collectors_.wlock()->emplace_back(std::move(name), std::move(collector));
+}
+
+std::string MetricsRegistry::collect() const {
+  MetricsWriter writer;
+  auto collectors = collectors_.rlock();
+  for (auto& [name, collector] : *collectors) {
+    collector(writer);
+  }
+  return writer.render();
+}
+
+MetricsRegistry& getMetricsRegistry() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+} // namespace watchman
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace watchman {
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+enum class MetricType {
+  Counter,
+  Gauge,
+};
+
+/**
+ * Accumulates samples and renders them in the OpenMetrics text exposition
+ * format.  The samples of a metric family may be added in any order, and
+ * from any number of collectors; they are grouped by family when rendered.
+ */
+class MetricsWriter {
+ public:
+  /**
+   * Adds a sample of the family `name`, which is declared by the first
+   * sample that is added to it.  The names of counters must not include
+   * their `_total` suffix; it is appended to their samples.
+   */
+  void add(
+      std::string_view name,
+      MetricType type,
+      std::string_view help,
+      const MetricLabels& labels,
+      double value);
+
+  // Returns the exposition, including the terminating `# EOF`
+  std::string render() const;
+
+  static std::string escapeLabelValue(std::string_view value);
+
+ private:
+  struct Family {
+    std::string name;
+    MetricType type;
+    std::string help;
+    std::vector<std::string> samples;
+  };
+
+  std::vector<Family> families_;
+  std::unordered_map<std::string, size_t> familyIndex_;
+};
+
+/**
+ * Holds the collectors that report the metrics of the subsystems.  They
+ * are called each time the metrics are exported, so they should only read
+ * counters that are already being maintained.
+ */
+class MetricsRegistry {
+ public:
+  using Collector = std::function<void(MetricsWriter&)>;
+
+  void add(std::string name, Collector collector);
+
+  // Runs the collectors and renders their samples
+  std::string collect() const;
+
+ private:
+  folly::Synchronized<std::vector<std::pair<std::string, Collector>>>
+      collectors_;
+};
+
+MetricsRegistry& getMetricsRegistry();
+
+// Registers a collector with getMetricsRegistry() during static
+// initialization, in the manner of W_CMD_REG
+struct MetricsCollectorRegistration {
+  MetricsCollectorRegistration(
+      std::string name,
+      MetricsRegistry::Collector collector) {
+    getMetricsRegistry().add(std::move(name), std::move(collector));
+  }
+};
+
+} // namespace watchman
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MetricsServer.h"
+#include <folly/Conv.h>
+#include <folly/portability/Sockets.h>
+#include <chrono>
+#include <optional>
+#include "watchman/Logging.h"
+#include "watchman/Metrics.h"
+#include "watchman/Shutdown.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+// Requests larger than this are refused; scrapers send a few hundred bytes
+constexpr size_t kMaxRequestSize = 8192;
+constexpr int kRequestTimeoutMs = 2000;
+
+std::string httpResponse(
+    const char* status,
+    const char* contentType,
+    const std::string& body) {
+  return folly::to<std::string>(
+      "HTTP/1.1 ",
+      status,
+      "\r\nContent-Type: ",
+      contentType,
+      "\r\nContent-Length: ",
+      body.size(),
+      "\r\nConnection: close\r\n\r\n",
+      body);
+}
+
+// Reads the request up to the end of its headers
+std::optional<std::string> readRequest(watchman_stream& client) {
+  std::string request;
+  auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(kRequestTimeoutMs);
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    if (request.size() > kMaxRequestSize) {
+      return std::nullopt;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return std::nullopt;
+    }
+    watchman_event_poll pfd{client.getEvents(), false};
+    if (w_poll_events(&pfd, 1, int(remaining.count())) == 0) {
+      return std::nullopt;
+    }
+    char buf[1024];
+    auto len = client.read(buf, sizeof(buf));
+    if (len <= 0) {
+      return std::nullopt;
+    }
+    request.append(buf, len);
+  }
+  return request;
+}
+
+void writeAll(watchman_stream& client, const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    auto len = client.write(data.data() + done, int(data.size() - done));
+    if (len <= 0) {
+      return;
+    }
+    done += len;
+  }
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(FileDescriptor&& listener)
+    : stopEvent_{w_event_make_sockets()} {
+  listener.setCloExec();
+  listener.setNonBlock();
+  w_push_listener_thread_event(stopEvent_);
+  thread_ = std::thread([this, listener = std::move(listener)]() mutable {
+    w_set_thread_name("metrics-server");
+    run(std::move(listener));
+  });
+}
+
+MetricsServer::~MetricsServer() {
+  stopping_ = true;
+  stopEvent_->notify();
+  thread_.join();
+}
+
+std::string MetricsServer::respond(
+    std::string_view request,
+    const std::function<std::string()>& collect) {
+  auto lineEnd = request.find("\r\n");
+  auto line = request.substr(0, lineEnd);
+  auto methodEnd = line.find(' ');
+  auto targetEnd = line.find(' ', methodEnd + 1);
+  if (methodEnd == std::string_view::npos ||
+      targetEnd == std::string_view::npos) {
+    return httpResponse("400 Bad Request", "text/plain", "bad request\n");
+  }
+  auto method = line.substr(0, methodEnd);
+  auto target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+  auto path = target.substr(0, target.find('?'));
+
+  if (path != "/metrics") {
+    return httpResponse("404 Not Found", "text/plain", "not found\n");
+  }
+  if (method != "GET") {
+    return httpResponse(
+        "405 Method Not Allowed", "text/plain", "method not allowed\n");
+  }
+  return httpResponse(
+      "200 OK",
+      "application/openmetrics-text; version=1.0.0; charset=utf-8",
+      collect());
+}
+
+void MetricsServer::run(FileDescriptor&& listenerDescriptor) {
+  auto listener = w_stm_fdopen(std::move(listenerDescriptor));
+  while (!stopping_ && !w_is_stopping()) {
+    watchman_event_poll pfd[2];
+    pfd[0].evt = listener->getEvents();
+    pfd[1].evt = stopEvent_.get();
+    if (w_poll_events(pfd, 2, 60000) == 0 || pfd[1].ready) {
+      continue;
+    }
+
+    FileDescriptor clientFd(
+        ::accept(listener->getFileDescriptor().system_handle(), nullptr, 0),
+        FileDescriptor::FDType::Socket);
+    if (!clientFd) {
+      continue;
+    }
+    clientFd.setCloExec();
+    auto client = w_stm_fdopen(std::move(clientFd));
+    client->setNonBlock(true);
+
+    try {
+      auto request = readRequest(*client);
+      if (!request) {
+        continue;
+      }
+      auto response = respond(
+          *request, [] { return getMetricsRegistry().collect(); });
+      client->setNonBlock(false);
+      writeAll(*client, response);
+    } catch (const std::exception& ex) {
+      log(ERR, "failed to serve metrics: ", ex.what(), "\n");
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "watchman/fs/FileDescriptor.h"
+
+class watchman_event;
+
+namespace watchman {
+
+/**
+ * Serves the OpenMetrics exposition of getMetricsRegistry() over HTTP at
+ * /metrics, so that the service can be scraped without a client library.
+ *
+ * Requests are answered one at a time on the server's own thread; scrapes
+ * are infrequent and the exposition is built from counters that are
+ * already maintained, so there is no need for more.
+ */
+class MetricsServer {
+ public:
+  // Serves on `listener`, which must be a listening TCP socket
+  explicit MetricsServer(FileDescriptor&& listener);
+  ~MetricsServer();
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  /**
+   * Returns the HTTP response to `request`, which holds at least its
+   * request line.  `collect` produces the exposition.
+   */
+  static std::string respond(
+      std::string_view request,
+      const std::function<std::string()>& collect);
+
+ private:
+  void run(FileDescriptor&& listener);
+
+  std::shared_ptr<watchman_event> stopEvent_;
+  std::atomic<bool> stopping_{false};
+  std::thread thread_;
+};
+
+} // namespace watchman
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NameTable.h"
+#include <ctype.h>
+
+namespace watchman {
+
+namespace {
+size_t storageSize(size_t len) {
+  return sizeof(w_string_t) + len + 1;
+}
+} // namespace
+
+w_string NameTable::intern(w_string_piece name) {
+  auto it = names_.find(name);
+  if (it != names_.end()) {
+    return it->second;
+  }
+
+  w_string str{name.data(), name.size()};
+  names_.emplace(w_string_piece{str}, str);
+  numNames_.fetch_add(1, std::memory_order_relaxed);
+  bytes_.fetch_add(storageSize(str.size()), std::memory_order_relaxed);
+  return str;
+}
+
+w_string NameTable::internLowerCase(const w_string& name) {
+  for (auto c : name.view()) {
+    if (isupper((uint8_t)c)) {
+      return intern(name.piece().asLowerCase());
+    }
+  }
+  return name;
+}
+
+const w_string* NameTable::find(w_string_piece name) const {
+  auto it = names_.find(name);
+  if (it == names_.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+size_t NameTable::prune() {
+  size_t pruned = 0;
+  size_t prunedBytes = 0;
+  for (auto it = names_.begin(); it != names_.end();) {
+    w_string_t* str = it->second;
+    if (str->refcnt.load(std::memory_order_relaxed) == 1) {
+      ++pruned;
+      prunedBytes += storageSize(str->len);
+      it = names_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  numNames_.fetch_sub(pruned, std::memory_order_relaxed);
+  bytes_.fetch_sub(prunedBytes, std::memory_order_relaxed);
+  return pruned;
+}
+
+NameTable::Stats NameTable::getStats() const {
+  return Stats{
+      numNames_.load(std::memory_order_relaxed),
+      bytes_.load(std::memory_order_relaxed),
+  };
+}
+
+} // namespace watchman
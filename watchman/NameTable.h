@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * An intern table for the names of the file and dir nodes of a
+ * ViewDatabase.
+ *
+ * Names like `src`, `test` and `node_modules` repeat throughout a large
+ * tree.  Interning them means that every node with a given name shares a
+ * single w_string, and that a lookup with an interned key compares equal
+ * to the stored name by pointer, without touching the bytes.
+ *
+ * Entries are kept alive by the table's own reference; prune() drops those
+ * that no node refers to any more.
+ *
+ * Thread safety: intern() and prune() must be externally serialized with
+ * all other calls; in practice they are only called while holding the
+ * view's write lock.  find() may be called concurrently with other calls to
+ * find().  getStats() may be called from any thread.
+ */
+class NameTable {
+ public:
+  struct Stats {
+    // Number of distinct names in the table
+    size_t names;
+    // Bytes of string storage held by the table
+    size_t bytes;
+  };
+
+  NameTable() = default;
+  NameTable(const NameTable&) = delete;
+  NameTable& operator=(const NameTable&) = delete;
+
+  /**
+   * Returns the interned string equal to name, adding it if this is the
+   * first time that the table has seen it.
+   */
+  w_string intern(w_string_piece name);
+
+  /**
+   * Returns the interned lowercase form of name, which must itself be
+   * interned.  Most names are already lowercase, in which case this returns
+   * name itself rather than adding an entry.
+   */
+  w_string internLowerCase(const w_string& name);
+
+  /**
+   * Returns the interned string equal to name, or nullptr if there is no
+   * such entry, in which case no node can have that name.
+   */
+  const w_string* find(w_string_piece name) const;
+
+  /**
+   * Forgets the names that are no longer referenced by anything other than
+   * the table.  Returns the number of names forgotten.
+   */
+  size_t prune();
+
+  Stats getStats() const;
+
+ private:
+  // Keyed by pieces of the mapped strings, which never move.
+  std::unordered_map<w_string_piece, w_string> names_;
+
+  std::atomic<size_t> numNames_{0};
+  std::atomic<size_t> bytes_{0};
+};
+
+} // namespace watchman
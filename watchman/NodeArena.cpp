@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <folly/Memory.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace watchman {
+
+namespace {
+
+// Lives at the start of each slab and at the start of each large
+// allocation, so that deallocate() can find its way back to the arena.
+struct alignas(NodeArena::kSizeClassGranularity) BlockHeader {
+  NodeArena* arena;
+  size_t sizeClass;
+};
+
+static_assert(
+    sizeof(BlockHeader) == NodeArena::kSizeClassGranularity,
+    "header must preserve the alignment of the objects that follow it");
+
+BlockHeader* slabHeaderOf(void* ptr) {
+  return reinterpret_cast<BlockHeader*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~(NodeArena::kSlabSize - 1));
+}
+
+} // namespace
+
+NodeArena::~NodeArena() {
+  for (auto slab : slabs_) {
+    folly::aligned_free(slab);
+  }
+}
+
+void NodeArena::newSlab(size_t sizeClass) {
+  auto slab = folly::aligned_malloc(kSlabSize, kSlabSize);
+  if (!slab) {
+    throw std::bad_alloc();
+  }
+  slabs_.push_back(slab);
+
+  auto header = new (slab) BlockHeader{this, sizeClass};
+  auto& cls = classes_[sizeClass];
+
+  // Any tail of the previous slab that is too small for another object is
+  // simply abandoned; it is at most one object's worth of space.
+  cls.bumpPtr = reinterpret_cast<char*>(header + 1);
+  cls.bumpEnd = static_cast<char*>(slab) + kSlabSize;
+
+  reservedBytes_.fetch_add(kSlabSize, std::memory_order_relaxed);
+}
+
+void* NodeArena::allocate(size_t size) {
+  if (size > kMaxSlabAllocation) {
+    auto block = static_cast<BlockHeader*>(
+        calloc(1, sizeof(BlockHeader) + size));
+    if (!block) {
+      throw std::bad_alloc();
+    }
+    block->arena = this;
+    block->sizeClass = kNumSizeClasses;
+    liveBytes_.fetch_add(size, std::memory_order_relaxed);
+    liveAllocations_.fetch_add(1, std::memory_order_relaxed);
+    largeAllocations_.fetch_add(1, std::memory_order_relaxed);
+    return block + 1;
+  }
+
+  auto sizeClass = sizeClassFor(size);
+  auto objSize = sizeOfClass(sizeClass);
+  auto& cls = classes_[sizeClass];
+
+  void* ptr;
+  if (cls.freeList) {
+    ptr = cls.freeList;
+    cls.freeList = cls.freeList->next;
+    freeBytes_.fetch_sub(objSize, std::memory_order_relaxed);
+  } else {
+    if (cls.bumpPtr + objSize > cls.bumpEnd) {
+      newSlab(sizeClass);
+    }
+    ptr = cls.bumpPtr;
+    cls.bumpPtr += objSize;
+  }
+
+  memset(ptr, 0, objSize);
+  liveBytes_.fetch_add(objSize, std::memory_order_relaxed);
+  liveAllocations_.fetch_add(1, std::memory_order_relaxed);
+  return ptr;
+}
+
+void NodeArena::release(void* ptr, size_t sizeClass) {
+  auto objSize = sizeOfClass(sizeClass);
+  auto node = static_cast<FreeNode*>(ptr);
+  auto& cls = classes_[sizeClass];
+  node->next = cls.freeList;
+  cls.freeList = node;
+
+  liveBytes_.fetch_sub(objSize, std::memory_order_relaxed);
+  liveAllocations_.fetch_sub(1, std::memory_order_relaxed);
+  freeBytes_.fetch_add(objSize, std::memory_order_relaxed);
+}
+
+void NodeArena::deallocate(void* ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+
+  if (size > kMaxSlabAllocation) {
+    auto block = static_cast<BlockHeader*>(ptr) - 1;
+    auto arena = block->arena;
+    arena->liveBytes_.fetch_sub(size, std::memory_order_relaxed);
+    arena->liveAllocations_.fetch_sub(1, std::memory_order_relaxed);
+    arena->largeAllocations_.fetch_sub(1, std::memory_order_relaxed);
+    free(block);
+    return;
+  }
+
+  auto header = slabHeaderOf(ptr);
+  header->arena->release(ptr, header->sizeClass);
+}
+
+size_t NodeArena::trim() {
+  std::unordered_map<void*, size_t> freeNodes;
+  for (auto& cls : classes_) {
+    for (auto node = cls.freeList; node; node = node->next) {
+      ++freeNodes[slabHeaderOf(node)];
+    }
+  }
+
+  // A slab can go once every object that was carved out of it is free
+  std::unordered_set<void*> unused;
+  for (auto slab : slabs_) {
+    auto header = static_cast<BlockHeader*>(slab);
+    auto& cls = classes_[header->sizeClass];
+    auto begin = reinterpret_cast<char*>(header + 1);
+    auto end = static_cast<char*>(slab) + kSlabSize;
+    if (cls.bumpPtr > static_cast<char*>(slab) && cls.bumpPtr <= end) {
+      // The slab that allocations are being carved from
+      end = cls.bumpPtr;
+    }
+    auto carved = size_t(end - begin) / sizeOfClass(header->sizeClass);
+    auto it = freeNodes.find(slab);
+    if (carved > 0 && it != freeNodes.end() && it->second == carved) {
+      unused.insert(slab);
+    }
+  }
+  if (unused.empty()) {
+    return 0;
+  }
+
+  for (size_t sizeClass = 0; sizeClass < kNumSizeClasses; ++sizeClass) {
+    auto& cls = classes_[sizeClass];
+    FreeNode** link = &cls.freeList;
+    while (auto node = *link) {
+      if (unused.count(slabHeaderOf(node))) {
+        *link = node->next;
+        freeBytes_.fetch_sub(sizeOfClass(sizeClass), std::memory_order_relaxed);
+      } else {
+        link = &node->next;
+      }
+    }
+    if (cls.bumpPtr && unused.count(slabHeaderOf(cls.bumpPtr - 1))) {
+      cls.bumpPtr = nullptr;
+      cls.bumpEnd = nullptr;
+    }
+  }
+
+  slabs_.erase(
+      std::remove_if(
+          slabs_.begin(),
+          slabs_.end(),
+          [&](void* slab) { return unused.count(slab) != 0; }),
+      slabs_.end());
+  for (auto slab : unused) {
+    folly::aligned_free(slab);
+  }
+  auto released = unused.size() * kSlabSize;
+  reservedBytes_.fetch_sub(released, std::memory_order_relaxed);
+  return released;
+}
+
+NodeArena::Stats NodeArena::getStats() const {
+  auto reserved = reservedBytes_.load(std::memory_order_relaxed);
+  return Stats{
+      reserved / kSlabSize,
+      reserved,
+      liveBytes_.load(std::memory_order_relaxed),
+      liveAllocations_.load(std::memory_order_relaxed),
+      freeBytes_.load(std::memory_order_relaxed),
+      largeAllocations_.load(std::memory_order_relaxed),
+  };
+}
+
+} // namespace watchman
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * A slab allocator for the watchman_file and watchman_dir nodes that make up
+ * a ViewDatabase.
+ *
+ * Allocations are rounded up to a multiple of kSizeClassGranularity and
+ * carved out of kSlabSize slabs dedicated to that size class.  Freed nodes go
+ * onto a per-class freelist and are handed out again by subsequent
+ * allocations, so the churn from age-outs and recrawls reuses memory rather
+ * than fragmenting the process heap.  Requests larger than
+ * kMaxSlabAllocation fall through to calloc.
+ *
+ * Slabs are aligned to their size, which lets deallocate() find the owning
+ * arena from the slab header without the node having to store a pointer
+ * back to it.
+ *
+ * Thread safety: allocate() and deallocate() must be externally serialized;
+ * in practice they are only called while holding the view's write lock.
+ * getStats() may be called from any thread.
+ */
+class NodeArena {
+ public:
+  static constexpr size_t kSlabSize = 64 * 1024;
+  static constexpr size_t kSizeClassGranularity = 16;
+  static constexpr size_t kMaxSlabAllocation = 1024;
+
+  struct Stats {
+    // Number of slabs obtained from the system
+    size_t slabs;
+    // Total bytes reserved in slabs
+    size_t reservedBytes;
+    // Bytes handed out to live nodes, including large allocations
+    size_t liveBytes;
+    // Number of live nodes, including large allocations
+    size_t liveAllocations;
+    // Bytes sitting in freelists, available for reuse
+    size_t freeBytes;
+    // Number of live allocations that were too big for a slab
+    size_t largeAllocations;
+  };
+
+  NodeArena() = default;
+  ~NodeArena();
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  /**
+   * Returns zero-filled storage for an object of the given size.
+   * Throws std::bad_alloc if memory could not be obtained.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Releases storage previously returned by allocate() on any arena.
+   * size must be the same value that was passed to allocate().
+   */
+  static void deallocate(void* ptr, size_t size);
+
+  Stats getStats() const;
+
+  /**
+   * Returns the slabs whose nodes have all been freed to the system, and
+   * returns how many bytes that released.  Walks every freelist, so it is
+   * meant for when the view has gone quiet.  Must be serialized with
+   * allocate() and deallocate().
+   */
+  size_t trim();
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  struct SizeClass {
+    FreeNode* freeList{nullptr};
+    char* bumpPtr{nullptr};
+    char* bumpEnd{nullptr};
+  };
+
+  static constexpr size_t kNumSizeClasses =
+      kMaxSlabAllocation / kSizeClassGranularity;
+
+  static size_t sizeClassFor(size_t size) {
+    return (size + kSizeClassGranularity - 1) / kSizeClassGranularity - 1;
+  }
+
+  static size_t sizeOfClass(size_t sizeClass) {
+    return (sizeClass + 1) * kSizeClassGranularity;
+  }
+
+  void newSlab(size_t sizeClass);
+  void release(void* ptr, size_t sizeClass);
+
+  std::array<SizeClass, kNumSizeClasses> classes_;
+  std::vector<void*> slabs_;
+
+  std::atomic<size_t> reservedBytes_{0};
+  std::atomic<size_t> liveBytes_{0};
+  std::atomic<size_t> liveAllocations_{0};
+  std::atomic<size_t> freeBytes_{0};
+  std::atomic<size_t> largeAllocations_{0};
+};
+
+} // namespace watchman
@@ -8,15 +8,35 @@
 #include "watchman/PDU.h"
 #include <folly/Range.h>
 #include <folly/String.h>
+#include <algorithm>
+#include <climits>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryAccounting.h"
 #include "watchman/bser.h"
 #include "watchman/watchman_stream.h"
+#include "watchman/watchman_system.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_MEMFD_SEALING
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 using namespace watchman;
 
 W_CAP_REG("bser-v2")
+W_CAP_REG("bser-v2-prefix-strings")
+#ifdef HAVE_ZLIB
+W_CAP_REG("bser-v2-compression")
+#endif
+#ifdef HAVE_MEMFD_SEALING
+W_CAP_REG("bser-v2-shared-memory")
+#endif
+
 watchman_json_buffer::watchman_json_buffer()
     : buf((char*)malloc(WATCHMAN_IO_BUF_SIZE)),
       allocd(WATCHMAN_IO_BUF_SIZE),
@@ -27,6 +47,7 @@ watchman_json_buffer::watchman_json_buffer()
   if (!buf) {
     throw std::bad_alloc();
   }
+  recordAllocation(MemoryCategory::ClientBuffers, allocd);
 }
 
 void watchman_json_buffer::clear() {
@@ -36,6 +57,7 @@ void watchman_json_buffer::clear() {
 
 watchman_json_buffer::~watchman_json_buffer() {
   free(buf);
+  recordDeallocation(MemoryCategory::ClientBuffers, allocd);
 }
 
 // Shunt down, return available size
@@ -67,6 +89,7 @@ bool watchman_json_buffer::fillBuffer(w_stm_t stm) {
     }
 
     buf = newBuf;
+    recordReallocation(MemoryCategory::ClientBuffers, allocd, allocd * 2);
     allocd *= 2;
 
     avail = allocd - wpos;
@@ -234,6 +257,7 @@ json_ref watchman_json_buffer::readBserPdu(
       }
 
       buf = newBuf;
+      recordReallocation(MemoryCategory::ClientBuffers, allocd, ideal);
       allocd = ideal;
     }
   }
@@ -586,7 +610,8 @@ bool watchman_json_buffer::bserEncodeToStream(
     uint32_t bser_version,
     uint32_t bser_capabilities,
     const json_ref& json,
-    w_stm_t stm) {
+    w_stm_t stm,
+    bool flush) {
   struct jbuffer_write_data data = {stm, this};
   int res;
 
@@ -597,13 +622,14 @@ bool watchman_json_buffer::bserEncodeToStream(
     return false;
   }
 
-  return data.flush();
+  return !flush || data.flush();
 }
 
 bool watchman_json_buffer::jsonEncodeToStream(
     const json_ref& json,
     w_stm_t stm,
-    int flags) {
+    int flags,
+    bool flush) {
   struct jbuffer_write_data data = {stm, this};
   int res;
 
@@ -617,28 +643,249 @@ bool watchman_json_buffer::jsonEncodeToStream(
     return false;
   }
 
-  return data.flush();
+  return !flush || data.flush();
+}
+
+#ifdef HAVE_ZLIB
+namespace {
+
+// Deflates the BSER encoding of a value as it is produced, so that only the
+// compressed form is held in memory.
+struct deflate_write_data {
+  z_stream zs;
+  bool initialized{false};
+  std::string out;
+
+  deflate_write_data() {
+    memset(&zs, 0, sizeof(zs));
+    initialized = deflateInit(&zs, Z_BEST_SPEED) == Z_OK;
+  }
+
+  ~deflate_write_data() {
+    if (initialized) {
+      deflateEnd(&zs);
+    }
+  }
+
+  static int write(const char* buffer, size_t size, void* ptr) {
+    auto data = (deflate_write_data*)ptr;
+    return data->deflateInput(buffer, size, Z_NO_FLUSH);
+  }
+
+  bool finish() {
+    if (deflateInput(nullptr, 0, Z_FINISH) != 0) {
+      return false;
+    }
+    out.resize(zs.total_out);
+    return true;
+  }
+
+  int deflateInput(const char* buffer, size_t size, int flush) {
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(buffer));
+    zs.avail_in = uInt(size);
+    while (true) {
+      if (out.size() == zs.total_out) {
+        out.resize(std::max<size_t>(out.size() * 2, WATCHMAN_IO_BUF_SIZE));
+      }
+      zs.next_out = reinterpret_cast<Bytef*>(out.data() + zs.total_out);
+      zs.avail_out =
+          uInt(std::min<size_t>(out.size() - zs.total_out, UINT_MAX));
+
+      auto ret = deflate(&zs, flush);
+      if (ret == Z_STREAM_END) {
+        return 0;
+      }
+      if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        return -1;
+      }
+      if (flush == Z_NO_FLUSH && zs.avail_in == 0) {
+        return 0;
+      }
+    }
+  }
+};
+
+} // namespace
+#endif
+
+bool watchman_json_buffer::compressedBserEncodeToStream(
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    w_stm_t stm,
+    bool flush) {
+#ifdef HAVE_ZLIB
+  deflate_write_data deflated;
+  bser_ctx_t value_ctx{2, bser_capabilities, deflate_write_data::write};
+  if (!deflated.initialized || w_bser_dump(&value_ctx, json, &deflated) ||
+      !deflated.finish()) {
+    return false;
+  }
+
+  struct jbuffer_write_data data = {stm, this};
+  uint32_t header_capabilities = bser_capabilities | BSER_CAP_COMPRESSED;
+  bser_ctx_t header_ctx{2, bser_capabilities, jbuffer_write_data::write};
+  if (data.write(BSER_V2_MAGIC, 2) ||
+      data.write(
+          (const char*)&header_capabilities, sizeof(header_capabilities)) ||
+      w_bser_dump(&header_ctx, json_integer(deflated.out.size()), &data) ||
+      data.write(deflated.out.data(), deflated.out.size())) {
+    return false;
+  }
+
+  return !flush || data.flush();
+#else
+  return bserEncodeToStream(2, bser_capabilities, json, stm, flush);
+#endif
+}
+
+bool watchman_json_buffer::sharedMemoryEncodeToStream(
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    w_stm_t stm) {
+#ifdef HAVE_MEMFD_SEALING
+  if (!stm->canPassDescriptors()) {
+    return bserEncodeToStream(2, bser_capabilities, json, stm);
+  }
+
+  // Anything waiting in the buffer goes ahead of the segment
+  if (!flushToStream(stm)) {
+    return false;
+  }
+
+  auto segment = w_stm_fdopen(FileDescriptor(
+      memfd_create("watchman-pdu", MFD_CLOEXEC | MFD_ALLOW_SEALING),
+      FileDescriptor::FDType::Generic));
+  if (!segment) {
+    return bserEncodeToStream(2, bser_capabilities, json, stm);
+  }
+  if (!bserEncodeToStream(2, bser_capabilities, json, segment.get())) {
+    return false;
+  }
+
+  // The client maps the segment, so it must not change under it
+  auto fd = segment->getFileDescriptor().fd();
+  auto size = lseek(fd, 0, SEEK_END);
+  if (size <= 0 ||
+      fcntl(
+          fd,
+          F_ADD_SEALS,
+          F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    return false;
+  }
+
+  auto notice = encodePdu(
+      is_bser_v2,
+      bser_capabilities | BSER_CAP_SHARED_MEMORY,
+      json_integer(size));
+  if (!notice) {
+    return false;
+  }
+  return stm->writeWithDescriptor(
+      notice->data(), int(notice->size()), segment->getFileDescriptor());
+#else
+  return bserEncodeToStream(2, bser_capabilities, json, stm);
+#endif
 }
 
 bool watchman_json_buffer::pduEncodeToStream(
     enum w_pdu_type pdu_type,
     uint32_t capabilities,
     const json_ref& json,
-    w_stm_t stm) {
+    w_stm_t stm,
+    bool flush) {
   switch (pdu_type) {
     case is_json_compact:
-      return jsonEncodeToStream(json, stm, JSON_COMPACT);
+      return jsonEncodeToStream(json, stm, JSON_COMPACT, flush);
     case is_json_pretty:
-      return jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      return jsonEncodeToStream(json, stm, JSON_INDENT(4), flush);
     case is_bser:
-      return bserEncodeToStream(1, capabilities, json, stm);
+      return bserEncodeToStream(1, capabilities, json, stm, flush);
     case is_bser_v2:
-      return bserEncodeToStream(2, capabilities, json, stm);
+      return bserEncodeToStream(2, capabilities, json, stm, flush);
     case need_data:
     default:
       return false;
   }
 }
 
+bool watchman_json_buffer::writeEncodedToStream(
+    const std::string& encoded,
+    w_stm_t stm,
+    bool flush) {
+  struct jbuffer_write_data data = {stm, this};
+  // Small PDUs join the others that are waiting in the buffer
+  if (encoded.size() <= allocd - wpos) {
+    if (data.write(encoded.data(), encoded.size()) != 0) {
+      return false;
+    }
+    return !flush || data.flush();
+  }
+
+  // Anything left over in the buffer goes first
+  if (!data.flush()) {
+    return false;
+  }
+
+  // The bytes are already contiguous, so they go straight to the stream
+  // rather than being copied through the buffer
+  const char* buf = encoded.data();
+  size_t remaining = encoded.size();
+  while (remaining) {
+    int x = stm->write(buf, (int)remaining);
+    if (x <= 0) {
+      return false;
+    }
+    buf += x;
+    remaining -= x;
+  }
+  return true;
+}
+
+bool watchman_json_buffer::flushToStream(w_stm_t stm) {
+  struct jbuffer_write_data data = {stm, this};
+  return data.flush();
+}
+
+namespace {
+
+int append_to_string(const char* buffer, size_t size, void* ptr) {
+  static_cast<std::string*>(ptr)->append(buffer, size);
+  return 0;
+}
+
+} // namespace
+
+std::optional<std::string> encodePdu(
+    enum w_pdu_type pdu_type,
+    uint32_t capabilities,
+    const json_ref& json) {
+  std::string encoded;
+  int res;
+  switch (pdu_type) {
+    case is_json_compact:
+      res = json_dump_callback(json, append_to_string, &encoded, JSON_COMPACT);
+      encoded.push_back('\n');
+      break;
+    case is_json_pretty:
+      res = json_dump_callback(
+          json, append_to_string, &encoded, JSON_INDENT(4));
+      encoded.push_back('\n');
+      break;
+    case is_bser:
+      res = w_bser_write_pdu(1, capabilities, append_to_string, json, &encoded);
+      break;
+    case is_bser_v2:
+      res = w_bser_write_pdu(2, capabilities, append_to_string, json, &encoded);
+      break;
+    case need_data:
+    default:
+      return std::nullopt;
+  }
+  if (res != 0) {
+    return std::nullopt;
+  }
+  return encoded;
+}
+
 /* vim:ts=2:sw=2:et:
  */
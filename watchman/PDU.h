@@ -8,6 +8,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <optional>
+#include <string>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 class watchman_stream;
@@ -33,10 +35,36 @@ struct watchman_json_buffer {
   watchman_json_buffer& operator=(const watchman_json_buffer&) = delete;
 
   void clear();
-  bool
-  jsonEncodeToStream(const json_ref& json, watchman_stream* stm, int flags);
+  // The encoding functions below accumulate the PDU in the buffer, which
+  // is written to the stream as it fills.  Passing flush=false leaves the
+  // tail of the PDU in the buffer, so that several PDUs can be written
+  // together; call flushToStream() once the last of them is encoded.
+  bool jsonEncodeToStream(
+      const json_ref& json,
+      watchman_stream* stm,
+      int flags,
+      bool flush = true);
   bool bserEncodeToStream(
       uint32_t bser_version,
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      watchman_stream* stm,
+      bool flush = true);
+
+  // Writes json as a BSER v2 PDU whose value is compressed; see
+  // BSER_CAP_COMPRESSED.  Writes it uncompressed if watchman was built
+  // without zlib.
+  bool compressedBserEncodeToStream(
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      watchman_stream* stm,
+      bool flush = true);
+
+  // Writes json as a BSER v2 PDU into a sealed shared memory segment, and
+  // sends stm a PDU that passes the segment's descriptor and holds its size;
+  // see BSER_CAP_SHARED_MEMORY.  Writes the PDU to stm itself if segments
+  // can't be made or passed.  Always flushes.
+  bool sharedMemoryEncodeToStream(
       uint32_t bser_capabilities,
       const json_ref& json,
       watchman_stream* stm);
@@ -45,7 +73,18 @@ struct watchman_json_buffer {
       w_pdu_type pdu_type,
       uint32_t capabilities,
       const json_ref& json,
-      watchman_stream* stm);
+      watchman_stream* stm,
+      bool flush = true);
+
+  // Writes a PDU that encodePdu() has already encoded, for PDUs that are
+  // sent to many clients and so are encoded once rather than per client.
+  bool writeEncodedToStream(
+      const std::string& encoded,
+      watchman_stream* stm,
+      bool flush = true);
+
+  // Writes whatever the encoding functions have left in the buffer
+  bool flushToStream(watchman_stream* stm);
 
   json_ref decodeNext(watchman_stream* stm, json_error_t* jerr);
 
@@ -77,3 +116,8 @@ struct watchman_json_buffer {
 };
 
 typedef struct watchman_json_buffer w_jbuffer_t;
+
+// Encodes json as the bytes that pduEncodeToStream() would write for it.
+// Returns std::nullopt if it can't be encoded.
+std::optional<std::string>
+encodePdu(w_pdu_type pdu_type, uint32_t capabilities, const json_ref& json);
@@ -7,8 +7,12 @@
 
 #include "watchman/PendingCollection.h"
 #include <folly/Synchronized.h>
+#include <mutex>
+#include <new>
 #include "watchman/Cookie.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryAccounting.h"
+#include "watchman/WatcherEventRecording.h"
 #include "watchman/watchman_dir.h"
 
 using namespace watchman;
@@ -21,8 +25,83 @@ const PendingFlags::NameTable PendingFlags::table = {
     {W_PENDING_NONRECURSIVE_SCAN, "NONRECURSIVE_SCAN"},
     {W_PENDING_VIA_NOTIFY, "VIA_NOTIFY"},
     {W_PENDING_IS_DESYNCED, "IS_DESYNCED"},
+    {W_PENDING_TRUST_READDIR, "TRUST_READDIR"},
+    {W_PENDING_SKIP_UNCHANGED, "SKIP_UNCHANGED"},
 };
 
+namespace {
+
+/**
+ * A process-wide freelist of watchman_pending_fs sized blocks.
+ *
+ * A checkout can queue hundreds of thousands of changes in a burst, and
+ * the same nodes are then released in bulk once the IO thread has
+ * processed them.  Recycling them saves a trip through the allocator for
+ * each change in the next burst.  Nodes are allocated by both the notify
+ * and IO threads, so the pool is shared and locked, but whole chains are
+ * returned under a single acquisition.
+ */
+class PendingNodePool {
+ public:
+  // Bounds the memory retained after a burst
+  static constexpr size_t kMaxPooledNodes = 64 * 1024;
+
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  static PendingNodePool& get() {
+    // Leaked so that it is usable by static PendingChanges instances
+    // during shutdown
+    static auto* pool = new PendingNodePool;
+    return *pool;
+  }
+
+  void* allocate() {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (auto node = head_) {
+        head_ = node->next;
+        --count_;
+        return node;
+      }
+    }
+    auto node = ::operator new(sizeof(watchman_pending_fs));
+    recordAllocation(
+        MemoryCategory::PendingChanges, sizeof(watchman_pending_fs));
+    return node;
+  }
+
+  // Takes ownership of the count nodes from head to tail.
+  void release(FreeNode* head, FreeNode* tail, size_t count) {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (count_ + count <= kMaxPooledNodes) {
+        tail->next = head_;
+        head_ = head;
+        count_ += count;
+        return;
+      }
+    }
+    while (head) {
+      auto next = head->next;
+      ::operator delete(head);
+      recordDeallocation(
+          MemoryCategory::PendingChanges, sizeof(watchman_pending_fs));
+      head = next;
+    }
+  }
+
+ private:
+  static_assert(sizeof(watchman_pending_fs) >= sizeof(FreeNode));
+
+  std::mutex mutex_;
+  FreeNode* head_{nullptr};
+  size_t count_{0};
+};
+
+} // namespace
+
 bool is_path_prefix(
     const char* path,
     size_t path_len,
@@ -49,38 +128,83 @@ bool is_path_prefix(
   return is_slash(path[common_prefix]);
 }
 
+void PendingChainDeleter::operator()(watchman_pending_fs* head) const {
+  using FreeNode = PendingNodePool::FreeNode;
+  FreeNode* freeHead = nullptr;
+  FreeNode* freeTail = nullptr;
+  size_t count = 0;
+
+  auto p = head;
+  while (p) {
+    auto next = p->next.release();
+    p->~watchman_pending_fs();
+
+    auto node = new (p) FreeNode{freeHead};
+    if (!freeTail) {
+      freeTail = node;
+    }
+    freeHead = node;
+    ++count;
+
+    p = next;
+  }
+
+  if (freeHead) {
+    PendingNodePool::get().release(freeHead, freeTail, count);
+  }
+}
+
+PendingChain watchman_pending_fs::make(
+    w_string path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags) {
+  auto mem = PendingNodePool::get().allocate();
+  try {
+    return PendingChain(
+        new (mem) watchman_pending_fs(std::move(path), now, flags));
+  } catch (...) {
+    auto node = new (mem) PendingNodePool::FreeNode{nullptr};
+    PendingNodePool::get().release(node, node, 1);
+    throw;
+  }
+}
+
 } // namespace watchman
 
 void PendingChanges::clear() {
   pending_.reset();
   tree_.clear();
   syncs_.clear();
+  renames_.clear();
 }
 
 void PendingChanges::add(
     const w_string& path,
     std::chrono::system_clock::time_point now,
     PendingFlags flags) {
+  if (recorder_) {
+    recorder_->record(path, now, flags);
+  }
   auto existing = tree_.search(path);
   if (existing) {
     /* Entry already exists: consolidate */
-    consolidateItem(existing->get(), flags);
+    consolidateItem(*existing, flags);
     /* all done */
     return;
   }
 
-  if (isObsoletedByContainingDir(path)) {
+  if (isObsoletedByContainingDir(path, flags)) {
     return;
   }
 
   // Try to allocate the new node before we prune any children.
-  auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
+  auto p = watchman_pending_fs::make(path, now, flags);
 
   maybePruneObsoletedChildren(path, flags);
 
   logf(DBG, "add_pending: {} {}\n", path, flags.format());
 
-  tree_.insert(path, p);
+  tree_.insert(path, p.get());
   linkHead(std::move(p));
 }
 
@@ -97,7 +221,7 @@ void PendingChanges::addSync(folly::Promise<folly::Unit> promise) {
 }
 
 void PendingChanges::append(
-    std::shared_ptr<watchman_pending_fs> chain,
+    PendingChain chain,
     std::vector<folly::Promise<folly::Unit>> syncs) {
   auto p = std::move(chain);
   while (p) {
@@ -105,19 +229,19 @@ void PendingChanges::append(
         tree_.search((const uint8_t*)p->path.data(), p->path.size());
     if (target_p) {
       /* Entry already exists: consolidate */
-      consolidateItem(target_p->get(), p->flags);
+      consolidateItem(*target_p, p->flags);
       p = std::move(p->next);
       continue;
     }
 
-    if (isObsoletedByContainingDir(p->path)) {
+    if (isObsoletedByContainingDir(p->path, p->flags)) {
       p = std::move(p->next);
       continue;
     }
     maybePruneObsoletedChildren(p->path, p->flags);
 
     auto next = std::move(p->next);
-    tree_.insert(p->path, p);
+    tree_.insert(p->path, p.get());
     linkHead(std::move(p));
 
     p = std::move(next);
@@ -129,7 +253,16 @@ void PendingChanges::append(
       std::make_move_iterator(syncs.end()));
 }
 
-std::shared_ptr<watchman_pending_fs> PendingChanges::stealItems() {
+void PendingChanges::append(
+    std::vector<PendingChain> chains,
+    std::vector<folly::Promise<folly::Unit>> syncs) {
+  for (auto& chain : chains) {
+    append(std::move(chain), {});
+  }
+  append(PendingChain{}, std::move(syncs));
+}
+
+PendingChain PendingChanges::stealItems() {
   tree_.clear();
   return std::move(pending_);
 }
@@ -140,6 +273,16 @@ std::vector<folly::Promise<folly::Unit>> PendingChanges::stealSyncs() {
   return syncs;
 }
 
+void PendingChanges::addRename(PendingRename rename) {
+  renames_.push_back(std::move(rename));
+}
+
+std::vector<PendingRename> PendingChanges::stealRenames() {
+  std::vector<PendingRename> renames;
+  std::swap(renames, renames_);
+  return renames;
+}
+
 bool PendingChanges::empty() const {
   return 0 == tree_.size() && syncs_.empty();
 }
@@ -148,6 +291,30 @@ uint32_t PendingChanges::getPendingItemCount() const {
   return tree_.size();
 }
 
+namespace {
+
+// Whether the crawl for these flags may skip reading dirs whose mtime is
+// unchanged
+bool skipsUnchangedDirs(PendingFlags flags) {
+  return flags.contains(W_PENDING_RECURSIVE | W_PENDING_SKIP_UNCHANGED) &&
+      !flags.contains(W_PENDING_IS_DESYNCED) &&
+      !flags.contains(W_PENDING_NONRECURSIVE_SCAN);
+}
+
+// Whether a pending recursive crawl of a dir makes a pending item for
+// something beneath it redundant.  A crawl that may skip unchanged dirs
+// wouldn't notice a file in one of them that was modified in place, so it
+// only covers the crawls beneath it that may skip them too.
+bool coversDescendant(PendingFlags dirFlags, PendingFlags flags) {
+  if ((dirFlags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) !=
+      W_PENDING_RECURSIVE) {
+    return false;
+  }
+  return !skipsUnchangedDirs(dirFlags) || skipsUnchangedDirs(flags);
+}
+
+} // namespace
+
 // if there are any entries that are obsoleted by a recursive insert,
 // walk over them now and mark them as ignored.
 void PendingChanges::maybePruneObsoletedChildren(
@@ -174,14 +341,13 @@ void PendingChanges::maybePruneObsoletedChildren(
     // a sibling node by mistake (see commentary on the is_path_prefix
     // function for more on that).
 
-    auto callback = [&](const w_string& key,
-                        std::shared_ptr<watchman_pending_fs>& p) -> int {
+    auto callback = [&](const w_string& key, watchman_pending_fs*& p) -> int {
       w_check(
           p,
           "Pending changes should be removed from both the list and the tree.");
 
       if (!p->flags.contains(W_PENDING_CRAWL_ONLY) &&
-          key.size() > path.size() &&
+          coversDescendant(flags, p->flags) && key.size() > path.size() &&
           is_path_prefix(
               (const char*)key.data(), key.size(), path.data(), path.size()) &&
           !watchman::isPossiblyACookie(p->path)) {
@@ -194,10 +360,9 @@ void PendingChanges::maybePruneObsoletedChildren(
             path.size(),
             path);
 
-        // Unlink the child from the pending index.
-        unlinkItem(p);
-
-        // Remove it from the art tree.
+        // Unlink the child from the pending index, and remove it from the
+        // art tree before it is released.
+        auto owned = unlinkItem(p);
         tree_.erase(key);
 
         // Stop iteration because we just invalidated the iterator state
@@ -232,11 +397,24 @@ void PendingChanges::consolidateItem(
   // flags are set.
   // We upgrade crawl-only as well as recursive; it indicates that
   // we've recently just performed the stat and we want to avoid
-  // infinitely trying to stat-and-crawl
+  // infinitely trying to stat-and-crawl.  The crawl that verifies a
+  // renamed dir turns the watcher's notification for it into a crawl, and
+  // that must stay a trusting one.
+  //
+  // Skipping unchanged dirs weakens a recursive crawl, so the merged crawl
+  // only may skip them if every recursive crawl merged into it may.
+  if (flags.contains(W_PENDING_RECURSIVE)) {
+    if (!flags.contains(W_PENDING_SKIP_UNCHANGED)) {
+      p->flags.clear(W_PENDING_SKIP_UNCHANGED);
+    } else if (!p->flags.contains(W_PENDING_RECURSIVE)) {
+      p->flags.set(W_PENDING_SKIP_UNCHANGED);
+    }
+  }
   p->flags.set(
       flags &
       (W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE |
-       W_PENDING_NONRECURSIVE_SCAN | W_PENDING_IS_DESYNCED));
+       W_PENDING_NONRECURSIVE_SCAN | W_PENDING_IS_DESYNCED |
+       W_PENDING_TRUST_READDIR));
 
   maybePruneObsoletedChildren(p->path, p->flags);
 }
@@ -245,15 +423,16 @@ void PendingChanges::consolidateItem(
 // filesystem than the input path; if there is, and it is recursive,
 // return true to indicate that there is no need to track this new path
 // due to the already scheduled higher level path.
-bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
+bool PendingChanges::isObsoletedByContainingDir(
+    const w_string& path,
+    PendingFlags flags) {
   auto leaf = tree_.longestMatch((const uint8_t*)path.data(), path.size());
   if (!leaf) {
     return false;
   }
   auto p = leaf->value;
 
-  if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
-          W_PENDING_RECURSIVE &&
+  if (coversDescendant(p->flags, flags) &&
       is_path_prefix(
           path.data(),
           path.size(),
@@ -272,32 +451,29 @@ bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
 }
 
 // Helper to doubly-link a pending item to the head of a collection.
-void PendingChanges::linkHead(std::shared_ptr<watchman_pending_fs>&& p) {
-  p->prev.reset();
-  p->next = pending_;
-  if (p->next) {
-    p->next->prev = p;
+void PendingChanges::linkHead(PendingChain&& p) {
+  p->prev = nullptr;
+  if (pending_) {
+    pending_->prev = p.get();
   }
+  p->next = std::move(pending_);
   pending_ = std::move(p);
 }
 
 // Helper to un-doubly-link a pending item.
-void PendingChanges::unlinkItem(std::shared_ptr<watchman_pending_fs>& p) {
-  if (pending_ == p) {
-    pending_ = p->next;
-  }
-  auto prev = p->prev.lock();
-
-  if (prev) {
-    prev->next = p->next;
+PendingChain PendingChanges::unlinkItem(watchman_pending_fs* p) {
+  auto prev = p->prev;
+  // Whoever points at p owns it
+  auto& owner = prev ? prev->next : pending_;
+  w_check(owner.get() == p, "pending list links are inconsistent");
+
+  auto self = std::move(owner);
+  owner = std::move(p->next);
+  if (owner) {
+    owner->prev = prev;
   }
-
-  if (p->next) {
-    p->next->prev = prev;
-  }
-
-  p->next.reset();
-  p->prev.reset();
+  p->prev = nullptr;
+  return self;
 }
 
 PendingCollectionBase::PendingCollectionBase(std::condition_variable& cond)
@@ -309,13 +485,40 @@ void PendingCollectionBase::ping() {
 }
 
 bool PendingCollectionBase::checkAndResetPinged() {
-  if (pending_ || pinged_) {
+  if (pending_ || !handedOff_.empty() || pinged_) {
     pinged_ = false;
     return true;
   }
   return false;
 }
 
+void PendingCollectionBase::handOff(PendingChanges& batch) {
+  auto chain = batch.stealItems();
+  if (chain) {
+    handedOff_.push_back(std::move(chain));
+  }
+  auto syncs = batch.stealSyncs();
+  syncs_.insert(
+      syncs_.end(),
+      std::make_move_iterator(syncs.begin()),
+      std::make_move_iterator(syncs.end()));
+  auto renames = batch.stealRenames();
+  renames_.insert(
+      renames_.end(),
+      std::make_move_iterator(renames.begin()),
+      std::make_move_iterator(renames.end()));
+}
+
+std::vector<PendingChain> PendingCollectionBase::stealAllItems() {
+  std::vector<PendingChain> chains;
+  std::swap(chains, handedOff_);
+  auto items = stealItems();
+  if (items) {
+    chains.push_back(std::move(items));
+  }
+  return chains;
+}
+
 PendingCollection::PendingCollection()
     : folly::Synchronized<PendingCollectionBase, std::mutex>{
           folly::in_place,
@@ -11,6 +11,8 @@
 #include <folly/futures/Promise.h>
 #include <chrono>
 #include <condition_variable>
+#include <memory>
+#include <vector>
 #include "watchman/OptionSet.h"
 #include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
@@ -19,6 +21,8 @@ struct watchman_dir;
 
 namespace watchman {
 
+class WatcherEventRecorder;
+
 struct PendingFlags : OptionSet<PendingFlags, uint8_t> {
   using OptionSet::OptionSet;
   static const NameTable table;
@@ -75,6 +79,25 @@ constexpr inline auto W_PENDING_CRAWL_ONLY = PendingFlags::raw(8);
  */
 constexpr inline auto W_PENDING_IS_DESYNCED = PendingFlags::raw(16);
 
+/**
+ * Set on the crawl that verifies a dir whose subtree the IO thread moved in
+ * the view because the watcher reported that it was renamed.  The crawler
+ * trusts that entries whose readdir inode and type match the view are
+ * unchanged, as if recrawl_trust_readdir applied, and passes the flag on to
+ * the child dirs.  Ignored alongside W_PENDING_IS_DESYNCED.
+ */
+constexpr inline auto W_PENDING_TRUST_READDIR = PendingFlags::raw(32);
+
+/**
+ * Set on the crawls of a recrawl, or of a rescan that the watcher asked for,
+ * that may skip reading a dir whose mtime and inode are the same as when the
+ * crawler last read every entry of it.  The crawler still visits the child
+ * dirs that the view knows, passing the flag on to them.  Ignored alongside
+ * W_PENDING_IS_DESYNCED.  Such a crawl only obsoletes the pending crawls
+ * beneath it that may skip unchanged dirs too.
+ */
+constexpr inline auto W_PENDING_SKIP_UNCHANGED = PendingFlags::raw(64);
+
 /**
  * Represents a change notification from the Watcher.
  */
@@ -84,10 +107,34 @@ struct PendingChange {
   PendingFlags flags;
 };
 
+/**
+ * A dir that the watcher saw renamed from one path in the root to another.
+ */
+struct PendingRename {
+  w_string from;
+  w_string to;
+  std::chrono::system_clock::time_point now;
+};
+
+struct watchman_pending_fs;
+
+/**
+ * Returns a chain of pending items to the node pool.  The chain is released
+ * iteratively, so arbitrarily long chains are safe to destroy.
+ */
+struct PendingChainDeleter {
+  void operator()(watchman_pending_fs* head) const;
+};
+
+/**
+ * Owns a singly-linked list of pending items via its head.
+ */
+using PendingChain = std::unique_ptr<watchman_pending_fs, PendingChainDeleter>;
+
 struct watchman_pending_fs : watchman::PendingChange {
   // We own the next entry and will destroy that chain when we
   // are destroyed.
-  std::shared_ptr<watchman_pending_fs> next;
+  PendingChain next;
 
   watchman_pending_fs(
       w_string path,
@@ -95,9 +142,19 @@ struct watchman_pending_fs : watchman::PendingChange {
       PendingFlags flags)
       : PendingChange{std::move(path), now, flags} {}
 
+  /**
+   * Allocates a new item from a process-wide pool of recycled nodes.
+   * Items that end up in a PendingChain must be allocated this way.
+   */
+  static PendingChain make(
+      w_string path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags);
+
  private:
-  // Only used for unlinking during pruning.
-  std::weak_ptr<watchman_pending_fs> prev;
+  // Only used for unlinking during pruning; the node before this one in the
+  // list, which owns us via its next field.
+  watchman_pending_fs* prev{nullptr};
   friend class PendingChanges;
 };
 
@@ -145,15 +202,41 @@ class PendingChanges {
    * `chain` is consumed -- the links are broken.
    */
   void append(
-      std::shared_ptr<watchman_pending_fs> chain,
+      PendingChain chain,
+      std::vector<folly::Promise<folly::Unit>> syncs);
+
+  /**
+   * Merge each of `chains`, in order, followed by `syncs`.  Typically the
+   * result of PendingCollectionBase::stealAllItems().
+   */
+  void append(
+      std::vector<PendingChain> chains,
       std::vector<folly::Promise<folly::Unit>> syncs);
 
   /* Moves the head of the chain of items to the caller.
    * The tree is cleared and the caller owns the whole chain */
-  std::shared_ptr<watchman_pending_fs> stealItems();
+  PendingChain stealItems();
 
   std::vector<folly::Promise<folly::Unit>> stealSyncs();
 
+  /**
+   * Records that a dir was renamed.  Watchers that can pair up the two
+   * sides of a rename add this alongside the changes to both paths, so
+   * that the IO thread can move the subtree in the view rather than
+   * deleting it and crawling the new location from scratch.
+   */
+  void addRename(PendingRename rename);
+
+  std::vector<PendingRename> stealRenames();
+
+  /**
+   * Returns the head of the chain of items without taking ownership; walk
+   * it via `next`.  Invalidated by any mutation of the collection.
+   */
+  const watchman_pending_fs* peekItems() const {
+    return pending_.get();
+  }
+
   /**
    * Returns true if there are no items or syncs.
    */
@@ -165,17 +248,30 @@ class PendingChanges {
    */
   uint32_t getPendingItemCount() const;
 
+  /**
+   * Has add() pass each change to `recorder` before consolidating it.
+   * The recorder must outlive the collection, or be reset to nullptr.
+   */
+  void setRecorder(WatcherEventRecorder* recorder) {
+    recorder_ = recorder;
+  }
+
  protected:
-  art_tree<std::shared_ptr<watchman_pending_fs>, w_string> tree_;
-  std::shared_ptr<watchman_pending_fs> pending_;
+  // Non-owning; every item in the tree is owned by the pending_ list.
+  art_tree<watchman_pending_fs*, w_string> tree_;
+  PendingChain pending_;
   std::vector<folly::Promise<folly::Unit>> syncs_;
+  std::vector<PendingRename> renames_;
 
  private:
+  WatcherEventRecorder* recorder_{nullptr};
+
   void maybePruneObsoletedChildren(w_string path, PendingFlags flags);
   inline void consolidateItem(watchman_pending_fs* p, PendingFlags flags);
-  bool isObsoletedByContainingDir(const w_string& path);
-  inline void linkHead(std::shared_ptr<watchman_pending_fs>&& p);
-  inline void unlinkItem(std::shared_ptr<watchman_pending_fs>& p);
+  bool isObsoletedByContainingDir(const w_string& path, PendingFlags flags);
+  inline void linkHead(PendingChain&& p);
+  // Returns ownership of p, which is no longer linked into the list.
+  inline PendingChain unlinkItem(watchman_pending_fs* p);
 };
 
 class PendingCollectionBase : public PendingChanges {
@@ -195,8 +291,29 @@ class PendingCollectionBase : public PendingChanges {
    */
   bool checkAndResetPinged();
 
+  /**
+   * Moves the items, syncs and renames from `batch` into this collection,
+   * leaving `batch` empty.
+   *
+   * Unlike append(), this doesn't merge the items with those already
+   * present, so it takes constant time regardless of the size of the batch.
+   * This keeps the critical section short for producers that have already
+   * consolidated their changes, such as the notify thread.  The merge is
+   * performed by the consumer, outside of the lock, when it appends the
+   * result of stealAllItems() to its own PendingChanges.
+   */
+  void handOff(PendingChanges& batch);
+
+  /**
+   * Like stealItems(), but also returns the chains given to handOff().
+   * The caller owns the returned chains.
+   */
+  std::vector<PendingChain> stealAllItems();
+
  private:
   std::condition_variable& cond_;
+  // Chains moved here by handOff() that have not yet been merged
+  std::vector<PendingChain> handedOff_;
   bool pinged_{false};
 };
 
@@ -6,8 +6,10 @@
  */
 
 #include "watchman/PerfSample.h"
-#include <folly/Synchronized.h>
-#include <condition_variable>
+#include <folly/concurrency/UnboundedQueue.h>
+#include <algorithm>
+#include <atomic>
+#include <optional>
 #include <thread>
 #include "watchman/ChildProcess.h"
 #include "watchman/Logging.h"
@@ -21,22 +23,64 @@ using namespace watchman;
 
 namespace watchman {
 namespace {
-class PerfLogThread {
-  struct State {
-    explicit State(bool start) : running(start) {}
 
-    bool running;
-    json_ref samples;
-  };
+// Samples logged while this many are already waiting are dropped, so that a
+// slow perf_logger_command can't grow the queue without bound
+constexpr size_t kMaxQueuedSamples = 4096;
+
+// A backlog is shipped in about this many perf_logger_command invocations
+constexpr size_t kBacklogInvocations = 4;
+constexpr size_t kMaxAdaptiveBatchSize = 64;
+
+// What PerfSample::log() hands to the logging thread.  Rendering it as JSON
+// is left to that thread, keeping it off the path of the sampled request.
+struct QueuedSample {
+  std::string description;
+  json_ref meta;
+  timeval start_time;
+  timeval elapsed_time;
+#ifdef HAVE_SYS_RESOURCE_H
+  timeval user_time;
+  timeval system_time;
+#endif
+};
+
+json_ref renderSample(const QueuedSample& sample) {
+  auto info = json_object(
+      {{"description", typed_string_to_json(sample.description.c_str())},
+       {"meta", sample.meta},
+       {"pid", json_integer(::getpid())},
+       {"version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE)}});
 
-  folly::Synchronized<State, std::mutex> state_;
+#ifdef WATCHMAN_BUILD_INFO
+  info.set(
+      "buildinfo", typed_string_to_json(WATCHMAN_BUILD_INFO, W_STRING_UNICODE));
+#endif
+
+#define ADDTV(name, tv) info.set(name, json_real(w_timeval_abs_seconds(tv)))
+  ADDTV("elapsed_time", sample.elapsed_time);
+  ADDTV("start_time", sample.start_time);
+#ifdef HAVE_SYS_RESOURCE_H
+  ADDTV("user_time", sample.user_time);
+  ADDTV("system_time", sample.system_time);
+#endif // HAVE_SYS_RESOURCE_H
+#undef ADDTV
+
+  return info;
+}
+
+class PerfLogThread {
+  // An empty entry asks the thread to stop
+  folly::UMPSCQueue<std::optional<QueuedSample>, true> queue_;
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> dropped_{0};
+  std::atomic<bool> running_;
   std::thread thread_;
-  std::condition_variable cond_;
 
   void loop() noexcept;
 
  public:
-  explicit PerfLogThread(bool start) : state_(folly::in_place, start) {
+  explicit PerfLogThread(bool start) : running_(start) {
     if (start) {
       thread_ = std::thread([this] { loop(); });
     }
@@ -47,24 +91,20 @@ class PerfLogThread {
   }
 
   void stop() {
-    {
-      auto state = state_.lock();
-      if (!state->running) {
-        return;
-      }
-      state->running = false;
+    if (!running_.exchange(false)) {
+      return;
     }
-    cond_.notify_all();
+    queue_.enqueue(std::nullopt);
     thread_.join();
   }
 
-  void addSample(json_ref&& sample) {
-    auto wlock = state_.lock();
-    if (!wlock->samples) {
-      wlock->samples = json_array();
+  void addSample(QueuedSample&& sample) {
+    if (queued_.fetch_add(1, std::memory_order_relaxed) >= kMaxQueuedSamples) {
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
     }
-    json_array_append_new(wlock->samples, std::move(sample));
-    cond_.notify_one();
+    queue_.enqueue(std::move(sample));
   }
 };
 
@@ -107,6 +147,11 @@ void processSamples(
   }
 }
 
+size_t adaptiveSampleBatchSize(size_t minimum, size_t pending) {
+  auto batch = std::min(pending / kBacklogInvocations, kMaxAdaptiveBatchSize);
+  return std::max(minimum, batch);
+}
+
 PerfSample::PerfSample(const char* description) : description(description) {
   gettimeofday(&time_begin, nullptr);
 #ifdef HAVE_SYS_RESOURCE_H
@@ -176,7 +221,6 @@ void PerfSample::force_log() {
 }
 
 void PerfLogThread::loop() noexcept {
-  json_ref samples;
   json_ref perf_cmd;
   int64_t sample_batch;
 
@@ -189,34 +233,47 @@ void PerfLogThread::loop() noexcept {
   if (perf_cmd.isString()) {
     perf_cmd = json_array({perf_cmd});
   }
-  if (!perf_cmd.isArray()) {
+  if (perf_cmd && !perf_cmd.isArray()) {
     logf(
         FATAL,
         "perf_logger_command must be either a string or an array of strings\n");
   }
 
+  // When the batch size isn't configured, it grows with the backlog
+  bool adaptive_batch =
+      !cfg_get_json("perf_logger_command_max_samples_per_call");
   sample_batch = cfg_get_int("perf_logger_command_max_samples_per_call", 4);
 
-  while (true) {
-    {
-      auto state = state_.lock();
-      while (true) {
-        if (state->samples) {
-          // We found samples to process
-          break;
-        }
-        if (!state->running) {
-          // No samples remaining, and we have been asked to quit.
-          return;
-        }
-        cond_.wait(state.as_lock());
+  bool stopping = false;
+  while (!stopping) {
+    // Wait for a sample, then take everything else that has been queued
+    std::optional<QueuedSample> queued;
+    queue_.dequeue(queued);
+
+    auto samples = json_array();
+    size_t count = 0;
+    do {
+      if (!queued) {
+        stopping = true;
+        break;
       }
-
-      samples = nullptr;
-      std::swap(samples, state->samples);
+      ++count;
+      auto info = renderSample(*queued);
+      watchman::log(watchman::ERR, "PERF: ", json_dumps(info, 0), "\n");
+      json_array_append_new(samples, std::move(info));
+    } while (queue_.try_dequeue(queued));
+    queued_.fetch_sub(count, std::memory_order_relaxed);
+
+    auto dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+      watchman::log(
+          watchman::ERR,
+          "perf logging is falling behind; dropped ",
+          dropped,
+          " samples\n");
     }
 
-    if (samples) {
+    if (perf_cmd && count > 0) {
       // Hack: Divide by two because this limit includes environment variables
       // and perf_cmd.
       // It's possible to compute this correctly on every platform given the
@@ -226,7 +283,8 @@ void PerfLogThread::loop() noexcept {
 
       processSamples(
           argv_limit,
-          sample_batch,
+          adaptive_batch ? adaptiveSampleBatchSize(sample_batch, count)
+                         : sample_batch,
           samples,
           [&](std::vector<std::string> sample_args) {
             std::vector<std::string_view> cmd;
@@ -312,38 +370,19 @@ void PerfSample::log() {
     return;
   }
 
-  // Assemble a perf blob
-  auto info = json_object(
-      {{"description", typed_string_to_json(description)},
-       {"meta", meta_data},
-       {"pid", json_integer(::getpid())},
-       {"version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE)}});
-
-#ifdef WATCHMAN_BUILD_INFO
-  info.set(
-      "buildinfo", typed_string_to_json(WATCHMAN_BUILD_INFO, W_STRING_UNICODE));
-#endif
-
-#define ADDTV(name, tv) info.set(name, json_real(w_timeval_abs_seconds(tv)))
-  ADDTV("elapsed_time", duration);
-  ADDTV("start_time", time_begin);
+  QueuedSample queued;
+  queued.description = description;
+  queued.meta = meta_data;
+  queued.start_time = time_begin;
+  queued.elapsed_time = duration;
 #ifdef HAVE_SYS_RESOURCE_H
-  ADDTV("user_time", usage.ru_utime);
-  ADDTV("system_time", usage.ru_stime);
-#endif // HAVE_SYS_RESOURCE_H
-#undef ADDTV
-
-  // Log to the log file
-  auto dumped = json_dumps(info, 0);
-  watchman::log(watchman::ERR, "PERF: ", dumped, "\n");
-
-  if (!cfg_get_json("perf_logger_command")) {
-    return;
-  }
+  queued.user_time = usage.ru_utime;
+  queued.system_time = usage.ru_stime;
+#endif
 
-  // Send this to our logging thread for async processing
-  auto& perfThread = getPerfThread();
-  perfThread.addSample(std::move(info));
+  // The logging thread writes the sample to the log file and sends it to
+  // perf_logger_command, if one is configured
+  getPerfThread().addSample(std::move(queued));
 }
 
 void perf_shutdown() {
@@ -70,7 +70,9 @@ class PerfSample {
   // Force the sample to go to the log
   void force_log();
 
-  // If will_log is set, arranges to send the sample to the log
+  // If will_log is set, arranges to send the sample to the log.
+  // The sample is queued for the perf logging thread, which renders it and
+  // runs perf_logger_command, so this doesn't block the caller.
   void log();
 };
 
@@ -83,6 +85,12 @@ void processSamples(
     std::function<void(std::vector<std::string>)> command_line,
     std::function<void(std::string)> single_large_sample);
 
+// Returns how many samples to pass to each perf_logger_command invocation
+// when `pending` samples are waiting.  This is `minimum` unless there is a
+// backlog, in which case larger batches are used so that it is worked off
+// with fewer process spawns.
+size_t adaptiveSampleBatchSize(size_t minimum, size_t pending);
+
 } // namespace watchman
 
 /* vim:ts=2:sw=2:et:
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PriorityPaths.h"
+
+namespace watchman {
+
+namespace {
+
+// Whether `path` is `dir` or lies beneath it
+bool isSameOrBeneath(w_string_piece path, w_string_piece dir) {
+  return path.startsWith(dir) &&
+      (path.size() == dir.size() || is_slash(path[dir.size()]));
+}
+
+} // namespace
+
+void PriorityPaths::add(const void* query, std::vector<w_string> paths) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  queries_[query] = Entry{std::move(paths), false};
+}
+
+void PriorityPaths::markSynced(const void* query) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = queries_.find(query);
+    if (it == queries_.end() || it->second.synced) {
+      return;
+    }
+    it->second.synced = true;
+    ++numSynced_;
+  }
+  cond_.notify_all();
+}
+
+void PriorityPaths::remove(const void* query) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto it = queries_.find(query);
+    if (it == queries_.end()) {
+      return;
+    }
+    if (it->second.synced) {
+      --numSynced_;
+    }
+    queries_.erase(it);
+  }
+  cond_.notify_all();
+}
+
+PriorityPaths::Waiting PriorityPaths::waiting() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  Waiting result;
+  for (auto& [query, entry] : queries_) {
+    if (!entry.synced) {
+      result.paths.insert(
+          result.paths.end(), entry.paths.begin(), entry.paths.end());
+      ++result.numQueries;
+    }
+  }
+  return result;
+}
+
+bool PriorityPaths::isRelevant(
+    const std::vector<w_string>& paths,
+    const w_string& path) {
+  for (auto& prefix : paths) {
+    if (isSameOrBeneath(path, prefix) || isSameOrBeneath(prefix, path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool PriorityPaths::waitForSyncedQueries(
+    size_t numWaiting,
+    std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  return cond_.wait_for(lock, timeout, [&] {
+    return queries_.size() - numSynced_ < numWaiting && numSynced_ == 0;
+  });
+}
+
+} // namespace watchman
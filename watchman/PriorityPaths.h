@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Tracks the paths that queries waiting to synchronize with the filesystem
+ * will examine, so that the IO thread can apply the pending changes to them
+ * ahead of unrelated bulk work, such as the crawl of a large directory that
+ * just appeared elsewhere in the root, and then briefly release the view so
+ * that those queries can run before it gets on with that work.
+ *
+ * Each query is identified by an opaque key, such as its QueryContext.
+ *
+ * Thread safe.
+ */
+class PriorityPaths {
+ public:
+  // Registers the full paths beneath which the query finds all its results
+  void add(const void* query, std::vector<w_string> paths);
+
+  // The query has synchronized and is about to read the view
+  void markSynced(const void* query);
+
+  // The query has finished, successfully or otherwise
+  void remove(const void* query);
+
+  struct Waiting {
+    // The paths of every query that has yet to synchronize
+    std::vector<w_string> paths;
+    size_t numQueries{0};
+  };
+  Waiting waiting() const;
+
+  /**
+   * Returns true if `path` is one of `paths`, is beneath one of them, or is
+   * a directory that contains one of them; changes to any of these can
+   * affect the results of a query restricted to `paths`.
+   */
+  static bool isRelevant(
+      const std::vector<w_string>& paths,
+      const w_string& path);
+
+  /**
+   * Waits for some of the `numWaiting` queries that waiting() reported to
+   * synchronize, and then for every synchronized query to finish.  Gives up
+   * after `timeout`.  Returns whether they finished.
+   */
+  bool waitForSyncedQueries(
+      size_t numWaiting,
+      std::chrono::milliseconds timeout);
+
+ private:
+  struct Entry {
+    std::vector<w_string> paths;
+    bool synced{false};
+  };
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::unordered_map<const void*, Entry> queries_;
+  size_t numSynced_{0};
+};
+
+} // namespace watchman
@@ -8,6 +8,7 @@
 #include "watchman/PubSub.h"
 #include <algorithm>
 #include <iterator>
+#include <limits>
 
 namespace watchman {
 
@@ -21,75 +22,42 @@ Publisher::Subscriber::Subscriber(
       info_(std::move(info)) {}
 
 Publisher::Subscriber::~Subscriber() {
-  // In the loop below we may own a reference to some other
-  // Subscriber instance.  That is fine, but we need to take
-  // care: if we end up with the last reference to that subscriber
-  // we will end up calling its destructor and effective recurse
-  // and attempt to acquire the wlock.   We therefore need to
-  // defer releasing any of the shared_ptr's that we lock in
-  // the loop below until after we have released the wlock.
-  std::vector<std::shared_ptr<Subscriber>> subscribers;
-
-  {
-    auto wlock = publisher_->state_.wlock();
-    auto it = wlock->subscribers.begin();
-    while (it != wlock->subscribers.end()) {
-      auto sub = it->lock();
-      // Prune vacated weak_ptr's or those that point to us
-      if (!sub || sub.get() == this) {
-        it = wlock->subscribers.erase(it);
-      } else {
-        ++it;
-        // Defer releasing the sub reference until after we've
-        // release the wlock!
-        subscribers.emplace_back(std::move(sub));
-      }
-    }
-    // Take this opportunity to reap anything that is no longer
-    // referenced now that we've removed some subscriber(s)
-    wlock->collectGarbage();
+  // Only our own entry is touched, so unlike a scan of the other
+  // subscribers this can't end up releasing the last reference to one of
+  // them while holding the lock.  The items that only we were holding on
+  // to are reclaimed by a later enqueue.
+  auto wlock = publisher_->state_.wlock();
+  if (wlock->subscribers.erase(this)) {
+    wlock->notifyList.reset();
+    publisher_->numSubscribers_.fetch_sub(1, std::memory_order_relaxed);
   }
-
-  // It is now safe for subscribers to be torn down and release
-  // any references we took ownership of in the loop above.
 }
 
 void Publisher::Subscriber::getPending(
     std::vector<std::shared_ptr<const Item>>& pending) {
-  {
-    auto rlock = publisher_->state_.rlock();
-    auto& items = rlock->items;
-
-    if (items.empty()) {
-      return;
-    }
-
-    // First we walk back to find the end of the range that
-    // we have seen previously.
-    int firstIndex;
-    for (firstIndex = int(items.size()) - 1; firstIndex >= 0; --firstIndex) {
-      if (items[firstIndex]->serial <= serial_) {
-        break;
-      }
-    }
+  // Clear this before looking at the items, so that an item published
+  // after we look notifies us again.
+  notified_.store(false);
 
-    // We found the item before the one we really want, so
-    // increment the index; we'll copy the remaining items.
-    ++firstIndex;
-    bool updated = false;
+  auto rlock = publisher_->state_.rlock();
+  auto& items = rlock->items;
 
-    while (firstIndex < int(items.size())) {
-      pending.push_back(items[firstIndex]);
-      ++firstIndex;
-      updated = true;
-    }
-
-    if (updated) {
-      serial_ = pending.back()->serial;
-    }
+  if (items.empty()) {
+    return;
+  }
 
+  // The serials of the items are consecutive, and the items that we
+  // haven't seen yet can't have been reclaimed.
+  auto serial = serial_.load(std::memory_order_relaxed);
+  auto firstSerial = items.front()->serial;
+  size_t firstIndex = serial < firstSerial ? 0 : serial + 1 - firstSerial;
+  if (firstIndex >= items.size()) {
     return;
   }
+
+  std::copy(
+      items.begin() + firstIndex, items.end(), std::back_inserter(pending));
+  serial_.store(items.back()->serial, std::memory_order_release);
 }
 
 void getPending(
@@ -109,69 +77,98 @@ std::shared_ptr<Publisher::Subscriber> Publisher::subscribe(
     const json_ref& info) {
   auto sub =
       std::make_shared<Publisher::Subscriber>(shared_from_this(), notify, info);
-  state_.wlock()->subscribers.emplace_back(sub);
+  auto wlock = state_.wlock();
+  // Items published before now are of no interest to the new subscriber
+  sub->serial_ = wlock->nextSerial - 1;
+  wlock->subscribers.emplace(sub.get(), sub);
+  wlock->notifyList.reset();
+  numSubscribers_.fetch_add(1, std::memory_order_relaxed);
   return sub;
 }
 
-bool Publisher::hasSubscribers() const {
-  return !state_.rlock()->subscribers.empty();
+size_t Publisher::getQueuedItemCount() const {
+  auto rlock = state_.rlock();
+  // Items that every subscriber has consumed may not have been reclaimed
+  // yet, so count from the slowest subscriber
+  auto minSerial = rlock->minConsumedSerial();
+  if (rlock->items.empty() || minSerial >= rlock->items.back()->serial) {
+    return 0;
+  }
+  auto firstUnconsumed = std::max(minSerial + 1, rlock->items.front()->serial);
+  return rlock->items.back()->serial - firstUnconsumed + 1;
 }
 
-void Publisher::state::collectGarbage() {
-  if (items.empty()) {
-    return;
+size_t Publisher::getSubscriberCount() const {
+  auto rlock = state_.rlock();
+  size_t count = 0;
+  for (auto& it : rlock->subscribers) {
+    if (!it.second.expired()) {
+      ++count;
+    }
   }
+  return count;
+}
 
+uint64_t Publisher::state::minConsumedSerial() const {
   uint64_t minSerial = std::numeric_limits<uint64_t>::max();
   for (auto& it : subscribers) {
-    auto sub = it.lock();
-    if (sub) {
-      minSerial = std::min(minSerial, sub->getSerial());
-    }
+    minSerial = std::min(minSerial, it.first->getSerial());
   }
+  return minSerial;
+}
 
-  while (!items.empty() && items.front()->serial < minSerial) {
+void Publisher::state::collectGarbage() {
+  if (items.empty()) {
+    return;
+  }
+
+  auto minSerial = minConsumedSerial();
+  while (!items.empty() && items.front()->serial <= minSerial) {
     items.pop_front();
   }
+
+  // Let the log grow to twice what is left before scanning again, so that
+  // the scans cost O(1) per enqueue however many subscribers there are
+  gcThreshold = std::max(kMinGCThreshold, items.size() * 2);
 }
 
 bool Publisher::enqueue(json_ref&& payload) {
-  std::vector<std::shared_ptr<Subscriber>> subscribers;
+  std::shared_ptr<const SubscriberList> toNotify;
 
   {
     auto wlock = state_.wlock();
 
-    // We need to collect live references for the notify portion,
-    // but since we're holding the wlock, take this opportunity to
-    // detect and prune dead subscribers and clean up some garbage.
-    auto it = wlock->subscribers.begin();
-    while (it != wlock->subscribers.end()) {
-      auto sub = it->lock();
-      // Prune vacated weak_ptr's
-      if (!sub) {
-        it = wlock->subscribers.erase(it);
-      } else {
-        ++it;
-        // Remember that live reference so that we can notify
-        // outside of the lock below.
-        subscribers.emplace_back(std::move(sub));
-      }
+    if (wlock->subscribers.empty()) {
+      return false;
     }
 
-    wlock->collectGarbage();
-
-    if (subscribers.empty()) {
-      return false;
+    if (wlock->items.size() >= wlock->gcThreshold) {
+      wlock->collectGarbage();
     }
 
     auto item = std::make_shared<Item>();
     item->payload = std::move(payload);
     item->serial = wlock->nextSerial++;
     wlock->items.emplace_back(std::move(item));
+
+    if (!wlock->notifyList) {
+      auto list = std::make_shared<SubscriberList>();
+      list->reserve(wlock->subscribers.size());
+      for (auto& it : wlock->subscribers) {
+        list->push_back(it.second);
+      }
+      wlock->notifyList = std::move(list);
+    }
+    toNotify = wlock->notifyList;
   }
 
-  // and notify them outside of the lock
-  for (auto& sub : subscribers) {
+  // and notify them outside of the lock.  Subscribers that were already
+  // notified and haven't collected their items yet will see this one too.
+  for (auto& weak : *toNotify) {
+    auto sub = weak.lock();
+    if (!sub || sub->notified_.exchange(true)) {
+      continue;
+    }
     auto& n = sub->getNotify();
     if (n) {
       n();
@@ -189,16 +186,16 @@ json_ref Publisher::getDebugInfo() const {
   auto subscribers = json_array();
   auto& subscribers_arr = subscribers.array();
 
-  for (auto& sub_ref : rlock->subscribers) {
-    auto sub = sub_ref.lock();
+  for (auto& it : rlock->subscribers) {
+    auto sub = it.second.lock();
     if (sub) {
       auto sub_json = json_object(
           {{"serial", json_integer(sub->getSerial())},
            {"info", sub->getInfo()}});
       subscribers_arr.emplace_back(sub_json);
     } else {
-      // This is a subscriber that is now dead. It will be cleaned up the next
-      // time enqueue is called.
+      // This is a subscriber that is being destroyed, and is about to
+      // remove itself.
     }
   }
 
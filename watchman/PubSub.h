@@ -7,12 +7,16 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include "watchman/MemoryAccounting.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
+#include <atomic>
 #include <deque>
 #include <functional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace watchman {
@@ -20,11 +24,26 @@ namespace watchman {
 class Publisher : public std::enable_shared_from_this<Publisher> {
  public:
   struct Item {
+    Item() {
+      recordAllocation(MemoryCategory::SubscriptionQueues, sizeof(Item));
+    }
+    ~Item() {
+      recordDeallocation(MemoryCategory::SubscriptionQueues, sizeof(Item));
+    }
+    Item(const Item&) = delete;
+    Item& operator=(const Item&) = delete;
+
     // copy of nextSerial_ at the time this was created.
     // The item can be released when all subscribers have
     // observed this serial number.
     uint64_t serial;
     json_ref payload;
+    // The payload encoded in each of the formats that it has been sent to
+    // clients in, keyed by the client's pdu type and capabilities, so that
+    // the clients that it is broadcast to share one encoding.
+    mutable folly::Synchronized<
+        std::vector<std::pair<uint64_t, std::shared_ptr<const std::string>>>>
+        encodings;
   };
 
   // Generic callback that subscribers can register to arrange
@@ -34,8 +53,13 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // Each subscriber is represented by one of these
   class Subscriber : public std::enable_shared_from_this<Subscriber> {
     // The serial of the last Item to be consumed by
-    // this subscriber.
-    uint64_t serial_;
+    // this subscriber.  This is the subscriber's cursor into the
+    // publisher's log of items.
+    std::atomic<uint64_t> serial_;
+    // Set when the subscriber has been notified of items that it hasn't
+    // yet collected with getPending(), during which publishing more items
+    // doesn't notify it again.
+    std::atomic<bool> notified_{false};
     // Subscriber keeps the publisher alive so that no Items are lost
     // if the Publisher is released before all of the subscribers.
     std::shared_ptr<Publisher> publisher_;
@@ -44,6 +68,8 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     // Information for debugging purposes
     const json_ref info_;
 
+    friend class Publisher;
+
    public:
     ~Subscriber();
     Subscriber(
@@ -56,7 +82,7 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     void getPending(std::vector<std::shared_ptr<const Item>>& pending);
 
     inline uint64_t getSerial() const {
-      return serial_;
+      return serial_.load(std::memory_order_acquire);
     }
 
     inline Notifier& getNotify() {
@@ -77,31 +103,55 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
 
   // Returns true if there are any subscribers.
   // This is racy and intended to be used to gate building a payload
-  // if there are no current subscribers.
-  bool hasSubscribers() const;
+  // if there are no current subscribers.  It doesn't take the lock.
+  bool hasSubscribers() const {
+    return numSubscribers_.load(std::memory_order_relaxed) != 0;
+  }
+
+  // Returns the number of live subscribers; like hasSubscribers(), racy
+  size_t getSubscriberCount() const;
+
+  // Returns the number of items yet to be consumed by every subscriber
+  size_t getQueuedItemCount() const;
 
   // Enqueue a new item, but only if there are subscribers.
-  // Returns true if the item was queued.
+  // Returns true if the item was queued.  The lock is only held to append
+  // the item; the subscribers are notified after it is released, and only
+  // those that have collected everything they were last notified of.
   bool enqueue(json_ref&& payload);
 
   // Return debugging info useful for state inspection.
   json_ref getDebugInfo() const;
 
  private:
+  using SubscriberList = std::vector<std::weak_ptr<Subscriber>>;
+  static constexpr size_t kMinGCThreshold = 64;
+
   struct state {
     state() = default;
     state(const state&) = delete;
     // Serial number to use for the next Item
     uint64_t nextSerial{1};
-    // The stream of Items
+    // The log of Items that some subscriber has yet to consume.  Their
+    // serials are consecutive, so a subscriber finds the first Item it
+    // hasn't seen by indexing rather than searching.
     std::deque<std::shared_ptr<const Item>> items;
-    // The subscribers
-    std::vector<std::weak_ptr<Subscriber>> subscribers;
-
+    // The subscribers, which remove themselves when they are destroyed
+    std::unordered_map<const Subscriber*, std::weak_ptr<Subscriber>>
+        subscribers;
+    // The subscribers to notify, built from `subscribers` by the first
+    // enqueue after it changes and shared by those that follow.
+    std::shared_ptr<const SubscriberList> notifyList;
+    // Items are only reclaimed once the log grows past this, which keeps
+    // the cost of finding the slowest subscriber out of most enqueues.
+    size_t gcThreshold{kMinGCThreshold};
+
+    // The lowest serial consumed by every subscriber
+    uint64_t minConsumedSerial() const;
     void collectGarbage();
-    void enqueue(json_ref&& payload);
   };
   folly::Synchronized<state> state_;
+  std::atomic<size_t> numSubscribers_{0};
 
   friend class Subscriber;
 };
@@ -18,6 +18,18 @@ void QueryableView::timeGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("timeGenerator not implemented");
 }
 
+void QueryableView::changeSetGenerator(const Query* query, QueryContext* ctx)
+    const {
+  timeGenerator(query, ctx);
+}
+
+std::optional<bool> QueryableView::anyFileChangedBetween(
+    ClockPosition,
+    ClockPosition,
+    const std::function<bool(w_string_piece, w_string_piece)>&) const {
+  return std::nullopt;
+}
+
 /** Walks files that match the supplied set of paths */
 void QueryableView::pathGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("pathGenerator not implemented");
@@ -35,6 +47,10 @@ uint32_t QueryableView::getLastAgeOutTickValue() const {
   return 0;
 }
 
+std::vector<ClockEpoch> QueryableView::getClockEpochs() const {
+  return {};
+}
+
 std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
     const {
   return std::chrono::system_clock::time_point{};
@@ -42,6 +58,36 @@ std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
 
 void QueryableView::ageOut(PerfSample&, std::chrono::seconds) {}
 
+void QueryableView::addPriorityPaths(const void*, std::vector<w_string>) {}
+void QueryableView::materialize(
+    const std::vector<w_string>&,
+    std::chrono::milliseconds) {}
+
+void QueryableView::hashTrees(
+    const IgnoreSet&,
+    const std::vector<w_string>&,
+    std::chrono::steady_clock::time_point) {}
+
+void QueryableView::markPrioritySynced(const void*) {}
+
+void QueryableView::removePriorityPaths(const void*) {}
+
+bool QueryableView::beginIncompleteRead(const std::shared_ptr<Root>&) {
+  return false;
+}
+
+void QueryableView::endIncompleteRead() {}
+
+json_ref QueryableView::getViewStatus() const {
+  return json_null();
+}
+
+json_ref QueryableView::getMemoryStatus() const {
+  return json_null();
+}
+
+void QueryableView::collectMetrics(MetricsWriter&, const MetricLabels&) const {}
+
 bool QueryableView::isVCSOperationInProgress() const {
   static const std::vector<w_string> lockFiles{".hg/wlock", ".git/index.lock"};
   return doAnyOfTheseFilesExist(lockFiles);
@@ -7,14 +7,18 @@
 
 #pragma once
 
+#include <functional>
 #include <future>
+#include <optional>
 #include <vector>
 #include "watchman/Clock.h"
+#include "watchman/Metrics.h"
 #include "watchman/PerfSample.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
 
+class IgnoreSet;
 struct Query;
 struct QueryContext;
 class Root;
@@ -36,6 +40,27 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    */
   virtual void timeGenerator(const Query* query, QueryContext* ctx) const;
 
+  /**
+   * Produces the same results as timeGenerator.  Views that record the
+   * changes they observe when they settle may serve the query from those,
+   * which suits subscriptions because they are dispatched at settle points.
+   * The default implementation calls timeGenerator.
+   */
+  virtual void changeSetGenerator(const Query* query, QueryContext* ctx) const;
+
+  /**
+   * Calls `visit` with the dir and base name of each file that changed
+   * after `since` and up to `upTo`, which must be the view's position when
+   * it last settled, until `visit` returns true.  Returns whether it did,
+   * or std::nullopt if the view doesn't know which files changed over that
+   * range.  The default implementation doesn't know.
+   */
+  virtual std::optional<bool> anyFileChangedBetween(
+      ClockPosition since,
+      ClockPosition upTo,
+      const std::function<bool(w_string_piece dirName, w_string_piece baseName)>&
+          visit) const;
+
   /**
    * Walks files that match the supplied set of paths.
    */
@@ -48,6 +73,11 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
   virtual ClockPosition getMostRecentRootNumberAndTickValue() const = 0;
   virtual w_string getCurrentClockString() const = 0;
   virtual uint32_t getLastAgeOutTickValue() const;
+  /**
+   * Clocks issued by earlier daemon processes that remain valid for this
+   * view, because it was restored from what they observed.
+   */
+  virtual std::vector<ClockEpoch> getClockEpochs() const;
   virtual std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const;
   virtual void ageOut(PerfSample& sample, std::chrono::seconds minAge);
   virtual void syncToNow(
@@ -55,6 +85,41 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
       std::chrono::milliseconds timeout,
       std::vector<w_string>& cookieFileNames) = 0;
 
+  /**
+   * Called before a query that only finds results beneath the full paths
+   * `paths` synchronizes, so that the view can apply pending changes to them
+   * ahead of unrelated work.  `query` identifies the query to the matching
+   * markPrioritySynced and removePriorityPaths calls.  Views that don't
+   * maintain pending changes ignore these.
+   */
+  virtual void addPriorityPaths(const void* query, std::vector<w_string> paths);
+  virtual void markPrioritySynced(const void* query);
+  virtual void removePriorityPaths(const void* query);
+
+  /**
+   * Called before a query runs with the full paths beneath which it may
+   * find its results, which is the root itself if it may find them
+   * anywhere.  Views that crawl lazily crawl, and start watching, the parts
+   * of these that they have put off, waiting up to `timeout` for that.
+   * Others ignore this.
+   */
+  virtual void materialize(
+      const std::vector<w_string>& paths,
+      std::chrono::milliseconds timeout);
+
+  /**
+   * Called after materialize() with the same paths for a query that
+   * requests content.treesha1hex.  Views that support the field compute the
+   * digests of the dirs beneath the paths that have changed since they were
+   * last computed, waiting until `deadline` at most for files to be hashed.
+   * The dirs that `ignore` lists as VCS dirs are left out of the digests.
+   * Others ignore this.
+   */
+  virtual void hashTrees(
+      const IgnoreSet& ignore,
+      const std::vector<w_string>& paths,
+      std::chrono::steady_clock::time_point deadline);
+
   // Specialized query function that is used to test whether
   // version control files exist as part of some settling handling.
   // It should query the view and return true if any of the named
@@ -72,18 +137,96 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    * Request that helper threads shutdown (but does not join them).
    */
   virtual void stopThreads() {}
+  /**
+   * Waits for the helper threads that stopThreads() asked to shut down to
+   * finish, until deadline.  Returns whether they did.
+   */
+  virtual bool waitForThreadsToStop(
+      std::chrono::steady_clock::time_point /*deadline*/) {
+    return true;
+  }
   /**
    * Request that helper threads wake up and re-evaluate their state.
    */
   virtual void wakeThreads() {}
+  /**
+   * Called when a client stops watching the root, so that a later watch
+   * starts from scratch: removes the view's persisted state, if any,
+   * rather than writing it as the threads stop.
+   */
+  virtual void discardSnapshot() {}
 
   virtual const w_string& getName() const = 0;
   virtual json_ref getWatcherDebugInfo() const = 0;
   virtual void clearWatcherDebugInfo() = 0;
+
+  /**
+   * Returns a JSON value summarizing the state of the view for inclusion in
+   * `debug-status`.  Must be cheap and must not block on the view lock.
+   */
+  virtual json_ref getViewStatus() const;
+
+  /**
+   * Returns a JSON value describing the memory held by the view for
+   * `debug-memory`.  Like getViewStatus(), this must be cheap.
+   */
+  virtual json_ref getMemoryStatus() const;
+
+  /**
+   * Returns the bytes held by the view's own structures that aren't
+   * already counted by MemoryAccounting, for the memory budget.
+   */
+  virtual size_t getMemoryBytes() const {
+    return 0;
+  }
+
+  /**
+   * Gives back memory that can be rebuilt on demand, when the root is idle
+   * or the daemon is over its memory budget.  May be called from any
+   * thread.
+   */
+  virtual void compact() {}
+
+  /**
+   * Destroys up to maxNodes of the view's nodes, so that a view that is no
+   * longer in use can be torn down a little at a time.  Returns the number
+   * destroyed, or 0 once there is nothing left to release.  Queries of the
+   * view see a partial tree after this.
+   */
+  virtual size_t releaseNodes(size_t /*maxNodes*/) {
+    return 0;
+  }
+
+  /**
+   * Adds the view's metrics to `writer`, with `labels` identifying the root.
+   * Like getViewStatus(), this must be cheap.
+   */
+  virtual void collectMetrics(MetricsWriter& writer, const MetricLabels& labels)
+      const;
   virtual std::shared_future<void> waitUntilReadyToQuery(
       const std::shared_ptr<Root>& root) = 0;
 
+  /**
+   * Called instead of syncToNow() and materialize() by a query that accepts
+   * incomplete results.  If the initial crawl of the root is still going,
+   * waits for it to reach a point where it can let the query read the view,
+   * and returns true; the crawl then waits for endIncompleteRead() before
+   * carrying on.  Returns false, and the query must synchronize as usual,
+   * if the view is complete.  Views that aren't crawled always return false.
+   */
+  virtual bool beginIncompleteRead(const std::shared_ptr<Root>& root);
+  virtual void endIncompleteRead();
+
   // Return the SCM detected for this watched root
   virtual SCM* getSCM() const = 0;
+
+  /**
+   * True if this view serves a root that is nested in another watched root
+   * from that root's view, which also holds the files outside of it.  The
+   * root's queries are then confined to its own dir.
+   */
+  virtual bool isSubtreeView() const {
+    return false;
+  }
 };
 } // namespace watchman
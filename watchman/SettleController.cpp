@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleController.h"
+#include <algorithm>
+#include <cmath>
+
+namespace watchman {
+
+namespace {
+// The time constant of the arrival rate average, in seconds
+constexpr double kRateTimeConstant = 1.0;
+} // namespace
+
+SettleController::SettleController(
+    std::chrono::milliseconds minSettle,
+    std::chrono::milliseconds maxSettle,
+    double halfRate)
+    : minSettle_{minSettle},
+      maxSettle_{std::max(minSettle, maxSettle)},
+      halfRate_{halfRate} {}
+
+void SettleController::observe(Clock::time_point now, size_t numChanges) {
+  rate_ = eventRate(now) + double(numChanges) / kRateTimeConstant;
+  lastObserved_ = now;
+  lastBatchSize_ = numChanges;
+}
+
+double SettleController::eventRate(Clock::time_point now) const {
+  if (rate_ == 0) {
+    return 0;
+  }
+  std::chrono::duration<double> elapsed = now - lastObserved_;
+  return rate_ * std::exp(-std::max(0.0, elapsed.count()) / kRateTimeConstant);
+}
+
+std::chrono::milliseconds SettleController::settle(
+    Clock::time_point now) const {
+  auto rate = eventRate(now);
+  double busy;
+  if (halfRate_ > 0) {
+    busy = rate / (rate + halfRate_);
+  } else {
+    busy = rate > 0 ? 1 : 0;
+  }
+  auto range = double((maxSettle_ - minSettle_).count());
+  return minSettle_ + std::chrono::milliseconds(std::lround(range * busy));
+}
+
+} // namespace watchman
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+
+namespace watchman {
+
+/**
+ * Chooses how long the IO thread waits for a root to be quiet before it
+ * considers it settled, based on how quickly changes have recently been
+ * arriving.  A root that sees the occasional change settles after
+ * `minSettle`, so that subscribers hear about it promptly, while one in the
+ * middle of a storm of changes, such as a checkout or a build, waits for up
+ * to `maxSettle` so that subscribers are less likely to be dispatched to
+ * between two bursts of it.
+ *
+ * The arrival rate is an exponentially weighted moving average with a time
+ * constant of one second.  The settle period is interpolated between the
+ * bounds by rate / (rate + halfRate), so it is halfway between them when
+ * changes arrive at `halfRate` per second.
+ *
+ * Not thread safe.
+ */
+class SettleController {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  SettleController(
+      std::chrono::milliseconds minSettle,
+      std::chrono::milliseconds maxSettle,
+      double halfRate);
+
+  // Records that `numChanges` changes were handed to the IO thread at `now`
+  void observe(Clock::time_point now, size_t numChanges);
+
+  // The settle period to use, given what was observed up to `now`
+  std::chrono::milliseconds settle(Clock::time_point now) const;
+
+  // Changes per second, decayed to `now`
+  double eventRate(Clock::time_point now) const;
+
+  // The numChanges of the most recent observe() call
+  size_t lastBatchSize() const {
+    return lastBatchSize_;
+  }
+
+ private:
+  const std::chrono::milliseconds minSettle_;
+  const std::chrono::milliseconds maxSettle_;
+  const double halfRate_;
+
+  double rate_{0};
+  Clock::time_point lastObserved_;
+  size_t lastBatchSize_{0};
+};
+
+} // namespace watchman
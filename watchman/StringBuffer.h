@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A builder for temporary strings, such as the paths that are assembled
+ * only to be looked up or matched and then thrown away.
+ *
+ * The contents live inline until they outgrow kInlineSize bytes, so the
+ * common case costs neither an allocation nor the atomic refcounting of a
+ * w_string.  Paths are typically built by appending a component, using the
+ * result, and then truncating back to the previous size() with resize().
+ *
+ * The contents are always NUL terminated.  The results of view() and
+ * c_str() are invalidated by any modification.
+ */
+class StringBuffer {
+ public:
+  static constexpr size_t kInlineSize = 256;
+
+  StringBuffer() {
+    inline_[0] = 0;
+  }
+
+  StringBuffer(const StringBuffer&) = delete;
+  StringBuffer& operator=(const StringBuffer&) = delete;
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  const char* data() const {
+    return data_;
+  }
+
+  const char* c_str() const {
+    return data_;
+  }
+
+  w_string_piece view() const {
+    return w_string_piece(data_, size_);
+  }
+
+  w_string asWString() const {
+    return w_string{data_, size_};
+  }
+
+  void append(w_string_piece str) {
+    reserve(size_ + str.size());
+    memcpy(data_ + size_, str.data(), str.size());
+    size_ += str.size();
+    data_[size_] = 0;
+  }
+
+  void push_back(char c) {
+    reserve(size_ + 1);
+    data_[size_++] = c;
+    data_[size_] = 0;
+  }
+
+  /**
+   * Appends a path separator, unless the buffer is empty, followed by
+   * component.
+   */
+  void appendComponent(w_string_piece component) {
+    if (size_) {
+      push_back('/');
+    }
+    append(component);
+  }
+
+  // Truncates the contents to their first size bytes
+  void resize(size_t size) {
+    assert(size <= size_);
+    size_ = size;
+    data_[size_] = 0;
+  }
+
+  void clear() {
+    resize(0);
+  }
+
+ private:
+  void reserve(size_t size) {
+    if (size < capacity_) {
+      return;
+    }
+    auto capacity = std::max(capacity_ * 2, size + 1);
+    auto heap = std::make_unique<char[]>(capacity);
+    memcpy(heap.get(), data_, size_ + 1);
+    heap_ = std::move(heap);
+    data_ = heap_.get();
+    capacity_ = capacity;
+  }
+
+  char inline_[kInlineSize];
+  std::unique_ptr<char[]> heap_;
+  char* data_{inline_};
+  size_t size_{0};
+  // Includes the space for the NUL terminator
+  size_t capacity_{kInlineSize};
+};
+
+} // namespace watchman
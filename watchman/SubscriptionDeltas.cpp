@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionDeltas.h"
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+
+namespace watchman {
+
+namespace {
+
+// Folds value into hash, then scrambles the result with the finalizer of
+// splitmix64, so that nearby values don't collide
+uint64_t mix(uint64_t hash, uint64_t value) {
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+uint64_t hashString(const w_string& str) {
+  return std::hash<std::string_view>{}(
+      std::string_view{str.data(), str.size()});
+}
+
+uint64_t hashValue(const json_ref& value) {
+  uint64_t hash = mix(0, uint64_t(value.type()));
+  switch (value.type()) {
+    case JSON_STRING:
+      return mix(hash, hashString(value.asString()));
+    case JSON_INTEGER:
+      return mix(hash, uint64_t(value.asInt()));
+    case JSON_REAL: {
+      auto real = json_real_value(value);
+      uint64_t bits;
+      static_assert(sizeof(bits) == sizeof(real), "doubles are 64 bits");
+      memcpy(&bits, &real, sizeof(bits));
+      return mix(hash, bits);
+    }
+    case JSON_ARRAY:
+      for (auto& item : value.array()) {
+        hash = mix(hash, hashValue(item));
+      }
+      return hash;
+    case JSON_OBJECT: {
+      // Combined so that the order of the members doesn't matter
+      uint64_t members = 0;
+      for (auto& [key, item] : value.object()) {
+        members += mix(hashString(key), hashValue(item));
+      }
+      return mix(hash, members);
+    }
+    default:
+      return hash;
+  }
+}
+
+// Stands in for the hash of a field that a file doesn't have
+constexpr uint64_t kMissing = 0;
+
+} // namespace
+
+SubscriptionDeltas::SubscriptionDeltas(std::vector<w_string> fields)
+    : fields_(std::move(fields)) {
+  bool haveName = false;
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i] == w_string_piece{"name"}) {
+      nameIndex_ = i;
+      haveName = true;
+    } else if (fields_[i] == w_string_piece{"exists"}) {
+      existsIndex_ = i;
+    }
+  }
+  if (!haveName) {
+    throw std::invalid_argument("the fields must include \"name\"");
+  }
+}
+
+json_ref SubscriptionDeltas::encode(const json_ref& files) {
+  auto encoded = json_array_of_size(json_array_size(files));
+  std::vector<uint64_t> hashes(fields_.size());
+  uint64_t elided = 0;
+  for (auto& file : files.array()) {
+    auto& members = file.object();
+    auto nameIt = members.find(fields_[nameIndex_]);
+    if (nameIt == members.end() || !nameIt->second.isString()) {
+      // Nothing to recognize it by next time
+      encoded.array().push_back(file);
+      continue;
+    }
+    auto name = json_to_w_string(nameIt->second);
+
+    for (size_t i = 0; i < fields_.size(); ++i) {
+      auto it = members.find(fields_[i]);
+      hashes[i] = it == members.end() ? kMissing : hashValue(it->second);
+    }
+
+    auto [previous, isNew] = delivered_.try_emplace(name);
+    auto delta = json_object();
+    for (size_t i = 0; i < fields_.size(); ++i) {
+      if (i == nameIndex_ || (!isNew && previous->second[i] == hashes[i])) {
+        continue;
+      }
+      auto it = members.find(fields_[i]);
+      if (it != members.end()) {
+        delta.set(fields_[i], json_ref(it->second));
+      }
+    }
+
+    // Less the name, which is always sent
+    elided += fields_.size() - 1 - delta.object().size();
+    if (!isNew && delta.object().empty()) {
+      // The client already has exactly this
+      ++elided;
+      continue;
+    }
+    delta.set(fields_[nameIndex_], json_ref(nameIt->second));
+    encoded.array().push_back(std::move(delta));
+
+    auto exists = existsIndex_
+        ? members.find(fields_[*existsIndex_])
+        : members.end();
+    if (exists != members.end() && exists->second.isBool() &&
+        !exists->second.asBool()) {
+      delivered_.erase(previous);
+    } else {
+      previous->second = hashes;
+    }
+  }
+
+  elidedFields_.fetch_add(elided, std::memory_order_relaxed);
+  if (auto templ = json_array_get_template(files)) {
+    json_array_set_template(encoded, templ);
+  }
+  return encoded;
+}
+
+} // namespace watchman
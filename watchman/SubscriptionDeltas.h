@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers what a subscription last delivered for each file, so that its
+ * later results need only carry the fields whose values differ from that.
+ * A client that requests many fields otherwise receives every one of them
+ * each time that a file changes, even when only its mtime did, and again
+ * each time that a file which flaps back to what it was is reported.
+ *
+ * Only a hash of the value of each field is kept, keyed by the file's
+ * name.  A file that is delivered as deleted is forgotten, so that one that
+ * is created again is delivered whole.
+ *
+ * Not thread safe; the subscription's client thread owns it.
+ */
+class SubscriptionDeltas {
+ public:
+  // fields are the names of the fields of the results, which must include
+  // "name"
+  explicit SubscriptionDeltas(std::vector<w_string> fields);
+
+  /**
+   * Returns a copy of files, an array of the results for the fields, in
+   * which each file has only its name and the fields whose values differ
+   * from those last delivered for it.  A file for which none do is left
+   * out altogether.  Records what is returned as delivered.
+   */
+  json_ref encode(const json_ref& files);
+
+  // Forgets everything that was delivered, so that every file is next
+  // delivered whole; for when the client starts over
+  void reset() {
+    delivered_.clear();
+  }
+
+  // The number of files whose delivered fields are remembered
+  size_t size() const {
+    return delivered_.size();
+  }
+
+  // How many fields encode() has left out, counting every field of the
+  // files that it left out altogether.  May be read from any thread.
+  uint64_t elidedFields() const {
+    return elidedFields_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const std::vector<w_string> fields_;
+  size_t nameIndex_{0};
+  std::optional<size_t> existsIndex_;
+  // The hash of each of fields_ as last delivered, by file name
+  std::unordered_map<w_string, std::vector<uint64_t>> delivered_;
+  std::atomic<uint64_t> elidedFields_{0};
+};
+
+} // namespace watchman
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionDispatcher.h"
+#include <algorithm>
+#include <thread>
+#include "watchman/Metrics.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+MetricsCollectorRegistration subscriptionDispatchMetrics(
+    "subscription_dispatch",
+    [](MetricsWriter& writer) {
+      auto& dispatcher = getSubscriptionDispatcher();
+      auto stats = dispatcher.getStats();
+      writer.add(
+          "watchman_subscription_dispatch_running",
+          MetricType::Gauge,
+          "Subscription queries that hold a dispatch slot",
+          {},
+          stats.running);
+      writer.add(
+          "watchman_subscription_dispatch_waiting",
+          MetricType::Gauge,
+          "Subscription queries that are waiting for a dispatch slot",
+          {},
+          stats.waiting);
+      writer.add(
+          "watchman_subscription_dispatches",
+          MetricType::Counter,
+          "Subscription queries dispatched, by whether they had to wait",
+          {{"waited", "false"}},
+          stats.dispatched - stats.waited);
+      writer.add(
+          "watchman_subscription_dispatches",
+          MetricType::Counter,
+          "Subscription queries dispatched, by whether they had to wait",
+          {{"waited", "true"}},
+          stats.waited);
+
+      static const std::pair<double, const char*> quantiles[] = {
+          {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+      auto latency = dispatcher.getWaitLatency();
+      for (auto& [quantile, name] : quantiles) {
+        writer.add(
+            "watchman_subscription_dispatch_wait_seconds",
+            MetricType::Gauge,
+            "Percentiles of the time that subscription queries waited to run",
+            {{"quantile", name}},
+            latency.percentile(quantile).count() / 1e6);
+      }
+    });
+
+} // namespace
+
+SubscriptionDispatcher::Slot& SubscriptionDispatcher::Slot::operator=(
+    Slot&& other) noexcept {
+  if (this != &other) {
+    if (owner_) {
+      owner_->release();
+    }
+    owner_ = other.owner_;
+    other.owner_ = nullptr;
+  }
+  return *this;
+}
+
+SubscriptionDispatcher::Slot::~Slot() {
+  if (owner_) {
+    owner_->release();
+  }
+}
+
+SubscriptionDispatcher::Slot SubscriptionDispatcher::acquire(
+    Priority priority,
+    std::chrono::microseconds cost) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto hasSlot = [&] {
+    return maxConcurrent_ == 0 || stats_.running < maxConcurrent_;
+  };
+
+  // Waiters go first so that a steady stream of new queries can't starve
+  // them
+  if (waiting_.empty() && hasSlot()) {
+    ++stats_.running;
+    ++stats_.dispatched;
+    return Slot{this};
+  }
+
+  auto start = Clock::now();
+  Waiter self{priority, cost.count(), nextSerial_++};
+  waiting_.insert(self);
+  stats_.waiting = waiting_.size();
+  slotFreed_.wait(
+      lock, [&] { return hasSlot() && *waiting_.begin() == self; });
+  waiting_.erase(waiting_.begin());
+  stats_.waiting = waiting_.size();
+  ++stats_.running;
+  ++stats_.dispatched;
+  ++stats_.waited;
+  bool more = !waiting_.empty() && hasSlot();
+  lock.unlock();
+
+  waitLatency_.record(std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - start));
+  if (more) {
+    // The waiters that looked before this one left the queue went back to
+    // waiting, and the one that is now first may be able to run too
+    slotFreed_.notify_all();
+  }
+  return Slot{this};
+}
+
+void SubscriptionDispatcher::release() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --stats_.running;
+  }
+  // Only the first of the waiters can take the slot, and any of them may
+  // be it
+  slotFreed_.notify_all();
+}
+
+SubscriptionDispatcher::Stats SubscriptionDispatcher::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+SubscriptionDispatcher& getSubscriptionDispatcher() {
+  // Never destroyed, since client threads may still be dispatching during
+  // static destruction
+  static auto* dispatcher = new SubscriptionDispatcher(size_t(std::max(
+      json_int_t(0),
+      Configuration().getInt(
+          "subscription_dispatch_max_concurrent",
+          std::max<json_int_t>(2, std::thread::hardware_concurrency() / 2)))));
+  return *dispatcher;
+}
+
+} // namespace watchman
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include "watchman/LatencyHistogram.h"
+
+namespace watchman {
+
+/**
+ * Bounds how many subscription queries the daemon evaluates at once.
+ *
+ * When a root settles, every client thread with a subscription on it wakes
+ * up and runs its query.  Left alone they all contend for the view's lock
+ * and the content caches at the same moment, which slows every one of them
+ * down and keeps the IO thread waiting for the write lock.  Instead, each
+ * query takes a slot before it runs, and when none is free, the waiting
+ * queries go in order of their priority, and then of their expected cost,
+ * so that the subscriptions that are latency sensitive or quick to answer
+ * are delivered first.  Queries of the same priority and cost go in the
+ * order that they arrived.
+ *
+ * Unlike the AdmissionController, nothing is turned away: a settle that
+ * isn't evaluated would leave the subscriber without its results.
+ *
+ * Thread safe.
+ */
+class SubscriptionDispatcher {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // In the same order as the ThreadPool's: higher priorities first
+  enum class Priority : uint8_t { High, Normal, Low };
+
+  struct Stats {
+    size_t running{0};
+    size_t waiting{0};
+    uint64_t dispatched{0};
+    // Of dispatched, those that had to wait for a slot
+    uint64_t waited{0};
+  };
+
+  // Holds a slot until it is destroyed
+  class Slot {
+   public:
+    Slot() = default;
+    Slot(Slot&& other) noexcept : owner_{other.owner_} {
+      other.owner_ = nullptr;
+    }
+    Slot& operator=(Slot&& other) noexcept;
+    Slot(const Slot&) = delete;
+    Slot& operator=(const Slot&) = delete;
+    ~Slot();
+
+   private:
+    friend class SubscriptionDispatcher;
+    explicit Slot(SubscriptionDispatcher* owner) : owner_{owner} {}
+
+    SubscriptionDispatcher* owner_{nullptr};
+  };
+
+  // 0 means that any number of queries may run at once
+  explicit SubscriptionDispatcher(size_t maxConcurrent)
+      : maxConcurrent_{maxConcurrent} {}
+
+  /**
+   * Blocks until a subscription query of the given priority, which is
+   * expected to take `cost` to run, may run.  That is when a slot is free
+   * and no waiting query comes before it.
+   */
+  Slot acquire(Priority priority, std::chrono::microseconds cost);
+
+  Stats getStats() const;
+
+  // How long the queries that were dispatched waited for their slots
+  LatencyHistogram::Snapshot getWaitLatency() const {
+    return waitLatency_.snapshot();
+  }
+
+  size_t getMaxConcurrent() const {
+    return maxConcurrent_;
+  }
+
+ private:
+  // Ordered so that the next query to run is first
+  struct Waiter {
+    Priority priority;
+    int64_t costMicros;
+    uint64_t serial;
+
+    bool operator<(const Waiter& other) const {
+      return std::tie(priority, costMicros, serial) <
+          std::tie(other.priority, other.costMicros, other.serial);
+    }
+    bool operator==(const Waiter& other) const {
+      return serial == other.serial;
+    }
+  };
+
+  void release();
+
+  const size_t maxConcurrent_;
+  mutable std::mutex mutex_;
+  std::condition_variable slotFreed_;
+  std::set<Waiter> waiting_;
+  uint64_t nextSerial_{0};
+  Stats stats_;
+  LatencyHistogram waitLatency_;
+};
+
+// The dispatcher of the daemon, configured by
+// subscription_dispatch_max_concurrent
+SubscriptionDispatcher& getSubscriptionDispatcher();
+
+} // namespace watchman
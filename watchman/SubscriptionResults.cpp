@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionResults.h"
+#include <unordered_map>
+
+namespace watchman {
+
+bool isSubscriptionResults(const json_ref& resp) {
+  return resp.get_default("files") && !resp.get_default("state-enter") &&
+      !resp.get_default("state-leave") && !resp.get_default("canceled");
+}
+
+json_ref mergeSubscriptionResults(
+    const json_ref& older,
+    const json_ref& newer,
+    bool namesOnly,
+    bool deltas) {
+  auto nameOf = [namesOnly](const json_ref& file) {
+    return json_to_w_string(namesOnly ? file : file.get("name"));
+  };
+
+  const auto& olderFiles = older.get("files");
+  const auto& newerFiles = newer.get("files");
+  auto files = json_array_of_size(
+      json_array_size(olderFiles) + json_array_size(newerFiles));
+  auto& merged = files.array();
+  std::unordered_map<w_string, size_t> indexByName;
+  for (auto& file : olderFiles.array()) {
+    indexByName.emplace(nameOf(file), merged.size());
+    merged.push_back(file);
+  }
+  for (auto& file : newerFiles.array()) {
+    auto [it, inserted] = indexByName.emplace(nameOf(file), merged.size());
+    if (inserted) {
+      merged.push_back(file);
+      continue;
+    }
+    auto& existing = merged[it->second];
+    // A file that is new relative to the older results' since is still new
+    // relative to it, whatever the newer results say
+    auto wasNew = namesOnly ? nullptr : existing.get_default("new");
+    if (deltas) {
+      auto combined = json_copy(existing);
+      for (auto& [key, value] : file.object()) {
+        combined.set(key, json_ref(value));
+      }
+      existing = std::move(combined);
+    } else {
+      existing = file;
+    }
+    if (wasNew && wasNew.asBool() && file.get_default("new")) {
+      if (!deltas) {
+        existing = json_copy(existing);
+      }
+      existing.set("new", json_true());
+    }
+  }
+  if (auto templ = json_array_get_template(newerFiles)) {
+    json_array_set_template(files, templ);
+  }
+
+  // The entries are shared with other subscriptions, so copy rather than
+  // modify them
+  auto result = json_copy(newer);
+  result.set(
+      {{"files", std::move(files)},
+       {"is_fresh_instance",
+        json_boolean(
+            older.get("is_fresh_instance").asBool() ||
+            newer.get("is_fresh_instance").asBool())}});
+  if (auto since = older.get_default("since")) {
+    result.set("since", since);
+  } else {
+    result.object().erase(w_string("since", W_STRING_UNICODE));
+  }
+  return result;
+}
+
+json_ref freshInstanceMarker(const json_ref& newer) {
+  auto result = json_copy(newer);
+  result.set({{"files", json_array()}, {"is_fresh_instance", json_true()}});
+  result.object().erase(w_string("since", W_STRING_UNICODE));
+  return result;
+}
+
+} // namespace watchman
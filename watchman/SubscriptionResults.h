@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * Returns true if resp is a set of subscription results, rather than a
+ * notification of a state change or of the subscription being canceled.
+ */
+bool isSubscriptionResults(const json_ref& resp);
+
+/**
+ * Returns a response that covers both `older` results, which are still
+ * queued for the client, and the `newer` results that follow them: the
+ * union of their files, the newer entry winning for a file in both, as of
+ * the newer clock.  A file that is new relative to the older results'
+ * since stays new.
+ *
+ * The files are told apart by name, so they must either be bare names
+ * (namesOnly) or objects with a "name" field.  With deltas, each entry only
+ * has the fields that changed, so those of both entries for a file are
+ * combined.  Neither input is modified.
+ */
+json_ref mergeSubscriptionResults(
+    const json_ref& older,
+    const json_ref& newer,
+    bool namesOnly,
+    bool deltas);
+
+/**
+ * Returns a fresh instance result with no files in place of newer, for
+ * clients that set empty_on_fresh_instance and so know to query afresh.
+ */
+json_ref freshInstanceMarker(const json_ref& newer);
+
+} // namespace watchman
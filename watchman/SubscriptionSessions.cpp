@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionSessions.h"
+#include <folly/Random.h>
+
+namespace watchman {
+
+SubscriptionSessions::SubscriptionSessions(size_t maxSessions)
+    : maxSessions_(maxSessions) {}
+
+w_string SubscriptionSessions::newToken() {
+  // The subscribe command is open to any user, so a token mustn't be
+  // something that another client could guess and resume in its place
+  return w_string::format(
+      "{:016x}{:016x}",
+      folly::Random::secureRand64(),
+      folly::Random::secureRand64());
+}
+
+json_ref SubscriptionSessions::withoutToken(const json_ref& query) {
+  if (!query.isObject() || !query.get_default("resume_token")) {
+    return query;
+  }
+  auto copy = json_copy(query);
+  json_object_del(copy, "resume_token");
+  return copy;
+}
+
+void SubscriptionSessions::expire(
+    State& state,
+    Clock::time_point now,
+    size_t keep) {
+  for (auto it = state.order.begin(); it != state.order.end();) {
+    auto entry = state.sessions.find(*it);
+    if (state.sessions.size() > keep || entry->second.deadline <= now) {
+      state.sessions.erase(entry);
+      it = state.order.erase(it);
+      ++state.expired;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void SubscriptionSessions::detach(
+    const w_string& token,
+    Session session,
+    std::chrono::seconds grace,
+    Clock::time_point now) {
+  if (maxSessions_ == 0 || grace.count() <= 0) {
+    return;
+  }
+  auto state = state_.wlock();
+  auto existing = state->sessions.find(token);
+  if (existing != state->sessions.end()) {
+    state->order.erase(existing->second.order);
+    state->sessions.erase(existing);
+  }
+  expire(*state, now, maxSessions_ - 1);
+  state->order.push_back(token);
+  state->sessions.emplace(
+      token,
+      Entry{std::move(session), now + grace, std::prev(state->order.end())});
+}
+
+json_ref SubscriptionSessions::resume(
+    const w_string& token,
+    const w_string& rootPath,
+    const w_string& name,
+    const json_ref& query,
+    Clock::time_point now) {
+  auto state = state_.wlock();
+  expire(*state, now, maxSessions_);
+  auto it = state->sessions.find(token);
+  if (it == state->sessions.end()) {
+    return nullptr;
+  }
+  auto session = std::move(it->second.session);
+  state->order.erase(it->second.order);
+  state->sessions.erase(it);
+
+  if (session.rootPath != rootPath || session.name != name ||
+      !json_equal(session.query, withoutToken(query))) {
+    // The results of a different query since the clock aren't the changes
+    // to those that the client was sent
+    return nullptr;
+  }
+  ++state->resumed;
+  return session.clock;
+}
+
+SubscriptionSessions& getSubscriptionSessions() {
+  static SubscriptionSessions sessions{1024};
+  return sessions;
+}
+
+} // namespace watchman
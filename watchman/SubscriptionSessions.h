@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Keeps the subscriptions of clients that have disconnected for a grace
+ * period, so that a client that restarts, or whose socket drops, can
+ * resubscribe where it left off and receive only the files that changed
+ * since the results it was last sent, rather than every file that
+ * matches again.
+ *
+ * A subscription that may be resumed is given an unguessable token when it
+ * is made.  When its client disconnects, what it last delivered is kept
+ * here under the token, and a subscribe that presents the token takes it.
+ * A session is only resumed by a subscription of the same name, root and
+ * query, and only once.
+ */
+class SubscriptionSessions {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Session {
+    w_string rootPath;
+    w_string name;
+    // The query, without its resume_token
+    json_ref query;
+    // The clock of the last results that were written to the client
+    json_ref clock;
+  };
+
+  explicit SubscriptionSessions(size_t maxSessions);
+
+  // Returns a new token for a subscription
+  static w_string newToken();
+
+  // Returns a copy of query without the resume_token that the client
+  // presented, for comparing queries
+  static json_ref withoutToken(const json_ref& query);
+
+  /**
+   * Keeps session under token until grace has passed.  The oldest session
+   * is dropped if there would be more than maxSessions.
+   */
+  void detach(
+      const w_string& token,
+      Session session,
+      std::chrono::seconds grace,
+      Clock::time_point now = Clock::now());
+
+  /**
+   * Takes the session kept under token and returns the clock from which
+   * it may be resumed, provided that it has the same root, name and query.
+   * Returns null if there is no such session, in which case the client
+   * must be sent its results afresh.
+   */
+  json_ref resume(
+      const w_string& token,
+      const w_string& rootPath,
+      const w_string& name,
+      const json_ref& query,
+      Clock::time_point now = Clock::now());
+
+  // The number of sessions that are kept, including those that have
+  // expired but not been dropped yet
+  size_t size() const {
+    return state_.rlock()->sessions.size();
+  }
+
+  // How many sessions were resumed, and how many expired or were dropped
+  // to make room
+  uint64_t resumed() const {
+    return state_.rlock()->resumed;
+  }
+  uint64_t expired() const {
+    return state_.rlock()->expired;
+  }
+
+ private:
+  struct Entry {
+    Session session;
+    Clock::time_point deadline;
+    // Its position in State::order
+    std::list<w_string>::iterator order;
+  };
+  struct State {
+    std::unordered_map<w_string, Entry> sessions;
+    // Tokens in the order that their sessions were detached
+    std::list<w_string> order;
+    uint64_t resumed{0};
+    uint64_t expired{0};
+  };
+
+  // Drops the sessions whose grace has passed, and the oldest of the rest
+  // while there are more than `keep`
+  void expire(State& state, Clock::time_point now, size_t keep);
+
+  const size_t maxSessions_;
+  folly::Synchronized<State> state_;
+};
+
+// The sessions of every client of this process
+SubscriptionSessions& getSubscriptionSessions();
+
+} // namespace watchman
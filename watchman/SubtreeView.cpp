@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubtreeView.h"
+#include "watchman/root/Root.h"
+
+namespace watchman {
+
+SubtreeView::SubtreeView(std::shared_ptr<Root> parent, w_string path)
+    : QueryableView{false},
+      parent_{std::move(parent)},
+      path_{std::move(path)} {}
+
+void SubtreeView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  parent_->view()->timeGenerator(query, ctx);
+}
+
+void SubtreeView::changeSetGenerator(const Query* query, QueryContext* ctx)
+    const {
+  parent_->view()->changeSetGenerator(query, ctx);
+}
+
+std::optional<bool> SubtreeView::anyFileChangedBetween(
+    ClockPosition since,
+    ClockPosition upTo,
+    const std::function<bool(w_string_piece, w_string_piece)>& visit) const {
+  return parent_->view()->anyFileChangedBetween(
+      since, upTo, [&](w_string_piece dirName, w_string_piece baseName) {
+        // Only changes beneath the nested root count
+        return (dirName == path_ ||
+                (dirName.size() > path_.size() && dirName.startsWith(path_) &&
+                 is_slash(dirName.data()[path_.size()]))) &&
+            visit(dirName, baseName);
+      });
+}
+
+void SubtreeView::pathGenerator(const Query* query, QueryContext* ctx) const {
+  parent_->view()->pathGenerator(query, ctx);
+}
+
+void SubtreeView::globGenerator(const Query* query, QueryContext* ctx) const {
+  parent_->view()->globGenerator(query, ctx);
+}
+
+void SubtreeView::allFilesGenerator(const Query* query, QueryContext* ctx)
+    const {
+  parent_->view()->allFilesGenerator(query, ctx);
+}
+
+ClockPosition SubtreeView::getMostRecentRootNumberAndTickValue() const {
+  return parent_->view()->getMostRecentRootNumberAndTickValue();
+}
+
+w_string SubtreeView::getCurrentClockString() const {
+  return parent_->view()->getCurrentClockString();
+}
+
+uint32_t SubtreeView::getLastAgeOutTickValue() const {
+  return parent_->view()->getLastAgeOutTickValue();
+}
+
+std::vector<ClockEpoch> SubtreeView::getClockEpochs() const {
+  return parent_->view()->getClockEpochs();
+}
+
+std::chrono::system_clock::time_point SubtreeView::getLastAgeOutTimeStamp()
+    const {
+  return parent_->view()->getLastAgeOutTimeStamp();
+}
+
+void SubtreeView::syncToNow(
+    const std::shared_ptr<Root>&,
+    std::chrono::milliseconds timeout,
+    std::vector<w_string>& cookieFileNames) {
+  // The enclosing root's IO thread only looks for its own cookies
+  parent_->view()->syncToNow(parent_, timeout, cookieFileNames);
+}
+
+void SubtreeView::addPriorityPaths(
+    const void* query,
+    std::vector<w_string> paths) {
+  parent_->view()->addPriorityPaths(query, std::move(paths));
+}
+
+void SubtreeView::markPrioritySynced(const void* query) {
+  parent_->view()->markPrioritySynced(query);
+}
+
+void SubtreeView::removePriorityPaths(const void* query) {
+  parent_->view()->removePriorityPaths(query);
+}
+
+void SubtreeView::materialize(
+    const std::vector<w_string>& paths,
+    std::chrono::milliseconds timeout) {
+  parent_->view()->materialize(paths, timeout);
+}
+
+void SubtreeView::hashTrees(
+    const IgnoreSet& ignore,
+    const std::vector<w_string>& paths,
+    std::chrono::steady_clock::time_point deadline) {
+  parent_->view()->hashTrees(ignore, paths, deadline);
+}
+
+bool SubtreeView::doAnyOfTheseFilesExist(
+    const std::vector<w_string>& fileNames) const {
+  return parent_->view()->doAnyOfTheseFilesExist(fileNames);
+}
+
+void SubtreeView::startThreads(const std::shared_ptr<Root>& root) {
+  std::weak_ptr<QueryableView> selfRef = shared_from_this();
+  std::weak_ptr<Root> rootRef = root;
+  auto forward = [selfRef, rootRef] {
+    auto self = std::static_pointer_cast<SubtreeView>(selfRef.lock());
+    auto root = rootRef.lock();
+    if (!self || !root) {
+      return;
+    }
+
+    std::vector<std::shared_ptr<const Publisher::Item>> pending;
+    {
+      auto forwarder = self->forwarder_.rlock();
+      if (!*forwarder) {
+        return;
+      }
+      (*forwarder)->getPending(pending);
+    }
+    for (auto& item : pending) {
+      if (item->payload.get_default("canceled")) {
+        root->cancel();
+      } else if (item->payload.get_default("settled")) {
+        root->unilateralResponses->enqueue(
+            json_object({{"settled", json_true()}}));
+      }
+    }
+  };
+
+  *forwarder_.wlock() = parent_->unilateralResponses->subscribe(
+      std::move(forward),
+      json_object({{"subtree", w_string_to_json(root->root_path)}}));
+}
+
+void SubtreeView::stopThreads() {
+  forwarder_.wlock()->reset();
+}
+
+const w_string& SubtreeView::getName() const {
+  return parent_->view()->getName();
+}
+
+json_ref SubtreeView::getWatcherDebugInfo() const {
+  return parent_->view()->getWatcherDebugInfo();
+}
+
+void SubtreeView::clearWatcherDebugInfo() {
+  parent_->view()->clearWatcherDebugInfo();
+}
+
+json_ref SubtreeView::getViewStatus() const {
+  return json_object({{"subtree_of", w_string_to_json(parent_->root_path)}});
+}
+
+std::shared_future<void> SubtreeView::waitUntilReadyToQuery(
+    const std::shared_ptr<Root>&) {
+  return parent_->view()->waitUntilReadyToQuery(parent_);
+}
+
+bool SubtreeView::beginIncompleteRead(const std::shared_ptr<Root>&) {
+  return parent_->view()->beginIncompleteRead(parent_);
+}
+
+void SubtreeView::endIncompleteRead() {
+  parent_->view()->endIncompleteRead();
+}
+
+SCM* SubtreeView::getSCM() const {
+  return parent_->view()->getSCM();
+}
+
+} // namespace watchman
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include "watchman/PubSub.h"
+#include "watchman/QueryableView.h"
+
+namespace watchman {
+
+/**
+ * Serves a root that is nested inside another watched root from the view of
+ * that enclosing root, so that watching both crawls and stores the nested
+ * dir only once.  It shares the enclosing root's clock, so the clocks of
+ * either root are good for both.  Its queries are confined to its own dir
+ * by giving them an implicit relative_root.
+ *
+ * The enclosing root's threads do the crawling and watching.  Its settle
+ * notifications are forwarded to the nested root so that subscriptions and
+ * triggers on it fire, and the nested root is cancelled along with it.
+ */
+class SubtreeView final : public QueryableView {
+ public:
+  // `path` is the nested root's path beneath the parent's
+  SubtreeView(std::shared_ptr<Root> parent, w_string path);
+
+  const std::shared_ptr<Root>& getParent() const {
+    return parent_;
+  }
+
+  void timeGenerator(const Query* query, QueryContext* ctx) const override;
+  void changeSetGenerator(const Query* query, QueryContext* ctx)
+      const override;
+  std::optional<bool> anyFileChangedBetween(
+      ClockPosition since,
+      ClockPosition upTo,
+      const std::function<bool(w_string_piece, w_string_piece)>& visit)
+      const override;
+  void pathGenerator(const Query* query, QueryContext* ctx) const override;
+  void globGenerator(const Query* query, QueryContext* ctx) const override;
+  void allFilesGenerator(const Query* query, QueryContext* ctx)
+      const override;
+
+  ClockPosition getMostRecentRootNumberAndTickValue() const override;
+  w_string getCurrentClockString() const override;
+  uint32_t getLastAgeOutTickValue() const override;
+  std::vector<ClockEpoch> getClockEpochs() const override;
+  std::chrono::system_clock::time_point getLastAgeOutTimeStamp()
+      const override;
+
+  void syncToNow(
+      const std::shared_ptr<Root>& root,
+      std::chrono::milliseconds timeout,
+      std::vector<w_string>& cookieFileNames) override;
+
+  void addPriorityPaths(const void* query, std::vector<w_string> paths)
+      override;
+  void markPrioritySynced(const void* query) override;
+  void removePriorityPaths(const void* query) override;
+  void materialize(
+      const std::vector<w_string>& paths,
+      std::chrono::milliseconds timeout) override;
+  void hashTrees(
+      const IgnoreSet& ignore,
+      const std::vector<w_string>& paths,
+      std::chrono::steady_clock::time_point deadline) override;
+
+  bool doAnyOfTheseFilesExist(
+      const std::vector<w_string>& fileNames) const override;
+
+  void startThreads(const std::shared_ptr<Root>& root) override;
+  void stopThreads() override;
+
+  const w_string& getName() const override;
+  json_ref getWatcherDebugInfo() const override;
+  void clearWatcherDebugInfo() override;
+  json_ref getViewStatus() const override;
+
+  std::shared_future<void> waitUntilReadyToQuery(
+      const std::shared_ptr<Root>& root) override;
+  bool beginIncompleteRead(const std::shared_ptr<Root>& root) override;
+  void endIncompleteRead() override;
+
+  SCM* getSCM() const override;
+
+  bool isSubtreeView() const override {
+    return true;
+  }
+
+ private:
+  const std::shared_ptr<Root> parent_;
+  const w_string path_;
+  // Forwards the enclosing root's unilateral responses to the nested one
+  folly::Synchronized<std::shared_ptr<Publisher::Subscriber>> forwarder_;
+};
+
+} // namespace watchman
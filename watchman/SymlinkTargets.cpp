@@ -29,8 +29,10 @@ std::size_t SymlinkTargetCacheKey::hashValue() const {
 SymlinkTargetCache::SymlinkTargetCache(
     const w_string& rootPath,
     size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+    std::chrono::milliseconds errorTTL,
+    size_t numShards)
+    : cache_(maxItems, errorTTL, std::chrono::seconds(300), numShards),
+      rootPath_(rootPath) {}
 
 folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
     const SymlinkTargetCacheKey& key) {
@@ -38,6 +40,15 @@ folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
       key, [this](const SymlinkTargetCacheKey& k) { return readLink(k); });
 }
 
+void SymlinkTargetCache::prefetch(const SymlinkTargetCacheKey& key) {
+  // Go through the getter so that a concurrent query for the same link
+  // shares our read rather than racing it; the future is ready by the time
+  // get() returns, as is any error, which is cached like a lazy one.
+  (void)cache_.get(key, [this](const SymlinkTargetCacheKey& k) {
+    return folly::makeFutureWith([&] { return readLinkImmediate(k); });
+  });
+}
+
 w_string SymlinkTargetCache::readLinkImmediate(
     const SymlinkTargetCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
@@ -47,7 +58,7 @@ w_string SymlinkTargetCache::readLinkImmediate(
 folly::Future<w_string> SymlinkTargetCache::readLink(
     const SymlinkTargetCacheKey& key) const {
   return folly::makeFuture(key)
-      .via(&getThreadPool())
+      .via(getThreadPool().executor(ThreadPool::Priority::High))
       .thenValue(
           [this](SymlinkTargetCacheKey key) { return readLinkImmediate(key); });
 }
@@ -56,6 +67,14 @@ const w_string& SymlinkTargetCache::rootPath() const {
   return rootPath_;
 }
 
+size_t SymlinkTargetCache::size() const {
+  return cache_.size();
+}
+
+void SymlinkTargetCache::clear() {
+  cache_.clear();
+}
+
 CacheStats SymlinkTargetCache::stats() const {
   return cache_.stats();
 }
@@ -42,11 +42,13 @@ class SymlinkTargetCache {
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
+  // caching TTL.  The cache is split into numShards independently
+  // locked LRUCache shards.
   SymlinkTargetCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      size_t numShards = 1);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
@@ -56,6 +58,11 @@ class SymlinkTargetCache {
   folly::Future<std::shared_ptr<const Node>> get(
       const SymlinkTargetCacheKey& key);
 
+  // Read the symlink target on the calling thread and cache it, unless it
+  // is already cached or being read.  Used to populate the cache as links
+  // are discovered, so that queries don't have to wait for them.
+  void prefetch(const SymlinkTargetCacheKey& key);
+
   // Read the symlink target.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
@@ -68,6 +75,12 @@ class SymlinkTargetCache {
   // Returns the root path that this cache is associated with
   const w_string& rootPath() const;
 
+  // Returns the number of cached targets
+  size_t size() const;
+
+  // Forgets every cached target; they are looked up again on demand
+  void clear();
+
   // Returns cache statistics
   CacheStats stats() const;
 
@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadAccounting.h"
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <map>
+#include "watchman/Logging.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <pthread.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace watchman {
+
+// Reads the CPU time of the thread that constructed it, from any thread
+struct ThreadAccount::Cpu {
+#if defined(_WIN32)
+  Cpu() {
+    if (!DuplicateHandle(
+            GetCurrentProcess(),
+            GetCurrentThread(),
+            GetCurrentProcess(),
+            &thread,
+            0,
+            FALSE,
+            DUPLICATE_SAME_ACCESS)) {
+      thread = nullptr;
+    }
+  }
+
+  ~Cpu() {
+    if (thread) {
+      CloseHandle(thread);
+    }
+  }
+
+  std::optional<std::chrono::nanoseconds> read() const {
+    FILETIME creation, exit, kernel, user;
+    if (!thread || !GetThreadTimes(thread, &creation, &exit, &kernel, &user)) {
+      return std::nullopt;
+    }
+    auto ticks = [](const FILETIME& time) {
+      return (uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    // FILETIMEs count 100ns intervals
+    return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+  }
+
+  HANDLE thread{nullptr};
+#elif defined(__APPLE__)
+  // macOS has no pthread_getcpuclockid
+  std::optional<std::chrono::nanoseconds> read() const {
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(
+            thread,
+            THREAD_BASIC_INFO,
+            reinterpret_cast<thread_info_t>(&info),
+            &count) != KERN_SUCCESS) {
+      return std::nullopt;
+    }
+    return std::chrono::seconds(
+               info.user_time.seconds + info.system_time.seconds) +
+        std::chrono::microseconds(
+               info.user_time.microseconds + info.system_time.microseconds);
+  }
+
+  mach_port_t thread{pthread_mach_thread_np(pthread_self())};
+#else
+  Cpu() {
+    valid = pthread_getcpuclockid(pthread_self(), &clock) == 0;
+  }
+
+  std::optional<std::chrono::nanoseconds> read() const {
+    struct timespec ts;
+    if (!valid || clock_gettime(clock, &ts) != 0) {
+      return std::nullopt;
+    }
+    return std::chrono::seconds(ts.tv_sec) +
+        std::chrono::nanoseconds(ts.tv_nsec);
+  }
+
+  clockid_t clock;
+  bool valid{false};
+#endif
+};
+
+namespace {
+
+thread_local ThreadAccount* currentAccount = nullptr;
+
+struct Registry {
+  std::vector<ThreadAccount*> live;
+  // The totals of the threads that have exited, by kind and root
+  std::map<std::pair<std::string, std::string>, ThreadAccount::Stats> exited;
+};
+
+folly::Synchronized<Registry>& getRegistry() {
+  // Leaked so that threads that exit during shutdown can still use it
+  static auto* registry = new folly::Synchronized<Registry>();
+  return *registry;
+}
+
+void accumulate(ThreadAccount::Stats& total, const ThreadAccount::Stats& add) {
+  if (add.cpu) {
+    total.cpu = total.cpu.value_or(std::chrono::nanoseconds{0}) + *add.cpu;
+  }
+  for (size_t i = 0; i < ThreadAccount::kNumWaits; ++i) {
+    total.waitTime[i] += add.waitTime[i];
+    total.waits[i] += add.waits[i];
+  }
+}
+
+double toSeconds(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+MetricsCollectorRegistration threadMetrics(
+    "threads",
+    ThreadAccount::collectMetrics);
+
+} // namespace
+
+ThreadAccount::ThreadAccount(std::string kind, std::string root)
+    : kind_(std::move(kind)),
+      root_(std::move(root)),
+      thread_(std::this_thread::get_id()),
+      start_(std::chrono::steady_clock::now()),
+      cpu_(std::make_unique<Cpu>()) {
+  currentAccount = this;
+  getRegistry().wlock()->live.push_back(this);
+}
+
+ThreadAccount::~ThreadAccount() {
+  {
+    auto registry = getRegistry().wlock();
+    auto& live = registry->live;
+    live.erase(std::find(live.begin(), live.end(), this));
+    auto& total = registry->exited[std::make_pair(kind_, root_)];
+    total.kind = kind_;
+    total.root = root_;
+    total.exited = true;
+    accumulate(total, stats());
+  }
+  currentAccount = nullptr;
+}
+
+ThreadAccount* ThreadAccount::current() {
+  return currentAccount;
+}
+
+ThreadAccount::Stats ThreadAccount::stats() const {
+  Stats stats;
+  stats.kind = kind_;
+  stats.root = root_;
+  stats.cpu = cpu_->read();
+  for (size_t i = 0; i < kNumWaits; ++i) {
+    stats.waitTime[i] = std::chrono::nanoseconds(
+        waitNanos_[i].load(std::memory_order_relaxed));
+    stats.waits[i] = waits_[i].load(std::memory_order_relaxed);
+  }
+  stats.age = std::chrono::steady_clock::now() - start_;
+  return stats;
+}
+
+std::vector<ThreadAccount::Stats> ThreadAccount::getLiveStats() {
+  auto names = Log::getThreadNames();
+  std::vector<Stats> result;
+  auto registry = getRegistry().rlock();
+  result.reserve(registry->live.size());
+  for (auto account : registry->live) {
+    result.push_back(account->stats());
+    auto it = names.find(account->thread_);
+    if (it != names.end()) {
+      result.back().name = it->second;
+    }
+  }
+  return result;
+}
+
+std::vector<ThreadAccount::Stats> ThreadAccount::getAllStats() {
+  auto result = getLiveStats();
+  auto registry = getRegistry().rlock();
+  for (auto& [key, total] : registry->exited) {
+    result.push_back(total);
+  }
+  return result;
+}
+
+void ThreadAccount::collectMetrics(MetricsWriter& writer) {
+  // The client threads come and go, so the threads are summed by kind and
+  // root rather than reported one by one
+  std::map<std::pair<std::string, std::string>, Stats> totals;
+  std::map<std::string, size_t> numLive;
+  for (auto& stats : getLiveStats()) {
+    ++numLive[stats.kind];
+    auto& total = totals[std::make_pair(stats.kind, stats.root)];
+    accumulate(total, stats);
+  }
+  {
+    auto registry = getRegistry().rlock();
+    for (auto& [key, exited] : registry->exited) {
+      accumulate(totals[key], exited);
+      numLive.emplace(key.first, 0);
+    }
+  }
+
+  for (auto& [kind, count] : numLive) {
+    writer.add(
+        "watchman_threads",
+        MetricType::Gauge,
+        "Threads that are running, by kind",
+        {{"thread", kind}},
+        count);
+  }
+
+  static const char* const kWaitNames[kNumWaits] = {"lock", "io"};
+  for (auto& [key, total] : totals) {
+    MetricLabels labels{{"thread", key.first}};
+    if (!key.second.empty()) {
+      labels.emplace_back("root", key.second);
+    }
+    if (total.cpu) {
+      writer.add(
+          "watchman_thread_cpu_seconds",
+          MetricType::Counter,
+          "CPU time used by the threads of each kind",
+          labels,
+          toSeconds(*total.cpu));
+    }
+    for (size_t i = 0; i < kNumWaits; ++i) {
+      auto waitLabels = labels;
+      waitLabels.emplace_back("wait", kWaitNames[i]);
+      writer.add(
+          "watchman_thread_wait_seconds",
+          MetricType::Counter,
+          "Time that the threads of each kind spent waiting on locks and "
+          "filesystem syscalls",
+          waitLabels,
+          toSeconds(total.waitTime[i]));
+      writer.add(
+          "watchman_thread_waits",
+          MetricType::Counter,
+          "Waits on locks and filesystem syscalls by the threads of each "
+          "kind",
+          waitLabels,
+          total.waits[i]);
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "watchman/Metrics.h"
+
+namespace watchman {
+
+/**
+ * Accounts for where the time of a thread goes: the CPU time that the
+ * kernel charges it, and the time that it spends blocked on locks and in
+ * filesystem syscalls, which is what it does when it isn't using the CPU.
+ * Together they tell whether the IO thread of a root is CPU-bound, waiting
+ * on lstat, or waiting on the view lock.
+ *
+ * The IO, notify and client threads each construct one of these on their
+ * stack for as long as they run, and the places where they block measure
+ * their waits with ThreadWait.  Threads that have no account aren't
+ * measured, so the same code may run on any thread.  The totals of threads
+ * that have exited are kept by kind, so that the exported counters never
+ * go backwards.
+ */
+class ThreadAccount {
+ public:
+  enum Wait { Lock, Io, kNumWaits };
+
+  struct Stats {
+    // "io", "notify" or "client"
+    std::string kind;
+    // The root that the thread serves, if any
+    std::string root;
+    // As last given to w_set_thread_name; tells the client threads apart
+    std::string name;
+    // Unset where the platform can't tell
+    std::optional<std::chrono::nanoseconds> cpu;
+    std::array<std::chrono::nanoseconds, kNumWaits> waitTime{};
+    std::array<uint64_t, kNumWaits> waits{};
+    // How long the thread has been accounted for
+    std::chrono::nanoseconds age{0};
+    // Set for the totals of the threads that have exited
+    bool exited{false};
+  };
+
+  // Starts accounting for the calling thread
+  explicit ThreadAccount(std::string kind, std::string root = {});
+  ~ThreadAccount();
+  ThreadAccount(const ThreadAccount&) = delete;
+  ThreadAccount& operator=(const ThreadAccount&) = delete;
+
+  // The account of the calling thread, or null if it has none
+  static ThreadAccount* current();
+
+  // Adds a wait to the account of the calling thread, if it has one
+  static void recordWait(Wait wait, std::chrono::nanoseconds duration) {
+    if (auto account = current()) {
+      account->addWait(wait, duration);
+    }
+  }
+
+  void addWait(Wait wait, std::chrono::nanoseconds duration) {
+    waitNanos_[wait].fetch_add(duration.count(), std::memory_order_relaxed);
+    waits_[wait].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // The stats of every thread that is being accounted for
+  static std::vector<Stats> getLiveStats();
+
+  /**
+   * The stats of every thread that is being accounted for, plus one per
+   * kind and root for the threads of that kind that have exited.  Those
+   * have no name or age.
+   */
+  static std::vector<Stats> getAllStats();
+
+  static void collectMetrics(MetricsWriter& writer);
+
+ private:
+  struct Cpu;
+
+  // Called with the registry locked, so the thread is still running
+  Stats stats() const;
+
+  const std::string kind_;
+  const std::string root_;
+  const std::thread::id thread_;
+  const std::chrono::steady_clock::time_point start_;
+  std::unique_ptr<Cpu> cpu_;
+  std::array<std::atomic<int64_t>, kNumWaits> waitNanos_{};
+  std::array<std::atomic<uint64_t>, kNumWaits> waits_{};
+};
+
+/**
+ * Adds the time between its construction and destruction to the calling
+ * thread's account as a wait of the given kind.  Costs only a thread-local
+ * read on threads that have no account.
+ */
+class ThreadWait {
+ public:
+  explicit ThreadWait(ThreadAccount::Wait wait)
+      : account_(ThreadAccount::current()), wait_(wait) {
+    if (account_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~ThreadWait() {
+    if (account_) {
+      account_->addWait(wait_, std::chrono::steady_clock::now() - start_);
+    }
+  }
+
+  ThreadWait(const ThreadWait&) = delete;
+  ThreadWait& operator=(const ThreadWait&) = delete;
+
+ private:
+  ThreadAccount* const account_;
+  const ThreadAccount::Wait wait_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace watchman
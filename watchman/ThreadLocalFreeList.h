@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstddef>
+#include <new>
+
+namespace watchman {
+
+/**
+ * A per-thread freelist of sizeof(T) blocks, for the class-specific
+ * operator new and delete of a T that is created and destroyed at a high
+ * rate.
+ *
+ * Blocks freed on a thread are kept on that thread's list, up to MaxFree of
+ * them, and handed out again by later allocations on it.  A block may be
+ * freed on a different thread than the one that allocated it, in which
+ * case it simply joins that thread's list.  Allocations of any other size,
+ * such as for a class derived from T, go straight to the allocator.
+ *
+ * The list is made of trivially destructible thread_locals so that it
+ * remains usable while other thread_locals are destroyed; the Drainer frees
+ * the retained blocks when the thread exits, and from then on blocks freed
+ * on that thread bypass the list.
+ */
+template <typename T, size_t MaxFree>
+class ThreadLocalFreeList {
+ public:
+  static void* allocate(size_t size) {
+    static_assert(sizeof(T) >= sizeof(Node), "T is too small to be listed");
+    if (size == sizeof(T)) {
+      if (auto node = head_) {
+        head_ = node->next;
+        --numFree_;
+        return node;
+      }
+    }
+    return ::operator new(size);
+  }
+
+  static void deallocate(void* ptr, size_t size) {
+    if (size == sizeof(T) && numFree_ < MaxFree) {
+      // Registers the drainer for this thread, which may never have
+      // allocated a block of its own
+      (void)&drainer_;
+      auto node = static_cast<Node*>(ptr);
+      node->next = head_;
+      head_ = node;
+      ++numFree_;
+      return;
+    }
+    ::operator delete(ptr);
+  }
+
+  // The number of blocks on the calling thread's list
+  static size_t numFree() {
+    return numFree_;
+  }
+
+ private:
+  struct Node {
+    Node* next;
+  };
+
+  struct Drainer {
+    ~Drainer() {
+      while (auto node = head_) {
+        head_ = node->next;
+        ::operator delete(node);
+      }
+      numFree_ = MaxFree;
+    }
+  };
+
+  static inline thread_local Node* head_ = nullptr;
+  static inline thread_local size_t numFree_ = 0;
+  static inline thread_local Drainer drainer_;
+};
+
+} // namespace watchman
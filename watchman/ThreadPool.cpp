@@ -7,9 +7,64 @@
 
 #include "watchman/ThreadPool.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
+#include "watchman/ThreadAccounting.h"
 
 namespace watchman {
 
+namespace {
+
+// The pool and index of the worker that runs on this thread, if any
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+const char* const kPriorityNames[ThreadPool::kNumPriorities] = {
+    "high",
+    "normal",
+    "low"};
+
+MetricsCollectorRegistration threadPoolMetrics(
+    "thread_pool",
+    [](MetricsWriter& writer) {
+      auto stats = getThreadPool().stats();
+      for (size_t i = 0; i < ThreadPool::kNumPriorities; ++i) {
+        auto& priority = stats.priorities[i];
+        MetricLabels labels{{"priority", kPriorityNames[i]}};
+        writer.add(
+            "watchman_thread_pool_queued",
+            MetricType::Gauge,
+            "Tasks waiting for a thread of the shared thread pool",
+            labels,
+            priority.queued);
+        writer.add(
+            "watchman_thread_pool_tasks",
+            MetricType::Counter,
+            "Tasks that the shared thread pool has started",
+            labels,
+            priority.executed);
+        static const std::pair<double, const char*> quantiles[] = {
+            {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+        for (auto& [quantile, name] : quantiles) {
+          auto quantileLabels = labels;
+          quantileLabels.emplace_back("quantile", name);
+          writer.add(
+              "watchman_thread_pool_wait_seconds",
+              MetricType::Gauge,
+              "Percentiles of the time that tasks waited for a thread",
+              quantileLabels,
+              priority.wait.percentile(quantile).count() / 1e6);
+        }
+      }
+      writer.add(
+          "watchman_thread_pool_steals",
+          MetricType::Counter,
+          "Tasks that a worker took from the queue of another",
+          {},
+          stats.steals);
+    });
+
+} // namespace
+
 ThreadPool& getThreadPool() {
   static ThreadPool pool;
   return pool;
@@ -21,37 +76,98 @@ ThreadPool::~ThreadPool() {
 
 void ThreadPool::start(size_t numWorkers, size_t maxItems) {
   std::unique_lock<std::mutex> lock(mutex_);
-  if (!workers_.empty()) {
+  if (started_) {
     throw std::runtime_error("ThreadPool already started");
   }
   if (stopping_) {
     throw std::runtime_error("Cannot restart a stopped pool");
   }
   maxItems_ = maxItems;
+  if (numWorkers == 0) {
+    return;
+  }
+
+  for (auto i = 0U; i < numWorkers; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  // Hand out whatever was added before we started
+  for (size_t priority = 0; priority < kNumPriorities; ++priority) {
+    size_t next = 0;
+    for (auto& task : pending_[priority]) {
+      workers_[next++ % numWorkers]->queues[priority].push_back(
+          std::move(task));
+    }
+    pending_[priority].clear();
+  }
+  started_ = true;
 
   for (auto i = 0U; i < numWorkers; ++i) {
-    workers_.emplace_back([this, i]() noexcept {
+    threads_.emplace_back([this, i]() noexcept {
       w_set_thread_name("ThreadPool-", i);
-      runWorker();
+      ThreadAccount account{"pool"};
+      runWorker(i);
     });
   }
 }
 
-void ThreadPool::runWorker() {
-  while (true) {
-    folly::Func task;
+size_t ThreadPool::numWorkers() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return threads_.size();
+}
+
+bool ThreadPool::popFrom(Worker& worker, size_t priority, Task& task) {
+  std::unique_lock<std::mutex> lock(worker.mutex);
+  auto& queue = worker.queues[priority];
+  if (queue.empty()) {
+    return false;
+  }
+  task = std::move(queue.front());
+  queue.pop_front();
+  --queuedByPriority_[priority];
+  --queued_;
+  return true;
+}
 
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) {
-        return;
+bool ThreadPool::takeTask(size_t index, Task& task) {
+  auto numWorkers = workers_.size();
+  for (size_t priority = 0; priority < kNumPriorities; ++priority) {
+    if (queuedByPriority_[priority].load() == 0) {
+      continue;
+    }
+    if (popFrom(*workers_[index], priority, task)) {
+      return true;
+    }
+    for (size_t i = 1; i < numWorkers; ++i) {
+      if (popFrom(*workers_[(index + i) % numWorkers], priority, task)) {
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
       }
-      task = std::move(tasks_.front());
-      tasks_.pop_front();
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runWorker(size_t index) {
+  currentPool = this;
+  currentWorker = index;
+
+  while (true) {
+    Task task;
+    if (takeTask(index, task)) {
+      auto p = size_t(task.priority);
+      executed_[p].fetch_add(1, std::memory_order_relaxed);
+      waitTime_[p].record(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              Clock::now() - task.queued));
+      task.func();
+      continue;
     }
 
-    task();
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    if (stopping_ && queued_ == 0) {
+      return;
+    }
   }
 }
 
@@ -63,25 +179,79 @@ void ThreadPool::stop(bool join) {
   condition_.notify_all();
 
   if (join) {
-    for (auto& worker : workers_) {
-      worker.join();
+    for (auto& thread : threads_) {
+      thread.join();
     }
+    // Allow stop() to be called again, eg: from the destructor
+    threads_.clear();
   }
 }
 
 void ThreadPool::add(folly::Func func) {
-  {
+  add(std::move(func), Priority::Normal);
+}
+
+void ThreadPool::addWithPriority(folly::Func func, int8_t priority) {
+  add(std::move(func),
+      priority > folly::Executor::MID_PRI       ? Priority::High
+          : priority < folly::Executor::MID_PRI ? Priority::Low
+                                                : Priority::Normal);
+}
+
+folly::Executor* ThreadPool::executor(Priority priority) {
+  return &executors_[size_t(priority)];
+}
+
+void ThreadPool::add(folly::Func func, Priority priority) {
+  if (stopping_) {
+    throw std::runtime_error("cannot add tasks after pool has stopped");
+  }
+
+  auto p = size_t(priority);
+  Task task{std::move(func), priority, Clock::now()};
+  auto enqueue = [&](std::deque<Task>& queue) {
+    queue.push_back(std::move(task));
+    ++queuedByPriority_[p];
+    ++queued_;
+  };
+
+  if (!started_) {
     std::unique_lock<std::mutex> lock(mutex_);
-    if (stopping_) {
-      throw std::runtime_error("cannot add tasks after pool has stopped");
-    }
-    if (tasks_.size() + 1 >= maxItems_) {
-      throw std::runtime_error("thread pool queue is full");
+    if (!started_) {
+      enqueue(pending_[p]);
+      return;
     }
+  }
+  if (queued_ + 1 >= maxItems_) {
+    throw std::runtime_error("thread pool queue is full");
+  }
 
-    tasks_.emplace_back(std::move(func));
+  // Keep the tasks that a worker spawns close to it, and spread the rest
+  auto index = currentPool == this
+      ? currentWorker
+      : nextWorker_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+  {
+    auto& worker = *workers_[index];
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    enqueue(worker.queues[p]);
   }
 
+  // Synchronize with a worker that is about to sleep so that it can't miss
+  // the wakeup
+  { std::unique_lock<std::mutex> lock(mutex_); }
   condition_.notify_one();
 }
+
+ThreadPool::Stats ThreadPool::stats() const {
+  Stats stats;
+  for (size_t i = 0; i < kNumPriorities; ++i) {
+    auto& priority = stats.priorities[i];
+    priority.queued = queuedByPriority_[i].load(std::memory_order_relaxed);
+    priority.executed = executed_[i].load(std::memory_order_relaxed);
+    priority.wait = waitTime_[i].snapshot();
+  }
+  stats.steals = steals_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 } // namespace watchman
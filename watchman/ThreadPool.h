@@ -7,16 +7,21 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
+#include "watchman/LatencyHistogram.h"
 #include "watchman/watchman_system.h" // to avoid system header ordering issue on win32
 
 namespace watchman {
 
-// Almost the dumbest possible thread pool implementation.
+// A fixed size thread pool with per-worker queues and task priorities.
 // This allows us to set an upper bound on the number of concurrent
 // tasks that are executed in the thread pool.  Contrast with
 // std::async which leaves it to the implementation to decide
@@ -24,9 +29,19 @@ namespace watchman {
 // thread pool with an unspecified number of threads.
 // Constraining the concurrency is important for watchman so
 // that we can limit the amount of I/O that we might induce.
+//
+// Each worker has a queue for each priority.  Tasks that are added from a
+// worker go to its own queue, and the others are spread round robin over
+// the workers.  An idle worker takes the oldest task of the highest
+// priority that is queued anywhere, preferring its own queue and otherwise
+// stealing from another worker's, so that cheap latency-sensitive tasks
+// such as symlink reads don't wait behind a burst of content hashing.
 
 class ThreadPool : public folly::Executor {
  public:
+  enum class Priority : uint8_t { High, Normal, Low };
+  static constexpr size_t kNumPriorities = 3;
+
   ThreadPool() = default;
   ~ThreadPool() override;
 
@@ -48,17 +63,92 @@ class ThreadPool : public folly::Executor {
   // may return before func has been executed.
   // If the thread pool has been stopped, throws a runtime_error.
   void add(folly::Func func) override;
+  void add(folly::Func func, Priority priority);
+
+  // folly's priorities grow with urgency, with MID_PRI in the middle
+  void addWithPriority(folly::Func func, int8_t priority) override;
+  uint8_t getNumPriorities() const override {
+    return kNumPriorities;
+  }
+
+  // An executor that adds its tasks to this pool at `priority`, for use
+  // with folly::via()
+  folly::Executor* executor(Priority priority);
+
+  // Returns the number of worker threads, which is zero until start()
+  // has been called.
+  size_t numWorkers();
+
+  struct PriorityStats {
+    size_t queued{0};
+    uint64_t executed{0};
+    // How long tasks waited in the queue before they started
+    LatencyHistogram::Snapshot wait;
+  };
+  struct Stats {
+    std::array<PriorityStats, kNumPriorities> priorities;
+    // Tasks that a worker took from another worker's queue
+    uint64_t steals{0};
+  };
+  Stats stats() const;
 
  private:
-  std::vector<std::thread> workers_;
-  std::deque<folly::Func> tasks_;
+  using Clock = std::chrono::steady_clock;
+
+  struct Task {
+    folly::Func func;
+    Priority priority{Priority::Normal};
+    Clock::time_point queued;
+  };
 
+  struct Worker {
+    std::mutex mutex;
+    std::array<std::deque<Task>, kNumPriorities> queues;
+  };
+
+  class PriorityExecutor : public folly::Executor {
+   public:
+    PriorityExecutor(ThreadPool& pool, Priority priority)
+        : pool_(pool), priority_(priority) {}
+    void add(folly::Func func) override {
+      pool_.add(std::move(func), priority_);
+    }
+
+   private:
+    ThreadPool& pool_;
+    const Priority priority_;
+  };
+
+  std::vector<std::thread> threads_;
+  // Fixed once started_ is set
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<bool> started_{false};
+  std::atomic<bool> stopping_{false};
+  std::atomic<size_t> nextWorker_{0};
+
+  // Protects pending_ and the sleep and wakeup of idle workers
   std::mutex mutex_;
   std::condition_variable condition_;
-  bool stopping_{false};
-  size_t maxItems_;
+  // Tasks added before start(), which hands them to the workers
+  std::array<std::deque<Task>, kNumPriorities> pending_;
+  // Fixed once started_ is set
+  size_t maxItems_{0};
+
+  // Updated while holding the lock of the queue that holds the task
+  std::atomic<size_t> queued_{0};
+  std::array<std::atomic<size_t>, kNumPriorities> queuedByPriority_{};
+  std::array<std::atomic<uint64_t>, kNumPriorities> executed_{};
+  std::array<LatencyHistogram, kNumPriorities> waitTime_;
+  std::atomic<uint64_t> steals_{0};
+
+  std::array<PriorityExecutor, kNumPriorities> executors_{
+      PriorityExecutor{*this, Priority::High},
+      PriorityExecutor{*this, Priority::Normal},
+      PriorityExecutor{*this, Priority::Low}};
 
-  void runWorker();
+  void runWorker(size_t index);
+  bool takeTask(size_t index, Task& task);
+  bool popFrom(Worker& worker, size_t priority, Task& task);
 };
 
 // Return a reference to the shared thread pool for the watchman process.
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Trace.h"
+#include <folly/Synchronized.h>
+#include <folly/portability/Unistd.h>
+#include <folly/system/ThreadId.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include "watchman/Logging.h"
+#include "watchman/RingBuffer.h"
+
+namespace watchman {
+
+struct ThreadTraceBuffer {
+  ThreadTraceBuffer(uint32_t capacity, uint64_t tid, std::string threadName)
+      : tid{tid}, threadName{std::move(threadName)}, events{capacity} {}
+
+  const uint64_t tid;
+  const std::string threadName;
+  RingBuffer<TraceEvent> events;
+};
+
+namespace {
+
+// The buffers of exited threads are kept so that the work of short-lived
+// threads still shows up, but only this many of them.
+constexpr size_t kMaxRetiredBuffers = 32;
+
+std::atomic<uint32_t> eventsPerThread{0};
+
+struct Buffers {
+  std::vector<std::shared_ptr<ThreadTraceBuffer>> live;
+  std::deque<std::shared_ptr<ThreadTraceBuffer>> retired;
+};
+
+folly::Synchronized<Buffers>& getBuffers() {
+  // Leaked so that threads that exit during static destruction can retire
+  // their buffers.
+  static auto* buffers = new folly::Synchronized<Buffers>();
+  return *buffers;
+}
+
+struct ThreadBufferHolder {
+  ~ThreadBufferHolder() {
+    if (!buffer) {
+      return;
+    }
+    auto buffers = getBuffers().wlock();
+    auto& live = buffers->live;
+    live.erase(std::remove(live.begin(), live.end(), buffer), live.end());
+    buffers->retired.push_back(std::move(buffer));
+    if (buffers->retired.size() > kMaxRetiredBuffers) {
+      buffers->retired.pop_front();
+    }
+  }
+
+  std::shared_ptr<ThreadTraceBuffer> buffer;
+};
+
+thread_local ThreadBufferHolder threadBuffer;
+
+ThreadTraceBuffer& getThreadBuffer(uint32_t capacity) {
+  if (!threadBuffer.buffer) {
+    auto buffer = std::make_shared<ThreadTraceBuffer>(
+        capacity, folly::getOSThreadID(), Log::getThreadName());
+    getBuffers().wlock()->live.push_back(buffer);
+    threadBuffer.buffer = std::move(buffer);
+  }
+  return *threadBuffer.buffer;
+}
+
+std::chrono::microseconds now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+}
+
+} // namespace
+
+void TraceEvent::setDetail(std::string_view value) noexcept {
+  if (value.size() >= sizeof(detail)) {
+    value = value.substr(value.size() - (sizeof(detail) - 1));
+    // Don't start in the middle of a UTF-8 sequence
+    while (!value.empty() && (value.front() & 0xc0) == 0x80) {
+      value.remove_prefix(1);
+    }
+  }
+  memcpy(detail, value.data(), value.size());
+  detail[value.size()] = 0;
+}
+
+std::string_view TraceEvent::getDetail() const noexcept {
+  return std::string_view{detail, strnlen(detail, sizeof(detail))};
+}
+
+void configureTracing(uint32_t events) {
+  eventsPerThread.store(events, std::memory_order_relaxed);
+}
+
+bool isTracingEnabled() {
+  return eventsPerThread.load(std::memory_order_relaxed) != 0;
+}
+
+std::vector<ThreadTrace> collectTrace() {
+  std::vector<ThreadTrace> result;
+  auto buffers = getBuffers().rlock();
+  auto collect = [&](const ThreadTraceBuffer& buffer) {
+    auto events = buffer.events.readAll();
+    if (!events.empty()) {
+      result.push_back(
+          ThreadTrace{buffer.tid, buffer.threadName, std::move(events)});
+    }
+  };
+  for (auto& buffer : buffers->retired) {
+    collect(*buffer);
+  }
+  for (auto& buffer : buffers->live) {
+    collect(*buffer);
+  }
+  return result;
+}
+
+void clearTrace() {
+  auto buffers = getBuffers().rlock();
+  for (auto& buffer : buffers->retired) {
+    buffer->events.clear();
+  }
+  for (auto& buffer : buffers->live) {
+    buffer->events.clear();
+  }
+}
+
+json_ref traceToChromeJson(const std::vector<ThreadTrace>& threads) {
+  auto pid = json_integer(::getpid());
+  auto events = json_array();
+  for (auto& thread : threads) {
+    auto tid = json_integer(thread.tid);
+    json_array_append_new(
+        events,
+        json_object({
+            {"ph", typed_string_to_json("M")},
+            {"name", typed_string_to_json("thread_name")},
+            {"pid", pid},
+            {"tid", tid},
+            {"args",
+             json_object(
+                 {{"name",
+                   typed_string_to_json(
+                       thread.threadName.data(),
+                       thread.threadName.size(),
+                       W_STRING_MIXED)}})},
+        }));
+    for (auto& event : thread.events) {
+      auto entry = json_object({
+          {"ph", typed_string_to_json("X")},
+          {"cat", typed_string_to_json(event.category)},
+          {"name", typed_string_to_json(event.name)},
+          {"ts", json_integer(event.start.count())},
+          {"dur", json_integer(event.duration.count())},
+          {"pid", pid},
+          {"tid", tid},
+      });
+      auto detail = event.getDetail();
+      if (!detail.empty()) {
+        entry.set(
+            "args",
+            json_object(
+                {{"detail",
+                  typed_string_to_json(
+                      detail.data(), detail.size(), W_STRING_MIXED)}}));
+      }
+      json_array_append_new(events, std::move(entry));
+    }
+  }
+  return json_object({
+      {"traceEvents", events},
+      {"displayTimeUnit", typed_string_to_json("ms")},
+  });
+}
+
+TraceSpan::TraceSpan(
+    const char* category,
+    const char* name,
+    std::string_view detail) noexcept {
+  auto capacity = eventsPerThread.load(std::memory_order_relaxed);
+  if (capacity == 0) {
+    return;
+  }
+  try {
+    buffer_ = &getThreadBuffer(capacity);
+  } catch (const std::exception&) {
+    return;
+  }
+  event_.category = category;
+  event_.name = name;
+  event_.setDetail(detail);
+  event_.start = now();
+}
+
+TraceSpan::~TraceSpan() {
+  if (buffer_) {
+    event_.duration = now() - event_.start;
+    buffer_->events.write(event_);
+  }
+}
+
+} // namespace watchman
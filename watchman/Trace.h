@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+struct ThreadTraceBuffer;
+
+/**
+ * A completed span of work on one thread.  These are written to lock-free
+ * per-thread ring buffers, so they hold only literals and a fixed amount of
+ * inline detail.
+ */
+struct TraceEvent {
+  TraceEvent() noexcept = default;
+
+  // String literals; name is null in slots that were never written
+  const char* category = nullptr;
+  const char* name = nullptr;
+  std::chrono::microseconds start{0};
+  std::chrono::microseconds duration{0};
+  // NUL-terminated; holds the tail of a longer detail such as a path
+  char detail[32] = {};
+
+  void setDetail(std::string_view value) noexcept;
+  std::string_view getDetail() const noexcept;
+};
+
+// The events recorded by one thread, oldest first
+struct ThreadTrace {
+  uint64_t tid;
+  std::string threadName;
+  std::vector<TraceEvent> events;
+};
+
+/**
+ * Enables tracing with room for `eventsPerThread` events in each thread's
+ * buffer, or disables it when that is zero.  Buffers that already exist keep
+ * their size.
+ */
+void configureTracing(uint32_t eventsPerThread);
+
+bool isTracingEnabled();
+
+// Returns the contents of the buffers of the live and recently exited threads
+std::vector<ThreadTrace> collectTrace();
+
+// Forgets the events recorded so far
+void clearTrace();
+
+/**
+ * Renders `threads` in the Chrome trace event format, which can be loaded
+ * into chrome://tracing or Perfetto.
+ */
+json_ref traceToChromeJson(const std::vector<ThreadTrace>& threads);
+
+/**
+ * Records the lifetime of the span as an event in the calling thread's trace
+ * buffer.  When tracing is disabled this costs an atomic load.
+ */
+class TraceSpan {
+ public:
+  TraceSpan(
+      const char* category,
+      const char* name,
+      std::string_view detail = {}) noexcept;
+  ~TraceSpan();
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+ private:
+  ThreadTraceBuffer* buffer_{nullptr};
+  TraceEvent event_;
+};
+
+} // namespace watchman
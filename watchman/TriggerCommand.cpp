@@ -7,11 +7,14 @@
 
 #include "watchman/TriggerCommand.h"
 #include <folly/String.h>
+#include <algorithm>
+#include <chrono>
 #include "watchman/Errors.h"
 #include "watchman/PDU.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
 #include "watchman/UserDir.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -23,6 +26,19 @@ namespace watchman {
 
 namespace {
 
+// How often a trigger checks whether its process has finished
+constexpr int kReapIntervalMs = 100;
+
+// Shared by the triggers of every root
+TriggerScheduler& getTriggerScheduler() {
+  static TriggerScheduler scheduler{size_t(std::max(
+      json_int_t(0),
+      Configuration().getInt(
+          "trigger_concurrency",
+          std::max(1u, std::thread::hardware_concurrency()))))};
+  return scheduler;
+}
+
 void parse_redirection(
     json_ref trig,
     std::string& name,
@@ -61,6 +77,47 @@ void parse_redirection(
   }
 }
 
+// Writes the results to stm in the form that style calls for
+bool write_stdin(
+    trigger_input_style style,
+    const json_ref& results,
+    watchman_stream* stm) {
+  switch (style) {
+    case input_json: {
+      w_jbuffer_t buffer;
+
+      logf(DBG, "input_json: sending json object to stm\n");
+      if (!buffer.jsonEncodeToStream(results, stm, 0)) {
+        logf(
+            ERR,
+            "input_json: failed to write json data to stream: {}\n",
+            folly::errnoStr(errno));
+        return false;
+      }
+      break;
+    }
+    case input_name_list:
+      for (auto& name : results.array()) {
+        auto& nameStr = json_to_w_string(name);
+        if (stm->write(nameStr.data(), nameStr.size()) !=
+                (int)nameStr.size() ||
+            stm->write("\n", 1) != 1) {
+          logf(
+              ERR,
+              "write failure while producing trigger stdin: {}\n",
+              folly::errnoStr(errno));
+          return false;
+        }
+      }
+      break;
+    case input_dev_null:
+      // Nothing to write
+      break;
+  }
+
+  return true;
+}
+
 std::unique_ptr<watchman_stream> prepare_stdin(
     struct TriggerCommand* cmd,
     QueryResult* res) {
@@ -70,13 +127,6 @@ std::unique_ptr<watchman_stream> prepare_stdin(
     return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
   }
 
-  // Adjust result to fit within the specified limit
-  if (cmd->max_files_stdin > 0) {
-    auto& fileList = res->resultsArray.array();
-    auto n_files = std::min(size_t(cmd->max_files_stdin), fileList.size());
-    fileList.resize(std::min(fileList.size(), n_files));
-  }
-
   /* prepare the input stream for the child process */
   snprintf(
       stdin_file_name,
@@ -97,43 +147,63 @@ std::unique_ptr<watchman_stream> prepare_stdin(
    * we'll pass the fd on to the child as stdin */
   unlink(stdin_file_name); // FIXME: windows path translation
 
-  switch (cmd->stdin_style) {
-    case input_json: {
-      w_jbuffer_t buffer;
-
-      logf(DBG, "input_json: sending json object to stm\n");
-      if (!buffer.jsonEncodeToStream(res->resultsArray, stdin_file.get(), 0)) {
-        logf(
-            ERR,
-            "input_json: failed to write json data to stream: {}\n",
-            folly::errnoStr(errno));
-        return NULL;
-      }
-      break;
-    }
-    case input_name_list:
-      for (auto& name : res->resultsArray.array()) {
-        auto& nameStr = json_to_w_string(name);
-        if (stdin_file->write(nameStr.data(), nameStr.size()) !=
-                (int)nameStr.size() ||
-            stdin_file->write("\n", 1) != 1) {
-          logf(
-              ERR,
-              "write failure while producing trigger stdin: {}\n",
-              folly::errnoStr(errno));
-          return nullptr;
-        }
-      }
-      break;
-    case input_dev_null:
-      // already handled above
-      break;
+  if (!write_stdin(cmd->stdin_style, res->resultsArray, stdin_file.get())) {
+    return nullptr;
   }
 
   stdin_file->rewind();
   return stdin_file;
 }
 
+// Returns the options shared by every process that cmd spawns: its
+// environment, output streams and working dir.
+ChildProcess::Options child_options(
+    const std::shared_ptr<Root>& root,
+    struct TriggerCommand* cmd) {
+  ChildProcess::Options opts;
+  opts.environment() = cmd->env;
+#ifndef _WIN32
+  sigset_t mask;
+  sigemptyset(&mask);
+  opts.setSigMask(mask);
+#endif
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+  opts.setKind(ChildProcess::Kind::Trigger);
+
+  if (!cmd->stdout_name.empty()) {
+    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+  }
+
+  if (!cmd->stderr_name.empty()) {
+    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+  }
+
+  // Figure out the appropriate cwd
+  w_string working_dir(cmd->query->relative_root);
+  if (!working_dir) {
+    working_dir = root->root_path;
+  }
+
+  auto cwd = cmd->definition.get_default("chdir");
+  if (cwd) {
+    auto target = json_to_w_string(cwd);
+    if (w_is_path_absolute_cstr_len(target.data(), target.size())) {
+      working_dir = target;
+    } else {
+      working_dir = w_string::pathCat({working_dir, target});
+    }
+  }
+
+  watchman::log(watchman::DBG, "using ", working_dir, " for working dir\n");
+  opts.chdir(working_dir.c_str());
+
+  return opts;
+}
+
 void spawn_command(
     const std::shared_ptr<Root>& root,
     struct TriggerCommand* cmd,
@@ -148,15 +218,21 @@ void spawn_command(
   // Allow some misc working overhead
   argspace_remaining -= 32;
 
-  // Record an overflow before we call prepare_stdin(), which mutates
-  // and resizes the results to fit the specified limit.
+  // Adjust result to fit within the specified limit
   if (cmd->max_files_stdin > 0 &&
       res->resultsArray.array().size() > cmd->max_files_stdin) {
     file_overflow = true;
+    res->resultsArray.array().resize(cmd->max_files_stdin);
   }
 
-  auto stdin_file = prepare_stdin(cmd, res);
-  if (!stdin_file) {
+  // The input is written to a pipe while the process runs, rather than to
+  // a temporary file before it starts
+  bool pipe_stdin = cmd->stdin_pipe && cmd->stdin_style != input_dev_null;
+  std::unique_ptr<watchman_stream> stdin_file;
+  if (!pipe_stdin) {
+    stdin_file = prepare_stdin(cmd, res);
+  }
+  if (!pipe_stdin && !stdin_file) {
     logf(
         ERR,
         "trigger {}:{} {}\n",
@@ -182,12 +258,6 @@ void spawn_command(
   cmd->env.set(
       "WATCHMAN_CLOCK", res->clockAtStartOfQuery.position().toClockString());
 
-  if (cmd->query->relative_root) {
-    cmd->env.set("WATCHMAN_RELATIVE_ROOT", cmd->query->relative_root);
-  } else {
-    cmd->env.unset("WATCHMAN_RELATIVE_ROOT");
-  }
-
   // Compute args
   auto args = json_deep_copy(cmd->command);
 
@@ -199,10 +269,8 @@ void spawn_command(
       argspace_remaining -= strlen(ele) + 1 + sizeof(char*);
     }
 
-    // Dry run with env to compute space
-    size_t env_size;
-    cmd->env.asEnviron(&env_size);
-    argspace_remaining -= env_size;
+    // Encode the env to compute its space; the spawn reuses the encoding
+    argspace_remaining -= cmd->env.encode()->size;
 
     for (const auto& item : res->dedupedFileNames) {
       // also: NUL terminator and entry in argv
@@ -220,54 +288,31 @@ void spawn_command(
 
   cmd->env.setBool("WATCHMAN_FILES_OVERFLOW", file_overflow);
 
-  ChildProcess::Options opts;
-  opts.environment() = cmd->env;
-#ifndef _WIN32
-  sigset_t mask;
-  sigemptyset(&mask);
-  opts.setSigMask(mask);
-#endif
-  opts.setFlags(POSIX_SPAWN_SETPGROUP);
-
-  opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
-
-  if (!cmd->stdout_name.empty()) {
-    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
-  }
-
-  if (!cmd->stderr_name.empty()) {
-    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  auto opts = child_options(root, cmd);
+  if (pipe_stdin) {
+    opts.pipeStdin();
   } else {
-    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+    opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
   }
 
-  // Figure out the appropriate cwd
-  w_string working_dir(cmd->query->relative_root);
-  if (!working_dir) {
-    working_dir = root->root_path;
-  }
-
-  auto cwd = cmd->definition.get_default("chdir");
-  if (cwd) {
-    auto target = json_to_w_string(cwd);
-    if (w_is_path_absolute_cstr_len(target.data(), target.size())) {
-      working_dir = target;
-    } else {
-      working_dir = w_string::pathCat({working_dir, target});
-    }
-  }
-
-  watchman::log(watchman::DBG, "using ", working_dir, " for working dir\n");
-  opts.chdir(working_dir.c_str());
-
   try {
     if (cmd->current_proc) {
       cmd->current_proc->kill();
       cmd->current_proc->wait();
     }
     cmd->current_proc = std::make_unique<ChildProcess>(args, std::move(opts));
+    if (pipe_stdin) {
+      // The writer owns the results and the pipe, and finishes when the
+      // process has read them all or has closed its stdin
+      auto pipe = cmd->current_proc->takePipe(STDIN_FILENO);
+      std::thread([style = cmd->stdin_style,
+                   results = std::move(res->resultsArray),
+                   stm = w_stm_fdopen(std::move(pipe->write)),
+                   name = cmd->triggername]() mutable {
+        w_set_thread_name("trigger stdin ", name.view());
+        write_stdin(style, results, stm.get());
+      }).detach();
+    }
   } catch (const std::exception& exc) {
     watchman::log(
         watchman::ERR,
@@ -288,6 +333,138 @@ void spawn_command(
       "\n");
 }
 
+// How long to wait before restarting a persistent process that exited.  The
+// delay doubles each time that the process exits sooner than the longest
+// delay after it was started.
+constexpr std::chrono::milliseconds kInitialRestartDelay{100};
+constexpr std::chrono::milliseconds kMaxRestartDelay{30000};
+
+// Forgets the persistent process of cmd and decides when it may next be
+// started.
+void stop_persistent(
+    const std::shared_ptr<Root>& root,
+    struct TriggerCommand* cmd,
+    const char* why) {
+  cmd->stdin_stream.reset();
+  cmd->current_proc->kill();
+  cmd->current_proc->wait();
+  cmd->current_proc.reset();
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - cmd->proc_started >= kMaxRestartDelay) {
+    cmd->restart_delay = kInitialRestartDelay;
+  } else {
+    cmd->restart_delay = std::min(
+        std::max(cmd->restart_delay * 2, kInitialRestartDelay),
+        kMaxRestartDelay);
+  }
+  cmd->next_start = now + cmd->restart_delay;
+
+  watchman::log(
+      watchman::ERR,
+      "trigger ",
+      root->root_path,
+      ":",
+      cmd->triggername,
+      " process ",
+      why,
+      "; restarting it in ",
+      cmd->restart_delay.count(),
+      "ms\n");
+}
+
+// Starts the persistent process of cmd, unless it exited too recently.
+bool start_persistent(
+    const std::shared_ptr<Root>& root,
+    struct TriggerCommand* cmd) {
+  auto now = std::chrono::steady_clock::now();
+  if (now < cmd->next_start) {
+    return false;
+  }
+
+  // Each batch carries its own clocks and overflow status
+  cmd->env.unset("WATCHMAN_SINCE");
+  cmd->env.unset("WATCHMAN_CLOCK");
+  cmd->env.unset("WATCHMAN_FILES_OVERFLOW");
+
+  auto opts = child_options(root, cmd);
+  opts.pipeStdin();
+
+  try {
+    cmd->current_proc =
+        std::make_unique<ChildProcess>(cmd->command, std::move(opts));
+  } catch (const std::exception& exc) {
+    watchman::log(
+        watchman::ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        cmd->triggername,
+        " failed: ",
+        exc.what(),
+        "\n");
+    cmd->proc_started = now;
+    cmd->restart_delay = std::min(
+        std::max(cmd->restart_delay * 2, kInitialRestartDelay),
+        kMaxRestartDelay);
+    cmd->next_start = now + cmd->restart_delay;
+    return false;
+  }
+
+  // We have integration tests that check for this string
+  watchman::log(watchman::DBG, "posix_spawnp: ", cmd->triggername, "\n");
+
+  auto pipe = cmd->current_proc->takePipe(STDIN_FILENO);
+  // Writing blocks while the process is busy, which holds back the next
+  // query until it is ready for more
+  pipe->write.clearNonBlock();
+  cmd->stdin_stream = w_stm_fdopen(std::move(pipe->write));
+  cmd->proc_started = now;
+  return true;
+}
+
+// Writes the results to the persistent process of cmd as one PDU,
+// (re)starting the process if it isn't running.  Returns false if they
+// couldn't be delivered.
+bool stream_results(
+    const std::shared_ptr<Root>& root,
+    struct TriggerCommand* cmd,
+    QueryResult* res,
+    ClockSpec* since_spec) {
+  if (cmd->current_proc && cmd->current_proc->terminated()) {
+    stop_persistent(root, cmd, "exited");
+  }
+  if (!cmd->current_proc && !start_persistent(root, cmd)) {
+    return false;
+  }
+
+  auto& fileList = res->resultsArray.array();
+  bool file_overflow =
+      cmd->max_files_stdin > 0 && fileList.size() > cmd->max_files_stdin;
+  if (file_overflow) {
+    fileList.resize(cmd->max_files_stdin);
+  }
+
+  auto batch = json_object(
+      {{"root", w_string_to_json(root->root_path)},
+       {"clock",
+        w_string_to_json(res->clockAtStartOfQuery.position().toClockString())},
+       {"files", res->resultsArray},
+       {"files_overflow", json_boolean(file_overflow)}});
+  if (since_spec && since_spec->tag == w_cs_clock) {
+    batch.set(
+        "since", w_string_to_json(since_spec->clock.position.toClockString()));
+  }
+
+  w_jbuffer_t buffer;
+  if (!buffer.pduEncodeToStream(
+          cmd->stdin_pdu, 0, batch, cmd->stdin_stream.get())) {
+    stop_persistent(root, cmd, "stopped reading its input");
+    return false;
+  }
+  return true;
+}
+
 } // namespace
 
 TriggerCommand::TriggerCommand(
@@ -298,8 +475,11 @@ TriggerCommand::TriggerCommand(
       append_files(false),
       stdin_style(input_dev_null),
       max_files_stdin(0),
+      stdin_pipe(false),
       stdout_flags(0),
       stderr_flags(0),
+      persistent(false),
+      stdin_pdu(is_json_compact),
       savedStateFactory_{savedStateFactory},
       ping_(w_event_make_sockets()) {
   auto queryDef = json_object();
@@ -316,6 +496,7 @@ TriggerCommand::TriggerCommand(
   if (!query) {
     return;
   }
+  query->command = "trigger";
 
   auto name = trig.get_default("name");
   if (!name || !name.isString()) {
@@ -338,6 +519,7 @@ TriggerCommand::TriggerCommand(
     // "easy" workaround, we'll capture the list of names from the deduping
     // mechanism.
     query->dedup_results = true;
+    query->capture_deduped_names = true;
   }
 
   auto ele = definition.get_default("stdin");
@@ -368,6 +550,38 @@ TriggerCommand::TriggerCommand(
   }
   max_files_stdin = ival;
 
+  stdin_pipe = trig.get_default("stdin_pipe", json_false()).asBool();
+
+  persistent = trig.get_default("persistent", json_false()).asBool();
+  if (persistent) {
+    if (append_files) {
+      throw CommandValidationError(
+          "append_files cannot be used with a persistent trigger");
+    }
+    if (stdin_style != input_json) {
+      throw CommandValidationError(
+          "a persistent trigger requires stdin to be a list of fields");
+    }
+  }
+
+  auto encoding = trig.get_default("stdin_encoding");
+  if (encoding) {
+    if (!encoding.isString()) {
+      throw CommandValidationError("stdin_encoding must be a string");
+    }
+    if (!persistent) {
+      throw CommandValidationError(
+          "stdin_encoding can only be used with a persistent trigger");
+    }
+    auto encodingName = json_to_w_string(encoding);
+    if (encodingName == "bser") {
+      stdin_pdu = is_bser;
+    } else if (encodingName != "json") {
+      throw CommandValidationError(
+          "invalid stdin_encoding ", encodingName.view());
+    }
+  }
+
   parse_redirection(trig, stdout_name, &stdout_flags, "stdout");
   parse_redirection(trig, stderr_name, &stderr_flags, "stderr");
 
@@ -376,6 +590,11 @@ TriggerCommand::TriggerCommand(
       {{"WATCHMAN_ROOT", root->root_path},
        {"WATCHMAN_SOCK", get_sock_name_legacy()},
        {"WATCHMAN_TRIGGER", triggername}});
+  if (query->relative_root) {
+    env.set("WATCHMAN_RELATIVE_ROOT", query->relative_root);
+  } else {
+    env.unset("WATCHMAN_RELATIVE_ROOT");
+  }
 }
 
 TriggerCommand::~TriggerCommand() {
@@ -399,30 +618,65 @@ void TriggerCommand::run(const std::shared_ptr<Root>& root) {
     watchman::log(watchman::DBG, "waiting for settle\n");
 
     while (!w_is_stopping() && !stopTrigger_) {
-      ignore_result(w_poll_events(pfd, 1, 86400));
+      int timeoutms = 86400;
+      if (current_proc && !persistent) {
+        // Watch for the process to finish so that its slot can be reused
+        timeoutms = kReapIntervalMs;
+      } else if (retryPending_) {
+        timeoutms = std::max(
+            1,
+            int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    next_start - std::chrono::steady_clock::now())
+                    .count()));
+      }
+      ignore_result(w_poll_events(pfd, 1, timeoutms));
       if (w_is_stopping() || stopTrigger_) {
         break;
       }
+
+      // Runs that are asked for while we wait for a slot, or while the
+      // process runs, are coalesced into the next one
       while (ping_->testAndClear()) {
         pending.clear();
         subscriber_->getPending(pending);
-        bool seenSettle = false;
         for (auto& item : pending) {
           if (item->payload.get_default("settled")) {
-            seenSettle = true;
+            runPending_ = true;
             break;
           }
         }
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (retryPending_ && now >= next_start) {
+        retryPending_ = false;
+        runPending_ = true;
+      }
+
+      if (persistent) {
+        // The persistent process is always running, so it has no slot
+        if (runPending_) {
+          runPending_ = false;
+          maybeSpawn(root);
+        }
+        continue;
+      }
 
-        if (seenSettle) {
-          if (!maybeSpawn(root)) {
-            continue;
-          }
-          waitNoIntr();
+      auto& scheduler = getTriggerScheduler();
+      if (current_proc && current_proc->terminated()) {
+        current_proc.reset();
+        scheduler.release(schedulerId_, now);
+      }
+      if (runPending_ && scheduler.request(schedulerId_, now)) {
+        runPending_ = false;
+        maybeSpawn(root);
+        if (!current_proc) {
+          // Nothing needed to run, or it failed to start
+          scheduler.release(schedulerId_, std::chrono::steady_clock::now());
         }
       }
     }
 
+    stdin_stream.reset();
     if (current_proc) {
       current_proc->kill();
       current_proc->wait();
@@ -444,9 +698,46 @@ void TriggerCommand::stop() {
     ping_->notify();
     triggerThread_.join();
   }
+  if (schedulerId_) {
+    getTriggerScheduler().remove(
+        schedulerId_, std::chrono::steady_clock::now());
+    schedulerId_ = 0;
+  }
+}
+
+json_ref TriggerCommand::schedulingStats() const {
+  auto id = schedulerId_.load();
+  if (!id) {
+    return json_null();
+  }
+  auto stats =
+      getTriggerScheduler().stats(id, std::chrono::steady_clock::now());
+  const char* state = "idle";
+  switch (stats.state) {
+    case TriggerScheduler::State::Idle:
+      break;
+    case TriggerScheduler::State::Queued:
+      state = "queued";
+      break;
+    case TriggerScheduler::State::Running:
+      state = "running";
+      break;
+  }
+  return json_object(
+      {{"state", typed_string_to_json(state)},
+       {"queued_ms", json_integer(stats.queuedFor.count())},
+       {"last_queue_ms", json_integer(stats.lastQueueTime.count())},
+       {"last_run_ms", json_integer(stats.lastRunTime.count())},
+       {"runs", json_integer(stats.runs)},
+       {"coalesced", json_integer(stats.coalesced)}});
 }
 
 void TriggerCommand::start(const std::shared_ptr<Root>& root) {
+  if (!persistent) {
+    // The event outlives us if the scheduler is waking us as we stop
+    schedulerId_ =
+        getTriggerScheduler().add([ping = ping_] { ping->notify(); });
+  }
   subscriber_ =
       root->unilateralResponses->subscribe([this] { ping_->notify(); });
   triggerThread_ = std::thread([this, root] {
@@ -510,9 +801,18 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
         res.clockAtStartOfQuery.position().ticks,
         " ticks next time\n");
 
-    if (!res.resultsArray.array().empty()) {
+    if (res.resultsArray.array().empty()) {
+      return false;
+    }
+    if (!persistent) {
       didRun = true;
       spawn_command(root, this, &res, saved_spec.get());
+    } else if (stream_results(root, this, &res, saved_spec.get())) {
+      didRun = true;
+    } else {
+      // Deliver these results with the next batch instead
+      query->since_spec = std::move(saved_spec);
+      retryPending_ = true;
     }
     return didRun;
   } catch (const QueryExecError& e) {
@@ -527,14 +827,4 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
   }
 }
 
-bool TriggerCommand::waitNoIntr() {
-  if (!w_is_stopping() && !stopTrigger_) {
-    if (current_proc && current_proc->terminated()) {
-      current_proc.reset();
-      return true;
-    }
-  }
-  return false;
-}
-
 } // namespace watchman
@@ -7,10 +7,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 #include "watchman/ChildProcess.h"
+#include "watchman/PDU.h"
 #include "watchman/PubSub.h"
+#include "watchman/TriggerScheduler.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 
 class watchman_event;
@@ -32,16 +36,31 @@ struct TriggerCommand {
   bool append_files;
   enum trigger_input_style stdin_style;
   uint32_t max_files_stdin;
+  /* Write stdin through a pipe while the process runs, rather than to a
+   * temporary file before it starts */
+  bool stdin_pipe;
 
   int stdout_flags;
   int stderr_flags;
   std::string stdout_name;
   std::string stderr_name;
 
+  /* Rather than spawning a process per batch of results, keep one
+   * running and write each batch to its stdin as a PDU */
+  bool persistent;
+  enum w_pdu_type stdin_pdu;
+
   /* While we are running, this holds the pid
    * of the running process */
   std::unique_ptr<watchman::ChildProcess> current_proc;
 
+  /* The stdin of a persistent process, when it started, and when it may
+   * next be started after exiting */
+  std::unique_ptr<watchman_stream> stdin_stream;
+  std::chrono::steady_clock::time_point proc_started;
+  std::chrono::steady_clock::time_point next_start;
+  std::chrono::milliseconds restart_delay{0};
+
   TriggerCommand(
       SavedStateFactory savedStateFactory,
       const std::shared_ptr<Root>& root,
@@ -51,6 +70,9 @@ struct TriggerCommand {
   void stop();
   void start(const std::shared_ptr<Root>& root);
 
+  // How the trigger has fared for slots to run its process in
+  json_ref schedulingStats() const;
+
  private:
   TriggerCommand(const TriggerCommand&) = delete;
   TriggerCommand(TriggerCommand&&) = delete;
@@ -60,13 +82,18 @@ struct TriggerCommand {
 
   void run(const std::shared_ptr<Root>& root);
   bool maybeSpawn(const std::shared_ptr<Root>& root);
-  bool waitNoIntr();
 
   const SavedStateFactory savedStateFactory_;
   std::thread triggerThread_;
   std::shared_ptr<watchman::Publisher::Subscriber> subscriber_;
-  std::unique_ptr<watchman_event> ping_;
+  std::shared_ptr<watchman_event> ping_;
   bool stopTrigger_{false};
+  // A batch couldn't be given to the persistent process and should be
+  // retried once it may be restarted
+  bool retryPending_{false};
+  // The root settled since the process last ran
+  bool runPending_{false};
+  std::atomic<TriggerScheduler::Id> schedulerId_{0};
 };
 
 } // namespace watchman
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TriggerScheduler.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+std::chrono::milliseconds elapsed(
+    TriggerScheduler::Clock::time_point since,
+    TriggerScheduler::Clock::time_point now) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now - since);
+}
+
+} // namespace
+
+TriggerScheduler::TriggerScheduler(size_t concurrency)
+    : concurrency_{concurrency} {}
+
+TriggerScheduler::Id TriggerScheduler::add(std::function<void()> wake) {
+  auto inner = inner_.wlock();
+  auto id = inner->nextId++;
+  inner->triggers[id].wake = std::move(wake);
+  return id;
+}
+
+void TriggerScheduler::remove(Id id, Clock::time_point now) {
+  std::vector<std::function<void()>> woken;
+  {
+    auto inner = inner_.wlock();
+    auto it = inner->triggers.find(id);
+    if (it == inner->triggers.end()) {
+      return;
+    }
+    if (it->second.stats.state == State::Running) {
+      --inner->running;
+    } else if (it->second.stats.state == State::Queued) {
+      auto& queue = inner->queue;
+      queue.erase(std::remove(queue.begin(), queue.end(), id), queue.end());
+    }
+    inner->triggers.erase(it);
+    woken = grant(*inner, concurrency_, now);
+  }
+  for (auto& wake : woken) {
+    wake();
+  }
+}
+
+bool TriggerScheduler::request(Id id, Clock::time_point now) {
+  auto inner = inner_.wlock();
+  auto it = inner->triggers.find(id);
+  if (it == inner->triggers.end()) {
+    return false;
+  }
+  auto& trigger = it->second;
+  switch (trigger.stats.state) {
+    case State::Running:
+      return true;
+    case State::Queued:
+      ++trigger.stats.coalesced;
+      return false;
+    case State::Idle:
+      break;
+  }
+
+  if (concurrency_ == 0 || inner->running < concurrency_) {
+    ++inner->running;
+    trigger.stats.state = State::Running;
+    trigger.stats.lastQueueTime = std::chrono::milliseconds{0};
+    trigger.since = now;
+    return true;
+  }
+  trigger.stats.state = State::Queued;
+  trigger.since = now;
+  inner->queue.push_back(id);
+  return false;
+}
+
+void TriggerScheduler::release(Id id, Clock::time_point now) {
+  std::vector<std::function<void()>> woken;
+  {
+    auto inner = inner_.wlock();
+    auto it = inner->triggers.find(id);
+    if (it == inner->triggers.end() ||
+        it->second.stats.state != State::Running) {
+      return;
+    }
+    auto& trigger = it->second;
+    trigger.stats.state = State::Idle;
+    trigger.stats.lastRunTime = elapsed(trigger.since, now);
+    ++trigger.stats.runs;
+    --inner->running;
+    woken = grant(*inner, concurrency_, now);
+  }
+  for (auto& wake : woken) {
+    wake();
+  }
+}
+
+std::vector<std::function<void()>> TriggerScheduler::grant(
+    Inner& inner,
+    size_t concurrency,
+    Clock::time_point now) {
+  std::vector<std::function<void()>> woken;
+  while (!inner.queue.empty() &&
+         (concurrency == 0 || inner.running < concurrency)) {
+    // The shortest last run wins, less the time spent waiting for this one
+    auto priority = [&](Id id) {
+      const auto& trigger = inner.triggers.at(id);
+      return trigger.stats.lastRunTime - elapsed(trigger.since, now);
+    };
+    auto best = std::min_element(
+        inner.queue.begin(), inner.queue.end(), [&](Id a, Id b) {
+          return priority(a) < priority(b);
+        });
+    auto& trigger = inner.triggers.at(*best);
+    inner.queue.erase(best);
+
+    ++inner.running;
+    trigger.stats.state = State::Running;
+    trigger.stats.lastQueueTime = elapsed(trigger.since, now);
+    trigger.since = now;
+    woken.push_back(trigger.wake);
+  }
+  return woken;
+}
+
+TriggerScheduler::Stats TriggerScheduler::stats(Id id, Clock::time_point now)
+    const {
+  auto inner = inner_.rlock();
+  auto it = inner->triggers.find(id);
+  if (it == inner->triggers.end()) {
+    return Stats{};
+  }
+  auto stats = it->second.stats;
+  if (stats.state == State::Queued) {
+    stats.queuedFor = elapsed(it->second.since, now);
+  }
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Limits how many trigger processes run at once across every root, so that
+ * a checkout that touches many roots doesn't spawn a process for each of
+ * their triggers at the same time.
+ *
+ * A trigger requests a slot when its root settles and runs its process once
+ * it is granted one.  Requests made while the trigger is already waiting
+ * are coalesced into the one that is waiting, since the trigger's query
+ * covers every change since it last ran.  When a slot is released it is
+ * granted to the waiting trigger whose last run was shortest, less how long
+ * it has been waiting, so that quick triggers go first without starving
+ * slow ones.
+ *
+ * Thread safe.
+ */
+class TriggerScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Id = uint64_t;
+
+  // `concurrency` is the number of slots; 0 means unlimited
+  explicit TriggerScheduler(size_t concurrency);
+
+  // Registers a trigger.  `wake` is called, without any lock held, when a
+  // slot is granted to it after it had to wait.
+  Id add(std::function<void()> wake);
+
+  // Forgets a trigger, giving up its slot or its place in the queue
+  void remove(Id id, Clock::time_point now);
+
+  // Returns true if the trigger holds a slot, which is granted now if one
+  // is free.  Otherwise the trigger waits for one, and false is returned.
+  bool request(Id id, Clock::time_point now);
+
+  // Gives up the slot of a trigger whose process has finished
+  void release(Id id, Clock::time_point now);
+
+  enum class State { Idle, Queued, Running };
+
+  struct Stats {
+    State state{State::Idle};
+    // How long the trigger has been waiting, if it is queued
+    std::chrono::milliseconds queuedFor{0};
+    // How long it waited for, and held, its last slot
+    std::chrono::milliseconds lastQueueTime{0};
+    std::chrono::milliseconds lastRunTime{0};
+    uint64_t runs{0};
+    // Requests that were folded into one that was already waiting
+    uint64_t coalesced{0};
+  };
+  Stats stats(Id id, Clock::time_point now) const;
+
+  size_t concurrency() const {
+    return concurrency_;
+  }
+
+ private:
+  struct Trigger {
+    std::function<void()> wake;
+    Stats stats;
+    // When the trigger was queued or granted its slot
+    Clock::time_point since;
+  };
+  struct Inner {
+    Id nextId{1};
+    size_t running{0};
+    std::unordered_map<Id, Trigger> triggers;
+    // Queued triggers, oldest first
+    std::deque<Id> queue;
+  };
+
+  // Grants free slots to queued triggers, returning their wake callbacks
+  static std::vector<std::function<void()>>
+  grant(Inner& inner, size_t concurrency, Clock::time_point now);
+
+  const size_t concurrency_;
+  folly::Synchronized<Inner> inner_;
+};
+
+} // namespace watchman
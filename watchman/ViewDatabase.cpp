@@ -0,0 +1,568 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/InMemoryView.h"
+#include <algorithm>
+#include "watchman/FileMetadataTable.h"
+#include "watchman/Logging.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+namespace {
+// How often, in files moved to the head of the recency list, the view
+// records a checkpoint, and how many it keeps
+constexpr uint32_t kCheckpointInterval = 1024;
+constexpr size_t kMaxCheckpoints = 4096;
+} // namespace
+
+ViewDatabase::ViewDatabase(
+    const w_string& root_path,
+    std::shared_ptr<NodeArena> arena,
+    std::shared_ptr<NameTable> names,
+    std::shared_ptr<DirTreeHashes> treeHashes)
+    : rootPath_{root_path},
+      names_{std::move(names)},
+      arena_{std::move(arena)},
+      treeHashes_{std::move(treeHashes)},
+      rootDir_{watchman_dir::make(*arena_, root_path, nullptr)} {}
+
+void ViewDatabase::enableMetadataTable() {
+  metadataTable_ = std::make_unique<FileMetadataTable>();
+}
+
+watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
+  if (dir_name == rootPath_) {
+    return rootDir_.get();
+  }
+
+  const char* dir_component = dir_name.data();
+  const char* dir_end = dir_component + dir_name.size();
+
+  watchman_dir* dir = rootDir_.get();
+  dir_component += rootPath_.size() + 1; // Skip root path prefix
+
+  w_assert(dir_component <= dir_end, "impossible file name");
+
+  watchman_dir* parent;
+  while (true) {
+    auto sep = (const char*)memchr(dir_component, '/', dir_end - dir_component);
+    // Note: if sep is NULL it means that we're looking at the basename
+    // component of the input directory name, which is the terminal
+    // iteration of this search.
+
+    w_string_piece component(
+        dir_component, sep ? (sep - dir_component) : (dir_end - dir_component));
+
+    auto child = dir->getChildDir(component);
+
+    if (!child && !create) {
+      return nullptr;
+    }
+    if (!child && sep && create) {
+      // A component in the middle wasn't present.  Since we're in create
+      // mode, we know that the leaf must exist.  The assumption is that
+      // we have another pending item for the parent.  We'll create the
+      // parent dir now and our other machinery will populate its contents
+      // later.
+      auto child_name = names_->intern(component);
+
+      // Careful! dir->dirs is keyed by non-owning string pieces so the
+      // child_name MUST be stored or otherwise kept alive by the watchman_dir
+      // instance constructed below!
+      auto& new_child = dir->dirs[child_name];
+      new_child = watchman_dir::make(*arena_, child_name, dir);
+
+      child = new_child.get();
+    }
+
+    parent = dir;
+    dir = child;
+
+    if (!sep) {
+      // We reached the end of the string
+      if (dir) {
+        // We found the dir
+        return dir;
+      }
+      // We need to create the dir
+      break;
+    }
+
+    // Skip to the next component for the next iteration
+    dir_component = sep + 1;
+  }
+
+  auto child_name =
+      names_->intern(w_string_piece(dir_component, dir_end - dir_component));
+  // Careful! parent->dirs is keyed by non-owning string pieces so the
+  // child_name MUST be stored or otherwise kept alive by the watchman_dir
+  // instance constructed below!
+  auto& new_child = parent->dirs[child_name];
+  new_child = watchman_dir::make(*arena_, child_name, parent);
+  return new_child.get();
+}
+
+const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
+  if (dir_name == rootPath_) {
+    return rootDir_.get();
+  }
+
+  const char* dir_component = dir_name.data();
+  const char* dir_end = dir_component + dir_name.size();
+
+  const watchman_dir* dir = rootDir_.get();
+  dir_component += rootPath_.size() + 1; // Skip root path prefix
+
+  w_assert(dir_component <= dir_end, "impossible file name");
+
+  while (true) {
+    auto sep = (const char*)memchr(dir_component, '/', dir_end - dir_component);
+    // Note: if sep is NULL it means that we're looking at the basename
+    // component of the input directory name, which is the terminal
+    // iteration of this search.
+
+    auto child = findChildDir(
+        dir,
+        w_string_piece(
+            dir_component,
+            sep ? (sep - dir_component) : (dir_end - dir_component)));
+    if (!child) {
+      return nullptr;
+    }
+
+    dir = child;
+
+    if (!sep) {
+      // We reached the end of the string
+      if (dir) {
+        // We found the dir
+        return dir;
+      }
+      // Does not exist
+      return nullptr;
+    }
+
+    // Skip to the next component for the next iteration
+    dir_component = sep + 1;
+  }
+
+  return nullptr;
+}
+
+const watchman_dir* ViewDatabase::findChildDir(
+    const watchman_dir* dir,
+    w_string_piece name) const {
+  // A name that was never interned can't belong to any dir, and one that
+  // was compares equal to the child's name by pointer.
+  auto component = names_->find(name);
+  if (!component) {
+    return nullptr;
+  }
+  return dir->getChildDir(*component);
+}
+
+watchman_file* ViewDatabase::getOrCreateChildFile(
+    Watcher& watcher,
+    watchman_dir* dir,
+    const w_string& file_name,
+    w_clock_t ctime) {
+  // file_name is typically a baseName slice; let's use it as-is
+  // to look up a child...
+  auto it = dir->files.find(file_name);
+  if (it != dir->files.end()) {
+    return it->second.get();
+  }
+
+  // ... but key the entry by the interned name held by the file that
+  // we create.
+  auto name = names_->intern(file_name);
+  auto file = watchman_file::make(
+      *arena_, name, names_->internLowerCase(name), dir);
+  auto& file_ptr = dir->files[file->getName()];
+  file_ptr = std::move(file);
+
+  file_ptr->ctime = ctime;
+  for (auto d = dir; d; d = d->parent) {
+    ++d->subtreeFiles;
+  }
+  insertIntoSuffixIndex(file_ptr.get());
+  insertIntoNameIndex(file_ptr.get());
+  if (metadataTable_) {
+    file_ptr->metadata_table = metadataTable_.get();
+    file_ptr->metadata_id = metadataTable_->add(file_ptr.get());
+  }
+
+  watcher.startWatchFile(file_ptr.get());
+
+  return file_ptr.get();
+}
+
+void ViewDatabase::markFileChanged(
+    Watcher& watcher,
+    watchman_file* file,
+    w_clock_t otime) {
+  if (file->exists) {
+    watcher.startWatchFile(file);
+  }
+
+  file->otime = otime;
+  noteStatTimes(file);
+  if (file->metadata_table) {
+    file->metadata_table->update(file->metadata_id, *file);
+  }
+
+  // A dir without a digest has no parent with one
+  for (auto dir = file->parent; dir && dir->treeHashValid; dir = dir->parent) {
+    dir->treeHashValid = false;
+    treeHashes_->erase(dir->getFullPath());
+  }
+
+  if (latestFile_ != file) {
+    // unlink from list
+    file->removeFromFileList();
+
+    // and move to the head
+    insertAtHeadOfFileList(file);
+  }
+}
+
+void ViewDatabase::markDirDeleted(
+    Watcher& watcher,
+    watchman_dir* dir,
+    w_clock_t otime,
+    bool recursive) {
+  if (!dir->last_check_existed) {
+    // If we know that it doesn't exist, return early
+    return;
+  }
+  dir->last_check_existed = false;
+
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+
+    if (file->exists) {
+      auto full_name = dir->getFullPathToChild(file->getName());
+      logf(DBG, "mark_deleted: {}\n", full_name);
+      file->exists = false;
+      markFileChanged(watcher, file, otime);
+    }
+  }
+
+  if (recursive) {
+    for (auto& it : dir->dirs) {
+      auto child = it.second.get();
+
+      markDirDeleted(watcher, child, otime, true);
+    }
+  }
+}
+
+bool ViewDatabase::renameDir(
+    Watcher& watcher,
+    const w_string& from,
+    const w_string& to,
+    w_clock_t otime) {
+  if (from == rootPath_ || to == rootPath_ || is_path_prefix(to, from)) {
+    return false;
+  }
+
+  auto fromParent = resolveDir(from.dirName(), false);
+  auto toParent = resolveDir(to.dirName(), false);
+  if (!fromParent || !toParent || !toParent->last_check_existed) {
+    return false;
+  }
+  auto fromName = from.baseName();
+  auto toName = to.baseName();
+  auto src = fromParent->getChildDir(fromName);
+  auto srcFile = fromParent->getChildFile(fromName);
+  if (!src || !src->last_check_existed || !srcFile || !srcFile->exists ||
+      toParent->getChildDir(toName)) {
+    return false;
+  }
+  auto dstFile = toParent->getChildFile(toName);
+  if (dstFile && dstFile->exists) {
+    return false;
+  }
+
+  logf(DBG, "rename_dir: {} -> {}\n", from, to);
+
+  auto name = names_->intern(toName);
+  // Careful! toParent->dirs is keyed by non-owning string pieces; name is
+  // kept alive by the dir constructed below.
+  auto& dst = toParent->dirs[name];
+  dst = watchman_dir::make(*arena_, name, toParent);
+  copyDirContents(watcher, src, dst.get(), otime);
+
+  dstFile = getOrCreateChildFile(watcher, toParent, toName, otime);
+  dstFile->ctime = otime;
+  dstFile->exists = true;
+  setFileStat(dstFile, srcFile->stat);
+  markFileChanged(watcher, dstFile, otime);
+
+  markDirDeleted(watcher, src, otime, true);
+  srcFile->exists = false;
+  markFileChanged(watcher, srcFile, otime);
+  return true;
+}
+
+void ViewDatabase::copyDirContents(
+    Watcher& watcher,
+    const watchman_dir* src,
+    watchman_dir* dst,
+    w_clock_t otime) {
+  dst->crawled_mtime = src->crawled_mtime;
+
+  for (auto& it : src->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      continue;
+    }
+    auto copy = getOrCreateChildFile(watcher, dst, file->name, otime);
+    copy->exists = true;
+    setFileStat(copy, file->stat);
+    markFileChanged(watcher, copy, otime);
+  }
+
+  for (auto& it : src->dirs) {
+    auto child = it.second.get();
+    if (!child->last_check_existed) {
+      continue;
+    }
+    // The names are already interned, and outlive both dirs
+    auto& copy = dst->dirs[child->name];
+    copy = watchman_dir::make(*arena_, child->name, dst);
+    copyDirContents(watcher, child, copy.get(), otime);
+  }
+}
+
+void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
+  file->next = latestFile_;
+  if (file->next) {
+    file->next->prev = &file->next;
+  }
+  latestFile_ = file;
+  file->prev = &latestFile_;
+  ++numChanges_;
+
+  if (!checkpoints_.empty() &&
+      file->otime.timestamp < checkpoints_.back().timestamp) {
+    // The clock went backwards; the checkpoints no longer bound the
+    // timestamps of the files ahead of them.
+    checkpoints_.clear();
+  }
+  if (++filesSinceCheckpoint_ >= kCheckpointInterval) {
+    filesSinceCheckpoint_ = 0;
+    checkpoints_.push_back(
+        {file, file->otime.timestamp, file->otime.ticks, numChanges_});
+    if (checkpoints_.size() > kMaxCheckpoints) {
+      checkpoints_.pop_front();
+    }
+  }
+}
+
+void ViewDatabase::noteStatTimes(const watchman_file* file) {
+  // A file that the view has yet to see change has no otime to compare
+  // against; markFileChanged() looks again once it does
+  if (file->otime.ticks == 0) {
+    return;
+  }
+  auto latest = std::max(file->stat.mtimeSec, file->stat.ctimeSec);
+  statTimeSkew_ =
+      std::max(statTimeSkew_, latest - int64_t(file->otime.timestamp));
+}
+
+watchman_file* ViewDatabase::getAgeOutStart(time_t cutoff) {
+  // A file can only be aged out if it changed at or before cutoff, in which
+  // case so did any checkpoint that refers to it.
+  while (!checkpoints_.empty() && checkpoints_.front().timestamp <= cutoff) {
+    checkpoints_.pop_front();
+  }
+  // The oldest remaining checkpoint is the furthest we can skip ahead.  If
+  // its file has moved since, it is now nearer the head, which is still
+  // ahead of the files that we're looking for.
+  if (checkpoints_.empty()) {
+    return latestFile_;
+  }
+  return checkpoints_.front().file;
+}
+
+size_t ViewDatabase::getNumFiles() const {
+  return rootDir_->subtreeFiles;
+}
+
+size_t ViewDatabase::estimateFilesChangedSince(const QuerySince& since) const {
+  size_t numFiles = rootDir_->subtreeFiles;
+  // The newest checkpoint that is no newer than since.  Every file that
+  // changed after since moved to the head after that checkpoint was made.
+  auto it = std::upper_bound(
+      checkpoints_.begin(),
+      checkpoints_.end(),
+      since,
+      [](const QuerySince& since, const Checkpoint& checkpoint) {
+        return since.is_timestamp ? since.timestamp < checkpoint.timestamp
+                                  : since.clock.ticks < checkpoint.ticks;
+      });
+  if (it == checkpoints_.begin()) {
+    return numFiles;
+  }
+  --it;
+  return std::min<uint64_t>(numChanges_ - it->changes, numFiles);
+}
+
+void ViewDatabase::insertIntoSuffixIndex(struct watchman_file* file) {
+  // A file's name never changes, so this is the only place that needs to
+  // link it; it unlinks itself when it is destroyed.
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (!suffix) {
+    return;
+  }
+
+  auto& head = suffixIndex_[suffix];
+  file->suffix_next = head;
+  if (file->suffix_next) {
+    file->suffix_next->suffix_prev = &file->suffix_next;
+  }
+  head = file;
+  file->suffix_prev = &head;
+}
+
+void ViewDatabase::insertIntoNameIndex(struct watchman_file* file) {
+  auto& head = nameIndex_[file->lower_name];
+  file->name_next = head;
+  if (file->name_next) {
+    file->name_next->name_prev = &file->name_next;
+  }
+  head = file;
+  file->name_prev = &head;
+}
+
+watchman_file* ViewDatabase::getFilesNamed(
+    const w_string& lowerCaseName) const {
+  auto it = nameIndex_.find(lowerCaseName);
+  if (it == nameIndex_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+watchman_file* ViewDatabase::getFilesWithSuffix(const w_string& suffix) const {
+  auto it = suffixIndex_.find(suffix);
+  if (it == suffixIndex_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+watchman_file** ViewDatabase::typeListHead(DType type) {
+  switch (type) {
+    case DType::Dir:
+      return &dirFiles_;
+    case DType::Symlink:
+      return &symlinkFiles_;
+    default:
+      return nullptr;
+  }
+}
+
+watchman_file* ViewDatabase::getFilesOfType(DType type) const {
+  switch (type) {
+    case DType::Dir:
+      return dirFiles_;
+    case DType::Symlink:
+      return symlinkFiles_;
+    default:
+      return nullptr;
+  }
+}
+
+void ViewDatabase::setFileStat(
+    watchman_file* file,
+    const CompactFileInformation& st) {
+  auto oldType = file->stat.dtype();
+  file->stat = st;
+  noteStatTimes(file);
+  if (file->metadata_table) {
+    file->metadata_table->update(file->metadata_id, *file);
+  }
+
+  // A file that is already linked stays put as long as its type is the
+  // same; check type_prev rather than the old type since a freshly created
+  // file has a zeroed stat.
+  auto newType = st.dtype();
+  if (file->type_prev && oldType == newType) {
+    return;
+  }
+  file->removeFromTypeList();
+
+  auto head = typeListHead(newType);
+  if (!head) {
+    return;
+  }
+  file->type_next = *head;
+  if (file->type_next) {
+    file->type_next->type_prev = &file->type_next;
+  }
+  *head = file;
+  file->type_prev = head;
+}
+
+size_t ViewDatabase::pruneNames() {
+  return names_->prune();
+}
+
+size_t ViewDatabase::releaseNodes(size_t maxNodes) {
+  size_t released = 0;
+  while (released < maxNodes) {
+    // Take the nodes from the ends of the deepest dirs, where erasing them
+    // needn't move any of their siblings
+    auto dir = rootDir_.get();
+    while (!dir->dirs.empty()) {
+      dir = (dir->dirs.end() - 1)->second.get();
+    }
+
+    while (released < maxNodes && !dir->files.empty()) {
+      dir->files.erase((dir->files.end() - 1)->first);
+      ++released;
+    }
+    if (released == maxNodes) {
+      break;
+    }
+    auto parent = dir->parent;
+    if (!parent) {
+      // Only the root dir is left
+      break;
+    }
+    parent->dirs.erase(dir->name);
+    ++released;
+  }
+  return released;
+}
+
+void ViewDatabase::pruneSuffixIndex() {
+  for (auto it = suffixIndex_.begin(); it != suffixIndex_.end();) {
+    if (it->second) {
+      ++it;
+    } else {
+      it = suffixIndex_.erase(it);
+    }
+  }
+}
+
+void ViewDatabase::pruneNameIndex() {
+  for (auto it = nameIndex_.begin(); it != nameIndex_.end();) {
+    if (it->second) {
+      ++it;
+    } else {
+      it = nameIndex_.erase(it);
+    }
+  }
+}
+
+} // namespace watchman
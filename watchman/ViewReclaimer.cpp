@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ViewReclaimer.h"
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/QueryableView.h"
+#include "watchman/WatchmanConfig.h"
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace watchman {
+
+ViewReclaimer::ViewReclaimer(size_t batchSize, std::chrono::milliseconds pause)
+    : batchSize_{batchSize}, pause_{pause}, thread_{[this] { loop(); }} {}
+
+ViewReclaimer::~ViewReclaimer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  thread_.join();
+}
+
+void ViewReclaimer::reclaim(std::shared_ptr<QueryableView> view) {
+  if (!view) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    views_.push_back(std::move(view));
+    ++stats_.pendingViews;
+  }
+  cond_.notify_all();
+}
+
+void ViewReclaimer::drain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [&] { return views_.empty() && !busy_; });
+}
+
+ViewReclaimer::Stats ViewReclaimer::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void ViewReclaimer::loop() noexcept {
+  w_set_thread_name("viewreclaimer");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_.wait(lock, [&] { return stopping_ || !views_.empty(); });
+    if (views_.empty()) {
+      return;
+    }
+    auto view = std::move(views_.front());
+    views_.pop_front();
+    busy_ = true;
+    lock.unlock();
+
+    // Something may have picked up a reference since the view was handed
+    // over; it then goes away with that, untouched.
+    if (view.use_count() == 1) {
+      release(*view);
+    }
+    view.reset();
+#ifdef __GLIBC__
+    // The view's slabs and tables came from malloc, which holds on to
+    // freed memory unless asked
+    malloc_trim(0);
+#endif
+
+    lock.lock();
+    busy_ = false;
+    --stats_.pendingViews;
+    ++stats_.reclaimedViews;
+    cond_.notify_all();
+  }
+}
+
+void ViewReclaimer::release(QueryableView& view) {
+  if (batchSize_ == 0) {
+    return;
+  }
+  while (true) {
+    size_t released;
+    try {
+      released = view.releaseNodes(batchSize_);
+    } catch (const std::exception& exc) {
+      logf(ERR, "releasing the nodes of a view failed: {}\n", exc.what());
+      return;
+    }
+    if (released == 0) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    stats_.releasedNodes += released;
+    // Once stopping, finish up without pausing
+    cond_.wait_for(lock, pause_, [&] { return stopping_; });
+  }
+}
+
+ViewReclaimer& getViewReclaimer() {
+  // Never destroyed, since roots may be released during static destruction
+  static auto* reclaimer = new ViewReclaimer(
+      size_t(std::max(
+          json_int_t(0),
+          Configuration().getInt("view_reclaim_batch_size", 64 * 1024))),
+      std::chrono::milliseconds(std::max(
+          json_int_t(0), Configuration().getInt("view_reclaim_pause_ms", 10))));
+  return *reclaimer;
+}
+
+} // namespace watchman
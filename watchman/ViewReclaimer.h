@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace watchman {
+
+class QueryableView;
+
+/**
+ * Destroys the views of roots that are no longer watched on a thread of its
+ * own.  Freeing the millions of nodes of a large view takes seconds, and
+ * would otherwise happen on whichever thread dropped the last reference to
+ * its root: a client running `watch-del` or `watch-del-all`, or the IO
+ * thread of a root that was reaped.
+ *
+ * A view that nothing else refers to is released batchSize nodes at a
+ * time, pausing between batches, so that the teardown doesn't compete with
+ * the roots that remain for the CPU and the allocator.  Views are torn down
+ * one after another, in the order that they were handed over.
+ *
+ * Thread safe.
+ */
+class ViewReclaimer {
+ public:
+  struct Stats {
+    // Views handed over and not yet destroyed
+    size_t pendingViews{0};
+    uint64_t reclaimedViews{0};
+    uint64_t releasedNodes{0};
+  };
+
+  // A batchSize of 0 releases each view all at once
+  ViewReclaimer(size_t batchSize, std::chrono::milliseconds pause);
+  ~ViewReclaimer();
+  ViewReclaimer(const ViewReclaimer&) = delete;
+  ViewReclaimer& operator=(const ViewReclaimer&) = delete;
+
+  // Takes the reference to view, and destroys the view in the background
+  void reclaim(std::shared_ptr<QueryableView> view);
+
+  // Blocks until every view handed over so far has been destroyed
+  void drain();
+
+  Stats getStats() const;
+
+ private:
+  void loop() noexcept;
+  // Releases the nodes of view, pausing between batches until stopping
+  void release(QueryableView& view);
+
+  const size_t batchSize_;
+  const std::chrono::milliseconds pause_;
+
+  mutable std::mutex mutex_;
+  // Signalled when a view is queued, when one is destroyed, and on stopping
+  std::condition_variable cond_;
+  std::deque<std::shared_ptr<QueryableView>> views_;
+  // Set while the thread is tearing down the view it took off the queue
+  bool busy_{false};
+  bool stopping_{false};
+  Stats stats_;
+
+  // Last, so that it starts after everything that it uses
+  std::thread thread_;
+};
+
+// The daemon's reclaimer, as configured by view_reclaim_batch_size and
+// view_reclaim_pause_ms
+ViewReclaimer& getViewReclaimer();
+
+} // namespace watchman
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ViewSnapshot.h"
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+namespace {
+
+static_assert(
+    std::is_trivially_copyable_v<CompactFileInformation>,
+    "CompactFileInformation is stored as raw bytes");
+
+constexpr char kMagic[8] = {'W', 'M', 'V', 'S', 'N', 'A', 'P', 0};
+constexpr uint32_t kVersion = 5;
+// Bounds what a corrupt header can make us read
+constexpr uint32_t kMaxEpochs = 1024;
+
+// Followed by the root path, the epochs and then the watcher position
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  // Guards against loading a snapshot written by a build with a different
+  // CompactFileInformation layout.
+  uint32_t fileInfoSize;
+  uint32_t rootPathLength;
+  uint32_t numEpochs;
+  uint32_t lastAgeOutTick;
+  uint32_t watcherPositionLength;
+  // The root dir's crawled_mtime; other dirs carry theirs in their records
+  int64_t rootCrawledSec;
+  int64_t rootCrawledNsec;
+};
+
+enum RecordType : uint8_t {
+  kDirRecord = 'D',
+  kFileRecord = 'F',
+  kEndRecord = 'E',
+};
+
+// The root dir is implicitly dir 0
+constexpr uint32_t kRootDirIndex = 0;
+
+class SnapshotWriter {
+ public:
+  SnapshotWriter(
+      const w_string& rootPath,
+      const watchman_dir* rootDir,
+      const ViewSnapshotClock& clock) {
+    SnapshotHeader header{};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.fileInfoSize = sizeof(CompactFileInformation);
+    header.rootPathLength = rootPath.size();
+    header.numEpochs = clock.epochs.size();
+    header.lastAgeOutTick = clock.lastAgeOutTick;
+    header.watcherPositionLength = clock.watcherPosition.size();
+    if (rootDir) {
+      header.rootCrawledSec = rootDir->crawled_mtime.tv_sec;
+      header.rootCrawledNsec = rootDir->crawled_mtime.tv_nsec;
+    }
+    append(header);
+    buf_.append(rootPath.data(), rootPath.size());
+    for (auto& epoch : clock.epochs) {
+      append(epoch.startTime);
+      append(int32_t(epoch.pid));
+      append(epoch.rootNumber);
+      append(epoch.ticks);
+    }
+    buf_.append(clock.watcherPosition);
+  }
+
+  uint32_t dirIndex(const watchman_dir* dir) {
+    if (!dir->parent) {
+      return kRootDirIndex;
+    }
+    auto it = dirIndices_.find(dir);
+    if (it != dirIndices_.end()) {
+      return it->second;
+    }
+
+    // Parents are always emitted before their children
+    auto parent = dirIndex(dir->parent);
+    auto index = uint32_t(dirIndices_.size() + 1);
+    dirIndices_.emplace(dir, index);
+
+    append(kDirRecord);
+    append(parent);
+    appendName(dir->name);
+    append(int64_t(dir->crawled_mtime.tv_sec));
+    append(int64_t(dir->crawled_mtime.tv_nsec));
+    return index;
+  }
+
+  void addFile(const watchman_file* file) {
+    auto dir = dirIndex(file->parent);
+    append(kFileRecord);
+    append(dir);
+    append(file->stat);
+    appendName(file->getName());
+    append(uint8_t(file->exists));
+    appendClock(file->otime);
+    appendClock(file->ctime);
+  }
+
+  std::string finish() {
+    append(kEndRecord);
+    return std::move(buf_);
+  }
+
+ private:
+  template <typename T>
+  void append(const T& value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void appendName(w_string_piece name) {
+    append(uint32_t(name.size()));
+    buf_.append(name.data(), name.size());
+  }
+
+  void appendClock(const w_clock_t& clock) {
+    append(clock.ticks);
+    append(int64_t(clock.timestamp));
+  }
+
+  std::string buf_;
+  std::unordered_map<const watchman_dir*, uint32_t> dirIndices_;
+};
+
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(folly::ByteRange data) : data_(data) {}
+
+  template <typename T>
+  T read() {
+    T value;
+    memcpy(&value, take(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+  w_string_piece readBytes(size_t len) {
+    return w_string_piece(reinterpret_cast<const char*>(take(len)), len);
+  }
+
+  w_string_piece readName() {
+    return readBytes(read<uint32_t>());
+  }
+
+  w_clock_t readClock() {
+    w_clock_t clock;
+    clock.ticks = read<uint32_t>();
+    clock.timestamp = time_t(read<int64_t>());
+    return clock;
+  }
+
+ private:
+  const uint8_t* take(size_t len) {
+    if (data_.size() < len) {
+      throw std::runtime_error("view snapshot is truncated");
+    }
+    auto result = data_.data();
+    data_.advance(len);
+    return result;
+  }
+
+  folly::ByteRange data_;
+};
+
+} // namespace
+
+std::string serializeViewSnapshot(
+    const ViewDatabase& view,
+    const ViewSnapshotClock& clock) {
+  SnapshotWriter writer(
+      view.getRootPath(), view.resolveDir(view.getRootPath()), clock);
+
+  // The recency list runs newest to oldest; emit it oldest first so that
+  // re-inserting each file at the head of the list restores the order.
+  // Deleted files are included so that since queries still report them.
+  std::vector<const watchman_file*> files;
+  for (auto file = view.getLatestFile(); file; file = file->next) {
+    files.push_back(file);
+  }
+  for (auto it = files.rbegin(); it != files.rend(); ++it) {
+    writer.addFile(*it);
+  }
+
+  return writer.finish();
+}
+
+size_t loadViewSnapshot(
+    ViewDatabase& view,
+    Watcher& watcher,
+    folly::ByteRange data,
+    ViewSnapshotClock& clock) {
+  SnapshotReader reader(data);
+
+  auto header = reader.read<SnapshotHeader>();
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("not a view snapshot");
+  }
+  if (header.version != kVersion) {
+    throw std::runtime_error("unsupported view snapshot version");
+  }
+  if (header.fileInfoSize != sizeof(CompactFileInformation)) {
+    throw std::runtime_error("view snapshot was written by a different build");
+  }
+  if (reader.readBytes(header.rootPathLength) != view.getRootPath()) {
+    throw std::runtime_error("view snapshot is for a different root");
+  }
+  if (header.numEpochs == 0 || header.numEpochs > kMaxEpochs) {
+    throw std::runtime_error("view snapshot has invalid clock epochs");
+  }
+  std::vector<ClockEpoch> epochs;
+  for (uint32_t i = 0; i < header.numEpochs; ++i) {
+    ClockEpoch epoch;
+    epoch.startTime = reader.read<uint64_t>();
+    epoch.pid = reader.read<int32_t>();
+    epoch.rootNumber = reader.read<uint32_t>();
+    epoch.ticks = reader.read<uint32_t>();
+    epochs.push_back(epoch);
+  }
+  clock.epochs = std::move(epochs);
+  clock.lastAgeOutTick = header.lastAgeOutTick;
+  clock.watcherPosition =
+      reader.readBytes(header.watcherPositionLength).string();
+
+  std::vector<watchman_dir*> dirs;
+  dirs.push_back(view.resolveDir(view.getRootPath(), true));
+  // A crawl may skip reading a dir whose crawled_mtime matches, so they are
+  // only applied once every file of the snapshot has been restored
+  std::vector<timespec> crawledMtimes;
+  crawledMtimes.push_back(
+      timespec{time_t(header.rootCrawledSec), long(header.rootCrawledNsec)});
+
+  auto lookupDir = [&](uint32_t index) {
+    if (index >= dirs.size()) {
+      throw std::runtime_error("view snapshot references an unknown dir");
+    }
+    return dirs[index];
+  };
+
+  size_t numFiles = 0;
+  while (true) {
+    switch (reader.read<uint8_t>()) {
+      case kDirRecord: {
+        auto parent = lookupDir(reader.read<uint32_t>());
+        auto name = reader.readName();
+        dirs.push_back(
+            view.resolveDir(parent->getFullPathToChild(name), true));
+        auto sec = reader.read<int64_t>();
+        auto nsec = reader.read<int64_t>();
+        crawledMtimes.push_back(timespec{time_t(sec), long(nsec)});
+        break;
+      }
+      case kFileRecord: {
+        auto dir = lookupDir(reader.read<uint32_t>());
+        auto stat = reader.read<CompactFileInformation>();
+        auto name = reader.readName().asWString();
+        bool exists = reader.read<uint8_t>() != 0;
+        auto otime = reader.readClock();
+        auto ctime = reader.readClock();
+        if (otime.ticks > clock.epochs.back().ticks) {
+          throw std::runtime_error("view snapshot has a file from the future");
+        }
+        auto file = view.getOrCreateChildFile(watcher, dir, name, ctime);
+        file->ctime = ctime;
+        file->exists = exists;
+        view.setFileStat(file, stat);
+        view.markFileChanged(watcher, file, otime);
+        ++numFiles;
+        break;
+      }
+      case kEndRecord:
+        for (size_t i = 0; i < dirs.size(); ++i) {
+          dirs[i]->crawled_mtime = crawledMtimes[i];
+        }
+        return numFiles;
+      default:
+        throw std::runtime_error("view snapshot is corrupt");
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Range.h>
+#include <string>
+#include <vector>
+#include "watchman/Clock.h"
+
+namespace watchman {
+
+class ViewDatabase;
+class Watcher;
+
+/**
+ * A view snapshot is a flat binary image of the files in a ViewDatabase,
+ * written to the state dir so that a restarted daemon can seed its view
+ * instead of discovering every file from scratch.
+ *
+ * The layout is a fixed header naming the root, the clock epochs that its
+ * ticks belong to and the position of the watcher's event stream, followed
+ * by a stream of records: dir records name a
+ * dir relative to a previously emitted dir, along with the mtime at which
+ * it was last read in full, and file records carry the name,
+ * CompactFileInformation and clocks of a file in a dir.  Files are emitted
+ * oldest first so that loading them reproduces the recency order.
+ * Everything is stored in native byte order and the snapshot is only
+ * meaningful to a daemon built for the same platform; the header records
+ * enough to reject anything else.
+ *
+ * Files keep their clocks, and deleted files are kept until they are aged
+ * out, so a daemon that continues counting ticks from the snapshot can
+ * answer since queries with the clocks of the process that wrote it.
+ */
+
+/** The clocks that the ticks of a snapshot belong to. */
+struct ViewSnapshotClock {
+  // Oldest first; the last is that of the process that wrote the snapshot,
+  // and its ticks are the view's most recent tick at the time
+  std::vector<ClockEpoch> epochs;
+  // Deleted files with older ticks had been aged out
+  uint32_t lastAgeOutTick{0};
+  // Where the watcher's event stream stood; see Watcher::getStreamPosition
+  std::string watcherPosition;
+};
+
+/**
+ * Encodes the files of view, whose clocks belong to clock.
+ */
+std::string serializeViewSnapshot(
+    const ViewDatabase& view,
+    const ViewSnapshotClock& clock);
+
+/**
+ * Populates view, which must be freshly constructed, from a snapshot
+ * produced by serializeViewSnapshot, and sets clock to that of the
+ * snapshot.  Every file keeps the clocks that it had when the snapshot was
+ * written.  Returns the number of files that were loaded.
+ *
+ * Throws std::runtime_error if data is not a valid snapshot of view's root.
+ * The view may be partially populated in that case, which is harmless
+ * because the subsequent crawl revalidates every node, as long as ticks
+ * are counted from the clock, which is set before any file is loaded.
+ */
+size_t loadViewSnapshot(
+    ViewDatabase& view,
+    Watcher& watcher,
+    folly::ByteRange data,
+    ViewSnapshotClock& clock);
+
+} // namespace watchman
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/WatcherEventRecording.h"
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'E', 'V', 'E', 'N', 'T', 'S'};
+constexpr uint32_t kVersion = 1;
+
+// Buffered events are written once there are this many bytes of them, even
+// in the middle of a batch
+constexpr size_t kMaxBufferedBytes = 64 * 1024;
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t rootPathLength;
+};
+
+template <typename T>
+void append(std::string& buf, const T& value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read(const std::string& data, size_t& offset, T& value) {
+  if (data.size() - offset < sizeof(value)) {
+    return false;
+  }
+  memcpy(&value, data.data() + offset, sizeof(value));
+  offset += sizeof(value);
+  return true;
+}
+
+std::string encodeHeader(const w_string& rootPath) {
+  RecordingHeader header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.rootPathLength = rootPath.size();
+
+  std::string buf;
+  append(buf, header);
+  buf.append(rootPath.data(), rootPath.size());
+  return buf;
+}
+
+} // namespace
+
+WatcherEventRecorder::WatcherEventRecorder(
+    w_string path,
+    w_string rootPath,
+    uint64_t maxBytes)
+    : path_{std::move(path)},
+      rootPath_{std::move(rootPath)},
+      maxFileBytes_{maxBytes / 2} {}
+
+WatcherEventRecorder::~WatcherEventRecorder() {
+  flush();
+}
+
+void WatcherEventRecorder::record(
+    const w_string& path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags) {
+  if (failed_) {
+    return;
+  }
+  append(
+      buffer_,
+      int64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                  now.time_since_epoch())
+                  .count()));
+  append(buffer_, flags.asRaw());
+  append(buffer_, uint32_t(path.size()));
+  buffer_.append(path.data(), path.size());
+  if (buffer_.size() >= kMaxBufferedBytes) {
+    flush();
+  }
+}
+
+void WatcherEventRecorder::open() {
+  // Whatever is already there, perhaps from before a restart, becomes the
+  // previous file
+  std::rename(path_.c_str(), w_string::build(path_, ".1").c_str());
+  try {
+    file_ = folly::File(
+        path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "unable to open watcher event recording {}: {}\n",
+        path_,
+        exc.what());
+    failed_ = true;
+    return;
+  }
+  auto header = encodeHeader(rootPath_);
+  buffer_.insert(0, header);
+  fileBytes_ = 0;
+}
+
+void WatcherEventRecorder::flush() {
+  if (failed_ || buffer_.empty()) {
+    return;
+  }
+  if (!file_ || fileBytes_ + buffer_.size() > maxFileBytes_) {
+    file_.close();
+    open();
+    if (failed_) {
+      buffer_.clear();
+      return;
+    }
+  }
+  if (folly::writeFull(file_.fd(), buffer_.data(), buffer_.size()) !=
+      ssize_t(buffer_.size())) {
+    logf(
+        ERR,
+        "unable to write to watcher event recording {}: {}\n",
+        path_,
+        folly::errnoStr(errno));
+    file_.close();
+    failed_ = true;
+  }
+  fileBytes_ += buffer_.size();
+  buffer_.clear();
+}
+
+WatcherEventReader::WatcherEventReader(const char* path) {
+  if (!folly::readFile(path, data_)) {
+    throw std::runtime_error(folly::to<std::string>(
+        "unable to read ", path, ": ", folly::errnoStr(errno)));
+  }
+  RecordingHeader header;
+  if (!read(data_, offset_, header) ||
+      memcmp(header.magic, kMagic, sizeof(kMagic)) ||
+      header.version != kVersion ||
+      data_.size() - offset_ < header.rootPathLength) {
+    throw std::runtime_error(folly::to<std::string>(
+        path, " is not a watcher event recording"));
+  }
+  rootPath_ = w_string(data_.data() + offset_, header.rootPathLength);
+  offset_ += header.rootPathLength;
+}
+
+std::optional<RecordedWatcherEvent> WatcherEventReader::next() {
+  int64_t micros;
+  PendingFlags::UnderlyingType flags;
+  uint32_t pathLength;
+  if (!read(data_, offset_, micros) || !read(data_, offset_, flags) ||
+      !read(data_, offset_, pathLength) ||
+      data_.size() - offset_ < pathLength) {
+    offset_ = data_.size();
+    return std::nullopt;
+  }
+  RecordedWatcherEvent event{
+      std::chrono::system_clock::time_point{
+          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+              std::chrono::microseconds{micros})},
+      PendingFlags::raw(flags),
+      w_string(data_.data() + offset_, pathLength)};
+  offset_ += pathLength;
+  return event;
+}
+
+w_string rebaseRecordedPath(
+    const w_string& path,
+    const w_string& fromRoot,
+    const w_string& toRoot) {
+  if (path == fromRoot) {
+    return toRoot;
+  }
+  if (path.size() > fromRoot.size() &&
+      w_string_piece(path).startsWith(fromRoot) &&
+      is_slash(path.data()[fromRoot.size()])) {
+    return w_string::pathCat(
+        {toRoot,
+         w_string_piece(
+             path.data() + fromRoot.size() + 1,
+             path.size() - fromRoot.size() - 1)});
+  }
+  return path;
+}
+
+} // namespace watchman
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/File.h>
+#include <chrono>
+#include <optional>
+#include <string>
+#include "watchman/PendingCollection.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+// One change that a watcher added to its PendingChanges
+struct RecordedWatcherEvent {
+  std::chrono::system_clock::time_point time;
+  PendingFlags flags;
+  w_string path;
+};
+
+/**
+ * Records the changes that a watcher reports, as they are added to the
+ * notify thread's PendingChanges and before they are consolidated, so that
+ * storms seen in the wild can be replayed to profile the IO thread.
+ *
+ * The recording is bounded by keeping the most recent events in two files:
+ * when `path` reaches half of `maxBytes` it is renamed to `path.1`,
+ * replacing the previous one, and a new `path` is started.
+ *
+ * Events are buffered until flush(); the notify thread flushes after each
+ * batch.  Not thread safe.
+ */
+class WatcherEventRecorder {
+ public:
+  WatcherEventRecorder(w_string path, w_string rootPath, uint64_t maxBytes);
+  ~WatcherEventRecorder();
+
+  void record(
+      const w_string& path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags);
+
+  void flush();
+
+  const w_string& getPath() const {
+    return path_;
+  }
+
+ private:
+  void open();
+
+  const w_string path_;
+  const w_string rootPath_;
+  const uint64_t maxFileBytes_;
+  folly::File file_;
+  uint64_t fileBytes_{0};
+  std::string buffer_;
+  // Set when the recording can't be written, to stop trying
+  bool failed_{false};
+};
+
+/**
+ * Reads a file written by WatcherEventRecorder.  Throws std::runtime_error if
+ * the file can't be read or isn't a recording.  A partial event at the end,
+ * left by an interrupted write, is ignored.
+ */
+class WatcherEventReader {
+ public:
+  explicit WatcherEventReader(const char* path);
+
+  // The root that the events were recorded for
+  const w_string& getRootPath() const {
+    return rootPath_;
+  }
+
+  // Returns the next event, or nullopt at the end of the recording
+  std::optional<RecordedWatcherEvent> next();
+
+ private:
+  std::string data_;
+  size_t offset_{0};
+  w_string rootPath_;
+};
+
+/**
+ * Returns `path`, which was recorded under `fromRoot`, as the same path under
+ * `toRoot`.  Paths outside of `fromRoot` are returned unchanged.
+ */
+w_string rebaseRecordedPath(
+    const w_string& path,
+    const w_string& fromRoot,
+    const w_string& toRoot);
+
+} // namespace watchman
@@ -8,6 +8,7 @@
 #include "watchman/WatchmanConfig.h"
 #include <folly/ExceptionString.h>
 #include <folly/Synchronized.h>
+#include <atomic>
 #include <optional>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
@@ -23,6 +24,69 @@ struct ConfigState {
 };
 folly::Synchronized<ConfigState> configState;
 
+// Replaced, never modified, while configState is write locked
+std::shared_ptr<const ConfigSnapshot> configSnapshot =
+    std::make_shared<const ConfigSnapshot>();
+
+json_ref getLocked(const ConfigState& state, const char* name) {
+  json_ref val;
+  // Highest precedence: command line arguments
+  if (state.arg_cfg) {
+    val = state.arg_cfg.get_default(name);
+  }
+  // then: global config options
+  if (!val && state.global_cfg) {
+    val = state.global_cfg.get_default(name);
+  }
+  return val;
+}
+
+// Must be called with configState write locked
+void publishSnapshot(const ConfigState& state) {
+  auto snapshot = std::make_shared<ConfigSnapshot>();
+
+  if (auto val = getLocked(state, "_use_bulkstat")) {
+    if (val.isBool()) {
+      snapshot->useBulkstat = val.asBool();
+    } else {
+      logf(ERR, "Expected config value _use_bulkstat to be a boolean\n");
+    }
+  }
+
+  if (auto val = getLocked(state, "_bulkstat_readahead")) {
+    if (val.isBool()) {
+      snapshot->bulkstatReadahead = val.asBool();
+    } else {
+      logf(ERR, "Expected config value _bulkstat_readahead to be a boolean\n");
+    }
+  }
+
+  if (auto val = getLocked(state, "slow_command_log_threshold_seconds")) {
+    if (val.isNumber()) {
+      snapshot->slowCommandLogThresholdSeconds = json_real_value(val);
+    } else {
+      logf(
+          ERR,
+          "Expected config value slow_command_log_threshold_seconds "
+          "to be a number\n");
+    }
+  }
+
+  if (auto val = getLocked(state, "slow_query_log_threshold_ms")) {
+    if (val.isInt()) {
+      snapshot->slowQueryLogThresholdMs = val.asInt();
+    } else {
+      logf(
+          ERR,
+          "Expected config value slow_query_log_threshold_ms to be an "
+          "integer\n");
+    }
+  }
+
+  std::atomic_store(
+      &configSnapshot, std::shared_ptr<const ConfigSnapshot>(snapshot));
+}
+
 std::optional<std::pair<json_ref, w_string>> loadSystemConfig() {
   const char* cfg_file = getenv("WATCHMAN_CONFIG_FILE");
 #ifdef WATCHMAN_CONFIG_FILE
@@ -128,6 +192,11 @@ void cfg_shutdown() {
   auto state = configState.wlock();
   state->global_cfg.reset();
   state->arg_cfg.reset();
+  publishSnapshot(*state);
+}
+
+std::shared_ptr<const ConfigSnapshot> watchman::cfg_get_snapshot() {
+  return std::atomic_load(&configSnapshot);
 }
 
 w_string cfg_get_global_config_file_path() {
@@ -152,6 +221,7 @@ void cfg_load_global_config_file() {
       lockedState->global_cfg.object()[key] = value;
     }
   }
+  publishSnapshot(*lockedState);
 }
 
 void cfg_set_arg(const char* name, const json_ref& val) {
@@ -161,6 +231,7 @@ void cfg_set_arg(const char* name, const json_ref& val) {
   }
 
   state->arg_cfg.set(name, json_ref(val));
+  publishSnapshot(*state);
 }
 
 void cfg_set_global(const char* name, const json_ref& val) {
@@ -170,28 +241,11 @@ void cfg_set_global(const char* name, const json_ref& val) {
   }
 
   state->global_cfg.set(name, json_ref(val));
-}
-
-static json_ref cfg_get_raw(const char* name, const json_ref* optr) {
-  json_ref val;
-
-  if (*optr) {
-    val = optr->get_default(name);
-  }
-  return val;
+  publishSnapshot(*state);
 }
 
 json_ref cfg_get_json(const char* name) {
-  json_ref val;
-  auto state = configState.rlock();
-
-  // Highest precedence: command line arguments
-  val = cfg_get_raw(name, &state->arg_cfg);
-  // then: global config options
-  if (!val) {
-    val = cfg_get_raw(name, &state->global_cfg);
-  }
-  return val;
+  return getLocked(*configState.rlock(), name);
 }
 
 const char* cfg_get_string(const char* name, const char* defval) {
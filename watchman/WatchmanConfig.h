@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 class w_string;
@@ -31,6 +33,29 @@ std::string cfg_pretty_print_root_files(const json_ref& root_files);
 
 namespace watchman {
 
+/**
+ * The global configuration values that are read on hot paths, parsed once
+ * each time the configuration changes so that readers need neither the
+ * config lock nor a walk of the JSON.  A value of the wrong type is logged
+ * and leaves the default in place.
+ */
+struct ConfigSnapshot {
+  // _use_bulkstat; unset means the platform default
+  std::optional<bool> useBulkstat;
+  // _bulkstat_readahead
+  bool bulkstatReadahead{true};
+  // slow_command_log_threshold_seconds
+  double slowCommandLogThresholdSeconds{1.0};
+  // slow_query_log_threshold_ms; negative disables the slow query log
+  json_int_t slowQueryLogThresholdMs{1000};
+};
+
+/**
+ * Returns the snapshot of the current global configuration.  It is never
+ * null, and a held snapshot doesn't change when the configuration does.
+ */
+std::shared_ptr<const ConfigSnapshot> cfg_get_snapshot();
+
 class Configuration {
  public:
   Configuration() = default;
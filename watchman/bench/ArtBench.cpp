@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include "watchman/bench/Datasets.h"
+#include "watchman/thirdparty/libart/src/art.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+constexpr uint32_t kSeed = 1;
+
+// The paths of the default tree in insertion order, as a crawl visits them
+const std::vector<w_string>& crawlOrder() {
+  static const std::vector<w_string> paths = [] {
+    auto& tree = defaultTree();
+    std::vector<w_string> result = tree.dirs;
+    result.insert(result.end(), tree.files.begin(), tree.files.end());
+    return result;
+  }();
+  return paths;
+}
+
+const std::vector<w_string>& randomOrder() {
+  static const std::vector<w_string> paths = shuffled(crawlOrder(), kSeed);
+  return paths;
+}
+
+void insertAll(const std::vector<w_string>& paths, size_t iters) {
+  for (size_t i = 0; i < iters; ++i) {
+    art_tree<uint32_t, w_string> tree;
+    uint32_t value = 0;
+    for (auto& path : paths) {
+      tree.insert(path, value++);
+    }
+    folly::doNotOptimizeAway(tree.size());
+  }
+}
+
+void searchAll(const std::vector<w_string>& paths, size_t iters) {
+  art_tree<uint32_t, w_string> tree;
+  BENCHMARK_SUSPEND {
+    uint32_t value = 0;
+    for (auto& path : crawlOrder()) {
+      tree.insert(path, value++);
+    }
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      folly::doNotOptimizeAway(tree.search(path));
+    }
+  }
+}
+
+} // namespace
+
+BENCHMARK(art_insert_crawl_order, iters) {
+  insertAll(crawlOrder(), iters);
+}
+
+BENCHMARK_RELATIVE(art_insert_random_order, iters) {
+  insertAll(randomOrder(), iters);
+}
+
+BENCHMARK(art_search_crawl_order, iters) {
+  searchAll(crawlOrder(), iters);
+}
+
+BENCHMARK_RELATIVE(art_search_random_order, iters) {
+  searchAll(randomOrder(), iters);
+}
+
+// Lookups of paths that share long prefixes with those in the tree but
+// aren't in it themselves
+BENCHMARK(art_search_missing, iters) {
+  std::vector<w_string> missing;
+  BENCHMARK_SUSPEND {
+    for (auto& path : randomOrder()) {
+      missing.push_back(w_string::build(path, ".orig"));
+    }
+  }
+  searchAll(missing, iters);
+}
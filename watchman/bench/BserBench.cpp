@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <string>
+#include "watchman/bench/Datasets.h"
+#include "watchman/bser.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+int appendToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+// A response to a query over the default tree for its name, size, exists,
+// mtime_ms and new fields
+const json_ref& queryResponse() {
+  static const json_ref response = [] {
+    auto files = json_array();
+    int64_t i = 0;
+    for (auto& name : defaultTree().files) {
+      json_array_append_new(
+          files,
+          json_object({
+              {"name", w_string_to_json(name)},
+              {"size", json_integer(4096 + i % 8192)},
+              {"exists", json_boolean(i % 16 != 0)},
+              {"mtime_ms", json_integer(1600000000000 + i)},
+              {"new", json_boolean(i % 4 == 0)},
+          }));
+      ++i;
+    }
+    return json_object({
+        {"version", typed_string_to_json("benchmark")},
+        {"clock", typed_string_to_json("c:1600000000:1234:1:5678")},
+        {"is_fresh_instance", json_false()},
+        {"files", files},
+    });
+  }();
+  return response;
+}
+
+std::string encode(uint32_t version, const json_ref& json) {
+  std::string buffer;
+  bser_ctx_t ctx{version, 0, appendToString};
+  w_bser_dump(&ctx, json, &buffer);
+  return buffer;
+}
+
+} // namespace
+
+BENCHMARK(bser_encode_v1, iters) {
+  auto& response = queryResponse();
+  for (size_t i = 0; i < iters; ++i) {
+    folly::doNotOptimizeAway(encode(1, response));
+  }
+}
+
+BENCHMARK_RELATIVE(bser_encode_v2, iters) {
+  auto& response = queryResponse();
+  for (size_t i = 0; i < iters; ++i) {
+    folly::doNotOptimizeAway(encode(2, response));
+  }
+}
+
+BENCHMARK(bser_decode, iters) {
+  std::string encoded;
+  BENCHMARK_SUSPEND {
+    encoded = encode(1, queryResponse());
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    json_int_t needed;
+    json_error_t jerr;
+    folly::doNotOptimizeAway(bunser(
+        encoded.data(), encoded.data() + encoded.size(), &needed, &jerr));
+  }
+}
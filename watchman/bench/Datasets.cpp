@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/bench/Datasets.h"
+#include <iterator>
+#include <random>
+#include <utility>
+
+namespace watchman::bench {
+
+namespace {
+
+// Directory names vary in length to exercise prefix compression in the
+// tries, and suffixes repeat as they do in real trees.
+const char* const kDirNames[] = {
+    "src", "lib", "test", "include", "java", "com", "facebook", "internal"};
+const char* const kSuffixes[] = {".cpp", ".h", ".py", ".js", ".json", ".txt"};
+
+void addChildren(
+    SyntheticTree& tree,
+    w_string_piece parent,
+    uint32_t depth,
+    uint32_t dirsPerDir,
+    uint32_t filesPerDir) {
+  for (uint32_t i = 0; i < filesPerDir; ++i) {
+    auto name = w_string::build(
+        "file", i, kSuffixes[i % std::size(kSuffixes)]);
+    tree.files.push_back(
+        parent.size() ? w_string::pathCat({parent, name}) : name);
+  }
+  if (depth == 0) {
+    return;
+  }
+  for (uint32_t i = 0; i < dirsPerDir; ++i) {
+    auto name = w_string::build(kDirNames[i % std::size(kDirNames)], i);
+    auto dir = parent.size() ? w_string::pathCat({parent, name}) : name;
+    tree.dirs.push_back(dir);
+    addChildren(tree, dir, depth - 1, dirsPerDir, filesPerDir);
+  }
+}
+
+} // namespace
+
+SyntheticTree
+makeTree(uint32_t depth, uint32_t dirsPerDir, uint32_t filesPerDir) {
+  SyntheticTree tree;
+  addChildren(tree, w_string_piece{}, depth, dirsPerDir, filesPerDir);
+  return tree;
+}
+
+const SyntheticTree& defaultTree() {
+  static const SyntheticTree tree = makeTree(4, 6, 10);
+  return tree;
+}
+
+std::vector<w_string> underRoot(
+    w_string_piece root,
+    const std::vector<w_string>& paths) {
+  std::vector<w_string> result;
+  result.reserve(paths.size());
+  for (auto& path : paths) {
+    result.push_back(w_string::pathCat({root, path}));
+  }
+  return result;
+}
+
+std::vector<w_string> shuffled(std::vector<w_string> paths, uint32_t seed) {
+  // The output of mt19937 is fully specified by the standard
+  std::mt19937 gen{seed};
+  for (size_t i = paths.size(); i > 1; --i) {
+    std::swap(paths[i - 1], paths[gen() % i]);
+  }
+  return paths;
+}
+
+} // namespace watchman::bench
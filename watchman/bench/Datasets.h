@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman::bench {
+
+/**
+ * A synthetic directory tree.  The same shape always produces the same
+ * paths, in the same order, so that the results of different builds can be
+ * compared.
+ */
+struct SyntheticTree {
+  // Relative to the root of the tree; every directory follows its parent
+  std::vector<w_string> dirs;
+  std::vector<w_string> files;
+};
+
+// Each directory down to `depth` has `dirsPerDir` subdirectories and
+// `filesPerDir` files with a mix of common suffixes.
+SyntheticTree
+makeTree(uint32_t depth, uint32_t dirsPerDir, uint32_t filesPerDir);
+
+/**
+ * The tree that the benchmarks share unless they need a particular shape:
+ * 1554 directories and 15550 files, about the size of a small repository.
+ */
+const SyntheticTree& defaultTree();
+
+// The root that the benchmarks of absolute paths place the tree under
+constexpr const char* kRootPath = "/benchmark/root";
+
+// Returns `root` joined with each of `paths`
+std::vector<w_string> underRoot(
+    w_string_piece root,
+    const std::vector<w_string>& paths);
+
+/**
+ * Returns `paths` in a pseudo-random order that depends only on `seed`.
+ * This doesn't use std::shuffle, whose algorithm differs between standard
+ * libraries.
+ */
+std::vector<w_string> shuffled(std::vector<w_string> paths, uint32_t seed);
+
+} // namespace watchman::bench
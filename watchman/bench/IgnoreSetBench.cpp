@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include "watchman/IgnoreSet.h"
+#include "watchman/bench/Datasets.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+// Ignores the way a typical .watchmanconfig and VCS do: a few build output
+// directories at the top and deeper in the tree, and the VCS directories.
+void addIgnores(IgnoreSet& ignores, const SyntheticTree& tree) {
+  for (auto dir : {"buck-out", "build", ".idea", "node_modules"}) {
+    ignores.add(w_string(dir, W_STRING_UNICODE), false);
+  }
+  // Every 50th directory of the tree, at any depth
+  for (size_t i = 0; i < tree.dirs.size(); i += 50) {
+    ignores.add(tree.dirs[i], false);
+  }
+  for (auto dir : {".hg", ".git", ".svn"}) {
+    ignores.add(w_string(dir, W_STRING_UNICODE), true);
+  }
+}
+
+void checkAll(const std::vector<w_string>& paths, size_t iters) {
+  IgnoreSet ignores;
+  BENCHMARK_SUSPEND {
+    addIgnores(ignores, defaultTree());
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      folly::doNotOptimizeAway(ignores.isIgnored(path.data(), path.size()));
+    }
+  }
+}
+
+} // namespace
+
+// Most of the files are not ignored
+BENCHMARK(IgnoreSet_isIgnored_tree, iters) {
+  checkAll(defaultTree().files, iters);
+}
+
+BENCHMARK(IgnoreSet_isIgnored_build_output, iters) {
+  std::vector<w_string> paths;
+  BENCHMARK_SUSPEND {
+    for (auto& file : defaultTree().files) {
+      paths.push_back(w_string::pathCat({"buck-out/gen", file}));
+    }
+  }
+  checkAll(paths, iters);
+}
+
+BENCHMARK(IgnoreSet_isIgnored_vcs, iters) {
+  std::vector<w_string> paths;
+  BENCHMARK_SUSPEND {
+    for (auto& file : defaultTree().files) {
+      paths.push_back(w_string::pathCat({".hg/store/data", file}));
+    }
+  }
+  checkAll(paths, iters);
+}
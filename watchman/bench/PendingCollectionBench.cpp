@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <chrono>
+#include "watchman/PendingCollection.h"
+#include "watchman/bench/Datasets.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+struct Change {
+  w_string path;
+  PendingFlags flags;
+};
+
+// Every directory of the default tree, followed by its files, as a crawl
+// would report them
+const std::vector<Change>& topDownChanges() {
+  static const std::vector<Change> changes = [] {
+    std::vector<Change> result;
+    auto& tree = defaultTree();
+    for (auto& dir : underRoot(kRootPath, tree.dirs)) {
+      result.push_back(Change{dir, W_PENDING_RECURSIVE});
+    }
+    for (auto& file : underRoot(kRootPath, tree.files)) {
+      result.push_back(Change{file, W_PENDING_VIA_NOTIFY});
+    }
+    return result;
+  }();
+  return changes;
+}
+
+void addAll(
+    PendingChanges& pending,
+    std::vector<Change>::const_iterator begin,
+    std::vector<Change>::const_iterator end) {
+  auto now = std::chrono::system_clock::now();
+  for (auto it = begin; it != end; ++it) {
+    pending.add(it->path, now, it->flags);
+  }
+}
+
+} // namespace
+
+// The recursive changes to the directories prune the changes to the files
+// beneath them as they are added.
+BENCHMARK(PendingChanges_add_top_down, iters) {
+  auto& changes = topDownChanges();
+  for (size_t i = 0; i < iters; ++i) {
+    PendingChanges pending;
+    addAll(pending, changes.begin(), changes.end());
+    folly::doNotOptimizeAway(pending.getPendingItemCount());
+  }
+}
+
+// A recursive delete reports the leaves first; their changes are only
+// pruned once their ancestors' changes arrive.
+BENCHMARK_RELATIVE(PendingChanges_add_bottom_up, iters) {
+  std::vector<Change> changes;
+  BENCHMARK_SUSPEND {
+    changes.assign(topDownChanges().rbegin(), topDownChanges().rend());
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    PendingChanges pending;
+    addAll(pending, changes.begin(), changes.end());
+    folly::doNotOptimizeAway(pending.getPendingItemCount());
+  }
+}
+
+// Changes to files alone, which are never pruned
+BENCHMARK(PendingChanges_add_files_only, iters) {
+  std::vector<Change> changes;
+  BENCHMARK_SUSPEND {
+    for (auto& change : topDownChanges()) {
+      if (change.flags == W_PENDING_VIA_NOTIFY) {
+        changes.push_back(change);
+      }
+    }
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    PendingChanges pending;
+    addAll(pending, changes.begin(), changes.end());
+    folly::doNotOptimizeAway(pending.getPendingItemCount());
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <string>
+#include "watchman/bench/Datasets.h"
+#include "watchman/watchman_hash.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+const std::vector<std::string>& rawPaths() {
+  static const std::vector<std::string> paths = [] {
+    std::vector<std::string> result;
+    for (auto& path : underRoot(kRootPath, defaultTree().files)) {
+      result.emplace_back(path.view());
+    }
+    return result;
+  }();
+  return paths;
+}
+
+} // namespace
+
+BENCHMARK(w_string_construct, iters) {
+  auto& paths = rawPaths();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      w_string str{path.data(), path.size(), W_STRING_BYTE};
+      folly::doNotOptimizeAway(str);
+    }
+  }
+}
+
+// Paths are usually built by joining a directory and a name
+BENCHMARK(w_string_pathCat, iters) {
+  auto& tree = defaultTree();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& file : tree.files) {
+      auto str = w_string::pathCat({kRootPath, file});
+      folly::doNotOptimizeAway(str);
+    }
+  }
+}
+
+// Hashes pieces, since a w_string computes its hash only once
+BENCHMARK(w_string_hash, iters) {
+  auto& paths = rawPaths();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      folly::doNotOptimizeAway(
+          w_string_piece{path.data(), path.size()}.hashValue());
+    }
+  }
+}
+
+// The hash that hashValue() used before, for comparison
+BENCHMARK_RELATIVE(w_hash_bytes_lookup3, iters) {
+  auto& paths = rawPaths();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      folly::doNotOptimizeAway(w_hash_bytes(path.data(), path.size(), 0));
+    }
+  }
+}
+
+// Names repeat much more than paths, and are much shorter
+BENCHMARK(w_string_hash_names, iters) {
+  auto& tree = defaultTree();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& file : tree.files) {
+      folly::doNotOptimizeAway(w_string_piece{file}.baseName().hashValue());
+    }
+  }
+}
+
+BENCHMARK_RELATIVE(w_hash_bytes_lookup3_names, iters) {
+  auto& tree = defaultTree();
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& file : tree.files) {
+      auto name = w_string_piece{file}.baseName();
+      folly::doNotOptimizeAway(w_hash_bytes(name.data(), name.size(), 0));
+    }
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(w_string_piece_baseName_dirName, iters) {
+  std::vector<w_string> paths;
+  BENCHMARK_SUSPEND {
+    paths = underRoot(kRootPath, defaultTree().files);
+  }
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& path : paths) {
+      auto piece = w_string_piece{path};
+      folly::doNotOptimizeAway(piece.baseName());
+      folly::doNotOptimizeAway(piece.dirName());
+    }
+  }
+}
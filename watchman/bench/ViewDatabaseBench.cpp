@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include "watchman/InMemoryView.h"
+#include "watchman/bench/Datasets.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+constexpr uint32_t kSeed = 2;
+
+const std::vector<w_string>& absoluteDirs() {
+  static const std::vector<w_string> dirs =
+      underRoot(kRootPath, defaultTree().dirs);
+  return dirs;
+}
+
+} // namespace
+
+// Building the directory tree, as the initial crawl does.  Every directory
+// follows its parent, so each call creates a single directory.
+BENCHMARK(ViewDatabase_resolveDir_create, iters) {
+  auto& dirs = absoluteDirs();
+  for (size_t i = 0; i < iters; ++i) {
+    ViewDatabase view{w_string{kRootPath}};
+    for (auto& dir : dirs) {
+      folly::doNotOptimizeAway(view.resolveDir(dir, true));
+    }
+  }
+}
+
+// Finding existing directories, as processing changes does
+BENCHMARK(ViewDatabase_resolveDir_lookup, iters) {
+  ViewDatabase view{w_string{kRootPath}};
+  std::vector<w_string> dirs;
+  BENCHMARK_SUSPEND {
+    for (auto& dir : absoluteDirs()) {
+      view.resolveDir(dir, true);
+    }
+    dirs = shuffled(absoluteDirs(), kSeed);
+  }
+  const auto& constView = view;
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& dir : dirs) {
+      folly::doNotOptimizeAway(constView.resolveDir(dir));
+    }
+  }
+}
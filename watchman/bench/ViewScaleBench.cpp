@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/portability/GFlags.h>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include "watchman/InMemoryView.h"
+#include "watchman/bench/Datasets.h"
+#include "watchman/query/GlobTree.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+// The defaults make a tree of 37448 directories and 936225 files
+DEFINE_uint32(view_scale_depth, 5, "Depth of the synthetic tree");
+DEFINE_uint32(
+    view_scale_dirs_per_dir,
+    8,
+    "Subdirectories of each directory of the synthetic tree");
+DEFINE_uint32(
+    view_scale_files_per_dir,
+    25,
+    "Files in each directory of the synthetic tree");
+DEFINE_uint32(
+    view_scale_changed_files,
+    1000,
+    "Files that the since query benchmark finds changed");
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+using Continue = InMemoryView::Continue;
+
+// The synthetic tree, defined in a FakeFileSystem so that crawling it only
+// costs what the view does
+struct ScaleTree {
+  SyntheticTree tree;
+  FakeFileSystem fs;
+
+  ScaleTree()
+      : tree{makeTree(
+            FLAGS_view_scale_depth,
+            FLAGS_view_scale_dirs_per_dir,
+            FLAGS_view_scale_files_per_dir)} {
+    fs.addNode(kRootPath, fs.fakeDir());
+    for (auto& dir : underRoot(kRootPath, tree.dirs)) {
+      fs.addNode(dir.c_str(), fs.fakeDir());
+    }
+    for (auto& file : underRoot(kRootPath, tree.files)) {
+      fs.addNode(file.c_str(), fs.fakeFile());
+    }
+  }
+
+  size_t numFiles() const {
+    // The view holds a node for each dir as well as for each file
+    return tree.dirs.size() + tree.files.size();
+  }
+};
+
+ScaleTree& scaleTree() {
+  static ScaleTree tree;
+  return tree;
+}
+
+// A view of the scale tree, along with what it takes to drive its IO thread
+// by hand
+struct ScaleView {
+  Configuration config;
+  std::shared_ptr<FakeWatcher> watcher;
+  std::shared_ptr<InMemoryView> view;
+  std::shared_ptr<Root> root;
+  PendingCollection pending;
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+
+  explicit ScaleView(FakeFileSystem& fs)
+      : watcher{std::make_shared<FakeWatcher>(fs)},
+        view{std::make_shared<InMemoryView>(
+            fs, w_string{kRootPath}, config, watcher)},
+        root{std::make_shared<Root>(
+            fs,
+            w_string{kRootPath},
+            "fs_type",
+            w_string_to_json("{}"),
+            config,
+            view,
+            [] {})} {
+    pending.lock()->ping();
+  }
+
+  void step() {
+    if (view->stepIoThread(root, state, pending) != Continue::Continue) {
+      throw std::logic_error("the IO thread of the benchmark view stopped");
+    }
+  }
+
+  // The bytes held by the nodes and names of the view
+  int64_t memoryBytes() const {
+    auto status = view->getMemoryStatus();
+    return status.get("view_nodes").get("live_bytes").asInt() +
+        status.get("view_names").get("bytes").asInt();
+  }
+};
+
+// A crawled view that the query benchmarks share.  Some files are changed
+// after the crawl, and sinceTicks is the tick before they were.
+struct QueriedView {
+  ScaleView scale{scaleTree().fs};
+  uint32_t sinceTicks;
+
+  QueriedView() {
+    scale.step();
+    sinceTicks = scale.view->getMostRecentRootNumberAndTickValue().ticks;
+
+    auto& tree = scaleTree();
+    auto files = underRoot(kRootPath, tree.tree.files);
+    size_t numChanged =
+        std::min<size_t>(FLAGS_view_scale_changed_files, files.size());
+    // Spread the changes across the tree
+    size_t stride = numChanged ? files.size() / numChanged : 1;
+    auto now = std::chrono::system_clock::now();
+    for (size_t i = 0; i < numChanged; ++i) {
+      auto& file = files[i * stride];
+      tree.fs.updateMetadata(
+          file.c_str(), [](FileInformation& fi) { fi.size += 1; });
+      scale.pending.lock()->add(file, now, W_PENDING_VIA_NOTIFY);
+    }
+    scale.pending.lock()->ping();
+    scale.step();
+  }
+};
+
+QueriedView& queriedView() {
+  static QueriedView view;
+  return view;
+}
+
+size_t runQuery(
+    const Query& query,
+    void (QueryableView::*generator)(const Query*, QueryContext*) const,
+    std::optional<uint32_t> sinceTicks = std::nullopt) {
+  auto& scale = queriedView().scale;
+  QueryContext ctx{&query, scale.root, false};
+  if (sinceTicks) {
+    ctx.clockAtStartOfQuery =
+        ClockSpec(scale.view->getMostRecentRootNumberAndTickValue());
+    ctx.since.clock.is_fresh_instance = false;
+    ctx.since.clock.ticks = *sinceTicks;
+  }
+  ((*scale.view).*generator)(&query, &ctx);
+  return ctx.resultsArray.size();
+}
+
+} // namespace
+
+// The initial crawl of the scale tree.  Reports the rate at which files were
+// crawled and the memory that the view holds for each of them.
+BENCHMARK_COUNTERS(InMemoryView_initial_crawl, counters, iters) {
+  auto& tree = scaleTree();
+  std::chrono::steady_clock::duration elapsed{};
+  int64_t bytesPerFile = 0;
+  for (size_t i = 0; i < iters; ++i) {
+    std::unique_ptr<ScaleView> scale;
+    BENCHMARK_SUSPEND {
+      scale = std::make_unique<ScaleView>(tree.fs);
+    }
+    auto start = std::chrono::steady_clock::now();
+    scale->step();
+    elapsed += std::chrono::steady_clock::now() - start;
+    BENCHMARK_SUSPEND {
+      bytesPerFile = scale->memoryBytes() / int64_t(tree.numFiles());
+      scale.reset();
+    }
+  }
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  counters["files"] = int64_t(tree.numFiles());
+  counters["files_per_sec"] =
+      seconds > 0 ? int64_t(double(tree.numFiles() * iters) / seconds) : 0;
+  counters["bytes_per_file"] = bytesPerFile;
+}
+
+// The query latencies below are for a view that has already been crawled
+
+// Every file, as a query without a generator does
+BENCHMARK_COUNTERS(InMemoryView_all_files_query, counters, iters) {
+  Query query;
+  BENCHMARK_SUSPEND {
+    queriedView();
+    query.fieldList.add("name");
+  }
+  size_t results = 0;
+  for (size_t i = 0; i < iters; ++i) {
+    results = runQuery(query, &QueryableView::allFilesGenerator);
+  }
+  counters["results"] = int64_t(results);
+}
+
+// The files beneath one of the top level dirs
+BENCHMARK_COUNTERS(InMemoryView_path_query, counters, iters) {
+  Query query;
+  BENCHMARK_SUSPEND {
+    queriedView();
+    query.fieldList.add("name");
+    query.paths.emplace();
+    if (!scaleTree().tree.dirs.empty()) {
+      query.paths->emplace_back(QueryPath{scaleTree().tree.dirs.front(), -1});
+    }
+  }
+  size_t results = 0;
+  for (size_t i = 0; i < iters; ++i) {
+    results = runQuery(query, &QueryableView::pathGenerator);
+  }
+  counters["results"] = int64_t(results);
+}
+
+// The files with one of the tree's suffixes, from the suffix index
+BENCHMARK_COUNTERS(InMemoryView_suffix_query, counters, iters) {
+  Query query;
+  BENCHMARK_SUSPEND {
+    queriedView();
+    query.fieldList.add("name");
+    query.glob_tree = std::make_unique<GlobTree>("", 0);
+    query.suffixes = std::vector<w_string>{"cpp"};
+  }
+  size_t results = 0;
+  for (size_t i = 0; i < iters; ++i) {
+    results = runQuery(query, &QueryableView::globGenerator);
+  }
+  counters["results"] = int64_t(results);
+}
+
+// The files changed since the crawl, as a subscription would ask for
+BENCHMARK_COUNTERS(InMemoryView_since_query, counters, iters) {
+  Query query;
+  uint32_t sinceTicks = 0;
+  BENCHMARK_SUSPEND {
+    sinceTicks = queriedView().sinceTicks;
+    query.fieldList.add("name");
+  }
+  size_t results = 0;
+  for (size_t i = 0; i < iters; ++i) {
+    results = runQuery(query, &QueryableView::timeGenerator, sinceTicks);
+  }
+  counters["results"] = int64_t(results);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Benchmark.h>
+#include "watchman/bench/Datasets.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+using namespace watchman;
+using namespace watchman::bench;
+
+namespace {
+
+void matchAll(const char* pattern, unsigned int flags, size_t iters) {
+  auto& files = defaultTree().files;
+  for (size_t i = 0; i < iters; ++i) {
+    for (auto& file : files) {
+      folly::doNotOptimizeAway(
+          wildmatch(pattern, file.c_str(), flags, nullptr));
+    }
+  }
+}
+
+} // namespace
+
+BENCHMARK(wildmatch_suffix, iters) {
+  matchAll("*.cpp", 0, iters);
+}
+
+BENCHMARK(wildmatch_doublestar_suffix, iters) {
+  matchAll("**/*.cpp", WM_PATHNAME, iters);
+}
+
+BENCHMARK(wildmatch_doublestar_middle, iters) {
+  matchAll("src0/**/test2/*.h", WM_PATHNAME, iters);
+}
+
+BENCHMARK(wildmatch_casefold, iters) {
+  matchAll("**/FILE*.PY", WM_PATHNAME | WM_CASEFOLD, iters);
+}
+
+BENCHMARK(wildmatch_character_class, iters) {
+  matchAll("**/file[0-4].[ch]*", WM_PATHNAME, iters);
+}
@@ -6,6 +6,7 @@
  */
 
 #include "watchman/bser.h"
+#include <algorithm>
 #include "watchman/Logging.h"
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
@@ -38,6 +39,7 @@
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_PREFIXSTRING 0x0e
 
 static const char bser_true = BSER_TRUE;
 static const char bser_false = BSER_FALSE;
@@ -48,6 +50,7 @@ static const char bser_object_hdr = BSER_OBJECT;
 static const char bser_template_hdr = BSER_TEMPLATE;
 static const char bser_utf8string_hdr = BSER_UTF8STRING;
 static const char bser_skip = BSER_SKIP;
+static const char bser_prefixstring_hdr = BSER_PREFIXSTRING;
 
 static bool is_bser_version_supported(const bser_ctx_t* ctx) {
   return ctx->bser_version == 1 || ctx->bser_version == 2;
@@ -82,7 +85,7 @@ bool bunser_generic_string(
   avail -= ineed + 1;
   *needed = ineed + 1 + *len;
 
-  if (*len > avail) {
+  if (*len < 0 || *len > avail) {
     return false;
   }
 
@@ -104,6 +107,12 @@ bool bunser_int(
   int32_t i32;
   int64_t i64;
 
+  if (avail < 1) {
+    // Need at least the type byte to know how much more to ask for
+    *needed = 1;
+    return false;
+  }
+
   switch (buf[0]) {
     case BSER_INT8:
       *needed = 2;
@@ -242,6 +251,44 @@ bser_mixedstring(const bser_ctx_t* ctx, w_string_piece str, void* data) {
   }
 }
 
+static int bser_string(const bser_ctx_t* ctx, const w_string& str, void* data) {
+  switch (str.type()) {
+    case W_STRING_BYTE:
+      return bser_bytestring(ctx, str, data);
+    case W_STRING_UNICODE:
+      return bser_utf8string(ctx, str, data);
+    case W_STRING_MIXED:
+      return bser_mixedstring(ctx, str, data);
+    default:
+      w_assert(false, "unknown string type 0x%02x", str.type());
+      return -1;
+  }
+}
+
+// Emits the elements of an array that were encoded ahead of time by a
+// BserEncoder.  They are only valid for the encoding they were made with.
+static int
+bser_rows(const bser_ctx_t* ctx, const json_bser_rows* rows, void* data) {
+  if (rows->bser_version != ctx->bser_version ||
+      rows->bser_capabilities != ctx->bser_capabilities) {
+    watchman::logf(
+        watchman::ERR,
+        "BSER rows encoded for version {} capabilities {} "
+        "cannot be sent as version {} capabilities {}\n",
+        rows->bser_version,
+        rows->bser_capabilities,
+        ctx->bser_version,
+        ctx->bser_capabilities);
+    return -1;
+  }
+  return ctx->dump(rows->data.data(), rows->data.size(), data);
+}
+
+static size_t bser_array_size(const json_t* array) {
+  auto rows = json_array_get_bser_rows(array);
+  return json_array_size(array) + (rows ? rows->count : 0);
+}
+
 static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data);
 
 static int bser_template(
@@ -251,6 +298,7 @@ static int bser_template(
     void* data) {
   size_t n = json_array_size(array);
   size_t i, pn;
+  auto rows = json_array_get_bser_rows(array);
 
   if (!is_bser_version_supported(ctx)) {
     return -1;
@@ -267,7 +315,7 @@ static int bser_template(
 
   // Now the array of arrays of object values.
   // How many objects
-  if (bser_int(ctx, n, data)) {
+  if (bser_int(ctx, bser_array_size(array), data)) {
     return -1;
   }
 
@@ -299,6 +347,10 @@ static int bser_template(
     }
   }
 
+  if (rows) {
+    return bser_rows(ctx, rows, data);
+  }
+
   return 0;
 }
 
@@ -319,7 +371,7 @@ static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data) {
     return -1;
   }
 
-  if (bser_int(ctx, n, data)) {
+  if (bser_int(ctx, bser_array_size(array), data)) {
     return -1;
   }
 
@@ -331,6 +383,11 @@ static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data) {
     }
   }
 
+  auto rows = json_array_get_bser_rows(array);
+  if (rows) {
+    return bser_rows(ctx, rows, data);
+  }
+
   return 0;
 }
 
@@ -383,20 +440,8 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
       return bser_real(ctx, json_real_value(json), data);
     case JSON_INTEGER:
       return bser_int(ctx, json.asInt(), data);
-    case JSON_STRING: {
-      auto& wstr = json_to_w_string(json);
-      switch (wstr.type()) {
-        case W_STRING_BYTE:
-          return bser_bytestring(ctx, wstr, data);
-        case W_STRING_UNICODE:
-          return bser_utf8string(ctx, wstr, data);
-        case W_STRING_MIXED:
-          return bser_mixedstring(ctx, wstr, data);
-        default:
-          w_assert(false, "unknown string type 0x%02x", wstr.type());
-          return -1;
-      }
-    }
+    case JSON_STRING:
+      return bser_string(ctx, json_to_w_string(json), data);
     case JSON_ARRAY:
       return bser_array(ctx, json, data);
     case JSON_OBJECT:
@@ -460,11 +505,145 @@ int w_bser_write_pdu(
   return 0;
 }
 
+static int append_to_string(const char* buf, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buf, size);
+  return 0;
+}
+
+BserEncoder::BserEncoder(uint32_t bser_version, uint32_t bser_capabilities)
+    : ctx_{bser_version, bser_capabilities, append_to_string},
+      rows_{std::make_unique<json_bser_rows>()} {
+  w_check(
+      is_bser_version_supported(&ctx_),
+      "unsupported BSER version ",
+      bser_version,
+      "\n");
+  rows_->bser_version = bser_version;
+  rows_->bser_capabilities = bser_capabilities;
+}
+
+void BserEncoder::appendNull() {
+  rows_->data.push_back(bser_null);
+}
+
+void BserEncoder::appendBool(bool value) {
+  rows_->data.push_back(value ? bser_true : bser_false);
+}
+
+void BserEncoder::appendInt(json_int_t value) {
+  bser_int(&ctx_, value, &rows_->data);
+}
+
+void BserEncoder::appendReal(double value) {
+  bser_real(&ctx_, value, &rows_->data);
+}
+
+void BserEncoder::appendString(const w_string& value) {
+  bser_string(&ctx_, value, &rows_->data);
+}
+
+void BserEncoder::appendUTF8String(w_string_piece value) {
+  bser_utf8string(&ctx_, value, &rows_->data);
+}
+
+void BserEncoder::appendPrefixString(const w_string& value) {
+  if (ctx_.bser_version == 1 ||
+      !(ctx_.bser_capabilities & BSER_CAP_ACCEPT_PREFIX_STRINGS)) {
+    appendString(value);
+    return;
+  }
+
+  // Work out the bytes and type that bser_string would send
+  w_string bytes = value;
+  char hdr = bser_bytestring_hdr;
+  switch (value.type()) {
+    case W_STRING_BYTE:
+      break;
+    case W_STRING_UNICODE:
+      if (!(ctx_.bser_capabilities & BSER_CAP_DISABLE_UNICODE)) {
+        hdr = bser_utf8string_hdr;
+      }
+      break;
+    case W_STRING_MIXED:
+      if (!(ctx_.bser_capabilities &
+            (BSER_CAP_DISABLE_UNICODE_FOR_ERRORS | BSER_CAP_DISABLE_UNICODE))) {
+        bytes = w_string_piece(value).asUTF8Clean();
+        hdr = bser_utf8string_hdr;
+      }
+      break;
+    default:
+      w_assert(false, "unknown string type 0x%02x", value.type());
+  }
+
+  w_string_piece previous{prefix_};
+  size_t shared = std::mismatch(
+                      bytes.data(),
+                      bytes.data() + std::min(bytes.size(), previous.size()),
+                      previous.data())
+                      .first -
+      bytes.data();
+
+  rows_->data.push_back(bser_prefixstring_hdr);
+  bser_int(&ctx_, shared, &rows_->data);
+  bser_generic_string(
+      &ctx_,
+      w_string_piece{bytes.data() + shared, bytes.size() - shared},
+      &rows_->data,
+      hdr);
+  prefix_ = std::move(bytes);
+}
+
+void BserEncoder::appendSkip() {
+  rows_->data.push_back(bser_skip);
+}
+
+void BserEncoder::appendValue(const json_ref& value) {
+  w_bser_dump(&ctx_, value, &rows_->data);
+}
+
+std::unique_ptr<json_bser_rows> BserEncoder::release() {
+  abandonElement();
+  elementStart_ = 0;
+  // The next rows may be sent on their own, so start the chain afresh
+  prefix_.reset();
+  prefixAtElementStart_.reset();
+  auto rows = std::make_unique<json_bser_rows>();
+  rows->bser_version = rows_->bser_version;
+  rows->bser_capabilities = rows_->bser_capabilities;
+  std::swap(rows, rows_);
+  return rows;
+}
+
+// Returns a capacity to reserve for a container that claims to hold nelems
+// items, each encoded in at least item_size bytes, within the remaining
+// input.  The count comes from the peer, so it is only trusted as far as
+// the input could actually satisfy it.
+static size_t bunser_size_hint(
+    json_int_t nelems,
+    json_int_t item_size,
+    const char* buf,
+    const char* end) {
+  if (nelems <= 0) {
+    return 0;
+  }
+  return (size_t)std::min<json_int_t>(nelems, (end - buf) / item_size);
+}
+
+// Decodes a value, where prefix holds the last prefix string decoded from
+// the same PDU
+static json_ref bunser_value(
+    const char* buf,
+    const char* end,
+    json_int_t* needed,
+    json_error_t* jerr,
+    std::string& prefix);
+
 static json_ref bunser_array(
     const char* buf,
     const char* end,
     json_int_t* used,
-    json_error_t* jerr) {
+    json_error_t* jerr,
+    std::string& prefix) {
   json_int_t needed;
   json_int_t total = 0;
   json_int_t i, nelems;
@@ -496,10 +675,10 @@ static json_ref bunser_array(
   total += needed;
   buf += needed;
 
-  auto arrval = json_array();
+  auto arrval = json_array_of_size(bunser_size_hint(nelems, 1, buf, end));
   for (i = 0; i < nelems; i++) {
     needed = 0;
-    auto item = bunser(buf, end, &needed, jerr);
+    auto item = bunser_value(buf, end, &needed, jerr, prefix);
 
     total += needed;
     buf += needed;
@@ -524,7 +703,8 @@ static json_ref bunser_template(
     const char* buf,
     const char* end,
     json_int_t* used,
-    json_error_t* jerr) {
+    json_error_t* jerr,
+    std::string& prefix) {
   json_int_t needed = 0;
   json_int_t total = 0;
   json_int_t i, nelems;
@@ -533,18 +713,18 @@ static json_ref bunser_template(
   buf++;
   total++;
 
-  if (*buf != BSER_ARRAY) {
+  if (buf >= end || *buf != BSER_ARRAY) {
     snprintf(
         jerr->text,
         sizeof(jerr->text),
         "Expected array encoding, but found 0x%02x",
-        *buf);
+        buf < end ? *buf : 0);
     *used = total;
     return nullptr;
   }
 
   // Load in the property names template
-  auto templ = bunser_array(buf, end, &needed, jerr);
+  auto templ = bunser_array(buf, end, &needed, jerr, prefix);
   if (!templ) {
     *used = needed + total;
     return nullptr;
@@ -570,18 +750,19 @@ static json_ref bunser_template(
   np = json_array_size(templ);
 
   // Now load up the array with object values
-  auto arrval = json_array_of_size((size_t)nelems);
+  auto arrval = json_array_of_size(
+      bunser_size_hint(nelems, std::max<json_int_t>(np, 1), buf, end));
   for (i = 0; i < nelems; i++) {
     auto item = json_object_of_size((size_t)np);
     for (ip = 0; ip < np; ip++) {
-      if (*buf == BSER_SKIP) {
+      if (buf < end && *buf == BSER_SKIP) {
         buf++;
         total++;
         continue;
       }
 
       needed = 0;
-      auto val = bunser(buf, end, &needed, jerr);
+      auto val = bunser_value(buf, end, &needed, jerr, prefix);
       if (!val) {
         *used = needed + total;
         return nullptr;
@@ -606,11 +787,11 @@ static json_ref bunser_object(
     const char* buf,
     const char* end,
     json_int_t* used,
-    json_error_t* jerr) {
+    json_error_t* jerr,
+    std::string& prefix) {
   json_int_t needed;
   json_int_t total = 0;
   json_int_t i, nelems;
-  char keybuf[128];
 
   total = 1;
   buf++;
@@ -627,7 +808,8 @@ static json_ref bunser_object(
   total += needed;
   buf += needed;
 
-  auto objval = json_object();
+  // An empty key takes three bytes and its value at least one more
+  auto objval = json_object_of_size(bunser_size_hint(nelems, 4, buf, end));
   for (i = 0; i < nelems; i++) {
     const char* start;
     json_int_t slen;
@@ -642,17 +824,10 @@ static json_ref bunser_object(
     total += needed;
     buf += needed;
 
-    // Saves us allocating a string when the library is going to
-    // do that anyway
-    if ((uint16_t)slen > sizeof(keybuf) - 1) {
-      snprintf(jerr->text, sizeof(jerr->text), "object key is too long");
-      return nullptr;
-    }
-    memcpy(keybuf, start, (size_t)slen);
-    keybuf[slen] = '\0';
+    w_string key(start, (size_t)slen, W_STRING_BYTE);
 
     // Read value
-    auto item = bunser(buf, end, &needed, jerr);
+    auto item = bunser_value(buf, end, &needed, jerr, prefix);
     total += needed;
     buf += needed;
 
@@ -661,24 +836,77 @@ static json_ref bunser_object(
       return nullptr;
     }
 
-    if (json_object_set_new_nocheck(objval, keybuf, std::move(item))) {
-      *used = total;
-      snprintf(jerr->text, sizeof(jerr->text), "failed to add object property");
-      return nullptr;
-    }
+    objval.set(key, std::move(item));
   }
 
   *used = total;
   return objval;
 }
 
+static json_ref bunser_prefix_string(
+    const char* buf,
+    const char* end,
+    json_int_t* used,
+    json_error_t* jerr,
+    std::string& prefix) {
+  json_int_t needed;
+  json_int_t shared;
+  const char* start;
+  json_int_t len;
+
+  buf++;
+  if (!bunser_int(buf, end - buf, &needed, &shared) || shared < 0 ||
+      (size_t)shared > prefix.size()) {
+    *used = needed + 1;
+    snprintf(jerr->text, sizeof(jerr->text), "invalid prefix string length");
+    return nullptr;
+  }
+  *used = needed + 1;
+  buf += needed;
+
+  if (buf >= end) {
+    *used += 1;
+    snprintf(jerr->text, sizeof(jerr->text), "unexpected end of input");
+    return nullptr;
+  }
+  if ((*buf != BSER_BYTESTRING && *buf != BSER_UTF8STRING) ||
+      !bunser_generic_string(buf, end - buf, &needed, &start, &len)) {
+    snprintf(jerr->text, sizeof(jerr->text), "invalid prefix string suffix");
+    return nullptr;
+  }
+  *used += needed;
+
+  prefix.resize((size_t)shared);
+  prefix.append(start, (size_t)len);
+  return typed_string_to_json(
+      prefix.data(),
+      prefix.size(),
+      *buf == BSER_BYTESTRING ? W_STRING_BYTE : W_STRING_UNICODE);
+}
+
 json_ref bunser(
     const char* buf,
     const char* end,
     json_int_t* needed,
     json_error_t* jerr) {
+  std::string prefix;
+  return bunser_value(buf, end, needed, jerr, prefix);
+}
+
+static json_ref bunser_value(
+    const char* buf,
+    const char* end,
+    json_int_t* needed,
+    json_error_t* jerr,
+    std::string& prefix) {
   json_int_t ival;
 
+  if (buf >= end) {
+    *needed = 1;
+    snprintf(jerr->text, sizeof(jerr->text), "unexpected end of input");
+    return nullptr;
+  }
+
   switch (buf[0]) {
     case BSER_INT8:
     case BSER_INT16:
@@ -709,6 +937,10 @@ json_ref bunser(
     case BSER_REAL: {
       double dval;
       *needed = sizeof(double) + 1;
+      if (end - buf < *needed) {
+        snprintf(jerr->text, sizeof(jerr->text), "invalid real encoding");
+        return nullptr;
+      }
       memcpy(&dval, buf + 1, sizeof(dval));
       return json_real(dval);
     }
@@ -722,12 +954,14 @@ json_ref bunser(
     case BSER_NULL:
       *needed = 1;
       return json_null();
+    case BSER_PREFIXSTRING:
+      return bunser_prefix_string(buf, end, needed, jerr, prefix);
     case BSER_ARRAY:
-      return bunser_array(buf, end, needed, jerr);
+      return bunser_array(buf, end, needed, jerr, prefix);
     case BSER_TEMPLATE:
-      return bunser_template(buf, end, needed, jerr);
+      return bunser_template(buf, end, needed, jerr, prefix);
     case BSER_OBJECT:
-      return bunser_object(buf, end, needed, jerr);
+      return bunser_object(buf, end, needed, jerr, prefix);
     default:
       snprintf(
           jerr->text,
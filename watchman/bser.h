@@ -21,6 +21,22 @@ typedef struct bser_ctx {
 // BSERv2 capabilities. Must be powers of 2.
 #define BSER_CAP_DISABLE_UNICODE 0x1
 #define BSER_CAP_DISABLE_UNICODE_FOR_ERRORS 0x2
+// The client can decode compressed PDUs, which the server may send in place
+// of large responses.
+#define BSER_CAP_ACCEPT_COMPRESSED 0x4
+// Set by the server in the header of a compressed PDU.  Its length is that
+// of a zlib stream which inflates to the BSER encoding of the value.
+#define BSER_CAP_COMPRESSED 0x8
+// The client can map shared memory segments whose descriptors are passed to
+// it, which the server may do in place of sending large responses.
+#define BSER_CAP_ACCEPT_SHARED_MEMORY 0x10
+// Set by the server in the header of a PDU whose value is the size of a
+// shared memory segment, the descriptor of which comes with the PDU's first
+// bytes.  The segment holds the BSER v2 PDU of the response.
+#define BSER_CAP_SHARED_MEMORY 0x20
+// The client can decode prefix strings, which the server may use for the
+// names of query results.
+#define BSER_CAP_ACCEPT_PREFIX_STRINGS 0x40
 
 int w_bser_write_pdu(
     const uint32_t bser_version,
@@ -39,3 +55,61 @@ json_ref bunser(
     const char* end,
     json_int_t* needed,
     json_error_t* jerr);
+
+/**
+ * Encodes a sequence of array elements directly as BSER, for producers that
+ * would otherwise build a json_ref only to have it serialized and freed.
+ * Each append produces exactly the bytes that w_bser_dump() would for the
+ * equivalent json_ref, so a complete element may be made up of several
+ * appends, such as one per field of a template row.
+ *
+ * The result is attached to an array with json_array_set_bser_rows().
+ */
+class BserEncoder {
+ public:
+  BserEncoder(uint32_t bser_version, uint32_t bser_capabilities);
+
+  void appendNull();
+  void appendBool(bool value);
+  void appendInt(json_int_t value);
+  void appendReal(double value);
+  void appendString(const w_string& value);
+  void appendUTF8String(w_string_piece value);
+  // Encodes value relative to the previous string appended this way, if the
+  // client accepts prefix strings.  For values that tend to share a prefix
+  // with the previous one, such as the names of files visited in tree order.
+  void appendPrefixString(const w_string& value);
+  // Marks a template field as absent from the current row
+  void appendSkip();
+  // For values that don't have a more direct encoding
+  void appendValue(const json_ref& value);
+
+  // Counts the bytes appended since the last call as one element
+  void finishElement() {
+    rows_->count++;
+    elementStart_ = rows_->data.size();
+    prefixAtElementStart_ = prefix_;
+  }
+
+  // Discards the bytes appended since the last finishElement()
+  void abandonElement() {
+    rows_->data.resize(elementStart_);
+    prefix_ = prefixAtElementStart_;
+  }
+
+  // The number of finished elements
+  size_t size() const {
+    return rows_->count;
+  }
+
+  // Hands over the finished elements, leaving the encoder empty
+  std::unique_ptr<json_bser_rows> release();
+
+ private:
+  bser_ctx_t ctx_;
+  std::unique_ptr<json_bser_rows> rows_;
+  size_t elementStart_{0};
+  // The last prefix string, as the client will decode it
+  w_string prefix_;
+  w_string prefixAtElementStart_;
+};
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string.h>
+#include <unordered_set>
+#include "watchman/Errors.h"
+#include "watchman/root/Root.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_client.h"
+#include "watchman/watchman_cmd.h"
+
+using namespace watchman;
+
+namespace {
+
+bool isCommand(const json_ref& cmd, const char* name) {
+  auto cmdName = json_string_value(json_array_get(cmd, 0));
+  return cmdName && strcmp(cmdName, name) == 0;
+}
+
+bool isFlagSet(const json_ref& resp, const char* name) {
+  auto flag = resp.get_default(name);
+  return flag && flag.isBool() && flag.asBool();
+}
+
+// Removes and returns the reply of the command, from among the responses
+// that it queued after queuedBefore.  A command may queue more than its
+// reply: subscribe queues its initial results after it, and those and any
+// other unilateral responses stay queued, to be routed by the client as
+// usual.  Partial responses are dropped, as the reply carries their
+// contents too.
+json_ref takeReply(struct watchman_client* client, size_t queuedBefore) {
+  json_ref reply = json_null();
+  auto& responses = client->responses;
+  for (size_t i = queuedBefore; i < responses.size();) {
+    auto& queued = responses[i];
+    if (queued.broadcast || isFlagSet(queued.response, "unilateral")) {
+      ++i;
+      continue;
+    }
+    auto resp = std::move(queued.response);
+    responses.erase(responses.begin() + i);
+    client->responsesBytes -= approximateResponseSize(resp);
+    if (!isFlagSet(resp, "partial")) {
+      reply = std::move(resp);
+    }
+  }
+  return reply;
+}
+
+} // namespace
+
+/* batch [cmd, ...]
+ * Runs each of the commands in turn and responds with their responses, in
+ * the same order.  Of the queries on each root, only the first that syncs
+ * with the filesystem does so; the rest are answered as of that sync. */
+static void cmd_batch(struct watchman_client* client, const json_ref& args) {
+  if (json_array_size(args) != 2 || !args.at(1).isArray()) {
+    send_error_response(client, "'batch' expects an array of commands");
+    return;
+  }
+  auto mode = client->client_mode ? CMD_CLIENT : CMD_DAEMON;
+
+  auto responses = json_array();
+  std::unordered_set<const Root*> synced;
+  for (const auto& cmd : args.at(1).array()) {
+    if (isCommand(cmd, "batch")) {
+      auto resp = make_response();
+      resp.set(
+          "error",
+          typed_string_to_json("'batch' cannot be nested", W_STRING_UNICODE));
+      responses.array().push_back(std::move(resp));
+      continue;
+    }
+
+    json_ref toRun = cmd;
+    const Root* syncingRoot = nullptr;
+    if (isCommand(cmd, "query") && json_array_size(cmd) == 3 &&
+        cmd.at(2).isObject()) {
+      // The results are collected into one response, so can't be streamed
+      auto spec = json_copy(cmd.at(2));
+      spec.set("stream_results", json_false());
+
+      if (!spec.get_default("sync_timeout")) {
+        std::shared_ptr<Root> root;
+        try {
+          root = resolveRoot(client, cmd);
+        } catch (const std::exception&) {
+          // The query reports this itself
+        }
+        if (root && synced.count(root.get())) {
+          spec.set("sync_timeout", json_integer(0));
+        } else if (root) {
+          syncingRoot = root.get();
+        }
+      }
+      toRun = json_array({cmd.at(0), cmd.at(1), spec});
+    } else if (
+        isCommand(cmd, "watch-projects") && json_array_size(cmd) == 3 &&
+        cmd.at(2).isObject()) {
+      // Its partial responses would be written ahead of the batch's reply
+      auto opts = json_copy(cmd.at(2));
+      opts.set("stream_results", json_false());
+      toRun = json_array({cmd.at(0), cmd.at(1), opts});
+    }
+
+    auto queuedBefore = client->responses.size();
+    bool succeeded = dispatch_command(client, toRun, mode);
+    responses.array().push_back(takeReply(client, queuedBefore));
+    if (succeeded && syncingRoot) {
+      synced.insert(syncingRoot);
+    }
+  }
+
+  auto resp = make_response();
+  resp.set("responses", std::move(responses));
+  send_and_dispose_response(client, std::move(resp));
+}
+
+// Validates each of the commands as the CLI would if it were run alone
+static void cli_validate_batch(json_ref& args) {
+  if (json_array_size(args) != 2 || !args.at(1).isArray()) {
+    throw CommandValidationError("'batch' expects an array of commands");
+  }
+  for (auto& cmd : args.array()[1].array()) {
+    auto name = json_string_value(json_array_get(cmd, 0));
+    if (!name) {
+      continue;
+    }
+    auto def = lookup_command(name, CommandFlags{});
+    if (def && def->cli_validate) {
+      def->cli_validate(cmd);
+    }
+  }
+}
+W_CMD_REG(
+    "batch",
+    cmd_batch,
+    CMD_DAEMON | CMD_CLIENT | CMD_POISON_IMMUNE | CMD_ALLOW_ANY_USER |
+        CMD_DISPATCHER,
+    cli_validate_batch)
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -7,11 +7,18 @@
 
 #include <folly/chrono/Conv.h>
 #include <iomanip>
+#include "watchman/CpuProfiler.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryAccounting.h"
+#include "watchman/MemoryBudget.h"
 #include "watchman/Poison.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadAccounting.h"
+#include "watchman/Trace.h"
+#include "watchman/ViewReclaimer.h"
+#include "watchman/query/SlowQueryLog.h"
 #include "watchman/root/Root.h"
 #include "watchman/watchman_client.h"
 #include "watchman/watchman_cmd.h"
@@ -56,11 +63,9 @@ static void cmd_debug_show_cursors(
   auto resp = make_response();
 
   {
-    auto map = root->inner.cursors.rlock();
-    cursors = json_object_of_size(map->size());
-    for (const auto& it : *map) {
-      const auto& name = it.first;
-      const auto& ticks = it.second;
+    auto map = root->inner.cursors.snapshot();
+    cursors = json_object_of_size(map.size());
+    for (const auto& [name, ticks] : map) {
       cursors.set(name.c_str(), json_integer(ticks));
     }
   }
@@ -74,6 +79,45 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root)
 
+static void cmd_debug_metrics(
+    struct watchman_client* client,
+    const json_ref& args) {
+  /* resolve the root */
+  if (json_array_size(args) != 2) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-metrics'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto resp = make_response();
+  resp.set("query-latencies", root->queryMetrics.toJson());
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-metrics", cmd_debug_metrics, CMD_DAEMON, w_cmd_realpath_root)
+
+static void cmd_debug_trace(struct watchman_client* client, const json_ref&) {
+  if (!isTracingEnabled()) {
+    send_error_response(
+        client, "tracing is disabled; set trace_buffer_events to enable it");
+    return;
+  }
+
+  auto resp = make_response();
+  resp.set("trace", traceToChromeJson(collectTrace()));
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-trace", cmd_debug_trace, CMD_DAEMON, NULL)
+
+static void cmd_debug_trace_clear(
+    struct watchman_client* client,
+    const json_ref&) {
+  clearTrace();
+  send_and_dispose_response(client, make_response());
+}
+W_CMD_REG("debug-trace-clear", cmd_debug_trace_clear, CMD_DAEMON, NULL)
+
 /* debug-ageout */
 static void cmd_debug_ageout(
     struct watchman_client* client,
@@ -198,11 +242,27 @@ static json_ref getDebugSubscriptionInfo(Root* root) {
           }));
         }
 
-        subscriptions.array().push_back(json_object({
+        auto info = json_object({
             {"name", w_string_to_json(sub.first)},
             {"client_id", json_integer(user_client->unique_id)},
             {"last_responses", last_responses},
-        }));
+            {"queued_response_bytes",
+             json_integer(user_client->responsesBytes.load())},
+            {"coalesced_responses",
+             json_integer(sub.second->coalescedResponses.load())},
+            {"fresh_instance_markers",
+             json_integer(sub.second->freshInstanceMarkers.load())},
+            {"irrelevant_settles",
+             json_integer(sub.second->irrelevantSettles.load())},
+            {"parked_settles",
+             json_integer(sub.second->parkedSettles.load())},
+        });
+        if (sub.second->deltas) {
+          info.set(
+              "delta_elided_fields",
+              json_integer(sub.second->deltas->elidedFields()));
+        }
+        subscriptions.array().push_back(std::move(info));
       }
     }
   }
@@ -253,10 +313,43 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root)
 
+// Where the time of the IO, notify, client and pool threads has gone, in
+// milliseconds.  Threads that have exited are summed by kind and root.
+static json_ref getThreadAccounting() {
+  auto toMs = [](std::chrono::nanoseconds duration) {
+    return json_real(
+        std::chrono::duration<double, std::milli>(duration).count());
+  };
+  auto threads = json_array();
+  for (auto& stats : ThreadAccount::getAllStats()) {
+    auto info = json_object(
+        {{"kind", typed_string_to_json(stats.kind.c_str())},
+         {"lock_wait_ms", toMs(stats.waitTime[ThreadAccount::Lock])},
+         {"lock_waits", json_integer(stats.waits[ThreadAccount::Lock])},
+         {"io_wait_ms", toMs(stats.waitTime[ThreadAccount::Io])},
+         {"io_waits", json_integer(stats.waits[ThreadAccount::Io])}});
+    if (!stats.root.empty()) {
+      info.set("root", typed_string_to_json(stats.root.c_str()));
+    }
+    if (stats.cpu) {
+      info.set("cpu_ms", toMs(*stats.cpu));
+    }
+    if (stats.exited) {
+      info.set("exited", json_true());
+    } else {
+      info.set(
+          {{"name", typed_string_to_json(stats.name.c_str())},
+           {"age_ms", toMs(stats.age)}});
+    }
+    threads.array().push_back(std::move(info));
+  }
+  return threads;
+}
+
 static void cmd_debug_status(struct watchman_client* client, const json_ref&) {
   auto resp = make_response();
   auto roots = Root::getStatusForAllRoots();
-  resp.set("roots", std::move(roots));
+  resp.set({{"roots", std::move(roots)}, {"threads", getThreadAccounting()}});
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG(
@@ -265,6 +358,125 @@ W_CMD_REG(
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     NULL)
 
+static void cmd_debug_memory(struct watchman_client* client, const json_ref&) {
+  auto totals = json_object();
+  for (size_t i = 0; i < kNumMemoryCategories; ++i) {
+    auto category = static_cast<MemoryCategory>(i);
+    auto usage = getMemoryUsage(category);
+    totals.set(
+        getMemoryCategoryName(category),
+        json_object({
+            {"bytes", json_integer(usage.bytes)},
+            {"allocations", json_integer(usage.allocations)},
+        }));
+  }
+
+  auto reclaimer = getViewReclaimer().getStats();
+
+  auto resp = make_response();
+  resp.set(
+      {{"memory", std::move(totals)},
+       {"roots", Root::getMemoryStatusForAllRoots()},
+       {"view_reclaimer",
+        json_object({
+            {"pending_views", json_integer(reclaimer.pendingViews)},
+            {"reclaimed_views", json_integer(reclaimer.reclaimedViews)},
+            {"released_nodes", json_integer(reclaimer.releasedNodes)},
+        })}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-memory", cmd_debug_memory, CMD_DAEMON, NULL)
+
+static void cmd_debug_memory_budget(
+    struct watchman_client* client,
+    const json_ref&) {
+  auto resp = make_response();
+  resp.set("memory_budget", getMemoryBudget().report());
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-memory-budget", cmd_debug_memory_budget, CMD_DAEMON, NULL)
+
+static void cmd_debug_profile(
+    struct watchman_client* client,
+    const json_ref& args) {
+  if (json_array_size(args) > 3) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-profile'");
+    return;
+  }
+  json_int_t seconds = 5;
+  if (json_array_size(args) >= 2) {
+    auto arg = args.at(1);
+    if (!arg.isInt() || arg.asInt() < 1 || arg.asInt() > 300) {
+      send_error_response(
+          client, "'debug-profile' expects a duration of 1 to 300 seconds");
+      return;
+    }
+    seconds = arg.asInt();
+  }
+  // Not a multiple of the rates of the periodic work of the daemon, so
+  // that the samples don't keep landing in step with it
+  json_int_t frequency = 99;
+  if (json_array_size(args) == 3) {
+    auto arg = args.at(2);
+    if (!arg.isInt() || arg.asInt() < 1 || arg.asInt() > 1000) {
+      send_error_response(
+          client, "'debug-profile' expects a frequency of 1 to 1000 Hz");
+      return;
+    }
+    frequency = arg.asInt();
+  }
+
+  auto profile =
+      profileCpu(std::chrono::seconds{seconds}, uint32_t(frequency));
+  auto folded = json_array_of_size(profile.folded.size());
+  for (auto& stack : profile.folded) {
+    folded.array().push_back(
+        typed_string_to_json(stack.c_str(), W_STRING_MIXED));
+  }
+
+  auto resp = make_response();
+  resp.set(
+      "profile",
+      json_object(
+          {{"seconds", json_integer(seconds)},
+           {"frequency", json_integer(frequency)},
+           {"samples", json_integer(profile.samples)},
+           {"dropped", json_integer(profile.dropped)},
+           {"folded", std::move(folded)}}));
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-profile", cmd_debug_profile, CMD_DAEMON, NULL)
+
+static void cmd_debug_slow_queries(
+    struct watchman_client* client,
+    const json_ref&) {
+  auto& log = getSlowQueryLog();
+  auto entries = log.entries();
+  auto list = json_array_of_size(entries.size());
+  for (auto& entry : entries) {
+    list.array().push_back(entry);
+  }
+  auto resp = make_response();
+  resp.set(
+      {{"slow_queries", std::move(list)},
+       {"total", json_integer(log.numAdded())}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-slow-queries", cmd_debug_slow_queries, CMD_DAEMON, NULL)
+
+static void cmd_debug_slow_queries_clear(
+    struct watchman_client* client,
+    const json_ref&) {
+  getSlowQueryLog().clear();
+  send_and_dispose_response(client, make_response());
+}
+W_CMD_REG(
+    "debug-slow-queries-clear",
+    cmd_debug_slow_queries_clear,
+    CMD_DAEMON,
+    NULL)
+
 static void cmd_debug_watcher_info(
     struct watchman_client* clientbase,
     const json_ref& args) {
@@ -329,6 +541,18 @@ void debugContentHashCache(
   auto stats = view->debugAccessCaches().contentHashCache.stats();
   auto resp = make_response();
   addCacheStats(resp, stats);
+  auto micros = stats.hashingTime.count();
+  resp.set(
+      {{"filesHashed", json_integer(stats.filesHashed)},
+       {"bytesHashed", json_integer(stats.bytesHashed)},
+       {"hashingTimeMicros", json_integer(micros)},
+       {"diskHit", json_integer(stats.diskHit)},
+       {"diskMiss", json_integer(stats.diskMiss)},
+       {"inodeHit", json_integer(stats.inodeHit)},
+       {"hashBytesPerSecond",
+        json_integer(
+            micros > 0 ? json_int_t(stats.bytesHashed * 1000000 / micros)
+                       : 0)}});
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG(
@@ -366,6 +590,151 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root)
 
+void debugCrawlProfile(struct watchman_client* client, const json_ref& args) {
+  /* resolve the root */
+  if (json_array_size(args) != 2 && json_array_size(args) != 3) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-crawl-profile'");
+    return;
+  }
+  size_t limit = SIZE_MAX;
+  if (json_array_size(args) == 3) {
+    auto arg = args.at(2);
+    if (!arg.isInt() || arg.asInt() < 0) {
+      send_error_response(
+          client, "'debug-crawl-profile' expects a non-negative count");
+      return;
+    }
+    limit = size_t(arg.asInt());
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto view = std::dynamic_pointer_cast<watchman::InMemoryView>(root->view());
+  if (!view) {
+    send_error_response(client, "root is not an InMemoryView watcher");
+    return;
+  }
+
+  auto resp = make_response();
+  resp.set("crawl_profile", view->getCrawlProfile(limit));
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-crawl-profile",
+    debugCrawlProfile,
+    CMD_DAEMON,
+    w_cmd_realpath_root)
+
+void debugQueryResultCache(
+    struct watchman_client* client,
+    const json_ref& args) {
+  /* resolve the root */
+  if (json_array_size(args) != 2) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-query-result-cache'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto resp = make_response();
+  addCacheStats(resp, root->queryResultCache.stats());
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-query-result-cache",
+    debugQueryResultCache,
+    CMD_DAEMON,
+    w_cmd_realpath_root)
+
+void debugQueryParseCache(
+    struct watchman_client* client,
+    const json_ref& args) {
+  /* resolve the root */
+  if (json_array_size(args) != 2) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-query-parse-cache'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto resp = make_response();
+  addCacheStats(resp, root->queryParseCache.stats());
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-query-parse-cache",
+    debugQueryParseCache,
+    CMD_DAEMON,
+    w_cmd_realpath_root)
+
+void debugReplayWatcherEvents(
+    struct watchman_client* client,
+    const json_ref& args) {
+  auto numArgs = json_array_size(args);
+  if (numArgs != 3 && numArgs != 4) {
+    send_error_response(
+        client, "wrong number of arguments for 'debug-replay-watcher-events'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto view = std::dynamic_pointer_cast<watchman::InMemoryView>(root->view());
+  if (!view) {
+    send_error_response(client, "root is not an InMemoryView watcher");
+    return;
+  }
+
+  const auto& recording = json_array_get(args, 2);
+  if (!recording.isString()) {
+    send_error_response(client, "expected the path to a recording");
+    return;
+  }
+
+  double speed = 1;
+  if (numArgs == 4) {
+    auto options = json_array_get(args, 3);
+    if (!options.isObject()) {
+      send_error_response(client, "expected an object of options");
+      return;
+    }
+    auto option = options.get_default("speed");
+    if (option) {
+      if (!option.isNumber() || json_number_value(option) < 0) {
+        send_error_response(client, "speed must be a non-negative number");
+        return;
+      }
+      speed = json_number_value(option);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t count;
+  try {
+    WatcherEventReader reader{recording.asString().c_str()};
+    count = view->replayWatcherEvents(reader, speed);
+  } catch (const std::exception& exc) {
+    send_error_response(client, "%s", exc.what());
+    return;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  auto resp = make_response();
+  resp.set(
+      {{"events", json_integer(count)},
+       {"milliseconds", json_integer(elapsed.count())}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-replay-watcher-events",
+    debugReplayWatcherEvents,
+    CMD_DAEMON,
+    w_cmd_realpath_root)
+
 } // namespace
 
 /* vim:ts=2:sw=2:et:
@@ -29,8 +29,12 @@ static void cmd_find(struct watchman_client* client, const json_ref& args) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->command = "find";
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  auto res = w_query_execute(
+      query.get(), root, nullptr, getInterface, nullptr, [client] {
+        return client->hasHungUp();
+      });
   auto response = make_response();
   response.set(
       {{"clock", res.clockAtStartOfQuery.toJson()},
@@ -41,7 +45,7 @@ static void cmd_find(struct watchman_client* client, const json_ref& args) {
 W_CMD_REG(
     "find",
     cmd_find,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_QUERY,
     w_cmd_realpath_root)
 
 /* vim:ts=2:sw=2:et:
@@ -7,6 +7,7 @@
 
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/sockname.h"
@@ -110,6 +111,17 @@ W_CMD_REG(
     CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
     NULL)
 
+/* get-metrics */
+static void cmd_get_metrics(struct watchman_client* client, const json_ref&) {
+  auto resp = make_response();
+  auto metrics = getMetricsRegistry().collect();
+  resp.set(
+      "metrics",
+      typed_string_to_json(metrics.data(), metrics.size(), W_STRING_UNICODE));
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("get-metrics", cmd_get_metrics, CMD_DAEMON, NULL)
+
 /* get-sockname */
 static void cmd_get_sockname(struct watchman_client* client, const json_ref&) {
   auto resp = make_response();
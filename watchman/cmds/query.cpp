@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include "watchman/Errors.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -24,20 +25,64 @@ static void cmd_query(struct watchman_client* client, const json_ref& args) {
   auto root = resolveRoot(client, args);
 
   const auto& query_spec = args.at(2);
-  auto query = w_query_parse(root, query_spec);
+  auto query = w_query_parse_cached(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->command = "query";
 
   if (client->client_mode) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  // The response will be written as BSER in the same format that the request
+  // arrived in, so the results can be encoded up front instead of being
+  // built as JSON values first.
+  if (client->stm && !client->client_mode &&
+      (client->pdu_type == is_bser || client->pdu_type == is_bser_v2)) {
+    query->bserVersion = client->pdu_type == is_bser_v2 ? 2 : 1;
+    query->bserCapabilities = client->capabilities;
+  }
+
+  // Send chunks of results to the client as they are produced, ahead of the
+  // final response, which carries the remainder along with the usual fields.
+  QueryResultsSink resultsSink;
+  if (query->stream_results && client->stm && !client->client_mode) {
+    resultsSink = [client](json_ref&& files) {
+      auto partial = make_response();
+      partial.set({{"files", std::move(files)}, {"partial", json_true()}});
+      client->enqueueResponse(std::move(partial), false);
+      if (!client->sendQueuedResponses()) {
+        throw QueryExecError("client went away while streaming results");
+      }
+    };
+  }
+
+  auto res = w_query_execute(
+      query.get(),
+      root,
+      nullptr,
+      getInterface,
+      std::move(resultsSink),
+      [client] { return client->hasHungUp(); });
   auto response = make_response();
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
        {"clock", res.clockAtStartOfQuery.toJson()},
-       {"files", std::move(res.resultsArray)},
        {"debug", res.debugInfo.render()}});
+  if (res.aggregate) {
+    response.set("aggregate", std::move(res.aggregate));
+  } else {
+    response.set("files", std::move(res.resultsArray));
+  }
+  if (query->limit) {
+    response.set("truncated", json_boolean(res.truncated));
+  }
+  if (res.incomplete) {
+    response.set("incomplete", json_true());
+  }
+  if (query->request_id) {
+    // Lets a client that pipelines its queries match this response
+    response.set("request_id", w_string_to_json(query->request_id));
+  }
   if (res.savedStateInfo) {
     response.set({{"saved-state-info", std::move(res.savedStateInfo)}});
   }
@@ -49,7 +94,7 @@ static void cmd_query(struct watchman_client* client, const json_ref& args) {
 W_CMD_REG(
     "query",
     cmd_query,
-    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER | CMD_QUERY,
     w_cmd_realpath_root)
 
 /* vim:ts=2:sw=2:et:
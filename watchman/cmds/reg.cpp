@@ -8,9 +8,13 @@
 #include <folly/ExceptionString.h>
 #include <folly/ScopeGuard.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <thread>
+#include "watchman/AdmissionController.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/PDU.h"
 #include "watchman/Poison.h"
 #include "watchman/WatchmanConfig.h"
@@ -39,6 +43,82 @@ command_handler_def* lookup(const json_ref& args, CommandFlags mode) {
 
   return lookup_command(json_to_w_string(jstr).view(), mode);
 }
+
+AdmissionController::Config admissionConfig(
+    const char* prefix,
+    json_int_t defaultConcurrent,
+    json_int_t defaultQueued) {
+  auto key = [&](const char* suffix) {
+    return folly::to<std::string>(prefix, suffix);
+  };
+  AdmissionController::Config config;
+  config.maxConcurrent = std::max<json_int_t>(
+      0, cfg_get_int(key("_max_concurrent").c_str(), defaultConcurrent));
+  config.maxQueued = std::max<json_int_t>(
+      0, cfg_get_int(key("_max_queued").c_str(), defaultQueued));
+  config.queueTimeout = std::chrono::milliseconds(std::max<json_int_t>(
+      0, cfg_get_int(key("_queue_timeout_ms").c_str(), 60000)));
+  return config;
+}
+
+// Admits the commands that evaluate queries
+AdmissionController& getQueryAdmission() {
+  static AdmissionController controller{admissionConfig(
+      "query",
+      std::max<json_int_t>(8, 2 * std::thread::hardware_concurrency()),
+      4096)};
+  return controller;
+}
+
+// Admits the rest, which are cheap, and by default aren't limited
+AdmissionController& getCommandAdmission() {
+  static AdmissionController controller{
+      admissionConfig("command", 0, 4096)};
+  return controller;
+}
+
+MetricsCollectorRegistration admissionMetrics(
+    "command_admission",
+    [](MetricsWriter& writer) {
+      static const std::pair<const char*, AdmissionController& (*)()>
+          classes[] = {
+              {"query", getQueryAdmission},
+              {"command", getCommandAdmission}};
+      for (auto& [name, get] : classes) {
+        auto stats = get().stats();
+        MetricLabels labels{{"class", name}};
+        writer.add(
+            "watchman_command_admission_running",
+            MetricType::Gauge,
+            "Commands that hold an admission slot",
+            labels,
+            stats.running);
+        writer.add(
+            "watchman_command_admission_queued",
+            MetricType::Gauge,
+            "Commands that are waiting for an admission slot",
+            labels,
+            stats.queued);
+        writer.add(
+            "watchman_command_admission_rejected",
+            MetricType::Counter,
+            "Commands turned away because the server was overloaded",
+            labels,
+            stats.rejected + stats.timedOut);
+      }
+    });
+
+void send_overloaded_response(
+    struct watchman_client* client,
+    const CommandOverloadedError& e) {
+  // Logged at DBG so that an overload doesn't also flood the log
+  logf(DBG, "dispatch_command: {}\n", e.what());
+  auto resp = make_response();
+  resp.set(
+      {{"error", typed_string_to_json(e.what(), W_STRING_MIXED)},
+       {"overloaded", json_true()}});
+  send_and_dispose_response(client, std::move(resp));
+}
 } // namespace
 
 void preprocess_command(
@@ -80,10 +160,12 @@ bool dispatch_command(
   char sample_name[128];
 
   // Stash a reference to the current command to make it easier to log
-  // the command context in some of the error paths
+  // the command context in some of the error paths.  A batch dispatches its
+  // commands from within its own, so restore whatever was there.
+  auto outerCommand = client->current_command;
   client->current_command = args;
   SCOPE_EXIT {
-    client->current_command = nullptr;
+    client->current_command = outerCommand;
   };
 
   try {
@@ -105,19 +187,27 @@ bool dispatch_command(
       return false;
     }
 
+    AdmissionController::Ticket ticket;
+    if (mode.contains(CMD_DAEMON) && !def->flags.contains(CMD_DISPATCHER)) {
+      ticket = def->flags.contains(CMD_QUERY)
+          ? getQueryAdmission().admit(def->name)
+          : getCommandAdmission().admit(def->name);
+    }
+
     // Scope for the perf sample
     {
       logf(DBG, "dispatch_command: {}\n", def->name);
       snprintf(
           sample_name, sizeof(sample_name), "dispatch_command:%s", def->name);
       PerfSample sample(sample_name);
+      auto outerSample = client->perf_sample;
       client->perf_sample = &sample;
       SCOPE_EXIT {
-        client->perf_sample = nullptr;
+        client->perf_sample = outerSample;
       };
 
       sample.set_wall_time_thresh(
-          cfg_get_double("slow_command_log_threshold_seconds", 1.0));
+          cfg_get_snapshot()->slowCommandLogThresholdSeconds);
 
       def->func(client, args);
 
@@ -133,6 +223,9 @@ bool dispatch_command(
     }
 
     return true;
+  } catch (const CommandOverloadedError& e) {
+    send_overloaded_response(client, e);
+    return false;
   } catch (const std::exception& e) {
     auto what = folly::exceptionStr(e);
     send_error_response(client, "%s", what.c_str());
@@ -35,8 +35,12 @@ static void cmd_since(struct watchman_client* client, const json_ref& args) {
 
   auto query = w_query_parse_legacy(root, args, 3, nullptr, clockspec, nullptr);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->command = "since";
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  auto res = w_query_execute(
+      query.get(), root, nullptr, getInterface, nullptr, [client] {
+        return client->hasHungUp();
+      });
   auto response = make_response();
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
@@ -53,7 +57,7 @@ static void cmd_since(struct watchman_client* client, const json_ref& args) {
 W_CMD_REG(
     "since",
     cmd_since,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_QUERY,
     w_cmd_realpath_root)
 
 /* vim:ts=2:sw=2:et:
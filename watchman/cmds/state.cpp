@@ -163,6 +163,15 @@ static void leave_state(
     std::shared_ptr<ClientStateAssertion> assertion,
     bool abandoned,
     json_t* metadata) {
+  // Subscribers that connect from here on must not see the state as
+  // asserted, since they won't see this broadcast
+  {
+    auto assertedStates = assertion->root->assertedStates.wlock();
+    if (assertion->disposition == ClientStateDisposition::Asserted) {
+      assertion->disposition = ClientStateDisposition::PendingLeave;
+    }
+  }
+
   // Broadcast about the state leave
   auto payload = json_object(
       {{"root", w_string_to_json(assertion->root->root_path)},
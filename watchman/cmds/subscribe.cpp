@@ -5,10 +5,16 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/MapUtil.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/MapUtil.h"
+#include "watchman/MemoryBudget.h"
 #include "watchman/QueryableView.h"
+#include "watchman/SubscriptionResults.h"
+#include "watchman/SubscriptionSessions.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -50,17 +56,152 @@ bool watchman_user_client::unsubByName(const w_string& name) {
   // Break the weakClient pointer so that ~watchman_client_subscription()
   // cannot successfully lockClient and recursively call us.
   subIter->second->weakClient.reset();
+  auto& groupName = subIter->second->group;
+  auto* group = groupName ? folly::get_ptr(pendingGroups, groupName) : nullptr;
+  if (group) {
+    auto& held = group->results;
+    held.erase(
+        std::remove_if(
+            held.begin(),
+            held.end(),
+            [&](const auto& result) { return result.first == name; }),
+        held.end());
+    if (held.empty()) {
+      pendingGroups.erase(groupName);
+    }
+  }
   unilateralSub.erase(subIter->second);
   subscriptions.erase(subIter);
 
   return true;
 }
 
+namespace {
+
+// Merges the results of a query as per mergeSubscriptionResults(), or
+// returns nullptr if it doesn't return the names that tell the files apart
+json_ref mergeQueryResults(
+    const json_ref& older,
+    const json_ref& newer,
+    const Query& query,
+    bool deltas) {
+  if (!query.isFieldRequested("name")) {
+    return nullptr;
+  }
+  return mergeSubscriptionResults(
+      older, newer, query.fieldList.size() == 1, deltas);
+}
+
+} // namespace
+
+void watchman_user_client::enqueueSubscriptionResponse(
+    watchman_client_subscription& sub,
+    json_ref&& response) {
+  if (sub.group) {
+    auto [it, opened] = pendingGroups.try_emplace(sub.group);
+    auto& group = it->second;
+    if (opened) {
+      group.deadline = std::chrono::steady_clock::now() + groupSettle;
+      if (groupSettle.count() > 0) {
+        // Wake up the client when the window closes
+        std::weak_ptr<watchman_client> weakSelf(shared_from_this());
+        folly::futures::sleepUnsafe(groupSettle).thenValue([weakSelf](auto&&) {
+          if (auto self = weakSelf.lock()) {
+            self->ping->notify();
+          }
+        });
+      }
+    }
+    // Later results for a subscription subsume the ones that it already
+    // has in the window, if they can be told apart by name
+    for (auto& [name, held] : group.results) {
+      if (name != sub.name) {
+        continue;
+      }
+      if (auto merged = mergeQueryResults(
+              held, response, *sub.query, sub.deltas != nullptr)) {
+        held = std::move(merged);
+        return;
+      }
+    }
+    group.results.emplace_back(sub.name, std::move(response));
+    return;
+  }
+
+  // While the daemon is over its memory budget, any client that has
+  // anything queued counts as having fallen behind
+  auto budget = getMemoryBudget().underPressure() ? 0 : responseBudgetBytes;
+  if (responsesBytes + approximateResponseSize(response) <= budget) {
+    enqueueResponse(std::move(response), false);
+    return;
+  }
+
+  // The client has fallen behind.  If the last response queued for this
+  // subscription is also results, fold these into it rather than adding
+  // to the queue.  Anything else, such as a state change, has to stay in
+  // order with the results around it.
+  for (auto it = responses.rbegin(); it != responses.rend(); ++it) {
+    auto& queued = it->response;
+    auto name = queued.get_default("subscription");
+    if (!name || !name.isString() || json_to_w_string(name) != sub.name) {
+      continue;
+    }
+    if (!isSubscriptionResults(queued)) {
+      break;
+    }
+
+    auto replacement = mergeQueryResults(
+        queued, response, *sub.query, sub.deltas != nullptr);
+    if (replacement && approximateResponseSize(replacement) <= budget) {
+      ++sub.coalescedResponses;
+    } else if (sub.query->empty_on_fresh_instance) {
+      replacement = freshInstanceMarker(response);
+      ++sub.freshInstanceMarkers;
+      if (sub.deltas) {
+        // The client queries afresh, and so has none of what it was sent
+        sub.deltas->reset();
+      }
+    } else if (replacement) {
+      ++sub.coalescedResponses;
+    } else {
+      break;
+    }
+
+    responsesBytes -= approximateResponseSize(queued);
+    responsesBytes += approximateResponseSize(replacement);
+    queued = std::move(replacement);
+    return;
+  }
+
+  enqueueResponse(std::move(response), false);
+}
+
+void watchman_user_client::flushSubscriptionGroups(bool all) {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = pendingGroups.begin(); it != pendingGroups.end();) {
+    if (!all && it->second.deadline > now) {
+      ++it;
+      continue;
+    }
+
+    auto results = json_array_of_size(it->second.results.size());
+    for (auto& result : it->second.results) {
+      json_array_append_new(results, std::move(result.second));
+    }
+    auto resp = make_response();
+    resp.set(
+        {{"unilateral", json_true()},
+         {"subscription_group", w_string_to_json(it->first)},
+         {"results", std::move(results)}});
+    enqueueResponse(std::move(resp), false);
+    it = pendingGroups.erase(it);
+  }
+}
+
 enum class sub_action { no_sync_needed, execute, defer, drop };
 
 static std::tuple<sub_action, w_string> get_subscription_action(
     struct watchman_client_subscription* sub,
-    const std::shared_ptr<Root>& root,
     ClockPosition position) {
   auto action = sub_action::execute;
   w_string policy_name;
@@ -78,34 +219,13 @@ static std::tuple<sub_action, w_string> get_subscription_action(
       "\n");
 
   if (sub->last_sub_tick != position.ticks) {
-    if (!sub->drop_or_defer.empty()) {
-      auto assertedStates = root->assertedStates.rlock();
-      // This subscription has some policy for states.
-      // Figure out what we should do.
-      for (auto& policy_iter : sub->drop_or_defer) {
-        auto name = policy_iter.first;
-        bool policy_is_drop = policy_iter.second;
-
-        if (!assertedStates->isStateAsserted(name)) {
-          continue;
-        }
-
-        if (action != sub_action::defer) {
-          // This policy is active
-          action = sub_action::defer;
-          policy_name = name;
-        }
-
-        if (policy_is_drop) {
-          action = sub_action::drop;
-
-          // If we're dropping, we don't need to look at any
-          // other policies
-          policy_name = name;
-          break;
-        }
-        // Otherwise keep looking until we find a drop
-      }
+    // A drop policy wins over any defer policy
+    if (!sub->assertedDrops.empty()) {
+      action = sub_action::drop;
+      policy_name = *sub->assertedDrops.begin();
+    } else if (!sub->assertedDefers.empty()) {
+      action = sub_action::defer;
+      policy_name = *sub->assertedDefers.begin();
     }
   } else {
     watchman::log(
@@ -116,9 +236,56 @@ static std::tuple<sub_action, w_string> get_subscription_action(
   return std::make_tuple(action, policy_name);
 }
 
+void watchman_client_subscription::stateTransition(
+    const w_string& state,
+    bool entered) {
+  auto policy = drop_or_defer.find(state);
+  if (policy == drop_or_defer.end()) {
+    return;
+  }
+  auto& asserted = policy->second ? assertedDrops : assertedDefers;
+  if (entered) {
+    asserted.insert(state);
+  } else {
+    asserted.erase(state);
+  }
+}
+
+void watchman_client_subscription::refreshAssertedStates() {
+  assertedDrops.clear();
+  assertedDefers.clear();
+  if (drop_or_defer.empty()) {
+    return;
+  }
+  auto assertedStates = root->assertedStates.rlock();
+  for (auto& [state, isDrop] : drop_or_defer) {
+    if (assertedStates->isStateAsserted(state)) {
+      (isDrop ? assertedDrops : assertedDefers).insert(state);
+    }
+  }
+}
+
+bool watchman_client_subscription::anyRelevantChange(
+    ClockPosition position) const {
+  auto since_spec = query->since_spec.get();
+  if (!relevance || !since_spec || since_spec->tag != w_cs_clock ||
+      since_spec->hasScmParams()) {
+    return true;
+  }
+
+  auto any = root->view()->anyFileChangedBetween(
+      since_spec->clock.position,
+      position,
+      [this](w_string_piece dirName, w_string_piece baseName) {
+        return relevance->matches(dirName, baseName);
+      });
+  return any.value_or(true);
+}
+
 void watchman_client_subscription::processSubscription() {
   try {
     processSubscriptionImpl();
+    root->latencyProbe.dispatched(std::chrono::system_clock::now());
   } catch (const std::system_error& exc) {
     if (exc.code() == error_code::stale_file_handle) {
       // This can happen if, for example, the Eden filesystem got into
@@ -150,7 +317,7 @@ void watchman_client_subscription::processSubscriptionImpl() {
   sub_action action;
   w_string policy_name;
   auto position = root->view()->getMostRecentRootNumberAndTickValue();
-  std::tie(action, policy_name) = get_subscription_action(this, root, position);
+  std::tie(action, policy_name) = get_subscription_action(this, position);
 
   if (action != sub_action::no_sync_needed) {
     bool executeQuery = true;
@@ -187,7 +354,26 @@ void watchman_client_subscription::processSubscriptionImpl() {
       executeQuery = false;
     }
 
+    if (executeQuery && !anyRelevantChange(position)) {
+      // The query would find nothing, so skip straight to where it would
+      // have left its clock
+      last_sub_tick = position.ticks;
+      query->since_spec = std::make_unique<ClockSpec>(position);
+      ++irrelevantSettles;
+      watchman::log(
+          watchman::DBG,
+          "nothing relevant to subscription ",
+          name,
+          " changed.  Advanced ticks to ",
+          last_sub_tick,
+          "\n");
+      executeQuery = false;
+    }
+
     if (executeQuery) {
+      // Take turns with the subscriptions of other clients
+      auto slot = getSubscriptionDispatcher().acquire(priority, queryCost);
+      auto start = std::chrono::steady_clock::now();
       try {
         last_sub_tick =
             runSubscriptionRules(client.get(), root).position().ticks;
@@ -206,13 +392,112 @@ void watchman_client_subscription::processSubscriptionImpl() {
             exc.what(),
             ". Deferring until next change.\n");
       }
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+      queryCost = queryCost.count() ? (3 * queryCost + elapsed) / 4 : elapsed;
     }
   } else {
     watchman::log(watchman::DBG, "subscription ", name, " is up to date\n");
   }
 }
 
-void watchman_client_subscription::updateSubscriptionTicks(QueryResult* res) {
+namespace {
+
+bool samePosition(const ClockPosition& a, const ClockPosition& b) {
+  return a.rootNumber == b.rootNumber && a.ticks == b.ticks;
+}
+
+std::shared_ptr<const QueryResult> executeSubscriptionQuery(
+    Query* query,
+    const std::shared_ptr<Root>& root) {
+  return std::make_shared<const QueryResult>(
+      w_query_execute(query, root, change_set_generator, getInterface));
+}
+
+/**
+ * Executes the query for a subscription, sharing the result with other
+ * subscriptions against this root that run the same query since the same
+ * clock while the root is at the same position.  Clients tend to subscribe
+ * several times with the same expression, and the generator walk and
+ * evaluation only need to happen once for all of them.
+ *
+ * SCM aware queries and queries without a clock are always run directly,
+ * as their result depends on more than the query and the ticks.
+ */
+std::shared_ptr<const QueryResult> executeSharedSubscriptionQuery(
+    const w_string& name,
+    Query* query,
+    const std::shared_ptr<Root>& root) {
+  auto since_spec = query->since_spec.get();
+  if (!since_spec || since_spec->tag != w_cs_clock ||
+      since_spec->hasScmParams()) {
+    return executeSubscriptionQuery(query, root);
+  }
+
+  auto position = root->view()->getMostRecentRootNumberAndTickValue();
+  const auto& since = since_spec->clock.position;
+  auto key = w_string::build(
+      json_dumps(query->query_spec, JSON_COMPACT | JSON_SORT_KEYS),
+      ":",
+      since.rootNumber,
+      ":",
+      since.ticks,
+      ":",
+      query->bserVersion);
+
+  std::promise<std::shared_ptr<const QueryResult>> promise;
+  std::shared_future<std::shared_ptr<const QueryResult>> future;
+  bool owner = false;
+  {
+    auto shared = root->sharedSubscriptionResults.wlock();
+    auto it = shared->find(key);
+    if (it != shared->end() && samePosition(it->second.position, position)) {
+      future = it->second.result;
+    } else {
+      // Results from earlier positions can never be reused
+      for (auto entry = shared->begin(); entry != shared->end();) {
+        if (samePosition(entry->second.position, position)) {
+          ++entry;
+        } else {
+          entry = shared->erase(entry);
+        }
+      }
+      future = promise.get_future().share();
+      (*shared)[key] = Root::SharedQueryResult{position, future};
+      owner = true;
+    }
+  }
+
+  if (!owner) {
+    try {
+      auto res = future.get();
+      logf(DBG, "subscription {} reused the results of the same query\n", name);
+      return res;
+    } catch (const std::exception&) {
+      // Whatever went wrong will be reported when we run it ourselves
+      return executeSubscriptionQuery(query, root);
+    }
+  }
+
+  try {
+    auto res = executeSubscriptionQuery(query, root);
+    promise.set_value(res);
+    return res;
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    auto shared = root->sharedSubscriptionResults.wlock();
+    auto it = shared->find(key);
+    if (it != shared->end() && samePosition(it->second.position, position)) {
+      shared->erase(it);
+    }
+    throw;
+  }
+}
+
+} // namespace
+
+void watchman_client_subscription::updateSubscriptionTicks(
+    const QueryResult* res) {
   // create a new spec that will be used the next time
   query->since_spec = std::make_unique<ClockSpec>(res->clockAtStartOfQuery);
 }
@@ -247,7 +532,8 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
   logf(DBG, "running subscription {} {}\n", name, fmt::ptr(this));
 
   try {
-    auto res = w_query_execute(query.get(), root, time_generator, getInterface);
+    auto sharedResult = executeSharedSubscriptionQuery(name, query.get(), root);
+    const auto& res = *sharedResult;
 
     logf(
         DBG,
@@ -271,12 +557,20 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
       }
     }
 
+    auto files = res.resultsArray;
+    if (deltas) {
+      if (res.isFreshInstance) {
+        // The client starts over from these
+        deltas->reset();
+      }
+      files = deltas->encode(files);
+    }
+
     // We can suppress empty results, unless this is a source code aware query
     // and the mergeBase has changed or this is a fresh instance.
     bool mergeBaseChanged = scmAwareQuery &&
         res.clockAtStartOfQuery.scmMergeBase != query->since_spec->scmMergeBase;
-    if (res.resultsArray.array().empty() && !mergeBaseChanged &&
-        !res.isFreshInstance) {
+    if (files.array().empty() && !mergeBaseChanged && !res.isFreshInstance) {
       updateSubscriptionTicks(&res);
       return nullptr;
     }
@@ -294,12 +588,15 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
     response.set(
         {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
          {"clock", res.clockAtStartOfQuery.toJson()},
-         {"files", std::move(res.resultsArray)},
+         {"files", std::move(files)},
          {"root", w_string_to_json(root->root_path)},
          {"subscription", w_string_to_json(name)},
          {"unilateral", json_true()}});
     if (res.savedStateInfo) {
-      response.set({{"saved-state-info", std::move(res.savedStateInfo)}});
+      response.set({{"saved-state-info", res.savedStateInfo}});
+    }
+    if (res.debugInfo.profile) {
+      response.set({{"profile", res.debugInfo.profile}});
     }
 
     return response;
@@ -324,7 +621,7 @@ ClockSpec watchman_client_subscription::runSubscriptionRules(
 
   if (response) {
     add_root_warnings_to_response(response, root);
-    client->enqueueResponse(std::move(response), false);
+    client->enqueueSubscriptionResponse(*this, std::move(response));
   }
   return position;
 }
@@ -405,6 +702,9 @@ static void cmd_flush_subscriptions(
   std::vector<w_string> cookieFileNames;
   root->syncToNow(std::chrono::milliseconds(sync_timeout), cookieFileNames);
 
+  // Results that are held for a group come before the flushed ones
+  client->flushSubscriptionGroups(true);
+
   auto resp = make_response();
   auto synced = json_array();
   auto no_sync_needed = json_array();
@@ -417,8 +717,11 @@ static void cmd_flush_subscriptions(
     sub_action action;
     w_string policy_name;
     auto position = root->view()->getMostRecentRootNumberAndTickValue();
+    // The state broadcasts since the last settle may not have been
+    // processed yet, so ask the root
+    sub->refreshAssertedStates();
     std::tie(action, policy_name) =
-        get_subscription_action(sub.get(), root, position);
+        get_subscription_action(sub.get(), position);
 
     if (action == sub_action::drop) {
       sub->last_sub_tick = position.ticks;
@@ -536,8 +839,15 @@ static void cmd_subscribe(
 
   query = w_query_parse(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->command = "subscribe";
   query->subscriptionName = json_to_w_string(jname);
 
+  if (query->aggregate) {
+    send_error_response(
+        client, "subscriptions deliver files and can't be aggregate queries");
+    return;
+  }
+
   defer_list = query_spec.get_default("defer");
   if (defer_list && !defer_list.isArray()) {
     send_error_response(client, "defer field must be an array of strings");
@@ -555,6 +865,56 @@ static void cmd_subscribe(
 
   sub->name = json_to_w_string(jname);
   sub->query = query;
+  sub->relevance = RelevanceFilter::forQuery(
+      root->root_path, query->relative_root, query->expr.get());
+
+  auto group = query_spec.get_default("group");
+  if (group) {
+    if (!group.isString()) {
+      send_error_response(client, "group must be a string");
+      return;
+    }
+    sub->group = json_to_w_string(group);
+  }
+
+  auto priority = query_spec.get_default("priority");
+  if (priority) {
+    static const std::pair<const char*, SubscriptionDispatcher::Priority>
+        priorities[] = {
+            {"high", SubscriptionDispatcher::Priority::High},
+            {"normal", SubscriptionDispatcher::Priority::Normal},
+            {"low", SubscriptionDispatcher::Priority::Low}};
+    auto it = std::find_if(
+        std::begin(priorities), std::end(priorities), [&](const auto& p) {
+          return priority.isString() &&
+              json_to_w_string(priority) == w_string_piece{p.first};
+        });
+    if (it == std::end(priorities)) {
+      send_error_response(
+          client, "priority must be one of \"high\", \"normal\" or \"low\"");
+      return;
+    }
+    sub->priority = it->second;
+  }
+
+  auto deltaFields = query_spec.get_default("delta_fields", json_false());
+  if (!deltaFields.isBool()) {
+    send_error_response(client, "delta_fields must be boolean");
+    return;
+  }
+  if (deltaFields.asBool()) {
+    if (!query->isFieldRequested("name") || query->fieldList.size() < 2) {
+      send_error_response(
+          client,
+          "delta_fields requires the \"name\" field and at least one other");
+      return;
+    }
+    std::vector<w_string> fields;
+    for (auto& field : query->fieldList) {
+      fields.push_back(field->name);
+    }
+    sub->deltas = std::make_unique<SubscriptionDeltas>(std::move(fields));
+  }
 
   auto defer = query_spec.get_default("defer_vcs", json_true());
   if (!defer.isBool()) {
@@ -580,6 +940,32 @@ static void cmd_subscribe(
     }
   }
 
+  auto resumeToken = query_spec.get_default("resume_token");
+  if (resumeToken && !resumeToken.isString()) {
+    send_error_response(client, "resume_token must be a string");
+    return;
+  }
+  bool resumed = false;
+  auto resumeGrace = std::chrono::seconds(
+      root->config.getInt("subscription_resume_grace_seconds", 0));
+  if (resumeGrace.count() > 0) {
+    // A query that has its own since is resumed by it instead
+    if (resumeToken && !query->since_spec) {
+      auto token = json_to_w_string(resumeToken);
+      auto clock = getSubscriptionSessions().resume(
+          token, root->root_path, sub->name, query_spec);
+      if (clock) {
+        query->since_spec = std::make_unique<ClockSpec>(clock);
+        sub->resumeToken = token;
+        resumed = true;
+      }
+    }
+    if (!sub->resumeToken) {
+      sub->resumeToken = SubscriptionSessions::newToken();
+    }
+    sub->resumeGrace = resumeGrace;
+  }
+
   // If they want SCM aware results we should wait for SCM events to finish
   // before dispatching subscriptions
   if (query->since_spec && query->since_spec->hasScmParams()) {
@@ -621,6 +1007,11 @@ static void cmd_subscribe(
 
   client->subscriptions[sub->name] = sub;
 
+  if (query->isFieldRequested("content.sha1hex") ||
+      query->isFieldRequested("content.spooky128hex")) {
+    root->contentHashQueries.wlock()->push_back(query);
+  }
+
   resp = make_response();
   resp.set("subscribe", json_ref(jname));
 
@@ -629,20 +1020,28 @@ static void cmd_subscribe(
   initial_subscription_results = sub->buildSubscriptionResults(
       root, position, OnStateTransition::DontAdvance);
   resp.set("clock", position.toJson());
+  if (sub->resumeToken) {
+    resp.set(
+        {{"resume_token", w_string_to_json(sub->resumeToken)},
+         {"resumed", json_boolean(resumed)}});
+  }
+  if (!initial_subscription_results && position.tag == w_cs_clock) {
+    // There were no changes to send, so the client is up to date
+    sub->deliveredClock = position.toJson();
+  }
   auto saved_state_info =
       initial_subscription_results.get_default("saved-state-info");
   if (saved_state_info) {
     resp.set("saved-state-info", std::move(saved_state_info));
   }
 
+  // The subscription is already connected to the root, so the broadcasts
+  // of any states that are entered or left from here on will follow
+  sub->refreshAssertedStates();
   auto asserted_states = json_array();
-  {
-    auto rootAssertedStates = root->assertedStates.rlock();
-    for (const auto& key : sub->drop_or_defer) {
-      if (rootAssertedStates->isStateAsserted(key.first)) {
-        // Not sure what to do in case of failure here. -jupi
-        json_array_append(asserted_states, w_string_to_json(key.first));
-      }
+  for (const auto* asserted : {&sub->assertedDrops, &sub->assertedDefers}) {
+    for (const auto& state : *asserted) {
+      json_array_append(asserted_states, w_string_to_json(state));
     }
   }
   resp.set("asserted-states", json_ref(asserted_states));
@@ -655,8 +1054,9 @@ static void cmd_subscribe(
 W_CMD_REG(
     "subscribe",
     cmd_subscribe,
-    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER | CMD_QUERY,
     w_cmd_realpath_root)
+W_CAP_REG("subscription-groups")
 
 /* vim:ts=2:sw=2:et:
  */
@@ -82,7 +82,16 @@ static void cmd_trigger_list(
   auto resp = make_response();
   auto arr = root->triggerListToJson();
 
-  resp.set("triggers", std::move(arr));
+  auto scheduling = json_object();
+  {
+    auto map = root->triggers.rlock();
+    for (const auto& it : *map) {
+      scheduling.set(it.first, it.second->schedulingStats());
+    }
+  }
+
+  resp.set(
+      {{"triggers", std::move(arr)}, {"scheduling", std::move(scheduling)}});
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG("trigger-list", cmd_trigger_list, CMD_DAEMON, w_cmd_realpath_root)
@@ -198,6 +207,7 @@ static void cmd_trigger(struct watchman_client* client, const json_ref& args) {
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG("trigger", cmd_trigger, CMD_DAEMON, w_cmd_realpath_root)
+W_CAP_REG("trigger-persistent")
 
 /* vim:ts=2:sw=2:et:
  */
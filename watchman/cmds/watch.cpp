@@ -5,12 +5,24 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/LogConfig.h"
+#include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/RealPathCache.h"
 #include "watchman/root/Root.h"
+#include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
+#include "watchman/watchman_client.h"
 #include "watchman/watchman_cmd.h"
 
 using namespace watchman;
@@ -111,6 +123,8 @@ static void cmd_watch_delete(
   }
 
   auto root = resolveRoot(client, args);
+  // A watch after this one starts from scratch
+  root->view()->discardSnapshot();
 
   auto resp = make_response();
   resp.set(
@@ -213,7 +227,7 @@ static w_string resolve_projpath(const json_ref& args, w_string& relpath) {
     throw CommandValidationError("second argument must be a string");
   }
 
-  auto resolved = realPath(path);
+  auto resolved = getRealPathCache().resolve(path);
 
   auto root_files = cfg_compute_root_files(&enforcing);
   if (!root_files) {
@@ -297,21 +311,76 @@ W_CMD_REG(
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root)
 
+// Arranges for the progress of the crawl of root to be relayed to client
+// until it is ready.  Returns false if the crawl is already ready, in which
+// case nothing is relayed.
+static bool relay_crawl_progress(
+    watchman_user_client* client,
+    const std::shared_ptr<Root>& root) {
+  std::weak_ptr<watchman_client> clientRef(client->shared_from_this());
+  auto progress = root->unilateralResponses->subscribe(
+      [clientRef]() {
+        if (auto client = clientRef.lock()) {
+          client->ping->notify();
+        }
+      },
+      json_object(
+          {{"watch", w_string_to_json(root->root_path)},
+           {"client", w_string_to_json(w_string::build(client->unique_id))},
+           {"crawl_progress", json_true()}}));
+
+  // Checked only once subscribed, so that a crawl that completes after
+  // this is relayed as ready
+  auto ready = root->view()->waitUntilReadyToQuery(root);
+  if (ready.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    return false;
+  }
+  client->crawlWatches[root->root_path] =
+      watchman_user_client::CrawlWatch{root, std::move(progress)};
+  return true;
+}
+
 static void cmd_watch_project(
     struct watchman_client* client,
     const json_ref& args) {
   /* resolve the root */
-  if (json_array_size(args) != 2) {
+  if (json_array_size(args) != 2 && json_array_size(args) != 3) {
     send_error_response(client, "wrong number of arguments to 'watch-project'");
     return;
   }
 
+  // With "async", respond as soon as the root is being watched rather than
+  // once its crawl is ready, and relay the crawl's progress meanwhile
+  bool async = false;
+  if (json_array_size(args) == 3) {
+    auto& opts = args.at(2);
+    if (!opts.isObject()) {
+      throw CommandValidationError(
+          "the third argument to 'watch-project' must be an object");
+    }
+    auto asyncOpt = opts.get_default("async", json_false());
+    if (!asyncOpt.isBool()) {
+      throw CommandValidationError("'async' must be a boolean");
+    }
+    async = asyncOpt.asBool();
+  }
+  auto userClient = dynamic_cast<watchman_user_client*>(client);
+  if (async && !userClient) {
+    throw CommandValidationError(
+        "'async' requires a connection to the watchman service");
+  }
+
   w_string rel_path_from_watch;
   auto dir_to_watch = resolve_projpath(args, rel_path_from_watch);
 
   auto root = resolveOrCreateRoot(client, args);
 
-  root->view()->waitUntilReadyToQuery(root).wait();
+  bool crawling = false;
+  if (async) {
+    crawling = relay_crawl_progress(userClient, root);
+  } else {
+    root->view()->waitUntilReadyToQuery(root).wait();
+  }
 
   auto resp = make_response();
 
@@ -324,6 +393,9 @@ static void cmd_watch_project(
     resp.set(
         {{"watch", w_string_to_json(root->root_path)},
          {"watcher", w_string_to_json(root->view()->getName())}});
+    if (async) {
+      resp.set("crawling", json_boolean(crawling));
+    }
   }
   add_root_warnings_to_response(resp, root);
   if (!rel_path_from_watch.empty()) {
@@ -336,6 +408,231 @@ W_CMD_REG(
     cmd_watch_project,
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root)
+W_CAP_REG("watch-project-async")
+
+namespace {
+
+// The outcome of watching one of the paths of a watch-projects command
+struct ProjectWatch {
+  size_t index;
+  std::shared_ptr<Root> root;
+  w_string relPath;
+  std::string error;
+};
+
+// How often a watch-projects worker that is waiting for a crawl checks
+// whether the command has been abandoned
+constexpr std::chrono::milliseconds kWatchProjectsPollInterval{100};
+
+// Resolves the project that contains path, and watches it until its crawl
+// is ready, as watch-project would for a client in clientMode whose owner
+// status is isOwner.  This runs on a thread of its own, so it doesn't touch
+// the client.  Gives up waiting for the crawl once cancelled is set.
+ProjectWatch watchProject(
+    size_t index,
+    const json_ref& path,
+    bool clientMode,
+    bool isOwner,
+    const std::atomic<bool>& cancelled) {
+  ProjectWatch watch{index, nullptr, w_string(), std::string()};
+  try {
+    auto args = json_array({typed_string_to_json("watch-project"), path});
+    resolve_projpath(args, watch.relPath);
+    watch.root = resolveOrCreateRootAs(args, true, clientMode, isOwner);
+    auto ready = watch.root->view()->waitUntilReadyToQuery(watch.root);
+    while (ready.wait_for(kWatchProjectsPollInterval) !=
+           std::future_status::ready) {
+      if (cancelled) {
+        break;
+      }
+    }
+  } catch (const std::exception& exc) {
+    watch.root = nullptr;
+    watch.error = exc.what();
+  }
+  return watch;
+}
+
+// The response that watch-project would have sent for watch
+json_ref projectWatchResult(const json_ref& path, const ProjectWatch& watch) {
+  auto result = json_object({{"path", path}});
+  if (!watch.root) {
+    result.set(
+        "error", typed_string_to_json(watch.error.c_str(), W_STRING_UNICODE));
+    return result;
+  }
+  auto& root = watch.root;
+  if (root->failure_reason) {
+    result.set("error", w_string_to_json(root->failure_reason));
+  } else if (root->inner.cancelled) {
+    result.set(
+        "error", typed_string_to_json("root was cancelled", W_STRING_UNICODE));
+  } else {
+    result.set(
+        {{"watch", w_string_to_json(root->root_path)},
+         {"watcher", w_string_to_json(root->view()->getName())}});
+  }
+  add_root_warnings_to_response(result, root);
+  if (!watch.relPath.empty()) {
+    result.set("relative_path", w_string_to_json(watch.relPath));
+  }
+  return result;
+}
+
+} // namespace
+
+/* watch-projects [path, ...] [options]
+ * Watches the project of each path as watch-project would, several at a
+ * time, and responds with what watch-project would have responded for each
+ * of them, in the same order.  With stream_results, each is also sent as
+ * soon as it is ready. */
+static void cmd_watch_projects(
+    struct watchman_client* client,
+    const json_ref& args) {
+  if ((json_array_size(args) != 2 && json_array_size(args) != 3) ||
+      !args.at(1).isArray()) {
+    send_error_response(
+        client, "'watch-projects' expects an array of paths to watch");
+    return;
+  }
+  const auto& paths = args.at(1).array();
+  for (const auto& path : paths) {
+    if (!path.isString()) {
+      send_error_response(
+          client, "the paths passed to 'watch-projects' must be strings");
+      return;
+    }
+  }
+
+  auto limit = size_t(std::max(
+      json_int_t(1), cfg_get_int("watch_projects_concurrency", 8)));
+  bool stream = false;
+  if (json_array_size(args) == 3) {
+    auto& opts = args.at(2);
+    if (!opts.isObject()) {
+      throw CommandValidationError(
+          "the third argument to 'watch-projects' must be an object");
+    }
+    auto concurrency = opts.get_default("concurrency");
+    if (concurrency) {
+      if (!concurrency.isInt() || concurrency.asInt() < 1) {
+        throw CommandValidationError(
+            "'concurrency' must be a positive integer");
+      }
+      // It may only lower the limit that the service allows
+      limit = std::min(limit, size_t(concurrency.asInt()));
+    }
+    auto streamOpt = opts.get_default("stream_results", json_false());
+    if (!streamOpt.isBool()) {
+      throw CommandValidationError("'stream_results' must be a boolean");
+    }
+    stream = streamOpt.asBool() && client->stm;
+  }
+
+  bool clientMode = client->client_mode;
+  bool isOwner = client->client_is_owner;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  size_t next = 0;
+  std::deque<ProjectWatch> done;
+  std::atomic<bool> cancelled{false};
+
+  std::vector<std::thread> threads;
+  // The workers refer to our locals, so they finish even if we throw or
+  // return early, such as when the client went away; the paths not yet
+  // taken are skipped, and the crawls aren't waited for.
+  SCOPE_EXIT {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      next = paths.size();
+    }
+    cancelled = true;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  };
+  auto numThreads = std::min(limit, paths.size());
+  for (size_t i = 0; i < numThreads; ++i) {
+    threads.emplace_back([&, i] {
+      w_set_thread_name("watch-projects-", i);
+      while (true) {
+        size_t index;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (next == paths.size()) {
+            return;
+          }
+          index = next++;
+        }
+        auto watch =
+            watchProject(index, paths[index], clientMode, isOwner, cancelled);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          done.push_back(std::move(watch));
+        }
+        cond.notify_one();
+      }
+    });
+  }
+
+  std::vector<json_ref> results(paths.size());
+  for (size_t received = 0; received < paths.size(); ++received) {
+    ProjectWatch watch;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!cond.wait_for(
+          lock, kWatchProjectsPollInterval, [&] { return !done.empty(); })) {
+        if (client->hasHungUp()) {
+          // Nobody will read the results, so stop waiting for the crawls
+          return;
+        }
+      }
+      watch = std::move(done.front());
+      done.pop_front();
+    }
+    if (watch.root && client->perf_sample) {
+      watch.root->addPerfSampleMetadata(*client->perf_sample);
+    }
+    auto result = projectWatchResult(paths[watch.index], watch);
+    results[watch.index] = result;
+
+    if (stream) {
+      auto partial = make_response();
+      partial.set({{"watch", result}, {"partial", json_true()}});
+      client->enqueueResponse(std::move(partial), false);
+      if (!client->sendQueuedResponses()) {
+        // The client went away, so nobody will read the rest
+        return;
+      }
+    }
+  }
+  auto watches = json_array();
+  for (auto& result : results) {
+    watches.array().push_back(std::move(result));
+  }
+  auto resp = make_response();
+  resp.set("watches", std::move(watches));
+  send_and_dispose_response(client, std::move(resp));
+}
+
+// Resolves each of the paths relative to the CLI's working directory
+static void cli_validate_watch_projects(json_ref& args) {
+  if (json_array_size(args) < 2 || !args.at(1).isArray()) {
+    throw CommandValidationError(
+        "'watch-projects' expects an array of paths to watch");
+  }
+  for (auto& path : args.array()[1].array()) {
+    auto pathArgs = json_array({typed_string_to_json("watch-project"), path});
+    w_cmd_realpath_root(pathArgs);
+    path = pathArgs.at(1);
+  }
+}
+W_CMD_REG(
+    "watch-projects",
+    cmd_watch_projects,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    cli_validate_watch_projects)
 
 /* vim:ts=2:sw=2:et:
  */
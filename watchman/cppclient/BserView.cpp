@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "BserView.h"
+
+#include <cstring>
+
+#include "WatchmanConnection.h"
+
+namespace watchman {
+
+namespace {
+
+// Capabilities of a version 2 PDU whose payload isn't plain BSER
+constexpr uint32_t kCompressed = 0x8;
+constexpr uint32_t kSharedMemory = 0x20;
+
+[[noreturn]] void malformed(const char* what) {
+  throw WatchmanError(std::string("malformed BSER: ") + what);
+}
+
+void need(const uint8_t* pos, const uint8_t* end, size_t bytes) {
+  if (size_t(end - pos) < bytes) {
+    malformed("value runs past the end of the buffer");
+  }
+}
+
+template <typename T>
+int64_t load(const uint8_t* pos) {
+  T value;
+  memcpy(&value, pos, sizeof(value));
+  return value;
+}
+
+// Decodes the integer at `pos`, returning it and the position after it
+std::pair<int64_t, const uint8_t*> readInt(
+    const uint8_t* pos,
+    const uint8_t* end) {
+  need(pos, end, 1);
+  switch (BserView::Type(*pos)) {
+    case BserView::Type::Int8:
+      need(pos, end, 2);
+      return {load<int8_t>(pos + 1), pos + 2};
+    case BserView::Type::Int16:
+      need(pos, end, 3);
+      return {load<int16_t>(pos + 1), pos + 3};
+    case BserView::Type::Int32:
+      need(pos, end, 5);
+      return {load<int32_t>(pos + 1), pos + 5};
+    case BserView::Type::Int64:
+      need(pos, end, 9);
+      return {load<int64_t>(pos + 1), pos + 9};
+    default:
+      throw WatchmanError("BSER value is not an integer");
+  }
+}
+
+// Decodes a count or length, which must not be negative
+std::pair<size_t, const uint8_t*> readSize(
+    const uint8_t* pos,
+    const uint8_t* end) {
+  auto [value, next] = readInt(pos, end);
+  if (value < 0) {
+    malformed("negative size");
+  }
+  return {size_t(value), next};
+}
+
+} // namespace
+
+BserView::BserView(const uint8_t* data, const uint8_t* end)
+    : data_{data}, end_{end} {
+  need(data, end, 1);
+  if (*data > uint8_t(Type::Utf8String)) {
+    malformed("unknown type");
+  }
+}
+
+BserView BserView::fromPdu(folly::ByteRange pdu) {
+  auto pos = pdu.begin();
+  auto end = pdu.end();
+  need(pos, end, 2);
+  if (pos[0] != 0 || (pos[1] != 1 && pos[1] != 2)) {
+    malformed("bad magic");
+  }
+  bool v2 = pos[1] == 2;
+  pos += 2;
+  if (v2) {
+    need(pos, end, sizeof(uint32_t));
+    uint32_t capabilities;
+    memcpy(&capabilities, pos, sizeof(capabilities));
+    if (capabilities & (kCompressed | kSharedMemory)) {
+      throw WatchmanError("compressed and shared memory PDUs can't be viewed");
+    }
+    pos += sizeof(capabilities);
+  }
+  auto [len, value] = readSize(pos, end);
+  need(value, end, len);
+  return BserView{value, value + len};
+}
+
+const uint8_t* BserView::skip(const uint8_t* pos, const uint8_t* end) {
+  need(pos, end, 1);
+  switch (Type(*pos)) {
+    case Type::Array: {
+      auto [count, next] = readSize(pos + 1, end);
+      for (size_t i = 0; i < count; ++i) {
+        next = skip(next, end);
+      }
+      return next;
+    }
+    case Type::Object: {
+      auto [count, next] = readSize(pos + 1, end);
+      for (size_t i = 0; i < count; ++i) {
+        next = skip(skip(next, end), end);
+      }
+      return next;
+    }
+    case Type::String:
+    case Type::Utf8String: {
+      auto [len, next] = readSize(pos + 1, end);
+      need(next, end, len);
+      return next + len;
+    }
+    case Type::Int8:
+    case Type::Int16:
+    case Type::Int32:
+    case Type::Int64:
+      return readInt(pos, end).second;
+    case Type::Real:
+      need(pos, end, 1 + sizeof(double));
+      return pos + 1 + sizeof(double);
+    case Type::True:
+    case Type::False:
+    case Type::Null:
+    case Type::Skip:
+      return pos + 1;
+    case Type::Template: {
+      auto keys = pos + 1;
+      need(keys, end, 1);
+      if (Type(*keys) != Type::Array) {
+        malformed("template keys are not an array");
+      }
+      auto numKeys = readSize(keys + 1, end).first;
+      auto [numRows, next] = readSize(skip(keys, end), end);
+      for (size_t row = 0; row < numRows; ++row) {
+        for (size_t key = 0; key < numKeys; ++key) {
+          next = skip(next, end);
+        }
+      }
+      return next;
+    }
+  }
+  malformed("unknown type");
+}
+
+std::pair<const uint8_t*, size_t> BserView::containerStart(
+    Type expected) const {
+  if (type() != expected) {
+    throw WatchmanError(
+        expected == Type::Array ? "BSER value is not an array"
+                                : "BSER value is not an object");
+  }
+  auto [count, first] = readSize(data_ + 1, end_);
+  return {first, count};
+}
+
+bool BserView::isInt() const {
+  switch (type()) {
+    case Type::Int8:
+    case Type::Int16:
+    case Type::Int32:
+    case Type::Int64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string_view BserView::asString() const {
+  if (!isString()) {
+    throw WatchmanError("BSER value is not a string");
+  }
+  auto [len, chars] = readSize(data_ + 1, end_);
+  need(chars, end_, len);
+  return std::string_view{reinterpret_cast<const char*>(chars), len};
+}
+
+int64_t BserView::asInt() const {
+  return readInt(data_, end_).first;
+}
+
+double BserView::asDouble() const {
+  if (type() == Type::Real) {
+    need(data_, end_, 1 + sizeof(double));
+    double value;
+    memcpy(&value, data_ + 1, sizeof(value));
+    return value;
+  }
+  return double(asInt());
+}
+
+bool BserView::asBool() const {
+  switch (type()) {
+    case Type::True:
+      return true;
+    case Type::False:
+      return false;
+    default:
+      throw WatchmanError("BSER value is not a boolean");
+  }
+}
+
+size_t BserView::size() const {
+  switch (type()) {
+    case Type::Array:
+    case Type::Object:
+      return readSize(data_ + 1, end_).first;
+    case Type::Template:
+      return readSize(skip(data_ + 1, end_), end_).first;
+    default:
+      throw WatchmanError("BSER value is not a container");
+  }
+}
+
+folly::ByteRange BserView::encoded() const {
+  return folly::ByteRange{data_, skip(data_, end_)};
+}
+
+std::optional<BserView> BserView::get(std::string_view key) const {
+  auto [pos, count] = containerStart(Type::Object);
+  for (size_t i = 0; i < count; ++i) {
+    BserView name{pos, end_};
+    auto value = skip(pos, end_);
+    if (name.asString() == key) {
+      return BserView{value, end_};
+    }
+    pos = skip(value, end_);
+  }
+  return std::nullopt;
+}
+
+BserView::ElementIterator& BserView::ElementIterator::operator++() {
+  pos_ = skip(pos_, end_);
+  --remaining_;
+  return *this;
+}
+
+folly::Range<BserView::ElementIterator> BserView::elements() const {
+  auto [first, count] = containerStart(Type::Array);
+  return {ElementIterator{first, end_, count}, ElementIterator{end_, end_, 0}};
+}
+
+folly::dynamic BserView::toDynamic() const {
+  switch (type()) {
+    case Type::Array: {
+      auto result = folly::dynamic::array();
+      for (auto element : elements()) {
+        result.push_back(element.toDynamic());
+      }
+      return result;
+    }
+    case Type::Object: {
+      auto result = folly::dynamic::object();
+      forEachField([&](std::string_view key, BserView value) {
+        result.insert(std::string{key}, value.toDynamic());
+      });
+      return result;
+    }
+    case Type::Template: {
+      auto result = folly::dynamic::array();
+      BserRows rows{*this};
+      for (auto row : rows) {
+        auto obj = folly::dynamic::object();
+        for (auto key : rows.keys_) {
+          if (auto value = row.get(key)) {
+            obj.insert(std::string{key}, value->toDynamic());
+          }
+        }
+        result.push_back(std::move(obj));
+      }
+      return result;
+    }
+    case Type::String:
+    case Type::Utf8String:
+      return std::string{asString()};
+    case Type::Int8:
+    case Type::Int16:
+    case Type::Int32:
+    case Type::Int64:
+      return asInt();
+    case Type::Real:
+      return asDouble();
+    case Type::True:
+      return true;
+    case Type::False:
+      return false;
+    case Type::Null:
+    case Type::Skip:
+      return nullptr;
+  }
+  malformed("unknown type");
+}
+
+BserRows::BserRows(BserView rows) : end_{rows.end_} {
+  isTemplate_ = rows.isTemplate();
+  if (isTemplate_) {
+    BserView keys{rows.data_ + 1, end_};
+    for (auto key : keys.elements()) {
+      keys_.push_back(key.asString());
+    }
+    auto [count, first] = readSize(BserView::skip(keys.data_, end_), end_);
+    first_ = first;
+    size_ = count;
+  } else {
+    auto [first, count] = rows.containerStart(BserView::Type::Array);
+    first_ = first;
+    size_ = count;
+  }
+}
+
+BserRows::Iterator& BserRows::Iterator::operator++() {
+  if (rows_->isTemplate_) {
+    for (size_t i = 0; i < rows_->keys_.size(); ++i) {
+      pos_ = BserView::skip(pos_, rows_->end_);
+    }
+  } else {
+    pos_ = BserView::skip(pos_, rows_->end_);
+  }
+  --remaining_;
+  return *this;
+}
+
+std::optional<BserView> BserRows::Row::get(std::string_view field) const {
+  if (!rows_->isTemplate_) {
+    return BserView{pos_, rows_->end_}.get(field);
+  }
+  auto pos = pos_;
+  for (auto key : rows_->keys_) {
+    if (key == field) {
+      BserView value{pos, rows_->end_};
+      if (value.type() == BserView::Type::Skip) {
+        return std::nullopt;
+      }
+      return value;
+    }
+    pos = BserView::skip(pos, rows_->end_);
+  }
+  return std::nullopt;
+}
+
+} // namespace watchman
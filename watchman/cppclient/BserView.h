@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <folly/Range.h>
+#include <folly/dynamic.h>
+#include <folly/io/IOBuf.h>
+
+namespace watchman {
+
+/**
+ * A read-only view of a BSER encoded value that decodes what is accessed,
+ * when it is accessed, rather than materializing a folly::dynamic tree.
+ * Strings are returned as views into the encoded buffer, which must outlive
+ * the view and everything obtained from it.
+ *
+ * Elements are reached by walking the encoding, so arrays and objects are
+ * best visited in order.  Throws WatchmanError if the encoding is malformed
+ * or a value is read as a type that it isn't.
+ */
+class BserView {
+ public:
+  enum class Type : uint8_t {
+    Array = 0x00,
+    Object = 0x01,
+    String = 0x02,
+    Int8 = 0x03,
+    Int16 = 0x04,
+    Int32 = 0x05,
+    Int64 = 0x06,
+    Real = 0x07,
+    True = 0x08,
+    False = 0x09,
+    Null = 0x0a,
+    Template = 0x0b,
+    Skip = 0x0c,
+    Utf8String = 0x0d,
+  };
+
+  // Views the value in a complete PDU, as sent by the service.  Compressed
+  // and shared memory PDUs are not supported.
+  static BserView fromPdu(folly::ByteRange pdu);
+
+  Type type() const {
+    return Type(*data_);
+  }
+  bool isString() const {
+    return type() == Type::String || type() == Type::Utf8String;
+  }
+  bool isInt() const;
+  bool isObject() const {
+    return type() == Type::Object;
+  }
+  bool isArray() const {
+    return type() == Type::Array;
+  }
+  bool isTemplate() const {
+    return type() == Type::Template;
+  }
+  bool isNull() const {
+    return type() == Type::Null;
+  }
+
+  std::string_view asString() const;
+  int64_t asInt() const;
+  // Accepts integers as well as reals
+  double asDouble() const;
+  bool asBool() const;
+
+  // The number of elements of an array, pairs of an object or rows of a
+  // template
+  size_t size() const;
+
+  // The bytes that encode this value
+  folly::ByteRange encoded() const;
+
+  // Looks up a key of an object, which takes time linear in its size
+  std::optional<BserView> get(std::string_view key) const;
+
+  // Iterates the elements of an array
+  class ElementIterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = BserView;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const BserView*;
+    using reference = const BserView&;
+
+    BserView operator*() const {
+      return BserView{pos_, end_};
+    }
+    ElementIterator& operator++();
+    bool operator==(const ElementIterator& other) const {
+      return remaining_ == other.remaining_;
+    }
+    bool operator!=(const ElementIterator& other) const {
+      return remaining_ != other.remaining_;
+    }
+
+   private:
+    friend class BserView;
+    ElementIterator(const uint8_t* pos, const uint8_t* end, size_t remaining)
+        : pos_{pos}, end_{end}, remaining_{remaining} {}
+
+    const uint8_t* pos_;
+    const uint8_t* end_;
+    size_t remaining_;
+  };
+  folly::Range<ElementIterator> elements() const;
+
+  // Calls func(key, value) for each pair of an object
+  template <typename Func>
+  void forEachField(Func&& func) const {
+    auto [pos, count] = containerStart(Type::Object);
+    for (size_t i = 0; i < count; ++i) {
+      BserView key{pos, end_};
+      BserView value{skip(pos, end_), end_};
+      func(key.asString(), value);
+      pos = skip(value.data_, end_);
+    }
+  }
+
+  folly::dynamic toDynamic() const;
+
+ private:
+  friend class BserRows;
+
+  BserView(const uint8_t* data, const uint8_t* end);
+
+  // Returns the first element, pair or key of a container of `expected`
+  // type, and its size
+  std::pair<const uint8_t*, size_t> containerStart(Type expected) const;
+
+  // Returns the position just past the value at `pos`
+  static const uint8_t* skip(const uint8_t* pos, const uint8_t* end);
+
+  const uint8_t* data_;
+  const uint8_t* end_;
+};
+
+/**
+ * The rows of an array of objects, such as the files of a query result,
+ * whether or not the service compacted them into a template.
+ */
+class BserRows {
+ public:
+  // `rows` must be a template or an array of objects
+  explicit BserRows(BserView rows);
+
+  size_t size() const {
+    return size_;
+  }
+
+  class Row {
+   public:
+    // The value of a field, or nullopt if this row doesn't have it
+    std::optional<BserView> get(std::string_view field) const;
+
+   private:
+    friend class BserRows;
+    Row(const BserRows* rows, const uint8_t* pos) : rows_{rows}, pos_{pos} {}
+
+    const BserRows* rows_;
+    const uint8_t* pos_;
+  };
+
+  class Iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Row*;
+    using reference = const Row&;
+
+    Row operator*() const {
+      return Row{rows_, pos_};
+    }
+    Iterator& operator++();
+    bool operator==(const Iterator& other) const {
+      return remaining_ == other.remaining_;
+    }
+    bool operator!=(const Iterator& other) const {
+      return remaining_ != other.remaining_;
+    }
+
+   private:
+    friend class BserRows;
+    Iterator(const BserRows* rows, const uint8_t* pos, size_t remaining)
+        : rows_{rows}, pos_{pos}, remaining_{remaining} {}
+
+    const BserRows* rows_;
+    const uint8_t* pos_;
+    size_t remaining_;
+  };
+  Iterator begin() const {
+    return Iterator{this, first_, size_};
+  }
+  Iterator end() const {
+    return Iterator{this, nullptr, 0};
+  }
+
+ private:
+  friend class BserView;
+
+  const uint8_t* end_;
+  const uint8_t* first_;
+  size_t size_;
+  // The field names of a template; empty for an array of objects
+  std::vector<std::string_view> keys_;
+  bool isTemplate_;
+};
+
+/**
+ * A response PDU, together with a view of the value in it.  Moving the
+ * response leaves its views valid.
+ */
+class BserResponse {
+ public:
+  explicit BserResponse(std::unique_ptr<folly::IOBuf> pdu)
+      : pdu_{std::move(pdu)}, value_{BserView::fromPdu(pdu_->coalesce())} {}
+
+  BserView value() const {
+    return value_;
+  }
+
+  const folly::IOBuf* pdu() const {
+    return pdu_.get();
+  }
+
+ private:
+  std::unique_ptr<folly::IOBuf> pdu_;
+  BserView value_;
+};
+
+} // namespace watchman
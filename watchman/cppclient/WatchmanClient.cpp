@@ -121,6 +121,27 @@ SemiFuture<QueryResult> WatchmanClient::query(
           [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
 }
 
+SemiFuture<QueryResultView> WatchmanClient::queryView(
+    dynamic queryObj,
+    WatchPathPtr path) {
+  if (path->relativePath_) {
+    queryObj["relative_root"] = *path->relativePath_;
+  }
+  return conn_
+      ->runRaw(dynamic::array("query", path->root_, std::move(queryObj)))
+      .thenValue([](BserResponse&& res) {
+        return QueryResultView{std::move(res)};
+      });
+}
+
+BserView QueryResultView::files() const {
+  auto files = raw().get("files");
+  if (!files) {
+    throw WatchmanError("query response has no files");
+  }
+  return *files;
+}
+
 SemiFuture<SubscriptionPtr> WatchmanClient::subscribe(
     dynamic query,
     WatchPathPtr path,
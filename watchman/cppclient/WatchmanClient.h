@@ -80,10 +80,12 @@
 namespace watchman {
 
 struct WatchmanClient;
+struct WatchmanClientPool;
 struct Subscription;
 
 struct WatchPath {
   friend WatchmanClient;
+  friend WatchmanClientPool;
 
   WatchPath(
       const std::string& root,
@@ -106,6 +108,22 @@ struct QueryResult {
   folly::dynamic raw_;
 };
 
+// A query result that is read in place rather than decoded; see BserView
+struct QueryResultView {
+  explicit QueryResultView(BserResponse response)
+      : response_{std::move(response)} {}
+
+  BserView raw() const {
+    return response_.value();
+  }
+
+  // The files, which are names if the query asked for just the name field,
+  // and otherwise rows that can be read with BserRows
+  BserView files() const;
+
+  BserResponse response_;
+};
+
 struct Subscription {
   friend WatchmanClient;
 
@@ -203,6 +221,20 @@ struct WatchmanClient {
       folly::dynamic queryObj,
       WatchPathPtr path);
 
+  /**
+   * Like query(), but the result refers to the response as it was received
+   * instead of decoding it, which saves an allocation per file and field
+   * for large results.  For example:
+   *
+   *  auto result = client.queryView(query, watch).get();
+   *  for (auto row : BserRows{result.files()}) {
+   *    std::string_view name = row.get("name")->asString();
+   *  }
+   */
+  folly::SemiFuture<QueryResultView> queryView(
+      folly::dynamic queryObj,
+      WatchPathPtr path);
+
   /**
    * Establishes a subscription that will trigger callback (via your specified
    * executor) whenever matching files change.
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "WatchmanClientPool.h"
+
+#include <algorithm>
+#include <map>
+
+#include <folly/Conv.h>
+#include <folly/executors/InlineExecutor.h>
+#include <folly/json.h>
+#include <glog/logging.h>
+
+namespace watchman {
+
+using namespace folly;
+
+WatchmanClientPool::WatchmanClientPool(
+    EventBase* eventBase,
+    size_t numClients,
+    std::optional<std::string> sockPath,
+    Executor* cpuExecutor,
+    ErrorCallback errCb)
+    : eventBase_(eventBase) {
+  CHECK(numClients > 0) << "A pool needs at least one client";
+  for (size_t i = 0; i < numClients; ++i) {
+    clients_.push_back(std::make_unique<WatchmanClient>(
+        eventBase, std::optional<std::string>{sockPath}, cpuExecutor, errCb));
+  }
+}
+
+std::shared_ptr<WatchmanClientPool> WatchmanClientPool::getShared(
+    EventBase* eventBase,
+    std::optional<std::string> sockPath) {
+  static std::mutex mutex;
+  static std::map<
+      std::pair<EventBase*, std::string>,
+      std::weak_ptr<WatchmanClientPool>>
+      pools;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  auto& slot = pools[std::make_pair(eventBase, sockPath.value_or(""))];
+  auto pool = slot.lock();
+  if (!pool || pool->isDead()) {
+    pool = std::make_shared<WatchmanClientPool>(
+        eventBase, kDefaultNumClients, std::move(sockPath));
+    slot = pool;
+  }
+  return pool;
+}
+
+SemiFuture<dynamic> WatchmanClientPool::connect(dynamic versionArgs) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!connected_) {
+    connected_ = std::make_shared<SharedPromise<dynamic>>();
+    std::vector<SemiFuture<dynamic>> connecting;
+    for (auto& client : clients_) {
+      connecting.push_back(client->connect(versionArgs));
+    }
+    collectAll(std::move(connecting))
+        .via(eventBase_)
+        .thenValue([connected = connected_, weak = weak_from_this()](
+                       std::vector<Try<dynamic>>&& results) {
+          for (auto& result : results) {
+            if (result.hasException()) {
+              if (auto pool = weak.lock()) {
+                pool->close();
+              }
+              connected->setException(result.exception());
+              return;
+            }
+          }
+          connected->setTry(std::move(results.front()));
+        });
+  }
+  return connected_->getSemiFuture();
+}
+
+void WatchmanClientPool::close() {
+  for (auto& client : clients_) {
+    client->close();
+  }
+}
+
+bool WatchmanClientPool::isDead() {
+  return std::any_of(clients_.begin(), clients_.end(), [](auto& client) {
+    return client->isDead();
+  });
+}
+
+WatchmanClient& WatchmanClientPool::nextClient() {
+  return liveClient(nextClient_++);
+}
+
+WatchmanClient& WatchmanClientPool::liveClient(size_t start) {
+  for (size_t i = 0; i < clients_.size(); ++i) {
+    auto& client = clients_[(start + i) % clients_.size()];
+    if (!client->isDead()) {
+      return *client;
+    }
+  }
+  // Every connection is gone; let the command fail on the first we tried
+  return *clients_[start % clients_.size()];
+}
+
+void WatchmanClientPool::forgetUpstream(
+    const std::shared_ptr<Upstream>& upstream) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = upstreams_.find(upstream->key);
+  if (it != upstreams_.end() && it->second == upstream) {
+    upstreams_.erase(it);
+  }
+}
+
+SemiFuture<dynamic> WatchmanClientPool::run(const dynamic& cmd) {
+  return nextClient().run(cmd);
+}
+
+SemiFuture<WatchPathPtr> WatchmanClientPool::watch(std::string_view path) {
+  return nextClient().watch(path);
+}
+
+SemiFuture<Clock> WatchmanClientPool::getClock(WatchPathPtr path) {
+  return nextClient().getClock(std::move(path));
+}
+
+SemiFuture<QueryResult> WatchmanClientPool::query(
+    dynamic queryObj,
+    WatchPathPtr path) {
+  return nextClient().query(std::move(queryObj), std::move(path));
+}
+
+SemiFuture<QueryResultView> WatchmanClientPool::queryView(
+    dynamic queryObj,
+    WatchPathPtr path) {
+  return nextClient().queryView(std::move(queryObj), std::move(path));
+}
+
+SemiFuture<PooledSubscriptionPtr> WatchmanClientPool::subscribe(
+    const dynamic& query,
+    WatchPathPtr path,
+    Executor* executor,
+    SubscriptionCallback&& callback) {
+  // Queries that only differ in the order of their fields are the same
+  json::serialization_opts opts;
+  opts.sort_keys = true;
+  auto key = folly::to<std::string>(
+      path->root_,
+      '\0',
+      path->relativePath_.value_or(""),
+      '\0',
+      json::serialize(query, opts));
+
+  auto subscription =
+      std::make_shared<PooledSubscription>(executor, std::move(callback));
+  std::shared_ptr<Upstream> upstream;
+  bool created = false;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& slot = upstreams_[key];
+    // An upstream whose connection broke is forgotten once it hears about
+    // it, but it may not have heard yet
+    if (!slot || slot->client->isDead()) {
+      slot = std::make_shared<Upstream>();
+      slot->key = key;
+      // Keep the subscriptions of a path on one connection, so that their
+      // updates arrive in order
+      slot->client = &liveClient(std::hash<std::string>{}(key));
+      created = true;
+    }
+    upstream = slot;
+    std::lock_guard<std::mutex> upstreamGuard(upstream->mutex);
+    upstream->subscribers.push_back(subscription);
+  }
+  subscription->upstream_ = upstream;
+
+  if (created) {
+    std::weak_ptr<Upstream> weakUpstream = upstream;
+    upstream->client
+        ->subscribe(
+            query,
+            path,
+            &InlineExecutor::instance(),
+            [weakUpstream, weak = weak_from_this()](Try<dynamic>&& data) {
+              if (auto upstream = weakUpstream.lock()) {
+                if (data.hasException()) {
+                  // The connection broke and took the subscription with
+                  // it, so later subscribers must start a new one
+                  if (auto pool = weak.lock()) {
+                    pool->forgetUpstream(upstream);
+                  }
+                }
+                upstream->deliver(std::move(data));
+              }
+            })
+        .via(eventBase_)
+        .thenTry([upstream, weak = weak_from_this()](
+                     Try<SubscriptionPtr>&& result) {
+          if (result.hasException()) {
+            // Let the next subscriber try again
+            if (auto pool = weak.lock()) {
+              pool->forgetUpstream(upstream);
+            }
+          }
+          upstream->subscribed.setTry(std::move(result));
+        });
+  }
+
+  return upstream->subscribed.getSemiFuture().deferValue(
+      [subscription](SubscriptionPtr&&) { return subscription; });
+}
+
+SemiFuture<Unit> WatchmanClientPool::unsubscribe(
+    PooledSubscriptionPtr subscription) {
+  CHECK(subscription->active_) << "Already unsubscribed.";
+
+  subscription->active_ = false;
+  auto upstream = std::move(subscription->upstream_);
+  bool last;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    std::lock_guard<std::mutex> upstreamGuard(upstream->mutex);
+    auto& subscribers = upstream->subscribers;
+    subscribers.erase(
+        std::remove(subscribers.begin(), subscribers.end(), subscription),
+        subscribers.end());
+    last = subscribers.empty();
+    if (last) {
+      auto it = upstreams_.find(upstream->key);
+      if (it != upstreams_.end() && it->second == upstream) {
+        upstreams_.erase(it);
+      }
+    }
+  }
+  if (!last) {
+    return makeSemiFuture();
+  }
+
+  return upstream->subscribed.getSemiFuture()
+      .via(eventBase_)
+      .thenValue([upstream, eventBase = eventBase_](SubscriptionPtr&& sub) {
+        if (upstream->client->isDead()) {
+          // The subscription went with the connection
+          return makeFuture(dynamic());
+        }
+        return upstream->client->unsubscribe(std::move(sub)).via(eventBase);
+      })
+      .unit()
+      .semi();
+}
+
+size_t WatchmanClientPool::numUpstreamSubscriptions() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return upstreams_.size();
+}
+
+void WatchmanClientPool::Upstream::deliver(Try<dynamic>&& data) {
+  std::vector<PooledSubscriptionPtr> targets;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    targets = subscribers;
+  }
+  for (size_t i = 0; i < targets.size(); ++i) {
+    // Copy the update for all but the last subscriber
+    auto update = i + 1 < targets.size() ? data : std::move(data);
+    auto& target = targets[i];
+    target->executor_->add(
+        [target, update = std::move(update)]() mutable {
+          if (target->active_) {
+            target->callback_(std::move(update));
+          }
+        });
+  }
+}
+
+PooledSubscription::PooledSubscription(
+    Executor* executor,
+    SubscriptionCallback&& callback)
+    : executor_(executor), callback_(std::move(callback)) {}
+
+} // namespace watchman
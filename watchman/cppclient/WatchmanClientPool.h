@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+/* Shares a few connections to Watchman between the many parts of a process
+ * that would otherwise each create a WatchmanClient, with a socket and a
+ * client thread in the service for every one of them.
+ *
+ * Commands are spread over the connections of the pool that are still alive,
+ * and subscriptions to the same query of the same path are made once, with
+ * every update delivered to each subscriber on its own executor.  When a
+ * connection breaks, the pool carries on with the others; getShared()
+ * replaces a pool once any of its connections is gone.
+ *
+ * Example usage:
+ *  auto pool = WatchmanClientPool::getShared(&eb);
+ *  pool->connect().get();
+ *  auto watch = pool->watch("/some/path").get();
+ *  auto subscription = pool->subscribe(
+ *      folly::dynamic::object("fields", folly::dynamic::array("name")),
+ *      watch,
+ *      &executor,
+ *      [](folly::Try<folly::dynamic>&& data) { ... }).get();
+ *
+ *  // ... do stuff ...
+ *
+ *  pool->unsubscribe(subscription).get();
+ */
+
+#include "WatchmanClient.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/futures/SharedPromise.h>
+
+namespace watchman {
+
+struct PooledSubscription;
+using PooledSubscriptionPtr = std::shared_ptr<PooledSubscription>;
+
+struct WatchmanClientPool
+    : public std::enable_shared_from_this<WatchmanClientPool> {
+  static constexpr size_t kDefaultNumClients = 2;
+
+  explicit WatchmanClientPool(
+      folly::EventBase* eventBase,
+      size_t numClients = kDefaultNumClients,
+      std::optional<std::string> sockPath = {},
+      folly::Executor* cpuExecutor = {},
+      ErrorCallback errCb = {});
+
+  /**
+   * Returns the pool of the process for a given event base and socket,
+   * creating it if nobody holds it or it is dead.  Parts of a process that
+   * share an event base thread should use this rather than their own
+   * WatchmanClient.
+   */
+  static std::shared_ptr<WatchmanClientPool> getShared(
+      folly::EventBase* eventBase,
+      std::optional<std::string> sockPath = {});
+
+  /**
+   * Connects every client of the pool, yielding the version response of the
+   * first.  Only the first call connects; later calls, which may pass other
+   * arguments, yield the same result.  If any client fails to connect,
+   * the pool is closed.
+   */
+  folly::SemiFuture<folly::dynamic> connect(
+      folly::dynamic versionArgs = folly::dynamic::object()(
+          "required",
+          folly::dynamic::array("relative_root")));
+
+  /** Closes every connection of the pool. */
+  void close();
+
+  /** Returns true if any connection of the pool is closed or broken. */
+  bool isDead();
+
+  /**
+   * As per WatchmanClient, taking turns between the connections that are
+   * alive.
+   */
+  folly::SemiFuture<folly::dynamic> run(const folly::dynamic& cmd);
+  folly::SemiFuture<WatchPathPtr> watch(std::string_view path);
+  folly::SemiFuture<Clock> getClock(WatchPathPtr path);
+  folly::SemiFuture<QueryResult> query(
+      folly::dynamic queryObj,
+      WatchPathPtr path);
+  folly::SemiFuture<QueryResultView> queryView(
+      folly::dynamic queryObj,
+      WatchPathPtr path);
+
+  /**
+   * Subscribes to changes of the files of path that match query, calling
+   * callback via executor for each update.  If somebody else already
+   * subscribed to the same query of the same path, this shares their
+   * subscription: the new subscriber gets the updates that follow, but not
+   * the initial result that the first subscriber got.
+   *
+   * If the connection of the subscription breaks, each subscriber gets the
+   * error, and later subscribers start a new subscription on a connection
+   * that is alive.
+   */
+  folly::SemiFuture<PooledSubscriptionPtr> subscribe(
+      const folly::dynamic& query,
+      WatchPathPtr path,
+      folly::Executor* executor,
+      SubscriptionCallback&& callback);
+
+  /**
+   * Stops the updates of a subscription, and cancels the subscription in
+   * the service once its last subscriber is gone, unless its connection
+   * broke, which cancelled it already.
+   */
+  folly::SemiFuture<folly::Unit> unsubscribe(
+      PooledSubscriptionPtr subscription);
+
+  /** The number of subscriptions that the service has for this pool. */
+  size_t numUpstreamSubscriptions();
+
+ private:
+  friend PooledSubscription;
+
+  // A subscription in the service and the subscribers that share it
+  struct Upstream {
+    std::string key;
+    WatchmanClient* client;
+    folly::SharedPromise<SubscriptionPtr> subscribed;
+    std::mutex mutex;
+    std::vector<PooledSubscriptionPtr> subscribers;
+
+    void deliver(folly::Try<folly::dynamic>&& data);
+  };
+
+  WatchmanClient& nextClient();
+  // The first client, from clients_[start % size] on, whose connection is
+  // alive, or that one if none is
+  WatchmanClient& liveClient(size_t start);
+  // Removes upstream from upstreams_, unless another replaced it already
+  void forgetUpstream(const std::shared_ptr<Upstream>& upstream);
+
+  folly::EventBase* eventBase_;
+  std::vector<std::unique_ptr<WatchmanClient>> clients_;
+  std::atomic<size_t> nextClient_{0};
+
+  std::mutex mutex_;
+  std::shared_ptr<folly::SharedPromise<folly::dynamic>> connected_;
+  // Keyed by the path and the canonical JSON of the query
+  std::unordered_map<std::string, std::shared_ptr<Upstream>> upstreams_;
+};
+
+struct PooledSubscription {
+  friend WatchmanClientPool;
+
+  PooledSubscription(
+      folly::Executor* executor,
+      SubscriptionCallback&& callback);
+
+ private:
+  folly::Executor::KeepAlive<folly::Executor> executor_;
+  SubscriptionCallback callback_;
+  std::shared_ptr<WatchmanClientPool::Upstream> upstream_;
+  std::atomic<bool> active_{true};
+};
+
+} // namespace watchman
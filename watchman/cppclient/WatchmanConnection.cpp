@@ -7,7 +7,9 @@
 
 #include "WatchmanConnection.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <string_view>
 
 #include <folly/ExceptionWrapper.h>
 #include <folly/SocketAddress.h>
@@ -29,10 +31,15 @@ using facebook::eden::SpawnedProcess;
 #endif
 
 // Ordered with the most likely kind first
-static const std::vector<dynamic> kUnilateralLabels{"subscription", "log"};
+static constexpr std::string_view kUnilateralLabels[] = {"subscription", "log"};
 
 static const dynamic kError("error");
 static const dynamic kCapabilities("capabilities");
+static const dynamic kRequestId("request_id");
+
+// Numbers the request_ids that we give to queries, across connections so
+// that they are unique in the service's logs
+static std::atomic<uint64_t> nextRequestId{1};
 
 // We'll just dispatch bser decodes and callbacks inline unless they
 // give us an alternative environment
@@ -194,25 +201,87 @@ void WatchmanConnection::connectErr(
 WatchmanConnection::QueuedCommand::QueuedCommand(const dynamic& command)
     : cmd(command) {}
 
+void WatchmanConnection::QueuedCommand::fail(const exception_wrapper& ex) {
+  if (rawPromise) {
+    if (!rawPromise->isFulfilled()) {
+      rawPromise->setException(ex);
+    }
+  } else if (!promise.isFulfilled()) {
+    promise.setException(ex);
+  }
+}
+
+// Tags a query so that its response can be matched to it
+void WatchmanConnection::assignRequestId(QueuedCommand& cmd) {
+  if (!cmd.cmd.isArray() || cmd.cmd.size() != 3 || !cmd.cmd[0].isString() ||
+      cmd.cmd[0].getString() != "query" || !cmd.cmd[2].isObject()) {
+    return;
+  }
+  auto& query = cmd.cmd[2];
+  auto existing = query.get_ptr(kRequestId);
+  if (existing) {
+    if (existing->isString()) {
+      cmd.requestId = existing->asString();
+    }
+    return;
+  }
+  cmd.requestId = folly::to<std::string>(
+      "cppclient-", nextRequestId.fetch_add(1, std::memory_order_relaxed));
+  query[kRequestId] = *cmd.requestId;
+}
+
+void WatchmanConnection::setMaxInFlight(size_t maxInFlight) {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    maxInFlight_ = std::max(size_t(1), maxInFlight);
+  }
+  // Commands that were waiting may now be sent
+  eventBase_->runInEventBaseThread(
+      [shared_this = shared_from_this()] { shared_this->sendCommand(); });
+}
+
 Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
   auto cmd = std::make_shared<QueuedCommand>(command);
+  auto future = cmd->promise.getFuture();
+  enqueue(cmd);
+  return future;
+}
+
+Future<BserResponse> WatchmanConnection::runRaw(
+    const dynamic& command) noexcept {
+  auto cmd = std::make_shared<QueuedCommand>(command);
+  cmd->rawPromise.emplace();
+  auto future = cmd->rawPromise->getFuture();
+  enqueue(cmd);
+  return future;
+}
+
+void WatchmanConnection::enqueue(
+    const std::shared_ptr<QueuedCommand>& cmd) noexcept {
+  try {
+    assignRequestId(*cmd);
+  } catch (const std::exception& ex) {
+    cmd->fail(folly::exception_wrapper{std::current_exception(), ex});
+    return;
+  }
   if (broken_) {
-    cmd->promise.setException(WatchmanError("The connection was broken"));
-    return cmd->promise.getFuture();
+    cmd->fail(make_exception_wrapper<WatchmanError>(
+        "The connection was broken"));
+    return;
   }
   if (!sock_) {
-    cmd->promise.setException(WatchmanError(
+    cmd->fail(make_exception_wrapper<WatchmanError>(
         "No socket (did you call connect() and check result for exceptions?)"));
-    return cmd->promise.getFuture();
+    return;
   }
 
   bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
-    // We only need to call sendCommand if we don't have a command in
-    // progress; the completion handler will trigger it once we receive
-    // the response
-    shouldWrite = commandQ_.empty();
+    // We only need to call sendCommand if we have room for another command
+    // in flight; otherwise the completion handler will trigger it once we
+    // receive a response
+    shouldWrite = inFlight_ < maxInFlight_;
     commandQ_.push_back(cmd);
   }
 
@@ -220,8 +289,6 @@ Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
     eventBase_->runInEventBaseThread(
         [shared_this = shared_from_this()] { shared_this->sendCommand(); });
   }
-
-  return cmd->promise.getFuture();
 }
 
 // Generate a failure for all queued commands
@@ -230,12 +297,11 @@ void WatchmanConnection::failQueuedCommands(
   std::lock_guard<std::mutex> g(mutex_);
   auto q = commandQ_;
   commandQ_.clear();
+  inFlight_ = 0;
 
   broken_ = true;
   for (auto& cmd : q) {
-    if (!cmd->promise.isFulfilled()) {
-      cmd->promise.setException(ex);
-    }
+    cmd->fail(ex);
   }
 
   // If the user has explicitly closed the connection no need for callback
@@ -246,29 +312,54 @@ void WatchmanConnection::failQueuedCommands(
   }
 }
 
-// Sends the next eligible command to the Watchman service
-void WatchmanConnection::sendCommand(bool pop) {
-  std::shared_ptr<QueuedCommand> cmd;
-
+// Sends the queued commands that there is room in flight for to the
+// Watchman service.  Runs in the event base thread, which keeps the writes
+// in order.
+void WatchmanConnection::sendCommand() {
+  if (!sock_) {
+    return;
+  }
+  std::vector<std::shared_ptr<QueuedCommand>> toSend;
   {
     std::lock_guard<std::mutex> g(mutex_);
-
-    if (pop) {
-      // We finished processing this one, discard it and focus
-      // on the next item, if any.
-      commandQ_.pop_front();
+    while (inFlight_ < maxInFlight_ && inFlight_ < commandQ_.size()) {
+      toSend.push_back(commandQ_[inFlight_++]);
     }
-    if (commandQ_.empty()) {
-      return;
-    }
-    cmd = commandQ_.front();
   }
 
-  sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
+  for (auto& cmd : toSend) {
+    sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
+  }
 }
 
-void WatchmanConnection::popAndSendCommand() {
-  sendCommand(/* pop = */ true);
+// Removes the command that `response` answers from the queue.  That is the
+// query whose request_id it echoes, if it has one, and otherwise the oldest
+// command in flight, since the service answers in order.
+std::shared_ptr<WatchmanConnection::QueuedCommand>
+WatchmanConnection::takeCommandFor(const BserView& response) {
+  std::optional<std::string_view> requestId;
+  if (auto id = response.get(kRequestId.getString()); id && id->isString()) {
+    requestId = id->asString();
+  }
+
+  std::lock_guard<std::mutex> g(mutex_);
+  if (inFlight_ == 0) {
+    return nullptr;
+  }
+  auto match = commandQ_.begin();
+  if (requestId) {
+    auto end = commandQ_.begin() + inFlight_;
+    auto it = std::find_if(commandQ_.begin(), end, [&](const auto& cmd) {
+      return cmd->requestId == *requestId;
+    });
+    if (it != end) {
+      match = it;
+    }
+  }
+  auto cmd = std::move(*match);
+  commandQ_.erase(match);
+  --inFlight_;
+  return cmd;
 }
 
 // Called when AsyncSocket::writeChain completes
@@ -351,15 +442,19 @@ void WatchmanConnection::decodeNextResponse() {
     }
 
     try {
-      auto decoded = parseBser(pdu.get());
+      // Peek at the response in place to find out where it goes before
+      // decoding it, which runRaw() callers do for themselves
+      BserResponse response{std::move(pdu)};
+      auto value = response.value();
 
       bool is_unilateral = false;
       // Check for a unilateral response
-      for (const auto& k : kUnilateralLabels) {
-        if (decoded.get_ptr(k)) {
+      for (auto k : kUnilateralLabels) {
+        if (value.get(k)) {
           // This is a unilateral response
           if (callback_.has_value()) {
-            callback_.value()(watchmanResponseToTry(std::move(decoded)));
+            callback_.value()(
+                watchmanResponseToTry(parseBser(response.pdu())));
             is_unilateral = true;
             break;
           }
@@ -375,26 +470,26 @@ void WatchmanConnection::decodeNextResponse() {
 
       // It's actually a command response; get the cmd so that we
       // can fulfil its promise
-      std::shared_ptr<QueuedCommand> cmd;
-      {
-        std::lock_guard<std::mutex> g(mutex_);
-        if (commandQ_.empty()) {
-          failQueuedCommands(
-              std::runtime_error("No commands have been queued"));
-          return;
-        }
-        cmd = commandQ_.front();
+      auto cmd = takeCommandFor(value);
+      if (!cmd) {
+        failQueuedCommands(std::runtime_error("No commands have been queued"));
+        return;
       }
 
       // Dispatch outside of the lock in case it tries to send another
       // command
-      cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+      if (!cmd->rawPromise) {
+        cmd->promise.setTry(watchmanResponseToTry(parseBser(response.pdu())));
+      } else if (value.get(kError.getString())) {
+        cmd->rawPromise->setException(
+            make_exception_wrapper<WatchmanResponseError>(value.toDynamic()));
+      } else {
+        cmd->rawPromise->setValue(std::move(response));
+      }
 
-      // Now we're in a position to send the next queued command.
-      // We remove it after dispatching the try above in case that
-      // queued up more commands; we want to be the one thing that
-      // is responsible for sending the next queued command here
-      popAndSendCommand();
+      // Now there is room in flight for the next queued command
+      eventBase_->runInEventBaseThread(
+          [shared_this = shared_from_this()] { shared_this->sendCommand(); });
     } catch (const std::exception& ex) {
       failQueuedCommands(
           folly::exception_wrapper{std::current_exception(), ex});
@@ -19,6 +19,8 @@
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
 
+#include "BserView.h"
+
 namespace watchman {
 
 // General watchman error
@@ -69,9 +71,22 @@ class WatchmanConnection
           folly::dynamic::array("relative_root")));
 
   // Issue a watchman command, yielding the results at a later time.
-  // If the connection was terminated, will throw immediately
+  // If the connection was terminated, will throw immediately.
+  // A query that doesn't set a request_id is given one, which the service
+  // echoes in its response and reports in its logs.
   folly::Future<folly::dynamic> run(const folly::dynamic& command) noexcept;
 
+  // Like run(), but yields the response as received, to be read in place
+  // rather than decoded into a folly::dynamic.  Error responses still fail.
+  folly::Future<BserResponse> runRaw(const folly::dynamic& command) noexcept;
+
+  // Allow up to `maxInFlight` commands to be sent before their responses
+  // arrive, rather than sending each once the previous one has completed.
+  // The service answers the commands of a connection in order, so this
+  // saves a round trip per command for callers that issue many small ones.
+  // Defaults to 1.
+  void setMaxInFlight(size_t maxInFlight);
+
   // Close the connection.  All queued commands will be cancelled
   void close();
 
@@ -89,15 +104,22 @@ class WatchmanConnection
   // Represents a command queued up by the run() function
   struct QueuedCommand {
     folly::dynamic cmd;
+    // Fulfilled by run(), or rawPromise by runRaw()
     folly::Promise<folly::dynamic> promise;
+    std::optional<folly::Promise<BserResponse>> rawPromise;
+    // The request_id of a query, which its response echoes
+    std::optional<std::string> requestId;
 
     explicit QueuedCommand(const folly::dynamic& command);
+    void fail(const folly::exception_wrapper& ex);
   };
 
   folly::Future<std::string> getSockPath();
   void failQueuedCommands(const folly::exception_wrapper& ex);
-  void sendCommand(bool pop = false);
-  void popAndSendCommand();
+  void enqueue(const std::shared_ptr<QueuedCommand>& cmd) noexcept;
+  void sendCommand();
+  void assignRequestId(QueuedCommand& cmd);
+  std::shared_ptr<QueuedCommand> takeCommandFor(const BserView& response);
   void decodeNextResponse();
   folly::Try<folly::dynamic> watchmanResponseToTry(folly::dynamic&& value);
   std::unique_ptr<folly::IOBuf> splitNextPdu();
@@ -126,7 +148,10 @@ class WatchmanConnection
   folly::dynamic versionCmd_;
   std::shared_ptr<folly::AsyncSocket> sock_;
   std::mutex mutex_;
+  // The first inFlight_ commands have been sent; the rest are waiting
   std::deque<std::shared_ptr<QueuedCommand>> commandQ_;
+  size_t inFlight_{0};
+  size_t maxInFlight_{1};
   folly::IOBufQueue bufQ_{folly::IOBufQueue::cacheChainLength()};
   bool broken_{false};
   bool closing_{false};
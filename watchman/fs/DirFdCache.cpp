@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/DirFdCache.h"
+#include <algorithm>
+
+namespace watchman {
+
+DirFdCache::DirFdCache(FileSystem& fileSystem, size_t capacity)
+    : fileSystem_(fileSystem), capacity_(capacity) {}
+
+std::shared_ptr<const FileDescriptor> DirFdCache::getDir(
+    const w_string& dir) {
+  {
+    auto state = state_.wlock();
+    auto it = state->dirs.find(dir);
+    if (it != state->dirs.end()) {
+      it->second.lastUsed = ++state->clock;
+      return it->second.fd;
+    }
+  }
+
+  // Open it without holding the lock; if another thread races us to it,
+  // the last one in wins and the other descriptor is closed once its user
+  // is done with it.
+  auto fd = std::make_shared<const FileDescriptor>(
+      fileSystem_.openDirForStat(dir.c_str()));
+
+  auto state = state_.wlock();
+  if (state->dirs.size() >= capacity_) {
+    auto lru = std::min_element(
+        state->dirs.begin(), state->dirs.end(), [](auto& a, auto& b) {
+          return a.second.lastUsed < b.second.lastUsed;
+        });
+    state->dirs.erase(lru);
+  }
+  state->dirs[dir] = Entry{fd, ++state->clock};
+  return fd;
+}
+
+FileInformation DirFdCache::getFileInformation(
+    const w_string& path,
+    const StatOptions& options) {
+  if (capacity_ > 0 && supported_.load(std::memory_order_relaxed)) {
+    std::shared_ptr<const FileDescriptor> dir;
+    try {
+      dir = getDir(path.dirName());
+    } catch (const std::system_error& exc) {
+      if (exc.code() == std::errc::function_not_supported) {
+        supported_.store(false, std::memory_order_relaxed);
+      }
+      // Let the fallback report the error for path
+    }
+    if (dir) {
+      // The base name is a suffix of path, so it is NUL terminated
+      return fileSystem_.getFileInformationAt(
+          *dir, w_string_piece(path).baseName().data(), options);
+    }
+  }
+  return fileSystem_.getFileInformation(
+      path.c_str(), CaseSensitivity::CaseSensitive, options);
+}
+
+void DirFdCache::clear() {
+  state_.wlock()->dirs.clear();
+}
+
+size_t DirFdCache::size() const {
+  return state_.rlock()->dirs.size();
+}
+
+} // namespace watchman
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include "watchman/fs/FileSystem.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Stats paths relative to open descriptors of their parent dirs, so that
+ * the kernel only resolves their final component rather than every
+ * component of the path again.  The descriptors of the most recently used
+ * dirs are kept open.
+ *
+ * A cached descriptor keeps referring to its dir if that is renamed or
+ * replaced, so callers must clear the cache once the changes that they
+ * are processing have been applied.
+ *
+ * Performs no name checks, so must only be used for case sensitive roots.
+ * Safe to use from multiple threads.
+ */
+class DirFdCache {
+ public:
+  DirFdCache(FileSystem& fileSystem, size_t capacity);
+
+  /**
+   * Equivalent to fileSystem.getFileInformation(path), which it falls back
+   * to if the parent dir of path can't be opened.
+   */
+  FileInformation getFileInformation(
+      const w_string& path,
+      const StatOptions& options = StatOptions{});
+
+  /** Closes every cached descriptor. */
+  void clear();
+
+  size_t size() const;
+
+ private:
+  std::shared_ptr<const FileDescriptor> getDir(const w_string& dir);
+
+  struct Entry {
+    std::shared_ptr<const FileDescriptor> fd;
+    uint64_t lastUsed;
+  };
+  struct State {
+    std::unordered_map<w_string, Entry> dirs;
+    uint64_t clock{0};
+  };
+
+  FileSystem& fileSystem_;
+  const size_t capacity_;
+  // Cleared if the filesystem doesn't support stats relative to a dir
+  std::atomic<bool> supported_{true};
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -16,12 +16,23 @@ struct DirEntry {
   bool has_stat;
   const char* d_name;
   FileInformation stat;
+  // When has_stat is false, the inode number and type that readdir
+  // reported for the entry, if it did; 0 and DType::Unknown otherwise.
+  ino_t ino{0};
+  DType dtype{DType::Unknown};
 };
 
 class DirHandle {
  public:
   virtual ~DirHandle() = default;
   virtual const DirEntry* readDir() = 0;
+
+  /**
+   * Tells the handle how many entries the caller expects the dir to have,
+   * before the first readDir.  Handles that read entries in batches use it
+   * to size their first batch.
+   */
+  virtual void setSizeHint(size_t /*numEntries*/) {}
 #ifndef _WIN32
   virtual int getFd() const = 0;
 #endif
@@ -8,6 +8,9 @@
 #include "watchman/fs/FSDetect.h"
 #include <folly/FileUtil.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <mutex>
+#include <unordered_map>
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/watchman_system.h"
 
@@ -24,7 +27,9 @@
 #include <sys/mount.h>
 #endif
 #ifdef __linux__
+#include <fcntl.h>
 #include <linux/magic.h>
+#include <poll.h>
 #endif
 
 namespace watchman {
@@ -42,6 +47,48 @@ CaseSensitivity getCaseSensitivityForPath(const char* path) {
 #endif
 }
 
+std::optional<uint64_t> getMountTableGeneration() {
+#ifdef __linux__
+  // The kernel flags an open /proc/self/mounts for poll() whenever the
+  // mount table changes, until it is read again.
+  struct MountWatch {
+    std::mutex mutex;
+    std::optional<FileDescriptor> fd;
+    uint64_t generation{0};
+  };
+  static MountWatch watch;
+
+  std::lock_guard<std::mutex> guard(watch.mutex);
+  if (!watch.fd) {
+    watch.fd = FileDescriptor(
+        open("/proc/self/mounts", O_RDONLY | O_CLOEXEC),
+        FileDescriptor::FDType::Generic);
+  }
+  if (!*watch.fd) {
+    return std::nullopt;
+  }
+
+  struct pollfd pfd;
+  pfd.fd = watch.fd->fd();
+  pfd.events = POLLPRI;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, 0) < 0) {
+    return std::nullopt;
+  }
+  if (pfd.revents & (POLLPRI | POLLERR)) {
+    ++watch.generation;
+    // Reading from the start acknowledges the change
+    char buf[256];
+    if (lseek(pfd.fd, 0, SEEK_SET) == 0) {
+      (void)read(pfd.fd, buf, sizeof(buf));
+    }
+  }
+  return watch.generation;
+#else
+  return std::nullopt;
+#endif
+}
+
 } // namespace watchman
 
 // This function is used to return the fstype for a given path
@@ -119,7 +166,8 @@ w_string w_fstype_detect_macos_nfs(w_string fstype, w_string edenfs_indicator) {
 // need to have a fully comprehensive mapping of the underlying filesystem
 // type codes to names, just the known problematic types
 
-w_string w_fstype(const char* path) {
+namespace {
+w_string detect_fstype(const char* path) {
 #ifdef __linux__
   // If possible, we prefer to read the filesystem type names from
   // `/proc/self/mounts`
@@ -215,5 +263,67 @@ w_string w_fstype(const char* path) {
 #endif
 }
 
+struct FsTypeCache {
+  uint64_t generation{0};
+  std::unordered_map<w_string, w_string> types;
+};
+// Only the paths of new watches are looked up, so a small bound suffices
+constexpr size_t kMaxFsTypeCacheSize = 1024;
+} // namespace
+
+w_string w_fstype(const char* path) {
+  auto generation = watchman::getMountTableGeneration();
+  if (!generation) {
+    return detect_fstype(path);
+  }
+
+  static folly::Synchronized<FsTypeCache> cache;
+  w_string key(path, W_STRING_BYTE);
+  {
+    auto locked = cache.rlock();
+    if (locked->generation == *generation) {
+      auto it = locked->types.find(key);
+      if (it != locked->types.end()) {
+        return it->second;
+      }
+    }
+  }
+
+  auto type = detect_fstype(path);
+  auto locked = cache.wlock();
+  if (locked->generation != *generation ||
+      locked->types.size() >= kMaxFsTypeCacheSize) {
+    locked->types.clear();
+    locked->generation = *generation;
+  }
+  locked->types[key] = type;
+  return type;
+}
+
+bool is_dir_mtime_reliable_fs_type(w_string_piece fs_type) {
+  // Network and FUSE filesystems may cache dir attributes or synthesize
+  // them, so only trust the ones that we know.
+  static const char* const kReliable[] = {
+      "apfs",
+      "btrfs",
+      "ext2",
+      "ext3",
+      "ext4",
+      "f2fs",
+      "hfs",
+      "NTFS",
+      "ReFS",
+      "tmpfs",
+      "xfs",
+      "zfs",
+  };
+  for (auto name : kReliable) {
+    if (fs_type == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 /* vim:ts=2:sw=2:et:
  */
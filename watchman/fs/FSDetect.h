@@ -8,6 +8,8 @@
 #pragma once
 
 #include <folly/Range.h>
+#include <cstdint>
+#include <optional>
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/watchman_string.h"
 
@@ -17,9 +19,17 @@ namespace watchman {
  * case sensitivity of the input path. */
 CaseSensitivity getCaseSensitivityForPath(const char* path);
 
+/**
+ * Returns a number that changes whenever a filesystem is mounted or
+ * unmounted, so that things learned about paths can be remembered until
+ * then.  Returns nullopt on systems where that can't be detected cheaply.
+ */
+std::optional<uint64_t> getMountTableGeneration();
+
 } // namespace watchman
 
-// Returns the name of the filesystem for the specified path
+// Returns the name of the filesystem for the specified path.  Remembered
+// until the mount table changes, where getMountTableGeneration can tell.
 w_string w_fstype(const char* path);
 w_string find_fstype_in_linux_proc_mounts(
     std::string_view path,
@@ -28,3 +38,8 @@ w_string find_fstype_in_linux_proc_mounts(
 inline bool is_edenfs_fs_type(w_string_piece fs_type) {
   return fs_type == "edenfs" || fs_type.startsWith("edenfs:");
 }
+
+// Returns true if fs_type is a local filesystem that updates the mtime of a
+// dir whenever an entry is added to, removed from or renamed in it, so that
+// an unchanged mtime shows that the entries are unchanged.
+bool is_dir_mtime_reliable_fs_type(w_string_piece fs_type);
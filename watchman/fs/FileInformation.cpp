@@ -6,6 +6,12 @@
  */
 
 #include "watchman/fs/FileInformation.h"
+#include <algorithm>
+#include <cstdint>
+#ifdef HAVE_STATX
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#endif
 #include "watchman/watchman_time.h"
 
 namespace watchman {
@@ -25,6 +31,38 @@ FileInformation::FileInformation(const struct stat& st)
 }
 #endif
 
+#ifdef HAVE_STATX
+FileInformation::FileInformation(const struct statx& stx)
+    : mode(stx.stx_mode),
+      size(off_t(stx.stx_size)),
+      uid(stx.stx_uid),
+      gid(stx.stx_gid),
+      ino(stx.stx_ino),
+      dev(makedev(stx.stx_dev_major, stx.stx_dev_minor)),
+      nlink(stx.stx_nlink) {
+  if (stx.stx_mask & STATX_ATIME) {
+    atime = timespec{time_t(stx.stx_atime.tv_sec), stx.stx_atime.tv_nsec};
+  }
+  mtime = timespec{time_t(stx.stx_mtime.tv_sec), stx.stx_mtime.tv_nsec};
+  ctime = timespec{time_t(stx.stx_ctime.tv_sec), stx.stx_ctime.tv_nsec};
+}
+
+unsigned int FileInformation::statxMask(const StatOptions& options) {
+  // Everything that we compare to detect changes, but not the block
+  // counts or the birth time, which nothing uses
+  unsigned int mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID |
+      STATX_GID | STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME;
+  if (options.atime) {
+    mask |= STATX_ATIME;
+  }
+  return mask;
+}
+
+int FileInformation::statxFlags(const StatOptions& options) {
+  return options.dontSync ? AT_STATX_DONT_SYNC : AT_STATX_SYNC_AS_STAT;
+}
+#endif
+
 #ifdef _WIN32
 FileInformation::FileInformation(uint32_t dwFileAttributes)
     : fileAttributes(dwFileAttributes) {
@@ -47,59 +85,96 @@ FileInformation::FileInformation(uint32_t dwFileAttributes)
 }
 #endif
 
-DType FileInformation::dtype() const {
-#ifdef DTTOIF
-  return static_cast<DType>(IFTODT(mode));
+namespace {
+
+#ifdef _WIN32
+using TypeBits = uint32_t;
 #else
-  // Windows, Solaris
-  if (isSymlink()) {
-    return DType::Symlink;
-  }
-  if (isDir()) {
-    return DType::Dir;
-  }
-  if (isFile()) {
-    return DType::Regular;
-  }
-  return DType::Unknown;
+using TypeBits = mode_t;
 #endif
-}
 
-bool FileInformation::isSymlink() const {
+// The file type predicates, given the mode on POSIX systems and the file
+// attributes on Windows
+bool isSymlinkType(TypeBits bits) {
 #ifdef _WIN32
   // We treat all reparse points as equivalent to symlinks
-  return fileAttributes & FILE_ATTRIBUTE_REPARSE_POINT;
+  return bits & FILE_ATTRIBUTE_REPARSE_POINT;
 #else
-  return S_ISLNK(mode);
+  return S_ISLNK(bits);
 #endif
 }
 
-bool FileInformation::isDir() const {
+bool isDirType(TypeBits bits) {
 #ifdef _WIN32
   // Note that junctions have both DIRECTORY and REPARSE_POINT set,
   // so we have to check both bits to make sure that we only report
   // this as a dir if it isn't a junction, otherwise we will fail to
   // opendir.
-  return (fileAttributes &
-          (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
+  return (bits & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
       FILE_ATTRIBUTE_DIRECTORY;
 #else
-  return S_ISDIR(mode);
+  return S_ISDIR(bits);
 #endif
 }
 
-bool FileInformation::isFile() const {
+bool isFileType(TypeBits bits) {
 #ifdef _WIN32
   // We can't simply test for FILE_ATTRIBUTE_NORMAL as that is only
   // valid when no other bits are set.  Instead we check for the absence
   // of DIRECTORY and REPARSE_POINT to decide that it is a regular file.
-  return (fileAttributes &
-          (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) == 0;
+  return (bits & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT)) ==
+      0;
+#else
+  return S_ISREG(bits);
+#endif
+}
+
+DType dtypeOf(TypeBits bits) {
+#ifdef DTTOIF
+  return static_cast<DType>(IFTODT(bits));
+#else
+  // Windows, Solaris
+  if (isSymlinkType(bits)) {
+    return DType::Symlink;
+  }
+  if (isDirType(bits)) {
+    return DType::Dir;
+  }
+  if (isFileType(bits)) {
+    return DType::Regular;
+  }
+  return DType::Unknown;
+#endif
+}
+
+// FileInformation and CompactFileInformation hold the same type bits
+template <typename Info>
+TypeBits typeBitsOf(const Info& info) {
+#ifdef _WIN32
+  return info.fileAttributes;
 #else
-  return S_ISREG(mode);
+  return info.mode;
 #endif
 }
 
+} // namespace
+
+DType FileInformation::dtype() const {
+  return dtypeOf(typeBitsOf(*this));
+}
+
+bool FileInformation::isSymlink() const {
+  return isSymlinkType(typeBitsOf(*this));
+}
+
+bool FileInformation::isDir() const {
+  return isDirType(typeBitsOf(*this));
+}
+
+bool FileInformation::isFile() const {
+  return isFileType(typeBitsOf(*this));
+}
+
 FileInformation FileInformation::makeDeletedFileInformation() {
   FileInformation info;
 #ifndef _WIN32
@@ -109,4 +184,57 @@ FileInformation FileInformation::makeDeletedFileInformation() {
 #endif
   return info;
 }
+
+CompactFileInformation::CompactFileInformation(const FileInformation& info)
+    : size(info.size),
+      ino(info.ino),
+      dev(info.dev),
+      mtimeSec(info.mtime.tv_sec),
+      ctimeSec(info.ctime.tv_sec),
+      mtimeNsec(uint32_t(info.mtime.tv_nsec)),
+      ctimeNsec(uint32_t(info.ctime.tv_nsec)),
+      mode(info.mode),
+      nlink(uint32_t(std::min<uint64_t>(info.nlink, UINT32_MAX))),
+      uid(info.uid),
+      gid(info.gid)
+#ifdef _WIN32
+      ,
+      fileAttributes(info.fileAttributes)
+#endif
+{
+}
+
+DType CompactFileInformation::dtype() const {
+  return dtypeOf(typeBitsOf(*this));
+}
+
+bool CompactFileInformation::isSymlink() const {
+  return isSymlinkType(typeBitsOf(*this));
+}
+
+bool CompactFileInformation::isDir() const {
+  return isDirType(typeBitsOf(*this));
+}
+
+bool CompactFileInformation::isFile() const {
+  return isFileType(typeBitsOf(*this));
+}
+
+FileInformation CompactFileInformation::expand() const {
+  FileInformation info;
+  info.mode = mode;
+  info.size = size;
+  info.uid = uid;
+  info.gid = gid;
+  info.ino = ino;
+  info.dev = dev;
+  info.nlink = nlink;
+#ifdef _WIN32
+  info.fileAttributes = fileAttributes;
+#endif
+  info.mtime = mtime();
+  info.ctime = ctime();
+  return info;
+}
+
 } // namespace watchman
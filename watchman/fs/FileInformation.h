@@ -8,6 +8,7 @@
 #pragma once
 
 #include <sys/stat.h>
+#include <cstdint>
 #include "watchman/watchman_system.h"
 
 #ifndef _WIN32
@@ -83,6 +84,18 @@ enum class DType {
 #endif
 };
 
+/**
+ * What a stat needs to fetch, for the platforms that can leave things out.
+ */
+struct StatOptions {
+  // Whether FileInformation::atime is needed.  If not, it may be left 0.
+  bool atime{true};
+  // Whether attributes that the kernel has cached for a network filesystem
+  // may be used without asking the server whether they are current.  Local
+  // filesystems are unaffected.
+  bool dontSync{false};
+};
+
 struct FileInformation {
   // On POSIX systems, the complete mode information.
   // On Windows, this is lossy wrt. symlink information,
@@ -132,6 +145,14 @@ struct FileInformation {
 
 #ifndef _WIN32
   explicit FileInformation(const struct stat& st);
+#ifdef HAVE_STATX
+  // Fills in the fields that stx.stx_mask says are valid
+  explicit FileInformation(const struct statx& stx);
+
+  // The statx mask and flags that fetch what options need
+  static unsigned int statxMask(const StatOptions& options);
+  static int statxFlags(const StatOptions& options);
+#endif
 #else
   // Partially initialize the common fields.
   // There are a number of different forms of windows specific data
@@ -149,6 +170,50 @@ struct FileInformation {
   static FileInformation makeDeletedFileInformation();
 };
 
+/**
+ * What the view keeps of a FileInformation for each of its files: the
+ * fields that are compared to detect changes and that queries report, in
+ * narrower types, without the access time.  The access time is read from
+ * the filesystem when a query asks for it.
+ */
+struct CompactFileInformation {
+  off_t size{0};
+  ino_t ino{0};
+  dev_t dev{0};
+  int64_t mtimeSec{0};
+  int64_t ctimeSec{0};
+  uint32_t mtimeNsec{0};
+  uint32_t ctimeNsec{0};
+  mode_t mode{0};
+  // Saturates at UINT32_MAX
+  uint32_t nlink{0};
+  uid_t uid{0};
+  gid_t gid{0};
+#ifdef _WIN32
+  uint32_t fileAttributes{0};
+#endif
+
+  CompactFileInformation() = default;
+  // Implicit, so that the results of a stat can be stored directly
+  /* implicit */ CompactFileInformation(const FileInformation& info);
+
+  struct timespec mtime() const {
+    return timespec{time_t(mtimeSec), long(mtimeNsec)};
+  }
+  struct timespec ctime() const {
+    return timespec{time_t(ctimeSec), long(ctimeNsec)};
+  }
+
+  // As for FileInformation
+  DType dtype() const;
+  bool isSymlink() const;
+  bool isDir() const;
+  bool isFile() const;
+
+  // Returns the FileInformation that this was made from, with an atime of 0
+  FileInformation expand() const;
+};
+
 } // namespace watchman
 
 #ifndef _WIN32
@@ -8,6 +8,12 @@
 #include "watchman/fs/FileSystem.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/watchman_string.h"
+#include <atomic>
+#include <optional>
+
+#ifdef HAVE_STATX
+#include <fcntl.h>
+#endif
 
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
@@ -25,6 +31,39 @@ namespace watchman {
 
 namespace {
 
+#ifdef HAVE_STATX
+// Set once we find that the kernel doesn't implement statx, or that a
+// seccomp policy forbids it
+std::atomic<bool> statxUnavailable{false};
+
+/** Calls statx, or returns nullopt if it isn't available.  Throws
+ * std::system_error if it fails. */
+std::optional<FileInformation> statxAt(
+    int dirFd,
+    const char* name,
+    int flags,
+    const StatOptions& options) {
+  if (statxUnavailable.load(std::memory_order_relaxed)) {
+    return std::nullopt;
+  }
+  struct statx stx;
+  if (statx(
+          dirFd,
+          name,
+          flags | FileInformation::statxFlags(options),
+          FileInformation::statxMask(options),
+          &stx)) {
+    int err = errno;
+    if (err == ENOSYS || err == EPERM) {
+      statxUnavailable.store(true, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    throw std::system_error(err, std::generic_category(), "statx");
+  }
+  return FileInformation(stx);
+}
+#endif
+
 class RealFileSystem : public FileSystem {
  public:
   std::unique_ptr<DirHandle> openDir(const char* path, bool strict = true)
@@ -34,9 +73,32 @@ class RealFileSystem : public FileSystem {
 
   FileInformation getFileInformation(
       const char* path,
-      CaseSensitivity caseSensitive = CaseSensitivity::Unknown) override {
-    return watchman::getFileInformation(path, caseSensitive);
+      CaseSensitivity caseSensitive = CaseSensitivity::Unknown,
+      const StatOptions& options = StatOptions{}) override {
+    return watchman::getFileInformation(path, caseSensitive, options);
+  }
+
+#ifndef _WIN32
+  FileDescriptor openDirForStat(const char* path) override {
+    return openFileHandle(path, OpenFileHandleOptions::strictOpenDir());
   }
+
+  FileInformation getFileInformationAt(
+      const FileDescriptor& dir,
+      const char* name,
+      const StatOptions& options = StatOptions{}) override {
+#ifdef HAVE_STATX
+    if (auto info = statxAt(dir.fd(), name, AT_SYMLINK_NOFOLLOW, options)) {
+      return *info;
+    }
+#endif
+    struct stat st;
+    if (fstatat(dir.fd(), name, &st, AT_SYMLINK_NOFOLLOW)) {
+      throw std::system_error(errno, std::generic_category(), "fstatat");
+    }
+    return FileInformation(st);
+  }
+#endif
 };
 
 RealFileSystem gRealFileSystem;
@@ -247,16 +309,27 @@ FileDescriptor openFileHandle(
 
 FileInformation getFileInformation(
     const char* path,
-    CaseSensitivity caseSensitive) {
+    CaseSensitivity caseSensitive,
+    const StatOptions& statOptions) {
   auto options = OpenFileHandleOptions::queryFileInfo();
   options.caseSensitive = caseSensitive;
 #if defined(_WIN32) || defined(O_PATH)
   // These operating systems allow opening symlink nodes and querying them
   // for stat information
   auto handle = openFileHandle(path, options);
+#ifdef HAVE_STATX
+  // The open did the name checks; statx lets us leave out what we don't
+  // need, which saves network filesystems a round trip.
+  if (auto info = statxAt(handle.fd(), "", AT_EMPTY_PATH, statOptions)) {
+    return *info;
+  }
+#else
+  (void)statOptions;
+#endif
   auto info = handle.getInfo();
   return info;
 #else
+  (void)statOptions;
   // Since the leaf of the path may be a symlink, and this system doesn't
   // allow opening symlinks for stat purposes, we have to resort to performing
   // a relative fstatat() from the parent dir.
@@ -6,6 +6,8 @@
  */
 
 #pragma once
+#include <cerrno>
+#include <system_error>
 #include "watchman/Result.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileDescriptor.h"
@@ -36,7 +38,33 @@ class FileSystem {
 
   virtual FileInformation getFileInformation(
       const char* path,
-      CaseSensitivity caseSensitive = CaseSensitivity::Unknown) = 0;
+      CaseSensitivity caseSensitive = CaseSensitivity::Unknown,
+      const StatOptions& options = StatOptions{}) = 0;
+
+  /**
+   * Opens a dir so that its entries can be stat'd with getFileInformationAt.
+   * Throws std::system_error, with ENOSYS if this filesystem can't.
+   */
+  virtual FileDescriptor openDirForStat(const char* /*path*/) {
+    throw std::system_error(
+        ENOSYS, std::generic_category(), "openDirForStat is not supported");
+  }
+
+  /**
+   * Stats the entry `name` of the dir that `dir` refers to, without
+   * following a final symlink.  Unlike getFileInformation this performs no
+   * name checks, so it is only suitable for case sensitive filesystems.
+   * Throws std::system_error, with ENOSYS if this filesystem can't.
+   */
+  virtual FileInformation getFileInformationAt(
+      const FileDescriptor& /*dir*/,
+      const char* /*name*/,
+      const StatOptions& /*options*/ = StatOptions{}) {
+    throw std::system_error(
+        ENOSYS,
+        std::generic_category(),
+        "getFileInformationAt is not supported");
+  }
 };
 
 extern FileSystem& realFileSystem;
@@ -48,10 +76,12 @@ FileDescriptor openFileHandle(
     const char* path,
     const OpenFileHandleOptions& opts);
 
-/** equivalent to lstat(2), but performs strict name checking */
+/** equivalent to lstat(2), but performs strict name checking.  Where
+ * statx(2) is available, only fetches what options ask for. */
 FileInformation getFileInformation(
     const char* path,
-    CaseSensitivity caseSensitive = CaseSensitivity::Unknown);
+    CaseSensitivity caseSensitive = CaseSensitivity::Unknown,
+    const StatOptions& options = StatOptions{});
 
 /** equivalent to realpath() */
 w_string realPath(const char* path);
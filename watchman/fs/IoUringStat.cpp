@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/IoUringStat.h"
+#include <system_error>
+
+#if defined(HAVE_IO_URING_STATX) && defined(HAVE_STATX)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#endif
+
+namespace watchman {
+
+#if defined(HAVE_IO_URING_STATX) && defined(HAVE_STATX)
+
+namespace {
+
+// Returns true if the kernel behind ring implements IORING_OP_STATX
+bool supportsStatx(int ring) {
+  constexpr unsigned kNumOps = 256;
+  std::vector<char> buf(
+      sizeof(io_uring_probe) + kNumOps * sizeof(io_uring_probe_op), 0);
+  auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+  if (syscall(
+          __NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, kNumOps) <
+      0) {
+    return false;
+  }
+  return probe->last_op >= IORING_OP_STATX &&
+      (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+}
+
+template <typename T>
+T* ringPtr(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+} // namespace
+
+IoUringStat::IoUringStat(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_ = FileDescriptor(
+      int(syscall(__NR_io_uring_setup, entries, &params)),
+      "io_uring_setup",
+      FileDescriptor::FDType::Generic);
+  if (!supportsStatx(ring_.fd())) {
+    throw std::system_error(
+        ENOSYS, std::generic_category(), "io_uring does not support statx");
+  }
+  entries_ = params.sq_entries;
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+
+  auto map = [&](size_t size, off_t offset) {
+    auto addr = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        ring_.fd(),
+        offset);
+    if (addr == MAP_FAILED) {
+      auto err = errno;
+      unmap();
+      throw std::system_error(err, std::generic_category(), "mmap io_uring");
+    }
+    return addr;
+  };
+
+  sqRing_ = map(sqRingSize_, IORING_OFF_SQ_RING);
+  cqRing_ = singleMmap ? sqRing_ : map(cqRingSize_, IORING_OFF_CQ_RING);
+  sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(map(sqesSize_, IORING_OFF_SQES));
+
+  sqHead_ = ringPtr<unsigned>(sqRing_, params.sq_off.head);
+  sqTail_ = ringPtr<unsigned>(sqRing_, params.sq_off.tail);
+  sqMask_ = *ringPtr<unsigned>(sqRing_, params.sq_off.ring_mask);
+  sqArray_ = ringPtr<unsigned>(sqRing_, params.sq_off.array);
+  cqHead_ = ringPtr<unsigned>(cqRing_, params.cq_off.head);
+  cqTail_ = ringPtr<unsigned>(cqRing_, params.cq_off.tail);
+  cqMask_ = *ringPtr<unsigned>(cqRing_, params.cq_off.ring_mask);
+  cqes_ = ringPtr<io_uring_cqe>(cqRing_, params.cq_off.cqes);
+}
+
+IoUringStat::~IoUringStat() {
+  unmap();
+}
+
+void IoUringStat::unmap() {
+  if (sqes_) {
+    munmap(sqes_, sqesSize_);
+    sqes_ = nullptr;
+  }
+  if (cqRing_ && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  cqRing_ = nullptr;
+  if (sqRing_) {
+    munmap(sqRing_, sqRingSize_);
+    sqRing_ = nullptr;
+  }
+}
+
+std::vector<std::optional<FileInformation>> IoUringStat::statAll(
+    const std::vector<w_string>& paths,
+    const StatOptions& options) {
+  std::vector<std::optional<FileInformation>> results(paths.size());
+  auto mask = FileInformation::statxMask(options);
+  auto flags = AT_SYMLINK_NOFOLLOW | FileInformation::statxFlags(options);
+  std::vector<struct statx> buffers(paths.size());
+
+  size_t next = 0;
+  // Queued in the submission ring but not yet consumed by the kernel
+  unsigned unsubmitted = 0;
+  // Queued and not yet reaped from the completion ring.  Keeping this
+  // within the size of the submission ring means that neither ring can
+  // overflow; the completion ring is twice as large.
+  unsigned inFlight = 0;
+
+  while (next < paths.size() || inFlight > 0) {
+    // We are the only producer, so the tail is ours to read non-atomically
+    unsigned tail = *sqTail_;
+    while (next < paths.size() && inFlight < entries_) {
+      auto index = tail & sqMask_;
+      auto* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<uint64_t>(paths[next].c_str());
+      sqe->len = mask;
+      sqe->off = reinterpret_cast<uint64_t>(&buffers[next]);
+      sqe->statx_flags = flags;
+      sqe->user_data = next;
+      sqArray_[index] = index;
+      ++tail;
+      ++next;
+      ++unsubmitted;
+      ++inFlight;
+    }
+    __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+
+    auto submitted = syscall(
+        __NR_io_uring_enter,
+        ring_.fd(),
+        unsubmitted,
+        1,
+        IORING_ENTER_GETEVENTS,
+        nullptr,
+        0);
+    if (submitted < 0) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw std::system_error(
+            errno, std::generic_category(), "io_uring_enter");
+      }
+      // Reap whatever has completed and try again
+      submitted = 0;
+    }
+    unsubmitted -= unsigned(submitted);
+
+    unsigned head = *cqHead_;
+    unsigned cqTail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    while (head != cqTail) {
+      const auto& cqe = cqes_[head & cqMask_];
+      if (cqe.res == 0) {
+        results[cqe.user_data] = FileInformation(buffers[cqe.user_data]);
+      }
+      ++head;
+      --inFlight;
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+  }
+
+  return results;
+}
+
+#else
+
+IoUringStat::IoUringStat(unsigned) {
+  throw std::system_error(
+      ENOSYS, std::generic_category(), "io_uring is not available");
+}
+
+IoUringStat::~IoUringStat() {}
+
+void IoUringStat::unmap() {}
+
+std::vector<std::optional<FileInformation>> IoUringStat::statAll(
+    const std::vector<w_string>& paths,
+    const StatOptions&) {
+  return std::vector<std::optional<FileInformation>>(paths.size());
+}
+
+#endif
+
+} // namespace watchman
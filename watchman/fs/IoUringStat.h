@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <optional>
+#include <vector>
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/watchman_string.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace watchman {
+
+/**
+ * Stats a batch of paths by submitting a statx operation for each of them to
+ * an io_uring, so that the latency of the calls overlaps rather than
+ * accumulates.  This matters most on network filesystems and cold caches.
+ *
+ * Requires Linux 5.6 or later; the constructor throws std::system_error on
+ * systems that don't support io_uring or its statx operation, including
+ * those where it is disabled by seccomp or sysctl.
+ *
+ * An instance must only be used by one thread at a time.
+ */
+class IoUringStat {
+ public:
+  // Creates a ring with room for `entries` operations in flight
+  explicit IoUringStat(unsigned entries = 256);
+  ~IoUringStat();
+
+  IoUringStat(const IoUringStat&) = delete;
+  IoUringStat& operator=(const IoUringStat&) = delete;
+
+  // Returns the lstat(2) information for each of paths, which must be
+  // absolute, or nullopt for those that couldn't be stat'd.  Only fetches
+  // what options ask for.  Throws if the ring itself fails.
+  std::vector<std::optional<FileInformation>> statAll(
+      const std::vector<w_string>& paths,
+      const StatOptions& options = StatOptions{});
+
+ private:
+  void unmap();
+
+  FileDescriptor ring_;
+  unsigned entries_{0};
+
+  void* sqRing_{nullptr};
+  size_t sqRingSize_{0};
+  void* cqRing_{nullptr};
+  size_t cqRingSize_{0};
+  io_uring_sqe* sqes_{nullptr};
+  size_t sqesSize_{0};
+
+  // Pointers into the rings shared with the kernel
+  unsigned* sqHead_{nullptr};
+  unsigned* sqTail_{nullptr};
+  unsigned sqMask_{0};
+  unsigned* sqArray_{nullptr};
+  unsigned* cqHead_{nullptr};
+  unsigned* cqTail_{nullptr};
+  unsigned cqMask_{0};
+  io_uring_cqe* cqes_{nullptr};
+};
+
+} // namespace watchman
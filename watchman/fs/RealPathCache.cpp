@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/RealPathCache.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileSystem.h"
+
+namespace watchman {
+
+namespace {
+// Commands name a handful of paths; if something names many more, start
+// over rather than grow without bound.
+constexpr size_t kMaxEntries = 4096;
+} // namespace
+
+RealPathCache::RealPathCache(
+    std::chrono::milliseconds ttl,
+    Resolver resolver,
+    GenerationSource mountGeneration)
+    : ttl_(ttl),
+      resolver_(resolver ? std::move(resolver) : Resolver(realPath)),
+      mountGeneration_(
+          mountGeneration ? std::move(mountGeneration)
+                          : GenerationSource(getMountTableGeneration)) {}
+
+w_string RealPathCache::resolve(const char* path, bool* cached) {
+  if (cached) {
+    *cached = false;
+  }
+  if (ttl_.count() <= 0) {
+    return resolver_(path);
+  }
+
+  auto generation = mountGeneration_();
+  auto now = std::chrono::steady_clock::now();
+  w_string key(path, W_STRING_BYTE);
+  {
+    auto state = state_.rlock();
+    if (state->generation == generation) {
+      auto it = state->entries.find(key);
+      if (it != state->entries.end() && it->second.expires > now) {
+        if (cached) {
+          *cached = true;
+        }
+        return it->second.resolved;
+      }
+    }
+  }
+
+  auto resolved = resolver_(path);
+
+  auto state = state_.wlock();
+  if (state->generation != generation ||
+      state->entries.size() >= kMaxEntries) {
+    state->entries.clear();
+    state->generation = generation;
+  }
+  state->entries[key] = Entry{resolved, now + ttl_};
+  return resolved;
+}
+
+void RealPathCache::forget(const char* path) {
+  state_.wlock()->entries.erase(w_string(path, W_STRING_BYTE));
+}
+
+size_t RealPathCache::size() const {
+  return state_.rlock()->entries.size();
+}
+
+} // namespace watchman
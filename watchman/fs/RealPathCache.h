@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers what realPath() resolved paths to, so that commands that name
+ * the same paths over and over, such as a watch-project before every build
+ * step, don't walk every component of them each time.
+ *
+ * A symlink along a path may be changed at any time, so entries expire
+ * after a while, and all of them are forgotten whenever the mount table
+ * changes.  Failures aren't remembered.  Safe to use from multiple threads.
+ */
+class RealPathCache {
+ public:
+  using Resolver = std::function<w_string(const char*)>;
+  using GenerationSource = std::function<std::optional<uint64_t>()>;
+
+  /**
+   * A ttl of zero disables the cache.  The resolver and generation source
+   * default to realPath() and getMountTableGeneration().
+   */
+  explicit RealPathCache(
+      std::chrono::milliseconds ttl,
+      Resolver resolver = {},
+      GenerationSource mountGeneration = {});
+
+  /**
+   * Returns what the resolver returns for path, throwing what it throws.
+   * If cached is provided, it is set to whether the result came from the
+   * cache, in which case the resolver wasn't called.
+   */
+  w_string resolve(const char* path, bool* cached = nullptr);
+
+  /**
+   * Forgets path, for callers that found that what it resolved to is no
+   * longer of use to them.
+   */
+  void forget(const char* path);
+
+  size_t size() const;
+
+ private:
+  struct Entry {
+    w_string resolved;
+    std::chrono::steady_clock::time_point expires;
+  };
+  struct State {
+    std::optional<uint64_t> generation;
+    std::unordered_map<w_string, Entry> entries;
+  };
+
+  const std::chrono::milliseconds ttl_;
+  Resolver resolver_;
+  GenerationSource mountGeneration_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -8,8 +8,12 @@
 #include "watchman/fs/DirHandle.h"
 
 #include <folly/String.h>
+#include <folly/synchronization/Baton.h>
+#include <algorithm>
+#include <atomic>
 #include <system_error>
 #include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileSystem.h"
@@ -57,6 +61,88 @@ typedef struct {
   off_t file_size; // ATTR_FILE_TOTALSIZE
 
 } __attribute__((packed)) bulk_attr_item;
+
+// The most that a single entry can take up
+constexpr size_t kMaxBulkItemSize = sizeof(bulk_attr_item) + NAME_MAX * 3 + 1;
+// What an entry with a name of typical length takes up
+constexpr size_t kTypicalBulkItemSize = sizeof(bulk_attr_item) + 32;
+// Room for 64 of the largest entries, which holds several hundred typical
+// ones; this is all that small dirs need
+constexpr size_t kMinBulkBufSize = 64 * kMaxBulkItemSize;
+// Beyond this, the syscalls saved don't make up for the memory
+constexpr size_t kMaxBulkBufSize = 4 * 1024 * 1024;
+
+/**
+ * A getattrlistbulk call and the batch of entries that it returned.  Once
+ * a dir has shown that it has more entries than fit in one batch, the next
+ * batch is read on the thread pool while the crawler works through the
+ * current one.
+ */
+struct BulkRead {
+  enum State { Queued, Running, Done, Abandoned };
+
+  std::vector<char> buf;
+  struct attrlist attrs;
+  int retcount{0};
+  int err{0};
+  std::atomic<int> state{Queued};
+  folly::Baton<> done;
+
+  BulkRead(const struct attrlist& attrs, size_t size)
+      : buf(size), attrs(attrs) {}
+
+  void run(int fd) {
+    while (true) {
+      errno = 0;
+      retcount = getattrlistbulk(
+          fd,
+          &attrs,
+          buf.data(),
+          buf.size(),
+          // FSOPT_PACK_INVAL_ATTRS informs the kernel that we want to
+          // include attrs in our buffer even if it doesn't return them
+          // to us; we want this because we took pains to craft our
+          // bulk_attr_item struct to avoid pointer math.
+          FSOPT_PACK_INVAL_ATTRS);
+      err = errno;
+      // ERANGE means that not even one entry fit
+      if (retcount != -1 || err != ERANGE || buf.size() >= kMaxBulkBufSize) {
+        return;
+      }
+      buf.assign(std::min(buf.size() * 2, kMaxBulkBufSize), 0);
+    }
+  }
+
+  /**
+   * Called by the handle that owns the read: waits for the thread pool to
+   * finish it, or, if no worker has picked it up yet, takes it back and
+   * carries it out here when `read` is true.  The pool's workers may all be
+   * waiting on a lock that the crawler holds, so they can't be relied on.
+   */
+  void settle(int fd, bool read) {
+    int expected = Queued;
+    if (state.compare_exchange_strong(expected, Abandoned)) {
+      if (read) {
+        run(fd);
+      }
+    } else {
+      done.wait();
+    }
+  }
+};
+
+// Sizes the next read from how full the last one left the buffer, and from
+// how many more entries the caller expects
+static size_t
+nextBulkSize(size_t size, size_t used, int count, size_t remaining) {
+  // The kernel stops filling the buffer when the next entry doesn't fit, so
+  // a full buffer means that there are more entries to come
+  size_t next = used + kMaxBulkItemSize > size ? size * 2 : size;
+  if (remaining > 0 && count > 0) {
+    next = std::max(next, remaining * (used / count) + kMaxBulkItemSize);
+  }
+  return std::clamp(next, kMinBulkBufSize, kMaxBulkBufSize);
+}
 #endif
 
 #ifndef _WIN32
@@ -65,9 +151,23 @@ class UnixDirHandle : public DirHandle {
   std::string dirName_;
   FileDescriptor fd_;
   struct attrlist attrlist_;
+  // The entries that the caller expects, which sizes the first read
+  size_t sizeHint_{0};
+  size_t entriesRead_{0};
+  // The size of the next read, adapted to how full the last one was
+  size_t nextSize_{0};
+  bool readahead_{false};
+  bool eof_{false};
+  // The batch being decoded, and the one after it, if it is being read on
+  // the thread pool
+  std::shared_ptr<BulkRead> batch_;
+  std::shared_ptr<BulkRead> nextBatch_;
   int retcount_{0};
-  char buf_[64 * (sizeof(bulk_attr_item) + NAME_MAX * 3 + 1)];
   char* cursor_{nullptr};
+
+  // Reads the batch after batch_ into batch_, and starts reading the one
+  // after it if this one filled its buffer.  Returns false at the end.
+  bool readBatch();
 #endif
   DIR* d_{nullptr};
   struct DirEntry ent_;
@@ -77,6 +177,11 @@ class UnixDirHandle : public DirHandle {
   ~UnixDirHandle() override;
   const DirEntry* readDir() override;
   int getFd() const override;
+#ifdef HAVE_GETATTRLISTBULK
+  void setSizeHint(size_t numEntries) override {
+    sizeHint_ = numEntries;
+  }
+#endif
 };
 #endif
 
@@ -179,7 +284,9 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
 {
 #ifdef HAVE_GETATTRLISTBULK
   dirName_ = path;
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  auto config = cfg_get_snapshot();
+  if (config->useBulkstat.value_or(use_bulkstat_by_default())) {
+    readahead_ = config->bulkstatReadahead;
     auto opts = strict ? OpenFileHandleOptions::strictOpenDir()
                        : OpenFileHandleOptions::openDir();
 
@@ -222,53 +329,24 @@ const DirEntry* UnixDirHandle::readDir() {
   if (fd_) {
     bulk_attr_item* item;
 
-    if (!cursor_) {
-      // Read the next batch of results
-      int retcount;
-
-      memset(buf_, 0, sizeof(buf_));
-      errno = 0;
-      retcount = getattrlistbulk(
-          fd_.fd(),
-          &attrlist_,
-          buf_,
-          sizeof(buf_),
-          // FSOPT_PACK_INVAL_ATTRS informs the kernel that we want to
-          // include attrs in our buffer even if it doesn't return them
-          // to us; we want this because we took pains to craft our
-          // bulk_attr_item struct to avoid pointer math.
-          FSOPT_PACK_INVAL_ATTRS);
-      if (retcount == -1) {
-        throw std::system_error(
-            errno, std::generic_category(), "getattrlistbulk");
-      }
-      if (retcount == 0) {
-        // End of the stream
-        return nullptr;
-      }
-
-      retcount_ = retcount;
-      cursor_ = buf_;
+    if (!cursor_ && !readBatch()) {
+      return nullptr;
     }
 
     // Decode the next item
+    // readBatch checked that the items lie within the buffer
+    const char* bufEnd = batch_->buf.data() + batch_->buf.size();
     item = (bulk_attr_item*)cursor_;
     cursor_ += item->len;
-    if (cursor_ > buf_ + sizeof(buf_)) {
-      // This shouldn't happen in practice: the man page indicates that ERANGE
-      // is returned from getattrlistbulk() if the buffer isn't large enough
-      // for a single entry.
-      throw std::system_error(
-          ENOSPC,
-          std::generic_category(),
-          "getattrlistbulk: attributes overflow size of buf storage");
-    }
     if (--retcount_ == 0) {
       // No more entries from the last chunk
       cursor_ = nullptr;
     }
 
     w_string_piece name{};
+    // Everything is reported via stat, if at all
+    ent_.ino = 0;
+    ent_.dtype = DType::Unknown;
 
     if (item->returned.commonattr & ATTR_CMN_NAME) {
       ent_.d_name = ((char*)&item->name) + item->name.attr_dataoffset;
@@ -278,7 +356,7 @@ const DirEntry* UnixDirHandle::readDir() {
       // Note that even though the data reference records the length,
       // that length is the padded length of the value; the true
       // name value is a NUL terminated string within that space.
-      if (ent_.d_name + item->name.attr_length > buf_ + sizeof(buf_)) {
+      if (ent_.d_name + item->name.attr_length > bufEnd) {
         throw std::system_error(
             ENOSPC,
             std::generic_category(),
@@ -394,10 +472,105 @@ const DirEntry* UnixDirHandle::readDir() {
 
   ent_.d_name = dent->d_name;
   ent_.has_stat = false;
+  ent_.ino = dent->d_ino;
+#ifdef DT_UNKNOWN
+  ent_.dtype = DType(dent->d_type);
+#else
+  ent_.dtype = DType::Unknown;
+#endif
   return &ent_;
 }
 
+#ifdef HAVE_GETATTRLISTBULK
+bool UnixDirHandle::readBatch() {
+  if (eof_) {
+    return false;
+  }
+
+  auto read = std::move(nextBatch_);
+  if (read) {
+    read->settle(fd_.fd(), true);
+  } else {
+    if (nextSize_ == 0) {
+      nextSize_ = std::clamp(
+          sizeHint_ * kTypicalBulkItemSize, kMinBulkBufSize, kMaxBulkBufSize);
+    }
+    read = std::make_shared<BulkRead>(attrlist_, nextSize_);
+    read->run(fd_.fd());
+  }
+
+  if (read->retcount == -1) {
+    throw std::system_error(
+        read->err, std::generic_category(), "getattrlistbulk");
+  }
+  if (read->retcount == 0) {
+    // End of the stream
+    eof_ = true;
+    batch_.reset();
+    return false;
+  }
+
+  // Check the extent of each item up front, so that decoding needn't
+  size_t used = 0;
+  for (int i = 0; i < read->retcount; ++i) {
+    uint32_t len = 0;
+    if (used + sizeof(len) <= read->buf.size()) {
+      memcpy(&len, read->buf.data() + used, sizeof(len));
+    }
+    if (len == 0 || used + len > read->buf.size()) {
+      // This shouldn't happen in practice: the man page indicates that ERANGE
+      // is returned from getattrlistbulk() if the buffer isn't large enough
+      // for a single entry.
+      throw std::system_error(
+          ENOSPC,
+          std::generic_category(),
+          "getattrlistbulk: attributes overflow size of buf storage");
+    }
+    used += len;
+  }
+
+  entriesRead_ += read->retcount;
+  size_t remaining = sizeHint_ > entriesRead_ ? sizeHint_ - entriesRead_ : 0;
+  bool full = used + kMaxBulkItemSize > read->buf.size();
+  nextSize_ =
+      nextBulkSize(read->buf.size(), used, read->retcount, remaining);
+
+  batch_ = std::move(read);
+  retcount_ = batch_->retcount;
+  cursor_ = batch_->buf.data();
+
+  if (full && readahead_) {
+    // There's more to come, so fetch it while this batch is decoded
+    auto next = std::make_shared<BulkRead>(attrlist_, nextSize_);
+    try {
+      getThreadPool().add(
+          [next, fd = fd_.fd()] {
+            int expected = BulkRead::Queued;
+            if (!next->state.compare_exchange_strong(
+                    expected, BulkRead::Running)) {
+              return;
+            }
+            next->run(fd);
+            next->state.store(BulkRead::Done);
+            next->done.post();
+          },
+          ThreadPool::Priority::High);
+      nextBatch_ = std::move(next);
+    } catch (const std::exception&) {
+      // The pool is stopping; the next batch will be read when it's needed
+    }
+  }
+  return true;
+}
+#endif
+
 UnixDirHandle::~UnixDirHandle() {
+#ifdef HAVE_GETATTRLISTBULK
+  // A read on the thread pool must be done with fd_ before it is closed
+  if (nextBatch_) {
+    nextBatch_->settle(fd_.fd(), false);
+  }
+#endif
   if (d_) {
     closedir(d_);
   }
@@ -405,7 +578,8 @@ UnixDirHandle::~UnixDirHandle() {
 
 int UnixDirHandle::getFd() const {
 #ifdef HAVE_GETATTRLISTBULK
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  // Opened with bulkstat
+  if (fd_) {
     return fd_.fd();
   }
 #endif
@@ -10,6 +10,10 @@
 // Origin: http://www.burtleburtle.net/bob/c/lookup3.c
 
 #include "watchman/watchman_system.h"
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #if HAVE_SYS_PARAM_H
 #include <sys/param.h> /* attempt to define endianness */
@@ -346,5 +350,110 @@ uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval) {
   return c;
 }
 
+// The remainder of this file is an implementation of wyhash, by Wang Yi,
+// which is in the public domain.  Origin: https://github.com/wangyi-fudan/wyhash
+
+namespace {
+
+const uint64_t kWyhashSecret[4] = {
+    0xa0761d6478bd642full,
+    0xe7037ed1a0b428dbull,
+    0x8ebc6af09c88c6e3ull,
+    0x589965cc75374cc3ull,
+};
+
+/* Computes the 128 bit product of *a and *b, leaving the low half in *a
+ * and the high half in *b */
+inline void wymum(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+inline uint64_t wymix(uint64_t a, uint64_t b) {
+  wymum(&a, &b);
+  return a ^ b;
+}
+
+/* These read in native byte order, so the hash values differ between
+ * little and big endian machines.  That's fine for an in-memory hash. */
+inline uint64_t wyr8(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t wyr4(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t wyr3(const uint8_t* p, size_t k) {
+  return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+} // namespace
+
+uint32_t w_hash_string(const void* key, size_t length) {
+  const uint8_t* p = (const uint8_t*)key;
+  const uint64_t* secret = kWyhashSecret;
+  uint64_t seed = wymix(secret[0], secret[1]);
+  uint64_t a, b;
+
+  if (length <= 16) {
+    if (length >= 4) {
+      a = (wyr4(p) << 32) | wyr4(p + ((length >> 3) << 2));
+      b = (wyr4(p + length - 4) << 32) |
+          wyr4(p + length - 4 - ((length >> 3) << 2));
+    } else if (length > 0) {
+      a = wyr3(p, length);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = length;
+    if (i > 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+        see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+        see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wyr8(p + i - 16);
+    b = wyr8(p + i - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  wymum(&a, &b);
+  uint64_t h = wymix(a ^ secret[0] ^ length, b ^ secret[1]);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
 /* vim:ts=2:sw=2:et:
  */
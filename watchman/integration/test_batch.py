@@ -0,0 +1,64 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestBatch(WatchmanTestCase.WatchmanTestCase):
+    def test_batch(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.c")
+        self.touchRelative(root, "a.h")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a.c", "a.h"])
+
+        res = self.watchmanCommand(
+            "batch",
+            [
+                ["clock", root],
+                ["query", root, {"suffix": "c", "fields": ["name"]}],
+                ["query", root, {"suffix": "h", "fields": ["name"]}],
+                ["no-such-command"],
+                ["batch", []],
+            ],
+        )
+        responses = res["responses"]
+        self.assertEqual(5, len(responses))
+        self.assertRegex(responses[0]["clock"], "^c:\\d+:\\d+:\\d+:\\d+$")
+        self.assertFileListsEqual(responses[1]["files"], ["a.c"])
+        self.assertFileListsEqual(responses[2]["files"], ["a.h"])
+        # The second query shares the sync of the first
+        self.assertEqual([], responses[2]["debug"]["cookie_files"])
+        self.assertIn("error", responses[3])
+        self.assertIn("error", responses[4])
+
+    def test_batch_subscribe(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.c")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a.c"])
+
+        res = self.watchmanCommand(
+            "batch",
+            [
+                ["subscribe", root, "sub", {"fields": ["name"]}],
+                ["clock", root],
+            ],
+        )
+        responses = res["responses"]
+        self.assertEqual(2, len(responses))
+        # The subscribe reply is in the batch, not its initial results
+        self.assertEqual("sub", responses[0]["subscribe"])
+        self.assertNotIn("unilateral", responses[0])
+        self.assertRegex(responses[1]["clock"], "^c:\\d+:\\d+:\\d+:\\d+$")
+
+        # which are delivered to the subscription as usual
+        dat = self.waitForSub("sub", root=root)
+        self.assertFileListsEqual(dat[0]["files"], ["a.c"])
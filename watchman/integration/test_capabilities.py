@@ -211,6 +211,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             expected.add("cmd-debug-fsevents-inject-drop")
         elif sys.platform == "linux":
             expected.add("watcher-inotify")
+            expected.add("watcher-fanotify")
         elif sys.platform == "win32":
             expected.add("watcher-win32")
 
@@ -46,6 +46,8 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         self.assertEqual(stats["size"], 1)
         self.assertEqual(stats["cacheHit"], 0)
         self.assertEqual(stats["cacheStore"], 1)
+        self.assertEqual(stats["filesHashed"], 1)
+        self.assertEqual(stats["bytesHashed"], len("hello\n"))
 
         # repeated query also works
         res = self.watchmanCommand(
@@ -141,6 +143,49 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
 
+    def test_contentHashWarmingForSubscriptions(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "content_hash_warm_subscriptions": True,
+                        "content_hash_warm_wait_before_settle": True,
+                    }
+                )
+            )
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig"])
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "hashes",
+            {"expression": ["name", "foo"], "fields": ["name", "content.sha1hex"]},
+        )
+        self.waitForSub("hashes", root=root)
+
+        expect_hex = self.write_file_and_hash(os.path.join(root, "foo"), "hello\n")
+        self.write_file_and_hash(os.path.join(root, "bar"), "different\n")
+
+        def hasFoo(sub):
+            return any(
+                f["name"] == "foo" for item in sub for f in item.get("files", [])
+            )
+
+        sub = self.waitForSub("hashes", root=root, accept=hasFoo)
+        self.assertIsNotNone(sub)
+        files = [f for item in sub for f in item.get("files", [])]
+        self.assertEqual(expect_hex, files[-1]["content.sha1hex"])
+        self.assertEqual(["foo"], list({f["name"] for f in files}))
+
+        # Only the file that the subscription matches was hashed, before the
+        # subscription ran, so it found the hash in the cache
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["size"], 1)
+        self.assertEqual(stats["filesHashed"], 1)
+        self.assertGreaterEqual(stats["cacheHit"], 1)
+
     def test_cacheLimit(self):
         root = self.mkdtemp()
 
@@ -175,3 +220,35 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         self.assertEqual(stats["cacheMiss"], 2)
         self.assertEqual(stats["cacheStore"], 2)
         self.assertEqual(stats["cacheLoad"], 2)
+
+    def test_spooky128Hash(self):
+        root = self.mkdtemp()
+
+        self.write_file_and_hash(os.path.join(root, "foo"), "hello\n")
+        self.write_file_and_hash(os.path.join(root, "same"), "hello\n")
+        self.write_file_and_hash(os.path.join(root, "bar"), "different\n")
+        os.mkdir(os.path.join(root, "dir"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["foo", "same", "bar", "dir"])
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name", "content.spooky128hex"]}
+        )
+        hashes = {f["name"]: f["content.spooky128hex"] for f in res["files"]}
+        self.assertEqual(None, hashes["dir"])
+        self.assertEqual(32, len(hashes["foo"]))
+        int(hashes["foo"], 16)
+        self.assertEqual(hashes["foo"], hashes["same"])
+        self.assertNotEqual(hashes["foo"], hashes["bar"])
+
+        # The sha1 cache is separate and untouched
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["size"], 0)
+
+        self.write_file_and_hash(os.path.join(root, "foo"), "goodbye\n")
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"path": ["foo"], "fields": ["name", "content.spooky128hex"]},
+        )
+        self.assertNotEqual(hashes["foo"], res["files"][0]["content.spooky128hex"])
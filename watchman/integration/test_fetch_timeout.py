@@ -0,0 +1,78 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import hashlib
+import os
+
+import pywatchman
+import WatchmanTestCase
+
+
+# Large enough that hashing it takes well over the timeouts below
+BIG_FILE_SIZE = 2 * 1024 * 1024 * 1024
+
+
+@WatchmanTestCase.expand_matrix
+class TestFetchTimeout(WatchmanTestCase.WatchmanTestCase):
+    def query(self, root, fetch_timeout, names):
+        spec = {"path": names, "fields": ["name", "content.sha1hex"]}
+        if fetch_timeout is not None:
+            spec["fetch_timeout"] = fetch_timeout
+        res = self.watchmanCommand("query", root, spec)
+        return {f["name"]: f["content.sha1hex"] for f in res["files"]}
+
+    def test_capability(self):
+        res = self.watchmanCommand("version", {"required": ["fetch_timeout"]})
+        self.assertTrue(res["capabilities"]["fetch_timeout"])
+
+    def test_invalid_values(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        for value in (-1, "1000", 1.5):
+            with self.assertRaises(pywatchman.WatchmanError) as ctx:
+                self.query(root, value, ["foo"])
+            self.assertIn(
+                "fetch_timeout must be an integer value >= 0", str(ctx.exception)
+            )
+
+    def test_fetches_within_the_timeout(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, "foo"), "wb") as f:
+            f.write(b"hello\n")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["foo"])
+
+        expect_hex = hashlib.sha1(b"hello\n").hexdigest()
+        for fetch_timeout in (None, 0, 60000):
+            self.assertEqual(
+                {"foo": expect_hex}, self.query(root, fetch_timeout, ["foo"])
+            )
+
+    def test_slow_hashes_time_out(self):
+        if os.name == "nt":
+            self.skipTest("needs a sparse file to be cheap to create")
+
+        root = self.mkdtemp()
+        with open(os.path.join(root, "big"), "wb") as f:
+            f.truncate(BIG_FILE_SIZE)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["big"])
+
+        # The query doesn't wait for the hash
+        res = self.query(root, 100, ["big"])
+        self.assertIn("fetch_timeout", res["big"]["error"])
+
+        # Which is still computed and cached, for the queries that do
+        sha = hashlib.sha1()
+        chunk = b"\0" * (1024 * 1024)
+        for _ in range(BIG_FILE_SIZE // len(chunk)):
+            sha.update(chunk)
+        self.assertEqual({"big": sha.hexdigest()}, self.query(root, 0, ["big"]))
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(1, stats["filesHashed"])
@@ -0,0 +1,103 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import pywatchman
+import WatchmanInstance
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryParseCache(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.txt")
+        self.touchRelative(root, "b.c")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.txt", "b.c"])
+        return root
+
+    def stats(self, root):
+        return self.watchmanCommand("debug-query-parse-cache", root)
+
+    def query(self, root, spec):
+        return sorted(self.watchmanCommand("query", root, spec)["files"])
+
+    def test_repeated_specs_are_parsed_once(self):
+        root = self.makeRoot()
+        before = self.stats(root)
+
+        spec = {"suffix": "txt", "fields": ["name"]}
+        self.assertEqual(["a.txt"], self.query(root, spec))
+        after_first = self.stats(root)
+        self.assertEqual(before["cacheMiss"] + 1, after_first["cacheMiss"])
+        self.assertEqual(before["cacheStore"] + 1, after_first["cacheStore"])
+
+        # The same spec, with its fields in another order and with a
+        # request_id of its own, is answered from the first parse
+        for repeat in (
+            {"suffix": "txt", "fields": ["name"]},
+            {"fields": ["name"], "suffix": "txt"},
+            {"suffix": "txt", "fields": ["name"], "request_id": "build-2"},
+        ):
+            self.assertEqual(["a.txt"], self.query(root, repeat))
+        after_repeats = self.stats(root)
+        self.assertEqual(after_first["cacheHit"] + 3, after_repeats["cacheHit"])
+        self.assertEqual(after_first["cacheMiss"], after_repeats["cacheMiss"])
+        self.assertEqual(after_first["size"], after_repeats["size"])
+
+        # A different spec is parsed on its own
+        self.assertEqual(["b.c"], self.query(root, {"suffix": "c", "fields": ["name"]}))
+        after_other = self.stats(root)
+        self.assertEqual(after_repeats["cacheMiss"] + 1, after_other["cacheMiss"])
+        self.assertEqual(after_repeats["size"] + 1, after_other["size"])
+
+    def test_results_are_not_cached(self):
+        root = self.makeRoot()
+        spec = {"suffix": "txt", "fields": ["name"]}
+        self.assertEqual(["a.txt"], self.query(root, spec))
+
+        # A hit reuses the parse only; the query still sees the new file
+        self.touchRelative(root, "c.txt")
+        hits = self.stats(root)["cacheHit"]
+        self.assertEqual(["a.txt", "c.txt"], self.query(root, spec))
+        self.assertEqual(hits + 1, self.stats(root)["cacheHit"])
+
+        # As does a since query, whose clock is part of the cached spec
+        clock = self.watchmanCommand("clock", root)["clock"]
+        since = {"since": clock, "suffix": "txt", "fields": ["name"]}
+        self.assertEqual([], self.query(root, since))
+        self.touchRelative(root, "d.txt")
+        self.assertEqual(["d.txt"], self.query(root, since))
+
+    def test_invalid_specs_are_not_cached(self):
+        root = self.makeRoot()
+        before = self.stats(root)
+        for _ in range(2):
+            with self.assertRaises(pywatchman.WatchmanError) as ctx:
+                self.watchmanCommand("query", root, {"expression": ["nope"]})
+            self.assertIn("unknown expression term 'nope'", str(ctx.exception))
+        after = self.stats(root)
+        self.assertEqual(before["cacheMiss"] + 2, after["cacheMiss"])
+        self.assertEqual(before["cacheStore"], after["cacheStore"])
+        self.assertEqual(before["size"], after["size"])
+
+    def test_disabled_by_zero_size(self):
+        inst = WatchmanInstance.Instance(config={"query_parse_cache_size": 0})
+        inst.start()
+        self.addCleanup(inst.stop)
+        self.getClient(inst, replace_cached=True)
+
+        root = self.makeRoot()
+        spec = {"suffix": "txt", "fields": ["name"]}
+        for _ in range(2):
+            self.assertEqual(["a.txt"], self.query(root, spec))
+        stats = self.stats(root)
+        self.assertEqual(0, stats["cacheHit"])
+        self.assertEqual(0, stats["cacheMiss"])
+        self.assertEqual(0, stats["size"])
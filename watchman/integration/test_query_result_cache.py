@@ -0,0 +1,49 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryResultCache(WatchmanTestCase.WatchmanTestCase):
+    def test_tagged_queries_share_results(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.txt")
+        self.touchRelative(root, "b.txt")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.txt", "b.txt"])
+
+        def stats():
+            return self.watchmanCommand("debug-query-result-cache", root)
+
+        def query(request_id):
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "suffix": "txt",
+                    "fields": ["name"],
+                    "sync_timeout": 0,
+                    "request_id": request_id,
+                },
+            )
+            self.assertEqual(["a.txt", "b.txt"], sorted(res["files"]))
+
+        before = stats()
+        query("build-1")
+        after_first = stats()
+        self.assertEqual(before["cacheMiss"] + 1, after_first["cacheMiss"])
+
+        # Each process of a build tags its query with its own id, and is
+        # answered from the result of the first
+        def hits():
+            query("build-2")
+            return stats()["cacheHit"] > after_first["cacheHit"]
+
+        self.assertWaitFor(hits)
@@ -0,0 +1,71 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+import socket
+
+import WatchmanInstance
+import WatchmanTestCase
+
+
+def freeAddress():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    try:
+        sock.bind(("127.0.0.1", 0))
+        return "127.0.0.1:%d" % sock.getsockname()[1]
+    finally:
+        sock.close()
+
+
+@WatchmanTestCase.expand_matrix
+class TestReplica(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self):
+        if os.name == "nt":
+            self.skipTest("The replica watcher isn't available on Windows")
+
+    def test_replica_follows_primary(self):
+        address = freeAddress()
+        primary_config = {
+            "tcp-listener-enable": True,
+            "tcp-listener-address": address,
+        }
+        replica_config = {
+            "watcher": "replica",
+            "replica_primary": address,
+            "replica_max_retry_delay_ms": 200,
+        }
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+
+        with WatchmanInstance.Instance(config=primary_config) as primary:
+            primary.start()
+            self.getClient(primary).query("watch", root)
+
+            with WatchmanInstance.Instance(config=replica_config) as replica:
+                replica.start()
+                self.getClient(replica, replace_cached=True)
+                res = self.watchmanCommand("watch", root)
+                self.assertEqual("replica", res["watcher"])
+                self.assertFileList(root, ["a"])
+
+                # The change reaches the replica through the primary, as do
+                # the cookies that synchronize the query
+                self.touchRelative(root, "b")
+                self.assertFileList(root, ["a", "b"])
+
+                def connected():
+                    info = self.watchmanCommand("debug-watcher-info", root)
+                    return info["watcher-debug-info"]["watcher"]["connected"]
+
+                self.assertWaitFor(connected)
+                primary.stop()
+                self.assertWaitFor(lambda: not connected())
+
+                # Isn't held up by the lost connection
+                self.watchmanCommand("watch-del", root)
@@ -0,0 +1,99 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import time
+
+import WatchmanInstance
+import WatchmanTestCase
+from path_utils import norm_absolute_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestRestoreOrder(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "file.txt")
+        return root
+
+    def startWithState(self, watched):
+        # One root at a time, so that the order is observable
+        inst = WatchmanInstance.Instance(config={"root_restore_concurrency": 1})
+        with open(inst.state_file, "w") as f:
+            json.dump({"version": "test", "watched": watched}, f)
+        inst.start()
+        self.addCleanup(inst.stop)
+        self.getClient(inst, replace_cached=True)
+        return inst
+
+    def waitForWatches(self, roots):
+        def watched():
+            return [norm_absolute_path(root) for root in self.getWatchList()]
+
+        for root in roots:
+            self.assertWaitFor(lambda: norm_absolute_path(root) in watched())
+
+    def restoreOrder(self, inst, roots):
+        # The service logs this once for each root that it resolves
+        log = inst.getServerLogContents().replace("\\", "/")
+
+        def position(root):
+            pos = log.find("Want to watch %s" % root.replace("\\", "/"))
+            self.assertNotEqual(-1, pos, "%s should be resolved" % root)
+            return pos
+
+        return sorted(roots, key=position)
+
+    def test_most_recently_used_first(self):
+        old, newest, newer, legacy = [self.makeRoot() for _ in range(4)]
+        inst = self.startWithState(
+            [
+                {"path": old, "triggers": [], "last_used": 100},
+                # Saved by a version that didn't record when it was used
+                {"path": legacy, "triggers": []},
+                {"path": newest, "triggers": [], "last_used": 300},
+                {"path": newer, "triggers": [], "last_used": 200},
+            ]
+        )
+        roots = [newest, newer, old, legacy]
+        self.waitForWatches(roots)
+        self.assertEqual(roots, self.restoreOrder(inst, roots))
+        for root in roots:
+            self.assertFileList(root, ["file.txt"])
+
+    def test_last_used_is_saved(self):
+        restored = self.makeRoot()
+        inst = self.startWithState(
+            [{"path": restored, "triggers": [], "last_used": 100}]
+        )
+        self.waitForWatches([restored])
+
+        # Watching another root saves the state
+        before = int(time.time())
+        fresh = self.makeRoot()
+        self.watchmanCommand("watch", fresh)
+
+        def lastUsed():
+            try:
+                with open(inst.state_file) as f:
+                    state = json.load(f)
+            except ValueError:
+                # Caught in the middle of being written
+                return {}
+            return {
+                norm_absolute_path(entry["path"]): entry.get("last_used")
+                for entry in state["watched"]
+            }
+
+        self.assertWaitFor(lambda: norm_absolute_path(fresh) in lastUsed())
+        saved = lastUsed()
+        # A restored root keeps when it was last used until it is used again
+        self.assertEqual(100, saved[norm_absolute_path(restored)])
+        self.assertGreaterEqual(saved[norm_absolute_path(fresh)], before - 1)
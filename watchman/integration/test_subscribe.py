@@ -345,6 +345,65 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
             self.assertTrue(dat["canceled"])
             self.assertTrue(dat["unilateral"])
 
+    def test_subscribe_identical_queries(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a"])
+
+        # Identical queries may share their results; each subscription must
+        # still see every change under its own name
+        for name in ("first", "second"):
+            self.watchmanCommand(
+                "subscribe",
+                root,
+                name,
+                {"expression": ["type", "f"], "fields": ["name"]},
+            )
+            dat = self.waitForSub(name, root=root)[0]
+            self.assertEqual(True, dat["is_fresh_instance"])
+            self.assertFileListsEqual(dat["files"], ["a"])
+
+        self.touchRelative(root, "b")
+        for name in ("first", "second"):
+            dat = self.waitForSub(
+                name,
+                root=root,
+                accept=lambda x: self.findSubscriptionContainingFile(x, "b"),
+            )
+            self.assertNotEqual(None, dat)
+            self.assertEqual(False, dat[0]["is_fresh_instance"])
+            self.assertEqual(name, dat[0]["subscription"])
+
+    def test_subscribe_priority(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a"])
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "subscribe", root, "bogus", {"fields": ["name"], "priority": "asap"}
+            )
+        self.assertIn("priority must be one of", str(ctx.exception))
+
+        for name, priority in (("urgent", "high"), ("background", "low")):
+            self.watchmanCommand(
+                "subscribe", root, name, {"fields": ["name"], "priority": priority}
+            )
+            self.waitForSub(name, root=root)
+
+        self.touchRelative(root, "b")
+        for name in ("urgent", "background"):
+            dat = self.waitForSub(
+                name,
+                root=root,
+                accept=lambda x: self.findSubscriptionContainingFile(x, "b"),
+            )
+            self.assertNotEqual(None, dat)
+
     def test_subscribe(self):
         root = self.mkdtemp()
         a_dir = os.path.join(root, "a")
@@ -0,0 +1,98 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscribeRelevance(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self):
+        return True
+
+    def irrelevantSettles(self, root, name):
+        out = self.watchmanCommand("debug-get-subscriptions", root)
+        for sub in out["subscribers"]:
+            if sub["info"]["name"] == name:
+                return sub["info"]["irrelevant_settles"]
+        self.fail("no subscription named %s" % name)
+
+    def subscribe(self, root, name, query):
+        self.watchmanCommand("subscribe", root, name, query)
+        # The initial results
+        self.assertIsNotNone(self.waitForSub(name, root=root))
+
+    def assertSkips(self, root, name, *touched):
+        before = self.irrelevantSettles(root, name)
+        for path in touched:
+            self.touchRelative(root, *path.split("/"))
+        self.assertWaitFor(lambda: self.irrelevantSettles(root, name) > before)
+
+    def assertDelivers(self, root, name, touched, expected):
+        self.touchRelative(root, *touched.split("/"))
+
+        def delivered(subs):
+            names = set()
+            for sub in subs:
+                names.update(sub.get("files", []))
+            return expected in names
+
+        self.assertIsNotNone(self.waitForSub(name, root=root, accept=delivered))
+
+    def makeRoot(self):
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "a", "b"))
+        os.makedirs(os.path.join(root, "a", "bc"))
+        self.touchRelative(root, "top.txt")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "a/b", "a/bc", "top.txt"])
+        return root
+
+    def test_relative_root(self):
+        root = self.makeRoot()
+        self.subscribe(root, "rel", {"relative_root": "a/b", "fields": ["name"]})
+
+        # a/bc only shares a prefix with the relative root
+        self.assertSkips(root, "rel", "a/bc/x", "top.txt")
+        # A relevant change after the skipped ones is still delivered
+        self.assertDelivers(root, "rel", "a/b/y", "y")
+
+    def test_dirname(self):
+        root = self.makeRoot()
+        self.subscribe(
+            root, "dir", {"expression": ["dirname", "a/b"], "fields": ["name"]}
+        )
+
+        self.assertSkips(root, "dir", "a/bc/x")
+        self.assertDelivers(root, "dir", "a/b/y", "a/b/y")
+
+    def test_suffix_is_case_insensitive(self):
+        root = self.makeRoot()
+        self.subscribe(
+            root, "suffix", {"expression": ["suffix", "txt"], "fields": ["name"]}
+        )
+
+        self.assertSkips(root, "suffix", "a/notes.dat")
+        self.assertDelivers(root, "suffix", "a/NOTES.TXT", "a/NOTES.TXT")
+
+    def test_name_is_case_insensitive(self):
+        root = self.makeRoot()
+        self.subscribe(
+            root,
+            "name",
+            {
+                "expression": ["name", ["build"], "basename"],
+                "case_sensitive": False,
+                "fields": ["name"],
+            },
+        )
+
+        self.assertSkips(root, "name", "a/builder")
+        self.assertDelivers(root, "name", "a/BUILD", "a/BUILD")
@@ -0,0 +1,100 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscribeStateTracking(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self):
+        return True
+
+    def parkedSettles(self, root, name):
+        out = self.watchmanCommand("debug-get-subscriptions", root)
+        for sub in out["subscribers"]:
+            if sub["info"]["name"] == name:
+                return sub["info"]["parked_settles"]
+        self.fail("no subscription named %s" % name)
+
+    def makeRoot(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "initial")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["initial"])
+        return root
+
+    def subscribe(self, root, name, query):
+        res = self.watchmanCommand("subscribe", root, name, query)
+        # The initial results
+        self.assertIsNotNone(self.waitForSub(name, root=root))
+        return res
+
+    def assertParks(self, root, name, touched):
+        before = self.parkedSettles(root, name)
+        self.touchRelative(root, touched)
+        self.assertWaitFor(lambda: self.parkedSettles(root, name) > before)
+
+    def assertDelivers(self, root, name, touched):
+        def delivered(subs):
+            return any(touched in sub.get("files", []) for sub in subs)
+
+        self.assertIsNotNone(self.waitForSub(name, root=root, accept=delivered))
+
+    def test_deferred_settles_are_parked(self):
+        root = self.makeRoot()
+        self.subscribe(root, "defer", {"fields": ["name"], "defer": ["foo"]})
+        self.watchmanCommand("state-enter", root, "foo")
+        self.assertParks(root, "defer", "in-foo")
+
+        # Leaving the state runs the query without waiting for another settle
+        self.watchmanCommand("state-leave", root, "foo")
+        self.assertDelivers(root, "defer", "in-foo")
+
+    def test_other_states_are_not_parked(self):
+        root = self.makeRoot()
+        self.subscribe(root, "defer", {"fields": ["name"], "defer": ["foo"]})
+        self.watchmanCommand("state-enter", root, "bar")
+        self.touchRelative(root, "in-bar")
+        self.assertDelivers(root, "defer", "in-bar")
+        self.assertEqual(0, self.parkedSettles(root, "defer"))
+        self.watchmanCommand("state-leave", root, "bar")
+
+    def test_dropping_is_not_parked(self):
+        root = self.makeRoot()
+        self.subscribe(
+            root, "both", {"fields": ["name"], "defer": ["foo"], "drop": ["foo"]}
+        )
+        self.watchmanCommand("state-enter", root, "foo")
+        self.touchRelative(root, "dropped")
+        self.watchmanCommand("state-leave", root, "foo")
+        self.touchRelative(root, "after")
+        self.assertDelivers(root, "both", "after")
+        self.assertEqual(0, self.parkedSettles(root, "both"))
+
+    def test_subscribing_during_a_state_starts_parked(self):
+        root = self.makeRoot()
+        self.watchmanCommand("state-enter", root, "foo")
+        res = self.subscribe(root, "late", {"fields": ["name"], "defer": ["foo"]})
+        self.assertEqual(["foo"], res["asserted-states"])
+        self.assertParks(root, "late", "in-foo")
+
+        self.watchmanCommand("state-leave", root, "foo")
+        self.assertDelivers(root, "late", "in-foo")
+
+    def test_state_of_a_departed_client_is_vacated(self):
+        root = self.makeRoot()
+        self.subscribe(root, "defer", {"fields": ["name"], "defer": ["foo"]})
+
+        other = self.getClient(no_cache=True)
+        other.query("state-enter", root, "foo")
+        self.assertParks(root, "defer", "in-foo")
+
+        # Its state is left for it when it goes away
+        other.close()
+        self.assertDelivers(root, "defer", "in-foo")
@@ -0,0 +1,90 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import time
+
+import WatchmanInstance
+import WatchmanTestCase
+from path_utils import norm_absolute_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscriptionGroup(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self):
+        return True
+
+    def setUp(self):
+        super(TestSubscriptionGroup, self).setUp()
+        # A window long enough that the tests needn't race it
+        self.inst = WatchmanInstance.Instance(
+            config={"subscription_group_settle_ms": 2000}
+        )
+        self.inst.start()
+        self.addCleanup(self.inst.stop)
+        self.getClient(self.inst, replace_cached=True)
+
+    def subscribe(self, name, group):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand(
+            "subscribe", root, name, {"fields": ["name"], "group": group}
+        )
+        # The initial results
+        self.assertIsNotNone(self.waitForSub(name, root=root))
+        return root
+
+    def waitForGroup(self, group):
+        client = self.getClient()
+        deadline = time.time() + self.getTimeout()
+        while time.time() < deadline:
+            client.setTimeout(deadline - time.time())
+            pdu = client.receive()
+            if pdu.get("subscription_group") == group:
+                return pdu
+        self.fail("no results for group %s" % group)
+
+    def test_roots_are_delivered_together(self):
+        first = self.subscribe("first", "editor")
+        second = self.subscribe("second", "editor")
+        self.touchRelative(first, "a.txt")
+        self.touchRelative(second, "b.txt")
+
+        pdu = self.waitForGroup("editor")
+        self.assertTrue(pdu["unilateral"])
+        results = {r["subscription"]: r for r in pdu["results"]}
+        self.assertCountEqual(["first", "second"], results.keys())
+        self.assertEqual(
+            norm_absolute_path(first), norm_absolute_path(results["first"]["root"])
+        )
+        self.assertFileListsEqual(["a.txt"], results["first"]["files"])
+        self.assertFileListsEqual(["b.txt"], results["second"]["files"])
+
+        # pywatchman buffers them as though each had come on its own
+        self.assertIsNotNone(self.getSubscription("first", root=first))
+        self.assertIsNotNone(self.getSubscription("second", root=second))
+
+    def test_repeat_results_are_merged(self):
+        root = self.subscribe("only", "editor")
+        self.touchRelative(root, "a.txt")
+        # Well past the settle period, so that the root settles twice within
+        # the window
+        time.sleep(0.5)
+        self.touchRelative(root, "b.txt")
+
+        pdu = self.waitForGroup("editor")
+        self.assertEqual(1, len(pdu["results"]))
+        self.assertFileListsEqual(["a.txt", "b.txt"], pdu["results"][0]["files"])
+
+    def test_other_groups_are_separate(self):
+        first = self.subscribe("first", "editor")
+        self.subscribe("second", "indexer")
+        self.touchRelative(first, "a.txt")
+
+        pdu = self.waitForGroup("editor")
+        self.assertEqual(["first"], [r["subscription"] for r in pdu["results"]])
@@ -0,0 +1,114 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanInstance
+import WatchmanTestCase
+from path_utils import norm_absolute_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubtreeView(WatchmanTestCase.WatchmanTestCase):
+    def setUp(self):
+        super(TestSubtreeView, self).setUp()
+        self.inst = WatchmanInstance.Instance(
+            config={"share_enclosing_root_view": True}
+        )
+        self.inst.start()
+        self.addCleanup(self.inst.stop)
+        self.getClient(self.inst, replace_cached=True)
+
+    def makeRoots(self):
+        parent = self.mkdtemp()
+        nested = os.path.join(parent, "sub")
+        os.makedirs(os.path.join(nested, "deep"))
+        self.touchRelative(parent, "top.txt")
+        self.touchRelative(nested, "a.txt")
+        self.touchRelative(nested, "deep", "b.txt")
+
+        self.watchmanCommand("watch", parent)
+        self.assertFileList(
+            parent, ["top.txt", "sub", "sub/a.txt", "sub/deep", "sub/deep/b.txt"]
+        )
+        self.watchmanCommand("watch", nested)
+        return parent, nested
+
+    def viewStatus(self, root):
+        for status in self.watchmanCommand("debug-status")["roots"]:
+            if norm_absolute_path(status["path"]) == norm_absolute_path(root):
+                return status["view"]
+        self.fail("%s is not watched" % root)
+
+    def since(self, root, clock):
+        return self.watchmanCommand("query", root, {"since": clock, "fields": ["name"]})
+
+    def test_nested_root_shares_the_view(self):
+        parent, nested = self.makeRoots()
+        self.assertEqual(
+            norm_absolute_path(parent),
+            norm_absolute_path(self.viewStatus(nested)["subtree_of"]),
+        )
+        self.assertNotIn("subtree_of", self.viewStatus(parent))
+
+    def test_results_are_rebased(self):
+        parent, nested = self.makeRoots()
+        self.assertFileList(nested, ["a.txt", "deep", "deep/b.txt"])
+        self.assertFileList(nested, ["b.txt"], relativeRoot="deep")
+
+        res = self.watchmanCommand(
+            "query", nested, {"expression": ["dirname", "deep"], "fields": ["name"]}
+        )
+        self.assertFileListsEqual(["deep/b.txt"], res["files"])
+
+        # Changes are seen through the enclosing root's watcher
+        self.touchRelative(nested, "c.txt")
+        self.assertFileList(nested, ["a.txt", "c.txt", "deep", "deep/b.txt"])
+
+    def test_clocks_are_shared(self):
+        parent, nested = self.makeRoots()
+        parentClock = self.watchmanCommand("clock", parent)["clock"]
+        nestedClock = self.watchmanCommand("clock", nested)["clock"]
+
+        self.touchRelative(nested, "new.txt")
+        self.touchRelative(parent, "outside.txt")
+        self.assertFileList(nested, ["a.txt", "deep", "deep/b.txt", "new.txt"])
+
+        # Either root's clock is good for the other
+        res = self.since(nested, parentClock)
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertFileListsEqual(["new.txt"], res["files"])
+
+        res = self.since(parent, nestedClock)
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertFileListContains(res["files"], ["sub/new.txt", "outside.txt"])
+        self.assertNotIn("sub/a.txt", res["files"])
+
+        # A clock from elsewhere is a fresh instance of the nested dir only
+        res = self.since(nested, "c:1:2:3:4")
+        self.assertTrue(res["is_fresh_instance"])
+        self.assertFileListsEqual(
+            ["a.txt", "deep", "deep/b.txt", "new.txt"], res["files"]
+        )
+
+    def test_deleting_the_parent_cancels_the_nested_root(self):
+        parent, nested = self.makeRoots()
+        self.watchmanCommand("watch-del", parent)
+
+        def watched():
+            return [norm_absolute_path(root) for root in self.getWatchList()]
+
+        self.assertWaitFor(lambda: norm_absolute_path(nested) not in watched())
+        self.assertNotIn(norm_absolute_path(parent), watched())
+
+        # Watching it again gives it a view of its own
+        self.watchmanCommand("watch", nested)
+        self.assertNotIn("subtree_of", self.viewStatus(nested))
+        self.touchRelative(nested, "after.txt")
+        self.assertFileList(nested, ["a.txt", "after.txt", "deep", "deep/b.txt"])
@@ -0,0 +1,115 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import sys
+
+import pywatchman
+import WatchmanTestCase
+from path_utils import norm_absolute_path
+
+
+WATCHMAN_SRC_DIR = os.environ.get("WATCHMAN_SRC_DIR", os.getcwd())
+THIS_DIR = os.path.join(WATCHMAN_SRC_DIR, "integration")
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerPersistent(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a.c")
+        self.touchRelative(root, "b.txt")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c", "b.txt"])
+        # Keep the log out of the root, so that writing it isn't a change
+        log = os.path.join(self.mkdtemp(), "batches.log")
+        return root, log
+
+    def defineTrigger(self, root, log, *args, **extra):
+        command = [sys.executable, os.path.join(THIS_DIR, "trigpersist.py"), log]
+        trigger = {
+            "name": "persist",
+            "expression": ["suffix", "c"],
+            "command": command + list(args),
+            "persistent": True,
+            "stdin": ["name", "exists"],
+        }
+        trigger.update(extra)
+        return self.watchmanCommand("trigger", root, trigger)
+
+    def waitForBatches(self, log, count):
+        def batches():
+            if not os.path.exists(log):
+                return []
+            with open(log) as f:
+                return [json.loads(line) for line in f if line.endswith("\n")]
+
+        self.assertWaitFor(
+            lambda: len(batches()) >= count,
+            message="%d batches should be logged in %s" % (count, log),
+        )
+        return batches()
+
+    def names(self, entry):
+        return [f["name"] for f in entry["batch"]["files"]]
+
+    def test_batches_go_to_one_process(self):
+        root, log = self.makeRoot()
+        self.defineTrigger(root, log)
+
+        first = self.waitForBatches(log, 1)[0]
+        self.assertEqual(["a.c"], self.names(first))
+        self.assertEqual(
+            norm_absolute_path(root), norm_absolute_path(first["batch"]["root"])
+        )
+        self.assertIn("clock", first["batch"])
+        self.assertNotIn("since", first["batch"])
+        self.assertFalse(first["batch"]["files_overflow"])
+
+        self.touchRelative(root, "c.c")
+        self.touchRelative(root, "d.txt")
+        second = self.waitForBatches(log, 2)[1]
+        self.assertEqual(["c.c"], self.names(second))
+        self.assertIn("since", second["batch"])
+        self.assertEqual(first["pid"], second["pid"])
+
+    def test_exited_process_is_restarted(self):
+        root, log = self.makeRoot()
+        # The process exits after its first batch
+        self.defineTrigger(root, log, "1")
+        first = self.waitForBatches(log, 1)[0]
+        self.assertEqual(["a.c"], self.names(first))
+
+        # The next batch starts it again, and isn't lost meanwhile
+        self.touchRelative(root, "c.c")
+        second = self.waitForBatches(log, 2)[1]
+        self.assertIn("c.c", self.names(second))
+        self.assertNotEqual(first["pid"], second["pid"])
+
+    def test_max_files_stdin_flags_overflow(self):
+        root, log = self.makeRoot()
+        self.touchRelative(root, "c.c")
+        self.touchRelative(root, "d.c")
+        self.assertFileList(root, ["a.c", "b.txt", "c.c", "d.c"])
+        self.defineTrigger(root, log, max_files_stdin=1)
+
+        first = self.waitForBatches(log, 1)[0]
+        self.assertEqual(1, len(self.names(first)))
+        self.assertTrue(first["batch"]["files_overflow"])
+
+    def test_invalid_definitions(self):
+        root, log = self.makeRoot()
+        for extra, err in [
+            ({"append_files": True}, "append_files cannot be used"),
+            ({"stdin": "NAME_PER_LINE"}, "requires stdin to be a list of fields"),
+        ]:
+            with self.assertRaises(pywatchman.WatchmanError) as ctx:
+                self.defineTrigger(root, log, **extra)
+            self.assertIn(err, str(ctx.exception))
@@ -0,0 +1,75 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import sys
+
+import WatchmanTestCase
+
+
+WATCHMAN_SRC_DIR = os.environ.get("WATCHMAN_SRC_DIR", os.getcwd())
+THIS_DIR = os.path.join(WATCHMAN_SRC_DIR, "integration")
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerStdinPipe(WatchmanTestCase.WatchmanTestCase):
+    def runTrigger(self, root, **extra):
+        # Keep the log out of the root, so that writing it isn't a change
+        log = os.path.join(self.mkdtemp(), "stdin.log")
+        trigger = {
+            "name": "pipe",
+            "expression": ["suffix", "c"],
+            "command": [sys.executable, os.path.join(THIS_DIR, "trigstdin.py"), log],
+            "stdin_pipe": True,
+        }
+        trigger.update(extra)
+        self.watchmanCommand("trigger", root, trigger)
+
+        def records():
+            if not os.path.exists(log):
+                return []
+            with open(log) as f:
+                return [json.loads(line) for line in f if line.endswith("\n")]
+
+        self.assertWaitFor(lambda: records(), message="the trigger should run")
+        record = records()[0]
+        if os.name != "nt":
+            self.assertTrue(record["fifo"])
+        return record
+
+    def test_json_larger_than_the_pipe(self):
+        root = self.mkdtemp()
+        # More than the 64KiB that a pipe buffers, so the writer must wait for
+        # the command to read
+        expect = ["a-rather-long-file-name-%04d.c" % i for i in range(1500)]
+        for name in expect:
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, expect)
+
+        record = self.runTrigger(root, stdin=["name", "exists"])
+        files = json.loads(record["stdin"])
+        self.assertFileListsEqual(expect, [f["name"] for f in files])
+        self.assertTrue(all(f["exists"] for f in files))
+        self.assertEqual("false", record["overflow"])
+
+    def test_name_per_line_with_max_files(self):
+        root = self.mkdtemp()
+        for name in ("a.c", "b.c", "c.c", "d.txt"):
+            self.touchRelative(root, name)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a.c", "b.c", "c.c", "d.txt"])
+
+        record = self.runTrigger(root, stdin="NAME_PER_LINE", max_files_stdin=2)
+        names = record["stdin"].splitlines()
+        self.assertEqual(2, len(names))
+        for name in names:
+            self.assertIn(name, ["a.c", "b.c", "c.c"])
+        self.assertEqual("true", record["overflow"])
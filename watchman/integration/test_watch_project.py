@@ -131,3 +131,68 @@ class TestWatchProject(WatchmanTestCase.WatchmanTestCase):
         res = self.watchmanCommand("watch-project", abc)
         self.assertEqual(d, norm_absolute_path(res["watch"]))
         self.assertEqual("a/b/c", norm_relative_path(res["relative_path"]))
+
+    def test_watchProjectAsync(self):
+        d = self.mkdtemp()
+        for i in range(10):
+            self.touchRelative(d, "file%d" % i)
+        make_empty_watchmanconfig(d)
+
+        client = self.getClient()
+        res = client.query("watch-project", d, {"async": True})
+        self.assertEqual(d, norm_absolute_path(res["watch"]))
+        if res["crawling"]:
+            while True:
+                pdu = client.receive()
+                self.assertTrue(pdu["unilateral"])
+                self.assertIn("crawl", pdu)
+                if pdu.get("ready"):
+                    self.assertIn("clock", pdu)
+                    break
+
+        # Nothing is relayed once the crawl is ready
+        res = client.query("watch-project", d, {"async": True})
+        self.assertFalse(res["crawling"])
+        files = ["file%d" % i for i in range(10)]
+        self.assertFileList(d, [".watchmanconfig"] + files)
+
+    def test_watchProjectAsyncRejectsBadOptions(self):
+        d = self.mkdtemp()
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("watch-project", d, {"async": "yes"})
+        self.assertIn("'async' must be a boolean", str(ctx.exception))
+
+    def test_incompleteQueryDuringCrawl(self):
+        d = self.mkdtemp()
+        expected = {".watchmanconfig"}
+        for i in range(20):
+            sub = "dir%d" % i
+            os.mkdir(os.path.join(d, sub))
+            expected.add(sub)
+            for j in range(50):
+                self.touchRelative(d, sub, "file%d" % j)
+                expected.add(norm_relative_path("%s/file%d" % (sub, j)))
+        make_empty_watchmanconfig(d)
+
+        self.watchmanCommand("watch-project", d, {"async": True})
+        res = self.watchmanCommand(
+            "query", d, {"fields": ["name"], "allow_incomplete": True}
+        )
+        seen = set(norm_relative_path(f) for f in res["files"])
+
+        # Whatever the crawl had yet to find is reported since that clock
+        res = self.watchmanCommand(
+            "query", d, {"fields": ["name"], "since": res["clock"]}
+        )
+        self.assertNotIn("incomplete", res)
+        seen.update(norm_relative_path(f) for f in res["files"])
+        self.assertEqual(expected, seen)
+
+        # The crawl is done, so the option makes no difference
+        res = self.watchmanCommand(
+            "query", d, {"fields": ["name"], "allow_incomplete": True}
+        )
+        self.assertNotIn("incomplete", res)
+        self.assertEqual(
+            expected, set(norm_relative_path(f) for f in res["files"])
+        )
@@ -0,0 +1,94 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import pywatchman
+import WatchmanTestCase
+from path_utils import norm_absolute_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestWatchProjects(WatchmanTestCase.WatchmanTestCase):
+    def makeProjects(self, count):
+        projects = []
+        for i in range(count):
+            d = self.mkdtemp(suffix="-project%d" % i)
+            self.touchRelative(d, ".watchmanconfig")
+            os.makedirs(os.path.join(d, "sub"))
+            self.touchRelative(d, "sub", "file%d" % i)
+            projects.append(d)
+        return projects
+
+    def test_results_in_input_order(self):
+        projects = self.makeProjects(4)
+        paths = [os.path.join(d, "sub") for d in projects]
+        res = self.watchmanCommand("watch-projects", paths, {"concurrency": 2})
+
+        watches = res["watches"]
+        self.assertEqual(len(paths), len(watches))
+        for path, project, watch in zip(paths, projects, watches):
+            self.assertEqual(path, watch["path"])
+            self.assertNotIn("error", watch)
+            self.assertEqual(
+                norm_absolute_path(project), norm_absolute_path(watch["watch"])
+            )
+            self.assertEqual("sub", watch["relative_path"])
+        self.assertFileList(projects[2], [".watchmanconfig", "sub", "sub/file2"])
+
+    def test_bad_path_has_its_own_error(self):
+        projects = self.makeProjects(2)
+        missing = os.path.join(self.mkdtemp(), "missing")
+        paths = [projects[0], missing, projects[1]]
+        res = self.watchmanCommand("watch-projects", paths)
+
+        watches = res["watches"]
+        self.assertEqual(
+            norm_absolute_path(projects[0]), norm_absolute_path(watches[0]["watch"])
+        )
+        self.assertEqual(missing, watches[1]["path"])
+        self.assertNotIn("watch", watches[1])
+        self.assertIn("error", watches[1])
+        self.assertEqual(
+            norm_absolute_path(projects[1]), norm_absolute_path(watches[2]["watch"])
+        )
+
+    def test_stream_results(self):
+        projects = self.makeProjects(3)
+        client = self.getClient()
+        res = client.query("watch-projects", projects, {"stream_results": True})
+
+        streamed = []
+        while res.get("partial"):
+            streamed.append(res["watch"]["path"])
+            res = client.receive()
+
+        # Every result is streamed as it is ready, in whichever order that
+        # is, and the final response has them all in input order
+        self.assertEqual(sorted(projects), sorted(streamed))
+        self.assertEqual(projects, [watch["path"] for watch in res["watches"]])
+
+    def test_validation(self):
+        projects = self.makeProjects(1)
+        for opts, message in [
+            ({"concurrency": 0}, "'concurrency' must be a positive integer"),
+            ({"concurrency": "2"}, "'concurrency' must be a positive integer"),
+            ({"stream_results": 1}, "'stream_results' must be a boolean"),
+        ]:
+            with self.assertRaises(pywatchman.WatchmanError) as ctx:
+                self.watchmanCommand("watch-projects", projects, opts)
+            self.assertIn(message, str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("watch-projects", projects[0])
+        self.assertIn("expects an array of paths", str(ctx.exception))
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand("watch-projects", [projects[0], 1])
+        self.assertIn("must be strings", str(ctx.exception))
@@ -0,0 +1,29 @@
+#!/usr/bin/env python
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import sys
+
+
+log_file_name = sys.argv[1]
+# Exit after this many batches, to have watchman restart us
+max_batches = int(sys.argv[2]) if len(sys.argv) > 2 else None
+
+# Append each batch that a persistent trigger streams to us, along with
+# our pid, to the log file
+num_batches = 0
+while max_batches is None or num_batches < max_batches:
+    line = sys.stdin.readline()
+    if not line:
+        break
+    batch = json.loads(line)
+    with open(log_file_name, "a") as f:
+        f.write(json.dumps({"pid": os.getpid(), "batch": batch}) + "\n")
+    num_batches += 1
@@ -0,0 +1,26 @@
+#!/usr/bin/env python
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import stat
+import sys
+
+
+log_file_name = sys.argv[1]
+
+# Log the whole of stdin, whether it is a pipe, and whether the files
+# overflowed, as one line of json
+record = {
+    "fifo": stat.S_ISFIFO(os.fstat(sys.stdin.fileno()).st_mode),
+    "overflow": os.environ.get("WATCHMAN_FILES_OVERFLOW"),
+    "stdin": sys.stdin.read(),
+}
+with open(log_file_name, "a") as f:
+    f.write(json.dumps(record) + "\n")
@@ -6,9 +6,12 @@
  */
 
 #include <folly/ScopeGuard.h>
+#include <algorithm>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/Shutdown.h"
+#include "watchman/SubscriptionSessions.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/watchman_client.h"
@@ -50,10 +53,11 @@ void add_root_warnings_to_response(
           "'`\n")));
 }
 
-std::shared_ptr<Root> doResolveOrCreateRoot(
-    struct watchman_client* client,
+std::shared_ptr<Root> resolveOrCreateRootAs(
     const json_ref& args,
-    bool create) {
+    bool create,
+    bool clientMode,
+    bool isOwner) {
   const char* root_name;
 
   // Assume root is first element
@@ -72,21 +76,14 @@ std::shared_ptr<Root> doResolveOrCreateRoot(
   }
 
   try {
-    std::shared_ptr<Root> root;
-    if (client->client_mode) {
-      root = w_root_resolve_for_client_mode(root_name);
-    } else {
-      if (!client->client_is_owner) {
-        // Only the owner is allowed to create watches
-        create = false;
-      }
-      root = w_root_resolve(root_name, create);
+    if (clientMode) {
+      return w_root_resolve_for_client_mode(root_name);
     }
-
-    if (client->perf_sample) {
-      root->addPerfSampleMetadata(*client->perf_sample);
+    if (!isOwner) {
+      // Only the owner is allowed to create watches
+      create = false;
     }
-    return root;
+    return w_root_resolve(root_name, create);
 
   } catch (const std::exception& exc) {
     throw RootResolveError(
@@ -94,10 +91,21 @@ std::shared_ptr<Root> doResolveOrCreateRoot(
         root_name,
         ": ",
         exc.what(),
-        client->client_is_owner
-            ? ""
-            : " (this may be because you are not the process owner)");
+        isOwner ? ""
+                : " (this may be because you are not the process owner)");
+  }
+}
+
+std::shared_ptr<Root> doResolveOrCreateRoot(
+    struct watchman_client* client,
+    const json_ref& args,
+    bool create) {
+  auto root = resolveOrCreateRootAs(
+      args, create, client->client_mode, client->client_is_owner);
+  if (client->perf_sample) {
+    root->addPerfSampleMetadata(*client->perf_sample);
   }
+  return root;
 }
 
 std::shared_ptr<Root> resolveRoot(
@@ -114,9 +122,29 @@ std::shared_ptr<Root> resolveOrCreateRoot(
 
 watchman_user_client::watchman_user_client(
     std::unique_ptr<watchman_stream>&& stm)
-    : watchman_client(std::move(stm)) {}
+    : watchman_client(std::move(stm)),
+      responseBudgetBytes(size_t(Configuration().getInt(
+          "client_response_budget_bytes",
+          32 * 1024 * 1024))),
+      groupSettle(std::max(
+          json_int_t(0),
+          Configuration().getInt("subscription_group_settle_ms", 20))) {}
 
 watchman_user_client::~watchman_user_client() {
+  // Keep the sessions of resumable subscriptions for their grace period
+  for (auto& [name, sub] : subscriptions) {
+    if (sub->resumeToken && sub->deliveredClock) {
+      getSubscriptionSessions().detach(
+          sub->resumeToken,
+          SubscriptionSessions::Session{
+              sub->root->root_path,
+              name,
+              SubscriptionSessions::withoutToken(sub->query->query_spec),
+              sub->deliveredClock},
+          sub->resumeGrace);
+    }
+  }
+
   /* cancel subscriptions */
   subscriptions.clear();
 
@@ -12,16 +12,27 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/net/NetworkSocket.h>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <optional>
 #include <thread>
+#include <tuple>
+#include "watchman/ClientEventLoop.h"
 #include "watchman/Constants.h"
 #include "watchman/GroupLookup.h"
+#include "watchman/MemoryBudget.h"
+#include "watchman/Metrics.h"
+#include "watchman/MetricsServer.h"
+#include "watchman/QueryableView.h"
 #include "watchman/SanityCheck.h"
 #include "watchman/Shutdown.h"
 #include "watchman/SignalHandler.h"
+#include "watchman/ThreadAccounting.h"
 #include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
 #include "watchman/sockname.h"
 #include "watchman/state.h"
 #include "watchman/watchman_client.h"
@@ -31,6 +42,16 @@ using namespace watchman;
 
 folly::Synchronized<std::unordered_set<std::shared_ptr<watchman_client>>>
     clients;
+static MetricsCollectorRegistration clientMetrics(
+    "clients",
+    [](MetricsWriter& writer) {
+      writer.add(
+          "watchman_clients",
+          MetricType::Gauge,
+          "Connected clients",
+          {},
+          clients.rlock()->size());
+    });
 static FileDescriptor listener_fd;
 static constexpr size_t kResponseLogLimit = 8;
 
@@ -100,7 +121,16 @@ watchman_client::watchman_client(std::unique_ptr<watchman_stream>&& stm)
           w_event_make_sockets()
 #endif
 
-      ) {
+          ),
+      writeBatchSize(size_t(std::max(
+          json_int_t(1),
+          Configuration().getInt("client_write_batch_size", 64)))),
+      compressionThresholdBytes(size_t(Configuration().getInt(
+          "bser_compression_threshold_bytes",
+          4 * 1024 * 1024))),
+      sharedMemoryThresholdBytes(size_t(Configuration().getInt(
+          "shared_memory_threshold_bytes",
+          1024 * 1024))) {
   logf(DBG, "accepted client:stm={}\n", fmt::ptr(this->stm.get()));
 }
 
@@ -115,201 +145,457 @@ watchman_client::~watchman_client() {
   }
 }
 
+size_t approximateResponseSize(const json_ref& resp) {
+  // Enough for the envelope and a typical file entry respectively
+  constexpr size_t kEnvelopeBytes = 256;
+  constexpr size_t kFileBytes = 128;
+
+  auto files = resp.get_default("files");
+  if (files && files.isArray()) {
+    size_t size = kEnvelopeBytes + json_array_size(files) * kFileBytes;
+    // Files that were encoded as BSER by the query are not array elements
+    if (auto rows = json_array_get_bser_rows(files)) {
+      size += rows->data.size();
+    }
+    return size;
+  }
+  return kEnvelopeBytes;
+}
+
 void watchman_client::enqueueResponse(json_ref&& resp, bool ping) {
-  responses.emplace_back(std::move(resp));
+  responsesBytes += approximateResponseSize(resp);
+  responses.push_back(QueuedResponse{std::move(resp), nullptr});
 
   if (ping) {
     this->ping->notify();
   }
 }
 
-// The client thread reads and decodes json packets,
-// then dispatches the commands that it finds
-static void client_thread(
-    std::shared_ptr<watchman_user_client> client) noexcept {
-  // Keep a persistent vector around so that we can avoid allocating
-  // and releasing heap memory when we collect items from the publisher
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+void watchman_client::enqueueBroadcast(
+    std::shared_ptr<const watchman::Publisher::Item> item,
+    bool ping) {
+  auto payload = item->payload;
+  responsesBytes += approximateResponseSize(payload);
+  responses.push_back(QueuedResponse{std::move(payload), std::move(item)});
 
-  client->stm->setNonBlock(true);
-  w_set_thread_name(
-      "client=",
-      client->unique_id,
-      ":stm=",
-      uintptr_t(client->stm.get()),
-      ":pid=",
-      client->stm->getPeerProcessID());
+  if (ping) {
+    this->ping->notify();
+  }
+}
 
-  client->client_is_owner = client->stm->peerIsOwner();
+namespace {
 
-  struct watchman_event_poll pfd[2];
-  pfd[0].evt = client->stm->getEvents();
-  pfd[1].evt = client->ping.get();
+// Returns the payload of item encoded as a PDU of pdu_type, encoding it
+// only if no other client has yet asked for it in that format.
+std::shared_ptr<const std::string> encodedBroadcast(
+    const watchman::Publisher::Item& item,
+    w_pdu_type pdu_type,
+    uint32_t capabilities) {
+  uint64_t format = (uint64_t(pdu_type) << 32) | capabilities;
+  {
+    auto encodings = item.encodings.rlock();
+    for (auto& encoding : *encodings) {
+      if (encoding.first == format) {
+        return encoding.second;
+      }
+    }
+  }
+
+  auto encoded = encodePdu(pdu_type, capabilities, item.payload);
+  if (!encoded) {
+    return nullptr;
+  }
+  auto bytes = std::make_shared<const std::string>(std::move(*encoded));
+  auto encodings = item.encodings.wlock();
+  for (auto& encoding : *encodings) {
+    // Another client encoded it first; share theirs
+    if (encoding.first == format) {
+      return encoding.second;
+    }
+  }
+  encodings->emplace_back(format, bytes);
+  return bytes;
+}
+
+} // namespace
+
+bool watchman_client::sendQueuedResponses() {
+  if (responses.empty()) {
+    return true;
+  }
 
   bool client_alive = true;
-  while (!w_is_stopping() && client_alive) {
-    // Wait for input from either the client socket or
-    // via the ping pipe, which signals that some other
-    // thread wants to unilaterally send data to the client
+  size_t batched = 0;
+  stm->setNonBlock(false);
+  while (!responses.empty() && client_alive) {
+    auto& queued = responses.front();
+    auto& response_to_send = queued.response;
+    auto responseBytes = approximateResponseSize(response_to_send);
+    bool isBserV2 = pdu_type == is_bser_v2;
+
+    // Small responses accumulate in the writer's buffer, which is written
+    // out as it fills and after every writeBatchSize responses, so that a
+    // subscriber with many small responses queued costs few writes.
+    bool flush = responses.size() == 1 || ++batched >= writeBatchSize;
+    if (flush) {
+      batched = 0;
+    }
 
-    ignore_result(w_poll_events(pfd, 2, 2000));
-    if (w_is_stopping()) {
-      break;
+    /* Return the data in the same format that was used to ask for it.
+     * Update client liveness based on send success.
+     */
+    if (queued.broadcast) {
+      auto encoded =
+          encodedBroadcast(*queued.broadcast, pdu_type, capabilities);
+      client_alive = encoded &&
+          writer.writeEncodedToStream(*encoded, stm.get(), flush);
+    } else if (
+        isBserV2 && (capabilities & BSER_CAP_ACCEPT_SHARED_MEMORY) &&
+        responseBytes >= sharedMemoryThresholdBytes) {
+      client_alive = writer.sharedMemoryEncodeToStream(
+          capabilities, response_to_send, stm.get());
+      batched = 0;
+    } else if (
+        isBserV2 && (capabilities & BSER_CAP_ACCEPT_COMPRESSED) &&
+        responseBytes >= compressionThresholdBytes) {
+      client_alive = writer.compressedBserEncodeToStream(
+          capabilities, response_to_send, stm.get(), flush);
+    } else {
+      client_alive = writer.pduEncodeToStream(
+          pdu_type, capabilities, response_to_send, stm.get(), flush);
+    }
+
+    responseSent(response_to_send);
+    responsesBytes -= responseBytes;
+    responses.pop_front();
+  }
+  stm->setNonBlock(true);
+  if (!client_alive) {
+    writeFailed();
+  }
+  return client_alive;
+}
+
+void watchman_user_client::writeFailed() {
+  // Responses that were written before the failure may still have been
+  // buffered, so it isn't known what the client last received and its
+  // subscriptions can't be resumed
+  for (auto& [name, sub] : subscriptions) {
+    sub->deliveredClock = nullptr;
+  }
+}
+
+void watchman_user_client::responseSent(const json_ref& resp) {
+  if (resp.get_default("subscription_group")) {
+    for (auto& result : resp.get("results").array()) {
+      responseSent(result);
+    }
+    return;
+  }
+  json_ref subscriptionValue = resp.get_default("subscription");
+  if (subscriptionValue && subscriptionValue.isString() &&
+      json_string_value(subscriptionValue)) {
+    auto subscriptionName = json_to_w_string(subscriptionValue);
+    if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
+      if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
+        (*sub)->lastResponses.pop_front();
+      }
+      (*sub)->lastResponses.push_back(
+          watchman_client_subscription::LoggedResponse{
+              std::chrono::system_clock::now(), resp});
+      if (auto clock = resp.get_default("clock")) {
+        (*sub)->deliveredClock = clock;
+      }
+    }
+  }
+}
+
+namespace {
+
+enum class ClientStatus {
+  Alive,
+  // The request limit was reached before the socket was drained.
+  MoreInput,
+  Disconnected,
+};
+
+// Upper bound on the number of requests that the event loop will dispatch
+// for a client before letting other clients have a turn.
+constexpr size_t kMaxRequestsPerStep = 16;
+
+// Relays the progress of the crawls of the roots that the client watched
+// without waiting, and forgets each root once its crawl is ready.
+void client_relay_crawls(
+    watchman_user_client* client,
+    std::vector<std::shared_ptr<const watchman::Publisher::Item>>& pending) {
+  auto it = client->crawlWatches.begin();
+  while (it != client->crawlWatches.end()) {
+    auto& watch = it->second;
+    pending.clear();
+    watch.progress->getPending(pending);
+
+    bool done = false;
+    for (auto& item : pending) {
+      auto resp = make_response();
+      resp.set(
+          {{"unilateral", json_true()},
+           {"watch", w_string_to_json(watch.root->root_path)}});
+      if (auto progress = item->payload.get_default("crawl-progress")) {
+        resp.set("crawl", json_ref(progress));
+      } else if (auto ready = item->payload.get_default("crawl-ready")) {
+        resp.set(
+            {{"ready", json_true()},
+             {"crawl", json_ref(ready)},
+             {"clock",
+              w_string_to_json(
+                  watch.root->view()->getCurrentClockString())}});
+        add_root_warnings_to_response(resp, watch.root);
+        done = true;
+      } else if (item->payload.get_default("canceled")) {
+        resp.set("canceled", json_true());
+        done = true;
+      } else {
+        continue;
+      }
+      client->enqueueResponse(std::move(resp), false);
+      if (done) {
+        break;
+      }
+    }
+
+    if (done) {
+      it = client->crawlWatches.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+// Fans out pending log payloads and subscription notifications to client,
+// and queues the results of subscription groups whose window has closed.
+void client_process_pings(
+    watchman_user_client* client,
+    std::vector<std::shared_ptr<const watchman::Publisher::Item>>& pending) {
+  while (client->ping->testAndClear()) {
+    // Enqueue refs to pending log payloads
+    pending.clear();
+    getPending(pending, client->debugSub, client->errorSub);
+    for (auto& item : pending) {
+      client->enqueueBroadcast(item, false);
+    }
+
+    // Maybe we have subscriptions to dispatch?
+    std::vector<w_string> subsToDelete;
+    std::vector<std::shared_ptr<watchman_client_subscription>> settled;
+    for (auto& subiter : client->unilateralSub) {
+      auto sub = subiter.first;
+      auto subStream = subiter.second;
+
+      watchman::log(watchman::DBG, "consider fan out sub ", sub->name, "\n");
+
+      pending.clear();
+      subStream->getPending(pending);
+      bool seenSettle = false;
+      for (auto& item : pending) {
+        auto dumped = json_dumps(item->payload, 0);
+        watchman::log(
+            watchman::DBG,
+            "Unilateral payload for sub ",
+            sub->name,
+            " ",
+            dumped,
+            "\n");
+
+        if (item->payload.get_default("canceled")) {
+          watchman::log(
+              watchman::ERR,
+              "Cancel subscription ",
+              sub->name,
+              " due to root cancellation\n");
+
+          auto resp = make_response();
+          resp.set(
+              {{"root", item->payload.get_default("root")},
+               {"unilateral", json_true()},
+               {"canceled", json_true()},
+               {"subscription", w_string_to_json(sub->name)}});
+          client->enqueueResponse(std::move(resp), false);
+          // Remember to cancel this subscription.
+          // We can't do it in this loop because that would
+          // invalidate the iterators and cause a headache.
+          subsToDelete.push_back(sub->name);
+          continue;
+        }
+
+        auto enter = item->payload.get_default("state-enter");
+        auto leave = item->payload.get_default("state-leave");
+        if (enter || leave) {
+          sub->stateTransition(
+              json_to_w_string(enter ? enter : leave), bool(enter));
+          auto resp = make_response();
+          json_object_update(item->payload, resp);
+          // We have the opportunity to populate additional response
+          // fields here (since we don't want to block the command).
+          // We don't populate the fat clock for SCM aware queries
+          // because determination of mergeBase could add latency.
+          resp.set(
+              {{"unilateral", json_true()},
+               {"subscription", w_string_to_json(sub->name)}});
+          client->enqueueResponse(std::move(resp), false);
+
+          watchman::log(
+              watchman::DBG,
+              "Fan out subscription state change for ",
+              sub->name,
+              "\n");
+          continue;
+        }
+
+        if (!sub->debug_paused && item->payload.get_default("settled")) {
+          seenSettle = true;
+          continue;
+        }
+      }
+
+      if (sub->parked()) {
+        // Hold off until the state that defers it is left
+        if (seenSettle) {
+          sub->settledWhileParked = true;
+          ++sub->parkedSettles;
+        }
+        continue;
+      }
+      if (sub->settledWhileParked) {
+        sub->settledWhileParked = false;
+        seenSettle = !sub->debug_paused;
+      }
+      if (seenSettle) {
+        settled.push_back(sub);
+      }
+    }
+
+    // The client's most urgent and then quickest subscriptions first, in
+    // the order that the dispatcher would run them
+    std::stable_sort(
+        settled.begin(), settled.end(), [](const auto& a, const auto& b) {
+          return std::tie(a->priority, a->queryCost) <
+              std::tie(b->priority, b->queryCost);
+        });
+    for (auto& sub : settled) {
+      sub->processSubscription();
+    }
+
+    for (auto& name : subsToDelete) {
+      client->unsubByName(name);
     }
 
-    if (pfd[0].ready) {
+    client_relay_crawls(client, pending);
+  }
+
+  client->flushSubscriptionGroups();
+}
+
+// Handles one wakeup for a client: decodes and dispatches up to maxRequests
+// requests if the socket is readable, fans out anything that other threads
+// published for it if it was pinged, and then sends the responses.
+ClientStatus client_step(
+    watchman_user_client* client,
+    std::vector<std::shared_ptr<const watchman::Publisher::Item>>& pending,
+    bool readable,
+    bool pinged,
+    size_t maxRequests) {
+  auto status = ClientStatus::Alive;
+
+  if (readable) {
+    status = ClientStatus::MoreInput;
+    for (size_t i = 0; i < maxRequests; ++i) {
       json_error_t jerr;
       auto request = client->reader.decodeNext(client->stm.get(), &jerr);
 
       if (!request && errno == EAGAIN) {
         // That's fine
+        status = ClientStatus::Alive;
+        break;
       } else if (!request) {
         // Not so cool
         if (client->reader.wpos == client->reader.rpos) {
           // If they disconnected in between PDUs, no need to log
           // any error
-          goto disconnected;
+          return ClientStatus::Disconnected;
         }
         send_error_response(
-            client.get(),
+            client,
             "invalid json at position %d: %s",
             jerr.position,
             jerr.text);
         logf(ERR, "invalid data from client: {}\n", jerr.text);
 
-        goto disconnected;
+        return ClientStatus::Disconnected;
       } else if (request) {
         client->pdu_type = client->reader.pdu_type;
-        client->capabilities = client->reader.capabilities;
-        dispatch_command(client.get(), request, CMD_DAEMON);
+        // Only the server marks PDUs as compressed or shared
+        client->capabilities = client->reader.capabilities &
+            ~(BSER_CAP_COMPRESSED | BSER_CAP_SHARED_MEMORY);
+        dispatch_command(client, request, CMD_DAEMON);
       }
     }
+  }
 
-    if (pfd[1].ready) {
-      while (client->ping->testAndClear()) {
-        // Enqueue refs to pending log payloads
-        pending.clear();
-        getPending(pending, client->debugSub, client->errorSub);
-        for (auto& item : pending) {
-          client->enqueueResponse(json_ref(item->payload), false);
-        }
+  if (pinged) {
+    client_process_pings(client, pending);
+  }
 
-        // Maybe we have subscriptions to dispatch?
-        std::vector<w_string> subsToDelete;
-        for (auto& subiter : client->unilateralSub) {
-          auto sub = subiter.first;
-          auto subStream = subiter.second;
+  /* now send our response(s) */
+  if (!client->sendQueuedResponses()) {
+    return ClientStatus::Disconnected;
+  }
+  return status;
+}
 
-          watchman::log(
-              watchman::DBG, "consider fan out sub ", sub->name, "\n");
-
-          pending.clear();
-          subStream->getPending(pending);
-          bool seenSettle = false;
-          for (auto& item : pending) {
-            auto dumped = json_dumps(item->payload, 0);
-            watchman::log(
-                watchman::DBG,
-                "Unilateral payload for sub ",
-                sub->name,
-                " ",
-                dumped,
-                "\n");
-
-            if (item->payload.get_default("canceled")) {
-              watchman::log(
-                  watchman::ERR,
-                  "Cancel subscription ",
-                  sub->name,
-                  " due to root cancellation\n");
-
-              auto resp = make_response();
-              resp.set(
-                  {{"root", item->payload.get_default("root")},
-                   {"unilateral", json_true()},
-                   {"canceled", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              client->enqueueResponse(std::move(resp), false);
-              // Remember to cancel this subscription.
-              // We can't do it in this loop because that would
-              // invalidate the iterators and cause a headache.
-              subsToDelete.push_back(sub->name);
-              continue;
-            }
-
-            if (item->payload.get_default("state-enter") ||
-                item->payload.get_default("state-leave")) {
-              auto resp = make_response();
-              json_object_update(item->payload, resp);
-              // We have the opportunity to populate additional response
-              // fields here (since we don't want to block the command).
-              // We don't populate the fat clock for SCM aware queries
-              // because determination of mergeBase could add latency.
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              client->enqueueResponse(std::move(resp), false);
-
-              watchman::log(
-                  watchman::DBG,
-                  "Fan out subscription state change for ",
-                  sub->name,
-                  "\n");
-              continue;
-            }
-
-            if (!sub->debug_paused && item->payload.get_default("settled")) {
-              seenSettle = true;
-              continue;
-            }
-          }
-
-          if (seenSettle) {
-            sub->processSubscription();
-          }
-        }
+std::unique_ptr<ClientEventLoop> client_event_loop;
 
-        for (auto& name : subsToDelete) {
-          client->unsubByName(name);
-        }
-      }
-    }
+} // namespace
 
-    /* now send our response(s) */
-    while (!client->responses.empty() && client_alive) {
-      auto& response_to_send = client->responses.front();
-
-      client->stm->setNonBlock(false);
-      /* Return the data in the same format that was used to ask for it.
-       * Update client liveness based on send success.
-       */
-      client_alive = client->writer.pduEncodeToStream(
-          client->pdu_type,
-          client->capabilities,
-          response_to_send,
-          client->stm.get());
-      client->stm->setNonBlock(true);
-
-      json_ref subscriptionValue = response_to_send.get_default("subscription");
-      if (subscriptionValue && subscriptionValue.isString() &&
-          json_string_value(subscriptionValue)) {
-        auto subscriptionName = json_to_w_string(subscriptionValue);
-        if (auto* sub =
-                folly::get_ptr(client->subscriptions, subscriptionName)) {
-          if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
-            (*sub)->lastResponses.pop_front();
-          }
-          (*sub)->lastResponses.push_back(
-              watchman_client_subscription::LoggedResponse{
-                  std::chrono::system_clock::now(), response_to_send});
-        }
-      }
+// The client thread reads and decodes json packets,
+// then dispatches the commands that it finds
+static void client_thread(
+    std::shared_ptr<watchman_user_client> client) noexcept {
+  // Keep a persistent vector around so that we can avoid allocating
+  // and releasing heap memory when we collect items from the publisher
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+
+  client->stm->setNonBlock(true);
+  w_set_thread_name(
+      "client=",
+      client->unique_id,
+      ":stm=",
+      uintptr_t(client->stm.get()),
+      ":pid=",
+      client->stm->getPeerProcessID());
+  ThreadAccount account{"client"};
+
+  client->client_is_owner = client->stm->peerIsOwner();
+
+  struct watchman_event_poll pfd[2];
+  pfd[0].evt = client->stm->getEvents();
+  pfd[1].evt = client->ping.get();
 
-      client->responses.pop_front();
+  while (!w_is_stopping()) {
+    // Wait for input from either the client socket or
+    // via the ping pipe, which signals that some other
+    // thread wants to unilaterally send data to the client
+
+    ignore_result(w_poll_events(pfd, 2, 2000));
+    if (w_is_stopping()) {
+      break;
+    }
+
+    if (client_step(client.get(), pending, pfd[0].ready, pfd[1].ready, 1) ==
+        ClientStatus::Disconnected) {
+      break;
     }
   }
 
-disconnected:
   w_set_thread_name(
       "NOT_CONN:client=",
       client->unique_id,
@@ -323,6 +609,38 @@ disconnected:
   clients.wlock()->erase(client);
 }
 
+// Registers client with the event loop rather than giving it a thread.
+static void client_start_event_loop(
+    std::shared_ptr<watchman_user_client> client) {
+  client->stm->setNonBlock(true);
+  client->client_is_owner = client->stm->peerIsOwner();
+
+  auto socket = client->stm->getEvents()->system_handle();
+  auto ping = client->ping->system_handle();
+  client_event_loop->add(
+      socket,
+      ping,
+      [client,
+       pending =
+           std::vector<std::shared_ptr<const watchman::Publisher::Item>>()](
+          bool readable, bool pinged) mutable {
+        if (w_is_stopping()) {
+          return ClientEventLoop::StepResult::Disconnect;
+        }
+        switch (client_step(
+            client.get(), pending, readable, pinged, kMaxRequestsPerStep)) {
+          case ClientStatus::Alive:
+            return ClientEventLoop::StepResult::Idle;
+          case ClientStatus::MoreInput:
+            return ClientEventLoop::StepResult::MoreInput;
+          case ClientStatus::Disconnected:
+            break;
+        }
+        return ClientEventLoop::StepResult::Disconnect;
+      },
+      [client] { clients.wlock()->erase(client); });
+}
+
 #if defined(HAVE_KQUEUE) || defined(HAVE_FSEVENTS)
 #ifdef __OpenBSD__
 #include <sys/siginfo.h> // @manual
@@ -354,12 +672,11 @@ void w_listener_prep_inetd() {
 
 #endif
 
-static FileDescriptor get_listener_tcp_socket() {
+static FileDescriptor get_listener_tcp_socket(const char* address) {
   FileDescriptor listener_fd;
 
   folly::SocketAddress addr;
-  addr.setFromHostPort(
-      Configuration().getString("tcp-listener-address", nullptr));
+  addr.setFromHostPort(address);
 
   listener_fd = FileDescriptor(
       ::socket(addr.getFamily(), SOCK_STREAM, 0),
@@ -501,15 +818,19 @@ static std::shared_ptr<watchman_client> make_new_client(
 
   clients.wlock()->insert(client);
 
-  // Start a thread for the client.
-  // We used to use libevent for this, but we have
-  // a low volume of concurrent clients and the json
-  // parse/encode APIs are not easily used in a non-blocking
-  // server architecture.
+  // Start a thread for the client, unless client_event_loop is enabled.
+  // The json parse/encode APIs are not easily used in a non-blocking
+  // server architecture, so even in the event loop mode each request
+  // is decoded and answered synchronously by a worker thread; we just
+  // don't dedicate a thread to waiting for the next one.
   try {
-    std::thread thr([client] { client_thread(client); });
+    if (client_event_loop) {
+      client_start_event_loop(client);
+    } else {
+      std::thread thr([client] { client_thread(client); });
 
-    thr.detach();
+      thr.detach();
+    }
   } catch (const std::exception&) {
     clients.wlock()->erase(client);
     throw;
@@ -845,15 +1166,48 @@ bool w_start_listener() {
     }
   }
 
+  if (Configuration().getBool("client_event_loop", false)) {
+    if (ClientEventLoop::isSupported()) {
+      auto ioThreads = std::max(
+          json_int_t(1), Configuration().getInt("client_io_threads", 1));
+      auto workerThreads = std::max(
+          json_int_t(1), Configuration().getInt("client_worker_threads", 8));
+      client_event_loop =
+          std::make_unique<ClientEventLoop>(ioThreads, workerThreads);
+    } else {
+      logf(
+          ERR,
+          "client_event_loop is not supported on this platform; "
+          "using a thread per client\n");
+    }
+  }
+
   if (listener_fd && !disable_unix_socket) {
     unix_loop = AcceptLoop("unix-listener", std::move(listener_fd));
   }
 
   if (Configuration().getBool("tcp-listener-enable", false)) {
-    tcp_loop = AcceptLoop("tcp-listener", get_listener_tcp_socket());
+    tcp_loop = AcceptLoop(
+        "tcp-listener",
+        get_listener_tcp_socket(
+            Configuration().getString("tcp-listener-address", nullptr)));
+  }
+
+  std::optional<MetricsServer> metrics_server;
+  auto metrics_address =
+      Configuration().getString("metrics-http-address", nullptr);
+  if (metrics_address && *metrics_address) {
+    try {
+      metrics_server.emplace(get_listener_tcp_socket(metrics_address));
+    } catch (const std::exception& ex) {
+      logf(ERR, "Failed to start the metrics server: {}\n", ex.what());
+    }
   }
 
   startSanityCheckThread();
+  getMemoryBudget().setConsumers(Root::getMemoryBudgetConsumers);
+  startMemoryBudgetThread();
+  startLatencyProbeThread();
 
 #ifdef _WIN32
   // Start the named pipes and join them; this will
@@ -911,6 +1265,9 @@ bool w_start_listener() {
     }
   }
 
+  // Any clients that are still connected are dropped along with the loop.
+  client_event_loop.reset();
+
   w_state_shutdown();
 
   return true;
@@ -13,6 +13,7 @@
 #include <folly/net/NetworkSocket.h>
 
 #include <stdio.h>
+#include <algorithm>
 #include <variant>
 
 #include "watchman/ChildProcess.h"
@@ -25,6 +26,7 @@
 #include "watchman/PerfSample.h"
 #include "watchman/ProcessLock.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/Trace.h"
 #include "watchman/UserDir.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
@@ -171,13 +173,28 @@ void detect_low_process_priority() {
   watchman::getThreadPool().start(
       cfg_get_int("thread_pool_worker_threads", 16),
       cfg_get_int("thread_pool_max_items", 1024 * 1024));
+  watchman::configureTracing(static_cast<uint32_t>(
+      std::max<json_int_t>(0, cfg_get_int("trace_buffer_events", 0))));
+  auto logBufferLines = cfg_get_int("log_buffer_lines", 0);
+  if (logBufferLines > 0) {
+    watchman::getLog().startAsyncWriter(logBufferLines);
+  }
 
   ClockSpec::init();
   w_state_load();
   bool res = w_start_listener();
-  w_root_free_watched_roots();
+  if (cfg_get_bool("fast_shutdown", false)) {
+    // The listener has answered the clients and saved the state file; the
+    // views are left for the process exit to reclaim
+    auto timeout = cfg_get_int("fast_shutdown_timeout_ms", 3000);
+    w_root_abandon_watched_roots(
+        std::chrono::milliseconds(std::max<json_int_t>(0, timeout)));
+  } else {
+    w_root_free_watched_roots();
+  }
   perf_shutdown();
   cfg_shutdown();
+  watchman::getLog().stopAsyncWriter();
 
   log(ERR, "Exiting from service with res=", res, "\n");
 
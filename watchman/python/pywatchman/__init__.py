@@ -8,11 +8,14 @@ from __future__ import absolute_import, division, print_function
 
 import inspect
 import math
+import mmap
 import os
 import socket
+import struct
 import subprocess
 import sys
 import time
+import zlib
 
 from . import capabilities, compat, encoding, load
 
@@ -68,6 +71,37 @@ if os.name == "nt":
 # 2 bytes marker, 1 byte int size, 8 bytes int64 value
 sniff_len = 13
 
+# BSER v2 capabilities for compressed PDUs; see watchman/bser.h.  Clients
+# that set BSER_CAP_ACCEPT_COMPRESSED may be sent large responses as PDUs
+# whose header has BSER_CAP_COMPRESSED set and whose value is deflated.
+BSER_CAP_ACCEPT_COMPRESSED = 0x4
+BSER_CAP_COMPRESSED = 0x8
+# Clients that set BSER_CAP_ACCEPT_SHARED_MEMORY may instead be sent a PDU
+# with BSER_CAP_SHARED_MEMORY set, whose value is the size of a shared memory
+# segment that holds the response.  Its descriptor comes with the PDU.
+BSER_CAP_ACCEPT_SHARED_MEMORY = 0x10
+BSER_CAP_SHARED_MEMORY = 0x20
+# Clients that set BSER_CAP_ACCEPT_PREFIX_STRINGS may be sent file names as
+# BSER prefix strings, which share their leading bytes with the previous one.
+BSER_CAP_ACCEPT_PREFIX_STRINGS = 0x40
+
+# The sizes of the BSER integer types, by type code
+_bser_int_sizes = {b"\x03": 1, b"\x04": 2, b"\x05": 4, b"\x06": 8}
+
+
+def _inflate_pdu(response):
+    """Returns the uncompressed BSER v2 PDU that a compressed PDU stands for"""
+    (capabilities,) = struct.unpack_from("=I", response, 2)
+    header_len = 7 + _bser_int_sizes[response[6:7]]
+    value = zlib.decompress(response[header_len:])
+    return (
+        response[0:2]
+        + struct.pack("=I", capabilities & ~BSER_CAP_COMPRESSED)
+        + b"\x06"
+        + struct.pack("=q", len(value))
+        + value
+    )
+
 # This is a helper for debugging the client.
 _debugging = False
 if _debugging:
@@ -310,6 +344,8 @@ class UnixSocketTransport(SocketTransport):
         super(UnixSocketTransport, self).__init__()
         self.sockpath = sockpath
         self.timeout = timeout
+        # Descriptors that the server passed, oldest first
+        self.descriptors = []
 
         sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
         try:
@@ -320,6 +356,29 @@ class UnixSocketTransport(SocketTransport):
             sock.close()
             raise SocketConnectError(self.sockpath.unix_domain, e)
 
+    def canReceiveDescriptors(self):
+        return hasattr(self.sock, "recvmsg") and hasattr(socket, "SCM_RIGHTS")
+
+    def readBytes(self, size):
+        if not self.canReceiveDescriptors():
+            return super(UnixSocketTransport, self).readBytes(size)
+        int_size = struct.calcsize("i")
+        try:
+            data, ancdata, _flags, _addr = self.sock.recvmsg(
+                size, socket.CMSG_SPACE(int_size)
+            )
+        except socket.timeout:
+            raise SocketTimeout("timed out waiting for response")
+        for level, kind, payload in ancdata:
+            if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+                count = len(payload) // int_size
+                self.descriptors.extend(
+                    struct.unpack("=%di" % count, payload[: count * int_size])
+                )
+        if not data:
+            raise WatchmanError("empty watchman response")
+        return data
+
 
 class WindowsUnixSocketTransport(SocketTransport):
     """local unix domain socket transport on Windows"""
@@ -736,7 +795,16 @@ class Bser2WithFallbackCodec(BserCodec):
         else:
             bserv2_key = "optional"
 
-        self.send(["version", {bserv2_key: ["bser-v2"]}])
+        receives_descriptors = getattr(
+            transport, "canReceiveDescriptors", lambda: False
+        )()
+        version_args = {bserv2_key: ["bser-v2"]}
+        optional = version_args.setdefault("optional", [])
+        optional.append("bser-v2-compression")
+        optional.append("bser-v2-prefix-strings")
+        if receives_descriptors:
+            optional.append("bser-v2-shared-memory")
+        self.send(["version", version_args])
 
         capabilities = self.receive()
 
@@ -749,6 +817,15 @@ class Bser2WithFallbackCodec(BserCodec):
         if capabilities["capabilities"]["bser-v2"]:
             self.bser_version = 2
             self.bser_capabilities = 0
+            if capabilities["capabilities"]["bser-v2-compression"]:
+                self.bser_capabilities |= BSER_CAP_ACCEPT_COMPRESSED
+            if (
+                receives_descriptors
+                and capabilities["capabilities"]["bser-v2-shared-memory"]
+            ):
+                self.bser_capabilities |= BSER_CAP_ACCEPT_SHARED_MEMORY
+            if capabilities["capabilities"]["bser-v2-prefix-strings"]:
+                self.bser_capabilities |= BSER_CAP_ACCEPT_PREFIX_STRINGS
         else:
             self.bser_version = 1
             self.bser_capabilities = 0
@@ -772,11 +849,30 @@ class Bser2WithFallbackCodec(BserCodec):
 
         response = b"".join(buf)
         try:
+            if recv_bser_capabilities & BSER_CAP_SHARED_MEMORY:
+                return self._loadShared(self._loads(response))
+            if recv_bser_capabilities & BSER_CAP_COMPRESSED:
+                response = _inflate_pdu(response)
             res = self._loads(response)
             return res
-        except ValueError as e:
+        except (ValueError, zlib.error) as e:
             raise WatchmanError("watchman response decode error: %s" % e)
 
+    def _loadShared(self, size):
+        """Decodes the response in the shared memory segment of the given size
+        whose descriptor the server passed"""
+        if not getattr(self.transport, "descriptors", None):
+            raise WatchmanError("shared memory response without a descriptor")
+        fd = self.transport.descriptors.pop(0)
+        try:
+            segment = mmap.mmap(fd, size, access=mmap.ACCESS_READ)
+        finally:
+            os.close(fd)
+        try:
+            return self._loads(segment)
+        finally:
+            segment.close()
+
     def send(self, *args):
         if hasattr(self, "bser_version"):
             cmd = bser.dumps(
@@ -1071,22 +1167,31 @@ class client(object):
         if self._hasprop(result, "log"):
             self.logs.append(result["log"])
 
+        if self._hasprop(result, "subscription_group"):
+            # The results of each subscription in the group are
+            # buffered as though they had arrived on their own
+            for sub_result in result["results"]:
+                self._addSubscriptionResult(sub_result)
+
         if self._hasprop(result, "subscription"):
-            sub = result["subscription"]
-            if not (sub in self.subs):
-                self.subs[sub] = []
-            self.subs[sub].append(result)
-
-            # also accumulate in {root,sub} keyed store
-            root = os.path.normpath(os.path.normcase(result["root"]))
-            if not root in self.sub_by_root:
-                self.sub_by_root[root] = {}
-            if not sub in self.sub_by_root[root]:
-                self.sub_by_root[root][sub] = []
-            self.sub_by_root[root][sub].append(result)
+            self._addSubscriptionResult(result)
 
         return result
 
+    def _addSubscriptionResult(self, result):
+        sub = result["subscription"]
+        if not (sub in self.subs):
+            self.subs[sub] = []
+        self.subs[sub].append(result)
+
+        # also accumulate in {root,sub} keyed store
+        root = os.path.normpath(os.path.normcase(result["root"]))
+        if not root in self.sub_by_root:
+            self.sub_by_root[root] = {}
+        if not sub in self.sub_by_root[root]:
+            self.sub_by_root[root][sub] = []
+        self.sub_by_root[root][sub].append(result)
+
     def isUnilateralResponse(self, res):
         if "unilateral" in res and res["unilateral"]:
             return True
@@ -8,6 +8,7 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <bytesobject.h>
+#include <stddef.h>
 #ifdef _MSC_VER
 #define inline __inline
 #if _MSC_VER >= 1800
@@ -47,6 +48,7 @@ typedef unsigned __int64 uint64_t;
 #define BSER_TEMPLATE  0x0b
 #define BSER_SKIP      0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_PREFIXSTRING 0x0e
 // clang-format on
 
 // An immutable object representation of BSER_OBJECT.
@@ -222,12 +224,23 @@ PyTypeObject bserObjectType = {
 };
 // clang-format on
 
+// The last BSER_PREFIXSTRING decoded from a PDU, which the next one
+// shares its leading bytes with
+typedef struct bser_prefix {
+  char* buf;
+  int64_t len;
+  int64_t cap;
+} bser_prefix_t;
+
 typedef struct loads_ctx {
   int mutable;
   const char* value_encoding;
   const char* value_errors;
   uint32_t bser_version;
   uint32_t bser_capabilities;
+  bser_prefix_t* prefix;
+  // Whether to decode templates into one sequence per key
+  int columns;
 } unser_ctx_t;
 
 static PyObject*
@@ -629,6 +642,217 @@ static int bunser_bytestring(
   return 1;
 }
 
+// Decodes a BSER_PREFIXSTRING into prefix, and reports whether its
+// suffix was a bytestring rather than a utf8 string
+static int bunser_prefix_string(
+    const char** ptr,
+    const char* end,
+    bser_prefix_t* prefix,
+    int* is_bytestring) {
+  const char* buf = *ptr;
+  const char* start;
+  int64_t shared;
+  int64_t len;
+
+  // skip string marker
+  buf++;
+  if (!bunser_int(&buf, end, &shared)) {
+    return 0;
+  }
+
+  if (shared < 0 || shared > prefix->len || buf >= end ||
+      (buf[0] != BSER_BYTESTRING && buf[0] != BSER_UTF8STRING)) {
+    PyErr_Format(PyExc_ValueError, "invalid prefix string in bser data");
+    return 0;
+  }
+  *is_bytestring = buf[0] == BSER_BYTESTRING;
+
+  if (!bunser_bytestring(&buf, end, &start, &len)) {
+    return 0;
+  }
+
+  if (shared + len > prefix->cap) {
+    int64_t cap = shared + len < 256 ? 256 : (shared + len) * 2;
+    char* grown = realloc(prefix->buf, (size_t)cap);
+    if (!grown) {
+      PyErr_NoMemory();
+      return 0;
+    }
+    prefix->buf = grown;
+    prefix->cap = cap;
+  }
+  memcpy(prefix->buf + shared, start, (size_t)len);
+  prefix->len = shared + len;
+
+  *ptr = buf;
+  return 1;
+}
+
+// The bscan functions check that values are well formed and find where they
+// end.  They don't touch any Python state, so they can run with the GIL
+// released.
+
+static int bscan_int(const char** ptr, const char* end, int64_t* val) {
+  const char* buf = *ptr;
+  int8_t i8;
+  int16_t i16;
+  int32_t i32;
+
+  if (buf >= end) {
+    return 0;
+  }
+  switch (buf[0]) {
+    case BSER_INT8:
+      if (end - buf < 2) {
+        return 0;
+      }
+      memcpy(&i8, buf + 1, sizeof(i8));
+      *val = i8;
+      *ptr = buf + 2;
+      return 1;
+    case BSER_INT16:
+      if (end - buf < 3) {
+        return 0;
+      }
+      memcpy(&i16, buf + 1, sizeof(i16));
+      *val = i16;
+      *ptr = buf + 3;
+      return 1;
+    case BSER_INT32:
+      if (end - buf < 5) {
+        return 0;
+      }
+      memcpy(&i32, buf + 1, sizeof(i32));
+      *val = i32;
+      *ptr = buf + 5;
+      return 1;
+    case BSER_INT64:
+      if (end - buf < 9) {
+        return 0;
+      }
+      memcpy(val, buf + 1, sizeof(*val));
+      *ptr = buf + 9;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int bscan_value(const char** ptr, const char* end);
+
+// Each row holds a value or BSER_SKIP for each of nkeys keys
+static int
+bscan_rows(const char** ptr, const char* end, int64_t nkeys, int64_t nrows) {
+  const char* buf = *ptr;
+  int64_t i, keyidx;
+
+  for (i = 0; nkeys > 0 && i < nrows; i++) {
+    for (keyidx = 0; keyidx < nkeys; keyidx++) {
+      if (buf < end && buf[0] == BSER_SKIP) {
+        buf++;
+      } else if (!bscan_value(&buf, end)) {
+        return 0;
+      }
+    }
+  }
+  *ptr = buf;
+  return 1;
+}
+
+static int bscan_value(const char** ptr, const char* end) {
+  const char* buf = *ptr;
+  int64_t n, i;
+
+  if (buf >= end) {
+    return 0;
+  }
+  switch (buf[0]) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      return bscan_int(ptr, end, &n);
+
+    case BSER_REAL:
+      if (end - buf < 1 + (ptrdiff_t)sizeof(double)) {
+        return 0;
+      }
+      *ptr = buf + 1 + sizeof(double);
+      return 1;
+
+    case BSER_TRUE:
+    case BSER_FALSE:
+    case BSER_NULL:
+      *ptr = buf + 1;
+      return 1;
+
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING:
+      buf++;
+      if (!bscan_int(&buf, end, &n) || n < 0 || n > end - buf) {
+        return 0;
+      }
+      *ptr = buf + n;
+      return 1;
+
+    case BSER_PREFIXSTRING:
+      buf++;
+      if (!bscan_int(&buf, end, &n) || n < 0 || buf >= end ||
+          (buf[0] != BSER_BYTESTRING && buf[0] != BSER_UTF8STRING)) {
+        return 0;
+      }
+      *ptr = buf;
+      return bscan_value(ptr, end);
+
+    case BSER_ARRAY:
+    case BSER_OBJECT: {
+      // An object holds a key as well as a value for each of its n items
+      int is_object = buf[0] == BSER_OBJECT;
+
+      buf++;
+      if (!bscan_int(&buf, end, &n) || n < 0) {
+        return 0;
+      }
+      // Every value takes at least one byte, which bounds the loop
+      for (i = 0; i < n; i++) {
+        if ((is_object && !bscan_value(&buf, end)) ||
+            !bscan_value(&buf, end)) {
+          return 0;
+        }
+      }
+      *ptr = buf;
+      return 1;
+    }
+
+    case BSER_TEMPLATE: {
+      int64_t nkeys;
+
+      buf++;
+      if (buf >= end || buf[0] != BSER_ARRAY) {
+        return 0;
+      }
+      buf++;
+      if (!bscan_int(&buf, end, &nkeys) || nkeys < 0) {
+        return 0;
+      }
+      for (i = 0; i < nkeys; i++) {
+        if (!bscan_value(&buf, end)) {
+          return 0;
+        }
+      }
+      if (!bscan_int(&buf, end, &n) || n < 0 ||
+          !bscan_rows(&buf, end, nkeys, n)) {
+        return 0;
+      }
+      *ptr = buf;
+      return 1;
+    }
+
+    default:
+      return 0;
+  }
+}
+
 static PyObject*
 bunser_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   const char* buf = *ptr;
@@ -753,6 +977,96 @@ bunser_object(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   return res;
 }
 
+// Decodes the rows of a template into one list (or tuple) of values per
+// key, which saves making an object for every row
+static PyObject* bunser_template_columns(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    PyObject* keys,
+    Py_ssize_t numkeys,
+    Py_ssize_t nitems) {
+  const char* rows_end = *ptr;
+  PyObject* columns;
+  PyObject* res = NULL;
+  Py_ssize_t i, keyidx;
+  int ok;
+
+  // Check the rows before allocating anything for them, which also bounds
+  // nitems by the size of the input.  Other threads can run meanwhile.
+  Py_BEGIN_ALLOW_THREADS
+  ok = bscan_rows(&rows_end, end, numkeys, nitems);
+  Py_END_ALLOW_THREADS
+  if (!ok) {
+    PyErr_Format(PyExc_ValueError, "invalid template rows in bser data");
+    return NULL;
+  }
+
+  columns = PyTuple_New(numkeys);
+  if (!columns) {
+    return NULL;
+  }
+  for (keyidx = 0; keyidx < numkeys; keyidx++) {
+    PyObject* column =
+        ctx->mutable ? PyList_New(nitems) : PyTuple_New(nitems);
+    if (!column) {
+      goto bail;
+    }
+    PyTuple_SET_ITEM(columns, keyidx, column);
+  }
+
+  for (i = 0; numkeys > 0 && i < nitems; i++) {
+    for (keyidx = 0; keyidx < numkeys; keyidx++) {
+      PyObject* column = PyTuple_GET_ITEM(columns, keyidx);
+      PyObject* ele;
+
+      if (**ptr == BSER_SKIP) {
+        *ptr = *ptr + 1;
+        ele = Py_None;
+        Py_INCREF(ele);
+      } else {
+        ele = bser_loads_recursive(ptr, end, ctx);
+      }
+
+      if (!ele) {
+        goto bail;
+      }
+
+      // SET_ITEM steals the ref
+      if (ctx->mutable) {
+        PyList_SET_ITEM(column, i, ele);
+      } else {
+        PyTuple_SET_ITEM(column, i, ele);
+      }
+    }
+  }
+
+  if (ctx->mutable) {
+    res = PyDict_New();
+    for (keyidx = 0; res && keyidx < numkeys; keyidx++) {
+      if (PyDict_SetItem(
+              res,
+              PyList_GET_ITEM(keys, keyidx),
+              PyTuple_GET_ITEM(columns, keyidx))) {
+        Py_CLEAR(res);
+      }
+    }
+  } else {
+    bserObject* obj = PyObject_New(bserObject, &bserObjectType);
+    if (obj) {
+      obj->keys = keys;
+      Py_INCREF(obj->keys);
+      obj->values = columns;
+      Py_INCREF(obj->values);
+    }
+    res = (PyObject*)obj;
+  }
+
+bail:
+  Py_DECREF(columns);
+  return res;
+}
+
 static PyObject*
 bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   const char* buf = *ptr;
@@ -762,6 +1076,7 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   PyObject* keys;
   Py_ssize_t numkeys, keyidx;
   unser_ctx_t keys_ctx = {0};
+  keys_ctx.prefix = ctx->prefix;
   if (mutable) {
     keys_ctx.mutable = 1;
     // Decode keys as UTF-8 in this case.
@@ -802,6 +1117,13 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     return NULL;
   }
 
+  if (ctx->columns) {
+    arrval = bunser_template_columns(
+        ptr, end, ctx, keys, numkeys, (Py_ssize_t)nitems);
+    Py_DECREF(keys);
+    return arrval;
+  }
+
   arrval = PyList_New((Py_ssize_t)nitems);
   if (!arrval) {
     Py_DECREF(keys);
@@ -950,6 +1272,33 @@ static PyObject* bser_loads_recursive(
       return PyUnicode_Decode(start, (long)len, "utf-8", "strict");
     }
 
+    case BSER_PREFIXSTRING: {
+      int is_bytestring;
+
+      if (!bunser_prefix_string(ptr, end, ctx->prefix, &is_bytestring)) {
+        return NULL;
+      }
+
+      if (ctx->prefix->len > LONG_MAX) {
+        PyErr_Format(PyExc_ValueError, "string too long for python");
+        return NULL;
+      }
+
+      if (!is_bytestring) {
+        return PyUnicode_Decode(
+            ctx->prefix->buf, (long)ctx->prefix->len, "utf-8", "strict");
+      } else if (ctx->value_encoding != NULL) {
+        return PyUnicode_Decode(
+            ctx->prefix->buf,
+            (long)ctx->prefix->len,
+            ctx->value_encoding,
+            ctx->value_errors);
+      } else {
+        return PyBytes_FromStringAndSize(
+            ctx->prefix->buf, (long)ctx->prefix->len);
+      }
+    }
+
     case BSER_ARRAY:
       return bunser_array(ptr, end, ctx);
 
@@ -993,10 +1342,12 @@ static int _pdu_info_helper(
 
   if (bser_version == 2) {
     // Expect an integer telling us what capabilities are supported by the
-    // remote server (currently unused).
-    if (!memcpy(&bser_capabilities, &data, sizeof(bser_capabilities))) {
+    // remote server, and whether this PDU is compressed.
+    if (end - data < (ptrdiff_t)sizeof(bser_capabilities)) {
+      PyErr_SetString(PyExc_ValueError, "invalid bser header");
       return 0;
     }
+    memcpy(&bser_capabilities, data, sizeof(bser_capabilities));
     data += sizeof(bser_capabilities);
   }
 
@@ -1082,29 +1433,36 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   const char* value_encoding = NULL;
   const char* value_errors = NULL;
+  PyObject* columns_obj = NULL;
   unser_ctx_t ctx = {1, 0};
+  bser_prefix_t prefix = {NULL, 0, 0};
+  PyObject* result;
 
   static char* kw_list[] = {
-      "buf", "mutable", "value_encoding", "value_errors", NULL};
+      "buf", "mutable", "value_encoding", "value_errors", "columns", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "s#|Ozz:loads",
+          "s#|OzzO:loads",
           kw_list,
           &start,
           &datalen,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &columns_obj)) {
     return NULL;
   }
 
   if (mutable_obj) {
     ctx.mutable = PyObject_IsTrue(mutable_obj) > 0 ? 1 : 0;
   }
+  if (columns_obj) {
+    ctx.columns = PyObject_IsTrue(columns_obj) > 0 ? 1 : 0;
+  }
   ctx.value_encoding = value_encoding;
   if (value_encoding == NULL) {
     ctx.value_errors = NULL;
@@ -1133,7 +1491,10 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
     return NULL;
   }
 
-  return bser_loads_recursive(&data, end, &ctx);
+  ctx.prefix = &prefix;
+  result = bser_loads_recursive(&data, end, &ctx);
+  free(prefix.buf);
+  return result;
 }
 
 static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
@@ -1146,21 +1507,23 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   PyObject* value_encoding = NULL;
   PyObject* value_errors = NULL;
+  PyObject* columns_obj = NULL;
 
   static char* kw_list[] = {
-      "fp", "mutable", "value_encoding", "value_errors", NULL};
+      "fp", "mutable", "value_encoding", "value_errors", "columns", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "O|OOO:load",
+          "O|OOOO:load",
           kw_list,
           &fp,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &columns_obj)) {
     return NULL;
   }
 
@@ -1191,6 +1554,9 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   if (value_errors) {
     PyDict_SetItemString(load_method_kwargs, "value_errors", value_errors);
   }
+  if (columns_obj) {
+    PyDict_SetItemString(load_method_kwargs, "columns", columns_obj);
+  }
   string = PyObject_Call(load_method, load_method_args, load_method_kwargs);
   Py_DECREF(load_method_kwargs);
   Py_DECREF(load_method_args);
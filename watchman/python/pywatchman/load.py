@@ -42,7 +42,7 @@ def _read_bytes(fp, buf):
     return offset
 
 
-def load(fp, mutable=True, value_encoding=None, value_errors=None):
+def load(fp, mutable=True, value_encoding=None, value_errors=None, columns=False):
     """Deserialize a BSER-encoded blob.
 
     @param fp: The file-object to deserialize.
@@ -59,6 +59,13 @@ def load(fp, mutable=True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param columns: Whether to decode templated arrays, such as the files of
+                    a query result, into one sequence of values per field
+                    rather than one object per row.  The result maps each
+                    field to a list, or is an object with a tuple attribute
+                    per field if mutable is false.
+    @type columns: bool
     """
     buf = ctypes.create_string_buffer(8192)
     SNIFF_BUFFER_SIZE = len(EMPTY_HEADER)
@@ -81,4 +88,5 @@ def load(fp, mutable=True, value_encoding=None, value_errors=None):
         mutable,
         value_encoding,
         value_errors,
+        columns,
     )
@@ -31,6 +31,7 @@ BSER_NULL = b"\x0a"
 BSER_TEMPLATE = b"\x0b"
 BSER_SKIP = b"\x0c"
 BSER_UTF8STRING = b"\x0d"
+BSER_PREFIXSTRING = b"\x0e"
 
 if compat.PYTHON3:
     STRING_TYPES = (str, bytes)
@@ -293,9 +294,12 @@ class _BunserDict(object):
 
 
 class Bunser(object):
-    def __init__(self, mutable=True, value_encoding=None, value_errors=None):
+    def __init__(
+        self, mutable=True, value_encoding=None, value_errors=None, columns=False
+    ):
         self.mutable = mutable
         self.value_encoding = value_encoding
+        self.columns = columns
 
         if value_encoding is None:
             self.value_errors = None
@@ -304,6 +308,10 @@ class Bunser(object):
         else:
             self.value_errors = value_errors
 
+        # The last prefix string decoded, which the next one shares its
+        # leading bytes with
+        self.last_prefix = b""
+
     @staticmethod
     def unser_int(buf, pos):
         try:
@@ -343,6 +351,25 @@ class Bunser(object):
             # str_len stays the same because that's the length in bytes
         return (str_val, pos + str_len)
 
+    def unser_prefix_string(self, buf, pos):
+        shared, pos = self.unser_int(buf, pos + 1)
+        str_type = _buf_pos(buf, pos)
+        if (
+            shared < 0
+            or shared > len(self.last_prefix)
+            or str_type not in (BSER_BYTESTRING, BSER_UTF8STRING)
+        ):
+            raise ValueError("Invalid bser prefix string at position %s" % pos)
+        str_len, pos = self.unser_int(buf, pos + 1)
+        suffix = struct.unpack_from(tobytes(str_len) + b"s", buf, pos)[0]
+        str_val = self.last_prefix[:shared] + suffix
+        self.last_prefix = str_val
+        if str_type == BSER_UTF8STRING:
+            str_val = str_val.decode("utf-8")
+        elif self.value_encoding is not None:
+            str_val = str_val.decode(self.value_encoding, self.value_errors)
+        return (str_val, pos + str_len)
+
     def unser_array(self, buf, pos):
         arr_len, pos = self.unser_int(buf, pos + 1)
         arr = []
@@ -383,8 +410,12 @@ class Bunser(object):
             raise RuntimeError("Expect ARRAY to follow TEMPLATE")
         # force UTF-8 on keys
         keys_bunser = Bunser(mutable=self.mutable, value_encoding="utf-8")
+        keys_bunser.last_prefix = self.last_prefix
         keys, pos = keys_bunser.unser_array(buf, pos + 1)
+        self.last_prefix = keys_bunser.last_prefix
         nitems, pos = self.unser_int(buf, pos)
+        if self.columns:
+            return self.unser_template_columns(buf, pos, keys, nitems)
         arr = []
         for _ in range(nitems):
             if self.mutable:
@@ -411,6 +442,23 @@ class Bunser(object):
             arr.append(obj)
         return arr, pos
 
+    def unser_template_columns(self, buf, pos, keys, nitems):
+        columns = [[] for _ in keys]
+        for _ in range(nitems if keys else 0):
+            for column in columns:
+                if pos >= len(buf):
+                    raise ValueError("Invalid bser template rows, out of data")
+                if _buf_pos(buf, pos) == BSER_SKIP:
+                    pos += 1
+                    ele = None
+                else:
+                    ele, pos = self.loads_recursive(buf, pos)
+                column.append(ele)
+
+        if self.mutable:
+            return dict(zip(keys, columns)), pos
+        return _BunserDict(keys, tuple(tuple(c) for c in columns)), pos
+
     def loads_recursive(self, buf, pos):
         val_type = _buf_pos(buf, pos)
         if (
@@ -433,6 +481,8 @@ class Bunser(object):
             return self.unser_bytestring(buf, pos)
         elif val_type == BSER_UTF8STRING:
             return self.unser_utf8_string(buf, pos)
+        elif val_type == BSER_PREFIXSTRING:
+            return self.unser_prefix_string(buf, pos)
         elif val_type == BSER_ARRAY:
             return self.unser_array(buf, pos)
         elif val_type == BSER_OBJECT:
@@ -474,7 +524,7 @@ def pdu_len(buf):
     return info[2] + info[3]
 
 
-def loads(buf, mutable=True, value_encoding=None, value_errors=None):
+def loads(buf, mutable=True, value_encoding=None, value_errors=None, columns=False):
     """Deserialize a BSER-encoded blob.
 
     @param buf: The buffer to deserialize.
@@ -491,6 +541,13 @@ def loads(buf, mutable=True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param columns: Whether to decode templated arrays, such as the files of
+                    a query result, into one sequence of values per field
+                    rather than one object per row.  The result maps each
+                    field to a list, or is an object with a tuple attribute
+                    per field if mutable is false.
+    @type columns: bool
     """
 
     info = _pdu_info_helper(buf)
@@ -503,13 +560,16 @@ def loads(buf, mutable=True, value_encoding=None, value_errors=None):
         )
 
     bunser = Bunser(
-        mutable=mutable, value_encoding=value_encoding, value_errors=value_errors
+        mutable=mutable,
+        value_encoding=value_encoding,
+        value_errors=value_errors,
+        columns=columns,
     )
 
     return bunser.loads_recursive(buf, pos)[0]
 
 
-def load(fp, mutable=True, value_encoding=None, value_errors=None):
+def load(fp, mutable=True, value_encoding=None, value_errors=None, columns=False):
     from . import load
 
-    return load.load(fp, mutable, value_encoding, value_errors)
+    return load.load(fp, mutable, value_encoding, value_errors, columns)
@@ -66,6 +66,7 @@ setup(
     zip_safe=True,
     scripts=srcs(
         [
+            "bin/watchman-bench",
             "bin/watchman-make",
             "bin/watchman-wait",
             "bin/watchman-replicate-subscription",
@@ -375,6 +375,20 @@ class TestBSERDump(unittest.TestCase):
         for i in range(0, len(exp)):
             self.assertItemAttributes(exp[i], res[i])
 
+        dec = self.bser_mod.loads(templ, columns=True)
+        exp = {"name": [b"fred", b"pete", None], "age": [20, 30, 25]}
+        self.assertEqual(exp, dec)
+        res = self.bser_mod.loads(templ, False, columns=True)
+        self.assertEqual((b"fred", b"pete", None), res.name)
+        self.assertEqual((20, 30, 25), res["age"])
+
+        fp = FakeFile(templ)
+        self.assertEqual(exp, self.bser_mod.load(fp, columns=True))
+
+        # Claiming more rows than there are is rejected
+        short = templ.replace(b"\x61\x67\x65\x03\x03", b"\x61\x67\x65\x03\x05")
+        self.assertRaises(ValueError, self.bser_mod.loads, short, columns=True)
+
     def test_pdu_info(self):
         enc = self.bser_mod.dumps(1)
         DEFAULT_BSER_VERSION = 1
@@ -6,6 +6,7 @@
  */
 
 #include "watchman/query/FileResult.h"
+#include <system_error>
 
 namespace watchman {
 
@@ -19,4 +20,30 @@ std::optional<DType> FileResult::dtype() {
   return statInfo->dtype();
 }
 
+w_string FileResult::lowerCaseBaseName() {
+  return baseName().asLowerCase();
+}
+
+const void* FileResult::identity() const {
+  return nullptr;
+}
+
+std::optional<FileResult::FastContentHash> FileResult::getContentSpooky128() {
+  throw std::system_error(
+      std::make_error_code(std::errc::operation_not_supported),
+      "content.spooky128hex is not supported by this watcher");
+}
+
+std::optional<FileResult::FastContentHash> FileResult::getContentChunked128() {
+  throw std::system_error(
+      std::make_error_code(std::errc::operation_not_supported),
+      "content.chunked128hex is not supported by this watcher");
+}
+
+std::optional<FileResult::ContentHash> FileResult::getTreeSha1() {
+  throw std::system_error(
+      std::make_error_code(std::errc::operation_not_supported),
+      "content.treesha1hex is not supported by this watcher");
+}
+
 } // namespace watchman
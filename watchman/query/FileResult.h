@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <optional>
 #include <vector>
 #include "watchman/Clock.h"
@@ -42,6 +43,9 @@ class FileResult {
 
   // Returns the name of the file in its containing dir
   virtual w_string_piece baseName() = 0;
+  // Returns baseName(), lowercased, for case insensitive matching.  Views
+  // that keep a lowercased copy of each name return it without folding.
+  virtual w_string lowerCaseBaseName();
   // Returns the name of the containing dir relative to the
   // VFS root
   virtual w_string_piece dirName() = 0;
@@ -65,6 +69,20 @@ class FileResult {
   using ContentHash = std::array<uint8_t, 20>;
   virtual std::optional<ContentHash> getContentSha1() = 0;
 
+  // Returns the SpookyHash V2 128-bit hash of the file contents.  This is
+  // much cheaper to compute than the SHA-1 hash, but is not cryptographic.
+  // Views that don't support it throw.
+  using FastContentHash = std::array<uint8_t, 16>;
+  virtual std::optional<FastContentHash> getContentSpooky128();
+
+  // Returns the hash of the file's chunk tree; see ChunkTree.  Views that
+  // don't support it throw.
+  virtual std::optional<FastContentHash> getContentChunked128();
+
+  // Returns the digest of the tree below a dir; see DirTreeHashes.  Throws
+  // for files that aren't dirs, and views that don't support it throw.
+  virtual std::optional<ContentHash> getTreeSha1();
+
   // Maybe return the dtype.
   // Returns folly::none if the dtype is not currently known.
   // Returns DType::Unknown if we have dtype data but it doesn't
@@ -72,6 +90,12 @@ class FileResult {
   // on linux).
   virtual std::optional<DType> dtype();
 
+  // Returns a value that uniquely identifies the file among the results of
+  // the view that produced it, which lets dedup_results compare results
+  // without building their names.  Returns nullptr if the view has no such
+  // value, in which case results are compared by name.
+  virtual const void* identity() const;
+
   // A bitset of Property values
   using Properties = uint_least16_t;
 
@@ -103,6 +127,10 @@ class FileResult {
     SymlinkTarget = 1 << 8,
     // Need full stat metadata
     FullFileInformation = 1 << 9,
+    // The getContentSpooky128() method will be called
+    ContentSpooky128 = 1 << 10,
+    // The getContentChunked128() method will be called
+    ContentChunked128 = 1 << 11,
   };
 
   // Perform a batch fetch to fill in some missing data.
@@ -121,8 +149,12 @@ class FileResult {
   // batch.
   // The implementation of batchFetchProperties must clear
   // neededProperties_ to None.
+  // Implementations that fetch slowly changing data asynchronously, such as
+  // content hashes, stop waiting at `deadline` and fail the properties that
+  // are still outstanding with an error rather than stalling the query.
   virtual void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) = 0;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      std::chrono::steady_clock::time_point deadline) = 0;
 
  protected:
   // To be called by one of the FileResult accessors when it needs
@@ -141,7 +173,21 @@ class FileResult {
     return neededProperties_;
   }
 
+  // The name of this file relative to the root of the query, once
+  // QueryContext::computeWholeName has built it; null until then.
+  const w_string& cachedWholeName() const {
+    return wholeName_;
+  }
+
+  void setCachedWholeName(w_string wholeName) {
+    wholeName_ = std::move(wholeName);
+  }
+
  private:
+  // Kept with the file so that every term that matches on it and every
+  // field that renders it share one copy.
+  w_string wholeName_;
+
   // The implementation of FileResult will set appropriate
   // bits in neededProperties_ when its accessors are called
   // and the associated data is not available.
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobMatcher.h"
+#include <algorithm>
+#include <map>
+#include "watchman/query/GlobTree.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace watchman {
+
+/* An NFA item is a position in a pattern together with some context about
+ * how it was reached, all packed into 64 bits: the pattern number, the
+ * index of the next atom to match and a set of flags.
+ *
+ * The flags model wildmatch's WM_PERIOD checks, which depend on more than
+ * the next character:
+ *
+ * - kFresh: wildmatch starts a new (recursive) match at this point, and
+ *   will require a leading period to be matched literally.
+ * - kNeedsPeriod: the match started at a period that was consumed by
+ *   something other than a literal; wildmatch fails the match if it
+ *   reaches a star before the next literal.
+ * - kNoDot: the next character must not be a period.
+ */
+namespace {
+constexpr uint8_t kFresh = 1;
+constexpr uint8_t kNeedsPeriod = 2;
+constexpr uint8_t kNoDot = 4;
+
+inline uint64_t makeItem(uint32_t pattern, uint32_t atom, uint8_t flags) {
+  return (uint64_t(pattern) << 32) | (uint64_t(atom) << 8) | flags;
+}
+inline uint32_t itemPattern(uint64_t item) {
+  return item >> 32;
+}
+inline uint32_t itemAtom(uint64_t item) {
+  return (item >> 8) & 0xffffff;
+}
+inline uint8_t itemFlags(uint64_t item) {
+  return item & 0xff;
+}
+} // namespace
+
+struct GlobMatcher::Atom {
+  enum Kind : uint8_t {
+    // A single character: a literal, `?` or a bracket expression
+    Char,
+    // A literal `/` with WM_PATHNAME
+    Slash,
+    // `*`, which can't match `/` with WM_PATHNAME
+    Star,
+    // `*/` with WM_PATHNAME, which wildmatch handles specially.  It
+    // consumes everything up to and including the next `/`.
+    StarSlash,
+    // `**` with WM_PATHNAME, which is always followed by `/` or the end
+    DoubleStar,
+  };
+
+  Kind kind;
+  // For Char, whether it is a literal, which satisfies WM_PERIOD
+  bool literal{false};
+  // For Slash and DoubleStar, whether the pattern character after the
+  // slash is a literal period
+  bool nextIsDot{false};
+  // The characters that this atom consumes
+  std::bitset<256> chars;
+};
+
+size_t GlobMatcher::ItemSetHash::operator()(const ItemSet& set) const {
+  size_t hash = set.size();
+  for (auto item : set) {
+    hash ^= std::hash<uint64_t>()(item) + 0x9e3779b97f4a7c15ULL + (hash << 6) +
+        (hash >> 2);
+  }
+  return hash;
+}
+
+GlobMatcher::GlobMatcher(
+    const std::vector<std::string_view>& patterns,
+    int flags)
+    : flags_(flags) {
+  ItemSet initial;
+  uint8_t initialFlags = (flags_ & WM_PERIOD) ? kFresh : 0;
+  atoms_.resize(patterns.size());
+  for (uint32_t i = 0; i < patterns.size(); ++i) {
+    if (compile(patterns[i], atoms_[i])) {
+      initial.push_back(makeItem(i, 0, initialFlags));
+    } else {
+      atoms_[i].clear();
+      fallback_.emplace_back(std::string(patterns[i]), i);
+    }
+  }
+
+  // Partition the bytes by the atoms that accept them.  `/` and `.` have
+  // their own significance, so they always get a class of their own.
+  std::vector<const std::bitset<256>*> sets;
+  for (auto& atoms : atoms_) {
+    for (auto& atom : atoms) {
+      sets.push_back(&atom.chars);
+    }
+  }
+  std::map<std::vector<bool>, uint8_t> classes;
+  for (int c = 0; c < 256; ++c) {
+    std::vector<bool> signature;
+    signature.reserve(sets.size() + 2);
+    signature.push_back(c == '/');
+    signature.push_back(c == '.');
+    for (auto set : sets) {
+      signature.push_back(set->test(c));
+    }
+    auto it = classes.find(signature);
+    if (it == classes.end()) {
+      it = classes.emplace(std::move(signature), uint8_t(numClasses_)).first;
+      classRepresentative_[numClasses_] = uint8_t(c);
+      ++numClasses_;
+    }
+    byteClass_[c] = it->second;
+  }
+
+  // State 0 is the dead state
+  stateFor(ItemSet{});
+
+  ItemSet closure;
+  for (auto item : initial) {
+    addItem(item, closure);
+  }
+  start_ = stateFor(std::move(closure));
+}
+
+GlobMatcher::~GlobMatcher() = default;
+
+std::bitset<256> GlobMatcher::charsMatching(const std::string& atom) const {
+  // Asking wildmatch() about each byte in turn ensures that we agree with
+  // it on case folding and how bracket expressions are interpreted.
+  std::bitset<256> result;
+  auto flags = flags_ & (WM_CASEFOLD | WM_PATHNAME);
+  for (int c = 1; c < 256; ++c) {
+    char text[2] = {char(c), 0};
+    if (wildmatch(atom.c_str(), text, flags, nullptr) == WM_MATCH) {
+      result.set(c);
+    }
+  }
+  return result;
+}
+
+bool GlobMatcher::compile(std::string_view pattern, std::vector<Atom>& atoms) {
+  const bool pathname = flags_ & WM_PATHNAME;
+  const size_t len = pattern.size();
+
+  if (pattern.find('\\') != std::string_view::npos ||
+      pattern.find("//") != std::string_view::npos ||
+      pattern.find("[:") != std::string_view::npos ||
+      pattern.find('\0') != std::string_view::npos) {
+    return false;
+  }
+
+  size_t i = 0;
+  while (i < len) {
+    Atom atom;
+    auto c = pattern[i];
+
+    if (c == '*') {
+      auto end = i;
+      while (end < len && pattern[end] == '*') {
+        ++end;
+      }
+
+      if (pathname && end - i >= 2) {
+        // wildmatch only accepts ** as a whole path component
+        if ((i > 0 && pattern[i - 1] != '/') ||
+            (end < len && pattern[end] != '/')) {
+          return false;
+        }
+        atom.kind = Atom::DoubleStar;
+        atom.nextIsDot = end + 1 < len && pattern[end + 1] == '.';
+        atom.chars.set();
+        atom.chars.reset(0);
+        i = end;
+      } else if (pathname && end < len && pattern[end] == '/') {
+        atom.kind = Atom::StarSlash;
+        atom.chars.set();
+        atom.chars.reset(0);
+        i = end + 1;
+      } else {
+        atom.kind = Atom::Star;
+        atom.chars.set();
+        atom.chars.reset(0);
+        if (pathname) {
+          atom.chars.reset('/');
+        }
+        i = end;
+      }
+      atoms.push_back(std::move(atom));
+      continue;
+    }
+
+    if (c == '/' && pathname) {
+      atom.kind = Atom::Slash;
+      atom.nextIsDot = i + 1 < len && pattern[i + 1] == '.';
+      atom.chars.set('/');
+      atoms.push_back(std::move(atom));
+      ++i;
+      continue;
+    }
+
+    atom.kind = Atom::Char;
+    auto end = i + 1;
+    if (c == '[') {
+      // Find the end of the bracket expression the same way that
+      // wildmatch does.  The first character after the opening bracket
+      // (and negation) is never the closing bracket.
+      auto p = i + 1;
+      if (p < len && (pattern[p] == '!' || pattern[p] == '^')) {
+        ++p;
+      }
+      char prev = 0;
+      while (true) {
+        if (p >= len) {
+          // Unterminated; wildmatch never matches these
+          return false;
+        }
+        char cur = pattern[p];
+        if (cur == '-' && prev && p + 1 < len && pattern[p + 1] != ']') {
+          ++p;
+          cur = 0;
+        }
+        prev = cur;
+        ++p;
+        if (p < len && pattern[p] == ']') {
+          break;
+        }
+      }
+      end = p + 1;
+    } else {
+      atom.literal = c != '?';
+    }
+    atom.chars = charsMatching(std::string(pattern.substr(i, end - i)));
+    atoms.push_back(std::move(atom));
+    i = end;
+  }
+
+  return true;
+}
+
+void GlobMatcher::addItem(Item item, ItemSet& set, bool repeat) const {
+  const bool period = flags_ & WM_PERIOD;
+  auto pattern = itemPattern(item);
+  auto index = itemAtom(item);
+  auto flags = itemFlags(item);
+  auto& atoms = atoms_[pattern];
+
+  if (index == atoms.size()) {
+    set.push_back(item);
+    return;
+  }
+
+  auto& atom = atoms[index];
+  bool trailing = index + 1 == atoms.size();
+  // A recursive match that starts after this star, without it consuming
+  // anything, is only reached if wildmatch didn't reject the star
+  // because of a leading period.
+  uint8_t continuationFlags =
+      period ? ((flags & kFresh) ? kNoDot : kFresh) | (flags & kNoDot) : 0;
+
+  switch (atom.kind) {
+    case Atom::Char:
+    case Atom::Slash:
+    case Atom::StarSlash:
+      set.push_back(item);
+      return;
+
+    case Atom::Star:
+      if (flags & kNeedsPeriod) {
+        return;
+      }
+      set.push_back(item);
+      if (!trailing) {
+        addItem(makeItem(pattern, index + 1, continuationFlags), set);
+      }
+      return;
+
+    case Atom::DoubleStar:
+      if (!trailing && !repeat) {
+        // `**/` may match no directories at all, which wildmatch checks
+        // with a new match that skips over the slash when it first
+        // reaches the `**`.
+        addItem(
+            makeItem(
+                pattern,
+                index + 2,
+                period ? uint8_t(kFresh | (flags & kNoDot)) : 0),
+            set);
+      }
+      if (flags & kNeedsPeriod) {
+        return;
+      }
+      set.push_back(item);
+      if (!trailing) {
+        addItem(makeItem(pattern, index + 1, continuationFlags), set);
+      }
+      return;
+  }
+}
+
+GlobMatcher::State GlobMatcher::stateFor(ItemSet&& set) {
+  std::sort(set.begin(), set.end());
+  set.erase(std::unique(set.begin(), set.end()), set.end());
+
+  auto it = stateIndex_.find(set);
+  if (it != stateIndex_.end()) {
+    return it->second;
+  }
+
+  auto state = State(states_.size());
+  std::vector<uint32_t> accepts;
+  for (auto item : set) {
+    auto& atoms = atoms_[itemPattern(item)];
+    auto index = itemAtom(item);
+    if (index == atoms.size() ||
+        (index + 1 == atoms.size() &&
+         (atoms[index].kind == Atom::Star ||
+          atoms[index].kind == Atom::DoubleStar))) {
+      accepts.push_back(itemPattern(item));
+    }
+  }
+  accepts.erase(std::unique(accepts.begin(), accepts.end()), accepts.end());
+
+  stateIndex_.emplace(set, state);
+  states_.push_back(std::move(set));
+  accepts_.push_back(std::move(accepts));
+  transitions_.resize(transitions_.size() + numClasses_, kUnknownState);
+  return state;
+}
+
+GlobMatcher::State GlobMatcher::computeTransition(State state, uint8_t c) {
+  const bool period = flags_ & WM_PERIOD;
+  ItemSet next;
+
+  for (auto item : states_[state]) {
+    auto pattern = itemPattern(item);
+    auto index = itemAtom(item);
+    auto flags = itemFlags(item);
+    auto& atoms = atoms_[pattern];
+
+    if (index == atoms.size()) {
+      continue;
+    }
+    if ((flags & kNoDot) && c == '.') {
+      continue;
+    }
+
+    auto& atom = atoms[index];
+    if (!atom.chars.test(c)) {
+      continue;
+    }
+    // This character is the start of a match that needs a leading period
+    bool freshDot = (flags & kFresh) && c == '.';
+    uint8_t needsPeriod =
+        ((flags & kNeedsPeriod) || freshDot) ? kNeedsPeriod : 0;
+
+    switch (atom.kind) {
+      case Atom::Char:
+        addItem(
+            makeItem(pattern, index + 1, atom.literal ? 0 : needsPeriod),
+            next);
+        break;
+
+      case Atom::Slash:
+        addItem(
+            makeItem(
+                pattern, index + 1, period && !atom.nextIsDot ? kNoDot : 0),
+            next);
+        break;
+
+      case Atom::StarSlash:
+        if (c == '/') {
+          addItem(makeItem(pattern, index + 1, needsPeriod), next);
+        } else {
+          addItem(makeItem(pattern, index, needsPeriod), next);
+        }
+        break;
+
+      case Atom::Star:
+        if (!freshDot) {
+          addItem(makeItem(pattern, index, 0), next);
+        }
+        break;
+
+      case Atom::DoubleStar:
+        if (!freshDot) {
+          // wildmatch won't let ** continue into a directory whose name
+          // starts with a period, unless the pattern does too.
+          bool trailing = index + 1 == atoms.size();
+          addItem(
+              makeItem(
+                  pattern,
+                  index,
+                  period && c == '/' && !trailing && !atom.nextIsDot ? kNoDot
+                                                                     : 0),
+              next,
+              true);
+        }
+        break;
+    }
+  }
+
+  return stateFor(std::move(next));
+}
+
+GlobMatcher::State GlobMatcher::advance(State state, std::string_view text) {
+  for (auto ch : text) {
+    if (state == kDeadState) {
+      return state;
+    }
+    auto c = uint8_t(ch);
+    auto slot = state * numClasses_ + byteClass_[c];
+    auto next = transitions_[slot];
+    if (next == kUnknownState) {
+      next = computeTransition(state, classRepresentative_[byteClass_[c]]);
+      transitions_[slot] = next;
+    }
+    state = next;
+  }
+  return state;
+}
+
+void GlobMatcher::matches(
+    State state,
+    const char* text,
+    std::vector<uint32_t>& result) {
+  auto& accepts = accepts_[state];
+  if (fallback_.empty()) {
+    result.insert(result.end(), accepts.begin(), accepts.end());
+    return;
+  }
+
+  auto first = result.size();
+  result.insert(result.end(), accepts.begin(), accepts.end());
+  for (auto& [pattern, index] : fallback_) {
+    if (wildmatch(pattern.c_str(), text, flags_, nullptr) == WM_MATCH) {
+      result.push_back(index);
+    }
+  }
+  std::sort(result.begin() + first, result.end());
+}
+
+std::vector<uint32_t> GlobMatcher::match(const char* text) {
+  std::vector<uint32_t> result;
+  matches(advance(start_, text), text, result);
+  return result;
+}
+
+GlobTreeMatcher::Node& GlobTreeMatcher::get(const GlobTree* node) {
+  auto it = nodes_.find(node);
+  if (it != nodes_.end()) {
+    return it->second;
+  }
+
+  Node compiled;
+  std::vector<std::string_view> patterns;
+  for (auto& child : node->children) {
+    if (child->kind == GlobTree::Kind::Pattern) {
+      compiled.matchedChildren.push_back(child.get());
+      patterns.push_back(child->pattern);
+    } else if (!directLookups_ || child->had_specials) {
+      compiled.comparedChildren.push_back(child.get());
+    }
+  }
+  if (!patterns.empty()) {
+    compiled.children = std::make_unique<GlobMatcher>(patterns, flags_);
+  }
+
+  patterns.clear();
+  for (auto& child : node->doublestar_children) {
+    patterns.push_back(child->pattern);
+  }
+  compiled.doublestar =
+      std::make_unique<GlobMatcher>(patterns, flags_ | WM_PATHNAME);
+
+  return nodes_.emplace(node, std::move(compiled)).first->second;
+}
+
+} // namespace watchman
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace watchman {
+
+struct GlobTree;
+
+/**
+ * Matches text against a set of wildmatch patterns in a single pass.
+ *
+ * The patterns are compiled to an NFA whose transitions reproduce the
+ * behavior of wildmatch(), including its handling of WM_PERIOD, and the
+ * equivalent DFA is built lazily as text is matched.  Feeding text a piece
+ * at a time lets callers share the work for a common prefix, such as the
+ * directory portion of a path.
+ *
+ * Patterns that use backslash escapes, "[:class:]" expressions, repeated
+ * slashes or a malformed "**" are matched by calling wildmatch() instead.
+ *
+ * A GlobMatcher caches the DFA as it goes and so is not thread safe.  The
+ * cache grows by at most one state per distinct piece of text consumed.
+ */
+class GlobMatcher {
+ public:
+  using State = uint32_t;
+
+  /**
+   * `flags` are the wildmatch flags (WM_CASEFOLD, WM_PATHNAME, WM_PERIOD
+   * and WM_NOESCAPE) that apply to all of the patterns.
+   */
+  GlobMatcher(const std::vector<std::string_view>& patterns, int flags);
+  ~GlobMatcher();
+
+  GlobMatcher(const GlobMatcher&) = delete;
+  GlobMatcher& operator=(const GlobMatcher&) = delete;
+
+  /** The state before any text has been consumed. */
+  State start() const {
+    return start_;
+  }
+
+  /** Consumes `text` from `state`. */
+  State advance(State state, std::string_view text);
+
+  /**
+   * Returns true if nothing that follows the text consumed to reach `state`
+   * can result in a match.
+   */
+  bool isDead(State state) const {
+    return state == kDeadState && fallback_.empty();
+  }
+
+  /**
+   * Returns true if some patterns are matched by wildmatch(), in which case
+   * matches() needs the complete text.
+   */
+  bool hasFallbackPatterns() const {
+    return !fallback_.empty();
+  }
+
+  /**
+   * Appends to `result` the indices of the patterns that match `text`, in
+   * increasing order.  `state` must be the result of advancing from start()
+   * through the whole of `text`.  `text` must be NUL terminated, and is
+   * only examined if hasFallbackPatterns() is true.
+   */
+  void matches(State state, const char* text, std::vector<uint32_t>& result);
+
+  /** Convenience for matching the whole of `text` in one go. */
+  std::vector<uint32_t> match(const char* text);
+
+ private:
+  static constexpr State kDeadState = 0;
+  static constexpr State kUnknownState = ~State(0);
+
+  struct Atom;
+  using Item = uint64_t;
+  using ItemSet = std::vector<Item>;
+  struct ItemSetHash {
+    size_t operator()(const ItemSet& set) const;
+  };
+
+  bool compile(std::string_view pattern, std::vector<Atom>& atoms);
+  std::bitset<256> charsMatching(const std::string& atom) const;
+  // Adds item and the items reachable from it without consuming anything.
+  // `repeat` is set when a star consumes a character and stays put.
+  void addItem(Item item, ItemSet& set, bool repeat = false) const;
+  State stateFor(ItemSet&& set);
+  State computeTransition(State state, uint8_t c);
+
+  const int flags_;
+  // The compiled patterns, indexed by pattern number; the fallback patterns
+  // have no atoms.
+  std::vector<std::vector<Atom>> atoms_;
+  // Patterns that are matched with wildmatch(), and their indices
+  std::vector<std::pair<std::string, uint32_t>> fallback_;
+
+  // Bytes that no pattern distinguishes between share a column in the
+  // transition table.
+  uint8_t byteClass_[256];
+  uint8_t classRepresentative_[256];
+  size_t numClasses_{0};
+
+  State start_{kDeadState};
+  std::vector<ItemSet> states_;
+  std::vector<std::vector<uint32_t>> accepts_;
+  std::unordered_map<ItemSet, State, ItemSetHash> stateIndex_;
+  // numClasses_ entries per state
+  std::vector<State> transitions_;
+};
+
+/**
+ * Holds the GlobMatchers for the nodes of a GlobTree during the execution
+ * of a query.  They are compiled as the glob generator reaches each node.
+ */
+class GlobTreeMatcher {
+ public:
+  struct Node {
+    // The Prefix and Suffix children, and the Literal ones that aren't left
+    // to be looked up by name, which are compared with each name directly.
+    std::vector<const GlobTree*> comparedChildren;
+    // The Pattern children, in the order of their patterns in `children`,
+    // which is null if there are none.
+    std::vector<const GlobTree*> matchedChildren;
+    std::unique_ptr<GlobMatcher> children;
+    // Matches paths relative to the node against its doublestar_children
+    std::unique_ptr<GlobMatcher> doublestar;
+  };
+
+  /**
+   * `flags` are the wildmatch flags for the query.  If `directLookups` is
+   * true, children without wildcards are left for the caller to look up
+   * by name.
+   */
+  GlobTreeMatcher(int flags, bool directLookups)
+      : flags_(flags), directLookups_(directLookups) {}
+
+  Node& get(const GlobTree* node);
+
+  int flags() const {
+    return flags_;
+  }
+
+ private:
+  const int flags_;
+  const bool directLookups_;
+  std::unordered_map<const GlobTree*, Node> nodes_;
+};
+
+} // namespace watchman
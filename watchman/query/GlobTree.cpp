@@ -8,14 +8,79 @@
 #include "watchman/query/GlobTree.h"
 #include <folly/Conv.h>
 #include <folly/Range.h>
+#include <algorithm>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 namespace watchman {
 
+namespace {
+
+bool hasSpecials(std::string_view text) {
+  return text.find_first_of("*?[\\/") != std::string_view::npos;
+}
+
+// Like wildmatch(), only folds ASCII
+char foldCase(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+bool equalText(std::string_view a, std::string_view b, int flags) {
+  if (!(flags & WM_CASEFOLD)) {
+    return a == b;
+  }
+  return a.size() == b.size() &&
+      std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return foldCase(x) == foldCase(y);
+         });
+}
+
+} // namespace
+
 GlobTree::GlobTree(const char* pattern, uint32_t pattern_len)
     : pattern(pattern, pattern_len),
       is_leaf(0),
       had_specials(0),
-      is_doublestar(0) {}
+      is_doublestar(0) {
+  std::string_view name = this->pattern;
+  if (name.substr(0, 3) == "**/") {
+    name.remove_prefix(3);
+    if (name.empty()) {
+      return;
+    }
+  }
+  if (!hasSpecials(name)) {
+    kind = Kind::Literal;
+    literal = name;
+  } else if (name.front() == '*' && !hasSpecials(name.substr(1))) {
+    kind = Kind::Suffix;
+    literal = name.substr(1);
+  } else if (
+      name.back() == '*' && !hasSpecials(name.substr(0, name.size() - 1))) {
+    kind = Kind::Prefix;
+    literal = name.substr(0, name.size() - 1);
+  }
+}
+
+bool GlobTree::matchesName(std::string_view name, int flags) const {
+  switch (kind) {
+    case Kind::Literal:
+      return equalText(name, literal, flags);
+    case Kind::Prefix:
+      return name.size() >= literal.size() &&
+          equalText(name.substr(0, literal.size()), literal, flags);
+    case Kind::Suffix:
+      // A leading star doesn't match a leading period
+      if ((flags & WM_PERIOD) && !name.empty() && name.front() == '.') {
+        return false;
+      }
+      return name.size() >= literal.size() &&
+          equalText(name.substr(name.size() - literal.size()), literal, flags);
+    case Kind::Pattern:
+      break;
+  }
+  std::string text(name);
+  return wildmatch(pattern.c_str(), text.c_str(), flags, nullptr) == WM_MATCH;
+}
 
 std::vector<std::string> GlobTree::unparse() const {
   std::vector<std::string> result;
@@ -7,8 +7,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace watchman {
@@ -17,7 +19,27 @@ namespace watchman {
  * A node in the tree of node matching rules.
  */
 struct GlobTree {
+  /**
+   * The shape of the pattern, which decides how it is matched.  For a **
+   * node, this describes the part after a leading `**` and `/`, which
+   * then matches a name at any depth.
+   */
+  enum class Kind : uint8_t {
+    // No wildcards; the name must equal `literal`
+    Literal,
+    // `literal` followed by a single `*`
+    Prefix,
+    // A single `*` followed by `literal`
+    Suffix,
+    // Anything else, which needs a GlobMatcher
+    Pattern,
+  };
+
   std::string pattern;
+  Kind kind{Kind::Pattern};
+  // The text around the `*` of a Prefix or Suffix, or the whole name of a
+  // Literal
+  std::string literal;
 
   // The list of child rules, excluding any ** rules
   std::vector<std::unique_ptr<GlobTree>> children;
@@ -30,6 +52,11 @@ struct GlobTree {
 
   GlobTree(const char* pattern, uint32_t pattern_len);
 
+  // Matches a name against a node that isn't a ** node, with the
+  // wildmatch() flags of the query.  Literal, Prefix and Suffix are
+  // compared directly.
+  bool matchesName(std::string_view name, int flags) const;
+
   // Produces a list of globs from the glob tree, effectively
   // performing the reverse of the original parsing operation.
   std::vector<std::string> unparse() const;
@@ -6,6 +6,8 @@
  */
 
 #include "watchman/query/LocalFileResult.h"
+#include <algorithm>
+#include "watchman/ChunkedContentHash.h"
 #include "watchman/ContentHash.h"
 
 namespace watchman {
@@ -112,8 +114,27 @@ std::optional<FileResult::ContentHash> LocalFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
+std::optional<FileResult::FastContentHash>
+LocalFileResult::getContentSpooky128() {
+  if (contentSpooky128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentSpooky128);
+    return std::nullopt;
+  }
+  return contentSpooky128_.value();
+}
+
+std::optional<FileResult::FastContentHash>
+LocalFileResult::getContentChunked128() {
+  if (contentChunked128_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentChunked128);
+    return std::nullopt;
+  }
+  return contentChunked128_.value();
+}
+
 void LocalFileResult::batchFetchProperties(
-    const std::vector<std::unique_ptr<FileResult>>& files) {
+    const std::vector<std::unique_ptr<FileResult>>& files,
+    std::chrono::steady_clock::time_point /*deadline*/) {
   for (auto& f : files) {
     auto localFile = dynamic_cast<LocalFileResult*>(f.get());
     localFile->getInfo();
@@ -140,6 +161,27 @@ void LocalFileResult::batchFetchProperties(
       });
     }
 
+    if (localFile->neededProperties() &
+        FileResult::Property::ContentSpooky128) {
+      localFile->contentSpooky128_ = makeResultWith([&] {
+        auto hash = ContentHashCache::computeHashImmediate(
+            localFile->fullPath_.c_str(), ContentHashAlgorithm::Spooky128);
+        FileResult::FastContentHash result;
+        std::copy_n(hash.begin(), result.size(), result.begin());
+        return result;
+      });
+    }
+
+    if (localFile->neededProperties() &
+        FileResult::Property::ContentChunked128) {
+      localFile->contentChunked128_ = makeResultWith([&] {
+        uint64_t bytesRead = 0;
+        return ChunkedContentHashCache::hashFile(
+                   localFile->fullPath_.c_str(), nullptr, bytesRead)
+            .rootHash();
+      });
+    }
+
     localFile->clearNeededProperties();
   }
 }
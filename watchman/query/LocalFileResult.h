@@ -60,9 +60,14 @@ class LocalFileResult : public FileResult {
 
   // Returns the SHA-1 hash of the file contents
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  // Returns the SpookyHash V2 128-bit hash of the file contents
+  std::optional<FileResult::FastContentHash> getContentSpooky128() override;
+  // Returns the hash of the file's chunk tree
+  std::optional<FileResult::FastContentHash> getContentChunked128() override;
 
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      std::chrono::steady_clock::time_point deadline) override;
 
  private:
   void getInfo();
@@ -75,6 +80,8 @@ class LocalFileResult : public FileResult {
   CaseSensitivity caseSensitivity_;
   std::optional<w_string> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::FastContentHash> contentSpooky128_;
+  Result<FileResult::FastContentHash> contentChunked128_;
 };
 
 } // namespace watchman
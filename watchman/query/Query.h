@@ -10,9 +10,12 @@
 #include <optional>
 #include "watchman/Clock.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/QueryProfile.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
+class BserEncoder;
+
 namespace watchman {
 
 class FileResult;
@@ -23,6 +26,10 @@ class QueryExpr;
 struct QueryFieldRenderer {
   w_string name;
   std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+  // If set, appends the same value as `make` straight to a BSER encoder.
+  // Returns false, having appended nothing, if data needs to be loaded.
+  bool (*encode)(FileResult* file, const QueryContext* ctx, BserEncoder& out) =
+      nullptr;
 };
 
 class QueryFieldList : public std::vector<QueryFieldRenderer*> {
@@ -33,6 +40,19 @@ class QueryFieldList : public std::vector<QueryFieldRenderer*> {
    * Throws QueryParseError if the name is invalid.
    */
   void add(const w_string& name);
+
+  /**
+   * Returns true if every field can be encoded directly to BSER.
+   */
+  bool canEncodeBser() const;
+
+  // If set, encodes a whole row of these fields to BSER in one call, in
+  // place of the encode function of each field.  add() sets it for the
+  // most common lists of fields.  Returns false, having appended part of
+  // the row, if data needs to be loaded.
+  using RowEncoder =
+      bool (*)(FileResult* file, const QueryContext* ctx, BserEncoder& out);
+  RowEncoder encodeRow = nullptr;
 };
 
 struct QueryPath {
@@ -40,13 +60,46 @@ struct QueryPath {
   int depth;
 };
 
+// The order in which the results of a query are returned
+struct QueryOrder {
+  enum class Key { OTime, MTime, Size, Name };
+  Key key;
+  bool descending;
+};
+
+// Asks for totals over the matching files in place of a list of them
+struct QueryAggregate {
+  // If non-zero, totals are also kept for each distinct prefix of up to
+  // this many dir components of the names of the matching files
+  uint32_t groupByDepth{0};
+};
+
 struct Query {
   CaseSensitivity case_sensitive = CaseSensitivity::CaseInSensitive;
   bool fail_if_no_saved_state = false;
   bool empty_on_fresh_instance = false;
   bool omit_changed_files = false;
   bool dedup_results = false;
+  // Set if the names of the deduped results are needed in
+  // QueryResult::dedupedFileNames, which rules out deduping them by
+  // FileResult::identity().
+  bool capture_deduped_names = false;
   uint32_t bench_iterations = 0;
+  // If non-zero, the query command sends the results to the client in
+  // chunks of this many files as they are produced.
+  uint32_t stream_results = 0;
+  // If set, generators that walk whole subtrees may split the walk across
+  // the threads of the shared ThreadPool.
+  bool parallel = false;
+  // If set, a query that arrives during the initial crawl of the root runs
+  // at once against what has been crawled so far, rather than waiting for
+  // the crawl to finish.
+  bool allow_incomplete = false;
+  // If set, the execution of the query is profiled and the profile is
+  // returned with the results.  The terms of the expression are listed in
+  // profiledTerms in the order they appear in the query.
+  bool profile = false;
+  std::vector<ProfiledTerm> profiledTerms;
 
   /* optional full path to relative root, without and with trailing slash */
   w_string relative_root;
@@ -54,20 +107,40 @@ struct Query {
 
   std::optional<std::vector<QueryPath>> paths;
 
-  std::unique_ptr<GlobTree> glob_tree;
+  // The parsed parts of the query are shared by the copies handed out by
+  // w_query_parse_cached(), and aren't modified after parsing.
+  std::shared_ptr<GlobTree> glob_tree;
   // Additional flags to pass to wildmatch in the glob_generator
   int glob_flags{0};
+  // The lowercased suffixes of the suffix generator, when they can be looked
+  // up directly in place of matching glob_tree.  glob_tree is populated
+  // regardless, for views that don't index their files by suffix.
+  std::optional<std::vector<w_string>> suffixes;
 
   std::chrono::milliseconds sync_timeout{0};
   uint32_t lock_timeout{0};
+  // If non-zero, the content hashes and symlink targets that are still
+  // being fetched this long after the query started are returned as errors.
+  std::chrono::milliseconds fetch_timeout{0};
+  // If non-zero, the query fails if it is still running this long after it
+  // started
+  std::chrono::milliseconds deadline{0};
+  // If non-zero, the query stops once this many files have matched
+  uint64_t limit{0};
+  // If set, the results are sorted before they are returned, and a limit
+  // keeps the first files in this order rather than the first found.
+  std::optional<QueryOrder> order_by;
+  // If set, the query returns totals over the matching files instead of
+  // the files themselves
+  std::optional<QueryAggregate> aggregate;
 
   // We can't (and mustn't!) evaluate the clockspec
   // fully until we execute query, because we have
   // to evaluate named cursors and determine fresh
   // instance at the time we execute
-  std::unique_ptr<ClockSpec> since_spec;
+  std::shared_ptr<ClockSpec> since_spec;
 
-  std::unique_ptr<QueryExpr> expr;
+  std::shared_ptr<QueryExpr> expr;
 
   // The query that we parsed into this struct
   json_ref query_spec;
@@ -76,8 +149,18 @@ struct Query {
 
   w_string request_id;
   w_string subscriptionName;
+  // The command that issued the query, under which its latencies are
+  // recorded
+  w_string command;
   pid_t clientPid{0};
-
+  // Set by commands whose response will be sent as BSER.  If non-zero and
+  // the fieldList allows it, results are encoded for this BSER version as
+  // they are rendered, rather than being built up as json_ref values.
+  uint32_t bserVersion{0};
+  uint32_t bserCapabilities{0};
+
+  Query() = default;
+  Query(const Query&) = default;
   ~Query();
 
   /** Returns true if the supplied name is contained in
@@ -7,6 +7,9 @@
 
 #include "watchman/query/QueryContext.h"
 
+#include <algorithm>
+
+#include "watchman/Errors.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -39,20 +42,37 @@ std::optional<json_ref> file_result_to_json(
   return value;
 }
 
-} // namespace
-
-void QueryContext::resetWholeName() {
-  wholename_.reset();
+bool file_result_to_bser(
+    const QueryFieldList& fieldList,
+    const std::unique_ptr<FileResult>& file,
+    const QueryContext* ctx,
+    BserEncoder& out) {
+  if (fieldList.encodeRow) {
+    if (!fieldList.encodeRow(file.get(), ctx, out)) {
+      out.abandonElement();
+      return false;
+    }
+    out.finishElement();
+    return true;
+  }
+  for (auto& f : fieldList) {
+    if (!f->encode(file.get(), ctx, out)) {
+      // Need data to be loaded
+      out.abandonElement();
+      return false;
+    }
+  }
+  out.finishElement();
+  return true;
 }
 
-const w_string& QueryContext::getWholeName() {
-  if (!wholename_) {
-    wholename_ = computeWholeName(file.get());
+} // namespace
+
+const w_string& QueryContext::computeWholeName(FileResult* file) const {
+  if (file->cachedWholeName()) {
+    return file->cachedWholeName();
   }
-  return wholename_;
-}
 
-w_string QueryContext::computeWholeName(FileResult* file) const {
   uint32_t name_start;
 
   if (query->relative_root) {
@@ -66,10 +86,12 @@ w_string QueryContext::computeWholeName(FileResult* file) const {
   // Record the name relative to the root
   auto parent = file->dirName();
   if (name_start > parent.size()) {
-    return file->baseName().asWString();
+    file->setCachedWholeName(file->baseName().asWString());
+  } else {
+    parent.advance(name_start);
+    file->setCachedWholeName(w_string::build(parent, "/", file->baseName()));
   }
-  parent.advance(name_start);
-  return w_string::build(parent, "/", file->baseName());
+  return file->cachedWholeName();
 }
 
 bool QueryContext::dirMatchesRelativeRoot(w_string_piece fullDirectoryPath) {
@@ -111,7 +133,52 @@ QueryContext::QueryContext(
     : created(std::chrono::steady_clock::now()),
       query(q),
       root(root),
-      disableFreshInstance{disableFreshInstance} {}
+      disableFreshInstance{disableFreshInstance} {
+  if (q->bserVersion && q->fieldList.canEncodeBser()) {
+    bserResults =
+        std::make_unique<BserEncoder>(q->bserVersion, q->bserCapabilities);
+  }
+  if (q->profile) {
+    profile = std::make_unique<QueryProfile>(q->profiledTerms.size());
+  }
+}
+
+std::unique_ptr<QueryContext> QueryContext::createShard() const {
+  auto shard =
+      std::make_unique<QueryContext>(query, root, disableFreshInstance);
+  shard->clockAtStartOfQuery = clockAtStartOfQuery;
+  shard->lastAgeOutTickValueAtStartOfQuery = lastAgeOutTickValueAtStartOfQuery;
+  shard->since = since;
+  shard->cancelCheck = cancelCheck;
+  shard->created = created;
+  // The shard never renders anything
+  shard->bserResults.reset();
+  shard->collectMatches = true;
+  return shard;
+}
+
+void QueryContext::mergeShard(QueryContext& shard) {
+  bumpNumWalked(shard.getNumWalked());
+  shard.numWalked_ = 0;
+
+  if (profile && shard.profile) {
+    profile->merge(*shard.profile);
+    shard.profile =
+        std::make_unique<QueryProfile>(query->profiledTerms.size());
+  }
+
+  auto matched = std::move(shard.matches);
+  shard.matches.clear();
+  for (auto& file : matched) {
+    w_query_emit_file(this, std::move(file));
+  }
+
+  auto pending = std::move(shard.evalBatch_);
+  shard.evalBatch_.clear();
+  for (auto& file : pending) {
+    addToEvalBatch(std::move(file));
+  }
+}
 
 void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   evalBatch_.emplace_back(std::move(file));
@@ -119,7 +186,7 @@ void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   // Find a balance between local memory usage, latency in fetching
   // and the cost of fetching the data needed to re-evaluate this batch.
   // TODO: maybe allow passing this number in via the query?
-  if (evalBatch_.size() >= 20480) {
+  if (!collectMatches && evalBatch_.size() >= 20480) {
     fetchEvalBatchNow();
   }
 }
@@ -128,7 +195,11 @@ void QueryContext::fetchEvalBatchNow() {
   if (evalBatch_.empty()) {
     return;
   }
-  evalBatch_.front()->batchFetchProperties(evalBatch_);
+  if (profile) {
+    ++profile->evalBatchFetches;
+    profile->evalBatchFiles += evalBatch_.size();
+  }
+  evalBatch_.front()->batchFetchProperties(evalBatch_, fetchDeadline());
 
   auto toProcess = std::move(evalBatch_);
 
@@ -150,18 +221,123 @@ json_ref QueryContext::renderResults() {
   for (auto& result : resultsArray) {
     json_array_append_new(results, std::move(result));
   }
+  resultsArray.clear();
+
+  if (bserResults && bserResults->size() > 0) {
+    json_array_set_bser_rows(results, bserResults->release());
+  }
 
   return results;
 }
 
-void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
+void QueryContext::maybeFlushResults() {
+  auto numResults = getNumPendingResults();
+  if (resultsSink && numResults >= resultsChunkSize) {
+    resultsSink(renderResults());
+    numStreamedResults += numResults;
+  }
+}
+
+void QueryContext::addResult(json_ref&& rendered) {
+  resultsArray.push_back(std::move(rendered));
+  maybeFlushResults();
+}
+
+json_ref QueryContext::AggregateTotals::render() const {
+  auto totals = json_object(
+      {{"count", json_integer(count)},
+       {"deleted", json_integer(deleted)},
+       {"size", json_integer(size)}});
+  if (maxMtime) {
+    totals.set("max_mtime", json_integer(maxMtime->tv_sec));
+  }
+  return totals;
+}
+
+json_ref QueryContext::renderAggregate() const {
+  auto aggregate = aggregateTotals_.render();
+  if (query->aggregate->groupByDepth > 0) {
+    auto groups = json_object_of_size(aggregateGroups_.size());
+    for (auto& [prefix, totals] : aggregateGroups_) {
+      groups.set(prefix, totals.render());
+    }
+    aggregate.set("groups", std::move(groups));
+  }
+  return aggregate;
+}
+
+bool QueryContext::addToAggregate(const std::unique_ptr<FileResult>& file) {
+  auto exists = file->exists();
+  if (!exists.has_value()) {
+    return false;
+  }
+  std::optional<size_t> size;
+  std::optional<struct timespec> mtime;
+  if (*exists) {
+    size = file->size();
+    mtime = file->modifiedTime();
+    if (!size.has_value() || !mtime.has_value()) {
+      return false;
+    }
+  }
+
+  auto add = [&](AggregateTotals& totals) {
+    if (!*exists) {
+      ++totals.deleted;
+      return;
+    }
+    ++totals.count;
+    totals.size += *size;
+    if (!totals.maxMtime || mtime->tv_sec > totals.maxMtime->tv_sec ||
+        (mtime->tv_sec == totals.maxMtime->tv_sec &&
+         mtime->tv_nsec > totals.maxMtime->tv_nsec)) {
+      totals.maxMtime = mtime;
+    }
+  };
+  add(aggregateTotals_);
+
+  if (auto depth = query->aggregate->groupByDepth) {
+    // The first `depth` dir components of the name; files that aren't that
+    // deep are grouped under their whole dir
+    auto name = computeWholeName(file.get()).view();
+    size_t end = 0;
+    for (uint32_t i = 0; i < depth; ++i) {
+      auto slash = name.find('/', end == 0 ? 0 : end + 1);
+      if (slash == std::string_view::npos) {
+        break;
+      }
+      end = slash;
+    }
+    add(aggregateGroups_[w_string{name.substr(0, end)}]);
+  }
+  return true;
+}
+
+bool QueryContext::render(const std::unique_ptr<FileResult>& file) {
+  if (query->aggregate) {
+    return addToAggregate(file);
+  }
+  if (bserResults) {
+    if (!file_result_to_bser(query->fieldList, file, this, *bserResults)) {
+      return false;
+    }
+    maybeFlushResults();
+    return true;
+  }
+
   auto maybeRendered = file_result_to_json(query->fieldList, file, this);
-  if (maybeRendered.has_value()) {
-    resultsArray.push_back(std::move(maybeRendered.value()));
-    return;
+  if (!maybeRendered.has_value()) {
+    return false;
   }
+  addResult(std::move(maybeRendered.value()));
+  return true;
+}
 
-  addToRenderBatch(std::move(file));
+void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
+  checkCanceled();
+  if (!render(file)) {
+    addToRenderBatch(std::move(file));
+  }
 }
 
 void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
@@ -172,19 +348,151 @@ void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
   }
 }
 
+bool QueryContext::limitReached() const {
+  if (query->limit == 0 || numMatched < query->limit) {
+    return false;
+  }
+  // Files that wait in the eval batch may come before the later matches
+  return !query->order_by || (walkingInOrder && evalBatch_.empty());
+}
+
+void QueryContext::checkCanceledNow() const {
+  if (query->deadline.count() &&
+      std::chrono::steady_clock::now() >= created + query->deadline) {
+    throw QueryExecError(
+        "the query ran for longer than its deadline_ms of ",
+        query->deadline.count());
+  }
+  if (cancelCheck && cancelCheck()) {
+    throw QueryExecError("the query was canceled");
+  }
+}
+
+bool QueryContext::ordersByRecency() const {
+  return query->order_by && query->order_by->key == QueryOrder::Key::OTime &&
+      query->order_by->descending;
+}
+
+bool QueryContext::comesBefore(
+    const OrderedResult& a,
+    const OrderedResult& b) const {
+  const auto& order = *query->order_by;
+  if (a.value != b.value) {
+    return order.descending ? a.value > b.value : a.value < b.value;
+  }
+  // Ties are broken by name, which is the only value when ordering by name
+  if (order.key == QueryOrder::Key::Name && order.descending) {
+    return b.name < a.name;
+  }
+  return a.name < b.name;
+}
+
+bool QueryContext::insertOrdered(
+    std::unique_ptr<FileResult>& file,
+    bool force) {
+  std::optional<int64_t> value;
+  switch (query->order_by->key) {
+    case QueryOrder::Key::OTime:
+      if (auto otime = file->otime()) {
+        value = otime->ticks;
+      }
+      break;
+    case QueryOrder::Key::MTime:
+      if (auto mtime = file->modifiedTime()) {
+        value = int64_t(mtime->tv_sec) * 1000000000 + mtime->tv_nsec;
+      }
+      break;
+    case QueryOrder::Key::Size:
+      if (auto size = file->size()) {
+        value = int64_t(*size);
+      }
+      break;
+    case QueryOrder::Key::Name:
+      value = 0;
+      break;
+  }
+  if (!value.has_value() && !force) {
+    return false;
+  }
+
+  OrderedResult result{
+      value.value_or(0), computeWholeName(file.get()), std::move(file)};
+  auto before = [this](const OrderedResult& a, const OrderedResult& b) {
+    return comesBefore(a, b);
+  };
+  if (query->limit != 0 && ordered_.size() >= query->limit) {
+    if (!comesBefore(result, ordered_.front())) {
+      return true;
+    }
+    std::pop_heap(ordered_.begin(), ordered_.end(), before);
+    ordered_.back() = std::move(result);
+  } else {
+    ordered_.push_back(std::move(result));
+  }
+  std::push_heap(ordered_.begin(), ordered_.end(), before);
+  return true;
+}
+
+void QueryContext::addToOrderedResults(std::unique_ptr<FileResult>&& file) {
+  if (insertOrdered(file, false)) {
+    return;
+  }
+  orderBatch_.emplace_back(std::move(file));
+  if (orderBatch_.size() >= kMaximumRenderBatchSize) {
+    fetchOrderBatchNow();
+  }
+}
+
+void QueryContext::fetchOrderBatchNow() {
+  if (orderBatch_.empty()) {
+    return;
+  }
+  orderBatch_.front()->batchFetchProperties(orderBatch_, fetchDeadline());
+
+  auto toInsert = std::move(orderBatch_);
+  orderBatch_.clear();
+  for (auto& file : toInsert) {
+    insertOrdered(file, true);
+  }
+}
+
+void QueryContext::renderOrderedResults() {
+  fetchOrderBatchNow();
+
+  std::sort_heap(
+      ordered_.begin(),
+      ordered_.end(),
+      [this](const OrderedResult& a, const OrderedResult& b) {
+        return comesBefore(a, b);
+      });
+  auto toRender = std::move(ordered_);
+  ordered_.clear();
+  for (auto& result : toRender) {
+    maybeRender(std::move(result.file));
+  }
+}
+
+std::chrono::steady_clock::time_point QueryContext::fetchDeadline() const {
+  if (query->fetch_timeout.count() == 0) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return created + query->fetch_timeout;
+}
+
 bool QueryContext::fetchRenderBatchNow() {
   if (renderBatch_.empty()) {
     return true;
   }
-  renderBatch_.front()->batchFetchProperties(renderBatch_);
+  if (profile) {
+    ++profile->renderBatchFetches;
+    profile->renderBatchFiles += renderBatch_.size();
+  }
+  renderBatch_.front()->batchFetchProperties(renderBatch_, fetchDeadline());
 
   auto toProcess = std::move(renderBatch_);
 
   for (auto& file : toProcess) {
-    auto maybeRendered = file_result_to_json(query->fieldList, file, this);
-    if (maybeRendered.has_value()) {
-      resultsArray.push_back(std::move(maybeRendered.value()));
-    } else {
+    if (!render(file)) {
       renderBatch_.emplace_back(std::move(file));
     }
   }
@@ -10,7 +10,10 @@
 #include <folly/stop_watch.h>
 #include <unordered_set>
 #include "watchman/Clock.h"
+#include "watchman/ThreadAccounting.h"
+#include "watchman/bser.h"
 #include "watchman/query/QueryExpr.h"
+#include "watchman/query/QueryResult.h"
 
 struct watchman_file;
 
@@ -32,19 +35,23 @@ enum class QueryContextState {
 // Holds state for the execution of a query
 struct QueryContext : QueryContextBase {
   std::chrono::time_point<std::chrono::steady_clock> created;
-  folly::stop_watch<std::chrono::milliseconds> stopWatch;
+  folly::stop_watch<std::chrono::microseconds> stopWatch;
   std::atomic<QueryContextState> state{QueryContextState::NotStarted};
-  std::atomic<std::chrono::milliseconds> cookieSyncDuration{
-      std::chrono::milliseconds(0)};
-  std::atomic<std::chrono::milliseconds> viewLockWaitDuration{
-      std::chrono::milliseconds(0)};
-  std::atomic<std::chrono::milliseconds> generationDuration{
-      std::chrono::milliseconds(0)};
-  std::atomic<std::chrono::milliseconds> renderDuration{
-      std::chrono::milliseconds(0)};
+  std::atomic<std::chrono::microseconds> cookieSyncDuration{
+      std::chrono::microseconds(0)};
+  std::atomic<std::chrono::microseconds> viewLockWaitDuration{
+      std::chrono::microseconds(0)};
+  std::atomic<std::chrono::microseconds> generationDuration{
+      std::chrono::microseconds(0)};
+  std::atomic<std::chrono::microseconds> renderDuration{
+      std::chrono::microseconds(0)};
+  // The number of requests made to EdenFS on behalf of this query
+  std::atomic<uint64_t> numEdenRequests{0};
 
   void generationStarted() {
-    viewLockWaitDuration = stopWatch.lap();
+    auto lockWait = stopWatch.lap();
+    viewLockWaitDuration = lockWait;
+    ThreadAccount::recordWait(ThreadAccount::Lock, lockWait);
     state = QueryContextState::Generating;
   }
 
@@ -56,9 +63,26 @@ struct QueryContext : QueryContextBase {
   // Rendered results
   std::vector<json_ref> resultsArray;
 
+  // Set when the query asked for BSER and every field can be encoded
+  // directly, in which case results are appended here instead of to
+  // resultsArray.
+  std::unique_ptr<BserEncoder> bserResults;
+
+  // If set, resultsArray is handed to resultsSink whenever it reaches
+  // resultsChunkSize entries, instead of accumulating for the whole query.
+  QueryResultsSink resultsSink;
+  size_t resultsChunkSize{0};
+  // The number of results that have been passed to resultsSink
+  uint64_t numStreamedResults{0};
+
   // When deduping the results, set<wholename> of
   // the files held in results
   std::unordered_set<w_string> dedup;
+  // When deduping the results, the FileResult::identity() of the files
+  // held in results.  Used in place of dedup for the files that have one,
+  // unless the query captures the deduped names.  A query's results all
+  // come from one view, so the two sets never hold the same file.
+  std::unordered_set<const void*> dedupIdentities;
 
   // When unconditional_log_if_results_contain_file_prefixes is set
   // and one of those prefixes matches a file in the generated results,
@@ -69,9 +93,27 @@ struct QueryContext : QueryContextBase {
   // How many times we suppressed a result due to dedup checking
   uint32_t num_deduped{0};
 
+  // The number of files that matched, after dedup.  For a shard, only
+  // those that matched on the shard.
+  uint64_t numMatched{0};
+
+  // Set by a generator while it produces files in the query's order_by
+  // order, during which a limit lets it stop at the first files to match.
+  bool walkingInOrder{false};
+
   // Disable fresh instance queries
   bool disableFreshInstance{false};
 
+  // If set, polled by checkCanceled()
+  QueryCancelCheck cancelCheck;
+
+  // Set for the contexts that the workers of a parallel generator use.
+  // Matching files are collected in `matches` instead of being rendered,
+  // and files that need data loaded are held until mergeShard() instead of
+  // being fetched on the worker.
+  bool collectMatches{false};
+  std::vector<std::unique_ptr<FileResult>> matches;
+
   QueryContext(
       const Query* q,
       const std::shared_ptr<Root>& root,
@@ -79,6 +121,19 @@ struct QueryContext : QueryContextBase {
   QueryContext(const QueryContext&) = delete;
   QueryContext& operator=(const QueryContext&) = delete;
 
+  // The generators that ran, in the order that they ran, for the slow
+  // query log
+  std::vector<const char*> generators;
+
+  // Records that the generator `name` ran, also in the profile if the query
+  // is being profiled
+  void noteGenerator(const char* name) {
+    generators.push_back(name);
+    if (profile) {
+      profile->generators.push_back(name);
+    }
+  }
+
   // Increment numWalked_ by the specified amount
   inline void bumpNumWalked(int64_t amount = 1) {
     numWalked_ += amount;
@@ -88,14 +143,52 @@ struct QueryContext : QueryContextBase {
     return numWalked_;
   }
 
-  void resetWholeName();
+  // Returns true once as many files have matched as the query's limit
+  // allows.  Generators check this to stop walking, and no further files
+  // are evaluated.  An ordered query needs all of its matches to pick the
+  // first ones, unless they arrive in order.
+  bool limitReached() const;
+
+  // Throws QueryExecError if the query has passed its deadline or
+  // cancelCheck says it should stop.  Cheap enough to call for every file:
+  // the checks themselves are made once per kCancelCheckInterval calls.
+  void checkCanceled() {
+    if (++cancelCheckCalls_ % kCancelCheckInterval == 0) {
+      checkCanceledNow();
+    }
+  }
+
+  // Makes the checks of checkCanceled() without waiting for the interval
+  void checkCanceledNow() const;
+
+  static constexpr uint32_t kCancelCheckInterval = 1024;
+
+  // Returns true if the query is ordered by descending otime, which is the
+  // order of a view's recency list.
+  bool ordersByRecency() const;
+
+  /**
+   * Returns a context for a worker thread of a parallel generator.  The
+   * worker evaluates the query against its files using the shard, and
+   * the generator then passes the shard to mergeShard().
+   */
+  std::unique_ptr<QueryContext> createShard() const;
+
+  /**
+   * Takes the files that a shard has processed: its matches are deduped
+   * and rendered as results of this context, and the files that still
+   * need data are queued for evaluation here.
+   */
+  void mergeShard(QueryContext& shard);
 
   /**
    * Returns a shared reference to the wholename
    * of the file.  The caller must not delref
    * the reference.
    */
-  const w_string& getWholeName() override;
+  const w_string& getWholeName() override {
+    return computeWholeName(file.get());
+  }
 
   /**
    * Returns a JSON array containing the query results.
@@ -104,6 +197,28 @@ struct QueryContext : QueryContextBase {
    */
   json_ref renderResults();
 
+  /**
+   * Returns the totals of an aggregate query as a JSON object; see
+   * Query::aggregate.
+   */
+  json_ref renderAggregate() const;
+
+  // Appends a rendered result, streaming the accumulated chunk to
+  // resultsSink if it is full.
+  void addResult(json_ref&& rendered);
+
+  // Returns the number of results that have been rendered but not yet
+  // streamed.
+  size_t getNumPendingResults() const {
+    return resultsArray.size() + (bserResults ? bserResults->size() : 0);
+  }
+
+  // Returns the number of results produced so far, including those that
+  // have already been streamed.
+  uint64_t getNumResults() const {
+    return numStreamedResults + getNumPendingResults();
+  }
+
   // Adds `file` to the currently accumulating batch of files
   // that require data to be loaded.
   // If the batch is large enough, this will trigger `fetchEvalBatchNow()`.
@@ -117,15 +232,29 @@ struct QueryContext : QueryContextBase {
   void fetchEvalBatchNow();
 
   void maybeRender(std::unique_ptr<FileResult>&& file);
+
+  // Holds a matching file of an ordered query until renderOrderedResults().
+  // With a limit, only the first files in order are kept.
+  void addToOrderedResults(std::unique_ptr<FileResult>&& file);
+
+  // Sorts the files held by addToOrderedResults() and renders them.
+  void renderOrderedResults();
+
   void addToRenderBatch(std::unique_ptr<FileResult>&& file);
 
+  // Returns the time after which batch fetches give up on the properties
+  // that are still outstanding, as set by the query's fetch_timeout.
+  std::chrono::steady_clock::time_point fetchDeadline() const;
+
   // Perform a batch load of the items in the render batch,
   // and attempt to render those items again.
   // Returns true if the render batch is empty after rendering
   // the items, false if still more data is needed.
   bool fetchRenderBatchNow();
 
-  w_string computeWholeName(FileResult* file) const;
+  // Returns the name of file relative to the root of the query, building it
+  // the first time that it is asked for and caching it in file.
+  const w_string& computeWholeName(FileResult* file) const;
 
   // Returns true if the filename associated with `f` matches
   // the relative_root constraint set on the query.
@@ -145,11 +274,11 @@ struct QueryContext : QueryContextBase {
   bool dirMatchesRelativeRoot(w_string_piece fullDirectoryPath);
 
  private:
-  w_string wholename_;
-
   // Number of files considered as part of running this query
   int64_t numWalked_{0};
 
+  uint32_t cancelCheckCalls_{0};
+
   // Files for which we encountered NeedMoreData and that we
   // will re-evaluate once we have enough of them accumulated
   // to batch fetch the required data
@@ -160,6 +289,47 @@ struct QueryContext : QueryContextBase {
   // expression and are just pending data to be loaded
   // for rendering the result fields.
   std::vector<std::unique_ptr<FileResult>> renderBatch_;
+
+  struct OrderedResult {
+    int64_t value;
+    w_string name;
+    std::unique_ptr<FileResult> file;
+  };
+
+  // The matches of an ordered query, as a heap whose front is the last of
+  // them in order, so that a limit can cheaply evict it.
+  std::vector<OrderedResult> ordered_;
+
+  // Matches of an ordered query that need data loaded to be ordered
+  std::vector<std::unique_ptr<FileResult>> orderBatch_;
+
+  // Adds `file` to ordered_.  Returns false if data needs to be loaded
+  // first, unless `force`, in which case a missing value orders as zero.
+  bool insertOrdered(std::unique_ptr<FileResult>& file, bool force);
+  void fetchOrderBatchNow();
+  bool comesBefore(const OrderedResult& a, const OrderedResult& b) const;
+
+  // The totals of an aggregate query, overall and for each group
+  struct AggregateTotals {
+    // Matching files that exist, and those that were deleted
+    uint64_t count{0};
+    uint64_t deleted{0};
+    // The sum of the sizes and the latest mtime of the files that exist
+    uint64_t size{0};
+    std::optional<struct timespec> maxMtime;
+
+    json_ref render() const;
+  };
+  AggregateTotals aggregateTotals_;
+  std::unordered_map<w_string, AggregateTotals> aggregateGroups_;
+
+  // Renders `file` into resultsArray or bserResults.  Returns false if
+  // data needs to be loaded first.
+  bool render(const std::unique_ptr<FileResult>& file);
+  // Adds `file` to the totals of an aggregate query in place of render.
+  // Returns false if data needs to be loaded first.
+  bool addToAggregate(const std::unique_ptr<FileResult>& file);
+  void maybeFlushResults();
 };
 
 } // namespace watchman
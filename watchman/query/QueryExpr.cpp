@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryExpr.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace watchman {
+
+void MetadataFilter::intersect(const MetadataFilter& other) {
+  auto raise = [](auto& bound, const auto& otherBound) {
+    if (otherBound && (!bound || *otherBound > *bound)) {
+      bound = otherBound;
+    }
+  };
+  auto lower = [](auto& bound, const auto& otherBound) {
+    if (otherBound && (!bound || *otherBound < *bound)) {
+      bound = otherBound;
+    }
+  };
+
+  existing = existing || other.existing;
+  raise(changedAfterTicks, other.changedAfterTicks);
+  raise(changedSince, other.changedSince);
+  raise(modifiedSince, other.modifiedSince);
+  raise(statusChangedSince, other.statusChangedSince);
+  raise(minSize, other.minSize);
+  lower(maxSize, other.maxSize);
+  if (other.type) {
+    if (type && *type != *other.type) {
+      matchesNothing = true;
+    }
+    type = other.type;
+  }
+  matchesNothing = matchesNothing || other.matchesNothing;
+}
+
+namespace {
+
+class NotExpr : public QueryExpr {
+  std::unique_ptr<QueryExpr> expr;
+
+ public:
+  explicit NotExpr(std::unique_ptr<QueryExpr> other_expr)
+      : expr(std::move(other_expr)) {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    auto res = expr->evaluate(ctx, file);
+    if (!res.has_value()) {
+      return res;
+    }
+    return !*res;
+  }
+
+  ExprCost cost() const override {
+    return expr->cost();
+  }
+};
+
+class ListExpr : public QueryExpr {
+  bool allof;
+  std::vector<std::unique_ptr<QueryExpr>> exprs;
+
+ public:
+  ListExpr(bool isAll, std::vector<std::unique_ptr<QueryExpr>> exprs)
+      : allof(isAll), exprs(std::move(exprs)) {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    bool needData = false;
+
+    for (auto& expr : exprs) {
+      auto res = expr->evaluate(ctx, file);
+
+      if (!res.has_value()) {
+        needData = true;
+      } else if (!*res) {
+        if (allof) {
+          // Return NoMatch even if we have needData set, as allof
+          // requires that all terms match and this one doesn't,
+          // so we can avoid loading the data for prior terms
+          // in this list
+          return false;
+        }
+      } else {
+        // Matched
+
+        if (!allof) {
+          // Similar to the condition above, we can short circuit loading
+          // other data if this one matches for the anyof case.
+          return true;
+        }
+      }
+    }
+
+    if (needData) {
+      // We're not sure yet
+      return std::nullopt;
+    }
+    return allof;
+  }
+
+  // We may have to evaluate every term
+  ExprCost cost() const override {
+    auto result = ExprCost::Constant;
+    for (auto& expr : exprs) {
+      result = std::max(result, expr->cost());
+    }
+    return result;
+  }
+
+  std::optional<std::vector<w_string>> requiredSuffixes() const override {
+    return requiredStrings(&QueryExpr::requiredSuffixes);
+  }
+
+  std::optional<std::vector<w_string>> requiredNames() const override {
+    return requiredStrings(&QueryExpr::requiredNames);
+  }
+
+  std::optional<DType> requiredType() const override {
+    if (allof) {
+      for (auto& expr : exprs) {
+        if (auto type = expr->requiredType()) {
+          return type;
+        }
+      }
+      return std::nullopt;
+    }
+
+    // Otherwise every term must be restricted to the same type
+    std::optional<DType> result;
+    for (auto& expr : exprs) {
+      auto type = expr->requiredType();
+      if (!type || (result && *result != *type)) {
+        return std::nullopt;
+      }
+      result = type;
+    }
+    return result;
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    if (!allof) {
+      // The subtrees of the terms could be merged, but queries that list
+      // alternative dirs are better served by "path" generators
+      return std::nullopt;
+    }
+    for (auto& expr : exprs) {
+      if (auto dir = expr->requiredDir()) {
+        return dir;
+      }
+    }
+    return std::nullopt;
+  }
+
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase* ctx) const override {
+    if (!allof) {
+      // The bounds of the terms could be merged, but rarely to anything
+      // narrower than the whole root
+      return std::nullopt;
+    }
+    // Every bounded term narrows the whole list
+    std::optional<MetadataFilter> result;
+    for (auto& expr : exprs) {
+      if (auto filter = expr->requiredMetadata(ctx)) {
+        if (result) {
+          result->intersect(*filter);
+        } else {
+          result = filter;
+        }
+      }
+    }
+    return result;
+  }
+
+  // Combines the terms' answers to one of the required*() methods that
+  // return a set of strings
+  std::optional<std::vector<w_string>> requiredStrings(
+      std::optional<std::vector<w_string>> (QueryExpr::*required)() const)
+      const {
+    if (allof) {
+      // Any one restricted term restricts the whole list
+      for (auto& expr : exprs) {
+        if (auto strings = (expr.get()->*required)()) {
+          return strings;
+        }
+      }
+      return std::nullopt;
+    }
+
+    // Otherwise every term must be restricted, to the union of their sets
+    std::vector<w_string> result;
+    for (auto& expr : exprs) {
+      auto strings = (expr.get()->*required)();
+      if (!strings) {
+        return std::nullopt;
+      }
+      for (auto& str : *strings) {
+        if (std::find(result.begin(), result.end(), str) == result.end()) {
+          result.push_back(std::move(str));
+        }
+      }
+    }
+    return result;
+  }
+};
+
+} // namespace
+
+std::unique_ptr<QueryExpr> makeNotExpr(std::unique_ptr<QueryExpr> expr) {
+  return std::make_unique<NotExpr>(std::move(expr));
+}
+
+std::unique_ptr<QueryExpr> makeListExpr(
+    bool allof,
+    std::vector<std::unique_ptr<QueryExpr>> terms) {
+  // The result doesn't depend on the order of the terms, and evaluation
+  // stops at the first one that decides it, so try the cheapest first.
+  // This also brings terms of the same kind together, where they may be
+  // aggregated below.
+  std::stable_sort(
+      terms.begin(), terms.end(), [](const auto& a, const auto& b) {
+        return a->cost() < b->cost();
+      });
+
+  auto op = allof ? AggregateOp::AllOf : AggregateOp::AnyOf;
+  std::vector<std::unique_ptr<QueryExpr>> list;
+  list.reserve(terms.size());
+  for (auto& term : terms) {
+    if (list.empty()) {
+      list.emplace_back(std::move(term));
+    } else {
+      // Try to aggregate with previous expression
+      auto aggExpr = list.back().get()->aggregate(term.get(), op);
+      if (aggExpr) {
+        list.back() = std::move(aggExpr);
+      } else {
+        list.emplace_back(std::move(term));
+      }
+    }
+  }
+
+  return std::make_unique<ListExpr>(allof, std::move(list));
+}
+
+} // namespace watchman
@@ -8,7 +8,10 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 #include "watchman/Clock.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/query/QueryProfile.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -16,11 +19,53 @@ namespace watchman {
 using EvaluateResult = std::optional<bool>;
 class FileResult;
 
+// A subtree that contains every file that an expression can match: the
+// files of the dir `name`, relative to the query root, and of its
+// descendants up to `depth` levels below it.
+struct RequiredDir {
+  w_string name;
+  uint32_t depth;
+};
+
+/**
+ * Bounds on the metadata of the files that an expression can match.  A
+ * generator can check them against the view's dense copy of that metadata
+ * without visiting the files that fall outside of them, or follow the
+ * recency index only as far back as the bounds on when the files changed.
+ * Every bound must hold for a file to match.
+ */
+struct MetadataFilter {
+  // Only files that exist can match
+  bool existing{false};
+  // Only files whose otime ticks are after this can match
+  std::optional<uint32_t> changedAfterTicks;
+  // Only files whose otime timestamp is at least this can match
+  std::optional<int64_t> changedSince;
+  // Only files whose mtime, in seconds, is at least this can match
+  std::optional<int64_t> modifiedSince;
+  // Only files whose ctime, in seconds, is at least this can match
+  std::optional<int64_t> statusChangedSince;
+  // Only files whose size is within [minSize, maxSize] can match.  Sizes
+  // are only compared for files that exist, so the terms that bound them
+  // set `existing` too.
+  std::optional<int64_t> minSize;
+  std::optional<int64_t> maxSize;
+  // Only files of this type can match
+  std::optional<DType> type;
+  // Set when the bounds contradict each other, so no file can match
+  bool matchesNothing{false};
+
+  // Narrows these bounds to those of `other` as well, as "allof" does
+  void intersect(const MetadataFilter& other);
+};
+
 class QueryContextBase {
  public:
   // root number, ticks at start of query execution
   ClockSpec clockAtStartOfQuery;
   uint32_t lastAgeOutTickValueAtStartOfQuery;
+  // Set if the query asked for a profile
+  std::unique_ptr<QueryProfile> profile;
 
   virtual ~QueryContextBase() = default;
 
@@ -41,11 +86,71 @@ enum AggregateOp {
   AllOf,
 };
 
+/**
+ * A rough estimate of how expensive an expression is to evaluate, from
+ * cheapest to most expensive.  "allof" and "anyof" evaluate their terms in
+ * this order, so that cheap terms get the chance to decide the result before
+ * expensive ones are consulted.
+ */
+enum class ExprCost {
+  // Doesn't depend on the file at all
+  Constant,
+  // Compares the file's name
+  Name,
+  // Matches the file's name against a wildcard pattern
+  Pattern,
+  // Matches the file's name against a regular expression
+  Regex,
+  // Needs file metadata, which may have to be fetched before the
+  // expression can be decided
+  Metadata,
+};
+
 class QueryExpr {
  public:
   virtual ~QueryExpr() = default;
   virtual EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) = 0;
 
+  // Estimates the cost of evaluate().  Terms that don't say are assumed to
+  // need file metadata.
+  virtual ExprCost cost() const {
+    return ExprCost::Metadata;
+  }
+
+  // If this expression can only match files whose names have one of a set
+  // of suffixes, returns that set, lowercased.  Generators may use it to
+  // avoid visiting files that can't match.
+  virtual std::optional<std::vector<w_string>> requiredSuffixes() const {
+    return std::nullopt;
+  }
+
+  // If this expression can only match files whose names are one of a set of
+  // names, returns that set, lowercased.  The set must not repeat a name.
+  virtual std::optional<std::vector<w_string>> requiredNames() const {
+    return std::nullopt;
+  }
+
+  // If this expression can only match files of a single type, returns that
+  // type.  Like requiredSuffixes(), generators may use it to avoid visiting
+  // files that can't match.
+  virtual std::optional<DType> requiredType() const {
+    return std::nullopt;
+  }
+
+  // If this expression can only match files within a subtree, returns that
+  // subtree, so that generators can walk it rather than the whole root.
+  virtual std::optional<RequiredDir> requiredDir() const {
+    return std::nullopt;
+  }
+
+  // If this expression can only match files whose metadata is within some
+  // bounds, returns them.  The bounds may depend on the clock that the query
+  // started at, which is why this takes the query's context.
+  virtual std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase* /*ctx*/) const {
+    return std::nullopt;
+  }
+
   // If OTHER can be aggregated with THIS, returns a new expression instance
   // representing the combined state.  Op provides information on the containing
   // query and can be used to determine how aggregation is done.
@@ -57,4 +162,18 @@ class QueryExpr {
   }
 };
 
+/**
+ * Returns the negation of `expr`, which is unsure whenever `expr` is.
+ */
+std::unique_ptr<QueryExpr> makeNotExpr(std::unique_ptr<QueryExpr> expr);
+
+/**
+ * Returns an expression that matches if all (or, unless `allof`, any) of
+ * `terms` match.  The terms are evaluated cheapest first, by cost(), and
+ * adjacent terms that aggregate() are combined.
+ */
+std::unique_ptr<QueryExpr> makeListExpr(
+    bool allof,
+    std::vector<std::unique_ptr<QueryExpr>> terms);
+
 } // namespace watchman
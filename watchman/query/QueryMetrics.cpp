@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryMetrics.h"
+
+namespace watchman {
+
+namespace {
+
+json_ref histogramToJson(const LatencyHistogram& histogram) {
+  auto snap = histogram.snapshot();
+  return json_object({
+      {"count", json_integer(snap.count)},
+      {"p50-microseconds", json_integer(snap.percentile(0.5).count())},
+      {"p90-microseconds", json_integer(snap.percentile(0.9).count())},
+      {"p99-microseconds", json_integer(snap.percentile(0.99).count())},
+      {"max-microseconds", json_integer(snap.max.count())},
+  });
+}
+
+} // namespace
+
+void QueryMetrics::collectMetrics(
+    MetricsWriter& writer,
+    const MetricLabels& labels) const {
+  auto commands = commands_.rlock();
+  for (auto& [command, phases] : *commands) {
+    auto commandLabels = labels;
+    commandLabels.emplace_back("command", command.string());
+
+    auto addPhase = [&](const char* phase, const LatencyHistogram& histogram) {
+      auto snap = histogram.snapshot();
+      auto phaseLabels = commandLabels;
+      phaseLabels.emplace_back("phase", phase);
+      static const std::pair<double, const char*> quantiles[] = {
+          {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}};
+      for (auto& [quantile, name] : quantiles) {
+        auto quantileLabels = phaseLabels;
+        quantileLabels.emplace_back("quantile", name);
+        writer.add(
+            "watchman_query_latency_seconds",
+            MetricType::Gauge,
+            "Percentiles of the time spent in each phase of the queries",
+            quantileLabels,
+            snap.percentile(quantile).count() / 1e6);
+      }
+      return snap.count;
+    };
+    addPhase("cookie_sync", phases->cookieSync);
+    addPhase("view_lock_wait", phases->viewLockWait);
+    addPhase("generation", phases->generation);
+    addPhase("render", phases->render);
+    auto count = addPhase("total", phases->total);
+    writer.add(
+        "watchman_queries",
+        MetricType::Counter,
+        "Queries executed, by the command that issued them",
+        commandLabels,
+        count);
+  }
+}
+
+QueryMetrics::Phases& QueryMetrics::forCommand(const w_string& command) {
+  {
+    auto commands = commands_.rlock();
+    auto it = commands->find(command);
+    if (it != commands->end()) {
+      return *it->second;
+    }
+  }
+  auto commands = commands_.wlock();
+  auto& phases = (*commands)[command];
+  if (!phases) {
+    phases = std::make_unique<Phases>();
+  }
+  return *phases;
+}
+
+json_ref QueryMetrics::toJson() const {
+  auto result = json_object();
+  auto commands = commands_.rlock();
+  for (auto& [command, phases] : *commands) {
+    result.set(
+        command,
+        json_object({
+            {"cookie-sync", histogramToJson(phases->cookieSync)},
+            {"view-lock-wait", histogramToJson(phases->viewLockWait)},
+            {"generation", histogramToJson(phases->generation)},
+            {"render", histogramToJson(phases->render)},
+            {"total", histogramToJson(phases->total)},
+        }));
+  }
+  return result;
+}
+
+} // namespace watchman
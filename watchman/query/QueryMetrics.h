@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <memory>
+#include <unordered_map>
+#include "watchman/LatencyHistogram.h"
+#include "watchman/Metrics.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The latencies of the phases of the queries that a root has executed, kept
+ * separately for each of the commands that issued them.  These are reported
+ * by the `debug-metrics` command.
+ */
+class QueryMetrics {
+ public:
+  struct Phases {
+    // Only the queries that synchronized with the filesystem
+    LatencyHistogram cookieSync;
+    LatencyHistogram viewLockWait;
+    LatencyHistogram generation;
+    LatencyHistogram render;
+    // From the creation of the query context to the end of rendering
+    LatencyHistogram total;
+  };
+
+  // The histograms for `command`, which are created on first use
+  Phases& forCommand(const w_string& command);
+
+  /**
+   * Returns {command: {phase: {"count": n, "p50-microseconds": ...}}} with
+   * the 50th, 90th and 99th percentiles and the maximum of each phase.
+   */
+  json_ref toJson() const;
+
+  // Adds the query counts and latency percentiles to `writer`
+  void collectMetrics(MetricsWriter& writer, const MetricLabels& labels) const;
+
+ private:
+  folly::Synchronized<std::unordered_map<w_string, std::unique_ptr<Phases>>>
+      commands_;
+};
+
+} // namespace watchman
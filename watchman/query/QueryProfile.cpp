@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryProfile.h"
+#include "watchman/query/QueryExpr.h"
+
+namespace watchman {
+
+namespace {
+
+class ProfiledExpr : public QueryExpr {
+ public:
+  ProfiledExpr(size_t index, std::unique_ptr<QueryExpr> inner)
+      : index_(index), inner_(std::move(inner)) {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    if (!ctx->profile) {
+      return inner_->evaluate(ctx, file);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = inner_->evaluate(ctx, file);
+    auto& term = ctx->profile->terms[index_];
+    term.duration += std::chrono::steady_clock::now() - start;
+    ++term.evaluations;
+    if (!result.has_value()) {
+      ++term.deferred;
+    } else if (*result) {
+      ++term.matched;
+    }
+    return result;
+  }
+
+  ExprCost cost() const override {
+    return inner_->cost();
+  }
+
+  std::optional<std::vector<w_string>> requiredSuffixes() const override {
+    return inner_->requiredSuffixes();
+  }
+
+  std::optional<std::vector<w_string>> requiredNames() const override {
+    return inner_->requiredNames();
+  }
+
+  std::optional<DType> requiredType() const override {
+    return inner_->requiredType();
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    return inner_->requiredDir();
+  }
+
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    // Terms only recognize their own kind, so unwrap the other term.  The
+    // combined term is counted under this one.
+    auto profiledOther = dynamic_cast<const ProfiledExpr*>(other);
+    auto combined = inner_->aggregate(
+        profiledOther ? profiledOther->inner_.get() : other, op);
+    if (!combined) {
+      return nullptr;
+    }
+    return std::make_unique<ProfiledExpr>(index_, std::move(combined));
+  }
+
+ private:
+  size_t index_;
+  std::unique_ptr<QueryExpr> inner_;
+};
+
+} // namespace
+
+void QueryProfile::merge(const QueryProfile& other) {
+  for (size_t i = 0; i < terms.size() && i < other.terms.size(); ++i) {
+    terms[i].evaluations += other.terms[i].evaluations;
+    terms[i].matched += other.terms[i].matched;
+    terms[i].deferred += other.terms[i].deferred;
+    terms[i].duration += other.terms[i].duration;
+  }
+  evalBatchFetches += other.evalBatchFetches;
+  evalBatchFiles += other.evalBatchFiles;
+  renderBatchFetches += other.renderBatchFetches;
+  renderBatchFiles += other.renderBatchFiles;
+}
+
+json_ref QueryProfile::render(
+    const std::vector<ProfiledTerm>& profiledTerms) const {
+  auto generatorList = json_array();
+  for (auto name : generators) {
+    json_array_append_new(
+        generatorList, typed_string_to_json(name, W_STRING_UNICODE));
+  }
+
+  auto termList = json_array();
+  for (size_t i = 0; i < terms.size() && i < profiledTerms.size(); ++i) {
+    auto& term = terms[i];
+    json_array_append_new(
+        termList,
+        json_object({
+            {"term", w_string_to_json(profiledTerms[i].name)},
+            {"depth", json_integer(profiledTerms[i].depth)},
+            {"evaluations", json_integer(term.evaluations)},
+            {"matched", json_integer(term.matched)},
+            {"deferred", json_integer(term.deferred)},
+            {"true_rate",
+             json_real(
+                 term.evaluations ? double(term.matched) / term.evaluations
+                                  : 0.0)},
+            {"microseconds",
+             json_integer(
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     term.duration)
+                     .count())},
+        }));
+  }
+
+  return json_object({
+      {"generators", generatorList},
+      {"terms", termList},
+      {"eval_batch_fetches", json_integer(evalBatchFetches)},
+      {"eval_batch_files", json_integer(evalBatchFiles)},
+      {"render_batch_fetches", json_integer(renderBatchFetches)},
+      {"render_batch_files", json_integer(renderBatchFiles)},
+  });
+}
+
+std::unique_ptr<QueryExpr> makeProfiledExpr(
+    size_t index,
+    std::unique_ptr<QueryExpr> expr) {
+  return std::make_unique<ProfiledExpr>(index, std::move(expr));
+}
+
+} // namespace watchman
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class QueryExpr;
+
+// A term of a query that asked for a profile
+struct ProfiledTerm {
+  w_string name;
+  // How deeply the term is nested in the expression; the outermost is 0
+  uint32_t depth;
+};
+
+/**
+ * Statistics gathered while executing a query that set "profile", so that
+ * the cost of a slow query can be attributed to its generators, its terms
+ * or the data that had to be fetched for them.
+ */
+struct QueryProfile {
+  struct Term {
+    uint64_t evaluations{0};
+    // Evaluations that matched the file
+    uint64_t matched{0};
+    // Evaluations that needed data to be fetched before they could decide
+    uint64_t deferred{0};
+    // Includes the time spent evaluating nested terms
+    std::chrono::nanoseconds duration{0};
+  };
+
+  explicit QueryProfile(size_t numTerms) : terms(numTerms) {}
+
+  // The generators that ran, in the order that they ran
+  std::vector<const char*> generators;
+  // Indexed like Query::profiledTerms
+  std::vector<Term> terms;
+  // Calls to batchFetchProperties, and the files they fetched for
+  uint64_t evalBatchFetches{0};
+  uint64_t evalBatchFiles{0};
+  uint64_t renderBatchFetches{0};
+  uint64_t renderBatchFiles{0};
+
+  // Adds in the counts from the shard of a parallel generator
+  void merge(const QueryProfile& other);
+
+  // Renders the counts, labelling the terms from `profiledTerms`
+  json_ref render(const std::vector<ProfiledTerm>& profiledTerms) const;
+};
+
+/**
+ * Wraps `expr` so that its evaluations are counted in the profile of the
+ * executing query, under the term at `index`.
+ */
+std::unique_ptr<QueryExpr> makeProfiledExpr(
+    size_t index,
+    std::unique_ptr<QueryExpr> expr);
+
+} // namespace watchman
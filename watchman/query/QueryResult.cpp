@@ -14,9 +14,14 @@ json_ref QueryDebugInfo::render() const {
   for (auto& fn : cookieFileNames) {
     json_array_append(arr, w_string_to_json(fn));
   }
-  return json_object({
+  auto result = json_object({
       {"cookie_files", arr},
+      {"eden_requests", json_integer(numEdenRequests)},
   });
+  if (profile) {
+    result.set("profile", json_ref(profile));
+  }
+  return result;
 }
 
 } // namespace watchman
@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <functional>
 #include <unordered_set>
 #include <vector>
 #include "watchman/Clock.h"
@@ -17,6 +18,10 @@ namespace watchman {
 
 struct QueryDebugInfo {
   std::vector<w_string> cookieFileNames;
+  // The number of requests made to EdenFS while executing the query
+  uint64_t numEdenRequests{0};
+  // Set if the query asked for a profile
+  json_ref profile;
 
   json_ref render() const;
 };
@@ -24,7 +29,16 @@ struct QueryDebugInfo {
 struct QueryResult {
   bool isFreshInstance;
   json_ref resultsArray;
-  // Only populated if the query was set to dedup_results
+  // The totals of an aggregate query, in place of resultsArray
+  json_ref aggregate;
+  // Set if as many files matched as the query's limit, in which case more
+  // files may have matched
+  bool truncated{false};
+  // Set if the query ran against a view that the initial crawl had yet to
+  // complete; see Query::allow_incomplete
+  bool incomplete{false};
+  // Only populated if the query was set to dedup_results and
+  // capture_deduped_names
   std::unordered_set<w_string> dedupedFileNames;
   ClockSpec clockAtStartOfQuery;
   uint32_t stateTransCountAtStartOfQuery;
@@ -32,4 +46,13 @@ struct QueryResult {
   QueryDebugInfo debugInfo;
 };
 
+// Receives a rendered array of results when a query streams its results
+// rather than accumulating them in QueryResult::resultsArray.
+// Throwing from the sink aborts the query.
+using QueryResultsSink = std::function<void(json_ref&& files)>;
+
+// Polled while a query runs; returning true, such as when the client that
+// asked for the query has gone away, aborts it.
+using QueryCancelCheck = std::function<bool()>;
+
 } // namespace watchman
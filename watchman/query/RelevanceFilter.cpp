@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/RelevanceFilter.h"
+#include "watchman/query/QueryExpr.h"
+
+namespace watchman {
+
+bool RelevanceFilter::matches(
+    w_string_piece dirName,
+    w_string_piece baseName) const {
+  if (dir && dirName != dir &&
+      !(dirName.size() > dir.size() && dirName.startsWith(dir) &&
+        dirName[dir.size()] == '/')) {
+    return false;
+  }
+  if (suffixes) {
+    bool found = false;
+    for (const auto& suffix : *suffixes) {
+      if (baseName.hasSuffix(suffix)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  if (names) {
+    bool found = false;
+    for (const auto& name : *names) {
+      if (baseName.size() == name.size() &&
+          baseName.startsWithCaseInsensitive(name)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every result of a subscription changed since the clock of its last run,
+// whichever generator produced it, and has to satisfy the expression and
+// lie under the relative root.  So a filter derived from those alone can't
+// reject a file that the query would return.  The `paths` and `glob`
+// generators narrow the results further, but aren't taken into account,
+// which only makes the filter more permissive than it could be.
+std::optional<RelevanceFilter> RelevanceFilter::forQuery(
+    const w_string& rootPath,
+    const w_string& relativeRoot,
+    const QueryExpr* expr) {
+  RelevanceFilter filter;
+  bool constrained = false;
+
+  if (relativeRoot) {
+    filter.dir = relativeRoot;
+    constrained = true;
+  }
+  if (expr) {
+    if (auto required = expr->requiredDir()) {
+      filter.dir = w_string::pathCat(
+          {relativeRoot ? relativeRoot : rootPath, required->name});
+      constrained = true;
+    }
+    filter.suffixes = expr->requiredSuffixes();
+    filter.names = expr->requiredNames();
+    constrained = constrained || filter.suffixes || filter.names;
+  }
+
+  if (!constrained) {
+    return std::nullopt;
+  }
+  return filter;
+}
+
+} // namespace watchman
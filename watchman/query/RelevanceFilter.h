@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class QueryExpr;
+
+/**
+ * A cheap test of whether a changed file could be among the results of a
+ * subscription's query, so that the query needn't run when none of the
+ * files that changed since it last ran could be.  It must never reject a
+ * file that the query could match, but may accept files that it can't.
+ */
+struct RelevanceFilter {
+  // The full path of the dir that holds every file that can match
+  w_string dir;
+  // Matching files have one of these lowercased suffixes or names
+  std::optional<std::vector<w_string>> suffixes;
+  std::optional<std::vector<w_string>> names;
+
+  bool matches(w_string_piece dirName, w_string_piece baseName) const;
+
+  /**
+   * Derives the filter for a query on rootPath from the parts of it that
+   * constrain its results: its relativeRoot, which may be null, and the
+   * suffixes, names and subtree that its expr, if any, requires.  Returns
+   * nullopt if the query could match any file.
+   */
+  static std::optional<RelevanceFilter> forQuery(
+      const w_string& rootPath,
+      const w_string& relativeRoot,
+      const QueryExpr* expr);
+};
+
+} // namespace watchman
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/SlowQueryLog.h"
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+// Replaces a clock with the sort of clock that it is.  Named cursors are
+// kept since they identify the client.
+json_ref normalizeClock(const json_ref& clock) {
+  if (clock.isInt()) {
+    return typed_string_to_json("timestamp");
+  }
+  if (clock.isString()) {
+    if (json_to_w_string(clock).piece().startsWith("c:")) {
+      return typed_string_to_json("clock");
+    }
+  }
+  return clock;
+}
+
+} // namespace
+
+SlowQueryLog::SlowQueryLog(size_t capacity, w_string path)
+    : capacity_{capacity}, path_{std::move(path)} {}
+
+void SlowQueryLog::add(json_ref record) {
+  auto state = state_.lock();
+  ++state->numAdded;
+
+  if (!path_.empty()) {
+    if (!state->opened) {
+      state->opened = true;
+      try {
+        state->file = folly::File(
+            path_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+      } catch (const std::exception& exc) {
+        logf(
+            ERR,
+            "unable to open slow query log {}: {}; slow queries will only "
+            "be kept in memory\n",
+            path_,
+            exc.what());
+      }
+    }
+    if (state->file) {
+      auto line = json_dumps(record, JSON_COMPACT | JSON_SORT_KEYS);
+      line.push_back('\n');
+      if (folly::writeFull(state->file.fd(), line.data(), line.size()) !=
+          ssize_t(line.size())) {
+        logf(
+            ERR,
+            "unable to write to slow query log {}: {}\n",
+            path_,
+            folly::errnoStr(errno));
+        state->file.close();
+      }
+    }
+  }
+
+  if (capacity_ == 0) {
+    return;
+  }
+  if (state->entries.size() >= capacity_) {
+    state->entries.pop_front();
+  }
+  state->entries.push_back(std::move(record));
+}
+
+std::vector<json_ref> SlowQueryLog::entries() const {
+  auto state = state_.lock();
+  return {state->entries.begin(), state->entries.end()};
+}
+
+void SlowQueryLog::clear() {
+  state_.lock()->entries.clear();
+}
+
+uint64_t SlowQueryLog::numAdded() const {
+  return state_.lock()->numAdded;
+}
+
+json_ref SlowQueryLog::normalizeQuerySpec(const json_ref& spec) {
+  if (!spec) {
+    return json_null();
+  }
+  if (!spec.isObject()) {
+    return spec;
+  }
+  auto result = json_copy(spec);
+  auto& fields = result.object();
+  fields.erase(w_string{"request_id"});
+
+  auto since = fields.find(w_string{"since"});
+  if (since != fields.end()) {
+    if (since->second.isObject()) {
+      // An SCM-aware clock
+      auto scmSince = json_copy(since->second);
+      auto& scmFields = scmSince.object();
+      auto clock = scmFields.find(w_string{"clock"});
+      if (clock != scmFields.end()) {
+        clock->second = normalizeClock(clock->second);
+      }
+      auto scm = scmFields.find(w_string{"scm"});
+      if (scm != scmFields.end() && scm->second.isObject()) {
+        auto scmCopy = json_copy(scm->second);
+        scmCopy.object().erase(w_string{"mergebase"});
+        scm->second = std::move(scmCopy);
+      }
+      since->second = std::move(scmSince);
+    } else {
+      since->second = normalizeClock(since->second);
+    }
+  }
+  return result;
+}
+
+SlowQueryLog& getSlowQueryLog() {
+  // Meyer's singleton to hold this for the life of the process
+  static SlowQueryLog log = [] {
+    Configuration config;
+    return SlowQueryLog{
+        size_t(std::max<json_int_t>(
+            0, config.getInt("slow_query_log_size", 64))),
+        w_string{config.getString("slow_query_log_file", "")}};
+  }();
+  return log;
+}
+
+} // namespace watchman
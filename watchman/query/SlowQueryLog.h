@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/File.h>
+#include <folly/Synchronized.h>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Keeps a record of each of the most recent slow queries, so that the
+ * clients whose queries cost the daemon the most can be found after the
+ * fact.  Each record is a JSON object; see the slow_query_log_threshold_ms
+ * documentation for its fields.  If a path is given, every record is also
+ * appended to that file as a line of JSON.
+ *
+ * Thread safe.
+ */
+class SlowQueryLog {
+ public:
+  // Keeps the last `capacity` records in memory
+  SlowQueryLog(size_t capacity, w_string path);
+
+  void add(json_ref record);
+
+  // The records in memory, oldest first
+  std::vector<json_ref> entries() const;
+
+  // Forgets the records in memory; the file is left alone
+  void clear();
+
+  // The number of records added since the daemon started
+  uint64_t numAdded() const;
+
+  /**
+   * Returns a copy of the query spec that identifies the query but not
+   * when it ran: the request_id is dropped and a since clock is replaced by
+   * what sort of clock it is, so that the repeated queries of a client
+   * compare equal.
+   */
+  static json_ref normalizeQuerySpec(const json_ref& spec);
+
+ private:
+  struct State {
+    std::deque<json_ref> entries;
+    folly::File file;
+    bool opened{false};
+    uint64_t numAdded{0};
+  };
+
+  const size_t capacity_;
+  const w_string path_;
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+// The daemon's log, configured by slow_query_log_size and
+// slow_query_log_file when it is first used
+SlowQueryLog& getSlowQueryLog();
+
+} // namespace watchman
@@ -6,8 +6,10 @@
  */
 
 #include "watchman/query/TermRegistry.h"
+#include <folly/ScopeGuard.h>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
 
 namespace watchman {
@@ -36,6 +38,9 @@ static struct Init {
   }
 } init;
 
+// The nesting depth of the term being parsed, for profiled queries
+thread_local uint32_t profileParseDepth = 0;
+
 } // namespace
 
 QueryExprParser getQueryExprParser(const w_string& name) {
@@ -68,7 +73,20 @@ std::unique_ptr<QueryExpr> parseQueryExpr(Query* query, const json_ref& exp) {
     throw QueryParseError("expected array or string for an expression");
   }
 
-  return getQueryExprParser(name)(query, exp);
+  auto parser = getQueryExprParser(name);
+  if (!query->profile) {
+    return parser(query, exp);
+  }
+
+  // Terms are numbered before their nested terms are parsed, so that the
+  // profile lists each term ahead of the terms inside it
+  auto index = query->profiledTerms.size();
+  query->profiledTerms.push_back(ProfiledTerm{name, profileParseDepth});
+  ++profileParseDepth;
+  SCOPE_EXIT {
+    --profileParseDepth;
+  };
+  return makeProfiledExpr(index, parser(query, exp));
 }
 
 } // namespace watchman
@@ -11,6 +11,8 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/query/intcompare.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 
 using namespace watchman;
@@ -68,6 +70,51 @@ class DirNameExpr : public QueryExpr {
     return eval_int_compare(actual_depth, &depth);
   }
 
+  ExprCost cost() const override {
+    return ExprCost::Name;
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    // The view's dirs are looked up case sensitively
+    if (startswith != w_string_startswith) {
+      return std::nullopt;
+    }
+    // Empty path components or backslashes would make the dir lookup
+    // disagree with evaluate() about which files are inside dirname
+    auto name = dirname.data();
+    auto size = dirname.size();
+    for (size_t i = 0; i < size; ++i) {
+      if (name[i] == '\\') {
+        return std::nullopt;
+      }
+      if (name[i] == '/' && (i == 0 || i == size - 1 || name[i - 1] == '/')) {
+        return std::nullopt;
+      }
+    }
+
+    json_int_t maxDepth;
+    switch (depth.op) {
+      case W_QUERY_ICMP_EQ:
+      case W_QUERY_ICMP_LE:
+        maxDepth = depth.operand;
+        break;
+      case W_QUERY_ICMP_LT:
+        maxDepth = depth.operand - 1;
+        break;
+      default:
+        maxDepth = std::numeric_limits<uint32_t>::max();
+        break;
+    }
+    if (maxDepth < 0) {
+      // Nothing can match; let evaluate() say so
+      return std::nullopt;
+    }
+    return RequiredDir{
+        dirname,
+        uint32_t(std::min<json_int_t>(
+            maxDepth, std::numeric_limits<uint32_t>::max()))};
+  }
+
   // ["dirname", "foo"] -> ["dirname", "foo", ["depth", "ge", 0]]
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity case_sensitive) {
@@ -11,11 +11,14 @@
 #include "watchman/Errors.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Trace.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/SlowQueryLog.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 #include "watchman/scm/SCM.h"
@@ -44,16 +47,264 @@ const std::vector<w_string>& getUnconditionalLogFilePrefixes() {
       computeUnconditionalLogFilePrefixes();
   return names;
 }
+
+// Adds ctx->file, which matched the query, to the results
+void emitFile(QueryContext* ctx) {
+  // Files from the eval batch and from shards can arrive after the limit
+  // was reached.  An ordered query's limit is applied as it orders them.
+  if (!ctx->query->order_by && ctx->limitReached()) {
+    return;
+  }
+
+  if (ctx->query->dedup_results) {
+    auto identity = ctx->query->capture_deduped_names
+        ? nullptr
+        : ctx->file->identity();
+    bool inserted = identity
+        ? ctx->dedupIdentities.insert(identity).second
+        : ctx->dedup.insert(ctx->getWholeName()).second;
+    if (!inserted) {
+      // Already present in the results, no need to emit it again
+      ctx->num_deduped++;
+      return;
+    }
+  }
+
+  ++ctx->numMatched;
+
+  auto logPrefixes = getUnconditionalLogFilePrefixes();
+  if (!logPrefixes.empty()) {
+    auto name = ctx->getWholeName();
+    for (auto& prefix : logPrefixes) {
+      if (name.piece().startsWith(prefix)) {
+        ctx->namesToLog.push_back(name);
+      }
+    }
+  }
+
+  if (ctx->query->order_by) {
+    ctx->addToOrderedResults(std::move(ctx->file));
+  } else {
+    ctx->maybeRender(std::move(ctx->file));
+  }
+}
+
+// The full paths beneath which the query will find all of its results, if
+// it is restricted to a part of the root; see
+// QueryableView::addPriorityPaths.
+std::vector<w_string> priorityPathsForQuery(
+    const Query* query,
+    const std::shared_ptr<Root>& root) {
+  std::vector<w_string> result;
+  const auto& base =
+      query->relative_root ? query->relative_root : root->root_path;
+  if (query->paths && !query->since_spec && !query->glob_tree) {
+    for (auto& path : *query->paths) {
+      result.push_back(
+          path.name.empty() ? base : w_string::pathCat({base, path.name}));
+    }
+  } else if (query->relative_root) {
+    result.push_back(query->relative_root);
+  }
+  return result;
+}
+
+// Adds the dirs beneath which the glob patterns of `node`, relative to
+// `dir`, can match.  Literal names that lead to more patterns are followed,
+// and anything else needs all of `dir`.
+void addGlobMaterializePaths(
+    const GlobTree& node,
+    const w_string& dir,
+    std::vector<w_string>& result) {
+  bool needsDir = !node.doublestar_children.empty();
+  for (auto& child : node.children) {
+    if (child->had_specials || child->is_leaf) {
+      needsDir = true;
+    }
+  }
+  if (needsDir) {
+    result.push_back(dir);
+    return;
+  }
+  for (auto& child : node.children) {
+    w_string_piece name(child->pattern.data(), child->pattern.size());
+    addGlobMaterializePaths(*child, w_string::pathCat({dir, name}), result);
+  }
+}
+
+// Returns the full paths beneath which the query can find its results, so
+// that a lazily crawled view can crawl them first
+std::vector<w_string> materializePathsForQuery(
+    const Query* query,
+    const std::shared_ptr<Root>& root) {
+  const auto& base =
+      query->relative_root ? query->relative_root : root->root_path;
+  // The time generator, and the all files generator that runs when no other
+  // applies, consider everything under the base
+  if (query->since_spec || (!query->paths && !query->glob_tree)) {
+    return {base};
+  }
+  std::vector<w_string> result;
+  if (query->paths) {
+    for (auto& path : *query->paths) {
+      result.push_back(
+          path.name.empty() ? base : w_string::pathCat({base, path.name}));
+    }
+  }
+  if (query->glob_tree) {
+    addGlobMaterializePaths(*query->glob_tree, base, result);
+  }
+  return result;
+}
+
+// Warms the parts of the root that the query is restricted to in its
+// crawl heat map
+void recordQueriedPaths(Root& root, const std::vector<w_string>& paths) {
+  for (auto& path : paths) {
+    auto prefix = root.root_path.size() + 1;
+    if (path.size() > prefix) {
+      root.crawlHeat.touch(
+          w_string(path.data() + prefix, path.size() - prefix));
+    }
+  }
+}
+
+// Appends the root-relative paths of the files that the view saw change
+// after since, up to upTo.  Returns false if the view doesn't know them.
+bool appendChangedPaths(
+    const Root& root,
+    ClockPosition since,
+    ClockPosition upTo,
+    std::vector<w_string>& paths) {
+  auto known = root.view()->anyFileChangedBetween(
+      since, upTo, [&](w_string_piece dirName, w_string_piece baseName) {
+        auto fullPath = w_string::pathCat({dirName, baseName});
+        w_string_piece relPath(fullPath);
+        if (relPath.size() > root.root_path.size()) {
+          relPath.advance(root.root_path.size() + 1);
+          paths.push_back(relPath.asWString());
+        }
+        return false;
+      });
+  return known.has_value();
+}
+
+void recordQueryMetrics(const QueryContext& ctx, bool synced) {
+  auto& phases = ctx.root->queryMetrics.forCommand(
+      ctx.query->command ? ctx.query->command : w_string{"query"});
+  if (synced) {
+    phases.cookieSync.record(ctx.cookieSyncDuration.load());
+  }
+  phases.viewLockWait.record(ctx.viewLockWaitDuration.load());
+  phases.generation.record(ctx.generationDuration.load());
+  phases.render.record(ctx.renderDuration.load());
+  phases.total.record(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - ctx.created));
+}
+
+// Adds the query to the slow query log if it took long enough
+void maybeLogSlowQuery(const QueryContext& ctx) {
+  auto threshold = cfg_get_snapshot()->slowQueryLogThresholdMs;
+  auto total = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - ctx.created);
+  if (threshold < 0 || total < std::chrono::milliseconds(threshold)) {
+    return;
+  }
+
+  auto query = ctx.query;
+  auto generators = json_array_of_size(ctx.generators.size());
+  for (auto name : ctx.generators) {
+    generators.array().push_back(typed_string_to_json(name));
+  }
+  auto record = json_object({
+      {"time",
+       json_integer(std::chrono::system_clock::to_time_t(
+           std::chrono::system_clock::now()))},
+      {"root", w_string_to_json(ctx.root->root_path)},
+      {"command",
+       w_string_to_json(query->command ? query->command : w_string{"query"})},
+      {"client_pid", json_integer(query->clientPid)},
+      {"query", SlowQueryLog::normalizeQuerySpec(query->query_spec)},
+      {"generators", std::move(generators)},
+      {"files_walked", json_integer(ctx.getNumWalked())},
+      {"num_results", json_integer(ctx.getNumResults())},
+      {"num_deduped", json_integer(ctx.num_deduped)},
+      {"cookie_sync_us", json_integer(ctx.cookieSyncDuration.load().count())},
+      {"view_lock_wait_us",
+       json_integer(ctx.viewLockWaitDuration.load().count())},
+      {"generation_us", json_integer(ctx.generationDuration.load().count())},
+      {"render_us", json_integer(ctx.renderDuration.load().count())},
+      {"total_us", json_integer(total.count())},
+  });
+  if (query->request_id && !query->request_id.empty()) {
+    record.set("request_id", w_string_to_json(query->request_id));
+  }
+  getSlowQueryLog().add(std::move(record));
+}
 } // namespace
 
+// Returns the key for the result of the query in its root's
+// queryResultCache, or nullptr if the result can't be shared.  Only queries
+// whose result follows from their spec and the position of the view
+// qualify: not those with their own generator, which includes SCM-aware
+// queries, nor named cursors, which move with each query.  Streamed,
+// profiled and benchmarked queries are left alone too, as their responses
+// are about the execution as well as the files, and so are those with a
+// fetch_timeout, whose results lack the fields that took too long.
+w_string queryResultCacheKey(
+    const Query* query,
+    const QueryContext& ctx,
+    bool hasGenerator) {
+  if (hasGenerator || ctx.resultsSink || query->profile ||
+      query->bench_iterations > 0 || query->capture_deduped_names ||
+      query->fetch_timeout.count() != 0 || !query->query_spec ||
+      ctx.root->queryResultCacheSize == 0) {
+    return nullptr;
+  }
+  if (query->since_spec &&
+      (query->since_spec->tag == w_cs_named_cursor ||
+       query->since_spec->hasScmParams())) {
+    return nullptr;
+  }
+
+  // Sorting the keys means that specs that only differ by the order of
+  // their fields share an entry.  The options that don't affect the result
+  // at a given position are left out, so that clients that tag each query
+  // with its own request_id still share it.  The results are encoded for
+  // the client, so the encoding is part of the key too.
+  auto spec = query->query_spec;
+  if (spec.isObject()) {
+    spec = json_copy(spec);
+    auto& fields = spec.object();
+    for (auto name : {"request_id", "sync_timeout", "lock_timeout"}) {
+      fields.erase(w_string{name});
+    }
+  }
+  auto position = ctx.clockAtStartOfQuery.position();
+  return w_string::build(
+      json_dumps(spec, JSON_COMPACT | JSON_SORT_KEYS),
+      ":",
+      position.rootNumber,
+      ":",
+      position.ticks,
+      ":",
+      ctx.lastAgeOutTickValueAtStartOfQuery,
+      ":",
+      query->bserVersion,
+      ":",
+      query->bserCapabilities);
+}
+
 /* Query evaluator */
 void w_query_process_file(
     const Query* query,
     QueryContext* ctx,
     std::unique_ptr<FileResult> file) {
-  // TODO: Should this be implicit by assigning a file to the QueryContext? It
-  // could be cleared when resetting the file.
-  ctx->resetWholeName();
+  if (!query->order_by && ctx->limitReached()) {
+    return;
+  }
+  ctx->checkCanceled();
+
   ctx->file = std::move(file);
   SCOPE_EXIT {
     ctx->file.reset();
@@ -92,37 +343,41 @@ void w_query_process_file(
     }
   }
 
-  if (ctx->query->dedup_results) {
-    auto name = ctx->getWholeName();
-
-    auto inserted = ctx->dedup.insert(name);
-    if (!inserted.second) {
-      // Already present in the results, no need to emit it again
-      ctx->num_deduped++;
-      return;
-    }
+  if (ctx->collectMatches) {
+    // Each shard stops at the limit by itself; mergeShard() then applies
+    // it to the matches of all of them
+    ++ctx->numMatched;
+    ctx->matches.push_back(std::move(ctx->file));
+    return;
   }
 
-  auto logPrefixes = getUnconditionalLogFilePrefixes();
-  if (!logPrefixes.empty()) {
-    auto name = ctx->getWholeName();
-    for (auto& prefix : logPrefixes) {
-      if (name.piece().startsWith(prefix)) {
-        ctx->namesToLog.push_back(name);
-      }
-    }
-  }
+  emitFile(ctx);
+}
 
-  ctx->maybeRender(std::move(ctx->file));
+void w_query_emit_file(QueryContext* ctx, std::unique_ptr<FileResult> file) {
+  ctx->file = std::move(file);
+  SCOPE_EXIT {
+    ctx->file.reset();
+  };
+  emitFile(ctx);
 }
 
 void time_generator(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryContext* ctx) {
+  ctx->noteGenerator("since");
   root->view()->timeGenerator(query, ctx);
 }
 
+void change_set_generator(
+    const Query* query,
+    const std::shared_ptr<Root>& root,
+    QueryContext* ctx) {
+  ctx->noteGenerator("change_set");
+  root->view()->changeSetGenerator(query, ctx);
+}
+
 static void default_generators(
     const Query* query,
     const std::shared_ptr<Root>& root,
@@ -136,11 +391,13 @@ static void default_generators(
   }
 
   if (query->paths.has_value()) {
+    ctx->noteGenerator("path");
     root->view()->pathGenerator(query, ctx);
     generated = true;
   }
 
   if (query->glob_tree) {
+    ctx->noteGenerator(query->suffixes ? "suffix" : "glob");
     root->view()->globGenerator(query, ctx);
     generated = true;
   }
@@ -148,6 +405,7 @@ static void default_generators(
   // And finally, if there were no other generators, we walk all known
   // files
   if (!generated) {
+    ctx->noteGenerator("all");
     root->view()->allFilesGenerator(query, ctx);
   }
 }
@@ -167,7 +425,11 @@ static void execute_common(
   res->isFreshInstance =
       !ctx->since.is_timestamp && ctx->since.clock.is_fresh_instance;
 
+  // The cookie sync may have used up the deadline, or outlasted the client
+  ctx->checkCanceledNow();
+
   if (!(res->isFreshInstance && ctx->query->empty_on_fresh_instance)) {
+    TraceSpan span("query", "generation", ctx->query->command.view());
     if (!generator) {
       generator = default_generators;
     }
@@ -179,15 +441,22 @@ static void execute_common(
   // We may have some file results pending re-evaluation,
   // so make sure that we process them before we get to
   // the render phase below.
-  ctx->fetchEvalBatchNow();
-  while (!ctx->fetchRenderBatchNow()) {
-    // Depending on the implementation of the query terms and
-    // the field renderers, we may need to do a couple of fetches
-    // to get all that we need, so we loop until we get them all.
+  {
+    TraceSpan span("query", "render", ctx->query->command.view());
+    ctx->fetchEvalBatchNow();
+    if (ctx->query->order_by) {
+      ctx->renderOrderedResults();
+    }
+    while (!ctx->fetchRenderBatchNow()) {
+      // Depending on the implementation of the query terms and
+      // the field renderers, we may need to do a couple of fetches
+      // to get all that we need, so we loop until we get them all.
+    }
   }
 
   ctx->renderDuration = ctx->stopWatch.lap();
   ctx->state = QueryContextState::Completed;
+  res->debugInfo.numEdenRequests = ctx->numEdenRequests.load();
 
   // For Eden instances it is possible that when running the query it was
   // discovered that it is actually a fresh instance [e.g. mount generation
@@ -219,13 +488,36 @@ static void execute_common(
         json_object(
             {{"fresh_instance", json_boolean(res->isFreshInstance)},
              {"num_deduped", json_integer(ctx->num_deduped)},
-             {"num_results", json_integer(ctx->resultsArray.size())},
+             {"num_results", json_integer(ctx->getNumResults())},
              {"num_walked", json_integer(ctx->getNumWalked())},
              {"query", ctx->query->query_spec}}));
     sample->log();
   }
 
+  if (ctx->profile) {
+    auto profile = ctx->profile->render(ctx->query->profiledTerms);
+    profile.set({
+        {"files_walked", json_integer(ctx->getNumWalked())},
+        {"num_results", json_integer(ctx->getNumResults())},
+        {"num_deduped", json_integer(ctx->num_deduped)},
+        {"cookie_sync_microseconds",
+         json_integer(ctx->cookieSyncDuration.load().count())},
+        {"view_lock_wait_microseconds",
+         json_integer(ctx->viewLockWaitDuration.load().count())},
+        {"generation_microseconds",
+         json_integer(ctx->generationDuration.load().count())},
+        {"render_microseconds",
+         json_integer(ctx->renderDuration.load().count())},
+    });
+    res->debugInfo.profile = std::move(profile);
+  }
+
+  res->truncated =
+      ctx->query->limit != 0 && ctx->numMatched >= ctx->query->limit;
   res->resultsArray = ctx->renderResults();
+  if (ctx->query->aggregate) {
+    res->aggregate = ctx->renderAggregate();
+  }
   res->dedupedFileNames = std::move(ctx->dedup);
 }
 
@@ -236,7 +528,9 @@ QueryResult w_query_execute(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryGenerator generator,
-    SavedStateFactory savedStateFactory) {
+    SavedStateFactory savedStateFactory,
+    QueryResultsSink resultsSink,
+    QueryCancelCheck cancelCheck) {
   QueryResult res;
   ClockSpec resultClock(ClockPosition{});
   bool disableFreshInstance{false};
@@ -282,16 +576,28 @@ QueryResult w_query_execute(
       if (query->since_spec->hasSavedStateParams()) {
         // Find the most recent saved state to the new mergebase and return
         // changed files since that saved state, if available.
-        auto savedStateInterface = savedStateFactory(
-            query->since_spec->savedStateStorageType,
-            query->since_spec->savedStateConfig,
-            scm,
-            root->config,
-            [root](PerfSample& sample) {
-              root->addPerfSampleMetadata(sample);
-            });
-        auto savedStateResult = savedStateInterface->getMostRecentSavedState(
-            resultClock.scmMergeBase);
+        std::shared_ptr<const SavedStateInterface> savedStateInterface =
+            savedStateFactory(
+                query->since_spec->savedStateStorageType,
+                query->since_spec->savedStateConfig,
+                scm,
+                root->config,
+                [root](PerfSample& sample) {
+                  root->addPerfSampleMetadata(sample);
+                });
+        // This is usually ready already, having been prefetched when the
+        // merge base changed.
+        auto savedStateResult =
+            root->savedStates
+                .get(
+                    SavedStateCache::makeSourceKey(
+                        reinterpret_cast<const void*>(savedStateFactory),
+                        query->since_spec->savedStateStorageType,
+                        query->since_spec->savedStateConfig),
+                    std::move(savedStateInterface),
+                    resultClock.scmMergeBaseWith,
+                    resultClock.scmMergeBase)
+                .get();
         res.savedStateInfo = savedStateResult.savedStateInfo;
         if (savedStateResult.commitId) {
           resultClock.savedStateCommitId = savedStateResult.commitId;
@@ -318,22 +624,28 @@ QueryResult w_query_execute(
                         const Query* q,
                         const std::shared_ptr<Root>& r,
                         QueryContext* c) {
-          auto changedFiles =
-              root->view()->getSCM()->getFilesChangedSinceMergeBaseWith(
-                  modifiedMergebase, requestId);
-
-          auto pathList = json_array_of_size(changedFiles.size());
-          for (auto& f : changedFiles) {
-            json_array_append_new(pathList, w_string_to_json(f));
-          }
+          c->noteGenerator("scm");
+          // Subscriptions on a stable merge base only pay for what the view
+          // saw change since the last one ran.
+          auto changedFiles = r->scmChangedFiles.get(
+              modifiedMergebase,
+              c->clockAtStartOfQuery.position(),
+              [&] {
+                auto scm = root->view()->getSCM();
+                return scm->getFilesChangedSinceMergeBaseWith(
+                    modifiedMergebase, requestId);
+              },
+              [&](ClockPosition since,
+                  ClockPosition upTo,
+                  std::vector<w_string>& paths) {
+                return appendChangedPaths(*r, since, upTo, paths);
+              });
 
           auto spec = r->view()->getMostRecentRootNumberAndTickValue();
           w_clock_t clock{0, 0};
           clock.ticks = spec.ticks;
           time(&clock.timestamp);
-          for (auto& pathEntry : pathList.array()) {
-            auto path = json_to_w_string(pathEntry);
-
+          for (auto& path : *changedFiles) {
             auto fullPath = w_string::pathCat({r->root_path, path});
             if (!c->fileMatchesRelativeRoot(fullPath)) {
               continue;
@@ -374,6 +686,11 @@ QueryResult w_query_execute(
     };
   }
   QueryContext ctx{query, root, disableFreshInstance};
+  if (resultsSink && query->stream_results) {
+    ctx.resultsSink = std::move(resultsSink);
+    ctx.resultsChunkSize = query->stream_results;
+  }
+  ctx.cancelCheck = std::move(cancelCheck);
 
   // Track the query against the root.
   // This is to enable the `watchman debug-status` diagnostic command.
@@ -382,17 +699,54 @@ QueryResult w_query_execute(
   SCOPE_EXIT {
     root->queries.wlock()->erase(&ctx);
   };
-  if (query->sync_timeout.count()) {
+  SCOPE_EXIT {
+    root->view()->removePriorityPaths(&ctx);
+  };
+
+  // Synchronizing, or crawling the queried paths, would wait for the crawl
+  // that the query asked not to wait for.  The view is held still for the
+  // query instead.
+  res.incomplete =
+      query->allow_incomplete && root->view()->beginIncompleteRead(root);
+  SCOPE_EXIT {
+    if (res.incomplete) {
+      root->view()->endIncompleteRead();
+    }
+  };
+
+  if (query->sync_timeout.count() && !res.incomplete) {
     ctx.state = QueryContextState::WaitingForCookieSync;
     ctx.stopWatch.reset();
+    auto priorityPaths = priorityPathsForQuery(query, root);
+    if (!priorityPaths.empty()) {
+      root->view()->addPriorityPaths(&ctx, std::move(priorityPaths));
+    }
     try {
+      TraceSpan span("query", "cookieSync", query->command.view());
       root->syncToNow(query->sync_timeout, res.debugInfo.cookieFileNames);
     } catch (const std::exception& exc) {
       throw QueryExecError("synchronization failed: ", exc.what());
     }
+    root->view()->markPrioritySynced(&ctx);
     ctx.cookieSyncDuration = ctx.stopWatch.lap();
   }
 
+  auto queriedPaths = materializePathsForQuery(query, root);
+  recordQueriedPaths(*root, queriedPaths);
+  if (!res.incomplete) {
+    try {
+      root->view()->materialize(
+          queriedPaths,
+          query->sync_timeout.count() ? query->sync_timeout
+                                      : DEFAULT_QUERY_SYNC_MS);
+    } catch (const std::exception& exc) {
+      throw QueryExecError("crawling the queried paths failed: ", exc.what());
+    }
+  }
+  if (query->isFieldRequested("content.treesha1hex")) {
+    root->view()->hashTrees(root->ignore, queriedPaths, ctx.fetchDeadline());
+  }
+
   /* The first stage of execution is generation.
    * We generate a series of file inputs to pass to
    * the query executor.
@@ -415,16 +769,39 @@ QueryResult w_query_execute(
   res.clockAtStartOfQuery.clock = ctx.clockAtStartOfQuery.clock;
 
   // Evaluate the cursor for this root
-  ctx.since = query->since_spec ? query->since_spec->evaluate(
-                                      ctx.clockAtStartOfQuery.position(),
-                                      ctx.lastAgeOutTickValueAtStartOfQuery,
-                                      &root->inner.cursors)
-                                : w_query_since();
+  if (query->since_spec) {
+    auto epochs = root->view()->getClockEpochs();
+    ctx.since = query->since_spec->evaluate(
+        ctx.clockAtStartOfQuery.position(),
+        ctx.lastAgeOutTickValueAtStartOfQuery,
+        &root->inner.cursors,
+        &epochs);
+  } else {
+    ctx.since = w_query_since();
+  }
+
+  // Identical queries tend to arrive in bursts, from many processes of the
+  // same build; if one ran at this position already, its result is ours.
+  // An incomplete result isn't the answer at its clock position
+  auto cacheKey = res.incomplete
+      ? w_string()
+      : queryResultCacheKey(query, ctx, bool(generator));
+  if (cacheKey) {
+    if (auto cached = root->queryResultCache.get(cacheKey)) {
+      res.isFreshInstance = cached->value()->isFreshInstance;
+      res.resultsArray = cached->value()->resultsArray;
+      res.aggregate = cached->value()->aggregate;
+      res.truncated = cached->value()->truncated;
+      recordQueryMetrics(ctx, query->sync_timeout.count() != 0);
+      return res;
+    }
+  }
 
   if (query->bench_iterations > 0) {
     for (uint32_t i = 0; i < query->bench_iterations; ++i) {
       QueryContext c{query, root, ctx.disableFreshInstance};
       QueryResult r;
+      c.cancelCheck = ctx.cancelCheck;
       c.clockAtStartOfQuery = ctx.clockAtStartOfQuery;
       c.since = ctx.since;
       execute_common(&c, nullptr, &r, generator);
@@ -432,6 +809,12 @@ QueryResult w_query_execute(
   }
 
   execute_common(&ctx, &sample, &res, generator);
+  recordQueryMetrics(ctx, query->sync_timeout.count() != 0);
+  maybeLogSlowQuery(ctx);
+  if (cacheKey) {
+    root->queryResultCache.set(
+        cacheKey, std::make_shared<const QueryResult>(res));
+  }
   return res;
 }
 
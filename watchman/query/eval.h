@@ -33,12 +33,29 @@ using QueryGenerator = std::function<void(
  *
  * savedStateFactory allows testing this function without pulling in a wide
  * set of dependencies.
+ *
+ * If resultsSink is provided and the query set stream_results, results are
+ * passed to resultsSink in chunks as they are rendered, and
+ * QueryResult::resultsArray holds only the final, possibly empty, chunk.
+ *
+ * If cancelCheck is provided, it is polled while the query runs, and the
+ * query fails with QueryExecError once it returns true.
  */
 watchman::QueryResult w_query_execute(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
     watchman::QueryGenerator generator,
-    watchman::SavedStateFactory savedStateFactory);
+    watchman::SavedStateFactory savedStateFactory,
+    watchman::QueryResultsSink resultsSink = nullptr,
+    watchman::QueryCancelCheck cancelCheck = nullptr);
+
+// Returns the key under which the result of the query is kept in the
+// root's queryResultCache, or nullptr if the result can't be shared.
+// hasGenerator is true if the query runs with a generator of its own.
+w_string queryResultCacheKey(
+    const watchman::Query* query,
+    const watchman::QueryContext& ctx,
+    bool hasGenerator);
 
 // Allows a generator to process a file node
 // through the query engine
@@ -47,7 +64,20 @@ void w_query_process_file(
     watchman::QueryContext* ctx,
     std::unique_ptr<watchman::FileResult> file);
 
+// Adds a file that is already known to match the query to the results,
+// subject to dedup_results.  Used to merge the matches that a parallel
+// generator collected in QueryContext::matches.
+void w_query_emit_file(
+    watchman::QueryContext* ctx,
+    std::unique_ptr<watchman::FileResult> file);
+
 void time_generator(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
     watchman::QueryContext* ctx);
+
+// Like time_generator, but uses the view's changeSetGenerator
+void change_set_generator(
+    const watchman::Query* query,
+    const std::shared_ptr<watchman::Root>& root,
+    watchman::QueryContext* ctx);
@@ -5,8 +5,11 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <string>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/bser.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
@@ -20,6 +23,12 @@ static std::optional<json_ref> make_name(
   return w_string_to_json(ctx->computeWholeName(file));
 }
 
+static bool
+encode_name(FileResult* file, const QueryContext* ctx, BserEncoder& out) {
+  out.appendPrefixString(ctx->computeWholeName(file));
+  return true;
+}
+
 static std::optional<json_ref> make_symlink(
     FileResult* file,
     const QueryContext*) {
@@ -30,42 +39,66 @@ static std::optional<json_ref> make_symlink(
   return *target ? w_string_to_json(*target) : json_null();
 }
 
-static std::optional<json_ref> make_sha1_hex(
-    FileResult* file,
-    const QueryContext*) {
+// Renders the hash returned by getHash as hex, or the error it throws as
+// an object so that it can be distinguished from a valid hash result.
+template <typename GetHash>
+static std::optional<json_ref> make_hash_hex(GetHash getHash) {
   try {
-    auto hash = file->getContentSha1();
+    auto hash = getHash();
     if (!hash.has_value()) {
       // Need to load it still
       return std::nullopt;
     }
-    char buf[40];
+    std::string buf(hash->size() * 2, '0');
     static const char* hexDigit = "0123456789abcdef";
     for (size_t i = 0; i < hash->size(); ++i) {
       auto& digit = (*hash)[i];
       buf[(i * 2) + 0] = hexDigit[digit >> 4];
       buf[(i * 2) + 1] = hexDigit[digit & 0xf];
     }
-    return w_string_to_json(w_string(buf, sizeof(buf), W_STRING_UNICODE));
+    return w_string_to_json(
+        w_string(buf.data(), buf.size(), W_STRING_UNICODE));
   } catch (const std::system_error& exc) {
     auto errcode = exc.code();
     if (errcode == watchman::error_code::no_such_file_or_directory ||
-        errcode == watchman::error_code::is_a_directory) {
-      // Deleted files, or (currently existing) directories have no hash
+        errcode == watchman::error_code::is_a_directory ||
+        errcode == watchman::error_code::not_a_directory) {
+      // Deleted files, (currently existing) directories and, for the tree
+      // hash, files other than directories have no hash
       return json_null();
     }
-    // We'll report the error wrapped up in an object so that it can be
-    // distinguished from a valid hash result.
     return json_object(
         {{"error", w_string_to_json(w_string(exc.what(), W_STRING_UNICODE))}});
   } catch (const std::exception& exc) {
-    // We'll report the error wrapped up in an object so that it can be
-    // distinguished from a valid hash result.
     return json_object(
         {{"error", w_string_to_json(w_string(exc.what(), W_STRING_UNICODE))}});
   }
 }
 
+static std::optional<json_ref> make_sha1_hex(
+    FileResult* file,
+    const QueryContext*) {
+  return make_hash_hex([file] { return file->getContentSha1(); });
+}
+
+static std::optional<json_ref> make_spooky128_hex(
+    FileResult* file,
+    const QueryContext*) {
+  return make_hash_hex([file] { return file->getContentSpooky128(); });
+}
+
+static std::optional<json_ref> make_chunked128_hex(
+    FileResult* file,
+    const QueryContext*) {
+  return make_hash_hex([file] { return file->getContentChunked128(); });
+}
+
+static std::optional<json_ref> make_treesha1_hex(
+    FileResult* file,
+    const QueryContext*) {
+  return make_hash_hex([file] { return file->getTreeSha1(); });
+}
+
 static std::optional<json_ref> make_size(
     FileResult* file,
     const QueryContext*) {
@@ -76,6 +109,16 @@ static std::optional<json_ref> make_size(
   return json_integer(size.value());
 }
 
+static bool
+encode_size(FileResult* file, const QueryContext*, BserEncoder& out) {
+  auto size = file->size();
+  if (!size.has_value()) {
+    return false;
+  }
+  out.appendInt(size.value());
+  return true;
+}
+
 static std::optional<json_ref> make_exists(
     FileResult* file,
     const QueryContext*) {
@@ -86,27 +129,50 @@ static std::optional<json_ref> make_exists(
   return json_boolean(exists.value());
 }
 
+static bool
+encode_exists(FileResult* file, const QueryContext*, BserEncoder& out) {
+  auto exists = file->exists();
+  if (!exists.has_value()) {
+    return false;
+  }
+  out.appendBool(exists.value());
+  return true;
+}
+
+static std::optional<bool> is_new(FileResult* file, const QueryContext* ctx) {
+  if (!ctx->since.is_timestamp && ctx->since.clock.is_fresh_instance) {
+    return true;
+  }
+
+  auto ctime = file->ctime();
+  if (!ctime.has_value()) {
+    // Reconsider this one later
+    return std::nullopt;
+  }
+  if (ctx->since.is_timestamp) {
+    return ctx->since.timestamp > ctime->timestamp;
+  }
+  return ctime->ticks > ctx->since.clock.ticks;
+}
+
 static std::optional<json_ref> make_new(
     FileResult* file,
     const QueryContext* ctx) {
-  bool is_new = false;
-
-  if (!ctx->since.is_timestamp && ctx->since.clock.is_fresh_instance) {
-    is_new = true;
-  } else {
-    auto ctime = file->ctime();
-    if (!ctime.has_value()) {
-      // Reconsider this one later
-      return std::nullopt;
-    }
-    if (ctx->since.is_timestamp) {
-      is_new = ctx->since.timestamp > ctime->timestamp;
-    } else {
-      is_new = ctime->ticks > ctx->since.clock.ticks;
-    }
+  auto value = is_new(file, ctx);
+  if (!value.has_value()) {
+    return std::nullopt;
   }
+  return json_boolean(value.value());
+}
 
-  return json_boolean(is_new);
+static bool
+encode_new(FileResult* file, const QueryContext* ctx, BserEncoder& out) {
+  auto value = is_new(file, ctx);
+  if (!value.has_value()) {
+    return false;
+  }
+  out.appendBool(value.value());
+  return true;
 }
 
 #define MAKE_CLOCK_FIELD(name, member)                      \
@@ -137,39 +203,71 @@ static_assert(
     sizeof(json_int_t) >= sizeof(time_t),
     "json_int_t isn't large enough to hold a time_t");
 
-#define MAKE_INT_FIELD(name, member)           \
-  static std::optional<json_ref> make_##name(  \
-      FileResult* file, const QueryContext*) { \
-    auto stat = file->stat();                  \
-    if (!stat.has_value()) {                   \
-      /* need to load data */                  \
-      return std::nullopt;                     \
-    }                                          \
-    return json_integer(stat->member);         \
-  }
-
-#define MAKE_TIME_INT_FIELD(name, member, scale)                  \
+#define MAKE_INT_FIELD(name, member)                              \
   static std::optional<json_ref> make_##name(                     \
       FileResult* file, const QueryContext*) {                    \
-    auto spec = file->member();                                   \
-    if (!spec.has_value()) {                                      \
+    auto stat = file->stat();                                     \
+    if (!stat.has_value()) {                                      \
       /* need to load data */                                     \
       return std::nullopt;                                        \
     }                                                             \
-    return json_integer(                                          \
-        ((int64_t)spec->tv_sec * scale) +                         \
-        ((int64_t)spec->tv_nsec * scale / WATCHMAN_NSEC_IN_SEC)); \
+    return json_integer(stat->member);                            \
+  }                                                               \
+  static bool encode_##name(                                      \
+      FileResult* file, const QueryContext*, BserEncoder& out) {  \
+    auto stat = file->stat();                                     \
+    if (!stat.has_value()) {                                      \
+      /* need to load data */                                     \
+      return false;                                               \
+    }                                                             \
+    out.appendInt(stat->member);                                  \
+    return true;                                                  \
+  }
+
+#define TIME_INT_VALUE(spec, scale)   \
+  (((int64_t)(spec).tv_sec * scale) + \
+   ((int64_t)(spec).tv_nsec * scale / WATCHMAN_NSEC_IN_SEC))
+
+#define MAKE_TIME_INT_FIELD(name, member, scale)                 \
+  static std::optional<json_ref> make_##name(                    \
+      FileResult* file, const QueryContext*) {                   \
+    auto spec = file->member();                                  \
+    if (!spec.has_value()) {                                     \
+      /* need to load data */                                    \
+      return std::nullopt;                                       \
+    }                                                            \
+    return json_integer(TIME_INT_VALUE(*spec, scale));           \
+  }                                                              \
+  static bool encode_##name(                                     \
+      FileResult* file, const QueryContext*, BserEncoder& out) { \
+    auto spec = file->member();                                  \
+    if (!spec.has_value()) {                                     \
+      /* need to load data */                                    \
+      return false;                                              \
+    }                                                            \
+    out.appendInt(TIME_INT_VALUE(*spec, scale));                 \
+    return true;                                                 \
   }
 
-#define MAKE_TIME_DOUBLE_FIELD(name, member)               \
-  static std::optional<json_ref> make_##name(              \
-      FileResult* file, const QueryContext*) {             \
-    auto spec = file->member();                            \
-    if (!spec.has_value()) {                               \
-      /* need to load data */                              \
-      return std::nullopt;                                 \
-    }                                                      \
-    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec); \
+#define MAKE_TIME_DOUBLE_FIELD(name, member)                     \
+  static std::optional<json_ref> make_##name(                    \
+      FileResult* file, const QueryContext*) {                   \
+    auto spec = file->member();                                  \
+    if (!spec.has_value()) {                                     \
+      /* need to load data */                                    \
+      return std::nullopt;                                       \
+    }                                                            \
+    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec);       \
+  }                                                              \
+  static bool encode_##name(                                     \
+      FileResult* file, const QueryContext*, BserEncoder& out) { \
+    auto spec = file->member();                                  \
+    if (!spec.has_value()) {                                     \
+      /* need to load data */                                    \
+      return false;                                              \
+    }                                                            \
+    out.appendReal(spec->tv_sec + 1e-9 * spec->tv_nsec);         \
+    return true;                                                 \
   }
 
 /* For each type (e.g. "m"), define fields
@@ -198,38 +296,38 @@ MAKE_INT_FIELD(nlink, nlink)
 
 // clang-format off
 #define MAKE_TIME_FIELD_DEFS(type) \
-  { #type "time", make_##type##time}, \
-  { #type "time_ms", make_##type##time_ms},\
-  { #type "time_us", make_##type##time_us}, \
-  { #type "time_ns", make_##type##time_ns}, \
-  { #type "time_f", make_##type##time_f}
+  { #type "time", make_##type##time, encode_##type##time}, \
+  { #type "time_ms", make_##type##time_ms, encode_##type##time_ms},\
+  { #type "time_us", make_##type##time_us, encode_##type##time_us}, \
+  { #type "time_ns", make_##type##time_ns, encode_##type##time_ns}, \
+  { #type "time_f", make_##type##time_f, encode_##type##time_f}
 // clang-format on
 
-static std::optional<json_ref> make_type_field(
-    FileResult* file,
-    const QueryContext*) {
+// Returns the letter code for the type of file, or nullptr if data needs to
+// be loaded
+static const char* file_type_code(FileResult* file) {
   auto dtype = file->dtype();
   if (dtype.has_value()) {
     switch (*dtype) {
       case DType::Regular:
-        return typed_string_to_json("f", W_STRING_UNICODE);
+        return "f";
       case DType::Dir:
-        return typed_string_to_json("d", W_STRING_UNICODE);
+        return "d";
       case DType::Symlink:
-        return typed_string_to_json("l", W_STRING_UNICODE);
+        return "l";
       case DType::Block:
-        return typed_string_to_json("b", W_STRING_UNICODE);
+        return "b";
       case DType::Char:
-        return typed_string_to_json("c", W_STRING_UNICODE);
+        return "c";
       case DType::Fifo:
-        return typed_string_to_json("p", W_STRING_UNICODE);
+        return "p";
       case DType::Socket:
-        return typed_string_to_json("s", W_STRING_UNICODE);
+        return "s";
       case DType::Whiteout:
         // Whiteout shouldn't generally be visible to userspace,
         // and we don't have a defined letter code for it, so
         // treat it as "who knows!?"
-        return typed_string_to_json("?", W_STRING_UNICODE);
+        return "?";
       case DType::Unknown:
       default:
           // Not enough info; fall through and use the full stat data
@@ -240,39 +338,59 @@ static std::optional<json_ref> make_type_field(
   // Bias towards the more common file types first
   auto optionalStat = file->stat();
   if (!optionalStat.has_value()) {
-    return std::nullopt;
+    return nullptr;
   }
 
   auto stat = optionalStat.value();
   if (stat.isFile()) {
-    return typed_string_to_json("f", W_STRING_UNICODE);
+    return "f";
   }
   if (stat.isDir()) {
-    return typed_string_to_json("d", W_STRING_UNICODE);
+    return "d";
   }
   if (stat.isSymlink()) {
-    return typed_string_to_json("l", W_STRING_UNICODE);
+    return "l";
   }
 #ifndef _WIN32
   if (S_ISBLK(stat.mode)) {
-    return typed_string_to_json("b", W_STRING_UNICODE);
+    return "b";
   }
   if (S_ISCHR(stat.mode)) {
-    return typed_string_to_json("c", W_STRING_UNICODE);
+    return "c";
   }
   if (S_ISFIFO(stat.mode)) {
-    return typed_string_to_json("p", W_STRING_UNICODE);
+    return "p";
   }
   if (S_ISSOCK(stat.mode)) {
-    return typed_string_to_json("s", W_STRING_UNICODE);
+    return "s";
   }
 #endif
 #ifdef S_ISDOOR
   if (S_ISDOOR(stat.mode)) {
-    return typed_string_to_json("D", W_STRING_UNICODE);
+    return "D";
   }
 #endif
-  return typed_string_to_json("?", W_STRING_UNICODE);
+  return "?";
+}
+
+static std::optional<json_ref> make_type_field(
+    FileResult* file,
+    const QueryContext*) {
+  auto code = file_type_code(file);
+  if (!code) {
+    return std::nullopt;
+  }
+  return typed_string_to_json(code, W_STRING_UNICODE);
+}
+
+static bool
+encode_type_field(FileResult* file, const QueryContext*, BserEncoder& out) {
+  auto code = file_type_code(file);
+  if (!code) {
+    return false;
+  }
+  out.appendUTF8String(code);
+  return true;
 }
 
 // Helper to construct the list of field defs
@@ -280,35 +398,89 @@ static std::unordered_map<w_string, QueryFieldRenderer> build_defs() {
   struct {
     const char* name;
     std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+    bool (*encode)(FileResult* file, const QueryContext* ctx, BserEncoder& out);
   } defs[] = {
-      {"name", make_name},
+      {"name", make_name, encode_name},
       {"symlink_target", make_symlink},
-      {"exists", make_exists},
-      {"size", make_size},
-      {"mode", make_mode},
-      {"uid", make_uid},
-      {"gid", make_gid},
+      {"exists", make_exists, encode_exists},
+      {"size", make_size, encode_size},
+      {"mode", make_mode, encode_mode},
+      {"uid", make_uid, encode_uid},
+      {"gid", make_gid, encode_gid},
       MAKE_TIME_FIELD_DEFS(a),
       MAKE_TIME_FIELD_DEFS(m),
       MAKE_TIME_FIELD_DEFS(c),
-      {"ino", make_ino},
-      {"dev", make_dev},
-      {"nlink", make_nlink},
-      {"new", make_new},
+      {"ino", make_ino, encode_ino},
+      {"dev", make_dev, encode_dev},
+      {"nlink", make_nlink, encode_nlink},
+      {"new", make_new, encode_new},
       {"oclock", make_oclock},
       {"cclock", make_cclock},
-      {"type", make_type_field},
+      {"type", make_type_field, encode_type_field},
       {"content.sha1hex", make_sha1_hex},
+      {"content.spooky128hex", make_spooky128_hex},
+      {"content.chunked128hex", make_chunked128_hex},
+      {"content.treesha1hex", make_treesha1_hex},
   };
   std::unordered_map<w_string, QueryFieldRenderer> map;
   for (auto& def : defs) {
     w_string name(def.name, W_STRING_UNICODE);
-    map.emplace(name, QueryFieldRenderer{name, def.make});
+    map.emplace(name, QueryFieldRenderer{name, def.make, def.encode});
   }
 
   return map;
 }
 
+// Encodes the fields of a row with the encode functions given as template
+// arguments, which the compiler can inline into a single loop-free kernel
+// instead of calling each through a pointer.
+template <bool (*... encoders)(FileResult*, const QueryContext*, BserEncoder&)>
+static bool
+encode_row(FileResult* file, const QueryContext* ctx, BserEncoder& out) {
+  return (encoders(file, ctx, out) && ...);
+}
+
+// Returns the specialized row encoder for `fields`, if they are one of the
+// lists that clients ask for the most, including the default list.
+static QueryFieldList::RowEncoder select_row_encoder(
+    const QueryFieldList& fields) {
+  static const struct {
+    std::vector<const char*> names;
+    QueryFieldList::RowEncoder encodeRow;
+  } row_encoders[] = {
+      {{"name"}, encode_row<encode_name>},
+      {{"name", "exists", "new", "size", "mode"},
+       encode_row<
+           encode_name,
+           encode_exists,
+           encode_new,
+           encode_size,
+           encode_mode>},
+      {{"name", "exists", "new", "size", "mode", "mtime_ms"},
+       encode_row<
+           encode_name,
+           encode_exists,
+           encode_new,
+           encode_size,
+           encode_mode,
+           encode_mtime_ms>},
+  };
+
+  for (auto& def : row_encoders) {
+    if (def.names.size() == fields.size() &&
+        std::equal(
+            def.names.begin(),
+            def.names.end(),
+            fields.begin(),
+            [](const char* name, const QueryFieldRenderer* field) {
+              return field->name.view() == name;
+            })) {
+      return def.encodeRow;
+    }
+  }
+  return nullptr;
+}
+
 // Meyers singleton to avoid SIOF wrt. static constructors in this module
 // and the order that w_ctor_fn callbacks are dispatched.
 static std::unordered_map<w_string, QueryFieldRenderer>& field_defs() {
@@ -323,6 +495,17 @@ void QueryFieldList::add(const w_string& name) {
     throw QueryParseError("unknown field name '", name.view(), "'");
   }
   this->push_back(&it->second);
+
+  encodeRow = select_row_encoder(*this);
+}
+
+bool QueryFieldList::canEncodeBser() const {
+  for (auto& f : *this) {
+    if (!f->encode) {
+      return false;
+    }
+  }
+  return true;
 }
 
 json_ref field_list_to_json_name_array(const QueryFieldList& fieldList) {
@@ -339,6 +522,7 @@ void parse_field_list(json_ref field_list, QueryFieldList* selected) {
   uint32_t i;
 
   selected->clear();
+  selected->encodeRow = nullptr;
 
   if (!field_list) {
     // Use the default list
@@ -6,6 +6,7 @@
  */
 
 #include <folly/ScopeGuard.h>
+#include <algorithm>
 #include <memory>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
@@ -222,6 +223,12 @@ void parse_suffixes(Query* res, const json_ref& query) {
   res->glob_flags = WM_CASEFOLD;
   res->glob_tree = folly::make_unique<GlobTree>("", 0);
 
+  // Views that index their files by suffix can generate the results
+  // directly, unless a suffix would mean something different as a pattern
+  // or can't be the suffix of a name.
+  std::vector<w_string> plainSuffixes;
+  bool allPlain = true;
+
   for (auto& ele : suffixArray) {
     if (!ele.isString()) {
       throw QueryParseError("'suffix' must be a string or an array of strings");
@@ -232,6 +239,18 @@ void parse_suffixes(Query* res, const json_ref& query) {
     if (!add_glob(res->glob_tree.get(), pattern)) {
       throw QueryParseError("failed to compile multi-glob");
     }
+
+    if (suff.view().find_first_of("./\\*?[") != std::string_view::npos) {
+      allPlain = false;
+    } else if (
+        std::find(plainSuffixes.begin(), plainSuffixes.end(), suff) ==
+        plainSuffixes.end()) {
+      plainSuffixes.push_back(suff);
+    }
+  }
+
+  if (allPlain) {
+    res->suffixes = std::move(plainSuffixes);
   }
 }
 
@@ -109,6 +109,33 @@ class SizeExpr : public QueryExpr {
     return eval_int_compare(size.value(), &comp);
   }
 
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase*) const override {
+    MetadataFilter filter;
+    filter.existing = true;
+    switch (comp.op) {
+      case W_QUERY_ICMP_EQ:
+        filter.minSize = comp.operand;
+        filter.maxSize = comp.operand;
+        break;
+      case W_QUERY_ICMP_GT:
+        filter.minSize = comp.operand + 1;
+        break;
+      case W_QUERY_ICMP_GE:
+        filter.minSize = comp.operand;
+        break;
+      case W_QUERY_ICMP_LT:
+        filter.maxSize = comp.operand - 1;
+        break;
+      case W_QUERY_ICMP_LE:
+        filter.maxSize = comp.operand;
+        break;
+      default:
+        break;
+    }
+    return filter;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     if (!term.isArray()) {
       throw QueryParseError("Expected array for 'size' term");
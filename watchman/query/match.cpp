@@ -66,6 +66,10 @@ class WildMatchExpr : public QueryExpr {
     return res;
   }
 
+  ExprCost cost() const override {
+    return ExprCost::Pattern;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity case_sensitive) {
     const char *pattern, *scope = "basename";
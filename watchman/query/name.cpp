@@ -12,6 +12,7 @@
 #include "watchman/query/TermRegistry.h"
 
 #include <unordered_set>
+#include <vector>
 
 using namespace watchman;
 
@@ -41,7 +42,7 @@ class NameExpr : public QueryExpr {
         }
       } else {
         str = caseSensitive == CaseSensitivity::CaseInSensitive
-            ? file->baseName().asLowerCase()
+            ? file->lowerCaseBaseName()
             : file->baseName().asWString();
       }
 
@@ -64,6 +65,33 @@ class NameExpr : public QueryExpr {
     return str == name;
   }
 
+  ExprCost cost() const override {
+    return ExprCost::Name;
+  }
+
+  std::optional<std::vector<w_string>> requiredNames() const override {
+    if (wholename) {
+      return std::nullopt;
+    }
+    if (set.empty()) {
+      if (!name) {
+        // An empty list of names, which nothing matches
+        return std::vector<w_string>{};
+      }
+      return std::vector<w_string>{name.piece().asLowerCase()};
+    }
+
+    // Names that only differ by case share an entry in the view's index
+    std::unordered_set<w_string> lowered;
+    for (auto& element : set) {
+      lowered.insert(
+          caseSensitive == CaseSensitivity::CaseInSensitive
+              ? element
+              : element.piece().asLowerCase());
+    }
+    return std::vector<w_string>{lowered.begin(), lowered.end()};
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
     const char *pattern = nullptr, *scope = "basename";
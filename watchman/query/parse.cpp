@@ -84,21 +84,24 @@ static void parse_relative_root(
     const std::shared_ptr<Root>& root,
     Query* res,
     const json_ref& query) {
-  auto relative_root = query.get_default("relative_root");
-  if (!relative_root) {
-    return;
-  }
-
-  if (!relative_root.isString()) {
-    throw QueryParseError("'relative_root' must be a string");
+  w_string path;
+  if (auto relative_root = query.get_default("relative_root")) {
+    if (!relative_root.isString()) {
+      throw QueryParseError("'relative_root' must be a string");
+    }
+    path = json_to_w_string(relative_root).normalizeSeparators();
   }
 
-  auto path = json_to_w_string(relative_root).normalizeSeparators();
   if (path.empty()) {
     // An empty relative_root is equivalent to not specifying
     // a relative root.  Importantly, we want to avoid setting
     // relative_root to "" because that introduces some complexities
     // in handling that case for eg: eden.
+    if (root->view()->isSubtreeView()) {
+      // The view also holds the rest of the enclosing root
+      res->relative_root = root->root_path;
+      res->relative_root_slash = w_string::build(res->relative_root, "/");
+    }
     return;
   }
 
@@ -117,6 +120,8 @@ static void parse_query_expression(Query* res, const json_ref& query) {
   res->expr = parseQueryExpr(res, exp);
 }
 
+W_CAP_REG("query-request-id")
+
 static void parse_request_id(Query* res, const json_ref& query) {
   auto request_id = query.get_default("request_id");
   if (!request_id) {
@@ -164,6 +169,122 @@ static void parse_lock_timeout(Query* res, const json_ref& query) {
   res->lock_timeout = value;
 }
 
+W_CAP_REG("fetch_timeout")
+
+static void parse_fetch_timeout(Query* res, const json_ref& query) {
+  auto fetch_timeout = query.get_default("fetch_timeout", json_integer(0));
+
+  if (!fetch_timeout.isInt()) {
+    throw QueryParseError("fetch_timeout must be an integer value >= 0");
+  }
+
+  auto value = fetch_timeout.asInt();
+
+  if (value < 0) {
+    throw QueryParseError("fetch_timeout must be an integer value >= 0");
+  }
+
+  res->fetch_timeout = std::chrono::milliseconds(value);
+}
+
+W_CAP_REG("deadline_ms")
+
+static void parse_deadline(Query* res, const json_ref& query) {
+  auto deadline = query.get_default("deadline_ms", json_integer(0));
+
+  if (!deadline.isInt() || deadline.asInt() < 0) {
+    throw QueryParseError("deadline_ms must be an integer value >= 0");
+  }
+
+  res->deadline = std::chrono::milliseconds(deadline.asInt());
+}
+
+W_CAP_REG("limit")
+
+static void parse_limit(Query* res, const json_ref& query) {
+  auto limit = query.get_default("limit", json_integer(0));
+
+  if (!limit.isInt() || limit.asInt() < 0) {
+    throw QueryParseError("limit must be an integer value >= 0");
+  }
+
+  res->limit = limit.asInt();
+}
+
+W_CAP_REG("order_by")
+
+static void parse_order_by(Query* res, const json_ref& query) {
+  auto order_by = query.get_default("order_by");
+  if (!order_by) {
+    return;
+  }
+
+  // Either "key" or ["key", "asc" | "desc"]
+  json_ref key = order_by;
+  bool descending = false;
+  if (order_by.isArray()) {
+    auto& arr = order_by.array();
+    if (arr.size() != 2 || !arr[1].isString()) {
+      throw QueryParseError(
+          "order_by must be a key name or an array of a key name and "
+          "\"asc\" or \"desc\"");
+    }
+    key = arr[0];
+    auto direction = json_to_w_string(arr[1]);
+    if (direction.view() == "desc") {
+      descending = true;
+    } else if (direction.view() != "asc") {
+      throw QueryParseError(
+          "order_by direction must be \"asc\" or \"desc\", not ",
+          direction);
+    }
+  }
+
+  if (!key.isString()) {
+    throw QueryParseError("order_by key must be a string");
+  }
+  auto name = json_to_w_string(key);
+  QueryOrder order{QueryOrder::Key::Name, descending};
+  if (name.view() == "otime") {
+    order.key = QueryOrder::Key::OTime;
+  } else if (name.view() == "mtime") {
+    order.key = QueryOrder::Key::MTime;
+  } else if (name.view() == "size") {
+    order.key = QueryOrder::Key::Size;
+  } else if (name.view() != "name") {
+    throw QueryParseError(
+        "order_by key must be one of otime, mtime, size or name, not ", name);
+  }
+  res->order_by = order;
+}
+
+W_CAP_REG("aggregate")
+
+static void parse_aggregate(Query* res, const json_ref& query) {
+  auto aggregate = query.get_default("aggregate");
+  if (!aggregate) {
+    return;
+  }
+
+  // Either true or {"group_by_depth": N}
+  QueryAggregate agg;
+  if (aggregate.isBool()) {
+    if (!aggregate.asBool()) {
+      return;
+    }
+  } else if (aggregate.isObject()) {
+    auto depth = aggregate.get_default("group_by_depth", json_integer(0));
+    if (!depth.isInt() || depth.asInt() < 0) {
+      throw QueryParseError(
+          "aggregate.group_by_depth must be an integer value >= 0");
+    }
+    agg.groupByDepth = depth.asInt();
+  } else {
+    throw QueryParseError("aggregate must be a boolean or an object");
+  }
+  res->aggregate = agg;
+}
+
 static bool
 parse_bool_param(const json_ref& query, const char* name, bool default_value) {
   auto value = query.get_default(name, json_boolean(default_value));
@@ -207,6 +328,43 @@ static void parse_benchmark(Query* res, const json_ref& query) {
   }
 }
 
+W_CAP_REG("stream_results")
+
+static void parse_stream_results(Query* res, const json_ref& query) {
+  auto stream = query.get_default("stream_results");
+  if (!stream) {
+    return;
+  }
+  if (stream.isBool()) {
+    res->stream_results =
+        stream.asBool() ? DEFAULT_STREAM_RESULTS_CHUNK_SIZE : 0;
+    return;
+  }
+  if (!stream.isInt() || stream.asInt() < 0) {
+    throw QueryParseError(
+        "stream_results must be a boolean or a non-negative integer");
+  }
+  res->stream_results = stream.asInt();
+}
+
+W_CAP_REG("parallel")
+
+static void parse_parallel(Query* res, const json_ref& query) {
+  res->parallel = parse_bool_param(query, "parallel", false);
+}
+
+W_CAP_REG("allow_incomplete")
+
+static void parse_allow_incomplete(Query* res, const json_ref& query) {
+  res->allow_incomplete = parse_bool_param(query, "allow_incomplete", false);
+}
+
+W_CAP_REG("query-profile")
+
+static void parse_profile(Query* res, const json_ref& query) {
+  res->profile = parse_bool_param(query, "profile", false);
+}
+
 static void parse_case_sensitive(
     Query* res,
     const std::shared_ptr<Root>& root,
@@ -231,10 +389,20 @@ std::shared_ptr<Query> w_query_parse(
   parse_sync(res, query);
   parse_dedup(res, query);
   parse_lock_timeout(res, query);
+  parse_fetch_timeout(res, query);
+  parse_deadline(res, query);
+  parse_limit(res, query);
+  parse_order_by(res, query);
+  parse_aggregate(res, query);
   parse_relative_root(root, res, query);
   parse_empty_on_fresh_instance(res, query);
   parse_fail_if_no_saved_state(res, query);
   parse_omit_changed_files(res, query);
+  parse_stream_results(res, query);
+  parse_parallel(res, query);
+  parse_allow_incomplete(res, query);
+  // Before the expression, whose terms are wrapped if this is set
+  parse_profile(res, query);
 
   /* Look for path generators */
   parse_paths(res, query);
@@ -259,6 +427,43 @@ std::shared_ptr<Query> w_query_parse(
   return result;
 }
 
+std::shared_ptr<Query> w_query_parse_cached(
+    const std::shared_ptr<Root>& root,
+    const json_ref& query) {
+  if (root->queryParseCacheSize == 0) {
+    return w_query_parse(root, query);
+  }
+
+  // Sorting the keys means that specs that only differ by the order of
+  // their fields share an entry.  Parsing also depends on the root, such as
+  // for its case sensitivity, which is why each root has its own cache.
+  // Clients that tag each query with its own request_id would otherwise
+  // never hit, so it is left out of the key and applied to the copy.
+  auto spec = query;
+  w_string requestId;
+  if (query.isObject()) {
+    auto id = query.get_default("request_id");
+    if (id && id.isString()) {
+      requestId = json_to_w_string(id);
+      spec = json_copy(query);
+      json_object_del(spec, "request_id");
+    }
+  }
+  auto key = w_string{json_dumps(spec, JSON_COMPACT | JSON_SORT_KEYS)};
+  std::shared_ptr<const Query> parsed;
+  if (auto cached = root->queryParseCache.get(key)) {
+    parsed = cached->value();
+  } else {
+    parsed = w_query_parse(root, spec);
+    root->queryParseCache.set(key, parsed);
+  }
+  auto result = std::make_shared<Query>(*parsed);
+  if (requestId) {
+    result->request_id = requestId;
+  }
+  return result;
+}
+
 void w_query_legacy_field_list(QueryFieldList* flist) {
   static const char* names[] = {
       "name",
@@ -12,6 +12,8 @@
 #include "watchman/fs/FileSystem.h"
 
 constexpr std::chrono::milliseconds DEFAULT_QUERY_SYNC_MS(60000);
+// Chunk size used when a query sets "stream_results": true
+constexpr uint32_t DEFAULT_STREAM_RESULTS_CHUNK_SIZE = 1024;
 
 namespace watchman {
 struct Query;
@@ -24,6 +26,14 @@ std::shared_ptr<watchman::Query> w_query_parse(
     const std::shared_ptr<watchman::Root>& root,
     const json_ref& query);
 
+// Like w_query_parse(), but keeps the parsed query in the root's
+// queryParseCache, so that a spec that was parsed before is returned as a
+// copy that shares its expression, globs and clockspec with the cached one.
+// The caller may change the fields of the copy that describe the request.
+std::shared_ptr<watchman::Query> w_query_parse_cached(
+    const std::shared_ptr<watchman::Root>& root,
+    const json_ref& query);
+
 // parse the old style since and find queries
 std::shared_ptr<watchman::Query> w_query_parse_legacy(
     const std::shared_ptr<watchman::Root>& root,
@@ -14,29 +14,53 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/watchman_system.h"
 
-#ifdef HAVE_PCRE_H
+#ifdef HAVE_PCRE2_H
 
-#include <pcre.h> // @manual
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h> // @manual
+#include "watchman/LRUCache.h"
 
 using namespace watchman;
 
+namespace {
+
+// A compiled pattern is never modified after it has been JIT compiled, so
+// one copy can be shared by every query, on any thread.
+using CompiledPattern = std::shared_ptr<pcre2_code>;
+
+// Subscriptions and IDE integrations tend to issue the same few patterns
+// over and over, so remember the compiled forms rather than recompiling
+// them for each query.  Keyed by the pattern, prefixed with 'i' for
+// caseless patterns and 'c' for the others.
+LRUCache<std::string, CompiledPattern>& compiledPatterns() {
+  static auto* cache = new LRUCache<std::string, CompiledPattern>(
+      256, std::chrono::milliseconds(0));
+  return *cache;
+}
+
+// We only want to know whether a pattern matches, so one pair of offsets
+// is enough for every pattern, and each thread can reuse the same match
+// data for all of them.
+pcre2_match_data* threadMatchData() {
+  struct Deleter {
+    void operator()(pcre2_match_data* data) const {
+      pcre2_match_data_free(data);
+    }
+  };
+  thread_local std::unique_ptr<pcre2_match_data, Deleter> data{
+      pcre2_match_data_create(1, nullptr)};
+  return data.get();
+}
+
+} // namespace
+
 class PcreExpr : public QueryExpr {
-  pcre* re;
-  pcre_extra* extra;
+  CompiledPattern re;
   bool wholename;
 
  public:
-  explicit PcreExpr(pcre* re, pcre_extra* extra, bool wholename)
-      : re(re), extra(extra), wholename(wholename) {}
-
-  ~PcreExpr() override {
-    if (re) {
-      pcre_free(re);
-    }
-    if (extra) {
-      pcre_free(extra);
-    }
-  }
+  explicit PcreExpr(CompiledPattern re, bool wholename)
+      : re(std::move(re)), wholename(wholename) {}
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
@@ -48,9 +72,17 @@ class PcreExpr : public QueryExpr {
       str = file->baseName();
     }
 
-    rc = pcre_exec(re, extra, str.data(), str.size(), 0, 0, nullptr, 0);
+    // pcre2_match uses the JIT compiled code if there is any
+    rc = pcre2_match(
+        re.get(),
+        reinterpret_cast<PCRE2_SPTR>(str.data()),
+        str.size(),
+        0,
+        0,
+        threadMatchData(),
+        nullptr);
 
-    if (rc == PCRE_ERROR_NOMATCH) {
+    if (rc == PCRE2_ERROR_NOMATCH) {
       return false;
     }
     if (rc >= 0) {
@@ -60,15 +92,59 @@ class PcreExpr : public QueryExpr {
     return false;
   }
 
+  ExprCost cost() const override {
+    return ExprCost::Regex;
+  }
+
+  static CompiledPattern compile(
+      const char* which,
+      const char* pattern,
+      CaseSensitivity caseSensitive) {
+    bool caseless = caseSensitive == CaseSensitivity::CaseInSensitive;
+    auto key = folly::to<std::string>(caseless ? "i" : "c", pattern);
+    if (auto node = compiledPatterns().get(key)) {
+      return node->value();
+    }
+
+    int errcode = 0;
+    PCRE2_SIZE erroff = 0;
+    auto code = pcre2_compile(
+        reinterpret_cast<PCRE2_SPTR>(pattern),
+        PCRE2_ZERO_TERMINATED,
+        caseless ? PCRE2_CASELESS : 0,
+        &errcode,
+        &erroff,
+        nullptr);
+    if (!code) {
+      PCRE2_UCHAR message[256];
+      pcre2_get_error_message(errcode, message, sizeof(message));
+      throw QueryParseError(folly::to<std::string>(
+          "invalid ",
+          which,
+          ": code ",
+          errcode,
+          " ",
+          reinterpret_cast<const char*>(message),
+          " at offset ",
+          erroff,
+          " in ",
+          pattern));
+    }
+    CompiledPattern re{code, pcre2_code_free};
+
+    // Not every platform has a JIT; pcre2_match interprets the pattern
+    // when JIT compilation fails.
+    pcre2_jit_compile(re.get(), PCRE2_JIT_COMPLETE);
+
+    compiledPatterns().set(key, CompiledPattern{re});
+    return re;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
     const char *pattern, *scope = "basename";
     const char* which =
         caseSensitive == CaseSensitivity::CaseInSensitive ? "ipcre" : "pcre";
-    pcre* re;
-    const char* errptr = nullptr;
-    int erroff = 0;
-    int errcode = 0;
 
     if (term.array().size() > 1 && term.at(1).isString()) {
       pattern = json_string_value(term.at(1));
@@ -93,29 +169,8 @@ class PcreExpr : public QueryExpr {
           "Invalid scope '", scope, "' for ", which, " expression"));
     }
 
-    re = pcre_compile2(
-        pattern,
-        caseSensitive == CaseSensitivity::CaseInSensitive ? PCRE_CASELESS : 0,
-        &errcode,
-        &errptr,
-        &erroff,
-        nullptr);
-    if (!re) {
-      throw QueryParseError(folly::to<std::string>(
-          "invalid ",
-          which,
-          ": code ",
-          errcode,
-          " ",
-          errptr,
-          " at offset ",
-          erroff,
-          " in ",
-          pattern));
-    }
-
     return std::make_unique<PcreExpr>(
-        re, pcre_study(re, 0, &errptr), !strcmp(scope, "wholename"));
+        compile(which, pattern, caseSensitive), !strcmp(scope, "wholename"));
   }
   static std::unique_ptr<QueryExpr> parsePcre(
       Query* query,
@@ -91,6 +91,36 @@ class SinceExpr : public QueryExpr {
     return tval >= since.timestamp;
   }
 
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase* ctx) const override {
+    auto since = spec->evaluate(
+        ctx->clockAtStartOfQuery.position(),
+        ctx->lastAgeOutTickValueAtStartOfQuery);
+
+    MetadataFilter filter;
+    switch (field) {
+      case since_what::SINCE_OCLOCK:
+      case since_what::SINCE_CCLOCK:
+        // A file's ctime is never after its otime, so bounding the former
+        // bounds the latter too
+        if (since.is_timestamp) {
+          filter.changedSince = since.timestamp;
+        } else if (since.clock.is_fresh_instance) {
+          filter.existing = true;
+        } else {
+          filter.changedAfterTicks = since.clock.ticks;
+        }
+        return filter;
+      case since_what::SINCE_MTIME:
+        filter.modifiedSince = since.timestamp;
+        return filter;
+      case since_what::SINCE_CTIME:
+        filter.statusChangedSince = since.timestamp;
+        return filter;
+    }
+    return std::nullopt;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     auto selected_field = since_what::SINCE_OCLOCK;
     const char* fieldname = "oclock";
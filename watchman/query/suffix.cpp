@@ -39,6 +39,21 @@ class SuffixExpr : public QueryExpr {
     return suffix && (suffixSet_.find(suffix) != suffixSet_.end());
   }
 
+  ExprCost cost() const override {
+    return ExprCost::Name;
+  }
+
+  std::optional<std::vector<w_string>> requiredSuffixes() const override {
+    for (auto const& suffix : suffixSet_) {
+      // hasSuffix() can match these, but they can't be the suffix() of a
+      // name, which is what views index by.
+      if (suffix.view().find_first_of("./\\") != std::string_view::npos) {
+        return std::nullopt;
+      }
+    }
+    return std::vector<w_string>(suffixSet_.begin(), suffixSet_.end());
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     std::unordered_set<w_string> suffixSet;
 
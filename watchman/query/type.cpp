@@ -77,6 +77,38 @@ class TypeExpr : public QueryExpr {
     }
   }
 
+  std::optional<DType> requiredType() const override {
+    switch (arg) {
+      case 'b':
+        return DType::Block;
+      case 'c':
+        return DType::Char;
+      case 'p':
+        return DType::Fifo;
+      case 's':
+        return DType::Socket;
+      case 'd':
+        return DType::Dir;
+      case 'f':
+        return DType::Regular;
+      case 'l':
+        return DType::Symlink;
+      default:
+        return std::nullopt;
+    }
+  }
+
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase*) const override {
+    auto type = requiredType();
+    if (!type) {
+      return std::nullopt;
+    }
+    MetadataFilter filter;
+    filter.type = type;
+    return filter;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     const char *typestr, *found;
     char arg;
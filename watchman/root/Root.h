@@ -7,14 +7,25 @@
 
 #pragma once
 
+#include <future>
 #include <memory>
 #include <unordered_map>
+#include <vector>
+#include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
+#include "watchman/CrawlHeat.h"
+#include "watchman/CursorMap.h"
 #include "watchman/IgnoreSet.h"
+#include "watchman/LRUCache.h"
+#include "watchman/LatencyProbe.h"
+#include "watchman/MemoryBudget.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PubSub.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/QueryMetrics.h"
+#include "watchman/saved_state/SavedStateCache.h"
+#include "watchman/scm/ChangedFilesCache.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
@@ -27,7 +38,9 @@ namespace watchman {
 class Root;
 struct TriggerCommand;
 class QueryableView;
+struct Query;
 struct QueryContext;
+struct QueryResult;
 class PerfSample;
 
 enum ClientStateDisposition {
@@ -145,6 +158,11 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
    */
   const std::chrono::seconds gc_age{DEFAULT_GC_AGE};
   const std::chrono::seconds idle_reap_age{0};
+  /**
+   * How long the root must go without commands before its view is
+   * compacted.  If zero, then never compact.
+   */
+  const std::chrono::seconds idle_compact_age{0};
 
   // Stream of broadcast unilateral items emitted by this root
   std::shared_ptr<Publisher> unilateralResponses;
@@ -171,6 +189,8 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   folly::Synchronized<ClientStateAssertions> assertedStates;
 
   struct Inner {
+    explicit Inner(std::chrono::seconds cursorTtl) : cursors(cursorTtl) {}
+
     /**
      * Initially false and set to false by the iothread after scheduleRecrawl.
      * Set true after fullCrawl is done.
@@ -182,14 +202,24 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     bool cancelled{false};
 
     /* map of cursor name => last observed tick value */
-    folly::Synchronized<std::unordered_map<w_string, uint32_t>> cursors;
+    CursorMap cursors;
 
     /// Set by connection threads and read on the iothread.
     std::atomic<std::chrono::steady_clock::time_point> last_cmd_timestamp{
         std::chrono::steady_clock::time_point{}};
 
+    /// The wall clock time of the last command against the root.  Unlike
+    /// last_cmd_timestamp, this is saved with the state so that the roots
+    /// that were in use are restored first when the service restarts.
+    std::atomic<std::chrono::system_clock::time_point> last_cmd_wallclock{
+        std::chrono::system_clock::time_point{}};
+
     /// Only accessed on the iothread.
     std::chrono::steady_clock::time_point last_reap_timestamp;
+
+    /// The last_cmd_timestamp as of the last compaction, so that each idle
+    /// spell compacts once.  Only accessed on the iothread.
+    std::chrono::steady_clock::time_point last_compact_cmd_timestamp;
   } inner;
 
   // For debugging and diagnostic purposes, this set references
@@ -199,6 +229,54 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   // are not changed by the query exection.
   folly::Synchronized<std::unordered_set<QueryContext*>> queries;
 
+  // The result of a subscription query, shared with the other subscriptions
+  // that run an identical query from the same clock.  `position` is the
+  // most recent root position at the time the query was started: an entry
+  // is only reused while the root is still at that position.
+  struct SharedQueryResult {
+    ClockPosition position;
+    std::shared_future<std::shared_ptr<const QueryResult>> result;
+  };
+  // map of query key => result, see buildSubscriptionResults()
+  folly::Synchronized<std::unordered_map<w_string, SharedQueryResult>>
+      sharedSubscriptionResults;
+
+  // The queries of the subscriptions that request content hashes, which
+  // the view uses to warm its caches when the root settles.  Entries
+  // expire along with their subscriptions.
+  folly::Synchronized<std::vector<std::weak_ptr<const Query>>>
+      contentHashQueries;
+
+  // The saved states found for SCM-aware queries, by merge base.  The view
+  // prefetches the ones for new merge bases when the root settles.
+  SavedStateCache savedStates;
+
+  // The files that changed since the merge bases of recent SCM-aware
+  // queries, kept up to date from the view; see w_query_execute().
+  ChangedFilesCache scmChangedFiles;
+
+  // The latencies of the queries run against this root, by command
+  QueryMetrics queryMetrics;
+
+  // Times canary files on their way to subscribers, when latency probing
+  // is enabled; see startLatencyProbeThread()
+  LatencyProbe latencyProbe;
+
+  // The parts of the root that queries are restricted to, which the crawl
+  // visits first.  Kept in the state file.
+  CrawlHeat crawlHeat;
+
+  // The results of recent queries, for identical queries that arrive while
+  // the root is still at the same position; see w_query_execute().  Not
+  // used if queryResultCacheSize is 0.
+  const size_t queryResultCacheSize;
+  LRUCache<w_string, std::shared_ptr<const QueryResult>> queryResultCache;
+
+  // The queries parsed by w_query_parse_cached(), by spec.  Not used if
+  // queryParseCacheSize is 0.
+  const size_t queryParseCacheSize;
+  LRUCache<w_string, std::shared_ptr<const Query>> queryParseCache;
+
   /**
    * Returns the view with which this Root was constructed.
    */
@@ -231,6 +309,11 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
   // Returns true if the caller should stop the watch.
   bool considerReap();
+  // Returns true if the root has been idle for long enough that the view
+  // should compact itself, which it does once per idle spell.
+  bool considerCompaction();
+  // Drops the root's caches and compacts its view
+  void compact();
   bool removeFromWatched();
   void stopThreads();
   bool stopWatch();
@@ -239,6 +322,15 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   static json_ref getStatusForAllRoots();
   json_ref getStatus() const;
 
+  // Describes the memory held by each root, for `debug-memory`
+  static json_ref getMemoryStatusForAllRoots();
+  // Lists the roots as consumers of the memory budget
+  static std::vector<MemoryBudget::Consumer> getMemoryBudgetConsumers();
+  json_ref getMemoryStatus() const;
+
+  // Adds the metrics of this root and its view to `writer`
+  void collectMetrics(MetricsWriter& writer) const;
+
   // Annotate the sample with some standard metadata taken from a root.
   void addPerfSampleMetadata(PerfSample& sample) const;
 
@@ -247,7 +339,8 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   }
 
  private:
-  const std::shared_ptr<QueryableView> view_;
+  // Only modified by the destructor, which hands it to the ViewReclaimer
+  std::shared_ptr<QueryableView> view_;
 
   /// A hook that allows saving Watchman's state after key operations. Usually
   /// holds w_state_save.
@@ -35,17 +35,7 @@ void Root::performAgeOut(std::chrono::seconds min_age) {
   view()->ageOut(sample, std::chrono::seconds(min_age));
 
   // Age out cursors too.
-  {
-    auto cursors = inner.cursors.wlock();
-    auto it = cursors->begin();
-    while (it != cursors->end()) {
-      if (it->second < view()->getLastAgeOutTickValue()) {
-        it = cursors->erase(it);
-      } else {
-        ++it;
-      }
-    }
-  }
+  inner.cursors.expire(view()->getLastAgeOutTickValue());
   if (sample.finish()) {
     addPerfSampleMetadata(sample);
     sample.log();
@@ -6,15 +6,29 @@
  */
 
 #include "watchman/watchman_dir.h"
+#include "watchman/NodeArena.h"
 #include "watchman/watchman_file.h"
 
 void watchman_dir::Deleter::operator()(watchman_file* file) const {
   free_file_node(file);
 }
 
+void watchman_dir::DirDeleter::operator()(watchman_dir* dir) const {
+  dir->~watchman_dir();
+  watchman::NodeArena::deallocate(dir, sizeof(watchman_dir));
+}
+
 watchman_dir::watchman_dir(w_string name, watchman_dir* parent)
     : name(std::move(name)), parent(parent) {}
 
+watchman_dir::Ptr watchman_dir::make(
+    watchman::NodeArena& arena,
+    w_string name,
+    watchman_dir* parent) {
+  auto mem = arena.allocate(sizeof(watchman_dir));
+  return Ptr(new (mem) watchman_dir(std::move(name), parent));
+}
+
 w_string watchman_dir::getFullPath() const {
   return getFullPathToChild(w_string_piece());
 }
@@ -52,6 +66,7 @@ w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
 
   s->refcnt = 1;
   s->len = length - 1;
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
   end = buf + s->len;
 
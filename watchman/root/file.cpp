@@ -6,6 +6,8 @@
  */
 
 #include "watchman/watchman_file.h"
+#include "watchman/FileMetadataTable.h"
+#include "watchman/NodeArena.h"
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #endif
@@ -24,29 +26,46 @@ void watchman_file::removeFromFileList() {
   }
 }
 
-/* We embed our name string in the tail end of the struct that we're
- * allocating here.  This turns out to be more memory efficient due
- * to the way that the allocator bins sizeof(watchman_file); there's
- * a bit of unusable space after the end of the structure that happens
- * to be about the right size to fit a typical filename.
- * Embedding the name in the end allows us to make the most of this
- * memory and free up the separate heap allocation for file_name.
- */
+void watchman_file::removeFromSuffixList() {
+  if (suffix_next) {
+    suffix_next->suffix_prev = suffix_prev;
+  }
+  if (suffix_prev) {
+    *suffix_prev = suffix_next;
+  }
+}
+
+void watchman_file::removeFromNameList() {
+  if (name_next) {
+    name_next->name_prev = name_prev;
+  }
+  if (name_prev) {
+    *name_prev = name_next;
+  }
+}
+
+void watchman_file::removeFromTypeList() {
+  if (type_next) {
+    type_next->type_prev = type_prev;
+  }
+  if (type_prev) {
+    *type_prev = type_next;
+  }
+  type_prev = nullptr;
+  type_next = nullptr;
+}
+
 std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
+    watchman::NodeArena& arena,
     const w_string& name,
+    const w_string& lower_name,
     watchman_dir* parent) {
-  auto file = (watchman_file*)calloc(
-      1, sizeof(watchman_file) + sizeof(uint32_t) + name.size() + 1);
+  auto file = (watchman_file*)arena.allocate(sizeof(watchman_file));
   std::unique_ptr<watchman_file, watchman_dir::Deleter> filePtr(
       file, watchman_dir::Deleter());
 
-  auto lenPtr = (uint32_t*)(file + 1);
-  *lenPtr = name.size();
-
-  auto data = (char*)(lenPtr + 1);
-  memcpy(data, name.data(), name.size());
-  data[name.size()] = 0;
-
+  new (&file->name) w_string(name);
+  new (&file->lower_name) w_string(lower_name);
   file->parent = parent;
   file->exists = true;
 
@@ -55,11 +74,20 @@ std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
 
 watchman_file::~watchman_file() {
   removeFromFileList();
+  removeFromSuffixList();
+  removeFromNameList();
+  removeFromTypeList();
+  if (metadata_table) {
+    metadata_table->remove(metadata_id);
+  }
+  for (auto dir = parent; dir; dir = dir->parent) {
+    --dir->subtreeFiles;
+  }
 }
 
 void free_file_node(struct watchman_file* file) {
   file->~watchman_file();
-  free(file);
+  watchman::NodeArena::deallocate(file, sizeof(watchman_file));
 }
 
 /* vim:ts=2:sw=2:et:
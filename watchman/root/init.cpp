@@ -8,7 +8,9 @@
 #include <folly/String.h>
 #include "watchman/Logging.h"
 #include "watchman/QueryableView.h"
+#include "watchman/Shutdown.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/ViewReclaimer.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/root/Root.h"
@@ -20,6 +22,8 @@ namespace {
 /// Idle out watches that haven't had activity in several days
 inline constexpr json_int_t kDefaultReapAge = 86400 * 5;
 inline constexpr json_int_t kDefaultSettlePeriod = 20;
+/// Forget named cursors that haven't been used for a week
+inline constexpr json_int_t kDefaultCursorTtl = 86400 * 7;
 } // namespace
 
 void ClientStateAssertions::queueAssertion(
@@ -253,7 +257,25 @@ Root::Root(
       gc_age(int(config.getInt("gc_age_seconds", DEFAULT_GC_AGE))),
       idle_reap_age(
           int(config.getInt("idle_reap_age_seconds", kDefaultReapAge))),
+      idle_compact_age(int(config.getInt("idle_compact_age_seconds", 0))),
       unilateralResponses(std::make_shared<Publisher>()),
+      inner(std::chrono::seconds(
+          config.getInt("cursor_ttl_seconds", kDefaultCursorTtl))),
+      savedStates(
+          config.getInt("saved_state_cache_size", 32),
+          std::chrono::seconds(
+              config.getInt("saved_state_cache_error_ttl_seconds", 10)),
+          config.getBool("prefetch_saved_states", true) ? 8 : 0),
+      scmChangedFiles(config.getInt("scm_changed_files_cache_size", 4)),
+      crawlHeat(config.getInt("crawl_heat_size", 64)),
+      queryResultCacheSize(config.getInt("query_result_cache_size", 32)),
+      queryResultCache(
+          std::max(queryResultCacheSize, size_t(1)),
+          std::chrono::milliseconds(0)),
+      queryParseCacheSize(config.getInt("query_parse_cache_size", 256)),
+      queryParseCache(
+          std::max(queryParseCacheSize, size_t(1)),
+          std::chrono::milliseconds(0)),
       view_{std::move(view)},
       saveGlobalStateHook_{std::move(saveGlobalStateHook)} {
   // This just opens and releases the dir.  If an exception is thrown
@@ -265,6 +287,8 @@ Root::Root(
   ++live_roots;
 
   inner.last_cmd_timestamp = std::chrono::steady_clock::now();
+  inner.last_cmd_wallclock = std::chrono::system_clock::now();
+  cookies.setCoalesceSyncs(config.getBool("coalesce_cookie_syncs", false));
 
   if (!view_->requiresCrawl) {
     // This watcher can resolve queries without needing a crawl.
@@ -278,6 +302,11 @@ Root::Root(
 
 Root::~Root() {
   logf(DBG, "root: final ref on {}\n", root_path);
+  // Tearing down a large view takes a while; don't hold up the thread that
+  // let go of the root, unless the daemon is exiting anyway
+  if (view_ && view_.use_count() == 1 && !w_is_stopping()) {
+    getViewReclaimer().reclaim(std::move(view_));
+  }
   --live_roots;
 }
 
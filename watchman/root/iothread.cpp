@@ -6,17 +6,118 @@
  */
 
 #include <fmt/chrono.h>
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <algorithm>
 #include <chrono>
+#include <optional>
+#include <thread>
 #include "watchman/Errors.h"
+#include "watchman/ThreadAccounting.h"
+#include "watchman/Trace.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/fs/DirFdCache.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/IoUringStat.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/warnerr.h"
+#include "watchman/scm/SCM.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_dir.h"
 #include "watchman/watchman_file.h"
+#include "watchman/watchman_system.h"
 
 namespace watchman {
 
+folly::Synchronized<ViewDatabase>::WLockedPtr InMemoryView::lockView() {
+  ThreadWait wait(ThreadAccount::Lock);
+  return view_.wlock();
+}
+
+folly::Synchronized<ViewDatabase>::ConstRLockedPtr InMemoryView::readView()
+    const {
+  queuedReaders_.fetch_add(1, std::memory_order_relaxed);
+  SCOPE_EXIT {
+    queuedReaders_.fetch_sub(1, std::memory_order_relaxed);
+  };
+  return view_.rlock();
+}
+
+void InMemoryView::yieldToQueuedReaders(
+    folly::Synchronized<ViewDatabase>::WLockedPtr& viewLock) {
+  // The readers take the view as soon as it's released, so this is only a
+  // bound in case one of them is descheduled between counting itself and
+  // blocking on the lock
+  constexpr auto kMaxHandoff = std::chrono::milliseconds(1);
+  viewLock.unlock();
+  auto deadline = std::chrono::steady_clock::now() + kMaxHandoff;
+  while (queuedReaders_.load(std::memory_order_relaxed) > 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  viewLock = lockView();
+  pendingSliceYields_.fetch_add(1, std::memory_order_relaxed);
+  // The readers reported the current tick, so the rest of the changes must
+  // be recorded as happening after it
+  mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+}
+
+bool InMemoryView::beginIncompleteRead(const std::shared_ptr<Root>& root) {
+  if (root->inner.done_initial.load(std::memory_order_acquire)) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock{incompleteReads_.mutex};
+    ++incompleteReads_.waiting;
+  }
+  bool crawling;
+  {
+    // The crawl releases the view at the end of its current batch
+    ThreadWait wait(ThreadAccount::Lock);
+    auto view = readView();
+    // done_initial is set under the view lock, so this is what the query
+    // will see
+    crawling = !root->inner.done_initial.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> lock{incompleteReads_.mutex};
+    --incompleteReads_.waiting;
+    if (crawling) {
+      ++incompleteReads_.reading;
+    }
+  }
+  incompleteReads_.cond.notify_all();
+  return crawling;
+}
+
+void InMemoryView::endIncompleteRead() {
+  {
+    std::lock_guard<std::mutex> lock{incompleteReads_.mutex};
+    --incompleteReads_.reading;
+  }
+  incompleteReads_.cond.notify_all();
+}
+
+bool InMemoryView::yieldToIncompleteReads() {
+  if (!crawlProgress_ || !crawlProgress_->viewLock) {
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lock{incompleteReads_.mutex};
+    if (incompleteReads_.waiting == 0) {
+      return false;
+    }
+    crawlProgress_->viewLock->unlock();
+    incompleteReads_.cond.wait_for(lock, incompleteReadYield_, [&] {
+      return incompleteReads_.waiting == 0 && incompleteReads_.reading == 0;
+    });
+  }
+  *crawlProgress_->viewLock = lockView();
+  // The queries reported the current tick along with what had been crawled
+  // so far, so the rest of the crawl must be recorded as happening after it
+  // for their next since query to find it.
+  mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  return true;
+}
+
 std::shared_future<void> InMemoryView::waitUntilReadyToQuery(
     const std::shared_ptr<Root>& root) {
   auto lockPair = acquireLockedPair(root->recrawlInfo, crawlState_);
@@ -43,19 +144,85 @@ std::shared_future<void> InMemoryView::waitUntilReadyToQuery(
 void InMemoryView::fullCrawl(
     const std::shared_ptr<Root>& root,
     PendingCollection& pendingFromWatcher,
-    PendingChanges& localPending) {
+    PendingChanges& localPending,
+    bool clientMode) {
+  TraceSpan span("io", "fullCrawl");
   root->recrawlInfo.wlock()->crawlStart = std::chrono::steady_clock::now();
 
   PerfSample sample("full-crawl");
 
-  auto view = view_.wlock();
+  auto view = lockView();
   // Ensure that we observe these files with a new, distinct clock,
   // otherwise a fresh subscription established immediately after a watch
   // can get stuck with an empty view until another change is observed
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
+  // After a daemon restart, start from what we knew last time.  The crawl
+  // below still visits every dir, but unchanged files are then merely
+  // revalidated, and unchanged dirs may not even be read.
+  bool restored = loadSnapshot(*view);
+  // A watcher that can replay what changed while the daemon was down makes
+  // crawling the restored tree unnecessary.  Nothing watches between client
+  // mode invocations.
+  bool resumed = restored && !clientMode &&
+      !snapshotWatcherPosition_.empty() &&
+      watcher_->resumeFromStreamPosition(snapshotWatcherPosition_);
+  snapshotWatcherPosition_.clear();
+
+  // Index the parts of the tree that queries use before the rest.  A lazy
+  // crawl materializes them up front.
+  std::vector<w_string> crawlFirst;
+  for (auto& path : root->crawlHeat.hottest()) {
+    crawlFirst.push_back(w_string::pathCat({rootPath_, path}));
+  }
+  if (lazyCrawlDepth_ > 0) {
+    auto lazy = lazyCrawl_.wlock();
+    std::vector<w_string> toCrawl;
+    for (auto& path : crawlFirst) {
+      addMaterialized(*lazy, path, toCrawl);
+    }
+  }
+
+  if (crawlProfileSize_ > 0) {
+    crawlProfiler_ = std::make_unique<CrawlProfiler>();
+  }
+  crawlProgress_.emplace();
+  crawlProgress_->start = std::chrono::steady_clock::now();
+  crawlProgress_->lastReport = crawlProgress_->start;
+  crawlProgress_->expectedFiles = view->getNumFiles();
+  crawlProgress_->viewLock = &view;
+  SCOPE_EXIT {
+    crawlProfiler_.reset();
+    crawlProgress_.reset();
+  };
+
   auto start = std::chrono::system_clock::now();
-  pendingFromWatcher.lock()->add(root->root_path, start, W_PENDING_RECURSIVE);
+  PendingFlags crawlFlags = W_PENDING_RECURSIVE;
+  if (recrawlSkipUnchangedDirs_ &&
+      root->recrawlInfo.rlock()->recrawlCount > 0 &&
+      is_dir_mtime_reliable_fs_type(root->fs_type)) {
+    // The view still holds what the previous crawl found, so only the dirs
+    // that changed since need to be read again
+    crawlFlags.set(W_PENDING_SKIP_UNCHANGED);
+  } else if (
+      restored &&
+      (clientMode ? clientModeSkipUnchangedDirs_
+                  : snapshotSkipUnchangedDirs_) &&
+      is_dir_mtime_reliable_fs_type(root->fs_type)) {
+    // Nothing was watching since the snapshot was written, neither between
+    // client mode invocations nor while the service was down, but the dirs
+    // whose mtime matches the snapshot still hold what it recorded
+    crawlFlags.set(W_PENDING_SKIP_UNCHANGED);
+  }
+  if (resumed) {
+    logf(
+        ERR,
+        "resuming {} from its view snapshot without a crawl\n",
+        rootPath_);
+    sample.add_meta("resumed_from_snapshot", json_true());
+  } else {
+    pendingFromWatcher.lock()->add(root->root_path, start, crawlFlags);
+  }
   while (true) {
     // There is the potential for a subtle race condition here.  Since we now
     // coalesce overlaps we must consume our outstanding set before we merge
@@ -65,14 +232,29 @@ void InMemoryView::fullCrawl(
     // inotify, then the inner loop processes it and any dirs that we pick up
     // from recursive processing.
     {
-      auto lock = pendingFromWatcher.lock();
-      localPending.append(lock->stealItems(), lock->stealSyncs());
+      std::vector<PendingChain> items;
+      std::vector<folly::Promise<folly::Unit>> syncs;
+      {
+        auto lock = pendingFromWatcher.lock();
+        items = lock->stealAllItems();
+        syncs = lock->stealSyncs();
+      }
+      localPending.append(std::move(items), std::move(syncs));
     }
     if (localPending.empty()) {
       break;
     }
 
-    (void)processAllPending(root, *view, localPending);
+    (void)processAllPending(
+        root, *view, localPending, nullptr, nullptr, &crawlFirst);
+  }
+
+  if (crawlProfiler_) {
+    // The dirs that it refers to are alive for as long as we hold the view
+    // lock
+    *crawlProfile_.wlock() =
+        crawlProfiler_->finish(rootPath_, crawlProfileSize_);
+    crawlProfiler_.reset();
   }
 
   auto [recrawlInfo, crawlState] =
@@ -94,6 +276,19 @@ void InMemoryView::fullCrawl(
 
   root->cookies.abortAllCookies();
 
+  // For the clients that watched without waiting for this
+  root->unilateralResponses->enqueue(json_object(
+      {{"crawl-ready",
+        json_object(
+            {{"dirs", json_integer(json_int_t(crawlProgress_->dirs))},
+             {"files", json_integer(json_int_t(crawlProgress_->entries))},
+             {"elapsed_ms",
+              json_integer(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() -
+                      crawlProgress_->start)
+                      .count())}})}}));
+
   root->addPerfSampleMetadata(sample);
 
   sample.finish();
@@ -104,6 +299,7 @@ void InMemoryView::fullCrawl(
 }
 
 InMemoryView::Continue InMemoryView::doSettleThings(Root& root) {
+  TraceSpan span("io", "doSettleThings");
   // No new pending items were given to us, so consider that
   // we may now be settled.
 
@@ -114,6 +310,24 @@ InMemoryView::Continue InMemoryView::doSettleThings(Root& root) {
 
   warmContentCache();
 
+  if (!snapshotPath_.empty() &&
+      std::chrono::steady_clock::now() - lastSnapshot_ >= snapshotInterval_) {
+    saveSnapshot();
+  }
+
+  recordChangeSet();
+  warmContentCacheForQueries(root);
+
+  if (auto scm = getSCM()) {
+    // Resolving the merge bases may run the SCM, so it happens on the thread
+    // pool, which holds the root for as long as it needs the scm.
+    root.savedStates.prefetch([rootPtr = root.shared_from_this(),
+                               scm](const w_string& mergeBaseWith) {
+      return scm->mergeBaseWith(mergeBaseWith);
+    });
+  }
+
+  root.latencyProbe.settled(std::chrono::system_clock::now());
   root.unilateralResponses->enqueue(json_object({{"settled", json_true()}}));
 
   if (root.considerReap()) {
@@ -121,13 +335,17 @@ InMemoryView::Continue InMemoryView::doSettleThings(Root& root) {
     return Continue::Stop;
   }
 
+  if (root.considerCompaction()) {
+    root.compact();
+  }
+
   root.considerAgeOut();
   return Continue::Continue;
 }
 
 void InMemoryView::clientModeCrawl(const std::shared_ptr<Root>& root) {
   PendingChanges pending;
-  fullCrawl(root, pendingFromWatcher_, pending);
+  fullCrawl(root, pendingFromWatcher_, pending, /*clientMode=*/true);
 }
 
 bool InMemoryView::handleShouldRecrawl(Root& root) {
@@ -157,6 +375,11 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
        root.idle_reap_age < biggest_timeout)) {
     biggest_timeout = root.idle_reap_age;
   }
+  if (root.idle_compact_age.count() != 0 &&
+      (biggest_timeout.count() == 0 ||
+       root.idle_compact_age < biggest_timeout)) {
+    biggest_timeout = root.idle_compact_age;
+  }
   if (biggest_timeout.count() == 0) {
     biggest_timeout = std::chrono::hours(24);
   }
@@ -165,12 +388,31 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
 
 } // namespace
 
+std::chrono::milliseconds InMemoryView::settlePeriod(const Root& root) const {
+  if (!settleController_) {
+    return root.trigger_settle;
+  }
+  return settleController_->lock()->settle(std::chrono::steady_clock::now());
+}
+
 void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
   IoThreadState state{getBiggestTimeout(*root)};
-  state.currentTimeout = root->trigger_settle;
+  state.currentTimeout = settlePeriod(*root);
 
   while (Continue::Continue == stepIoThread(root, state, pendingFromWatcher_)) {
   }
+
+  if (snapshotDiscarded_.load(std::memory_order_acquire)) {
+    // The root was unwatched; we're the only writer, so nothing can
+    // recreate it after this
+    if (!snapshotPath_.empty()) {
+      unlink(snapshotPath_.c_str());
+    }
+  } else if (root->inner.done_initial.load(std::memory_order_acquire)) {
+    // Capture anything that changed since the last settle so that a
+    // restart doesn't have to rediscover it.
+    saveSnapshot();
+  }
 }
 
 InMemoryView::Continue InMemoryView::stepIoThread(
@@ -185,32 +427,55 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     /* first order of business is to find all the files under our root */
     fullCrawl(root, pendingFromWatcher, state.localPending);
 
-    state.currentTimeout = root->trigger_settle;
+    state.currentTimeout = settlePeriod(*root);
   }
 
   // Wait for the notify thread to give us pending items, or for
   // the settle period to expire
   bool pinged;
+  std::vector<PendingRename> renames;
   {
-    logf(DBG, "poll_events timeout={}ms\n", state.currentTimeout);
-    auto targetPendingLock =
-        pendingFromWatcher.lockAndWait(state.currentTimeout, pinged);
-    logf(DBG, " ... wake up (pinged={})\n", pinged);
-    state.localPending.append(
-        targetPendingLock->stealItems(), targetPendingLock->stealSyncs());
+    std::vector<PendingChain> items;
+    std::vector<folly::Promise<folly::Unit>> syncs;
+    {
+      logf(DBG, "poll_events timeout={}ms\n", state.currentTimeout);
+      auto targetPendingLock =
+          pendingFromWatcher.lockAndWait(state.currentTimeout, pinged);
+      logf(DBG, " ... wake up (pinged={})\n", pinged);
+      items = targetPendingLock->stealAllItems();
+      syncs = targetPendingLock->stealSyncs();
+      renames = targetPendingLock->stealRenames();
+    }
+    if (settleController_ && !items.empty()) {
+      size_t numChanges = 0;
+      for (auto& chain : items) {
+        for (auto item = chain.get(); item; item = item->next.get()) {
+          ++numChanges;
+        }
+      }
+      settleController_->lock()->observe(
+          std::chrono::steady_clock::now(), numChanges);
+    }
+    // Merge outside of the lock so that the notify thread can keep handing
+    // us changes in the meantime.
+    state.localPending.append(std::move(items), std::move(syncs));
   }
 
+  // Spans the work done after waking, not the wait itself
+  TraceSpan span("io", "stepIoThread");
+
   // Do we need to recrawl?
   if (handleShouldRecrawl(*root)) {
     // TODO: can this just continue? handleShouldRecrawl sets done_initial to
     // false.
     fullCrawl(root, pendingFromWatcher, state.localPending);
-    state.currentTimeout = root->trigger_settle;
+    state.currentTimeout = settlePeriod(*root);
     return Continue::Continue;
   }
 
   // Waiting for an event timed out, so consider the root settled.
   if (!pinged && state.localPending.empty()) {
+    refreshSummaryDirs(root);
     if (Continue::Stop == doSettleThings(*root)) {
       return Continue::Stop;
     }
@@ -223,7 +488,7 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 
   // We are now, by definition, unsettled, so reduce sleep timeout
   // to the settle duration ready for the next loop through
-  state.currentTimeout = root->trigger_settle;
+  state.currentTimeout = settlePeriod(*root);
 
   // Some Linux 5.6 kernels will report inotify events before the file has
   // been evicted from the cache, causing Watchman to incorrectly think the
@@ -237,7 +502,10 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     std::this_thread::sleep_for(std::chrono::milliseconds(notify_sleep_ms));
   }
 
-  auto view = view_.wlock();
+  auto preStats =
+      prefetchPendingStats(*root, root->cookies, state.localPending);
+
+  auto view = lockView();
 
   // fullCrawl unconditionally sets done_initial to true and if
   // handleShouldRecrawl set it false, execution wouldn't reach this part of
@@ -248,7 +516,12 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
-  auto isDesynced = processAllPending(root, *view, state.localPending);
+  if (!renames.empty()) {
+    applyRenames(*root, *view, state.localPending, renames);
+  }
+
+  auto isDesynced =
+      processAllPending(root, *view, state.localPending, &preStats, &view);
   if (isDesynced == IsDesynced::Yes) {
     logf(ERR, "recrawl complete, aborting all pending cookies\n");
     root->cookies.abortAllCookies();
@@ -256,16 +529,249 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   return Continue::Continue;
 }
 
+InMemoryView::PendingStats InMemoryView::prefetchPendingStats(
+    const RootConfig& root,
+    const CookieSync& cookies,
+    const PendingChanges& pending) {
+  // Mirror the dispatch in processPath: only the items that go to statPath
+  // benefit.  Crawls enumerate the dir and must hold the lock throughout.
+  auto notified = watcher_->takeNotifiedStats();
+  PendingStats result;
+  std::vector<w_string> paths;
+  for (auto item = pending.peekItems(); item; item = item->next.get()) {
+    if ((item->flags & W_PENDING_CRAWL_ONLY) ||
+        w_string_equal(item->path, rootPath_) ||
+        cookies.isCookiePrefix(item->path)) {
+      continue;
+    }
+    auto it = notified.find(item->path);
+    if (it != notified.end()) {
+      // The watcher already told us what we'd learn from a stat
+      result.emplace(item->path, DirEntry{true, nullptr, it->second});
+      continue;
+    }
+    paths.push_back(item->path);
+  }
+
+  std::vector<DirEntry> entries(paths.size(), DirEntry{false, nullptr, {}});
+  if (ioUringStat_ && root.case_sensitive == CaseSensitivity::CaseSensitive) {
+    // statx can't perform the extra name checks that getFileInformation
+    // does for case insensitive roots, so those use the other strategies.
+    try {
+      std::vector<w_string> toStat;
+      std::vector<size_t> indices;
+      for (size_t i = 0; i < paths.size(); ++i) {
+        if (!root.ignore.isIgnoreDir(paths[i])) {
+          toStat.push_back(paths[i]);
+          indices.push_back(i);
+        }
+      }
+      auto stats = ioUringStat_->statAll(toStat, statOptions_);
+      for (size_t i = 0; i < stats.size(); ++i) {
+        if (stats[i]) {
+          entries[indices[i]].stat = *stats[i];
+          entries[indices[i]].has_stat = true;
+        }
+      }
+    } catch (const std::system_error& exc) {
+      // statPath stats anything we missed under the lock
+      logf(ERR, "io_uring stat failed, disabling it: {}\n", exc.what());
+      ioUringStat_.reset();
+    }
+  } else if (crawlPool_ && paths.size() >= crawlParallelMinEntries_) {
+    prefetchCrawlStats(root, paths, entries);
+  } else {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      if (root.ignore.isIgnoreDir(paths[i])) {
+        continue;
+      }
+      try {
+        entries[i].stat = getEntryInformation(root, paths[i]);
+        entries[i].has_stat = true;
+      } catch (const std::system_error&) {
+        // statPath will try again and handle the error.
+      }
+    }
+  }
+
+  result.reserve(result.size() + paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (entries[i].has_stat) {
+      result.emplace(std::move(paths[i]), entries[i]);
+    }
+  }
+  return result;
+}
+
+namespace {
+
+/**
+ * Splits `chain` into the items for which `urgent` returns true and the
+ * rest, preserving their order.
+ */
+template <typename Predicate>
+std::pair<PendingChain, PendingChain> partitionChain(
+    PendingChain chain,
+    Predicate urgent) {
+  PendingChain heads[2];
+  PendingChain* tails[2] = {&heads[0], &heads[1]};
+  while (chain) {
+    auto next = std::move(chain->next);
+    auto lane = urgent(*chain) ? 0 : 1;
+    *tails[lane] = std::move(chain);
+    tails[lane] = &(*tails[lane])->next;
+    chain = std::move(next);
+  }
+  return {std::move(heads[0]), std::move(heads[1])};
+}
+
+} // namespace
+
+void InMemoryView::applyRenames(
+    const RootConfig& root,
+    ViewDatabase& view,
+    PendingChanges& pending,
+    const std::vector<PendingRename>& renames) {
+  for (auto& rename : renames) {
+    if (root.ignore.isIgnored(rename.to.data(), rename.to.size()) ||
+        !view.renameDir(
+            *watcher_, rename.from, rename.to, getClock(rename.now))) {
+      // The changes that the watcher reported for both paths take care of
+      // it, at the cost of crawling the new path from scratch.
+      continue;
+    }
+
+    // Changes that were reported before the rename refer to the old path,
+    // and the files that they affected moved, so look at them there too.
+    std::vector<PendingChange> moved;
+    for (auto item = pending.peekItems(); item; item = item->next.get()) {
+      if (item->path.size() > rename.from.size() &&
+          is_path_prefix(item->path, rename.from)) {
+        moved.push_back(PendingChange{
+            w_string::build(
+                rename.to,
+                w_string_piece(
+                    item->path.data() + rename.from.size(),
+                    item->path.size() - rename.from.size())),
+            item->now,
+            item->flags});
+      }
+    }
+    for (auto& change : moved) {
+      pending.add(change.path, change.now, change.flags);
+    }
+
+    pending.add(
+        rename.to,
+        rename.now,
+        W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY | W_PENDING_TRUST_READDIR);
+  }
+}
+
 InMemoryView::IsDesynced InMemoryView::processAllPending(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
-    PendingChanges& coll) {
+    PendingChanges& coll,
+    const PendingStats* preStats,
+    folly::Synchronized<ViewDatabase>::WLockedPtr* viewLock,
+    const std::vector<w_string>* crawlFirst) {
+  TraceSpan span("io", "processAllPending");
   auto desyncState = IsDesynced::No;
 
   // Don't resolve any of these until any recursive crawls are done.
   std::vector<std::vector<folly::Promise<folly::Unit>>> allSyncs;
 
-  while (!coll.empty()) {
+  // If queries are waiting to synchronize, the changes that can affect them
+  // and the cookies that they're waiting for are applied first, and the
+  // rest are set aside in `deferred` until that's done.
+  PriorityPaths::Waiting waiting;
+  if (viewLock && priorityYieldTimeout_.count() > 0) {
+    waiting = priorityPaths_.waiting();
+  } else if (crawlFirst) {
+    waiting.paths = *crawlFirst;
+  }
+  std::vector<PendingChain> deferred;
+  bool sawCookie = false;
+  auto isUrgent = [&](const PendingChange& pending) {
+    if (root->cookies.isCookiePrefix(pending.path)) {
+      sawCookie = true;
+      return true;
+    }
+    return PriorityPaths::isRelevant(waiting.paths, pending.path);
+  };
+
+  // If viewLock is provided, the changes are applied in slices of at most
+  // pending_slice_ms and pending_slice_items, and queries that are waiting
+  // to read the view get it between slices.  Once a cookie has been applied,
+  // the query waiting on it must see every change that came before it, so
+  // the view is held until the rest have been applied.
+  auto heldSince = std::chrono::steady_clock::now();
+  auto sliceStart = heldSince;
+  size_t sliceItems = 0;
+  bool mayYield = viewLock &&
+      (pendingSliceBudget_.count() > 0 || pendingSliceItems_ > 0);
+  auto endSlice = [&](std::chrono::steady_clock::time_point now) {
+    if (viewLock) {
+      pendingLockHeld_.record(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              now - heldSince));
+    }
+  };
+  auto startSlice = [&] {
+    heldSince = std::chrono::steady_clock::now();
+    sliceStart = heldSince;
+    sliceItems = 0;
+  };
+  auto maybeEndSlice = [&](const PendingChange& applied) {
+    if (!mayYield) {
+      return;
+    }
+    if (root->cookies.isCookiePrefix(applied.path)) {
+      mayYield = false;
+      return;
+    }
+    ++sliceItems;
+    auto now = std::chrono::steady_clock::now();
+    bool exhausted =
+        (pendingSliceItems_ > 0 && sliceItems >= pendingSliceItems_) ||
+        (pendingSliceBudget_.count() > 0 &&
+         now - sliceStart >= pendingSliceBudget_);
+    if (!exhausted) {
+      return;
+    }
+    if (queuedReaders_.load(std::memory_order_relaxed) > 0) {
+      endSlice(now);
+      yieldToQueuedReaders(*viewLock);
+      startSlice();
+    } else {
+      // Nobody is waiting, so carry on without releasing the view
+      sliceStart = now;
+      sliceItems = 0;
+    }
+  };
+
+  while (!coll.empty() || !deferred.empty()) {
+    if (coll.empty()) {
+      // Everything that the waiting queries care about has been applied.
+      // If their cookies were among it, let them read the view before we
+      // get on with the rest.
+      if (sawCookie && viewLock) {
+        endSlice(std::chrono::steady_clock::now());
+        viewLock->unlock();
+        priorityPaths_.waitForSyncedQueries(
+            waiting.numQueries, priorityYieldTimeout_);
+        *viewLock = lockView();
+        startSlice();
+        // The queries reported the current tick, so the rest must be
+        // recorded as happening after it.
+        mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+      }
+      waiting.paths.clear();
+      coll.append(std::move(deferred), {});
+      deferred.clear();
+      continue;
+    }
+
     logf(
         DBG,
         "processing {} events in {}\n",
@@ -282,6 +788,29 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
       allSyncs.push_back(std::move(syncs));
     }
 
+    if (!waiting.paths.empty()) {
+      auto [urgent, rest] = partitionChain(std::move(pending), isUrgent);
+      pending = std::move(urgent);
+      if (rest) {
+        deferred.push_back(std::move(rest));
+      }
+    }
+
+    if ((ioShardPool_ || crawlPool_) && !stopThreads_) {
+      for (auto item = pending.get(); item; item = item->next.get()) {
+        // See below
+        if ((item->flags & W_PENDING_IS_DESYNCED) &&
+            (item->flags & W_PENDING_CRAWL_ONLY)) {
+          desyncState = IsDesynced::Yes;
+        }
+      }
+      if (ioShardPool_) {
+        processShardedBatch(root, view, coll, std::move(pending), preStats);
+      } else {
+        pending = crawlSiblingDirs(root, view, coll, std::move(pending));
+      }
+    }
+
     while (pending) {
       if (!stopThreads_) {
         if (pending->flags & W_PENDING_IS_DESYNCED) {
@@ -298,15 +827,44 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
           }
         }
 
+        const DirEntry* pre_stat = nullptr;
+        if (preStats) {
+          auto it = preStats->find(pending->path);
+          if (it != preStats->end()) {
+            pre_stat = &it->second;
+          }
+        }
+
         // processPath may insert new pending items into `coll`,
-        processPath(root, view, coll, *pending, nullptr);
+        processPath(root, view, coll, *pending, pre_stat);
+        maybeEndSlice(*pending);
       }
 
       // TODO: Document that continuing to run this loop when stopThreads_ is
       // true fixes a stack overflow when pending is long.
       pending = std::move(pending->next);
     }
+
+    // Anything added to `coll` since was generated while applying the first
+    // batch and may postdate the prefetched stats.  So may anything that was
+    // deferred, by the time we get to it.
+    preStats = nullptr;
+    // The changes that we just applied may have renamed the dirs that
+    // these refer to.
+    if (dirFds_) {
+      dirFds_->clear();
+    }
+    watcher_->flushWatches();
+
+    // Queries that accept incomplete results may read the view between the
+    // batches of the crawl
+    auto beforeYield = std::chrono::steady_clock::now();
+    if (yieldToIncompleteReads()) {
+      endSlice(beforeYield);
+      startSlice();
+    }
   }
+  endSlice(std::chrono::steady_clock::now());
 
   for (auto& outer : allSyncs) {
     for (auto& sync : outer) {
@@ -317,12 +875,73 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   return desyncState;
 }
 
+PendingChain InMemoryView::crawlSiblingDirs(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    PendingChain pending) {
+  size_t numCrawls = 0;
+  for (auto item = pending.get(); item; item = item->next.get()) {
+    if (isCrawl(*item)) {
+      ++numCrawls;
+    }
+  }
+  if (numCrawls < 2) {
+    return pending;
+  }
+  TraceSpan span("io", "crawlSiblingDirs");
+
+  auto [crawls, rest] = partitionChain(
+      std::move(pending),
+      [this](const PendingChange& item) { return isCrawl(item); });
+  std::vector<const PendingChange*> items;
+  for (auto item = crawls.get(); item; item = item->next.get()) {
+    if (admitPath(*root, view, *item)) {
+      items.push_back(item);
+    }
+  }
+
+  auto listings = readCrawlDirs(root, view, coll, items, crawlPool_.get());
+  for (auto& listing : listings) {
+    auto statStart = std::chrono::steady_clock::now();
+    prefetchCrawlStats(*root, listing.paths, listing.entries);
+    listing.statTime = std::chrono::steady_clock::now() - statStart;
+    applyCrawl(root, view, coll, listing);
+  }
+
+  // Free the crawled items one by one, as a long chain would recurse
+  while (crawls) {
+    crawls = std::move(crawls->next);
+  }
+  return std::move(rest);
+}
+
 void InMemoryView::processPath(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending,
     const DirEntry* pre_stat) {
+  if (!admitPath(*root, view, pending)) {
+    return;
+  }
+
+  if (isCrawl(pending)) {
+    crawler(root, view, coll, pending);
+  } else {
+    statPath(*root, root->cookies, view, coll, pending, pre_stat);
+  }
+}
+
+bool InMemoryView::isCrawl(const PendingChange& pending) const {
+  return w_string_equal(pending.path, rootPath_) ||
+      (pending.flags & W_PENDING_CRAWL_ONLY);
+}
+
+bool InMemoryView::admitPath(
+    Root& root,
+    ViewDatabase& view,
+    const PendingChange& pending) {
   w_assert(
       pending.path.size() >= rootPath_.size(),
       "full_path must be a descendant of the root directory\n");
@@ -341,14 +960,14 @@ void InMemoryView::processPath(
    *
    * The below condition is true for cases 1 and 2 and false for 3 and 4.
    */
-  if (root->cookies.isCookiePrefix(pending.path)) {
+  if (root.cookies.isCookiePrefix(pending.path)) {
     bool consider_cookie;
     if (watcher_->flags & WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
       // The watcher gives us file level notification, thus only consider
       // cookies if this path is coming directly from the watcher, not from a
       // recursive crawl.
       consider_cookie = (pending.flags & W_PENDING_VIA_NOTIFY) ||
-          !root->inner.done_initial.load(std::memory_order_acquire);
+          !root.inner.done_initial.load(std::memory_order_acquire);
     } else {
       // If we are de-synced, we shouldn't consider cookies as we are currently
       // walking directories recursively and we need to wait for after the
@@ -358,19 +977,137 @@ void InMemoryView::processPath(
           (pending.flags & W_PENDING_IS_DESYNCED) != W_PENDING_IS_DESYNCED;
     }
 
-    if (consider_cookie) {
-      root->cookies.notifyCookie(pending.path);
+    if (consider_cookie &&
+        !root.latencyProbe.observe(
+            pending.path, pending.now, std::chrono::system_clock::now())) {
+      root.cookies.notifyCookie(pending.path);
     }
 
     // Never allow cookie files to show up in the tree
-    return;
+    return false;
   }
 
-  if (w_string_equal(pending.path, rootPath_) ||
-      (pending.flags & W_PENDING_CRAWL_ONLY)) {
-    crawler(root, view, coll, pending);
-  } else {
-    statPath(*root, root->cookies, view, coll, pending, pre_stat);
+  if (auto index = summaryDirContaining(pending.path)) {
+    // The dir's own node is kept up to date like any other, but nothing
+    // beneath it gets one
+    if (pending.path.size() != summaryDirPaths_[*index].size() ||
+        isCrawl(pending)) {
+      markSummaryDirChanged(view, *index, pending.now);
+      return false;
+    }
+  }
+
+  if (lazyCrawlDepth_ > 0) {
+    // Leave the contents of deferred dirs out of the view until a query
+    // materializes them
+    auto dir = (pending.flags & W_PENDING_CRAWL_ONLY) ? pending.path
+                                                      : pending.path.dirName();
+    if (!w_string_equal(dir, rootPath_) && shouldDeferCrawl(root, dir)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void InMemoryView::processShardedBatch(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    PendingChain pending,
+    const PendingStats* preStats) {
+  TraceSpan span("io", "processShardedBatch");
+
+  // Unlink the items as we go so that freeing a long chain doesn't recurse
+  std::vector<PendingChain> items;
+  while (pending) {
+    auto next = std::move(pending->next);
+    items.push_back(std::move(pending));
+    pending = std::move(next);
+  }
+
+  // Start watching and read each dir that is to be crawled, and set aside
+  // the items that are to be stat'ed
+  std::vector<const PendingChange*> crawlItems;
+  std::vector<const PendingChange*> statItems;
+  for (auto& item : items) {
+    if (!admitPath(*root, view, *item)) {
+      continue;
+    }
+    if (isCrawl(*item)) {
+      crawlItems.push_back(item.get());
+    } else {
+      statItems.push_back(item.get());
+    }
+  }
+  auto listings =
+      readCrawlDirs(root, view, coll, crawlItems, ioShardPool_.get());
+
+  // Gather everything that the batch needs to stat, sharded by parent dir
+  // so that the entries of a dir are stat'ed together
+  std::vector<DirEntry> statEntries(
+      statItems.size(), DirEntry{false, nullptr, {}});
+  std::vector<std::vector<std::pair<const w_string*, DirEntry*>>> shards(
+      ioShards_);
+  auto addWork = [&](const w_string& path, DirEntry& entry) {
+    if (entry.has_stat || root->ignore.isIgnoreDir(path)) {
+      return;
+    }
+    auto shard = w_string_piece(path).dirName().hashValue() % ioShards_;
+    shards[shard].emplace_back(&path, &entry);
+  };
+  for (size_t i = 0; i < statItems.size(); ++i) {
+    if (preStats) {
+      auto it = preStats->find(statItems[i]->path);
+      if (it != preStats->end()) {
+        statEntries[i] = it->second;
+        continue;
+      }
+    }
+    addWork(statItems[i]->path, statEntries[i]);
+  }
+  for (auto& listing : listings) {
+    for (size_t i = 0; i < listing.paths.size(); ++i) {
+      addWork(listing.paths[i], listing.entries[i]);
+    }
+  }
+
+  {
+    std::vector<folly::Future<folly::Unit>> futures;
+    // The lambdas capture references to locals, so we must wait for all of
+    // them to complete before leaving this scope
+    SCOPE_EXIT {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    };
+    for (auto& shard : shards) {
+      if (shard.empty()) {
+        continue;
+      }
+      futures.emplace_back(
+          folly::via(ioShardPool_.get(), [this, &root, &shard] {
+            auto slot = acquireIoSlot();
+            for (auto& [path, entry] : shard) {
+              try {
+                entry->stat = getEntryInformation(*root, *path);
+                entry->has_stat = true;
+              } catch (const std::system_error&) {
+                // statPath will try again and handle the error
+              }
+            }
+          }));
+    }
+  }
+
+  for (auto& listing : listings) {
+    applyCrawl(root, view, coll, listing);
+  }
+  for (size_t i = 0; i < statItems.size(); ++i) {
+    statPath(
+        *root,
+        root->cookies,
+        view,
+        coll,
+        *statItems[i],
+        statEntries[i].has_stat ? &statEntries[i] : nullptr);
   }
 }
 
@@ -392,6 +1129,36 @@ void InMemoryView::crawler(
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending) {
+  TraceSpan span("io", "crawler", pending.path.view());
+  auto listing = readCrawlDir(root, view, coll, pending);
+  if (!listing) {
+    return;
+  }
+  if (crawlPool_) {
+    auto statStart = std::chrono::steady_clock::now();
+    prefetchCrawlStats(*root, listing->paths, listing->entries);
+    listing->statTime = std::chrono::steady_clock::now() - statStart;
+  }
+  applyCrawl(root, view, coll, *listing);
+}
+
+std::optional<InMemoryView::CrawlListing> InMemoryView::readCrawlDir(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    const PendingChange& pending) {
+  auto opened = openCrawlDir(root, view, pending);
+  if (!opened) {
+    return std::nullopt;
+  }
+  readCrawlEntries(*opened);
+  return listCrawlDir(root, view, coll, *opened);
+}
+
+std::optional<InMemoryView::OpenedCrawlDir> InMemoryView::openCrawlDir(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    const PendingChange& pending) {
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
 
   bool stat_all;
@@ -406,6 +1173,10 @@ void InMemoryView::crawler(
     // directory was added by the watcher.
     stat_all = pending.flags.contains(W_PENDING_NONRECURSIVE_SCAN);
   }
+  if (pending.flags.contains(W_PENDING_IS_DESYNCED)) {
+    // The watcher may have missed changes to any of the entries
+    stat_all = true;
+  }
 
   auto dir = view.resolveDir(pending.path, true);
 
@@ -421,6 +1192,7 @@ void InMemoryView::crawler(
   // left the cookie sync mechanism broken forever.
   if (pending.path == root->root_path) {
     try {
+      ThreadWait wait(ThreadAccount::Io);
       auto st = fileSystem_.getFileInformation(
           pending.path.c_str(), root->case_sensitive);
       if (st.ino != view.getRootInode()) {
@@ -432,7 +1204,7 @@ void InMemoryView::crawler(
         if (view.getRootInode() != 0) {
           root->scheduleRecrawl(
               "root was replaced and we didn't get notified by the kernel");
-          return;
+          return std::nullopt;
         }
         recursive = true;
         view.setRootInode(st.ino);
@@ -441,7 +1213,7 @@ void InMemoryView::crawler(
       handle_open_errno(
           *root, dir, pending.now, "getFileInformation", err.code());
       view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
-      return;
+      return std::nullopt;
     }
   }
 
@@ -456,95 +1228,344 @@ void InMemoryView::crawler(
    * Whether we open the dir prior to watching or after is watcher specific,
    * so the operations are rolled together in our abstraction */
   std::unique_ptr<DirHandle> osdir;
+  auto readStart = std::chrono::steady_clock::now();
 
   try {
+    ThreadWait wait(ThreadAccount::Io);
     osdir = watcher_->startWatchDir(root, dir, path);
   } catch (const std::system_error& err) {
     logf(DBG, "startWatchDir({}) threw {}\n", path, err.what());
     handle_open_errno(*root, dir, pending.now, "opendir", err.code());
     view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
-    return;
+    return std::nullopt;
   }
 
-  if (dir->files.empty()) {
-    // Pre-size our hash(es) if we can, so that we can avoid collisions
-    // and re-hashing during initial crawl
-    uint32_t num_dirs = 0;
+  const bool isNewDir = dir->files.empty();
+  uint32_t num_dirs = 0;
+  if (isNewDir) {
+    // Remember the subdir count so that we can pre-size the child index
+    // once we know how many entries there are.
 #ifndef _WIN32
     struct stat st;
     int dfd = osdir->getFd();
     if (dfd != -1 && fstat(dfd, &st) == 0) {
-      num_dirs = (uint32_t)st.st_nlink;
+      // st.st_nlink is usually number of dirs + 2 (., ..).
+      // If it is less than 2 then it doesn't follow that convention.
+      num_dirs = st.st_nlink > 2 ? (uint32_t)st.st_nlink - 2 : 0;
     }
 #endif
-    // st.st_nlink is usually number of dirs + 2 (., ..).
-    // If it is less than 2 then it doesn't follow that convention.
-    // We just pass it through for the dir size hint and the hash
-    // table implementation will round that up to the next power of 2
-    apply_dir_size_hint(
-        dir,
-        num_dirs,
-        uint32_t(root->config.getInt("hint_num_files_per_dir", 64)));
+    osdir->setSizeHint(std::max(
+        size_t(num_dirs),
+        size_t(root->config.getInt("hint_num_files_per_dir", 64))));
+  } else {
+    osdir->setSizeHint(dir->files.size());
   }
 
-  /* flag for delete detection */
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-    if (file->exists) {
-      file->maybe_deleted = true;
+  // When recrawl_trust_readdir is enabled, an unchanged dir mtime means that
+  // no entries were added, removed or renamed since we last crawled it, so
+  // entries whose readdir inode and type match our records are assumed to be
+  // unchanged and aren't stat'd again.  A recrawl with
+  // recrawl_skip_unchanged_dirs doesn't even read such a dir, provided that
+  // it is still the same dir.
+  std::optional<FileInformation> dirStat;
+  bool trustReadDir = false;
+  bool skipReadDir = false;
+  if ((recrawlTrustReadDir_ || recrawlSkipUnchangedDirs_ ||
+       pending.flags.contains(W_PENDING_SKIP_UNCHANGED)) &&
+      recursive) {
+    try {
+      ThreadWait wait(ThreadAccount::Io);
+      dirStat = fileSystem_.getFileInformation(
+          path, root->case_sensitive, statOptions_);
+    } catch (const std::system_error&) {
+      // We'll just stat every entry
     }
+    bool mtimeUnchanged = dirStat && !isNewDir &&
+        (dir->crawled_mtime.tv_sec != 0 || dir->crawled_mtime.tv_nsec != 0) &&
+        dir->crawled_mtime.tv_sec == dirStat->mtime.tv_sec &&
+        dir->crawled_mtime.tv_nsec == dirStat->mtime.tv_nsec;
+    trustReadDir = recrawlTrustReadDir_ && mtimeUnchanged;
+
+    if (mtimeUnchanged && pending.flags.contains(W_PENDING_SKIP_UNCHANGED) &&
+        !pending.flags.contains(W_PENDING_IS_DESYNCED) &&
+        !pending.flags.contains(W_PENDING_NONRECURSIVE_SCAN)) {
+      ino_t knownIno = 0;
+      if (!dir->parent) {
+        knownIno = view.getRootInode();
+      } else if (auto file = dir->parent->getChildFile(dir->name)) {
+        knownIno = file->stat.ino;
+      }
+      skipReadDir = knownIno != 0 && knownIno == dirStat->ino;
+    }
+  }
+
+  OpenedCrawlDir opened;
+  opened.pending = &pending;
+  opened.dir = dir;
+  opened.recursive = recursive;
+  opened.statAll = stat_all;
+  opened.isNewDir = isNewDir;
+  opened.numDirs = num_dirs;
+  opened.dirStat = std::move(dirStat);
+  opened.readStart = readStart;
+  if (skipReadDir) {
+    // applyCrawl still visits the child dirs that we know of
+    logf(DBG, "crawler({}) skipped reading unchanged dir\n", path);
+    opened.skipped = true;
+    opened.readTime = std::chrono::steady_clock::now() - readStart;
+    return opened;
   }
 
+  if (pending.flags.contains(W_PENDING_TRUST_READDIR) &&
+      !pending.flags.contains(W_PENDING_IS_DESYNCED) && !isNewDir) {
+    // The view moved here along with the dir, so it is only as stale as
+    // the watcher's notifications leave it
+    trustReadDir = true;
+  }
+  opened.trustReadDir = trustReadDir;
+  opened.osdir = std::move(osdir);
+  return opened;
+}
+
+void InMemoryView::readCrawlEntries(OpenedCrawlDir& opened) {
+  if (!opened.osdir) {
+    return;
+  }
+  auto readNext = [&] {
+    ThreadWait wait(ThreadAccount::Io);
+    return opened.osdir->readDir();
+  };
+
   try {
-    while (const DirEntry* dirent = osdir->readDir()) {
+    while (const DirEntry* dirent = readNext()) {
       // Don't follow parent/self links
       if (dirent->d_name[0] == '.' &&
           (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
         continue;
       }
+      opened.names.emplace_back(dirent->d_name, strlen(dirent->d_name));
+      opened.entries.push_back(*dirent);
+      // d_name points into the DirHandle's buffer, which is about to be
+      // reused; the name is kept in names instead
+      opened.entries.back().d_name = nullptr;
+    }
+    opened.readAll = true;
+  } catch (const std::system_error& exc) {
+    opened.readError = exc.what();
+  }
+  opened.osdir.reset();
+  opened.readTime = std::chrono::steady_clock::now() - opened.readStart;
+}
 
-      // Queue it up for analysis if the file is newly existing
-      w_string name(dirent->d_name, W_STRING_BYTE);
-      struct watchman_file* file = dir->getChildFile(name);
-      if (file) {
-        file->maybe_deleted = false;
-      }
-      if (!file || !file->exists || stat_all || recursive) {
-        auto full_path = dir->getFullPathToChild(name);
+InMemoryView::CrawlListing InMemoryView::listCrawlDir(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    OpenedCrawlDir& opened) {
+  auto& pending = *opened.pending;
+  auto dir = opened.dir;
+  auto recursive = opened.recursive;
+  if (opened.skipped) {
+    CrawlListing listing{&pending, dir, recursive, {}, {}, {}};
+    listing.readTime = opened.readTime;
+    return listing;
+  }
+  size_t numTrusted = 0;
 
-        PendingFlags newFlags;
-        if (recursive || !file || !file->exists) {
-          newFlags.set(W_PENDING_RECURSIVE);
-        }
-        if (pending.flags & W_PENDING_IS_DESYNCED) {
-          newFlags.set(W_PENDING_IS_DESYNCED);
-        }
+  /* flag for delete detection */
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+    if (file->exists) {
+      file->maybe_deleted = true;
+    }
+  }
 
-        logf(
-            DBG,
-            "in crawler calling processPath on {} oldflags={} newflags={}\n",
-            full_path,
-            pending.flags.asRaw(),
-            newFlags.asRaw());
+  // The entries that need to be examined are collected here and processed
+  // by applyCrawl.  This lets us fetch their stat information in parallel
+  // when crawlPool_ is configured.
+  std::vector<w_string> crawlPaths;
+  std::vector<PendingFlags> crawlFlags;
+  std::vector<DirEntry> crawlEntries;
+  for (size_t i = 0; i < opened.entries.size(); ++i) {
+    auto& dirent = opened.entries[i];
+    // Queue it up for analysis if the file is newly existing
+    w_string_piece name(opened.names[i]);
+    struct watchman_file* file = dir->getChildFile(name);
+    if (file) {
+      file->maybe_deleted = false;
+    }
+    if (opened.trustReadDir && file && file->exists && !dirent.has_stat &&
+        dirent.ino != 0 && dirent.ino == file->stat.ino &&
+        dirent.dtype != DType::Unknown &&
+        dirent.dtype == file->stat.dtype()) {
+      // Child dirs are still crawled by the loop at the end of this
+      // function.
+      ++numTrusted;
+      continue;
+    }
+    if (!file || !file->exists || opened.statAll || recursive) {
+      PendingFlags newFlags;
+      if (recursive || !file || !file->exists) {
+        newFlags.set(W_PENDING_RECURSIVE);
+      }
+      if (pending.flags & W_PENDING_IS_DESYNCED) {
+        newFlags.set(W_PENDING_IS_DESYNCED);
+      }
+      if (file && file->exists) {
+        newFlags.set(pending.flags & W_PENDING_SKIP_UNCHANGED);
+      }
 
-        processPath(
-            root,
-            view,
-            coll,
-            PendingChange{std::move(full_path), pending.now, newFlags},
-            dirent);
+      auto fullPath = dir->getFullPathToChild(name);
+      if (root->ignore.isIgnored(fullPath.data(), fullPath.size())) {
+        // statPath would only throw it away
+        continue;
       }
+
+      crawlPaths.push_back(std::move(fullPath));
+      crawlFlags.push_back(newFlags);
+      crawlEntries.push_back(dirent);
     }
-  } catch (const std::system_error& exc) {
+  }
+  if (!opened.readAll) {
     log(ERR,
         "Error while reading dir ",
-        path,
+        pending.path,
         ": ",
-        exc.what(),
+        opened.readError,
         ", re-adding to pending list to re-assess\n");
-    coll.add(path, pending.now, {});
+    coll.add(pending.path, pending.now, {});
+  }
+
+  if (opened.dirStat) {
+    // A dir that was modified within the last second may be modified again
+    // without its mtime visibly changing, so only remember mtimes that are
+    // safely in the past.
+    auto now = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now());
+    if (opened.readAll && opened.dirStat->mtime.tv_sec < now - 1) {
+      dir->crawled_mtime = opened.dirStat->mtime;
+    } else {
+      dir->crawled_mtime = timespec{0, 0};
+    }
+    if (numTrusted > 0) {
+      logf(
+          DBG,
+          "crawler({}) skipped stat of {} entries that readdir showed were "
+          "unchanged\n",
+          pending.path,
+          numTrusted);
+    }
+  }
+
+  if (opened.isNewDir) {
+    // Every entry that we're about to process will get a file node, so we
+    // know exactly how big the index needs to be.
+    apply_dir_size_hint(
+        dir,
+        std::min(opened.numDirs, uint32_t(crawlPaths.size())),
+        std::min(
+            uint32_t(crawlPaths.size()),
+            uint32_t(root->config.getInt("hint_num_files_per_dir", 64))));
+  }
+
+  return CrawlListing{
+      &pending,
+      dir,
+      recursive,
+      std::move(crawlPaths),
+      std::move(crawlFlags),
+      std::move(crawlEntries),
+      opened.readTime,
+      opened.entries.size()};
+}
+
+std::vector<InMemoryView::CrawlListing> InMemoryView::readCrawlDirs(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    const std::vector<const PendingChange*>& items,
+    ThreadPool* pool) {
+  TraceSpan span("io", "readCrawlDirs");
+  // The dirs are watched in order, on this thread, so that the watcher
+  // sees each one before it is read
+  std::vector<OpenedCrawlDir> opened;
+  opened.reserve(items.size());
+  for (auto item : items) {
+    if (auto dir = openCrawlDir(root, view, *item)) {
+      opened.push_back(std::move(*dir));
+    }
+  }
+
+  std::vector<OpenedCrawlDir*> toRead;
+  for (auto& dir : opened) {
+    if (dir.osdir) {
+      toRead.push_back(&dir);
+    }
+  }
+  if (pool && toRead.size() > 1) {
+    // Reading a dir doesn't touch the view, so the workers take the dirs
+    // one at a time until they're all read
+    std::atomic<size_t> next{0};
+    std::vector<folly::Future<folly::Unit>> futures;
+    // The lambdas capture references to locals, so we must wait for all of
+    // them to complete before leaving this scope
+    SCOPE_EXIT {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    };
+    auto numTasks = std::min(pool->numWorkers(), toRead.size());
+    for (size_t i = 0; i < numTasks; ++i) {
+      futures.emplace_back(folly::via(pool, [this, &next, &toRead] {
+        for (auto index = next++; index < toRead.size(); index = next++) {
+          auto slot = acquireIoSlot();
+          readCrawlEntries(*toRead[index]);
+        }
+      }));
+    }
+  } else {
+    for (auto dir : toRead) {
+      readCrawlEntries(*dir);
+    }
+  }
+
+  std::vector<CrawlListing> listings;
+  listings.reserve(opened.size());
+  for (auto& dir : opened) {
+    listings.push_back(listCrawlDir(root, view, coll, dir));
+  }
+  return listings;
+}
+
+void InMemoryView::applyCrawl(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    CrawlListing& listing) {
+  auto applyStart = std::chrono::steady_clock::now();
+  auto& pending = *listing.pending;
+  auto& crawlPaths = listing.paths;
+  auto& crawlFlags = listing.flags;
+  auto& crawlEntries = listing.entries;
+  auto dir = listing.dir;
+  auto recursive = listing.recursive;
+  // Carry a trusted or incremental scan on down through the child dirs
+  auto carriedFlags =
+      pending.flags & (W_PENDING_TRUST_READDIR | W_PENDING_SKIP_UNCHANGED);
+
+  for (size_t i = 0; i < crawlPaths.size(); ++i) {
+    logf(
+        DBG,
+        "in crawler calling processPath on {} oldflags={} newflags={}\n",
+        crawlPaths[i],
+        pending.flags.asRaw(),
+        crawlFlags[i].asRaw());
+
+    processPath(
+        root,
+        view,
+        coll,
+        PendingChange{std::move(crawlPaths[i]), pending.now, crawlFlags[i]},
+        &crawlEntries[i]);
   }
-  osdir.reset();
 
   // Anything still in maybe_deleted is actually deleted.
   // Arrange to re-process it shortly
@@ -556,15 +1577,151 @@ void InMemoryView::crawler(
           dir,
           file->getName().data(),
           pending.now,
-          recursive ? W_PENDING_RECURSIVE : PendingFlags{});
+          recursive ? W_PENDING_RECURSIVE | carriedFlags : PendingFlags{});
+    }
+  }
+
+  if (crawlProfiler_) {
+    crawlProfiler_->record(
+        dir,
+        listing.readTime,
+        listing.statTime + (std::chrono::steady_clock::now() - applyStart),
+        listing.numEntries);
+  }
+
+  if (crawlProgress_) {
+    ++crawlProgress_->dirs;
+    crawlProgress_->entries += listing.numEntries;
+    maybeReportCrawlProgress(*root, coll);
+  }
+}
+
+void InMemoryView::maybeReportCrawlProgress(
+    Root& root,
+    const PendingChanges& coll) {
+  auto& progress = *crawlProgress_;
+  auto now = std::chrono::steady_clock::now();
+  if (crawlProgressInterval_.count() <= 0 ||
+      now - progress.lastReport < crawlProgressInterval_) {
+    return;
+  }
+  progress.lastReport = now;
+  if (!root.unilateralResponses->hasSubscribers()) {
+    return;
+  }
+
+  size_t queued = coll.getPendingItemCount();
+  size_t remaining = 0;
+  if (progress.expectedFiles > 0) {
+    if (progress.expectedFiles > progress.entries) {
+      remaining = progress.expectedFiles - progress.entries;
+    }
+  } else if (progress.dirs > 0) {
+    // Nothing to go on but the dirs crawled so far, which the queued ones
+    // are assumed to resemble.  The queued dirs have subtrees of their own,
+    // so this runs low until the crawl nears the leaves.
+    remaining = queued * progress.entries / progress.dirs;
+  }
+
+  root.unilateralResponses->enqueue(json_object(
+      {{"crawl-progress",
+        json_object(
+            {{"dirs", json_integer(json_int_t(progress.dirs))},
+             {"files", json_integer(json_int_t(progress.entries))},
+             {"dirs_queued", json_integer(json_int_t(queued))},
+             {"estimated_files_remaining",
+              json_integer(json_int_t(remaining))},
+             {"elapsed_ms",
+              json_integer(
+                  std::chrono::duration_cast<std::chrono::milliseconds>(
+                      now - progress.start)
+                      .count())}})}}));
+}
+
+namespace {
+// The number of entries stat'd by each crawl pool task.  Small enough that
+// the work for a large dir spreads across the pool, large enough that the
+// per-task overhead is dwarfed by the syscalls.
+constexpr size_t kCrawlStatChunkSize = 16;
+} // namespace
+
+void InMemoryView::prefetchCrawlStats(
+    const RootConfig& root,
+    const std::vector<w_string>& paths,
+    std::vector<DirEntry>& entries) {
+  std::vector<size_t> needStat;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!entries[i].has_stat && !root.ignore.isIgnoreDir(paths[i])) {
+      needStat.push_back(i);
+    }
+  }
+  if (needStat.size() < crawlParallelMinEntries_) {
+    return;
+  }
+
+  std::vector<folly::Future<folly::Unit>> futures;
+  futures.reserve(needStat.size() / kCrawlStatChunkSize + 1);
+
+  // The lambdas below capture references to locals, so we must wait for
+  // all of them to complete before leaving this scope, even if scheduling
+  // one of them throws.
+  SCOPE_EXIT {
+    folly::collectAll(futures.begin(), futures.end()).wait();
+  };
+
+  for (size_t begin = 0; begin < needStat.size();
+       begin += kCrawlStatChunkSize) {
+    auto end = std::min(begin + kCrawlStatChunkSize, needStat.size());
+    futures.emplace_back(folly::via(
+        crawlPool_.get(),
+        [this, &root, &paths, &entries, &needStat, begin, end] {
+          auto slot = acquireIoSlot();
+          for (auto i = begin; i < end; ++i) {
+            auto idx = needStat[i];
+            try {
+              entries[idx].stat = getEntryInformation(root, paths[idx]);
+              entries[idx].has_stat = true;
+            } catch (const std::system_error&) {
+              // Leave has_stat unset; statPath will try again and handle
+              // the error in the usual way.
+            }
+          }
+        }));
+  }
+}
+
+IoThrottle::Slot InMemoryView::acquireIoSlot() {
+  if (!ioThrottle_) {
+    return IoThrottle::Slot{};
+  }
+  // Only called from crawlPool_ and ioShardPool_ workers, which belong to
+  // this view and so may block
+  return ioThrottle_->acquire().get();
+}
+
+FileInformation InMemoryView::getEntryInformation(
+    const RootConfig& root,
+    const w_string& path) {
+  ThreadWait wait(ThreadAccount::Io);
+  auto start = ioThrottle_ ? IoThrottle::Clock::now()
+                           : IoThrottle::Clock::time_point{};
+  SCOPE_EXIT {
+    if (ioThrottle_) {
+      ioThrottle_->record(
+          IoThrottle::Kind::Metadata, IoThrottle::Clock::now() - start);
     }
+  };
+  if (dirFds_ && root.case_sensitive == CaseSensitivity::CaseSensitive) {
+    return dirFds_->getFileInformation(path, statOptions_);
   }
+  return fileSystem_.getFileInformation(
+      path.c_str(), root.case_sensitive, statOptions_);
 }
 
 namespace {
 bool did_file_change(
-    const watchman::FileInformation* saved,
-    const watchman::FileInformation* fresh) {
+    const watchman::CompactFileInformation* saved,
+    const watchman::CompactFileInformation* fresh) {
   /* we have to compare this way because the stat structure
    * may contain fields that vary and that don't impact our
    * understanding of the file */
@@ -574,17 +1731,6 @@ bool did_file_change(
     return true;                    \
   }
 
-  // Can't compare with memcmp due to padding and garbage in the struct
-  // on OpenBSD, which has a 32-bit tv_sec + 64-bit tv_nsec
-#define TIMESPEC_FIELD_CHG(wat)                           \
-  {                                                       \
-    struct timespec a = saved->wat##time;                 \
-    struct timespec b = fresh->wat##time;                 \
-    if (a.tv_sec != b.tv_sec || a.tv_nsec != b.tv_nsec) { \
-      return true;                                        \
-    }                                                     \
-  }
-
   FIELD_CHG(mode);
 
   if (!saved->isDir()) {
@@ -597,9 +1743,11 @@ bool did_file_change(
   FIELD_CHG(gid);
   // Don't care about st_blocks
   // Don't care about st_blksize
-  // Don't care about st_atimespec
-  TIMESPEC_FIELD_CHG(m);
-  TIMESPEC_FIELD_CHG(c);
+  // Don't care about st_atimespec, which isn't kept
+  FIELD_CHG(mtimeSec);
+  FIELD_CHG(mtimeNsec);
+  FIELD_CHG(ctimeSec);
+  FIELD_CHG(ctimeNsec);
 
   return false;
 }
@@ -618,7 +1766,7 @@ bool InMemoryView::propagateToParentDirIfAppropriate(
     const RootConfig& root,
     PendingChanges& coll,
     std::chrono::system_clock::time_point now,
-    const FileInformation& entryStat,
+    const CompactFileInformation& entryStat,
     const w_string& dirName,
     const watchman_dir* parentDir,
     bool isUnlink) {
@@ -660,6 +1808,9 @@ void InMemoryView::statPath(
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   const bool via_notify = pending.flags.contains(W_PENDING_VIA_NOTIFY);
   const PendingFlags desynced_flag = pending.flags & W_PENDING_IS_DESYNCED;
+  // Only apply to the entries of the dir that the view knows
+  PendingFlags crawl_flags =
+      pending.flags & (W_PENDING_TRUST_READDIR | W_PENDING_SKIP_UNCHANGED);
 
   if (root.ignore.isIgnoreDir(pending.path)) {
     logf(DBG, "{} matches ignore_dir rules\n", pending.path);
@@ -688,7 +1839,7 @@ void InMemoryView::statPath(
     st = pre_stat->stat;
   } else {
     try {
-      st = fileSystem_.getFileInformation(path, root.case_sensitive);
+      st = getEntryInformation(root, pending.path);
       log(DBG,
           "getFileInformation(",
           path,
@@ -809,8 +1960,10 @@ void InMemoryView::statPath(
       /* if a dir was deleted and now exists again, we want
        * to crawl it again */
       recursive = true;
+      crawl_flags = PendingFlags{};
     }
-    if (!file->exists || via_notify || did_file_change(&file->stat, &st)) {
+    watchman::CompactFileInformation fresh{st};
+    if (!file->exists || via_notify || did_file_change(&file->stat, &fresh)) {
       logf(
           DBG,
           "file changed exists={} via_notify={} stat-changed={} isdir={} size={} {}\n",
@@ -823,16 +1976,26 @@ void InMemoryView::statPath(
       file->exists = true;
       view.markFileChanged(*watcher_, file, getClock(pending.now));
 
+      if (prefetchSymlinkTargets_ && st.isSymlink()) {
+        // Keyed like the lookups of the symlink_target field
+        w_string_piece relPath = pending.path;
+        relPath.advance(std::min(root.root_path.size() + 1, relPath.size()));
+        caches_.symlinkTargetCache.prefetch(
+            SymlinkTargetCacheKey{relPath.asWString(), file->otime});
+      }
+
       // If the inode number changed then we definitely need to recursively
       // examine any children because we cannot assume that the kernel will
       // have given us the correct hints about this change.  BTRFS is one
       // example of a filesystem where this has been observed to happen.
       if (file->stat.ino != st.ino) {
         recursive = true;
+        // and what we knew of its entries was about something else
+        crawl_flags = PendingFlags{};
       }
     }
 
-    memcpy(&file->stat, &st, sizeof(file->stat));
+    view.setFileStat(file, fresh);
 
     if (st.isDir()) {
       if (dir_ent == NULL) {
@@ -853,7 +2016,8 @@ void InMemoryView::statPath(
           coll.add(
               pending.path,
               pending.now,
-              desynced_flag | W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+              desynced_flag | crawl_flags | W_PENDING_RECURSIVE |
+                  W_PENDING_CRAWL_ONLY);
         } else if (pending.flags & W_PENDING_NONRECURSIVE_SCAN) {
           /* on file changes, we receive a notification on the directory and
            * thus we just need to crawl this one directory to consider all
@@ -5,8 +5,13 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <chrono>
+#include <optional>
+#include <thread>
 #include "watchman/Constants.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/ThreadAccounting.h"
+#include "watchman/Trace.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 
@@ -19,6 +24,7 @@ namespace watchman {
 // we have drained the inotify descriptor
 void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
   PendingChanges fromWatcher;
+  fromWatcher.setRecorder(eventRecorder_.get());
 
   if (!watcher_->start(root)) {
     logf(
@@ -40,6 +46,7 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     if (!watcher_->waitNotify(86400)) {
       continue;
     }
+    TraceSpan span("notify", "consumeNotify");
     do {
       auto resultFlags = watcher_->consumeNotify(root, fromWatcher);
 
@@ -53,11 +60,64 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     } while (watcher_->waitNotify(0));
 
     if (!fromWatcher.empty()) {
+      // fromWatcher is already consolidated; leave merging it with anything
+      // else to the IO thread so that we hold the lock only briefly.
+      auto lock = [&] {
+        ThreadWait wait(ThreadAccount::Lock);
+        return pendingFromWatcher_.lock();
+      }();
+      lock->handOff(fromWatcher);
+      lock->ping();
+    }
+    if (eventRecorder_) {
+      eventRecorder_->flush();
+    }
+  }
+}
+
+size_t InMemoryView::replayWatcherEvents(
+    WatcherEventReader& reader,
+    double speed) {
+  PendingChanges batch;
+  auto handOff = [&] {
+    if (!batch.empty()) {
       auto lock = pendingFromWatcher_.lock();
-      lock->append(fromWatcher.stealItems(), fromWatcher.stealSyncs());
+      lock->handOff(batch);
       lock->ping();
     }
+  };
+
+  size_t count = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::optional<std::chrono::system_clock::time_point> firstEvent;
+  while (auto event = reader.next()) {
+    if (stopThreads_.load(std::memory_order_acquire)) {
+      break;
+    }
+    if (!firstEvent) {
+      firstEvent = event->time;
+    }
+    if (speed > 0) {
+      auto due = start +
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     (event->time - *firstEvent) / speed);
+      if (due > std::chrono::steady_clock::now()) {
+        // The watcher would have handed off what it had while it waited
+        handOff();
+        std::this_thread::sleep_until(due);
+      }
+    }
+    batch.add(
+        rebaseRecordedPath(event->path, reader.getRootPath(), rootPath_),
+        std::chrono::system_clock::now(),
+        event->flags);
+    ++count;
+    if (batch.getPendingItemCount() >= WATCHMAN_BATCH_LIMIT) {
+      handOff();
+    }
   }
+  handOff();
+  return count;
 }
 } // namespace watchman
 
@@ -41,5 +41,26 @@ bool Root::considerReap() {
   return false;
 }
 
+bool Root::considerCompaction() {
+  if (idle_compact_age.count() == 0) {
+    return false;
+  }
+
+  auto lastCmd = inner.last_cmd_timestamp.load(std::memory_order_acquire);
+  if (std::chrono::steady_clock::now() <= lastCmd + idle_compact_age ||
+      inner.last_compact_cmd_timestamp == lastCmd) {
+    return false;
+  }
+  inner.last_compact_cmd_timestamp = lastCmd;
+  return true;
+}
+
+void Root::compact() {
+  queryResultCache.clear();
+  scmChangedFiles.clear();
+  queryParseCache.clear();
+  view()->compact();
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -8,9 +8,12 @@
 #include <folly/String.h>
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/SubtreeView.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/fs/RealPathCache.h"
 #include "watchman/root/Root.h"
+#include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/state.h"
 #include "watchman/watcher/WatcherRegistry.h"
@@ -124,8 +127,42 @@ json_ref load_root_config(const char* path) {
   return json_load_file(cfgfilename, 0);
 }
 
+/**
+ * Returns the deepest watched root whose view can also serve `path`, which
+ * is nested inside it, or nullptr if there isn't one.  Views that don't
+ * crawl aren't shared, and neither is a dir that the root ignores, as its
+ * view doesn't hold it.
+ */
+std::shared_ptr<Root> findEnclosingRoot(
+    const w_string& path,
+    const w_string& fs_type) {
+  std::shared_ptr<Root> enclosing;
+  auto map = watched_roots.rlock();
+  for (const auto& [rootPath, root] : *map) {
+    if (path.size() <= rootPath.size() || !is_path_prefix(path, rootPath) ||
+        root->inner.cancelled || root->fs_type != fs_type) {
+      continue;
+    }
+    auto view = root->view();
+    if (!view->requiresCrawl || view->isSubtreeView() ||
+        root->ignore.isIgnored(path.data(), path.size())) {
+      continue;
+    }
+    if (!enclosing || rootPath.size() > enclosing->root_path.size()) {
+      enclosing = root;
+    }
+  }
+  return enclosing;
+}
+
 } // namespace
 
+RealPathCache& getRealPathCache() {
+  static RealPathCache cache{
+      std::chrono::milliseconds(cfg_get_int("realpath_cache_ttl_ms", 10000))};
+  return cache;
+}
+
 std::shared_ptr<Root>
 root_resolve(const char* filename, bool auto_watch, bool* created) {
   std::error_code realpath_err;
@@ -149,12 +186,17 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
   }
 
   w_string root_str;
+  // A cached resolution was checked when it was made
+  bool cached = false;
 
   try {
-    root_str = watchman::realPath(filename);
+    root_str = getRealPathCache().resolve(filename, &cached);
     try {
-      watchman::getFileInformation(filename);
+      if (!cached) {
+        watchman::getFileInformation(filename);
+      }
     } catch (const std::system_error& exc) {
+      getRealPathCache().forget(filename);
       if (exc.code() == watchman::error_code::no_such_file_or_directory) {
         throw RootResolveError(
             "\"",
@@ -187,6 +229,13 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
     }
   }
 
+  if (!root && cached) {
+    // It may have been resolved while it was watched; take a fresh look at
+    // it before watching it or reporting that it isn't watched.
+    getRealPathCache().forget(filename);
+    return root_resolve(filename, auto_watch, created);
+  }
+
   if (!root && realpath_err.value() != 0) {
     // Path didn't resolve and neither did the name they passed in
     throw RootResolveError(
@@ -209,6 +258,8 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
     // are typically on the order of days.
     root->inner.last_cmd_timestamp.store(
         std::chrono::steady_clock::now(), std::memory_order_release);
+    root->inner.last_cmd_wallclock.store(
+        std::chrono::system_clock::now(), std::memory_order_relaxed);
     return root;
   }
 
@@ -240,13 +291,30 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
 
   auto config_file = load_root_config(root_str.c_str());
   Configuration config{config_file};
+
+  // A nested dir with a config of its own may want it crawled differently
+  std::shared_ptr<Root> enclosing;
+  if (!config_file && cfg_get_bool("share_enclosing_root_view", false)) {
+    enclosing = findEnclosingRoot(root_str, fs_type);
+  }
+  std::shared_ptr<QueryableView> view;
+  if (enclosing) {
+    logf(
+        ERR,
+        "{} is inside {}; serving it from that root's view\n",
+        root_str,
+        enclosing->root_path);
+    view = std::make_shared<SubtreeView>(enclosing, root_str);
+  } else {
+    view = WatcherRegistry::initWatcher(root_str, fs_type, config);
+  }
   root = std::make_shared<Root>(
       realFileSystem,
       root_str,
       fs_type,
       config_file,
       config,
-      WatcherRegistry::initWatcher(root_str, fs_type, config),
+      std::move(view),
       &w_state_save);
 
   {
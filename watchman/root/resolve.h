@@ -10,6 +10,7 @@
 #include <memory>
 
 namespace watchman {
+class RealPathCache;
 class Root;
 }
 
@@ -22,3 +23,9 @@ std::shared_ptr<watchman::Root> w_root_resolve_for_client_mode(
 
 std::shared_ptr<watchman::Root>
 root_resolve(const char* filename, bool auto_watch, bool* created);
+
+/**
+ * The process-wide cache of the canonical paths that resolving roots and
+ * projects computes; see realpath_cache_ttl_ms.
+ */
+watchman::RealPathCache& getRealPathCache();
@@ -7,7 +7,11 @@
 
 #include "watchman/root/watchlist.h"
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <thread>
 #include <vector>
+#include "watchman/QueryableView.h"
+#include "watchman/Shutdown.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
@@ -19,6 +23,13 @@ folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<Root>>>
     watched_roots;
 std::atomic<long> live_roots{0};
 
+namespace {
+int64_t toMilliseconds(std::chrono::microseconds duration) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+      .count();
+}
+} // namespace
+
 bool Root::removeFromWatched() {
   auto map = watched_roots.wlock();
   auto it = map->find(root_path);
@@ -92,6 +103,7 @@ json_ref w_root_stop_watch_all() {
       root = it->second;
     }
 
+    root->view()->discardSnapshot();
     root->cancel();
     if (!saveGlobalStateHook) {
       saveGlobalStateHook = root->getSaveGlobalStateHook();
@@ -137,6 +149,47 @@ json_ref Root::getStatusForAllRoots() {
   return arr;
 }
 
+json_ref Root::getMemoryStatusForAllRoots() {
+  auto arr = json_array();
+
+  auto map = watched_roots.rlock();
+  for (const auto& it : *map) {
+    json_array_append_new(arr, it.second->getMemoryStatus());
+  }
+
+  return arr;
+}
+
+std::vector<MemoryBudget::Consumer> Root::getMemoryBudgetConsumers() {
+  std::vector<MemoryBudget::Consumer> consumers;
+
+  auto map = watched_roots.rlock();
+  for (const auto& it : *map) {
+    auto& root = it.second;
+    std::weak_ptr<Root> weak = root;
+    consumers.push_back(MemoryBudget::Consumer{
+        root->root_path,
+        root->view()->getMemoryBytes(),
+        root->inner.last_cmd_timestamp.load(std::memory_order_acquire),
+        [weak] {
+          if (auto root = weak.lock()) {
+            root->compact();
+          }
+        }});
+  }
+
+  return consumers;
+}
+
+json_ref Root::getMemoryStatus() const {
+  return json_object({
+      {"path", w_string_to_json(root_path)},
+      {"view", view()->getMemoryStatus()},
+      {"subscription_queue_items",
+       json_integer(unilateralResponses->getQueuedItemCount())},
+  });
+}
+
 json_ref Root::getStatus() const {
   auto obj = json_object();
   auto now = std::chrono::steady_clock::now();
@@ -222,13 +275,14 @@ json_ref Root::getStatus() const {
                std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
                    .count())},
           {"cookie-sync-duration-milliseconds",
-           json_integer(ctx->cookieSyncDuration.load().count())},
+           json_integer(toMilliseconds(ctx->cookieSyncDuration.load()))},
           {"generation-duration-milliseconds",
-           json_integer(ctx->generationDuration.load().count())},
+           json_integer(toMilliseconds(ctx->generationDuration.load()))},
           {"render-duration-milliseconds",
-           json_integer(ctx->renderDuration.load().count())},
+           json_integer(toMilliseconds(ctx->renderDuration.load()))},
           {"view-lock-wait-duration-milliseconds",
-           json_integer(ctx->viewLockWaitDuration.load().count())},
+           json_integer(toMilliseconds(ctx->viewLockWaitDuration.load()))},
+          {"eden-requests", json_integer(ctx->numEdenRequests.load())},
           {"state", typed_string_to_json(queryState)},
           {"client-pid", json_integer(ctx->query->clientPid)},
           {"request-id", w_string_to_json(ctx->query->request_id)},
@@ -270,10 +324,77 @@ json_ref Root::getStatus() const {
       {"cancelled", json_boolean(inner.cancelled)},
       {"crawl-status",
        w_string_to_json(w_string(crawl_status.data(), crawl_status.size()))},
+      {"view", view_->getViewStatus()},
   });
   return obj;
 }
 
+void Root::collectMetrics(MetricsWriter& writer) const {
+  MetricLabels labels{{"root", root_path.string()}};
+
+  writer.add(
+      "watchman_root_recrawls",
+      MetricType::Counter,
+      "Recrawls of the root",
+      labels,
+      recrawlInfo.rlock()->recrawlCount);
+  writer.add(
+      "watchman_root_crawl_complete",
+      MetricType::Gauge,
+      "Whether the initial crawl of the root has completed",
+      labels,
+      inner.done_initial.load() ? 1 : 0);
+  writer.add(
+      "watchman_root_queries_in_flight",
+      MetricType::Gauge,
+      "Queries that are currently executing against the root",
+      labels,
+      queries.rlock()->size());
+  writer.add(
+      "watchman_root_subscribers",
+      MetricType::Gauge,
+      "Subscriptions and triggers that are listening to the root",
+      labels,
+      unilateralResponses->getSubscriberCount());
+  writer.add(
+      "watchman_root_triggers",
+      MetricType::Gauge,
+      "Triggers that are defined on the root",
+      labels,
+      triggers.rlock()->size());
+  writer.add(
+      "watchman_root_outstanding_cookies",
+      MetricType::Gauge,
+      "Cookie files that the root is waiting to observe",
+      labels,
+      cookies.getOutstandingCookieFileList().size());
+
+  queryMetrics.collectMetrics(writer, labels);
+  latencyProbe.collectMetrics(writer, labels);
+  view_->collectMetrics(writer, labels);
+}
+
+namespace {
+MetricsCollectorRegistration rootMetrics("roots", [](MetricsWriter& writer) {
+  std::vector<std::shared_ptr<Root>> roots;
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      roots.push_back(it.second);
+    }
+  }
+  writer.add(
+      "watchman_roots",
+      MetricType::Gauge,
+      "Roots that are being watched",
+      {},
+      roots.size());
+  for (const auto& root : roots) {
+    root->collectMetrics(writer);
+  }
+});
+} // namespace
+
 json_ref Root::triggerListToJson() const {
   auto arr = json_array();
   {
@@ -337,6 +458,82 @@ void w_root_free_watched_roots() {
   logf(DBG, "all roots are gone\n");
 }
 
+void startLatencyProbeThread() {
+  auto interval = std::chrono::milliseconds(
+      Configuration().getInt("latency_probe_interval_ms", 0));
+  if (interval.count() <= 0) {
+    return;
+  }
+  std::thread thr([interval]() noexcept {
+    w_set_thread_name("latencyprobe");
+    auto lastProbe = std::chrono::steady_clock::now();
+    // Sleep a second at most at a time so that shutdown isn't held up
+    while (!w_is_stopping()) {
+      auto remaining = lastProbe + interval - std::chrono::steady_clock::now();
+      if (remaining > std::chrono::steady_clock::duration::zero()) {
+        /* sleep override */ std::this_thread::sleep_for(
+            std::min<std::chrono::steady_clock::duration>(
+                remaining, std::chrono::seconds(1)));
+        continue;
+      }
+      lastProbe = std::chrono::steady_clock::now();
+
+      std::vector<std::shared_ptr<Root>> roots;
+      {
+        auto map = watched_roots.rlock();
+        for (const auto& it : *map) {
+          roots.push_back(it.second);
+        }
+      }
+      for (auto& root : roots) {
+        if (!root->inner.done_initial.load(std::memory_order_acquire) ||
+            root->inner.cancelled) {
+          continue;
+        }
+        auto prefixes = root->cookies.cookiePrefix();
+        if (!prefixes.empty()) {
+          root->latencyProbe.writeCanary(
+              *prefixes.begin(), std::chrono::system_clock::now());
+        }
+      }
+    }
+  });
+  thr.detach();
+}
+
+void w_root_abandon_watched_roots(std::chrono::milliseconds timeout) {
+  // Deliberately leaked: the process exits without destroying the roots
+  auto roots = new std::vector<std::shared_ptr<Root>>();
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      roots->emplace_back(it.second);
+    }
+  }
+
+  for (auto& root : *roots) {
+    if (!root->cancel()) {
+      root->stopThreads();
+    }
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  size_t stopped = 0;
+  for (auto& root : *roots) {
+    if (root->view()->waitForThreadsToStop(deadline)) {
+      ++stopped;
+    }
+  }
+  if (stopped != roots->size()) {
+    logf(
+        ERR,
+        "{} of {} roots were still saving their state at exit\n",
+        roots->size() - stopped,
+        roots->size());
+  }
+  logf(DBG, "abandoned {} roots\n", roots->size());
+}
+
 } // namespace watchman
 
 /* vim:ts=2:sw=2:et:
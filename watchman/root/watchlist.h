@@ -9,6 +9,7 @@
 
 #include <folly/Synchronized.h>
 #include <atomic>
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -28,6 +29,19 @@ bool findEnclosingRoot(
     w_string_piece& relativePath);
 
 void w_root_free_watched_roots();
+
+/**
+ * If latency_probe_interval_ms is configured, starts a thread that writes a
+ * LatencyProbe canary into each crawled root at that interval.
+ */
+void startLatencyProbeThread();
+
+/**
+ * Stops the watched roots and waits, for up to timeout, for their IO
+ * threads to save their view snapshots, but never frees the roots, so that
+ * a daemon that is about to exit needn't tear down every view first.
+ */
+void w_root_abandon_watched_roots(std::chrono::milliseconds timeout);
 json_ref w_root_stop_watch_all();
 json_ref w_root_watch_list_to_json();
 
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/saved_state/SavedStateCache.h"
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
+
+namespace watchman {
+
+namespace {
+
+// getMostRecentSavedState() reports failures in its result rather than by
+// throwing; they are turned into exceptions so that the cache only keeps
+// them for its error TTL.
+class SavedStateLookupError : public std::runtime_error {
+ public:
+  explicit SavedStateLookupError(SavedStateInterface::SavedStateResult result)
+      : std::runtime_error("Error while finding saved state"),
+        result(std::move(result)) {}
+
+  SavedStateInterface::SavedStateResult result;
+};
+
+} // namespace
+
+SavedStateCache::SavedStateCache(
+    size_t maxItems,
+    std::chrono::milliseconds errorTTL,
+    size_t maxInterests)
+    : cache_(maxItems, errorTTL), maxInterests_(maxInterests) {}
+
+std::string SavedStateCache::makeSourceKey(
+    const void* factory,
+    w_string_piece storageType,
+    const json_ref& savedStateConfig) {
+  return folly::to<std::string>(
+      reinterpret_cast<uintptr_t>(factory),
+      ":",
+      storageType.view(),
+      ":",
+      json_dumps(savedStateConfig, JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+folly::Future<SavedStateCache::Result> SavedStateCache::get(
+    const std::string& sourceKey,
+    std::shared_ptr<const SavedStateInterface> interface,
+    const w_string& mergeBaseWith,
+    const w_string& mergeBase) {
+  noteInterest(sourceKey, interface, mergeBaseWith, mergeBase);
+  return lookup(sourceKey, std::move(interface), mergeBase, &getThreadPool());
+}
+
+folly::Future<SavedStateCache::Result> SavedStateCache::lookup(
+    const std::string& sourceKey,
+    std::shared_ptr<const SavedStateInterface> interface,
+    const w_string& mergeBase,
+    folly::Executor* executor) {
+  auto key = folly::to<std::string>(sourceKey, ":", mergeBase.view());
+  return cache_
+      .get(
+          key,
+          [interface = std::move(interface), mergeBase, executor](
+              const std::string&) {
+            auto find = [interface, mergeBase] {
+              auto result = interface->getMostRecentSavedState(mergeBase);
+              if (!result.commitId && result.savedStateInfo &&
+                  result.savedStateInfo.get_default("error")) {
+                throw SavedStateLookupError(std::move(result));
+              }
+              return result;
+            };
+            return executor ? folly::via(executor, std::move(find))
+                            : folly::makeFutureWith(std::move(find));
+          })
+      .thenValue([](std::shared_ptr<const decltype(cache_)::NodeType> node) {
+        auto& result = node->result();
+        if (result.hasException()) {
+          if (auto error =
+                  result.exception().get_exception<SavedStateLookupError>()) {
+            return error->result;
+          }
+          Result failed;
+          failed.commitId = w_string();
+          failed.savedStateInfo = json_object(
+              {{"error", w_string_to_json("Error while finding saved state")}});
+          return failed;
+        }
+        return result.value();
+      });
+}
+
+void SavedStateCache::noteInterest(
+    const std::string& sourceKey,
+    const std::shared_ptr<const SavedStateInterface>& interface,
+    const w_string& mergeBaseWith,
+    const w_string& mergeBase) {
+  if (maxInterests_ == 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto interests = interests_.wlock();
+  for (auto& interest : *interests) {
+    if (interest.sourceKey == sourceKey &&
+        interest.mergeBaseWith == mergeBaseWith) {
+      interest.interface = interface;
+      interest.mergeBase = mergeBase;
+      interest.lastUsed = now;
+      return;
+    }
+  }
+  if (interests->size() >= maxInterests_) {
+    // Forget the one that has gone unused the longest
+    auto oldest = std::min_element(
+        interests->begin(),
+        interests->end(),
+        [](const Interest& a, const Interest& b) {
+          return a.lastUsed < b.lastUsed;
+        });
+    interests->erase(oldest);
+  }
+  interests->push_back(
+      Interest{sourceKey, interface, mergeBaseWith, mergeBase, now});
+}
+
+void SavedStateCache::prefetch(ResolveMergeBase resolve) {
+  auto interests = interests_.copy();
+  if (interests.empty() || prefetching_.exchange(true)) {
+    return;
+  }
+
+  auto job = [this,
+              interests = std::move(interests),
+              resolve = std::move(resolve)] {
+    SCOPE_EXIT {
+      prefetching_.store(false);
+    };
+    for (auto& interest : interests) {
+      w_string mergeBase;
+      try {
+        mergeBase = resolve(interest.mergeBaseWith);
+      } catch (const std::exception& ex) {
+        log(DBG,
+            "not prefetching saved state: failed to resolve the merge "
+            "base with ",
+            interest.mergeBaseWith,
+            ": ",
+            ex.what(),
+            "\n");
+        continue;
+      }
+      if (mergeBase == interest.mergeBase) {
+        continue;
+      }
+      log(DBG,
+          "merge base with ",
+          interest.mergeBaseWith,
+          " moved to ",
+          mergeBase,
+          ", prefetching its saved state\n");
+      noteInterest(
+          interest.sourceKey,
+          interest.interface,
+          interest.mergeBaseWith,
+          mergeBase);
+      // One at a time, to keep the load on the storage down.  This is
+      // already on the thread pool, so look it up here rather than
+      // tying up another of its threads.
+      lookup(interest.sourceKey, interest.interface, mergeBase, nullptr)
+          .wait();
+    }
+  };
+  try {
+    getThreadPool().add(std::move(job));
+  } catch (const std::exception& ex) {
+    log(ERR, "failed to schedule saved state prefetch: ", ex.what(), "\n");
+    prefetching_.store(false);
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/LRUCache.h"
+#include "watchman/saved_state/SavedStateInterface.h"
+
+namespace watchman {
+
+/**
+ * Remembers the saved state that was found for each merge base, so that the
+ * SCM-aware queries that follow a rebase don't have to wait for the saved
+ * state storage to be searched.
+ *
+ * The lookups run on the thread pool, and concurrent queries for the same
+ * merge base share one.  Failed lookups are remembered for errorTTL.
+ *
+ * Each lookup also registers its saved state configuration and mergebase-with
+ * as an interest.  When the root settles, prefetch() resolves their merge
+ * bases again and, for those that have moved, looks up the saved state for
+ * the new merge base ahead of the next query.
+ */
+class SavedStateCache {
+ public:
+  using Result = SavedStateInterface::SavedStateResult;
+  using ResolveMergeBase =
+      std::function<w_string(const w_string& mergeBaseWith)>;
+
+  SavedStateCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      size_t maxInterests);
+
+  /**
+   * Returns the saved state for `mergeBase`, looking it up with `interface`
+   * unless it has already been found.  `sourceKey` identifies the storage
+   * type and saved state configuration that `interface` was created from;
+   * see makeSourceKey().  `mergeBaseWith` is noted for prefetch().
+   */
+  folly::Future<Result> get(
+      const std::string& sourceKey,
+      std::shared_ptr<const SavedStateInterface> interface,
+      const w_string& mergeBaseWith,
+      const w_string& mergeBase);
+
+  /**
+   * Starts looking up the saved states for the merge bases that have moved
+   * since the interests were last seen, unless a previous prefetch is still
+   * running.  `resolve` is called on the thread pool and must keep whatever
+   * it needs, including this cache, alive until it is destroyed.
+   */
+  void prefetch(ResolveMergeBase resolve);
+
+  // Distinguishes the saved states of different storage configurations
+  static std::string makeSourceKey(
+      const void* factory,
+      w_string_piece storageType,
+      const json_ref& savedStateConfig);
+
+  // Used by tests to wait for a prefetch to finish
+  bool isPrefetching() const {
+    return prefetching_.load();
+  }
+
+ private:
+  struct Interest {
+    std::string sourceKey;
+    std::shared_ptr<const SavedStateInterface> interface;
+    w_string mergeBaseWith;
+    // The merge base of the most recent lookup or prefetch
+    w_string mergeBase;
+    std::chrono::steady_clock::time_point lastUsed;
+  };
+
+  // Looks the saved state up on `executor`, or inline if it is null
+  folly::Future<Result> lookup(
+      const std::string& sourceKey,
+      std::shared_ptr<const SavedStateInterface> interface,
+      const w_string& mergeBase,
+      folly::Executor* executor);
+
+  // Records that `mergeBaseWith` resolved to `mergeBase`
+  void noteInterest(
+      const std::string& sourceKey,
+      const std::shared_ptr<const SavedStateInterface>& interface,
+      const w_string& mergeBaseWith,
+      const w_string& mergeBase);
+
+  LRUCache<std::string, Result> cache_;
+  const size_t maxInterests_;
+  folly::Synchronized<std::vector<Interest>> interests_;
+  std::atomic<bool> prefetching_{false};
+};
+
+} // namespace watchman
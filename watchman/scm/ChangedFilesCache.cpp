@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/ChangedFilesCache.h"
+#include <algorithm>
+
+namespace watchman {
+
+namespace {
+
+void sortUnique(std::vector<w_string>& files) {
+  std::sort(files.begin(), files.end());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+}
+
+} // namespace
+
+ChangedFilesCache::ChangedFilesCache(size_t maxItems)
+    : entries_(std::max(maxItems, size_t(1)), std::chrono::milliseconds(0)) {}
+
+ChangedFilesCache::Files ChangedFilesCache::get(
+    const w_string& mergeBase,
+    ClockPosition position,
+    const Fetch& fetch,
+    const CatchUp& catchUp) {
+  if (auto node = entries_.get(mergeBase)) {
+    auto entry = node->value();
+    if (entry->position.rootNumber == position.rootNumber &&
+        entry->position.ticks <= position.ticks) {
+      if (entry->position.ticks == position.ticks) {
+        return entry->files;
+      }
+      std::vector<w_string> changed;
+      if (catchUp(entry->position, position, changed)) {
+        auto files = entry->files;
+        if (!changed.empty()) {
+          auto merged = std::vector<w_string>(*files);
+          merged.insert(merged.end(), changed.begin(), changed.end());
+          sortUnique(merged);
+          files = std::make_shared<const std::vector<w_string>>(
+              std::move(merged));
+        }
+        set(mergeBase, position, files);
+        return files;
+      }
+    }
+  }
+
+  auto fetched = fetch();
+  sortUnique(fetched);
+  auto files =
+      std::make_shared<const std::vector<w_string>>(std::move(fetched));
+  set(mergeBase, position, files);
+  return files;
+}
+
+void ChangedFilesCache::set(
+    const w_string& mergeBase,
+    ClockPosition position,
+    Files files) {
+  entries_.set(
+      mergeBase,
+      std::make_shared<const Entry>(Entry{position, std::move(files)}));
+}
+
+} // namespace watchman
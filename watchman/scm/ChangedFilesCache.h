@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/LRUCache.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Remembers the files that changed since each recently queried merge base,
+ * as of a clock position of the view, so that the SCM-aware queries that
+ * follow a rebase don't each have to ask the SCM.
+ *
+ * A query at a later position catches the files up by adding the ones that
+ * the view saw change in between, which are few when subscriptions run on
+ * every settle.  A file changed back to its state at the merge base stays
+ * in the list, which is harmless as the query examines each file anyway.
+ * Only when the view can't say what changed is the SCM asked again.
+ */
+class ChangedFilesCache {
+ public:
+  // Root-relative paths, sorted
+  using Files = std::shared_ptr<const std::vector<w_string>>;
+  // Asks the SCM for the files that changed since the merge base
+  using Fetch = std::function<std::vector<w_string>()>;
+  // Appends the root-relative paths of the files that changed after
+  // `since`, up to `upTo`, returning false if that isn't known
+  using CatchUp = std::function<
+      bool(ClockPosition since, ClockPosition upTo, std::vector<w_string>&)>;
+
+  explicit ChangedFilesCache(size_t maxItems);
+
+  /**
+   * Returns the files that changed since mergeBase, as of position.
+   */
+  Files get(
+      const w_string& mergeBase,
+      ClockPosition position,
+      const Fetch& fetch,
+      const CatchUp& catchUp);
+
+  CacheStats stats() const {
+    return entries_.stats();
+  }
+
+  void clear() {
+    entries_.clear();
+  }
+
+ private:
+  struct Entry {
+    ClockPosition position;
+    Files files;
+  };
+
+  void set(const w_string& mergeBase, ClockPosition position, Files files);
+
+  LRUCache<w_string, std::shared_ptr<const Entry>> entries_;
+};
+
+} // namespace watchman
@@ -6,10 +6,13 @@
  */
 
 #include "watchman/scm/Git.h"
+#include <folly/FileUtil.h>
 #include <folly/String.h>
+#include <algorithm>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
 
 // Capability indicating support for the git SCM
@@ -119,11 +122,25 @@ Git::Git(w_string_piece rootPath, w_string_piece scmRoot)
           Configuration(),
           "scm_git_files_since_mergebase",
           32,
-          10) {}
+          10) {
+  if (cfg_get_bool("scm_git_native", false)) {
+    // Worktrees and submodules have a .git file pointing elsewhere, which
+    // is left to git
+    auto gitDir = to<std::string>(getSCMRoot().view(), "/.git");
+    try {
+      if (getFileInformation(gitDir.c_str(), CaseSensitivity::CaseSensitive)
+              .isDir()) {
+        objects_ = std::make_unique<GitObjectStore>(gitDir);
+      }
+    } catch (const std::system_error&) {
+    }
+  }
+}
 
 ChildProcess::Options Git::makeGitOptions(w_string requestId) const {
   ChildProcess::Options opt;
   (void)requestId;
+  opt.setKind(ChildProcess::Kind::Scm);
   opt.nullStdin();
   opt.pipeStdout();
   opt.pipeStderr();
@@ -147,6 +164,115 @@ struct timespec Git::getIndexMtime() const {
   }
 }
 
+std::shared_ptr<const GitIndex> Git::readIndex(struct timespec mtime) const {
+  {
+    auto parsed = parsedIndex_.rlock();
+    if (parsed->index && parsed->mtime.tv_sec == mtime.tv_sec &&
+        parsed->mtime.tv_nsec == mtime.tv_nsec) {
+      return parsed->index;
+    }
+  }
+
+  std::string data;
+  if (!folly::readFile(indexPath_.c_str(), data)) {
+    return nullptr;
+  }
+  auto index = GitIndex::parse(data);
+  if (!index) {
+    return nullptr;
+  }
+  auto result = std::make_shared<const GitIndex>(std::move(*index));
+  auto parsed = parsedIndex_.wlock();
+  parsed->mtime = mtime;
+  parsed->index = result;
+  return result;
+}
+
+std::optional<w_string> Git::nativeMergeBaseWith(
+    const std::string& commit) const {
+  auto head = objects_->resolveCommit("HEAD");
+  auto other = objects_->resolveCommit(commit);
+  if (!head || !other) {
+    return std::nullopt;
+  }
+  auto base = objects_->mergeBase(*other, *head);
+  if (!base) {
+    return std::nullopt;
+  }
+  return w_string{gitObjectIdToHex(*base).c_str()};
+}
+
+std::optional<std::vector<w_string>> Git::nativeFilesChangedSince(
+    const std::string& commit,
+    struct timespec indexMtime) const {
+  auto id = objects_->resolveCommit(commit);
+  if (!id) {
+    return std::nullopt;
+  }
+  auto parsedCommit = objects_->readCommit(*id);
+  auto index = readIndex(indexMtime);
+  if (!parsedCommit || !index) {
+    return std::nullopt;
+  }
+
+  // The commit against the index...
+  auto changed = index->diffAgainstTree(
+      parsedCommit->tree, [this](const GitObjectId& tree) {
+        auto object = objects_->read(tree);
+        if (!object || object->type != GitObjectType::Tree) {
+          throw SCMError("missing git tree ", gitObjectIdToHex(tree));
+        }
+        return parseGitTree(object->data);
+      });
+
+  // ...and the index against the working copy.  git would hash the files
+  // whose stat information doesn't match the index to see whether they
+  // really changed; we report them, along with those modified so close to
+  // the index being written that the index can't vouch for them.
+  auto root = std::string{getSCMRoot().view()};
+  for (auto& entry : index->entries()) {
+    if (entry.stage != 0 || entry.skipWorktree ||
+        (entry.mode & 0170000) == 0160000) {
+      // Unmerged paths were reported above; submodules are left alone
+      continue;
+    }
+    auto path = root + "/" + entry.path;
+    bool clean = false;
+    try {
+      auto info =
+          getFileInformation(path.c_str(), CaseSensitivity::CaseSensitive);
+      bool racy = info.mtime.tv_sec > indexMtime.tv_sec ||
+          (info.mtime.tv_sec == indexMtime.tv_sec &&
+           info.mtime.tv_nsec >= indexMtime.tv_nsec);
+      clean = !racy && uint32_t(info.size) == entry.size &&
+          uint32_t(info.mtime.tv_sec) == entry.mtimeSec &&
+          uint32_t(info.mtime.tv_nsec) == entry.mtimeNsec;
+#ifndef _WIN32
+      if ((entry.mode & 0170000) == 0120000) {
+        clean = clean && info.isSymlink();
+      } else {
+        clean = clean && info.isFile() &&
+            bool(info.mode & S_IXUSR) == bool(entry.mode & 0100);
+      }
+#endif
+    } catch (const std::system_error&) {
+      // Removed from the working copy
+    }
+    if (!clean) {
+      changed.push_back(entry.path);
+    }
+  }
+
+  std::sort(changed.begin(), changed.end());
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  std::vector<w_string> result;
+  result.reserve(changed.size());
+  for (auto& path : changed) {
+    result.emplace_back(path.data(), path.size());
+  }
+  return result;
+}
+
 w_string Git::mergeBaseWith(w_string_piece commitId, w_string requestId) const {
   auto mtime = getIndexMtime();
   auto key = folly::to<std::string>(
@@ -157,6 +283,19 @@ w_string Git::mergeBaseWith(w_string_piece commitId, w_string requestId) const {
       .get(
           key,
           [this, commit, requestId](const std::string&) {
+            if (objects_) {
+              try {
+                if (auto base = nativeMergeBaseWith(commit)) {
+                  return folly::makeFuture(*base);
+                }
+              } catch (const std::exception& exc) {
+                log(ERR,
+                    "failed to read the merge base from the repository: ",
+                    exc.what(),
+                    "\n");
+              }
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "merge-base", commit, "HEAD"},
                 makeGitOptions(requestId),
@@ -190,8 +329,21 @@ std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
   return filesChangedSinceMergeBaseWith_
       .get(
           key,
-          [this, commit = std::move(commitCopy), requestId](
+          [this, commit = std::move(commitCopy), mtime, requestId](
               const std::string&) {
+            if (objects_) {
+              try {
+                if (auto files = nativeFilesChangedSince(commit, mtime)) {
+                  return folly::makeFuture(std::move(*files));
+                }
+              } catch (const std::exception& exc) {
+                log(ERR,
+                    "failed to read the changed files from the repository: ",
+                    exc.what(),
+                    "\n");
+              }
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "diff", "--name-only", "-z", commit},
                 makeGitOptions(requestId),
@@ -8,10 +8,15 @@
 #pragma once
 
 #include <folly/String.h>
+#include <folly/Synchronized.h>
 #include <chrono>
+#include <memory>
+#include <optional>
 #include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/GitIndex.h"
+#include "watchman/scm/GitObjectStore.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -56,8 +61,29 @@ class Git : public SCM {
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
 
+  // If scm_git_native is set, reads the repository directly rather than
+  // running git, for the queries that it can answer
+  std::unique_ptr<GitObjectStore> objects_;
+  struct ParsedIndex {
+    struct timespec mtime {
+      0, 0
+    };
+    // nullptr if the index uses features GitIndex doesn't support
+    std::shared_ptr<const GitIndex> index;
+  };
+  mutable folly::Synchronized<ParsedIndex> parsedIndex_;
+
   ChildProcess::Options makeGitOptions(w_string requestId) const;
   struct timespec getIndexMtime() const;
+
+  // The index as of `mtime`, reparsed if it has changed since
+  std::shared_ptr<const GitIndex> readIndex(struct timespec mtime) const;
+
+  // These yield nullopt if git must be asked instead
+  std::optional<w_string> nativeMergeBaseWith(const std::string& commit) const;
+  std::optional<std::vector<w_string>> nativeFilesChangedSince(
+      const std::string& commit,
+      struct timespec indexMtime) const;
 };
 
 } // namespace watchman
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitIndex.h"
+#include <cstring>
+#include <unordered_set>
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+namespace {
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_{data} {}
+
+  size_t remaining() const {
+    return data_.size() - pos_;
+  }
+
+  size_t pos() const {
+    return pos_;
+  }
+
+  std::string_view take(size_t size) {
+    if (size > remaining()) {
+      throw SCMError("truncated git index");
+    }
+    auto result = data_.substr(pos_, size);
+    pos_ += size;
+    return result;
+  }
+
+  uint8_t byte() {
+    return uint8_t(take(1)[0]);
+  }
+
+  uint16_t be16() {
+    auto b = take(2);
+    return uint16_t((uint8_t(b[0]) << 8) | uint8_t(b[1]));
+  }
+
+  uint32_t be32() {
+    auto b = take(4);
+    return (uint32_t(uint8_t(b[0])) << 24) | (uint32_t(uint8_t(b[1])) << 16) |
+        (uint32_t(uint8_t(b[2])) << 8) | uint32_t(uint8_t(b[3]));
+  }
+
+  // Up to, and consuming, the next `delim`
+  std::string_view until(char delim) {
+    auto end = data_.find(delim, pos_);
+    if (end == std::string_view::npos) {
+      throw SCMError("truncated git index");
+    }
+    auto result = data_.substr(pos_, end - pos_);
+    pos_ = end + 1;
+    return result;
+  }
+
+  // The variable length integers of index version 4
+  uint64_t varint() {
+    auto c = byte();
+    uint64_t value = c & 0x7f;
+    while (c & 0x80) {
+      c = byte();
+      value = ((value + 1) << 7) | (c & 0x7f);
+    }
+    return value;
+  }
+
+ private:
+  std::string_view data_;
+  size_t pos_{0};
+};
+
+long parseDecimal(std::string_view str) {
+  return strtol(std::string{str}.c_str(), nullptr, 10);
+}
+
+// Trees record 100664 for some files written by old versions of git
+uint32_t normalizeMode(uint32_t mode) {
+  if ((mode & 0170000) == 0100000) {
+    return (mode & 0100) ? 0100755 : 0100644;
+  }
+  return mode;
+}
+
+void parseCacheTree(
+    Reader& reader,
+    const std::string& parent,
+    std::unordered_map<std::string, GitObjectId>& trees,
+    int depth) {
+  if (depth > 4096) {
+    throw SCMError("git index cache-tree is too deep");
+  }
+  auto name = reader.until('\0');
+  auto entryCount = parseDecimal(reader.until(' '));
+  auto subtrees = parseDecimal(reader.until('\n'));
+  auto dir = name.empty() ? parent : parent + std::string{name} + "/";
+  if (entryCount >= 0) {
+    GitObjectId id;
+    memcpy(id.data(), reader.take(id.size()).data(), id.size());
+    trees[dir] = id;
+  }
+  for (long i = 0; i < subtrees; ++i) {
+    parseCacheTree(reader, dir, trees, depth + 1);
+  }
+}
+
+} // namespace
+
+std::optional<GitIndex> GitIndex::parse(std::string_view data) {
+  // The trailing checksum isn't verified; git writes the index atomically
+  if (data.size() < 12 + 20) {
+    throw SCMError("truncated git index");
+  }
+  Reader reader{data.substr(0, data.size() - 20)};
+  if (reader.take(4) != "DIRC") {
+    throw SCMError("not a git index");
+  }
+  auto version = reader.be32();
+  if (version < 2 || version > 4) {
+    return std::nullopt;
+  }
+  auto count = reader.be32();
+
+  GitIndex index;
+  index.entries_.reserve(count);
+  std::string previousPath;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto start = reader.pos();
+    GitIndexEntry entry;
+    reader.take(8); // ctime
+    entry.mtimeSec = reader.be32();
+    entry.mtimeNsec = reader.be32();
+    reader.take(8); // dev, ino
+    entry.mode = reader.be32();
+    reader.take(8); // uid, gid
+    entry.size = reader.be32();
+    memcpy(entry.id.data(), reader.take(entry.id.size()).data(), 20);
+    auto flags = reader.be16();
+    entry.stage = (flags >> 12) & 3;
+    if (version >= 3 && (flags & 0x4000)) {
+      auto extended = reader.be16();
+      entry.skipWorktree = extended & 0x4000;
+      entry.intentToAdd = extended & 0x2000;
+    }
+
+    if (version == 4) {
+      auto strip = reader.varint();
+      if (strip > previousPath.size()) {
+        throw SCMError("malformed path compression in git index");
+      }
+      entry.path = previousPath.substr(0, previousPath.size() - strip);
+      entry.path.append(reader.until('\0'));
+    } else {
+      entry.path = std::string{reader.until('\0')};
+      // Entries are padded with NULs to a multiple of eight bytes
+      auto length = reader.pos() - start;
+      auto padded = (length + 7) & ~size_t(7);
+      reader.take(padded - length);
+    }
+
+    if ((entry.mode & 0170000) == 0040000) {
+      // A directory entry of a sparse index
+      return std::nullopt;
+    }
+    previousPath = entry.path;
+    index.entries_.push_back(std::move(entry));
+  }
+
+  while (reader.remaining() > 0) {
+    auto signature = reader.take(4);
+    auto size = reader.be32();
+    auto body = reader.take(size);
+    if (signature == "TREE") {
+      Reader treeReader{body};
+      while (treeReader.remaining() > 0) {
+        parseCacheTree(treeReader, "", index.cachedTrees_, 0);
+      }
+    } else if (signature[0] < 'A' || signature[0] > 'Z') {
+      // Extensions that aren't upper case change the meaning of the index;
+      // this includes the split and sparse index ones.
+      return std::nullopt;
+    }
+  }
+
+  return index;
+}
+
+const GitObjectId* GitIndex::cachedTree(const std::string& dir) const {
+  auto it = cachedTrees_.find(dir);
+  return it == cachedTrees_.end() ? nullptr : &it->second;
+}
+
+std::vector<std::string> GitIndex::diffAgainstTree(
+    const GitObjectId& tree,
+    const ReadTree& readTree) const {
+  std::vector<std::string> changed;
+  diffDirectory("", &tree, 0, entries_.size(), readTree, changed);
+  return changed;
+}
+
+void GitIndex::diffDirectory(
+    const std::string& prefix,
+    const GitObjectId* tree,
+    size_t begin,
+    size_t end,
+    const ReadTree& readTree,
+    std::vector<std::string>& changed) const {
+  if (tree) {
+    auto cached = cachedTree(prefix);
+    if (cached && *cached == *tree) {
+      // The index matches the tree everywhere beneath here
+      return;
+    }
+  }
+
+  std::vector<GitTreeEntry> treeEntries;
+  if (tree) {
+    treeEntries = readTree(*tree);
+  }
+  std::unordered_map<std::string_view, const GitTreeEntry*> byName;
+  for (auto& entry : treeEntries) {
+    byName.emplace(entry.name, &entry);
+  }
+  std::unordered_set<std::string_view> seen;
+
+  auto i = begin;
+  while (i < end) {
+    auto& entry = entries_[i];
+    auto rel = std::string_view{entry.path}.substr(prefix.size());
+    auto slash = rel.find('/');
+    auto name = rel.substr(0, slash);
+    seen.insert(name);
+    auto it = byName.find(name);
+    const GitTreeEntry* treeEntry = it == byName.end() ? nullptr : it->second;
+
+    if (slash != std::string_view::npos) {
+      // Everything beneath this subdirectory is contiguous
+      auto childPrefix = prefix + std::string{name} + "/";
+      auto j = i;
+      while (j < end &&
+             entries_[j].path.compare(0, childPrefix.size(), childPrefix) ==
+                 0) {
+        ++j;
+      }
+      if (treeEntry && treeEntry->isDir()) {
+        diffDirectory(childPrefix, &treeEntry->id, i, j, readTree, changed);
+      } else {
+        diffDirectory(childPrefix, nullptr, i, j, readTree, changed);
+        if (treeEntry) {
+          changed.push_back(prefix + std::string{name});
+        }
+      }
+      i = j;
+      continue;
+    }
+
+    // The stages of an unmerged path are adjacent
+    auto j = i + 1;
+    while (j < end && entries_[j].path == entry.path) {
+      ++j;
+    }
+    if (j - i > 1 || entry.stage != 0 || entry.intentToAdd || !treeEntry) {
+      changed.push_back(entry.path);
+    } else if (treeEntry->isDir()) {
+      changed.push_back(entry.path);
+      diffDirectory(
+          entry.path + "/", &treeEntry->id, end, end, readTree, changed);
+    } else if (
+        treeEntry->id != entry.id ||
+        normalizeMode(treeEntry->mode) != normalizeMode(entry.mode)) {
+      changed.push_back(entry.path);
+    }
+    i = j;
+  }
+
+  // Whatever is left was removed from the index
+  for (auto& treeEntry : treeEntries) {
+    if (seen.count(treeEntry.name)) {
+      continue;
+    }
+    auto path = prefix + treeEntry.name;
+    if (treeEntry.isDir()) {
+      diffDirectory(path + "/", &treeEntry.id, end, end, readTree, changed);
+    } else {
+      changed.push_back(std::move(path));
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "watchman/scm/GitObjectStore.h"
+
+namespace watchman {
+
+struct GitIndexEntry {
+  // Relative to the root of the working copy, with forward slashes
+  std::string path;
+  GitObjectId id;
+  uint32_t mode{0};
+  // Non-zero for the sides of an unresolved merge conflict
+  uint16_t stage{0};
+  // Not checked out; git ignores the working copy for these
+  bool skipWorktree{false};
+  // Added with `git add -N`; not yet in the index for real
+  bool intentToAdd{false};
+  uint32_t mtimeSec{0};
+  uint32_t mtimeNsec{0};
+  uint32_t size{0};
+};
+
+/**
+ * A parsed .git/index, for computing the files changed since a commit
+ * without running git.
+ *
+ * Versions 2 to 4 are supported, along with the cache-tree extension, which
+ * lets diffAgainstTree skip the directories whose contents match the tree.
+ * Split and sparse indices are not; parse() yields nullopt for them so that
+ * the caller can fall back to running git.
+ */
+class GitIndex {
+ public:
+  // Throws SCMError if `data` is not a valid index
+  static std::optional<GitIndex> parse(std::string_view data);
+
+  // Sorted by path, as git keeps them
+  const std::vector<GitIndexEntry>& entries() const {
+    return entries_;
+  }
+
+  // The tree id that the cache-tree extension records for `dir` ("" for the
+  // root, otherwise with a trailing slash), if it is still valid
+  const GitObjectId* cachedTree(const std::string& dir) const;
+
+  using ReadTree =
+      std::function<std::vector<GitTreeEntry>(const GitObjectId& tree)>;
+
+  /**
+   * The paths whose index entries differ from the tree `tree`: those that
+   * were added, removed, modified or changed type, along with unmerged ones.
+   * This is the index half of what `git diff --name-only <commit>` reports.
+   */
+  std::vector<std::string> diffAgainstTree(
+      const GitObjectId& tree,
+      const ReadTree& readTree) const;
+
+ private:
+  void diffDirectory(
+      const std::string& prefix,
+      const GitObjectId* tree,
+      size_t begin,
+      size_t end,
+      const ReadTree& readTree,
+      std::vector<std::string>& changed) const;
+
+  std::vector<GitIndexEntry> entries_;
+  std::unordered_map<std::string, GitObjectId> cachedTrees_;
+};
+
+} // namespace watchman
@@ -0,0 +1,726 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitObjectStore.h"
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/system/MemoryMapping.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <unordered_map>
+#include "watchman/Logging.h"
+#include "watchman/fs/DirHandle.h"
+#include "watchman/scm/SCM.h"
+#include "watchman/watchman_system.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+struct ObjectIdHasher {
+  size_t operator()(const GitObjectId& id) const {
+    size_t result;
+    memcpy(&result, id.data(), sizeof(result));
+    return result;
+  }
+};
+
+int hexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+uint32_t readBE32(const uint8_t* p) {
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+      (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+uint64_t readBE64(const uint8_t* p) {
+  return (uint64_t(readBE32(p)) << 32) | readBE32(p + 4);
+}
+
+/**
+ * Inflates the zlib stream at the start of `input`, which may be followed
+ * by other data.  If `expectedSize` is given, the stream must inflate to
+ * exactly that many bytes.
+ */
+std::string inflateStream(
+    std::string_view input,
+    std::optional<size_t> expectedSize) {
+#ifdef HAVE_ZLIB
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    throw SCMError("inflateInit failed");
+  }
+  SCOPE_EXIT {
+    inflateEnd(&zs);
+  };
+
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  zs.avail_in = uInt(std::min<size_t>(input.size(), UINT_MAX));
+
+  // One byte of slack so that reaching the end of the stream with a full
+  // buffer is distinguishable from running out of room.
+  std::string out;
+  out.resize(expectedSize.value_or(input.size() * 2 + 64) + 1);
+  while (true) {
+    zs.next_out = reinterpret_cast<Bytef*>(out.data() + zs.total_out);
+    zs.avail_out = uInt(out.size() - zs.total_out);
+    auto ret = inflate(&zs, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END) {
+      break;
+    }
+    if (ret == Z_OK || (ret == Z_BUF_ERROR && zs.avail_out == 0)) {
+      if (zs.avail_out == 0) {
+        if (expectedSize) {
+          throw SCMError("git object is larger than its header says");
+        }
+        out.resize(out.size() * 2);
+      }
+      continue;
+    }
+    throw SCMError("failed to inflate git object: ", zs.msg ? zs.msg : "");
+  }
+  out.resize(zs.total_out);
+  if (expectedSize && out.size() != *expectedSize) {
+    throw SCMError("git object is smaller than its header says");
+  }
+  return out;
+#else
+  (void)input;
+  (void)expectedSize;
+  throw SCMError("watchman was built without zlib");
+#endif
+}
+
+bool isSafeRefName(std::string_view name) {
+  if (name.empty() || name.front() == '/' || name.back() == '/' ||
+      name.find("..") != std::string_view::npos ||
+      name.find("@{") != std::string_view::npos) {
+    return false;
+  }
+  for (auto c : name) {
+    if (c <= ' ' || c == '~' || c == '^' || c == ':' || c == '?' ||
+        c == '*' || c == '[' || c == '\\') {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+std::optional<GitObjectId> parseGitObjectId(std::string_view hex) {
+  if (hex.size() != 40) {
+    return std::nullopt;
+  }
+  GitObjectId id;
+  for (size_t i = 0; i < id.size(); ++i) {
+    auto hi = hexValue(hex[2 * i]);
+    auto lo = hexValue(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      return std::nullopt;
+    }
+    id[i] = uint8_t((hi << 4) | lo);
+  }
+  return id;
+}
+
+std::string gitObjectIdToHex(const GitObjectId& id) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string result;
+  result.reserve(40);
+  for (auto b : id) {
+    result.push_back(kDigits[b >> 4]);
+    result.push_back(kDigits[b & 0xf]);
+  }
+  return result;
+}
+
+std::vector<GitTreeEntry> parseGitTree(std::string_view data) {
+  std::vector<GitTreeEntry> entries;
+  while (!data.empty()) {
+    auto space = data.find(' ');
+    auto nul = data.find('\0');
+    if (space == std::string_view::npos || nul == std::string_view::npos ||
+        space > nul || nul + 21 > data.size()) {
+      throw SCMError("malformed git tree");
+    }
+    GitTreeEntry entry;
+    entry.mode = 0;
+    for (auto c : data.substr(0, space)) {
+      if (c < '0' || c > '7') {
+        throw SCMError("malformed mode in git tree");
+      }
+      entry.mode = (entry.mode << 3) | uint32_t(c - '0');
+    }
+    entry.name = std::string{data.substr(space + 1, nul - space - 1)};
+    memcpy(entry.id.data(), data.data() + nul + 1, entry.id.size());
+    entries.push_back(std::move(entry));
+    data.remove_prefix(nul + 21);
+  }
+  return entries;
+}
+
+GitCommit parseGitCommit(std::string_view data) {
+  GitCommit commit;
+  bool sawTree = false;
+  while (!data.empty()) {
+    auto eol = data.find('\n');
+    auto line = data.substr(0, eol);
+    data = eol == std::string_view::npos ? std::string_view{}
+                                         : data.substr(eol + 1);
+    if (line.empty()) {
+      // The end of the headers; the rest is the message
+      break;
+    }
+    auto space = line.find(' ');
+    auto key = line.substr(0, space);
+    auto value = space == std::string_view::npos ? std::string_view{}
+                                                 : line.substr(space + 1);
+    if (key == "tree") {
+      auto id = parseGitObjectId(value);
+      if (!id) {
+        throw SCMError("malformed tree in git commit");
+      }
+      commit.tree = *id;
+      sawTree = true;
+    } else if (key == "parent") {
+      auto id = parseGitObjectId(value);
+      if (!id) {
+        throw SCMError("malformed parent in git commit");
+      }
+      commit.parents.push_back(*id);
+    } else if (key == "committer") {
+      // "Name <email> timestamp tz"
+      auto close = value.rfind('>');
+      if (close != std::string_view::npos) {
+        commit.commitTime = strtoll(
+            std::string{value.substr(close + 1)}.c_str(), nullptr, 10);
+      }
+    }
+  }
+  if (!sawTree) {
+    throw SCMError("git commit has no tree");
+  }
+  return commit;
+}
+
+std::string applyGitDelta(std::string_view base, std::string_view delta) {
+  size_t pos = 0;
+  auto next = [&]() -> uint8_t {
+    if (pos >= delta.size()) {
+      throw SCMError("truncated git delta");
+    }
+    return uint8_t(delta[pos++]);
+  };
+  auto readSize = [&] {
+    uint64_t size = 0;
+    int shift = 0;
+    uint8_t c;
+    do {
+      c = next();
+      size |= uint64_t(c & 0x7f) << shift;
+      shift += 7;
+    } while ((c & 0x80) && shift < 64);
+    return size;
+  };
+
+  auto baseSize = readSize();
+  auto resultSize = readSize();
+  if (baseSize != base.size()) {
+    throw SCMError("git delta doesn't match the size of its base");
+  }
+
+  std::string result;
+  result.reserve(resultSize);
+  while (pos < delta.size()) {
+    auto op = next();
+    if (op & 0x80) {
+      uint64_t offset = 0;
+      uint64_t size = 0;
+      for (int i = 0; i < 4; ++i) {
+        if (op & (1 << i)) {
+          offset |= uint64_t(next()) << (8 * i);
+        }
+      }
+      for (int i = 0; i < 3; ++i) {
+        if (op & (0x10 << i)) {
+          size |= uint64_t(next()) << (8 * i);
+        }
+      }
+      if (size == 0) {
+        size = 0x10000;
+      }
+      if (offset + size > base.size()) {
+        throw SCMError("git delta copies from beyond its base");
+      }
+      result.append(base.data() + offset, size);
+    } else if (op) {
+      if (pos + op > delta.size()) {
+        throw SCMError("truncated git delta");
+      }
+      result.append(delta.data() + pos, op);
+      pos += op;
+    } else {
+      throw SCMError("invalid git delta opcode");
+    }
+  }
+  if (result.size() != resultSize) {
+    throw SCMError("git delta produced the wrong size");
+  }
+  return result;
+}
+
+struct GitObjectStore::Pack {
+  std::string name;
+  folly::MemoryMapping idx;
+  folly::MemoryMapping pack;
+  uint32_t numObjects{0};
+
+  Pack(std::string name, const std::string& idxPath, std::string packPath)
+      : name{std::move(name)},
+        idx{idxPath.c_str()},
+        pack{packPath.c_str()} {
+    auto data = idx.range();
+    if (data.size() < 8 + 1024 ||
+        memcmp(data.data(), "\377tOc\0\0\0\2", 8) != 0) {
+      throw SCMError("unsupported git pack index ", idxPath);
+    }
+    numObjects = readBE32(data.data() + 8 + 255 * 4);
+    if (data.size() < 8 + 1024 + size_t(numObjects) * 28 + 40) {
+      throw SCMError("truncated git pack index ", idxPath);
+    }
+    if (pack.range().size() < 32 ||
+        memcmp(pack.range().data(), "PACK", 4) != 0) {
+      throw SCMError("invalid git pack ", packPath);
+    }
+  }
+
+  std::optional<uint64_t> find(const GitObjectId& id) const {
+    const uint8_t* fanout = idx.range().data() + 8;
+    const uint8_t* names = fanout + 1024;
+    uint32_t lo = id[0] == 0 ? 0 : readBE32(fanout + 4 * (id[0] - 1));
+    uint32_t hi = readBE32(fanout + 4 * id[0]);
+    while (lo < hi) {
+      auto mid = lo + (hi - lo) / 2;
+      auto cmp = memcmp(names + size_t(mid) * 20, id.data(), 20);
+      if (cmp == 0) {
+        return offsetOf(mid);
+      }
+      if (cmp < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return std::nullopt;
+  }
+
+  uint64_t offsetOf(uint32_t index) const {
+    const uint8_t* offsets =
+        idx.range().data() + 8 + 1024 + size_t(numObjects) * 24;
+    auto offset = readBE32(offsets + size_t(index) * 4);
+    if (!(offset & 0x80000000)) {
+      return offset;
+    }
+    const uint8_t* large = offsets + size_t(numObjects) * 4;
+    auto pos = size_t(offset & 0x7fffffff) * 8;
+    if (large + pos + 8 > idx.range().end()) {
+      throw SCMError("corrupt git pack index ", name);
+    }
+    return readBE64(large + pos);
+  }
+};
+
+GitObjectStore::GitObjectStore(std::string gitDir)
+    : gitDir_{std::move(gitDir)} {}
+
+GitObjectStore::~GitObjectStore() = default;
+
+std::vector<std::shared_ptr<const GitObjectStore::Pack>> GitObjectStore::packs(
+    bool rescan) const {
+  std::lock_guard<std::mutex> lock{packsMutex_};
+  if (scannedPacks_ && !rescan) {
+    return packs_;
+  }
+  scannedPacks_ = true;
+
+  auto packDir = gitDir_ + "/objects/pack";
+  std::vector<std::shared_ptr<const Pack>> found;
+  try {
+    auto dir = openDir(packDir.c_str());
+    while (auto entry = dir->readDir()) {
+      std::string_view name{entry->d_name};
+      constexpr std::string_view kSuffix{".idx"};
+      if (name.size() <= kSuffix.size() ||
+          name.substr(name.size() - kSuffix.size()) != kSuffix) {
+        continue;
+      }
+      auto base = std::string{name.substr(0, name.size() - kSuffix.size())};
+      auto existing =
+          std::find_if(packs_.begin(), packs_.end(), [&](const auto& pack) {
+            return pack->name == base;
+          });
+      if (existing != packs_.end()) {
+        found.push_back(*existing);
+        continue;
+      }
+      try {
+        found.push_back(std::make_shared<Pack>(
+            base,
+            packDir + "/" + std::string{name},
+            packDir + "/" + base + ".pack"));
+      } catch (const std::exception& exc) {
+        // Possibly one that is still being written
+        log(DBG, "ignoring git pack ", base, ": ", exc.what(), "\n");
+      }
+    }
+  } catch (const std::system_error& exc) {
+    log(DBG, "failed to list ", packDir, ": ", exc.what(), "\n");
+  }
+  packs_ = std::move(found);
+  return packs_;
+}
+
+GitObject GitObjectStore::readPackEntry(
+    const Pack& pack,
+    uint64_t offset,
+    int depth) const {
+  // git itself limits delta chains to 4095
+  if (depth > 5000) {
+    throw SCMError("git delta chain is too long in ", pack.name);
+  }
+  auto range = pack.pack.range();
+  // The last 20 bytes are the checksum of the pack
+  auto end = range.end() - 20;
+  if (offset < 12 || offset >= uint64_t(end - range.begin())) {
+    throw SCMError("git pack offset is out of range in ", pack.name);
+  }
+  const uint8_t* p = range.begin() + offset;
+  auto next = [&]() -> uint8_t {
+    if (p >= end) {
+      throw SCMError("truncated git pack ", pack.name);
+    }
+    return *p++;
+  };
+
+  auto c = next();
+  auto type = (c >> 4) & 7;
+  uint64_t size = c & 15;
+  int shift = 4;
+  while ((c & 0x80) && shift < 64) {
+    c = next();
+    size |= uint64_t(c & 0x7f) << shift;
+    shift += 7;
+  }
+
+  auto rest = [&] {
+    return std::string_view{reinterpret_cast<const char*>(p), size_t(end - p)};
+  };
+
+  switch (type) {
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+      return GitObject{GitObjectType(type), inflateStream(rest(), size)};
+    case 6: {
+      // OFS_DELTA: the base is earlier in the same pack
+      c = next();
+      uint64_t distance = c & 0x7f;
+      while (c & 0x80) {
+        c = next();
+        distance = ((distance + 1) << 7) | (c & 0x7f);
+      }
+      if (distance == 0 || distance > offset) {
+        throw SCMError("invalid git delta base offset in ", pack.name);
+      }
+      auto delta = inflateStream(rest(), size);
+      auto base = readPackEntry(pack, offset - distance, depth + 1);
+      return GitObject{base.type, applyGitDelta(base.data, delta)};
+    }
+    case 7: {
+      // REF_DELTA: the base is named by its id
+      GitObjectId baseId;
+      for (auto& b : baseId) {
+        b = next();
+      }
+      auto delta = inflateStream(rest(), size);
+      auto base = read(baseId);
+      if (!base) {
+        throw SCMError(
+            "missing git delta base ", gitObjectIdToHex(baseId));
+      }
+      return GitObject{base->type, applyGitDelta(base->data, delta)};
+    }
+    default:
+      throw SCMError("unknown git pack entry type ", type, " in ", pack.name);
+  }
+}
+
+std::optional<GitObject> GitObjectStore::readPacked(
+    const GitObjectId& id) const {
+  for (auto& pack : packs(false)) {
+    if (auto offset = pack->find(id)) {
+      return readPackEntry(*pack, *offset, 0);
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<GitObject> GitObjectStore::readLoose(
+    const GitObjectId& id) const {
+  auto hex = gitObjectIdToHex(id);
+  auto path = gitDir_ + "/objects/" + hex.substr(0, 2) + "/" + hex.substr(2);
+  std::string compressed;
+  if (!folly::readFile(path.c_str(), compressed)) {
+    return std::nullopt;
+  }
+  auto raw = inflateStream(compressed, std::nullopt);
+
+  // "<type> <size>\0<data>"
+  auto space = raw.find(' ');
+  auto nul = raw.find('\0');
+  if (space == std::string::npos || nul == std::string::npos || space > nul) {
+    throw SCMError("malformed loose git object ", hex);
+  }
+  auto typeName = std::string_view{raw}.substr(0, space);
+  GitObjectType type;
+  if (typeName == "commit") {
+    type = GitObjectType::Commit;
+  } else if (typeName == "tree") {
+    type = GitObjectType::Tree;
+  } else if (typeName == "blob") {
+    type = GitObjectType::Blob;
+  } else if (typeName == "tag") {
+    type = GitObjectType::Tag;
+  } else {
+    throw SCMError("unknown type of loose git object ", hex);
+  }
+  auto size = strtoull(raw.c_str() + space + 1, nullptr, 10);
+  if (size != raw.size() - nul - 1) {
+    throw SCMError("loose git object ", hex, " has the wrong size");
+  }
+  return GitObject{type, raw.substr(nul + 1)};
+}
+
+std::optional<GitObject> GitObjectStore::read(const GitObjectId& id) const {
+  if (auto object = readPacked(id)) {
+    return object;
+  }
+  if (auto object = readLoose(id)) {
+    return object;
+  }
+  // It may have been packed since we last looked
+  for (auto& pack : packs(true)) {
+    if (auto offset = pack->find(id)) {
+      return readPackEntry(*pack, *offset, 0);
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<GitObjectId> GitObjectStore::resolveRef(
+    std::string_view ref,
+    int depth) const {
+  if (depth > 5 || !isSafeRefName(ref)) {
+    return std::nullopt;
+  }
+
+  std::string contents;
+  if (folly::readFile((gitDir_ + "/" + std::string{ref}).c_str(), contents)) {
+    std::string_view value{contents};
+    while (!value.empty() && isspace(uint8_t(value.back()))) {
+      value.remove_suffix(1);
+    }
+    constexpr std::string_view kSymref{"ref: "};
+    if (value.substr(0, kSymref.size()) == kSymref) {
+      return resolveRef(value.substr(kSymref.size()), depth + 1);
+    }
+    return parseGitObjectId(value);
+  }
+
+  if (ref.substr(0, 5) != "refs/") {
+    return std::nullopt;
+  }
+  if (!folly::readFile((gitDir_ + "/packed-refs").c_str(), contents)) {
+    return std::nullopt;
+  }
+  // "<hex> <refname>" lines, with comments and "^<hex>" peeled values
+  std::string_view remaining{contents};
+  while (!remaining.empty()) {
+    auto eol = remaining.find('\n');
+    auto line = remaining.substr(0, eol);
+    remaining = eol == std::string_view::npos ? std::string_view{}
+                                              : remaining.substr(eol + 1);
+    if (line.size() > 41 && line[40] == ' ' && line.substr(41) == ref) {
+      return parseGitObjectId(line.substr(0, 40));
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<GitObjectId> GitObjectStore::resolveCommit(
+    std::string_view name) const {
+  auto id = parseGitObjectId(name);
+  if (!id) {
+    std::vector<std::string> candidates;
+    auto str = std::string{name};
+    if (name == "HEAD" || name.substr(0, 5) == "refs/") {
+      candidates = {str};
+    } else {
+      // Mirrors the order in which git looks names up
+      candidates = {
+          "refs/tags/" + str,
+          "refs/heads/" + str,
+          "refs/remotes/" + str,
+          "refs/remotes/" + str + "/HEAD"};
+    }
+    for (auto& candidate : candidates) {
+      id = resolveRef(candidate, 0);
+      if (id) {
+        break;
+      }
+    }
+    if (!id) {
+      return std::nullopt;
+    }
+  }
+
+  // Peel annotated tags
+  for (int depth = 0; depth < 10; ++depth) {
+    auto object = read(*id);
+    if (!object) {
+      return std::nullopt;
+    }
+    if (object->type == GitObjectType::Commit) {
+      return id;
+    }
+    constexpr std::string_view kObject{"object "};
+    std::string_view data{object->data};
+    if (object->type != GitObjectType::Tag ||
+        data.substr(0, kObject.size()) != kObject) {
+      return std::nullopt;
+    }
+    id = parseGitObjectId(data.substr(kObject.size(), 40));
+    if (!id) {
+      return std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<GitCommit> GitObjectStore::readCommit(
+    const GitObjectId& id) const {
+  auto object = read(id);
+  if (!object || object->type != GitObjectType::Commit) {
+    return std::nullopt;
+  }
+  return parseGitCommit(object->data);
+}
+
+std::optional<GitObjectId> GitObjectStore::mergeBase(
+    const GitObjectId& a,
+    const GitObjectId& b) const {
+  if (a == b) {
+    return a;
+  }
+
+  // The same walk as git's paint_down_to_common: each commit is painted
+  // with the sides that can reach it, newest first, until everything left
+  // to visit is already known to be reachable from both.
+  enum : uint8_t {
+    kFromA = 1,
+    kFromB = 2,
+    kStale = 4,
+    kResult = 8,
+  };
+  struct Node {
+    uint8_t flags{0};
+    GitCommit commit;
+  };
+  std::unordered_map<GitObjectId, Node, ObjectIdHasher> nodes;
+  std::vector<std::pair<int64_t, GitObjectId>> queue;
+  auto queueCompare = [](const auto& x, const auto& y) {
+    return x.first < y.first;
+  };
+
+  auto visit = [&](const GitObjectId& id, uint8_t flags) -> bool {
+    auto it = nodes.find(id);
+    if (it == nodes.end()) {
+      auto commit = readCommit(id);
+      if (!commit) {
+        return false;
+      }
+      it = nodes.emplace(id, Node{0, std::move(*commit)}).first;
+    }
+    if ((it->second.flags & flags) == flags) {
+      return true;
+    }
+    it->second.flags |= flags;
+    queue.emplace_back(it->second.commit.commitTime, id);
+    std::push_heap(queue.begin(), queue.end(), queueCompare);
+    return true;
+  };
+
+  if (!visit(a, kFromA) || !visit(b, kFromB)) {
+    return std::nullopt;
+  }
+
+  std::vector<GitObjectId> results;
+  auto hasNonStale = [&] {
+    return std::any_of(queue.begin(), queue.end(), [&](const auto& entry) {
+      return !(nodes[entry.second].flags & kStale);
+    });
+  };
+  while (hasNonStale()) {
+    std::pop_heap(queue.begin(), queue.end(), queueCompare);
+    auto id = queue.back().second;
+    queue.pop_back();
+
+    auto& node = nodes[id];
+    uint8_t flags = node.flags & (kFromA | kFromB | kStale);
+    if (flags == (kFromA | kFromB)) {
+      if (!(node.flags & kResult)) {
+        node.flags |= kResult;
+        results.push_back(id);
+      }
+      flags |= kStale;
+    }
+    // Copied, as visiting may rehash nodes
+    auto parents = node.commit.parents;
+    for (auto& parent : parents) {
+      if (!visit(parent, flags)) {
+        // Probably a shallow clone
+        return std::nullopt;
+      }
+    }
+  }
+
+  if (results.size() != 1) {
+    // None, or several that git would have to choose between
+    return std::nullopt;
+  }
+  return results.front();
+}
+
+} // namespace watchman
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace watchman {
+
+using GitObjectId = std::array<uint8_t, 20>;
+
+// Parses a 40 character hex object id; returns nullopt for anything else
+std::optional<GitObjectId> parseGitObjectId(std::string_view hex);
+std::string gitObjectIdToHex(const GitObjectId& id);
+
+enum class GitObjectType {
+  Commit = 1,
+  Tree = 2,
+  Blob = 3,
+  Tag = 4,
+};
+
+struct GitObject {
+  GitObjectType type;
+  std::string data;
+};
+
+struct GitTreeEntry {
+  std::string name;
+  uint32_t mode;
+  GitObjectId id;
+
+  bool isDir() const {
+    return (mode & 0170000) == 0040000;
+  }
+};
+
+// Parses the body of a tree object.  Throws SCMError if it is malformed.
+std::vector<GitTreeEntry> parseGitTree(std::string_view data);
+
+struct GitCommit {
+  GitObjectId tree;
+  std::vector<GitObjectId> parents;
+  // The committer timestamp, in seconds since the epoch
+  int64_t commitTime{0};
+};
+
+// Parses the body of a commit object.  Throws SCMError if it is malformed.
+GitCommit parseGitCommit(std::string_view data);
+
+// Applies a packfile delta to `base`.  Throws SCMError if it is malformed.
+std::string applyGitDelta(std::string_view base, std::string_view delta);
+
+/**
+ * Reads objects and refs directly from a repository's .git directory, so
+ * that the SCM-aware queries of Git roots don't have to run git for them.
+ *
+ * Loose objects and version 2 pack indices are supported; packs are memory
+ * mapped and rescanned when an object can't be found, so objects that were
+ * repacked by a gc are still found.  Anything this doesn't understand, from
+ * an unsupported ref syntax to an object that can't be found, yields
+ * nullopt so that the caller can fall back to running git.
+ *
+ * Thread safe.
+ */
+class GitObjectStore {
+ public:
+  explicit GitObjectStore(std::string gitDir);
+  ~GitObjectStore();
+
+  // Throws SCMError if the object is present but can't be decoded
+  std::optional<GitObject> read(const GitObjectId& id) const;
+
+  /**
+   * Resolves a full object id, HEAD, or the name of a branch, remote
+   * branch or tag, to the commit it refers to, peeling annotated tags.
+   */
+  std::optional<GitObjectId> resolveCommit(std::string_view name) const;
+
+  std::optional<GitCommit> readCommit(const GitObjectId& id) const;
+
+  /**
+   * The merge base of two commits, found by walking back from both in
+   * commit-time order like `git merge-base`.  Yields nullopt if there is more
+   * than one candidate, so that git can choose between them.
+   */
+  std::optional<GitObjectId> mergeBase(
+      const GitObjectId& a,
+      const GitObjectId& b) const;
+
+ private:
+  struct Pack;
+
+  std::optional<GitObject> readLoose(const GitObjectId& id) const;
+  std::optional<GitObject> readPacked(const GitObjectId& id) const;
+  GitObject readPackEntry(const Pack& pack, uint64_t offset, int depth)
+      const;
+  std::vector<std::shared_ptr<const Pack>> packs(bool rescan) const;
+  std::optional<GitObjectId> resolveRef(std::string_view ref, int depth)
+      const;
+
+  const std::string gitDir_;
+
+  mutable std::mutex packsMutex_;
+  mutable std::vector<std::shared_ptr<const Pack>> packs_;
+  mutable bool scannedPacks_{false};
+};
+
+} // namespace watchman
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
+#include <cctype>
+#include "watchman/Logging.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+struct HgCommandServer::Connection {
+  std::unique_ptr<ChildProcess> proc;
+  // The server's stdin and stdout
+  std::unique_ptr<Pipe> in;
+  std::unique_ptr<Pipe> out;
+  std::thread reader;
+
+  // Guards pending and dead, which are shared with the reader thread
+  std::mutex mutex;
+  // The commands that have been written, oldest first
+  std::deque<folly::Promise<Result>> pending;
+  bool dead{false};
+
+  bool isDead() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return dead;
+  }
+};
+
+namespace {
+
+void appendUInt32(std::string& buf, uint32_t value) {
+  buf.push_back(char((value >> 24) & 0xff));
+  buf.push_back(char((value >> 16) & 0xff));
+  buf.push_back(char((value >> 8) & 0xff));
+  buf.push_back(char(value & 0xff));
+}
+
+void readExactly(const FileDescriptor& fd, char* buf, size_t size) {
+  while (size > 0) {
+    auto result = fd.read(buf, int(std::min<size_t>(size, 1 << 20)));
+    result.throwIfError();
+    auto len = result.value();
+    if (len == 0) {
+      throw SCMError("hg command server closed its output");
+    }
+    buf += len;
+    size -= len;
+  }
+}
+
+bool writeAll(const FileDescriptor& fd, const std::string& buf) {
+  const char* data = buf.data();
+  size_t size = buf.size();
+  while (size > 0) {
+    auto result = fd.write(data, int(size));
+    if (result.hasError() || result.value() <= 0) {
+      return false;
+    }
+    data += result.value();
+    size -= result.value();
+  }
+  return true;
+}
+
+// Reads a message: a channel byte, a big-endian length and that many bytes
+char readMessage(const FileDescriptor& fd, std::string& data) {
+  char header[5];
+  readExactly(fd, header, sizeof(header));
+  data.resize(HgCommandServer::decodeUInt32(header + 1));
+  readExactly(fd, data.data(), data.size());
+  return header[0];
+}
+
+} // namespace
+
+HgCommandServer::HgCommandServer(
+    std::string hgPath,
+    std::function<ChildProcess::Options()> makeOptions)
+    : hgPath_{std::move(hgPath)}, makeOptions_{std::move(makeOptions)} {}
+
+HgCommandServer::~HgCommandServer() {
+  std::shared_ptr<Connection> conn;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    conn = std::move(connection_);
+  }
+  if (conn) {
+    // The server exits when its input is closed, which ends the reader
+    conn->in.reset();
+    conn->reader.join();
+  }
+}
+
+std::string HgCommandServer::encodeRunCommand(
+    const std::vector<std::string>& args) {
+  auto body = folly::join('\0', args);
+  std::string request{"runcommand\n"};
+  appendUInt32(request, uint32_t(body.size()));
+  request.append(body);
+  return request;
+}
+
+bool HgCommandServer::helloSupportsRunCommand(std::string_view hello) {
+  constexpr std::string_view kCapabilities{"capabilities:"};
+  while (!hello.empty()) {
+    auto eol = hello.find('\n');
+    auto line = hello.substr(0, eol);
+    hello = eol == std::string_view::npos ? std::string_view{}
+                                          : hello.substr(eol + 1);
+    if (line.substr(0, kCapabilities.size()) != kCapabilities) {
+      continue;
+    }
+    line.remove_prefix(kCapabilities.size());
+    while (!line.empty()) {
+      auto space = line.find(' ');
+      if (line.substr(0, space) == "runcommand") {
+        return true;
+      }
+      if (space == std::string_view::npos) {
+        break;
+      }
+      line.remove_prefix(space + 1);
+    }
+    return false;
+  }
+  return false;
+}
+
+uint32_t HgCommandServer::decodeUInt32(const char* bytes) {
+  auto b = reinterpret_cast<const unsigned char*>(bytes);
+  return (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) |
+      (uint32_t(b[2]) << 8) | uint32_t(b[3]);
+}
+
+std::shared_ptr<HgCommandServer::Connection> HgCommandServer::start() {
+  auto options = makeOptions_();
+  options.pipeStdin();
+  options.pipeStdout();
+
+  auto conn = std::make_shared<Connection>();
+  // Prompts would ask us for input, which would confuse the pipelining
+  conn->proc = std::make_unique<ChildProcess>(
+      std::vector<std::string_view>{
+          hgPath_,
+          "serve",
+          "--cmdserver",
+          "pipe",
+          "--config",
+          "ui.interactive=false"},
+      std::move(options));
+  conn->in = conn->proc->takePipe(STDIN_FILENO);
+  conn->out = conn->proc->takePipe(STDOUT_FILENO);
+
+  try {
+    std::string hello;
+    auto channel = readMessage(conn->out->read, hello);
+    if (channel != 'o' || !helloSupportsRunCommand(hello)) {
+      throw SCMError("unexpected hello from hg command server: ", hello);
+    }
+  } catch (const std::exception&) {
+    conn->proc->kill();
+    conn->proc->wait();
+    throw;
+  }
+
+  conn->reader = std::thread([conn] { readLoop(conn); });
+  return conn;
+}
+
+void HgCommandServer::readLoop(std::shared_ptr<Connection> conn) {
+  std::string reason;
+  try {
+    std::string data;
+    std::string output;
+    std::string error;
+    while (true) {
+      auto channel = readMessage(conn->out->read, data);
+      switch (channel) {
+        case 'o':
+          output.append(data);
+          break;
+        case 'e':
+          error.append(data);
+          break;
+        case 'r': {
+          if (data.size() != 4) {
+            throw SCMError("malformed result from hg command server");
+          }
+          folly::Promise<Result> promise;
+          {
+            std::lock_guard<std::mutex> lock{conn->mutex};
+            if (conn->pending.empty()) {
+              throw SCMError("hg command server answered an unasked command");
+            }
+            promise = std::move(conn->pending.front());
+            conn->pending.pop_front();
+          }
+          promise.setValue(Result{
+              int32_t(decodeUInt32(data.data())),
+              w_string{output.data(), output.size()},
+              w_string{error.data(), error.size()}});
+          output.clear();
+          error.clear();
+          break;
+        }
+        default:
+          // Upper case channels are required to be handled; this includes
+          // the input channels, which we never expect.
+          if (isupper(static_cast<unsigned char>(channel))) {
+            throw SCMError(
+                "hg command server used unsupported channel ", channel);
+          }
+      }
+    }
+  } catch (const std::exception& exc) {
+    reason = exc.what();
+  }
+
+  std::deque<folly::Promise<Result>> pending;
+  {
+    std::lock_guard<std::mutex> lock{conn->mutex};
+    conn->dead = true;
+    pending = std::move(conn->pending);
+  }
+  if (!pending.empty()) {
+    log(ERR, "hg command server failed: ", reason, "\n");
+  }
+  for (auto& promise : pending) {
+    promise.setException(SCMError("hg command server failed: ", reason));
+  }
+
+  conn->proc->kill();
+  conn->proc->wait();
+}
+
+folly::Future<HgCommandServer::Result> HgCommandServer::runCommand(
+    std::vector<std::string> args) {
+  std::shared_ptr<Connection> stale;
+  SCOPE_EXIT {
+    // Its reader has finished, or is about to
+    if (stale) {
+      stale->reader.join();
+    }
+  };
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!connection_ || connection_->isDead()) {
+    stale = std::move(connection_);
+    connection_ = start();
+  }
+
+  folly::Future<Result> future = folly::Future<Result>::makeEmpty();
+  {
+    std::lock_guard<std::mutex> connLock{connection_->mutex};
+    if (connection_->dead) {
+      throw SCMError("hg command server exited");
+    }
+    // Queued before writing so that the reader can't see the answer first
+    connection_->pending.emplace_back();
+    future = connection_->pending.back().getFuture();
+  }
+
+  if (!writeAll(connection_->in->write, encodeRunCommand(args))) {
+    // The server has gone away; the reader fails this along with everything
+    // else outstanding once it sees that, and the next call starts another.
+    std::lock_guard<std::mutex> connLock{connection_->mutex};
+    connection_->dead = true;
+    connection_->in.reset();
+  }
+  return future;
+}
+
+} // namespace watchman
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "watchman/ChildProcess.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A long-lived `hg serve --cmdserver pipe` process that runs hg commands
+ * without paying for the startup of a fresh hg for each of them.
+ *
+ * Commands are pipelined: runCommand writes the request and returns
+ * immediately, and a reader thread fulfills the results in the order that
+ * the server answers them, which is the order that they were written.
+ *
+ * If the server dies or misbehaves, every outstanding command fails with
+ * an SCMError and the next runCommand call starts a new server.
+ *
+ * See https://www.mercurial-scm.org/wiki/CommandServer for the protocol.
+ */
+class HgCommandServer {
+ public:
+  struct Result {
+    int status{0};
+    w_string output;
+    w_string error;
+  };
+
+  /**
+   * `makeOptions` returns the options to spawn the server with: its
+   * environment and working directory.  Its stdin and stdout are replaced
+   * with pipes.
+   */
+  HgCommandServer(
+      std::string hgPath,
+      std::function<ChildProcess::Options()> makeOptions);
+  ~HgCommandServer();
+
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  /**
+   * Runs `hg <args...>` in the server.  Throws SCMError if the server could
+   * not be started, and otherwise yields its result, or an SCMError if the
+   * server went away before answering.
+   */
+  folly::Future<Result> runCommand(std::vector<std::string> args);
+
+  // The bytes of a runcommand request for `args`; public for testing
+  static std::string encodeRunCommand(const std::vector<std::string>& args);
+
+  // Whether the server's hello message says that it can run commands;
+  // public for testing
+  static bool helloSupportsRunCommand(std::string_view hello);
+
+  // Decodes the big-endian length and result fields of the protocol
+  static uint32_t decodeUInt32(const char* bytes);
+
+ private:
+  struct Connection;
+
+  std::shared_ptr<Connection> start();
+  static void readLoop(std::shared_ptr<Connection> conn);
+
+  const std::string hgPath_;
+  const std::function<ChildProcess::Options()> makeOptions_;
+
+  // Guards connection_ and serializes the writing of requests
+  std::mutex mutex_;
+  std::shared_ptr<Connection> connection_;
+};
+
+} // namespace watchman
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgDirState.h"
+#include <folly/String.h>
+#include <algorithm>
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr std::string_view kV2Marker = "dirstate-v2\n";
+constexpr size_t kNodeIdSize = 20;
+// dirstate-v2 pads node ids to this size
+constexpr size_t kV2NodeIdSize = 32;
+constexpr size_t kV2TreeMetadataSize = 44;
+constexpr size_t kV2NodeSize = 44;
+
+// dirstate-v2 node flags
+constexpr uint16_t kWdirTracked = 1 << 0;
+constexpr uint16_t kP1Tracked = 1 << 1;
+constexpr uint16_t kP2Info = 1 << 2;
+constexpr uint16_t kModeExecPerm = 1 << 3;
+constexpr uint16_t kModeIsSymlink = 1 << 4;
+constexpr uint16_t kHasModeAndSize = 1 << 10;
+constexpr uint16_t kHasMtime = 1 << 11;
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data, size_t pos = 0)
+      : data_{data}, pos_{pos} {}
+
+  size_t remaining() const {
+    return pos_ <= data_.size() ? data_.size() - pos_ : 0;
+  }
+
+  std::string_view take(size_t size) {
+    if (size > remaining()) {
+      throw SCMError("truncated hg dirstate");
+    }
+    auto result = data_.substr(pos_, size);
+    pos_ += size;
+    return result;
+  }
+
+  uint8_t byte() {
+    return uint8_t(take(1)[0]);
+  }
+
+  uint16_t be16() {
+    auto b = take(2);
+    return uint16_t((uint8_t(b[0]) << 8) | uint8_t(b[1]));
+  }
+
+  uint32_t be32() {
+    auto b = take(4);
+    return (uint32_t(uint8_t(b[0])) << 24) | (uint32_t(uint8_t(b[1])) << 16) |
+        (uint32_t(uint8_t(b[2])) << 8) | uint32_t(uint8_t(b[3]));
+  }
+
+ private:
+  std::string_view data_;
+  size_t pos_;
+};
+
+std::string hexNode(std::string_view node) {
+  return folly::hexlify(node.substr(0, kNodeIdSize));
+}
+
+bool isV2(std::string_view head) {
+  return head.substr(0, kV2Marker.size()) == kV2Marker;
+}
+
+// The state that dirstate-v1 would record for the flags of a v2 node, or
+// 0 if the node is only a directory
+char stateOfFlags(uint16_t flags) {
+  bool wdir = flags & kWdirTracked;
+  bool p1 = flags & kP1Tracked;
+  bool p2 = flags & kP2Info;
+  if (!wdir) {
+    return p1 || p2 ? 'r' : 0;
+  }
+  if (p1 && p2) {
+    return 'm';
+  }
+  return p1 || p2 ? 'n' : 'a';
+}
+
+} // namespace
+
+HgDirStateParents HgDirState::parseParents(std::string_view head) {
+  Reader reader{head};
+  size_t nodeSize = kNodeIdSize;
+  if (isV2(head)) {
+    reader.take(kV2Marker.size());
+    nodeSize = kV2NodeIdSize;
+  }
+  HgDirStateParents parents;
+  parents.p1 = hexNode(reader.take(nodeSize));
+  parents.p2 = hexNode(reader.take(nodeSize));
+  return parents;
+}
+
+HgDirState HgDirState::parse(
+    std::string_view dirstate,
+    const ReadFile& readFile) {
+  HgDirState result;
+  result.parents_ = parseParents(dirstate);
+  if (isV2(dirstate)) {
+    result.parseV2(dirstate, readFile);
+  } else {
+    result.parseV1(dirstate);
+  }
+  std::sort(
+      result.entries_.begin(),
+      result.entries_.end(),
+      [](const HgDirStateEntry& a, const HgDirStateEntry& b) {
+        return a.path < b.path;
+      });
+  return result;
+}
+
+void HgDirState::parseV1(std::string_view dirstate) {
+  Reader reader{dirstate, 2 * kNodeIdSize};
+  while (reader.remaining()) {
+    HgDirStateEntry entry;
+    entry.state = char(reader.byte());
+    entry.mode = reader.be32();
+    entry.size = int32_t(reader.be32());
+    entry.mtime = int32_t(reader.be32());
+    auto name = reader.take(reader.be32());
+    // A copied file is followed by its source
+    entry.path = std::string(name.substr(0, name.find('\0')));
+    entries_.push_back(std::move(entry));
+  }
+}
+
+void HgDirState::parseV2(std::string_view docket, const ReadFile& readFile) {
+  Reader reader{docket, kV2Marker.size() + 2 * kV2NodeIdSize};
+  Reader metadata{reader.take(kV2TreeMetadataSize)};
+  auto rootStart = metadata.be32();
+  auto rootCount = metadata.be32();
+  auto dataSize = reader.be32();
+  auto uuid = reader.take(reader.byte());
+
+  auto data = readFile("dirstate." + std::string(uuid));
+  if (data.size() < dataSize) {
+    throw SCMError("truncated hg dirstate data file");
+  }
+  std::string_view tree{data.data(), dataSize};
+
+  // Each node appears once in the tree, so bounding the number of visits by
+  // the number of nodes that fit protects against cycles.
+  size_t budget = tree.size() / kV2NodeSize;
+  std::vector<std::pair<uint32_t, uint32_t>> pending{{rootStart, rootCount}};
+  while (!pending.empty()) {
+    auto [start, count] = pending.back();
+    pending.pop_back();
+    if (count > budget) {
+      throw SCMError("invalid hg dirstate tree");
+    }
+    budget -= count;
+
+    Reader nodes{tree, start};
+    for (uint32_t i = 0; i < count; ++i) {
+      Reader node{nodes.take(kV2NodeSize)};
+      auto pathStart = node.be32();
+      auto pathLen = node.be16();
+      node.take(2 + 6); // base name start and copy source
+      auto childStart = node.be32();
+      auto childCount = node.be32();
+      node.take(4 + 4); // descendant counts
+      auto flags = node.be16();
+      auto size = node.be32();
+      auto mtime = node.be32();
+
+      if (childCount) {
+        pending.emplace_back(childStart, childCount);
+      }
+      auto state = stateOfFlags(flags);
+      if (!state) {
+        continue;
+      }
+      HgDirStateEntry entry;
+      entry.path = std::string(Reader{tree, pathStart}.take(pathLen));
+      entry.state = state;
+      if (flags & kHasModeAndSize) {
+        entry.mode = (flags & kModeIsSymlink) ? 0120000
+            : (flags & kModeExecPerm)         ? 0100755
+                                              : 0100644;
+        entry.size = int32_t(size);
+      }
+      if (flags & kHasMtime) {
+        entry.mtime = int32_t(mtime);
+      }
+      entries_.push_back(std::move(entry));
+    }
+  }
+}
+
+} // namespace watchman
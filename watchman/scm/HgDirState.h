@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace watchman {
+
+struct HgDirStateParents {
+  // 40 hex digits each; p2 is all zeros unless a merge is in progress
+  std::string p1;
+  std::string p2;
+};
+
+struct HgDirStateEntry {
+  // Relative to the root of the working copy, with forward slashes
+  std::string path;
+  // As hg debugstate shows it: 'n'ormal, 'a'dded, 'r'emoved or 'm'erged
+  char state{'n'};
+  uint32_t mode{0};
+  int32_t size{0};
+  int32_t mtime{0};
+};
+
+/**
+ * A parsed .hg/dirstate, which tells the working copy parents and the state
+ * of the tracked files without running hg.
+ *
+ * Both formats are supported.  A dirstate-v1 file holds everything; a
+ * dirstate-v2 file is a docket that holds the parents and names the data
+ * file that holds the tree of files.
+ */
+class HgDirState {
+ public:
+  // Enough of the head of either format for parseParents()
+  static constexpr size_t kParentsSize = 76;
+
+  // Throws SCMError if `head` is not the start of a dirstate
+  static HgDirStateParents parseParents(std::string_view head);
+
+  // Returns the contents of the named file in .hg
+  using ReadFile = std::function<std::string(const std::string& name)>;
+
+  // Throws SCMError if `dirstate`, or the data file that it names, is not
+  // valid
+  static HgDirState parse(std::string_view dirstate, const ReadFile& readFile);
+
+  const HgDirStateParents& parents() const {
+    return parents_;
+  }
+
+  // Sorted by path
+  const std::vector<HgDirStateEntry>& entries() const {
+    return entries_;
+  }
+
+ private:
+  void parseV1(std::string_view dirstate);
+  void parseV2(std::string_view docket, const ReadFile& readFile);
+
+  HgDirStateParents parents_;
+  std::vector<HgDirStateEntry> entries_;
+};
+
+} // namespace watchman
@@ -6,14 +6,17 @@
  */
 
 #include "Mercurial.h"
+#include <folly/FileUtil.h>
 #include <folly/String.h>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <optional>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/scm/HgDirState.h"
 #include "watchman/sockname.h"
 
 // Capability indicating support for the mercurial SCM
@@ -37,34 +40,24 @@ std::string hgExecutablePath() {
   return "hg";
 }
 
-struct MercurialResult {
-  w_string output;
-};
-
-MercurialResult runMercurial(
-    std::vector<std::string_view> cmdline,
-    ChildProcess::Options options,
-    std::string_view description) {
-  ChildProcess proc{cmdline, std::move(options)};
-  auto outputs = proc.communicate();
-  auto status = proc.wait();
-  if (status) {
-    auto output = std::string{outputs.first.view()};
-    auto error = std::string{outputs.second.view()};
-    replaceEmbeddedNulls(output);
-    replaceEmbeddedNulls(error);
-    throw SCMError{
-        "failed to ",
-        description,
-        "\ncmd = ",
-        folly::join(" ", cmdline),
-        "\nstdout = ",
-        output,
-        "\nstderr = ",
-        error};
-  }
-
-  return MercurialResult{std::move(outputs.first)};
+[[noreturn]] void throwHgFailure(
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description,
+    const w_string& stdoutData,
+    const w_string& stderrData) {
+  auto output = std::string{stdoutData.view()};
+  auto error = std::string{stderrData.view()};
+  replaceEmbeddedNulls(output);
+  replaceEmbeddedNulls(error);
+  throw SCMError{
+      "failed to ",
+      description,
+      "\ncmd = ",
+      folly::join(" ", cmdline),
+      "\nstdout = ",
+      output,
+      "\nstderr = ",
+      error};
 }
 
 } // namespace
@@ -113,6 +106,7 @@ SCM::StatusResult StatusAccumulator::finalize() const {
 
 ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   ChildProcess::Options opt;
+  opt.setKind(ChildProcess::Kind::Scm);
   // Ensure that the hgrc doesn't mess with the behavior
   // of the commands that we're runing.
   opt.environment().set("HGPLAIN", w_string("1"));
@@ -152,12 +146,52 @@ ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   // rather than whatever is hardcoded in its config.
   opt.environment().set("WATCHMAN_SOCK", get_sock_name_legacy());
 
+  opt.chdir(getRootPath());
+
+  return opt;
+}
+
+w_string Mercurial::runMercurial(
+    std::vector<std::string_view> cmdline,
+    w_string requestId,
+    std::string_view description) const {
+  // The server's environment is fixed when it starts, so a request id that
+  // would be logged needs an hg of its own.
+  bool needsOwnProcess = requestId && !requestId.empty() &&
+      cfg_get_bool("enable_hg_telemetry_logging", false);
+  if (commandServer_ && !needsOwnProcess) {
+    std::vector<std::string> args{cmdline.begin() + 1, cmdline.end()};
+    std::optional<HgCommandServer::Result> result;
+    try {
+      result = commandServer_->runCommand(std::move(args)).get();
+    } catch (const std::exception& exc) {
+      // The server could not be started or went away; fall back to running
+      // this one ourselves.  The next command starts a new server.
+      log(ERR,
+          "hg command server failed, running hg directly: ",
+          exc.what(),
+          "\n");
+    }
+    if (result) {
+      if (result->status) {
+        throwHgFailure(cmdline, description, result->output, result->error);
+      }
+      return std::move(result->output);
+    }
+  }
+
+  auto opt = makeHgOptions(requestId);
   opt.nullStdin();
   opt.pipeStdout();
   opt.pipeStderr();
-  opt.chdir(getRootPath());
+  ChildProcess proc{cmdline, std::move(opt)};
+  auto outputs = proc.communicate();
+  auto status = proc.wait();
+  if (status) {
+    throwHgFailure(cmdline, description, outputs.first, outputs.second);
+  }
 
-  return opt;
+  return std::move(outputs.first);
 }
 
 Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
@@ -174,7 +208,13 @@ Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
           Configuration(),
           "scm_hg_files_since_mergebase",
           32,
-          10) {}
+          10) {
+  if (cfg_get_bool("scm_hg_command_server", false)) {
+    // The server never logs telemetry, as it can't be told the request ids
+    commandServer_ = std::make_unique<HgCommandServer>(
+        hgExecutablePath(), [this] { return makeHgOptions(nullptr); });
+  }
+}
 
 struct timespec Mercurial::getDirStateMtime() const {
   try {
@@ -192,11 +232,35 @@ struct timespec Mercurial::getDirStateMtime() const {
   }
 }
 
+std::optional<std::string> Mercurial::readWorkingCopyParent() const {
+  std::string head;
+  if (!folly::readFile(dirStatePath_.c_str(), head, HgDirState::kParentsSize)) {
+    return std::nullopt;
+  }
+  try {
+    return HgDirState::parseParents(head).p1;
+  } catch (const SCMError& exc) {
+    logf(DBG, "unable to read {}: {}\n", dirStatePath_, exc.what());
+    return std::nullopt;
+  }
+}
+
 w_string Mercurial::mergeBaseWith(w_string_piece commitId, w_string requestId)
     const {
-  auto mtime = getDirStateMtime();
-  auto key = folly::to<std::string>(
-      commitId.view(), ":", mtime.tv_sec, ":", mtime.tv_nsec);
+  // The merge base only depends on the working copy parent, which the
+  // dirstate says directly.  Its mtime, which hg bumps far more often, is
+  // the fallback.
+  std::string key;
+  if (auto parent = readWorkingCopyParent()) {
+    if (commitId.view() == *parent) {
+      return commitId.asWString();
+    }
+    key = folly::to<std::string>(commitId.view(), ":", *parent);
+  } else {
+    auto mtime = getDirStateMtime();
+    key = folly::to<std::string>(
+        commitId.view(), ":", mtime.tv_sec, ":", mtime.tv_nsec);
+  }
   auto commit = std::string{commitId.view()};
 
   return mergeBases_
@@ -204,18 +268,18 @@ w_string Mercurial::mergeBaseWith(w_string_piece commitId, w_string requestId)
           key,
           [this, commit, requestId](const std::string&) {
             auto revset = to<std::string>("ancestor(.,", commit, ")");
-            auto result = runMercurial(
+            auto output = runMercurial(
                 {hgExecutablePath(), "log", "-T", "{node}", "-r", revset},
-                makeHgOptions(requestId),
+                requestId,
                 "query for the merge base");
 
-            if (result.output.size() != 40) {
+            if (output.size() != 40) {
               throw SCMError(
                   "expected merge base to be a 40 character string, got ",
-                  result.output.view());
+                  output.view());
             }
 
-            return folly::makeFuture(result.output);
+            return folly::makeFuture(output);
           })
       .get()
       ->value();
@@ -234,7 +298,7 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runMercurial(
+            auto output = runMercurial(
                 {hgExecutablePath(),
                  "--traceback",
                  "status",
@@ -244,11 +308,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
                  // The "" argument at the end causes paths to be printed out
                  // relative to the cwd (set to root path above).
                  ""},
-                makeHgOptions(requestId),
+                requestId,
                 "query for files changed since merge base");
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -287,7 +351,7 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
             .get(
                 key,
                 [&](const std::string&) {
-                  auto hgresult = runMercurial(
+                  auto output = runMercurial(
                       {hgExecutablePath(),
                        "--traceback",
                        "status",
@@ -299,10 +363,10 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
                        // The "" argument at the end causes paths to be printed
                        // out relative to the cwd (set to root path above).
                        ""},
-                      makeHgOptions(requestId),
+                      requestId,
                       "get files changed between commits");
 
-                  return folly::makeFuture(hgresult.output);
+                  return folly::makeFuture(output);
                 })
             .get()
             ->value());
@@ -313,7 +377,7 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
 time_point<system_clock> Mercurial::getCommitDate(
     w_string_piece commitId,
     w_string requestId) const {
-  auto result = runMercurial(
+  auto output = runMercurial(
       {hgExecutablePath(),
        "--traceback",
        "log",
@@ -321,9 +385,9 @@ time_point<system_clock> Mercurial::getCommitDate(
        commitId.data(),
        "-T",
        "{date}\n"},
-      makeHgOptions(requestId),
+      requestId,
       "get commit date");
-  return Mercurial::convertCommitDate(result.output.c_str());
+  return Mercurial::convertCommitDate(output.c_str());
 }
 
 time_point<system_clock> Mercurial::convertCommitDate(const char* commitDate) {
@@ -355,7 +419,7 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
                 "), ",
                 numCommits,
                 "))\n");
-            auto result = runMercurial(
+            auto output = runMercurial(
                 {hgExecutablePath(),
                  "--traceback",
                  "log",
@@ -363,11 +427,11 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
                  revset,
                  "-T",
                  "{node}\n"},
-                makeHgOptions(requestId),
+                requestId,
                 "get prior commits");
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
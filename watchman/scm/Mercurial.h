@@ -9,11 +9,14 @@
 #include "watchman/watchman_system.h"
 
 #include <folly/Synchronized.h>
+#include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/scm/HgCommandServer.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -61,9 +64,25 @@ class Mercurial : public SCM {
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
 
-  // Returns options for invoking hg
+  // If scm_hg_command_server is set, runs the commands that don't need a
+  // process of their own
+  std::unique_ptr<HgCommandServer> commandServer_;
+
+  // Returns the environment and working directory for invoking hg
   ChildProcess::Options makeHgOptions(w_string requestId) const;
+
+  // Runs `cmdline` and returns its output, throwing SCMError if it fails.
+  // Uses commandServer_ if possible.
+  w_string runMercurial(
+      std::vector<std::string_view> cmdline,
+      w_string requestId,
+      std::string_view description) const;
+
   struct timespec getDirStateMtime() const;
+
+  // Reads the first parent of the working copy from the dirstate, without
+  // running hg.  Returns nullopt if the dirstate can't be read.
+  std::optional<std::string> readWorkingCopyParent() const;
 };
 
 } // namespace watchman
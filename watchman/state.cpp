@@ -8,6 +8,11 @@
 #include "watchman/state.h"
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <unordered_map>
+#include <utility>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
@@ -15,6 +20,7 @@
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
@@ -40,6 +46,23 @@ struct state {
 folly::Synchronized<state, std::mutex> saveState;
 std::condition_variable stateCond;
 std::thread state_saver_thread;
+
+/** The roots of the state file are restored in the background by a few
+ * threads, most recently used first.  Each thread waits for the initial
+ * crawl of its root before taking the next one, so that the roots in use
+ * don't compete for I/O with all of the others. */
+struct Restoration {
+  // The entries of "watched" that are waiting for a thread
+  std::deque<json_ref> queue;
+  // The entries that aren't watched yet, including those being restored,
+  // by path.  They are saved along with the watched roots so that a
+  // restart during the restoration doesn't forget them.
+  std::unordered_map<w_string, json_ref> unresolved;
+};
+folly::Synchronized<Restoration> restoration;
+std::vector<std::thread> restore_threads;
+
+constexpr json_int_t kDefaultRestoreConcurrency = 4;
 } // namespace
 
 static bool do_state_save();
@@ -70,8 +93,19 @@ void w_state_shutdown() {
     return;
   }
 
+  for (auto& thread : restore_threads) {
+    thread.join();
+  }
+  restore_threads.clear();
+
   stateCond.notify_one();
   state_saver_thread.join();
+
+  // The saver stops without looking for a save that was requested as the
+  // daemon began to stop
+  if (std::exchange(saveState.lock()->needsSave, false)) {
+    do_state_save();
+  }
 }
 
 bool w_state_load() {
@@ -170,8 +204,23 @@ bool w_root_save_state(json_ref& state) {
       auto triggers = root->triggerListToJson();
       json_object_set_new(obj, "triggers", std::move(triggers));
 
+      auto lastUsed = root->inner.last_cmd_wallclock.load();
+      obj.set(
+          "last_used",
+          json_integer(std::chrono::duration_cast<std::chrono::seconds>(
+                           lastUsed.time_since_epoch())
+                           .count()));
+      obj.set("crawl_heat", root->crawlHeat.toJson());
+
       json_array_append_new(watched_dirs, std::move(obj));
     }
+
+    auto pending = restoration.rlock();
+    for (const auto& it : pending->unresolved) {
+      if (map->find(it.first) == map->end()) {
+        json_array_append(watched_dirs, it.second);
+      }
+    }
   }
 
   json_object_set_new(state, "watched", std::move(watched_dirs));
@@ -179,6 +228,119 @@ bool w_root_save_state(json_ref& state) {
   return result;
 }
 
+// Watches the root of an entry of the state file and re-creates its
+// triggers
+static std::shared_ptr<Root> restore_root(const json_ref& obj) {
+  bool created = false;
+  size_t j;
+
+  auto triggers = obj.get_default("triggers");
+  auto filename = json_string_value(json_object_get(obj, "path"));
+
+  std::shared_ptr<Root> root;
+  try {
+    root = root_resolve(filename, true, &created);
+  } catch (const std::exception&) {
+    return nullptr;
+  }
+
+  // Carry the recorded activity over to the next save
+  auto lastUsed = obj.get_default("last_used");
+  if (lastUsed && lastUsed.isInt()) {
+    root->inner.last_cmd_wallclock.store(
+        std::chrono::system_clock::time_point{
+            std::chrono::seconds{lastUsed.asInt()}});
+  }
+  // The crawl starts below, and visits what queries used first
+  root->crawlHeat.load(obj.get_default("crawl_heat"));
+
+  {
+    auto wlock = root->triggers.wlock();
+    auto& map = *wlock;
+
+    /* re-create the trigger configuration */
+    for (j = 0; j < json_array_size(triggers); j++) {
+      const auto& tobj = triggers.at(j);
+
+      // Legacy rules format
+      auto rarray = tobj.get_default("rules");
+      if (rarray) {
+        continue;
+      }
+
+      try {
+        auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
+        cmd->start(root);
+        auto& mapEntry = map[cmd->triggername];
+        mapEntry = std::move(cmd);
+      } catch (const std::exception& exc) {
+        watchman::log(
+            watchman::ERR,
+            "loading trigger for ",
+            root->root_path,
+            ": ",
+            exc.what(),
+            "\n");
+      }
+    }
+  }
+
+  if (created) {
+    try {
+      root->view()->startThreads(root);
+    } catch (const std::exception& e) {
+      watchman::log(
+          watchman::ERR,
+          "root_start(",
+          root->root_path,
+          ") failed: ",
+          e.what(),
+          "\n");
+      root->cancel();
+      return nullptr;
+    }
+  }
+
+  return root;
+}
+
+static void root_restorer(size_t index) noexcept {
+  w_set_thread_name("restore-", index);
+
+  while (!w_is_stopping()) {
+    json_ref obj;
+    {
+      auto pending = restoration.wlock();
+      if (pending->queue.empty()) {
+        return;
+      }
+      obj = std::move(pending->queue.front());
+      pending->queue.pop_front();
+    }
+
+    std::shared_ptr<Root> root;
+    try {
+      root = restore_root(obj);
+    } catch (const std::exception& exc) {
+      logf(ERR, "restoring a watch: {}\n", exc.what());
+    }
+    restoration.wlock()->unresolved.erase(
+        json_to_w_string(json_object_get(obj, "path")));
+    if (!root) {
+      continue;
+    }
+
+    auto ready = root->view()->waitUntilReadyToQuery(root);
+    while (!w_is_stopping() &&
+           ready.wait_for(std::chrono::seconds(1)) !=
+               std::future_status::ready) {
+      if (root->inner.cancelled) {
+        break;
+      }
+    }
+  }
+}
+
 bool w_root_load_state(const json_ref& state) {
   size_t i;
 
@@ -191,69 +353,45 @@ bool w_root_load_state(const json_ref& state) {
     return false;
   }
 
+  std::vector<json_ref> entries;
   for (i = 0; i < json_array_size(watched); i++) {
     const auto& obj = watched.at(i);
-    bool created = false;
-    const char* filename;
-    size_t j;
-
-    auto triggers = obj.get_default("triggers");
-    filename = json_string_value(json_object_get(obj, "path"));
-
-    std::shared_ptr<Root> root;
-    try {
-      root = root_resolve(filename, true, &created);
-    } catch (const std::exception&) {
+    if (!json_string_value(json_object_get(obj, "path"))) {
       continue;
     }
+    entries.push_back(obj);
+  }
 
-    {
-      auto wlock = root->triggers.wlock();
-      auto& map = *wlock;
-
-      /* re-create the trigger configuration */
-      for (j = 0; j < json_array_size(triggers); j++) {
-        const auto& tobj = triggers.at(j);
-
-        // Legacy rules format
-        auto rarray = tobj.get_default("rules");
-        if (rarray) {
-          continue;
-        }
-
-        try {
-          auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
-          cmd->start(root);
-          auto& mapEntry = map[cmd->triggername];
-          mapEntry = std::move(cmd);
-        } catch (const std::exception& exc) {
-          watchman::log(
-              watchman::ERR,
-              "loading trigger for ",
-              root->root_path,
-              ": ",
-              exc.what(),
-              "\n");
-        }
-      }
-    }
+  // Most recently used first; roots saved by older versions go last
+  auto lastUsed = [](const json_ref& obj) {
+    auto value = obj.get_default("last_used");
+    return value && value.isInt() ? value.asInt() : json_int_t(0);
+  };
+  std::stable_sort(
+      entries.begin(),
+      entries.end(),
+      [&](const json_ref& a, const json_ref& b) {
+        return lastUsed(a) > lastUsed(b);
+      });
 
-    if (created) {
-      try {
-        root->view()->startThreads(root);
-      } catch (const std::exception& e) {
-        watchman::log(
-            watchman::ERR,
-            "root_start(",
-            root->root_path,
-            ") failed: ",
-            e.what(),
-            "\n");
-        root->cancel();
-      }
+  {
+    auto pending = restoration.wlock();
+    for (auto& obj : entries) {
+      pending->unresolved.emplace(
+          json_to_w_string(json_object_get(obj, "path")), obj);
+      pending->queue.push_back(obj);
     }
   }
 
+  auto concurrency = std::min(
+      size_t(std::max(
+          json_int_t(1),
+          cfg_get_int("root_restore_concurrency", kDefaultRestoreConcurrency))),
+      entries.size());
+  for (i = 0; i < concurrency; ++i) {
+    restore_threads.emplace_back(root_restorer, i);
+  }
+
   return true;
 }
 
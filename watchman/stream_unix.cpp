@@ -219,6 +219,66 @@ class UnixStream : public watchman_stream {
     return x.value();
   }
 
+#if !defined(_WIN32) && defined(SCM_RIGHTS)
+  bool canPassDescriptors() const override {
+    return fd.fdType() == FileDescriptor::FDType::Socket;
+  }
+
+  bool writeWithDescriptor(
+      const void* buf,
+      int size,
+      const FileDescriptor& descriptor) override {
+    if (!canPassDescriptors() || size <= 0) {
+      return false;
+    }
+
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(buf);
+    iov.iov_len = size;
+
+    union {
+      struct cmsghdr hdr;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int passed = descriptor.fd();
+    memcpy(CMSG_DATA(cmsg), &passed, sizeof(passed));
+
+    ssize_t sent;
+    do {
+      sent = sendmsg(fd.fd(), &msg, 0);
+    } while (sent == -1 && errno == EINTR);
+    if (sent <= 0) {
+      return false;
+    }
+
+    // The descriptor travels with the first bytes; the rest are plain data
+    auto rest = reinterpret_cast<const char*>(buf) + sent;
+    size -= int(sent);
+    while (size > 0) {
+      auto x = write(rest, size);
+      if (x <= 0) {
+        return false;
+      }
+      rest += x;
+      size -= x;
+    }
+    return true;
+  }
+#endif
+
   w_evt_t getEvents() override {
     return &evt;
   }
@@ -251,6 +311,22 @@ class UnixStream : public watchman_stream {
     );
   }
 
+  bool peerHasHungUp() override {
+    // Only a peer that has closed its end entirely is reported as hung up;
+    // one that merely shut down its writes after sending its request is
+    // still waiting for the response.
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = 0;
+    pfd.revents = 0;
+#ifdef _WIN32
+    int res = WSAPoll(&pfd, 1, 0);
+#else
+    int res = poll(&pfd, 1, 0);
+#endif
+    return res == 1 && (pfd.revents & (POLLERR | POLLHUP));
+  }
+
   // For these PEERCRED things, the uid reported is the effective uid of
   // the process, which may have been altered due to setuid or similar
   // mechanisms.  We'll treat the other process as an owner if their
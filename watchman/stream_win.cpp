@@ -19,6 +19,13 @@ using namespace watchman;
 // and dispatched to the underlying handle as prior
 // writes complete.
 
+// Reads fill this much of a buffer at a time
+static constexpr int kReadBufSize = 64 * 1024;
+// Writes are coalesced into queued buffers of at least this size, so that a
+// large result goes out in a few large operations rather than one per flush
+// of the encoder.  One buffer of this size is kept for reuse.
+static constexpr int kWriteBufSize = 256 * 1024;
+
 class win_handle;
 
 namespace {
@@ -66,6 +73,8 @@ struct overlapped_op {
 struct write_buf {
   struct write_buf* next;
   int len;
+  // How many bytes data has room for
+  int capacity;
   char* cursor;
   char data[1];
 };
@@ -80,8 +89,9 @@ class win_handle : public watchman_stream {
   DWORD errcode{0};
   DWORD file_type;
   struct write_buf *write_head{nullptr}, *write_tail{nullptr};
-  char read_buf[8192];
-  char* read_cursor{read_buf};
+  struct write_buf* spare_wbuf{nullptr};
+  std::unique_ptr<char[]> read_buf{std::make_unique<char[]>(kReadBufSize)};
+  char* read_cursor{read_buf.get()};
   int read_avail{0};
   bool blocking{true};
 
@@ -229,6 +239,7 @@ win_handle::~win_handle() {
       free(b);
     }
   }
+  free(spare_wbuf);
 
   DeleteCriticalSection(&mtx);
 }
@@ -255,10 +266,10 @@ static void move_from_read_buffer(
   stream_debug("moved %d bytes from buffer\n", nread);
 
   // Pack the buffer to free up space at the rear for reads
-  wasted = h->read_cursor - h->read_buf;
+  wasted = h->read_cursor - h->read_buf.get();
   if (wasted) {
-    memmove(h->read_buf, h->read_cursor, h->read_avail);
-    h->read_cursor = h->read_buf;
+    memmove(h->read_buf.get(), h->read_cursor, h->read_avail);
+    h->read_cursor = h->read_buf.get();
   }
 }
 
@@ -362,7 +373,7 @@ static int win_read_non_blocking(class win_handle* h, void* buf, int size) {
   move_from_read_buffer(h, &total_read, (char**)&buf, &size);
 
   target = h->read_cursor + h->read_avail;
-  target_space = (DWORD)((h->read_buf + sizeof(h->read_buf)) - target);
+  target_space = (DWORD)((h->read_buf.get() + kReadBufSize) - target);
 
   stream_debug("initiate read for %d\n", target_space);
 
@@ -437,6 +448,36 @@ int win_handle::read(void* buf, int size) {
 
 static void initiate_write(class win_handle* h);
 
+// Returns an empty buffer with room for at least size bytes.
+// Must be called with the mutex held.
+static struct write_buf* alloc_write_buf(class win_handle* h, int size) {
+  struct write_buf* wbuf;
+  if (size <= kWriteBufSize && h->spare_wbuf) {
+    wbuf = h->spare_wbuf;
+    h->spare_wbuf = nullptr;
+  } else {
+    int capacity = std::max(size, kWriteBufSize);
+    wbuf = (write_buf*)malloc(sizeof(*wbuf) + capacity - 1);
+    if (!wbuf) {
+      return nullptr;
+    }
+    wbuf->capacity = capacity;
+  }
+  wbuf->next = nullptr;
+  wbuf->cursor = wbuf->data;
+  wbuf->len = 0;
+  return wbuf;
+}
+
+// Must be called with the mutex held
+static void release_write_buf(class win_handle* h, struct write_buf* wbuf) {
+  if (!h->spare_wbuf && wbuf->capacity == kWriteBufSize) {
+    h->spare_wbuf = wbuf;
+  } else {
+    free(wbuf);
+  }
+}
+
 static void CALLBACK
 write_completed(DWORD err, DWORD bytes, LPOVERLAPPED olap) {
   // Reverse engineer our handle from the olap pointer
@@ -460,7 +501,7 @@ write_completed(DWORD err, DWORD bytes, LPOVERLAPPED olap) {
 
     if (wbuf->len == 0) {
       // Consumed this buffer
-      free(wbuf);
+      release_write_buf(h, wbuf);
     } else {
       stream_debug(
           "WriteFileEx: short write: %d written, %d remain\n",
@@ -552,23 +593,29 @@ int win_handle::write(const void* buf, int size) {
     return -1;
   }
 
-  wbuf = (write_buf*)malloc(sizeof(*wbuf) + size - 1);
-  if (!wbuf) {
-    return -1;
-  }
-  wbuf->next = nullptr;
-  wbuf->cursor = wbuf->data;
-  wbuf->len = size;
-  memcpy(wbuf->data, buf, size);
-
-  if (write_tail) {
-    write_tail->next = wbuf;
+  // Queued buffers aren't being written yet, so the last one can take
+  // more data if it has room
+  wbuf = write_tail;
+  if (wbuf &&
+      wbuf->capacity - int(wbuf->cursor - wbuf->data) - wbuf->len >= size) {
+    stream_debug("append write of %d bytes to write_tail\n", size);
   } else {
-    write_head = wbuf;
+    wbuf = alloc_write_buf(this, size);
+    if (!wbuf) {
+      LeaveCriticalSection(&mtx);
+      errno = ENOMEM;
+      return -1;
+    }
+    if (write_tail) {
+      write_tail->next = wbuf;
+    } else {
+      write_head = wbuf;
+    }
+    write_tail = wbuf;
+    stream_debug("queue write of %d bytes to write_tail\n", size);
   }
-  write_tail = wbuf;
-
-  stream_debug("queue write of %d bytes to write_tail\n", size);
+  memcpy(wbuf->cursor + wbuf->len, buf, size);
+  wbuf->len += size;
 
   if (!write_pending) {
     initiate_write(this);
@@ -9,6 +9,7 @@
 #include <new>
 #include <ostream>
 #include <stdexcept>
+#include "watchman/MemoryAccounting.h"
 #include "watchman/thirdparty/jansson/utf.h"
 #include "watchman/watchman_hash.h"
 #include "watchman/watchman_string.h"
@@ -43,6 +44,7 @@ w_string w_string_piece::asLowerCase(w_string_type_t stringType) const {
 
   s->refcnt = 1;
   s->len = size();
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
   s->type = stringType;
 
@@ -72,6 +74,7 @@ w_string w_string_piece::asLowerCaseSuffix(w_string_type_t stringType) const {
 
   s->refcnt = 1;
   s->len = suffixPiece.size();
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
   s->type = stringType;
 
@@ -378,6 +381,7 @@ w_string w_string::normalizeSeparators(char targetSeparator) const {
 
   s->refcnt = 1;
   s->len = len;
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
 
   for (i = 0; i < len; i++) {
@@ -433,18 +437,19 @@ w_string w_string::pathCat(std::initializer_list<w_string_piece> elems) {
   }
   *buf = 0;
   s->len = buf - s->buf;
+  w_string_record_allocation(s);
 
   return w_string(s, false);
 }
 
 uint32_t w_string_compute_hval(w_string_t* str) {
-  str->_hval = w_hash_bytes(str->buf, str->len, 0);
+  str->_hval = w_hash_string(str->buf, str->len);
   str->hval_computed = 1;
   return str->_hval;
 }
 
 uint32_t w_string_piece::hashValue() const {
-  return w_hash_bytes(data(), size(), 0);
+  return w_hash_string(data(), size());
 }
 
 uint32_t strlen_uint32(const char* str) {
@@ -466,6 +471,7 @@ w_string_new_len_typed(const char* str, uint32_t len, w_string_type_t type) {
 
   s->refcnt = 1;
   s->len = len;
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
   if (str) {
     memcpy(buf, str, len);
@@ -492,6 +498,7 @@ w_string w_string::vprintf(const char* format, va_list args) {
 
   s->refcnt = 1;
   s->len = len;
+  w_string_record_allocation(s);
   buf = const_cast<char*>(s->buf);
   vsnprintf(buf, len + 1, format, args);
 
@@ -502,10 +509,17 @@ void w_string_addref(w_string_t* str) {
   ++str->refcnt;
 }
 
+void w_string_record_allocation(const w_string_t* str) {
+  watchman::recordAllocation(
+      watchman::MemoryCategory::Strings, sizeof(*str) + str->len + 1);
+}
+
 void w_string_delref(w_string_t* str) {
   if (--str->refcnt != 0) {
     return;
   }
+  watchman::recordDeallocation(
+      watchman::MemoryCategory::Strings, sizeof(*str) + str->len + 1);
   // Call the destructor.  We can't use regular delete because
   // we allocated using operator new[], and we can't use delete[]
   // directly either because the type doesn't match what we allocated.
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/AdmissionController.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+#include "watchman/Errors.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(AdmissionControllerTest, unlimited) {
+  AdmissionController controller{{0, 0, 0ms}};
+  auto a = controller.admit("a");
+  auto b = controller.admit("b");
+  EXPECT_EQ(2, controller.stats().running);
+}
+
+TEST(AdmissionControllerTest, rejects_when_queue_is_full) {
+  AdmissionController controller{{1, 0, 1000ms}};
+  {
+    auto ticket = controller.admit("a");
+    EXPECT_THROW(controller.admit("b"), CommandOverloadedError);
+    EXPECT_EQ(1, controller.stats().rejected);
+  }
+  // The slot is free again
+  auto ticket = controller.admit("c");
+  auto stats = controller.stats();
+  EXPECT_EQ(1, stats.running);
+  EXPECT_EQ(2, stats.admitted);
+}
+
+TEST(AdmissionControllerTest, times_out_while_queued) {
+  AdmissionController controller{{1, 1, 10ms}};
+  auto ticket = controller.admit("a");
+  EXPECT_THROW(controller.admit("b"), CommandOverloadedError);
+  auto stats = controller.stats();
+  EXPECT_EQ(1, stats.timedOut);
+  EXPECT_EQ(0, stats.queued);
+}
+
+TEST(AdmissionControllerTest, queued_command_runs_when_slot_frees) {
+  AdmissionController controller{{1, 1, 10000ms}};
+  auto ticket = std::make_unique<AdmissionController::Ticket>(
+      controller.admit("a"));
+
+  std::thread waiter([&] { auto queued = controller.admit("b"); });
+  while (controller.stats().queued == 0) {
+    std::this_thread::yield();
+  }
+  // The queue is full
+  EXPECT_THROW(controller.admit("c"), CommandOverloadedError);
+
+  ticket.reset();
+  waiter.join();
+  auto stats = controller.stats();
+  EXPECT_EQ(0, stats.running);
+  EXPECT_EQ(2, stats.admitted);
+  EXPECT_EQ(1, stats.rejected);
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/cppclient/BserView.h"
+#include <folly/experimental/bser/Bser.h>
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <string>
+#include "watchman/cppclient/WatchmanConnection.h"
+
+using namespace watchman;
+using folly::dynamic;
+
+namespace {
+
+// Encodes values by hand, to cover what folly's encoder doesn't produce,
+// such as templates and every width of integer
+
+template <typename T>
+std::string raw(T value) {
+  std::string out(sizeof(value), '\0');
+  memcpy(out.data(), &value, sizeof(value));
+  return out;
+}
+
+std::string i8(int8_t value) {
+  return "\x03" + raw(value);
+}
+std::string i16(int16_t value) {
+  return "\x04" + raw(value);
+}
+std::string i32(int32_t value) {
+  return "\x05" + raw(value);
+}
+std::string i64(int64_t value) {
+  return "\x06" + raw(value);
+}
+std::string real(double value) {
+  return "\x07" + raw(value);
+}
+std::string str(const std::string& value) {
+  return "\x02" + i8(int8_t(value.size())) + value;
+}
+std::string utf8(const std::string& value) {
+  return "\x0d" + i8(int8_t(value.size())) + value;
+}
+std::string arr(int8_t count) {
+  return std::string(1, '\x00') + i8(count);
+}
+std::string obj(int8_t count) {
+  return "\x01" + i8(count);
+}
+const std::string kTrue = "\x08";
+const std::string kFalse = "\x09";
+const std::string kNull = "\x0a";
+const std::string kSkip = "\x0c";
+
+std::string pdu(const std::string& value) {
+  return std::string("\x00\x01", 2) + i32(int32_t(value.size())) + value;
+}
+
+std::string pduV2(const std::string& value, uint32_t capabilities) {
+  return std::string("\x00\x02", 2) + raw(capabilities) +
+      i32(int32_t(value.size())) + value;
+}
+
+// The view refers to `encoded`, which must outlive it
+BserView view(const std::string& encoded) {
+  return BserView::fromPdu(folly::ByteRange{
+      reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size()});
+}
+
+} // namespace
+
+TEST(BserViewTest, scalars) {
+  for (auto [encoded, expected] : std::vector<std::pair<std::string, int64_t>>{
+           {i8(-5), -5},
+           {i16(1000), 1000},
+           {i32(-100000), -100000},
+           {i64(int64_t(1) << 40), int64_t(1) << 40}}) {
+    auto data = pdu(encoded);
+    auto value = view(data);
+    EXPECT_TRUE(value.isInt());
+    EXPECT_EQ(expected, value.asInt());
+    EXPECT_EQ(double(expected), value.asDouble());
+    EXPECT_THROW(value.asString(), WatchmanError);
+  }
+
+  auto data = pdu(real(1.5));
+  EXPECT_EQ(1.5, view(data).asDouble());
+  EXPECT_THROW(view(data).asInt(), WatchmanError);
+
+  data = pdu(kTrue);
+  EXPECT_TRUE(view(data).asBool());
+  data = pdu(kFalse);
+  EXPECT_FALSE(view(data).asBool());
+  data = pdu(kNull);
+  EXPECT_TRUE(view(data).isNull());
+  EXPECT_THROW(view(data).asBool(), WatchmanError);
+
+  data = pdu(str("hello"));
+  EXPECT_TRUE(view(data).isString());
+  EXPECT_EQ("hello", view(data).asString());
+  data = pdu(utf8("h\xc3\xa9"));
+  EXPECT_TRUE(view(data).isString());
+  EXPECT_EQ("h\xc3\xa9", view(data).asString());
+}
+
+TEST(BserViewTest, objects_and_arrays) {
+  auto data = pdu(
+      obj(3) + str("name") + str("a") + str("list") + arr(3) + i8(1) +
+      i16(2) + i32(3) + str("size") + i64(5));
+  auto value = view(data);
+  ASSERT_TRUE(value.isObject());
+  EXPECT_EQ(3, value.size());
+  EXPECT_EQ("a", value.get("name")->asString());
+  EXPECT_EQ(5, value.get("size")->asInt());
+  EXPECT_FALSE(value.get("missing"));
+  EXPECT_THROW(value.elements(), WatchmanError);
+  EXPECT_THROW(value.asString(), WatchmanError);
+
+  auto list = *value.get("list");
+  ASSERT_TRUE(list.isArray());
+  EXPECT_EQ(3, list.size());
+  std::vector<int64_t> ints;
+  for (auto element : list.elements()) {
+    ints.push_back(element.asInt());
+  }
+  EXPECT_EQ((std::vector<int64_t>{1, 2, 3}), ints);
+  EXPECT_THROW(list.get("name"), WatchmanError);
+
+  std::vector<std::string> keys;
+  value.forEachField(
+      [&](std::string_view key, BserView) { keys.emplace_back(key); });
+  EXPECT_EQ((std::vector<std::string>{"name", "list", "size"}), keys);
+
+  // The encoding of the value is all of the PDU after its header
+  EXPECT_EQ(data.size() - 7, value.encoded().size());
+
+  EXPECT_EQ(
+      dynamic::object("name", "a")("list", dynamic::array(1, 2, 3))("size", 5),
+      value.toDynamic());
+}
+
+TEST(BserViewTest, templates) {
+  // The second row skips its size
+  auto data = pdu(
+      "\x0b" + arr(2) + str("name") + str("size") + i8(2) + str("a") +
+      i8(1) + str("b") + kSkip);
+  auto value = view(data);
+  ASSERT_TRUE(value.isTemplate());
+  EXPECT_EQ(2, value.size());
+
+  BserRows rows{value};
+  EXPECT_EQ(2, rows.size());
+  std::vector<std::string> names;
+  std::vector<std::optional<int64_t>> sizes;
+  for (auto row : rows) {
+    names.emplace_back(row.get("name")->asString());
+    auto size = row.get("size");
+    sizes.push_back(
+        size ? std::optional<int64_t>(size->asInt()) : std::nullopt);
+    EXPECT_FALSE(row.get("missing"));
+  }
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), names);
+  EXPECT_EQ((std::vector<std::optional<int64_t>>{1, std::nullopt}), sizes);
+
+  EXPECT_EQ(
+      dynamic::array(
+          dynamic::object("name", "a")("size", 1),
+          dynamic::object("name", "b")),
+      value.toDynamic());
+}
+
+TEST(BserViewTest, rows_of_an_array_of_objects) {
+  auto data = pdu(
+      arr(2) + obj(1) + str("name") + str("a") + obj(2) + str("size") +
+      i8(2) + str("name") + str("b"));
+  BserRows rows{view(data)};
+  EXPECT_EQ(2, rows.size());
+  std::vector<std::string> names;
+  for (auto row : rows) {
+    names.emplace_back(row.get("name")->asString());
+  }
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), names);
+
+  auto scalar = pdu(i8(1));
+  EXPECT_THROW(BserRows{view(scalar)}, WatchmanError);
+}
+
+TEST(BserViewTest, agrees_with_folly) {
+  auto expected = dynamic::object("version", "1.2.3")("clock", "c:1:2:3:4")(
+      "files",
+      dynamic::array(
+          dynamic::object("name", "a.txt")("size", 123456789)("exists", true),
+          dynamic::object("name", "b")("size", -1)("exists", false)))(
+      "ratio", 0.25)("none", nullptr);
+  std::string data =
+      folly::bser::toBser(expected, folly::bser::serialization_opts());
+  EXPECT_EQ(expected, view(data).toDynamic());
+}
+
+TEST(BserViewTest, version_2_pdus) {
+  auto data = pduV2(str("hello"), 0);
+  EXPECT_EQ("hello", view(data).asString());
+
+  // Compressed and shared memory payloads can't be read in place
+  for (uint32_t capabilities : {0x8, 0x20}) {
+    data = pduV2(str("hello"), capabilities);
+    EXPECT_THROW(view(data), WatchmanError);
+  }
+}
+
+TEST(BserViewTest, malformed_headers) {
+  EXPECT_THROW(view(""), WatchmanError);
+  EXPECT_THROW(view(std::string("\x00", 1)), WatchmanError);
+  // Bad magic
+  EXPECT_THROW(view("\x01\x01" + i8(1) + kNull), WatchmanError);
+  EXPECT_THROW(view(std::string("\x00\x03", 2) + i8(1) + kNull), WatchmanError);
+  // The length isn't an integer
+  EXPECT_THROW(view(std::string("\x00\x01", 2) + kNull), WatchmanError);
+  // Or is negative
+  EXPECT_THROW(view(std::string("\x00\x01", 2) + i8(-1)), WatchmanError);
+  // Unknown type
+  EXPECT_THROW(view(pdu("\x0e")), WatchmanError);
+}
+
+TEST(BserViewTest, truncated_pdus) {
+  auto data = pdu(
+      obj(1) + str("files") + arr(2) + str("a") + str("some/longer/name"));
+  ASSERT_EQ(2, view(data).get("files")->size());
+  for (size_t len = 0; len < data.size(); ++len) {
+    EXPECT_THROW(view(data.substr(0, len)), WatchmanError) << len;
+  }
+}
+
+TEST(BserViewTest, values_that_overrun_their_pdu) {
+  // A string that is longer than what is left
+  auto data = pdu("\x02" + i8(10) + "abc");
+  auto value = view(data);
+  EXPECT_TRUE(value.isString());
+  EXPECT_THROW(value.asString(), WatchmanError);
+  EXPECT_THROW(value.encoded(), WatchmanError);
+
+  // A negative length
+  data = pdu("\x02" + i8(-1));
+  EXPECT_THROW(view(data).asString(), WatchmanError);
+
+  // An array with fewer elements than it claims
+  data = pdu(arr(3) + i8(1) + i8(2));
+  value = view(data);
+  EXPECT_EQ(3, value.size());
+  EXPECT_THROW(
+      {
+        for (auto element : value.elements()) {
+          element.asInt();
+        }
+      },
+      WatchmanError);
+  EXPECT_THROW(value.toDynamic(), WatchmanError);
+
+  // An object whose last value is missing
+  data = pdu(obj(2) + str("a") + i8(1) + str("b"));
+  value = view(data);
+  EXPECT_EQ(1, value.get("a")->asInt());
+  EXPECT_THROW(value.get("b"), WatchmanError);
+
+  // An integer cut short
+  data = pdu(std::string("\x05\x01", 2));
+  EXPECT_THROW(view(data).asInt(), WatchmanError);
+
+  // A template with fewer rows than it claims
+  data = pdu("\x0b" + arr(1) + str("name") + i8(3) + str("a"));
+  value = view(data);
+  EXPECT_THROW(value.encoded(), WatchmanError);
+  EXPECT_THROW(
+      {
+        for (auto row : BserRows{value}) {
+          row.get("name");
+        }
+      },
+      WatchmanError);
+}
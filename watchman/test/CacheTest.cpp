@@ -142,6 +142,47 @@ TEST(CacheTest, future) {
       << "cache should still be full (no excess) but has " << cache.size();
 }
 
+TEST(CacheTest, sharded) {
+  using Cache = LRUCache<int, int>;
+  Cache cache(8, kErrorTTL, std::chrono::seconds(300), 4);
+  folly::ManualExecutor exec;
+  EXPECT_EQ(cache.numShards(), 4);
+
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(cache.set(i, i * 2)->value(), i * 2) << "inserted";
+  }
+  EXPECT_LE(cache.size(), 8) << "each shard holds its share of the limit";
+  EXPECT_GT(cache.size(), 2) << "items are spread across the shards";
+
+  size_t found = 0;
+  for (int i = 0; i < 100; ++i) {
+    auto node = cache.get(i);
+    if (node) {
+      EXPECT_EQ(node->value(), i * 2) << "found the value stored for " << i;
+      ++found;
+    }
+  }
+  EXPECT_EQ(found, cache.size());
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.cacheStore, 100) << "stats are summed over the shards";
+  EXPECT_EQ(stats.cacheLoad, 100);
+  EXPECT_EQ(stats.cacheHit, found);
+  EXPECT_EQ(stats.size, found);
+
+  auto f = cache.get(
+      1000,
+      [&exec](int k) { return folly::makeFuture(k).via(&exec); },
+      std::chrono::steady_clock::now());
+  exec.drain();
+  EXPECT_EQ(std::move(f).get()->value(), 1000) << "getter fills its shard";
+  EXPECT_EQ(cache.get(1000)->value(), 1000);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0) << "all shards are cleared";
+  EXPECT_EQ(cache.stats().clearCount, 1);
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   folly::init(&argc, &argv);
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+
+using namespace watchman;
+
+namespace {
+
+QuerySince sinceTicks(uint32_t ticks) {
+  QuerySince since;
+  since.clock.is_fresh_instance = false;
+  since.clock.ticks = ticks;
+  return since;
+}
+
+std::vector<ChangeJournal::Entry> entriesSince(
+    const ChangeJournal& journal,
+    const QuerySince& since) {
+  std::vector<ChangeJournal::Entry> entries;
+  journal.forEachSince(since, [&](const ChangeJournal::Entry& entry) {
+    entries.push_back(entry);
+  });
+  return entries;
+}
+
+} // namespace
+
+TEST(ChangeJournalTest, replays_entries_after_since) {
+  ChangeJournal journal{1024 * 1024};
+  journal.record("/root/dir/a.txt", w_clock_t{10, 1000}, w_clock_t{4, 400}, 1);
+  journal.record("/root/dir/b.txt", w_clock_t{8, 800}, w_clock_t{8, 800}, 2);
+  journal.record("/root/other/c", w_clock_t{12, 1200}, w_clock_t{11, 900}, 3);
+  EXPECT_EQ(3, journal.numEntries());
+
+  auto entries = entriesSince(journal, sinceTicks(8));
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ(w_string("/root/dir/a.txt"), entries[0].path);
+  EXPECT_EQ(10, entries[0].otime.ticks);
+  EXPECT_EQ(1000, entries[0].otime.timestamp);
+  EXPECT_EQ(4, entries[0].ctime.ticks);
+  EXPECT_EQ(400, entries[0].ctime.timestamp);
+  EXPECT_EQ(1, entries[0].mode);
+  EXPECT_EQ(w_string("/root/other/c"), entries[1].path);
+  EXPECT_EQ(12, entries[1].otime.ticks);
+  EXPECT_EQ(11, entries[1].ctime.ticks);
+  EXPECT_EQ(900, entries[1].ctime.timestamp);
+  EXPECT_EQ(3, entries[1].mode);
+
+  QuerySince since;
+  since.is_timestamp = true;
+  since.timestamp = 1000;
+  entries = entriesSince(journal, since);
+  ASSERT_EQ(1, entries.size());
+  EXPECT_EQ(w_string("/root/other/c"), entries[0].path);
+
+  EXPECT_EQ(0, journal.forgottenTicks());
+  journal.forget(5);
+  EXPECT_EQ(5, journal.forgottenTicks());
+}
+
+TEST(ChangeJournalTest, drops_the_oldest_blocks_beyond_the_budget) {
+  ChangeJournal journal{2048, 256};
+  const uint32_t numEntries = 1000;
+  for (uint32_t i = 1; i <= numEntries; ++i) {
+    journal.record(
+        w_string::build("/root/some/long/dir/name/file-", i),
+        w_clock_t{i, time_t(i)},
+        w_clock_t{i, time_t(i)},
+        0);
+  }
+  EXPECT_LE(journal.memoryUsage(), 2048);
+  EXPECT_LT(journal.numEntries(), numEntries);
+
+  // The ticks of the dropped entries can no longer be answered, and
+  // everything after them still can
+  auto forgotten = journal.forgottenTicks();
+  EXPECT_GT(forgotten, 0);
+  auto entries = entriesSince(journal, sinceTicks(forgotten));
+  EXPECT_EQ(numEntries - forgotten, entries.size());
+  EXPECT_EQ(journal.numEntries(), entries.size());
+  std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+    return a.otime.ticks < b.otime.ticks;
+  });
+  EXPECT_EQ(forgotten + 1, entries.front().otime.ticks);
+  EXPECT_EQ(
+      w_string::build("/root/some/long/dir/name/file-", numEntries),
+      entries.back().path);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/ChangedFilesCache.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+struct Fixture {
+  ChangedFilesCache cache{4};
+  int fetches = 0;
+  int catchUps = 0;
+  std::vector<w_string> scmFiles{"b", "a"};
+  std::vector<w_string> viewChanges;
+  bool viewKnows = true;
+
+  std::vector<w_string> get(const char* mergeBase, ClockPosition position) {
+    auto files = cache.get(
+        w_string(mergeBase),
+        position,
+        [&] {
+          ++fetches;
+          return scmFiles;
+        },
+        [&](ClockPosition, ClockPosition, std::vector<w_string>& paths) {
+          ++catchUps;
+          paths.insert(paths.end(), viewChanges.begin(), viewChanges.end());
+          return viewKnows;
+        });
+    return *files;
+  }
+};
+
+} // namespace
+
+TEST(ChangedFilesCacheTest, catches_up_with_the_view) {
+  Fixture f;
+  using Files = std::vector<w_string>;
+  EXPECT_EQ((Files{"a", "b"}), f.get("base", ClockPosition(1, 10)));
+  EXPECT_EQ(1, f.fetches);
+
+  // Nothing happened since
+  EXPECT_EQ((Files{"a", "b"}), f.get("base", ClockPosition(1, 10)));
+  EXPECT_EQ(0, f.catchUps);
+
+  f.viewChanges = {"c", "a"};
+  EXPECT_EQ((Files{"a", "b", "c"}), f.get("base", ClockPosition(1, 12)));
+  EXPECT_EQ(1, f.fetches);
+  EXPECT_EQ(1, f.catchUps);
+
+  // Another merge base has its own files
+  f.scmFiles = {"z"};
+  EXPECT_EQ((Files{"z"}), f.get("other", ClockPosition(1, 12)));
+  EXPECT_EQ(2, f.fetches);
+}
+
+TEST(ChangedFilesCacheTest, asks_the_scm_when_the_view_cant_say) {
+  Fixture f;
+  using Files = std::vector<w_string>;
+  f.get("base", ClockPosition(1, 10));
+
+  f.scmFiles = {"d"};
+  f.viewKnows = false;
+  EXPECT_EQ((Files{"d"}), f.get("base", ClockPosition(1, 20)));
+  EXPECT_EQ(2, f.fetches);
+
+  // Nor for another instance of the root, or an earlier position
+  f.viewKnows = true;
+  f.scmFiles = {"e"};
+  EXPECT_EQ((Files{"e"}), f.get("base", ClockPosition(2, 30)));
+  f.scmFiles = {"f"};
+  EXPECT_EQ((Files{"f"}), f.get("base", ClockPosition(2, 25)));
+  EXPECT_EQ(4, f.fetches);
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "watchman/ChildIndex.h"
+
+using namespace watchman;
+
+namespace {
+
+using Index = ChildIndex<std::unique_ptr<int>>;
+
+// Keys are non-owning, so keep the names alive for the test duration
+std::vector<w_string> makeNames(size_t n) {
+  std::vector<w_string> names;
+  for (size_t i = 0; i < n; ++i) {
+    names.emplace_back(w_string::build("child", i));
+  }
+  return names;
+}
+
+void expectContents(const Index& index, const std::vector<w_string>& names) {
+  EXPECT_EQ(names.size(), index.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    auto it = index.find(names[i]);
+    ASSERT_NE(it, index.end()) << names[i].view();
+    EXPECT_EQ(int(i), *it->second);
+  }
+}
+
+} // namespace
+
+TEST(ChildIndexTest, small_insert_find_erase) {
+  auto names = makeNames(3);
+  Index index;
+  EXPECT_TRUE(index.empty());
+
+  for (size_t i = 0; i < names.size(); ++i) {
+    index[names[i]] = std::make_unique<int>(i);
+  }
+  expectContents(index, names);
+  EXPECT_EQ(index.find(w_string_piece("missing")), index.end());
+
+  EXPECT_EQ(1, index.erase(names[0]));
+  EXPECT_EQ(0, index.erase(names[0]));
+  EXPECT_EQ(index.find(names[0]), index.end());
+  EXPECT_EQ(2, index.size());
+  EXPECT_EQ(1, *index.find(names[1])->second);
+  EXPECT_EQ(2, *index.find(names[2])->second);
+}
+
+TEST(ChildIndexTest, operator_brackets_returns_existing_entry) {
+  auto names = makeNames(1);
+  Index index;
+  index[names[0]] = std::make_unique<int>(42);
+  EXPECT_EQ(42, *index[names[0]]);
+  EXPECT_EQ(1, index.size());
+}
+
+TEST(ChildIndexTest, grows_and_shrinks_across_index_threshold) {
+  auto names = makeNames(1000);
+  Index index;
+  for (size_t i = 0; i < names.size(); ++i) {
+    index[names[i]] = std::make_unique<int>(i);
+  }
+  expectContents(index, names);
+
+  size_t visited = 0;
+  for (const auto& it : index) {
+    EXPECT_NE(nullptr, it.second);
+    ++visited;
+  }
+  EXPECT_EQ(names.size(), visited);
+
+  // Remove everything but the first few entries, checking that the
+  // survivors remain reachable as entries get shuffled around.
+  for (size_t i = names.size() - 1; i >= 4; --i) {
+    EXPECT_EQ(1, index.erase(names[i])) << i;
+    if (i % 97 == 0) {
+      expectContents(
+          index, std::vector<w_string>(names.begin(), names.begin() + i));
+    }
+  }
+  expectContents(
+      index, std::vector<w_string>(names.begin(), names.begin() + 4));
+}
+
+TEST(ChildIndexTest, shrink_to_fit_keeps_entries_reachable) {
+  auto names = makeNames(1000);
+  Index index;
+  for (size_t i = 0; i < names.size(); ++i) {
+    index[names[i]] = std::make_unique<int>(i);
+  }
+  for (size_t i = names.size() - 1; i >= 100; --i) {
+    index.erase(names[i]);
+  }
+  index.shrinkToFit();
+  std::vector<w_string> survivors(names.begin(), names.begin() + 100);
+  expectContents(index, survivors);
+
+  // It keeps working as it grows again
+  for (size_t i = 100; i < 200; ++i) {
+    index[names[i]] = std::make_unique<int>(i);
+  }
+  expectContents(
+      index, std::vector<w_string>(names.begin(), names.begin() + 200));
+}
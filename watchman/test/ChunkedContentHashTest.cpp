@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChunkedContentHash.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+constexpr size_t kChunk = ChunkTree::kChunkSize;
+
+std::string pattern(size_t size, char seed) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = char(seed + i * 31 + i / 4096);
+  }
+  return data;
+}
+
+class ChunkedContentHashTest : public testing::Test {
+ public:
+  folly::test::TemporaryDirectory dir;
+  const std::string path{(dir.path() / "file").string()};
+
+  void write(const std::string& data) {
+    ASSERT_TRUE(folly::writeFile(data, path.c_str()));
+  }
+
+  void append(const std::string& data) {
+    ASSERT_TRUE(folly::writeFile(data, path.c_str(), O_WRONLY | O_APPEND));
+  }
+
+  ChunkTree hash(const ChunkTree* previous, uint64_t& bytesRead) {
+    bytesRead = 0;
+    return ChunkedContentHashCache::hashFile(path.c_str(), previous, bytesRead);
+  }
+};
+
+} // namespace
+
+TEST_F(ChunkedContentHashTest, hashes_in_chunks) {
+  uint64_t bytesRead;
+  write("");
+  auto empty = hash(nullptr, bytesRead);
+  EXPECT_EQ(0, empty.size);
+  EXPECT_TRUE(empty.chunks.empty());
+
+  write(pattern(2 * kChunk + 10, 'a'));
+  auto tree = hash(nullptr, bytesRead);
+  EXPECT_EQ(2 * kChunk + 10, tree.size);
+  EXPECT_EQ(3, tree.chunks.size());
+  EXPECT_EQ(tree.size, bytesRead);
+  EXPECT_NE(empty.rootHash(), tree.rootHash());
+
+  // The size is part of the hash, so it can't collide with a file that is
+  // its chunk digests
+  write(pattern(10, 'a'));
+  EXPECT_NE(tree.rootHash(), hash(nullptr, bytesRead).rootHash());
+}
+
+TEST_F(ChunkedContentHashTest, reuses_chunks_after_append) {
+  uint64_t bytesRead;
+  write(pattern(3 * kChunk + 100, 'x'));
+  auto before = hash(nullptr, bytesRead);
+
+  append(pattern(kChunk, 'y'));
+  auto after = hash(&before, bytesRead);
+  auto full = hash(nullptr, bytesRead);
+  EXPECT_EQ(full.rootHash(), after.rootHash());
+  EXPECT_EQ(full.chunks, after.chunks);
+
+  // The first and last reused chunks are checked, and the partial chunk and
+  // the appended data are read
+  hash(&before, bytesRead);
+  EXPECT_EQ(2 * kChunk + (kChunk + 100), bytesRead);
+}
+
+TEST_F(ChunkedContentHashTest, rehashes_when_not_appended) {
+  uint64_t bytesRead;
+  write(pattern(3 * kChunk, 'x'));
+  auto before = hash(nullptr, bytesRead);
+
+  // Shrunk
+  write(pattern(2 * kChunk, 'x'));
+  auto shrunk = hash(&before, bytesRead);
+  EXPECT_EQ(2 * kChunk, bytesRead);
+  EXPECT_EQ(hash(nullptr, bytesRead).rootHash(), shrunk.rootHash());
+
+  // Rewritten in place and grown; the first chunk differs
+  write(pattern(4 * kChunk, 'z'));
+  auto rewritten = hash(&before, bytesRead);
+  EXPECT_EQ(kChunk + 4 * kChunk, bytesRead);
+  EXPECT_EQ(hash(nullptr, bytesRead).rootHash(), rewritten.rootHash());
+
+  // A different inode
+  auto other = before;
+  other.ino += 1;
+  write(pattern(4 * kChunk, 'x'));
+  hash(&other, bytesRead);
+  EXPECT_EQ(4 * kChunk, bytesRead);
+}
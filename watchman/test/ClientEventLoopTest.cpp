@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ClientEventLoop.h"
+#include <folly/portability/GTest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "watchman/fs/Pipe.h"
+
+using namespace watchman;
+
+namespace {
+
+// Records what a connection's Step observed.
+struct Recorder {
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::string received;
+  size_t pings{0};
+  size_t steps{0};
+  bool closed{false};
+
+  template <typename Pred>
+  bool waitFor(Pred pred) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cond.wait_for(lock, std::chrono::seconds(10), [&] {
+      return pred(*this);
+    });
+  }
+};
+
+// Reads everything available from fd into rec, returning false at EOF.
+bool drain(const FileDescriptor& fd, Recorder& rec) {
+  char buf[64];
+  while (true) {
+    auto res = fd.read(buf, sizeof(buf));
+    if (res.hasError()) {
+      return true;
+    }
+    if (res.value() == 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(rec.mutex);
+    rec.received.append(buf, res.value());
+  }
+}
+
+void drainPing(const FileDescriptor& fd, Recorder& rec) {
+  char buf[64];
+  while (true) {
+    auto res = fd.read(buf, sizeof(buf));
+    if (res.hasError() || res.value() == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(rec.mutex);
+    rec.pings += res.value();
+  }
+}
+
+void addConnection(
+    ClientEventLoop& loop,
+    SocketPair& sock,
+    SocketPair& ping,
+    Recorder& rec) {
+  loop.add(
+      sock.read.system_handle(),
+      ping.read.system_handle(),
+      [&](bool readable, bool pinged) {
+        bool open = true;
+        if (readable) {
+          open = drain(sock.read, rec);
+        }
+        if (pinged) {
+          drainPing(ping.read, rec);
+        }
+        {
+          std::lock_guard<std::mutex> lock(rec.mutex);
+          ++rec.steps;
+        }
+        rec.cond.notify_all();
+        return open ? ClientEventLoop::StepResult::Idle
+                    : ClientEventLoop::StepResult::Disconnect;
+      },
+      [&] {
+        {
+          std::lock_guard<std::mutex> lock(rec.mutex);
+          rec.closed = true;
+        }
+        rec.cond.notify_all();
+      });
+}
+
+} // namespace
+
+TEST(ClientEventLoop, dispatches_input_and_pings) {
+  if (!ClientEventLoop::isSupported()) {
+    GTEST_SKIP() << "no poller on this platform";
+  }
+
+  SocketPair sock;
+  SocketPair ping;
+  Recorder rec;
+  // Declared last so that it stops before the state it refers to goes away
+  ClientEventLoop loop(1, 2);
+  addConnection(loop, sock, ping, rec);
+  EXPECT_EQ(1, loop.size());
+
+  ASSERT_TRUE(sock.write.write("hello", 5).hasValue());
+  EXPECT_TRUE(rec.waitFor([](Recorder& r) { return r.received == "hello"; }));
+
+  ASSERT_TRUE(ping.write.write("a", 1).hasValue());
+  EXPECT_TRUE(rec.waitFor([](Recorder& r) { return r.pings == 1; }));
+
+  // A second burst of input must be noticed even though the descriptor is
+  // edge triggered.
+  ASSERT_TRUE(sock.write.write(" world", 6).hasValue());
+  EXPECT_TRUE(
+      rec.waitFor([](Recorder& r) { return r.received == "hello world"; }));
+
+  sock.write.close();
+  EXPECT_TRUE(rec.waitFor([](Recorder& r) { return r.closed; }));
+  EXPECT_EQ(0, loop.size());
+}
+
+TEST(ClientEventLoop, multiplexes_connections) {
+  if (!ClientEventLoop::isSupported()) {
+    GTEST_SKIP() << "no poller on this platform";
+  }
+
+  constexpr size_t kNumConnections = 32;
+  std::vector<std::unique_ptr<SocketPair>> socks;
+  std::vector<std::unique_ptr<SocketPair>> pings;
+  std::vector<std::unique_ptr<Recorder>> recs;
+  ClientEventLoop loop(2, 4);
+  for (size_t i = 0; i < kNumConnections; ++i) {
+    socks.push_back(std::make_unique<SocketPair>());
+    pings.push_back(std::make_unique<SocketPair>());
+    recs.push_back(std::make_unique<Recorder>());
+    addConnection(loop, *socks.back(), *pings.back(), *recs.back());
+  }
+  EXPECT_EQ(kNumConnections, loop.size());
+
+  for (size_t i = 0; i < kNumConnections; ++i) {
+    auto msg = std::to_string(i);
+    ASSERT_TRUE(socks[i]->write.write(msg.data(), msg.size()).hasValue());
+  }
+  for (size_t i = 0; i < kNumConnections; ++i) {
+    auto msg = std::to_string(i);
+    EXPECT_TRUE(
+        recs[i]->waitFor([&](Recorder& r) { return r.received == msg; }))
+        << i;
+  }
+
+  // Stopping drops the remaining connections without closing them.
+  loop.stop();
+  for (auto& rec : recs) {
+    std::lock_guard<std::mutex> lock(rec->mutex);
+    EXPECT_FALSE(rec->closed);
+  }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <cstdint>
+
+#include "watchman/fs/FileInformation.h"
+
+using namespace watchman;
+
+namespace {
+
+FileInformation makeInfo() {
+  FileInformation info;
+#ifndef _WIN32
+  info.mode = S_IFREG | 0644;
+#else
+  info.mode = _S_IFREG | 0644;
+#endif
+  info.size = 12345;
+  info.uid = 1000;
+  info.gid = 100;
+  info.ino = 0x123456789;
+  info.dev = 42;
+  info.nlink = 2;
+  info.atime = timespec{111, 1};
+  info.mtime = timespec{222, 999999999};
+  info.ctime = timespec{333, 3};
+  return info;
+}
+
+} // namespace
+
+TEST(CompactFileInformationTest, is_smaller_than_file_information) {
+  EXPECT_LT(sizeof(CompactFileInformation), sizeof(FileInformation));
+}
+
+TEST(CompactFileInformationTest, keeps_everything_but_atime) {
+  auto info = makeInfo();
+  CompactFileInformation compact{info};
+
+  EXPECT_EQ(222, compact.mtime().tv_sec);
+  EXPECT_EQ(999999999, compact.mtime().tv_nsec);
+  EXPECT_EQ(333, compact.ctime().tv_sec);
+  EXPECT_EQ(3, compact.ctime().tv_nsec);
+
+  auto expanded = compact.expand();
+  EXPECT_EQ(info.mode, expanded.mode);
+  EXPECT_EQ(info.size, expanded.size);
+  EXPECT_EQ(info.uid, expanded.uid);
+  EXPECT_EQ(info.gid, expanded.gid);
+  EXPECT_EQ(info.ino, expanded.ino);
+  EXPECT_EQ(info.dev, expanded.dev);
+  EXPECT_EQ(info.nlink, expanded.nlink);
+  EXPECT_EQ(info.mtime.tv_sec, expanded.mtime.tv_sec);
+  EXPECT_EQ(info.mtime.tv_nsec, expanded.mtime.tv_nsec);
+  EXPECT_EQ(info.ctime.tv_sec, expanded.ctime.tv_sec);
+  EXPECT_EQ(info.ctime.tv_nsec, expanded.ctime.tv_nsec);
+  EXPECT_EQ(0, expanded.atime.tv_sec);
+  EXPECT_EQ(0, expanded.atime.tv_nsec);
+}
+
+TEST(CompactFileInformationTest, reports_the_same_type) {
+  auto info = makeInfo();
+  CompactFileInformation compact{info};
+  EXPECT_EQ(info.dtype(), compact.dtype());
+  EXPECT_TRUE(compact.isFile());
+  EXPECT_FALSE(compact.isDir());
+  EXPECT_FALSE(compact.isSymlink());
+
+#ifndef _WIN32
+  info.mode = S_IFDIR | 0755;
+  compact = info;
+  EXPECT_EQ(DType::Dir, compact.dtype());
+  EXPECT_TRUE(compact.isDir());
+
+  info.mode = S_IFLNK | 0777;
+  compact = info;
+  EXPECT_EQ(DType::Symlink, compact.dtype());
+  EXPECT_TRUE(compact.isSymlink());
+#endif
+}
+
+TEST(CompactFileInformationTest, link_count_saturates) {
+  auto info = makeInfo();
+  if (sizeof(info.nlink) <= sizeof(uint32_t)) {
+    GTEST_SKIP() << "nlink_t is no wider than the compact link count";
+  }
+  info.nlink = nlink_t(UINT32_MAX) + 1;
+  CompactFileInformation compact{info};
+  EXPECT_EQ(UINT32_MAX, compact.nlink);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHash.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <cstdio>
+#include <string>
+#include "watchman/ThreadPool.h"
+#include "watchman/fs/FileSystem.h"
+
+using namespace watchman;
+
+namespace {
+
+class ContentHashCacheTest : public testing::Test {
+ public:
+  folly::test::TemporaryDirectory dir;
+  const w_string rootPath{dir.path().string()};
+
+  ContentHashCacheTest() {
+    if (getThreadPool().numWorkers() == 0) {
+      getThreadPool().start(4, 1024);
+    }
+  }
+
+  std::string fullPath(const char* name) {
+    return (dir.path() / name).string();
+  }
+
+  void write(const char* name, const std::string& data) {
+    ASSERT_TRUE(folly::writeFile(data, fullPath(name).c_str()));
+  }
+
+  void rename(const char* from, const char* to) {
+    ASSERT_EQ(0, std::rename(fullPath(from).c_str(), fullPath(to).c_str()));
+  }
+
+  // As the view would make it from its stat of the file
+  ContentHashCacheKey keyFor(const char* name) {
+    auto stat = getFileInformation(fullPath(name).c_str());
+    return ContentHashCacheKey{
+        w_string(name),
+        size_t(stat.size),
+        stat.mtime,
+        uint64_t(stat.dev),
+        uint64_t(stat.ino)};
+  }
+
+  ContentHashCache::HashValue hash(
+      ContentHashCache& cache,
+      const ContentHashCacheKey& key) {
+    return cache.get(key).get()->value();
+  }
+};
+
+} // namespace
+
+TEST_F(ContentHashCacheTest, renamed_file_reuses_hash_by_inode) {
+  ContentHashCache cache{rootPath, 16, std::chrono::milliseconds(0)};
+  cache.reuseByInode(16);
+
+  write("old", "some contents");
+  auto before = hash(cache, keyFor("old"));
+  EXPECT_EQ(1, cache.stats().filesHashed);
+
+  rename("old", "new");
+  EXPECT_EQ(before, hash(cache, keyFor("new")));
+  auto stats = cache.stats();
+  EXPECT_EQ(1, stats.filesHashed);
+  EXPECT_EQ(1, stats.inodeHit);
+
+  // A file that merely has the same name is hashed
+  write("old", "other contents");
+  EXPECT_NE(before, hash(cache, keyFor("old")));
+  EXPECT_EQ(2, cache.stats().filesHashed);
+}
+
+TEST_F(ContentHashCacheTest, stale_inode_key_is_hashed) {
+  ContentHashCache cache{rootPath, 16, std::chrono::milliseconds(0)};
+  cache.reuseByInode(16);
+
+  write("file", "some contents");
+  auto key = keyFor("file");
+  hash(cache, key);
+
+  // The same inode under another path, but the key for that path is from
+  // before the file was modified, so the stat by path doesn't match it
+  rename("file", "moved");
+  auto stale = key;
+  stale.relativePath = w_string("moved");
+  write("moved", "different contents");
+  EXPECT_THROW(hash(cache, stale), std::runtime_error);
+  EXPECT_EQ(0, cache.stats().inodeHit);
+}
+
+TEST_F(ContentHashCacheTest, without_inode_reuse_renamed_file_is_hashed) {
+  ContentHashCache cache{rootPath, 16, std::chrono::milliseconds(0)};
+
+  write("old", "some contents");
+  auto before = hash(cache, keyFor("old"));
+  rename("old", "new");
+  EXPECT_EQ(before, hash(cache, keyFor("new")));
+  EXPECT_EQ(2, cache.stats().filesHashed);
+  EXPECT_EQ(0, cache.stats().inodeHit);
+}
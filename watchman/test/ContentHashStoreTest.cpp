@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+#include "watchman/ContentHash.h"
+
+using namespace watchman;
+
+namespace {
+
+ContentHashCacheKey makeKey(const char* path, size_t size, time_t mtime) {
+  ContentHashCacheKey key;
+  key.relativePath = w_string(path);
+  key.fileSize = size;
+  key.mtime.tv_sec = mtime;
+  key.mtime.tv_nsec = 0;
+  return key;
+}
+
+ContentHashStore::HashValue makeHash(uint8_t fill) {
+  ContentHashStore::HashValue hash;
+  hash.fill(fill);
+  return hash;
+}
+
+class ContentHashStoreTest : public testing::Test {
+ public:
+  folly::test::TemporaryDirectory dir;
+  const w_string path{(dir.path() / "store").string()};
+  const w_string rootPath{"/root"};
+};
+
+} // namespace
+
+TEST_F(ContentHashStoreTest, survives_reopening) {
+  {
+    ContentHashStore store(path, rootPath);
+    EXPECT_EQ(0, store.size());
+    store.add(makeKey("a", 1, 100), makeHash(1));
+    store.add(makeKey("b", 2, 100), makeHash(2));
+    // b changed; only the latest hash is kept
+    store.add(makeKey("b", 3, 200), makeHash(3));
+  }
+
+  ContentHashStore store(path, rootPath);
+  EXPECT_EQ(2, store.size());
+  EXPECT_EQ(makeHash(1), store.lookup(makeKey("a", 1, 100)));
+  EXPECT_EQ(makeHash(3), store.lookup(makeKey("b", 3, 200)));
+  EXPECT_EQ(std::nullopt, store.lookup(makeKey("b", 2, 100)));
+  // The key must match exactly
+  EXPECT_EQ(std::nullopt, store.lookup(makeKey("a", 1, 101)));
+  EXPECT_EQ(std::nullopt, store.lookup(makeKey("a", 2, 100)));
+  EXPECT_EQ(std::nullopt, store.lookup(makeKey("c", 1, 100)));
+}
+
+TEST_F(ContentHashStoreTest, ignores_partial_record) {
+  {
+    ContentHashStore store(path, rootPath);
+    store.add(makeKey("a", 1, 100), makeHash(1));
+    store.add(makeKey("b", 2, 100), makeHash(2));
+  }
+
+  std::string data;
+  ASSERT_TRUE(folly::readFile(path.c_str(), data));
+  data.resize(data.size() - 5);
+  ASSERT_TRUE(folly::writeFile(data, path.c_str()));
+
+  {
+    ContentHashStore store(path, rootPath);
+    EXPECT_EQ(makeHash(1), store.lookup(makeKey("a", 1, 100)));
+    EXPECT_EQ(std::nullopt, store.lookup(makeKey("b", 2, 100)));
+    // New records are readable after the truncated one was discarded
+    store.add(makeKey("c", 3, 100), makeHash(3));
+  }
+
+  ContentHashStore store(path, rootPath);
+  EXPECT_EQ(2, store.size());
+  EXPECT_EQ(makeHash(3), store.lookup(makeKey("c", 3, 100)));
+}
+
+TEST_F(ContentHashStoreTest, rejects_other_root) {
+  {
+    ContentHashStore store(path, w_string("/other"));
+    store.add(makeKey("a", 1, 100), makeHash(1));
+  }
+
+  ContentHashStore store(path, rootPath);
+  EXPECT_EQ(std::nullopt, store.lookup(makeKey("a", 1, 100)));
+  EXPECT_EQ(0, store.size());
+}
+
+TEST_F(ContentHashStoreTest, compacts_superseded_records) {
+  {
+    ContentHashStore store(path, rootPath);
+    for (time_t i = 0; i < 5000; ++i) {
+      store.add(makeKey("a", 1, i), makeHash(uint8_t(i)));
+    }
+  }
+
+  std::string before;
+  ASSERT_TRUE(folly::readFile(path.c_str(), before));
+  {
+    ContentHashStore store(path, rootPath);
+    EXPECT_EQ(1, store.size());
+    EXPECT_EQ(makeHash(uint8_t(4999)), store.lookup(makeKey("a", 1, 4999)));
+  }
+  std::string after;
+  ASSERT_TRUE(folly::readFile(path.c_str(), after));
+  EXPECT_LT(after.size() * 100, before.size());
+}
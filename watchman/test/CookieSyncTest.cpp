@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CookieSync.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+class CookieSyncTest : public testing::Test {
+ public:
+  folly::test::TemporaryDirectory dir;
+  CookieSync cookies{w_string(dir.path().string())};
+
+  // Waits until getCoalescedSyncCount reaches count
+  void waitForCoalescedSyncs(uint64_t count) {
+    while (cookies.getCoalescedSyncCount() < count) {
+      std::this_thread::sleep_for(1ms);
+    }
+  }
+};
+
+} // namespace
+
+TEST_F(CookieSyncTest, sync_completes_when_cookie_is_observed) {
+  std::vector<w_string> names;
+  auto future = cookies.sync(names);
+  ASSERT_EQ(1, names.size());
+  EXPECT_EQ(names, cookies.getOutstandingCookieFileList());
+  EXPECT_FALSE(future.isReady());
+
+  cookies.notifyCookie(names[0]);
+  EXPECT_TRUE(future.isReady());
+  EXPECT_TRUE(cookies.getOutstandingCookieFileList().empty());
+}
+
+TEST_F(CookieSyncTest, concurrent_syncs_share_the_next_cookie) {
+  cookies.setCoalesceSyncs(true, 1min);
+
+  std::vector<w_string> firstNames;
+  auto first = cookies.sync(firstNames);
+  ASSERT_EQ(1, firstNames.size());
+
+  constexpr size_t kNumSyncs = 4;
+  std::vector<std::vector<w_string>> names(kNumSyncs);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumSyncs; ++i) {
+    threads.emplace_back([&, i] { cookies.syncToNow(1min, names[i]); });
+  }
+  waitForCoalescedSyncs(kNumSyncs);
+
+  // None of them wrote a cookie of their own while the first was in flight
+  EXPECT_EQ(firstNames, cookies.getOutstandingCookieFileList());
+
+  // Observing it writes the one that they share
+  cookies.notifyCookie(firstNames[0]);
+  EXPECT_TRUE(first.isReady());
+  auto shared = cookies.getOutstandingCookieFileList();
+  ASSERT_EQ(1, shared.size());
+  EXPECT_NE(firstNames, shared);
+
+  cookies.notifyCookie(shared[0]);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& n : names) {
+    EXPECT_EQ(shared, n);
+  }
+}
+
+TEST_F(CookieSyncTest, shared_cookie_is_written_if_outstanding_one_is_lost) {
+  cookies.setCoalesceSyncs(true, 10ms);
+
+  std::vector<w_string> lostNames;
+  auto lost = cookies.sync(lostNames);
+
+  std::vector<w_string> names;
+  std::thread thread([&] { cookies.syncToNow(1min, names); });
+  waitForCoalescedSyncs(1);
+
+  // The shared cookie is written anyway once the wait has elapsed
+  std::vector<w_string> outstanding;
+  while ((outstanding = cookies.getOutstandingCookieFileList()).size() < 2) {
+    std::this_thread::sleep_for(1ms);
+  }
+  auto it = std::find(outstanding.begin(), outstanding.end(), lostNames[0]);
+  ASSERT_NE(outstanding.end(), it);
+  outstanding.erase(it);
+
+  cookies.notifyCookie(outstanding[0]);
+  thread.join();
+  EXPECT_EQ(outstanding, names);
+  EXPECT_FALSE(lost.isReady());
+}
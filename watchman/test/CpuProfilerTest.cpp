@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CpuProfiler.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <thread>
+#include "watchman/Logging.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+#ifndef _WIN32
+
+TEST(CpuProfilerTest, samples_busy_threads_by_name) {
+  std::atomic<bool> done{false};
+  std::thread busy([&] {
+    w_set_thread_name("busy-worker");
+    volatile uint64_t n = 0;
+    while (!done.load(std::memory_order_relaxed)) {
+      n = n + 1;
+    }
+  });
+
+  auto profile = profileCpu(500ms, 199);
+  done = true;
+  busy.join();
+
+  EXPECT_GT(profile.samples, 0);
+  EXPECT_EQ(0, profile.dropped);
+  size_t busySamples = 0;
+  for (auto& stack : profile.folded) {
+    if (stack.rfind("busy-worker;", 0) == 0) {
+      busySamples += std::stoul(stack.substr(stack.rfind(' ') + 1));
+    }
+  }
+  EXPECT_GT(busySamples, 0);
+}
+
+TEST(CpuProfilerTest, one_profile_at_a_time) {
+  std::thread first([] { profileCpu(300ms, 99); });
+  // Give the first profile time to start
+  std::this_thread::sleep_for(100ms);
+  EXPECT_THROW(profileCpu(10ms, 99), std::runtime_error);
+  first.join();
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlHeat.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+std::vector<w_string> paths(std::initializer_list<const char*> names) {
+  std::vector<w_string> result;
+  for (auto name : names) {
+    result.emplace_back(name);
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(CrawlHeatTest, hottest_first) {
+  CrawlHeat heat{16};
+  heat.touch("b");
+  heat.touch("a");
+  heat.touch("b");
+  heat.touch("c/d");
+  heat.touch("b");
+  heat.touch("c/d");
+  EXPECT_EQ(paths({"b", "c/d", "a"}), heat.hottest());
+}
+
+TEST(CrawlHeatTest, forgets_the_coldest) {
+  CrawlHeat heat{2};
+  heat.touch("a");
+  heat.touch("a");
+  heat.touch("b");
+  // The newest path stays even though it is the coldest
+  heat.touch("c");
+  EXPECT_EQ(2u, heat.hottest().size());
+  EXPECT_EQ(w_string{"c"}, heat.hottest().back());
+}
+
+TEST(CrawlHeatTest, heat_decays) {
+  CrawlHeat heat{2};
+  for (int i = 0; i < 15; ++i) {
+    heat.touch("old");
+  }
+  // The sixteenth touch halves the old path's heat to 7
+  for (int i = 0; i < 8; ++i) {
+    heat.touch("new");
+  }
+  EXPECT_EQ(paths({"new", "old"}), heat.hottest());
+}
+
+TEST(CrawlHeatTest, round_trips_through_json) {
+  CrawlHeat heat{16};
+  heat.touch("a");
+  heat.touch("b");
+  heat.touch("b");
+
+  CrawlHeat restored{16};
+  restored.load(heat.toJson());
+  EXPECT_EQ(paths({"b", "a"}), restored.hottest());
+
+  // Malformed entries are skipped
+  restored.load(json_array(
+      {json_array({w_string_to_json("c")}),
+       json_array({json_integer(1), json_integer(1)}),
+       json_array({w_string_to_json("d"), json_integer(0)}),
+       w_string_to_json("e")}));
+  EXPECT_EQ(paths({"b", "a"}), restored.hottest());
+}
+
+TEST(CrawlHeatTest, zero_capacity_disables) {
+  CrawlHeat heat{0};
+  heat.touch("a");
+  EXPECT_TRUE(heat.hottest().empty());
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlProfile.h"
+#include <folly/portability/GTest.h>
+#include "watchman/watchman_dir.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+std::vector<std::string> paths(const std::vector<CrawlProfileEntry>& list) {
+  std::vector<std::string> result;
+  for (auto& entry : list) {
+    result.push_back(entry.path.string());
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(CrawlProfileTest, sums_subtrees) {
+  watchman_dir root{w_string{"/root"}, nullptr};
+  watchman_dir a{w_string{"a"}, &root};
+  watchman_dir b{w_string{"b"}, &a};
+  watchman_dir c{w_string{"c"}, &root};
+
+  CrawlProfiler profiler;
+  profiler.record(&root, 1ms, 1ms, 2);
+  profiler.record(&a, 1ms, 2ms, 1);
+  profiler.record(&b, 10ms, 20ms, 1000);
+  profiler.record(&c, 5ms, 5ms, 5);
+  // A dir that is crawled again adds to its cost
+  profiler.record(&c, 5ms, 5ms, 5);
+
+  auto report = profiler.finish(w_string{"/root"}, 2);
+  EXPECT_EQ(4, report.numDirs);
+  EXPECT_EQ(1013, report.numEntries);
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"", "a"}), paths(report.slowestSubtrees));
+  auto& rootEntry = report.slowestSubtrees[0];
+  EXPECT_EQ(std::chrono::microseconds(55ms), rootEntry.subtreeTime);
+  EXPECT_EQ(1013, rootEntry.subtreeEntries);
+  EXPECT_EQ(4, rootEntry.subtreeDirs);
+  auto& aEntry = report.slowestSubtrees[1];
+  EXPECT_EQ(std::chrono::microseconds(33ms), aEntry.subtreeTime);
+  EXPECT_EQ(2, aEntry.subtreeDirs);
+
+  EXPECT_EQ((std::vector<std::string>{"a/b", "c"}), paths(report.slowestDirs));
+  EXPECT_EQ(std::chrono::microseconds(10ms), report.slowestDirs[1].readTime);
+  EXPECT_EQ(10, report.slowestDirs[1].entries);
+
+  EXPECT_EQ((std::vector<std::string>{"a/b", "c"}), paths(report.largestDirs));
+
+  auto json = report.toJson(1);
+  EXPECT_EQ(4, json.get("dirs").asInt());
+  EXPECT_EQ(1, json_array_size(json.get("largest_dirs")));
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CursorMap.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(CursorMapTest, exchanges_ticks) {
+  CursorMap cursors;
+  EXPECT_EQ(std::nullopt, cursors.exchange("a", 10));
+  EXPECT_EQ(10u, cursors.exchange("a", 20));
+  EXPECT_EQ(std::nullopt, cursors.exchange("b", 15));
+  EXPECT_EQ(20u, cursors.exchange("a", 30));
+
+  auto snapshot = cursors.snapshot();
+  std::sort(snapshot.begin(), snapshot.end());
+  ASSERT_EQ(2u, snapshot.size());
+  EXPECT_EQ(w_string("a"), snapshot[0].first);
+  EXPECT_EQ(30u, snapshot[0].second);
+  EXPECT_EQ(w_string("b"), snapshot[1].first);
+  EXPECT_EQ(15u, snapshot[1].second);
+}
+
+TEST(CursorMapTest, expires_aged_out_cursors) {
+  CursorMap cursors;
+  cursors.exchange("old", 5);
+  cursors.exchange("new", 50);
+  cursors.expire(10);
+  EXPECT_EQ(1u, cursors.size());
+  EXPECT_EQ(std::nullopt, cursors.exchange("old", 60));
+  EXPECT_EQ(50u, cursors.exchange("new", 60));
+}
+
+TEST(CursorMapTest, expires_unused_cursors) {
+  auto start = std::chrono::steady_clock::now();
+  CursorMap cursors{60s};
+  cursors.exchange("idle", 1, start);
+  cursors.exchange("busy", 1, start);
+  cursors.exchange("busy", 2, start + 50s);
+
+  cursors.expire(0, start + 70s);
+  EXPECT_EQ(1u, cursors.size());
+  EXPECT_EQ(std::nullopt, cursors.exchange("idle", 3, start + 70s));
+  EXPECT_EQ(2u, cursors.exchange("busy", 3, start + 70s));
+
+  // Without a ttl, only aging out forgets cursors
+  CursorMap forever;
+  forever.exchange("idle", 1, start);
+  forever.expire(0, start + 1000h);
+  EXPECT_EQ(1u, forever.exchange("idle", 2, start + 1000h));
+}
+
+TEST(CursorMapTest, use_sweeps_unused_cursors) {
+  auto start = std::chrono::steady_clock::now();
+  CursorMap cursors{60s};
+  for (int i = 0; i < 100; ++i) {
+    cursors.exchange(w_string::build("job-", i), 1, start);
+  }
+  // Using cursors after the ttl forgets the idle ones in their shards
+  for (int i = 0; i < 100; ++i) {
+    cursors.exchange(w_string::build("next-", i), 2, start + 61s);
+  }
+  EXPECT_LE(cursors.size(), 150u);
+  EXPECT_GE(cursors.size(), 100u);
+}
+
+TEST(CursorMapTest, concurrent_cursors) {
+  CursorMap cursors;
+  constexpr int kThreads = 8;
+  constexpr uint32_t kUses = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&cursors, t] {
+      auto name = w_string::build("cursor-", t);
+      for (uint32_t i = 1; i <= kUses; ++i) {
+        auto previous = cursors.exchange(name, i);
+        EXPECT_EQ(
+            i == 1 ? std::nullopt : std::optional<uint32_t>(i - 1), previous);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(size_t(kThreads), cursors.size());
+}
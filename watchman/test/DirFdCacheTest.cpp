@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/DirFdCache.h"
+#include <fcntl.h>
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <sys/stat.h>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+// Stats with the plain syscalls, counting the dirs that it opens
+class CountingFileSystem : public FileSystem {
+ public:
+  explicit CountingFileSystem(bool supportsAt = true)
+      : supportsAt_{supportsAt} {}
+
+  std::unique_ptr<DirHandle> openDir(const char*, bool) override {
+    throw std::system_error(ENOSYS, std::generic_category(), "openDir");
+  }
+
+  FileInformation getFileInformation(
+      const char* path,
+      CaseSensitivity,
+      const StatOptions&) override {
+    ++pathStats;
+    struct stat st;
+    if (lstat(path, &st)) {
+      throw std::system_error(errno, std::generic_category(), "lstat");
+    }
+    return FileInformation(st);
+  }
+
+  FileDescriptor openDirForStat(const char* path) override {
+    if (!supportsAt_) {
+      return FileSystem::openDirForStat(path);
+    }
+    ++dirOpens;
+    return FileDescriptor(
+        open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+        "open",
+        FileDescriptor::FDType::Generic);
+  }
+
+  FileInformation getFileInformationAt(
+      const FileDescriptor& dir,
+      const char* name,
+      const StatOptions&) override {
+    struct stat st;
+    if (fstatat(dir.fd(), name, &st, AT_SYMLINK_NOFOLLOW)) {
+      throw std::system_error(errno, std::generic_category(), "fstatat");
+    }
+    return FileInformation(st);
+  }
+
+  size_t dirOpens{0};
+  size_t pathStats{0};
+
+ private:
+  bool supportsAt_;
+};
+
+w_string makeFile(
+    const folly::test::TemporaryDirectory& dir,
+    const char* name) {
+  auto path = (dir.path() / name).string();
+  EXPECT_TRUE(folly::writeFile(std::string(name), path.c_str()));
+  return w_string(path.c_str());
+}
+
+} // namespace
+
+TEST(DirFdCacheTest, stats_relative_to_the_parent_dir) {
+  folly::test::TemporaryDirectory dir;
+  auto a = makeFile(dir, "a");
+  auto bb = makeFile(dir, "bb");
+  auto link = (dir.path() / "link").string();
+  ASSERT_EQ(0, symlink("nowhere", link.c_str()));
+
+  CountingFileSystem fs;
+  DirFdCache cache{fs, 4};
+  EXPECT_EQ(1, cache.getFileInformation(a).size);
+  EXPECT_EQ(2, cache.getFileInformation(bb).size);
+  EXPECT_TRUE(cache.getFileInformation(w_string(link.c_str())).isSymlink());
+  EXPECT_EQ(1u, fs.dirOpens);
+  EXPECT_EQ(0u, fs.pathStats);
+
+  try {
+    cache.getFileInformation(w_string((dir.path() / "missing").c_str()));
+    FAIL() << "stat of a missing file succeeded";
+  } catch (const std::system_error& exc) {
+    EXPECT_EQ(std::errc::no_such_file_or_directory, exc.code());
+  }
+}
+
+TEST(DirFdCacheTest, evicts_the_least_recently_used_dir) {
+  folly::test::TemporaryDirectory one;
+  folly::test::TemporaryDirectory two;
+  folly::test::TemporaryDirectory three;
+  auto inOne = makeFile(one, "a");
+  auto inTwo = makeFile(two, "a");
+  auto inThree = makeFile(three, "a");
+
+  CountingFileSystem fs;
+  DirFdCache cache{fs, 2};
+  cache.getFileInformation(inOne);
+  cache.getFileInformation(inTwo);
+  cache.getFileInformation(inOne);
+  // Evicts two
+  cache.getFileInformation(inThree);
+  EXPECT_EQ(3u, fs.dirOpens);
+  cache.getFileInformation(inOne);
+  EXPECT_EQ(3u, fs.dirOpens);
+  cache.getFileInformation(inTwo);
+  EXPECT_EQ(4u, fs.dirOpens);
+  EXPECT_EQ(2u, cache.size());
+
+  cache.clear();
+  EXPECT_EQ(0u, cache.size());
+  cache.getFileInformation(inOne);
+  EXPECT_EQ(5u, fs.dirOpens);
+}
+
+TEST(DirFdCacheTest, falls_back_to_full_paths) {
+  folly::test::TemporaryDirectory dir;
+  auto a = makeFile(dir, "a");
+
+  CountingFileSystem fs{false};
+  DirFdCache cache{fs, 4};
+  EXPECT_EQ(1, cache.getFileInformation(a).size);
+  EXPECT_EQ(1, cache.getFileInformation(a).size);
+  EXPECT_EQ(2u, fs.pathStats);
+  EXPECT_EQ(0u, cache.size());
+}
@@ -57,3 +57,12 @@ TEST(FSType, fstype) {
       find_fstype_in_linux_proc_mounts(
           "/mnt/xarfuse/uid-5537/326c1234-ns-4026531840/", mount_data));
 }
+
+TEST(FSType, dir_mtime_reliability) {
+  EXPECT_TRUE(is_dir_mtime_reliable_fs_type("ext4"));
+  EXPECT_TRUE(is_dir_mtime_reliable_fs_type("apfs"));
+  EXPECT_FALSE(is_dir_mtime_reliable_fs_type("nfs"));
+  EXPECT_FALSE(is_dir_mtime_reliable_fs_type("fuse.squashfuse_ll"));
+  EXPECT_FALSE(is_dir_mtime_reliable_fs_type("edenfs"));
+  EXPECT_FALSE(is_dir_mtime_reliable_fs_type("unknown"));
+}
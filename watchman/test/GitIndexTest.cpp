@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitIndex.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <map>
+#include "watchman/scm/SCM.h"
+
+using namespace watchman;
+
+namespace {
+
+GitObjectId makeId(uint8_t fill) {
+  GitObjectId id;
+  id.fill(fill);
+  return id;
+}
+
+void appendBE16(std::string& buf, uint16_t value) {
+  buf.push_back(char(value >> 8));
+  buf.push_back(char(value & 0xff));
+}
+
+void appendBE32(std::string& buf, uint32_t value) {
+  appendBE16(buf, uint16_t(value >> 16));
+  appendBE16(buf, uint16_t(value & 0xffff));
+}
+
+struct Entry {
+  std::string path;
+  uint8_t id;
+  uint32_t mode{0100644};
+  uint16_t stage{0};
+};
+
+std::string makeIndex(
+    uint32_t version,
+    const std::vector<Entry>& entries,
+    const std::string& extensions = "") {
+  std::string buf{"DIRC"};
+  appendBE32(buf, version);
+  appendBE32(buf, uint32_t(entries.size()));
+  std::string previous;
+  for (auto& entry : entries) {
+    auto start = buf.size();
+    buf.append(8, '\0'); // ctime
+    appendBE32(buf, 1600000000); // mtime
+    appendBE32(buf, 0);
+    buf.append(8, '\0'); // dev, ino
+    appendBE32(buf, entry.mode);
+    buf.append(8, '\0'); // uid, gid
+    appendBE32(buf, 42); // size
+    auto id = makeId(entry.id);
+    buf.append(reinterpret_cast<const char*>(id.data()), id.size());
+    appendBE16(buf, uint16_t((entry.stage << 12) | entry.path.size()));
+    if (version == 4) {
+      size_t common = 0;
+      while (common < previous.size() && common < entry.path.size() &&
+             previous[common] == entry.path[common]) {
+        ++common;
+      }
+      buf.push_back(char(previous.size() - common));
+      buf.append(entry.path.substr(common));
+      buf.push_back('\0');
+    } else {
+      buf.append(entry.path);
+      do {
+        buf.push_back('\0');
+      } while ((buf.size() - start) % 8 != 0);
+    }
+    previous = entry.path;
+  }
+  buf.append(extensions);
+  buf.append(20, '\0'); // checksum
+  return buf;
+}
+
+std::string makeExtension(const std::string& signature, std::string body) {
+  std::string buf{signature};
+  appendBE32(buf, uint32_t(body.size()));
+  return buf + body;
+}
+
+std::string cacheTreeEntry(
+    const std::string& name,
+    int entryCount,
+    int subtrees,
+    uint8_t id) {
+  std::string buf{name};
+  buf.push_back('\0');
+  buf += std::to_string(entryCount) + " " + std::to_string(subtrees) + "\n";
+  if (entryCount >= 0) {
+    buf.append(20, char(id));
+  }
+  return buf;
+}
+
+// Trees, named by the byte that their ids are filled with
+struct FakeTrees {
+  std::map<uint8_t, std::vector<GitTreeEntry>> trees;
+  int reads{0};
+
+  void add(uint8_t id, std::vector<GitTreeEntry> entries) {
+    trees[id] = std::move(entries);
+  }
+
+  GitIndex::ReadTree reader() {
+    return [this](const GitObjectId& id) {
+      ++reads;
+      return trees.at(id[0]);
+    };
+  }
+};
+
+GitTreeEntry file(const std::string& name, uint8_t id) {
+  return GitTreeEntry{name, 0100644, makeId(id)};
+}
+
+GitTreeEntry dir(const std::string& name, uint8_t id) {
+  return GitTreeEntry{name, 040000, makeId(id)};
+}
+
+} // namespace
+
+TEST(GitIndexTest, parses_entries_and_the_cache_tree) {
+  auto tree =
+      cacheTreeEntry("", 2, 1, 0x10) + cacheTreeEntry("dir", 1, 0, 0x11);
+  auto data = makeIndex(
+      2,
+      {{"a.txt", 1}, {"dir/b", 2, 0100755}},
+      makeExtension("TREE", tree));
+  auto index = GitIndex::parse(data);
+  ASSERT_TRUE(index.has_value());
+  ASSERT_EQ(2, index->entries().size());
+  EXPECT_EQ("a.txt", index->entries()[0].path);
+  EXPECT_EQ(makeId(1), index->entries()[0].id);
+  EXPECT_EQ("dir/b", index->entries()[1].path);
+  EXPECT_EQ(0100755u, index->entries()[1].mode);
+  EXPECT_EQ(1600000000u, index->entries()[1].mtimeSec);
+  EXPECT_EQ(42u, index->entries()[1].size);
+
+  ASSERT_NE(nullptr, index->cachedTree(""));
+  EXPECT_EQ(makeId(0x10), *index->cachedTree(""));
+  ASSERT_NE(nullptr, index->cachedTree("dir/"));
+  EXPECT_EQ(makeId(0x11), *index->cachedTree("dir/"));
+}
+
+TEST(GitIndexTest, parses_compressed_paths) {
+  auto index =
+      GitIndex::parse(makeIndex(4, {{"dir/a", 1}, {"dir/b", 2}, {"e", 3}}));
+  ASSERT_TRUE(index.has_value());
+  ASSERT_EQ(3, index->entries().size());
+  EXPECT_EQ("dir/a", index->entries()[0].path);
+  EXPECT_EQ("dir/b", index->entries()[1].path);
+  EXPECT_EQ("e", index->entries()[2].path);
+}
+
+TEST(GitIndexTest, rejects_what_it_cannot_interpret) {
+  EXPECT_FALSE(GitIndex::parse(makeIndex(5, {})).has_value());
+  auto split = makeExtension("link", std::string(20, '\0'));
+  EXPECT_FALSE(GitIndex::parse(makeIndex(2, {}, split)).has_value());
+  // Optional extensions are skipped
+  EXPECT_TRUE(GitIndex::parse(makeIndex(2, {}, makeExtension("UNTR", "x")))
+                  .has_value());
+  EXPECT_THROW(GitIndex::parse("DIRC"), SCMError);
+}
+
+TEST(GitIndexTest, diff_reports_added_removed_and_modified_paths) {
+  FakeTrees trees;
+  trees.add(0x10, {file("a.txt", 1), dir("dir", 0x11), file("gone.txt", 3)});
+  trees.add(0x11, {file("x", 4), file("y", 5)});
+  trees.add(0x12, {file("inner", 7)});
+  trees.add(0x20, {dir("was_dir", 0x12)});
+
+  auto index = GitIndex::parse(makeIndex(
+      2,
+      {{"a.txt", 1},
+       {"dir/x", 9},
+       {"dir/y", 5, 0100755},
+       {"new.txt", 6},
+       {"unmerged", 8, 0100644, 1},
+       {"unmerged", 8, 0100644, 2}}));
+  ASSERT_TRUE(index.has_value());
+
+  auto changed = index->diffAgainstTree(makeId(0x10), trees.reader());
+  std::sort(changed.begin(), changed.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "dir/x", "dir/y", "gone.txt", "new.txt", "unmerged"}),
+      changed);
+
+  // A directory that became a file
+  index = GitIndex::parse(makeIndex(2, {{"was_dir", 1}}));
+  changed = index->diffAgainstTree(makeId(0x20), trees.reader());
+  std::sort(changed.begin(), changed.end());
+  EXPECT_EQ((std::vector<std::string>{"was_dir", "was_dir/inner"}), changed);
+}
+
+TEST(GitIndexTest, diff_skips_directories_that_the_cache_tree_vouches_for) {
+  FakeTrees trees;
+  trees.add(0x10, {file("a.txt", 1), dir("dir", 0x11)});
+  trees.add(0x11, {file("x", 4)});
+
+  auto cacheTree = cacheTreeEntry("", -1, 1, 0) +
+      cacheTreeEntry("dir", 1, 0, 0x11);
+  auto index = GitIndex::parse(makeIndex(
+      2, {{"a.txt", 2}, {"dir/x", 4}}, makeExtension("TREE", cacheTree)));
+  ASSERT_TRUE(index.has_value());
+
+  auto changed = index->diffAgainstTree(makeId(0x10), trees.reader());
+  EXPECT_EQ((std::vector<std::string>{"a.txt"}), changed);
+  // Only the root was read
+  EXPECT_EQ(1, trees.reads);
+}
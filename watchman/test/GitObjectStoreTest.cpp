@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitObjectStore.h"
+#include <folly/portability/GTest.h>
+#include "watchman/scm/SCM.h"
+
+using namespace watchman;
+
+namespace {
+
+GitObjectId makeId(uint8_t fill) {
+  GitObjectId id;
+  id.fill(fill);
+  return id;
+}
+
+std::string rawId(uint8_t fill) {
+  return std::string(20, char(fill));
+}
+
+} // namespace
+
+TEST(GitObjectStoreTest, object_ids_round_trip_through_hex) {
+  auto hex = std::string{"0123456789abcdef0123456789ABCDEF01234567"};
+  auto id = parseGitObjectId(hex);
+  ASSERT_TRUE(id.has_value());
+  EXPECT_EQ(0x01, (*id)[0]);
+  EXPECT_EQ(0xef, (*id)[7]);
+  EXPECT_EQ("0123456789abcdef0123456789abcdef01234567", gitObjectIdToHex(*id));
+
+  EXPECT_FALSE(parseGitObjectId("0123").has_value());
+  EXPECT_FALSE(
+      parseGitObjectId("g123456789abcdef0123456789abcdef01234567").has_value());
+}
+
+TEST(GitObjectStoreTest, parses_trees) {
+  std::string data;
+  data += "100644 a.txt";
+  data += '\0';
+  data += rawId(1);
+  data += "40000 dir";
+  data += '\0';
+  data += rawId(2);
+
+  auto entries = parseGitTree(data);
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ("a.txt", entries[0].name);
+  EXPECT_EQ(0100644u, entries[0].mode);
+  EXPECT_EQ(makeId(1), entries[0].id);
+  EXPECT_FALSE(entries[0].isDir());
+  EXPECT_EQ("dir", entries[1].name);
+  EXPECT_TRUE(entries[1].isDir());
+
+  EXPECT_THROW(parseGitTree("100644 truncated"), SCMError);
+}
+
+TEST(GitObjectStoreTest, parses_commits) {
+  auto commit = parseGitCommit(
+      "tree 0101010101010101010101010101010101010101\n"
+      "parent 0202020202020202020202020202020202020202\n"
+      "parent 0303030303030303030303030303030303030303\n"
+      "author A U Thor <a@example.com> 1500000000 +0100\n"
+      "committer C O Mitter <c@example.com> 1600000000 -0700\n"
+      "\n"
+      "tree ffffffffffffffffffffffffffffffffffffffff is in the message\n");
+  EXPECT_EQ(makeId(1), commit.tree);
+  ASSERT_EQ(2, commit.parents.size());
+  EXPECT_EQ(makeId(2), commit.parents[0]);
+  EXPECT_EQ(makeId(3), commit.parents[1]);
+  EXPECT_EQ(1600000000, commit.commitTime);
+
+  EXPECT_THROW(parseGitCommit("author nobody\n"), SCMError);
+}
+
+TEST(GitObjectStoreTest, applies_deltas) {
+  std::string base{"hello, world"};
+  std::string delta;
+  delta += char(base.size());
+  delta += char(18); // The size of the result
+  // Copy "hello" from offset 0
+  delta += char(0x80 | 0x10);
+  delta += char(5);
+  // Insert " there"
+  delta += char(6);
+  delta += " there";
+  // Copy ", world" from offset 5
+  delta += char(0x80 | 0x01 | 0x10);
+  delta += char(5);
+  delta += char(7);
+  EXPECT_EQ("hello there, world", applyGitDelta(base, delta));
+
+  // The base must be the size that the delta expects
+  EXPECT_THROW(applyGitDelta("hello", delta), SCMError);
+
+  // And so must the result
+  delta[1] = char(17);
+  EXPECT_THROW(applyGitDelta(base, delta), SCMError);
+}
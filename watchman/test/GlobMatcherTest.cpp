@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobMatcher.h"
+#include <folly/Conv.h>
+#include <folly/logging/xlog.h>
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "watchman/query/GlobTree.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/watchman_time.h"
+
+using namespace watchman;
+
+namespace {
+
+const int kFlagSets[] = {
+    0,
+    WM_PERIOD,
+    WM_PATHNAME,
+    WM_PATHNAME | WM_PERIOD,
+    WM_CASEFOLD | WM_PATHNAME | WM_PERIOD,
+};
+
+// Returns every string of up to maxLen characters drawn from alphabet.
+std::vector<std::string> allStrings(
+    const std::string& alphabet,
+    size_t maxLen) {
+  std::vector<std::string> result{""};
+  size_t begin = 0;
+  for (size_t len = 1; len <= maxLen; ++len) {
+    size_t end = result.size();
+    for (size_t i = begin; i < end; ++i) {
+      for (char c : alphabet) {
+        result.push_back(result[i] + c);
+      }
+    }
+    begin = end;
+  }
+  return result;
+}
+
+std::vector<uint32_t> wildmatchAll(
+    const std::vector<std::string>& patterns,
+    const char* text,
+    int flags) {
+  std::vector<uint32_t> result;
+  for (uint32_t i = 0; i < patterns.size(); ++i) {
+    if (wildmatch(patterns[i].c_str(), text, flags, nullptr) == WM_MATCH) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+std::vector<std::string_view> views(const std::vector<std::string>& strings) {
+  return std::vector<std::string_view>(strings.begin(), strings.end());
+}
+
+} // namespace
+
+TEST(GlobMatcher, agrees_with_wildmatch) {
+  auto patterns = allStrings("a*?/.[]!", 3);
+  // A few longer patterns that exercise the WM_PERIOD and `**` handling
+  for (const char* pattern :
+       {"**/*",
+        "**/.*",
+        "*/.a",
+        "a/**/a",
+        "**/a/**",
+        "a*/.",
+        "*.a",
+        "[!a]*",
+        "[a-b]?",
+        "a/**",
+        "**/",
+        "a**",
+        "a/*/a",
+        "\\*a",
+        "[[:alpha:]]",
+        "a//a"}) {
+    patterns.emplace_back(pattern);
+  }
+  auto texts = allStrings("aA/.", 5);
+
+  for (int flags : kFlagSets) {
+    for (auto& pattern : patterns) {
+      GlobMatcher matcher({pattern}, flags);
+      for (auto& text : texts) {
+        bool expected =
+            wildmatch(pattern.c_str(), text.c_str(), flags, nullptr) ==
+            WM_MATCH;
+        ASSERT_EQ(expected, !matcher.match(text.c_str()).empty())
+            << "pattern [" << pattern << "] text [" << text << "] flags "
+            << flags;
+      }
+    }
+  }
+}
+
+TEST(GlobMatcher, matches_every_pattern_at_once) {
+  std::vector<std::string> patterns{
+      "*.h", "*.cpp", "foo*", "**/*.h", "[a-f]*", "*", ".*", "\\f*", "f?o.h"};
+  auto texts = allStrings("fo./h", 5);
+
+  for (int flags : kFlagSets) {
+    GlobMatcher matcher(views(patterns), flags);
+    for (auto& text : texts) {
+      EXPECT_EQ(
+          wildmatchAll(patterns, text.c_str(), flags),
+          matcher.match(text.c_str()))
+          << "text [" << text << "] flags " << flags;
+    }
+  }
+}
+
+TEST(GlobMatcher, consumes_text_a_piece_at_a_time) {
+  std::vector<std::string> patterns{"**/*.h", "foo/**/bar", "**/.git"};
+  GlobMatcher matcher(views(patterns), WM_PATHNAME | WM_PERIOD);
+  EXPECT_FALSE(matcher.hasFallbackPatterns());
+
+  auto foo = matcher.advance(matcher.start(), "foo/");
+  std::vector<uint32_t> result;
+  matcher.matches(matcher.advance(foo, "bar"), nullptr, result);
+  EXPECT_EQ(std::vector<uint32_t>{1}, result);
+
+  result.clear();
+  auto baz = matcher.advance(foo, "baz/");
+  matcher.matches(matcher.advance(baz, "a.h"), nullptr, result);
+  EXPECT_EQ(std::vector<uint32_t>{0}, result);
+
+  result.clear();
+  matcher.matches(matcher.advance(baz, ".git"), nullptr, result);
+  EXPECT_EQ(std::vector<uint32_t>{2}, result);
+
+  // wildmatch lets the `**/` in "**/.git" match dot dirs, but "*" can't
+  EXPECT_FALSE(matcher.isDead(matcher.advance(baz, ".hg/")));
+  GlobMatcher headers({"**/*.h", "foo/*.h"}, WM_PATHNAME | WM_PERIOD);
+  EXPECT_TRUE(headers.isDead(headers.advance(headers.start(), ".hg/")));
+  EXPECT_FALSE(headers.isDead(headers.advance(headers.start(), "hg/")));
+  EXPECT_TRUE(headers.isDead(headers.advance(headers.start(), "foo/.h")));
+}
+
+TEST(GlobMatcher, falls_back_to_wildmatch) {
+  std::vector<std::string> patterns{"*.\\h", "[[:digit:]]*", "*.c"};
+  GlobMatcher matcher(views(patterns), WM_PATHNAME);
+  EXPECT_TRUE(matcher.hasFallbackPatterns());
+
+  auto state = matcher.advance(matcher.start(), "dir/1.c");
+  EXPECT_FALSE(matcher.isDead(state));
+  EXPECT_TRUE(matcher.match("a.h") == std::vector<uint32_t>{0});
+  EXPECT_TRUE(matcher.match("1.c") == (std::vector<uint32_t>{1, 2}));
+  EXPECT_TRUE(matcher.match("dir/1.c").empty());
+}
+
+TEST(GlobMatcher, classifies_patterns) {
+  auto kind = [](const char* pattern) {
+    return GlobTree(pattern, strlen(pattern)).kind;
+  };
+  EXPECT_EQ(GlobTree::Kind::Literal, kind("foo.h"));
+  EXPECT_EQ(GlobTree::Kind::Literal, kind("**/BUCK"));
+  EXPECT_EQ(GlobTree::Kind::Suffix, kind("*.h"));
+  EXPECT_EQ(GlobTree::Kind::Suffix, kind("**/*.h"));
+  EXPECT_EQ(GlobTree::Kind::Prefix, kind("foo*"));
+  EXPECT_EQ(GlobTree::Kind::Pattern, kind("*.\\h"));
+  EXPECT_EQ(GlobTree::Kind::Pattern, kind("f*.h"));
+  EXPECT_EQ(GlobTree::Kind::Pattern, kind("**"));
+  EXPECT_EQ(GlobTree::Kind::Pattern, kind("**/"));
+  EXPECT_EQ(GlobTree::Kind::Pattern, kind("**/a/*.h"));
+  EXPECT_EQ("h", GlobTree("*h", 2).literal);
+}
+
+TEST(GlobMatcher, compared_names_agree_with_wildmatch) {
+  auto patterns = allStrings("a.*", 3);
+  auto texts = allStrings("aA.", 4);
+
+  for (int flags : kFlagSets) {
+    for (auto& pattern : patterns) {
+      GlobTree node(pattern.data(), pattern.size());
+      for (auto& text : texts) {
+        bool expected =
+            wildmatch(pattern.c_str(), text.c_str(), flags, nullptr) ==
+            WM_MATCH;
+        ASSERT_EQ(expected, node.matchesName(text, flags))
+            << "pattern [" << pattern << "] text [" << text << "] flags "
+            << flags;
+      }
+    }
+  }
+}
+
+TEST(GlobMatcher, bench_versus_wildmatch) {
+  std::vector<std::string> patterns;
+  for (const char* ext : {"h", "cpp", "c", "py", "rs", "js", "java", "go"}) {
+    patterns.push_back(folly::to<std::string>("*.", ext));
+    patterns.push_back(folly::to<std::string>("**/test_*.", ext));
+  }
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 10000; ++i) {
+    names.push_back(folly::to<std::string>(
+        "some_file_name_", i, i % 3 ? ".cpp" : ".txt"));
+  }
+  const int flags = WM_PATHNAME | WM_PERIOD;
+  struct timeval start, end;
+  size_t expected = 0;
+  size_t found = 0;
+
+  gettimeofday(&start, nullptr);
+  for (size_t n = 0; n < 10; ++n) {
+    for (auto& name : names) {
+      for (auto& pattern : patterns) {
+        if (wildmatch(pattern.c_str(), name.c_str(), flags, nullptr) ==
+            WM_MATCH) {
+          ++expected;
+        }
+      }
+    }
+  }
+  gettimeofday(&end, nullptr);
+  XLOG(ERR) << "wildmatch: took " << w_timeval_diff(start, end);
+
+  GlobMatcher matcher(views(patterns), flags);
+  std::vector<uint32_t> result;
+  gettimeofday(&start, nullptr);
+  for (size_t n = 0; n < 10; ++n) {
+    for (auto& name : names) {
+      result.clear();
+      matcher.matches(
+          matcher.advance(matcher.start(), name), name.c_str(), result);
+      found += result.size();
+    }
+  }
+  gettimeofday(&end, nullptr);
+  XLOG(ERR) << "GlobMatcher: took " << w_timeval_diff(start, end);
+
+  EXPECT_EQ(expected, found);
+}
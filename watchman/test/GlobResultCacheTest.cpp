@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/GlobResultCache.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+using Results = GlobResultCache::Results;
+using Paths = std::vector<std::string>;
+
+Results makeResults(std::map<std::string, DType> matches) {
+  Results results;
+  results.generation = 1;
+  results.sequence = 10;
+  results.matches = std::move(matches);
+  return results;
+}
+
+const Paths kCppPatterns{"src/**/*.cpp"};
+
+} // namespace
+
+TEST(GlobResultCacheTest, evicts_least_recently_used) {
+  GlobResultCache cache{2};
+  auto a = GlobResultCache::makeKey("c1", {"*.cpp"}, false);
+  auto b = GlobResultCache::makeKey("c1", {"*.h"}, false);
+  auto c = GlobResultCache::makeKey("c2", {"*.cpp"}, false);
+  EXPECT_NE(a, GlobResultCache::makeKey("c1", {"*.cpp"}, true));
+
+  cache.insert(a, std::make_shared<Results>());
+  cache.insert(b, std::make_shared<Results>());
+  EXPECT_NE(nullptr, cache.get(a));
+  cache.insert(c, std::make_shared<Results>());
+
+  EXPECT_EQ(2, cache.size());
+  EXPECT_NE(nullptr, cache.get(a));
+  EXPECT_EQ(nullptr, cache.get(b));
+  EXPECT_NE(nullptr, cache.get(c));
+}
+
+TEST(GlobResultCacheTest, only_paths_that_can_affect_matches_are_relevant) {
+  auto results = makeResults({{"src/a.cpp", DType::Regular}});
+  auto relevant = GlobResultCache::relevantPaths(
+      results,
+      kCppPatterns,
+      false,
+      {"src/a.cpp", "src/b.cpp", "src/c.h", "docs/x.cpp", "src", "README"});
+  // src/c.h may be a directory that holds matches
+  EXPECT_EQ((Paths{"src/a.cpp", "src/b.cpp", "src/c.h", "src"}), relevant);
+}
+
+TEST(GlobResultCacheTest, patch_applies_creations_and_removals) {
+  auto results = makeResults(
+      {{"src/a.cpp", DType::Regular}, {"src/old.cpp", DType::Regular}});
+  auto patched = GlobResultCache::patch(
+      results,
+      kCppPatterns,
+      false,
+      {"src/new.cpp", "src/old.cpp", "src/a.cpp"},
+      {DType::Regular, std::nullopt, DType::Symlink});
+  ASSERT_TRUE(patched.has_value());
+  std::map<std::string, DType> expected{
+      {"src/a.cpp", DType::Symlink}, {"src/new.cpp", DType::Regular}};
+  EXPECT_EQ(expected, patched->matches);
+}
+
+TEST(GlobResultCacheTest, patch_gives_up_on_renamed_directories) {
+  auto results = makeResults({{"src/sub/a.cpp", DType::Regular}});
+
+  // A directory that appeared may have brought matches with it
+  EXPECT_FALSE(GlobResultCache::patch(
+                   results, kCppPatterns, false, {"src/new"}, {DType::Dir})
+                   .has_value());
+
+  // And one that disappeared without its matches being removed took them
+  EXPECT_FALSE(GlobResultCache::patch(
+                   results, kCppPatterns, false, {"src/sub"}, {std::nullopt})
+                   .has_value());
+
+  // Whereas one that was emptied first is fine
+  auto patched = GlobResultCache::patch(
+      results,
+      kCppPatterns,
+      false,
+      {"src/sub/a.cpp", "src/sub"},
+      {std::nullopt, std::nullopt});
+  ASSERT_TRUE(patched.has_value());
+  EXPECT_TRUE(patched->matches.empty());
+}
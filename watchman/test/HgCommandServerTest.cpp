@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(HgCommandServerTest, encodes_runcommand_requests) {
+  auto request = HgCommandServer::encodeRunCommand({"log", "-r", "."});
+  std::string expected{"runcommand\n"};
+  expected.append(std::string{"\0\0\0\x08", 4});
+  expected.append(std::string{"log\0-r\0.", 8});
+  EXPECT_EQ(expected, request);
+
+  EXPECT_EQ(
+      std::string("runcommand\n\0\0\0\0", 15),
+      HgCommandServer::encodeRunCommand({}));
+}
+
+TEST(HgCommandServerTest, decodes_big_endian_fields) {
+  EXPECT_EQ(0x01020304u, HgCommandServer::decodeUInt32("\x01\x02\x03\x04"));
+  EXPECT_EQ(0xffffffffu, HgCommandServer::decodeUInt32("\xff\xff\xff\xff"));
+}
+
+TEST(HgCommandServerTest, hello_must_offer_runcommand) {
+  EXPECT_TRUE(HgCommandServer::helloSupportsRunCommand(
+      "capabilities: getencoding runcommand\nencoding: UTF-8\npid: 42"));
+  EXPECT_TRUE(HgCommandServer::helloSupportsRunCommand(
+      "encoding: UTF-8\ncapabilities: runcommand"));
+  EXPECT_FALSE(HgCommandServer::helloSupportsRunCommand(
+      "capabilities: getencoding\nencoding: UTF-8"));
+  EXPECT_FALSE(HgCommandServer::helloSupportsRunCommand(
+      "capabilities: runcommandx\n"));
+  EXPECT_FALSE(HgCommandServer::helloSupportsRunCommand(""));
+}
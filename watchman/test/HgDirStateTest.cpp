@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgDirState.h"
+#include <folly/portability/GTest.h>
+#include "watchman/scm/SCM.h"
+
+using namespace watchman;
+
+namespace {
+
+void appendBE16(std::string& buf, uint16_t value) {
+  buf.push_back(char(value >> 8));
+  buf.push_back(char(value & 0xff));
+}
+
+void appendBE32(std::string& buf, uint32_t value) {
+  appendBE16(buf, uint16_t(value >> 16));
+  appendBE16(buf, uint16_t(value & 0xffff));
+}
+
+std::string node(char fill, size_t size) {
+  return std::string(20, fill) + std::string(size - 20, '\0');
+}
+
+void appendV1Entry(
+    std::string& buf,
+    char state,
+    uint32_t mode,
+    uint32_t size,
+    uint32_t mtime,
+    const std::string& name) {
+  buf.push_back(state);
+  appendBE32(buf, mode);
+  appendBE32(buf, size);
+  appendBE32(buf, mtime);
+  appendBE32(buf, name.size());
+  buf.append(name);
+}
+
+struct V2Node {
+  uint32_t pathStart;
+  uint16_t pathLen;
+  uint32_t childStart;
+  uint32_t childCount;
+  uint16_t flags;
+  uint32_t size;
+  uint32_t mtime;
+};
+
+void appendV2Node(std::string& buf, const V2Node& n) {
+  appendBE32(buf, n.pathStart);
+  appendBE16(buf, n.pathLen);
+  appendBE16(buf, 0); // base name start
+  appendBE32(buf, 0); // copy source
+  appendBE16(buf, 0);
+  appendBE32(buf, n.childStart);
+  appendBE32(buf, n.childCount);
+  appendBE32(buf, 0); // descendants with entry
+  appendBE32(buf, 0); // tracked descendants
+  appendBE16(buf, n.flags);
+  appendBE32(buf, n.size);
+  appendBE32(buf, n.mtime);
+  appendBE32(buf, 0); // mtime nanoseconds
+}
+
+} // namespace
+
+TEST(HgDirStateTest, parses_v1) {
+  std::string data = node('\x11', 20) + node('\0', 20);
+  appendV1Entry(data, 'n', 0100644, 12, 1000, "src/main.c");
+  appendV1Entry(data, 'a', 0100755, 3, 0, std::string("copy\0orig", 9));
+  appendV1Entry(data, 'r', 0, 0, 0, "gone");
+
+  auto parents = HgDirState::parseParents(data.substr(0, 40));
+  EXPECT_EQ(std::string(40, '1'), parents.p1);
+  EXPECT_EQ(std::string(40, '0'), parents.p2);
+
+  auto dirstate = HgDirState::parse(data, nullptr);
+  EXPECT_EQ(std::string(40, '1'), dirstate.parents().p1);
+  auto& entries = dirstate.entries();
+  ASSERT_EQ(3, entries.size());
+  EXPECT_EQ("copy", entries[0].path);
+  EXPECT_EQ('a', entries[0].state);
+  EXPECT_EQ(0100755, entries[0].mode);
+  EXPECT_EQ("gone", entries[1].path);
+  EXPECT_EQ('r', entries[1].state);
+  EXPECT_EQ("src/main.c", entries[2].path);
+  EXPECT_EQ('n', entries[2].state);
+  EXPECT_EQ(12, entries[2].size);
+  EXPECT_EQ(1000, entries[2].mtime);
+
+  EXPECT_THROW(
+      HgDirState::parse(data.substr(0, data.size() - 1), nullptr), SCMError);
+}
+
+TEST(HgDirStateTest, parses_v2) {
+  // The tree: "src" holding "src/a" (modified) and "src/b" (added), and
+  // "c" (removed)
+  std::string paths = "srcsrc/asrc/bc";
+  std::string tree = paths;
+  uint32_t nodes = tree.size();
+  // Children of src, then the root nodes
+  appendV2Node(tree, {3, 5, 0, 0, 1 | 2 | (1 << 10) | (1 << 11), 7, 99});
+  appendV2Node(tree, {8, 5, 0, 0, 1 | (1 << 10) | (1 << 3), 5, 0});
+  appendV2Node(tree, {0, 3, nodes, 2, 0, 0, 0});
+  appendV2Node(tree, {13, 1, 0, 0, 2, 0, 0});
+
+  std::string docket = "dirstate-v2\n" + node('\xab', 32) + node('\xcd', 32);
+  appendBE32(docket, nodes + 2 * 44); // root nodes
+  appendBE32(docket, 2);
+  docket.append(44 - 8, '\0');
+  appendBE32(docket, tree.size());
+  docket.push_back(4);
+  docket.append("uuid");
+
+  auto parents = HgDirState::parseParents(docket);
+  std::string p1, p2;
+  for (int i = 0; i < 20; ++i) {
+    p1 += "ab";
+    p2 += "cd";
+  }
+  EXPECT_EQ(p1, parents.p1);
+  EXPECT_EQ(p2, parents.p2);
+
+  std::string requested;
+  auto dirstate = HgDirState::parse(docket, [&](const std::string& name) {
+    requested = name;
+    return tree;
+  });
+  EXPECT_EQ("dirstate.uuid", requested);
+  auto& entries = dirstate.entries();
+  ASSERT_EQ(3, entries.size());
+  EXPECT_EQ("c", entries[0].path);
+  EXPECT_EQ('r', entries[0].state);
+  EXPECT_EQ("src/a", entries[1].path);
+  EXPECT_EQ('n', entries[1].state);
+  EXPECT_EQ(0100644, entries[1].mode);
+  EXPECT_EQ(7, entries[1].size);
+  EXPECT_EQ(99, entries[1].mtime);
+  EXPECT_EQ("src/b", entries[2].path);
+  EXPECT_EQ('a', entries[2].state);
+  EXPECT_EQ(0100755, entries[2].mode);
+
+  // A data file shorter than the docket says is rejected
+  EXPECT_THROW(
+      HgDirState::parse(
+          docket, [&](const std::string&) { return tree.substr(0, 10); }),
+      SCMError);
+}
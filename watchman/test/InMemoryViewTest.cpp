@@ -7,14 +7,25 @@
 
 #include "watchman/InMemoryView.h"
 #include <folly/portability/GTest.h>
+#include <algorithm>
+#include <limits>
+#include "watchman/Errors.h"
+#include "watchman/FileMetadataTable.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/ViewReclaimer.h"
+#include "watchman/ViewSnapshot.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/test/lib/FakeWatcher.h"
 #include "watchman/watcher/Watcher.h"
+#include "watchman/watchman_file.h"
 
 namespace {
 
@@ -39,6 +50,143 @@ class InMemoryViewTest : public testing::Test {
   }
 };
 
+// Matches dirs, like the "type" term does for "d"
+class DirsOnlyExpr : public QueryExpr {
+ public:
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    auto dtype = file->dtype();
+    if (!dtype.has_value()) {
+      return std::nullopt;
+    }
+    return *dtype == DType::Dir;
+  }
+
+  std::optional<DType> requiredType() const override {
+    return DType::Dir;
+  }
+};
+
+// Matches files named BUCK, like ["name", "BUCK"] does
+class BuckFilesExpr : public QueryExpr {
+ public:
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    return file->baseName() == w_string_piece{"BUCK"};
+  }
+
+  std::optional<std::vector<w_string>> requiredNames() const override {
+    return std::vector<w_string>{"buck"};
+  }
+};
+
+// Matches everything, but claims to only match the direct children of dir
+class DirChildrenExpr : public QueryExpr {
+ public:
+  EvaluateResult evaluate(QueryContextBase*, FileResult*) override {
+    return true;
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    return RequiredDir{"dir", 0};
+  }
+};
+
+// Matches the files named *.js within dir, to depth, like a combination of
+// the "suffix" and "dirname" terms does
+class DirJsFilesExpr : public QueryExpr {
+ public:
+  explicit DirJsFilesExpr(uint32_t depth) : depth_{depth} {}
+
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    auto dirName = file->dirName();
+    auto name = file->baseName().view();
+    return (dirName == w_string_piece{"dir"} ||
+            (depth_ > 0 && dirName.startsWith("dir/"))) &&
+        name.size() > 3 && name.substr(name.size() - 3) == ".js";
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    return RequiredDir{"dir", depth_};
+  }
+
+  std::optional<std::vector<w_string>> requiredSuffixes() const override {
+    return std::vector<w_string>{"js"};
+  }
+
+ private:
+  uint32_t depth_;
+};
+
+// Matches existing files of at least 10 bytes, like ["size", "ge", 10] does
+class LargeFilesExpr : public QueryExpr {
+ public:
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    auto exists = file->exists();
+    auto size = file->size();
+    if (!exists.has_value() || !size.has_value()) {
+      return std::nullopt;
+    }
+    return *exists && *size >= 10;
+  }
+
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase*) const override {
+    MetadataFilter filter;
+    filter.existing = true;
+    filter.minSize = 10;
+    return filter;
+  }
+};
+
+// Matches the files that changed after the given ticks, like an "oclock"
+// since term
+class ChangedAfterExpr : public QueryExpr {
+ public:
+  explicit ChangedAfterExpr(uint32_t ticks) : ticks_{ticks} {}
+
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    auto otime = file->otime();
+    if (!otime.has_value()) {
+      return std::nullopt;
+    }
+    return otime->ticks > ticks_;
+  }
+
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase*) const override {
+    MetadataFilter filter;
+    filter.changedAfterTicks = ticks_;
+    return filter;
+  }
+
+ private:
+  uint32_t ticks_;
+};
+
+// Matches the files modified at or after the given time, like an "mtime"
+// since term
+class ModifiedSinceExpr : public QueryExpr {
+ public:
+  explicit ModifiedSinceExpr(time_t since) : since_{since} {}
+
+  EvaluateResult evaluate(QueryContextBase*, FileResult* file) override {
+    auto mtime = file->modifiedTime();
+    if (!mtime.has_value()) {
+      return std::nullopt;
+    }
+    return mtime->tv_sec >= since_;
+  }
+
+  std::optional<MetadataFilter> requiredMetadata(
+      const QueryContextBase*) const override {
+    MetadataFilter filter;
+    filter.modifiedSince = since_;
+    return filter;
+  }
+
+ private:
+  time_t since_;
+};
+
 TEST_F(InMemoryViewTest, can_construct) {
   fs.defineContents({
       "/root",
@@ -72,9 +220,7 @@ TEST_F(InMemoryViewTest, drive_initial_crawl) {
   EXPECT_STREQ("dir/file.txt", ctx.resultsArray.at(1).asCString());
 }
 
-TEST_F(InMemoryViewTest, respond_to_watcher_events) {
-  getLog().setStdErrLoggingLevel(DBG);
-
+TEST_F(InMemoryViewTest, compact_keeps_the_view_queryable) {
   fs.defineContents({"/root/dir/file.txt"});
 
   auto root = std::make_shared<Root>(
@@ -83,56 +229,1937 @@ TEST_F(InMemoryViewTest, respond_to_watcher_events) {
   InMemoryView::IoThreadState state{std::chrono::minutes(5)};
   EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
 
+  view->compact();
+  auto compaction = view->getViewStatus().get("compaction");
+  EXPECT_EQ(1, compaction.get("count").asInt());
+
   Query query;
   query.fieldList.add("name");
-  query.fieldList.add("size");
   query.paths.emplace();
   query.paths->emplace_back(QueryPath{"", 1});
 
-  QueryContext ctx1{&query, root, false};
-  view->pathGenerator(&query, &ctx1);
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
 
-  EXPECT_EQ(2, ctx1.resultsArray.size());
+  EXPECT_EQ(2, ctx.resultsArray.size());
+  EXPECT_STREQ("dir", ctx.resultsArray.at(0).asCString());
+  EXPECT_STREQ("dir/file.txt", ctx.resultsArray.at(1).asCString());
+}
 
-  auto one = ctx1.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
-  auto two = ctx1.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+TEST_F(InMemoryViewTest, sliced_pending_changes_are_all_applied) {
+  fs.defineContents({"/root/dir/a.txt", "/root/dir/b.txt", "/root/c.txt"});
 
-  // Update filesystem and ensure the query results don't update.
+  Configuration sliceConfig{
+      json_object({{"pending_slice_items", json_integer(1)}})};
+  auto slicedView =
+      std::make_shared<InMemoryView>(fs, root_path, sliceConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      sliceConfig,
+      slicedView,
+      [] {});
 
-  fs.updateMetadata(
-      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, slicedView->stepIoThread(root, state, pending));
+
+  for (auto path : {"/root/dir/a.txt", "/root/dir/b.txt", "/root/c.txt"}) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = 100; });
+    pending.lock()->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+  }
   pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, slicedView->stepIoThread(root, state, pending));
+
+  {
+    auto db = slicedView->debugAccessViewDatabase().rlock();
+    EXPECT_EQ(100, db->resolveDir(w_string{"/root/dir"})
+                       ->getChildFile("b.txt")
+                       ->stat.size);
+    EXPECT_EQ(100, db->resolveDir(root_path)->getChildFile("c.txt")->stat.size);
+  }
+
+  // Nothing was waiting to read the view, so it was never released
+  auto slices = slicedView->getViewStatus().get("pending_slices");
+  EXPECT_EQ(0, slices.get("yields").asInt());
+  EXPECT_GE(slices.get("lock_held").get("count").asInt(), 1);
+}
+
+TEST_F(InMemoryViewTest, release_nodes_in_batches) {
+  fs.defineContents({"/root/a/x", "/root/a/y", "/root/b/c/z"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
   EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
 
-  QueryContext ctx2{&query, root, false};
-  view->pathGenerator(&query, &ctx2);
+  // The files a, b, c, x, y and z, and the dirs a, b and c
+  size_t total = 0;
+  while (auto released = view->releaseNodes(2)) {
+    EXPECT_LE(released, 2);
+    total += released;
+  }
+  EXPECT_EQ(9, total);
 
-  one = ctx2.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
-  two = ctx2.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(0, two.get("size").asInt());
+  auto db = view->debugAccessViewDatabase().rlock();
+  auto rootDir = db->resolveDir(root_path);
+  ASSERT_NE(nullptr, rootDir);
+  EXPECT_TRUE(rootDir->files.empty());
+  EXPECT_TRUE(rootDir->dirs.empty());
+}
 
-  // Now notify the iothread of the change, process events, and assert the view
-  // updates.
-  pending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
-  pending.lock()->ping();
+TEST_F(InMemoryViewTest, reclaimer_tears_down_views) {
+  fs.defineContents({"/root/a/x", "/root/b/y"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
   EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  root.reset();
 
-  QueryContext ctx3{&query, root, false};
-  view->pathGenerator(&query, &ctx3);
+  ViewReclaimer reclaimer{2, std::chrono::milliseconds(0)};
+  std::weak_ptr<InMemoryView> weakView = view;
+  reclaimer.reclaim(std::move(view));
+  reclaimer.drain();
 
-  one = ctx3.resultsArray.at(0);
-  EXPECT_STREQ("dir", one.get("name").asCString());
-  EXPECT_EQ(0, one.get("size").asInt());
-  two = ctx3.resultsArray.at(1);
-  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
-  EXPECT_EQ(100, two.get("size").asInt());
+  EXPECT_TRUE(weakView.expired());
+  auto stats = reclaimer.getStats();
+  EXPECT_EQ(0, stats.pendingViews);
+  EXPECT_EQ(1, stats.reclaimedViews);
+  // The files a, b, x and y, and the dirs a and b
+  EXPECT_EQ(6, stats.releasedNodes);
+}
+
+TEST_F(InMemoryViewTest, stream_results_in_chunks) {
+  fs.defineContents({"/root/dir/a.txt", "/root/dir/b.txt", "/root/c.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 2});
+
+  std::vector<size_t> chunkSizes;
+  QueryContext ctx{&query, root, false};
+  ctx.resultsChunkSize = 2;
+  ctx.resultsSink = [&](json_ref&& files) {
+    chunkSizes.push_back(files.array().size());
+  };
+  view->pathGenerator(&query, &ctx);
+
+  // dir, dir/a.txt, dir/b.txt and c.txt: two full chunks were streamed
+  EXPECT_EQ((std::vector<size_t>{2, 2}), chunkSizes);
+  EXPECT_EQ(0, ctx.resultsArray.size());
+  EXPECT_EQ(4, ctx.getNumResults());
+}
+
+TEST_F(InMemoryViewTest, suffix_generator_uses_index) {
+  fs.defineContents(
+      {"/root/a.js",
+       "/root/dir/B.JS",
+       "/root/dir/c.txt",
+       "/root/dir/js",
+       "/root/dir/sub/d.js"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  {
+    auto db = view->debugAccessViewDatabase().rlock();
+    size_t numJs = 0;
+    for (auto f = db->getFilesWithSuffix("js"); f; f = f->suffix_next) {
+      ++numJs;
+    }
+    EXPECT_EQ(3, numJs);
+    EXPECT_EQ(nullptr, db->getFilesWithSuffix("cpp"));
+  }
+
+  Query query;
+  query.fieldList.add("name");
+  query.glob_tree = std::make_unique<GlobTree>("", 0);
+  query.suffixes = std::vector<w_string>{"js"};
+  query.relative_root = "/root/dir";
+  query.relative_root_slash = "/root/dir/";
+
+  QueryContext ctx{&query, root, false};
+  view->globGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"B.JS", "sub/d.js"}), names);
+  // a.js was visited but is outside of the relative root; c.txt and js
+  // were never looked at.
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, doublestar_globs_use_indexes) {
+  fs.defineContents(
+      {"/root/a.js",
+       "/root/.hidden/b.js",
+       "/root/dir/C.JS",
+       "/root/dir/c.txt",
+       "/root/dir/sub/d.js",
+       "/root/dir/sub/BUCK",
+       "/root/dir/sub/e.txt",
+       "/root/dir/sub/f.txt",
+       "/root/dir/sub/g.txt",
+       "/root/other/BUCK"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto globNames = [&](json_ref globs, const char* relativeRoot) {
+    Query query;
+    query.fieldList.add("name");
+    parse_globs(&query, json_object({{"glob", globs}}));
+    if (relativeRoot) {
+      query.relative_root = w_string::pathCat({root_path, relativeRoot});
+      query.relative_root_slash =
+          w_string::build(query.relative_root, "/");
+    }
+
+    QueryContext ctx{&query, root, false};
+    view->globGenerator(&query, &ctx);
+
+    std::vector<std::string> names;
+    for (auto& name : ctx.resultsArray.array()) {
+      names.push_back(name.asCString());
+    }
+    std::sort(names.begin(), names.end());
+    return std::make_pair(names, ctx.getNumWalked());
+  };
+
+  // Matching is still case sensitive, and skips dot dirs, although the
+  // suffix index is neither.  Only the files on the js list are visited.
+  auto [names, walked] = globNames(
+      json_array({typed_string_to_json("**/*.js"),
+                  typed_string_to_json("**/BUCK")}),
+      nullptr);
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.js", "dir/sub/BUCK", "dir/sub/d.js",
+                                "other/BUCK"}),
+      names);
+  EXPECT_EQ(6, walked);
+
+  // Beneath a relative root, files elsewhere on the list are skipped
+  std::tie(names, walked) =
+      globNames(json_array({typed_string_to_json("**/*.js")}), "dir");
+  EXPECT_EQ((std::vector<std::string>{"sub/d.js"}), names);
+
+  // Prefix and suffix patterns match without the index
+  std::tie(names, walked) = globNames(
+      json_array({typed_string_to_json("dir/sub/*.txt"),
+                  typed_string_to_json("dir/c*")}),
+      nullptr);
+  EXPECT_EQ(
+      (std::vector<std::string>{"dir/c.txt", "dir/sub/e.txt",
+                                "dir/sub/f.txt", "dir/sub/g.txt"}),
+      names);
+}
+
+TEST_F(InMemoryViewTest, type_generator_uses_index) {
+  fs.defineContents(
+      {"/root/a.txt",
+       "/root/dir/b.txt",
+       "/root/dir/sub/c.txt",
+       "/root/other/d.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  {
+    auto db = view->debugAccessViewDatabase().rlock();
+    size_t numDirs = 0;
+    for (auto f = db->getFilesOfType(DType::Dir); f; f = f->type_next) {
+      EXPECT_TRUE(f->stat.isDir());
+      ++numDirs;
+    }
+    EXPECT_EQ(3, numDirs);
+    EXPECT_EQ(nullptr, db->getFilesOfType(DType::Symlink));
+  }
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<DirsOnlyExpr>();
+  query.relative_root = "/root/dir";
+  query.relative_root_slash = "/root/dir/";
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  EXPECT_EQ((std::vector<std::string>{"sub"}), names);
+  // Only the dirs were visited; none of the files were looked at.
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, metadata_generator_scans_columns) {
+  fs.defineContents(
+      {"/root/big.txt",
+       "/root/small.txt",
+       "/root/dir/big.bin",
+       "/root/dir/empty.bin"});
+  auto setSize = [&](const char* path, uint64_t size) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = size; });
+  };
+  setSize("/root/big.txt", 100);
+  setSize("/root/small.txt", 1);
+  setSize("/root/dir/big.bin", 10);
+  setSize("/root/dir/empty.bin", 0);
+
+  Configuration columnsConfig{
+      json_object({{"view_metadata_columns", json_true()}})};
+  auto columnsView =
+      std::make_shared<InMemoryView>(fs, root_path, columnsConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      columnsConfig,
+      columnsView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, columnsView->stepIoThread(root, state, pending));
+
+  {
+    auto db = columnsView->debugAccessViewDatabase().rlock();
+    ASSERT_NE(nullptr, db->getMetadataTable());
+    // A row for each of the dir and the four files
+    EXPECT_EQ(5, db->getMetadataTable()->size());
+  }
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<LargeFilesExpr>();
+
+  QueryContext ctx{&query, root, false};
+  columnsView->allFilesGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"big.txt", "dir/big.bin"}), names);
+  // Only the files that passed the scan were visited
+  EXPECT_EQ(2, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, name_generator_uses_index) {
+  fs.defineContents(
+      {"/root/BUCK",
+       "/root/a/BUCK",
+       "/root/a/buck",
+       "/root/a/b.txt",
+       "/root/c/BUCK.bak"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<BuckFilesExpr>();
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"BUCK", "a/BUCK"}), names);
+  // a/buck was visited and rejected by the expression; nothing else was.
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, all_files_generator_walks_required_dir) {
+  fs.defineContents(
+      {"/root/a.txt",
+       "/root/dir/b.txt",
+       "/root/dir/sub/c.txt",
+       "/root/other/d.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<DirChildrenExpr>();
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"dir/b.txt", "dir/sub"}), names);
+  EXPECT_EQ(2, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, all_files_generator_weighs_index_against_dir) {
+  fs.defineContents(
+      {"/root/dir/a.js",
+       "/root/dir/b.txt",
+       "/root/dir/sub/c.txt",
+       "/root/dir/sub/d.txt",
+       "/root/dir/sub/e.txt",
+       "/root/other/f.js",
+       "/root/other/g.js",
+       "/root/other/h.js"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto run = [&](uint32_t depth) {
+    Query query;
+    query.fieldList.add("name");
+    query.expr = std::make_unique<DirJsFilesExpr>(depth);
+
+    auto ctx = std::make_unique<QueryContext>(&query, root, false);
+    view->allFilesGenerator(&query, ctx.get());
+    EXPECT_EQ(1, ctx->resultsArray.size());
+    return ctx->getNumWalked();
+  };
+
+  // The four js files are fewer than the six files beneath dir...
+  EXPECT_EQ(4, run(std::numeric_limits<uint32_t>::max()));
+  // ... but not than the three files directly within it
+  EXPECT_EQ(3, run(0));
+}
+
+TEST_F(InMemoryViewTest, generators_stop_at_limit) {
+  fs.defineContents(
+      {"/root/a.txt", "/root/dir/b.txt", "/root/dir/c.txt", "/root/d.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.limit = 2;
+
+  QueryContext all{&query, root, false};
+  view->allFilesGenerator(&query, &all);
+  EXPECT_EQ(2, all.resultsArray.size());
+  EXPECT_EQ(2, all.getNumWalked());
+  EXPECT_TRUE(all.limitReached());
+
+  query.paths = std::vector<QueryPath>{{"", 1024}};
+  QueryContext paths{&query, root, false};
+  view->pathGenerator(&query, &paths);
+  EXPECT_EQ(2, paths.resultsArray.size());
+}
+
+TEST_F(InMemoryViewTest, path_generator_resolves_shared_prefixes) {
+  fs.defineContents(
+      {"/root/a/b/one.txt",
+       "/root/a/b/two.txt",
+       "/root/a/b-c/three.txt",
+       "/root/a/four.txt",
+       "/root/z/five.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths = std::vector<QueryPath>{
+      {"z/five.txt", 0},
+      {"a/b/two.txt", 0},
+      {"a/missing/six.txt", 0},
+      {"a/missing/seven.txt", 0},
+      {"a/b-c/three.txt", 0},
+      {"a/b/one.txt", 0},
+      {"a/four.txt", 0},
+  };
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray.array()) {
+    names.push_back(name.asCString());
+  }
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "a/b-c/three.txt",
+          "a/b/one.txt",
+          "a/b/two.txt",
+          "a/four.txt",
+          "z/five.txt"}),
+      names);
+
+  // Siblings are left in the order given
+  query.paths = std::vector<QueryPath>{{"a/b/two.txt", 0}, {"a/b/one.txt", 0}};
+  QueryContext siblings{&query, root, false};
+  view->pathGenerator(&query, &siblings);
+  ASSERT_EQ(2, siblings.resultsArray.size());
+  EXPECT_STREQ("a/b/two.txt", siblings.resultsArray.at(0).asCString());
+  EXPECT_STREQ("a/b/one.txt", siblings.resultsArray.at(1).asCString());
+}
+
+TEST_F(InMemoryViewTest, generators_stop_when_canceled) {
+  size_t numFiles = 3 * QueryContext::kCancelCheckInterval;
+  for (size_t i = 0; i < numFiles; ++i) {
+    fs.addNode(folly::to<std::string>("/root/f", i).c_str(), fs.fakeFile());
+  }
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  // The client goes away partway through the walk
+  QueryContext canceled{&query, root, false};
+  size_t checks = 0;
+  canceled.cancelCheck = [&] { return ++checks == 2; };
+  EXPECT_THROW(view->allFilesGenerator(&query, &canceled), QueryExecError);
+  EXPECT_EQ(2, checks);
+  EXPECT_LT(canceled.getNumWalked(), numFiles);
+
+  query.deadline = std::chrono::milliseconds(10);
+  QueryContext late{&query, root, false};
+  late.created -= std::chrono::seconds(1);
+  EXPECT_THROW(view->allFilesGenerator(&query, &late), QueryExecError);
+
+  QueryContext inTime{&query, root, false};
+  view->allFilesGenerator(&query, &inTime);
+  EXPECT_EQ(numFiles, inTime.resultsArray.size());
+}
+
+TEST_F(InMemoryViewTest, tree_hashes_are_dropped_above_changes) {
+  // Only dirs, since their digests need no file to be read
+  fs.defineContents({"/root/a/b/", "/root/a/c/", "/root/d/"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto& hashes = *view->debugAccessCaches().treeHashes;
+  auto digestOf = [&](const char* path) {
+    auto digest = hashes.get(w_string(path));
+    return digest ? std::optional(digest->value()) : std::nullopt;
+  };
+  auto hashAll = [&] {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    view->hashTrees(root->ignore, {root_path}, deadline);
+  };
+  std::vector<DirTreeHashes::Entry> none;
+  auto empty = DirTreeHashes::combine(none);
+
+  hashAll();
+  std::vector<DirTreeHashes::Entry> a{{'d', "c", empty}, {'d', "b", empty}};
+  auto aDigest = DirTreeHashes::combine(a);
+  EXPECT_EQ(empty, digestOf("/root/a/b"));
+  EXPECT_EQ(aDigest, digestOf("/root/a"));
+  std::vector<DirTreeHashes::Entry> top{{'d', "a", aDigest}, {'d', "d", empty}};
+  EXPECT_EQ(DirTreeHashes::combine(top), digestOf("/root"));
+
+  fs.addNode("/root/a/b/e", fs.fakeDir());
+  pending.lock()->add("/root/a/b/e", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // Only the dirs above the change lose their digests
+  EXPECT_FALSE(digestOf("/root/a/b"));
+  EXPECT_FALSE(digestOf("/root/a"));
+  EXPECT_FALSE(digestOf("/root"));
+  EXPECT_EQ(empty, digestOf("/root/a/c"));
+  EXPECT_EQ(empty, digestOf("/root/d"));
+
+  hashAll();
+  std::vector<DirTreeHashes::Entry> b{{'d', "e", empty}};
+  EXPECT_EQ(DirTreeHashes::combine(b), digestOf("/root/a/b"));
+  EXPECT_NE(aDigest, digestOf("/root/a"));
+}
+
+TEST_F(InMemoryViewTest, ordered_queries_keep_first_files) {
+  fs.defineContents(
+      {"/root/a.txt", "/root/dir/b.txt", "/root/dir/c.txt", "/root/d.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.limit = 2;
+  query.order_by = QueryOrder{QueryOrder::Key::Name, true};
+
+  QueryContext byName{&query, root, false};
+  view->allFilesGenerator(&query, &byName);
+  EXPECT_FALSE(byName.limitReached());
+  byName.renderOrderedResults();
+  ASSERT_EQ(2, byName.resultsArray.size());
+  EXPECT_STREQ("dir/c.txt", byName.resultsArray[0].asCString());
+  EXPECT_STREQ("dir/b.txt", byName.resultsArray[1].asCString());
+
+  // The recency list is already in this order, so the walk stops early
+  query.limit = 1;
+  query.order_by = QueryOrder{QueryOrder::Key::OTime, true};
+  QueryContext byRecency{&query, root, false};
+  view->allFilesGenerator(&query, &byRecency);
+  EXPECT_EQ(1, byRecency.getNumWalked());
+  byRecency.renderOrderedResults();
+  EXPECT_EQ(1, byRecency.resultsArray.size());
+}
+
+TEST_F(InMemoryViewTest, aggregate_queries_total_the_matches) {
+  auto file = [&](const char* path, size_t size, time_t mtime) {
+    auto fi = fs.fakeFile();
+    fi.size = size;
+    fi.mtime.tv_sec = mtime;
+    fs.addNode(path, fi);
+  };
+  file("/root/top.txt", 10, 10);
+  file("/root/a/one.txt", 20, 20);
+  file("/root/a/x/two.txt", 40, 40);
+  file("/root/b/three.txt", 80, 30);
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.aggregate = QueryAggregate{1};
+  // Leaves out the dirs
+  query.expr = std::make_unique<LargeFilesExpr>();
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+  EXPECT_TRUE(ctx.resultsArray.empty());
+
+  auto aggregate = ctx.renderAggregate();
+  EXPECT_EQ(4, aggregate.get("count").asInt());
+  EXPECT_EQ(150, aggregate.get("size").asInt());
+  EXPECT_EQ(40, aggregate.get("max_mtime").asInt());
+
+  auto groups = aggregate.get("groups");
+  EXPECT_EQ(3, groups.object().size());
+  EXPECT_EQ(1, groups.get("").get("count").asInt());
+  EXPECT_EQ(2, groups.get("a").get("count").asInt());
+  EXPECT_EQ(60, groups.get("a").get("size").asInt());
+  EXPECT_EQ(40, groups.get("a").get("max_mtime").asInt());
+  EXPECT_EQ(80, groups.get("b").get("size").asInt());
+}
+
+TEST_F(InMemoryViewTest, cached_aggregate_queries_keep_their_totals) {
+  auto fi = fs.fakeFile();
+  fi.size = 10;
+  fs.addNode("/root/a/one.txt", fi);
+  fs.addNode("/root/b/two.txt", fi);
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto query = w_query_parse(
+      root,
+      json_object(
+          {{"expression", json_array({typed_string_to_json("type"),
+                                      typed_string_to_json("f")})},
+           {"fields", json_array({typed_string_to_json("name")})},
+           {"aggregate", json_object({{"group_by_depth", json_integer(1)}})},
+           {"sync_timeout", json_integer(0)}}));
+
+  // The second run at the same position is answered from the cache
+  auto first = w_query_execute(query.get(), root, nullptr, nullptr);
+  auto second = w_query_execute(query.get(), root, nullptr, nullptr);
+  ASSERT_TRUE(first.aggregate);
+  ASSERT_TRUE(second.aggregate);
+  EXPECT_EQ(2, second.aggregate.get("count").asInt());
+  EXPECT_EQ(20, second.aggregate.get("size").asInt());
+  EXPECT_EQ(
+      json_dumps(first.aggregate, JSON_SORT_KEYS),
+      json_dumps(second.aggregate, JSON_SORT_KEYS));
+}
+
+TEST_F(InMemoryViewTest, query_results_are_cached_at_their_position) {
+  fs.addNode("/root/a.txt", fs.fakeFile());
+  fs.addNode("/root/b.txt", fs.fakeFile());
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto parse = [&](const char* suffix) {
+    return w_query_parse(
+        root,
+        json_object(
+            {{"suffix", typed_string_to_json(suffix)},
+             {"fields", json_array({typed_string_to_json("name")})},
+             {"sync_timeout", json_integer(0)}}));
+  };
+  auto run = [&](const std::shared_ptr<Query>& query) {
+    return w_query_execute(query.get(), root, nullptr, nullptr);
+  };
+  auto txt = parse("txt");
+
+  auto first = run(txt);
+  EXPECT_EQ(2, first.resultsArray.size());
+  EXPECT_EQ(0, root->queryResultCache.stats().cacheHit);
+  EXPECT_EQ(1, root->queryResultCache.stats().cacheMiss);
+  EXPECT_EQ(1, root->queryResultCache.size());
+
+  auto second = run(txt);
+  EXPECT_EQ(1, root->queryResultCache.stats().cacheHit);
+  EXPECT_EQ(1, root->queryResultCache.stats().cacheMiss);
+  EXPECT_EQ(2, second.resultsArray.size());
+
+  // Another spec misses
+  EXPECT_TRUE(run(parse("c")).resultsArray.empty());
+  EXPECT_EQ(1, root->queryResultCache.stats().cacheHit);
+  EXPECT_EQ(2, root->queryResultCache.stats().cacheMiss);
+  EXPECT_EQ(2, root->queryResultCache.size());
+
+  // A query that is tagged with its own request_id shares the result
+  auto tagged = w_query_parse(
+      root,
+      json_object(
+          {{"suffix", typed_string_to_json("txt")},
+           {"fields", json_array({typed_string_to_json("name")})},
+           {"request_id", typed_string_to_json("build-1234")},
+           {"sync_timeout", json_integer(0)}}));
+  EXPECT_EQ(2, run(tagged).resultsArray.size());
+  EXPECT_EQ(2, root->queryResultCache.stats().cacheHit);
+  EXPECT_EQ(2, root->queryResultCache.stats().cacheMiss);
+
+  // A change moves the view past the cached result
+  fs.addNode("/root/c.txt", fs.fakeFile());
+  pending.lock()->add(w_string{"/root/c.txt"}, {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto third = run(txt);
+  EXPECT_EQ(2, root->queryResultCache.stats().cacheHit);
+  EXPECT_EQ(3, root->queryResultCache.stats().cacheMiss);
+  EXPECT_EQ(3, third.resultsArray.size());
+}
+
+TEST_F(InMemoryViewTest, query_result_cache_keys) {
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  // The spec of a query for names, with one more field if name is set
+  auto parse = [&](const char* name = nullptr, json_ref value = json_ref()) {
+    auto spec =
+        json_object({{"fields", json_array({typed_string_to_json("name")})}});
+    if (name) {
+      spec.set(name, std::move(value));
+    }
+    return w_query_parse(root, spec);
+  };
+  auto keyOf = [&](const std::shared_ptr<Query>& query,
+                   ClockPosition position,
+                   uint32_t lastAgeOutTick) {
+    QueryContext ctx{query.get(), root, false};
+    ctx.clockAtStartOfQuery = ClockSpec(position);
+    ctx.lastAgeOutTickValueAtStartOfQuery = lastAgeOutTick;
+    return queryResultCacheKey(query.get(), ctx, false);
+  };
+  ClockPosition position{1, 10};
+  auto plain = parse();
+
+  auto key = keyOf(plain, position, 0);
+  ASSERT_TRUE(key);
+  EXPECT_EQ(key, keyOf(parse(), position, 0));
+  // A new tick, or files aged out, make another result
+  EXPECT_NE(key, keyOf(plain, ClockPosition{1, 11}, 0));
+  EXPECT_NE(key, keyOf(plain, position, 3));
+  // The options that don't affect the result are left out
+  EXPECT_EQ(
+      key,
+      keyOf(parse("request_id", typed_string_to_json("abc")), position, 0));
+  EXPECT_EQ(key, keyOf(parse("sync_timeout", json_integer(10)), position, 0));
+  EXPECT_EQ(key, keyOf(parse("lock_timeout", json_integer(10)), position, 0));
+  EXPECT_NE(key, keyOf(parse("dedup_results", json_true()), position, 0));
+
+  QueryContext ctx{plain.get(), root, false};
+  ctx.clockAtStartOfQuery = ClockSpec(position);
+  EXPECT_FALSE(queryResultCacheKey(plain.get(), ctx, true));
+  ctx.resultsSink = [](json_ref&&) {};
+  EXPECT_FALSE(queryResultCacheKey(plain.get(), ctx, false));
+
+  auto scm = json_object(
+      {{"scm",
+        json_object({{"mergebase-with", typed_string_to_json("main")}})}});
+  EXPECT_FALSE(
+      keyOf(parse("since", typed_string_to_json("n:cursor")), position, 0));
+  EXPECT_FALSE(keyOf(parse("since", std::move(scm)), position, 0));
+  EXPECT_FALSE(keyOf(parse("profile", json_true()), position, 0));
+  EXPECT_FALSE(keyOf(parse("bench", json_integer(2)), position, 0));
+  EXPECT_FALSE(keyOf(parse("fetch_timeout", json_integer(100)), position, 0));
+}
+
+TEST_F(InMemoryViewTest, row_encoder_matches_field_encoders) {
+  fs.defineContents({"/root/a.txt", "/root/dir/b.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.bserVersion = 2;
+  for (auto name : {"name", "exists", "new", "size", "mode", "mtime_ms"}) {
+    query.fieldList.add(w_string{name, W_STRING_UNICODE});
+  }
+  ASSERT_TRUE(query.fieldList.encodeRow);
+
+  QueryContext rows{&query, root, false};
+  view->allFilesGenerator(&query, &rows);
+  auto encodedRows = rows.bserResults->release();
+
+  query.fieldList.encodeRow = nullptr;
+  QueryContext fields{&query, root, false};
+  view->allFilesGenerator(&query, &fields);
+  auto encodedFields = fields.bserResults->release();
+
+  EXPECT_EQ(3, encodedRows->count);
+  EXPECT_EQ(encodedFields->count, encodedRows->count);
+  EXPECT_EQ(encodedFields->data, encodedRows->data);
+
+  // Any other list of fields is encoded one field at a time
+  query.fieldList.add(w_string{"uid", W_STRING_UNICODE});
+  EXPECT_FALSE(query.fieldList.encodeRow);
+}
+
+TEST_F(InMemoryViewTest, parallel_generators_match_serial) {
+  fs.defineContents(
+      {"/root/top.txt",
+       "/root/a/1.txt",
+       "/root/a/x/2.txt",
+       "/root/a/y/3.txt",
+       "/root/b/4.txt",
+       "/root/b/x/y/z/5.txt",
+       "/root/c/x/6.txt",
+       "/root/d/7.txt",
+       "/root/e"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  if (getThreadPool().numWorkers() == 0) {
+    getThreadPool().start(4, 1024);
+  }
+
+  auto names = [](QueryContext& ctx) {
+    std::vector<std::string> result;
+    for (auto& name : ctx.resultsArray) {
+      result.push_back(name.asCString());
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  // The second path overlaps with the first, so dedup has to apply across
+  // the threads.
+  query.paths->emplace_back(QueryPath{"", -1});
+  query.paths->emplace_back(QueryPath{"a", -1});
+
+  QueryContext serial{&query, root, false};
+  view->pathGenerator(&query, &serial);
+
+  query.parallel = true;
+  QueryContext parallel{&query, root, false};
+  view->pathGenerator(&query, &parallel);
+
+  EXPECT_EQ(names(serial), names(parallel));
+  EXPECT_EQ(serial.num_deduped, parallel.num_deduped);
+  // The view's files are deduped without building their names
+  EXPECT_TRUE(serial.dedup.empty());
+  EXPECT_TRUE(parallel.dedup.empty());
+  EXPECT_EQ(serial.getNumWalked(), parallel.getNumWalked());
+
+  Query all;
+  all.fieldList.add("name");
+  all.relative_root = "/root/b";
+  all.relative_root_slash = "/root/b/";
+
+  QueryContext allSerial{&all, root, false};
+  view->allFilesGenerator(&all, &allSerial);
+
+  all.parallel = true;
+  QueryContext allParallel{&all, root, false};
+  view->allFilesGenerator(&all, &allParallel);
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"4.txt", "x", "x/y", "x/y/z", "x/y/z/5.txt"}),
+      names(allParallel));
+  EXPECT_EQ(names(allSerial), names(allParallel));
+}
+
+TEST_F(InMemoryViewTest, respond_to_watcher_events) {
+  getLog().setStdErrLoggingLevel(DBG);
+
+  fs.defineContents({"/root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx1{&query, root, false};
+  view->pathGenerator(&query, &ctx1);
+
+  EXPECT_EQ(2, ctx1.resultsArray.size());
+
+  auto one = ctx1.resultsArray.at(0);
+  EXPECT_STREQ("dir", one.get("name").asCString());
+  EXPECT_EQ(0, one.get("size").asInt());
+  auto two = ctx1.resultsArray.at(1);
+  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
+  EXPECT_EQ(0, two.get("size").asInt());
+
+  // Update filesystem and ensure the query results don't update.
+
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  QueryContext ctx2{&query, root, false};
+  view->pathGenerator(&query, &ctx2);
+
+  one = ctx2.resultsArray.at(0);
+  EXPECT_STREQ("dir", one.get("name").asCString());
+  EXPECT_EQ(0, one.get("size").asInt());
+  two = ctx2.resultsArray.at(1);
+  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
+  EXPECT_EQ(0, two.get("size").asInt());
+
+  // Now notify the iothread of the change, process events, and assert the view
+  // updates.
+  pending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  QueryContext ctx3{&query, root, false};
+  view->pathGenerator(&query, &ctx3);
+
+  one = ctx3.resultsArray.at(0);
+  EXPECT_STREQ("dir", one.get("name").asCString());
+  EXPECT_EQ(0, one.get("size").asInt());
+  two = ctx3.resultsArray.at(1);
+  EXPECT_STREQ("dir/file.txt", two.get("name").asCString());
+  EXPECT_EQ(100, two.get("size").asInt());
+}
+
+TEST_F(InMemoryViewTest, change_set_generator_matches_time_generator) {
+  fs.defineContents(
+      {"/root/dir/file.txt", "/root/dir/other.txt", "/root/top.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  view->recordChangeSet();
+  auto since = view->getMostRecentRootNumberAndTickValue();
+
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  pending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  view->recordChangeSet();
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+
+  auto run = [&](bool useChangeSet) {
+    auto ctx = std::make_unique<QueryContext>(&query, root, false);
+    ctx->clockAtStartOfQuery =
+        ClockSpec(view->getMostRecentRootNumberAndTickValue());
+    ctx->since.clock.is_fresh_instance = false;
+    ctx->since.clock.ticks = since.ticks;
+    if (useChangeSet) {
+      view->changeSetGenerator(&query, ctx.get());
+    } else {
+      view->timeGenerator(&query, ctx.get());
+    }
+    return ctx;
+  };
+
+  auto walked = run(false);
+  auto recorded = run(true);
+  ASSERT_EQ(1, recorded->resultsArray.size());
+  EXPECT_STREQ(
+      "dir/file.txt", recorded->resultsArray.at(0).get("name").asCString());
+  EXPECT_EQ(100, recorded->resultsArray.at(0).get("size").asInt());
+  EXPECT_EQ(
+      json_dumps(walked->renderResults(), JSON_SORT_KEYS),
+      json_dumps(recorded->renderResults(), JSON_SORT_KEYS));
+  // The change set holds only the changed files, whereas the walk also
+  // visits the file at the boundary.
+  EXPECT_EQ(walked->getNumWalked(), recorded->getNumWalked() + 1);
+
+  // Once the view has moved on, the change set is no longer complete and
+  // the view is walked instead.
+  fs.updateMetadata(
+      "/root/top.txt", [&](FileInformation& fi) { fi.size = 5; });
+  pending.lock()->add("/root/top.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  EXPECT_EQ(2, run(true)->resultsArray.size());
+}
+
+TEST_F(InMemoryViewTest, any_file_changed_between_needs_the_change_set) {
+  fs.defineContents({"/root/dir/file.txt", "/root/top.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  view->recordChangeSet();
+  auto since = view->getMostRecentRootNumberAndTickValue();
+
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  pending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  view->recordChangeSet();
+  auto upTo = view->getMostRecentRootNumberAndTickValue();
+
+  std::vector<std::string> visited;
+  auto isTop = [&](w_string_piece dirName, w_string_piece baseName) {
+    visited.push_back(
+        std::string{dirName.view()} + "/" + std::string{baseName.view()});
+    return baseName == "top.txt";
+  };
+  auto isFile = [](w_string_piece, w_string_piece baseName) {
+    return baseName == "file.txt";
+  };
+
+  // Only the changed file is visited
+  EXPECT_EQ(false, view->anyFileChangedBetween(since, upTo, isTop));
+  EXPECT_EQ(std::vector<std::string>{"/root/dir/file.txt"}, visited);
+  EXPECT_EQ(true, view->anyFileChangedBetween(since, upTo, isFile));
+  // Nothing changed since upTo
+  EXPECT_EQ(false, view->anyFileChangedBetween(upTo, upTo, isFile));
+
+  // The change set doesn't reach back before since, nor belong to another
+  // root number, so the callers have to run the query
+  auto earlier = ClockPosition{since.rootNumber, since.ticks - 1};
+  EXPECT_EQ(std::nullopt, view->anyFileChangedBetween(earlier, upTo, isFile));
+  auto otherRoot = ClockPosition{since.rootNumber + 1, since.ticks};
+  EXPECT_EQ(
+      std::nullopt, view->anyFileChangedBetween(otherRoot, upTo, isFile));
+
+  // Nor does it reach past where it was recorded
+  fs.updateMetadata(
+      "/root/top.txt", [&](FileInformation& fi) { fi.size = 5; });
+  pending.lock()->add("/root/top.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  auto now = view->getMostRecentRootNumberAndTickValue();
+  EXPECT_EQ(std::nullopt, view->anyFileChangedBetween(since, now, isTop));
+  view->recordChangeSet();
+  EXPECT_EQ(true, view->anyFileChangedBetween(upTo, now, isTop));
+}
+
+TEST_F(InMemoryViewTest, subtree_file_counts_follow_the_view) {
+  fs.defineContents({"/root/a/x", "/root/a/y", "/root/b/c/z"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto subtreeFiles = [&](const char* path) {
+    auto db = view->debugAccessViewDatabase().rlock();
+    return db->resolveDir(w_string{path})->subtreeFiles;
+  };
+  // The files a, b, c, x, y and z
+  EXPECT_EQ(6, subtreeFiles("/root"));
+  EXPECT_EQ(2, subtreeFiles("/root/a"));
+  EXPECT_EQ(2, subtreeFiles("/root/b"));
+  EXPECT_EQ(1, subtreeFiles("/root/b/c"));
+
+  // The file that moved away is deleted, but counted until it is aged out
+  fs.rename("/root/a/y", "/root/b/y");
+  pending.lock()->add("/root/a/y", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->add("/root/b/y", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_EQ(7, subtreeFiles("/root"));
+  EXPECT_EQ(2, subtreeFiles("/root/a"));
+  EXPECT_EQ(3, subtreeFiles("/root/b"));
+
+  while (view->releaseNodes(2)) {
+  }
+  EXPECT_EQ(0, subtreeFiles("/root"));
+}
+
+TEST_F(InMemoryViewTest, time_generator_walks_relative_root_when_cheaper) {
+  fs.defineContents(
+      {"/root/dir/a.txt",
+       "/root/dir/b.txt",
+       "/root/dir/c.txt",
+       "/root/dir/d.txt",
+       "/root/other/e.txt",
+       "/root/other/f.txt",
+       "/root/other/g.txt",
+       "/root/other/h.txt",
+       "/root/other/i.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto change = [&](std::vector<const char*> paths) {
+    auto since = view->getMostRecentRootNumberAndTickValue();
+    for (auto path : paths) {
+      fs.updateMetadata(path, [&](FileInformation& fi) { fi.size += 1; });
+      pending.lock()->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    pending.lock()->ping();
+    EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+    return since;
+  };
+
+  Query query;
+  query.fieldList.add("name");
+  query.relative_root = "/root/dir";
+  query.relative_root_slash = "/root/dir/";
+
+  auto run = [&](ClockPosition since) {
+    auto ctx = std::make_unique<QueryContext>(&query, root, false);
+    ctx->since.clock.is_fresh_instance = false;
+    ctx->since.clock.ticks = since.ticks;
+    view->timeGenerator(&query, ctx.get());
+    return ctx;
+  };
+
+  // Six files changed, which is more than the four within the relative
+  // root, so those are walked instead
+  auto since = change(
+      {"/root/dir/a.txt",
+       "/root/other/e.txt",
+       "/root/other/f.txt",
+       "/root/other/g.txt",
+       "/root/other/h.txt",
+       "/root/other/i.txt"});
+  auto walkedDir = run(since);
+  ASSERT_EQ(1, walkedDir->resultsArray.size());
+  EXPECT_STREQ("a.txt", walkedDir->resultsArray.at(0).asCString());
+  EXPECT_EQ(4, walkedDir->getNumWalked());
+
+  // A single change is found by walking the recency index up to the
+  // boundary
+  since = change({"/root/dir/b.txt"});
+  auto walkedRecent = run(since);
+  ASSERT_EQ(1, walkedRecent->resultsArray.size());
+  EXPECT_STREQ("b.txt", walkedRecent->resultsArray.at(0).asCString());
+  EXPECT_EQ(2, walkedRecent->getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, all_files_generator_walks_changes_after_bound) {
+  fs.defineContents(
+      {"/root/a.txt",
+       "/root/b.txt",
+       "/root/c.txt",
+       "/root/d.txt",
+       "/root/e.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto since = view->getMostRecentRootNumberAndTickValue();
+  fs.updateMetadata("/root/c.txt", [&](FileInformation& fi) { fi.size += 1; });
+  pending.lock()->add(w_string{"/root/c.txt"}, {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<ChangedAfterExpr>(since.ticks);
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("c.txt", ctx.resultsArray.at(0).asCString());
+  // The changed file, and the one behind it that marks the boundary
+  EXPECT_EQ(2, ctx.getNumWalked());
+}
+
+TEST_F(InMemoryViewTest, mtime_bound_allows_for_future_mtimes) {
+  fs.defineContents({"/root/a.txt", "/root/b.txt", "/root/c.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // a.txt is given an mtime an hour ahead, then b.txt is changed, which
+  // leaves a.txt behind b.txt on the recency index
+  auto future = time(nullptr) + 3600;
+  fs.updateMetadata(
+      "/root/a.txt", [&](FileInformation& fi) { fi.mtime.tv_sec = future; });
+  pending.lock()->add(w_string{"/root/a.txt"}, {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  fs.updateMetadata("/root/b.txt", [&](FileInformation& fi) { fi.size += 1; });
+  pending.lock()->add(w_string{"/root/b.txt"}, {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  EXPECT_LE(
+      3600 - 5, view->debugAccessViewDatabase().rlock()->getStatTimeSkew());
+
+  Query query;
+  query.fieldList.add("name");
+  query.expr = std::make_unique<ModifiedSinceExpr>(future);
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  // Its otime is an hour before its mtime, yet a.txt is still found
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("a.txt", ctx.resultsArray.at(0).asCString());
+}
+
+TEST_F(InMemoryViewTest, view_snapshot_round_trip) {
+  fs.defineContents({"/root/dir/file.txt", "/root/dir/sub/deep.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 42; });
+  pending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  ViewSnapshotClock clock;
+  clock.epochs.push_back(
+      ClockEpoch::current(view->getMostRecentRootNumberAndTickValue()));
+  clock.lastAgeOutTick = 1;
+  clock.watcherPosition = std::string("pos\0ition", 9);
+
+  view->debugAccessViewDatabase()
+      .wlock()
+      ->resolveDir("/root/dir/sub")
+      ->crawled_mtime = timespec{1234, 5678};
+
+  std::string data;
+  std::vector<std::pair<w_string, w_clock_t>> originalOrder;
+  {
+    auto db = view->debugAccessViewDatabase().rlock();
+    data = serializeViewSnapshot(*db, clock);
+    for (auto file = db->getLatestFile(); file; file = file->next) {
+      originalOrder.emplace_back(
+          file->parent->getFullPathToChild(file->getName()), file->otime);
+    }
+  }
+
+  ViewDatabase loaded{root_path};
+  ViewSnapshotClock loadedClock;
+  auto numFiles = loadViewSnapshot(
+      loaded, *watcher, folly::StringPiece(data), loadedClock);
+  EXPECT_EQ(4, numFiles);
+  ASSERT_EQ(1, loadedClock.epochs.size());
+  EXPECT_EQ(clock.epochs[0].pid, loadedClock.epochs[0].pid);
+  EXPECT_EQ(clock.epochs[0].ticks, loadedClock.epochs[0].ticks);
+  EXPECT_EQ(1, loadedClock.lastAgeOutTick);
+  EXPECT_EQ(clock.watcherPosition, loadedClock.watcherPosition);
+
+  // Files keep the order and the clocks they were observed at
+  std::vector<std::pair<w_string, w_clock_t>> loadedOrder;
+  for (auto file = loaded.getLatestFile(); file; file = file->next) {
+    loadedOrder.emplace_back(
+        file->parent->getFullPathToChild(file->getName()), file->otime);
+    EXPECT_TRUE(file->exists);
+  }
+  ASSERT_EQ(originalOrder.size(), loadedOrder.size());
+  for (size_t i = 0; i < originalOrder.size(); ++i) {
+    EXPECT_EQ(originalOrder[i].first, loadedOrder[i].first);
+    EXPECT_EQ(originalOrder[i].second.ticks, loadedOrder[i].second.ticks);
+    EXPECT_EQ(
+        originalOrder[i].second.timestamp, loadedOrder[i].second.timestamp);
+  }
+
+  auto dir = loaded.resolveDir("/root/dir");
+  ASSERT_NE(nullptr, dir);
+  auto file = dir->getChildFile("file.txt");
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ(42, file->stat.size);
+  auto sub = loaded.resolveDir("/root/dir/sub");
+  ASSERT_NE(nullptr, sub);
+  EXPECT_NE(nullptr, sub->getChildFile("deep.txt"));
+  // Along with the mtime at which the dir was last read in full
+  EXPECT_EQ(1234, sub->crawled_mtime.tv_sec);
+  EXPECT_EQ(5678, sub->crawled_mtime.tv_nsec);
+}
+
+TEST_F(InMemoryViewTest, desynced_crawl_examines_every_entry) {
+  fs.defineContents({"/root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto sizeOfFile = [&] {
+    auto db = view->debugAccessViewDatabase().rlock();
+    return db->resolveDir(w_string("/root/dir"))
+        ->getChildFile("file.txt")
+        ->stat.size;
+  };
+
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+
+  // A plain crawl only looks for new entries
+  pending.lock()->add("/root/dir", {}, W_PENDING_CRAWL_ONLY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_EQ(0, sizeOfFile());
+
+  // But events may have been missed for any of them if the watcher desynced
+  pending.lock()->add(
+      "/root/dir", {}, W_PENDING_CRAWL_ONLY | W_PENDING_IS_DESYNCED);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_EQ(100, sizeOfFile());
+}
+
+TEST_F(InMemoryViewTest, recrawl_trusts_readdir_for_unchanged_dirs) {
+  fs.defineContents({"/root/dir/file.txt", "/root/top.txt", "/root/other.txt"});
+  auto setDirMtime = [&](const char* path, time_t mtime) {
+    fs.updateMetadata(
+        path, [&](FileInformation& fi) { fi.mtime.tv_sec = mtime; });
+  };
+  setDirMtime("/root", 1000);
+  setDirMtime("/root/dir", 1000);
+
+  Configuration trustConfig{
+      json_object({{"recrawl_trust_readdir", json_true()}})};
+  auto trustView =
+      std::make_shared<InMemoryView>(fs, root_path, trustConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      trustConfig,
+      trustView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, trustView->stepIoThread(root, state, pending));
+
+  auto sizeOf = [&](const char* dirPath, const char* name) {
+    auto db = trustView->debugAccessViewDatabase().rlock();
+    auto file = db->resolveDir(w_string(dirPath))->getChildFile(name);
+    return file ? file->stat.size : -1;
+  };
+  auto recrawl = [&] {
+    pending.lock()->add(root_path, {}, W_PENDING_RECURSIVE);
+    pending.lock()->ping();
+    EXPECT_EQ(
+        Continue::Continue, trustView->stepIoThread(root, state, pending));
+  };
+
+  // Modified in place: readdir can't tell, so the cached stat is kept
+  fs.updateMetadata(
+      "/root/top.txt", [&](FileInformation& fi) { fi.size = 100; });
+  // Replaced: the inode changed, so it is stat'd again
+  fs.updateMetadata("/root/dir/file.txt", [&](FileInformation& fi) {
+    fi.size = 200;
+    fi.ino += 1000;
+  });
+  recrawl();
+  EXPECT_EQ(0, sizeOf("/root", "top.txt"));
+  EXPECT_EQ(200, sizeOf("/root/dir", "file.txt"));
+
+  // Once the dir itself changes, every entry is stat'd
+  setDirMtime("/root", 2000);
+  recrawl();
+  EXPECT_EQ(100, sizeOf("/root", "top.txt"));
+  EXPECT_EQ(0, sizeOf("/root", "other.txt"));
+}
+
+TEST_F(InMemoryViewTest, recrawl_skips_unchanged_dirs) {
+  fs.defineContents({"/root/dir/file.txt", "/root/top.txt"});
+  auto setDirMtime = [&](const char* path, time_t mtime) {
+    fs.updateMetadata(
+        path, [&](FileInformation& fi) { fi.mtime.tv_sec = mtime; });
+  };
+  setDirMtime("/root", 1000);
+  setDirMtime("/root/dir", 1000);
+
+  Configuration skipConfig{
+      json_object({{"recrawl_skip_unchanged_dirs", json_true()}})};
+  auto skipView =
+      std::make_shared<InMemoryView>(fs, root_path, skipConfig, watcher);
+  // The fs type must be one whose dir mtimes are known to be reliable
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "ext4",
+      w_string_to_json("{}"),
+      skipConfig,
+      skipView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, skipView->stepIoThread(root, state, pending));
+
+  auto exists = [&](const char* dirPath, const char* name) {
+    auto db = skipView->debugAccessViewDatabase().rlock();
+    auto file = db->resolveDir(w_string(dirPath))->getChildFile(name);
+    return file && file->exists;
+  };
+  auto recrawl = [&] {
+    root->scheduleRecrawl("test");
+    EXPECT_EQ(
+        Continue::Continue, skipView->stepIoThread(root, state, pending));
+  };
+
+  // Added without the dir's mtime changing: it isn't read, so this is missed
+  fs.defineContents({"/root/dir/sneaky.txt"});
+  setDirMtime("/root/dir", 1000);
+  recrawl();
+  EXPECT_TRUE(exists("/root/dir", "file.txt"));
+  EXPECT_FALSE(exists("/root/dir", "sneaky.txt"));
+
+  // Once the dir changes, it is read again
+  setDirMtime("/root/dir", 2000);
+  recrawl();
+  EXPECT_TRUE(exists("/root/dir", "sneaky.txt"));
+}
+
+TEST_F(InMemoryViewTest, renamed_dir_moves_subtree) {
+  fs.defineContents({"/root/old/sub/file.txt", "/root/old/top.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  fs.rename("/root/old", "/root/new");
+  // Modified in place: the trusted scan doesn't look at it again
+  fs.updateMetadata(
+      "/root/new/sub/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  // Modified before the rename was reported
+  fs.updateMetadata(
+      "/root/new/top.txt", [&](FileInformation& fi) { fi.size = 200; });
+  {
+    auto lock = pending.lock();
+    lock->add("/root/old/top.txt", {}, W_PENDING_VIA_NOTIFY);
+    lock->add("/root/old", {}, W_PENDING_VIA_NOTIFY);
+    lock->add("/root/new", {}, W_PENDING_VIA_NOTIFY);
+    lock->addRename(PendingRename{"/root/old", "/root/new", {}});
+    lock->ping();
+  }
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto db = view->debugAccessViewDatabase().rlock();
+  auto fileAt = [&](const char* dirPath, const char* name) {
+    auto dir = db->resolveDir(w_string(dirPath));
+    return dir ? dir->getChildFile(name) : nullptr;
+  };
+
+  auto moved = fileAt("/root/new/sub", "file.txt");
+  ASSERT_TRUE(moved);
+  EXPECT_TRUE(moved->exists);
+  EXPECT_EQ(0, moved->stat.size);
+  auto top = fileAt("/root/new", "top.txt");
+  ASSERT_TRUE(top);
+  EXPECT_EQ(200, top->stat.size);
+
+  auto gone = fileAt("/root/old/sub", "file.txt");
+  ASSERT_TRUE(gone);
+  EXPECT_FALSE(gone->exists);
+  EXPECT_FALSE(fileAt("/root", "old")->exists);
+  EXPECT_TRUE(fileAt("/root", "new")->exists);
+}
+
+TEST_F(InMemoryViewTest, lazy_crawl_defers_deep_dirs) {
+  fs.defineContents({"/root/dir/sub/file.txt", "/root/top.txt"});
+
+  Configuration lazyConfig{
+      json_object({{"lazy_crawl_depth", json_integer(1)}})};
+  auto lazyView =
+      std::make_shared<InMemoryView>(fs, root_path, lazyConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      lazyConfig,
+      lazyView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, lazyView->stepIoThread(root, state, pending));
+
+  {
+    auto db = lazyView->debugAccessViewDatabase().rlock();
+    auto top = db->resolveDir(root_path);
+    EXPECT_TRUE(top->getChildFile("top.txt"));
+    EXPECT_TRUE(top->getChildFile("dir"));
+    // The dir is known, but not what is in it
+    auto dir = db->resolveDir(w_string("/root/dir"));
+    EXPECT_TRUE(!dir || !dir->getChildFile("sub"));
+  }
+
+  auto status = lazyView->getViewStatus().get("lazy_crawl");
+  EXPECT_EQ(1, status.get("deferred_dirs").asInt());
+  EXPECT_EQ(0, status.get("materialized_paths").asInt());
+}
+
+TEST_F(InMemoryViewTest, summary_dirs_are_tracked_as_one_node) {
+  fs.defineContents(
+      {"/root/vendor/a/one.js", "/root/vendor/two.js", "/root/top.txt"});
+
+  Configuration summaryConfig{json_object(
+      {{"summary_dirs", json_array({typed_string_to_json("vendor")})}})};
+  auto summaryView =
+      std::make_shared<InMemoryView>(fs, root_path, summaryConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      summaryConfig,
+      summaryView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, summaryView->stepIoThread(root, state, pending));
+
+  uint32_t crawledTick;
+  {
+    auto db = summaryView->debugAccessViewDatabase().rlock();
+    auto vendor = db->resolveDir(root_path)->getChildFile("vendor");
+    ASSERT_TRUE(vendor);
+    crawledTick = vendor->otime.ticks;
+    // Nothing beneath it has a node
+    auto dir = db->resolveDir(w_string("/root/vendor"));
+    EXPECT_TRUE(!dir || dir->files.empty());
+  }
+
+  // The root settles, and the dir is walked
+  EXPECT_EQ(
+      Continue::Continue, summaryView->stepIoThread(root, state, pending));
+  auto status = summaryView->getViewStatus().get("summary_dirs").at(0);
+  EXPECT_EQ(2, status.get("files").asInt());
+  EXPECT_EQ(1, status.get("dirs").asInt());
+  EXPECT_EQ(1, status.get("walks").asInt());
+  auto changes = status.get("changes").asInt();
+
+  // A change beneath it is a change to the dir
+  pending.lock()->add(
+      w_string{"/root/vendor/a/one.js"}, {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, summaryView->stepIoThread(root, state, pending));
+  {
+    auto db = summaryView->debugAccessViewDatabase().rlock();
+    auto vendor = db->resolveDir(root_path)->getChildFile("vendor");
+    EXPECT_GT(vendor->otime.ticks, crawledTick);
+    auto dir = db->resolveDir(w_string("/root/vendor/a"));
+    EXPECT_TRUE(!dir || dir->files.empty());
+  }
+  status = summaryView->getViewStatus().get("summary_dirs").at(0);
+  EXPECT_EQ(changes + 1, status.get("changes").asInt());
+}
+
+TEST_F(InMemoryViewTest, io_shards_crawl_everything) {
+  fs.defineContents(
+      {"/root/a/one.txt",
+       "/root/a/deep/two.txt",
+       "/root/b/three.txt",
+       "/root/four.txt"});
+
+  Configuration shardedConfig{json_object({{"io_shards", json_integer(3)}})};
+  auto shardedView =
+      std::make_shared<InMemoryView>(fs, root_path, shardedConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      shardedConfig,
+      shardedView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, shardedView->stepIoThread(root, state, pending));
+
+  auto db = shardedView->debugAccessViewDatabase().rlock();
+  auto top = db->resolveDir(root_path);
+  ASSERT_TRUE(top->getChildFile("four.txt"));
+  EXPECT_TRUE(top->getChildFile("four.txt")->exists);
+  EXPECT_TRUE(db->resolveDir(w_string("/root/a"))->getChildFile("one.txt"));
+  EXPECT_TRUE(
+      db->resolveDir(w_string("/root/a/deep"))->getChildFile("two.txt"));
+  EXPECT_TRUE(db->resolveDir(w_string("/root/b"))->getChildFile("three.txt"));
+}
+
+TEST_F(InMemoryViewTest, crawl_pool_reads_sibling_dirs_together) {
+  fs.defineContents(
+      {"/root/a/one.txt",
+       "/root/a/deep/two.txt",
+       "/root/a/deep/three.txt",
+       "/root/b/four.txt",
+       "/root/c/five.txt",
+       "/root/d/six.txt",
+       "/root/seven.txt"});
+
+  Configuration poolConfig{
+      json_object({{"crawl_stat_threads", json_integer(3)}})};
+  auto poolView =
+      std::make_shared<InMemoryView>(fs, root_path, poolConfig, watcher);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      poolConfig,
+      poolView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, poolView->stepIoThread(root, state, pending));
+
+  auto exists = [&](const char* dirPath, const char* name) {
+    auto db = poolView->debugAccessViewDatabase().rlock();
+    auto dir = db->resolveDir(w_string(dirPath));
+    auto file = dir ? dir->getChildFile(name) : nullptr;
+    return file && file->exists;
+  };
+  EXPECT_TRUE(exists("/root", "seven.txt"));
+  EXPECT_TRUE(exists("/root/a", "one.txt"));
+  EXPECT_TRUE(exists("/root/a/deep", "two.txt"));
+  EXPECT_TRUE(exists("/root/a/deep", "three.txt"));
+  EXPECT_TRUE(exists("/root/b", "four.txt"));
+  EXPECT_TRUE(exists("/root/c", "five.txt"));
+  EXPECT_TRUE(exists("/root/d", "six.txt"));
+
+  // The listings read on the pool are compared with the view as before
+  fs.rename("/root/b/four.txt", "/root/c/four.txt");
+  root->scheduleRecrawl("test");
+  EXPECT_EQ(Continue::Continue, poolView->stepIoThread(root, state, pending));
+  EXPECT_FALSE(exists("/root/b", "four.txt"));
+  EXPECT_TRUE(exists("/root/c", "four.txt"));
+  EXPECT_TRUE(exists("/root/c", "five.txt"));
+}
+
+TEST_F(InMemoryViewTest, age_out_start_skips_recent_files) {
+  ViewDatabase db{root_path};
+  auto dir = db.resolveDir(root_path, true);
+  const uint32_t numFiles = 5000;
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    auto file = db.getOrCreateChildFile(
+        *watcher, dir, w_string::build("f", i), w_clock_t{i, time_t(i)});
+    db.markFileChanged(*watcher, file, w_clock_t{i, time_t(i)});
+  }
+
+  auto start = db.getAgeOutStart(2000);
+  ASSERT_NE(nullptr, start);
+  EXPECT_NE(db.getLatestFile(), start);
+  EXPECT_GT(start->otime.timestamp, 2000);
+  size_t numOld = 0;
+  for (auto file = start; file; file = file->next) {
+    if (file->otime.timestamp <= 2000) {
+      ++numOld;
+    }
+  }
+  // Every file old enough to age out comes after the start
+  EXPECT_EQ(2001, numOld);
+
+  // A checkpointed file that moves to the head is still a valid start
+  db.markFileChanged(*watcher, start, w_clock_t{numFiles, time_t(numFiles)});
+  EXPECT_EQ(db.getLatestFile(), db.getAgeOutStart(2000));
+
+  // The checkpoints are discarded if the clock goes backwards
+  EXPECT_NE(db.getLatestFile(), db.getAgeOutStart(3000));
+  auto old = dir->getChildFile("f10");
+  ASSERT_NE(nullptr, old);
+  db.markFileChanged(*watcher, old, w_clock_t{numFiles + 1, 5});
+  EXPECT_EQ(old, db.getAgeOutStart(3000));
+}
+
+TEST_F(InMemoryViewTest, view_snapshot_rejects_other_root) {
+  ViewSnapshotClock clock;
+  clock.epochs.push_back(ClockEpoch::current(ClockPosition(1, 1)));
+  ViewDatabase original{w_string{"/other"}};
+  auto data = serializeViewSnapshot(original, clock);
+
+  ViewDatabase loaded{root_path};
+  ViewSnapshotClock loadedClock;
+  EXPECT_THROW(
+      loadViewSnapshot(
+          loaded, *watcher, folly::StringPiece(data), loadedClock),
+      std::runtime_error);
+
+  // Truncated data is rejected rather than read past the end
+  ViewDatabase truncated{root_path};
+  EXPECT_THROW(
+      loadViewSnapshot(
+          truncated,
+          *watcher,
+          folly::StringPiece(data).subpiece(0, 10),
+          loadedClock),
+      std::runtime_error);
+
+  // A snapshot must say which clocks its files were observed with
+  ViewDatabase unclocked{root_path};
+  auto noEpochs = serializeViewSnapshot(unclocked, ViewSnapshotClock{});
+  EXPECT_THROW(
+      loadViewSnapshot(
+          unclocked, *watcher, folly::StringPiece(noEpochs), loadedClock),
+      std::runtime_error);
+}
+
+TEST_F(InMemoryViewTest, view_snapshot_keeps_deleted_files) {
+  ViewDatabase original{root_path};
+  auto dir = original.resolveDir(root_path, true);
+  auto kept = original.getOrCreateChildFile(
+      *watcher, dir, w_string{"kept.txt"}, w_clock_t{2, 20});
+  kept->exists = true;
+  original.markFileChanged(*watcher, kept, w_clock_t{2, 20});
+  auto gone = original.getOrCreateChildFile(
+      *watcher, dir, w_string{"gone.txt"}, w_clock_t{3, 30});
+  gone->exists = false;
+  original.markFileChanged(*watcher, gone, w_clock_t{5, 50});
+
+  ViewSnapshotClock clock;
+  clock.epochs.push_back(ClockEpoch::current(ClockPosition(1, 5)));
+  auto data = serializeViewSnapshot(original, clock);
+
+  ViewDatabase loaded{root_path};
+  ViewSnapshotClock loadedClock;
+  EXPECT_EQ(
+      2,
+      loadViewSnapshot(
+          loaded, *watcher, folly::StringPiece(data), loadedClock));
+  auto file = loaded.getLatestFile();
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ(w_string_piece("gone.txt"), file->getName());
+  EXPECT_FALSE(file->exists);
+  EXPECT_EQ(5, file->otime.ticks);
+  EXPECT_EQ(3, file->ctime.ticks);
+  file = file->next;
+  ASSERT_NE(nullptr, file);
+  EXPECT_EQ(w_string_piece("kept.txt"), file->getName());
+  EXPECT_TRUE(file->exists);
+  EXPECT_EQ(2, file->otime.ticks);
+
+  // A file observed after the snapshot's clock is corrupt
+  clock.epochs.back().ticks = 4;
+  auto future = serializeViewSnapshot(original, clock);
+  ViewDatabase rejected{root_path};
+  EXPECT_THROW(
+      loadViewSnapshot(
+          rejected, *watcher, folly::StringPiece(future), loadedClock),
+      std::runtime_error);
+}
+
+TEST_F(InMemoryViewTest, clocks_of_restored_epochs_are_honored) {
+  // A clock issued by an earlier process, for its root number 3
+  ClockSpec spec{ClockPosition(3, 10)};
+  spec.clock.pid += 1;
+  std::vector<ClockEpoch> epochs{
+      ClockEpoch{spec.clock.start_time, spec.clock.pid, 3, 20}};
+  ClockPosition now(1, 30);
+
+  auto since = spec.evaluate(now, 0, nullptr, &epochs);
+  EXPECT_FALSE(since.clock.is_fresh_instance);
+  EXPECT_EQ(10, since.clock.ticks);
+
+  // Unless it's aged out since
+  EXPECT_TRUE(spec.evaluate(now, 15, nullptr, &epochs).clock.is_fresh_instance);
+
+  // Without the epoch, or past its end, it means nothing to us
+  EXPECT_TRUE(spec.evaluate(now, 0).clock.is_fresh_instance);
+  spec.clock.position.ticks = 25;
+  EXPECT_TRUE(spec.evaluate(now, 0, nullptr, &epochs).clock.is_fresh_instance);
+  spec.clock.position = ClockPosition(4, 10);
+  EXPECT_TRUE(spec.evaluate(now, 0, nullptr, &epochs).clock.is_fresh_instance);
+}
+
+// Reports that every event up to now has already been processed
+class SequencedWatcher : public FakeWatcher {
+ public:
+  using FakeWatcher::FakeWatcher;
+
+  folly::SemiFuture<folly::Unit> syncToSequencePosition() override {
+    ++syncs;
+    return folly::makeSemiFuture();
+  }
+
+  int syncs{0};
+};
+
+TEST_F(InMemoryViewTest, sequenced_watcher_syncs_without_cookies) {
+  fs.defineContents({"/root"});
+  auto sequenced = std::make_shared<SequencedWatcher>(fs);
+  auto sequencedView =
+      std::make_shared<InMemoryView>(fs, root_path, config, sequenced);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      config,
+      sequencedView,
+      [] {});
+
+  std::vector<w_string> cookieFileNames;
+  sequencedView->syncToNow(root, std::chrono::seconds(1), cookieFileNames);
+  EXPECT_EQ(1, sequenced->syncs);
+  EXPECT_TRUE(cookieFileNames.empty());
+  EXPECT_TRUE(root->cookies.getOutstandingCookieFileList().empty());
+}
+
+// Reports the metadata of the changes that it is told about
+class NotifyingWatcher : public FakeWatcher {
+ public:
+  using FakeWatcher::FakeWatcher;
+
+  std::unordered_map<w_string, FileInformation> takeNotifiedStats() override {
+    return std::move(stats);
+  }
+
+  std::unordered_map<w_string, FileInformation> stats;
+};
+
+TEST_F(InMemoryViewTest, notified_stats_replace_stat) {
+  fs.defineContents({"/root/file.txt"});
+  auto notifying = std::make_shared<NotifyingWatcher>(fs);
+  auto notifyingView =
+      std::make_shared<InMemoryView>(fs, root_path, config, notifying);
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      config,
+      notifyingView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, notifyingView->stepIoThread(root, state, pending));
+
+  // The filesystem still says 0 bytes, so the size can only come from the
+  // watcher
+  auto st = fs.getFileInformation("/root/file.txt");
+  st.size = 42;
+  notifying->stats.emplace("/root/file.txt", st);
+  pending.lock()->add("/root/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, notifyingView->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  notifyingView->pathGenerator(&query, &ctx);
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_STREQ("file.txt", ctx.resultsArray.at(0).get("name").asCString());
+  EXPECT_EQ(42, ctx.resultsArray.at(0).get("size").asInt());
 }
 
 } // namespace
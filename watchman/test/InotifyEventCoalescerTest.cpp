@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/InotifyEventCoalescer.h"
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_INOTIFY_INIT
+
+using namespace watchman;
+
+namespace {
+
+// Appends an event to buf as the kernel lays it out, with the name padded
+// to a multiple of the event size
+void addEvent(
+    std::vector<char>& buf,
+    int wd,
+    uint32_t mask,
+    const char* name = nullptr,
+    uint32_t cookie = 0) {
+  size_t nameLen = name ? strlen(name) + 1 : 0;
+  size_t len = (nameLen + sizeof(inotify_event) - 1) / sizeof(inotify_event) *
+      sizeof(inotify_event);
+  size_t offset = buf.size();
+  buf.resize(offset + sizeof(inotify_event) + len, 0);
+  auto ine = reinterpret_cast<inotify_event*>(buf.data() + offset);
+  ine->wd = wd;
+  ine->mask = mask;
+  ine->cookie = cookie;
+  ine->len = uint32_t(len);
+  if (name) {
+    memcpy(ine->name, name, nameLen);
+  }
+}
+
+// Describes the events of buf that the coalescer lets through
+std::vector<std::string> kept(
+    InotifyEventCoalescer& coalescer,
+    std::vector<char>& buf) {
+  std::vector<std::string> result;
+  forEachInotifyEvent(buf.data(), buf.size(), [&](inotify_event* ine) {
+    if (!coalescer.coalesce(ine)) {
+      result.push_back(
+          std::to_string(ine->wd) + ":" + std::to_string(ine->mask) + ":" +
+          (ine->len > 0 ? ine->name : ""));
+    }
+  });
+  return result;
+}
+
+std::string describe(int wd, uint32_t mask, const char* name = "") {
+  return std::to_string(wd) + ":" + std::to_string(mask) + ":" + name;
+}
+
+} // namespace
+
+TEST(InotifyEventCoalescerTest, walks_every_event) {
+  std::vector<char> buf;
+  addEvent(buf, 1, IN_MODIFY, "a");
+  addEvent(buf, 1, IN_ATTRIB);
+  addEvent(buf, 2, IN_CREATE, "a-name-that-needs-more-than-one-block");
+  addEvent(buf, 3, IN_DELETE, "b");
+
+  std::vector<std::string> names;
+  forEachInotifyEvent(buf.data(), buf.size(), [&](inotify_event* ine) {
+    names.push_back(ine->len > 0 ? ine->name : "");
+  });
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "a", "", "a-name-that-needs-more-than-one-block", "b"}),
+      names);
+}
+
+TEST(InotifyEventCoalescerTest, drops_repeated_subset_events) {
+  std::vector<char> buf;
+  addEvent(buf, 1, IN_MODIFY, "a");
+  // Same path and flags
+  addEvent(buf, 1, IN_MODIFY, "a");
+  addEvent(buf, 1, IN_ATTRIB, "a");
+  // Adds W_PENDING_RECURSIVE, so it is kept
+  addEvent(buf, 1, IN_CREATE, "a");
+  // A subset of what was added for it by now
+  addEvent(buf, 1, IN_MODIFY, "a");
+  addEvent(buf, 1, IN_DELETE, "a");
+  // Other paths
+  addEvent(buf, 1, IN_MODIFY, "b");
+  addEvent(buf, 2, IN_MODIFY, "a");
+  // The dir itself
+  addEvent(buf, 1, IN_ATTRIB);
+  addEvent(buf, 1, IN_MODIFY);
+
+  InotifyEventCoalescer coalescer;
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          describe(1, IN_MODIFY, "a"),
+          describe(1, IN_CREATE, "a"),
+          describe(1, IN_MODIFY, "b"),
+          describe(2, IN_MODIFY, "a"),
+          describe(1, IN_ATTRIB)}),
+      kept(coalescer, buf));
+}
+
+TEST(InotifyEventCoalescerTest, never_drops_uncoalescable_events) {
+  std::vector<char> buf;
+  for (int i = 0; i < 2; ++i) {
+    addEvent(buf, 1, IN_MODIFY, "a");
+    addEvent(buf, 1, IN_MOVED_FROM, "a", 7);
+    addEvent(buf, 1, IN_MOVED_TO, "a", 7);
+    addEvent(buf, 1, IN_MOVED_FROM | IN_ISDIR, "a", 8);
+    addEvent(buf, 1, IN_DELETE_SELF);
+    addEvent(buf, 1, IN_MOVE_SELF);
+    addEvent(buf, 1, IN_UNMOUNT);
+    addEvent(buf, 1, IN_IGNORED);
+    addEvent(buf, -1, IN_Q_OVERFLOW);
+  }
+
+  InotifyEventCoalescer coalescer;
+  auto result = kept(coalescer, buf);
+  std::vector<std::string> expected;
+  for (int i = 0; i < 2; ++i) {
+    if (i == 0) {
+      expected.push_back(describe(1, IN_MODIFY, "a"));
+    }
+    expected.push_back(describe(1, IN_MOVED_FROM, "a"));
+    expected.push_back(describe(1, IN_MOVED_TO, "a"));
+    expected.push_back(describe(1, IN_MOVED_FROM | IN_ISDIR, "a"));
+    expected.push_back(describe(1, IN_DELETE_SELF));
+    expected.push_back(describe(1, IN_MOVE_SELF));
+    expected.push_back(describe(1, IN_UNMOUNT));
+    expected.push_back(describe(1, IN_IGNORED));
+    expected.push_back(describe(-1, IN_Q_OVERFLOW));
+  }
+  EXPECT_EQ(expected, result);
+}
+
+TEST(InotifyEventCoalescerTest, forgets_events_on_reset) {
+  InotifyEventCoalescer coalescer;
+  std::vector<char> buf;
+  addEvent(buf, 1, IN_MODIFY, "a");
+  addEvent(buf, 1, IN_MODIFY, "b");
+  EXPECT_EQ(2, kept(coalescer, buf).size());
+  EXPECT_TRUE(kept(coalescer, buf).empty());
+
+  // The next read overwrites the buffer, including the names that the
+  // coalescer referred to
+  coalescer.reset();
+  std::vector<char> next;
+  addEvent(next, 1, IN_MODIFY, "b");
+  addEvent(next, 1, IN_MODIFY, "c");
+  ASSERT_EQ(buf.size(), next.size());
+  memcpy(buf.data(), next.data(), next.size());
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          describe(1, IN_MODIFY, "b"), describe(1, IN_MODIFY, "c")}),
+      kept(coalescer, buf));
+  EXPECT_TRUE(kept(coalescer, buf).empty());
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/IoThrottle.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+IoThrottle::Config config(size_t minConcurrency, size_t maxConcurrency) {
+  IoThrottle::Config config;
+  config.minConcurrency = minConcurrency;
+  config.maxConcurrency = maxConcurrency;
+  config.latencyRatio = 2;
+  config.minLatency = 1ms;
+  return config;
+}
+
+// Records a full window of samples of `latency`
+void window(
+    IoThrottle& throttle,
+    IoThrottle::Clock::duration latency,
+    IoThrottle::Kind kind = IoThrottle::Kind::Metadata) {
+  for (size_t i = 0; i < IoThrottle::kWindowSamples; ++i) {
+    throttle.record(kind, latency);
+  }
+}
+
+} // namespace
+
+TEST(IoThrottleTest, waits_for_a_slot) {
+  IoThrottle throttle{config(1, 2)};
+  auto a = throttle.acquire();
+  auto b = throttle.acquire();
+  auto c = throttle.acquire();
+  EXPECT_TRUE(a.isReady());
+  EXPECT_TRUE(b.isReady());
+  EXPECT_FALSE(c.isReady());
+  EXPECT_EQ(1, throttle.stats().waiting);
+
+  // Releasing a slot hands it to the waiter
+  { auto slot = std::move(a).get(); }
+  EXPECT_TRUE(c.isReady());
+  auto stats = throttle.stats();
+  EXPECT_EQ(2, stats.running);
+  EXPECT_EQ(0, stats.waiting);
+  EXPECT_EQ(1, stats.throttled);
+}
+
+TEST(IoThrottleTest, backs_off_when_latency_rises) {
+  IoThrottle throttle{config(1, 8)};
+  window(throttle, 2ms);
+  EXPECT_EQ(8, throttle.limit());
+
+  window(throttle, 10ms);
+  EXPECT_EQ(6, throttle.limit());
+  window(throttle, 10ms);
+  EXPECT_EQ(4, throttle.limit());
+  for (int i = 0; i < 10; ++i) {
+    window(throttle, 10ms);
+  }
+  EXPECT_EQ(1, throttle.limit());
+
+  // Speeds up again once the latency is back to normal
+  window(throttle, 2ms);
+  window(throttle, 2ms);
+  EXPECT_EQ(3, throttle.limit());
+}
+
+TEST(IoThrottleTest, ignores_latencies_below_the_floor) {
+  IoThrottle throttle{config(1, 8)};
+  // As from the page cache
+  window(throttle, 10us);
+  window(throttle, 500us);
+  EXPECT_EQ(8, throttle.limit());
+}
+
+TEST(IoThrottleTest, measures_kinds_separately) {
+  IoThrottle throttle{config(1, 8)};
+  window(throttle, 2ms, IoThrottle::Kind::Metadata);
+  // Reads are slower than stats, but no slower than they were
+  window(throttle, 20ms, IoThrottle::Kind::Data);
+  window(throttle, 20ms, IoThrottle::Kind::Data);
+  EXPECT_EQ(8, throttle.limit());
+
+  // Reads of 4MiB are no slower per MiB
+  for (size_t i = 0; i < IoThrottle::kWindowSamples; ++i) {
+    throttle.record(IoThrottle::Kind::Data, 80ms, 4);
+  }
+  EXPECT_EQ(8, throttle.limit());
+}
+
+TEST(IoThrottleTest, granted_slots_follow_a_raised_limit) {
+  IoThrottle throttle{config(1, 2)};
+  window(throttle, 2ms);
+  window(throttle, 10ms);
+  EXPECT_EQ(1, throttle.limit());
+
+  auto a = throttle.acquire();
+  auto b = throttle.acquire();
+  EXPECT_FALSE(b.isReady());
+  window(throttle, 2ms);
+  EXPECT_EQ(2, throttle.limit());
+  EXPECT_TRUE(b.isReady());
+}
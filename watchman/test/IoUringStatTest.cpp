@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/IoUringStat.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <sys/stat.h>
+#include <memory>
+#include <string>
+#include <system_error>
+
+using namespace watchman;
+
+namespace {
+
+std::unique_ptr<IoUringStat> makeIoUringStat(unsigned entries) {
+  try {
+    return std::make_unique<IoUringStat>(entries);
+  } catch (const std::system_error&) {
+    return nullptr;
+  }
+}
+
+} // namespace
+
+TEST(IoUringStatTest, matches_lstat) {
+  // So that the batch needs more than one trip around the ring
+  auto statter = makeIoUringStat(4);
+  if (!statter) {
+    GTEST_SKIP() << "io_uring is not available";
+  }
+
+  folly::test::TemporaryDirectory dir;
+  std::vector<w_string> paths;
+  for (size_t i = 0; i < 20; ++i) {
+    auto path = (dir.path() / ("file" + std::to_string(i))).string();
+    ASSERT_TRUE(folly::writeFile(std::string(i, 'x'), path.c_str()));
+    paths.emplace_back(path.c_str());
+  }
+  auto link = (dir.path() / "link").string();
+  ASSERT_EQ(0, symlink("nowhere", link.c_str()));
+  paths.emplace_back(link.c_str());
+  auto missing = (dir.path() / "missing").string();
+  paths.emplace_back(missing.c_str());
+
+  auto results = statter->statAll(paths);
+  ASSERT_EQ(paths.size(), results.size());
+
+  for (size_t i = 0; i < 21; ++i) {
+    ASSERT_TRUE(results[i].has_value()) << paths[i].c_str();
+    struct stat st;
+    ASSERT_EQ(0, lstat(paths[i].c_str(), &st));
+    FileInformation expected(st);
+    EXPECT_EQ(expected.mode, results[i]->mode);
+    EXPECT_EQ(expected.size, results[i]->size);
+    EXPECT_EQ(expected.ino, results[i]->ino);
+    EXPECT_EQ(expected.dev, results[i]->dev);
+    EXPECT_EQ(expected.mtime.tv_sec, results[i]->mtime.tv_sec);
+    EXPECT_EQ(expected.mtime.tv_nsec, results[i]->mtime.tv_nsec);
+  }
+  EXPECT_EQ(19, results[19]->size);
+  // The link itself is stat'd, not its target
+  EXPECT_TRUE(results[20]->isSymlink());
+  EXPECT_FALSE(results[21].has_value());
+
+  // The ring can be reused
+  EXPECT_TRUE(statter->statAll(paths)[0].has_value());
+}
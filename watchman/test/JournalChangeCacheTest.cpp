@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/JournalChangeCache.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+
+using namespace watchman;
+
+namespace {
+
+std::vector<std::string> sorted(std::vector<std::string> names) {
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+using Names = std::vector<std::string>;
+
+} // namespace
+
+TEST(JournalChangeCacheTest, unions_batches_since_position) {
+  JournalChangeCache cache{100};
+  cache.reset(1, 10);
+  cache.append(1, 10, 12, {"a", "b"}, {});
+  cache.append(1, 12, 15, {"b", "c"}, {"d"});
+  cache.append(1, 15, 16, {"d"}, {"e"});
+  EXPECT_EQ(16, cache.endSequence());
+
+  auto all = cache.changesSince(1, 10);
+  ASSERT_TRUE(all.has_value());
+  EXPECT_EQ((Names{"a", "b", "c"}), sorted(all->changed));
+  // Created within the range, even though it changed afterwards
+  EXPECT_EQ((Names{"d", "e"}), sorted(all->created));
+
+  auto recent = cache.changesSince(1, 15);
+  ASSERT_TRUE(recent.has_value());
+  EXPECT_EQ((Names{"d"}), recent->changed);
+  EXPECT_EQ((Names{"e"}), recent->created);
+
+  auto none = cache.changesSince(1, 16);
+  ASSERT_TRUE(none.has_value());
+  EXPECT_TRUE(none->changed.empty());
+  EXPECT_TRUE(none->created.empty());
+}
+
+TEST(JournalChangeCacheTest, rejects_positions_it_does_not_cover) {
+  JournalChangeCache cache{100};
+  cache.reset(1, 10);
+  cache.append(1, 10, 12, {"a"}, {});
+
+  EXPECT_FALSE(cache.changesSince(1, 9).has_value());
+  EXPECT_FALSE(cache.changesSince(1, 13).has_value());
+  EXPECT_FALSE(cache.changesSince(2, 12).has_value());
+
+  cache.clear();
+  EXPECT_FALSE(cache.changesSince(1, 12).has_value());
+}
+
+TEST(JournalChangeCacheTest, gap_restarts_cache) {
+  JournalChangeCache cache{100};
+  cache.reset(1, 10);
+  cache.append(1, 10, 12, {"a"}, {});
+  // Changes between 12 and 14 were never recorded
+  cache.append(1, 14, 15, {"b"}, {});
+
+  EXPECT_EQ(15, cache.endSequence());
+  EXPECT_FALSE(cache.changesSince(1, 12).has_value());
+  EXPECT_TRUE(cache.changesSince(1, 15).has_value());
+
+  // As does a new mount generation
+  cache.append(2, 15, 16, {"c"}, {});
+  EXPECT_FALSE(cache.isValid(1));
+  EXPECT_TRUE(cache.isValid(2));
+  EXPECT_FALSE(cache.changesSince(2, 15).has_value());
+}
+
+TEST(JournalChangeCacheTest, discards_oldest_batches_beyond_limit) {
+  JournalChangeCache cache{3};
+  cache.reset(1, 0);
+  cache.append(1, 0, 1, {"a", "b"}, {});
+  cache.append(1, 1, 2, {"c"}, {});
+  EXPECT_EQ(3, cache.numPaths());
+  EXPECT_TRUE(cache.changesSince(1, 0).has_value());
+
+  cache.append(1, 2, 3, {"d"}, {});
+  EXPECT_EQ(2, cache.numPaths());
+  EXPECT_FALSE(cache.changesSince(1, 0).has_value());
+  auto changes = cache.changesSince(1, 1);
+  ASSERT_TRUE(changes.has_value());
+  EXPECT_EQ((Names{"c", "d"}), sorted(changes->changed));
+
+  // A batch that doesn't fit on its own leaves nothing to answer from
+  cache.append(1, 3, 4, {"e", "f", "g", "h"}, {});
+  EXPECT_EQ(0, cache.numPaths());
+  EXPECT_FALSE(cache.changesSince(1, 3).has_value());
+  EXPECT_TRUE(cache.changesSince(1, 4).has_value());
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <string>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/thirdparty/jansson/utf.h"
+
+#define UTF8_PILE_OF_POO "\xf0\x9f\x92\xa9"
+
+namespace {
+
+std::string dumpString(const char* str, size_t flags = 0) {
+  return json_dumps(typed_string_to_json(str), flags | JSON_ENCODE_ANY);
+}
+
+} // namespace
+
+TEST(JsonTest, plain_prefix_stops_at_bytes_that_need_attention) {
+  EXPECT_EQ(0u, json_plain_prefix("", 0));
+  EXPECT_EQ(5u, json_plain_prefix("hello", 5));
+  // Long enough to exercise the block scans
+  std::string plain(100, 'a');
+  EXPECT_EQ(100u, json_plain_prefix(plain.data(), plain.size()));
+  for (char c : {'"', '\\', '\n', '\x1f', '\x80', '\xff'}) {
+    for (size_t at : {0, 7, 8, 15, 16, 40, 99}) {
+      auto str = plain;
+      str[at] = c;
+      EXPECT_EQ(at, json_plain_prefix(str.data(), str.size()))
+          << "byte " << int((unsigned char)c) << " at " << at;
+    }
+  }
+}
+
+TEST(JsonTest, escapes_strings) {
+  EXPECT_EQ("\"a/b c\"", dumpString("a/b c"));
+  EXPECT_EQ("\"a\\/b\"", dumpString("a/b", JSON_ESCAPE_SLASH));
+  EXPECT_EQ("\"q\\\"b\\\\n\\n\\t\\u0001\"", dumpString("q\"b\\n\n\t\x01"));
+  EXPECT_EQ(
+      "\"\xc3\xa9" UTF8_PILE_OF_POO "\"",
+      dumpString("\xc3\xa9" UTF8_PILE_OF_POO));
+  EXPECT_EQ(
+      "\"\\u00e9\\ud83d\\udca9\"",
+      dumpString("\xc3\xa9" UTF8_PILE_OF_POO, JSON_ENSURE_ASCII));
+  // Invalid UTF-8 can't be encoded
+  EXPECT_THROW(dumpString("a\xc3"), std::runtime_error);
+}
+
+TEST(JsonTest, round_trips_values_larger_than_the_output_buffer) {
+  auto paths = json_array();
+  for (int i = 0; i < 2000; ++i) {
+    auto path = std::string("dir/") + std::to_string(i) + "/\xc3\xa9\t\"file\"";
+    json_array_append(paths, typed_string_to_json(path.c_str()));
+  }
+  auto value = json_object({
+      {"paths", paths},
+      {"count", json_integer(-1234567890123)},
+      {"fresh", json_true()},
+  });
+
+  auto encoded = json_dumps(value, JSON_COMPACT | JSON_SORT_KEYS);
+  json_error_t error;
+  auto decoded = json_loadb(encoded.data(), encoded.size(), 0, &error);
+  ASSERT_TRUE(decoded) << error.text;
+  EXPECT_EQ(encoded, json_dumps(decoded, JSON_COMPACT | JSON_SORT_KEYS));
+  EXPECT_EQ(-1234567890123, json_integer_value(decoded.get("count")));
+  EXPECT_EQ(int(encoded.size()), error.position);
+
+  auto fromString = json_loads(encoded.c_str(), 0, &error);
+  ASSERT_TRUE(fromString) << error.text;
+  EXPECT_EQ(encoded, json_dumps(fromString, JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+TEST(JsonTest, reports_where_strings_go_wrong) {
+  json_error_t error;
+  const char newline[] = "[\"abcdefghijklmnopqrstuvwxyz\n\"]";
+  EXPECT_FALSE(json_loadb(newline, sizeof(newline) - 1, 0, &error));
+  EXPECT_STREQ("unexpected newline", error.text);
+  EXPECT_EQ(1, error.line);
+  EXPECT_EQ(28, error.column);
+
+  const char unterminated[] = "[\"abcdefghijklmnopqrstuvwxyz";
+  EXPECT_FALSE(json_loadb(unterminated, sizeof(unterminated) - 1, 0, &error));
+  EXPECT_STREQ("premature end of input", error.text);
+
+  const char shortString[] = "[\"ab\x01\"]";
+  EXPECT_FALSE(json_loadb(shortString, sizeof(shortString) - 1, 0, &error));
+  EXPECT_STREQ("control character 0x1 near '\"ab'", error.text);
+  EXPECT_EQ(4, error.column);
+}
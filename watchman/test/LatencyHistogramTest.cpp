@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/LatencyHistogram.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(LatencyHistogramTest, buckets_are_contiguous_and_bounded) {
+  size_t previous = 0;
+  for (uint64_t micros = 0; micros < 100000; ++micros) {
+    auto bucket = LatencyHistogram::bucketFor(micros);
+    ASSERT_TRUE(bucket == previous || bucket == previous + 1) << micros;
+    ASSERT_LE(micros, LatencyHistogram::bucketUpperBound(bucket));
+    if (bucket > 0) {
+      ASSERT_GT(micros, LatencyHistogram::bucketUpperBound(bucket - 1));
+    }
+    // The width of a bucket is within 1/kSubBuckets of its values
+    ASSERT_LE(
+        LatencyHistogram::bucketUpperBound(bucket) - micros,
+        micros / LatencyHistogram::kSubBuckets);
+    previous = bucket;
+  }
+  EXPECT_EQ(
+      LatencyHistogram::kNumBuckets - 1,
+      LatencyHistogram::bucketFor(~uint64_t(0)));
+}
+
+TEST(LatencyHistogramTest, percentiles) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0us, histogram.snapshot().percentile(0.5));
+
+  for (int i = 1; i <= 100; ++i) {
+    histogram.record(std::chrono::milliseconds(i));
+  }
+  auto snap = histogram.snapshot();
+  EXPECT_EQ(100, snap.count);
+  EXPECT_EQ(100000us, snap.max);
+
+  // Percentiles are reported to within the width of their bucket
+  auto within = [](std::chrono::microseconds actual, int64_t expected) {
+    auto slack = expected / int64_t(LatencyHistogram::kSubBuckets);
+    return actual.count() >= expected && actual.count() <= expected + slack;
+  };
+  EXPECT_TRUE(within(snap.percentile(0.5), 50000));
+  EXPECT_TRUE(within(snap.percentile(0.9), 90000));
+  EXPECT_TRUE(within(snap.percentile(0.99), 99000));
+  // Never more than the largest duration that was recorded
+  EXPECT_EQ(100000us, snap.percentile(1.0));
+}
+
+TEST(LatencyHistogramTest, merges_concurrent_recordings) {
+  LatencyHistogram histogram;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&histogram, t] {
+      for (int i = 0; i < 1000; ++i) {
+        histogram.record(std::chrono::microseconds(t * 1000 + i));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto snap = histogram.snapshot();
+  EXPECT_EQ(8000, snap.count);
+  EXPECT_EQ(7999us, snap.max);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/LatencyProbe.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+struct ProbeDir {
+  folly::test::TemporaryDirectory dir{"latencyprobe"};
+  w_string prefix{w_string::build(dir.path().string(), "/cookie-")};
+
+  w_string canary(uint64_t serial) const {
+    return w_string::build(prefix, "probe", serial);
+  }
+};
+
+} // namespace
+
+TEST(LatencyProbeTest, times_each_stage) {
+  ProbeDir dir;
+  LatencyProbe probe;
+  auto start = LatencyProbe::Clock::now();
+
+  ASSERT_TRUE(probe.writeCanary(dir.prefix, start));
+  // Other cookies aren't the canary
+  EXPECT_FALSE(probe.observe(w_string::build(dir.prefix, 1), start, start));
+  EXPECT_TRUE(probe.observe(dir.canary(1), start + 2ms, start + 5ms));
+  // Nor is the report of its removal
+  EXPECT_FALSE(probe.observe(dir.canary(1), start + 6ms, start + 6ms));
+  probe.settled(start + 105ms);
+  probe.dispatched(start + 110ms);
+  // Only the first subscription counts
+  probe.dispatched(start + 200ms);
+
+  auto expect = [&](LatencyProbe::Stage stage, std::chrono::microseconds d) {
+    auto latency = probe.getLatency(stage);
+    EXPECT_EQ(1, latency.count);
+    EXPECT_EQ(d, latency.max);
+  };
+  expect(LatencyProbe::Watcher, 2ms);
+  expect(LatencyProbe::Process, 3ms);
+  expect(LatencyProbe::Settle, 100ms);
+  expect(LatencyProbe::Dispatch, 5ms);
+  expect(LatencyProbe::Total, 110ms);
+  EXPECT_EQ(0, probe.getLostCanaries());
+}
+
+TEST(LatencyProbeTest, unreported_canaries_are_lost) {
+  ProbeDir dir;
+  LatencyProbe probe;
+  auto start = LatencyProbe::Clock::now();
+
+  ASSERT_TRUE(probe.writeCanary(dir.prefix, start));
+  ASSERT_TRUE(probe.writeCanary(dir.prefix, start + 1s));
+  EXPECT_EQ(1, probe.getLostCanaries());
+
+  // The first canary is no longer awaited
+  EXPECT_FALSE(probe.observe(dir.canary(1), start + 1s, start + 1s));
+  EXPECT_TRUE(probe.observe(dir.canary(2), start + 1s, start + 1s));
+  EXPECT_EQ(1, probe.getLatency(LatencyProbe::Watcher).count);
+}
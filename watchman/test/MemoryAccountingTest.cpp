@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryAccounting.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+using namespace watchman;
+
+TEST(MemoryAccounting, allocations_are_balanced_across_threads) {
+  auto before = getMemoryUsage(MemoryCategory::CacheEntries);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([] {
+      for (int i = 0; i < 1000; ++i) {
+        recordAllocation(MemoryCategory::CacheEntries, 48);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto during = getMemoryUsage(MemoryCategory::CacheEntries);
+  EXPECT_EQ(before.bytes + 8 * 1000 * 48, during.bytes);
+  EXPECT_EQ(before.allocations + 8 * 1000, during.allocations);
+
+  // Memory may be released by a different thread than allocated it
+  for (int i = 0; i < 8 * 1000; ++i) {
+    recordDeallocation(MemoryCategory::CacheEntries, 48);
+  }
+  auto after = getMemoryUsage(MemoryCategory::CacheEntries);
+  EXPECT_EQ(before.bytes, after.bytes);
+  EXPECT_EQ(before.allocations, after.allocations);
+}
+
+TEST(MemoryAccounting, reallocation_only_changes_bytes) {
+  auto before = getMemoryUsage(MemoryCategory::ClientBuffers);
+  recordAllocation(MemoryCategory::ClientBuffers, 100);
+  recordReallocation(MemoryCategory::ClientBuffers, 100, 400);
+
+  auto during = getMemoryUsage(MemoryCategory::ClientBuffers);
+  EXPECT_EQ(before.bytes + 400, during.bytes);
+  EXPECT_EQ(before.allocations + 1, during.allocations);
+
+  recordDeallocation(MemoryCategory::ClientBuffers, 400);
+  auto after = getMemoryUsage(MemoryCategory::ClientBuffers);
+  EXPECT_EQ(before.bytes, after.bytes);
+  EXPECT_EQ(before.allocations, after.allocations);
+}
+
+TEST(MemoryAccounting, strings_are_accounted) {
+  auto before = getMemoryUsage(MemoryCategory::Strings);
+  {
+    w_string str("some/path/to/a/file", W_STRING_BYTE);
+    auto copy = str;
+    auto joined = w_string::pathCat({str, "other"});
+    auto formatted = w_string::format("{}:{}", str, 42);
+
+    auto during = getMemoryUsage(MemoryCategory::Strings);
+    // The copy shares the storage of the original
+    EXPECT_EQ(before.allocations + 3, during.allocations);
+    EXPECT_GT(during.bytes, before.bytes);
+  }
+  auto after = getMemoryUsage(MemoryCategory::Strings);
+  EXPECT_EQ(before.bytes, after.bytes);
+  EXPECT_EQ(before.allocations, after.allocations);
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryBudget.h"
+#include <folly/portability/GTest.h>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Roots that give back all of their memory when reclaimed
+struct FakeRoots {
+  struct Root {
+    const char* name;
+    size_t bytes;
+    std::chrono::steady_clock::time_point lastUsed;
+  };
+  std::vector<Root> roots;
+  std::vector<std::string> reclaimed;
+
+  MemoryBudget::ListConsumers lister() {
+    return [this] {
+      std::vector<MemoryBudget::Consumer> consumers;
+      for (auto& root : roots) {
+        consumers.push_back(MemoryBudget::Consumer{
+            w_string{root.name}, root.bytes, root.lastUsed, [this, &root] {
+              reclaimed.push_back(root.name);
+              root.bytes = 0;
+            }});
+      }
+      return consumers;
+    };
+  }
+};
+
+const std::chrono::steady_clock::time_point kStart{};
+
+} // namespace
+
+TEST(MemoryBudgetTest, unlimited_never_reclaims) {
+  FakeRoots fake;
+  fake.roots = {{"a", 1000, kStart}};
+  MemoryBudget budget{0, fake.lister()};
+  budget.enforce([] { return size_t(1000000); });
+  EXPECT_TRUE(fake.reclaimed.empty());
+  EXPECT_FALSE(budget.underPressure());
+}
+
+TEST(MemoryBudgetTest, under_budget_leaves_roots_alone) {
+  FakeRoots fake;
+  fake.roots = {{"a", 300, kStart}, {"b", 300, kStart}};
+  MemoryBudget budget{1000, fake.lister()};
+  budget.enforce([] { return size_t(100); });
+  EXPECT_TRUE(fake.reclaimed.empty());
+  EXPECT_FALSE(budget.underPressure());
+}
+
+TEST(MemoryBudgetTest, reclaims_least_recently_used_first) {
+  FakeRoots fake;
+  fake.roots = {
+      {"recent", 400, kStart + 3s},
+      {"oldest", 400, kStart + 1s},
+      {"older", 400, kStart + 2s}};
+  MemoryBudget budget{1000, fake.lister()};
+  budget.enforce([] { return size_t(100); });
+
+  // 1300 bytes; reclaiming the oldest gets to 900, which is at the low
+  // watermark
+  EXPECT_EQ(std::vector<std::string>{"oldest"}, fake.reclaimed);
+  EXPECT_FALSE(budget.underPressure());
+}
+
+TEST(MemoryBudgetTest, pressure_lasts_until_below_the_low_watermark) {
+  FakeRoots fake;
+  fake.roots = {{"a", 100, kStart}};
+  size_t used = 1000;
+  MemoryBudget budget{1000, fake.lister()};
+  auto measure = [&] { return used; };
+
+  // Nothing reclaimed is enough to get under budget
+  budget.enforce(measure);
+  EXPECT_EQ(std::vector<std::string>{"a"}, fake.reclaimed);
+  EXPECT_TRUE(budget.underPressure());
+
+  // Back under budget, but not below the low watermark
+  used = 950;
+  budget.enforce(measure);
+  EXPECT_TRUE(budget.underPressure());
+
+  used = 850;
+  budget.enforce(measure);
+  EXPECT_FALSE(budget.underPressure());
+
+  auto report = budget.report();
+  EXPECT_EQ(3, report.get("checks").asInt());
+  EXPECT_EQ(1, report.get("over_budget").asInt());
+  EXPECT_EQ(1, report.get("reclaims").asInt());
+}
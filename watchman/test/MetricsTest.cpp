@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(MetricsTest, groups_samples_by_family) {
+  MetricsWriter writer;
+  writer.add(
+      "watchman_root_recrawls",
+      MetricType::Counter,
+      "Recrawls of the root",
+      {{"root", "/a"}},
+      2);
+  writer.add(
+      "watchman_roots", MetricType::Gauge, "Roots being watched", {}, 2);
+  writer.add(
+      "watchman_root_recrawls",
+      MetricType::Counter,
+      "Recrawls of the root",
+      {{"root", "/b"}},
+      0);
+  writer.add(
+      "watchman_latency_seconds",
+      MetricType::Gauge,
+      "",
+      {{"quantile", "0.5"}},
+      0.25);
+
+  EXPECT_EQ(
+      "# TYPE watchman_root_recrawls counter\n"
+      "# HELP watchman_root_recrawls Recrawls of the root\n"
+      "watchman_root_recrawls_total{root=\"/a\"} 2\n"
+      "watchman_root_recrawls_total{root=\"/b\"} 0\n"
+      "# TYPE watchman_roots gauge\n"
+      "# HELP watchman_roots Roots being watched\n"
+      "watchman_roots 2\n"
+      "# TYPE watchman_latency_seconds gauge\n"
+      "watchman_latency_seconds{quantile=\"0.5\"} 0.25\n"
+      "# EOF\n",
+      writer.render());
+}
+
+TEST(MetricsTest, escapes_label_values) {
+  EXPECT_EQ(
+      "C:\\\\repo \\\"x\\\"\\n",
+      MetricsWriter::escapeLabelValue("C:\\repo \"x\"\n"));
+}
+
+TEST(MetricsTest, registry_runs_every_collector) {
+  MetricsRegistry registry;
+  registry.add("a", [](MetricsWriter& writer) {
+    writer.add("a", MetricType::Gauge, "", {}, 1);
+  });
+  registry.add("b", [](MetricsWriter& writer) {
+    writer.add("b", MetricType::Gauge, "", {}, 2);
+  });
+  EXPECT_EQ(
+      "# TYPE a gauge\na 1\n# TYPE b gauge\nb 2\n# EOF\n", registry.collect());
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include "watchman/NameTable.h"
+
+using namespace watchman;
+
+TEST(NameTableTest, equal_names_share_storage) {
+  NameTable table;
+  auto first = table.intern(w_string_piece("node_modules"));
+  auto second = table.intern(w_string{"node_modules"});
+  EXPECT_EQ(first.data(), second.data());
+  EXPECT_NE(first.data(), table.intern(w_string_piece("src")).data());
+
+  auto stats = table.getStats();
+  EXPECT_EQ(2, stats.names);
+  EXPECT_LT(0, stats.bytes);
+}
+
+TEST(NameTableTest, find_only_returns_interned_names) {
+  NameTable table;
+  EXPECT_EQ(nullptr, table.find("src"));
+
+  auto name = table.intern(w_string_piece("src"));
+  auto found = table.find("src");
+  ASSERT_NE(nullptr, found);
+  EXPECT_EQ(name.data(), found->data());
+}
+
+TEST(NameTableTest, prune_forgets_unreferenced_names) {
+  NameTable table;
+  auto kept = table.intern(w_string_piece("kept"));
+  table.intern(w_string_piece("dropped"));
+
+  EXPECT_EQ(1, table.prune());
+  EXPECT_EQ(nullptr, table.find("dropped"));
+  ASSERT_NE(nullptr, table.find("kept"));
+  EXPECT_EQ(1, table.getStats().names);
+
+  kept.reset();
+  EXPECT_EQ(1, table.prune());
+  EXPECT_EQ(0, table.getStats().names);
+  EXPECT_EQ(0, table.getStats().bytes);
+}
+
+TEST(NameTableTest, lowercase_names_share_storage) {
+  NameTable table;
+  auto lower = table.intern(w_string_piece("readme"));
+  EXPECT_EQ(lower.data(), table.internLowerCase(lower).data());
+
+  auto upper = table.intern(w_string_piece("README"));
+  auto folded = table.internLowerCase(upper);
+  EXPECT_EQ("readme", folded.view());
+  EXPECT_EQ(lower.data(), folded.data());
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <vector>
+
+#include "watchman/NodeArena.h"
+
+using namespace watchman;
+
+TEST(NodeArenaTest, allocations_are_zeroed_and_counted) {
+  NodeArena arena;
+  auto p = static_cast<char*>(arena.allocate(100));
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(0, p[i]);
+  }
+  memset(p, 'x', 100);
+
+  auto stats = arena.getStats();
+  EXPECT_EQ(1, stats.slabs);
+  EXPECT_EQ(NodeArena::kSlabSize, stats.reservedBytes);
+  EXPECT_EQ(1, stats.liveAllocations);
+  EXPECT_EQ(112, stats.liveBytes);
+  EXPECT_EQ(0, stats.freeBytes);
+
+  NodeArena::deallocate(p, 100);
+  stats = arena.getStats();
+  EXPECT_EQ(0, stats.liveAllocations);
+  EXPECT_EQ(0, stats.liveBytes);
+  EXPECT_EQ(112, stats.freeBytes);
+}
+
+TEST(NodeArenaTest, freed_nodes_are_reused) {
+  NodeArena arena;
+  auto a = arena.allocate(40);
+  NodeArena::deallocate(a, 40);
+  auto b = static_cast<char*>(arena.allocate(48));
+  EXPECT_EQ(a, b);
+  for (size_t i = 0; i < 48; ++i) {
+    EXPECT_EQ(0, b[i]) << "reused memory must be zeroed again";
+  }
+  EXPECT_EQ(0, arena.getStats().freeBytes);
+  NodeArena::deallocate(b, 48);
+}
+
+TEST(NodeArenaTest, large_allocations_bypass_slabs) {
+  NodeArena arena;
+  auto p = arena.allocate(NodeArena::kMaxSlabAllocation + 1);
+  auto stats = arena.getStats();
+  EXPECT_EQ(0, stats.slabs);
+  EXPECT_EQ(1, stats.largeAllocations);
+  EXPECT_EQ(1, stats.liveAllocations);
+  NodeArena::deallocate(p, NodeArena::kMaxSlabAllocation + 1);
+  stats = arena.getStats();
+  EXPECT_EQ(0, stats.largeAllocations);
+  EXPECT_EQ(0, stats.liveAllocations);
+}
+
+TEST(NodeArenaTest, deallocate_finds_owning_arena) {
+  NodeArena first;
+  NodeArena second;
+  std::vector<void*> ptrs;
+  // Enough allocations to spill over into several slabs
+  for (size_t i = 0; i < 2 * NodeArena::kSlabSize / 64; ++i) {
+    ptrs.push_back((i % 2 ? first : second).allocate(64));
+  }
+  EXPECT_LT(1, first.getStats().slabs);
+  for (auto p : ptrs) {
+    NodeArena::deallocate(p, 64);
+  }
+  EXPECT_EQ(0, first.getStats().liveAllocations);
+  EXPECT_EQ(0, second.getStats().liveAllocations);
+}
+
+TEST(NodeArenaTest, trim_releases_unused_slabs) {
+  NodeArena arena;
+  // Enough 1KiB nodes to span several slabs
+  std::vector<void*> nodes;
+  for (size_t i = 0; i < 200; ++i) {
+    nodes.push_back(arena.allocate(1024));
+  }
+  auto slabs = arena.getStats().slabs;
+  EXPECT_LT(3u, slabs);
+
+  // Keep only the first node, which pins the first slab
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    NodeArena::deallocate(nodes[i], 1024);
+  }
+  EXPECT_EQ((slabs - 1) * NodeArena::kSlabSize, arena.trim());
+  auto stats = arena.getStats();
+  EXPECT_EQ(1u, stats.slabs);
+  EXPECT_EQ(1u, stats.liveAllocations);
+  // 63 nodes fit in a slab after its header; the first slab's other 62 are
+  // still free for reuse
+  EXPECT_EQ(62u * 1024, stats.freeBytes);
+  EXPECT_EQ(0u, arena.trim());
+
+  auto again = arena.allocate(1024);
+  EXPECT_EQ(1u, arena.getStats().slabs);
+  NodeArena::deallocate(again, 1024);
+  NodeArena::deallocate(nodes[0], 1024);
+  EXPECT_EQ(arena.getStats().slabs * NodeArena::kSlabSize, arena.trim());
+  EXPECT_EQ(0u, arena.getStats().reservedBytes);
+}
@@ -147,7 +147,7 @@ class NaivePendingCollection {
       const w_string& path,
       std::chrono::system_clock::time_point now,
       PendingFlags flags) {
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_.get(); p; p = p->next.get()) {
       if (w_string_startswith(path, p->path) &&
           watchman::is_path_prefix(path, p->path)) {
         if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
@@ -157,7 +157,7 @@ class NaivePendingCollection {
       }
     }
 
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_.get(); p; p = p->next.get()) {
       if (p->path == path) {
         // consolidateItem
         p->flags.set(
@@ -172,38 +172,35 @@ class NaivePendingCollection {
     // maybePruneObsoletedChildren
     if ((flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
         W_PENDING_RECURSIVE) {
-      std::shared_ptr<watchman_pending_fs>* prev = &head_;
-      auto p = head_;
-      while (p) {
-        if (watchman::is_path_prefix(p->path, path)) {
-          (*prev) = p->next;
-          p = p->next;
+      PendingChain* prev = &head_;
+      while (*prev) {
+        if (watchman::is_path_prefix((*prev)->path, path)) {
+          (*prev) = std::move((*prev)->next);
         } else {
           prev = &(*prev)->next;
-          p = p->next;
         }
       }
     }
 
-    auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
-    p->next = head_;
-    head_ = p;
+    auto p = watchman_pending_fs::make(path, now, flags);
+    p->next = std::move(head_);
+    head_ = std::move(p);
   }
 
   size_t getPendingItemCount() const {
     size_t i = 0;
-    for (auto p = head_; p; p = p->next) {
+    for (auto p = head_.get(); p; p = p->next.get()) {
       ++i;
     }
     return i;
   }
 
-  std::shared_ptr<watchman_pending_fs> stealItems() {
-    return std::exchange(head_, nullptr);
+  PendingChain stealItems() {
+    return std::move(head_);
   }
 
  private:
-  std::shared_ptr<watchman_pending_fs> head_;
+  PendingChain head_;
 };
 
 using PCTypes = ::testing::Types<PendingChanges, NaivePendingCollection>;
@@ -237,7 +234,7 @@ TYPED_TEST(PendingCollectionFixture, add_two_items) {
   EXPECT_EQ(w_string{"foo/baz"}, item->path);
   EXPECT_EQ(PendingFlags{}, item->flags);
 
-  item = item->next;
+  item = std::move(item->next);
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
@@ -306,7 +303,7 @@ TYPED_TEST(PendingCollectionFixture, unrelated_prefixes_dont_prune) {
   EXPECT_EQ(w_string{"f"}, item->path);
   EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
 
-  item = item->next;
+  item = std::move(item->next);
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
@@ -326,7 +323,7 @@ TYPED_TEST(PendingCollectionFixture, queue_crawl_then_notify) {
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
   EXPECT_EQ(W_PENDING_VIA_NOTIFY, item->flags);
 
-  item = item->next;
+  item = std::move(item->next);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo"}, item->path);
   EXPECT_EQ(W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE, item->flags);
@@ -343,7 +340,7 @@ TYPED_TEST(PendingCollectionFixture, queue_notify_then_crawl) {
   EXPECT_EQ(w_string{"foo"}, item->path);
   EXPECT_EQ(W_PENDING_CRAWL_ONLY | W_PENDING_RECURSIVE, item->flags);
 
-  item = item->next;
+  item = std::move(item->next);
   EXPECT_EQ(nullptr, item->next);
   EXPECT_EQ(w_string{"foo/bar"}, item->path);
   EXPECT_EQ(W_PENDING_VIA_NOTIFY, item->flags);
@@ -373,11 +370,106 @@ TYPED_TEST(PendingCollectionFixture, real_example) {
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
 
-  item = item->next;
+  item = std::move(item->next);
   ASSERT_NE(nullptr, item);
   EXPECT_NE(nullptr, item->next);
 
-  item = item->next;
+  item = std::move(item->next);
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
 }
+
+TEST(Pending, hand_off_is_merged_by_consumer) {
+  auto now = std::chrono::system_clock::now();
+  PendingCollection coll;
+
+  PendingChanges batch;
+  batch.add(w_string{"/root/dir/file"}, now, W_PENDING_VIA_NOTIFY);
+  batch.add(w_string{"/root/other"}, now, W_PENDING_VIA_NOTIFY);
+  coll.lock()->handOff(batch);
+  EXPECT_TRUE(batch.empty());
+
+  batch.add(w_string{"/root/dir"}, now, W_PENDING_RECURSIVE);
+  coll.lock()->handOff(batch);
+
+  std::vector<PendingChain> chains;
+  {
+    auto lock = coll.lock();
+    EXPECT_TRUE(lock->checkAndResetPinged());
+    chains = lock->stealAllItems();
+    EXPECT_FALSE(lock->checkAndResetPinged());
+  }
+  EXPECT_EQ(2, chains.size());
+
+  // The recursive entry for /root/dir obsoletes /root/dir/file
+  PendingChanges local;
+  local.append(std::move(chains), {});
+  EXPECT_EQ(2, local.getPendingItemCount());
+}
+
+TEST(Pending, peek_items_does_not_consume) {
+  auto now = std::chrono::system_clock::now();
+  PendingChanges coll;
+  coll.add(w_string{"/root/a"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"/root/b"}, now, W_PENDING_VIA_NOTIFY);
+
+  size_t peeked = 0;
+  for (auto item = coll.peekItems(); item; item = item->next.get()) {
+    ++peeked;
+  }
+  EXPECT_EQ(2, peeked);
+  EXPECT_EQ(2, coll.getPendingItemCount());
+
+  auto head = coll.peekItems();
+  auto item = coll.stealItems();
+  EXPECT_EQ(head, item.get());
+  EXPECT_EQ(nullptr, coll.peekItems());
+}
+
+TEST(Pending, skipping_crawls_only_obsolete_skipping_crawls) {
+  auto now = std::chrono::system_clock::now();
+  auto skip = W_PENDING_RECURSIVE | W_PENDING_SKIP_UNCHANGED;
+  PendingChanges coll;
+
+  coll.add(w_string{"foo"}, now, skip);
+  // A notification could be for a file modified in place in a dir that the
+  // crawl of foo doesn't read, so it is kept
+  coll.add(w_string{"foo/file"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo/bar"}, now, skip);
+  EXPECT_EQ(2, coll.getPendingItemCount());
+
+  // Neither is a crawl that reads every dir, but that covers what's beneath
+  // it
+  coll.add(w_string{"foo/baz/qux"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo/baz"}, now, W_PENDING_RECURSIVE);
+  EXPECT_EQ(3, coll.getPendingItemCount());
+
+  coll.add(w_string{"foo"}, now, W_PENDING_RECURSIVE);
+  auto item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+  EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
+}
+
+TEST(Pending, skipping_is_kept_only_if_every_crawl_skips) {
+  auto now = std::chrono::system_clock::now();
+  auto skip = W_PENDING_RECURSIVE | W_PENDING_SKIP_UNCHANGED;
+  PendingChanges coll;
+
+  coll.add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY);
+  coll.add(w_string{"foo"}, now, skip);
+  coll.add(w_string{"foo"}, now, skip);
+  coll.add(w_string{"bar"}, now, skip);
+  coll.add(w_string{"bar"}, now, W_PENDING_RECURSIVE);
+
+  auto item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"bar"}, item->path);
+  EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
+  item = std::move(item->next);
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY | skip, item->flags);
+}
@@ -122,3 +122,11 @@ TEST(Perf, large_samples_are_passed_in_stdin) {
   EXPECT_EQ("{\"value\": 1}", stdin_calls[0]);
   EXPECT_EQ("{\"value\": 2}", stdin_calls[1]);
 }
+
+TEST(Perf, batches_grow_with_the_backlog) {
+  EXPECT_EQ(4, adaptiveSampleBatchSize(4, 1));
+  EXPECT_EQ(4, adaptiveSampleBatchSize(4, 16));
+  EXPECT_EQ(25, adaptiveSampleBatchSize(4, 100));
+  EXPECT_EQ(64, adaptiveSampleBatchSize(4, 4000));
+  EXPECT_EQ(100, adaptiveSampleBatchSize(100, 4000));
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PriorityPaths.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(PriorityPathsTest, relevant_paths) {
+  std::vector<w_string> paths{"/root/a/b", "/root/c"};
+  EXPECT_TRUE(PriorityPaths::isRelevant(paths, "/root/a/b"));
+  EXPECT_TRUE(PriorityPaths::isRelevant(paths, "/root/a/b/x/y"));
+  // Directories that contain a prioritized path can be renamed along with it
+  EXPECT_TRUE(PriorityPaths::isRelevant(paths, "/root/a"));
+  EXPECT_TRUE(PriorityPaths::isRelevant(paths, "/root"));
+  EXPECT_FALSE(PriorityPaths::isRelevant(paths, "/root/a/bc"));
+  EXPECT_FALSE(PriorityPaths::isRelevant(paths, "/root/d/c"));
+  EXPECT_FALSE(PriorityPaths::isRelevant({}, "/root/a"));
+}
+
+TEST(PriorityPathsTest, only_unsynced_queries_are_waiting) {
+  PriorityPaths priority;
+  int q1, q2;
+  priority.add(&q1, {"/root/a"});
+  priority.add(&q2, {"/root/b", "/root/c"});
+
+  auto waiting = priority.waiting();
+  EXPECT_EQ(2, waiting.numQueries);
+  EXPECT_EQ(3, waiting.paths.size());
+
+  priority.markSynced(&q2);
+  waiting = priority.waiting();
+  EXPECT_EQ(1, waiting.numQueries);
+  EXPECT_EQ(std::vector<w_string>{"/root/a"}, waiting.paths);
+
+  priority.remove(&q1);
+  priority.remove(&q2);
+  EXPECT_EQ(0, priority.waiting().numQueries);
+}
+
+TEST(PriorityPathsTest, waits_for_synced_queries_to_finish) {
+  PriorityPaths priority;
+  int q1, q2;
+  priority.add(&q1, {"/root/a"});
+  priority.add(&q2, {"/root/b"});
+  auto waiting = priority.waiting();
+
+  // Nobody synchronizes
+  EXPECT_FALSE(priority.waitForSyncedQueries(waiting.numQueries, 1ms));
+
+  std::thread query{[&] {
+    priority.markSynced(&q1);
+    std::this_thread::sleep_for(10ms);
+    priority.remove(&q1);
+  }};
+  EXPECT_TRUE(priority.waitForSyncedQueries(waiting.numQueries, 10s));
+  query.join();
+  // q2 is still waiting; only q1 had to be let through
+  EXPECT_EQ(1, priority.waiting().numQueries);
+}
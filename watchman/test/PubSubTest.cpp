@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PubSub.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+using Pending = std::vector<std::shared_ptr<const Publisher::Item>>;
+
+Pending getAll(const std::shared_ptr<Publisher::Subscriber>& sub) {
+  Pending pending;
+  sub->getPending(pending);
+  return pending;
+}
+
+} // namespace
+
+TEST(PubSubTest, subscribers_see_items_published_after_they_subscribe) {
+  auto pub = std::make_shared<Publisher>();
+  EXPECT_FALSE(pub->enqueue(json_integer(0)));
+
+  auto first = pub->subscribe(nullptr);
+  EXPECT_TRUE(pub->enqueue(json_integer(1)));
+  auto second = pub->subscribe(nullptr);
+  EXPECT_TRUE(pub->enqueue(json_integer(2)));
+
+  auto firstItems = getAll(first);
+  ASSERT_EQ(2, firstItems.size());
+  EXPECT_EQ(1, firstItems[0]->payload.asInt());
+  EXPECT_EQ(2, firstItems[1]->payload.asInt());
+
+  auto secondItems = getAll(second);
+  ASSERT_EQ(1, secondItems.size());
+  EXPECT_EQ(2, secondItems[0]->payload.asInt());
+
+  EXPECT_TRUE(getAll(first).empty());
+  EXPECT_EQ(0, pub->getQueuedItemCount());
+}
+
+TEST(PubSubTest, notifies_once_until_items_are_collected) {
+  auto pub = std::make_shared<Publisher>();
+  int notified = 0;
+  auto sub = pub->subscribe([&notified] { ++notified; });
+
+  pub->enqueue(json_integer(1));
+  pub->enqueue(json_integer(2));
+  EXPECT_EQ(1, notified);
+
+  EXPECT_EQ(2, getAll(sub).size());
+  pub->enqueue(json_integer(3));
+  EXPECT_EQ(2, notified);
+}
+
+TEST(PubSubTest, queue_is_bounded_by_the_slowest_subscriber) {
+  auto pub = std::make_shared<Publisher>();
+  auto fast = pub->subscribe(nullptr);
+  auto slow = pub->subscribe(nullptr);
+
+  for (int i = 0; i < 1000; ++i) {
+    pub->enqueue(json_integer(i));
+    getAll(fast);
+  }
+  EXPECT_EQ(1000, pub->getQueuedItemCount());
+  EXPECT_EQ(1000, getAll(slow).size());
+  EXPECT_EQ(0, pub->getQueuedItemCount());
+
+  slow.reset();
+  EXPECT_EQ(1, pub->getSubscriberCount());
+  fast.reset();
+  EXPECT_FALSE(pub->hasSubscribers());
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryExpr.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+// Returns a fixed result, recording its evaluation in a shared log
+class LoggedExpr : public QueryExpr {
+ public:
+  LoggedExpr(
+      std::string name,
+      ExprCost cost,
+      EvaluateResult result,
+      std::vector<std::string>& log)
+      : name_(std::move(name)), cost_(cost), result_(result), log_(log) {}
+
+  EvaluateResult evaluate(QueryContextBase*, FileResult*) override {
+    log_.push_back(name_);
+    return result_;
+  }
+
+  ExprCost cost() const override {
+    return cost_;
+  }
+
+ private:
+  std::string name_;
+  ExprCost cost_;
+  EvaluateResult result_;
+  std::vector<std::string>& log_;
+};
+
+struct Term {
+  const char* name;
+  ExprCost cost;
+  EvaluateResult result;
+};
+
+std::vector<std::unique_ptr<QueryExpr>> makeTerms(
+    const std::vector<Term>& terms,
+    std::vector<std::string>& log) {
+  std::vector<std::unique_ptr<QueryExpr>> exprs;
+  for (auto& term : terms) {
+    exprs.push_back(
+        std::make_unique<LoggedExpr>(term.name, term.cost, term.result, log));
+  }
+  return exprs;
+}
+
+// What allof or anyof answer when their terms are evaluated in the order
+// they were written, without short-circuiting
+EvaluateResult expectedResult(bool allof, const std::vector<Term>& terms) {
+  bool unsure = false;
+  for (auto& term : terms) {
+    if (!term.result.has_value()) {
+      unsure = true;
+    } else if (*term.result != allof) {
+      return !allof;
+    }
+  }
+  if (unsure) {
+    return std::nullopt;
+  }
+  return allof;
+}
+
+EvaluateResult negate(EvaluateResult result) {
+  if (!result.has_value()) {
+    return result;
+  }
+  return !*result;
+}
+
+} // namespace
+
+TEST(QueryExprTest, cheap_terms_run_first) {
+  std::vector<std::string> log;
+  auto expr = makeListExpr(
+      true,
+      makeTerms(
+          {{"meta", ExprCost::Metadata, true},
+           {"regex", ExprCost::Regex, true},
+           {"name", ExprCost::Name, true},
+           {"pattern", ExprCost::Pattern, true},
+           {"constant", ExprCost::Constant, true},
+           {"name2", ExprCost::Name, true}},
+          log));
+
+  EXPECT_EQ(true, expr->evaluate(nullptr, nullptr));
+  // Terms of the same cost keep the order they were written in
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "constant", "name", "name2", "pattern", "regex", "meta"}),
+      log);
+}
+
+TEST(QueryExprTest, deciding_cheap_term_skips_expensive_ones) {
+  std::vector<std::string> log;
+  auto allof = makeListExpr(
+      true,
+      makeTerms(
+          {{"meta", ExprCost::Metadata, true},
+           {"name", ExprCost::Name, false}},
+          log));
+  EXPECT_EQ(false, allof->evaluate(nullptr, nullptr));
+  EXPECT_EQ(std::vector<std::string>{"name"}, log);
+
+  log.clear();
+  auto anyof = makeListExpr(
+      false,
+      makeTerms(
+          {{"regex", ExprCost::Regex, false},
+           {"name", ExprCost::Name, true}},
+          log));
+  EXPECT_EQ(true, anyof->evaluate(nullptr, nullptr));
+  EXPECT_EQ(std::vector<std::string>{"name"}, log);
+}
+
+TEST(QueryExprTest, reordering_keeps_the_result) {
+  // Every combination of results for terms written dearest first
+  const EvaluateResult results[] = {true, false, std::nullopt};
+  const ExprCost costs[] = {
+      ExprCost::Metadata, ExprCost::Regex, ExprCost::Name};
+
+  for (auto& a : results) {
+    for (auto& b : results) {
+      for (auto& c : results) {
+        std::vector<Term> terms{
+            {"a", costs[0], a}, {"b", costs[1], b}, {"c", costs[2], c}};
+        for (bool allof : {true, false}) {
+          SCOPED_TRACE(
+              std::string(allof ? "allof " : "anyof ") +
+              std::to_string(a.has_value() ? int(*a) : -1) + " " +
+              std::to_string(b.has_value() ? int(*b) : -1) + " " +
+              std::to_string(c.has_value() ? int(*c) : -1));
+          auto expected = expectedResult(allof, terms);
+
+          std::vector<std::string> log;
+          auto list = makeListExpr(allof, makeTerms(terms, log));
+          EXPECT_EQ(expected, list->evaluate(nullptr, nullptr));
+
+          auto negated =
+              makeNotExpr(makeListExpr(allof, makeTerms(terms, log)));
+          EXPECT_EQ(negate(expected), negated->evaluate(nullptr, nullptr));
+        }
+      }
+    }
+  }
+}
+
+TEST(QueryExprTest, unsure_term_keeps_the_list_unsure) {
+  // A term that needs data moves behind a cheap one that can't decide the
+  // result on its own; the list must still ask for the data
+  std::vector<std::string> log;
+  auto allof = makeListExpr(
+      true,
+      makeTerms(
+          {{"meta", ExprCost::Metadata, std::nullopt},
+           {"name", ExprCost::Name, true}},
+          log));
+  EXPECT_EQ(std::nullopt, allof->evaluate(nullptr, nullptr));
+  EXPECT_EQ((std::vector<std::string>{"name", "meta"}), log);
+
+  log.clear();
+  auto anyof = makeListExpr(
+      false,
+      makeTerms(
+          {{"meta", ExprCost::Metadata, std::nullopt},
+           {"name", ExprCost::Name, false}},
+          log));
+  EXPECT_EQ(std::nullopt, anyof->evaluate(nullptr, nullptr));
+  EXPECT_EQ((std::vector<std::string>{"name", "meta"}), log);
+
+  log.clear();
+  auto negated = makeNotExpr(makeListExpr(
+      true,
+      makeTerms(
+          {{"meta", ExprCost::Metadata, std::nullopt},
+           {"regex", ExprCost::Regex, true}},
+          log)));
+  EXPECT_EQ(std::nullopt, negated->evaluate(nullptr, nullptr));
+}
+
+TEST(QueryExprTest, lists_cost_as_much_as_their_dearest_term) {
+  std::vector<std::string> log;
+  auto list = makeListExpr(
+      true,
+      makeTerms(
+          {{"name", ExprCost::Name, true},
+           {"regex", ExprCost::Regex, true},
+           {"constant", ExprCost::Constant, true}},
+          log));
+  EXPECT_EQ(ExprCost::Regex, list->cost());
+
+  auto negated = makeNotExpr(std::move(list));
+  EXPECT_EQ(ExprCost::Regex, negated->cost());
+}
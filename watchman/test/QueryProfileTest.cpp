@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryProfile.h"
+#include <folly/portability/GTest.h>
+#include "watchman/query/QueryExpr.h"
+
+using namespace watchman;
+
+namespace {
+
+class Context : public QueryContextBase {
+ public:
+  const w_string& getWholeName() override {
+    return name_;
+  }
+
+ private:
+  w_string name_{"foo"};
+};
+
+// Returns each of the results in turn
+class ScriptedExpr : public QueryExpr {
+ public:
+  explicit ScriptedExpr(std::vector<EvaluateResult> results)
+      : results_(std::move(results)) {}
+
+  EvaluateResult evaluate(QueryContextBase*, FileResult*) override {
+    return results_[next_++ % results_.size()];
+  }
+
+  ExprCost cost() const override {
+    return ExprCost::Name;
+  }
+
+ private:
+  std::vector<EvaluateResult> results_;
+  size_t next_{0};
+};
+
+} // namespace
+
+TEST(QueryProfile, counts_evaluations_of_each_term) {
+  auto expr = makeProfiledExpr(
+      1,
+      std::make_unique<ScriptedExpr>(
+          std::vector<EvaluateResult>{true, false, std::nullopt, true}));
+  EXPECT_EQ(ExprCost::Name, expr->cost());
+
+  Context ctx;
+  ctx.profile = std::make_unique<QueryProfile>(2);
+  for (int i = 0; i < 8; ++i) {
+    expr->evaluate(&ctx, nullptr);
+  }
+
+  auto& term = ctx.profile->terms[1];
+  EXPECT_EQ(8, term.evaluations);
+  EXPECT_EQ(4, term.matched);
+  EXPECT_EQ(2, term.deferred);
+  EXPECT_EQ(0, ctx.profile->terms[0].evaluations);
+}
+
+TEST(QueryProfile, unprofiled_contexts_are_not_counted) {
+  auto expr = makeProfiledExpr(
+      0, std::make_unique<ScriptedExpr>(std::vector<EvaluateResult>{true}));
+  Context ctx;
+  EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&ctx, nullptr));
+}
+
+TEST(QueryProfile, shards_are_merged_and_rendered) {
+  QueryProfile profile(1);
+  profile.generators.push_back("all");
+  profile.terms[0].evaluations = 4;
+  profile.terms[0].matched = 1;
+  profile.evalBatchFetches = 1;
+  profile.evalBatchFiles = 3;
+
+  QueryProfile shard(1);
+  shard.terms[0].evaluations = 4;
+  shard.terms[0].matched = 3;
+  shard.evalBatchFetches = 1;
+  shard.evalBatchFiles = 2;
+  profile.merge(shard);
+
+  auto rendered = profile.render({ProfiledTerm{w_string("suffix"), 0}});
+  EXPECT_EQ(2, rendered.get("eval_batch_fetches").asInt());
+  EXPECT_EQ(5, rendered.get("eval_batch_files").asInt());
+  EXPECT_EQ(
+      "all", json_to_w_string(rendered.get("generators").at(0)).string());
+
+  auto term = rendered.get("terms").at(0);
+  EXPECT_EQ("suffix", json_to_w_string(term.get("term")).string());
+  EXPECT_EQ(8, term.get("evaluations").asInt());
+  EXPECT_EQ(4, term.get("matched").asInt());
+  EXPECT_DOUBLE_EQ(0.5, json_real_value(term.get("true_rate")));
+}
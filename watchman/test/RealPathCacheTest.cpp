@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/RealPathCache.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <system_error>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+// Resolves by prefixing /real, counting its calls, and fails for paths
+// that start with /missing
+struct FakeResolver {
+  size_t calls{0};
+  std::optional<uint64_t> generation{1};
+
+  RealPathCache makeCache(std::chrono::milliseconds ttl) {
+    return RealPathCache{
+        ttl,
+        [this](const char* path) {
+          ++calls;
+          if (w_string_piece(path).startsWith("/missing")) {
+            throw std::system_error(
+                ENOENT, std::generic_category(), "realpath");
+          }
+          return w_string::build("/real", path);
+        },
+        [this] { return generation; }};
+  }
+};
+
+} // namespace
+
+TEST(RealPathCacheTest, remembers_resolutions) {
+  FakeResolver resolver;
+  auto cache = resolver.makeCache(1h);
+
+  bool cached = true;
+  EXPECT_EQ(w_string("/real/a"), cache.resolve("/a", &cached));
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(w_string("/real/a"), cache.resolve("/a", &cached));
+  EXPECT_TRUE(cached);
+  EXPECT_EQ(w_string("/real/b"), cache.resolve("/b"));
+  EXPECT_EQ(2u, resolver.calls);
+  EXPECT_EQ(2u, cache.size());
+
+  cache.forget("/a");
+  EXPECT_EQ(w_string("/real/a"), cache.resolve("/a", &cached));
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(3u, resolver.calls);
+}
+
+TEST(RealPathCacheTest, forgets_everything_when_mounts_change) {
+  FakeResolver resolver;
+  auto cache = resolver.makeCache(1h);
+  cache.resolve("/a");
+  cache.resolve("/b");
+
+  resolver.generation = 2;
+  bool cached = true;
+  cache.resolve("/a", &cached);
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(3u, resolver.calls);
+  EXPECT_EQ(1u, cache.size());
+
+  // Without a generation, only the ttl applies
+  resolver.generation = std::nullopt;
+  cache.resolve("/a");
+  cache.resolve("/a", &cached);
+  EXPECT_TRUE(cached);
+  EXPECT_EQ(4u, resolver.calls);
+}
+
+TEST(RealPathCacheTest, does_not_remember_failures) {
+  FakeResolver resolver;
+  auto cache = resolver.makeCache(1h);
+  for (int i = 0; i < 2; ++i) {
+    try {
+      cache.resolve("/missing");
+      FAIL() << "resolving a missing path succeeded";
+    } catch (const std::system_error& exc) {
+      EXPECT_EQ(std::errc::no_such_file_or_directory, exc.code());
+    }
+  }
+  EXPECT_EQ(2u, resolver.calls);
+  EXPECT_EQ(0u, cache.size());
+}
+
+TEST(RealPathCacheTest, zero_ttl_disables_the_cache) {
+  FakeResolver resolver;
+  auto cache = resolver.makeCache(0ms);
+  bool cached = true;
+  cache.resolve("/a");
+  cache.resolve("/a", &cached);
+  EXPECT_FALSE(cached);
+  EXPECT_EQ(2u, resolver.calls);
+  EXPECT_EQ(0u, cache.size());
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/RelevanceFilter.h"
+#include <folly/portability/GTest.h>
+#include "watchman/query/QueryExpr.h"
+
+using namespace watchman;
+
+namespace {
+
+// An expression that only reports what it requires
+class RequiringExpr : public QueryExpr {
+ public:
+  EvaluateResult evaluate(QueryContextBase*, FileResult*) override {
+    return true;
+  }
+
+  std::optional<std::vector<w_string>> requiredSuffixes() const override {
+    return suffixes;
+  }
+
+  std::optional<std::vector<w_string>> requiredNames() const override {
+    return names;
+  }
+
+  std::optional<RequiredDir> requiredDir() const override {
+    return dir;
+  }
+
+  std::optional<std::vector<w_string>> suffixes;
+  std::optional<std::vector<w_string>> names;
+  std::optional<RequiredDir> dir;
+};
+
+RelevanceFilter dirFilter(const char* dir) {
+  RelevanceFilter filter;
+  filter.dir = w_string{dir};
+  return filter;
+}
+
+} // namespace
+
+TEST(RelevanceFilterTest, dir_matches_itself_and_descendants) {
+  auto filter = dirFilter("/root/a/b");
+  EXPECT_TRUE(filter.matches("/root/a/b", "x.txt"));
+  EXPECT_TRUE(filter.matches("/root/a/b/c", "x.txt"));
+  EXPECT_TRUE(filter.matches("/root/a/b/c/d", "x.txt"));
+
+  // Siblings that merely share the prefix
+  EXPECT_FALSE(filter.matches("/root/a/bc", "x.txt"));
+  EXPECT_FALSE(filter.matches("/root/a/b.d", "x.txt"));
+  // Ancestors and other dirs
+  EXPECT_FALSE(filter.matches("/root/a", "b"));
+  EXPECT_FALSE(filter.matches("/root", "x.txt"));
+  EXPECT_FALSE(filter.matches("/root/c/b", "x.txt"));
+}
+
+TEST(RelevanceFilterTest, suffixes_match_case_insensitively) {
+  RelevanceFilter filter;
+  filter.suffixes = std::vector<w_string>{w_string{"txt"}, w_string{"h"}};
+  EXPECT_TRUE(filter.matches("/root", "a.txt"));
+  EXPECT_TRUE(filter.matches("/root", "A.TXT"));
+  EXPECT_TRUE(filter.matches("/root/deep", "b.H"));
+  EXPECT_TRUE(filter.matches("/root", "a.b.txt"));
+
+  EXPECT_FALSE(filter.matches("/root", "txt"));
+  EXPECT_FALSE(filter.matches("/root", "atxt"));
+  EXPECT_FALSE(filter.matches("/root", "a.txt.bak"));
+  EXPECT_FALSE(filter.matches("/root", "a.cpp"));
+
+  // Nothing matches an empty set
+  filter.suffixes = std::vector<w_string>{};
+  EXPECT_FALSE(filter.matches("/root", "a.txt"));
+}
+
+TEST(RelevanceFilterTest, names_match_case_insensitively) {
+  RelevanceFilter filter;
+  filter.names =
+      std::vector<w_string>{w_string{"buck"}, w_string{"targets.bzl"}};
+  EXPECT_TRUE(filter.matches("/root", "BUCK"));
+  EXPECT_TRUE(filter.matches("/root/a", "buck"));
+  EXPECT_TRUE(filter.matches("/root", "TARGETS.bzl"));
+
+  EXPECT_FALSE(filter.matches("/root", "BUCK2"));
+  EXPECT_FALSE(filter.matches("/root", "BUC"));
+  EXPECT_FALSE(filter.matches("/root", "a.buck"));
+}
+
+TEST(RelevanceFilterTest, every_constraint_must_hold) {
+  auto filter = dirFilter("/root/src");
+  filter.suffixes = std::vector<w_string>{w_string{"cpp"}};
+  filter.names = std::vector<w_string>{w_string{"main.cpp"}};
+  EXPECT_TRUE(filter.matches("/root/src", "Main.cpp"));
+  EXPECT_FALSE(filter.matches("/root/src", "other.cpp"));
+  EXPECT_FALSE(filter.matches("/root/lib", "main.cpp"));
+}
+
+TEST(RelevanceFilterTest, for_query_without_constraints) {
+  w_string root{"/root"};
+  EXPECT_FALSE(RelevanceFilter::forQuery(root, nullptr, nullptr));
+
+  RequiringExpr expr;
+  EXPECT_FALSE(RelevanceFilter::forQuery(root, nullptr, &expr));
+}
+
+TEST(RelevanceFilterTest, for_query_with_relative_root) {
+  w_string root{"/root"};
+  auto filter = RelevanceFilter::forQuery(root, w_string{"/root/a/b"}, nullptr);
+  ASSERT_TRUE(filter);
+  EXPECT_EQ(w_string{"/root/a/b"}, filter->dir);
+  EXPECT_FALSE(filter->suffixes);
+  EXPECT_FALSE(filter->names);
+  EXPECT_TRUE(filter->matches("/root/a/b/c", "x"));
+  EXPECT_FALSE(filter->matches("/root/a/bc", "x"));
+}
+
+TEST(RelevanceFilterTest, for_query_with_dirname) {
+  w_string root{"/root"};
+  RequiringExpr expr;
+  expr.dir = RequiredDir{w_string{"a/b"}, 2};
+
+  // The dir is relative to the relative root, if any
+  auto filter = RelevanceFilter::forQuery(root, nullptr, &expr);
+  ASSERT_TRUE(filter);
+  EXPECT_EQ(w_string{"/root/a/b"}, filter->dir);
+  EXPECT_TRUE(filter->matches("/root/a/b", "x"));
+  EXPECT_FALSE(filter->matches("/root/a/bc", "x"));
+
+  filter = RelevanceFilter::forQuery(root, w_string{"/root/sub"}, &expr);
+  ASSERT_TRUE(filter);
+  EXPECT_EQ(w_string{"/root/sub/a/b"}, filter->dir);
+  EXPECT_TRUE(filter->matches("/root/sub/a/b/c", "x"));
+  EXPECT_FALSE(filter->matches("/root/a/b", "x"));
+}
+
+TEST(RelevanceFilterTest, for_query_with_suffixes_and_names) {
+  w_string root{"/root"};
+  RequiringExpr expr;
+  expr.suffixes = std::vector<w_string>{w_string{"js"}};
+  auto filter = RelevanceFilter::forQuery(root, nullptr, &expr);
+  ASSERT_TRUE(filter);
+  EXPECT_FALSE(filter->dir);
+  EXPECT_TRUE(filter->matches("/root/x", "a.JS"));
+  EXPECT_FALSE(filter->matches("/root/x", "a.ts"));
+
+  expr.suffixes = std::nullopt;
+  expr.names = std::vector<w_string>{w_string{"package.json"}};
+  filter = RelevanceFilter::forQuery(root, nullptr, &expr);
+  ASSERT_TRUE(filter);
+  EXPECT_FALSE(filter->suffixes);
+  EXPECT_TRUE(filter->matches("/root/x", "Package.json"));
+  EXPECT_FALSE(filter->matches("/root/x", "a.json"));
+}
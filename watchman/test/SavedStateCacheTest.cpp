@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/saved_state/SavedStateCache.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <thread>
+#include "watchman/ThreadPool.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+class FakeSavedStateInterface : public SavedStateInterface {
+ public:
+  FakeSavedStateInterface()
+      : SavedStateInterface(
+            json_object({{"project", w_string_to_json("foo")}})) {}
+
+  mutable std::atomic<int> lookups{0};
+  std::atomic<bool> fail{false};
+
+ protected:
+  SavedStateResult getMostRecentSavedStateImpl(
+      w_string_piece lookupCommitId) const override {
+    ++lookups;
+    if (fail) {
+      throw std::runtime_error("storage is unavailable");
+    }
+    SavedStateResult result;
+    result.commitId = w_string::build(lookupCommitId, "~1");
+    result.savedStateInfo =
+        json_object({{"commit-id", w_string_to_json(result.commitId)}});
+    return result;
+  }
+};
+
+void startThreadPool() {
+  if (getThreadPool().numWorkers() == 0) {
+    getThreadPool().start(4, 1024);
+  }
+}
+
+void waitForPrefetch(const SavedStateCache& cache) {
+  while (cache.isPrefetching()) {
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+} // namespace
+
+TEST(SavedStateCacheTest, looks_up_each_merge_base_once) {
+  startThreadPool();
+  SavedStateCache cache{8, 0ms, 4};
+  auto interface = std::make_shared<FakeSavedStateInterface>();
+
+  auto result = cache.get("source", interface, "main", "abc").get();
+  EXPECT_EQ(w_string{"abc~1"}, result.commitId);
+  result = cache.get("source", interface, "main", "abc").get();
+  EXPECT_EQ(w_string{"abc~1"}, result.commitId);
+  EXPECT_EQ(1, interface->lookups.load());
+
+  // Other configurations have their own saved states
+  cache.get("other", interface, "main", "abc").get();
+  EXPECT_EQ(2, interface->lookups.load());
+}
+
+TEST(SavedStateCacheTest, failures_are_reported_and_not_kept) {
+  startThreadPool();
+  SavedStateCache cache{8, 0ms, 4};
+  auto interface = std::make_shared<FakeSavedStateInterface>();
+  interface->fail = true;
+
+  auto result = cache.get("source", interface, "main", "abc").get();
+  EXPECT_FALSE(result.commitId);
+  EXPECT_TRUE(result.savedStateInfo.get_default("error"));
+
+  interface->fail = false;
+  result = cache.get("source", interface, "main", "abc").get();
+  EXPECT_EQ(w_string{"abc~1"}, result.commitId);
+  EXPECT_EQ(2, interface->lookups.load());
+}
+
+TEST(SavedStateCacheTest, prefetches_when_the_merge_base_moves) {
+  startThreadPool();
+  SavedStateCache cache{8, 0ms, 4};
+  auto interface = std::make_shared<FakeSavedStateInterface>();
+  cache.get("source", interface, "main", "abc").get();
+
+  std::atomic<int> resolved{0};
+  cache.prefetch([&](const w_string& mergeBaseWith) {
+    EXPECT_EQ(w_string{"main"}, mergeBaseWith);
+    ++resolved;
+    return w_string{"abc"};
+  });
+  waitForPrefetch(cache);
+  EXPECT_EQ(1, resolved.load());
+  EXPECT_EQ(1, interface->lookups.load());
+
+  cache.prefetch([](const w_string&) { return w_string{"def"}; });
+  waitForPrefetch(cache);
+  EXPECT_EQ(2, interface->lookups.load());
+
+  // The query that follows the rebase finds it ready
+  auto result = cache.get("source", interface, "main", "def").get();
+  EXPECT_EQ(w_string{"def~1"}, result.commitId);
+  EXPECT_EQ(2, interface->lookups.load());
+}
+
+TEST(SavedStateCacheTest, prefetch_can_be_disabled) {
+  startThreadPool();
+  SavedStateCache cache{8, 0ms, 0};
+  auto interface = std::make_shared<FakeSavedStateInterface>();
+  cache.get("source", interface, "main", "abc").get();
+
+  bool resolved = false;
+  cache.prefetch([&](const w_string&) {
+    resolved = true;
+    return w_string{"def"};
+  });
+  waitForPrefetch(cache);
+  EXPECT_FALSE(resolved);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleController.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+const SettleController::Clock::time_point kStart{};
+
+} // namespace
+
+TEST(SettleControllerTest, quiet_root_uses_minimum) {
+  SettleController controller{5ms, 200ms, 100};
+  EXPECT_EQ(5ms, controller.settle(kStart));
+  EXPECT_EQ(0, controller.eventRate(kStart));
+}
+
+TEST(SettleControllerTest, storm_approaches_maximum) {
+  SettleController controller{5ms, 200ms, 100};
+  // 100 changes per second puts us halfway between the bounds
+  controller.observe(kStart, 100);
+  EXPECT_DOUBLE_EQ(100, controller.eventRate(kStart));
+  EXPECT_EQ(103ms, controller.settle(kStart));
+
+  for (int i = 1; i <= 100; ++i) {
+    controller.observe(kStart + i * 10ms, 100);
+  }
+  auto end = kStart + 1s;
+  EXPECT_GT(controller.eventRate(end), 5000);
+  EXPECT_GE(controller.settle(end), 195ms);
+  EXPECT_LE(controller.settle(end), 200ms);
+  EXPECT_EQ(100, controller.lastBatchSize());
+}
+
+TEST(SettleControllerTest, rate_decays_once_changes_stop) {
+  SettleController controller{5ms, 200ms, 100};
+  controller.observe(kStart, 1000);
+  auto busy = controller.settle(kStart);
+  auto later = controller.settle(kStart + 2s);
+  auto quiet = controller.settle(kStart + 20s);
+  EXPECT_GT(busy, later);
+  EXPECT_GT(later, quiet);
+  EXPECT_EQ(5ms, quiet);
+}
+
+TEST(SettleControllerTest, inverted_bounds_use_minimum) {
+  SettleController controller{50ms, 10ms, 100};
+  controller.observe(kStart, 1000);
+  EXPECT_EQ(50ms, controller.settle(kStart));
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/SlowQueryLog.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+
+using namespace watchman;
+
+namespace {
+
+json_ref record(json_int_t n) {
+  return json_object({{"n", json_integer(n)}});
+}
+
+} // namespace
+
+TEST(SlowQueryLogTest, keeps_the_most_recent) {
+  SlowQueryLog log{2, w_string{""}};
+  log.add(record(1));
+  log.add(record(2));
+  log.add(record(3));
+
+  auto entries = log.entries();
+  ASSERT_EQ(2, entries.size());
+  EXPECT_EQ(2, entries[0].get("n").asInt());
+  EXPECT_EQ(3, entries[1].get("n").asInt());
+  EXPECT_EQ(3, log.numAdded());
+
+  log.clear();
+  EXPECT_TRUE(log.entries().empty());
+  EXPECT_EQ(3, log.numAdded());
+}
+
+TEST(SlowQueryLogTest, appends_to_the_file) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "slow.log").string();
+  {
+    SlowQueryLog log{0, w_string{path.c_str()}};
+    log.add(record(1));
+    log.add(record(2));
+    EXPECT_TRUE(log.entries().empty());
+  }
+  SlowQueryLog again{0, w_string{path.c_str()}};
+  again.add(record(3));
+
+  std::string contents;
+  ASSERT_TRUE(folly::readFile(path.c_str(), contents));
+  EXPECT_EQ("{\"n\":1}\n{\"n\":2}\n{\"n\":3}\n", contents);
+}
+
+TEST(SlowQueryLogTest, normalizes_the_query_spec) {
+  auto spec = json_object(
+      {{"since", typed_string_to_json("c:123:4:5:6")},
+       {"request_id", typed_string_to_json("abc")},
+       {"fields", json_array({typed_string_to_json("name")})}});
+  auto normalized = SlowQueryLog::normalizeQuerySpec(spec);
+  EXPECT_EQ("clock", json_to_w_string(normalized.get("since")).string());
+  EXPECT_FALSE(normalized.get_default("request_id"));
+  EXPECT_EQ(1, json_array_size(normalized.get("fields")));
+  // The spec itself is untouched
+  EXPECT_TRUE(spec.get_default("request_id"));
+
+  auto cursor = json_object({{"since", typed_string_to_json("n:build")}});
+  EXPECT_EQ(
+      "n:build",
+      json_to_w_string(
+          SlowQueryLog::normalizeQuerySpec(cursor).get("since"))
+          .string());
+
+  auto scm = json_object(
+      {{"since",
+        json_object(
+            {{"clock", typed_string_to_json("c:1:2:3:4")},
+             {"scm",
+              json_object(
+                  {{"mergebase", typed_string_to_json("f00")},
+                   {"mergebase-with", typed_string_to_json("main")}})}})}});
+  auto since = SlowQueryLog::normalizeQuerySpec(scm).get("since");
+  EXPECT_EQ("clock", json_to_w_string(since.get("clock")).string());
+  EXPECT_FALSE(since.get("scm").get_default("mergebase"));
+  EXPECT_TRUE(since.get("scm").get_default("mergebase-with"));
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <string>
+
+#include "watchman/StringBuffer.h"
+
+using namespace watchman;
+
+TEST(StringBufferTest, builds_and_truncates_paths) {
+  StringBuffer buf;
+  EXPECT_TRUE(buf.empty());
+  EXPECT_STREQ("", buf.c_str());
+
+  buf.appendComponent("foo");
+  auto mark = buf.size();
+  buf.appendComponent("bar.h");
+  EXPECT_EQ(w_string_piece("foo/bar.h"), buf.view());
+  EXPECT_STREQ("foo/bar.h", buf.c_str());
+
+  buf.resize(mark);
+  EXPECT_STREQ("foo", buf.c_str());
+  buf.appendComponent("baz");
+  EXPECT_EQ(w_string("foo/baz"), buf.asWString());
+}
+
+TEST(StringBufferTest, spills_to_the_heap) {
+  StringBuffer buf;
+  std::string expected;
+  while (expected.size() <= 2 * StringBuffer::kInlineSize) {
+    buf.appendComponent("component");
+    if (!expected.empty()) {
+      expected.push_back('/');
+    }
+    expected.append("component");
+  }
+  EXPECT_EQ(expected, std::string(buf.data(), buf.size()));
+  EXPECT_EQ(expected.size(), strlen(buf.c_str()));
+
+  buf.clear();
+  EXPECT_STREQ("", buf.c_str());
+}
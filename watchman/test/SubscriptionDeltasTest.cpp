@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionDeltas.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+json_ref file(const char* name, json_int_t size, json_int_t mtime) {
+  return json_object(
+      {{"name", typed_string_to_json(name, W_STRING_UNICODE)},
+       {"exists", json_true()},
+       {"size", json_integer(size)},
+       {"mtime", json_integer(mtime)}});
+}
+
+json_ref deleted(const char* name) {
+  return json_object(
+      {{"name", typed_string_to_json(name, W_STRING_UNICODE)},
+       {"exists", json_false()},
+       {"size", json_integer(0)},
+       {"mtime", json_integer(0)}});
+}
+
+json_ref files(std::vector<json_ref> list) {
+  auto array = json_array_of_size(list.size());
+  for (auto& item : list) {
+    array.array().push_back(std::move(item));
+  }
+  return array;
+}
+
+SubscriptionDeltas makeDeltas() {
+  return SubscriptionDeltas{{w_string{"name", W_STRING_UNICODE},
+                             w_string{"exists", W_STRING_UNICODE},
+                             w_string{"size", W_STRING_UNICODE},
+                             w_string{"mtime", W_STRING_UNICODE}}};
+}
+
+} // namespace
+
+TEST(SubscriptionDeltasTest, first_delivery_is_whole) {
+  auto deltas = makeDeltas();
+  auto encoded = deltas.encode(files({file("a", 1, 10), file("b", 2, 20)}));
+  ASSERT_EQ(2, encoded.array().size());
+  EXPECT_EQ(4, encoded.at(0).object().size());
+  EXPECT_EQ(4, encoded.at(1).object().size());
+  EXPECT_EQ(2, deltas.size());
+  EXPECT_EQ(0, deltas.elidedFields());
+}
+
+TEST(SubscriptionDeltasTest, only_changed_fields_are_sent) {
+  auto deltas = makeDeltas();
+  deltas.encode(files({file("a", 1, 10)}));
+
+  auto encoded = deltas.encode(files({file("a", 1, 11)}));
+  ASSERT_EQ(1, encoded.array().size());
+  auto& a = encoded.at(0);
+  EXPECT_EQ(2, a.object().size());
+  EXPECT_STREQ("a", a.get("name").asCString());
+  EXPECT_EQ(11, a.get("mtime").asInt());
+  EXPECT_EQ(2, deltas.elidedFields());
+}
+
+TEST(SubscriptionDeltasTest, unchanged_files_are_left_out) {
+  auto deltas = makeDeltas();
+  deltas.encode(files({file("a", 1, 10), file("b", 2, 20)}));
+
+  // a flapped back to what was delivered
+  auto encoded = deltas.encode(files({file("a", 1, 10), file("b", 3, 20)}));
+  ASSERT_EQ(1, encoded.array().size());
+  EXPECT_STREQ("b", encoded.at(0).get("name").asCString());
+  EXPECT_EQ(3, encoded.at(0).get("size").asInt());
+  EXPECT_EQ(4 + 2, deltas.elidedFields());
+}
+
+TEST(SubscriptionDeltasTest, recreated_files_are_sent_whole) {
+  auto deltas = makeDeltas();
+  deltas.encode(files({file("a", 1, 10)}));
+
+  auto encoded = deltas.encode(files({deleted("a")}));
+  ASSERT_EQ(1, encoded.array().size());
+  EXPECT_FALSE(encoded.at(0).get("exists").asBool());
+  EXPECT_EQ(0, deltas.size());
+
+  encoded = deltas.encode(files({file("a", 1, 10)}));
+  ASSERT_EQ(1, encoded.array().size());
+  EXPECT_EQ(4, encoded.at(0).object().size());
+}
+
+TEST(SubscriptionDeltasTest, reset_sends_everything_again) {
+  auto deltas = makeDeltas();
+  deltas.encode(files({file("a", 1, 10)}));
+  deltas.reset();
+  auto encoded = deltas.encode(files({file("a", 1, 10)}));
+  ASSERT_EQ(1, encoded.array().size());
+  EXPECT_EQ(4, encoded.at(0).object().size());
+}
+
+TEST(SubscriptionDeltasTest, keeps_the_template) {
+  auto deltas = makeDeltas();
+  auto list = files({file("a", 1, 10)});
+  auto templ = json_array(
+      {typed_string_to_json("name", W_STRING_UNICODE),
+       typed_string_to_json("exists", W_STRING_UNICODE),
+       typed_string_to_json("size", W_STRING_UNICODE),
+       typed_string_to_json("mtime", W_STRING_UNICODE)});
+  json_array_set_template(list, templ);
+  auto encoded = deltas.encode(list);
+  EXPECT_EQ((json_t*)templ, json_array_get_template(encoded));
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionDispatcher.h"
+#include <folly/portability/GTest.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+using Priority = SubscriptionDispatcher::Priority;
+
+TEST(SubscriptionDispatcherTest, unlimited) {
+  SubscriptionDispatcher dispatcher{0};
+  auto a = dispatcher.acquire(Priority::Normal, 0us);
+  auto b = dispatcher.acquire(Priority::Normal, 0us);
+  auto stats = dispatcher.getStats();
+  EXPECT_EQ(2, stats.running);
+  EXPECT_EQ(0, stats.waited);
+}
+
+TEST(SubscriptionDispatcherTest, slot_is_returned) {
+  SubscriptionDispatcher dispatcher{1};
+  { auto slot = dispatcher.acquire(Priority::Normal, 0us); }
+  auto slot = dispatcher.acquire(Priority::Normal, 0us);
+  auto stats = dispatcher.getStats();
+  EXPECT_EQ(1, stats.running);
+  EXPECT_EQ(2, stats.dispatched);
+  EXPECT_EQ(0, stats.waited);
+}
+
+TEST(SubscriptionDispatcherTest, waiters_run_by_priority_then_cost) {
+  SubscriptionDispatcher dispatcher{1};
+  auto held = std::make_unique<SubscriptionDispatcher::Slot>(
+      dispatcher.acquire(Priority::Normal, 0us));
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  std::vector<std::thread> threads;
+  auto wait = [&](std::string name, Priority priority,
+                  std::chrono::microseconds cost) {
+    size_t waiting = dispatcher.getStats().waiting;
+    threads.emplace_back([&, name, priority, cost] {
+      auto slot = dispatcher.acquire(priority, cost);
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+    });
+    // Queue them one at a time so that arrival order is known
+    while (dispatcher.getStats().waiting == waiting) {
+      std::this_thread::yield();
+    }
+  };
+  wait("slow", Priority::Normal, 5000us);
+  wait("low", Priority::Low, 0us);
+  wait("quick", Priority::Normal, 10us);
+  wait("urgent", Priority::High, 1000000us);
+  wait("quick again", Priority::Normal, 10us);
+
+  held.reset();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "urgent", "quick", "quick again", "slow", "low"}),
+      order);
+  auto stats = dispatcher.getStats();
+  EXPECT_EQ(0, stats.running);
+  EXPECT_EQ(0, stats.waiting);
+  EXPECT_EQ(6, stats.dispatched);
+  EXPECT_EQ(5, stats.waited);
+  EXPECT_EQ(5, dispatcher.getWaitLatency().count);
+}
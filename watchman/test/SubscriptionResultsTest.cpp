@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionResults.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+json_ref str(const char* value) {
+  return typed_string_to_json(value, W_STRING_UNICODE);
+}
+
+json_ref file(const char* name, json_int_t size, bool isNew) {
+  return json_object(
+      {{"name", str(name)},
+       {"size", json_integer(size)},
+       {"new", json_boolean(isNew)}});
+}
+
+json_ref results(
+    std::initializer_list<json_ref> files,
+    const char* since,
+    const char* clock) {
+  auto resp = json_object(
+      {{"subscription", str("sub")},
+       {"clock", str(clock)},
+       {"is_fresh_instance", json_false()},
+       {"files", json_array(files)}});
+  if (since) {
+    resp.set("since", str(since));
+  }
+  return resp;
+}
+
+std::vector<std::string> names(const json_ref& resp) {
+  std::vector<std::string> result;
+  for (auto& file : resp.get("files").array()) {
+    auto& name = file.isString() ? file : file.get("name");
+    result.emplace_back(name.asCString());
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(SubscriptionResultsTest, names_are_merged_once) {
+  auto older = results({str("a"), str("b")}, "c:1", "c:2");
+  auto newer = results({str("b"), str("c")}, "c:2", "c:3");
+  auto merged = mergeSubscriptionResults(older, newer, true, false);
+
+  EXPECT_EQ((std::vector<std::string>{"a", "b", "c"}), names(merged));
+  // As of the newer clock, since the older since
+  EXPECT_STREQ("c:1", merged.get("since").asCString());
+  EXPECT_STREQ("c:3", merged.get("clock").asCString());
+  EXPECT_STREQ("sub", merged.get("subscription").asCString());
+  EXPECT_FALSE(merged.get("is_fresh_instance").asBool());
+
+  // Neither input is modified
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), names(older));
+  EXPECT_EQ((std::vector<std::string>{"b", "c"}), names(newer));
+  EXPECT_STREQ("c:2", newer.get("since").asCString());
+}
+
+TEST(SubscriptionResultsTest, newer_entries_win) {
+  auto older =
+      results({file("a", 1, false), file("b", 2, true)}, "c:1", "c:2");
+  auto newer =
+      results({file("a", 10, false), file("b", 20, false)}, "c:2", "c:3");
+  auto merged = mergeSubscriptionResults(older, newer, false, false);
+
+  ASSERT_EQ((std::vector<std::string>{"a", "b"}), names(merged));
+  auto& a = merged.get("files").at(0);
+  auto& b = merged.get("files").at(1);
+  EXPECT_EQ(10, a.get("size").asInt());
+  EXPECT_FALSE(a.get("new").asBool());
+  EXPECT_EQ(20, b.get("size").asInt());
+  // b was created after the older since, so it is still new relative to it
+  EXPECT_TRUE(b.get("new").asBool());
+  // Without changing the entry that the newer results share
+  EXPECT_FALSE(newer.get("files").at(1).get("new").asBool());
+}
+
+TEST(SubscriptionResultsTest, deltas_are_combined) {
+  auto older = results(
+      {json_object({{"name", str("a")}, {"size", json_integer(1)}})},
+      "c:1",
+      "c:2");
+  auto newer = results(
+      {json_object({{"name", str("a")}, {"mtime", json_integer(5)}})},
+      "c:2",
+      "c:3");
+  auto merged = mergeSubscriptionResults(older, newer, false, true);
+
+  ASSERT_EQ(1, merged.get("files").array().size());
+  auto& a = merged.get("files").at(0);
+  EXPECT_EQ(1, a.get("size").asInt());
+  EXPECT_EQ(5, a.get("mtime").asInt());
+  EXPECT_FALSE(older.get("files").at(0).get_default("mtime"));
+}
+
+TEST(SubscriptionResultsTest, fresh_instances_stay_fresh) {
+  auto older = results({str("a")}, nullptr, "c:2");
+  older.set("is_fresh_instance", json_true());
+  auto newer = results({str("b")}, "c:2", "c:3");
+  auto merged = mergeSubscriptionResults(older, newer, true, false);
+
+  EXPECT_TRUE(merged.get("is_fresh_instance").asBool());
+  // There was no since before the older results, so there is none now
+  EXPECT_FALSE(merged.get_default("since"));
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), names(merged));
+}
+
+TEST(SubscriptionResultsTest, fresh_instance_marker) {
+  auto newer = results({str("a")}, "c:2", "c:3");
+  auto marker = freshInstanceMarker(newer);
+
+  EXPECT_TRUE(marker.get("files").array().empty());
+  EXPECT_TRUE(marker.get("is_fresh_instance").asBool());
+  EXPECT_FALSE(marker.get_default("since"));
+  EXPECT_STREQ("c:3", marker.get("clock").asCString());
+  EXPECT_EQ(1, newer.get("files").array().size());
+}
+
+TEST(SubscriptionResultsTest, only_results_are_merged) {
+  EXPECT_TRUE(isSubscriptionResults(results({}, "c:1", "c:2")));
+
+  for (auto key : {"state-enter", "state-leave"}) {
+    auto state = results({}, "c:1", "c:2");
+    state.set(key, str("hg.update"));
+    EXPECT_FALSE(isSubscriptionResults(state)) << key;
+  }
+
+  auto canceled = json_object(
+      {{"subscription", str("sub")},
+       {"canceled", json_true()},
+       {"files", json_array()}});
+  EXPECT_FALSE(isSubscriptionResults(canceled));
+
+  EXPECT_FALSE(isSubscriptionResults(
+      json_object({{"subscription", str("sub")}, {"clock", str("c:1")}})));
+}
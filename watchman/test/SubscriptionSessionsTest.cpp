@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SubscriptionSessions.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+const w_string kRoot{"/root", W_STRING_UNICODE};
+const w_string kName{"sub", W_STRING_UNICODE};
+
+json_ref query(const char* suffix) {
+  return json_object(
+      {{"expression",
+        json_array(
+            {typed_string_to_json("suffix", W_STRING_UNICODE),
+             typed_string_to_json(suffix, W_STRING_UNICODE)})}});
+}
+
+SubscriptionSessions::Session session(const char* suffix, const char* clock) {
+  return SubscriptionSessions::Session{
+      kRoot, kName, query(suffix), typed_string_to_json(clock)};
+}
+
+} // namespace
+
+TEST(SubscriptionSessionsTest, resumes_from_the_delivered_clock) {
+  SubscriptionSessions sessions{8};
+  auto now = SubscriptionSessions::Clock::now();
+  sessions.detach(w_string{"t"}, session("js", "c:1:2:3:4"), 10s, now);
+  EXPECT_EQ(1, sessions.size());
+
+  auto clock = sessions.resume(w_string{"t"}, kRoot, kName, query("js"), now);
+  ASSERT_TRUE(clock);
+  EXPECT_STREQ("c:1:2:3:4", clock.asCString());
+  EXPECT_EQ(1, sessions.resumed());
+
+  // A token is only good once
+  EXPECT_FALSE(sessions.resume(w_string{"t"}, kRoot, kName, query("js"), now));
+  EXPECT_EQ(0, sessions.size());
+}
+
+TEST(SubscriptionSessionsTest, the_query_must_match) {
+  SubscriptionSessions sessions{8};
+  auto now = SubscriptionSessions::Clock::now();
+  sessions.detach(w_string{"t"}, session("js", "c:1:2:3:4"), 10s, now);
+  EXPECT_FALSE(sessions.resume(w_string{"t"}, kRoot, kName, query("py"), now));
+  EXPECT_EQ(0, sessions.size());
+
+  // The token that the client presents isn't part of its query
+  sessions.detach(w_string{"t"}, session("js", "c:1:2:3:4"), 10s, now);
+  auto withToken = query("js");
+  withToken.set("resume_token", typed_string_to_json("t"));
+  EXPECT_TRUE(sessions.resume(w_string{"t"}, kRoot, kName, withToken, now));
+  EXPECT_TRUE(withToken.get_default("resume_token"));
+}
+
+TEST(SubscriptionSessionsTest, sessions_expire) {
+  SubscriptionSessions sessions{8};
+  auto now = SubscriptionSessions::Clock::now();
+  sessions.detach(w_string{"t"}, session("js", "c:1:2:3:4"), 10s, now);
+  EXPECT_FALSE(
+      sessions.resume(w_string{"t"}, kRoot, kName, query("js"), now + 11s));
+  EXPECT_EQ(1, sessions.expired());
+
+  // Without a grace period nothing is kept
+  sessions.detach(w_string{"t"}, session("js", "c:1:2:3:4"), 0s, now);
+  EXPECT_EQ(0, sessions.size());
+}
+
+TEST(SubscriptionSessionsTest, drops_the_oldest_sessions) {
+  SubscriptionSessions sessions{2};
+  auto now = SubscriptionSessions::Clock::now();
+  sessions.detach(w_string{"a"}, session("js", "c:1:2:3:4"), 10s, now);
+  sessions.detach(w_string{"b"}, session("js", "c:1:2:3:5"), 10s, now);
+  sessions.detach(w_string{"c"}, session("js", "c:1:2:3:6"), 10s, now);
+  EXPECT_EQ(2, sessions.size());
+  EXPECT_EQ(1, sessions.expired());
+  EXPECT_FALSE(sessions.resume(w_string{"a"}, kRoot, kName, query("js"), now));
+  EXPECT_TRUE(sessions.resume(w_string{"c"}, kRoot, kName, query("js"), now));
+}
+
+TEST(SubscriptionSessionsTest, tokens_are_unique) {
+  auto a = SubscriptionSessions::newToken();
+  auto b = SubscriptionSessions::newToken();
+  EXPECT_EQ(32, a.size());
+  EXPECT_NE(a, b);
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadAccounting.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+std::optional<ThreadAccount::Stats> find(
+    const std::vector<ThreadAccount::Stats>& all,
+    const std::string& kind,
+    bool exited) {
+  for (auto& stats : all) {
+    if (stats.kind == kind && stats.exited == exited) {
+      return stats;
+    }
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+TEST(ThreadAccountingTest, unaccounted_threads_are_not_measured) {
+  std::thread([] {
+    EXPECT_EQ(nullptr, ThreadAccount::current());
+    ThreadWait wait(ThreadAccount::Lock);
+    ThreadAccount::recordWait(ThreadAccount::Io, 1s);
+  }).join();
+}
+
+TEST(ThreadAccountingTest, accounts_for_cpu_and_waits) {
+  std::thread([] {
+    ThreadAccount account{"test-waits", "/root"};
+    EXPECT_EQ(&account, ThreadAccount::current());
+
+    {
+      ThreadWait wait(ThreadAccount::Lock);
+      std::this_thread::sleep_for(20ms);
+    }
+    ThreadAccount::recordWait(ThreadAccount::Io, 5ms);
+    ThreadAccount::recordWait(ThreadAccount::Io, 5ms);
+
+    // Burn some CPU
+    auto deadline = std::chrono::steady_clock::now() + 20ms;
+    volatile uint64_t spin = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+      spin = spin + 1;
+    }
+
+    auto stats = find(ThreadAccount::getLiveStats(), "test-waits", false);
+    ASSERT_TRUE(stats);
+    EXPECT_EQ("/root", stats->root);
+    EXPECT_GE(stats->waitTime[ThreadAccount::Lock], 20ms);
+    EXPECT_EQ(1, stats->waits[ThreadAccount::Lock]);
+    EXPECT_EQ(10ms, stats->waitTime[ThreadAccount::Io]);
+    EXPECT_EQ(2, stats->waits[ThreadAccount::Io]);
+    EXPECT_GE(stats->age, 40ms);
+#ifndef _WIN32
+    // Windows counts CPU time in scheduler quanta
+    ASSERT_TRUE(stats->cpu);
+    EXPECT_GT(*stats->cpu, 0ns);
+#endif
+  }).join();
+}
+
+TEST(ThreadAccountingTest, exited_threads_are_summed) {
+  for (int i = 0; i < 2; ++i) {
+    std::thread([] {
+      ThreadAccount account{"test-exited"};
+      ThreadAccount::recordWait(ThreadAccount::Lock, 3ms);
+    }).join();
+  }
+
+  auto all = ThreadAccount::getAllStats();
+  EXPECT_FALSE(find(all, "test-exited", false));
+  auto total = find(all, "test-exited", true);
+  ASSERT_TRUE(total);
+  EXPECT_EQ(6ms, total->waitTime[ThreadAccount::Lock]);
+  EXPECT_EQ(2, total->waits[ThreadAccount::Lock]);
+}
+
+TEST(ThreadAccountingTest, exports_metrics_by_kind) {
+  std::thread([] {
+    ThreadAccount account{"test-metrics", "/root"};
+    ThreadAccount::recordWait(ThreadAccount::Io, 2ms);
+
+    MetricsWriter writer;
+    ThreadAccount::collectMetrics(writer);
+    auto text = writer.render();
+    EXPECT_NE(
+        std::string::npos,
+        text.find("watchman_threads{thread=\"test-metrics\"} 1"));
+    EXPECT_NE(
+        std::string::npos,
+        text.find("watchman_thread_wait_seconds_total{thread=\"test-metrics\","
+                  "root=\"/root\",wait=\"io\"} 0.002"));
+  }).join();
+}
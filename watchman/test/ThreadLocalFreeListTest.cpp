@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "watchman/ThreadLocalFreeList.h"
+
+using namespace watchman;
+
+namespace {
+
+// Each test uses its own Tag so that it starts out with empty lists
+template <int Tag>
+struct Block {
+  using FreeList = ThreadLocalFreeList<Block, 4>;
+
+  static void* operator new(size_t size) {
+    return FreeList::allocate(size);
+  }
+  static void operator delete(void* ptr, size_t size) {
+    FreeList::deallocate(ptr, size);
+  }
+
+  char data[48];
+};
+
+template <int Tag>
+struct BiggerBlock : Block<Tag> {
+  char more[16];
+};
+
+} // namespace
+
+TEST(ThreadLocalFreeListTest, freed_blocks_are_reused) {
+  using B = Block<1>;
+  std::vector<B*> blocks{new B, new B, new B};
+  EXPECT_EQ(0, B::FreeList::numFree());
+
+  for (auto block : blocks) {
+    delete block;
+  }
+  EXPECT_EQ(3, B::FreeList::numFree());
+
+  // Most recently freed first
+  for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+    auto block = new B;
+    EXPECT_EQ(*it, block);
+    *it = block;
+  }
+  EXPECT_EQ(0, B::FreeList::numFree());
+
+  // Once the list is empty, blocks come from the allocator again
+  std::unique_ptr<B> fresh{new B};
+  EXPECT_EQ(0, std::set<B*>(blocks.begin(), blocks.end()).count(fresh.get()));
+
+  for (auto block : blocks) {
+    delete block;
+  }
+}
+
+TEST(ThreadLocalFreeListTest, list_is_bounded) {
+  using B = Block<2>;
+  std::vector<B*> blocks;
+  for (int i = 0; i < 6; ++i) {
+    blocks.push_back(new B);
+  }
+  for (auto block : blocks) {
+    delete block;
+  }
+  // The rest went back to the allocator
+  EXPECT_EQ(4, B::FreeList::numFree());
+
+  std::set<B*> reused;
+  for (int i = 0; i < 4; ++i) {
+    reused.insert(new B);
+  }
+  EXPECT_EQ(std::set<B*>(blocks.begin(), blocks.begin() + 4), reused);
+  for (auto block : reused) {
+    delete block;
+  }
+}
+
+TEST(ThreadLocalFreeListTest, other_sizes_bypass_the_list) {
+  using B = Block<3>;
+  using Bigger = BiggerBlock<3>;
+  delete new Bigger;
+  EXPECT_EQ(0, B::FreeList::numFree());
+
+  delete new B;
+  EXPECT_EQ(1, B::FreeList::numFree());
+  std::unique_ptr<Bigger> bigger{new Bigger};
+  EXPECT_EQ(1, B::FreeList::numFree());
+}
+
+TEST(ThreadLocalFreeListTest, each_thread_has_its_own_list) {
+  using B = Block<4>;
+  auto block = new B;
+
+  // Freed on another thread, the block joins that thread's list
+  size_t numFreeThere = 0;
+  std::thread other([&] {
+    delete block;
+    numFreeThere = B::FreeList::numFree();
+    // And is only handed out again there
+    auto again = new B;
+    EXPECT_EQ(block, again);
+    delete again;
+  });
+  other.join();
+  EXPECT_EQ(1, numFreeThere);
+  EXPECT_EQ(0, B::FreeList::numFree());
+
+  std::unique_ptr<B> here{new B};
+  EXPECT_EQ(0, B::FreeList::numFree());
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPool.h"
+#include <folly/portability/GTest.h>
+#include <future>
+#include <mutex>
+#include <vector>
+
+using namespace watchman;
+
+TEST(ThreadPoolTest, runs_tasks_added_before_start) {
+  ThreadPool pool;
+  std::promise<void> ran;
+  pool.add([&] { ran.set_value(); });
+  pool.start(2, 1024);
+  ran.get_future().get();
+  pool.stop();
+  EXPECT_EQ(
+      1u,
+      pool.stats()
+          .priorities[size_t(ThreadPool::Priority::Normal)]
+          .executed);
+}
+
+TEST(ThreadPoolTest, higher_priorities_go_first) {
+  ThreadPool pool;
+  pool.start(1, 1024);
+
+  // Occupy the only worker while we queue up the others
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> blocked;
+  pool.add([&] {
+    blocked.set_value();
+    released.wait();
+  });
+  blocked.get_future().get();
+
+  std::mutex mutex;
+  std::vector<int> order;
+  auto record = [&](int n) {
+    return [&, n] {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(n);
+    };
+  };
+  pool.add(record(3), ThreadPool::Priority::Low);
+  pool.add(record(2), ThreadPool::Priority::Normal);
+  pool.executor(ThreadPool::Priority::High)->add(record(1));
+  pool.addWithPriority(record(4), folly::Executor::LO_PRI);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(1u, stats.priorities[size_t(ThreadPool::Priority::High)].queued);
+  EXPECT_EQ(2u, stats.priorities[size_t(ThreadPool::Priority::Low)].queued);
+
+  release.set_value();
+  pool.stop();
+  EXPECT_EQ((std::vector<int>{1, 2, 3, 4}), order);
+}
+
+TEST(ThreadPoolTest, idle_workers_steal) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+
+  // The child task is queued on the worker that runs its parent, which
+  // then waits for it, so only the other worker can run it
+  std::promise<void> done;
+  pool.add([&] {
+    std::promise<void> child;
+    pool.add([&] { child.set_value(); });
+    child.get_future().get();
+    done.set_value();
+  });
+  done.get_future().get();
+  pool.stop();
+  EXPECT_LE(1u, pool.stats().steals);
+}
+
+TEST(ThreadPoolTest, rejects_tasks_beyond_the_limit) {
+  ThreadPool pool;
+  pool.start(1, 3);
+
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  std::promise<void> blocked;
+  pool.add([&] {
+    blocked.set_value();
+    released.wait();
+  });
+  blocked.get_future().get();
+
+  pool.add([] {});
+  pool.add([] {});
+  EXPECT_THROW(pool.add([] {}), std::runtime_error);
+
+  release.set_value();
+  pool.stop();
+  EXPECT_THROW(pool.add([] {}), std::runtime_error);
+}
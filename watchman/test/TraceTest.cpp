@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Trace.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <thread>
+#include "watchman/Logging.h"
+
+using namespace watchman;
+
+namespace {
+
+// Runs `func` on a new thread called `name` and waits for it to exit
+template <typename Func>
+void runOnThread(const std::string& name, Func func) {
+  std::thread thread([&] {
+    w_set_thread_name(name);
+    func();
+  });
+  thread.join();
+}
+
+const ThreadTrace* findThread(
+    const std::vector<ThreadTrace>& threads,
+    const std::string& name) {
+  for (auto& thread : threads) {
+    if (thread.threadName == name) {
+      return &thread;
+    }
+  }
+  return nullptr;
+}
+
+class TraceTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    configureTracing(16);
+    clearTrace();
+  }
+
+  void TearDown() override {
+    configureTracing(0);
+  }
+};
+
+} // namespace
+
+TEST_F(TraceTest, nothing_is_recorded_when_disabled) {
+  configureTracing(0);
+  EXPECT_FALSE(isTracingEnabled());
+  runOnThread("disabled", [] { TraceSpan span("test", "span"); });
+  EXPECT_EQ(nullptr, findThread(collectTrace(), "disabled"));
+}
+
+TEST_F(TraceTest, spans_are_recorded_in_order_of_completion) {
+  runOnThread("spans", [] {
+    TraceSpan outer("test", "outer");
+    { TraceSpan inner("test", "inner", "detail"); }
+  });
+
+  auto threads = collectTrace();
+  auto thread = findThread(threads, "spans");
+  ASSERT_NE(nullptr, thread);
+  ASSERT_EQ(2, thread->events.size());
+  auto& inner = thread->events[0];
+  auto& outer = thread->events[1];
+  EXPECT_STREQ("inner", inner.name);
+  EXPECT_EQ("detail", inner.getDetail());
+  EXPECT_STREQ("outer", outer.name);
+  EXPECT_EQ("", outer.getDetail());
+  EXPECT_LE(outer.start, inner.start);
+  EXPECT_GE(outer.start + outer.duration, inner.start + inner.duration);
+}
+
+TEST_F(TraceTest, long_details_keep_their_tail) {
+  TraceEvent event;
+  std::string path(100, 'a');
+  path += "/the/end";
+  event.setDetail(path);
+  auto detail = event.getDetail();
+  EXPECT_EQ(sizeof(event.detail) - 1, detail.size());
+  EXPECT_EQ(path.substr(path.size() - detail.size()), detail);
+}
+
+TEST_F(TraceTest, clear_forgets_recorded_events) {
+  runOnThread("cleared", [] { TraceSpan span("test", "span"); });
+  ASSERT_NE(nullptr, findThread(collectTrace(), "cleared"));
+  clearTrace();
+  EXPECT_EQ(nullptr, findThread(collectTrace(), "cleared"));
+}
+
+TEST_F(TraceTest, chrome_json_has_metadata_and_complete_events) {
+  runOnThread("chrome", [] { TraceSpan span("test", "span", "x"); });
+  auto threads = collectTrace();
+  auto thread = findThread(threads, "chrome");
+  ASSERT_NE(nullptr, thread);
+
+  auto json = traceToChromeJson({*thread});
+  auto events = json.get("traceEvents");
+  ASSERT_EQ(2, json_array_size(events));
+  auto meta = json_array_get(events, 0);
+  EXPECT_EQ(w_string("M"), meta.get("ph").asString());
+  EXPECT_EQ(
+      w_string("chrome"), meta.get("args").get("name").asString());
+  auto span = json_array_get(events, 1);
+  EXPECT_EQ(w_string("X"), span.get("ph").asString());
+  EXPECT_EQ(w_string("span"), span.get("name").asString());
+  EXPECT_EQ(w_string("x"), span.get("args").get("detail").asString());
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TriggerScheduler.h"
+#include <folly/portability/GTest.h>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+const TriggerScheduler::Clock::time_point kStart{};
+
+} // namespace
+
+TEST(TriggerSchedulerTest, unlimited_grants_every_request) {
+  TriggerScheduler scheduler{0};
+  std::vector<TriggerScheduler::Id> ids;
+  for (int i = 0; i < 10; ++i) {
+    ids.push_back(scheduler.add([] {}));
+  }
+  for (auto id : ids) {
+    EXPECT_TRUE(scheduler.request(id, kStart));
+  }
+}
+
+TEST(TriggerSchedulerTest, waits_for_a_slot_and_coalesces) {
+  TriggerScheduler scheduler{1};
+  int woken = 0;
+  auto first = scheduler.add([] {});
+  auto second = scheduler.add([&] { ++woken; });
+
+  EXPECT_TRUE(scheduler.request(first, kStart));
+  // Asking again while running keeps the slot
+  EXPECT_TRUE(scheduler.request(first, kStart));
+
+  EXPECT_FALSE(scheduler.request(second, kStart));
+  EXPECT_FALSE(scheduler.request(second, kStart + 10ms));
+  auto stats = scheduler.stats(second, kStart + 20ms);
+  EXPECT_EQ(TriggerScheduler::State::Queued, stats.state);
+  EXPECT_EQ(20ms, stats.queuedFor);
+  EXPECT_EQ(1u, stats.coalesced);
+
+  scheduler.release(first, kStart + 50ms);
+  EXPECT_EQ(1, woken);
+  EXPECT_EQ(50ms, scheduler.stats(first, kStart + 50ms).lastRunTime);
+
+  stats = scheduler.stats(second, kStart + 50ms);
+  EXPECT_EQ(TriggerScheduler::State::Running, stats.state);
+  EXPECT_EQ(50ms, stats.lastQueueTime);
+  EXPECT_TRUE(scheduler.request(second, kStart + 50ms));
+}
+
+TEST(TriggerSchedulerTest, quick_triggers_go_first) {
+  TriggerScheduler scheduler{1};
+  std::vector<int> order;
+  auto blocker = scheduler.add([] {});
+  auto slow = scheduler.add([&] { order.push_back(1); });
+  auto quick = scheduler.add([&] { order.push_back(2); });
+
+  // Give each a history
+  EXPECT_TRUE(scheduler.request(slow, kStart));
+  scheduler.release(slow, kStart + 5s);
+  EXPECT_TRUE(scheduler.request(quick, kStart + 5s));
+  scheduler.release(quick, kStart + 5s + 10ms);
+
+  EXPECT_TRUE(scheduler.request(blocker, kStart + 6s));
+  EXPECT_FALSE(scheduler.request(slow, kStart + 6s));
+  EXPECT_FALSE(scheduler.request(quick, kStart + 6s + 100ms));
+  scheduler.release(blocker, kStart + 7s);
+  EXPECT_EQ(std::vector<int>{2}, order);
+
+  scheduler.release(quick, kStart + 7s + 10ms);
+  EXPECT_EQ((std::vector<int>{2, 1}), order);
+}
+
+TEST(TriggerSchedulerTest, waiting_ages_into_priority) {
+  TriggerScheduler scheduler{1};
+  std::vector<int> order;
+  auto blocker = scheduler.add([] {});
+  auto slow = scheduler.add([&] { order.push_back(1); });
+  auto quick = scheduler.add([&] { order.push_back(2); });
+
+  EXPECT_TRUE(scheduler.request(slow, kStart));
+  scheduler.release(slow, kStart + 1s);
+
+  // The slow trigger has waited for longer than its last run took
+  EXPECT_TRUE(scheduler.request(blocker, kStart + 1s));
+  EXPECT_FALSE(scheduler.request(slow, kStart + 1s));
+  EXPECT_FALSE(scheduler.request(quick, kStart + 3s));
+  scheduler.release(blocker, kStart + 3s);
+  EXPECT_EQ(std::vector<int>{1}, order);
+}
+
+TEST(TriggerSchedulerTest, remove_frees_the_slot) {
+  TriggerScheduler scheduler{1};
+  int woken = 0;
+  auto first = scheduler.add([] {});
+  auto second = scheduler.add([&] { ++woken; });
+
+  EXPECT_TRUE(scheduler.request(first, kStart));
+  EXPECT_FALSE(scheduler.request(second, kStart));
+  scheduler.remove(first, kStart + 1s);
+  EXPECT_EQ(1, woken);
+  EXPECT_EQ(
+      TriggerScheduler::State::Idle, scheduler.stats(first, kStart).state);
+
+  // A removed trigger that was waiting doesn't hold up the others
+  auto third = scheduler.add([] {});
+  scheduler.remove(second, kStart + 2s);
+  EXPECT_TRUE(scheduler.request(third, kStart + 2s));
+}
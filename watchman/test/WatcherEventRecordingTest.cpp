@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/WatcherEventRecording.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+class WatcherEventRecordingTest : public testing::Test {
+ public:
+  folly::test::TemporaryDirectory dir;
+  const w_string path{(dir.path() / "events").string()};
+  const w_string rootPath{"/root"};
+  const std::chrono::system_clock::time_point now{std::chrono::seconds{1000}};
+};
+
+std::vector<RecordedWatcherEvent> readAll(WatcherEventReader& reader) {
+  std::vector<RecordedWatcherEvent> events;
+  while (auto event = reader.next()) {
+    events.push_back(std::move(*event));
+  }
+  return events;
+}
+
+} // namespace
+
+TEST_F(WatcherEventRecordingTest, events_can_be_read_back) {
+  {
+    WatcherEventRecorder recorder{path, rootPath, 1024 * 1024};
+    recorder.record(w_string{"/root/a"}, now, W_PENDING_VIA_NOTIFY);
+    recorder.record(
+        w_string{"/root/dir"},
+        now + std::chrono::microseconds{1500},
+        W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED);
+    recorder.flush();
+  }
+
+  WatcherEventReader reader{path.c_str()};
+  EXPECT_EQ(rootPath, reader.getRootPath());
+  auto events = readAll(reader);
+  ASSERT_EQ(2, events.size());
+  EXPECT_EQ(w_string{"/root/a"}, events[0].path);
+  EXPECT_EQ(now, events[0].time);
+  EXPECT_EQ(W_PENDING_VIA_NOTIFY, events[0].flags);
+  EXPECT_EQ(w_string{"/root/dir"}, events[1].path);
+  EXPECT_EQ(now + std::chrono::microseconds{1500}, events[1].time);
+  EXPECT_EQ(W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED, events[1].flags);
+}
+
+TEST_F(WatcherEventRecordingTest, partial_event_is_ignored) {
+  {
+    WatcherEventRecorder recorder{path, rootPath, 1024 * 1024};
+    recorder.record(w_string{"/root/a"}, now, W_PENDING_VIA_NOTIFY);
+    recorder.record(w_string{"/root/b"}, now, W_PENDING_VIA_NOTIFY);
+  }
+
+  std::string data;
+  ASSERT_TRUE(folly::readFile(path.c_str(), data));
+  data.resize(data.size() - 3);
+  ASSERT_TRUE(folly::writeFile(data, path.c_str()));
+
+  WatcherEventReader reader{path.c_str()};
+  auto events = readAll(reader);
+  ASSERT_EQ(1, events.size());
+  EXPECT_EQ(w_string{"/root/a"}, events[0].path);
+}
+
+TEST_F(WatcherEventRecordingTest, recording_is_bounded) {
+  const uint64_t maxBytes = 4096;
+  {
+    WatcherEventRecorder recorder{path, rootPath, maxBytes};
+    for (int i = 0; i < 1000; ++i) {
+      recorder.record(
+          w_string::build("/root/file", i), now, W_PENDING_CRAWL_ONLY);
+      recorder.flush();
+    }
+  }
+
+  std::string current, previous;
+  ASSERT_TRUE(folly::readFile(path.c_str(), current));
+  ASSERT_TRUE(folly::readFile(w_string::build(path, ".1").c_str(), previous));
+  EXPECT_LE(current.size() + previous.size(), maxBytes);
+
+  // The most recent events are kept
+  WatcherEventReader reader{path.c_str()};
+  auto events = readAll(reader);
+  ASSERT_FALSE(events.empty());
+  EXPECT_EQ(w_string{"/root/file999"}, events.back().path);
+}
+
+TEST_F(WatcherEventRecordingTest, rejects_other_files) {
+  ASSERT_TRUE(folly::writeFile(std::string{"not a recording"}, path.c_str()));
+  EXPECT_THROW(WatcherEventReader{path.c_str()}, std::runtime_error);
+}
+
+TEST_F(WatcherEventRecordingTest, paths_are_rebased) {
+  const w_string toRoot{"/other"};
+  EXPECT_EQ(toRoot, rebaseRecordedPath(w_string{"/root"}, rootPath, toRoot));
+  EXPECT_EQ(
+      w_string{"/other/a/b"},
+      rebaseRecordedPath(w_string{"/root/a/b"}, rootPath, toRoot));
+  EXPECT_EQ(
+      w_string{"/rooted/a"},
+      rebaseRecordedPath(w_string{"/rooted/a"}, rootPath, toRoot));
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/cppclient/WatchmanClientPool.h"
+#include <folly/Conv.h>
+#include <folly/executors/InlineExecutor.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/portability/GTest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "watchman/test/lib/FakeWatchmanServer.h"
+
+using namespace watchman;
+using folly::dynamic;
+
+namespace {
+
+constexpr auto kTimeout = std::chrono::seconds(10);
+
+// Records the updates of a subscription
+class Updates {
+ public:
+  SubscriptionCallback callback() {
+    return [this](folly::Try<dynamic>&& data) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      received_.push_back(std::move(data));
+      cond_.notify_all();
+    };
+  }
+
+  std::vector<folly::Try<dynamic>> waitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, kTimeout, [&] { return received_.size() >= count; });
+    return received_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<folly::Try<dynamic>> received_;
+};
+
+class WatchmanClientPoolTest : public testing::Test {
+ protected:
+  std::shared_ptr<WatchmanClientPool> makePool() {
+    auto pool = std::make_shared<WatchmanClientPool>(
+        ebt.getEventBase(), 2, server.path());
+    pool->connect().get(kTimeout);
+    return pool;
+  }
+
+  PooledSubscriptionPtr subscribe(
+      WatchmanClientPool& pool,
+      WatchPathPtr path,
+      Updates& updates) {
+    return pool
+        .subscribe(
+            dynamic::object("fields", dynamic::array("name")),
+            std::move(path),
+            &folly::InlineExecutor::instance(),
+            updates.callback())
+        .get(kTimeout);
+  }
+
+  // Answers the next command, which must arrive on `peer`
+  void answerClock(const std::shared_ptr<FakeWatchmanServer::Peer>& peer) {
+    auto requests = server.waitForRequests(1);
+    EXPECT_EQ(peer, requests[0].peer);
+    requests[0].peer->write(dynamic::object("clock", requests[0].pdu[1]));
+  }
+
+  // Waits for the pool to notice that one of its connections broke
+  static void waitUntilDead(WatchmanClientPool& pool) {
+    auto deadline = std::chrono::steady_clock::now() + kTimeout;
+    while (!pool.isDead()) {
+      ASSERT_LT(std::chrono::steady_clock::now(), deadline);
+      /* sleep override */ std::this_thread::sleep_for(
+          std::chrono::milliseconds(10));
+    }
+  }
+
+  // Declared first so that they outlive whatever the event base thread
+  // still holds of the subscriptions
+  Updates first;
+  Updates second;
+  Updates third;
+  FakeWatchmanServer server;
+  folly::ScopedEventBaseThread ebt;
+};
+
+} // namespace
+
+TEST_F(WatchmanClientPoolTest, commands_skip_broken_connections) {
+  auto pool = makePool();
+  auto peers = server.waitForPeers(2);
+
+  // Commands take turns between the connections
+  auto a = pool->run(dynamic::array("clock", "/a"));
+  auto b = pool->run(dynamic::array("clock", "/b"));
+  auto requests = server.waitForRequests(2);
+  EXPECT_NE(requests[0].peer, requests[1].peer);
+  for (auto& request : requests) {
+    request.peer->write(dynamic::object("clock", request.pdu[1]));
+  }
+  EXPECT_EQ("/a", std::move(a).get(kTimeout)["clock"].asString());
+  EXPECT_EQ("/b", std::move(b).get(kTimeout)["clock"].asString());
+
+  // Once one breaks, the other takes every command
+  peers[0]->close();
+  waitUntilDead(*pool);
+  for (int i = 0; i < 4; ++i) {
+    auto path = folly::to<std::string>("/", i);
+    auto result = pool->run(dynamic::array("clock", path));
+    answerClock(peers[1]);
+    EXPECT_EQ(path, std::move(result).get(kTimeout)["clock"].asString());
+  }
+}
+
+TEST_F(WatchmanClientPoolTest, subscribers_start_anew_after_a_break) {
+  auto pool = makePool();
+  auto peers = server.waitForPeers(2);
+  auto watch = pool->watch("/root").get(kTimeout);
+
+  auto firstSub = subscribe(*pool, watch, first);
+  auto secondSub = subscribe(*pool, watch, second);
+  EXPECT_EQ(1, pool->numUpstreamSubscriptions());
+
+  auto hosting = peers[0]->subscriptions().empty() ? peers[1] : peers[0];
+  auto other = hosting == peers[0] ? peers[1] : peers[0];
+  ASSERT_EQ(1, hosting->subscriptions().size());
+  EXPECT_TRUE(other->subscriptions().empty());
+
+  // Both subscribers get the updates of the one subscription
+  hosting->write(dynamic::object("unilateral", true)(
+      "subscription", hosting->subscriptions()[0])(
+      "files", dynamic::array("a")));
+  for (auto* updates : {&first, &second}) {
+    auto received = updates->waitFor(1);
+    ASSERT_EQ(1, received.size());
+    EXPECT_EQ(dynamic::array("a"), received[0].value()["files"]);
+  }
+
+  // And both hear that its connection broke
+  hosting->close();
+  for (auto* updates : {&first, &second}) {
+    auto received = updates->waitFor(2);
+    ASSERT_EQ(2, received.size());
+    EXPECT_TRUE(received[1].hasException());
+  }
+  EXPECT_EQ(0, pool->numUpstreamSubscriptions());
+
+  // A later subscriber gets a subscription of its own on the live connection
+  auto thirdSub = subscribe(*pool, watch, third);
+  EXPECT_EQ(1, pool->numUpstreamSubscriptions());
+  ASSERT_EQ(1, other->subscriptions().size());
+  other->write(dynamic::object("unilateral", true)(
+      "subscription", other->subscriptions()[0])(
+      "files", dynamic::array("b")));
+  auto received = third.waitFor(1);
+  ASSERT_EQ(1, received.size());
+  EXPECT_EQ(dynamic::array("b"), received[0].value()["files"]);
+
+  // Leaving the broken subscription needn't ask its connection
+  pool->unsubscribe(firstSub).get(kTimeout);
+  pool->unsubscribe(secondSub).get(kTimeout);
+  EXPECT_EQ(1, pool->numUpstreamSubscriptions());
+
+  pool->unsubscribe(thirdSub).get(kTimeout);
+  EXPECT_EQ(0, pool->numUpstreamSubscriptions());
+  EXPECT_TRUE(other->subscriptions().empty());
+}
+
+TEST_F(WatchmanClientPoolTest, getShared_replaces_a_dead_pool) {
+  auto pool = WatchmanClientPool::getShared(ebt.getEventBase(), server.path());
+  EXPECT_EQ(
+      pool, WatchmanClientPool::getShared(ebt.getEventBase(), server.path()));
+  pool->connect().get(kTimeout);
+  auto peers = server.waitForPeers(2);
+
+  peers[1]->close();
+  waitUntilDead(*pool);
+  auto replacement =
+      WatchmanClientPool::getShared(ebt.getEventBase(), server.path());
+  EXPECT_NE(pool, replacement);
+
+  // The old pool still works while somebody holds it
+  auto result = pool->run(dynamic::array("clock", "/old"));
+  answerClock(peers[0]);
+  EXPECT_EQ("/old", std::move(result).get(kTimeout)["clock"].asString());
+
+  replacement->connect().get(kTimeout);
+  result = replacement->run(dynamic::array("clock", "/new"));
+  auto requests = server.waitForRequests(1);
+  EXPECT_NE(peers[0], requests[0].peer);
+  requests[0].peer->write(dynamic::object("clock", "/new"));
+  EXPECT_EQ("/new", std::move(result).get(kTimeout)["clock"].asString());
+}
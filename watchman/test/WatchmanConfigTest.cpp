@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/WatchmanConfig.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(WatchmanConfigTest, snapshot_follows_config_changes) {
+  auto before = cfg_get_snapshot();
+  ASSERT_TRUE(before);
+  EXPECT_FALSE(before->useBulkstat.has_value());
+  EXPECT_EQ(1.0, before->slowCommandLogThresholdSeconds);
+
+  cfg_set_arg("_use_bulkstat", json_boolean(false));
+  cfg_set_arg("slow_command_log_threshold_seconds", json_real(2.5));
+  auto after = cfg_get_snapshot();
+  EXPECT_EQ(std::optional<bool>(false), after->useBulkstat);
+  EXPECT_EQ(2.5, after->slowCommandLogThresholdSeconds);
+
+  // A held snapshot doesn't change
+  EXPECT_FALSE(before->useBulkstat.has_value());
+
+  // A value of the wrong type leaves the default
+  cfg_set_arg("_use_bulkstat", typed_string_to_json("yes"));
+  EXPECT_FALSE(cfg_get_snapshot()->useBulkstat.has_value());
+
+  cfg_shutdown();
+  EXPECT_EQ(1.0, cfg_get_snapshot()->slowCommandLogThresholdSeconds);
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/cppclient/WatchmanConnection.h"
+#include <folly/experimental/bser/Bser.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/portability/GTest.h>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include "watchman/test/lib/FakeWatchmanServer.h"
+
+using namespace watchman;
+using folly::dynamic;
+
+namespace {
+
+constexpr auto kTimeout = std::chrono::seconds(10);
+
+// Records what the connection passes to its callback
+class Unilaterals {
+ public:
+  WatchmanConnection::Callback callback() {
+    return [this](folly::Try<dynamic> data) {
+      std::lock_guard<std::mutex> guard(mutex_);
+      received_.push_back(std::move(data));
+      cond_.notify_all();
+    };
+  }
+
+  std::vector<folly::Try<dynamic>> waitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait_for(lock, kTimeout, [&] { return received_.size() >= count; });
+    return received_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<folly::Try<dynamic>> received_;
+};
+
+class WatchmanConnectionTest : public testing::Test {
+ protected:
+  std::shared_ptr<WatchmanConnection> connect(bool withCallback = true) {
+    std::optional<WatchmanConnection::Callback> callback;
+    if (withCallback) {
+      callback = unilaterals.callback();
+    }
+    auto conn = std::make_shared<WatchmanConnection>(
+        ebt.getEventBase(), server.path(), std::move(callback));
+    conn->connect().get(kTimeout);
+    return conn;
+  }
+
+  static dynamic query(const char* name) {
+    return dynamic::array(
+        "query",
+        "/root",
+        dynamic::object("expression", dynamic::array("name", name)));
+  }
+
+  // Declared first so that it outlives whatever the event base thread
+  // still holds of the connection
+  Unilaterals unilaterals;
+  FakeWatchmanServer server;
+  folly::ScopedEventBaseThread ebt;
+};
+
+} // namespace
+
+TEST_F(WatchmanConnectionTest, pipelined_responses_out_of_order) {
+  auto conn = connect();
+  conn->setMaxInFlight(3);
+  auto a = conn->run(query("a"));
+  auto b = conn->run(query("b"));
+  auto clock = conn->run(dynamic::array("clock", "/root"));
+
+  // All three are sent before any of them is answered
+  auto requests = server.waitForRequests(3);
+  auto idA = requests[0].pdu[2]["request_id"].asString();
+  auto idB = requests[1].pdu[2]["request_id"].asString();
+  EXPECT_NE(idA, idB);
+  EXPECT_EQ("clock", requests[2].pdu[0].asString());
+
+  // Answer the second query first, with unilateral PDUs in between the
+  // responses
+  auto& peer = *requests[0].peer;
+  peer.write(dynamic::object("request_id", idB)("files", dynamic::array("b")));
+  peer.write(dynamic::object("subscription", "sub1")("unilateral", true)(
+      "files", dynamic::array("u")));
+  peer.write(dynamic::object("request_id", idA)("files", dynamic::array("a")));
+  peer.write(dynamic::object("log", "hello")("unilateral", true));
+  peer.write(dynamic::object("clock", "c:1:2"));
+
+  EXPECT_EQ(dynamic::array("a"), std::move(a).get(kTimeout)["files"]);
+  EXPECT_EQ(dynamic::array("b"), std::move(b).get(kTimeout)["files"]);
+  EXPECT_EQ("c:1:2", std::move(clock).get(kTimeout)["clock"].asString());
+
+  // The unilateral PDUs went to the callback, in the order they came
+  auto received = unilaterals.waitFor(2);
+  ASSERT_EQ(2, received.size());
+  EXPECT_EQ("sub1", received[0].value()["subscription"].asString());
+  EXPECT_EQ("hello", received[1].value()["log"].asString());
+}
+
+TEST_F(WatchmanConnectionTest, responses_without_request_id_complete_in_order) {
+  auto conn = connect();
+  conn->setMaxInFlight(2);
+  auto first = conn->run(dynamic::array("clock", "/a"));
+  auto second = conn->run(dynamic::array("clock", "/b"));
+
+  auto requests = server.waitForRequests(2);
+  auto& peer = *requests[0].peer;
+  peer.write(dynamic::object("clock", "first"));
+  // A request_id that matches nothing in flight is answered in order too
+  peer.write(dynamic::object("clock", "second")("request_id", "unknown"));
+
+  EXPECT_EQ("first", std::move(first).get(kTimeout)["clock"].asString());
+  EXPECT_EQ("second", std::move(second).get(kTimeout)["clock"].asString());
+}
+
+TEST_F(WatchmanConnectionTest, commands_wait_for_room_in_flight) {
+  auto conn = connect();
+  conn->setMaxInFlight(2);
+  auto first = conn->run(dynamic::array("clock", "/a"));
+  auto second = conn->run(dynamic::array("clock", "/b"));
+  auto third = conn->run(dynamic::array("clock", "/c"));
+
+  auto requests = server.waitForRequests(2);
+  /* sleep override */ std::this_thread::sleep_for(
+      std::chrono::milliseconds(100));
+  EXPECT_EQ(0, server.numQueuedRequests());
+
+  // Answering one makes room for the third
+  requests[0].peer->write(dynamic::object("clock", "1"));
+  auto last = server.waitForRequests(1);
+  EXPECT_EQ("/c", last[0].pdu[1].asString());
+  requests[0].peer->write(dynamic::object("clock", "2"));
+  requests[0].peer->write(dynamic::object("clock", "3"));
+
+  EXPECT_EQ("1", std::move(first).get(kTimeout)["clock"].asString());
+  EXPECT_EQ("2", std::move(second).get(kTimeout)["clock"].asString());
+  EXPECT_EQ("3", std::move(third).get(kTimeout)["clock"].asString());
+}
+
+TEST_F(WatchmanConnectionTest, unilateral_without_callback_fails_commands) {
+  auto conn = connect(false);
+  auto pending = conn->run(dynamic::array("clock", "/a"));
+
+  auto requests = server.waitForRequests(1);
+  requests[0].peer->write(
+      dynamic::object("subscription", "sub1")("unilateral", true));
+
+  EXPECT_THROW(std::move(pending).get(kTimeout), std::runtime_error);
+  EXPECT_TRUE(conn->isDead());
+}
+
+TEST_F(WatchmanConnectionTest, broken_connection_fails_commands_in_flight) {
+  auto conn = connect();
+  conn->setMaxInFlight(2);
+  auto first = conn->run(query("a"));
+  auto second = conn->run(query("b"));
+
+  // The connection breaks in the middle of a response
+  auto requests = server.waitForRequests(2);
+  auto response = folly::bser::toBser(
+      dynamic::object("files", dynamic::array("a")),
+      folly::bser::serialization_opts());
+  requests[0].peer->writeRaw(response.substr(0, response.size() / 2));
+  requests[0].peer->close();
+
+  EXPECT_THROW(std::move(first).get(kTimeout), std::system_error);
+  EXPECT_THROW(std::move(second).get(kTimeout), std::system_error);
+  EXPECT_TRUE(conn->isDead());
+
+  // The callback hears about it, and later commands fail straight away
+  auto received = unilaterals.waitFor(1);
+  ASSERT_EQ(1, received.size());
+  EXPECT_TRUE(received[0].hasException());
+  EXPECT_THROW(
+      conn->run(dynamic::array("clock", "/a")).get(kTimeout), WatchmanError);
+}
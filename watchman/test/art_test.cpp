@@ -11,6 +11,8 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#include <vector>
 #include "watchman/watchman_system.h"
 
 #include "watchman/thirdparty/libart/src/art.h"
@@ -408,3 +410,66 @@ TEST(Art, insert_search_uuid) {
   XLOG(ERR) << "maximum is " << l->key;
   EXPECT_TRUE(l && l->key == "ffffcb46-a92e-4822-82af-a7190f9c1ec5");
 }
+
+TEST(Art, node16_orders_high_bytes) {
+  art_tree<uintptr_t> t;
+  // Enough distinct first bytes to grow the root into a Node16, straddling
+  // 0x80 so that a signed comparison would misorder them
+  std::vector<unsigned char> bytes = {
+      0x01, 0xff, 0x7f, 0x80, 0x81, 0x20, 0xc0, 0x90, 0x10, 0xa0};
+  for (auto b : bytes) {
+    t.insert(std::string(1, char(b)) + "key", b);
+  }
+  for (auto b : bytes) {
+    auto val = t.search(std::string(1, char(b)) + "key");
+    ASSERT_NE(nullptr, val);
+    EXPECT_EQ(b, *val);
+  }
+  EXPECT_EQ(nullptr, t.search(std::string(1, char(0x82)) + "key"));
+
+  std::sort(bytes.begin(), bytes.end());
+  std::vector<unsigned char> seen;
+  t.iter([&seen](const std::string& key, uintptr_t&) {
+    seen.push_back(static_cast<unsigned char>(key[0]));
+    return 0;
+  });
+  EXPECT_EQ(bytes, seen);
+}
+
+TEST(Art, clear_and_reuse) {
+  art_tree<uintptr_t> t;
+  auto fill = [&t] {
+    // Covers every node type, up to a Node256 at the root
+    for (uintptr_t i = 0; i < 256 * 64; i++) {
+      t.insert(
+          std::string(1, char(i % 256)) + "/" + std::to_string(i / 256), i);
+    }
+  };
+
+  fill();
+  EXPECT_EQ(256 * 64, t.size());
+  t.clear();
+  EXPECT_EQ(0, t.size());
+  EXPECT_EQ(nullptr, t.search(std::string("a/0")));
+
+  fill();
+  EXPECT_EQ(256 * 64, t.size());
+  uint64_t erased = 0;
+  for (uintptr_t i = 0; i < 256 * 64; i += 97) {
+    auto key = std::string(1, char(i % 256)) + "/" + std::to_string(i / 256);
+    ASSERT_NE(nullptr, t.search(key));
+    EXPECT_EQ(i, *t.search(key));
+    EXPECT_NE(nullptr, t.erase(key));
+    erased++;
+  }
+
+  art_tree<uintptr_t> moved(std::move(t));
+  EXPECT_EQ(0, t.size());
+  EXPECT_EQ(nullptr, t.search(std::string("a/0")));
+  t.insert(std::string("a/0"), 1);
+  t.insert(std::string("b/0"), 2);
+  EXPECT_EQ(2, t.size());
+  EXPECT_EQ(2, *t.search(std::string("b/0")));
+  EXPECT_EQ(256 * 64 - erased, moved.size());
+  EXPECT_EQ(256, *moved.search(std::string(1, '\0') + "/1"));
+}
@@ -6,10 +6,13 @@
  */
 
 #include "watchman/bser.h"
+#include <folly/Conv.h>
 #include <folly/ScopeGuard.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
+#include <chrono>
 #include "watchman/thirdparty/jansson/jansson_private.h"
+#include "watchman/thirdparty/jansson/utf.h"
 
 #define UTF8_PILE_OF_POO "\xf0\x9f\x92\xa9"
 
@@ -294,5 +297,212 @@ TEST(Bser, bser_tests) {
   check_bser_typed_strings();
 }
 
+TEST(Bser, encoder_matches_json_rows) {
+  for (uint32_t version : {1, 2}) {
+    auto templ = json_array(
+        {typed_string_to_json("name", W_STRING_UNICODE),
+         typed_string_to_json("exists", W_STRING_UNICODE),
+         typed_string_to_json("size", W_STRING_UNICODE),
+         typed_string_to_json("mtime_f", W_STRING_UNICODE)});
+
+    auto expected = json_array();
+    json_array_set_template(expected, templ);
+    expected.array().push_back(json_object(
+        {{"name", typed_string_to_json("foo", W_STRING_BYTE)},
+         {"exists", json_true()},
+         {"size", json_integer(1234567)},
+         {"mtime_f", json_real(1.5)}}));
+    expected.array().push_back(json_object(
+        {{"name",
+          typed_string_to_json("bar" UTF8_PILE_OF_POO, W_STRING_UNICODE)},
+         {"exists", json_false()},
+         {"size", json_integer(-1)},
+         {"mtime_f", json_null()}}));
+
+    BserEncoder encoder(version, 0);
+    encoder.appendString(w_string("foo", W_STRING_BYTE));
+    encoder.appendBool(true);
+    encoder.appendInt(1234567);
+    encoder.appendReal(1.5);
+    encoder.finishElement();
+    // A row that is abandoned part way through leaves nothing behind
+    encoder.appendString(w_string("ignored", W_STRING_BYTE));
+    encoder.appendInt(42);
+    encoder.abandonElement();
+    encoder.appendString(w_string("bar" UTF8_PILE_OF_POO, W_STRING_UNICODE));
+    encoder.appendValue(json_false());
+    encoder.appendInt(-1);
+    encoder.appendNull();
+    encoder.finishElement();
+    EXPECT_EQ(2, encoder.size());
+
+    auto encoded = json_array();
+    json_array_set_template(encoded, templ);
+    json_array_set_bser_rows(encoded, encoder.release());
+    EXPECT_EQ(0, encoder.size());
+
+    auto expected_buf = bdumps(version, 0, expected);
+    auto encoded_buf = bdumps(version, 0, encoded);
+    ASSERT_NE(expected_buf, nullptr);
+    ASSERT_NE(encoded_buf, nullptr);
+    EXPECT_EQ(*expected_buf, *encoded_buf) << "version " << version;
+
+    // The rows are only valid for the encoding they were made with
+    EXPECT_EQ(nullptr, bdumps(version, BSER_CAP_DISABLE_UNICODE, encoded));
+    EXPECT_THROW(json_dumps(encoded, 0), std::runtime_error);
+  }
+}
+
+TEST(Bser, encoder_shares_prefixes_when_accepted) {
+  std::vector<w_string> names{
+      w_string("dir/sub/a.txt", W_STRING_BYTE),
+      w_string("dir/sub/b.txt", W_STRING_BYTE),
+      w_string("dir/sub/" UTF8_PILE_OF_POO, W_STRING_UNICODE),
+      w_string("dir/other", W_STRING_BYTE),
+      w_string("top", W_STRING_BYTE)};
+
+  auto encode = [&](uint32_t capabilities) {
+    BserEncoder encoder(2, capabilities);
+    for (auto& name : names) {
+      encoder.appendPrefixString(name);
+      encoder.finishElement();
+      // An abandoned element doesn't become the prefix of the next one
+      encoder.appendPrefixString(w_string("zzz", W_STRING_BYTE));
+      encoder.abandonElement();
+    }
+    auto encoded = json_array();
+    json_array_set_bser_rows(encoded, encoder.release());
+    return bdumps(2, capabilities, encoded);
+  };
+
+  auto expected = json_array();
+  for (auto& name : names) {
+    json_array_append(expected, w_string_to_json(name));
+  }
+  // Without the capability, the names are encoded as plain strings
+  auto plain = encode(0);
+  auto expected_buf = bdumps(2, 0, expected);
+  ASSERT_NE(plain, nullptr);
+  ASSERT_NE(expected_buf, nullptr);
+  EXPECT_EQ(*expected_buf, *plain);
+
+  auto shared = encode(BSER_CAP_ACCEPT_PREFIX_STRINGS);
+  ASSERT_NE(shared, nullptr);
+  EXPECT_LT(shared->size(), plain->size());
+
+  json_error_t jerr;
+  json_int_t needed;
+  auto decoded =
+      bunser(shared->data(), shared->data() + shared->size(), &needed, &jerr);
+  ASSERT_TRUE(decoded) << jerr.text;
+  EXPECT_TRUE(json_equal(expected, decoded));
+  // The type of the suffix gives the type of the whole value
+  EXPECT_EQ(W_STRING_UNICODE, json_to_w_string(decoded.at(2)).type());
+  EXPECT_EQ(W_STRING_BYTE, json_to_w_string(decoded.at(3)).type());
+}
+
+TEST(Bser, rejects_bogus_prefix_strings) {
+  json_error_t jerr;
+  json_int_t needed;
+
+  // Shares more bytes than the previous prefix string had
+  auto tooLong =
+      S("\x00\x03\x02\x0e\x03\x00\x02\x03\x01a"
+        "\x0e\x03\x02\x02\x03\x00");
+  EXPECT_FALSE(
+      bunser(tooLong.data(), tooLong.data() + tooLong.size(), &needed, &jerr));
+
+  // The suffix isn't a string
+  auto notString = S("\x0e\x03\x00\x03\x01");
+  EXPECT_FALSE(bunser(
+      notString.data(), notString.data() + notString.size(), &needed, &jerr));
+}
+
+TEST(Bser, rejects_bogus_lengths) {
+  json_error_t jerr;
+  json_int_t needed;
+
+  // A string with a negative length
+  auto negative = S("\x02\x03\xff");
+  EXPECT_FALSE(bunser(
+      negative.data(), negative.data() + negative.size(), &needed, &jerr));
+
+  // A real that is cut short
+  auto real = S("\x07\x00\x00\x00");
+  EXPECT_FALSE(bunser(real.data(), real.data() + real.size(), &needed, &jerr));
+
+  // Containers that claim far more elements than the input could hold
+  auto array = S("\x00\x06\xff\xff\xff\xff\xff\xff\xff\x0f\x0a");
+  EXPECT_FALSE(
+      bunser(array.data(), array.data() + array.size(), &needed, &jerr));
+  auto object = S("\x01\x05\xff\xff\xff\x0f\x02\x03\x01k\x0a");
+  EXPECT_FALSE(
+      bunser(object.data(), object.data() + object.size(), &needed, &jerr));
+}
+
+TEST(Bser, long_object_keys) {
+  std::string key(70000, 'k');
+  auto obj = json_object({{key.c_str(), json_integer(1)}});
+  auto buf = bdumps(2, 0, obj);
+  ASSERT_NE(buf, nullptr);
+
+  json_error_t jerr;
+  json_int_t needed;
+  auto decoded = bunser(buf->data(), buf->data() + buf->size(), &needed, &jerr);
+  ASSERT_TRUE(decoded) << jerr.text;
+  EXPECT_TRUE(json_equal(obj, decoded));
+}
+
+// Resembles a since query with a long list of paths
+TEST(Bser, bench_decode) {
+  const size_t kNumPaths = 100000;
+  const size_t kIterations = 20;
+
+  auto paths = json_array_of_size(kNumPaths);
+  for (size_t i = 0; i < kNumPaths; ++i) {
+    paths.array().push_back(typed_string_to_json(
+        folly::to<std::string>("some/fairly/deep/directory/", i, "/file.cpp")
+            .c_str(),
+        W_STRING_BYTE));
+  }
+  auto query = json_array(
+      {typed_string_to_json("query", W_STRING_UNICODE),
+       typed_string_to_json("/some/root", W_STRING_BYTE),
+       json_object(
+           {{"since", typed_string_to_json("c:0:1:2:3", W_STRING_UNICODE)},
+            {"paths", paths},
+            {"fields",
+             json_array(
+                 {typed_string_to_json("name", W_STRING_UNICODE),
+                  typed_string_to_json("size", W_STRING_UNICODE)})}})});
+
+  auto buf = bdumps(2, 0, query);
+  ASSERT_NE(buf, nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kIterations; ++i) {
+    json_error_t jerr;
+    json_int_t needed;
+    auto decoded =
+        bunser(buf->data(), buf->data() + buf->size(), &needed, &jerr);
+    ASSERT_TRUE(decoded) << jerr.text;
+    EXPECT_EQ(needed, (json_int_t)buf->size());
+  }
+  auto end = std::chrono::steady_clock::now();
+  XLOG(ERR) << "took " << std::chrono::duration<double>(end - start).count()
+            << "s to decode " << kIterations << " PDUs of " << buf->size()
+            << " bytes";
+
+  std::string ascii(buf->size(), 'a');
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < kIterations; ++i) {
+    EXPECT_TRUE(utf8_check_string(ascii.data(), ascii.size()));
+  }
+  end = std::chrono::steady_clock::now();
+  XLOG(ERR) << "took " << std::chrono::duration<double>(end - start).count()
+            << "s to validate " << kIterations << " strings of "
+            << ascii.size() << " bytes";
+}
+
 /* vim:ts=2:sw=2:et:
  */
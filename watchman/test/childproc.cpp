@@ -6,7 +6,11 @@
  */
 
 #include <folly/portability/GTest.h>
+#include <algorithm>
 #include <list>
+#include <memory>
+#include <string>
+#include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/watchman_system.h"
 
@@ -92,6 +96,38 @@ TEST(ChildProcess, stresstest_pipe_output) {
   EXPECT_TRUE(okay);
 }
 
+TEST(ChildProcess, concurrent_async) {
+#ifndef _WIN32
+  std::vector<std::unique_ptr<ChildProcess>> procs;
+  std::vector<folly::Future<std::pair<w_string, w_string>>> futures;
+  for (int i = 0; i < 32; ++i) {
+    Options opts;
+    opts.pipeStdout();
+    opts.pipeStdin();
+    procs.push_back(std::make_unique<ChildProcess>(
+        std::vector<std::string_view>{"cat", "-"}, std::move(opts)));
+    futures.push_back(procs.back()->communicateAsync(
+        [line = std::to_string(i) + "\n",
+         written = false](watchman::FileDescriptor& fd) mutable {
+          if (!written) {
+            if (write(fd.fd(), line.data(), line.size()) == -1) {
+              throw std::runtime_error("write to child failed");
+            }
+            written = true;
+          }
+          return true;
+        }));
+  }
+
+  for (int i = 0; i < 32; ++i) {
+    auto outputs = std::move(futures[i]).get();
+    procs[i]->wait();
+    EXPECT_EQ(std::to_string(i) + "\n", std::string{outputs.first.view()});
+    EXPECT_FALSE(outputs.second);
+  }
+#endif
+}
+
 TEST(ChildProcess, inputThreaded) {
   test_pipe_input(true);
 }
@@ -99,3 +135,35 @@ TEST(ChildProcess, inputThreaded) {
 TEST(ChildProcess, inputNotThreaded) {
   test_pipe_input(false);
 }
+
+TEST(ChildProcess, environment_encoding_is_shared_until_modified) {
+  ChildProcess::Environment env{
+      std::unordered_map<w_string, w_string>{{"A", "1"}, {"B", "2"}}};
+  auto copy = env;
+  auto encoded = env.encode();
+  EXPECT_EQ(encoded, copy.encode());
+
+  // Setting a variable to the value it already has keeps the encoding
+  copy.set("A", "1");
+  EXPECT_EQ(encoded, copy.encode());
+
+  copy.set("C", "3");
+  auto modified = copy.encode();
+  EXPECT_NE(encoded, modified);
+  EXPECT_EQ(encoded, env.encode());
+
+  std::vector<std::string> vars;
+  for (size_t i = 0; modified->envp.get()[i]; ++i) {
+    vars.emplace_back(modified->envp.get()[i]);
+  }
+  std::sort(vars.begin(), vars.end());
+  EXPECT_EQ((std::vector<std::string>{"A=1", "B=2", "C=3"}), vars);
+
+  // The original is unaffected
+  std::vector<std::string> original;
+  for (size_t i = 0; encoded->envp.get()[i]; ++i) {
+    original.emplace_back(encoded->envp.get()[i]);
+  }
+  std::sort(original.begin(), original.end());
+  EXPECT_EQ((std::vector<std::string>{"A=1", "B=2"}), original);
+}
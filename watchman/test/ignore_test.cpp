@@ -106,6 +106,28 @@ TEST(Ignore, correctness) {
   run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
 }
 
+TEST(Ignore, shorter_entries_are_not_shadowed) {
+  IgnoreSet state;
+  state.add(w_string("build", W_STRING_UNICODE), false);
+  state.add(w_string("build/b", W_STRING_UNICODE), false);
+  state.add(w_string("root/.hg", W_STRING_UNICODE), true);
+  state.add(w_string("root/.hg/store/lock", W_STRING_UNICODE), false);
+
+  static const struct test_case tests[] = {
+      {"build/bar", true},
+      {"build/b", true},
+      {"build", true},
+      {"other/build", false},
+      {"root/.hg/store", false},
+      {"root/.hg/store/lock", true},
+      {"root/.hg/store/data/foo", true},
+      {"root/.hgignore", false},
+      {"root/.hgx/a/b", false},
+  };
+
+  run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
+}
+
 // Load up the words data file and build a list of strings from that list.
 // Each of those strings is prefixed with the supplied string.
 // If there are fewer than limit entries available in the data file, we will
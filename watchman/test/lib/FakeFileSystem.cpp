@@ -83,6 +83,8 @@ class FakeDirHandle : public DirHandle {
   struct FakeDirEntry {
     std::string name;
     std::optional<FileInformation> stat;
+    ino_t ino{0};
+    DType dtype{DType::Unknown};
   };
 
   explicit FakeDirHandle(std::vector<FakeDirEntry> entries)
@@ -97,6 +99,8 @@ class FakeDirHandle : public DirHandle {
     current_.has_stat = e.stat.has_value();
     current_.d_name = e.name.c_str();
     current_.stat = e.stat ? e.stat.value() : FileInformation{};
+    current_.ino = e.ino;
+    current_.dtype = e.dtype;
     return &current_;
   }
 
@@ -134,6 +138,9 @@ std::unique_ptr<DirHandle> FakeFileSystem::openDir(
       entry.name = name;
       if (flags_.includeReadDirStat) {
         entry.stat = child.metadata;
+      } else {
+        entry.ino = child.metadata.ino;
+        entry.dtype = child.metadata.dtype();
       }
       entries.push_back(std::move(entry));
     }
@@ -144,7 +151,8 @@ std::unique_ptr<DirHandle> FakeFileSystem::openDir(
 
 FileInformation FakeFileSystem::getFileInformation(
     const char* path,
-    CaseSensitivity caseSensitive) {
+    CaseSensitivity caseSensitive,
+    const StatOptions& /*options*/) {
   auto root = root_.rlock();
   return withPath(*root, path, [&](const FakeInode& inode) {
     // TODO: validate case
@@ -202,6 +210,35 @@ void FakeFileSystem::updateMetadata(
   return withPath(*root, path, [&](FakeInode& inode) { func(inode.metadata); });
 }
 
+void FakeFileSystem::rename(const char* from, const char* to) {
+  // Returns the path of the parent dir and the name within it
+  auto split = [](const char* path) {
+    folly::StringPiece piece{path};
+    ensureAbsolute(piece);
+    auto idx = piece.rfind('/');
+    return std::make_pair(
+        piece.subpiece(0, idx == 0 ? 1 : idx).str(),
+        piece.subpiece(idx + 1).str());
+  };
+  auto source = split(from);
+  auto target = split(to);
+
+  auto root = root_.wlock();
+  auto node = withPath(*root, source.first, [&](FakeInode& dir) {
+    auto it = dir.children.find(source.second);
+    if (it == dir.children.end()) {
+      throw std::system_error(
+          ENOENT, std::generic_category(), fmt::format("no file at {}", from));
+    }
+    auto moved = std::move(it->second);
+    dir.children.erase(it);
+    return moved;
+  });
+  withPath(*root, target.first, [&](FakeInode& dir) {
+    dir.children.insert_or_assign(target.second, std::move(node));
+  });
+}
+
 FileInformation FakeFileSystem::fakeDir() {
   FileInformation fi{};
   fi.mode = S_IFDIR;
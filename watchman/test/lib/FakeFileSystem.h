@@ -49,7 +49,8 @@ class FakeFileSystem : public FileSystem {
 
   FileInformation getFileInformation(
       const char* path,
-      CaseSensitivity caseSensitive = CaseSensitivity::Unknown) override;
+      CaseSensitivity caseSensitive = CaseSensitivity::Unknown,
+      const StatOptions& options = StatOptions{}) override;
 
   // Modify the FS structure
 
@@ -61,6 +62,9 @@ class FakeFileSystem : public FileSystem {
       const char* path,
       std::function<void(FileInformation&)> func);
 
+  // Moves the node at `from`, along with its children, to `to`
+  void rename(const char* from, const char* to);
+
   FileInformation fakeDir();
   FileInformation fakeFile();
 
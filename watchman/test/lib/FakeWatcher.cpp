@@ -11,7 +11,7 @@
 namespace watchman {
 
 FakeWatcher::FakeWatcher(FileSystem& fileSystem)
-    : Watcher{"FakeWatcher", 0}, fileSystem_{fileSystem} {}
+    : Watcher{"FakeWatcher", WATCHER_WATCHES_PATHS}, fileSystem_{fileSystem} {}
 
 std::unique_ptr<DirHandle> FakeWatcher::startWatchDir(
     const std::shared_ptr<Root>& root,
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/test/lib/FakeWatchmanServer.h"
+
+#include <folly/experimental/bser/Bser.h>
+#include <folly/io/IOBuf.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace watchman {
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+[[noreturn]] void throwErrno(const char* what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+} // namespace
+
+FakeWatchmanServer::Peer::~Peer() {
+  ::close(fd_);
+}
+
+void FakeWatchmanServer::Peer::write(const folly::dynamic& pdu) {
+  writeRaw(folly::bser::toBser(pdu, folly::bser::serialization_opts()));
+}
+
+void FakeWatchmanServer::Peer::writeRaw(const std::string& bytes) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  size_t sent = 0;
+  while (sent < bytes.size()) {
+    auto res =
+        ::send(fd_, bytes.data() + sent, bytes.size() - sent, kSendFlags);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The client went away, which is its business
+      return;
+    }
+    sent += size_t(res);
+  }
+}
+
+void FakeWatchmanServer::Peer::close() {
+  ::shutdown(fd_, SHUT_RDWR);
+}
+
+folly::dynamic FakeWatchmanServer::Peer::read() {
+  while (true) {
+    if (!buf_.empty()) {
+      auto iobuf = folly::IOBuf::wrapBuffer(buf_.data(), buf_.size());
+      try {
+        auto len = folly::bser::decodePduLength(iobuf.get());
+        if (len <= buf_.size()) {
+          auto pdu = folly::bser::parseBser(
+              folly::ByteRange{
+                  reinterpret_cast<const uint8_t*>(buf_.data()), len});
+          buf_.erase(0, len);
+          return pdu;
+        }
+      } catch (const std::out_of_range&) {
+        // Not even the length has arrived yet
+      }
+    }
+
+    char chunk[4096];
+    auto res = ::recv(fd_, chunk, sizeof(chunk), 0);
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return nullptr;
+    }
+    buf_.append(chunk, size_t(res));
+  }
+}
+
+std::vector<std::string> FakeWatchmanServer::Peer::subscriptions() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return subscriptions_;
+}
+
+FakeWatchmanServer::FakeWatchmanServer() : dir_{"fake-watchman"} {
+  path_ = (dir_.path() / "sock").string();
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    throw std::runtime_error("socket path is too long: " + path_);
+  }
+  memcpy(addr.sun_path, path_.data(), path_.size());
+
+  listenFd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd_ < 0) {
+    throwErrno("socket");
+  }
+  if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+      ::listen(listenFd_, 16)) {
+    ::close(listenFd_);
+    throwErrno("bind");
+  }
+  acceptThread_ = std::thread([this] { acceptLoop(); });
+}
+
+FakeWatchmanServer::~FakeWatchmanServer() {
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+    for (auto& peer : peers_) {
+      peer->close();
+    }
+  }
+  acceptThread_.join();
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    threads = std::move(threads_);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ::close(listenFd_);
+}
+
+void FakeWatchmanServer::acceptLoop() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (stopping_) {
+        return;
+      }
+    }
+
+    // Poll so that the destructor needn't wake up accept()
+    struct pollfd pfd {
+      listenFd_, POLLIN, 0
+    };
+    if (::poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+    int fd = ::accept(listenFd_, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (stopping_) {
+      ::close(fd);
+      return;
+    }
+    auto peer = std::make_shared<Peer>(fd, peers_.size());
+    peers_.push_back(peer);
+    threads_.emplace_back([this, peer] { serve(peer); });
+    cond_.notify_all();
+  }
+}
+
+void FakeWatchmanServer::serve(std::shared_ptr<Peer> peer) {
+  while (true) {
+    auto req = peer->read();
+    if (req.isNull()) {
+      return;
+    }
+    if (answer(*peer, req)) {
+      continue;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    requests_.push_back(Request{peer, std::move(req)});
+    cond_.notify_all();
+  }
+}
+
+std::vector<std::shared_ptr<FakeWatchmanServer::Peer>>
+FakeWatchmanServer::waitForPeers(size_t count) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!cond_.wait_for(lock, std::chrono::seconds(10), [&] {
+        return peers_.size() >= count;
+      })) {
+    throw std::runtime_error("the client didn't connect");
+  }
+  return std::vector<std::shared_ptr<Peer>>(
+      peers_.begin(), peers_.begin() + count);
+}
+
+std::vector<FakeWatchmanServer::Request> FakeWatchmanServer::waitForRequests(
+    size_t count) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!cond_.wait_for(lock, std::chrono::seconds(10), [&] {
+        return requests_.size() >= count;
+      })) {
+    throw std::runtime_error("the client didn't send the requests");
+  }
+  std::vector<Request> result;
+  for (size_t i = 0; i < count; ++i) {
+    result.push_back(std::move(requests_.front()));
+    requests_.pop_front();
+  }
+  return result;
+}
+
+size_t FakeWatchmanServer::numQueuedRequests() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return requests_.size();
+}
+
+bool FakeWatchmanServer::answer(Peer& peer, const folly::dynamic& req) {
+  auto command = req[0].asString();
+  if (command == "version") {
+    auto capabilities = folly::dynamic::object();
+    if (req.size() > 1) {
+      for (auto key : {"required", "optional"}) {
+        if (auto names = req[1].get_ptr(key)) {
+          for (auto& name : *names) {
+            capabilities[name] = true;
+          }
+        }
+      }
+    }
+    peer.write(folly::dynamic::object("version", "fake")(
+        "capabilities", std::move(capabilities)));
+  } else if (command == "watch-project") {
+    peer.write(folly::dynamic::object("watch", req[1]));
+  } else if (command == "subscribe") {
+    {
+      std::lock_guard<std::mutex> guard(peer.mutex_);
+      peer.subscriptions_.push_back(req[2].asString());
+    }
+    peer.write(folly::dynamic::object("subscribe", req[2]));
+  } else if (command == "unsubscribe") {
+    {
+      std::lock_guard<std::mutex> guard(peer.mutex_);
+      auto& names = peer.subscriptions_;
+      names.erase(
+          std::remove(names.begin(), names.end(), req[2].asString()),
+          names.end());
+    }
+    peer.write(folly::dynamic::object("unsubscribe", req[2])("deleted", true));
+  } else {
+    return false;
+  }
+  return true;
+}
+
+} // namespace watchman
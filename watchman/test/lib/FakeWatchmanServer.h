@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/dynamic.h>
+#include <folly/experimental/TestUtil.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Stands in for the service in tests of the C++ client.  It listens on a
+ * unix socket in a temporary dir and serves each connection on a thread of
+ * its own.  It answers the commands that set up a session ("version",
+ * "watch-project", "subscribe" and "unsubscribe") itself, and queues the
+ * others for the test to answer.  Tests answer by writing PDUs to the peer,
+ * in whichever order and number they like, which lets them produce what the
+ * real service won't on demand: responses out of order, unilateral PDUs
+ * between them, and connections that break.
+ */
+class FakeWatchmanServer {
+ public:
+  class Peer {
+   public:
+    Peer(int fd, size_t index) : fd_{fd}, index_{index} {}
+    ~Peer();
+
+    // The order in which the connection was accepted, from 0
+    size_t index() const {
+      return index_;
+    }
+
+    // Sends `pdu` encoded as BSER
+    void write(const folly::dynamic& pdu);
+    // Sends bytes as they are, which needn't be a whole PDU
+    void writeRaw(const std::string& bytes);
+    // Closes the connection, which the client sees as it breaking
+    void close();
+
+    // Blocks until the client sends a whole PDU, returning it decoded, or
+    // returns nullptr once the connection is closed
+    folly::dynamic read();
+
+    // The names of the subscriptions that the client made on this
+    // connection, and hasn't cancelled
+    std::vector<std::string> subscriptions();
+
+   private:
+    friend class FakeWatchmanServer;
+
+    std::mutex mutex_;
+    int fd_;
+    const size_t index_;
+    std::string buf_;
+    std::vector<std::string> subscriptions_;
+  };
+
+  struct Request {
+    std::shared_ptr<Peer> peer;
+    folly::dynamic pdu;
+  };
+
+  FakeWatchmanServer();
+  ~FakeWatchmanServer();
+
+  const std::string& path() const {
+    return path_;
+  }
+
+  // Blocks until `count` connections have been accepted, returning them
+  std::vector<std::shared_ptr<Peer>> waitForPeers(size_t count);
+
+  // Blocks until `count` requests have been queued, and returns them in the
+  // order they arrived, leaving any others queued
+  std::vector<Request> waitForRequests(size_t count);
+
+  // The number of requests that are queued
+  size_t numQueuedRequests();
+
+ private:
+  void acceptLoop();
+  void serve(std::shared_ptr<Peer> peer);
+  // Answers the commands that set up a session, returning false for others
+  static bool answer(Peer& peer, const folly::dynamic& req);
+
+  folly::test::TemporaryDirectory dir_;
+  std::string path_;
+  int listenFd_{-1};
+  std::thread acceptThread_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_{false};
+  std::vector<std::shared_ptr<Peer>> peers_;
+  std::vector<std::thread> threads_;
+  std::deque<Request> requests_;
+};
+
+} // namespace watchman
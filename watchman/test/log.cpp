@@ -5,7 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
 #include <folly/portability/GTest.h>
+#include <thread>
 #include "watchman/Logging.h"
 
 using namespace watchman;
@@ -30,5 +32,46 @@ TEST(Log, logging) {
   EXPECT_TRUE(logged);
 }
 
+TEST(Log, async_writer_publishes_lines_in_order) {
+  auto sub = watchman::getLog().subscribe(watchman::DBG, [] {});
+
+  getLog().startAsyncWriter(16);
+  SCOPE_EXIT {
+    getLog().stopAsyncWriter();
+  };
+
+  std::thread other([] { log(DBG, "from another thread\n"); });
+  other.join();
+  log(DBG, "from this thread\n");
+  getLog().flushAsyncWriter();
+
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+  sub->getPending(pending);
+  ASSERT_EQ(2, pending.size());
+  auto first = json_to_w_string(pending[0]->payload.get("log"));
+  auto second = json_to_w_string(pending[1]->payload.get("log"));
+  EXPECT_NE(std::string_view::npos, first.view().find("from another thread"));
+  EXPECT_NE(std::string_view::npos, second.view().find("from this thread"));
+}
+
+TEST(Log, async_writer_drops_lines_when_full) {
+  auto sub = watchman::getLog().subscribe(watchman::DBG, [] {});
+  auto droppedBefore = getLog().getDroppedLines();
+
+  // With room for a single line, lines are dropped unless the writer
+  // happens to drain between them
+  getLog().startAsyncWriter(1);
+  for (int i = 0; i < 1000; ++i) {
+    log(DBG, "line ", i, "\n");
+  }
+  getLog().stopAsyncWriter();
+
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+  sub->getPending(pending);
+  auto dropped = getLog().getDroppedLines() - droppedBefore;
+  // Each line was either published or dropped
+  EXPECT_EQ(1000, pending.size() + dropped);
+}
+
 /* vim:ts=2:sw=2:et:
  */
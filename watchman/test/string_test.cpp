@@ -442,3 +442,43 @@ TEST(String, contains) {
   EXPECT_TRUE(haystack.contains("watchman"));
   EXPECT_FALSE(haystack.contains("watchman2"));
 }
+
+TEST(String, utf8_clean_block_boundaries) {
+  // The ASCII scan works a block at a time, so place an invalid byte at
+  // every offset either side of the block sizes.
+  for (size_t len = 0; len < 70; ++len) {
+    for (size_t bad = 0; bad <= len; ++bad) {
+      std::string input(len, 'a');
+      std::string expected(len, 'a');
+      if (bad < len) {
+        input[bad] = '\xff';
+        expected[bad] = '?';
+      }
+      w_string_piece piece(input.data(), input.size());
+      EXPECT_EQ(piece.asUTF8Clean().view(), expected) << len << " " << bad;
+    }
+  }
+
+  std::string poo(40, 'a');
+  poo.append("\xf0\x9f\x92\xa9");
+  w_string_piece piece(poo.data(), poo.size());
+  EXPECT_EQ(piece.asUTF8Clean().view(), poo);
+}
+
+TEST(String, hash_value) {
+  // Every length up to a couple of wyhash's 48 byte blocks
+  std::string path;
+  for (size_t len = 0; len < 100; ++len) {
+    w_string str{path.data(), path.size()};
+    w_string_piece piece{path.data(), path.size()};
+    EXPECT_EQ(w_string_hval(str), piece.hashValue()) << len;
+    EXPECT_EQ(std::hash<w_string>()(str), std::hash<w_string_piece>()(piece));
+
+    auto other = path;
+    if (len > 0) {
+      other[len / 2] ^= 1;
+      EXPECT_NE(piece.hashValue(), w_string_piece(other).hashValue()) << len;
+    }
+    path.push_back('a' + len % 26);
+  }
+}
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <charconv>
 
 #include "jansson.h"
 #include "jansson_private.h"
@@ -39,77 +40,110 @@ static int dump_to_file(const char* buffer, size_t size, void* data) {
   return 0;
 }
 
+namespace {
+
+/* Accumulates the output so that the callback is only invoked once per
+   block rather than once per token */
+struct dump_buffer {
+  json_dump_callback_t dump;
+  void* data;
+  size_t len{0};
+  char buf[4096];
+
+  dump_buffer(json_dump_callback_t dump, void* data) : dump(dump), data(data) {}
+
+  int put(const char* text, size_t size) {
+    if (size > sizeof(buf) - len) {
+      if (flush())
+        return -1;
+      if (size >= sizeof(buf))
+        return dump(text, size, data);
+    }
+    memcpy(buf + len, text, size);
+    len += size;
+    return 0;
+  }
+
+  int put(char c) {
+    if (len == sizeof(buf) && flush())
+      return -1;
+    buf[len++] = c;
+    return 0;
+  }
+
+  int flush() {
+    if (len == 0)
+      return 0;
+    size_t size = len;
+    len = 0;
+    return dump(buf, size, data);
+  }
+};
+
+} // namespace
+
 /* 32 spaces (the maximum indentation size) */
 static char whitespace[] = "                                ";
 
-static int dump_indent(
-    size_t flags,
-    int depth,
-    int space,
-    json_dump_callback_t dump,
-    void* data) {
+static int dump_indent(size_t flags, int depth, int space, dump_buffer& out) {
   if (JSON_INDENT(flags) > 0) {
     int i, ws_count = JSON_INDENT(flags);
 
-    if (dump("\n", 1, data))
+    if (out.put('\n'))
       return -1;
 
     for (i = 0; i < depth; i++) {
-      if (dump(whitespace, ws_count, data))
+      if (out.put(whitespace, ws_count))
         return -1;
     }
   } else if (space && !(flags & JSON_COMPACT)) {
-    return dump(" ", 1, data);
+    return out.put(' ');
   }
   return 0;
 }
 
-static int dump_string(
-    const char* str,
-    json_dump_callback_t dump,
-    void* data,
-    size_t flags) {
-  const char *pos, *end;
+static int dump_string(const char* str, dump_buffer& out, size_t flags) {
+  const char* pos = str;
+  const char* end = str + strlen(str);
   int32_t codepoint;
 
-  if (dump("\"", 1, data))
+  if (out.put('"'))
     return -1;
 
-  end = pos = str;
   while (1) {
+    const char* next;
     const char* text;
     char seq[13];
     int length;
 
-    while (*end) {
-      end = utf8_iterate(pos, &codepoint);
-      if (!end) {
-        return -1;
-      }
-
-      /* mandatory escape or control char */
-      if (codepoint == '\\' || codepoint == '"' || codepoint < 0x20)
-        break;
-
-      /* slash */
-      if ((flags & JSON_ESCAPE_SLASH) && codepoint == '/')
-        break;
+    /* copy the run that needs neither escaping nor decoding in one go */
+    size_t run = json_plain_prefix(pos, end - pos);
+    if ((flags & JSON_ESCAPE_SLASH) && run) {
+      auto slash = (const char*)memchr(pos, '/', run);
+      if (slash)
+        run = slash - pos;
+    }
+    if (run && out.put(pos, run))
+      return -1;
+    pos += run;
 
-      /* non-ASCII */
-      if ((flags & JSON_ENSURE_ASCII) && codepoint > 0x7F)
-        break;
+    if (pos == end)
+      break;
 
-      pos = end;
-    }
+    next = utf8_iterate(pos, &codepoint);
+    if (!next)
+      return -1;
 
-    if (pos != str) {
-      if (dump(str, pos - str, data))
+    /* mandatory escape or control char, slash, or non-ASCII */
+    if (!(codepoint == '\\' || codepoint == '"' || codepoint < 0x20 ||
+          ((flags & JSON_ESCAPE_SLASH) && codepoint == '/') ||
+          ((flags & JSON_ENSURE_ASCII) && codepoint > 0x7F))) {
+      if (out.put(pos, next - pos))
         return -1;
+      pos = next;
+      continue;
     }
 
-    if (end == pos)
-      break;
-
     /* handle \, /, ", and control codes */
     length = 2;
     switch (codepoint) {
@@ -161,45 +195,37 @@ static int dump_string(
       }
     }
 
-    if (dump(text, length, data))
+    if (out.put(text, length))
       return -1;
 
-    str = pos = end;
+    pos = next;
   }
 
-  return dump("\"", 1, data);
+  return out.put('"');
 }
 
-static int do_dump(
-    const json_t* json,
-    size_t flags,
-    int depth,
-    json_dump_callback_t dump,
-    void* data) {
+static int
+do_dump(const json_t* json, size_t flags, int depth, dump_buffer& out) {
   switch (json_typeof(json)) {
     case JSON_NULL:
-      return dump("null", 4, data);
+      return out.put("null", 4);
 
     case JSON_TRUE:
-      return dump("true", 4, data);
+      return out.put("true", 4);
 
     case JSON_FALSE:
-      return dump("false", 5, data);
+      return out.put("false", 5);
 
     case JSON_INTEGER: {
       char buffer[MAX_INTEGER_STR_LENGTH];
-      int size;
 
-      size = snprintf(
-          buffer,
-          MAX_INTEGER_STR_LENGTH,
-          "%" JSON_INTEGER_FORMAT,
-          json_integer_value(json));
-      if (size < 0 || size >= MAX_INTEGER_STR_LENGTH) {
+      auto result = std::to_chars(
+          buffer, buffer + sizeof(buffer), json_integer_value(json));
+      if (result.ec != std::errc()) {
         return -1;
       }
 
-      return dump(buffer, size, data);
+      return out.put(buffer, result.ptr - buffer);
     }
 
     case JSON_REAL: {
@@ -212,45 +238,49 @@ static int do_dump(
         return -1;
       }
 
-      return dump(buffer, size, data);
+      return out.put(buffer, size);
     }
 
     case JSON_STRING:
-      return dump_string(json_string_value(json), dump, data, flags);
+      return dump_string(json_string_value(json), out, flags);
 
     case JSON_ARRAY: {
       int i;
       int n;
 
+      if (json_array_get_bser_rows(json)) {
+        // Pre-encoded elements have no JSON representation
+        return -1;
+      }
+
       n = json_array_size(json);
 
-      if (dump("[", 1, data)) {
+      if (out.put('[')) {
         return -1;
       }
       if (n == 0) {
-        return dump("]", 1, data);
+        return out.put(']');
       }
-      if (dump_indent(flags, depth + 1, 0, dump, data))
+      if (dump_indent(flags, depth + 1, 0, out))
         return -1;
 
       for (i = 0; i < n; ++i) {
-        if (do_dump(json_array_get(json, i), flags, depth + 1, dump, data)) {
+        if (do_dump(json_array_get(json, i), flags, depth + 1, out)) {
           return -1;
         }
 
         if (i < n - 1) {
-          if (dump(",", 1, data) ||
-              dump_indent(flags, depth + 1, 1, dump, data)) {
+          if (out.put(',') || dump_indent(flags, depth + 1, 1, out)) {
             return -1;
           }
         } else {
-          if (dump_indent(flags, depth, 0, dump, data)) {
+          if (dump_indent(flags, depth, 0, out)) {
             return -1;
           }
         }
       }
 
-      return dump("]", 1, data);
+      return out.put(']');
     }
 
     case JSON_OBJECT: {
@@ -269,14 +299,14 @@ static int do_dump(
       object = json_to_object(json);
       auto it = object->map.begin();
 
-      if (dump("{", 1, data)) {
+      if (out.put('{')) {
         return -1;
       }
       if (object->map.empty()) {
-        return dump("}", 1, data);
+        return out.put('}');
       }
 
-      if (dump_indent(flags, depth + 1, 0, dump, data)) {
+      if (dump_indent(flags, depth + 1, 0, out)) {
         return -1;
       }
 
@@ -292,19 +322,18 @@ static int do_dump(
         while (sorted_it != items.end()) {
           auto next = std::next(sorted_it);
 
-          dump_string(sorted_it->first.c_str(), dump, data, flags);
-          if (dump(separator, separator_length, data) ||
-              do_dump(sorted_it->second, flags, depth + 1, dump, data)) {
+          dump_string(sorted_it->first.c_str(), out, flags);
+          if (out.put(separator, separator_length) ||
+              do_dump(sorted_it->second, flags, depth + 1, out)) {
             return -1;
           }
 
           if (next != items.end()) {
-            if (dump(",", 1, data) ||
-                dump_indent(flags, depth + 1, 1, dump, data)) {
+            if (out.put(',') || dump_indent(flags, depth + 1, 1, out)) {
               return -1;
             }
           } else {
-            if (dump_indent(flags, depth, 0, dump, data)) {
+            if (dump_indent(flags, depth, 0, out)) {
               return -1;
             }
           }
@@ -315,19 +344,18 @@ static int do_dump(
         while (it != object->map.end()) {
           auto next = std::next(it);
 
-          dump_string(it->first.c_str(), dump, data, flags);
-          if (dump(separator, separator_length, data) ||
-              do_dump(it->second, flags, depth + 1, dump, data)) {
+          dump_string(it->first.c_str(), out, flags);
+          if (out.put(separator, separator_length) ||
+              do_dump(it->second, flags, depth + 1, out)) {
             return -1;
           }
 
           if (next != object->map.end()) {
-            if (dump(",", 1, data) ||
-                dump_indent(flags, depth + 1, 1, dump, data)) {
+            if (out.put(',') || dump_indent(flags, depth + 1, 1, out)) {
               return -1;
             }
           } else {
-            if (dump_indent(flags, depth, 0, dump, data)) {
+            if (dump_indent(flags, depth, 0, out)) {
               return -1;
             }
           }
@@ -335,7 +363,7 @@ static int do_dump(
           it = next;
         }
       }
-      return dump("}", 1, data);
+      return out.put('}');
     }
 
     default:
@@ -380,5 +408,8 @@ int json_dump_callback(
       return -1;
   }
 
-  return do_dump(json, flags, 0, callback, data);
+  dump_buffer out(callback, data);
+  if (do_dump(json, flags, 0, out))
+    return -1;
+  return out.flush();
 }
@@ -15,6 +15,7 @@
 #include <unordered_map>
 #include <string>
 #include <atomic>
+#include <memory>
 #include <vector>
 #include "jansson_config.h" // @manual=//watchman/thirdparty/jansson:config_h
 #include "watchman/thirdparty/jansson/utf.h"
@@ -277,6 +278,22 @@ int json_array_set_template(json_t* array, json_t* templ);
 int json_array_set_template_new(json_t* json, json_ref&& templ);
 json_t* json_array_get_template(const json_t* array);
 
+/* Array elements that were encoded as BSER by their producer rather than
+ * being built as json_t values; see BserEncoder in bser.h.  They follow the
+ * ordinary elements of the array and can only be serialized as BSER with the
+ * same version and capabilities. */
+struct json_bser_rows {
+  uint32_t bser_version{0};
+  uint32_t bser_capabilities{0};
+  size_t count{0};
+  std::string data;
+};
+
+int json_array_set_bser_rows(
+    json_t* array,
+    std::unique_ptr<json_bser_rows> rows);
+const json_bser_rows* json_array_get_bser_rows(const json_t* array);
+
 static JSON_INLINE int
 json_array_set(json_t* array, size_t index, json_t* value) {
   return json_array_set_new(array, index, json_ref(value));
@@ -38,6 +38,7 @@ struct json_array_t {
   json_t json;
   std::vector<json_ref> table;
   json_ref templ;
+  std::unique_ptr<json_bser_rows> bserRows;
 
   json_array_t(size_t sizeHint = 0);
   json_array_t(std::initializer_list<json_ref> values);
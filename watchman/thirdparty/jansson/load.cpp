@@ -47,9 +47,18 @@
 typedef int (*get_func)(void* data);
 
 namespace {
+typedef struct {
+  const char* data;
+  size_t len;
+  size_t pos;
+} buffer_data_t;
+
 typedef struct {
   get_func get;
   void* data;
+  /* Set when the input is in memory, so that runs of plain characters can
+     be consumed without calling get for each of them */
+  buffer_data_t* direct;
   char buffer[5];
   size_t buffer_pos;
   int state;
@@ -135,6 +144,7 @@ error_set(json_error_t* error, const lex_t* lex, const char* msg, ...) {
 static void stream_init(stream_t* stream, get_func get, void* data) {
   stream->get = get;
   stream->data = data;
+  stream->direct = nullptr;
   stream->buffer[0] = '\0';
   stream->buffer_pos = 0;
 
@@ -255,6 +265,24 @@ static void lex_save_cached(lex_t* lex) {
   }
 }
 
+/* Saves the run of plain ASCII characters that the input continues with,
+   which is the bulk of most strings */
+static void lex_save_plain_run(lex_t* lex) {
+  stream_t* stream = &lex->stream;
+  buffer_data_t* direct = stream->direct;
+
+  if (!direct || stream->state != STREAM_STATE_OK ||
+      stream->buffer[stream->buffer_pos] != '\0')
+    return;
+
+  size_t run =
+      json_plain_prefix(direct->data + direct->pos, direct->len - direct->pos);
+  lex->saved_text.append(direct->data + direct->pos, run);
+  direct->pos += run;
+  stream->position += run;
+  stream->column += run;
+}
+
 /* assumes that str points to 'u' plus at least 4 valid hex digits */
 static int32_t decode_unicode_escape(const char* str) {
   int i;
@@ -287,6 +315,7 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
   lex->value.string.clear();
   lex->token = TOKEN_INVALID;
 
+  lex_save_plain_run(lex);
   c = lex_get_save(lex, error);
 
   while (c != '"') {
@@ -323,8 +352,10 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         error_set(error, lex, "invalid escape");
         goto out;
       }
-    } else
+    } else {
+      lex_save_plain_run(lex);
       c = lex_get_save(lex, error);
+    }
   }
 
   /* the actual value is at most of the same length as the source
@@ -418,8 +449,12 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         t++;
         p++;
       }
-    } else
-      *(t++) = *(p++);
+    } else {
+      size_t run = strcspn(p, "\\\"");
+      memcpy(t, p, run);
+      t += run;
+      p += run;
+    }
   }
   *t = '\0';
   lex->token = TOKEN_STRING;
@@ -795,26 +830,20 @@ static json_ref parse_json(lex_t* lex, size_t flags, json_error_t* error) {
   return result;
 }
 
-typedef struct {
-  const char* data;
-  int pos;
-} string_data_t;
-
-static int string_get(void* data) {
+static int buffer_get(void* data) {
   char c;
-  string_data_t* stream = (string_data_t*)data;
-  c = stream->data[stream->pos];
-  if (c == '\0')
+  auto stream = (buffer_data_t*)data;
+  if (stream->pos >= stream->len)
     return EOF;
-  else {
-    stream->pos++;
-    return (unsigned char)c;
-  }
+
+  c = stream->data[stream->pos];
+  stream->pos++;
+  return (unsigned char)c;
 }
 
 json_ref json_loads(const char* string, size_t flags, json_error_t* error) {
   lex_t lex;
-  string_data_t stream_data;
+  buffer_data_t stream_data;
 
   jsonp_error_init(error, "<string>");
 
@@ -825,32 +854,17 @@ json_ref json_loads(const char* string, size_t flags, json_error_t* error) {
 
   stream_data.data = string;
   stream_data.pos = 0;
+  stream_data.len = strlen(string);
 
-  if (lex_init(&lex, string_get, (void*)&stream_data))
+  if (lex_init(&lex, buffer_get, (void*)&stream_data))
     return nullptr;
+  lex.stream.direct = &stream_data;
 
   auto result = parse_json(&lex, flags, error);
 
   return result;
 }
 
-typedef struct {
-  const char* data;
-  size_t len;
-  size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void* data) {
-  char c;
-  auto stream = (buffer_data_t*)data;
-  if (stream->pos >= stream->len)
-    return EOF;
-
-  c = stream->data[stream->pos];
-  stream->pos++;
-  return (unsigned char)c;
-}
-
 json_ref json_loadb(
     const char* buffer,
     size_t buflen,
@@ -872,6 +886,7 @@ json_ref json_loadb(
 
   if (lex_init(&lex, buffer_get, (void*)&stream_data))
     return nullptr;
+  lex.stream.direct = &stream_data;
 
   auto result = parse_json(&lex, flags, error);
 
@@ -6,8 +6,15 @@
  */
 
 #include "utf.h"
+#include <stdint.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h> // @manual
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h> // @manual
+#endif
+
 int utf8_encode(int32_t codepoint, char* buffer, int* size) {
   if (codepoint < 0)
     return -1;
@@ -138,6 +145,94 @@ const char* utf8_iterate(const char* buffer, int32_t* codepoint) {
   return buffer + count;
 }
 
+size_t utf8_ascii_prefix(const char* string, size_t length) {
+  size_t i = 0;
+
+  /* Find the block containing the first byte with the high bit set, then
+     locate the byte itself below */
+#if defined(__SSE2__)
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)(string + i));
+    if (_mm_movemask_epi8(block) != 0)
+      break;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t block = vld1q_u8((const uint8_t*)(string + i));
+    if (vmaxvq_u8(block) >= 0x80)
+      break;
+  }
+#endif
+  for (; i + 8 <= length; i += 8) {
+    uint64_t block;
+    memcpy(&block, string + i, sizeof(block));
+    if (block & UINT64_C(0x8080808080808080))
+      break;
+  }
+
+  while (i < length && (unsigned char)string[i] < 0x80)
+    i++;
+
+  return i;
+}
+
+size_t json_plain_prefix(const char* string, size_t length) {
+  size_t i = 0;
+
+  /* Bytes below 0x20, quotes, backslashes and non-ASCII bytes either need
+     escaping or further checks.  Find the block containing the first of
+     them, then locate it below */
+#if defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(0x20);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i*)(string + i));
+    /* The comparison is signed, so it also matches bytes >= 0x80 */
+    __m128i special = _mm_or_si128(
+        _mm_cmplt_epi8(block, space),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+    if (_mm_movemask_epi8(special) != 0)
+      break;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t block = vld1q_u8((const uint8_t*)(string + i));
+    uint8x16_t special = vorrq_u8(
+        vorrq_u8(vcltq_u8(block, vdupq_n_u8(0x20)),
+                 vcgeq_u8(block, vdupq_n_u8(0x80))),
+        vorrq_u8(vceqq_u8(block, vdupq_n_u8('"')),
+                 vceqq_u8(block, vdupq_n_u8('\\'))));
+    if (vmaxvq_u8(special) != 0)
+      break;
+  }
+#endif
+  for (; i + 8 <= length; i += 8) {
+    const uint64_t ones = UINT64_C(0x0101010101010101);
+    const uint64_t highs = UINT64_C(0x8080808080808080);
+    uint64_t block, quotes, backslashes;
+    memcpy(&block, string + i, sizeof(block));
+    quotes = block ^ (ones * '"');
+    backslashes = block ^ (ones * '\\');
+    /* Sets the high bit of some byte if any byte is below 0x20, is a quote
+       or a backslash, or has its own high bit set */
+    if (((block - ones * 0x20) | (quotes - ones) | (backslashes - ones) |
+         block) &
+        highs)
+      break;
+  }
+
+  while (i < length) {
+    unsigned char c = (unsigned char)string[i];
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\')
+      break;
+    i++;
+  }
+
+  return i;
+}
+
 int utf8_check_string(const char* string, int length) {
   int i;
 
@@ -145,6 +240,10 @@ int utf8_check_string(const char* string, int length) {
     length = strlen(string);
 
   for (i = 0; i < length; i++) {
+    i += (int)utf8_ascii_prefix(string + i, length - i);
+    if (i == length)
+      break;
+
     int count = utf8_check_first(string[i]);
     if (count == 0)
       return 0;
@@ -166,6 +265,10 @@ void utf8_fix_string(char* string, size_t length) {
   auto end = string + length;
 
   while (string < end) {
+    string += utf8_ascii_prefix(string, end - string);
+    if (string == end)
+      return;
+
     int count = utf8_check_first(*string);
     if (count == 0) {
       // Invalid
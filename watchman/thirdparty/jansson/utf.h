@@ -36,6 +36,15 @@ int utf8_check_first(char byte);
 int utf8_check_full(const char* buffer, int size, int32_t* codepoint);
 const char* utf8_iterate(const char* buffer, int32_t* codepoint);
 
+/* Returns the length of the run of ASCII bytes at the start of string.
+   Long runs are scanned a block at a time. */
+size_t utf8_ascii_prefix(const char* string, size_t length);
+
+/* Returns the length of the run of bytes at the start of string that can
+   appear in a JSON string as they are: ASCII other than control characters,
+   quotes and backslashes. */
+size_t json_plain_prefix(const char* string, size_t length);
+
 int utf8_check_string(const char* string, int length);
 void utf8_fix_string(char* string, size_t length);
 
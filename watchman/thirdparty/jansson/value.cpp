@@ -402,6 +402,28 @@ json_t* json_array_get_template(const json_t* array) {
   return json_to_array(array)->templ;
 }
 
+int json_array_set_bser_rows(
+    json_t* json,
+    std::unique_ptr<json_bser_rows> rows) {
+  if (!json_is_array(json))
+    return 0;
+  json_to_array(json)->bserRows = std::move(rows);
+  return 1;
+}
+
+const json_bser_rows* json_array_get_bser_rows(const json_t* array) {
+  if (!json_is_array(array))
+    return nullptr;
+  return json_to_array(array)->bserRows.get();
+}
+
+static void json_array_copy_bser_rows(json_t* target, const json_t* src) {
+  auto rows = json_array_get_bser_rows(src);
+  if (rows) {
+    json_array_set_bser_rows(target, std::make_unique<json_bser_rows>(*rows));
+  }
+}
+
 size_t json_array_size(const json_t* json) {
   if (!json_is_array(json))
     return 0;
@@ -531,6 +553,14 @@ static int json_array_equal(json_t* array1, json_t* array2) {
       return 0;
   }
 
+  auto rows1 = json_array_get_bser_rows(array1);
+  auto rows2 = json_array_get_bser_rows(array2);
+  if (rows1 || rows2) {
+    return rows1 && rows2 && rows1->bser_version == rows2->bser_version &&
+        rows1->bser_capabilities == rows2->bser_capabilities &&
+        rows1->count == rows2->count && rows1->data == rows2->data;
+  }
+
   return 1;
 }
 
@@ -544,6 +574,7 @@ static json_ref json_array_copy(const json_t* array) {
 
   target_vector.insert(
       target_vector.begin(), src_vector.begin(), src_vector.end());
+  json_array_copy_bser_rows(result, array);
 
   return result;
 }
@@ -557,6 +588,7 @@ static json_ref json_array_deep_copy(const json_t* array) {
 
   for (i = 0; i < json_array_size(array); i++)
     json_array_append_new(result, json_deep_copy(json_array_get(array, i)));
+  json_array_copy_bser_rows(result, array);
 
   return result;
 }
@@ -1,7 +1,9 @@
 #include <memory>
 
-#ifdef __SSE__
+#if defined(__SSE2__)
 #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
 #endif
 #include <algorithm>
 #include <new>
@@ -19,10 +21,71 @@
 #endif
 
 namespace detail {
-template <typename T, typename Deleter, typename... Args>
-std::unique_ptr<T, Deleter> make_unique_with_deleter(Args&&... args) {
-  return std::unique_ptr<T, Deleter>(new T(std::forward<Args>(args)...));
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define ART_SIMD_NODE16 1
+
+#if defined(__SSE2__)
+// Yields one bit per matching lane
+inline unsigned node16Mask(__m128i cmp) {
+  return _mm_movemask_epi8(cmp);
+}
+inline unsigned node16ValidMask(unsigned num_children) {
+  return (1u << num_children) - 1;
+}
+inline unsigned node16Index(unsigned mask) {
+  return __builtin_ctz(mask);
+}
+#else
+// NEON has no movemask; narrowing each lane down to a nibble is the
+// cheapest equivalent, which yields four bits per matching lane
+inline uint64_t node16Mask(uint8x16_t cmp) {
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+inline uint64_t node16ValidMask(unsigned num_children) {
+  return num_children == 16 ? ~uint64_t(0)
+                            : (uint64_t(1) << (4 * num_children)) - 1;
 }
+inline unsigned node16Index(uint64_t mask) {
+  return __builtin_ctzll(mask) >> 2;
+}
+#endif
+
+// Returns the index of c in the first num_children keys, or -1
+inline int
+node16Find(const unsigned char* keys, unsigned num_children, unsigned char c) {
+#if defined(__SSE2__)
+  auto cmp = _mm_cmpeq_epi8(
+      _mm_set1_epi8(char(c)),
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)));
+#else
+  auto cmp = vceqq_u8(vdupq_n_u8(c), vld1q_u8(keys));
+#endif
+  auto bitfield = node16Mask(cmp) & node16ValidMask(num_children);
+  return bitfield ? int(node16Index(bitfield)) : -1;
+}
+
+// Returns the index of the first of the num_children keys that sorts after
+// c, or num_children if there is none
+inline unsigned node16UpperBound(
+    const unsigned char* keys,
+    unsigned num_children,
+    unsigned char c) {
+#if defined(__SSE2__)
+  // SSE2 only has a signed comparison, so flip the sign bits to get the
+  // unsigned ordering that the keys are sorted in
+  auto bias = _mm_set1_epi8(char(0x80));
+  auto cmp = _mm_cmplt_epi8(
+      _mm_xor_si128(_mm_set1_epi8(char(c)), bias),
+      _mm_xor_si128(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)), bias));
+#else
+  auto cmp = vcltq_u8(vdupq_n_u8(c), vld1q_u8(keys));
+#endif
+  auto bitfield = node16Mask(cmp) & node16ValidMask(num_children);
+  return bitfield ? node16Index(bitfield) : num_children;
+}
+#endif
 }
 
 // The ART implementation requires that no key be a full prefix of an existing
@@ -143,7 +206,7 @@ void art_tree<ValueType, KeyType>::Node4::addChild(
     this->num_children++;
 
   } else {
-    ref = detail::make_unique_with_deleter<Node16, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node16>(std::move(*this));
     ref->addChild(ref, c, std::move(child));
   }
 }
@@ -252,27 +315,15 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
     NodePtr&& child) {
   if (this->num_children < 16) {
     unsigned idx;
-#ifdef __SSE__
-    __m128i cmp;
-    unsigned mask, bitfield;
-
-    // Compare the key to all 16 stored keys
-    cmp = _mm_cmplt_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-    // Use a mask to ignore children that don't exist
-    mask = (1 << this->num_children) - 1;
-    bitfield = _mm_movemask_epi8(cmp) & mask;
-
-    // Check if less than any
-    if (bitfield) {
-      idx = __builtin_ctz(bitfield);
+#ifdef ART_SIMD_NODE16
+    // Compare the key to all 16 stored keys at once
+    idx = detail::node16UpperBound(keys, this->num_children, c);
+    if (idx < this->num_children) {
       memmove(keys + idx + 1, keys + idx, this->num_children - idx);
       std::move_backward(
           children.begin() + idx,
           children.begin() + this->num_children,
           children.begin() + this->num_children + 1);
-    } else {
-      idx = this->num_children;
     }
 #else
     for (idx = 0; idx < this->num_children; idx++) {
@@ -293,7 +344,7 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
     this->num_children++;
 
   } else {
-    ref = detail::make_unique_with_deleter<Node48, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node48>(std::move(*this));
     ref->addChild(ref, c, std::move(child));
   }
 }
@@ -301,24 +352,11 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
 template <typename ValueType, typename KeyType>
 typename art_tree<ValueType, KeyType>::NodePtr*
 art_tree<ValueType, KeyType>::Node16::findChild(unsigned char c) {
-#ifdef __SSE__
-  __m128i cmp;
-  int mask, bitfield;
-
-  // Compare the key to all 16 stored keys
-  cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-  // Use a mask to ignore children that don't exist
-  mask = (1 << this->num_children) - 1;
-  bitfield = _mm_movemask_epi8(cmp) & mask;
-
-  /*
-   * If we have a match (any bit set) then we can
-   * return the pointer match using ctz to get
-   * the index.
-   */
-  if (bitfield) {
-    return &children[__builtin_ctz(bitfield)];
+#ifdef ART_SIMD_NODE16
+  // Compare the key to all 16 stored keys at once
+  auto idx = detail::node16Find(keys, this->num_children, c);
+  if (idx >= 0) {
+    return &children[idx];
   }
 #else
   int i;
@@ -349,7 +387,7 @@ art_tree<ValueType, KeyType>::Node16::removeChild(
   this->num_children--;
 
   if (this->num_children == 3) {
-    ref = detail::make_unique_with_deleter<Node4, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node4>(std::move(*this));
   }
 
   return result;
@@ -410,7 +448,7 @@ void art_tree<ValueType, KeyType>::Node48::addChild(
     keys[c] = pos + 1;
     this->num_children++;
   } else {
-    ref = detail::make_unique_with_deleter<Node256, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node256>(std::move(*this));
     ref->addChild(ref, c, std::move(child));
   }
 }
@@ -438,7 +476,7 @@ art_tree<ValueType, KeyType>::Node48::removeChild(
   this->num_children--;
 
   if (this->num_children == 12) {
-    ref = detail::make_unique_with_deleter<Node16, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node16>(std::move(*this));
   }
 
   return result;
@@ -489,12 +527,108 @@ art_tree<ValueType, KeyType>::Node256::removeChild(
   // Resize to a node48 on underflow, not immediately to prevent
   // trashing if we sit on the 48/49 boundary
   if (this->num_children == 37) {
-    ref = detail::make_unique_with_deleter<Node48, Deleter>(std::move(*this));
+    ref = NodePool::of(this).template make<Node48>(std::move(*this));
   }
 
   return result;
 }
 
+// --------------------- NodePool
+
+template <typename ValueType, typename KeyType>
+art_tree<ValueType, KeyType>::NodePool::~NodePool() {
+  reset();
+}
+
+template <typename ValueType, typename KeyType>
+size_t art_tree<ValueType, KeyType>::NodePool::sizeOf(Node_type type) {
+  size_t size = 0;
+  switch (type) {
+    case NODE4:
+      size = sizeof(Node4);
+      break;
+    case NODE16:
+      size = sizeof(Node16);
+      break;
+    case NODE48:
+      size = sizeof(Node48);
+      break;
+    case NODE256:
+      size = sizeof(Node256);
+      break;
+  }
+  // Keep every node at the alignment of the chunk header
+  return (size + alignof(ChunkHeader) - 1) & ~(alignof(ChunkHeader) - 1);
+}
+
+template <typename ValueType, typename KeyType>
+template <typename T, typename... Args>
+typename art_tree<ValueType, KeyType>::NodePtr
+art_tree<ValueType, KeyType>::NodePool::make(Args&&... args) {
+  static_assert(
+      alignof(T) <= alignof(ChunkHeader),
+      "nodes must fit the alignment of the chunks");
+  return NodePtr(new (allocate(T::kType)) T(std::forward<Args>(args)...));
+}
+
+template <typename ValueType, typename KeyType>
+void* art_tree<ValueType, KeyType>::NodePool::allocate(Node_type type) {
+  auto& cls = classes_[type - 1];
+  if (cls.freeList) {
+    auto node = cls.freeList;
+    cls.freeList = node->next;
+    return node;
+  }
+
+  auto size = sizeOf(type);
+  if (cls.bumpPtr + size > cls.bumpEnd || !cls.bumpPtr) {
+    auto chunk = static_cast<char*>(
+        ::operator new(kChunkSize, std::align_val_t(kChunkSize)));
+    chunks_.push_back(chunk);
+    new (chunk) ChunkHeader{this, type};
+    cls.bumpPtr = chunk + sizeof(ChunkHeader);
+    cls.bumpEnd = chunk + kChunkSize;
+  }
+  auto node = cls.bumpPtr;
+  cls.bumpPtr += size;
+  return node;
+}
+
+template <typename ValueType, typename KeyType>
+void art_tree<ValueType, KeyType>::NodePool::release(
+    void* ptr,
+    Node_type type) {
+  auto& cls = classes_[type - 1];
+  auto node = static_cast<FreeNode*>(ptr);
+  node->next = cls.freeList;
+  cls.freeList = node;
+}
+
+template <typename ValueType, typename KeyType>
+typename art_tree<ValueType, KeyType>::NodePool&
+art_tree<ValueType, KeyType>::NodePool::of(const Node* node) {
+  auto header = reinterpret_cast<const ChunkHeader*>(
+      uintptr_t(node) & ~uintptr_t(kChunkSize - 1));
+  return *header->pool;
+}
+
+template <typename ValueType, typename KeyType>
+void art_tree<ValueType, KeyType>::NodePool::destroy(Node* node) {
+  auto& pool = of(node);
+  auto type = node->type;
+  node->~Node();
+  pool.release(node, type);
+}
+
+template <typename ValueType, typename KeyType>
+void art_tree<ValueType, KeyType>::NodePool::reset() {
+  for (auto chunk : chunks_) {
+    ::operator delete(chunk, std::align_val_t(kChunkSize));
+  }
+  chunks_.clear();
+  classes_ = {};
+}
+
 /**
  * Initializes an ART tree
  * @return 0 on success.
@@ -504,7 +638,20 @@ art_tree<ValueType, KeyType>::art_tree() : root_(nullptr), size_(0) {}
 
 template <typename ValueType, typename KeyType>
 art_tree<ValueType, KeyType>::art_tree(art_tree&& other) noexcept
-    : root_(std::move(other.root_)), size_(std::move(other.size_)) {}
+    : pool_(std::move(other.pool_)),
+      root_(std::move(other.root_)),
+      size_(std::move(other.size_)) {
+  other.size_ = 0;
+}
+
+template <typename ValueType, typename KeyType>
+typename art_tree<ValueType, KeyType>::NodePool&
+art_tree<ValueType, KeyType>::pool() {
+  if (!pool_) {
+    pool_ = std::make_unique<NodePool>();
+  }
+  return *pool_;
+}
 
 template <typename ValueType, typename KeyType>
 void art_tree<ValueType, KeyType>::Deleter::operator()(Node* node) const {
@@ -519,7 +666,7 @@ void art_tree<ValueType, KeyType>::Deleter::operator()(Node* node) const {
     return;
   }
 
-  delete node;
+  NodePool::destroy(node);
 }
 
 template <typename ValueType, typename KeyType>
@@ -527,8 +674,53 @@ art_tree<ValueType, KeyType>::~art_tree() {
   clear();
 }
 
+template <typename ValueType, typename KeyType>
+void art_tree<ValueType, KeyType>::releaseLeaves(Node* n) {
+  auto release = [](NodePtr& child) {
+    if (!child) {
+      return;
+    }
+    if (IS_LEAF(child.get())) {
+      child.reset();
+      return;
+    }
+    releaseLeaves(child.get());
+    // The node itself goes away with its pool
+    child.release();
+  };
+
+  union node_ptr p = {n};
+  switch (n->type) {
+    case NODE4:
+      for (int i = 0; i < n->num_children; i++) {
+        release(p.n4->children[i]);
+      }
+      break;
+    case NODE16:
+      for (int i = 0; i < n->num_children; i++) {
+        release(p.n16->children[i]);
+      }
+      break;
+    case NODE48:
+      for (auto& child : p.n48->children) {
+        release(child);
+      }
+      break;
+    case NODE256:
+      for (auto& child : p.n256->children) {
+        release(child);
+      }
+      break;
+  }
+}
+
 template <typename ValueType, typename KeyType>
 void art_tree<ValueType, KeyType>::clear() {
+  if (root_ && !IS_LEAF(root_.get()) && pool_) {
+    releaseLeaves(root_.get());
+    root_.release();
+    pool_->reset();
+  }
   root_.reset();
   size_ = 0;
 }
@@ -848,7 +1040,7 @@ void art_tree<ValueType, KeyType>::recursiveInsert(
     }
 
     // New value, we must split the leaf into a node4
-    NodePtr new_node = detail::make_unique_with_deleter<Node4, Deleter>();
+    NodePtr new_node = pool().template make<Node4>();
 
     // Create a new leaf
     auto l2 = std::make_unique<Leaf>(key, std::forward<Args>(args)...);
@@ -889,7 +1081,7 @@ void art_tree<ValueType, KeyType>::recursiveInsert(
     auto origNode = ref.get();
 
     // Create a new node
-    NodePtr new_node = detail::make_unique_with_deleter<Node4, Deleter>();
+    NodePtr new_node = pool().template make<Node4>();
     new_node->partial_len = prefix_diff;
     memcpy(
         new_node->partial,
@@ -6,6 +6,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
 #define ART_MAX_PREFIX_LEN 10u
 
@@ -24,6 +25,65 @@ struct art_tree {
   using NodePtr = std::unique_ptr<Node, Deleter>;
   using LeafPtr = std::unique_ptr<Leaf>;
 
+  /**
+   * Allocates the inner nodes of a tree.
+   *
+   * Nodes are carved out of chunks dedicated to their node type, and freed
+   * nodes go onto a freelist per type for reuse.  The chunks are aligned to
+   * their size, which lets a node find its pool from its own address, so
+   * neither the nodes nor their NodePtrs need to carry a pointer to it.
+   * The chunks are only returned to the system by reset() or destruction,
+   * which is what lets clear() release a whole tree without freeing its
+   * nodes one at a time.
+   */
+  class NodePool {
+   public:
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    NodePool() = default;
+    ~NodePool();
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    template <typename T, typename... Args>
+    NodePtr make(Args&&... args);
+
+    // Destroys a node allocated by any pool and returns it to that pool
+    static void destroy(Node* node);
+
+    // Returns the pool that allocated node
+    static NodePool& of(const Node* node);
+
+    // Releases all of the chunks.  Any nodes still in them must not be
+    // touched again, not even to destroy them.
+    void reset();
+
+   private:
+    struct FreeNode {
+      FreeNode* next;
+    };
+
+    struct alignas(16) ChunkHeader {
+      NodePool* pool;
+      Node_type type;
+    };
+
+    struct TypeClass {
+      FreeNode* freeList{nullptr};
+      char* bumpPtr{nullptr};
+      char* bumpEnd{nullptr};
+    };
+
+    static size_t sizeOf(Node_type type);
+
+    void* allocate(Node_type type);
+    void release(void* ptr, Node_type type);
+
+    // Indexed by Node_type - 1
+    std::array<TypeClass, 4> classes_;
+    std::vector<void*> chunks_;
+  };
+
   /**
    * This struct is included as part
    * of all the various node sizes
@@ -107,6 +167,7 @@ struct art_tree {
    * Small node with only 4 children
    */
   struct Node4 : public Node {
+    static constexpr Node_type kType = NODE4;
     unsigned char keys[4];
     std::array<NodePtr, 4> children;
 
@@ -121,6 +182,7 @@ struct art_tree {
    * Node with 16 children
    */
   struct Node16 : public Node {
+    static constexpr Node_type kType = NODE16;
     unsigned char keys[16];
     std::array<NodePtr, 16> children;
 
@@ -137,6 +199,7 @@ struct art_tree {
    * a full 256 byte field.
    */
   struct Node48 : public Node {
+    static constexpr Node_type kType = NODE48;
     unsigned char keys[256];
     std::array<NodePtr, 48> children;
 
@@ -152,6 +215,7 @@ struct art_tree {
    * Full node with 256 children
    */
   struct Node256 : public Node {
+    static constexpr Node_type kType = NODE256;
     std::array<NodePtr, 256> children;
 
     Node256();
@@ -190,6 +254,10 @@ struct art_tree {
     return size_;
   }
 
+  /**
+   * Removes all of the entries.  The leaves are destroyed, but the inner
+   * nodes are released along with the memory of the pool that holds them.
+   */
   void clear();
 
   /**
@@ -266,9 +334,17 @@ struct art_tree {
   int iterPrefix(const unsigned char* prefix, uint32_t prefix_len, Func&& func);
 
  private:
+  // Declared before root_ so that it outlives the nodes.  Created when the
+  // tree first needs a node.
+  std::unique_ptr<NodePool> pool_;
   NodePtr root_;
   uint64_t size_;
 
+  NodePool& pool();
+  // Destroys the leaves beneath n, leaving its inner nodes for the pool
+  // to release
+  static void releaseLeaves(Node* n);
+
   template <typename... Args>
   void recursiveInsert(
       NodePtr& ref,
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/GlobResultCache.h"
+#include <string_view>
+#include "watchman/query/GlobMatcher.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace watchman {
+
+namespace {
+
+std::unique_ptr<GlobMatcher> makeMatcher(
+    const std::vector<std::string>& patterns,
+    bool includeDotfiles) {
+  std::vector<std::string_view> views(patterns.begin(), patterns.end());
+  return std::make_unique<GlobMatcher>(
+      views, WM_PATHNAME | (includeDotfiles ? 0 : WM_PERIOD));
+}
+
+// Returns true if `matches` holds a path beneath `dir`
+bool hasMatchesBeneath(
+    const std::map<std::string, DType>& matches,
+    const std::string& dir) {
+  auto prefix = dir + "/";
+  auto it = matches.lower_bound(prefix);
+  return it != matches.end() &&
+      it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
+GlobResultCache::GlobResultCache(size_t maxEntries) : maxEntries_(maxEntries) {}
+
+std::string GlobResultCache::makeKey(
+    const std::string& commit,
+    const std::vector<std::string>& patterns,
+    bool includeDotfiles) {
+  // Neither commit hashes nor patterns can contain a NUL
+  std::string key = commit;
+  key.push_back('\0');
+  key.push_back(includeDotfiles ? '1' : '0');
+  for (const auto& pattern : patterns) {
+    key.push_back('\0');
+    key.append(pattern);
+  }
+  return key;
+}
+
+std::shared_ptr<const GlobResultCache::Results> GlobResultCache::get(
+    const std::string& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second.lruPosition);
+  return it->second.results;
+}
+
+void GlobResultCache::insert(
+    const std::string& key,
+    std::shared_ptr<const Results> results) {
+  if (maxEntries_ == 0) {
+    return;
+  }
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    it->second.results = std::move(results);
+    lru_.splice(lru_.begin(), lru_, it->second.lruPosition);
+    return;
+  }
+
+  while (entries_.size() >= maxEntries_) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  entries_.emplace(key, Entry{std::move(results), lru_.begin()});
+}
+
+std::vector<std::string> GlobResultCache::relevantPaths(
+    const Results& results,
+    const std::vector<std::string>& patterns,
+    bool includeDotfiles,
+    const std::vector<std::string>& changed) {
+  auto matcher = makeMatcher(patterns, includeDotfiles);
+  std::vector<std::string> relevant;
+  std::vector<uint32_t> matched;
+  for (const auto& path : changed) {
+    auto state = matcher->advance(matcher->start(), path);
+    matched.clear();
+    matcher->matches(state, path.c_str(), matched);
+    bool mayContainMatches = !matcher->isDead(matcher->advance(state, "/"));
+    if (!matched.empty() || mayContainMatches ||
+        results.matches.count(path) > 0 ||
+        hasMatchesBeneath(results.matches, path)) {
+      relevant.push_back(path);
+    }
+  }
+  return relevant;
+}
+
+std::optional<GlobResultCache::Results> GlobResultCache::patch(
+    const Results& results,
+    const std::vector<std::string>& patterns,
+    bool includeDotfiles,
+    const std::vector<std::string>& paths,
+    const std::vector<std::optional<DType>>& types) {
+  auto matcher = makeMatcher(patterns, includeDotfiles);
+  Results patched{results.generation, results.sequence, results.matches};
+  std::vector<const std::string*> removed;
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const auto& path = paths[i];
+    const auto& type = i < types.size() ? types[i] : std::nullopt;
+    if (!type) {
+      patched.matches.erase(path);
+      removed.push_back(&path);
+      continue;
+    }
+
+    if (*type == DType::Dir) {
+      auto it = results.matches.find(path);
+      bool wasDir = it != results.matches.end() && it->second == DType::Dir;
+      auto beneath =
+          matcher->advance(matcher->advance(matcher->start(), path), "/");
+      if (!wasDir && !matcher->isDead(beneath)) {
+        // It may have been renamed into place along with its contents
+        return std::nullopt;
+      }
+    }
+
+    if (!matcher->match(path.c_str()).empty()) {
+      patched.matches[path] = *type;
+    } else {
+      patched.matches.erase(path);
+    }
+  }
+
+  // Once every reported change has been applied, a directory that is gone
+  // but still holds matches was renamed away rather than emptied.
+  for (auto path : removed) {
+    if (hasMatchesBeneath(patched.matches, *path)) {
+      return std::nullopt;
+    }
+  }
+  return patched;
+}
+
+} // namespace watchman
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "watchman/fs/FileInformation.h"
+
+namespace watchman {
+
+/**
+ * Remembers the results of evaluating sets of glob patterns against an
+ * EdenFS mount at a particular commit, so that they can be brought up to
+ * date with the paths that the journal reports as changed since, rather
+ * than asking EdenFS to walk the tree again.
+ *
+ * Holds up to `maxEntries` results, discarding the least recently used.
+ *
+ * Not thread safe.
+ */
+class GlobResultCache {
+ public:
+  struct Results {
+    int64_t generation{0};
+    // The journal position that the matches are current as of
+    uint64_t sequence{0};
+    std::map<std::string, DType> matches;
+  };
+
+  explicit GlobResultCache(size_t maxEntries);
+
+  static std::string makeKey(
+      const std::string& commit,
+      const std::vector<std::string>& patterns,
+      bool includeDotfiles);
+
+  std::shared_ptr<const Results> get(const std::string& key);
+  void insert(const std::string& key, std::shared_ptr<const Results> results);
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  /**
+   * Returns the paths among `changed` that may affect the results of the
+   * patterns: those that they match, those that may contain matches, and
+   * those that contain cached matches.  Their current types are needed by
+   * patch().
+   */
+  static std::vector<std::string> relevantPaths(
+      const Results& results,
+      const std::vector<std::string>& patterns,
+      bool includeDotfiles,
+      const std::vector<std::string>& changed);
+
+  /**
+   * Returns `results` updated with the current type of each of `paths`,
+   * or nullopt for those that no longer exist.  Returns nullopt if a
+   * directory that may hold matches appeared or disappeared, because its
+   * contents are not necessarily reported as changed when it is renamed.
+   */
+  static std::optional<Results> patch(
+      const Results& results,
+      const std::vector<std::string>& patterns,
+      bool includeDotfiles,
+      const std::vector<std::string>& paths,
+      const std::vector<std::optional<DType>>& types);
+
+ private:
+  using LruList = std::list<std::string>;
+  struct Entry {
+    std::shared_ptr<const Results> results;
+    LruList::iterator lruPosition;
+  };
+
+  const size_t maxEntries_;
+  std::unordered_map<std::string, Entry> entries_;
+  // Most recently used first
+  LruList lru_;
+};
+
+} // namespace watchman
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/InotifyEventCoalescer.h"
+
+#ifdef HAVE_INOTIFY_INIT
+
+namespace watchman {
+
+bool InotifyEventCoalescer::coalesce(const struct inotify_event* ine) {
+  if (ine->wd == -1 || (ine->mask & kUncoalescableMask)) {
+    return false;
+  }
+
+  // Mirrors the flags that InotifyWatcher::process_inotify_event computes
+  PendingFlags flags = W_PENDING_VIA_NOTIFY;
+  if (ine->mask & (IN_CREATE | IN_DELETE)) {
+    flags.set(W_PENDING_RECURSIVE);
+  }
+
+  Key key{
+      ine->wd, ine->len > 0 ? std::string_view(ine->name) : std::string_view()};
+  auto [it, inserted] = paths_.emplace(key, flags);
+  if (inserted) {
+    return false;
+  }
+  if (it->second.containsAllOf(flags)) {
+    // Adding this path again with no new flags wouldn't change anything
+    return true;
+  }
+  it->second.set(flags);
+  return false;
+}
+
+} // namespace watchman
+
+#endif
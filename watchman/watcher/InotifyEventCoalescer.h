@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include "watchman/PendingCollection.h"
+#include "watchman/watchman_system.h"
+
+#ifdef HAVE_INOTIFY_INIT
+
+namespace watchman {
+
+// Events with these bits need bookkeeping beyond adding a pending item, so
+// they are never coalesced.
+constexpr uint32_t kUncoalescableMask = IN_MOVED_FROM | IN_MOVED_TO |
+    IN_UNMOUNT | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF | IN_Q_OVERFLOW;
+
+/**
+ * Drops the inotify events of a read that would only repeat an earlier
+ * event of that read: one for the same watch descriptor and name whose
+ * pending flags are a subset of those already added for it.
+ *
+ * The events are identified by referencing the name in the read buffer, so
+ * reset() must be called before the buffer is reused.  Coalescing across
+ * reads is left to PendingChanges.
+ *
+ * Not thread safe.
+ */
+class InotifyEventCoalescer {
+ public:
+  // Returns true if ine would only repeat an event that was seen since the
+  // last reset, and so needn't be processed.
+  bool coalesce(const struct inotify_event* ine);
+
+  // Forgets the events seen so far
+  void reset() {
+    paths_.clear();
+  }
+
+ private:
+  struct Key {
+    int wd;
+    std::string_view name;
+
+    bool operator==(const Key& other) const {
+      return wd == other.wd && name == other.name;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<std::string_view>()(key.name) ^ size_t(key.wd);
+    }
+  };
+
+  // Kept across reads to reuse its allocation
+  std::unordered_map<Key, PendingFlags, KeyHash> paths_;
+};
+
+/**
+ * Calls fn with each of the events in the size bytes that were read from an
+ * inotify descriptor into buf.
+ */
+template <typename Fn>
+void forEachInotifyEvent(char* buf, size_t size, Fn&& fn) {
+  struct inotify_event* ine;
+  for (char* iptr = buf; iptr < buf + size; iptr += sizeof(*ine) + ine->len) {
+    ine = reinterpret_cast<struct inotify_event*>(iptr);
+    fn(ine);
+  }
+}
+
+} // namespace watchman
+
+#endif
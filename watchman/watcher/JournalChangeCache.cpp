@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/JournalChangeCache.h"
+#include <unordered_set>
+
+namespace watchman {
+
+JournalChangeCache::JournalChangeCache(size_t maxPaths) : maxPaths_(maxPaths) {}
+
+void JournalChangeCache::reset(int64_t generation, uint64_t sequence) {
+  valid_ = true;
+  generation_ = generation;
+  start_ = end_ = sequence;
+  batches_.clear();
+  numPaths_ = 0;
+}
+
+void JournalChangeCache::clear() {
+  valid_ = false;
+  batches_.clear();
+  numPaths_ = 0;
+}
+
+void JournalChangeCache::append(
+    int64_t generation,
+    uint64_t fromSequence,
+    uint64_t toSequence,
+    const std::vector<std::string>& changed,
+    const std::vector<std::string>& created) {
+  if (!isValid(generation) || fromSequence != end_ || toSequence < end_) {
+    reset(generation, toSequence);
+    return;
+  }
+  if (toSequence == end_) {
+    return;
+  }
+
+  auto size = changed.size() + created.size();
+  if (size > maxPaths_) {
+    // This batch alone doesn't fit
+    reset(generation, toSequence);
+    return;
+  }
+
+  batches_.push_back(Batch{toSequence, changed, created});
+  numPaths_ += size;
+  end_ = toSequence;
+
+  while (numPaths_ > maxPaths_) {
+    auto& oldest = batches_.front();
+    numPaths_ -= oldest.changed.size() + oldest.created.size();
+    start_ = oldest.toSequence;
+    batches_.pop_front();
+  }
+}
+
+std::optional<JournalChangeCache::Changes> JournalChangeCache::changesSince(
+    int64_t generation,
+    uint64_t sequence) const {
+  if (!isValid(generation) || sequence < start_ || sequence > end_) {
+    return std::nullopt;
+  }
+
+  std::unordered_set<std::string> created;
+  std::unordered_set<std::string> changed;
+  for (const auto& batch : batches_) {
+    if (batch.toSequence <= sequence) {
+      continue;
+    }
+    for (const auto& name : batch.created) {
+      created.insert(name);
+      changed.erase(name);
+    }
+    for (const auto& name : batch.changed) {
+      if (created.find(name) == created.end()) {
+        changed.insert(name);
+      }
+    }
+  }
+
+  Changes result;
+  result.changed.assign(changed.begin(), changed.end());
+  result.created.assign(created.begin(), created.end());
+  return result;
+}
+
+} // namespace watchman
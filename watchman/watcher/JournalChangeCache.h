@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Remembers the batches of paths that a journaling filesystem (EdenFS)
+ * reported as changed between consecutive journal positions, so that a query
+ * for the changes since a recent position can be answered from memory rather
+ * than by asking the filesystem to recompute them.
+ *
+ * The cache covers a contiguous range of sequence numbers within a single
+ * mount generation.  Once it holds more than `maxPaths` paths, the oldest
+ * batches are discarded.
+ *
+ * Not thread safe.
+ */
+class JournalChangeCache {
+ public:
+  struct Changes {
+    // Paths that changed but were not created within the range
+    std::vector<std::string> changed;
+    // Paths that were created within the range
+    std::vector<std::string> created;
+  };
+
+  explicit JournalChangeCache(size_t maxPaths);
+
+  // Forgets every batch; the cache then covers no changes after `sequence`
+  void reset(int64_t generation, uint64_t sequence);
+
+  // Forgets every batch until the next append
+  void clear();
+
+  // Records the changes between fromSequence and toSequence.  If they don't
+  // begin where the cache ends, the cache is reset to start at toSequence.
+  void append(
+      int64_t generation,
+      uint64_t fromSequence,
+      uint64_t toSequence,
+      const std::vector<std::string>& changed,
+      const std::vector<std::string>& created);
+
+  // Whether the cache reaches up to a position in `generation`
+  bool isValid(int64_t generation) const {
+    return valid_ && generation == generation_;
+  }
+
+  uint64_t endSequence() const {
+    return end_;
+  }
+
+  // Returns the union of the changes after `sequence` up to endSequence(),
+  // or nullopt if the cache doesn't reach back that far.  Batches are not
+  // split, so the result may include changes from the batch that contains
+  // `sequence`.
+  std::optional<Changes> changesSince(int64_t generation, uint64_t sequence)
+      const;
+
+  size_t numPaths() const {
+    return numPaths_;
+  }
+
+ private:
+  struct Batch {
+    uint64_t toSequence;
+    std::vector<std::string> changed;
+    std::vector<std::string> created;
+  };
+
+  const size_t maxPaths_;
+  bool valid_{false};
+  int64_t generation_{0};
+  // The changes after start_ and up to end_ are cached
+  uint64_t start_{0};
+  uint64_t end_{0};
+  std::deque<Batch> batches_;
+  size_t numPaths_{0};
+};
+
+} // namespace watchman
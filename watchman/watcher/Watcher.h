@@ -8,6 +8,8 @@
 #pragma once
 #include <folly/futures/Future.h>
 #include <stdexcept>
+#include <string>
+#include <unordered_map>
 #include "watchman/PendingCollection.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -43,6 +45,9 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
 #define WATCHER_COALESCED_RENAME 2
   // if the watcher is comprised of multiple watchers
 #define WATCHER_HAS_SPLIT_WATCH 4
+  // if startWatchDir needs only the path of the dir, so that dirs that the
+  // view has no node for can be watched
+#define WATCHER_WATCHES_PATHS 8
   unsigned flags;
 
   Watcher(const char* name, unsigned flags);
@@ -74,9 +79,63 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
     return folly::SemiFuture<folly::Unit>::makeEmpty();
   }
 
+  /**
+   * If the returned SemiFuture is valid(), then this watcher's event stream
+   * is ordered and it can determine the position in that stream that
+   * corresponds to now, so synchronizing with the filesystem does not need a
+   * cookie file. The watcher has placed a Promise in the PendingCollection
+   * after every event up to that position, and it will be completed when
+   * InMemoryView processes it.
+   *
+   * Otherwise, syncToNow writes a cookie file and waits for it to be
+   * observed, followed by flushPendingEvents.
+   */
+  virtual folly::SemiFuture<folly::Unit> syncToSequencePosition() {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
+
+  /**
+   * Watchers whose notifications describe the metadata of the changed items
+   * return it here, keyed by full path, so that the IO thread can use it in
+   * place of stat'ing those paths.  Each call moves out what was gathered
+   * since the previous one.  An entry must be at least as recent as the last
+   * notification for its path that consumeNotify has returned.
+   */
+  virtual std::unordered_map<w_string, FileInformation> takeNotifiedStats() {
+    return {};
+  }
+
+  /**
+   * Watchers whose event stream outlives the daemon, such as a filesystem's
+   * change journal, return an opaque encoding of the position in it up to
+   * which InMemoryView has applied the events that consumeNotify returned,
+   * and of whatever else they need to resume from there.  It is saved with
+   * the view snapshot.  Others return an empty string.
+   */
+  virtual std::string getStreamPosition() {
+    return {};
+  }
+
+  /**
+   * Called by the IO thread once the view has been restored from a snapshot
+   * that was saved along with `position`, before the view is crawled.
+   * Returns true if the watcher will report every change made since then,
+   * in which case the view isn't crawled at all.
+   */
+  virtual bool resumeFromStreamPosition(const std::string& /*position*/) {
+    return false;
+  }
+
   // Initiate an OS-level watch on the provided file
   virtual bool startWatchFile(watchman_file* file);
 
+  /**
+   * Called by the IO thread once it has applied a batch of changes, so that
+   * watchers can complete the watches that startWatchFile queued for that
+   * batch in one go.
+   */
+  virtual void flushWatches() {}
+
   // Initiate an OS-level watch on the provided dir, return a DIR
   // handle, or throw on error.
   virtual std::unique_ptr<DirHandle> startWatchDir(
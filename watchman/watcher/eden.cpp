@@ -7,6 +7,7 @@
 
 #include <cpptoml.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
@@ -19,6 +20,8 @@
 #include <thrift/lib/cpp2/async/RocketClientChannel.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
+#include <functional>
 #include <iterator>
 #include <thread>
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
@@ -34,6 +37,8 @@
 #include "watchman/root/Root.h"
 #include "watchman/scm/SCM.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/watcher/GlobResultCache.h"
+#include "watchman/watcher/JournalChangeCache.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -179,17 +184,30 @@ std::unique_ptr<StreamingEdenServiceAsyncClient> getRocketEdenClient(
           AsyncSocket::UniquePtr(new AsyncSocket(eb, addr))));
 }
 
+// Properties are fetched from Eden in requests of up to kFetchChunkSize
+// paths, with up to kMaxFetchesInFlight of them outstanding at a time, so
+// that the round trips for a large result set overlap without any single
+// request growing unboundedly large.
+constexpr size_t kFetchChunkSize = 1024;
+constexpr size_t kMaxFetchesInFlight = 8;
+
+// Larger glob results, such as those of the "**" that enumerates a fresh
+// instance, are not worth holding in memory
+constexpr size_t kMaxCachedGlobResults = 100000;
+
 class EdenFileResult : public FileResult {
  public:
   EdenFileResult(
       const w_string& rootPath,
       std::shared_ptr<apache::thrift::PooledRequestChannel> thriftChannel,
+      std::atomic<uint64_t>* numRequests,
       const w_string& fullName,
       JournalPosition* position = nullptr,
       bool isNew = false,
       DType dtype = DType::Unknown)
       : rootPath_(rootPath),
         thriftChannel_{std::move(thriftChannel)},
+        numRequests_(numRequests),
         fullName_(fullName),
         dtype_(dtype) {
     otime_.ticks = ctime_.ticks = 0;
@@ -341,7 +359,8 @@ class EdenFileResult : public FileResult {
   }
 
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override {
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      std::chrono::steady_clock::time_point /*deadline*/) override {
     std::vector<EdenFileResult*> getFileInformationFiles;
     std::vector<std::string> getFileInformationNames;
     // If only dtype and exists are needed, Eden has a cheaper API for
@@ -404,40 +423,41 @@ class EdenFileResult : public FileResult {
     }
 
     auto client = getEdenClient(thriftChannel_);
-    loadFileInformation(
-        client.get(),
-        rootPath_,
-        getFileInformationNames,
-        getFileInformationFiles,
-        onlyEntryInfoNeeded);
+    folly::DrivableExecutor* executor =
+        folly::EventBaseManager::get()->getEventBase();
+
+    // The file information and SHA-1 requests are independent, so they
+    // share a single window of in-flight requests.
+    std::vector<std::function<folly::Future<folly::Unit>()>> fetches;
+    auto infoNames = chunk(getFileInformationNames);
+    auto infoFiles = chunk(getFileInformationFiles);
+    for (size_t i = 0; i < infoNames.size(); ++i) {
+      fetches.emplace_back([&, i] {
+        return loadFileInformation(
+            client.get(),
+            executor,
+            infoNames[i],
+            infoFiles[i],
+            onlyEntryInfoNeeded);
+      });
+    }
+    auto shaNames = chunk(getShaNames);
+    auto shaFiles = chunk(getShaFiles);
+    for (size_t i = 0; i < shaNames.size(); ++i) {
+      fetches.emplace_back([&, i] {
+        return loadSha1(client.get(), executor, shaNames[i], shaFiles[i]);
+      });
+    }
+    runPipelined(fetches, executor);
 
     // TODO: add eden bulk readlink call
     loadSymlinkTargets(client.get(), getSymlinkFiles);
-
-    if (!getShaFiles.empty()) {
-      std::vector<SHA1Result> sha1s;
-      client->sync_getSHA1(sha1s, std::string{rootPath_.view()}, getShaNames);
-
-      if (sha1s.size() != getShaFiles.size()) {
-        watchman::log(
-            ERR,
-            "Requested SHA-1 of ",
-            getShaFiles.size(),
-            " but Eden returned ",
-            sha1s.size(),
-            " results -- ignoring");
-      } else {
-        auto sha1Iter = sha1s.begin();
-        for (auto& edenFile : getShaFiles) {
-          edenFile->sha1_ = *sha1Iter++;
-        }
-      }
-    }
   }
 
  private:
   w_string rootPath_;
   std::shared_ptr<apache::thrift::PooledRequestChannel> thriftChannel_;
+  std::atomic<uint64_t>* numRequests_;
   w_string fullName_;
   std::optional<FileInformation> stat_;
   std::optional<bool> exists_;
@@ -467,60 +487,149 @@ class EdenFileResult : public FileResult {
     }
   }
 
-  static void loadFileInformation(
+  // Splits `items` into consecutive runs of up to kFetchChunkSize
+  template <typename T>
+  static std::vector<std::vector<T>> chunk(const std::vector<T>& items) {
+    std::vector<std::vector<T>> chunks;
+    for (size_t i = 0; i < items.size(); i += kFetchChunkSize) {
+      auto end = std::min(items.size(), i + kFetchChunkSize);
+      chunks.emplace_back(items.begin() + i, items.begin() + end);
+    }
+    return chunks;
+  }
+
+  // Starts each of `fetches`, keeping up to kMaxFetchesInFlight of them
+  // outstanding, and waits for all of them.  If any fail, no more are
+  // started and the first error is rethrown once the outstanding ones have
+  // completed, since their callbacks refer to the caller's state.
+  static void runPipelined(
+      const std::vector<std::function<folly::Future<folly::Unit>()>>& fetches,
+      folly::DrivableExecutor* executor) {
+    std::deque<folly::Future<folly::Unit>> inFlight;
+    folly::exception_wrapper error;
+    auto waitForOldest = [&] {
+      auto result = std::move(inFlight.front()).getTryVia(executor);
+      inFlight.pop_front();
+      if (result.hasException() && !error) {
+        error = std::move(result.exception());
+      }
+    };
+
+    for (auto& fetch : fetches) {
+      if (inFlight.size() >= kMaxFetchesInFlight) {
+        waitForOldest();
+      }
+      if (error) {
+        break;
+      }
+      inFlight.push_back(fetch());
+    }
+    while (!inFlight.empty()) {
+      waitForOldest();
+    }
+    if (error) {
+      error.throw_exception();
+    }
+  }
+
+  static void applySha1s(
+      const std::vector<EdenFileResult*>& files,
+      std::vector<SHA1Result>&& sha1s) {
+    if (sha1s.size() != files.size()) {
+      watchman::log(
+          ERR,
+          "Requested SHA-1 of ",
+          files.size(),
+          " but Eden returned ",
+          sha1s.size(),
+          " results -- ignoring");
+      return;
+    }
+    auto sha1Iter = sha1s.begin();
+    for (auto& edenFile : files) {
+      edenFile->sha1_ = std::move(*sha1Iter++);
+    }
+  }
+
+  folly::Future<folly::Unit> loadSha1(
       StreamingEdenServiceAsyncClient* client,
-      const w_string& rootPath,
+      folly::DrivableExecutor* executor,
       const std::vector<std::string>& names,
+      const std::vector<EdenFileResult*>& files) const {
+    ++*numRequests_;
+    return client->semifuture_getSHA1(std::string{rootPath_.view()}, names)
+        .via(executor)
+        .thenValue([&files](std::vector<SHA1Result>&& sha1s) {
+          applySha1s(files, std::move(sha1s));
+        });
+  }
+
+  template <typename InfoList>
+  static void applyResults(
       const std::vector<EdenFileResult*>& outFiles,
-      bool onlyEntryInfoNeeded) {
-    w_assert(
-        names.size() == outFiles.size(), "names.size must == outFiles.size");
-    if (names.empty()) {
-      return;
+      const InfoList& edenInfo) {
+    if (outFiles.size() != edenInfo.size()) {
+      watchman::log(
+          ERR,
+          "Requested file information of ",
+          outFiles.size(),
+          " files but Eden returned information for ",
+          edenInfo.size(),
+          " files. Treating missing entries as missing files.");
     }
 
-    auto applyResults = [&](const auto& edenInfo) {
-      if (names.size() != edenInfo.size()) {
-        watchman::log(
-            ERR,
-            "Requested file information of ",
-            names.size(),
-            " files but Eden returned information for ",
-            edenInfo.size(),
-            " files. Treating missing entries as missing files.");
+    auto infoIter = edenInfo.begin();
+    for (auto& edenFileResult : outFiles) {
+      if (infoIter == edenInfo.end()) {
+        edenFileResult->setExists(false);
+      } else {
+        edenFileResult->applyInformationOrError(*infoIter);
+        ++infoIter;
       }
+    }
+  }
 
-      auto infoIter = edenInfo.begin();
-      for (auto& edenFileResult : outFiles) {
-        if (infoIter == edenInfo.end()) {
-          edenFileResult->setExists(false);
-        } else {
-          edenFileResult->applyInformationOrError(*infoIter);
-          ++infoIter;
-        }
-      }
+  folly::Future<folly::Unit> loadFileInformation(
+      StreamingEdenServiceAsyncClient* client,
+      folly::DrivableExecutor* executor,
+      const std::vector<std::string>& names,
+      const std::vector<EdenFileResult*>& outFiles,
+      bool onlyEntryInfoNeeded) const {
+    w_assert(
+        names.size() == outFiles.size(), "names.size must == outFiles.size");
+
+    auto getFileInformation = [this, client, executor, &names, &outFiles] {
+      ++*numRequests_;
+      return client
+          ->semifuture_getFileInformation(std::string{rootPath_.view()}, names)
+          .via(executor)
+          .thenValue([&outFiles](std::vector<FileInformationOrError>&& info) {
+            applyResults(outFiles, info);
+          });
     };
 
-    if (onlyEntryInfoNeeded) {
-      std::vector<EntryInformationOrError> info;
-      try {
-        client->sync_getEntryInformation(
-            info, std::string{rootPath.view()}, names);
-        applyResults(info);
-        return;
-      } catch (const TApplicationException& ex) {
-        if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
-          throw;
-        }
-        // getEntryInformation is not available in this version of
-        // Eden. Fall back to the older, more expensive
-        // getFileInformation below.
-      }
+    if (!onlyEntryInfoNeeded) {
+      return getFileInformation();
     }
 
-    std::vector<FileInformationOrError> info;
-    client->sync_getFileInformation(info, std::string{rootPath.view()}, names);
-    applyResults(info);
+    ++*numRequests_;
+    return client
+        ->semifuture_getEntryInformation(std::string{rootPath_.view()}, names)
+        .via(executor)
+        .thenValue([&outFiles](std::vector<EntryInformationOrError>&& info) {
+          applyResults(outFiles, info);
+        })
+        .thenError(
+            folly::tag_t<TApplicationException>{},
+            [getFileInformation](TApplicationException&& ex) {
+              if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
+                return folly::makeFuture<folly::Unit>(std::move(ex));
+              }
+              // getEntryInformation is not available in this version of
+              // Eden. Fall back to the older, more expensive
+              // getFileInformation.
+              return getFileInformation();
+            });
   }
 
   void applyInformationOrError(const EntryInformationOrError& infoOrErr) {
@@ -662,12 +771,13 @@ void appendGlobResultToNameAndDTypeVec(
   }
 }
 
-/** Returns the files that match the glob. */
+/** Returns the files that match the glob, counting requests in numRequests */
 std::vector<NameAndDType> globNameAndDType(
     StreamingEdenServiceAsyncClient* client,
     const std::string& mountPoint,
     const std::vector<std::string>& globPatterns,
     bool includeDotfiles,
+    std::atomic<uint64_t>& numRequests,
     bool splitGlobPattern = false) {
   // TODO(xavierd): Once the config: "eden_split_glob_pattern" is rolled out
   // everywhere, remove this code.
@@ -684,6 +794,7 @@ std::vector<NameAndDType> globNameAndDType(
       params.includeDotfiles_ref() = includeDotfiles;
       params.wantDtype_ref() = true;
 
+      ++numRequests;
       globFutures.emplace_back(
           client->semifuture_globFiles(params).via(executor));
     }
@@ -702,6 +813,7 @@ std::vector<NameAndDType> globNameAndDType(
     params.wantDtype_ref() = true;
 
     Glob glob;
+    ++numRequests;
     client->sync_globFiles(glob, params);
     std::vector<NameAndDType> result;
     appendGlobResultToNameAndDTypeVec(result, std::move(glob));
@@ -737,6 +849,11 @@ std::shared_ptr<apache::thrift::PooledRequestChannel> makeThriftChannel(
 
 } // namespace
 
+size_t getJournalCacheMaxPaths(const Configuration& config) {
+  auto maxPaths = config.getInt("eden_journal_cache_max_paths", 0);
+  return maxPaths > 0 ? size_t(maxPaths) : 0;
+}
+
 class EdenView final : public QueryableView {
   w_string rootPath_;
   std::shared_ptr<apache::thrift::PooledRequestChannel> thriftChannel_;
@@ -748,6 +865,14 @@ class EdenView final : public QueryableView {
   std::promise<void> subscribeReadyPromise_;
   std::shared_future<void> subscribeReadyFuture_;
   bool splitGlobPattern_;
+  // The journal deltas fetched in response to subscription pushes,
+  // retained so that queries can be answered without recomputing them
+  const bool journalCacheEnabled_;
+  mutable folly::Synchronized<JournalChangeCache> journalCache_;
+  // Glob results for the current commit, brought up to date with the
+  // journal rather than reevaluated by Eden
+  const bool globCacheEnabled_;
+  mutable folly::Synchronized<GlobResultCache> globCache_;
 
  public:
   explicit EdenView(const w_string& root_path, const Configuration& config)
@@ -759,11 +884,284 @@ class EdenView final : public QueryableView {
         scm_(EdenWrappedSCM::wrap(SCM::scmForPath(root_path))),
         mountPoint_(root_path.string()),
         subscribeReadyFuture_(subscribeReadyPromise_.get_future()),
-        splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)) {
+        splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)),
+        journalCacheEnabled_(getJournalCacheMaxPaths(config) > 0),
+        journalCache_(std::in_place, getJournalCacheMaxPaths(config)),
+        globCacheEnabled_(config.getInt("eden_glob_cache_max_entries", 0) > 0),
+        globCache_(
+            std::in_place,
+            size_t(std::max(
+                json_int_t(0),
+                config.getInt("eden_glob_cache_max_entries", 0)))) {
     // Get the current journal position so that we can keep track of
     // cookie file changes
     auto client = getEdenClient(thriftChannel_);
     client->sync_getCurrentJournalPosition(lastCookiePosition_, mountPoint_);
+    if (journalCacheEnabled_) {
+      journalCache_.wlock()->reset(
+          *lastCookiePosition_.mountGeneration_ref(),
+          *lastCookiePosition_.sequenceNumber_ref());
+    }
+  }
+
+  static bool didChangeCommits(const FileDelta& delta) {
+    return delta.snapshotTransitions_ref()->size() >= 2 ||
+        (delta.fromPosition_ref()->snapshotHash_ref() !=
+         delta.toPosition_ref()->snapshotHash_ref());
+  }
+
+  static void appendToJournalCache(
+      JournalChangeCache& cache,
+      const FileDelta& delta) {
+    const auto& to = *delta.toPosition_ref();
+    if (didChangeCommits(delta)) {
+      // The changes across a commit transition have to be computed with
+      // the help of source control, so don't answer those from the cache.
+      cache.reset(*to.mountGeneration_ref(), *to.sequenceNumber_ref());
+      return;
+    }
+    const auto* changed = &*delta.changedPaths_ref();
+    std::vector<std::string> changedAndRemoved;
+    if (!delta.removedPaths_ref()->empty()) {
+      changedAndRemoved = *changed;
+      changedAndRemoved.insert(
+          changedAndRemoved.end(),
+          delta.removedPaths_ref()->begin(),
+          delta.removedPaths_ref()->end());
+      changed = &changedAndRemoved;
+    }
+    cache.append(
+        *to.mountGeneration_ref(),
+        *delta.fromPosition_ref()->sequenceNumber_ref(),
+        *to.sequenceNumber_ref(),
+        *changed,
+        *delta.createdPaths_ref());
+  }
+
+  /**
+   * Fills in `delta` with the changes since `since` from the journal cache,
+   * first fetching whatever has been journalled since the most recent push.
+   * Returns false if the cache doesn't reach back that far.
+   */
+  bool getCachedFilesChangedSince(
+      StreamingEdenServiceAsyncClient* client,
+      const JournalPosition& since,
+      const JournalPosition& current,
+      FileDelta& delta,
+      std::atomic<uint64_t>& numRequests) const {
+    if (!journalCacheEnabled_) {
+      return false;
+    }
+    auto generation = *current.mountGeneration_ref();
+    auto cache = journalCache_.wlock();
+    if (!cache->isValid(generation)) {
+      return false;
+    }
+
+    JournalPosition to = current;
+    if (cache->endSequence() < *current.sequenceNumber_ref()) {
+      JournalPosition end;
+      *end.mountGeneration_ref() = generation;
+      *end.sequenceNumber_ref() = cache->endSequence();
+      FileDelta recent;
+      try {
+        ++numRequests;
+        client->sync_getFilesChangedSince(recent, mountPoint_, end);
+      } catch (const EdenError&) {
+        // Let the uncached request report it
+        cache->clear();
+        return false;
+      }
+      appendToJournalCache(*cache, recent);
+      to = *recent.toPosition_ref();
+    } else {
+      *to.sequenceNumber_ref() = cache->endSequence();
+    }
+
+    auto changes = cache->changesSince(generation, *since.sequenceNumber_ref());
+    if (!changes) {
+      return false;
+    }
+    *delta.fromPosition_ref() = since;
+    *delta.fromPosition_ref()->snapshotHash_ref() = *to.snapshotHash_ref();
+    *delta.toPosition_ref() = std::move(to);
+    *delta.changedPaths_ref() = std::move(changes->changed);
+    *delta.createdPaths_ref() = std::move(changes->created);
+    return true;
+  }
+
+  /**
+   * Returns the paths that changed after `sequence`, or nullopt if they
+   * can't be determined without a change of commit in between.
+   */
+  std::optional<std::vector<std::string>> getPathsChangedSince(
+      StreamingEdenServiceAsyncClient* client,
+      const JournalPosition& current,
+      uint64_t sequence,
+      std::atomic<uint64_t>& numRequests) const {
+    auto generation = *current.mountGeneration_ref();
+    if (journalCacheEnabled_) {
+      auto cache = journalCache_.rlock();
+      if (cache->endSequence() >= *current.sequenceNumber_ref()) {
+        if (auto changes = cache->changesSince(generation, sequence)) {
+          auto paths = std::move(changes->changed);
+          paths.insert(
+              paths.end(),
+              std::make_move_iterator(changes->created.begin()),
+              std::make_move_iterator(changes->created.end()));
+          return paths;
+        }
+      }
+    }
+
+    JournalPosition since;
+    *since.mountGeneration_ref() = generation;
+    *since.sequenceNumber_ref() = sequence;
+    FileDelta delta;
+    try {
+      ++numRequests;
+      client->sync_getFilesChangedSince(delta, mountPoint_, since);
+    } catch (const EdenError&) {
+      return std::nullopt;
+    }
+    if (didChangeCommits(delta)) {
+      return std::nullopt;
+    }
+    std::vector<std::string> paths;
+    for (auto* list :
+         {&*delta.changedPaths_ref(),
+          &*delta.createdPaths_ref(),
+          &*delta.removedPaths_ref()}) {
+      paths.insert(
+          paths.end(),
+          std::make_move_iterator(list->begin()),
+          std::make_move_iterator(list->end()));
+    }
+    return paths;
+  }
+
+  /**
+   * Returns `cached` brought up to date with the changes journalled since
+   * it was recorded, or nullptr if Eden needs to evaluate the glob again.
+   */
+  std::shared_ptr<const GlobResultCache::Results> updateCachedGlob(
+      StreamingEdenServiceAsyncClient* client,
+      std::shared_ptr<const GlobResultCache::Results> cached,
+      const JournalPosition& current,
+      const std::vector<std::string>& globPatterns,
+      bool includeDotfiles,
+      std::atomic<uint64_t>& numRequests) const {
+    if (cached->generation != *current.mountGeneration_ref() ||
+        cached->sequence > *current.sequenceNumber_ref()) {
+      return nullptr;
+    }
+    if (cached->sequence == *current.sequenceNumber_ref()) {
+      return cached;
+    }
+
+    auto changed = getPathsChangedSince(
+        client, current, cached->sequence, numRequests);
+    if (!changed) {
+      return nullptr;
+    }
+    auto relevant = GlobResultCache::relevantPaths(
+        *cached, globPatterns, includeDotfiles, *changed);
+    if (relevant.size() > kFetchChunkSize) {
+      // Evaluating the glob again is likely to be cheaper
+      return nullptr;
+    }
+
+    std::vector<std::optional<DType>> types;
+    if (!relevant.empty()) {
+      std::vector<EntryInformationOrError> info;
+      try {
+        ++numRequests;
+        client->sync_getEntryInformation(info, mountPoint_, relevant);
+      } catch (const EdenError&) {
+        return nullptr;
+      } catch (const TApplicationException&) {
+        return nullptr;
+      }
+      for (auto& entry : info) {
+        if (entry.getType() == EntryInformationOrError::Type::info) {
+          types.emplace_back(getDTypeFromEden(*entry.get_info().dtype_ref()));
+        } else {
+          types.emplace_back(std::nullopt);
+        }
+      }
+    }
+
+    auto patched = GlobResultCache::patch(
+        *cached, globPatterns, includeDotfiles, relevant, types);
+    if (!patched) {
+      return nullptr;
+    }
+    patched->sequence = *current.sequenceNumber_ref();
+    return std::make_shared<GlobResultCache::Results>(std::move(*patched));
+  }
+
+  /**
+   * Returns the files that match the glob, from the glob cache when it holds
+   * results for the current commit.
+   */
+  std::vector<NameAndDType> glob(
+      StreamingEdenServiceAsyncClient* client,
+      const std::vector<std::string>& globPatterns,
+      bool includeDotfiles,
+      std::atomic<uint64_t>& numRequests) const {
+    if (!globCacheEnabled_) {
+      return globNameAndDType(
+          client,
+          mountPoint_,
+          globPatterns,
+          includeDotfiles,
+          numRequests,
+          splitGlobPattern_);
+    }
+
+    JournalPosition current;
+    ++numRequests;
+    client->sync_getCurrentJournalPosition(current, mountPoint_);
+    auto key = GlobResultCache::makeKey(
+        *current.snapshotHash_ref(), globPatterns, includeDotfiles);
+
+    auto cached = globCache_.wlock()->get(key);
+    if (cached) {
+      auto updated = updateCachedGlob(
+          client, cached, current, globPatterns, includeDotfiles, numRequests);
+      if (updated) {
+        if (updated != cached) {
+          globCache_.wlock()->insert(key, updated);
+        }
+        std::vector<NameAndDType> result;
+        result.reserve(updated->matches.size());
+        for (auto& [name, dtype] : updated->matches) {
+          result.emplace_back(name, dtype);
+        }
+        return result;
+      }
+    }
+
+    // Changes made while Eden evaluates the glob will be reapplied from
+    // `current` when the results are next used, which is harmless.
+    auto result = globNameAndDType(
+        client,
+        mountPoint_,
+        globPatterns,
+        includeDotfiles,
+        numRequests,
+        splitGlobPattern_);
+    if (result.size() > kMaxCachedGlobResults) {
+      return result;
+    }
+    auto results = std::make_shared<GlobResultCache::Results>();
+    results->generation = *current.mountGeneration_ref();
+    results->sequence = *current.sequenceNumber_ref();
+    for (auto& item : result) {
+      results->matches.emplace(item.name, item.dtype);
+    }
+    globCache_.wlock()->insert(key, std::move(results));
+    return result;
   }
 
   void timeGenerator(const Query* query, QueryContext* ctx) const override {
@@ -799,11 +1197,11 @@ class EdenView final : public QueryableView {
         globPattern.append("/");
       }
       globPattern.append("**");
-      return globNameAndDType(
+      return glob(
           client.get(),
-          mountPoint_,
           std::vector<std::string>{globPattern},
-          includeDotfiles);
+          includeDotfiles,
+          ctx->numEdenRequests);
     };
 
     std::vector<NameAndDType> fileInfo;
@@ -816,18 +1214,25 @@ class EdenView final : public QueryableView {
       // didn't match the current root which means that eden was restarted.
       // We need to translate this to a fresh instance result set and
       // return a list of all possible matching files.
+      ++ctx->numEdenRequests;
       client->sync_getCurrentJournalPosition(resultPosition, mountPoint_);
       fileInfo = getAllFiles();
     } else {
       // Query eden to fill in the mountGeneration field.
-      JournalPosition position;
-      client->sync_getCurrentJournalPosition(position, mountPoint_);
+      JournalPosition current;
+      ++ctx->numEdenRequests;
+      client->sync_getCurrentJournalPosition(current, mountPoint_);
       // dial back to the sequence number from the query
+      JournalPosition position = current;
       *position.sequenceNumber_ref() = ctx->since.clock.ticks;
 
       // Now we can get the change journal from eden
       try {
-        client->sync_getFilesChangedSince(delta, mountPoint_, position);
+        if (!getCachedFilesChangedSince(
+                client.get(), position, current, delta, ctx->numEdenRequests)) {
+          ++ctx->numEdenRequests;
+          client->sync_getFilesChangedSince(delta, mountPoint_, position);
+        }
 
         createdFileNames.insert(
             delta.createdPaths_ref()->begin(), delta.createdPaths_ref()->end());
@@ -844,11 +1249,7 @@ class EdenView final : public QueryableView {
           fileInfo.emplace_back(NameAndDType(std::move(name)));
         }
 
-        bool didChangeCommits = delta.snapshotTransitions_ref()->size() >= 2 ||
-            (delta.fromPosition_ref()->snapshotHash_ref() !=
-             delta.toPosition_ref()->snapshotHash_ref());
-
-        if (scm_ && didChangeCommits) {
+        if (scm_ && didChangeCommits(delta)) {
           // Check whether they checked out a new commit or reset the commit to
           // a different hash.  We interrogate source control to discover
           // the set of changed files between those hashes, and then
@@ -947,6 +1348,7 @@ class EdenView final : public QueryableView {
         // mountGeneration differs, or journal was truncated,
         // so treat this as equivalent to a fresh instance result
         ctx->since.clock.is_fresh_instance = true;
+        ++ctx->numEdenRequests;
         client->sync_getCurrentJournalPosition(resultPosition, mountPoint_);
         fileInfo = getAllFiles();
       } catch (const SCMError& err) {
@@ -960,6 +1362,7 @@ class EdenView final : public QueryableView {
             err.what(),
             "\n");
         ctx->since.clock.is_fresh_instance = true;
+        ++ctx->numEdenRequests;
         client->sync_getCurrentJournalPosition(resultPosition, mountPoint_);
         fileInfo = getAllFiles();
       }
@@ -976,6 +1379,7 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          &ctx->numEdenRequests,
           w_string::pathCat({mountPoint_, item.name}),
           &resultPosition,
           isNew,
@@ -1012,12 +1416,8 @@ class EdenView final : public QueryableView {
     auto client = getEdenClient(thriftChannel_);
 
     auto includeDotfiles = (query->glob_flags & WM_PERIOD) == 0;
-    auto fileInfo = globNameAndDType(
-        client.get(),
-        mountPoint_,
-        globStrings,
-        includeDotfiles,
-        splitGlobPattern_);
+    auto fileInfo =
+        glob(client.get(), globStrings, includeDotfiles, ctx->numEdenRequests);
 
     // Filter out any ignored files
     filterOutPaths(fileInfo, ctx);
@@ -1026,6 +1426,7 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          &ctx->numEdenRequests,
           w_string::pathCat({mountPoint_, item.name}),
           /* position=*/nullptr,
           /*isNew=*/false,
@@ -1171,7 +1572,14 @@ class EdenView final : public QueryableView {
   }
 
   json_ref getWatcherDebugInfo() const override {
-    return json_null();
+    if (!journalCacheEnabled_) {
+      return json_null();
+    }
+    auto cache = journalCache_.rlock();
+    return json_object({
+        {"journal_cache_paths", json_integer(cache->numPaths())},
+        {"journal_cache_end", json_integer(cache->endSequence())},
+    });
   }
 
   void clearWatcherDebugInfo() override {}
@@ -1197,6 +1605,10 @@ class EdenView final : public QueryableView {
         root->cookies.notifyCookie(full);
       }
 
+      if (journalCacheEnabled_) {
+        appendToJournalCache(*journalCache_.wlock(), delta);
+      }
+
       // Remember this position for subsequent calls
       lastCookiePosition_ = *delta.toPosition_ref();
     } catch (const EdenError& err) {
@@ -1213,6 +1625,9 @@ class EdenView final : public QueryableView {
       // cookie sync mechanism will retry if there is sufficient time remaining
       // in their individual retry schedule(s).
       root->cookies.abortAllCookies();
+      if (journalCacheEnabled_) {
+        journalCache_.wlock()->clear();
+      }
     }
   }
 
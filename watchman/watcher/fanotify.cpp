@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#ifdef HAVE_FANOTIFY_REPORT_DFID_NAME
+#include <fcntl.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+
+using namespace watchman;
+
+// Dirent events are only available for filesystem and inode marks; mount
+// marks can't report them.
+#define WATCHMAN_FANOTIFY_MASK                                    \
+  FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO |       \
+      FAN_MODIFY | FAN_ATTRIB | FAN_DELETE_SELF | FAN_MOVE_SELF | \
+      FAN_ONDIR | FAN_EVENT_ON_CHILD
+
+namespace {
+
+// Room for the largest handle that we'll look up
+constexpr size_t kMaxHandleSize = 128;
+
+// Identifies a directory by its filesystem id and file handle, in the form
+// that the kernel reports them with each event.
+std::string makeHandleKey(
+    const __kernel_fsid_t& fsid,
+    const struct file_handle& handle) {
+  std::string key(reinterpret_cast<const char*>(&fsid), sizeof(fsid));
+  key.append(
+      reinterpret_cast<const char*>(&handle.handle_type),
+      sizeof(handle.handle_type));
+  key.append(
+      reinterpret_cast<const char*>(handle.f_handle), handle.handle_bytes);
+  return key;
+}
+
+} // namespace
+
+struct FanotifyWatcher : public Watcher {
+  FileDescriptor fanfd_;
+  Pipe terminatePipe_;
+  // The filesystem id of the watched root, which every key includes
+  __kernel_fsid_t fsid_;
+
+  // Maps the handle of each dir that the crawler has visited to its path.
+  // The mark covers the whole filesystem, so events for dirs that aren't in
+  // this map are outside of the root (or within an ignored dir) and are
+  // dropped.
+  folly::Synchronized<std::unordered_map<std::string, w_string>> dirs_;
+
+  std::vector<char> buf_;
+
+  std::atomic<uint64_t> totalEventsSeen_ = 0;
+  // Events for dirs that we aren't tracking
+  std::atomic<uint64_t> totalEventsDropped_ = 0;
+  std::atomic<uint64_t> totalOverflows_ = 0;
+
+  FanotifyWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  // Process a single event and add it to the pending collection if needed.
+  // Returns true if the root directory was removed and the watch needs to be
+  // cancelled.
+  bool processEvent(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const struct fanotify_event_metadata* event,
+      std::chrono::system_clock::time_point now);
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+};
+
+FanotifyWatcher::FanotifyWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher(
+          "fanotify",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_WATCHES_PATHS) {
+  fanfd_ = FileDescriptor(
+      fanotify_init(
+          FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+          O_RDONLY | O_CLOEXEC | O_LARGEFILE),
+      "fanotify_init",
+      FileDescriptor::FDType::Generic);
+
+  if (fanotify_mark(
+          fanfd_.fd(),
+          FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+          WATCHMAN_FANOTIFY_MASK,
+          AT_FDCWD,
+          rootPath.c_str()) == -1) {
+    // Filesystem marks require CAP_SYS_ADMIN
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        folly::to<std::string>("fanotify_mark ", rootPath));
+  }
+
+  struct statfs sfs;
+  if (statfs(rootPath.c_str(), &sfs) == -1) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        folly::to<std::string>("statfs ", rootPath));
+  }
+  static_assert(sizeof(fsid_) == sizeof(sfs.f_fsid));
+  memcpy(&fsid_, &sfs.f_fsid, sizeof(fsid_));
+
+  {
+    auto wlock = dirs_.wlock();
+    wlock->reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+  }
+
+  buf_.resize(std::max(
+      size_t(config.getInt("fanotify_read_buffer_size", 256 * 1024)),
+      sizeof(struct fanotify_event_metadata) + kMaxHandleSize + NAME_MAX + 1));
+}
+
+std::unique_ptr<DirHandle> FanotifyWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // Carry out our very strict opendir first to ensure that we're not
+  // traversing symlinks in the context of this root
+  auto osdir = openDir(path);
+
+  union {
+    struct file_handle handle;
+    char buf[sizeof(struct file_handle) + kMaxHandleSize];
+  } h;
+  h.handle.handle_bytes = kMaxHandleSize;
+  int mountId;
+  if (name_to_handle_at(
+          osdir->getFd(), "", &h.handle, &mountId, AT_EMPTY_PATH) == -1) {
+    throw std::system_error(
+        errno, std::generic_category(), "name_to_handle_at");
+  }
+
+  // The dir might have been renamed since we last saw it, so always update
+  // the mapping.
+  auto key = makeHandleKey(fsid_, h.handle);
+  {
+    auto wlock = dirs_.wlock();
+    (*wlock)[key] = w_string(path, W_STRING_BYTE);
+  }
+  logf(DBG, "fanotify: tracking dir {}\n", path);
+
+  return osdir;
+}
+
+bool FanotifyWatcher::processEvent(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const struct fanotify_event_metadata* event,
+    std::chrono::system_clock::time_point now) {
+  if (event->mask & FAN_Q_OVERFLOW) {
+    totalOverflows_.fetch_add(1, std::memory_order_relaxed);
+    root->scheduleRecrawl("FAN_Q_OVERFLOW");
+    return false;
+  }
+
+  // With FAN_REPORT_DFID_NAME the event is followed by a record that
+  // identifies the dir that contains the object, and its name within it.
+  // Events on a dir itself, such as FAN_DELETE_SELF, only identify the dir.
+  const struct fanotify_event_info_fid* fid = nullptr;
+  const char* name = nullptr;
+  auto end = reinterpret_cast<const char*>(event) + event->event_len;
+  auto info = reinterpret_cast<const char*>(event) + event->metadata_len;
+  while (info + sizeof(struct fanotify_event_info_header) <= end) {
+    auto hdr = reinterpret_cast<const struct fanotify_event_info_header*>(info);
+    if (hdr->len == 0 || info + hdr->len > end) {
+      break;
+    }
+    if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+        hdr->info_type == FAN_EVENT_INFO_TYPE_DFID) {
+      fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+      if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+        auto handle = reinterpret_cast<const struct file_handle*>(fid->handle);
+        name = reinterpret_cast<const char*>(handle->f_handle) +
+            handle->handle_bytes;
+      }
+      break;
+    }
+    info += hdr->len;
+  }
+  if (!fid) {
+    log(ERR, "fanotify: event with mask ", event->mask, " has no dir fid\n");
+    root->scheduleRecrawl("fanotify event without a dir fid");
+    return false;
+  }
+
+  auto handle = reinterpret_cast<const struct file_handle*>(fid->handle);
+  auto key = makeHandleKey(fid->fsid, *handle);
+  w_string dirName;
+  {
+    auto rlock = dirs_.rlock();
+    auto it = rlock->find(key);
+    if (it != rlock->end()) {
+      dirName = it->second;
+    }
+  }
+  if (!dirName) {
+    totalEventsDropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  logf(
+      DBG,
+      "fanotify: mask={:x} {} {}\n",
+      event->mask,
+      dirName,
+      name ? name : "");
+
+  PendingFlags flags = W_PENDING_VIA_NOTIFY;
+  w_string path;
+  if (event->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+    if (w_string_equal(root->root_path, dirName)) {
+      logf(
+          ERR,
+          "root dir {} has been (re)moved, canceling watch\n",
+          root->root_path);
+      return true;
+    }
+    if (event->mask & FAN_DELETE_SELF) {
+      auto wlock = dirs_.wlock();
+      wlock->erase(key);
+    }
+    // We need to examine the parent and potentially crawl down.  The kernel
+    // merges queued events for the same object, so this also covers any
+    // other bits in the mask.
+    path = dirName.dirName();
+  } else if (name && strcmp(name, ".") != 0) {
+    path = w_string::pathCat({dirName, w_string_piece(name)});
+  } else {
+    path = dirName;
+  }
+
+  if (event->mask & (FAN_CREATE | FAN_DELETE | FAN_MOVED_TO)) {
+    flags.set(W_PENDING_RECURSIVE);
+  }
+  coll.add(path, now, flags);
+  return false;
+}
+
+Watcher::ConsumeNotifyRet FanotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  bool cancel = false;
+  size_t eventsSeen = 0;
+
+  auto n = read(fanfd_.fd(), buf_.data(), buf_.size());
+  if (n == -1) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return {false};
+    }
+    logf(
+        FATAL,
+        "read({}, {}): error {}\n",
+        fanfd_.fd(),
+        buf_.size(),
+        folly::errnoStr(errno));
+  }
+  auto now = std::chrono::system_clock::now();
+
+  auto event = reinterpret_cast<const struct fanotify_event_metadata*>(
+      buf_.data());
+  while (!cancel && FAN_EVENT_OK(event, n)) {
+    if (event->vers != FANOTIFY_METADATA_VERSION) {
+      logf(
+          FATAL,
+          "fanotify metadata version {} doesn't match {}\n",
+          event->vers,
+          FANOTIFY_METADATA_VERSION);
+    }
+    // We're in FID mode, so we're never given an fd that we'd need to close
+    cancel = processEvent(root, coll, event, now);
+    ++eventsSeen;
+    event = FAN_EVENT_NEXT(event, n);
+  }
+
+  totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  return {cancel};
+}
+
+bool FanotifyWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[2];
+  pfd[0].fd = fanfd_.fd();
+  pfd[0].events = POLLIN;
+  pfd[1].fd = terminatePipe_.read.fd();
+  pfd[1].events = POLLIN;
+
+  int n = poll(pfd, std::size(pfd), timeoutms);
+
+  if (n > 0) {
+    if (pfd[1].revents) {
+      // We were signalled via signalThreads
+      return false;
+    }
+    return pfd[0].revents != 0;
+  }
+  return false;
+}
+
+void FanotifyWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref FanotifyWatcher::getDebugInfo() {
+  return json_object({
+      {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"dropped_event_count", json_integer(totalEventsDropped_.load())},
+      {"overflow_count", json_integer(totalOverflows_.load())},
+      {"tracked_dir_count", json_integer(dirs_.rlock()->size())},
+  });
+}
+
+void FanotifyWatcher::clearDebugInfo() {
+  totalEventsSeen_.store(0, std::memory_order_release);
+  totalEventsDropped_.store(0, std::memory_order_release);
+  totalOverflows_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectFanotify(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (is_edenfs_fs_type(fstype)) {
+    throw std::runtime_error("cannot watch EdenFS file systems with fanotify");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<FanotifyWatcher>(root_path, config));
+}
+} // namespace
+
+// Lower priority than inotify, as it requires CAP_SYS_ADMIN; it's only used
+// when requested via the watcher config option.
+static WatcherRegistry reg("fanotify", detectFanotify, -1);
+
+#endif // HAVE_FANOTIFY_REPORT_DFID_NAME
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -8,13 +8,17 @@
 #include "fsevents.h"
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/LogConfig.h"
+#include "watchman/fs/FSDetect.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/WatcherRegistry.h"
@@ -28,6 +32,12 @@ namespace watchman {
 // If that limit is exceeded, it will fail.
 #define MAX_EXCLUSIONS size_t(8)
 
+// kFSEventStreamCreateFlagUseExtendedData was introduced in the 10.13 SDK
+#if defined(MAC_OS_X_VERSION_10_13) && \
+    MAC_OS_X_VERSION_MAX_ALLOWED >= MAC_OS_X_VERSION_10_13
+#define HAVE_FSEVENTS_EXTENDED_DATA 1
+#endif
+
 struct fse_stream {
   FSEventStreamRef stream{nullptr};
   std::shared_ptr<Root> root;
@@ -37,6 +47,8 @@ struct fse_stream {
   bool lost_sync{false};
   bool inject_drop{false};
   bool event_id_wrapped{false};
+  // Whether eventPaths holds extended data dictionaries rather than paths
+  bool extended_data{false};
   CFUUIDRef uuid;
 
   fse_stream(
@@ -116,6 +128,54 @@ static void log_drop_event(const std::shared_ptr<Root>& root, bool isKernel) {
   sample.log();
 }
 
+#ifdef HAVE_FSEVENTS_EXTENDED_DATA
+/**
+ * When the stream was created with kFSEventStreamCreateFlagUseExtendedData,
+ * eventPaths is a CFArray of dictionaries holding the path and inode number
+ * of each item.  Unpack them so that fse_callback can treat both kinds of
+ * stream in the same way.
+ */
+static void unpack_extended_data(
+    CFArrayRef events,
+    std::vector<std::string>& storage,
+    std::vector<const char*>& paths,
+    std::vector<uint64_t>& fileIds) {
+  auto numEvents = CFArrayGetCount(events);
+  storage.resize(numEvents);
+  paths.resize(numEvents);
+  fileIds.resize(numEvents);
+
+  for (CFIndex i = 0; i < numEvents; i++) {
+    auto dict = (CFDictionaryRef)CFArrayGetValueAtIndex(events, i);
+    auto cpath = (CFStringRef)CFDictionaryGetValue(
+        dict, kFSEventStreamEventExtendedDataPathKey);
+    auto fileId = (CFNumberRef)CFDictionaryGetValue(
+        dict, kFSEventStreamEventExtendedFileIDKey);
+
+    if (cpath) {
+      auto& path = storage[i];
+      path.resize(
+          CFStringGetMaximumSizeForEncoding(
+              CFStringGetLength(cpath), kCFStringEncodingUTF8) +
+          1);
+      if (CFStringGetCString(
+              cpath, path.data(), path.size(), kCFStringEncodingUTF8)) {
+        path.resize(strlen(path.c_str()));
+      } else {
+        path.clear();
+      }
+    }
+    paths[i] = storage[i].c_str();
+
+    // Not every event (eg: HistoryDone) refers to an item
+    int64_t ino = 0;
+    if (fileId && CFNumberGetValue(fileId, kCFNumberSInt64Type, &ino)) {
+      fileIds[i] = ino;
+    }
+  }
+}
+#endif
+
 void FSEventsWatcher::fse_callback(
     ConstFSEventStreamRef,
     void* clientCallBackInfo,
@@ -124,14 +184,31 @@ void FSEventsWatcher::fse_callback(
     const FSEventStreamEventFlags eventFlags[],
     const FSEventStreamEventId eventIds[]) {
   size_t i;
-  auto paths = (char**)eventPaths;
+  auto paths = (const char* const*)eventPaths;
   auto stream = (fse_stream*)clientCallBackInfo;
   auto root = stream->root;
   std::vector<watchman_fsevent> items;
+  std::unordered_map<w_string, size_t> itemIndex;
   auto watcher = stream->watcher;
 
+  std::vector<std::string> pathStorage;
+  std::vector<const char*> pathPtrs;
+  std::vector<uint64_t> fileIds;
+#ifdef HAVE_FSEVENTS_EXTENDED_DATA
+  if (stream->extended_data) {
+    unpack_extended_data(
+        (CFArrayRef)eventPaths, pathStorage, pathPtrs, fileIds);
+    paths = pathPtrs.data();
+  }
+#endif
+
   stream->watcher->totalEventsSeen_.fetch_add(
       numEvents, std::memory_order_relaxed);
+  if (numEvents > 0) {
+    // Ids are delivered in increasing order
+    stream->watcher->lastEventId_.store(
+        eventIds[numEvents - 1], std::memory_order_relaxed);
+  }
   if (stream->watcher->ringBuffer_) {
     for (i = 0; i < numEvents; i++) {
       uint32_t flags = eventFlags[i];
@@ -145,6 +222,7 @@ void FSEventsWatcher::fse_callback(
     if (stream->inject_drop) {
       stream->lost_sync = true;
       log_drop_event(root, false);
+      watcher->userDrops_.fetch_add(1, std::memory_order_relaxed);
       goto do_resync;
     }
 
@@ -160,8 +238,10 @@ void FSEventsWatcher::fse_callback(
         // set up a whole new state for the recrawled instance.
         stream->lost_sync = true;
 
-        log_drop_event(
-            root, eventFlags[i] & kFSEventStreamEventFlagKernelDropped);
+        bool isKernel = eventFlags[i] & kFSEventStreamEventFlagKernelDropped;
+        log_drop_event(root, isKernel);
+        (isKernel ? watcher->kernelDrops_ : watcher->userDrops_)
+            .fetch_add(1, std::memory_order_relaxed);
 
         if (watcher->attemptResyncOnDrop_) {
         // fseventsd has a reliable journal so we can attempt to resync.
@@ -213,6 +293,7 @@ void FSEventsWatcher::fse_callback(
 
             // mark the replacement as the winner
             watcher->stream_ = replacement;
+            watcher->resyncs_.fetch_add(1, std::memory_order_relaxed);
 
             // And tear ourselves down
             delete stream;
@@ -256,7 +337,7 @@ propagate:
     }
 
     uint32_t len = strlen(path);
-    while (path[len - 1] == '/') {
+    while (len > 0 && path[len - 1] == '/') {
       len--;
     }
 
@@ -264,7 +345,21 @@ propagate:
       continue;
     }
 
-    items.emplace_back(w_string(path, len), eventFlags[i]);
+    // A single save from an editor can produce several events for the same
+    // file within a batch.  Fold them into one item so that the consumer
+    // only examines the file once.
+    uint64_t fileId = i < fileIds.size() ? fileIds[i] : 0;
+    auto [it, inserted] =
+        itemIndex.emplace(w_string(path, len), items.size());
+    if (inserted) {
+      items.emplace_back(w_string{it->first}, eventFlags[i], fileId);
+    } else {
+      auto& item = items[it->second];
+      item.flags |= eventFlags[i];
+      if (fileId) {
+        item.fileId = fileId;
+      }
+    }
     if (!stream->lost_sync) {
       stream->last_good = eventIds[i];
     }
@@ -338,8 +433,8 @@ fse_stream* FSEventsWatcher::fse_stream_make(
           "fsevents journal is not available for dev_t=", st.st_dev, "\n");
       goto fail;
     }
-    // Compare the UUID with that of the current stream
-    if (!watcher->stream_->uuid) {
+    // Compare the UUID with that of the current stream, if there is one
+    if (watcher->stream_ && !watcher->stream_->uuid) {
       failure_reason = w_string(
           "fsevents journal was not available for prior stream",
           W_STRING_UNICODE);
@@ -347,7 +442,7 @@ fse_stream* FSEventsWatcher::fse_stream_make(
     }
 
     a = CFUUIDGetUUIDBytes(fse_stream->uuid);
-    b = CFUUIDGetUUIDBytes(watcher->stream_->uuid);
+    b = watcher->stream_ ? CFUUIDGetUUIDBytes(watcher->stream_->uuid) : a;
 
     if (memcmp(&a, &b, sizeof(a)) != 0) {
       failure_reason =
@@ -364,36 +459,48 @@ fse_stream* FSEventsWatcher::fse_stream_make(
     goto fail;
   }
 
-  if (auto subdir = watcher->subdir) {
-    path = *subdir;
-  } else {
-    path = root->root_path;
-  }
+  // A single stream can serve several dirs; events name the full path of
+  // the item, so they don't need to be told apart here.
+  for (size_t i = 0; i < std::max(watcher->subdirs_.size(), size_t(1)); ++i) {
+    path = watcher->subdirs_.empty() ? root->root_path : watcher->subdirs_[i];
+
+    cpath = CFStringCreateWithBytes(
+        nullptr,
+        (const UInt8*)path.data(),
+        path.size(),
+        kCFStringEncodingUTF8,
+        false);
+    if (!cpath) {
+      failure_reason =
+          w_string("CFStringCreateWithBytes failed", W_STRING_UNICODE);
+      goto fail;
+    }
 
-  cpath = CFStringCreateWithBytes(
-      nullptr,
-      (const UInt8*)path.data(),
-      path.size(),
-      kCFStringEncodingUTF8,
-      false);
-  if (!cpath) {
-    failure_reason =
-        w_string("CFStringCreateWithBytes failed", W_STRING_UNICODE);
-    goto fail;
+    CFArrayAppendValue(parray, cpath);
+    CFRelease(cpath);
+    cpath = nullptr;
   }
 
-  CFArrayAppendValue(parray, cpath);
-
   latency = root->config.getDouble("fsevents_latency", 0.01),
   logf(
       DBG,
-      "FSEventStreamCreate for path {} with latency {} seconds\n",
+      "FSEventStreamCreate for path {} ({} paths) with latency {} seconds\n",
       path,
+      CFArrayGetCount(parray),
       latency);
 
   flags = kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagWatchRoot;
   if (watcher->hasFileWatching_) {
     flags |= kFSEventStreamCreateFlagFileEvents;
+#ifdef HAVE_FSEVENTS_EXTENDED_DATA
+    if (watcher->useExtendedData_) {
+      if (__builtin_available(macOS 10.13, *)) {
+        flags |= kFSEventStreamCreateFlagUseCFTypes |
+            kFSEventStreamCreateFlagUseExtendedData;
+        fse_stream->extended_data = true;
+      }
+    }
+#endif
   }
   fse_stream->stream = FSEventStreamCreate(
       nullptr, fse_callback, &ctx, parray, since, latency, flags);
@@ -421,8 +528,14 @@ fse_stream* FSEventsWatcher::fse_stream_make(
     }
 
     for (const auto& path : dirs_vec) {
-      if (const auto& subdir = watcher->subdir) {
-        if (!w_string_startswith(path, *subdir)) {
+      if (!watcher->subdirs_.empty()) {
+        auto subdir = std::find_if(
+            watcher->subdirs_.begin(),
+            watcher->subdirs_.end(),
+            [&](const w_string& dir) {
+              return w_string_startswith(path, dir);
+            });
+        if (subdir == watcher->subdirs_.end()) {
           continue;
         }
         logf(DBG, "Adding exclusion: {} for subdir: {}\n", path, *subdir);
@@ -511,8 +624,23 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
       CFRelease(fdsrc);
     }
 
-    stream_ = fse_stream_make(
-        root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+    if (startSince_ != kFSEventStreamEventIdSinceNow) {
+      w_string reason;
+      stream_ = fse_stream_make(root, this, startSince_, reason);
+      if (!stream_) {
+        logf(
+            ERR,
+            "Can't replay fsevents since event {} ({}), only reporting "
+            "later changes\n",
+            startSince_,
+            reason);
+        missedHistory_ = true;
+      }
+    }
+    if (!stream_) {
+      stream_ = fse_stream_make(
+          root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+    }
     if (!stream_) {
       goto done;
     }
@@ -548,15 +676,23 @@ done:
 FSEventsWatcher::FSEventsWatcher(
     bool hasFileWatching,
     const Configuration& config,
-    std::optional<w_string> dir)
+    std::vector<w_string> dirs,
+    FSEventStreamEventId since)
     : Watcher(
           hasFileWatching ? "fsevents" : "dirfsevents",
           hasFileWatching
-              ? (WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_COALESCED_RENAME)
-              : 0),
+              ? (WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_COALESCED_RENAME |
+                 WATCHER_WATCHES_PATHS)
+              : WATCHER_WATCHES_PATHS),
       hasFileWatching_{hasFileWatching},
       enableStreamFlush_{config.getBool("fsevents_enable_stream_flush", true)},
-      subdir{std::move(dir)} {
+      syncWithoutCookies_{
+          config.getBool("fsevents_sync_without_cookies", false)},
+      useExtendedData_{config.getBool("fsevents_use_extended_data", false)},
+      skipUnchangedOnRescan_{
+          config.getBool("recrawl_skip_unchanged_dirs", false)},
+      subdirs_{std::move(dirs)},
+      startSince_{since} {
   // TODO: Add ring buffer logging for events in the shared kqueue+fsevents
   // logger.
 }
@@ -564,11 +700,11 @@ FSEventsWatcher::FSEventsWatcher(
 FSEventsWatcher::FSEventsWatcher(
     const w_string& /*root_path*/,
     const Configuration& config,
-    std::optional<w_string> dir)
+    std::vector<w_string> dirs)
     : FSEventsWatcher(
           config.getBool("fsevents_watch_files", true),
           config,
-          dir) {
+          std::move(dirs)) {
   json_int_t fsevents_ring_log_size =
       config.getInt("fsevents_ring_log_size", 0);
   if (fsevents_ring_log_size) {
@@ -592,7 +728,7 @@ bool FSEventsWatcher::start(const std::shared_ptr<Root>& root) {
         self->FSEventsThread(root);
       } catch (const std::exception& e) {
         watchman::log(watchman::ERR, "uncaught exception: ", e.what());
-        if (!self->subdir) {
+        if (self->subdirs_.empty()) {
           root->cancel();
         }
       }
@@ -672,6 +808,36 @@ folly::SemiFuture<folly::Unit> FSEventsWatcher::flushPendingEvents() {
   return std::move(f);
 }
 
+folly::SemiFuture<folly::Unit> FSEventsWatcher::syncToSequencePosition() {
+  if (!syncWithoutCookies_) {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
+
+  /*
+   * fseventsd assigns event ids in the order in which it reads changes from
+   * /dev/fsevents, so every change that has an id no greater than the current
+   * one is already queued inside FSEvents, and FSEventStreamFlushSync
+   * delivers those that are relevant to our stream before it returns.
+   *
+   * This is weaker than a cookie: a change that the kernel has recorded but
+   * fseventsd has not yet read is not covered.  That window is why this mode
+   * is opt-in; see the comment in flushPendingEvents.
+   */
+  auto position = FSEventsGetCurrentEventId();
+  FSEventStreamFlushSync(stream_->stream);
+  logf(
+      DBG,
+      "fsevents: sync through event id {}, last delivered {}\n",
+      position,
+      lastEventId_.load(std::memory_order_relaxed));
+
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  auto wlock = items_.lock();
+  wlock->syncs.push_back(std::move(p));
+  fseCond_.notify_one();
+  return std::move(f);
+}
+
 bool FSEventsWatcher::waitNotify(int timeoutms) {
   auto wlock = items_.lock();
   // First check to see if someone added elements to these lists while the lock
@@ -680,21 +846,20 @@ bool FSEventsWatcher::waitNotify(int timeoutms) {
     // Yes, let's not wait on the condition.
     return true;
   }
+  if (wlock->stopped) {
+    return false;
+  }
   fseCond_.wait_for(wlock.as_lock(), std::chrono::milliseconds(timeoutms));
   return !wlock->items.empty() || !wlock->syncs.empty();
 }
 
-namespace {
-bool isRootRemoved(
-    const w_string& path,
-    const w_string& root_path,
-    const std::optional<w_string>& subdir) {
-  if (subdir) {
-    return path == *subdir;
-  }
-  return path == root_path;
+bool FSEventsWatcher::isStopped() {
+  return items_.lock()->stopped;
+}
+
+std::vector<w_string> FSEventsWatcher::takeRemovedDirs() {
+  return std::exchange(newlyRemovedDirs_, {});
 }
-} // namespace
 
 Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
@@ -717,22 +882,27 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
       w_expand_flags(kflags, item.flags, flags_label, sizeof(flags_label));
       logf(
           DBG,
-          "fsevents: got {} {:x} {}\n",
+          "fsevents: got {} {:x} {} ino={}\n",
           item.path,
           item.flags,
-          flags_label);
+          flags_label,
+          item.fileId);
 
       if (item.flags &
           (kFSEventStreamEventFlagUserDropped |
            kFSEventStreamEventFlagKernelDropped)) {
-        if (!subdir) {
+        if (subdirs_.empty()) {
+          // The path of a dropped event is the dir that the stream watches,
+          // which here is the whole root
+          fullRecrawls_.fetch_add(1, std::memory_order_relaxed);
           root->scheduleRecrawl(flags_label);
           break;
         } else {
           w_assert(
               item.flags & kFSEventStreamEventFlagMustScanSubDirs,
               "dropped events should specify kFSEventStreamEventFlagMustScanSubDirs");
-          auto reason = fmt::format("{}: {}", *subdir, flags_label);
+          desyncedRescans_.fetch_add(1, std::memory_order_relaxed);
+          auto reason = fmt::format("{}: {}", item.path, flags_label);
           root->recrawlTriggered(reason.c_str());
         }
       }
@@ -746,8 +916,27 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
         break;
       }
 
-      if ((item.flags & kFSEventStreamEventFlagItemRemoved) &&
-          isRootRemoved(item.path, root->root_path, subdir)) {
+      bool isWatchedDir = subdirs_.empty()
+          ? item.path == root->root_path
+          : std::find(subdirs_.begin(), subdirs_.end(), item.path) !=
+              subdirs_.end();
+      if (isWatchedDir && subdirs_.size() > 1 &&
+          (item.flags &
+           (kFSEventStreamEventFlagItemRemoved |
+            kFSEventStreamEventFlagRootChanged))) {
+        // Only that dir is gone; the others that share the stream are fine
+        if (removedDirs_.insert(item.path).second) {
+          logf(ERR, "Watched directory {} removed\n", item.path);
+          newlyRemovedDirs_.push_back(item.path);
+        }
+        if (removedDirs_.size() == subdirs_.size()) {
+          cancelSelf = true;
+          break;
+        }
+        continue;
+      }
+
+      if ((item.flags & kFSEventStreamEventFlagItemRemoved) && isWatchedDir) {
         log(ERR, "Root directory removed, cancel watch\n");
         cancelSelf = true;
         break;
@@ -784,6 +973,16 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
           (kFSEventStreamEventFlagUserDropped |
            kFSEventStreamEventFlagKernelDropped)) {
         flags.set(W_PENDING_IS_DESYNCED);
+      } else if (item.flags & kFSEventStreamEventFlagMustScanSubDirs) {
+        // The events beneath the dir were coalesced rather than lost, so we
+        // still know of everything that happened up to it.  Rescan only that
+        // subtree, and where dir mtimes are reliable, only read the dirs in it
+        // that changed, as a recrawl with recrawl_skip_unchanged_dirs does.
+        scopedRescans_.fetch_add(1, std::memory_order_relaxed);
+        if (skipUnchangedOnRescan_ &&
+            is_dir_mtime_reliable_fs_type(root->fs_type)) {
+          flags.set(W_PENDING_SKIP_UNCHANGED);
+        }
       }
 
       coll.add(item.path, now, flags);
@@ -799,6 +998,11 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
 
 void FSEventsWatcher::stopThreads() {
   write(fsePipe_.write.fd(), "X", 1);
+  {
+    auto wlock = items_.lock();
+    wlock->stopped = true;
+    fseCond_.notify_one();
+  }
 }
 
 std::unique_ptr<DirHandle> FSEventsWatcher::startWatchDir(
@@ -819,6 +1023,16 @@ json_ref FSEventsWatcher::getDebugInfo() {
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"last_event_id", json_integer(lastEventId_.load())},
+      {"fallbacks",
+       json_object({
+           {"scoped_rescans", json_integer(scopedRescans_.load())},
+           {"user_dropped", json_integer(userDrops_.load())},
+           {"kernel_dropped", json_integer(kernelDrops_.load())},
+           {"resyncs", json_integer(resyncs_.load())},
+           {"desynced_rescans", json_integer(desyncedRescans_.load())},
+           {"full_recrawls", json_integer(fullRecrawls_.load())},
+       })},
   });
 }
 
@@ -827,6 +1041,15 @@ void FSEventsWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  for (auto* counter :
+       {&scopedRescans_,
+        &userDrops_,
+        &kernelDrops_,
+        &resyncs_,
+        &desyncedRescans_,
+        &fullRecrawls_}) {
+    counter->store(0, std::memory_order_relaxed);
+  }
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
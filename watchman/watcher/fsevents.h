@@ -7,7 +7,8 @@
 
 #pragma once
 
-#include <optional>
+#include <unordered_set>
+#include <vector>
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/watcher/Watcher.h"
@@ -25,27 +26,39 @@ struct FSEventsLogEntry;
 struct watchman_fsevent {
   w_string path;
   FSEventStreamEventFlags flags;
-
-  watchman_fsevent(w_string&& path, FSEventStreamEventFlags flags)
-      : path(std::move(path)), flags(flags) {}
+  // The inode number of the item, when the stream reports extended data
+  uint64_t fileId{0};
+
+  watchman_fsevent(
+      w_string&& path,
+      FSEventStreamEventFlags flags,
+      uint64_t fileId = 0)
+      : path(std::move(path)), flags(flags), fileId(fileId) {}
 };
 
 class FSEventsWatcher : public Watcher {
  public:
+  /**
+   * Watches the given dirs with one stream, or the whole root if there are
+   * none.  If since is not kFSEventStreamEventIdSinceNow, the stream first
+   * replays the events that the journal recorded for them after since.
+   */
   explicit FSEventsWatcher(
       bool hasFileWatching,
       const Configuration& config,
-      std::optional<w_string> dir = std::nullopt);
+      std::vector<w_string> dirs = {},
+      FSEventStreamEventId since = kFSEventStreamEventIdSinceNow);
 
   explicit FSEventsWatcher(
       const w_string& root_path,
       const Configuration& config,
-      std::optional<w_string> dir = std::nullopt);
+      std::vector<w_string> dirs = {});
   ~FSEventsWatcher();
 
   bool start(const std::shared_ptr<Root>& root) override;
 
   folly::SemiFuture<folly::Unit> flushPendingEvents() override;
+  folly::SemiFuture<folly::Unit> syncToSequencePosition() override;
 
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
@@ -60,6 +73,25 @@ class FSEventsWatcher : public Watcher {
   void stopThreads() override;
   void FSEventsThread(const std::shared_ptr<Root>& root);
 
+  /** Whether stopThreads has been called. */
+  bool isStopped();
+
+  /**
+   * Whether the journal could not replay the events since the time that
+   * was passed to the constructor, so that the stream only reports the
+   * changes made after it started.
+   */
+  bool missedHistory() const {
+    return missedHistory_;
+  }
+
+  /**
+   * Returns the watched dirs that have been removed or replaced since the
+   * last call.  The stream keeps watching the others; consumeNotify only
+   * asks for it to be cancelled once none are left.
+   */
+  std::vector<w_string> takeRemovedDirs();
+
   json_ref getDebugInfo() override;
   void clearDebugInfo() override;
 
@@ -91,6 +123,7 @@ class FSEventsWatcher : public Watcher {
     std::vector<std::vector<watchman_fsevent>> items;
     // Sync requests to be inserted into PendingCollection.
     std::vector<folly::Promise<folly::Unit>> syncs;
+    bool stopped{false};
   };
   folly::Synchronized<Items, std::mutex> items_;
 
@@ -98,10 +131,33 @@ class FSEventsWatcher : public Watcher {
   bool attemptResyncOnDrop_{false};
   const bool hasFileWatching_{false};
   const bool enableStreamFlush_{true};
-  std::optional<w_string> subdir{std::nullopt};
+  const bool syncWithoutCookies_{false};
+  // Whether the stream reports the inode number of each item alongside its
+  // path.  Only honored when hasFileWatching_ is set.
+  const bool useExtendedData_{false};
+  // Whether the rescans that kFSEventStreamEventFlagMustScanSubDirs asks for
+  // may skip the dirs whose mtime is unchanged
+  const bool skipUnchangedOnRescan_{false};
+  // The dirs watched by the stream, or empty if it watches the whole root
+  const std::vector<w_string> subdirs_;
+  const FSEventStreamEventId startSince_{kFSEventStreamEventIdSinceNow};
+  bool missedHistory_{false};
+  // Only accessed by consumeNotify and takeRemovedDirs
+  std::unordered_set<w_string> removedDirs_;
+  std::vector<w_string> newlyRemovedDirs_;
 
   // Incremented in fse_callback
   std::atomic<size_t> totalEventsSeen_{0};
+  // The id of the most recent event delivered to fse_callback
+  std::atomic<FSEventStreamEventId> lastEventId_{0};
+  // How often each of the fallbacks for the events that FSEvents couldn't
+  // deliver one by one happened, as reported by getDebugInfo
+  std::atomic<uint64_t> scopedRescans_{0};
+  std::atomic<uint64_t> userDrops_{0};
+  std::atomic<uint64_t> kernelDrops_{0};
+  std::atomic<uint64_t> resyncs_{0};
+  std::atomic<uint64_t> desyncedRescans_{0};
+  std::atomic<uint64_t> fullRecrawls_{0};
   /**
    * If not null, holds a fixed-size ring of the last `fsevents_ring_log_size`
    * FSEvents events.
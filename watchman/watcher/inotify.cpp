@@ -7,7 +7,11 @@
 
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "watchman/Constants.h"
 #include "watchman/Errors.h"
 #include "watchman/FlagMap.h"
@@ -16,8 +20,10 @@
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/root/Root.h"
+#include "watchman/watcher/InotifyEventCoalescer.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -119,13 +125,82 @@ struct InotifyLogEntry {
 };
 static_assert(64 == sizeof(InotifyLogEntry));
 
+// The space needed to read a single event with the longest possible name
+constexpr size_t kMaxEventSize = sizeof(struct inotify_event) + NAME_MAX + 1;
+
 } // namespace
 
+struct InotifyWatcher;
+
+/**
+ * The daemon-wide inotify instance used by the roots that set
+ * inotify_shared_instance, in place of one instance per root.  A single
+ * thread drains it, so the kernel queue is kept short however many roots
+ * there are, and routes each event by its watch descriptor to the queues of
+ * the watchers that own that watch.  Nested roots can both watch a dir,
+ * which inotify reports as a single watch descriptor.
+ */
+class InotifyMultiplexer {
+ public:
+  // The shared instance, created when the first watcher needs it and closed
+  // once the last watcher lets go of it
+  static std::shared_ptr<InotifyMultiplexer> get();
+
+  InotifyMultiplexer();
+  ~InotifyMultiplexer();
+
+  InotifyMultiplexer(const InotifyMultiplexer&) = delete;
+  InotifyMultiplexer& operator=(const InotifyMultiplexer&) = delete;
+
+  // Overflows are reported to every attached watcher
+  void attach(InotifyWatcher* watcher);
+
+  // Forgets the watcher and removes the watches that only it owned
+  void detach(InotifyWatcher* watcher);
+
+  // Returns the watch descriptor, or -1 with errno set
+  int addWatch(InotifyWatcher* watcher, const char* path);
+
+ private:
+  void drain();
+
+  FileDescriptor infd_;
+  Pipe terminatePipe_;
+  std::vector<char> buf_;
+
+  struct Owners {
+    std::unordered_map<int, std::vector<InotifyWatcher*>> byWd;
+    std::vector<InotifyWatcher*> all;
+  };
+  folly::Synchronized<Owners> owners_;
+
+  // Only used by drain; kept here to reuse the allocations
+  std::unordered_map<InotifyWatcher*, std::vector<char>> batches_;
+
+  std::thread thread_;
+};
+
 struct InotifyWatcher : public Watcher {
-  /* we use one inotify instance per watched root dir */
+  /* we use one inotify instance per watched root dir, unless mux_ is set */
   FileDescriptor infd;
   Pipe terminatePipe_;
 
+  // Set if this watcher shares the daemon-wide inotify instance.  Its
+  // events are then queued in sharedQueue_, and infd isn't opened.
+  std::shared_ptr<InotifyMultiplexer> mux_;
+  struct SharedQueue {
+    std::vector<char> events;
+    // Set when events were dropped because more than maxQueuedBytes_ of
+    // them were waiting; consumeNotify reports this as an IN_Q_OVERFLOW.
+    bool overflowed{false};
+  };
+  folly::Synchronized<SharedQueue, std::mutex> sharedQueue_;
+  size_t maxQueuedBytes_{0};
+  // Written to when sharedQueue_ stops being empty, to wake waitNotify
+  std::unique_ptr<Pipe> queuePipe_;
+  // The events that consumeNotify took from sharedQueue_
+  std::vector<char> sharedBuf_;
+
   /**
    * If not null, holds a fixed-size ring of the last `inotify_ring_log_size`
    * inotify events.
@@ -136,6 +211,14 @@ struct InotifyWatcher : public Watcher {
    * Published from consumeNotify so getDebugInfo can read a recent value.
    */
   std::atomic<uint64_t> totalEventsSeen_ = 0;
+  // Number of consumeNotify calls that read at least one event
+  std::atomic<uint64_t> totalBatches_ = 0;
+  // Number of read() calls across all batches
+  std::atomic<uint64_t> totalReads_ = 0;
+  // Events that were folded into an earlier event for the same path in the
+  // same batch
+  std::atomic<uint64_t> totalCoalescedEvents_ = 0;
+  std::atomic<uint64_t> maxEventsPerBatch_ = 0;
 
   struct maps {
     /* map of active watch descriptor to name of the corresponding dir */
@@ -146,12 +229,41 @@ struct InotifyWatcher : public Watcher {
 
   folly::Synchronized<maps> maps;
 
-  // Make the buffer big enough for 16k entries, which
+  // By default the buffer is big enough for 16k entries, which
   // happens to be the default fs.inotify.max_queued_events
-  char ibuf
-      [WATCHMAN_BATCH_LIMIT * (sizeof(struct inotify_event) + (NAME_MAX + 1))];
+  std::vector<char> ibuf_;
+
+  // How many times consumeNotify may read from infd before returning, if
+  // more events are immediately available.
+  size_t maxReadsPerBatch_{1};
+
+  // Only used by consumeNotify; kept here to reuse its allocation.
+  InotifyEventCoalescer coalescer_;
+
+  // When the last read from infd returned.  Any events dropped by a later
+  // IN_Q_OVERFLOW happened after this.
+  std::chrono::system_clock::time_point lastReadTime_ =
+      std::chrono::system_clock::now();
+
+  // If set, an IN_Q_OVERFLOW only rescans the dirs that changed since
+  // lastReadTime_, unless there are more than overflowMaxRescanDirs_ of them.
+  bool scopedOverflowRecovery_{false};
+  size_t overflowMaxRescanDirs_{0};
+  std::atomic<uint64_t> totalScopedRecoveries_ = 0;
+  std::atomic<uint64_t> totalOverflowRecrawls_ = 0;
+  std::atomic<uint64_t> totalOverflowRescannedDirs_ = 0;
 
   explicit InotifyWatcher(const Configuration& config);
+  ~InotifyWatcher() override;
+
+  // Called by the multiplexer with a run of whole events for this watcher
+  void queueEvents(const char* data, size_t size);
+
+  // Moves the queued events into sharedBuf_
+  void takeQueuedEvents();
+
+  // Returns the new watch descriptor, or -1 with errno set
+  int addWatch(const char* path);
 
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
@@ -173,35 +285,280 @@ struct InotifyWatcher : public Watcher {
       struct inotify_event* ine,
       std::chrono::system_clock::time_point now);
 
+  // Returns true if more events can be read from infd without blocking.
+  bool moreEventsAvailable();
+
+  // Queues a rescan of every watched dir whose mtime or ctime shows that it
+  // may have changed since lastReadTime_.  Returns false, having queued
+  // nothing, if a full recrawl is needed instead.
+  bool recoverFromOverflow(
+      PendingChanges& coll,
+      std::chrono::system_clock::time_point now);
+
   void stopThreads() override;
 
   json_ref getDebugInfo() override;
   void clearDebugInfo() override;
 };
 
-InotifyWatcher::InotifyWatcher(const Configuration& config)
-    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+namespace {
+
+FileDescriptor openInotify() {
 #ifdef HAVE_INOTIFY_INIT1
-  infd = FileDescriptor(
-      inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
+  FileDescriptor fd(inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
 #else
-  infd = FileDescriptor(inotify_init(), FileDescriptor::FDType::Generic);
+  FileDescriptor fd(inotify_init(), FileDescriptor::FDType::Generic);
 #endif
-  if (infd.fd() == -1) {
+  if (fd.fd() == -1) {
     throw std::system_error(errno, inotify_category(), "inotify_init");
   }
-  infd.setCloExec();
+  fd.setCloExec();
+  return fd;
+}
+
+} // namespace
+
+std::shared_ptr<InotifyMultiplexer> InotifyMultiplexer::get() {
+  static folly::Synchronized<std::weak_ptr<InotifyMultiplexer>, std::mutex>
+      instance;
+  auto locked = instance.lock();
+  auto mux = locked->lock();
+  if (!mux) {
+    mux = std::make_shared<InotifyMultiplexer>();
+    *locked = mux;
+  }
+  return mux;
+}
+
+InotifyMultiplexer::InotifyMultiplexer()
+    : infd_{openInotify()}, buf_(WATCHMAN_BATCH_LIMIT * kMaxEventSize) {
+  thread_ = std::thread([this] {
+    w_set_thread_name("inotify");
+    drain();
+  });
+}
+
+InotifyMultiplexer::~InotifyMultiplexer() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+  thread_.join();
+}
+
+void InotifyMultiplexer::attach(InotifyWatcher* watcher) {
+  owners_.wlock()->all.push_back(watcher);
+}
+
+void InotifyMultiplexer::detach(InotifyWatcher* watcher) {
+  auto owners = owners_.wlock();
+  auto& all = owners->all;
+  all.erase(std::remove(all.begin(), all.end(), watcher), all.end());
+
+  auto it = owners->byWd.begin();
+  while (it != owners->byWd.end()) {
+    auto& list = it->second;
+    list.erase(std::remove(list.begin(), list.end(), watcher), list.end());
+    if (list.empty()) {
+      inotify_rm_watch(infd_.fd(), it->first);
+      it = owners->byWd.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int InotifyMultiplexer::addWatch(InotifyWatcher* watcher, const char* path) {
+  // Held across inotify_add_watch so that drain can't route an event for
+  // the new watch before its owner is known
+  auto owners = owners_.wlock();
+  int wd = inotify_add_watch(infd_.fd(), path, WATCHMAN_INOTIFY_MASK);
+  if (wd == -1) {
+    return -1;
+  }
+  auto& list = owners->byWd[wd];
+  if (std::find(list.begin(), list.end(), watcher) == list.end()) {
+    list.push_back(watcher);
+  }
+  return wd;
+}
+
+void InotifyMultiplexer::drain() {
+  while (true) {
+    struct pollfd pfd[2];
+    pfd[0].fd = infd_.fd();
+    pfd[0].events = POLLIN;
+    pfd[1].fd = terminatePipe_.read.fd();
+    pfd[1].events = POLLIN;
+    if (poll(pfd, std::size(pfd), -1) <= 0) {
+      continue;
+    }
+    if (pfd[1].revents) {
+      return;
+    }
+
+    int n = read(infd_.fd(), buf_.data(), buf_.size());
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      logf(
+          FATAL,
+          "read({}, {}): error {}\n",
+          infd_.fd(),
+          buf_.size(),
+          folly::errnoStr(errno));
+    }
+
+    std::vector<int> ignored;
+    {
+      // The watchers can't detach while this is held, so they outlive the
+      // delivery of their events
+      auto owners = owners_.rlock();
+      struct inotify_event* ine;
+      char* ibuf = buf_.data();
+      for (char* iptr = ibuf; iptr < ibuf + n;
+           iptr += sizeof(*ine) + ine->len) {
+        ine = (struct inotify_event*)iptr;
+        auto append = [&](InotifyWatcher* watcher) {
+          auto& batch = batches_[watcher];
+          batch.insert(batch.end(), iptr, iptr + sizeof(*ine) + ine->len);
+        };
+
+        if (ine->wd == -1) {
+          // IN_Q_OVERFLOW: every root may have missed something
+          for (auto watcher : owners->all) {
+            append(watcher);
+          }
+          continue;
+        }
+        auto it = owners->byWd.find(ine->wd);
+        if (it == owners->byWd.end()) {
+          // Its owners have all detached
+          continue;
+        }
+        for (auto watcher : it->second) {
+          append(watcher);
+        }
+        if (ine->mask & IN_IGNORED) {
+          ignored.push_back(ine->wd);
+        }
+      }
+
+      for (auto& [watcher, batch] : batches_) {
+        if (!batch.empty()) {
+          watcher->queueEvents(batch.data(), batch.size());
+          batch.clear();
+        }
+      }
+    }
+    // Drop the batches of watchers that may since have detached
+    batches_.clear();
+
+    if (!ignored.empty()) {
+      // The kernel removed these watches
+      auto owners = owners_.wlock();
+      for (auto wd : ignored) {
+        owners->byWd.erase(wd);
+      }
+    }
+  }
+}
 
+InotifyWatcher::InotifyWatcher(const Configuration& config)
+    : Watcher(
+          "inotify",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_WATCHES_PATHS) {
   {
     auto wlock = maps.wlock();
     wlock->wd_to_name.reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
   }
 
+  auto bufferSize = std::max(
+      size_t(config.getInt(
+          "inotify_read_buffer_size", WATCHMAN_BATCH_LIMIT * kMaxEventSize)),
+      kMaxEventSize);
+  if (config.getBool("inotify_shared_instance", false)) {
+    // Events wait in sharedQueue_ rather than in the kernel, and are
+    // bounded the same way.
+    maxQueuedBytes_ = bufferSize;
+    queuePipe_ = std::make_unique<Pipe>();
+    mux_ = InotifyMultiplexer::get();
+  } else {
+    infd = openInotify();
+    ibuf_.resize(bufferSize);
+  }
+  maxReadsPerBatch_ = std::max(
+      json_int_t(1), config.getInt("inotify_max_reads_per_batch", 1));
+
+  scopedOverflowRecovery_ =
+      config.getBool("inotify_overflow_scoped_recovery", false);
+  overflowMaxRescanDirs_ = size_t(
+      config.getInt("inotify_overflow_max_rescan_dirs", 16 * 1024));
+
   json_int_t inotify_ring_log_size = config.getInt("inotify_ring_log_size", 0);
   if (inotify_ring_log_size) {
     ringBuffer_ =
         std::make_unique<RingBuffer<InotifyLogEntry>>(inotify_ring_log_size);
   }
+
+  if (mux_) {
+    mux_->attach(this);
+  }
+}
+
+InotifyWatcher::~InotifyWatcher() {
+  if (mux_) {
+    mux_->detach(this);
+  }
+}
+
+void InotifyWatcher::queueEvents(const char* data, size_t size) {
+  bool wake;
+  {
+    auto queue = sharedQueue_.lock();
+    if (queue->overflowed) {
+      // Recovering from the overflow will pick these up
+      return;
+    }
+    wake = queue->events.empty();
+    if (queue->events.size() + size > maxQueuedBytes_) {
+      logf(
+          ERR,
+          "inotify: more than {} bytes of events are waiting, dropping them\n",
+          maxQueuedBytes_);
+      queue->events.clear();
+      queue->overflowed = true;
+    } else {
+      queue->events.insert(queue->events.end(), data, data + size);
+    }
+  }
+  if (wake) {
+    ignore_result(write(queuePipe_->write.fd(), "X", 1));
+  }
+}
+
+void InotifyWatcher::takeQueuedEvents() {
+  char drain[64];
+  while (read(queuePipe_->read.fd(), drain, sizeof(drain)) > 0) {
+  }
+
+  sharedBuf_.clear();
+  auto queue = sharedQueue_.lock();
+  if (queue->overflowed) {
+    queue->overflowed = false;
+    struct inotify_event overflow {};
+    overflow.wd = -1;
+    overflow.mask = IN_Q_OVERFLOW;
+    auto bytes = reinterpret_cast<const char*>(&overflow);
+    sharedBuf_.assign(bytes, bytes + sizeof(overflow));
+  } else {
+    std::swap(sharedBuf_, queue->events);
+  }
+}
+
+int InotifyWatcher::addWatch(const char* path) {
+  if (mux_) {
+    return mux_->addWatch(this, path);
+  }
+  return inotify_add_watch(infd.fd(), path, WATCHMAN_INOTIFY_MASK);
 }
 
 std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
@@ -216,7 +573,7 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
 
   // The directory might be different since the last time we looked at it, so
   // call inotify_add_watch unconditionally.
-  int newwd = inotify_add_watch(infd.fd(), path, WATCHMAN_INOTIFY_MASK);
+  int newwd = addWatch(path);
   if (newwd == -1) {
     int err = errno;
     throw std::system_error(err, inotify_category(), "inotify_add_watch");
@@ -252,9 +609,19 @@ bool InotifyWatcher::process_inotify_event(
     ringBuffer_->write(InotifyLogEntry{ine});
   }
 
+  if (coalescer_.coalesce(ine)) {
+    totalCoalescedEvents_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
   if (ine->wd == -1 && (ine->mask & IN_Q_OVERFLOW)) {
-    /* we missed something, will need to re-crawl */
-    root->scheduleRecrawl("IN_Q_OVERFLOW");
+    if (scopedOverflowRecovery_ && recoverFromOverflow(coll, now)) {
+      totalScopedRecoveries_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      /* we missed something, will need to re-crawl */
+      totalOverflowRecrawls_.fetch_add(1, std::memory_order_relaxed);
+      root->scheduleRecrawl("IN_Q_OVERFLOW");
+    }
   } else if (ine->wd != -1) {
     w_string name;
     char buf[WATCHMAN_NAME_MAX];
@@ -298,13 +665,30 @@ bool InotifyWatcher::process_inotify_event(
     }
 
     if (ine->len > 0 &&
-        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
+        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR)) {
       auto wlock = maps.wlock();
       auto it = wlock->move_map.find(ine->cookie);
       if (it != wlock->move_map.end()) {
-        auto& old = it->second;
-        int wd =
-            inotify_add_watch(infd.fd(), name.c_str(), WATCHMAN_INOTIFY_MASK);
+        auto old = std::move(it->second);
+        wlock->move_map.erase(it);
+
+        // The watches of the dirs below it moved along with it; refer to
+        // them by their new names so that the events that follow are
+        // attributed to the right paths.
+        for (auto& watch : wlock->wd_to_name) {
+          auto& subName = watch.second;
+          if (subName.size() > old.name.size() &&
+              is_path_prefix(subName, old.name)) {
+            subName = w_string::build(
+                name,
+                w_string_piece(
+                    subName.data() + old.name.size(),
+                    subName.size() - old.name.size()));
+          }
+        }
+        coll.addRename(PendingRename{old.name, name, now});
+
+        int wd = addWatch(name.c_str());
         if (wd == -1) {
           if (errno == ENOSPC || errno == ENOMEM) {
             // Limits exceeded, no recovery from our perspective
@@ -357,12 +741,18 @@ bool InotifyWatcher::process_inotify_event(
         pending_flags.set(W_PENDING_RECURSIVE);
       }
 
-      logf(
-          DBG,
-          "add_pending for inotify mask={:x} {}\n",
-          ine->mask,
-          name.c_str());
-      coll.add(name, now, pending_flags);
+      if (root->ignore.isIgnored(name.data(), name.size())) {
+        // An ignored dir (or something in the grandchildren of a vcs dir)
+        // appearing inside a watched dir; statPath would discard it.
+        logf(DBG, "{} is ignored, not adding to pending\n", name);
+      } else {
+        logf(
+            DBG,
+            "add_pending for inotify mask={:x} {}\n",
+            ine->mask,
+            name.c_str());
+        coll.add(name, now, pending_flags);
+      }
 
       // The kernel removed the wd -> name mapping, so let's update
       // our state here also
@@ -393,37 +783,135 @@ bool InotifyWatcher::process_inotify_event(
   return false;
 }
 
-Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
-    const std::shared_ptr<Root>& root,
-    PendingChanges& coll) {
-  int n = read(infd.fd(), &ibuf, sizeof(ibuf));
-  if (n == -1) {
-    if (errno == EINTR) {
-      return {false};
+bool InotifyWatcher::recoverFromOverflow(
+    PendingChanges& coll,
+    std::chrono::system_clock::time_point now) {
+  std::vector<w_string> dirs;
+  {
+    auto rlock = maps.rlock();
+    dirs.reserve(rlock->wd_to_name.size());
+    for (auto& it : rlock->wd_to_name) {
+      dirs.push_back(it.second);
     }
-    logf(
-        FATAL,
-        "read({}, {}): error {}\n",
-        infd.fd(),
-        sizeof(ibuf),
-        folly::errnoStr(errno));
   }
 
-  logf(DBG, "inotify read: returned {}.\n", n);
-  auto now = std::chrono::system_clock::now();
+  // Timestamps come from a coarse clock, so allow some slack
+  auto since = std::chrono::system_clock::to_time_t(lastReadTime_) - 1;
+  std::vector<w_string> changed;
+  for (auto& dir : dirs) {
+    FileInformation st;
+    try {
+      st = getFileInformation(dir.c_str());
+    } catch (const std::system_error& exc) {
+      if (exc.code() == error_code::no_such_file_or_directory ||
+          exc.code() == error_code::not_a_directory) {
+        // It was removed or renamed, which changed its parent
+        continue;
+      }
+      logf(ERR, "IN_Q_OVERFLOW: can't stat {}: {}\n", dir, exc.what());
+      return false;
+    }
+    if (st.mtime.tv_sec >= since || st.ctime.tv_sec >= since) {
+      changed.push_back(dir);
+      if (changed.size() > overflowMaxRescanDirs_) {
+        logf(
+            ERR,
+            "IN_Q_OVERFLOW: more than {} dirs changed\n",
+            overflowMaxRescanDirs_);
+        return false;
+      }
+    }
+  }
 
-  struct inotify_event* ine;
+  logf(
+      ERR,
+      "IN_Q_OVERFLOW: rescanning {} of {} dirs instead of recrawling\n",
+      changed.size(),
+      dirs.size());
+  totalOverflowRescannedDirs_.fetch_add(
+      changed.size(), std::memory_order_relaxed);
+  for (auto& dir : changed) {
+    // Desynced so that every entry is examined, as we may have missed
+    // events for any of them, and so that pending cookies are recreated.
+    coll.add(
+        dir,
+        now,
+        W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN |
+            W_PENDING_IS_DESYNCED);
+  }
+  return true;
+}
+
+bool InotifyWatcher::moreEventsAvailable() {
+  if (mux_) {
+    auto queue = sharedQueue_.lock();
+    return !queue->events.empty() || queue->overflowed;
+  }
+  struct pollfd pfd;
+  pfd.fd = infd.fd();
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
   bool cancel = false;
   size_t eventsSeen = 0;
-  for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
-    ine = (struct inotify_event*)iptr;
+  size_t reads = 0;
+  auto now = std::chrono::system_clock::now();
 
-    cancel |= process_inotify_event(root, coll, ine, now);
-    ++eventsSeen;
+  do {
+    char* ibuf;
+    int n;
+    if (mux_) {
+      takeQueuedEvents();
+      ibuf = sharedBuf_.data();
+      n = int(sharedBuf_.size());
+    } else {
+      ibuf = ibuf_.data();
+      n = read(infd.fd(), ibuf_.data(), ibuf_.size());
+      if (n == -1) {
+        if (errno == EINTR) {
+          break;
+        }
+        logf(
+            FATAL,
+            "read({}, {}): error {}\n",
+            infd.fd(),
+            ibuf_.size(),
+            folly::errnoStr(errno));
+      }
+    }
+    ++reads;
+
+    logf(DBG, "inotify read: returned {}.\n", n);
+    now = std::chrono::system_clock::now();
+
+    // The coalescer refers to the names in ibuf, so it can't remember
+    // them past this read.
+    coalescer_.reset();
+    forEachInotifyEvent(ibuf, size_t(n), [&](struct inotify_event* ine) {
+      cancel |= process_inotify_event(root, coll, ine, now);
+      ++eventsSeen;
+    });
+    lastReadTime_ = now;
+  } while (!cancel && reads < maxReadsPerBatch_ && moreEventsAvailable());
+  coalescer_.reset();
+
+  if (eventsSeen == 0) {
+    return {cancel};
   }
 
   // Relaxed because we don't really care exactly when the value is visible.
   totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  totalBatches_.fetch_add(1, std::memory_order_relaxed);
+  totalReads_.fetch_add(reads, std::memory_order_relaxed);
+  auto maxEvents = maxEventsPerBatch_.load(std::memory_order_relaxed);
+  while (eventsSeen > maxEvents &&
+         !maxEventsPerBatch_.compare_exchange_weak(
+             maxEvents, eventsSeen, std::memory_order_relaxed)) {
+  }
 
   // It is possible that we can accumulate a set of pending_move
   // structs in move_map.  This happens when a directory is moved
@@ -456,7 +944,7 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
 
 bool InotifyWatcher::waitNotify(int timeoutms) {
   struct pollfd pfd[2];
-  pfd[0].fd = infd.fd();
+  pfd[0].fd = mux_ ? queuePipe_->read.fd() : infd.fd();
   pfd[0].events = POLLIN;
   pfd[1].fd = terminatePipe_.read.fd();
   pfd[1].events = POLLIN;
@@ -487,7 +975,17 @@ json_ref InotifyWatcher::getDebugInfo() {
   }
   return json_object({
       {"events", events},
+      {"shared_instance", json_boolean(mux_ != nullptr)},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"total_batch_count", json_integer(totalBatches_.load())},
+      {"total_read_count", json_integer(totalReads_.load())},
+      {"coalesced_event_count", json_integer(totalCoalescedEvents_.load())},
+      {"max_events_per_batch", json_integer(maxEventsPerBatch_.load())},
+      {"overflow_scoped_recovery_count",
+       json_integer(totalScopedRecoveries_.load())},
+      {"overflow_recrawl_count", json_integer(totalOverflowRecrawls_.load())},
+      {"overflow_rescanned_dir_count",
+       json_integer(totalOverflowRescannedDirs_.load())},
   });
 }
 
@@ -496,6 +994,13 @@ void InotifyWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  totalBatches_.store(0, std::memory_order_release);
+  totalReads_.store(0, std::memory_order_release);
+  totalCoalescedEvents_.store(0, std::memory_order_release);
+  maxEventsPerBatch_.store(0, std::memory_order_release);
+  totalScopedRecoveries_.store(0, std::memory_order_release);
+  totalOverflowRecrawls_.store(0, std::memory_order_release);
+  totalOverflowRescannedDirs_.store(0, std::memory_order_release);
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
@@ -8,7 +8,10 @@
 #include "kqueue.h"
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <sys/resource.h>
+#include <algorithm>
 #include <array>
+#include <limits>
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
@@ -57,6 +60,27 @@ static const struct flag_map kflags[] = {
     {0, nullptr},
 };
 
+namespace {
+
+// Registrations to submit in one kevent call, unless the IO thread flushes
+// them sooner
+constexpr size_t kRegistrationBatchSize = 64;
+
+// The descriptors that the watches of every root hold
+std::atomic<size_t> totalWatchFds{0};
+
+size_t defaultFdBudget() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1 ||
+      limit.rlim_cur == RLIM_INFINITY) {
+    return std::numeric_limits<size_t>::max();
+  }
+  // Leave a quarter for clients, state files and everything else
+  return size_t(limit.rlim_cur) / 4 * 3;
+}
+
+} // namespace
+
 KQueueWatcher::KQueueWatcher(
     const w_string& /*root_path*/,
     const Configuration& config,
@@ -66,6 +90,105 @@ KQueueWatcher::KQueueWatcher(
       recursive_(recursive) {
   kq_fd = FileDescriptor(kqueue(), "kqueue", FileDescriptor::FDType::Generic);
   kq_fd.setCloExec();
+
+  auto budget = config.getInt("kqueue_fd_budget", 0);
+  fdBudget_ = budget > 0 ? size_t(budget) : defaultFdBudget();
+}
+
+KQueueWatcher::~KQueueWatcher() {
+  auto rlock = maps_.rlock();
+  totalWatchFds.fetch_sub(
+      rlock->numFiles + rlock->numDirs, std::memory_order_relaxed);
+}
+
+void KQueueWatcher::addWatch(
+    maps& m,
+    FileDescriptor fd,
+    const w_string& name,
+    bool isDir) {
+  auto rawFd = fd.fd();
+  if (size_t(rawFd) >= m.fd_to_watch.size()) {
+    m.fd_to_watch.resize(
+        std::max(size_t(rawFd) + 1, m.fd_to_watch.size() * 2));
+  }
+  auto& watch = m.fd_to_watch[rawFd];
+  watch.fd = std::move(fd);
+  watch.name = name;
+  watch.isDir = isDir;
+  m.name_to_fd[name] = rawFd;
+  ++(isDir ? m.numDirs : m.numFiles);
+  totalWatchFds.fetch_add(1, std::memory_order_relaxed);
+}
+
+void KQueueWatcher::removeWatch(maps& m, int fd) {
+  if (fd < 0 || size_t(fd) >= m.fd_to_watch.size() ||
+      !m.fd_to_watch[fd].name) {
+    return;
+  }
+  auto& watch = m.fd_to_watch[fd];
+  auto it = m.name_to_fd.find(watch.name);
+  if (it != m.name_to_fd.end() && it->second == fd) {
+    m.name_to_fd.erase(it);
+  }
+  // Its descriptor number may be reused before the queued registrations
+  // are submitted
+  m.pendingChanges.erase(
+      std::remove_if(
+          m.pendingChanges.begin(),
+          m.pendingChanges.end(),
+          [&](const struct kevent& k) { return int(k.ident) == fd; }),
+      m.pendingChanges.end());
+  --(watch.isDir ? m.numDirs : m.numFiles);
+  totalWatchFds.fetch_sub(1, std::memory_order_relaxed);
+  // Closing it removes it from the kqueue
+  watch = Watch{};
+}
+
+void KQueueWatcher::submitPendingChanges(maps& m) {
+  if (m.pendingChanges.empty()) {
+    return;
+  }
+  auto& changes = m.pendingChanges;
+
+#ifdef EV_RECEIPT
+  // With EV_RECEIPT every change yields an event that reports whether it
+  // was applied, rather than the first failure aborting the whole call.
+  std::vector<struct kevent> receipts(changes.size());
+  struct timespec ts = {0, 0};
+  int n = kevent(
+      kq_fd.fd(),
+      changes.data(),
+      int(changes.size()),
+      receipts.data(),
+      int(receipts.size()),
+      &ts);
+  if (n >= 0) {
+    for (int i = 0; i < n; ++i) {
+      if ((receipts[i].flags & EV_ERROR) && receipts[i].data != 0) {
+        logf(
+            DBG,
+            "kevent EV_ADD fd {} failed: {}\n",
+            receipts[i].ident,
+            folly::errnoStr(int(receipts[i].data)));
+        removeWatch(m, int(receipts[i].ident));
+      }
+    }
+    changes.clear();
+    return;
+  }
+#endif
+
+  for (auto& change : changes) {
+    if (kevent(kq_fd.fd(), &change, 1, nullptr, 0, 0)) {
+      logf(
+          DBG,
+          "kevent EV_ADD fd {} failed: {}\n",
+          change.ident,
+          folly::errnoStr(errno));
+      removeWatch(m, int(change.ident));
+    }
+  }
+  changes.clear();
 }
 
 bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
@@ -80,6 +203,18 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
     }
   }
 
+  if (totalWatchFds.load(std::memory_order_relaxed) >= fdBudget_) {
+    if (!overBudget_.exchange(true)) {
+      logf(
+          ERR,
+          "kqueue: {} descriptors are watched, which is the limit; "
+          "watching only dirs for changes from now on. Consider raising "
+          "kern.maxfilesperproc or kqueue_fd_budget\n",
+          fdBudget_);
+    }
+    return false;
+  }
+
   logf(DBG, "watch_file({})\n", full_name);
 
   int openFlags = O_EVTONLY | O_CLOEXEC;
@@ -125,37 +260,38 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
       &k,
       rawFd,
       EVFILT_VNODE,
+#ifdef EV_RECEIPT
+      EV_ADD | EV_CLEAR | EV_RECEIPT,
+#else
       EV_ADD | EV_CLEAR,
+#endif
       NOTE_WRITE | NOTE_DELETE | NOTE_EXTEND | NOTE_RENAME | NOTE_ATTRIB,
       0,
       make_udata(isDir));
 
-  {
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd[full_name] = std::move(fdHolder);
-    wlock->fd_to_name[rawFd] = full_name;
+  // The file was stat'd before it got here, so registering it a little
+  // later doesn't widen the window in which we may miss a change to it by
+  // much; startWatchDir and the IO thread submit what we queue.
+  auto wlock = maps_.wlock();
+  if (wlock->name_to_fd.find(full_name) != wlock->name_to_fd.end()) {
+    // Another IO shard got there first
+    return true;
   }
-
-  if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
-    watchman::log(
-        watchman::DBG,
-        "kevent EV_ADD file ",
-        full_name,
-        " failed: ",
-        full_name.c_str(),
-        folly::errnoStr(errno),
-        "\n");
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(full_name);
-    wlock->fd_to_name.erase(rawFd);
-  } else {
-    watchman::log(
-        watchman::DBG, "kevent file ", full_name, " -> ", rawFd, "\n");
+  addWatch(*wlock, std::move(fdHolder), full_name, isDir);
+  wlock->pendingChanges.push_back(k);
+  if (wlock->pendingChanges.size() >= kRegistrationBatchSize) {
+    submitPendingChanges(*wlock);
   }
+  logf(DBG, "kevent file {} -> {}\n", full_name, rawFd);
 
   return true;
 }
 
+void KQueueWatcher::flushWatches() {
+  auto wlock = maps_.wlock();
+  submitPendingChanges(*wlock);
+}
+
 std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
     const std::shared_ptr<Root>& root,
     struct watchman_dir* dir,
@@ -198,28 +334,28 @@ std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
       &k,
       rawFd,
       EVFILT_VNODE,
+#ifdef EV_RECEIPT
+      EV_ADD | EV_CLEAR | EV_RECEIPT,
+#else
       EV_ADD | EV_CLEAR,
+#endif
       NOTE_WRITE | NOTE_DELETE | NOTE_EXTEND | NOTE_RENAME,
       0,
       make_udata(true));
 
   // Our mapping needs to be visible before we add it to the queue,
-  // otherwise we can get a wakeup and not know what it is
-  {
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd[dir_name] = std::move(fdHolder);
-    wlock->fd_to_name[rawFd] = dir_name;
-  }
-
-  if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
-    logf(DBG, "kevent EV_ADD dir {} failed: {}", path, folly::errnoStr(errno));
-
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(dir_name);
-    wlock->fd_to_name.erase(rawFd);
-  } else {
-    watchman::log(watchman::DBG, "kevent dir ", dir_name, " -> ", rawFd, "\n");
+  // otherwise we can get a wakeup and not know what it is.  The dir must
+  // be registered before it is read, so submit it right away, along with
+  // any files that are waiting.
+  auto wlock = maps_.wlock();
+  auto existing = wlock->name_to_fd.find(dir_name);
+  if (existing != wlock->name_to_fd.end()) {
+    removeWatch(*wlock, existing->second);
   }
+  addWatch(*wlock, std::move(fdHolder), dir_name, true);
+  wlock->pendingChanges.push_back(k);
+  submitPendingChanges(*wlock);
+  logf(DBG, "kevent dir {} -> {}\n", dir_name, rawFd);
 
   return osdir;
 }
@@ -247,7 +383,14 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
     return {false};
   }
 
+  // Without watches on all of the files, the changes to a dir may be all
+  // that we hear about changes to its files
+  PendingFlags dirFlags = overBudget_.load(std::memory_order_relaxed)
+      ? W_PENDING_NONRECURSIVE_SCAN
+      : PendingFlags{};
+
   auto now = std::chrono::system_clock::now();
+  auto wlock = maps_.wlock();
   for (int i = 0; n > 0 && i < n; i++) {
     uint32_t fflags = keventbuf[i].fflags;
     bool is_dir = is_udata_dir(keventbuf[i].udata);
@@ -255,15 +398,15 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
     int fd = keventbuf[i].ident;
 
     w_expand_flags(kflags, fflags, flags_label, sizeof(flags_label));
-    auto wlock = maps_.wlock();
-    auto it = wlock->fd_to_name.find(fd);
-    w_string path = it == wlock->fd_to_name.end() ? nullptr : it->second;
+    w_string path = fd >= 0 && size_t(fd) < wlock->fd_to_watch.size()
+        ? wlock->fd_to_watch[fd].name
+        : nullptr;
     if (!path) {
       // Was likely a buffered notification for something that we decided
       // to stop watching
       logf(
           DBG,
-          " KQ notif for fd={}; flags={:x} {} no ref for it in fd_to_name\n",
+          " KQ notif for fd={}; flags={:x} {} no ref for it in fd_to_watch\n",
           fd,
           fflags,
           flags_label);
@@ -272,8 +415,6 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
 
     logf(DBG, " KQ fd={} path {} [{:x} {}]\n", fd, path, fflags, flags_label);
     if ((fflags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE))) {
-      struct kevent k;
-
       if (w_string_equal(path, root->root_path)) {
         logf(
             ERR,
@@ -284,18 +425,14 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
       }
 
       // Remove our watch bits
-      memset(&k, 0, sizeof(k));
-      EV_SET(&k, fd, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
-      kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0);
-      wlock->name_to_fd.erase(path);
-      wlock->fd_to_name.erase(fd);
+      removeWatch(*wlock, fd);
     }
 
     // TODO: W_PENDING_VIA_NOTIFY should always be set
     coll.add(
         path,
         now,
-        is_dir ? PendingFlags{} : (W_PENDING_RECURSIVE | W_PENDING_VIA_NOTIFY));
+        is_dir ? dirFlags : (W_PENDING_RECURSIVE | W_PENDING_VIA_NOTIFY));
   }
 
   return {false};
@@ -326,6 +463,16 @@ void KQueueWatcher::stopThreads() {
   ignore_result(write(terminatePipe_.write.fd(), "X", 1));
 }
 
+json_ref KQueueWatcher::getDebugInfo() {
+  auto rlock = maps_.rlock();
+  return json_object({
+      {"watched_file_count", json_integer(rlock->numFiles)},
+      {"watched_dir_count", json_integer(rlock->numDirs)},
+      {"fd_budget", json_integer(fdBudget_)},
+      {"over_fd_budget", json_boolean(overBudget_.load())},
+  });
+}
+
 static RegisterWatcher<KQueueWatcher> reg(
     "kqueue",
     -1 /* last resort on macOS */);
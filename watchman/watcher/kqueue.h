@@ -5,6 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 #include "watchman/Constants.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
@@ -20,18 +23,34 @@ struct KQueueWatcher : public Watcher {
   FileDescriptor kq_fd;
   Pipe terminatePipe_;
 
+  struct Watch {
+    FileDescriptor fd;
+    w_string name;
+    bool isDir{false};
+  };
   struct maps {
-    std::unordered_map<w_string, FileDescriptor> name_to_fd;
-    /* map of active watch descriptor to name of the corresponding item */
-    std::unordered_map<int, w_string> fd_to_name;
+    /* the active watches, indexed by descriptor number; descriptors are
+     * allocated densely, so this is smaller and quicker than a hash map */
+    std::vector<Watch> fd_to_watch;
+    /* map of the name of each watched item to its descriptor */
+    std::unordered_map<w_string, int> name_to_fd;
+    // Registrations of files that have yet to be submitted to the kqueue
+    std::vector<struct kevent> pendingChanges;
+    size_t numFiles{0};
+    size_t numDirs{0};
 
     explicit maps(json_int_t sizeHint) {
       name_to_fd.reserve(sizeHint);
-      fd_to_name.reserve(sizeHint);
     }
   };
   folly::Synchronized<maps> maps_;
   bool recursive_;
+  // Once the watches of all roots hold this many descriptors, files are
+  // left unwatched and only dirs are watched.
+  size_t fdBudget_;
+  // Set once a file was left unwatched; the entries of dirs that change are
+  // then all stat'd, as the files themselves won't tell us about changes.
+  std::atomic<bool> overBudget_{false};
 
   struct kevent keventbuf[WATCHMAN_BATCH_LIMIT];
 
@@ -39,6 +58,7 @@ struct KQueueWatcher : public Watcher {
       const w_string& root_path,
       const Configuration& config,
       bool recursive = true);
+  ~KQueueWatcher() override;
 
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
@@ -47,12 +67,24 @@ struct KQueueWatcher : public Watcher {
 
   bool startWatchFile(struct watchman_file* file) override;
 
+  void flushWatches() override;
+
   Watcher::ConsumeNotifyRet consumeNotify(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) override;
 
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+
+ private:
+  // Remembers a watch whose registration is about to be submitted
+  void addWatch(maps& m, FileDescriptor fd, const w_string& name, bool isDir);
+  // Closes the descriptor of a watch and forgets it
+  void removeWatch(maps& m, int fd);
+  // Submits pendingChanges in a single kevent call
+  void submitPendingChanges(maps& m);
 };
 
 } // namespace watchman
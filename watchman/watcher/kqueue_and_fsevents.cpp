@@ -7,7 +7,10 @@
 
 #include <folly/Synchronized.h>
 #include <condition_variable>
+#include <algorithm>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "watchman/InMemoryView.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/WatcherRegistry.h"
@@ -80,6 +83,14 @@ class PendingEventsCond {
  *
  * The kqueue watches are used on the root directory and all the files at the
  * root, while the fsevents one is used on the subdirectories.
+ *
+ * Each stream runs two threads, so the top-level directories share at most
+ * `fsevents_split_max_streams` of them.  The first ones get a stream of their
+ * own; later ones join the stream that watches the fewest.  As the paths of
+ * a stream can't be changed, it is then replaced by one that also watches
+ * the new directories.  That happens once per IO batch, in flushWatches, and
+ * the replacement first replays the journal from the time the directories
+ * were added so that the changes made while they were crawled aren't lost.
  */
 class KQueueAndFSEventsWatcher : public Watcher {
  public:
@@ -98,6 +109,8 @@ class KQueueAndFSEventsWatcher : public Watcher {
 
   bool startWatchFile(struct watchman_file* file) override;
 
+  void flushWatches() override;
+
   Watcher::ConsumeNotifyRet consumeNotify(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) override;
@@ -112,9 +125,38 @@ class KQueueAndFSEventsWatcher : public Watcher {
   void injectRecrawl(w_string path);
 
  private:
-  folly::Synchronized<
-      std::unordered_map<w_string, std::shared_ptr<FSEventsWatcher>>>
-      fseventWatchers_;
+  struct Stream {
+    // Null once the stream has been cancelled
+    std::shared_ptr<FSEventsWatcher> watcher;
+    std::vector<w_string> dirs;
+    // Dirs to add when the stream is next replaced, and the event id at
+    // which the first of them was added
+    std::vector<w_string> pendingDirs;
+    FSEventStreamEventId pendingSince{0};
+
+    size_t size() const {
+      return dirs.size() + pendingDirs.size();
+    }
+  };
+  struct Streams {
+    std::vector<Stream> streams;
+    // Maps each top-level directory to the index of its stream
+    std::unordered_map<w_string, size_t> dirToStream;
+    // Replaced streams whose queued events haven't been consumed yet
+    std::vector<std::shared_ptr<FSEventsWatcher>> retired;
+    // Dirs whose changes may have been missed by their stream
+    std::vector<w_string> rescan;
+  };
+
+  std::shared_ptr<FSEventsWatcher> startStream(
+      const std::shared_ptr<Root>& root,
+      std::vector<w_string> dirs,
+      FSEventStreamEventId since = kFSEventStreamEventIdSinceNow);
+  void forgetDir(const std::shared_ptr<Root>& root, Streams& s, w_string dir);
+
+  folly::Synchronized<Streams> streams_;
+  const size_t maxStreams_;
+  std::weak_ptr<Root> root_;
   std::shared_ptr<KQueueWatcher> kqueueWatcher_;
 
   std::shared_ptr<PendingEventsCond> pendingCondition_;
@@ -126,6 +168,8 @@ KQueueAndFSEventsWatcher::KQueueAndFSEventsWatcher(
     const w_string& root_path,
     const Configuration& config)
     : Watcher("kqueue+fsevents", WATCHER_HAS_SPLIT_WATCH),
+      maxStreams_(std::max(
+          config.getInt("fsevents_split_max_streams", 16), json_int_t(1))),
       kqueueWatcher_(std::make_shared<KQueueWatcher>(root_path, config, false)),
       pendingCondition_(std::make_shared<PendingEventsCond>()) {}
 
@@ -148,6 +192,11 @@ bool startThread(
       } else if (cond->shouldStop()) {
         return;
       }
+      // A replaced stream has nothing more to report
+      auto fsevents = std::dynamic_pointer_cast<FSEventsWatcher>(watcher);
+      if (fsevents && fsevents->isStopped()) {
+        return;
+      }
     }
   });
   thr.detach();
@@ -156,6 +205,7 @@ bool startThread(
 } // namespace
 
 bool KQueueAndFSEventsWatcher::start(const std::shared_ptr<Root>& root) {
+  root_ = root;
   root->cookies.addCookieDir(root->root_path);
   return startThread(root, kqueueWatcher_, pendingCondition_);
 }
@@ -170,11 +220,19 @@ folly::SemiFuture<folly::Unit> KQueueAndFSEventsWatcher::flushPendingEvents() {
       !kqueueFlush.valid(),
       "This code needs to be updated to handle KQueueWatcher implementing flushPendingEvents");
 
-  auto fseventsWatchers = *fseventWatchers_.rlock();
+  std::vector<std::shared_ptr<FSEventsWatcher>> fseventsWatchers;
+  {
+    auto rlock = streams_.rlock();
+    for (auto& stream : rlock->streams) {
+      if (stream.watcher) {
+        fseventsWatchers.push_back(stream.watcher);
+      }
+    }
+  }
 
   std::vector<folly::SemiFuture<folly::Unit>> futures;
   futures.reserve(fseventsWatchers.size());
-  for (auto& [name, watcher] : fseventsWatchers) {
+  for (auto& watcher : fseventsWatchers) {
     auto future = watcher->flushPendingEvents();
     if (future.valid()) {
       futures.push_back(std::move(future));
@@ -193,23 +251,39 @@ std::unique_ptr<DirHandle> KQueueAndFSEventsWatcher::startWatchDir(
     kqueueWatcher_->startWatchDir(root, dir, path);
   } else if (dir->parent->getFullPath() == root->root_path) {
     auto fullPath = dir->getFullPath();
-    auto wlock = fseventWatchers_.wlock();
-    if (wlock->find(fullPath) == wlock->end()) {
-      logf(
-          DBG,
-          "Creating a new FSEventsWatcher for top-level directory {}\n",
-          dir->name);
-      root->cookies.addCookieDir(fullPath);
-      auto [it, _] = wlock->emplace(
-          fullPath,
-          std::make_shared<FSEventsWatcher>(
-              false, root->config, std::optional(fullPath)));
-      const auto& watcher = it->second;
-      if (!watcher->start(root)) {
-        throw std::runtime_error("couldn't start fsEvent");
-      }
-      if (!startThread(root, watcher, pendingCondition_)) {
-        throw std::runtime_error("couldn't start fsEvent");
+    auto wlock = streams_.wlock();
+    if (wlock->dirToStream.find(fullPath) == wlock->dirToStream.end()) {
+      auto& streams = wlock->streams;
+      auto idle = std::find_if(streams.begin(), streams.end(), [](auto& s) {
+        return !s.watcher && s.size() == 0;
+      });
+      if (idle != streams.end() || streams.size() < maxStreams_) {
+        logf(
+            DBG,
+            "Creating a new FSEventsWatcher for top-level directory {}\n",
+            dir->name);
+        if (idle == streams.end()) {
+          idle = streams.emplace(streams.end());
+        }
+        root->cookies.addCookieDir(fullPath);
+        idle->watcher = startStream(root, {fullPath});
+        idle->dirs.push_back(fullPath);
+        wlock->dirToStream[fullPath] = idle - streams.begin();
+      } else {
+        auto smallest = std::min_element(
+            streams.begin(), streams.end(), [](auto& a, auto& b) {
+              return a.size() < b.size();
+            });
+        logf(
+            DBG,
+            "Adding top-level directory {} to FSEventsWatcher {}\n",
+            dir->name,
+            smallest - streams.begin());
+        if (smallest->pendingDirs.empty()) {
+          smallest->pendingSince = FSEventsGetCurrentEventId();
+        }
+        smallest->pendingDirs.push_back(fullPath);
+        wlock->dirToStream[fullPath] = smallest - streams.begin();
       }
     }
   }
@@ -217,6 +291,37 @@ std::unique_ptr<DirHandle> KQueueAndFSEventsWatcher::startWatchDir(
   return openDir(path);
 }
 
+std::shared_ptr<FSEventsWatcher> KQueueAndFSEventsWatcher::startStream(
+    const std::shared_ptr<Root>& root,
+    std::vector<w_string> dirs,
+    FSEventStreamEventId since) {
+  auto watcher = std::make_shared<FSEventsWatcher>(
+      false, root->config, std::move(dirs), since);
+  if (!watcher->start(root)) {
+    throw std::runtime_error("couldn't start fsEvent");
+  }
+  if (!startThread(root, watcher, pendingCondition_)) {
+    throw std::runtime_error("couldn't start fsEvent");
+  }
+  return watcher;
+}
+
+void KQueueAndFSEventsWatcher::forgetDir(
+    const std::shared_ptr<Root>& root,
+    Streams& s,
+    w_string dir) {
+  auto it = s.dirToStream.find(dir);
+  if (it == s.dirToStream.end()) {
+    return;
+  }
+  auto& stream = s.streams[it->second];
+  s.dirToStream.erase(it);
+  stream.dirs.erase(
+      std::remove(stream.dirs.begin(), stream.dirs.end(), dir),
+      stream.dirs.end());
+  root->cookies.removeCookieDir(dir);
+}
+
 bool KQueueAndFSEventsWatcher::startWatchFile(struct watchman_file* file) {
   if (file->parent->parent == nullptr) {
     // File at the root, watch it with kqueue.
@@ -228,6 +333,49 @@ bool KQueueAndFSEventsWatcher::startWatchFile(struct watchman_file* file) {
   return true;
 }
 
+void KQueueAndFSEventsWatcher::flushWatches() {
+  kqueueWatcher_->flushWatches();
+
+  auto root = root_.lock();
+  if (!root) {
+    return;
+  }
+  auto wlock = streams_.wlock();
+  for (auto& stream : wlock->streams) {
+    if (stream.pendingDirs.empty()) {
+      continue;
+    }
+    auto dirs = stream.dirs;
+    dirs.insert(
+        dirs.end(), stream.pendingDirs.begin(), stream.pendingDirs.end());
+    logf(
+        DBG,
+        "Replacing an FSEventsWatcher to watch {} directories\n",
+        dirs.size());
+
+    // Start the replacement before stopping the current stream so that
+    // there is no gap between them; the changes that both report are
+    // only examined twice.
+    auto watcher = startStream(root, dirs, stream.pendingSince);
+    if (watcher->missedHistory()) {
+      wlock->rescan.insert(
+          wlock->rescan.end(),
+          stream.pendingDirs.begin(),
+          stream.pendingDirs.end());
+    }
+    if (stream.watcher) {
+      stream.watcher->stopThreads();
+      wlock->retired.push_back(std::move(stream.watcher));
+    }
+    for (auto& dir : stream.pendingDirs) {
+      root->cookies.addCookieDir(dir);
+    }
+    stream.watcher = std::move(watcher);
+    stream.dirs = std::move(dirs);
+    stream.pendingDirs.clear();
+  }
+}
+
 Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
@@ -247,15 +395,36 @@ Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
   }
 
   {
-    auto fseventWatches = fseventWatchers_.wlock();
-    for (auto& [watchpath, fsevent] : *fseventWatches) {
-      auto [cancelSelf] = fsevent->consumeNotify(root, coll);
-      if (cancelSelf) {
-        fsevent->stopThreads();
-        root->cookies.removeCookieDir(watchpath);
-        fseventWatches->erase(watchpath);
+    auto wlock = streams_.wlock();
+    for (auto& retired : wlock->retired) {
+      retired->consumeNotify(root, coll);
+    }
+    wlock->retired.clear();
+
+    if (!wlock->rescan.empty()) {
+      auto now = std::chrono::system_clock::now();
+      for (auto& dir : wlock->rescan) {
+        coll.add(dir, now, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+      }
+      wlock->rescan.clear();
+    }
+
+    for (auto& stream : wlock->streams) {
+      if (!stream.watcher) {
         continue;
       }
+      auto [cancelSelf] = stream.watcher->consumeNotify(root, coll);
+      for (auto& dir : stream.watcher->takeRemovedDirs()) {
+        forgetDir(root, *wlock, dir);
+      }
+      if (cancelSelf) {
+        stream.watcher->stopThreads();
+        stream.watcher.reset();
+        auto dirs = stream.dirs;
+        for (auto& dir : dirs) {
+          forgetDir(root, *wlock, dir);
+        }
+      }
     }
   }
 
@@ -269,9 +438,11 @@ bool KQueueAndFSEventsWatcher::waitNotify(int timeoutms) {
 void KQueueAndFSEventsWatcher::stopThreads() {
   pendingCondition_->stopAll();
   {
-    auto fseventWatches = fseventWatchers_.rlock();
-    for (auto& [_, fsevent] : *fseventWatches) {
-      fsevent->stopThreads();
+    auto rlock = streams_.rlock();
+    for (auto& stream : rlock->streams) {
+      if (stream.watcher) {
+        stream.watcher->stopThreads();
+      }
     }
   }
   kqueueWatcher_->stopThreads();
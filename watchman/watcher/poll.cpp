@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+using namespace watchman;
+
+namespace {
+
+// How often to look for the cookies of queries that are waiting to sync,
+// so that they needn't wait for the next sweep
+constexpr std::chrono::milliseconds kCookieCheckInterval{50};
+
+bool sameTime(const struct timespec& a, const struct timespec& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Whether path is a descendant of prefix, which ends with a slash
+bool isBeneath(const w_string& path, w_string_piece prefix) {
+  return w_string_piece(path).startsWith(prefix);
+}
+
+// Whether path is prefix, less its slash, or a descendant of it
+bool isAtOrBeneath(const w_string& path, w_string_piece prefix) {
+  return isBeneath(path, prefix) ||
+      (path.size() + 1 == prefix.size() &&
+       prefix.startsWith(w_string_piece(path)));
+}
+
+} // namespace
+
+/**
+ * Watches a root without any help from the kernel, for filesystems such as
+ * NFS and CIFS whose notifications are missing or unreliable.
+ *
+ * Every poll_interval_ms, the dirs that the crawler has read are stat'd, and
+ * those whose mtime or inode changed are read again, along with the stats of
+ * their entries.  A file that is modified in place doesn't change the mtime
+ * of its dir, so the entries of unchanged dirs are re-stat'd once they were
+ * last read poll_recheck_files_ms ago.  The dirs beneath the paths that
+ * queries were recently restricted to, as the root's crawl heat map records
+ * them, are checked first, and their entries are re-stat'd on every sweep.
+ * At most poll_max_dirs_per_interval dirs are checked per sweep; the rest
+ * are checked in turn over the following sweeps.
+ */
+struct PollWatcher : public Watcher {
+  const w_string rootPath_;
+  const std::chrono::milliseconds interval_;
+  const std::chrono::milliseconds recheckFiles_;
+  const size_t maxDirsPerInterval_;
+
+  struct DirState {
+    struct timespec mtime;
+    ino_t ino;
+    // When the crawler last read the dir
+    std::chrono::steady_clock::time_point lastRead;
+    // The dir was modified so recently that it may be modified again
+    // without its mtime visibly changing
+    bool unsettled;
+  };
+  // Ordered so that the dirs beneath a path are adjacent
+  folly::Synchronized<std::map<w_string, DirState>> dirs_;
+  // Where the next sweep resumes checking the dirs that no query is
+  // restricted to.  Only used by the notify thread.
+  w_string cursor_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_{false};
+  std::chrono::steady_clock::time_point nextSweep_;
+  std::chrono::steady_clock::time_point nextCookieCheck_;
+
+  std::atomic<uint64_t> totalSweeps_{0};
+  std::atomic<uint64_t> totalDirsChecked_{0};
+  std::atomic<uint64_t> totalDirsChanged_{0};
+  std::atomic<uint64_t> totalDirsRestatted_{0};
+
+  PollWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  // Picks the dirs that this sweep checks, the dirs that queries are
+  // restricted to first.  Sets `hot` for the dirs that are beneath them.
+  std::vector<w_string> chooseDirs(
+      const std::shared_ptr<Root>& root,
+      std::vector<bool>& hot);
+
+  // Stats dir and queues whatever work its changes call for.  Returns true
+  // if the root itself is gone and the watch needs to be cancelled.
+  bool checkDir(
+      const w_string& dir,
+      bool hot,
+      PendingChanges& coll,
+      std::chrono::steady_clock::time_point now,
+      std::chrono::system_clock::time_point wallNow);
+};
+
+PollWatcher::PollWatcher(const w_string& rootPath, const Configuration& config)
+    : Watcher("poll", 0),
+      rootPath_(rootPath),
+      interval_(std::max(
+          json_int_t(1),
+          config.getInt("poll_interval_ms", 2000))),
+      recheckFiles_(config.getInt("poll_recheck_files_ms", 60000)),
+      maxDirsPerInterval_(size_t(std::max(
+          json_int_t(1),
+          config.getInt("poll_max_dirs_per_interval", 4096)))) {
+  auto now = std::chrono::steady_clock::now();
+  nextSweep_ = now + interval_;
+  nextCookieCheck_ = now + kCookieCheckInterval;
+}
+
+std::unique_ptr<DirHandle> PollWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // Stat it before it is read, so that anything that changes it after it
+  // has been read changes its mtime from what we record here
+  auto st = getFileInformation(path, CaseSensitivity::CaseSensitive);
+  auto osdir = openDir(path);
+
+  auto wallNow = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  auto wlock = dirs_.wlock();
+  (*wlock)[w_string(path, W_STRING_BYTE)] = DirState{
+      st.mtime,
+      st.ino,
+      std::chrono::steady_clock::now(),
+      st.mtime.tv_sec >= wallNow - 1};
+  return osdir;
+}
+
+std::vector<w_string> PollWatcher::chooseDirs(
+    const std::shared_ptr<Root>& root,
+    std::vector<bool>& hot) {
+  std::vector<w_string> chosen;
+  auto rlock = dirs_.rlock();
+  auto& dirs = *rlock;
+  auto budget = std::min(maxDirsPerInterval_, dirs.size());
+
+  // Leave at least half of the budget for the rest of the tree, so that
+  // changes elsewhere are still noticed, if later
+  auto hotBudget = budget - budget / 2;
+  std::vector<w_string> hotPaths;
+  for (auto& rel : root->crawlHeat.hottest()) {
+    if (chosen.size() >= hotBudget) {
+      break;
+    }
+    auto full = w_string::pathCat({rootPath_, rel});
+    auto it = dirs.find(full);
+    if (it != dirs.end()) {
+      chosen.push_back(it->first);
+      hot.push_back(true);
+    }
+    auto prefix = w_string::build(full, "/");
+    for (it = dirs.lower_bound(prefix);
+         it != dirs.end() && chosen.size() < hotBudget &&
+         isBeneath(it->first, prefix);
+         ++it) {
+      chosen.push_back(it->first);
+      hot.push_back(true);
+    }
+    hotPaths.push_back(std::move(prefix));
+  }
+
+  // Then carry on round robin from where the previous sweep stopped
+  auto it = cursor_ ? dirs.upper_bound(cursor_) : dirs.begin();
+  size_t visited = 0;
+  while (chosen.size() < budget && visited < dirs.size()) {
+    if (it == dirs.end()) {
+      it = dirs.begin();
+    }
+    ++visited;
+    auto& path = it->first;
+    bool isHot = std::any_of(
+        hotPaths.begin(), hotPaths.end(), [&](const w_string& prefix) {
+          return isAtOrBeneath(path, prefix);
+        });
+    if (!isHot) {
+      chosen.push_back(path);
+      hot.push_back(false);
+      cursor_ = path;
+    }
+    ++it;
+  }
+  return chosen;
+}
+
+bool PollWatcher::checkDir(
+    const w_string& dir,
+    bool hot,
+    PendingChanges& coll,
+    std::chrono::steady_clock::time_point now,
+    std::chrono::system_clock::time_point wallNow) {
+  bool isRoot = w_string_equal(dir, rootPath_);
+  totalDirsChecked_.fetch_add(1, std::memory_order_relaxed);
+
+  FileInformation st;
+  try {
+    st = getFileInformation(dir.c_str(), CaseSensitivity::CaseSensitive);
+  } catch (const std::system_error& exc) {
+    if (isRoot) {
+      logf(
+          ERR,
+          "poll: can't stat root dir {}: {}, canceling watch\n",
+          rootPath_,
+          exc.what());
+      return true;
+    }
+    // Let statPath work out what happened to it; the crawler tells us
+    // about it again if it is still a dir
+    dirs_.wlock()->erase(dir);
+    coll.add(dir, wallNow, W_PENDING_VIA_NOTIFY);
+    totalDirsChanged_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  bool changed;
+  bool restat;
+  {
+    auto rlock = dirs_.rlock();
+    auto it = rlock->find(dir);
+    if (it == rlock->end()) {
+      return false;
+    }
+    auto& state = it->second;
+    changed = state.unsettled || state.ino != st.ino ||
+        !sameTime(state.mtime, st.mtime);
+    restat = hot || now - state.lastRead >= recheckFiles_;
+  }
+
+  if (changed) {
+    // Read it again and stat all of its entries
+    logf(DBG, "poll: {} changed\n", dir);
+    coll.add(dir, wallNow, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+    totalDirsChanged_.fetch_add(1, std::memory_order_relaxed);
+  } else if (restat) {
+    coll.add(
+        dir, wallNow, W_PENDING_CRAWL_ONLY | W_PENDING_NONRECURSIVE_SCAN);
+    totalDirsRestatted_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (changed || restat) {
+    // Don't ask again before the crawler has had a chance to read it; it
+    // records a fresh state when it does
+    auto wlock = dirs_.wlock();
+    auto it = wlock->find(dir);
+    if (it != wlock->end()) {
+      it->second.mtime = st.mtime;
+      it->second.ino = st.ino;
+      it->second.lastRead = now;
+      it->second.unsettled = false;
+    }
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet PollWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto now = std::chrono::steady_clock::now();
+  auto wallNow = std::chrono::system_clock::now();
+  bool sweep;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    sweep = now >= nextSweep_;
+    if (sweep) {
+      nextSweep_ = now + interval_;
+    }
+    nextCookieCheck_ = now + kCookieCheckInterval;
+  }
+
+  if (!sweep) {
+    // Only the dirs of outstanding cookies
+    if (root->cookies.getOutstandingCookieFileList().empty()) {
+      return {false};
+    }
+    for (auto& dir : root->cookies.cookieDirs()) {
+      if (checkDir(dir, false, coll, now, wallNow)) {
+        return {true};
+      }
+    }
+    return {false};
+  }
+
+  totalSweeps_.fetch_add(1, std::memory_order_relaxed);
+  std::vector<bool> hot;
+  auto dirs = chooseDirs(root, hot);
+  for (size_t i = 0; i < dirs.size(); ++i) {
+    if (checkDir(dirs[i], hot[i], coll, now, wallNow)) {
+      return {true};
+    }
+  }
+  return {false};
+}
+
+bool PollWatcher::waitNotify(int timeoutms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto deadline = std::min(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutms),
+      std::min(nextSweep_, nextCookieCheck_));
+  cond_.wait_until(lock, deadline, [&] { return stopping_; });
+  if (stopping_) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  return now >= nextSweep_ || now >= nextCookieCheck_;
+}
+
+void PollWatcher::stopThreads() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+}
+
+json_ref PollWatcher::getDebugInfo() {
+  return json_object({
+      {"sweep_count", json_integer(totalSweeps_.load())},
+      {"checked_dir_count", json_integer(totalDirsChecked_.load())},
+      {"changed_dir_count", json_integer(totalDirsChanged_.load())},
+      {"restatted_dir_count", json_integer(totalDirsRestatted_.load())},
+      {"tracked_dir_count", json_integer(dirs_.rlock()->size())},
+  });
+}
+
+void PollWatcher::clearDebugInfo() {
+  totalSweeps_.store(0, std::memory_order_release);
+  totalDirsChecked_.store(0, std::memory_order_release);
+  totalDirsChanged_.store(0, std::memory_order_release);
+  totalDirsRestatted_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectPoll(
+    const w_string& root_path,
+    const w_string& /*fstype*/,
+    const Configuration& config) {
+  // Much more expensive than any watcher that the kernel helps, so never
+  // fall back to it when one of those fails
+  if (std::string_view{config.getString("watcher", "auto")} != "poll") {
+    throw std::runtime_error("only used when requested via the watcher option");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<PollWatcher>(root_path, config));
+}
+} // namespace
+
+static WatcherRegistry reg("poll", detectPoll, -2);
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -180,7 +180,7 @@ bool PortFSWatcher::startWatchFile(struct watchman_file* file) {
     return false;
   }
 
-  return do_watch(name, file->stat, false);
+  return do_watch(name, file->stat.expand(), false);
 }
 
 std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
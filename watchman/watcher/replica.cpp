@@ -0,0 +1,497 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _WIN32
+
+#include <folly/SocketAddress.h>
+#include <folly/String.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
+#include "watchman/PDU.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+#include "watchman/watchman_stream.h"
+
+using namespace watchman;
+
+namespace {
+
+// The name of the subscription that a replica makes on the primary
+constexpr const char* kSubscriptionName = "replica";
+// How much is read from the primary per wakeup
+constexpr size_t kReadSize = 64 * 1024;
+// The connection is probed after this many seconds without traffic, and
+// given up after the probes go unanswered for as long again
+constexpr int kKeepAliveIdleSeconds = 30;
+constexpr int kKeepAliveIntervalSeconds = 10;
+constexpr int kKeepAliveProbes = 3;
+
+// Connects to address, a host:port, giving up after timeout
+FileDescriptor connectTcp(
+    const std::string& address,
+    std::chrono::milliseconds timeout) {
+  folly::SocketAddress addr;
+  addr.setFromHostPort(address);
+
+  FileDescriptor fd(
+      ::socket(addr.getFamily(), SOCK_STREAM, 0),
+      "socket() for replica connection",
+      FileDescriptor::FDType::Socket);
+  fd.setCloExec();
+  fd.setNonBlock();
+
+  sockaddr_storage storage;
+  auto addrLen = addr.getAddress(&storage);
+  if (::connect(fd.system_handle(), (struct sockaddr*)&storage, addrLen)) {
+    if (errno != EINPROGRESS) {
+      throw std::system_error(
+          errno, std::generic_category(), "connect to " + address);
+    }
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = POLLOUT;
+    int n = ::poll(&pfd, 1, int(timeout.count()));
+    if (n <= 0) {
+      throw std::system_error(
+          n == 0 ? ETIMEDOUT : errno,
+          std::generic_category(),
+          "connect to " + address);
+    }
+    int err = 0;
+    socklen_t errLen = sizeof(err);
+    ::getsockopt(fd.system_handle(), SOL_SOCKET, SO_ERROR, &err, &errLen);
+    if (err) {
+      throw std::system_error(
+          err, std::generic_category(), "connect to " + address);
+    }
+  }
+  // Blocks until the subscribe is sent; connect() makes it non-blocking
+  // again
+  fd.clearNonBlock();
+
+  int one = 1;
+  ::setsockopt(
+      fd.system_handle(), IPPROTO_TCP, TCP_NODELAY, (char*)&one, sizeof(one));
+  // A primary whose host went away never closes the connection, and its
+  // silence looks like a tree without changes
+  ::setsockopt(
+      fd.system_handle(), SOL_SOCKET, SO_KEEPALIVE, (char*)&one, sizeof(one));
+#ifdef TCP_KEEPIDLE
+  int idle = kKeepAliveIdleSeconds;
+  ::setsockopt(
+      fd.system_handle(),
+      IPPROTO_TCP,
+      TCP_KEEPIDLE,
+      (char*)&idle,
+      sizeof(idle));
+#elif defined(TCP_KEEPALIVE)
+  int idle = kKeepAliveIdleSeconds;
+  ::setsockopt(
+      fd.system_handle(),
+      IPPROTO_TCP,
+      TCP_KEEPALIVE,
+      (char*)&idle,
+      sizeof(idle));
+#endif
+#ifdef TCP_KEEPINTVL
+  int interval = kKeepAliveIntervalSeconds;
+  ::setsockopt(
+      fd.system_handle(),
+      IPPROTO_TCP,
+      TCP_KEEPINTVL,
+      (char*)&interval,
+      sizeof(interval));
+#endif
+#ifdef TCP_KEEPCNT
+  int probes = kKeepAliveProbes;
+  ::setsockopt(
+      fd.system_handle(),
+      IPPROTO_TCP,
+      TCP_KEEPCNT,
+      (char*)&probes,
+      sizeof(probes));
+#endif
+  return fd;
+}
+
+// Decodes the PDU at the start of input, which the primary encodes as BSER
+// v1 as we do.  Returns nullptr if input doesn't hold all of it yet, or
+// else sets consumed to its size.  Throws if input isn't a PDU.
+json_ref decodeBufferedPdu(std::string_view input, size_t& consumed) {
+  if (input.size() < 2) {
+    return nullptr;
+  }
+  if (memcmp(input.data(), BSER_MAGIC, 2) != 0) {
+    throw std::runtime_error("the primary sent something other than BSER");
+  }
+  json_int_t needed;
+  json_int_t len;
+  if (!bunser_int(input.data() + 2, input.size() - 2, &needed, &len)) {
+    if (needed == -1) {
+      throw std::runtime_error("failed to read PDU size");
+    }
+    return nullptr;
+  }
+  if (len < 0) {
+    throw std::runtime_error("the primary sent a PDU of negative size");
+  }
+  auto header = 2 + size_t(needed);
+  if (input.size() - header < size_t(len)) {
+    return nullptr;
+  }
+  json_error_t jerr;
+  auto pdu = bunser(
+      input.data() + header, input.data() + header + len, &needed, &jerr);
+  if (!pdu) {
+    throw std::runtime_error(jerr.text);
+  }
+  consumed = header + size_t(len);
+  return pdu;
+}
+
+} // namespace
+
+/**
+ * Follows the changes that a primary daemon observes in the same tree, for
+ * hosts that share the primary's source over NFS or another filesystem
+ * that doesn't notify them of changes made elsewhere, such as the workers
+ * of a build farm.
+ *
+ * The replica subscribes to the root on the primary's tcp-listener and
+ * queues each file that the primary reports for its own view to stat, so
+ * that it answers queries itself without polling the tree.  The cookies of
+ * its queries are written to the shared tree and reach it through the
+ * primary too, so its queries are synchronized with what the primary has
+ * seen.
+ *
+ * When the connection drops, the replica reconnects with backoff and
+ * subscribes again from the clock of the last results that it received.
+ * If the primary can't answer from there, as after it restarted, the
+ * replica recrawls.  The connection is read without blocking, so that
+ * stopThreads interrupts a replica that waits on a slow primary, and has
+ * TCP keepalives, so that a primary whose host went away is noticed.
+ */
+struct ReplicaWatcher : public Watcher {
+  ReplicaWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  // Connects and subscribes; on failure, backs off until the next attempt
+  void connect();
+  void disconnect(const char* why);
+  void handleResults(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const json_ref& pdu);
+
+  const w_string rootPath_;
+  const std::string primary_;
+  // The root's path on the primary
+  const w_string primaryRoot_;
+  const std::chrono::milliseconds connectTimeout_;
+  const std::chrono::milliseconds maxRetryDelay_;
+
+  Pipe terminatePipe_;
+
+  // Only used by the notify thread
+  std::unique_ptr<watchman_stream> stream_;
+  // Encodes our subscribe
+  w_jbuffer_t buffer_;
+  // What the primary sent that isn't decoded yet
+  std::string input_;
+  // Of the last results from the primary, from which a new subscription
+  // resumes
+  json_ref clock_;
+  std::chrono::steady_clock::time_point nextAttempt_;
+  std::chrono::milliseconds retryDelay_{0};
+
+  std::atomic<bool> connected_{false};
+  std::atomic<uint64_t> connects_{0};
+  std::atomic<uint64_t> disconnects_{0};
+  std::atomic<uint64_t> results_{0};
+  std::atomic<uint64_t> files_{0};
+  std::atomic<uint64_t> recrawls_{0};
+};
+
+ReplicaWatcher::ReplicaWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher(
+          "replica",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_WATCHES_PATHS),
+      rootPath_(rootPath),
+      primary_(config.getString("replica_primary", "")),
+      primaryRoot_(config.getString("replica_primary_root", rootPath.c_str())),
+      connectTimeout_(config.getInt("replica_connect_timeout_ms", 5000)),
+      maxRetryDelay_(std::max(
+          json_int_t(1),
+          config.getInt("replica_max_retry_delay_ms", 30000))) {
+  if (primary_.empty()) {
+    throw std::runtime_error(
+        "the replica watcher needs replica_primary to name the host:port of "
+        "the primary's tcp-listener");
+  }
+}
+
+std::unique_ptr<DirHandle> ReplicaWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // The primary watches it
+  return openDir(path);
+}
+
+void ReplicaWatcher::connect() {
+  ++connects_;
+  try {
+    stream_ = w_stm_fdopen(connectTcp(primary_, connectTimeout_));
+  } catch (const std::exception& exc) {
+    stream_.reset();
+    disconnect(exc.what());
+    return;
+  }
+  buffer_.clear();
+  input_.clear();
+
+  auto options = json_object(
+      {{"fields", json_array({typed_string_to_json("name")})},
+       // We crawl for ourselves, and only need to hear about changes
+       {"empty_on_fresh_instance", json_true()}});
+  if (clock_) {
+    options.set("since", json_ref(clock_));
+  }
+  auto cmd = json_array(
+      {typed_string_to_json("subscribe"),
+       w_string_to_json(primaryRoot_),
+       typed_string_to_json(kSubscriptionName),
+       options});
+  if (!buffer_.pduEncodeToStream(is_bser, 0, cmd, stream_.get())) {
+    disconnect("failed to send subscribe");
+    return;
+  }
+  logf(ERR, "replica: subscribed to {} on {}\n", primaryRoot_, primary_);
+  // So that stopThreads isn't kept waiting for a slow primary
+  stream_->setNonBlock(true);
+  connected_ = true;
+}
+
+void ReplicaWatcher::disconnect(const char* why) {
+  if (stream_) {
+    ++disconnects_;
+  }
+  logf(ERR, "replica: lost {}: {}\n", primary_, why);
+  stream_.reset();
+  input_.clear();
+  connected_ = false;
+  retryDelay_ = std::min(
+      maxRetryDelay_,
+      std::max(std::chrono::milliseconds(100), retryDelay_ * 2));
+  nextAttempt_ = std::chrono::steady_clock::now() + retryDelay_;
+}
+
+void ReplicaWatcher::handleResults(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const json_ref& pdu) {
+  if (auto error = pdu.get_default("error")) {
+    disconnect(
+        error.isString() ? json_string_value(error)
+                         : "the primary returned an error");
+    return;
+  }
+  auto name = pdu.get_default("subscription");
+  if (!name || !name.isString() ||
+      json_to_w_string(name) != w_string_piece{kSubscriptionName}) {
+    // The response to subscribe, and the primary's other broadcasts
+    if (pdu.get_default("subscribe")) {
+      retryDelay_ = std::chrono::milliseconds(0);
+    }
+    return;
+  }
+  auto files = pdu.get_default("files");
+  if (!files || !files.isArray()) {
+    // A state transition or cancellation
+    if (pdu.get_default("canceled")) {
+      disconnect("the primary stopped watching the root");
+    }
+    return;
+  }
+  ++results_;
+
+  auto isFresh = pdu.get_default("is_fresh_instance", json_false());
+  if (isFresh.asBool() && clock_) {
+    // The primary can't tell us what changed since our clock
+    ++recrawls_;
+    root->scheduleRecrawl("the primary can't replay its changes");
+  }
+  clock_ = pdu.get_default("clock");
+
+  auto now = std::chrono::system_clock::now();
+  for (auto& file : files.array()) {
+    if (!file.isString()) {
+      continue;
+    }
+    coll.add(
+        w_string::pathCat({rootPath_, json_to_w_string(file)}),
+        now,
+        W_PENDING_VIA_NOTIFY);
+    ++files_;
+  }
+}
+
+Watcher::ConsumeNotifyRet ReplicaWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  if (!stream_) {
+    connect();
+    return {false};
+  }
+
+  // Takes what has arrived; poll wakes us again for the rest
+  auto size = input_.size();
+  input_.resize(size + kReadSize);
+  errno = 0;
+  int r = stream_->read(input_.data() + size, int(kReadSize));
+  input_.resize(size + std::max(r, 0));
+  if (r == 0) {
+    disconnect("connection closed");
+    return {false};
+  }
+  if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    disconnect(folly::errnoStr(errno).c_str());
+    return {false};
+  }
+
+  size_t pos = 0;
+  while (stream_) {
+    size_t consumed = 0;
+    json_ref pdu;
+    try {
+      pdu = decodeBufferedPdu(std::string_view{input_}.substr(pos), consumed);
+    } catch (const std::exception& exc) {
+      disconnect(exc.what());
+      return {false};
+    }
+    if (!pdu) {
+      input_.erase(0, pos);
+      break;
+    }
+    pos += consumed;
+    handleResults(root, coll, pdu);
+  }
+  return {false};
+}
+
+bool ReplicaWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[2];
+  pfd[0].fd = terminatePipe_.read.fd();
+  pfd[0].events = POLLIN;
+  nfds_t nfds = 1;
+  if (stream_) {
+    pfd[1].fd = stream_->getFileDescriptor().fd();
+    pfd[1].events = POLLIN;
+    nfds = 2;
+  } else {
+    // Wake up in time for the next attempt to connect
+    auto untilAttempt =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            nextAttempt_ - std::chrono::steady_clock::now())
+            .count();
+    if (untilAttempt <= 0) {
+      return true;
+    }
+    timeoutms = int(std::min<int64_t>(timeoutms, untilAttempt));
+  }
+
+  int n = poll(pfd, nfds, timeoutms);
+  if (n > 0 && pfd[0].revents) {
+    // We were signalled via stopThreads
+    return false;
+  }
+  if (!stream_) {
+    return std::chrono::steady_clock::now() >= nextAttempt_;
+  }
+  return n > 0 && pfd[1].revents != 0;
+}
+
+void ReplicaWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref ReplicaWatcher::getDebugInfo() {
+  return json_object({
+      {"primary", typed_string_to_json(primary_.c_str())},
+      {"connected", json_boolean(connected_.load())},
+      {"connect_count", json_integer(connects_.load())},
+      {"disconnect_count", json_integer(disconnects_.load())},
+      {"result_count", json_integer(results_.load())},
+      {"file_count", json_integer(files_.load())},
+      {"recrawl_count", json_integer(recrawls_.load())},
+  });
+}
+
+void ReplicaWatcher::clearDebugInfo() {
+  connects_.store(0, std::memory_order_release);
+  disconnects_.store(0, std::memory_order_release);
+  results_.store(0, std::memory_order_release);
+  files_.store(0, std::memory_order_release);
+  recrawls_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectReplica(
+    const w_string& root_path,
+    const w_string& /*fstype*/,
+    const Configuration& config) {
+  // Only makes sense for a tree that another daemon watches
+  if (std::string_view{config.getString("watcher", "auto")} != "replica") {
+    throw std::runtime_error("only used when requested via the watcher option");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<ReplicaWatcher>(root_path, config));
+}
+} // namespace
+
+static WatcherRegistry reg("replica", detectReplica, -2);
+
+#endif
+
+/* vim:ts=2:sw=2:et:
+ */
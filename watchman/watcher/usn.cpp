@@ -0,0 +1,784 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+using namespace watchman;
+
+#ifdef _WIN32
+
+#include <winioctl.h>
+
+namespace {
+
+// The reasons that say something about the name, size, times or existence
+// of an item.  Each record carries every reason accumulated since the item
+// was opened, so the ones that we don't ask for still come along.
+constexpr DWORD kReasonMask = USN_REASON_DATA_OVERWRITE |
+    USN_REASON_DATA_EXTEND | USN_REASON_DATA_TRUNCATION |
+    USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE |
+    USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME |
+    USN_REASON_BASIC_INFO_CHANGE | USN_REASON_HARD_LINK_CHANGE |
+    USN_REASON_REPARSE_POINT_CHANGE;
+
+// The reasons after which the item is no longer at the name in the record
+constexpr DWORD kGoneMask = USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME;
+
+struct Item {
+  w_string path;
+  PendingFlags flags;
+
+  Item(w_string&& path, PendingFlags flags)
+      : path(std::move(path)), flags(flags) {}
+};
+
+/**
+ * The stream position is the id of the journal and the USN up to which the
+ * view has applied its records, followed by the dirs that were tracked at
+ * that point, as their file reference numbers and paths.  The dirs can't be
+ * recovered from the journal, which only names the parent of each record.
+ */
+struct PositionHeader {
+  uint64_t journalId;
+  int64_t usn;
+  uint64_t numDirs;
+};
+
+uint64_t getFileReferenceNumber(const FileDescriptor& handle) {
+  BY_HANDLE_FILE_INFORMATION info;
+  if (!GetFileInformationByHandle((HANDLE)handle.handle(), &info)) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "GetFileInformationByHandle");
+  }
+  return (uint64_t(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+}
+
+} // namespace
+
+/**
+ * Reads the NTFS change journal of the volume that holds the root rather
+ * than watching the root with ReadDirectoryChangesW.  The journal is
+ * persistent, so a root whose view was restored from a snapshot can pick up
+ * where the snapshot was taken instead of crawling again, and its records
+ * are never dropped for want of buffer space, only when the journal wraps.
+ *
+ * The journal covers the whole volume and names each item by its parent's
+ * file reference number (FRN), so, as with fanotify, records are resolved
+ * against the dirs that the crawler has visited and dropped when their
+ * parent isn't one of them.
+ */
+struct UsnJournalWatcher : public Watcher {
+  FileDescriptor rootHandle_;
+  uint64_t rootFrn_;
+  // The volume that holds the root, opened for overlapped journal reads.
+  // Reading the journal of a volume requires administrator rights.
+  FileDescriptor volume_;
+  HANDLE ping_{INVALID_HANDLE_VALUE};
+
+  // Maps the FRN of each dir that the crawler has visited to its path
+  folly::Synchronized<std::unordered_map<uint64_t, w_string>> dirs_;
+
+  struct State {
+    std::list<Item> items;
+    uint64_t journalId{0};
+    // The USN just past the records that produced items
+    USN publishedUsn{0};
+    // Where readJournalThread reads next
+    USN nextUsn{0};
+    // Bumped when resumeFromStreamPosition moves nextUsn, so that the
+    // records of a read that was issued before then are discarded
+    uint64_t generation{0};
+  };
+  std::condition_variable cond_;
+  folly::Synchronized<State, std::mutex> state_;
+
+  // A batch that consumeNotify handed to the view, with the USN just past
+  // its records; the view has applied them once `applied` is ready
+  struct InFlight {
+    USN usn;
+    folly::SemiFuture<folly::Unit> applied;
+  };
+  struct Applied {
+    std::deque<InFlight> inFlight;
+    // The USN up to which the view has applied the records
+    USN usn{0};
+  };
+  folly::Synchronized<Applied, std::mutex> applied_;
+
+  std::atomic<uint64_t> totalRecordsSeen_ = 0;
+  // Records whose parent dir we aren't tracking
+  std::atomic<uint64_t> totalRecordsDropped_ = 0;
+  // Times that the journal was purged past the records we had yet to read
+  std::atomic<uint64_t> totalJournalWraps_ = 0;
+
+  UsnJournalWatcher(const w_string& rootPath, const Configuration& config);
+  ~UsnJournalWatcher() override;
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+  bool start(const std::shared_ptr<Root>& root) override;
+  void stopThreads() override;
+
+  std::string getStreamPosition() override;
+  bool resumeFromStreamPosition(const std::string& position) override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+  void readJournalThread(const std::shared_ptr<Root>& root);
+
+ private:
+  std::optional<USN_JOURNAL_DATA_V0> queryJournal();
+
+  // Moves applied->usn past the batches that the view has applied
+  static void advanceApplied(Applied& applied);
+
+  // Appends the changes described by the records of a completed read to
+  // `items`.  Returns true if the root itself was deleted or renamed.
+  bool parseRecords(
+      const std::shared_ptr<Root>& root,
+      const uint8_t* buf,
+      DWORD bytes,
+      std::list<Item>& items);
+};
+
+UsnJournalWatcher::UsnJournalWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher(
+          "usn",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS | WATCHER_WATCHES_PATHS) {
+  auto wpath = rootPath.piece().asWideUNC();
+
+  WCHAR fsName[MAX_PATH + 1];
+  WCHAR volumePath[MAX_PATH + 1];
+  WCHAR volumeName[MAX_PATH + 1];
+  if (!GetVolumePathNameW(wpath.c_str(), volumePath, MAX_PATH + 1) ||
+      !GetVolumeInformationW(
+          volumePath,
+          nullptr,
+          0,
+          nullptr,
+          nullptr,
+          nullptr,
+          fsName,
+          MAX_PATH + 1) ||
+      !GetVolumeNameForVolumeMountPointW(
+          volumePath, volumeName, MAX_PATH + 1)) {
+    throw std::system_error(
+        GetLastError(),
+        std::system_category(),
+        folly::to<std::string>("resolving the volume of ", rootPath));
+  }
+  if (wcscmp(fsName, L"NTFS") != 0) {
+    throw std::runtime_error(folly::to<std::string>(
+        "the usn watcher requires an NTFS volume, and ",
+        rootPath,
+        " is not on one"));
+  }
+
+  // The volume name ends with a slash, which would open its root dir
+  // rather than the volume
+  auto len = wcslen(volumeName);
+  if (len > 0 && volumeName[len - 1] == L'\\') {
+    volumeName[len - 1] = L'\0';
+  }
+  volume_ = FileDescriptor(
+      intptr_t(CreateFileW(
+          volumeName,
+          GENERIC_READ,
+          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+          nullptr,
+          OPEN_EXISTING,
+          FILE_FLAG_OVERLAPPED,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!volume_) {
+    // Opening a volume requires administrator rights
+    throw std::system_error(
+        GetLastError(),
+        std::system_category(),
+        folly::to<std::string>("opening the volume of ", rootPath));
+  }
+
+  auto journal = queryJournal();
+  if (!journal) {
+    throw std::system_error(
+        GetLastError(),
+        std::system_category(),
+        folly::to<std::string>("FSCTL_QUERY_USN_JOURNAL for ", rootPath));
+  }
+  {
+    auto state = state_.lock();
+    state->journalId = journal->UsnJournalID;
+    state->publishedUsn = journal->NextUsn;
+    state->nextUsn = journal->NextUsn;
+  }
+  // Nothing before this point needs to be read: the crawl will see it
+  applied_.lock()->usn = journal->NextUsn;
+
+  rootHandle_ = openFileHandle(
+      rootPath.c_str(), OpenFileHandleOptions::queryFileInfo());
+  rootFrn_ = getFileReferenceNumber(rootHandle_);
+  {
+    auto wlock = dirs_.wlock();
+    wlock->reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+    wlock->emplace(rootFrn_, rootPath);
+  }
+
+  ping_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!ping_) {
+    throw std::runtime_error(
+        std::string("failed to create event: ") +
+        win32_strerror(GetLastError()));
+  }
+}
+
+UsnJournalWatcher::~UsnJournalWatcher() {
+  if (ping_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(ping_);
+  }
+}
+
+std::optional<USN_JOURNAL_DATA_V0> UsnJournalWatcher::queryJournal() {
+  USN_JOURNAL_DATA_V0 journal;
+  DWORD bytes;
+  OVERLAPPED olap{};
+  olap.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!olap.hEvent) {
+    return std::nullopt;
+  }
+  SCOPE_EXIT {
+    CloseHandle(olap.hEvent);
+  };
+  if (!DeviceIoControl(
+          (HANDLE)volume_.handle(),
+          FSCTL_QUERY_USN_JOURNAL,
+          nullptr,
+          0,
+          &journal,
+          sizeof(journal),
+          nullptr,
+          &olap) &&
+      GetLastError() != ERROR_IO_PENDING) {
+    return std::nullopt;
+  }
+  if (!GetOverlappedResult(
+          (HANDLE)volume_.handle(), &olap, &bytes, TRUE)) {
+    return std::nullopt;
+  }
+  return journal;
+}
+
+void UsnJournalWatcher::stopThreads() {
+  SetEvent(ping_);
+}
+
+std::unique_ptr<DirHandle> UsnJournalWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // Carry out our very strict opendir first to ensure that we're not
+  // traversing symlinks in the context of this root
+  auto osdir = openDir(path);
+
+  auto handle = openFileHandle(path, OpenFileHandleOptions::queryFileInfo());
+  auto frn = getFileReferenceNumber(handle);
+
+  // The dir might have been renamed since we last saw it, so always update
+  (*dirs_.wlock())[frn] = w_string(path, W_STRING_BYTE);
+  return osdir;
+}
+
+bool UsnJournalWatcher::parseRecords(
+    const std::shared_ptr<Root>& root,
+    const uint8_t* buf,
+    DWORD bytes,
+    std::list<Item>& items) {
+  // The buffer starts with the USN to read from next
+  DWORD offset = sizeof(USN);
+  while (offset + offsetof(USN_RECORD_V2, FileName) <= bytes) {
+    auto record = (const USN_RECORD_V2*)(buf + offset);
+    if (record->RecordLength == 0 || offset + record->RecordLength > bytes) {
+      break;
+    }
+    offset += record->RecordLength;
+    // We ask for version 2 records, but don't trust that blindly
+    if (record->MajorVersion != 2) {
+      continue;
+    }
+    ++totalRecordsSeen_;
+
+    auto reason = record->Reason;
+    bool isDir = (record->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if ((reason & kGoneMask) && record->FileReferenceNumber == rootFrn_) {
+      logf(
+          ERR,
+          "root dir {} has been (re)moved, canceling watch\n",
+          root->root_path);
+      return true;
+    }
+
+    w_string dirPath;
+    {
+      auto rlock = dirs_.rlock();
+      auto it = rlock->find(record->ParentFileReferenceNumber);
+      if (it != rlock->end()) {
+        dirPath = it->second;
+      }
+    }
+    if (isDir && (reason & kGoneMask)) {
+      // The crawler records it again under its new name, if it has one
+      dirs_.wlock()->erase(record->FileReferenceNumber);
+    }
+    if (!dirPath) {
+      ++totalRecordsDropped_;
+      continue;
+    }
+
+    // FileNameLength is in BYTES, but the name is WCHAR
+    w_string name(
+        (const WCHAR*)((const uint8_t*)record + record->FileNameOffset),
+        record->FileNameLength / sizeof(WCHAR));
+    auto full = w_string::pathCat({dirPath, name});
+    if (root->ignore.isIgnored(full.data(), full.size())) {
+      continue;
+    }
+
+    // As for ReadDirectoryChangesW, a delete or rename may be part of a
+    // recursive one, and a dir that appears under a new name brings its
+    // contents along
+    bool recursive = (reason & (kGoneMask | USN_REASON_RENAME_NEW_NAME)) ||
+        (isDir && (reason & USN_REASON_FILE_CREATE));
+    items.emplace_back(
+        std::move(full), recursive ? W_PENDING_RECURSIVE : PendingFlags{});
+  }
+  return false;
+}
+
+void UsnJournalWatcher::readJournalThread(const std::shared_ptr<Root>& root) {
+  w_set_thread_name("usnjournal ", root->root_path.view());
+  logf(DBG, "initializing\n");
+
+  // See readChangesThread in win32.cpp
+  auto extraLatency = root->config.getInt("win32_batch_latency_ms", 30);
+  std::vector<uint8_t> buf(std::max(
+      size_t(root->config.getInt("usn_read_buffer_size", 64 * 1024)),
+      sizeof(USN) + sizeof(USN_RECORD_V2) + MAX_PATH * sizeof(WCHAR)));
+
+  OVERLAPPED olap{};
+  olap.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+  if (!olap.hEvent) {
+    logf(ERR, "failed to create event: {}\n", win32_strerror(GetLastError()));
+    root->cancel();
+    return;
+  }
+  SCOPE_EXIT {
+    CloseHandle(olap.hEvent);
+  };
+
+  // The request is read by the kernel while the read is outstanding
+  READ_USN_JOURNAL_DATA_V0 request{};
+  request.ReasonMask = kReasonMask;
+  request.ReturnOnlyOnClose = FALSE;
+  request.Timeout = 0;
+  // Complete as soon as there is a record
+  request.BytesToWaitFor = 1;
+
+  bool outstanding = false;
+  DWORD bytes;
+  uint64_t generation = 0;
+  std::list<Item> items;
+  USN itemsUsn = 0;
+
+  // The kernel may still write into the buffer of an outstanding read, so
+  // it must be cancelled and reaped before the buffer is released
+  SCOPE_EXIT {
+    if (outstanding) {
+      CancelIoEx((HANDLE)volume_.handle(), &olap);
+      GetOverlappedResult((HANDLE)volume_.handle(), &olap, &bytes, TRUE);
+    }
+  };
+
+  auto issueRead = [&] {
+    {
+      auto state = state_.lock();
+      if (state->generation != generation) {
+        // resumeFromStreamPosition has moved us back; what we have is
+        // going to be read again
+        items.clear();
+        itemsUsn = state->nextUsn;
+        generation = state->generation;
+      }
+      request.StartUsn = state->nextUsn;
+      request.UsnJournalID = state->journalId;
+    }
+    ResetEvent(olap.hEvent);
+    outstanding = DeviceIoControl(
+        (HANDLE)volume_.handle(),
+        FSCTL_READ_USN_JOURNAL,
+        &request,
+        sizeof(request),
+        buf.data(),
+        (DWORD)buf.size(),
+        nullptr,
+        &olap);
+    if (!outstanding && GetLastError() == ERROR_IO_PENDING) {
+      outstanding = true;
+    }
+    return outstanding;
+  };
+
+  // When the records that we were due to read have gone, or the journal
+  // has been replaced, carries on from its end and recrawls to make up for
+  // whatever was missed.  Returns false if the read can't go on.
+  auto handleReadError = [&](DWORD err) {
+    if (err == ERROR_OPERATION_ABORTED) {
+      // Cancelled by resumeFromStreamPosition
+      return true;
+    }
+    if (err != ERROR_JOURNAL_ENTRY_DELETED &&
+        err != ERROR_JOURNAL_NOT_ACTIVE &&
+        err != ERROR_JOURNAL_DELETE_IN_PROGRESS &&
+        err != ERROR_INVALID_PARAMETER) {
+      logf(
+          ERR,
+          "FSCTL_READ_USN_JOURNAL({}) failed, cancel watch. {}\n",
+          root->root_path,
+          win32_strerror(err));
+      return false;
+    }
+    auto journal = queryJournal();
+    auto state = state_.lock();
+    if (!journal ||
+        (err != ERROR_JOURNAL_ENTRY_DELETED &&
+         journal->UsnJournalID == state->journalId)) {
+      // A journal that is still there with the same id was not the reason
+      logf(
+          ERR,
+          "FSCTL_READ_USN_JOURNAL({}) failed, cancel watch. {}\n",
+          root->root_path,
+          win32_strerror(err));
+      return false;
+    }
+    state->journalId = journal->UsnJournalID;
+    state->nextUsn = journal->NextUsn;
+    // A new journal numbers its records afresh
+    state->publishedUsn = journal->NextUsn;
+    itemsUsn = journal->NextUsn;
+    state.unlock();
+    {
+      auto applied = applied_.lock();
+      applied->inFlight.clear();
+      applied->usn = journal->NextUsn;
+    }
+
+    ++totalJournalWraps_;
+    root->scheduleRecrawl(
+        err == ERROR_JOURNAL_ENTRY_DELETED ? "USN journal wrapped"
+                                           : "USN journal replaced");
+    return true;
+  };
+
+  // Block until start is waiting for our initialization
+  {
+    auto wlock = state_.lock();
+    itemsUsn = wlock->publishedUsn;
+    cond_.notify_one();
+  }
+
+  while (!root->inner.cancelled) {
+    if (!outstanding && !issueRead()) {
+      if (handleReadError(GetLastError())) {
+        continue;
+      }
+      root->cancel();
+      break;
+    }
+
+    HANDLE handles[2] = {olap.hEvent, ping_};
+    DWORD status = WaitForMultipleObjects(
+        2, handles, FALSE, items.empty() ? 10000 : extraLatency);
+
+    if (status == WAIT_OBJECT_0) {
+      outstanding = false;
+      bytes = 0;
+      if (!GetOverlappedResult(
+              (HANDLE)volume_.handle(), &olap, &bytes, FALSE)) {
+        if (handleReadError(GetLastError())) {
+          continue;
+        }
+        root->cancel();
+        break;
+      }
+      if (bytes < sizeof(USN)) {
+        continue;
+      }
+      USN next;
+      memcpy(&next, buf.data(), sizeof(next));
+
+      auto state = state_.lock();
+      if (state->generation != generation) {
+        continue;
+      }
+      state->nextUsn = next;
+      state.unlock();
+
+      if (parseRecords(root, buf.data(), bytes, items)) {
+        root->cancel();
+        break;
+      }
+      itemsUsn = next;
+    } else if (status == WAIT_OBJECT_0 + 1) {
+      logf(ERR, "signalled\n");
+      break;
+    } else if (status == WAIT_TIMEOUT) {
+      auto state = state_.lock();
+      if (state->generation != generation) {
+        items.clear();
+        continue;
+      }
+      if (itemsUsn > state->publishedUsn) {
+        state->items.splice(state->items.end(), items);
+        state->publishedUsn = itemsUsn;
+        cond_.notify_one();
+      }
+    } else {
+      logf(ERR, "impossible wait status={}\n", status);
+      break;
+    }
+  }
+
+  logf(DBG, "done\n");
+}
+
+bool UsnJournalWatcher::start(const std::shared_ptr<Root>& root) {
+  try {
+    // Acquire the mutex so thread initialization waits until we release it
+    auto wlock = state_.lock();
+
+    auto self = std::dynamic_pointer_cast<UsnJournalWatcher>(
+        shared_from_this());
+    std::thread thread([self, root]() noexcept {
+      try {
+        self->readJournalThread(root);
+      } catch (const std::exception& e) {
+        log(ERR, "uncaught exception: ", e.what());
+        root->cancel();
+      }
+
+      // Ensure that we don't leave start waiting
+      auto wlock = self->state_.lock();
+      self->cond_.notify_one();
+    });
+    // The thread may hold the last reference to the watcher
+    thread.detach();
+
+    if (cond_.wait_for(wlock.as_lock(), std::chrono::seconds(10)) ==
+        std::cv_status::timeout) {
+      log(ERR, "timedout waiting for readJournalThread to start\n");
+      root->cancel();
+      return false;
+    }
+    return !root->inner.cancelled;
+  } catch (const std::exception& e) {
+    logf(ERR, "failed to start readJournalThread: {}\n", e.what());
+    return false;
+  }
+}
+
+Watcher::ConsumeNotifyRet UsnJournalWatcher::consumeNotify(
+    const std::shared_ptr<Root>&,
+    PendingChanges& coll) {
+  std::list<Item> items;
+  USN usn;
+  {
+    auto state = state_.lock();
+    std::swap(items, state->items);
+    usn = state->publishedUsn;
+  }
+
+  auto now = std::chrono::system_clock::now();
+  for (auto& item : items) {
+    coll.add(item.path, now, W_PENDING_VIA_NOTIFY | item.flags);
+  }
+
+  if (!items.empty()) {
+    // Resolved once the view has applied these items, which is when the
+    // stream position may move past them
+    auto [promise, future] = folly::makePromiseContract<folly::Unit>();
+    coll.addSync(std::move(promise));
+    auto applied = applied_.lock();
+    advanceApplied(*applied);
+    applied->inFlight.push_back({usn, std::move(future)});
+  } else {
+    // The records since the last batch were all outside of the root
+    auto applied = applied_.lock();
+    advanceApplied(*applied);
+    if (applied->inFlight.empty()) {
+      applied->usn = std::max(applied->usn, usn);
+    }
+  }
+
+  // The readJournalThread cancels itself.
+  return {false};
+}
+
+bool UsnJournalWatcher::waitNotify(int timeoutms) {
+  auto wlock = state_.lock();
+  if (!wlock->items.empty()) {
+    return true;
+  }
+  cond_.wait_for(wlock.as_lock(), std::chrono::milliseconds(timeoutms));
+  return !wlock->items.empty();
+}
+
+void UsnJournalWatcher::advanceApplied(Applied& applied) {
+  while (!applied.inFlight.empty() &&
+         applied.inFlight.front().applied.isReady()) {
+    auto& front = applied.inFlight.front();
+    if (front.applied.hasValue()) {
+      applied.usn = std::max(applied.usn, front.usn);
+    }
+    applied.inFlight.pop_front();
+  }
+}
+
+std::string UsnJournalWatcher::getStreamPosition() {
+  PositionHeader header;
+  {
+    auto applied = applied_.lock();
+    advanceApplied(*applied);
+    header.usn = applied->usn;
+  }
+  header.journalId = state_.lock()->journalId;
+
+  auto dirs = dirs_.rlock();
+  header.numDirs = dirs->size();
+  std::string position(
+      reinterpret_cast<const char*>(&header), sizeof(header));
+  for (auto& [frn, path] : *dirs) {
+    uint32_t len = path.size();
+    position.append(reinterpret_cast<const char*>(&frn), sizeof(frn));
+    position.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    position.append(path.data(), len);
+  }
+  return position;
+}
+
+bool UsnJournalWatcher::resumeFromStreamPosition(const std::string& position) {
+  PositionHeader header;
+  if (position.size() < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, position.data(), sizeof(header));
+
+  std::unordered_map<uint64_t, w_string> dirs;
+  dirs.reserve(header.numDirs);
+  size_t offset = sizeof(header);
+  for (uint64_t i = 0; i < header.numDirs; ++i) {
+    uint64_t frn;
+    uint32_t len;
+    if (position.size() - offset < sizeof(frn) + sizeof(len)) {
+      return false;
+    }
+    memcpy(&frn, position.data() + offset, sizeof(frn));
+    memcpy(&len, position.data() + offset + sizeof(frn), sizeof(len));
+    offset += sizeof(frn) + sizeof(len);
+    if (position.size() - offset < len) {
+      return false;
+    }
+    dirs.emplace(frn, w_string(position.data() + offset, len, W_STRING_BYTE));
+    offset += len;
+  }
+
+  auto journal = queryJournal();
+  if (!journal || journal->UsnJournalID != header.journalId ||
+      header.usn < journal->FirstUsn || header.usn > journal->NextUsn) {
+    logf(
+        ERR,
+        "USN journal no longer holds the changes since the view snapshot, "
+        "crawling instead\n");
+    return false;
+  }
+  // The root may have been replaced since
+  auto rootDir = dirs.find(rootFrn_);
+  if (rootDir == dirs.end()) {
+    return false;
+  }
+
+  *dirs_.wlock() = std::move(dirs);
+  {
+    auto applied = applied_.lock();
+    applied->inFlight.clear();
+    applied->usn = header.usn;
+  }
+  {
+    auto state = state_.lock();
+    state->items.clear();
+    state->journalId = header.journalId;
+    state->publishedUsn = header.usn;
+    state->nextUsn = header.usn;
+    ++state->generation;
+  }
+  // Wake readJournalThread, which is waiting on a read from the end of the
+  // journal, so that it goes back to the snapshot's position
+  CancelIoEx((HANDLE)volume_.handle(), nullptr);
+  return true;
+}
+
+json_ref UsnJournalWatcher::getDebugInfo() {
+  auto state = state_.lock();
+  return json_object({
+      {"total_record_count", json_integer(totalRecordsSeen_.load())},
+      {"dropped_record_count", json_integer(totalRecordsDropped_.load())},
+      {"journal_wrap_count", json_integer(totalJournalWraps_.load())},
+      {"tracked_dir_count", json_integer(dirs_.rlock()->size())},
+      {"journal_id", json_integer(json_int_t(state->journalId))},
+      {"next_usn", json_integer(state->nextUsn)},
+  });
+}
+
+void UsnJournalWatcher::clearDebugInfo() {
+  totalRecordsSeen_.store(0, std::memory_order_release);
+  totalRecordsDropped_.store(0, std::memory_order_release);
+  totalJournalWraps_.store(0, std::memory_order_release);
+}
+
+// Requires administrator rights, so it's only used when requested via the
+// watcher config option.
+static RegisterWatcher<UsnJournalWatcher> reg("usn", -1);
+
+#endif // _WIN32
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
 #include <folly/Synchronized.h>
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
@@ -17,7 +18,10 @@
 #include <iterator>
 #include <list>
 #include <mutex>
+#include <optional>
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
 
 using watchman::FileDescriptor;
 using namespace watchman;
@@ -26,6 +30,11 @@ using namespace watchman;
 
 #define NETWORK_BUF_SIZE (64 * 1024)
 
+// FILE_NOTIFY_EXTENDED_INFORMATION was introduced in Windows 10 1709
+#if defined(NTDDI_WIN10_RS3) && NTDDI_VERSION >= NTDDI_WIN10_RS3
+#define HAVE_RDCW_EX 1
+#endif
+
 namespace {
 
 struct Item {
@@ -36,14 +45,146 @@ struct Item {
       : path(std::move(path)), flags(flags) {}
 };
 
+// The metadata reported for each path since the last batch was published.
+// nullopt means that the path needs to be stat'ed after all.
+using NotifiedStats =
+    std::unordered_map<w_string, std::optional<FileInformation>>;
+
+/**
+ * One of the ReadDirectoryChanges requests that readChangesThread keeps
+ * outstanding.  With more than one, there is always a request that the
+ * kernel can complete while we're busy with the results of another, rather
+ * than leaving it to accumulate changes in its own buffer until we ask again.
+ */
+struct DirectoryRead {
+  std::vector<uint8_t> buf;
+  OVERLAPPED olap;
+  bool outstanding{false};
+
+  explicit DirectoryRead(DWORD size) : buf(size), olap(OVERLAPPED()) {
+    olap.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!olap.hEvent) {
+      throw std::runtime_error(
+          std::string("failed to create event: ") +
+          win32_strerror(GetLastError()));
+    }
+  }
+
+  DirectoryRead(const DirectoryRead&) = delete;
+  DirectoryRead& operator=(const DirectoryRead&) = delete;
+
+  ~DirectoryRead() {
+    CloseHandle(olap.hEvent);
+  }
+};
+
+#ifdef HAVE_RDCW_EX
+using read_directory_changes_ex_func = BOOL(WINAPI*)(
+    HANDLE,
+    LPVOID,
+    DWORD,
+    BOOL,
+    DWORD,
+    LPDWORD,
+    LPOVERLAPPED,
+    LPOVERLAPPED_COMPLETION_ROUTINE,
+    READ_DIRECTORY_NOTIFY_INFORMATION_CLASS);
+
+// Returns nullptr if this version of Windows doesn't have it
+read_directory_changes_ex_func getReadDirectoryChangesEx() {
+  return (read_directory_changes_ex_func)GetProcAddress(
+      GetModuleHandle("kernel32.dll"), "ReadDirectoryChangesExW");
+}
+
+// Mirrors what FileDescriptor::getInfo reports for the same item
+FileInformation statFromNotification(
+    const FILE_NOTIFY_EXTENDED_INFORMATION& notify) {
+  FileInformation st(notify.FileAttributes);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.CreationTime, &st.ctime);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.LastAccessTime, &st.atime);
+  FILETIME_LARGE_INTEGER_to_timespec(notify.LastModificationTime, &st.mtime);
+  st.size = notify.FileSize.QuadPart;
+  return st;
+}
+#endif
+
+/**
+ * Appends the changes described by a completed read to `items`, and their
+ * metadata to `stats` when the notifications carry it.
+ */
+template <typename Notify>
+void parseNotifications(
+    const std::shared_ptr<Root>& root,
+    const uint8_t* buf,
+    std::list<Item>& items,
+    NotifiedStats& stats) {
+  auto notify = (const Notify*)buf;
+
+  while (true) {
+    DWORD n_chars;
+
+    // FileNameLength is in BYTES, but FileName is WCHAR
+    n_chars = notify->FileNameLength / sizeof(notify->FileName[0]);
+    w_string name(notify->FileName, n_chars);
+
+    auto full = w_string::pathCat({root->root_path, name});
+
+    if (!root->ignore.isIgnored(full.data(), full.size())) {
+      bool recursive =
+          (notify->Action &
+           (FILE_ACTION_REMOVED | FILE_ACTION_RENAMED_OLD_NAME)) != 0;
+
+#ifdef HAVE_RDCW_EX
+      if constexpr (std::is_same_v<Notify, FILE_NOTIFY_EXTENDED_INFORMATION>) {
+        // On a case insensitive volume, the name that a change is reported
+        // under need not be the one that is on disk, which
+        // getFileInformation would have verified.  The name that an item
+        // was created or renamed with is the one on disk.
+        bool nameIsCanonical =
+            root->case_sensitive == CaseSensitivity::CaseSensitive ||
+            notify->Action == FILE_ACTION_ADDED ||
+            notify->Action == FILE_ACTION_RENAMED_NEW_NAME;
+        if (notify->Action != FILE_ACTION_REMOVED &&
+            notify->Action != FILE_ACTION_RENAMED_OLD_NAME && nameIsCanonical) {
+          stats[full] = statFromNotification(*notify);
+        } else {
+          stats[full] = std::nullopt;
+        }
+      }
+#endif
+
+      // If we have a delete or rename-away it may be part of
+      // a recursive tree remove or rename.  In that situation
+      // the notifications that we'll receive from the OS will
+      // be from the leaves and bubble up to the root of the
+      // delete/rename.  We want to flag those paths for recursive
+      // analysis so that we can prune children from the trie
+      // that is built when we pass this to the pending list
+      // later.  We don't do that here in this thread because
+      // we're trying to minimize latency in this context.
+      items.emplace_back(
+          std::move(full), recursive ? W_PENDING_RECURSIVE : PendingFlags{});
+    }
+
+    // Advance to next item
+    if (notify->NextEntryOffset == 0) {
+      break;
+    }
+    notify = (const Notify*)(notify->NextEntryOffset + (const char*)notify);
+  }
+}
+
 } // namespace
 
 struct WinWatcher : public Watcher {
-  HANDLE ping{INVALID_HANDLE_VALUE}, olapEvent{INVALID_HANDLE_VALUE};
+  HANDLE ping{INVALID_HANDLE_VALUE};
   FileDescriptor dir_handle;
 
   std::condition_variable cond;
   folly::Synchronized<std::list<Item>, std::mutex> changedItems;
+  // Published along with changedItems; see takeNotifiedStats
+  folly::Synchronized<std::unordered_map<w_string, FileInformation>, std::mutex>
+      notifiedStats;
 
   explicit WinWatcher(const w_string& root_path, const Configuration& config);
   ~WinWatcher();
@@ -57,10 +198,15 @@ struct WinWatcher : public Watcher {
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) override;
 
+  std::unordered_map<w_string, FileInformation> takeNotifiedStats() override;
+
   bool waitNotify(int timeoutms) override;
   bool start(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void readChangesThread(const std::shared_ptr<Root>& root);
+
+ private:
+  void publish(std::list<Item>& items, NotifiedStats& stats);
 };
 
 WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
@@ -92,33 +238,39 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
         std::string("failed to create event: ") +
         win32_strerror(GetLastError()));
   }
-  olapEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-  if (!olapEvent) {
-    throw std::runtime_error(
-        std::string("failed to create event: ") +
-        win32_strerror(GetLastError()));
-  }
 }
 
 WinWatcher::~WinWatcher() {
   if (ping != INVALID_HANDLE_VALUE) {
     CloseHandle(ping);
   }
-  if (olapEvent != INVALID_HANDLE_VALUE) {
-    CloseHandle(olapEvent);
-  }
 }
 
 void WinWatcher::stopThreads() {
   SetEvent(ping);
 }
 
+void WinWatcher::publish(std::list<Item>& items, NotifiedStats& stats) {
+  // The stats must be in place before consumeNotify can see the items
+  {
+    auto wlock = notifiedStats.lock();
+    for (auto& [path, st] : stats) {
+      if (st) {
+        (*wlock)[path] = *st;
+      } else {
+        wlock->erase(path);
+      }
+    }
+  }
+  stats.clear();
+
+  auto wlock = changedItems.lock();
+  wlock->splice(wlock->end(), items);
+  cond.notify_one();
+}
+
 void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
-  std::vector<uint8_t> buf;
   DWORD err, filter;
-  auto olap = OVERLAPPED();
-  BOOL initiate_read = true;
-  HANDLE handles[2] = {olapEvent, ping};
   DWORD bytes;
 
   w_set_thread_name("readchange ", root->root_path.view());
@@ -131,35 +283,94 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
   auto extraLatency = root->config.getInt("win32_batch_latency_ms", 30);
 
   DWORD size = root->config.getInt("win32_rdcw_buf_size", 16384);
+  size_t numReads = std::max(
+      json_int_t(1), root->config.getInt("win32_rdcw_num_buffers", 1));
+
+#ifdef HAVE_RDCW_EX
+  read_directory_changes_ex_func readChangesEx = nullptr;
+  if (root->config.getBool("win32_rdcw_extended_info", false)) {
+    readChangesEx = getReadDirectoryChangesEx();
+    if (!readChangesEx) {
+      logf(
+          ERR,
+          "ReadDirectoryChangesExW is not available, "
+          "using ReadDirectoryChangesW\n");
+    }
+  }
+#endif
 
-  // Block until winmatch_root_st is waiting for our initialization
-  {
-    auto wlock = changedItems.lock();
-
-    filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
-        FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
-        FILE_NOTIFY_CHANGE_LAST_WRITE;
-
-    olap.hEvent = olapEvent;
-
-    buf.resize(size);
+  filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+      FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+      FILE_NOTIFY_CHANGE_LAST_WRITE;
 
-    if (!ReadDirectoryChangesW(
-            (HANDLE)dir_handle.handle(),
-            &buf[0],
-            size,
-            TRUE,
-            filter,
-            nullptr,
-            &olap,
-            nullptr)) {
+  // Completed in the order they were issued, so the oldest, at `head`, is
+  // the one to wait for
+  std::vector<std::unique_ptr<DirectoryRead>> reads;
+  for (size_t i = 0; i < numReads; ++i) {
+    reads.push_back(std::make_unique<DirectoryRead>(size));
+  }
+  size_t head = 0;
+
+  auto issueRead = [&](DirectoryRead& read) {
+    ResetEvent(read.olap.hEvent);
+    BOOL ok;
+#ifdef HAVE_RDCW_EX
+    if (readChangesEx) {
+      ok = readChangesEx(
+          (HANDLE)dir_handle.handle(),
+          read.buf.data(),
+          (DWORD)read.buf.size(),
+          TRUE,
+          filter,
+          nullptr,
+          &read.olap,
+          nullptr,
+          ReadDirectoryNotifyExtendedInformation);
+    } else
+#endif
+    {
+      ok = ReadDirectoryChangesW(
+          (HANDLE)dir_handle.handle(),
+          read.buf.data(),
+          (DWORD)read.buf.size(),
+          TRUE,
+          filter,
+          nullptr,
+          &read.olap,
+          nullptr);
+    }
+    read.outstanding = ok;
+    if (!ok) {
       err = GetLastError();
       logf(
           ERR,
           "ReadDirectoryChangesW: failed, cancel watch. {}\n",
           win32_strerror(err));
       root->cancel();
-      return;
+    }
+    return ok;
+  };
+
+  // The kernel may still write into the buffers of outstanding reads, so
+  // they must be cancelled and reaped before the buffers are released
+  SCOPE_EXIT {
+    for (auto& read : reads) {
+      if (read->outstanding) {
+        CancelIoEx((HANDLE)dir_handle.handle(), &read->olap);
+        GetOverlappedResult(
+            (HANDLE)dir_handle.handle(), &read->olap, &bytes, TRUE);
+      }
+    }
+  };
+
+  // Block until winmatch_root_st is waiting for our initialization
+  {
+    auto wlock = changedItems.lock();
+
+    for (auto& read : reads) {
+      if (!issueRead(*read)) {
+        return;
+      }
     }
     // Signal that we are done with init.  We MUST do this AFTER our first
     // successful ReadDirectoryChangesW, otherwise there is a race condition
@@ -168,34 +379,18 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     logf(DBG, "ReadDirectoryChangesW signalling as init done\n");
     cond.notify_one();
   }
-  initiate_read = false;
 
   std::list<Item> items;
+  NotifiedStats stats;
 
   // The mutex must not be held when we enter the loop
   while (!root->inner.cancelled) {
-    if (initiate_read) {
-      if (!ReadDirectoryChangesW(
-              (HANDLE)dir_handle.handle(),
-              &buf[0],
-              size,
-              TRUE,
-              filter,
-              nullptr,
-              &olap,
-              nullptr)) {
-        err = GetLastError();
-        logf(
-            ERR,
-            "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-            win32_strerror(err));
-        root->cancel();
-        break;
-      } else {
-        initiate_read = false;
-      }
+    auto& read = *reads[head];
+    if (!read.outstanding && !issueRead(read)) {
+      break;
     }
 
+    HANDLE handles[2] = {read.olap.hEvent, ping};
     watchman::log(watchman::DBG, "waiting for change notifications\n");
     DWORD status = WaitForMultipleObjects(
         2,
@@ -212,8 +407,9 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
 
     if (status == WAIT_OBJECT_0) {
       bytes = 0;
+      read.outstanding = false;
       if (!GetOverlappedResult(
-              (HANDLE)dir_handle.handle(), &olap, &bytes, FALSE)) {
+              (HANDLE)dir_handle.handle(), &read.olap, &bytes, FALSE)) {
         err = GetLastError();
         logf(
             ERR,
@@ -222,7 +418,8 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
             err,
             win32_strerror(err));
 
-        if (err == ERROR_INVALID_PARAMETER && size > NETWORK_BUF_SIZE) {
+        if (err == ERROR_INVALID_PARAMETER &&
+            read.buf.size() > NETWORK_BUF_SIZE) {
           // May be a network buffer related size issue; the docs say that
           // we can hit this when watching a UNC path. Let's downsize and
           // retry the read just one time
@@ -231,8 +428,7 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
               "retrying watch for possible network location {} "
               "with smaller buffer\n",
               root->root_path);
-          size = NETWORK_BUF_SIZE;
-          initiate_read = true;
+          read.buf.resize(NETWORK_BUF_SIZE);
           continue;
         }
 
@@ -243,47 +439,27 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
           root->cancel();
           break;
         }
+      } else if (bytes == 0) {
+        // The notifications didn't fit in the buffer and were discarded
+        root->scheduleRecrawl("ReadDirectoryChangesW buffer overflow");
       } else {
-        PFILE_NOTIFY_INFORMATION notify = (PFILE_NOTIFY_INFORMATION)buf.data();
-
-        while (true) {
-          DWORD n_chars;
-
-          // FileNameLength is in BYTES, but FileName is WCHAR
-          n_chars = notify->FileNameLength / sizeof(notify->FileName[0]);
-          w_string name(notify->FileName, n_chars);
-
-          auto full = w_string::pathCat({root->root_path, name});
-
-          if (!root->ignore.isIgnored(full.data(), full.size())) {
-            // If we have a delete or rename-away it may be part of
-            // a recursive tree remove or rename.  In that situation
-            // the notifications that we'll receive from the OS will
-            // be from the leaves and bubble up to the root of the
-            // delete/rename.  We want to flag those paths for recursive
-            // analysis so that we can prune children from the trie
-            // that is built when we pass this to the pending list
-            // later.  We don't do that here in this thread because
-            // we're trying to minimize latency in this context.
-            items.emplace_back(
-                std::move(full),
-                (notify->Action &
-                 (FILE_ACTION_REMOVED | FILE_ACTION_RENAMED_OLD_NAME)) != 0
-                    ? W_PENDING_RECURSIVE
-                    : 0);
-          }
-
-          // Advance to next item
-          if (notify->NextEntryOffset == 0) {
-            break;
-          }
-          notify =
-              (PFILE_NOTIFY_INFORMATION)(notify->NextEntryOffset + (char*)notify);
+#ifdef HAVE_RDCW_EX
+        if (readChangesEx) {
+          parseNotifications<FILE_NOTIFY_EXTENDED_INFORMATION>(
+              root, read.buf.data(), items, stats);
+        } else
+#endif
+        {
+          parseNotifications<FILE_NOTIFY_INFORMATION>(
+              root, read.buf.data(), items, stats);
         }
+      }
 
-        ResetEvent(olapEvent);
-        initiate_read = true;
+      // Queue this read up behind the others again
+      if (!issueRead(read)) {
+        break;
       }
+      head = (head + 1) % reads.size();
     } else if (status == WAIT_OBJECT_0 + 1) {
       logf(ERR, "signalled\n");
       break;
@@ -294,9 +470,7 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
             "timed out waiting for changes, and we have ",
             items.size(),
             " items; move and notify\n");
-        auto wlock = changedItems.lock();
-        wlock->splice(wlock->end(), items);
-        cond.notify_one();
+        publish(items, stats);
       }
     } else {
       logf(ERR, "impossible wait status={}\n", status);
@@ -392,6 +566,12 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
   return {false};
 }
 
+std::unordered_map<w_string, FileInformation> WinWatcher::takeNotifiedStats() {
+  std::unordered_map<w_string, FileInformation> stats;
+  std::swap(stats, *notifiedStats.lock());
+  return stats;
+}
+
 bool WinWatcher::waitNotify(int timeoutms) {
   auto wlock = changedItems.lock();
   if (!wlock->empty()) {
@@ -7,13 +7,19 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include <atomic>
+#include <chrono>
 #include <deque>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include "watchman/Clock.h"
 #include "watchman/Logging.h"
 #include "watchman/PDU.h"
 #include "watchman/PerfSample.h"
+#include "watchman/SubscriptionDeltas.h"
+#include "watchman/SubscriptionDispatcher.h"
+#include "watchman/query/RelevanceFilter.h"
 #include "watchman/watchman_stream.h"
 
 struct watchman_client_subscription;
@@ -41,8 +47,29 @@ struct watchman_client : public std::enable_shared_from_this<watchman_client> {
   json_ref current_command;
   watchman::PerfSample* perf_sample{nullptr};
 
+  struct QueuedResponse {
+    json_ref response;
+    // Set for log payloads, which are broadcast to many clients.  They are
+    // sent using the encodings that the item keeps for its clients.
+    std::shared_ptr<const watchman::Publisher::Item> broadcast;
+  };
+
   // Queue of things to send to the client.
-  std::deque<json_ref> responses;
+  std::deque<QueuedResponse> responses;
+  // The approximate size of the queued responses once encoded; see
+  // approximateResponseSize().  Maintained by enqueueResponse() and
+  // sendQueuedResponses().
+  std::atomic<size_t> responsesBytes{0};
+  // The most responses that sendQueuedResponses() encodes into the writer's
+  // buffer before writing it out; see client_write_batch_size.
+  const size_t writeBatchSize;
+  // BSER v2 responses whose approximate size reaches this are compressed
+  // for clients that accept compressed PDUs; see
+  // bser_compression_threshold_bytes.
+  const size_t compressionThresholdBytes;
+  // BSER v2 responses whose approximate size reaches this are sent in shared
+  // memory to clients that accept it; see shared_memory_threshold_bytes.
+  const size_t sharedMemoryThresholdBytes;
 
   // Logging Subscriptions
   std::shared_ptr<watchman::Publisher::Subscriber> debugSub;
@@ -53,8 +80,38 @@ struct watchman_client : public std::enable_shared_from_this<watchman_client> {
   virtual ~watchman_client();
 
   void enqueueResponse(json_ref&& resp, bool ping = true);
+  // Queues the payload of a published item that is sent to many clients
+  void enqueueBroadcast(
+      std::shared_ptr<const watchman::Publisher::Item> item,
+      bool ping = true);
+
+  /**
+   * Writes the queued responses to the client, blocking until they have
+   * been sent.  Normally called once the current command has completed,
+   * but commands that stream their output may call it sooner.
+   * Returns false if the client could not be written to.
+   */
+  bool sendQueuedResponses();
+
+  /**
+   * Returns true if the client has closed its connection, so that a
+   * command can stop work whose results nobody will read.  Doesn't block.
+   */
+  bool hasHungUp() const {
+    return stm && !client_mode && stm->peerHasHungUp();
+  }
+
+ protected:
+  // Called after sendQueuedResponses has written resp.
+  virtual void responseSent(const json_ref& /*resp*/) {}
+  // Called when sendQueuedResponses could not write to the client.
+  virtual void writeFailed() {}
 };
 
+// Returns a cheap estimate of the number of bytes that resp encodes to,
+// which is dominated by the files of query and subscription results.
+size_t approximateResponseSize(const json_ref& resp);
+
 struct watchman_user_client;
 
 enum class OnStateTransition { QueryAnyway, DontAdvance };
@@ -75,20 +132,74 @@ struct watchman_client_subscription
   bool debug_paused = false;
 
   std::shared_ptr<Query> query;
+  // Subscriptions of a client that name the same group have their results
+  // delivered together; empty if this one isn't in a group
+  w_string group;
   bool vcs_defer;
+  // Which of the subscriptions whose roots settle together are evaluated
+  // first; see SubscriptionDispatcher
+  watchman::SubscriptionDispatcher::Priority priority{
+      watchman::SubscriptionDispatcher::Priority::Normal};
+  // A moving average of how long the query takes to run, by which the
+  // subscriptions of the same priority are ordered.  Only touched by the
+  // client's thread.
+  std::chrono::microseconds queryCost{0};
+  // Set if the client asked for delta_fields: what it was last sent of
+  // each file, so that only the fields that changed since are sent
+  std::unique_ptr<watchman::SubscriptionDeltas> deltas;
+  // Set if the subscription may be resumed by another connection after
+  // its client disconnects, and for how long; see SubscriptionSessions
+  w_string resumeToken;
+  std::chrono::seconds resumeGrace{0};
+  // The clock of the last results that were written to the client, from
+  // which a resumed subscription continues
+  json_ref deliveredClock;
   uint32_t last_sub_tick{0};
   // map of statename => bool.  If true, policy is drop, else defer
   std::unordered_map<w_string, bool> drop_or_defer;
+  // The states in drop_or_defer that are asserted on the root, as of the
+  // state-enter and state-leave broadcasts that the client has processed.
+  // Kept up to date as they arrive so that settles needn't consult the
+  // root's asserted states.
+  std::unordered_set<w_string> assertedDrops;
+  std::unordered_set<w_string> assertedDefers;
+  // Whether the root settled while the subscription was parked
+  bool settledWhileParked{false};
   std::weak_ptr<watchman_client> weakClient;
 
   std::deque<LoggedResponse> lastResponses;
 
+  // How many results were merged into results that were still queued for
+  // the client, and how many were replaced by a fresh instance marker,
+  // because the client had fallen behind.
+  std::atomic<uint64_t> coalescedResponses{0};
+  std::atomic<uint64_t> freshInstanceMarkers{0};
+
+  // Derived from the query when subscribing.  Unset if the query could
+  // match any file.
+  std::optional<watchman::RelevanceFilter> relevance;
+  // How many times the query wasn't run because none of the files that
+  // changed since its last run could match it
+  std::atomic<uint64_t> irrelevantSettles{0};
+  // How many times the root settled while the subscription was parked
+  std::atomic<uint64_t> parkedSettles{0};
+
   explicit watchman_client_subscription(
       const std::shared_ptr<watchman::Root>& root,
       std::weak_ptr<watchman_client> client);
   ~watchman_client_subscription();
   void processSubscription();
 
+  // A subscription is parked while it is deferred by a state and not
+  // dropping: settles aren't evaluated until the state is left.
+  bool parked() const {
+    return assertedDrops.empty() && !assertedDefers.empty();
+  }
+  // Records a state-enter or state-leave broadcast by the root
+  void stateTransition(const w_string& state, bool entered);
+  // Reads which of the states in drop_or_defer are asserted from the root
+  void refreshAssertedStates();
+
   std::shared_ptr<watchman_user_client> lockClient();
   json_ref buildSubscriptionResults(
       const std::shared_ptr<watchman::Root>& root,
@@ -98,10 +209,14 @@ struct watchman_client_subscription
  private:
   using QueryResult = watchman::QueryResult;
 
+  // Whether any file that changed since the query last ran, up to
+  // `position`, could match it.  True if that isn't known.
+  bool anyRelevantChange(ClockPosition position) const;
+
   ClockSpec runSubscriptionRules(
       watchman_user_client* client,
       const std::shared_ptr<watchman::Root>& root);
-  void updateSubscriptionTicks(QueryResult* res);
+  void updateSubscriptionTicks(const QueryResult* res);
   void processSubscriptionImpl();
 };
 
@@ -123,10 +238,51 @@ struct watchman_user_client : public watchman_client {
       std::shared_ptr<watchman::Publisher::Subscriber>>
       unilateralSub;
 
+  // The roots that the client watched with watch-project's "async" option
+  // and whose crawl hasn't completed, by root path.  Their progress is
+  // relayed to the client as unilateral responses until it has.
+  struct CrawlWatch {
+    std::shared_ptr<watchman::Root> root;
+    std::shared_ptr<watchman::Publisher::Subscriber> progress;
+  };
+  std::unordered_map<w_string, CrawlWatch> crawlWatches;
+
+  // Once the queued responses exceed this many bytes, the results of a
+  // subscription are merged into its results that are still queued,
+  // rather than being queued behind them.
+  const size_t responseBudgetBytes;
+
+  // Results of grouped subscriptions that are held until the window of
+  // their group closes, so that a burst of changes across several roots is
+  // delivered to the client in one response.
+  struct PendingGroup {
+    std::chrono::steady_clock::time_point deadline;
+    // Subscription name and results, in the order that they were produced
+    std::vector<std::pair<w_string, json_ref>> results;
+  };
+  std::unordered_map<w_string, PendingGroup> pendingGroups;
+  // How long a group holds results after the first of them
+  const std::chrono::milliseconds groupSettle;
+
   explicit watchman_user_client(std::unique_ptr<watchman_stream>&& stm);
   ~watchman_user_client() override;
 
   bool unsubByName(const w_string& name);
+
+  // Queues the results of sub for the client, applying backpressure
+  // according to responseBudgetBytes.
+  void enqueueSubscriptionResponse(
+      watchman_client_subscription& sub,
+      json_ref&& response);
+
+  // Queues one response for each group whose window has closed, or for
+  // every group if `all` is set.
+  void flushSubscriptionGroups(bool all = false);
+
+ protected:
+  // Records responses to subscriptions in their lastResponses log
+  void responseSent(const json_ref& resp) override;
+  void writeFailed() override;
 };
 
 extern folly::Synchronized<std::unordered_set<std::shared_ptr<watchman_client>>>
@@ -67,6 +67,16 @@ std::shared_ptr<watchman::Root> resolveOrCreateRoot(
     struct watchman_client* client,
     const json_ref& args);
 
+// resolveOrCreateRoot for a client in clientMode whose owner status is
+// isOwner, without touching the client, so that it can be called off the
+// client's thread.  create is as for resolveOrCreateRoot if true, and as
+// for resolveRoot if false.
+std::shared_ptr<watchman::Root> resolveOrCreateRootAs(
+    const json_ref& args,
+    bool create,
+    bool clientMode,
+    bool isOwner);
+
 json_ref make_response();
 void add_root_warnings_to_response(
     json_ref& response,
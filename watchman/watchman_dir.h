@@ -6,33 +6,66 @@
  */
 
 #pragma once
-#include <unordered_map>
+#include <memory>
+#include "watchman/ChildIndex.h"
 #include "watchman/watchman_string.h"
 
 struct watchman_file;
 
+namespace watchman {
+class NodeArena;
+}
+
 struct watchman_dir {
-  /* the name of this dir, relative to its parent */
+  /* the name of this dir, relative to its parent.  Interned by the view's
+   * NameTable, except for the root dir, which holds the root path. */
   w_string name;
   /* the parent dir */
   watchman_dir* parent;
 
+  // The number of file nodes in this dir and every dir below it, including
+  // those of deleted files that have yet to age out.  The ViewDatabase
+  // counts each file as it creates it, and each file uncounts itself when
+  // it is destroyed.  Declared before files so that it outlives them.
+  uint32_t subtreeFiles{0};
+
   /* files contained in this dir (keyed by file->name) */
   struct Deleter {
     void operator()(watchman_file*) const;
   };
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_file, Deleter>>
-      files;
+  watchman::ChildIndex<std::unique_ptr<watchman_file, Deleter>> files;
 
   /* child dirs contained in this dir (keyed by dir->name) */
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_dir>> dirs;
+  struct DirDeleter {
+    void operator()(watchman_dir*) const;
+  };
+  using Ptr = std::unique_ptr<watchman_dir, DirDeleter>;
+  watchman::ChildIndex<Ptr> dirs;
 
   // If we think this dir was deleted, we'll avoid recursing
   // to its children when processing deletes.
   bool last_check_existed{true};
 
+  // The mtime of this dir when its entries were last all read by the
+  // crawler with recrawl_trust_readdir enabled, or zero if unknown.
+  struct timespec crawled_mtime {
+    0, 0
+  };
+
+  // Whether the view's DirTreeHashes holds the digest of this dir, which
+  // implies that it holds those of every dir below it.  Cleared, along with
+  // that of each parent, when a file in this dir changes.
+  bool treeHashValid{false};
+
   watchman_dir(w_string name, watchman_dir* parent);
 
+  /**
+   * Allocates a new dir node from arena.  The node returns its storage to
+   * the arena when it is destroyed.
+   */
+  static Ptr
+  make(watchman::NodeArena& arena, w_string name, watchman_dir* parent);
+
   watchman_dir* getChildDir(w_string_piece name) const;
 
   /**
@@ -11,7 +11,16 @@
 #include "watchman/fs/FileInformation.h"
 #include "watchman/watchman_dir.h"
 
+namespace watchman {
+class FileMetadataTable;
+}
+
 struct watchman_file {
+  /* the name of this file, interned by the view's NameTable */
+  w_string name;
+  /* name, lowercased, for case insensitive matching; the same string as
+   * name when name is already lowercase */
+  w_string lower_name;
   /* the parent dir */
   watchman_dir* parent;
 
@@ -20,6 +29,18 @@ struct watchman_file {
    * previous file node, or the head of the list. */
   struct watchman_file **prev, *next;
 
+  /* linkage to the other files whose names have the same suffix, in the
+   * same style as prev and next.  Files without a suffix are not linked. */
+  struct watchman_file **suffix_prev, *suffix_next;
+
+  /* linkage to the other files whose names are the same when lowercased, in
+   * the same style as prev and next. */
+  struct watchman_file **name_prev, *name_next;
+
+  /* linkage to the other files of the same type, in the same style as
+   * prev and next.  Only dirs and symlinks are linked. */
+  struct watchman_file **type_prev, *type_next;
+
   /* the time we last observed a change to this file */
   w_clock_t otime;
   /* the time we first observed this file OR the time
@@ -34,23 +55,36 @@ struct watchman_file {
 
   /* cache stat results so we can tell if an entry
    * changed */
-  watchman::FileInformation stat;
+  watchman::CompactFileInformation stat;
+
+  /* the table that holds a dense copy of this file's metadata, and the id
+   * of its row there; null unless view_metadata_columns is enabled */
+  watchman::FileMetadataTable* metadata_table;
+  uint32_t metadata_id;
 
   inline w_string_piece getName() const {
-    uint32_t len;
-    memcpy(&len, this + 1, 4);
-    return w_string_piece(reinterpret_cast<const char*>(this + 1) + 4, len);
+    return name;
   }
 
   void removeFromFileList();
+  void removeFromSuffixList();
+  void removeFromNameList();
+  void removeFromTypeList();
 
   watchman_file() = delete;
   watchman_file(const watchman_file&) = delete;
   watchman_file& operator=(const watchman_file&) = delete;
   ~watchman_file();
 
+  /**
+   * Allocates a new file node from arena.  name and lower_name are normally
+   * the interned copies from the view's NameTable, so that files with the
+   * same name share their storage.
+   */
   static std::unique_ptr<watchman_file, watchman_dir::Deleter> make(
+      watchman::NodeArena& arena,
       const w_string& name,
+      const w_string& lower_name,
       watchman_dir* parent);
 };
 
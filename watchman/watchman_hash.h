@@ -8,9 +8,16 @@
 #ifndef WATCHMAN_HASH_H
 #define WATCHMAN_HASH_H
 
-/* Bob Jenkins' lookup3.c hash function */
+/* Bob Jenkins' lookup3.c hash function.  Its values are stable across
+ * builds and platforms, so use it for anything that is persisted. */
 uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval);
 
+/* Wang Yi's wyhash, folded to 32 bits.  This is considerably faster than
+ * lookup3 for path-length keys and backs w_string_hval and
+ * w_string_piece::hashValue, but its values are only meaningful within the
+ * running process. */
+uint32_t w_hash_string(const void* key, size_t length);
+
 namespace watchman {
 // This is the Hash128to64 function from Google's cityhash (available
 // under the MIT License).  We use it to reduce multiple 64 bit hashes
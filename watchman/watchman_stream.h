@@ -30,11 +30,28 @@ class watchman_stream {
   virtual ~watchman_stream() = default;
   virtual int read(void* buf, int size) = 0;
   virtual int write(const void* buf, int size) = 0;
+  // Whether writeWithDescriptor() can pass descriptors over this stream
+  virtual bool canPassDescriptors() const {
+    return false;
+  }
+  // Writes all of buf along with a descriptor that the peer receives with
+  // its first bytes.  Returns false if the write failed.
+  virtual bool writeWithDescriptor(
+      const void* /*buf*/,
+      int /*size*/,
+      const watchman::FileDescriptor& /*descriptor*/) {
+    return false;
+  }
   virtual w_evt_t getEvents() = 0;
   virtual void setNonBlock(bool nonBlock) = 0;
   virtual bool rewind() = 0;
   virtual bool shutdown() = 0;
   virtual bool peerIsOwner() = 0;
+  // Whether the peer has closed its end of the stream, and so won't read
+  // anything more that is written to it.  Doesn't block.
+  virtual bool peerHasHungUp() {
+    return false;
+  }
   virtual pid_t getPeerProcessID() const = 0;
   virtual const watchman::FileDescriptor& getFileDescriptor() const = 0;
 };
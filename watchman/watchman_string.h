@@ -55,6 +55,11 @@ struct watchman_string {
 
 uint32_t w_string_compute_hval(w_string_t* str);
 
+// Accounts for the storage of a newly allocated string in the Strings
+// MemoryCategory.  Call it once len has been set; w_string_delref accounts
+// for the release.
+void w_string_record_allocation(const w_string_t* str);
+
 static inline uint32_t w_string_hval(w_string_t* str) {
   if (str->hval_computed) {
     return str->_hval;
@@ -358,6 +363,7 @@ class w_string {
 
       mut_buf[s->len] = 0;
     }
+    w_string_record_allocation(s);
 
     return w_string(s, false);
   }
@@ -137,9 +137,6 @@ size_t backtrace_from_exception(
 #include <poll.h>
 #include <sys/wait.h>
 #endif
-#ifdef HAVE_PCRE_H
-#include <pcre.h> // @manual
-#endif
 #ifdef HAVE_EXECINFO_H
 #include <execinfo.h>
 #endif
@@ -64,6 +64,7 @@ w_string::w_string(const WCHAR* wpath, size_t pathlen) {
 
   str_->refcnt = 1;
   str_->len = len;
+  w_string_record_allocation(str_);
   auto buf = const_cast<char*>(str_->buf);
   str_->type = W_STRING_UNICODE;
 